@@ -0,0 +1,72 @@
+#ifndef REDREAM_ATOMIC_H
+#define REDREAM_ATOMIC_H
+
+#include <stdint.h>
+
+/*
+ * atomic operations on 32-bit words, plus adds on 64-bit words. loads have
+ * acquire and stores release semantics, read-modify-write operations are
+ * sequentially consistent and return the value prior to being modified
+ */
+#if COMPILER_MSVC
+#include <intrin.h>
+
+static inline uint32_t atomic_load32(volatile uint32_t *ptr) {
+  uint32_t value = *ptr;
+  _ReadWriteBarrier();
+  return value;
+}
+
+static inline void atomic_store32(volatile uint32_t *ptr, uint32_t value) {
+  _ReadWriteBarrier();
+  *ptr = value;
+}
+
+static inline int atomic_cas32(volatile uint32_t *ptr, uint32_t expected,
+                               uint32_t desired) {
+  return (uint32_t)_InterlockedCompareExchange(
+             (volatile long *)ptr, (long)desired, (long)expected) == expected;
+}
+
+static inline uint32_t atomic_exchange32(volatile uint32_t *ptr,
+                                         uint32_t value) {
+  return (uint32_t)_InterlockedExchange((volatile long *)ptr, (long)value);
+}
+
+static inline uint32_t atomic_add32(volatile uint32_t *ptr, uint32_t value) {
+  return (uint32_t)_InterlockedExchangeAdd((volatile long *)ptr, (long)value);
+}
+
+static inline int64_t atomic_add64(volatile int64_t *ptr, int64_t value) {
+  return _InterlockedExchangeAdd64((volatile __int64 *)ptr, value);
+}
+#else
+static inline uint32_t atomic_load32(volatile uint32_t *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store32(volatile uint32_t *ptr, uint32_t value) {
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline int atomic_cas32(volatile uint32_t *ptr, uint32_t expected,
+                               uint32_t desired) {
+  return __atomic_compare_exchange_n(ptr, &expected, desired, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_exchange32(volatile uint32_t *ptr,
+                                         uint32_t value) {
+  return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t atomic_add32(volatile uint32_t *ptr, uint32_t value) {
+  return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int64_t atomic_add64(volatile int64_t *ptr, int64_t value) {
+  return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+#endif
+
+#endif
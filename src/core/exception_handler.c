@@ -1,65 +1,169 @@
 #include "core/exception_handler.h"
+#include "core/atomic.h"
 #include "core/core.h"
-#include "core/list.h"
 
-#define MAX_EXCEPTION_HANDLERS 32
+/* each emulator instance adds a handler for its guest memory and for each of
+   its jits, so this bounds the number of instances per process */
+#define MAX_EXCEPTION_HANDLERS 256
 
+#define MAX_EXCEPTION_RANGES 4
+
+struct exception_range {
+  enum exception_range_type type;
+  volatile uintptr_t begin;
+  volatile uintptr_t end;
+};
+
+/* handlers are added and removed by the threads creating and destroying each
+   instance, while any thread may fault and run them concurrently. adding and
+   removing handlers is serialized by a spin lock, but handling takes no lock,
+   as the faulting thread may be interrupted while holding it. instead, each
+   slot counts the threads currently running it, and removing a handler waits
+   for its slot to drain before it can be reused */
 struct exception_handler {
   void *data;
   exception_handler_cb cb;
-  struct list_node it;
+  volatile uint32_t live;
+  volatile uint32_t busy;
+
+  /* ranges are published by incrementing num_ranges once they're written, and
+     may only grow while live, so a fault within them is never missed */
+  struct exception_range ranges[MAX_EXCEPTION_RANGES];
+  volatile uint32_t num_ranges;
 };
 
 static struct exception_handler handlers[MAX_EXCEPTION_HANDLERS];
-static struct list live_handlers;
-static struct list free_handlers;
+static volatile uint32_t num_handlers;
+/* one past the last slot ever used, bounding the slots checked on a fault */
+static volatile uint32_t num_slots;
+static volatile uint32_t handlers_lock;
 
-static void exception_handler_install() {
-  for (int i = 0; i < MAX_EXCEPTION_HANDLERS; i++) {
-    struct exception_handler *handler = &handlers[i];
-    list_add(&free_handlers, &handler->it);
+static void exception_handler_lock() {
+  while (!atomic_cas32(&handlers_lock, 0, 1)) {
   }
-
-  int res = exception_handler_install_platform();
-  CHECK(res);
 }
 
-static void exception_handler_uninstall() {
-  exception_handler_uninstall_platform();
+static void exception_handler_unlock() {
+  atomic_store32(&handlers_lock, 0);
 }
 
 struct exception_handler *exception_handler_add(void *data,
                                                 exception_handler_cb cb) {
-  if (list_empty(&live_handlers)) {
-    exception_handler_install();
+  exception_handler_lock();
+
+  if (!num_handlers) {
+    int res = exception_handler_install_platform();
+    CHECK(res);
   }
 
-  /* remove from free list */
-  struct exception_handler *handler =
-      list_first_entry(&free_handlers, struct exception_handler, it);
+  struct exception_handler *handler = NULL;
+
+  for (int i = 0; i < MAX_EXCEPTION_HANDLERS; i++) {
+    if (!handlers[i].live) {
+      handler = &handlers[i];
+      break;
+    }
+  }
   CHECK_NOTNULL(handler);
-  list_remove(&free_handlers, &handler->it);
 
-  /* add to live list */
+  /* the slot isn't visible to handling threads until it's marked live */
   handler->data = data;
   handler->cb = cb;
-  list_add(&live_handlers, &handler->it);
+  handler->num_ranges = 0;
+  atomic_store32(&handler->live, 1);
+  num_handlers++;
+
+  uint32_t slot = (uint32_t)(handler - handlers);
+  if (slot >= num_slots) {
+    atomic_store32(&num_slots, slot + 1);
+  }
+
+  exception_handler_unlock();
 
   return handler;
 }
 
 void exception_handler_remove(struct exception_handler *handler) {
-  list_remove(&live_handlers, &handler->it);
-  list_add(&free_handlers, &handler->it);
+  exception_handler_lock();
+
+  atomic_store32(&handler->live, 0);
+
+  /* wait on any threads which saw the handler as live before it was removed */
+  while (atomic_load32(&handler->busy)) {
+  }
+
+  if (!--num_handlers) {
+    exception_handler_uninstall_platform();
+  }
+
+  exception_handler_unlock();
+}
 
-  if (list_empty(&live_handlers)) {
-    exception_handler_uninstall();
+int exception_handler_add_range(struct exception_handler *handler,
+                                enum exception_range_type type,
+                                uintptr_t begin, uintptr_t end) {
+  int index = (int)handler->num_ranges;
+  CHECK_LT(index, MAX_EXCEPTION_RANGES);
+
+  struct exception_range *range = &handler->ranges[index];
+  range->type = type;
+  range->begin = begin;
+  range->end = end;
+  atomic_store32(&handler->num_ranges, (uint32_t)index + 1);
+
+  return index;
+}
+
+void exception_handler_update_range(struct exception_handler *handler,
+                                    int index, uintptr_t begin,
+                                    uintptr_t end) {
+  CHECK_LT(index, (int)handler->num_ranges);
+
+  struct exception_range *range = &handler->ranges[index];
+  range->begin = begin;
+  range->end = end;
+}
+
+static int exception_handler_matches(struct exception_handler *handler,
+                                     struct exception_state *ex) {
+  uint32_t num_ranges = atomic_load32(&handler->num_ranges);
+
+  /* handlers without any ranges see every exception */
+  if (!num_ranges) {
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < num_ranges; i++) {
+    struct exception_range *range = &handler->ranges[i];
+    uintptr_t addr = range->type == EX_RANGE_PC ? ex->pc : ex->fault_addr;
+
+    if (addr >= range->begin && addr < range->end) {
+      return 1;
+    }
   }
+
+  return 0;
 }
 
 int exception_handler_handle(struct exception_state *ex) {
-  list_for_each_entry(handler, &live_handlers, struct exception_handler, it) {
-    if (handler->cb(handler->data, ex)) {
+  uint32_t n = atomic_load32(&num_slots);
+
+  for (uint32_t i = 0; i < n; i++) {
+    struct exception_handler *handler = &handlers[i];
+
+    /* mark the slot busy before checking it's live, so a concurrent remove
+       either prevents it from being run, or waits for it to finish */
+    atomic_add32(&handler->busy, 1);
+
+    int handled = 0;
+    if (atomic_load32(&handler->live) &&
+        exception_handler_matches(handler, ex)) {
+      handled = handler->cb(handler->data, ex);
+    }
+
+    atomic_add32(&handler->busy, (uint32_t)-1);
+
+    if (handled) {
       return 1;
     }
   }
@@ -13,6 +13,12 @@ enum exception_type {
   EX_INVALID_INSTRUCTION,
 };
 
+/* which address of an exception a handler's range is matched against */
+enum exception_range_type {
+  EX_RANGE_PC,
+  EX_RANGE_FAULT,
+};
+
 struct thread_state {
 #if ARCH_A64
   union {
@@ -52,6 +58,18 @@ void exception_handler_uninstall_platform();
 struct exception_handler *exception_handler_add(void *data,
                                                 exception_handler_cb cb);
 void exception_handler_remove(struct exception_handler *handler);
+
+/* handlers may claim the ranges of host addresses their exceptions originate
+   from, e.g. a code buffer for the pc or watched pages for the fault address.
+   once a handler has claimed any, it's only ran for exceptions matching one
+   of them, sparing the rest from its own lookups. returns the range's index
+   for it to later be resized with exception_handler_update_range */
+int exception_handler_add_range(struct exception_handler *handler,
+                                enum exception_range_type type,
+                                uintptr_t begin, uintptr_t end);
+void exception_handler_update_range(struct exception_handler *handler,
+                                    int index, uintptr_t begin,
+                                    uintptr_t end);
 int exception_handler_handle(struct exception_state *ex);
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef FILES_H
 #define FILES_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 #if PLATFORM_ANDROID || PLATFORM_DARWIN || PLATFORM_LINUX
@@ -44,4 +45,77 @@ int fs_isdir(const char *path);
 int fs_isfile(const char *path);
 int fs_mkdir(const char *path);
 
+/* gets the size and last modification time, in seconds, of a file */
+int fs_stat(const char *path, int64_t *size, int64_t *mtime);
+
+/* flush the file's buffered writes through to storage */
+int fs_sync(FILE *fp);
+
+/*
+ * unbuffered files, read and written at explicit offsets so they may be
+ * accessed from multiple threads at once
+ */
+struct fs_file;
+
+/* opens an existing file, for writing as well as reading when write is set */
+struct fs_file *fs_open(const char *path, int write);
+void fs_close(struct fs_file *file);
+
+/* these transfer the full size unless an error occurs, or the end of the file
+   is reached when reading. they return the number of bytes transferred, or -1
+   on error */
+int64_t fs_pread(struct fs_file *file, void *dst, int64_t size,
+                 int64_t offset);
+int64_t fs_pwrite(struct fs_file *file, const void *src, int64_t size,
+                  int64_t offset);
+int fs_fsync(struct fs_file *file);
+
+#if PLATFORM_LINUX
+int fs_fileno(struct fs_file *file);
+#endif
+
+/*
+ * asynchronous i/o
+ *
+ * requests are queued by the thread owning the queue, which has their
+ * callbacks ran when it polls it. a queue may change owners, e.g. when guarded
+ * by a mutex, but must only be used by one thread at a time
+ *
+ * on linux, the requests are handed to the kernel in batches through io_uring.
+ * elsewhere, or when io_uring isn't available, they're serviced by a pool of
+ * worker threads
+ *
+ * requests may complete in any order, except for fsyncs which wait for those
+ * queued before them to complete, and hold back those queued after them
+ */
+struct fs_aio;
+
+/* res is the number of bytes transferred, short only when a read reaches the
+   end of the file, or -1 on error. for fsyncs it's 0 on success */
+typedef void (*fs_aio_cb)(void *data, int64_t res);
+
+struct fs_aio *fs_aio_create(int depth);
+/* waits for any outstanding requests to complete, running their callbacks */
+void fs_aio_destroy(struct fs_aio *aio);
+
+const char *fs_aio_backend(struct fs_aio *aio);
+
+/* when depth requests are already outstanding, these poll the queue until one
+   completes before queuing another. the buffers must stay valid until the
+   request's callback has been ran */
+void fs_aio_read(struct fs_aio *aio, struct fs_file *file, int64_t offset,
+                 void *dst, int size, fs_aio_cb cb, void *data);
+void fs_aio_write(struct fs_aio *aio, struct fs_file *file, int64_t offset,
+                  const void *src, int size, fs_aio_cb cb, void *data);
+void fs_aio_fsync(struct fs_aio *aio, struct fs_file *file, fs_aio_cb cb,
+                  void *data);
+
+/* submits any newly queued requests and runs the callbacks of those which
+   have completed, returning how many were ran. when wait is set and none have
+   completed, blocks until one does, unless none are outstanding */
+int fs_aio_poll(struct fs_aio *aio, int wait);
+
+/* polls until every outstanding request has completed */
+void fs_aio_drain(struct fs_aio *aio);
+
 #endif
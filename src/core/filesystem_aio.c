@@ -0,0 +1,523 @@
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/list.h"
+#include "core/thread.h"
+
+#if PLATFORM_LINUX
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#define AIO_MAX_WORKERS 4
+
+enum {
+  AIO_READ,
+  AIO_WRITE,
+  AIO_FSYNC,
+};
+
+struct aio_req {
+  int op;
+  struct fs_file *file;
+  int64_t offset;
+  uint8_t *buf;
+  int size;
+  /* bytes transferred so far, io_uring may complete a request partially */
+  int done;
+  int64_t res;
+  fs_aio_cb cb;
+  void *data;
+#if PLATFORM_LINUX
+  struct iovec iov;
+#endif
+  struct list_node it;
+};
+
+#if PLATFORM_LINUX
+struct aio_ring {
+  int fd;
+
+  /* submission queue, the tail is only ever written by the owning thread */
+  void *sq_ptr;
+  size_t sq_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  int to_submit;
+
+  /* completion queue, the head is only ever written by the owning thread */
+  void *cq_ptr;
+  size_t cq_size;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+#endif
+
+struct fs_aio {
+  struct aio_req *reqs;
+  int depth;
+  int outstanding;
+
+  /* requests not currently outstanding, only touched by the owning thread */
+  struct list free_reqs;
+
+#if PLATFORM_LINUX
+  int use_ring;
+  struct aio_ring ring;
+#endif
+
+  /* thread pool, used when io_uring isn't */
+  mutex_t mutex;
+  cond_t work_cond;
+  cond_t done_cond;
+  thread_t workers[AIO_MAX_WORKERS];
+  int num_workers;
+  struct list queued;
+  struct list completed;
+  int running;
+  /* set while an fsync is running, holding back everything queued after it */
+  int barrier;
+  int shutdown;
+};
+
+static int64_t aio_perform(struct aio_req *req) {
+  switch (req->op) {
+    case AIO_READ:
+      return fs_pread(req->file, req->buf, req->size, req->offset);
+    case AIO_WRITE:
+      return fs_pwrite(req->file, req->buf, req->size, req->offset);
+    case AIO_FSYNC:
+      return fs_fsync(req->file) ? 0 : -1;
+    default:
+      LOG_FATAL("aio_perform unexpected op %d", req->op);
+  }
+}
+
+/*
+ * thread pool backend
+ */
+static void *aio_worker_thread(void *data) {
+  struct fs_aio *aio = data;
+
+  mutex_lock(aio->mutex);
+
+  while (!aio->shutdown) {
+    struct aio_req *req = list_first_entry(&aio->queued, struct aio_req, it);
+
+    /* fsyncs wait on the requests queued before them, and hold back those
+       queued after them */
+    if (!req || aio->barrier || (req->op == AIO_FSYNC && aio->running)) {
+      cond_wait(aio->work_cond, aio->mutex);
+      continue;
+    }
+
+    list_remove(&aio->queued, &req->it);
+    aio->running++;
+    aio->barrier = req->op == AIO_FSYNC;
+
+    /* there's no broadcast, pass the wakeup on to another worker */
+    if (!list_empty(&aio->queued)) {
+      cond_signal(aio->work_cond);
+    }
+
+    mutex_unlock(aio->mutex);
+
+    req->res = aio_perform(req);
+
+    mutex_lock(aio->mutex);
+
+    aio->running--;
+    aio->barrier = 0;
+    list_add(&aio->completed, &req->it);
+    cond_signal(aio->done_cond);
+
+    if (!list_empty(&aio->queued)) {
+      cond_signal(aio->work_cond);
+    }
+  }
+
+  /* wake the next worker to exit as well */
+  cond_signal(aio->work_cond);
+
+  mutex_unlock(aio->mutex);
+
+  return NULL;
+}
+
+static void aio_pool_queue(struct fs_aio *aio, struct aio_req *req) {
+  mutex_lock(aio->mutex);
+  list_add(&aio->queued, &req->it);
+  cond_signal(aio->work_cond);
+  mutex_unlock(aio->mutex);
+}
+
+static int aio_pool_poll(struct fs_aio *aio, int wait) {
+  struct list completed;
+
+  mutex_lock(aio->mutex);
+
+  while (wait && list_empty(&aio->completed)) {
+    cond_wait(aio->done_cond, aio->mutex);
+  }
+
+  completed = aio->completed;
+  list_clear(&aio->completed);
+
+  mutex_unlock(aio->mutex);
+
+  /* run the callbacks with the lock released, they may queue more requests */
+  int num = 0;
+
+  list_for_each_entry_safe(req, &completed, struct aio_req, it) {
+    list_remove(&completed, &req->it);
+    list_add(&aio->free_reqs, &req->it);
+    aio->outstanding--;
+    num++;
+
+    req->cb(req->data, req->res);
+  }
+
+  return num;
+}
+
+static void aio_pool_destroy(struct fs_aio *aio) {
+  mutex_lock(aio->mutex);
+  aio->shutdown = 1;
+  cond_signal(aio->work_cond);
+  mutex_unlock(aio->mutex);
+
+  for (int i = 0; i < aio->num_workers; i++) {
+    void *result;
+    thread_join(aio->workers[i], &result);
+  }
+
+  cond_destroy(aio->done_cond);
+  cond_destroy(aio->work_cond);
+  mutex_destroy(aio->mutex);
+}
+
+static void aio_pool_init(struct fs_aio *aio) {
+  aio->mutex = mutex_create();
+  aio->work_cond = cond_create();
+  aio->done_cond = cond_create();
+  aio->num_workers = MIN(aio->depth, AIO_MAX_WORKERS);
+
+  for (int i = 0; i < aio->num_workers; i++) {
+    aio->workers[i] = thread_create(&aio_worker_thread, "aio", aio);
+    CHECK_NOTNULL(aio->workers[i]);
+  }
+}
+
+/*
+ * io_uring backend, driven through the raw syscalls as liburing isn't a
+ * dependency
+ */
+#if PLATFORM_LINUX
+static int aio_ring_enter(struct aio_ring *ring, int to_submit,
+                          int min_complete) {
+  unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+  for (;;) {
+    long res = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                       flags, NULL, 0);
+
+    if (res >= 0 || errno != EINTR) {
+      return (int)res;
+    }
+  }
+}
+
+static void aio_ring_prep(struct fs_aio *aio, struct aio_req *req) {
+  struct aio_ring *ring = &aio->ring;
+
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = fs_fileno(req->file);
+  sqe->user_data = (uint64_t)(req - aio->reqs);
+
+  if (req->op == AIO_FSYNC) {
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->flags = IOSQE_IO_DRAIN;
+  } else {
+    /* the vectored ops are used as they're supported by older kernels */
+    req->iov.iov_base = req->buf + req->done;
+    req->iov.iov_len = (size_t)(req->size - req->done);
+
+    sqe->opcode = req->op == AIO_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->off = (uint64_t)(req->offset + req->done);
+    sqe->addr = (uint64_t)(uintptr_t)&req->iov;
+    sqe->len = 1;
+  }
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+}
+
+static int aio_ring_poll(struct fs_aio *aio, int wait) {
+  struct aio_ring *ring = &aio->ring;
+  int num = 0;
+
+  do {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    /* submit what's been queued since the last poll, waiting on a completion
+       at the same time when there are none to reap */
+    if (ring->to_submit || (wait && head == tail)) {
+      int res = aio_ring_enter(ring, ring->to_submit, wait && head == tail);
+      CHECK_GE(res, 0, "aio_ring_poll io_uring_enter failed errno=%d", errno);
+      ring->to_submit -= MIN(res, ring->to_submit);
+
+      tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    /* copy out the completions first, as the callbacks may queue more
+       requests and overwrite the slots being reaped */
+    struct list completed = {0};
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      struct aio_req *req = &aio->reqs[cqe->user_data];
+      int res = cqe->res;
+
+      if (res < 0) {
+        req->res = -1;
+      } else if (req->op == AIO_FSYNC) {
+        req->res = 0;
+      } else {
+        req->done += res;
+        req->res = req->done;
+
+        /* resubmit the remainder of partial transfers, reads stopping short
+           only at the end of the file */
+        if (res && req->done < req->size) {
+          aio_ring_prep(aio, req);
+          continue;
+        }
+      }
+
+      list_add(&completed, &req->it);
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    list_for_each_entry_safe(req, &completed, struct aio_req, it) {
+      list_remove(&completed, &req->it);
+      list_add(&aio->free_reqs, &req->it);
+      aio->outstanding--;
+      num++;
+
+      req->cb(req->data, req->res);
+    }
+  } while (wait && !num && aio->outstanding);
+
+  return num;
+}
+
+static void aio_ring_destroy(struct fs_aio *aio) {
+  struct aio_ring *ring = &aio->ring;
+
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ptr != ring->sq_ptr) {
+    munmap(ring->cq_ptr, ring->cq_size);
+  }
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->fd);
+}
+
+static int aio_ring_init(struct fs_aio *aio) {
+  struct aio_ring *ring = &aio->ring;
+  struct io_uring_params p = {0};
+
+  /* this fails on kernels prior to 5.1, as well as where io_uring has been
+     disabled, e.g. by seccomp filters */
+  ring->fd = (int)syscall(__NR_io_uring_setup, aio->depth, &p);
+  if (ring->fd < 0) {
+    return 0;
+  }
+
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  /* newer kernels map both rings with a single mapping */
+  int single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    ring->sq_size = ring->cq_size = MAX(ring->sq_size, ring->cq_size);
+  }
+
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {
+    close(ring->fd);
+    return 0;
+  }
+
+  if (single_mmap) {
+    ring->cq_ptr = ring->sq_ptr;
+  } else {
+    ring->cq_ptr =
+        mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {
+      munmap(ring->sq_ptr, ring->sq_size);
+      close(ring->fd);
+      return 0;
+    }
+  }
+
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    if (ring->cq_ptr != ring->sq_ptr) {
+      munmap(ring->cq_ptr, ring->cq_size);
+    }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    return 0;
+  }
+
+  uint8_t *sq = ring->sq_ptr;
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+  uint8_t *cq = ring->cq_ptr;
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  return 1;
+}
+#endif
+
+/*
+ * api
+ */
+static void aio_queue(struct fs_aio *aio, int op, struct fs_file *file,
+                      int64_t offset, void *buf, int size, fs_aio_cb cb,
+                      void *data) {
+  while (aio->outstanding >= aio->depth) {
+    fs_aio_poll(aio, 1);
+  }
+
+  struct aio_req *req = list_first_entry(&aio->free_reqs, struct aio_req, it);
+  CHECK_NOTNULL(req);
+  list_remove(&aio->free_reqs, &req->it);
+  aio->outstanding++;
+
+  req->op = op;
+  req->file = file;
+  req->offset = offset;
+  req->buf = buf;
+  req->size = size;
+  req->done = 0;
+  req->res = 0;
+  req->cb = cb;
+  req->data = data;
+
+#if PLATFORM_LINUX
+  if (aio->use_ring) {
+    aio_ring_prep(aio, req);
+    return;
+  }
+#endif
+
+  aio_pool_queue(aio, req);
+}
+
+void fs_aio_drain(struct fs_aio *aio) {
+  while (aio->outstanding) {
+    fs_aio_poll(aio, 1);
+  }
+}
+
+int fs_aio_poll(struct fs_aio *aio, int wait) {
+  wait = wait && aio->outstanding;
+
+#if PLATFORM_LINUX
+  if (aio->use_ring) {
+    return aio_ring_poll(aio, wait);
+  }
+#endif
+
+  return aio_pool_poll(aio, wait);
+}
+
+void fs_aio_fsync(struct fs_aio *aio, struct fs_file *file, fs_aio_cb cb,
+                  void *data) {
+  aio_queue(aio, AIO_FSYNC, file, 0, NULL, 0, cb, data);
+}
+
+void fs_aio_write(struct fs_aio *aio, struct fs_file *file, int64_t offset,
+                  const void *src, int size, fs_aio_cb cb, void *data) {
+  aio_queue(aio, AIO_WRITE, file, offset, (void *)src, size, cb, data);
+}
+
+void fs_aio_read(struct fs_aio *aio, struct fs_file *file, int64_t offset,
+                 void *dst, int size, fs_aio_cb cb, void *data) {
+  aio_queue(aio, AIO_READ, file, offset, dst, size, cb, data);
+}
+
+const char *fs_aio_backend(struct fs_aio *aio) {
+#if PLATFORM_LINUX
+  if (aio->use_ring) {
+    return "io_uring";
+  }
+#endif
+
+  return "threads";
+}
+
+void fs_aio_destroy(struct fs_aio *aio) {
+  fs_aio_drain(aio);
+
+#if PLATFORM_LINUX
+  if (aio->use_ring) {
+    aio_ring_destroy(aio);
+  } else
+#endif
+  {
+    aio_pool_destroy(aio);
+  }
+
+  free(aio->reqs);
+  free(aio);
+}
+
+struct fs_aio *fs_aio_create(int depth) {
+  struct fs_aio *aio = calloc(1, sizeof(struct fs_aio));
+
+  aio->depth = depth;
+  aio->reqs = calloc(depth, sizeof(struct aio_req));
+
+  for (int i = 0; i < depth; i++) {
+    list_add(&aio->free_reqs, &aio->reqs[i].it);
+  }
+
+#if PLATFORM_LINUX
+  aio->use_ring = aio_ring_init(aio);
+  if (aio->use_ring) {
+    return aio;
+  }
+#endif
+
+  aio_pool_init(aio);
+
+  return aio;
+}
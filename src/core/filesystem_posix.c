@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,88 @@ int fs_mkdir(const char *path) {
   return res == 0 || errno == EEXIST;
 }
 
+int fs_sync(FILE *fp) {
+  return !fflush(fp) && !fsync(fileno(fp));
+}
+
+struct fs_file {
+  int fd;
+};
+
+struct fs_file *fs_open(const char *path, int write) {
+  int fd = open(path, (write ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct fs_file *file = calloc(1, sizeof(struct fs_file));
+  file->fd = fd;
+  return file;
+}
+
+void fs_close(struct fs_file *file) {
+  close(file->fd);
+  free(file);
+}
+
+int64_t fs_pread(struct fs_file *file, void *dst, int64_t size,
+                 int64_t offset) {
+  uint8_t *ptr = dst;
+  int64_t total = 0;
+
+  while (total < size) {
+    ssize_t n = pread(file->fd, ptr + total, (size_t)(size - total),
+                      (off_t)(offset + total));
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    if (!n) {
+      break;
+    }
+
+    total += n;
+  }
+
+  return total;
+}
+
+int64_t fs_pwrite(struct fs_file *file, const void *src, int64_t size,
+                  int64_t offset) {
+  const uint8_t *ptr = src;
+  int64_t total = 0;
+
+  while (total < size) {
+    ssize_t n = pwrite(file->fd, ptr + total, (size_t)(size - total),
+                       (off_t)(offset + total));
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    total += n;
+  }
+
+  return total;
+}
+
+int fs_fsync(struct fs_file *file) {
+  return !fsync(file->fd);
+}
+
+#if PLATFORM_LINUX
+int fs_fileno(struct fs_file *file) {
+  return file->fd;
+}
+#endif
+
 int fs_isfile(const char *path) {
   struct stat buffer;
   if (stat(path, &buffer) != 0) {
@@ -33,6 +116,16 @@ int fs_exists(const char *path) {
   return stat(path, &buffer) == 0;
 }
 
+int fs_stat(const char *path, int64_t *size, int64_t *mtime) {
+  struct stat buffer;
+  if (stat(path, &buffer) != 0) {
+    return 0;
+  }
+  *size = (int64_t)buffer.st_size;
+  *mtime = (int64_t)buffer.st_mtime;
+  return 1;
+}
+
 void fs_realpath(const char *path, char *resolved, size_t size) {
   char tmp[PATH_MAX];
   if (realpath(path, tmp)) {
@@ -1,10 +1,13 @@
 #include <Windows.h>
 #include <errno.h>
+#include <io.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <userenv.h>
 #include "core/filesystem.h"
+#include "core/math.h"
 
 int fs_mkdir(const char *path) {
   int res = _mkdir(path);
@@ -27,11 +30,107 @@ int fs_isdir(const char *path) {
   return (buffer.st_mode & S_IFDIR) == S_IFDIR;
 }
 
+int fs_sync(FILE *fp) {
+  return !fflush(fp) && !_commit(_fileno(fp));
+}
+
+struct fs_file {
+  HANDLE handle;
+};
+
+struct fs_file *fs_open(const char *path, int write) {
+  DWORD access = GENERIC_READ | (write ? GENERIC_WRITE : 0);
+  HANDLE handle =
+      CreateFileA(path, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  struct fs_file *file = calloc(1, sizeof(struct fs_file));
+  file->handle = handle;
+  return file;
+}
+
+void fs_close(struct fs_file *file) {
+  CloseHandle(file->handle);
+  free(file);
+}
+
+int64_t fs_pread(struct fs_file *file, void *dst, int64_t size,
+                 int64_t offset) {
+  uint8_t *ptr = dst;
+  int64_t total = 0;
+
+  while (total < size) {
+    /* the offset passed through the overlapped structure is used even though
+       the handle isn't opened for overlapped i/o */
+    OVERLAPPED ov = {0};
+    ov.Offset = (DWORD)(offset + total);
+    ov.OffsetHigh = (DWORD)((offset + total) >> 32);
+
+    DWORD chunk = (DWORD)MIN(size - total, 0x40000000);
+    DWORD n = 0;
+
+    if (!ReadFile(file->handle, ptr + total, chunk, &n, &ov)) {
+      if (GetLastError() == ERROR_HANDLE_EOF) {
+        break;
+      }
+      return -1;
+    }
+
+    if (!n) {
+      break;
+    }
+
+    total += n;
+  }
+
+  return total;
+}
+
+int64_t fs_pwrite(struct fs_file *file, const void *src, int64_t size,
+                  int64_t offset) {
+  const uint8_t *ptr = src;
+  int64_t total = 0;
+
+  while (total < size) {
+    OVERLAPPED ov = {0};
+    ov.Offset = (DWORD)(offset + total);
+    ov.OffsetHigh = (DWORD)((offset + total) >> 32);
+
+    DWORD chunk = (DWORD)MIN(size - total, 0x40000000);
+    DWORD n = 0;
+
+    if (!WriteFile(file->handle, ptr + total, chunk, &n, &ov)) {
+      return -1;
+    }
+
+    total += n;
+  }
+
+  return total;
+}
+
+int fs_fsync(struct fs_file *file) {
+  return FlushFileBuffers(file->handle) != 0;
+}
+
 int fs_exists(const char *path) {
   struct _stat buffer;
   return _stat(path, &buffer) == 0;
 }
 
+int fs_stat(const char *path, int64_t *size, int64_t *mtime) {
+  struct _stat64 buffer;
+  if (_stat64(path, &buffer) != 0) {
+    return 0;
+  }
+  *size = (int64_t)buffer.st_size;
+  *mtime = (int64_t)buffer.st_mtime;
+  return 1;
+}
+
 void fs_realpath(const char *path, char *resolved, size_t size) {
   if (!_fullpath(resolved, path, size)) {
     strncpy(resolved, path, size);
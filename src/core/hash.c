@@ -0,0 +1,95 @@
+#include "core/hash.h"
+#include "core/core.h"
+
+#define PRIME64_1 UINT64_C(0x9e3779b185ebca87)
+#define PRIME64_2 UINT64_C(0xc2b2ae3d27d4eb4f)
+#define PRIME64_3 UINT64_C(0x165667b19e3779f9)
+#define PRIME64_4 UINT64_C(0x85ebca77c2b2ae63)
+#define PRIME64_5 UINT64_C(0x27d4eb2f165667c5)
+
+static inline uint64_t hash_rotl(uint64_t v, int n) {
+  return (v << n) | (v >> (64 - n));
+}
+
+static inline uint64_t hash_read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t hash_read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+  acc += input * PRIME64_2;
+  acc = hash_rotl(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t v) {
+  acc ^= hash_round(0, v);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t hash_bytes(const void *data, int size, uint64_t seed) {
+  const uint8_t *p = data;
+  const uint8_t *end = p + size;
+  uint64_t h;
+
+  /* the bulk of the data is consumed 32 bytes at a time across 4 independent
+     accumulators */
+  if (size >= 32) {
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+
+    do {
+      v1 = hash_round(v1, hash_read64(p + 0));
+      v2 = hash_round(v2, hash_read64(p + 8));
+      v3 = hash_round(v3, hash_read64(p + 16));
+      v4 = hash_round(v4, hash_read64(p + 24));
+      p += 32;
+    } while (p + 32 <= end);
+
+    h = hash_rotl(v1, 1) + hash_rotl(v2, 7) + hash_rotl(v3, 12) +
+        hash_rotl(v4, 18);
+    h = hash_merge(h, v1);
+    h = hash_merge(h, v2);
+    h = hash_merge(h, v3);
+    h = hash_merge(h, v4);
+  } else {
+    h = seed + PRIME64_5;
+  }
+
+  h += (uint64_t)size;
+
+  /* fold in the remaining tail */
+  for (; p + 8 <= end; p += 8) {
+    h ^= hash_round(0, hash_read64(p));
+    h = hash_rotl(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+
+  if (p + 4 <= end) {
+    h ^= (uint64_t)hash_read32(p) * PRIME64_1;
+    h = hash_rotl(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  for (; p < end; p++) {
+    h ^= (uint64_t)*p * PRIME64_5;
+    h = hash_rotl(h, 11) * PRIME64_1;
+  }
+
+  /* avalanche */
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
@@ -32,4 +32,11 @@
 #define hash_bkt_for_each_entry(it, bkt, type, member) \
   list_for_each_entry(it, bkt, type, member)
 
+/*
+ * fast non-cryptographic hash of a block of memory, following xxhash's 64-bit
+ * variant. chaining calls by passing the previous result as the seed hashes
+ * multiple blocks together
+ */
+uint64_t hash_bytes(const void *data, int size, uint64_t seed);
+
 #endif
@@ -0,0 +1,214 @@
+#ifndef REDREAM_HASH_MAP_H
+#define REDREAM_HASH_MAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core/hash.h"
+
+/*
+ * open-addressing hash map for integer keys, using robin hood hashing
+ *
+ * entries are stored inline in a single array, with the distance of each from
+ * its home slot kept in a parallel byte array. on insert, an entry takes the
+ * slot of any it finds closer to its home than it is, which bounds the length
+ * of probe sequences and lets a lookup stop as soon as it passes the distance
+ * the key would have been placed at. entries are removed by shifting the rest
+ * of their probe sequence back, so no tombstones are left behind
+ *
+ * keys aren't required to be unique, entries sharing a key are found one after
+ * the other with name##_find and name##_find_next. inserting an entry moves
+ * others around, so any slot or value pointer previously returned is
+ * invalidated by it
+ *
+ * DEFINE_HASH_MAP(name, key_type, value_type) defines struct name along with
+ * the functions operating on it, a zero-initialized struct is an empty map
+ */
+#define HASH_MAP_MIN_SIZE 16
+
+#define hash_map_occupied(map, slot) ((map)->dists[slot] != 0)
+
+#define hash_map_value(map, slot) (&(map)->entries[slot].value)
+
+#define hash_map_for_each(it, map, name)                    \
+  for (int it = name##_next_slot(map, 0); it < (map)->size; \
+       it = name##_next_slot(map, it + 1))
+
+#define DEFINE_HASH_MAP(name, key_type, value_type)                            \
+  struct name##_entry {                                                        \
+    key_type key;                                                              \
+    value_type value;                                                          \
+  };                                                                           \
+                                                                               \
+  struct name {                                                                \
+    struct name##_entry *entries;                                              \
+    /* distance of each entry from its home slot plus one, 0 if empty */       \
+    uint8_t *dists;                                                            \
+    int size;                                                                  \
+    int num_entries;                                                           \
+  };                                                                           \
+                                                                               \
+  static inline uint32_t name##_home(const struct name *map, key_type key) {   \
+    return (uint32_t)hash_key(key, ctz32(map->size));                          \
+  }                                                                            \
+                                                                               \
+  /* returns the first occupied slot at or after slot, size if none is */      \
+  static inline int name##_next_slot(const struct name *map, int slot) {       \
+    while (slot < map->size && !map->dists[slot]) {                            \
+      slot++;                                                                  \
+    }                                                                          \
+    return slot;                                                               \
+  }                                                                            \
+                                                                               \
+  /* returns the slot of the next entry for key after slot, -1 if none is */   \
+  static inline int name##_find_next(const struct name *map, key_type key,     \
+                                     int slot) {                               \
+    uint32_t mask = map->size - 1;                                             \
+    uint32_t i = (uint32_t)(slot + 1) & mask;                                  \
+    int dist = map->dists[slot] + 1;                                           \
+                                                                               \
+    while (map->dists[i] >= dist) {                                            \
+      if (map->entries[i].key == key) {                                        \
+        return (int)i;                                                         \
+      }                                                                        \
+      i = (i + 1) & mask;                                                      \
+      dist++;                                                                  \
+    }                                                                          \
+                                                                               \
+    return -1;                                                                 \
+  }                                                                            \
+                                                                               \
+  /* returns the slot of the first entry for key, -1 if there is none */       \
+  static inline int name##_find(const struct name *map, key_type key) {        \
+    if (!map->size) {                                                          \
+      return -1;                                                               \
+    }                                                                          \
+                                                                               \
+    uint32_t mask = map->size - 1;                                             \
+    uint32_t i = name##_home(map, key);                                        \
+    int dist = 1;                                                              \
+                                                                               \
+    while (map->dists[i] >= dist) {                                            \
+      if (map->entries[i].key == key) {                                        \
+        return (int)i;                                                         \
+      }                                                                        \
+      i = (i + 1) & mask;                                                      \
+      dist++;                                                                  \
+    }                                                                          \
+                                                                               \
+    return -1;                                                                 \
+  }                                                                            \
+                                                                               \
+  static inline value_type *name##_get(const struct name *map, key_type key) { \
+    int slot = name##_find(map, key);                                          \
+    return slot >= 0 ? &map->entries[slot].value : NULL;                       \
+  }                                                                            \
+                                                                               \
+  static inline void name##_grow(struct name *map);                            \
+                                                                               \
+  /* adds an entry, regardless of any others already stored for its key */     \
+  static inline void name##_insert(struct name *map, key_type key,             \
+                                   value_type value) {                         \
+    /* robin hood hashing keeps probe sequences short even at high load */     \
+    if ((map->num_entries + 1) * 4 > map->size * 3) {                          \
+      name##_grow(map);                                                        \
+    }                                                                          \
+                                                                               \
+    uint32_t mask = map->size - 1;                                             \
+    uint32_t i = name##_home(map, key);                                        \
+    int dist = 1;                                                              \
+    struct name##_entry entry;                                                 \
+    entry.key = key;                                                           \
+    entry.value = value;                                                       \
+                                                                               \
+    while (map->dists[i]) {                                                    \
+      /* take the slot from entries closer to home */                          \
+      if (map->dists[i] < dist) {                                              \
+        struct name##_entry tmp = map->entries[i];                             \
+        int tmp_dist = map->dists[i];                                          \
+        map->entries[i] = entry;                                               \
+        map->dists[i] = (uint8_t)dist;                                         \
+        entry = tmp;                                                           \
+        dist = tmp_dist;                                                       \
+      }                                                                        \
+                                                                               \
+      i = (i + 1) & mask;                                                      \
+      dist++;                                                                  \
+                                                                               \
+      /* the distance doesn't fit, grow and insert whatever entry was left     \
+         displaced */                                                          \
+      if (dist > UINT8_MAX) {                                                  \
+        name##_grow(map);                                                      \
+        name##_insert(map, entry.key, entry.value);                            \
+        return;                                                                \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    map->entries[i] = entry;                                                   \
+    map->dists[i] = (uint8_t)dist;                                             \
+    map->num_entries++;                                                        \
+  }                                                                            \
+                                                                               \
+  static inline void name##_grow(struct name *map) {                           \
+    struct name##_entry *old_entries = map->entries;                           \
+    uint8_t *old_dists = map->dists;                                           \
+    int old_size = map->size;                                                  \
+                                                                               \
+    map->size = old_size ? old_size * 2 : HASH_MAP_MIN_SIZE;                   \
+    map->entries = (struct name##_entry *)malloc(map->size *                   \
+                                                 sizeof(struct name##_entry)); \
+    map->dists = (uint8_t *)calloc(map->size, 1);                              \
+    map->num_entries = 0;                                                      \
+                                                                               \
+    for (int i = 0; i < old_size; i++) {                                       \
+      if (old_dists[i]) {                                                      \
+        name##_insert(map, old_entries[i].key, old_entries[i].value);          \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    free(old_entries);                                                         \
+    free(old_dists);                                                           \
+  }                                                                            \
+                                                                               \
+  /* removes the entry in slot. only the entries after it in its probe         \
+     sequence are moved, each back a single slot */                            \
+  static inline void name##_remove_slot(struct name *map, int slot) {          \
+    uint32_t mask = map->size - 1;                                             \
+    uint32_t i = (uint32_t)slot;                                               \
+    uint32_t next = (i + 1) & mask;                                            \
+                                                                               \
+    while (map->dists[next] > 1) {                                             \
+      map->entries[i] = map->entries[next];                                    \
+      map->dists[i] = map->dists[next] - 1;                                    \
+      i = next;                                                                \
+      next = (next + 1) & mask;                                                \
+    }                                                                          \
+                                                                               \
+    map->dists[i] = 0;                                                         \
+    map->num_entries--;                                                        \
+  }                                                                            \
+                                                                               \
+  /* removes the first entry for key, returning if there was one */            \
+  static inline int name##_remove(struct name *map, key_type key) {            \
+    int slot = name##_find(map, key);                                          \
+    if (slot < 0) {                                                            \
+      return 0;                                                                \
+    }                                                                          \
+    name##_remove_slot(map, slot);                                             \
+    return 1;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_clear(struct name *map) {                          \
+    if (map->size) {                                                           \
+      memset(map->dists, 0, map->size);                                        \
+    }                                                                          \
+    map->num_entries = 0;                                                      \
+  }                                                                            \
+                                                                               \
+  static inline void name##_destroy(struct name *map) {                        \
+    free(map->entries);                                                        \
+    free(map->dists);                                                          \
+    memset(map, 0, sizeof(*map));                                              \
+  }
+
+#endif
@@ -1,30 +1,63 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "core/log.h"
+#include "core/atomic.h"
+#include "core/thread.h"
+#include "core/time.h"
 
 #if PLATFORM_ANDROID
 #include <android/log.h>
 #endif
 
-void log_line(enum log_level level, const char *format, ...) {
-  static char sbuffer[0x1000];
-  int buffer_size = sizeof(sbuffer);
-  char *buffer = sbuffer;
+/* messages are formatted by the thread logging them into fixed size slots,
+   those too long to fit are written out synchronously */
+#define LOG_MSG_SIZE 512
+#define LOG_QUEUE_SIZE 256
+#define LOG_DRAIN_MS 10
 
-  /* allocate a temporary buffer if need be to fit the string */
-  va_list args;
-  va_start(args, format);
-  int len = vsnprintf(0, 0, format, args);
-  if (len >= buffer_size) {
-    buffer_size = len + 1;
-    buffer = malloc(buffer_size);
-  }
-  va_end(args);
+/* lines written per second before the rest are dropped */
+#define LOG_MAX_LINES_PER_SEC 200
 
-  va_start(args, format);
-  vsnprintf(buffer, buffer_size, format, args);
-  va_end(args);
+struct log_msg {
+  volatile uint32_t seq;
+  enum log_level level;
+  char buffer[LOG_MSG_SIZE];
+};
+
+/*
+ * when running asynchronously, messages are handed off to a background thread
+ * through a bounded multi-producer queue, where each slot's sequence number
+ * says whether it's ready to be claimed by a producer or drained by the
+ * consumer. producers never block, dropping their message when the queue is
+ * full
+ */
+static struct {
+  int async;
+  thread_t thread;
+  int shutdown;
+
+  struct log_msg queue[LOG_QUEUE_SIZE];
+  volatile uint32_t head;
+  volatile uint32_t dropped;
+
+  /* consumer state, only accessed while holding the mutex */
+  mutex_t mutex;
+  cond_t cond;
+  uint32_t tail;
+  enum log_level last_level;
+  char last[LOG_MSG_SIZE];
+  int repeats;
+  int64_t window;
+  int window_lines;
+  int suppressed;
+} logger;
 
+/* set on the thread draining the queue, to avoid recursing into the drain if
+   writing a message fails fatally */
+static _Thread_local int log_draining;
+
+static void log_write(enum log_level level, const char *buffer) {
 #if PLATFORM_ANDROID
   static const char *LOG_TAG = "redream";
 
@@ -54,6 +87,234 @@ void log_line(enum log_level level, const char *format, ...) {
 #else
   printf("%s\n", buffer);
 #endif
+}
+
+static void log_write_repeats() {
+  if (!logger.repeats) {
+    return;
+  }
+
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "last message repeated %d times",
+           logger.repeats);
+  log_write(logger.last_level, buffer);
+  logger.repeats = 0;
+}
+
+static void log_write_limited(enum log_level level, const char *buffer) {
+  /* collapse runs of the same message into a count */
+  if (level == logger.last_level && !strcmp(buffer, logger.last)) {
+    logger.repeats++;
+    return;
+  }
+
+  log_write_repeats();
+
+  int64_t now = time_nanoseconds();
+
+  if (now - logger.window >= NS_PER_SEC) {
+    if (logger.suppressed) {
+      char summary[64];
+      snprintf(summary, sizeof(summary), "suppressed %d messages",
+               logger.suppressed);
+      log_write(LOG_LEVEL_WARNING, summary);
+    }
+
+    logger.window = now;
+    logger.window_lines = 0;
+    logger.suppressed = 0;
+  }
+
+  if (logger.window_lines >= LOG_MAX_LINES_PER_SEC) {
+    logger.suppressed++;
+    return;
+  }
+
+  log_write(level, buffer);
+  logger.window_lines++;
+
+  logger.last_level = level;
+  strncpy(logger.last, buffer, sizeof(logger.last));
+  logger.last[sizeof(logger.last) - 1] = 0;
+}
+
+static void log_drain_locked() {
+  log_draining = 1;
+
+  while (1) {
+    struct log_msg *msg = &logger.queue[logger.tail % LOG_QUEUE_SIZE];
+
+    if (atomic_load32(&msg->seq) != logger.tail + 1) {
+      break;
+    }
+
+    log_write_limited(msg->level, msg->buffer);
+
+    /* hand the slot back to the producers for its next lap of the queue */
+    atomic_store32(&msg->seq, logger.tail + LOG_QUEUE_SIZE);
+    logger.tail++;
+  }
+
+  uint32_t dropped = atomic_exchange32(&logger.dropped, 0);
+  if (dropped) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "dropped %u messages, queue was full",
+             dropped);
+    log_write_repeats();
+    log_write(LOG_LEVEL_WARNING, buffer);
+  }
+
+  fflush(stdout);
+
+  log_draining = 0;
+}
+
+static void log_write_sync(enum log_level level, const char *buffer) {
+  if (!logger.async || log_draining) {
+    log_write(level, buffer);
+    return;
+  }
+
+  /* write out everything queued before this message first, fatal messages in
+     particular have to make it out before the process exits */
+  mutex_lock(logger.mutex);
+  log_drain_locked();
+  log_write_repeats();
+  log_write(level, buffer);
+  fflush(stdout);
+  mutex_unlock(logger.mutex);
+}
+
+static void *log_thread(void *data) {
+  mutex_lock(logger.mutex);
+
+  while (!logger.shutdown) {
+    log_drain_locked();
+    cond_timedwait(logger.cond, logger.mutex, LOG_DRAIN_MS);
+  }
+
+  log_drain_locked();
+  log_write_repeats();
+
+  mutex_unlock(logger.mutex);
+
+  return NULL;
+}
+
+static int log_enqueue(enum log_level level, const char *buffer) {
+  uint32_t pos = atomic_load32(&logger.head);
+  struct log_msg *msg = NULL;
+
+  while (1) {
+    msg = &logger.queue[pos % LOG_QUEUE_SIZE];
+
+    int32_t diff = (int32_t)(atomic_load32(&msg->seq) - pos);
+
+    if (diff < 0) {
+      /* the consumer hasn't caught up to this slot's previous message */
+      return 0;
+    }
+
+    if (!diff && atomic_cas32(&logger.head, pos, pos + 1)) {
+      break;
+    }
+
+    pos = atomic_load32(&logger.head);
+  }
+
+  msg->level = level;
+  strcpy(msg->buffer, buffer);
+  atomic_store32(&msg->seq, pos + 1);
+
+  return 1;
+}
+
+static void log_stop() {
+  /* the queue can't be drained when exiting due to a fatal error while
+     draining it */
+  if (log_draining) {
+    return;
+  }
+
+  log_set_async(0);
+}
+
+void log_set_async(int async) {
+  if (logger.async == !!async) {
+    return;
+  }
+
+  if (async) {
+    for (int i = 0; i < LOG_QUEUE_SIZE; i++) {
+      logger.queue[i].seq = i;
+    }
+    logger.head = 0;
+    logger.tail = 0;
+    logger.dropped = 0;
+    logger.shutdown = 0;
+    logger.last_level = LOG_LEVEL_INFO;
+    logger.last[0] = 0;
+
+    logger.mutex = mutex_create();
+    logger.cond = cond_create();
+    logger.thread = thread_create(&log_thread, "log", NULL);
+
+    if (!logger.thread) {
+      cond_destroy(logger.cond);
+      mutex_destroy(logger.mutex);
+      return;
+    }
+
+    /* make sure the queue is drained on the way out */
+    static int registered;
+    if (!registered) {
+      atexit(&log_stop);
+      registered = 1;
+    }
+
+    logger.async = 1;
+  } else {
+    mutex_lock(logger.mutex);
+    logger.shutdown = 1;
+    cond_signal(logger.cond);
+    mutex_unlock(logger.mutex);
+
+    void *result;
+    thread_join(logger.thread, &result);
+
+    logger.async = 0;
+
+    cond_destroy(logger.cond);
+    mutex_destroy(logger.mutex);
+  }
+}
+
+void log_line(enum log_level level, const char *format, ...) {
+  char sbuffer[LOG_MSG_SIZE];
+  int buffer_size = sizeof(sbuffer);
+  char *buffer = sbuffer;
+
+  /* allocate a temporary buffer if need be to fit the string */
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(0, 0, format, args);
+  if (len >= buffer_size) {
+    buffer_size = len + 1;
+    buffer = malloc(buffer_size);
+  }
+  va_end(args);
+
+  va_start(args, format);
+  vsnprintf(buffer, buffer_size, format, args);
+  va_end(args);
+
+  if (logger.async && level != LOG_LEVEL_FATAL && buffer == sbuffer) {
+    if (!log_enqueue(level, buffer)) {
+      atomic_add32(&logger.dropped, 1);
+    }
+  } else {
+    log_write_sync(level, buffer);
+  }
 
   /* cleanup the temporary buffer */
   if (buffer != sbuffer) {
@@ -18,6 +18,10 @@ enum log_level {
 #define ANSI_COLOR_CYAN "\x1b[36m"
 #define ANSI_COLOR_RESET "\x1b[0m"
 
+/* when enabled, messages are queued up and written out from a background
+   thread, with repeated messages collapsed and bursts of them rate limited.
+   fatal messages are always written out immediately */
+void log_set_async(int async);
 void log_line(enum log_level level, const char *format, ...);
 
 #ifndef NDEBUG
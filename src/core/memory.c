@@ -5,19 +5,65 @@
 #include "core/interval_tree.h"
 #include "core/list.h"
 
+/* granularity reservations are attempted at, large enough to be a multiple of
+   the allocation granularity on each platform */
+#define RESERVE_STEP 0x1000000
+
+void *reserve_pages_near(const void *target, size_t size, size_t range) {
+  uintptr_t base = ALIGN_DOWN((uintptr_t)target, RESERVE_STEP);
+  uintptr_t span = ALIGN_UP(size, RESERVE_STEP);
+
+  /* probe outwards from the target, alternating between addresses before and
+     after it, until a reservation lands entirely within range of it */
+  for (uintptr_t dist = RESERVE_STEP; dist + span <= range;
+       dist += RESERVE_STEP) {
+    if (base > dist + span) {
+      void *ptr = reserve_pages((void *)(base - dist - span), size);
+      if (ptr) {
+        return ptr;
+      }
+    }
+
+    if (base + dist + span > base) {
+      void *ptr = reserve_pages((void *)(base + dist), size);
+      if (ptr) {
+        return ptr;
+      }
+    }
+  }
+
+  return NULL;
+}
+
 #define MAX_WATCHES 8192
+#define MAX_POLLED_PAGES 64
 
 struct memory_watch {
   enum memory_watch_type type;
   memory_watch_cb cb;
   void *data;
+
+  /* first page of a deferred watch seen written to, reported on the next
+     poll */
+  uintptr_t written;
+
   struct interval_node tree_it;
   struct list_node list_it;
 };
 
+/* single write watches protect the pages they cover, and are triggered by the
+   access violation raised on the first write to them. deferred watches are
+   instead kept in their own tree, with writes to their pages tracked by the
+   host without faulting */
 struct memory_watcher {
   struct exception_handler *exc_handler;
+  int exc_range;
+  /* bounds of every single write watch added, claimed as the exception
+     handler's range. deferred watches never fault, so aren't included */
+  uintptr_t watch_begin;
+  uintptr_t watch_end;
   struct rb_tree tree;
+  struct rb_tree deferred_tree;
   struct memory_watch watches[MAX_WATCHES];
   struct list free_watches;
   struct list live_watches;
@@ -27,10 +73,16 @@ static struct memory_watcher *watcher;
 
 static int watcher_handle_exception(void *ctx, struct exception_state *ex);
 
+static int watcher_empty() {
+  return !watcher->tree.root && !watcher->deferred_tree.root;
+}
+
 static void watcher_create() {
   watcher = calloc(1, sizeof(struct memory_watcher));
 
   watcher->exc_handler = exception_handler_add(NULL, &watcher_handle_exception);
+  watcher->exc_range =
+      exception_handler_add_range(watcher->exc_handler, EX_RANGE_FAULT, 0, 0);
 
   for (int i = 0; i < MAX_WATCHES; i++) {
     struct memory_watch *watch = &watcher->watches[i];
@@ -74,7 +126,7 @@ static int watcher_handle_exception(void *ctx, struct exception_state *ex) {
     n = next;
   }
 
-  if (watcher && !watcher->tree.root) {
+  if (watcher && watcher_empty()) {
     watcher_destroy();
   }
 
@@ -83,7 +135,11 @@ static int watcher_handle_exception(void *ctx, struct exception_state *ex) {
 
 void remove_memory_watch(struct memory_watch *watch) {
   /* remove from interval tree */
-  interval_tree_remove(&watcher->tree, &watch->tree_it);
+  if (watch->type == WATCH_DEFERRED_WRITE) {
+    interval_tree_remove(&watcher->deferred_tree, &watch->tree_it);
+  } else {
+    interval_tree_remove(&watcher->tree, &watch->tree_it);
+  }
 
   /* remove from live list */
   list_remove(&watcher->live_watches, &watch->list_it);
@@ -91,33 +147,47 @@ void remove_memory_watch(struct memory_watch *watch) {
   /* add to free list */
   list_add(&watcher->free_watches, &watch->list_it);
 
-  if (!watcher->tree.root) {
+  if (watcher_empty()) {
     watcher_destroy();
   }
 }
 
-struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
-                                            memory_watch_cb cb, void *data) {
+int get_memory_watch_range(const void *ptr, uintptr_t *begin,
+                           uintptr_t *end) {
   if (!watcher) {
-    watcher_create();
+    return 0;
   }
 
-  /* page align the range to be watched */
-  size_t page_size = get_page_size();
-  uintptr_t aligned_begin = ALIGN_DOWN((uintptr_t)ptr, page_size);
-  uintptr_t aligned_end = ALIGN_UP((uintptr_t)ptr + size, page_size) - 1;
-  size_t aligned_size = (aligned_end - aligned_begin) + 1;
+  struct interval_tree_it it;
+  struct interval_node *n = interval_tree_iter_first(
+      &watcher->tree, (uintptr_t)ptr, (uintptr_t)ptr, &it);
 
-  /* disable writing to the pages */
-  CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READONLY));
+  if (!n) {
+    return 0;
+  }
+
+  *begin = n->low;
+  *end = n->high + 1;
+
+  while ((n = interval_tree_iter_next(&it))) {
+    *begin = MIN(*begin, n->low);
+    *end = MAX(*end, n->high + 1);
+  }
+
+  return 1;
+}
 
-  /* allocate new access watch */
+static struct memory_watch *watcher_alloc_watch(enum memory_watch_type type,
+                                                uintptr_t begin, uintptr_t end,
+                                                memory_watch_cb cb,
+                                                void *data) {
   struct memory_watch *watch =
       list_first_entry(&watcher->free_watches, struct memory_watch, list_it);
   CHECK_NOTNULL(watch);
-  watch->type = WATCH_SINGLE_WRITE;
+  watch->type = type;
   watch->cb = cb;
   watch->data = data;
+  watch->written = 0;
 
   /* remove from free list */
   list_remove(&watcher->free_watches, &watch->list_it);
@@ -126,10 +196,143 @@ struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
   list_add(&watcher->live_watches, &watch->list_it);
 
   /* add to interval tree */
-  watch->tree_it.low = aligned_begin;
-  watch->tree_it.high = aligned_end;
+  watch->tree_it.low = begin;
+  watch->tree_it.high = end;
 
-  interval_tree_insert(&watcher->tree, &watch->tree_it);
+  if (type == WATCH_DEFERRED_WRITE) {
+    interval_tree_insert(&watcher->deferred_tree, &watch->tree_it);
+  } else {
+    interval_tree_insert(&watcher->tree, &watch->tree_it);
+  }
 
   return watch;
 }
+
+/* flag each deferred watch overlapping the pages collected from [begin, end],
+   returning if the range had any pages written to */
+static int watcher_collect_writes(uintptr_t begin, uintptr_t end) {
+  size_t page_size = get_page_size();
+  uintptr_t pages[MAX_POLLED_PAGES];
+  int num_pages, any = 0;
+
+  do {
+    num_pages = collect_page_writes((void *)begin, (end - begin) + 1, pages,
+                                    MAX_POLLED_PAGES);
+
+    for (int i = 0; i < num_pages; i++) {
+      struct interval_tree_it it;
+      struct interval_node *n =
+          interval_tree_iter_first(&watcher->deferred_tree, pages[i],
+                                   pages[i] + page_size - 1, &it);
+
+      while (n) {
+        struct memory_watch *watch =
+            container_of(n, struct memory_watch, tree_it);
+
+        if (!watch->written) {
+          watch->written = pages[i];
+        }
+
+        n = interval_tree_iter_next(&it);
+      }
+    }
+
+    any |= num_pages > 0;
+  } while (num_pages == MAX_POLLED_PAGES);
+
+  return any;
+}
+
+void poll_memory_watches() {
+  if (!watcher || !watcher->deferred_tree.root) {
+    return;
+  }
+
+  /* collecting the writes to a watch's pages marks them clean, so flag every
+     watch overlapping them before any are removed */
+  list_for_each_entry(watch, &watcher->live_watches, struct memory_watch,
+                      list_it) {
+    if (watch->type != WATCH_DEFERRED_WRITE || watch->written) {
+      continue;
+    }
+
+    watcher_collect_writes(watch->tree_it.low, watch->tree_it.high);
+  }
+
+  list_for_each_entry_safe(watch, &watcher->live_watches, struct memory_watch,
+                           list_it) {
+    if (watch->type != WATCH_DEFERRED_WRITE || !watch->written) {
+      continue;
+    }
+
+    struct exception_state ex = {0};
+    ex.type = EX_ACCESS_VIOLATION;
+    ex.fault_addr = watch->written;
+
+    /* note, the watcher is destroyed after removing the last watch, at which
+       point there's no next watch to continue on to */
+    watch->cb(&ex, watch->data);
+    remove_memory_watch(watch);
+  }
+}
+
+struct memory_watch *add_deferred_write_watch(const void *ptr, size_t size,
+                                              memory_watch_cb cb, void *data) {
+  if (!watcher) {
+    watcher_create();
+  }
+
+  size_t page_size = get_page_size();
+  uintptr_t aligned_begin = ALIGN_DOWN((uintptr_t)ptr, page_size);
+  uintptr_t aligned_end = ALIGN_UP((uintptr_t)ptr + size, page_size) - 1;
+  size_t aligned_size = (aligned_end - aligned_begin) + 1;
+
+  /* tracking the pages marks them clean, first collect any writes to them
+     that the deferred watches already overlapping them haven't seen */
+  struct interval_tree_it it;
+  struct interval_node *n = interval_tree_iter_first(
+      &watcher->deferred_tree, aligned_begin, aligned_end, &it);
+
+  while (n) {
+    watcher_collect_writes(MAX(n->low, aligned_begin),
+                           MIN(n->high, aligned_end));
+    n = interval_tree_iter_next(&it);
+  }
+
+  if (!track_page_writes((void *)aligned_begin, aligned_size)) {
+    return add_single_write_watch(ptr, size, cb, data);
+  }
+
+  return watcher_alloc_watch(WATCH_DEFERRED_WRITE, aligned_begin, aligned_end,
+                             cb, data);
+}
+
+struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
+                                            memory_watch_cb cb, void *data) {
+  if (!watcher) {
+    watcher_create();
+  }
+
+  /* page align the range to be watched */
+  size_t page_size = get_page_size();
+  uintptr_t aligned_begin = ALIGN_DOWN((uintptr_t)ptr, page_size);
+  uintptr_t aligned_end = ALIGN_UP((uintptr_t)ptr + size, page_size) - 1;
+  size_t aligned_size = (aligned_end - aligned_begin) + 1;
+
+  /* claim the pages before they can fault */
+  if (watcher->watch_begin == watcher->watch_end) {
+    watcher->watch_begin = aligned_begin;
+    watcher->watch_end = aligned_end + 1;
+  } else {
+    watcher->watch_begin = MIN(watcher->watch_begin, aligned_begin);
+    watcher->watch_end = MAX(watcher->watch_end, aligned_end + 1);
+  }
+  exception_handler_update_range(watcher->exc_handler, watcher->exc_range,
+                                 watcher->watch_begin, watcher->watch_end);
+
+  /* disable writing to the pages */
+  CHECK(protect_pages((void *)aligned_begin, aligned_size, ACC_READONLY));
+
+  return watcher_alloc_watch(WATCH_SINGLE_WRITE, aligned_begin, aligned_end,
+                             cb, data);
+}
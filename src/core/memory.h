@@ -2,6 +2,7 @@
 #define SYS_MEMORY_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct exception_state;
 
@@ -12,6 +13,7 @@ enum page_access {
   ACC_NONE,
   ACC_READONLY,
   ACC_READWRITE,
+  ACC_READEXEC,
   ACC_READWRITEEXEC,
 };
 
@@ -19,8 +21,14 @@ size_t get_page_size();
 size_t get_allocation_granularity();
 int protect_pages(void *ptr, size_t size, enum page_access access);
 void *reserve_pages(void *ptr, size_t size);
+void *reserve_pages_near(const void *target, size_t size, size_t range);
+int commit_pages(void *ptr, size_t size, enum page_access access);
 int release_pages(void *ptr, size_t size);
 
+/* hint that a range of shared memory should be backed by huge pages. returns
+   0 when the hint isn't supported by the host, leaving small pages in place */
+int advise_huge_pages(void *ptr, size_t size);
+
 /*
  * shared memory objects
  */
@@ -35,6 +43,35 @@ void *map_shared_memory(shmem_handle_t handle, size_t offset, void *start,
 int unmap_shared_memory(shmem_handle_t handle, void *start, size_t size);
 int destroy_shared_memory(shmem_handle_t handle);
 
+/*
+ * read-only file mappings
+ */
+const void *map_file(const char *path, size_t *size);
+void unmap_file(const void *ptr, size_t size);
+
+/* copy-on-write file mapping. pages are shared with the file's other mappings
+   until first written to, and writes are never carried back to the file.
+   unmapped with unmap_file */
+void *map_file_private(const char *path, size_t *size);
+
+/* hint that a file mapping will be read through sequentially, having the host
+   read ahead of the accesses. returns 0 when the hint isn't supported */
+int advise_sequential(const void *ptr, size_t size);
+
+/*
+ * write tracking
+ */
+
+/* start tracking writes to a page aligned range without faulting on them,
+   marking each page in it clean. returns 0 when the host can't */
+int track_page_writes(void *ptr, size_t size);
+
+/* store the address of up to max_pages pages in a tracked range written to
+   since they were last marked clean, marking those reported clean again.
+   returns the number of pages stored */
+int collect_page_writes(void *ptr, size_t size, uintptr_t *pages,
+                        int max_pages);
+
 /*
  * access watches
  */
@@ -42,12 +79,27 @@ struct memory_watch;
 
 enum memory_watch_type {
   WATCH_SINGLE_WRITE,
+  WATCH_DEFERRED_WRITE,
 };
 
 typedef void (*memory_watch_cb)(const struct exception_state *, void *);
 
 struct memory_watch *add_single_write_watch(const void *ptr, size_t size,
                                             memory_watch_cb cb, void *data);
+
+/* like add_single_write_watch, but when the host can track writes without
+   faulting, the callback is invoked by the next poll_memory_watches after the
+   write rather than at the time of it. the fault address passed to it is then
+   the start of the first page seen written */
+struct memory_watch *add_deferred_write_watch(const void *ptr, size_t size,
+                                              memory_watch_cb cb, void *data);
+void poll_memory_watches();
+
 void remove_memory_watch(struct memory_watch *watch);
 
+/* get the page aligned range [begin, end) covered by the watches containing
+   ptr, returning 0 if it isn't watched */
+int get_memory_watch_range(const void *ptr, uintptr_t *begin,
+                           uintptr_t *end);
+
 #endif
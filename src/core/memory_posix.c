@@ -1,4 +1,5 @@
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -11,6 +12,52 @@
 #include <linux/ashmem.h>
 #endif
 
+#if PLATFORM_LINUX
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/* async write-protect mode and PAGEMAP_SCAN were added in linux 6.7, define
+   them for older headers */
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+#ifndef PAGEMAP_SCAN
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PM_SCAN_WP_MATCHING (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+
+struct page_region {
+  uint64_t start;
+  uint64_t end;
+  uint64_t categories;
+};
+
+struct pm_scan_arg {
+  uint64_t size;
+  uint64_t flags;
+  uint64_t start;
+  uint64_t end;
+  uint64_t walk_end;
+  uint64_t vec;
+  uint64_t vec_len;
+  uint64_t max_pages;
+  uint64_t category_inverted;
+  uint64_t category_mask;
+  uint64_t category_anyof_mask;
+  uint64_t return_mask;
+};
+
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
+#endif
+
 #define MAX_SHMEM 128
 
 struct shmem {
@@ -19,6 +66,9 @@ struct shmem {
   struct list_node free_it;
 };
 
+/* the pool is shared by every instance, which may be created and destroyed
+   from different threads */
+static pthread_mutex_t shmem_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int initialized;
 static struct shmem shmem_pool[MAX_SHMEM];
 static struct list free_shmem;
@@ -26,8 +76,10 @@ static struct list free_shmem;
 static mode_t access_to_mode_flags(enum page_access access) {
   switch (access) {
     case ACC_READONLY:
+    case ACC_READEXEC:
       return S_IRUSR;
     case ACC_READWRITE:
+    case ACC_READWRITEEXEC:
       return S_IRUSR | S_IWUSR;
     default:
       return 0;
@@ -37,8 +89,10 @@ static mode_t access_to_mode_flags(enum page_access access) {
 static int access_to_open_flags(enum page_access access) {
   switch (access) {
     case ACC_READONLY:
+    case ACC_READEXEC:
       return O_RDONLY;
     case ACC_READWRITE:
+    case ACC_READWRITEEXEC:
       return O_RDWR;
     default:
       return 0;
@@ -51,6 +105,8 @@ static int access_to_protect_flags(enum page_access access) {
       return PROT_READ;
     case ACC_READWRITE:
       return PROT_READ | PROT_WRITE;
+    case ACC_READEXEC:
+      return PROT_READ | PROT_EXEC;
     case ACC_READWRITEEXEC:
       return PROT_READ | PROT_WRITE | PROT_EXEC;
     default:
@@ -86,31 +142,208 @@ void *reserve_pages(void *ptr, size_t size) {
   return res;
 }
 
+int commit_pages(void *ptr, size_t size, enum page_access access) {
+  /* reserved pages are backed on demand, they just need to be made
+     accessible */
+  return protect_pages(ptr, size, access);
+}
+
 int protect_pages(void *ptr, size_t size, enum page_access access) {
   int prot = access_to_protect_flags(access);
   return mprotect(ptr, size, prot) == 0;
 }
 
+int advise_huge_pages(void *ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+  /* madvise succeeds even when the kernel's policy for shared memory is to
+     never use transparent huge pages, so check the policy first */
+  static int policy = -1;
+
+  if (policy < 0) {
+    FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+    char buffer[128] = {0};
+
+    if (fp) {
+      fgets(buffer, sizeof(buffer), fp);
+      fclose(fp);
+    }
+
+    policy = strstr(buffer, "[always]") || strstr(buffer, "[within_size]") ||
+             strstr(buffer, "[advise]") || strstr(buffer, "[force]");
+  }
+
+  if (!policy) {
+    return 0;
+  }
+
+  return madvise(ptr, size, MADV_HUGEPAGE) == 0;
+#else
+  return 0;
+#endif
+}
+
 size_t get_allocation_granularity() {
   return get_page_size();
 }
 
+#if PLATFORM_LINUX
+/* writes are tracked by registering pages with a userfaultfd in async
+   write-protect mode. the first write to a protected page is resolved by the
+   kernel itself, which unprotects the page without raising a signal. the
+   pages written are then read back through the pagemap */
+#define UFFD_FEATURES (UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED)
+#define MAX_WRITE_REGIONS 64
+
+static int uffd = -1;
+static int pagemap = -1;
+static int write_tracking = -1;
+
+static int scan_page_writes(void *ptr, size_t size, int reset,
+                            struct page_region *regions, int max_regions,
+                            int max_pages) {
+  struct pm_scan_arg arg = {0};
+  arg.size = sizeof(arg);
+  arg.flags = reset ? PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC : 0;
+  arg.start = (uintptr_t)ptr;
+  arg.end = (uintptr_t)ptr + size;
+  arg.vec = (uintptr_t)regions;
+  arg.vec_len = max_regions;
+  arg.max_pages = max_pages;
+  arg.category_mask = PAGE_IS_WRITTEN;
+  arg.return_mask = PAGE_IS_WRITTEN;
+  return ioctl(pagemap, PAGEMAP_SCAN, &arg);
+}
+
+static int register_page_writes(void *ptr, size_t size) {
+  struct uffdio_register reg = {0};
+  reg.range.start = (uintptr_t)ptr;
+  reg.range.len = size;
+  reg.mode = UFFDIO_REGISTER_MODE_WP;
+  if (ioctl(uffd, UFFDIO_REGISTER, &reg)) {
+    return 0;
+  }
+
+  struct uffdio_writeprotect wp = {0};
+  wp.range.start = (uintptr_t)ptr;
+  wp.range.len = size;
+  wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+  return ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == 0;
+}
+
+static int init_write_tracking() {
+  /* unprivileged processes may only track faults raised from user mode, which
+     is all that's needed as the kernel never writes to the tracked pages */
+  uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+  if (uffd < 0) {
+    return 0;
+  }
+
+  struct uffdio_api api = {0};
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURES;
+  if (ioctl(uffd, UFFDIO_API, &api) ||
+      (api.features & UFFD_FEATURES) != UFFD_FEATURES) {
+    return 0;
+  }
+
+  pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (pagemap < 0) {
+    return 0;
+  }
+
+  /* make sure the pagemap can be scanned as well, by tracking a scratch page
+     and checking a write to it is seen */
+  size_t page_size = get_page_size();
+  uint8_t *page = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (page == MAP_FAILED) {
+    return 0;
+  }
+
+  struct page_region region;
+  int res = register_page_writes(page, page_size) &&
+            scan_page_writes(page, page_size, 1, &region, 1, 0) == 0;
+  page[0] = 1;
+  res = res && scan_page_writes(page, page_size, 1, &region, 1, 0) == 1;
+
+  munmap(page, page_size);
+
+  return res;
+}
+
+int track_page_writes(void *ptr, size_t size) {
+  if (write_tracking < 0) {
+    write_tracking = init_write_tracking();
+
+    if (!write_tracking) {
+      LOG_INFO("track_page_writes unsupported, falling back to page faults");
+    }
+  }
+
+  if (!write_tracking) {
+    return 0;
+  }
+
+  return register_page_writes(ptr, size);
+}
+
+int collect_page_writes(void *ptr, size_t size, uintptr_t *pages,
+                        int max_pages) {
+  struct page_region regions[MAX_WRITE_REGIONS];
+  int num_regions = scan_page_writes(ptr, size, 1, regions, MAX_WRITE_REGIONS,
+                                     max_pages);
+  CHECK_GE(num_regions, 0);
+
+  size_t page_size = get_page_size();
+  int num_pages = 0;
+
+  /* the scan stops once either limit is hit, only marking the pages reported
+     clean again */
+  for (int i = 0; i < num_regions; i++) {
+    for (uintptr_t page = regions[i].start;
+         page < regions[i].end && num_pages < max_pages; page += page_size) {
+      pages[num_pages++] = page;
+    }
+  }
+
+  return num_pages;
+}
+#else
+int track_page_writes(void *ptr, size_t size) {
+  return 0;
+}
+
+int collect_page_writes(void *ptr, size_t size, uintptr_t *pages,
+                        int max_pages) {
+  return 0;
+}
+#endif
+
 size_t get_page_size() {
   return getpagesize();
 }
 
 static void init_shared_memory_entries() {
-  if (initialized) {
-    return;
-  }
+  pthread_mutex_lock(&shmem_mutex);
 
-  initialized = 1;
+  if (!initialized) {
+    initialized = 1;
 
-  /* add all entries to free list */
-  for (int i = 0; i < MAX_SHMEM; i++) {
-    struct shmem *shmem = &shmem_pool[i];
-    list_add(&free_shmem, &shmem->free_it);
+    /* add all entries to free list */
+    for (int i = 0; i < MAX_SHMEM; i++) {
+      struct shmem *shmem = &shmem_pool[i];
+      list_add(&free_shmem, &shmem->free_it);
+    }
   }
+
+  pthread_mutex_unlock(&shmem_mutex);
+}
+
+static void release_shared_memory_entry(struct shmem *shmem) {
+  /* add back to free list */
+  pthread_mutex_lock(&shmem_mutex);
+  list_add(&free_shmem, &shmem->free_it);
+  pthread_mutex_unlock(&shmem_mutex);
 }
 
 int destroy_shared_memory(shmem_handle_t handle) {
@@ -127,8 +360,7 @@ int destroy_shared_memory(shmem_handle_t handle) {
   res = res1 == 0 && res2 == 0;
 #endif
 
-  /* add back to free list */
-  list_add(&free_shmem, &shmem->free_it);
+  release_shared_memory_entry(shmem);
 
   return res;
 }
@@ -158,27 +390,34 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
   init_shared_memory_entries();
 
   /* find unused shmem entry (wrapper for both shmem object name and file
-     handle) */
+     handle), claiming it up front so concurrent callers don't get the same
+     one */
+  pthread_mutex_lock(&shmem_mutex);
   struct shmem *shmem = list_first_entry(&free_shmem, struct shmem, free_it);
   CHECK_NOTNULL(shmem);
+  list_remove(&free_shmem, &shmem->free_it);
+  pthread_mutex_unlock(&shmem_mutex);
 
 #if PLATFORM_ANDROID
   int oflag = access_to_open_flags(access);
 
   int handle = open("/" ASHMEM_NAME_DEF, oflag);
   if (handle < 0) {
+    release_shared_memory_entry(shmem);
     return NULL;
   }
 
   int ret = ioctl(handle, ASHMEM_SET_NAME, filename);
   if (ret < 0) {
     close(handle);
+    release_shared_memory_entry(shmem);
     return NULL;
   }
 
   ret = ioctl(handle, ASHMEM_SET_SIZE, size);
   if (ret < 0) {
     close(handle);
+    release_shared_memory_entry(shmem);
     return NULL;
   }
 #else
@@ -190,21 +429,70 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
   mode_t mode = access_to_mode_flags(access);
   int handle = shm_open(filename, oflag | O_CREAT | O_EXCL, mode);
   if (handle == -1) {
+    release_shared_memory_entry(shmem);
     return NULL;
   }
 
   /* resize it */
   int res = ftruncate(handle, size);
   if (res == -1) {
+    close(handle);
     shm_unlink(filename);
+    release_shared_memory_entry(shmem);
     return NULL;
   }
 #endif
 
-  /* update entry, remove from free list */
-  strncpy(shmem->filename, filename, sizeof(shmem->filename));
+  /* update entry */
+  snprintf(shmem->filename, sizeof(shmem->filename), "%s", filename);
   shmem->handle = handle;
-  list_remove(&free_shmem, &shmem->free_it);
 
   return (shmem_handle_t)shmem;
 }
+
+void unmap_file(const void *ptr, size_t size) {
+  munmap((void *)ptr, size);
+}
+
+int advise_sequential(const void *ptr, size_t size) {
+  if (madvise((void *)ptr, size, MADV_SEQUENTIAL)) {
+    return 0;
+  }
+
+  /* start reading the file in right away */
+  return madvise((void *)ptr, size, MADV_WILLNEED) == 0;
+}
+
+static void *map_file_prot(const char *path, size_t *size, int prot) {
+  int handle = open(path, O_RDONLY);
+  if (handle == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(handle, &st) == -1 || !st.st_size) {
+    close(handle);
+    return NULL;
+  }
+
+  /* the mapping holds its own reference to the file */
+  void *ptr = mmap(NULL, st.st_size, prot, MAP_PRIVATE, handle, 0);
+  close(handle);
+
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+
+  *size = st.st_size;
+
+  return ptr;
+}
+
+const void *map_file(const char *path, size_t *size) {
+  return map_file_prot(path, size, PROT_READ);
+}
+
+void *map_file_private(const char *path, size_t *size) {
+  /* private writable mappings are copy-on-write */
+  return map_file_prot(path, size, PROT_READ | PROT_WRITE);
+}
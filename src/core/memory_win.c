@@ -7,6 +7,10 @@ static DWORD access_to_file_flags(enum page_access access) {
       return FILE_MAP_READ;
     case ACC_READWRITE:
       return FILE_MAP_READ | FILE_MAP_WRITE;
+    case ACC_READEXEC:
+      return FILE_MAP_READ | FILE_MAP_EXECUTE;
+    case ACC_READWRITEEXEC:
+      return FILE_MAP_READ | FILE_MAP_WRITE | FILE_MAP_EXECUTE;
     default:
       return 0;
   }
@@ -18,6 +22,8 @@ static DWORD access_to_protection_flags(enum page_access access) {
       return PAGE_READONLY;
     case ACC_READWRITE:
       return PAGE_READWRITE;
+    case ACC_READEXEC:
+      return PAGE_EXECUTE_READ;
     case ACC_READWRITEEXEC:
       return PAGE_EXECUTE_READWRITE;
     default:
@@ -46,12 +52,34 @@ void *reserve_pages(void *ptr, size_t size) {
   return res;
 }
 
+int commit_pages(void *ptr, size_t size, enum page_access access) {
+  DWORD protect = access_to_protection_flags(access);
+  return VirtualAlloc(ptr, size, MEM_COMMIT, protect) != NULL;
+}
+
 int protect_pages(void *ptr, size_t size, enum page_access access) {
   DWORD new_protect = access_to_protection_flags(access);
   DWORD old_protect;
   return VirtualProtect(ptr, size, new_protect, &old_protect) != 0;
 }
 
+int advise_huge_pages(void *ptr, size_t size) {
+  /* large pages can only be requested when a section is created, and can't be
+     mapped at the arbitrary offsets the address space mirrors require */
+  return 0;
+}
+
+int track_page_writes(void *ptr, size_t size) {
+  /* write watches can only be requested when memory is allocated, and not
+     for views of sections */
+  return 0;
+}
+
+int collect_page_writes(void *ptr, size_t size, uintptr_t *pages,
+                        int max_pages) {
+  return 0;
+}
+
 size_t get_allocation_granularity() {
   SYSTEM_INFO si;
   GetSystemInfo(&si);
@@ -98,3 +126,54 @@ shmem_handle_t create_shared_memory(const char *filename, size_t size,
   return CreateFileMapping(INVALID_HANDLE_VALUE, NULL, protect | SEC_RESERVE,
                            (DWORD)(size >> 32), (DWORD)(size), filename);
 }
+
+void unmap_file(const void *ptr, size_t size) {
+  UnmapViewOfFile(ptr);
+}
+
+int advise_sequential(const void *ptr, size_t size) {
+  /* views are read ahead of sequential accesses by default */
+  return 0;
+}
+
+static void *map_file_view(const char *path, size_t *size, DWORD protect,
+                           DWORD access) {
+  HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || !file_size.QuadPart) {
+    CloseHandle(file);
+    return NULL;
+  }
+
+  /* the view holds its own reference to the mapping and file */
+  HANDLE mapping = CreateFileMapping(file, NULL, protect, 0, 0, NULL);
+  CloseHandle(file);
+
+  if (!mapping) {
+    return NULL;
+  }
+
+  void *ptr = MapViewOfFile(mapping, access, 0, 0, 0);
+  CloseHandle(mapping);
+
+  if (!ptr) {
+    return NULL;
+  }
+
+  *size = (size_t)file_size.QuadPart;
+
+  return ptr;
+}
+
+const void *map_file(const char *path, size_t *size) {
+  return map_file_view(path, size, PAGE_READONLY, FILE_MAP_READ);
+}
+
+void *map_file_private(const char *path, size_t *size) {
+  return map_file_view(path, size, PAGE_WRITECOPY, FILE_MAP_COPY);
+}
@@ -61,6 +61,17 @@ static int options_ini_handler(void *user, const char *section,
   return 0;
 }
 
+static int options_override_handler(void *user, const char *section,
+                                    const char *name, const char *value) {
+  struct option *opt = options_find(name);
+
+  if (opt && !(opt->flags & OPTION_PERSIST)) {
+    options_parse_value(opt, value);
+  }
+
+  return 0;
+}
+
 static void options_print_help() {
   int max_name_width = 0;
   int max_desc_width = 0;
@@ -109,6 +120,32 @@ int options_read(const char *filename) {
   return ini_parse(filename, options_ini_handler, NULL) >= 0;
 }
 
+int options_read_overrides(const char *filename) {
+  return ini_parse(filename, options_override_handler, NULL) >= 0;
+}
+
+const char *option_get(const char *name) {
+  struct option *opt = options_find(name);
+
+  if (!opt) {
+    return NULL;
+  }
+
+  return options_format_value(opt);
+}
+
+int option_set(const char *name, const char *value) {
+  struct option *opt = options_find(name);
+
+  if (!opt) {
+    return 0;
+  }
+
+  options_parse_value(opt, value);
+
+  return 1;
+}
+
 int options_parse(int *argc, char ***argv) {
   int end = *argc;
 
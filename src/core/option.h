@@ -77,4 +77,13 @@ int options_parse(int *argc, char ***argv);
 int options_read(const char *filename);
 int options_write(const char *filename);
 
+/* reads options the same as options_read, but leaves those which are
+   persisted alone, for overrides to never be written back to the config */
+int options_read_overrides(const char *filename);
+
+/* sets or formats the value of an option by name, returning 0 / NULL if no
+   such option exists */
+int option_set(const char *name, const char *value);
+const char *option_get(const char *name);
+
 #endif
@@ -1,39 +1,297 @@
 #include "core/profiler.h"
+#include "core/atomic.h"
 #include "core/core.h"
+#include "core/thread.h"
 #include "core/time.h"
 
-#define PROFILER_MAX_COUNTERS 32
+#define PROFILER_MAX_COUNTERS 128
+#define PROFILER_MAX_ZONES 64
+#define PROFILER_MAX_THREADS 128
+#define PROFILER_MAX_DEPTH 32
 
+/* zones recorded per thread before the oldest are overwritten */
+#define PROFILER_MAX_EVENTS (1 << 16)
+
+/* counters are summed across each thread's own count of them, so threads
+   belonging to different emulator instances never contend on them. the
+   aggregated value of an aggregate counter is the amount its sum grew by over
+   the last second */
 struct counter {
+  char name[32];
   int aggregate;
-  int64_t value[2];
+  int64_t last_sum;
+  int64_t aggregated;
+};
+
+struct zone {
+  char name[32];
+};
+
+struct zone_event {
+  int64_t start;
+  int64_t end;
+  prof_token_t zone;
+};
+
+/* each thread's buffer is only written to by the thread itself. readers copy
+   events out from behind its head, and then discard any which may have been
+   overwritten while they were copying */
+struct zone_thread {
+  struct zone_event *events;
+  volatile uint32_t head;
+
+  /* zones entered but not yet left */
+  struct zone_event stack[PROFILER_MAX_DEPTH];
+  int depth;
+
+  int64_t counts[PROFILER_MAX_COUNTERS];
 };
 
 static struct {
   struct counter counters[PROFILER_MAX_COUNTERS];
   int num_counters;
 
+  struct zone zones[PROFILER_MAX_ZONES];
+  int num_zones;
+
+  struct zone_thread *threads[PROFILER_MAX_THREADS];
+  volatile uint32_t threads_ready[PROFILER_MAX_THREADS];
+  volatile uint32_t num_threads;
+
+  /* counts from threads beyond PROFILER_MAX_THREADS, which must be added to
+     atomically, and the values of counters which are set */
+  volatile int64_t shared_counts[PROFILER_MAX_COUNTERS];
+
   int64_t last_aggregation;
+
+  /* serializes registering tokens, which happens at runtime as each
+     instance's devices are created */
+  volatile uint32_t lock;
 } prof;
 
-prof_token_t prof_get_next_token() {
+static _Thread_local struct zone_thread *prof_thread;
+static _Thread_local int prof_thread_full;
+
+static struct zone_thread *prof_get_thread() {
+  if (prof_thread || prof_thread_full) {
+    return prof_thread;
+  }
+
+  uint32_t index = atomic_add32(&prof.num_threads, 1);
+
+  if (index >= PROFILER_MAX_THREADS) {
+    prof_thread_full = 1;
+    return NULL;
+  }
+
+  /* the event buffer is allocated on entering the first zone, as many threads
+     only ever update counters */
+  struct zone_thread *thread = calloc(1, sizeof(struct zone_thread));
+
+  prof.threads[index] = thread;
+  atomic_store32(&prof.threads_ready[index], 1);
+
+  prof_thread = thread;
+
+  return thread;
+}
+
+void prof_enter(prof_token_t zone) {
+  struct zone_thread *thread = prof_get_thread();
+
+  if (!thread) {
+    return;
+  }
+
+  if (!thread->events) {
+    thread->events = calloc(PROFILER_MAX_EVENTS, sizeof(struct zone_event));
+  }
+
+  /* zones nested too deep are dropped */
+  if (thread->depth < PROFILER_MAX_DEPTH) {
+    struct zone_event *entry = &thread->stack[thread->depth];
+    entry->zone = zone;
+    entry->start = time_nanoseconds();
+  }
+
+  thread->depth++;
+}
+
+void prof_leave(prof_token_t zone) {
+  struct zone_thread *thread = prof_thread;
+
+  if (!thread) {
+    return;
+  }
+
+  CHECK_GT(thread->depth, 0, "prof_leave without a matching prof_enter");
+  thread->depth--;
+
+  if (thread->depth >= PROFILER_MAX_DEPTH) {
+    return;
+  }
+
+  struct zone_event *entry = &thread->stack[thread->depth];
+  CHECK_EQ(entry->zone, zone, "prof_leave %s while in %s",
+           prof.zones[zone].name, prof.zones[entry->zone].name);
+
+  uint32_t head = thread->head;
+  struct zone_event *event = &thread->events[head % PROFILER_MAX_EVENTS];
+  event->start = entry->start;
+  event->end = time_nanoseconds();
+  event->zone = zone;
+  atomic_store32(&thread->head, head + 1);
+}
+
+static int prof_write_events(FILE *fp, int tid, struct zone_thread *thread,
+                             struct zone_event *events, int64_t since,
+                             int first) {
+  uint32_t head = atomic_load32(&thread->head);
+  uint32_t num_events = MIN(head, PROFILER_MAX_EVENTS);
+  uint32_t begin = head - num_events;
+
+  for (uint32_t i = 0; i < num_events; i++) {
+    events[i] = thread->events[(begin + i) % PROFILER_MAX_EVENTS];
+  }
+
+  /* anything the thread may have written over while copying is discarded */
+  uint32_t end = atomic_load32(&thread->head);
+  uint32_t skip = 0;
+  if (end - begin >= PROFILER_MAX_EVENTS) {
+    skip = MIN(end - begin - PROFILER_MAX_EVENTS + 1, num_events);
+  }
+
+  for (uint32_t i = skip; i < num_events; i++) {
+    struct zone_event *event = &events[i];
+
+    if (event->end < since) {
+      continue;
+    }
+
+    fprintf(fp,
+            "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f}",
+            first ? "" : ",", prof.zones[event->zone].name, tid,
+            event->start / 1000.0, (event->end - event->start) / 1000.0);
+    first = 0;
+  }
+
+  return first;
+}
+
+int prof_write_trace(const char *path, int64_t duration) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    return 0;
+  }
+
+  struct zone_event *events =
+      malloc(PROFILER_MAX_EVENTS * sizeof(struct zone_event));
+  int64_t since = time_nanoseconds() - duration;
+  int num_threads = (int)MIN(atomic_load32(&prof.num_threads),
+                             PROFILER_MAX_THREADS);
+  int first = 1;
+
+  fprintf(fp, "{\"traceEvents\":[");
+
+  for (int i = 0; i < num_threads; i++) {
+    if (!atomic_load32(&prof.threads_ready[i]) || !prof.threads[i]->events) {
+      continue;
+    }
+
+    fprintf(fp,
+            "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+            "\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+            first ? "" : ",", i, i);
+    first = 0;
+
+    first = prof_write_events(fp, i, prof.threads[i], events, since, first);
+  }
+
+  fprintf(fp, "\n]}\n");
+
+  free(events);
+  fclose(fp);
+
+  return 1;
+}
+
+static void prof_lock() {
+  while (!atomic_cas32(&prof.lock, 0, 1)) {
+  }
+}
+
+static void prof_unlock() {
+  atomic_store32(&prof.lock, 0);
+}
+
+prof_token_t prof_get_zone_token(const char *name) {
+  prof_lock();
+
+  /* zones are looked up by name, letting devices created again with each
+     machine share the same zone */
+  for (int i = 0; i < prof.num_zones; i++) {
+    if (!strcmp(prof.zones[i].name, name)) {
+      prof_unlock();
+      return i;
+    }
+  }
+
+  prof_token_t tok = prof.num_zones++;
+  CHECK_LT(tok, PROFILER_MAX_ZONES);
+  strncpy(prof.zones[tok].name, name, sizeof(prof.zones[tok].name) - 1);
+
+  prof_unlock();
+
+  return tok;
+}
+
+static prof_token_t prof_get_named_counter(const char *name, int aggregate) {
+  prof_lock();
+
+  /* counters are looked up by name as well, so each instance's devices count
+     into the same counters rather than exhausting them */
+  for (int i = 0; i < prof.num_counters; i++) {
+    struct counter *c = &prof.counters[i];
+
+    if (c->aggregate == aggregate && !strcmp(c->name, name)) {
+      prof_unlock();
+      return i;
+    }
+  }
+
   prof_token_t tok = prof.num_counters++;
   CHECK_LT(tok, PROFILER_MAX_COUNTERS);
+
+  struct counter *c = &prof.counters[tok];
+  strncpy(c->name, name, sizeof(c->name) - 1);
+  c->aggregate = aggregate;
+
+  prof_unlock();
+
   return tok;
 }
 
 prof_token_t prof_get_counter_token(const char *name) {
-  prof_token_t tok = prof_get_next_token();
-  struct counter *c = &prof.counters[tok];
-  c->aggregate = 0;
-  return tok;
+  return prof_get_named_counter(name, 0);
 }
 
 prof_token_t prof_get_aggregate_token(const char *name) {
-  prof_token_t tok = prof_get_next_token();
-  struct counter *c = &prof.counters[tok];
-  c->aggregate = 1;
-  return tok;
+  return prof_get_named_counter(name, 1);
+}
+
+static int64_t prof_counter_sum(prof_token_t tok) {
+  int num_threads =
+      (int)MIN(atomic_load32(&prof.num_threads), PROFILER_MAX_THREADS);
+  int64_t sum = prof.shared_counts[tok];
+
+  for (int i = 0; i < num_threads; i++) {
+    if (atomic_load32(&prof.threads_ready[i])) {
+      sum += prof.threads[i]->counts[tok];
+    }
+  }
+
+  return sum;
 }
 
 void prof_flip(int64_t now) {
@@ -41,12 +299,13 @@ void prof_flip(int64_t now) {
   int64_t next_aggregation = prof.last_aggregation + NS_PER_SEC;
 
   if (now > next_aggregation) {
-    for (int i = 0; i < PROFILER_MAX_COUNTERS; i++) {
+    for (int i = 0; i < prof.num_counters; i++) {
       struct counter *c = &prof.counters[i];
 
       if (c->aggregate) {
-        c->value[0] = c->value[1];
-        c->value[1] = 0;
+        int64_t sum = prof_counter_sum(i);
+        c->aggregated = sum - c->last_sum;
+        c->last_sum = sum;
       }
     }
 
@@ -54,22 +313,41 @@ void prof_flip(int64_t now) {
   }
 }
 
+void prof_write_counters(FILE *fp) {
+  for (int i = 0; i < prof.num_counters; i++) {
+    fprintf(fp, "%s\"%s\":%" PRId64, i ? "," : "", prof.counters[i].name,
+            prof_counter_load(i));
+  }
+}
+
 void prof_counter_set(prof_token_t tok, int64_t count) {
-  struct counter *c = &prof.counters[tok];
-  c->value[1] = count;
+  /* counters which are set hold a level rather than a count, e.g. the bytes
+     of textures resident, and are only ever set. the last value set by any
+     thread is kept, as a value left behind by a thread that's since exited
+     would be stale */
+  prof.shared_counts[tok] = count;
 }
 
 void prof_counter_add(prof_token_t tok, int64_t count) {
-  struct counter *c = &prof.counters[tok];
-  c->value[1] += count;
+  struct zone_thread *thread = prof_get_thread();
+
+  if (thread) {
+    thread->counts[tok] += count;
+  } else {
+    atomic_add64(&prof.shared_counts[tok], count);
+  }
+}
+
+int64_t prof_counter_total(prof_token_t tok) {
+  return prof_counter_sum(tok);
 }
 
 int64_t prof_counter_load(prof_token_t tok) {
   struct counter *c = &prof.counters[tok];
   if (c->aggregate) {
     /* return the last aggregated value */
-    return c->value[0];
+    return c->aggregated;
   } else {
-    return c->value[1];
+    return prof_counter_sum(tok);
   }
 }
@@ -2,6 +2,7 @@
 #define PROFILER_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include "core/constructor.h"
 #include "core/list.h"
 
@@ -22,14 +23,43 @@ typedef int prof_token_t;
     COUNTER_##name = prof_get_aggregate_token(#name); \
   }
 
+/* timing zones are recorded by each thread into its own ring buffer of the
+   most recent ones it left, which can be written out as a chrome trace. zones
+   may nest, but must be left on the thread they were entered on */
+#define DECLARE_ZONE(name) extern prof_token_t ZONE_##name;
+
+#define DEFINE_ZONE(name)                     \
+  prof_token_t ZONE_##name;                   \
+  CONSTRUCTOR(ZONE_REGISTER_##name) {         \
+    ZONE_##name = prof_get_zone_token(#name); \
+  }
+
+#define PROF_ENTER(name) prof_enter(ZONE_##name)
+#define PROF_LEAVE(name) prof_leave(ZONE_##name)
+
 prof_token_t prof_get_token(const char *group, const char *name);
 prof_token_t prof_get_counter_token(const char *name);
 prof_token_t prof_get_aggregate_token(const char *name);
+prof_token_t prof_get_zone_token(const char *name);
 
 int64_t prof_counter_load(prof_token_t tok);
+/* running total of a counter, aggregate or not, for measuring how much it
+   grew by over a span shorter than a second */
+int64_t prof_counter_total(prof_token_t tok);
 void prof_counter_add(prof_token_t tok, int64_t count);
 void prof_counter_set(prof_token_t tok, int64_t count);
 
+void prof_enter(prof_token_t zone);
+void prof_leave(prof_token_t zone);
+
+/* write out the zones left within the last duration nanoseconds as a chrome
+   trace, viewable through chrome://tracing or perfetto */
+int prof_write_trace(const char *path, int64_t duration);
+
+/* write out the current value of every counter as the members of a json
+   object, with aggregate counters being their count over the last second */
+void prof_write_counters(FILE *fp);
+
 void prof_flip(int64_t now);
 
 #endif
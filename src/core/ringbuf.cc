@@ -6,15 +6,49 @@ extern "C" {
 #include "core/ringbuf.h"
 }
 
-/* single producer, single consumer ring buffer implementation */
+#define RINGBUF_CACHE_LINE 64
+
+/* single producer, single consumer ring buffer implementation. each offset is
+   only ever stored to by one side, the producer owning write_offset and the
+   consumer owning read_offset. they're padded out onto separate cache lines,
+   so the two sides only contend on a line when one of them loads the other's
+   offset. the producer keeps its own copy of read_offset, refreshing it only
+   once the copy says there isn't enough room to reserve */
 struct ringbuf {
   shmem_handle_t shmem;
   int size;
   uint8_t *data;
-  std::atomic<int64_t> read_offset;
+
+  uint8_t pad0[RINGBUF_CACHE_LINE];
   std::atomic<int64_t> write_offset;
+  int64_t cached_read_offset;
+
+  uint8_t pad1[RINGBUF_CACHE_LINE];
+  std::atomic<int64_t> read_offset;
+
+  uint8_t pad2[RINGBUF_CACHE_LINE];
 };
 
+void ringbuf_commit(struct ringbuf *rb, int n) {
+  ringbuf_advance_write_ptr(rb, n);
+}
+
+void *ringbuf_reserve(struct ringbuf *rb, int n) {
+  int64_t write = rb->write_offset.load(std::memory_order_relaxed);
+
+  /* the copy of read_offset can only be behind, underestimating the room left,
+     so it's only refreshed when it comes up short */
+  if (rb->size - (int)(write - rb->cached_read_offset) < n) {
+    rb->cached_read_offset = rb->read_offset.load(std::memory_order_acquire);
+
+    if (rb->size - (int)(write - rb->cached_read_offset) < n) {
+      return NULL;
+    }
+  }
+
+  return rb->data + (write % rb->size);
+}
+
 void ringbuf_advance_write_ptr(struct ringbuf *rb, int n) {
   /* perform release to prevent the advance from occurring before the data is
      is written to the ring buffer, for example:
@@ -24,15 +58,28 @@ void ringbuf_advance_write_ptr(struct ringbuf *rb, int n) {
      ringbuf_advance_write_ptr(rb, size);
 
      without the release, the memcpy could be reordered to occur after the
-     advance, leaving the consumer to read garbage data */
-  rb->write_offset.fetch_add(n, std::memory_order_release);
+     advance, leaving the consumer to read garbage data. as the producer is
+     the only one storing to write_offset, a plain store is enough rather
+     than a read-modify-write */
+  int64_t write = rb->write_offset.load(std::memory_order_relaxed);
+  rb->write_offset.store(write + n, std::memory_order_release);
   DCHECK(ringbuf_remaining(rb) >= 0);
 }
 
+void ringbuf_retreat_write_ptr(struct ringbuf *rb, int n) {
+  /* takes back data most recently written, letting the buffer be used as a
+     stack from the write side. this races with the consumer reading the same
+     data, so it's only valid when the producer is also the consumer, or the
+     two are otherwise synchronized */
+  int64_t write = rb->write_offset.load(std::memory_order_relaxed);
+  rb->write_offset.store(write - n, std::memory_order_release);
+  DCHECK(ringbuf_available(rb) >= 0);
+}
+
 void *ringbuf_write_ptr(struct ringbuf *rb) {
   /* relaxed ordering is fine here as there is only a single thread writing to
      write_offset  */
-  int64_t write_offset = rb->write_offset.load();
+  int64_t write_offset = rb->write_offset.load(std::memory_order_relaxed);
   return rb->data + (write_offset % rb->size);
 }
 
@@ -47,14 +94,15 @@ void ringbuf_advance_read_ptr(struct ringbuf *rb, int n) {
      without the release, the advance could be reordered to occur before the
      memcpy, at which point the producer could start writing over data that's
      not yet been read */
-  rb->read_offset.fetch_add(n, std::memory_order_release);
+  int64_t read = rb->read_offset.load(std::memory_order_relaxed);
+  rb->read_offset.store(read + n, std::memory_order_release);
   DCHECK(ringbuf_remaining(rb) >= 0);
 }
 
 void *ringbuf_read_ptr(struct ringbuf *rb) {
   /* relaxed ordering is fine here as there is only a single thread writing to
      read_offset */
-  int64_t read_offset = rb->read_offset.load();
+  int64_t read_offset = rb->read_offset.load(std::memory_order_relaxed);
   return rb->data + (read_offset % rb->size);
 }
 
@@ -63,16 +111,18 @@ int ringbuf_remaining(struct ringbuf *rb) {
 }
 
 int ringbuf_available(struct ringbuf *rb) {
-  /* it should be safe to perform both of these loads with relaxed ordering as
-     both offsets only advance forward
-
-     in the case that the producer reads an old value for read_offset, it'd
-     think there was less room to write data than there actually is
-
-     in the case that the consumer reads an old value for the write_offset, it'd
-     think there was less data to be read than there actually is */
-  int64_t read = rb->read_offset.load();
-  int64_t write = rb->write_offset.load();
+  /* both offsets only advance forward, so a stale value of the other side's
+     offset errs on the safe side. in the case that the producer reads an old
+     value for read_offset, it'd think there was less room to write data than
+     there actually is. in the case that the consumer reads an old value for
+     write_offset, it'd think there was less data to be read than there
+     actually is
+
+     the loads are acquires to pair with the releases in the advances, making
+     sure the consumer sees the data written before write_offset was advanced,
+     and that the producer doesn't write over data before it's been read */
+  int64_t read = rb->read_offset.load(std::memory_order_acquire);
+  int64_t write = rb->write_offset.load(std::memory_order_acquire);
   int available = (int)(write - read);
   DCHECK(available >= 0 && available <= rb->size);
   return available;
@@ -15,5 +15,12 @@ void ringbuf_advance_read_ptr(struct ringbuf *rb, int n);
 
 void *ringbuf_write_ptr(struct ringbuf *rb);
 void ringbuf_advance_write_ptr(struct ringbuf *rb, int n);
+void ringbuf_retreat_write_ptr(struct ringbuf *rb, int n);
+
+/* returns a contiguous region of n bytes to produce directly into, or NULL if
+   there isn't room for it. the region is published to the consumer by
+   committing the bytes actually written */
+void *ringbuf_reserve(struct ringbuf *rb, int n);
+void ringbuf_commit(struct ringbuf *rb, int n);
 
 #endif
@@ -0,0 +1,45 @@
+#include "core/sampler.h"
+#include "core/atomic.h"
+#include "core/core.h"
+
+/* the buffer is written to from the timer's signal handler and read from
+   the sampled thread itself, so it has to hold the samples taken in between
+   the reads */
+#define SAMPLER_MAX_SAMPLES 8192
+
+static struct {
+  uintptr_t pcs[SAMPLER_MAX_SAMPLES];
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  volatile uint32_t dropped;
+} sampler;
+
+void sampler_record(uintptr_t pc) {
+  uint32_t head = sampler.head;
+
+  if (head - atomic_load32(&sampler.tail) >= SAMPLER_MAX_SAMPLES) {
+    atomic_add32(&sampler.dropped, 1);
+    return;
+  }
+
+  sampler.pcs[head % SAMPLER_MAX_SAMPLES] = pc;
+  atomic_store32(&sampler.head, head + 1);
+}
+
+int sampler_dropped() {
+  return (int)atomic_load32(&sampler.dropped);
+}
+
+int sampler_read(uintptr_t *pcs, int max) {
+  uint32_t tail = sampler.tail;
+  uint32_t head = atomic_load32(&sampler.head);
+  int n = (int)MIN(head - tail, (uint32_t)max);
+
+  for (int i = 0; i < n; i++) {
+    pcs[i] = sampler.pcs[(tail + i) % SAMPLER_MAX_SAMPLES];
+  }
+
+  atomic_store32(&sampler.tail, tail + n);
+
+  return n;
+}
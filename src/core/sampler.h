@@ -0,0 +1,33 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+/*
+ * sampling profiler
+ *
+ * installs a timer which periodically interrupts the thread that started it,
+ * recording the host pc it was interrupted at. the samples are buffered until
+ * they're read back by the same thread
+ */
+
+/* max rate the thread can be sampled at, in samples per second */
+#define SAMPLER_MAX_RATE 10000
+
+int sampler_start(int rate);
+void sampler_stop();
+
+/* moves up to max of the buffered samples into pcs, returning how many were
+   moved */
+int sampler_read(uintptr_t *pcs, int max);
+
+/* number of samples dropped due to the buffer being full */
+int sampler_dropped();
+
+/* describes the host function containing pc, if it can be found */
+int sampler_symbolize(uintptr_t pc, char *name, int size);
+
+/* called by the platform implementations on each sample */
+void sampler_record(uintptr_t pc);
+
+#endif
@@ -0,0 +1,160 @@
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/sampler.h"
+#include "core/time.h"
+
+#if PLATFORM_DARWIN
+#include <sys/ucontext.h>
+#else
+#include <sys/syscall.h>
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+static int installed;
+static int running;
+static pthread_t sampled_thread;
+
+#if !PLATFORM_DARWIN
+static timer_t timer;
+#endif
+
+static void signal_handler(int signo, siginfo_t *info, void *ctx) {
+  ucontext_t *uctx = ctx;
+
+#if PLATFORM_DARWIN
+  /* the interval timer is process wide, with the signal being delivered to
+     whichever thread happens to be running */
+  if (!pthread_equal(pthread_self(), sampled_thread)) {
+    return;
+  }
+#if ARCH_A64
+  sampler_record((uintptr_t)uctx->uc_mcontext->__ss.__pc);
+#elif ARCH_X64
+  sampler_record((uintptr_t)uctx->uc_mcontext->__ss.__rip);
+#endif
+#else
+#if ARCH_A64
+  sampler_record((uintptr_t)uctx->uc_mcontext.pc);
+#elif ARCH_X64
+  sampler_record((uintptr_t)uctx->uc_mcontext.gregs[REG_RIP]);
+#endif
+#endif
+}
+
+static int sampler_install() {
+  /* the handler is left installed once the timer is stopped, as a signal
+     already raised by it may still be pending for the thread */
+  if (installed) {
+    return 1;
+  }
+
+  struct sigaction new_sa;
+  new_sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&new_sa.sa_mask);
+  new_sa.sa_sigaction = &signal_handler;
+
+  if (sigaction(SIGPROF, &new_sa, NULL) != 0) {
+    return 0;
+  }
+
+  installed = 1;
+
+  return 1;
+}
+
+int sampler_start(int rate) {
+  if (running || !sampler_install()) {
+    return 0;
+  }
+
+  int64_t interval = NS_PER_SEC / CLAMP(rate, 1, SAMPLER_MAX_RATE);
+  sampled_thread = pthread_self();
+
+#if PLATFORM_DARWIN
+  struct itimerval spec = {0};
+  spec.it_interval.tv_sec = (time_t)(interval / NS_PER_SEC);
+  spec.it_interval.tv_usec = (suseconds_t)((interval % NS_PER_SEC) / 1000);
+  spec.it_value = spec.it_interval;
+
+  if (setitimer(ITIMER_PROF, &spec, NULL) != 0) {
+    return 0;
+  }
+#else
+  /* the timer runs off of the thread's own cpu time, and signals only it */
+  clockid_t clock;
+  if (pthread_getcpuclockid(sampled_thread, &clock) != 0) {
+    return 0;
+  }
+
+  struct sigevent sev = {0};
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+
+  if (timer_create(clock, &sev, &timer) != 0) {
+    return 0;
+  }
+
+  struct itimerspec spec = {0};
+  spec.it_interval.tv_sec = (time_t)(interval / NS_PER_SEC);
+  spec.it_interval.tv_nsec = (long)(interval % NS_PER_SEC);
+  spec.it_value = spec.it_interval;
+
+  if (timer_settime(timer, 0, &spec, NULL) != 0) {
+    timer_delete(timer);
+    return 0;
+  }
+#endif
+
+  running = 1;
+
+  return 1;
+}
+
+void sampler_stop() {
+  if (!running) {
+    return;
+  }
+
+#if PLATFORM_DARWIN
+  struct itimerval spec = {0};
+  setitimer(ITIMER_PROF, &spec, NULL);
+#else
+  timer_delete(timer);
+#endif
+
+  running = 0;
+}
+
+int sampler_symbolize(uintptr_t pc, char *name, int size) {
+  Dl_info info;
+
+  if (!dladdr((void *)pc, &info)) {
+    return 0;
+  }
+
+  if (info.dli_sname) {
+    snprintf(name, size, "%s", info.dli_sname);
+    return 1;
+  }
+
+  /* symbols local to the module aren't exported, fall back to the pc's
+     offset inside of it */
+  if (info.dli_fname) {
+    char base[PATH_MAX];
+    fs_basename(info.dli_fname, base, sizeof(base));
+    snprintf(name, size, "%s+0x%" PRIxPTR, base,
+             pc - (uintptr_t)info.dli_fbase);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,74 @@
+#include <windows.h>
+#include "core/core.h"
+#include "core/sampler.h"
+
+/* there are no timer signals on windows, instead a separate thread
+   periodically suspends the sampled thread to read its pc */
+static HANDLE sampled_thread;
+static HANDLE sampling_thread;
+static volatile LONG running;
+static DWORD interval_ms;
+
+static DWORD WINAPI sampler_thread(LPVOID data) {
+  while (running) {
+    Sleep(interval_ms);
+
+    if (SuspendThread(sampled_thread) == (DWORD)-1) {
+      continue;
+    }
+
+    CONTEXT ctx;
+    ctx.ContextFlags = CONTEXT_CONTROL;
+
+    if (GetThreadContext(sampled_thread, &ctx)) {
+      sampler_record((uintptr_t)ctx.Rip);
+    }
+
+    ResumeThread(sampled_thread);
+  }
+
+  return 0;
+}
+
+int sampler_start(int rate) {
+  if (running) {
+    return 0;
+  }
+
+  /* sleeps are at a millisecond granularity at best */
+  interval_ms = MAX(1000 / CLAMP(rate, 1, SAMPLER_MAX_RATE), 1);
+
+  if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+                       GetCurrentProcess(), &sampled_thread,
+                       THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, 0)) {
+    return 0;
+  }
+
+  running = 1;
+
+  sampling_thread = CreateThread(NULL, 0, &sampler_thread, NULL, 0, NULL);
+  if (!sampling_thread) {
+    running = 0;
+    CloseHandle(sampled_thread);
+    return 0;
+  }
+
+  return 1;
+}
+
+void sampler_stop() {
+  if (!running) {
+    return;
+  }
+
+  running = 0;
+
+  WaitForSingleObject(sampling_thread, INFINITE);
+  CloseHandle(sampling_thread);
+  CloseHandle(sampled_thread);
+}
+
+int sampler_symbolize(uintptr_t pc, char *name, int size) {
+  /* resolving symbols requires dbghelp, leave it to the report's reader */
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+#include "core/slab.h"
+#include "core/core.h"
+
+struct slab_chunk {
+  struct slab_chunk *next;
+  uint8_t data[];
+};
+
+void slab_reset(struct slab *slab) {
+  slab->curr = slab->head;
+  slab->next = 0;
+  slab->free_list = NULL;
+  slab->num_objs = 0;
+}
+
+void slab_free(struct slab *slab, void *ptr) {
+  *(void **)ptr = slab->free_list;
+  slab->free_list = ptr;
+  slab->num_objs--;
+}
+
+void *slab_alloc(struct slab *slab) {
+  void *ptr = slab->free_list;
+
+  if (ptr) {
+    slab->free_list = *(void **)ptr;
+  } else {
+    /* move on to the next chunk once this one is used up, allocating a new
+       one only if the slab has never grown this large before */
+    if (!slab->curr || slab->next == slab->objs_per_chunk) {
+      struct slab_chunk *chunk = slab->curr ? slab->curr->next : slab->head;
+
+      if (!chunk) {
+        chunk = malloc(sizeof(struct slab_chunk) +
+                       (size_t)slab->obj_size * slab->objs_per_chunk);
+        CHECK_NOTNULL(chunk);
+        chunk->next = NULL;
+
+        if (slab->tail) {
+          slab->tail->next = chunk;
+        } else {
+          slab->head = chunk;
+        }
+        slab->tail = chunk;
+      }
+
+      slab->curr = chunk;
+      slab->next = 0;
+    }
+
+    ptr = slab->curr->data + (size_t)slab->obj_size * slab->next++;
+  }
+
+  slab->num_objs++;
+
+  memset(ptr, 0, slab->obj_size);
+
+  return ptr;
+}
+
+void slab_destroy(struct slab *slab) {
+  struct slab_chunk *chunk = slab->head;
+
+  while (chunk) {
+    struct slab_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  memset(slab, 0, sizeof(*slab));
+}
+
+void slab_init(struct slab *slab, int obj_size, int chunk_size) {
+  memset(slab, 0, sizeof(*slab));
+
+  /* objects double as free list nodes, and are kept pointer aligned */
+  slab->obj_size = ALIGN_UP(MAX(obj_size, (int)sizeof(void *)),
+                            (int)sizeof(void *));
+  slab->objs_per_chunk = MAX(chunk_size / slab->obj_size, 1);
+}
@@ -0,0 +1,37 @@
+#ifndef REDREAM_SLAB_H
+#define REDREAM_SLAB_H
+
+/*
+ * allocator for objects of a single size
+ *
+ * objects are carved out of large chunks in order, with freed objects kept on
+ * a free list to be handed out again first. chunks are never returned to the
+ * system until the slab is destroyed, resetting the slab just rewinds it to the
+ * start of its first chunk, freeing every object at once in constant time
+ */
+struct slab_chunk;
+
+struct slab {
+  int obj_size;
+  int objs_per_chunk;
+
+  struct slab_chunk *head;
+  struct slab_chunk *tail;
+
+  /* chunk objects are being carved from, and the offset of the next one */
+  struct slab_chunk *curr;
+  int next;
+
+  void *free_list;
+  int num_objs;
+};
+
+void slab_init(struct slab *slab, int obj_size, int chunk_size);
+void slab_destroy(struct slab *slab);
+
+/* returns a zero-initialized object */
+void *slab_alloc(struct slab *slab);
+void slab_free(struct slab *slab, void *ptr);
+void slab_reset(struct slab *slab);
+
+#endif
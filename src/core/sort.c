@@ -39,6 +39,57 @@ void msort_noalloc(void *data, void *tmp, int num, size_t size, sort_cmp cmp) {
   msort_r(tmp, data, size, 0, num, cmp);
 }
 
+void rsort_noalloc(uint64_t *data, uint64_t *tmp, int num) {
+  int counts[4][256] = {0};
+
+  if (num < 2) {
+    return;
+  }
+
+  /* build the histograms for each digit of the key in a single pass */
+  for (int i = 0; i < num; i++) {
+    uint32_t key = (uint32_t)(data[i] >> 32);
+    counts[0][key & 0xff]++;
+    counts[1][(key >> 8) & 0xff]++;
+    counts[2][(key >> 16) & 0xff]++;
+    counts[3][key >> 24]++;
+  }
+
+  uint64_t *src = data;
+  uint64_t *dst = tmp;
+
+  for (int pass = 0; pass < 4; pass++) {
+    int shift = 32 + pass * 8;
+    int *count = counts[pass];
+
+    /* skip digits shared by every key, depths of a scene commonly sharing at
+       least their exponent */
+    if (count[(src[0] >> shift) & 0xff] == num) {
+      continue;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < 256; i++) {
+      int n = count[i];
+      count[i] = offset;
+      offset += n;
+    }
+
+    for (int i = 0; i < num; i++) {
+      uint64_t v = src[i];
+      dst[count[(v >> shift) & 0xff]++] = v;
+    }
+
+    uint64_t *swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != data) {
+    memcpy(data, src, num * sizeof(uint64_t));
+  }
+}
+
 void msort(void *data, int num, size_t size, sort_cmp cmp) {
   void *tmp = malloc(num * size);
   msort_noalloc(data, tmp, num, size, cmp);
@@ -2,6 +2,7 @@
 #define SORT_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* returns if a is <= b */
 typedef int (*sort_cmp)(const void *, const void *);
@@ -10,4 +11,22 @@ typedef int (*sort_cmp)(const void *, const void *);
 void msort_noalloc(void *data, void *tmp, int num, size_t size, sort_cmp cmp);
 void msort(void *data, int num, size_t size, sort_cmp cmp);
 
+/* stable lsd radix sort of 64-bit elements, ordered by the unsigned key in
+   their upper 32 bits. the key is carried along with the rest of the element,
+   so no comparisons or lookups are made while sorting */
+void rsort_noalloc(uint64_t *data, uint64_t *tmp, int num);
+
+/* maps a float to a key with the same ordering when compared as unsigned */
+static inline uint32_t rsort_float_key(float f) {
+  union {
+    float f;
+    uint32_t u;
+  } v;
+
+  /* -0.0 and 0.0 compare equal, and need to map to the same key */
+  v.f = f == 0.0f ? 0.0f : f;
+
+  return (v.u & 0x80000000) ? ~v.u : (v.u | 0x80000000);
+}
+
 #endif
@@ -1,15 +1,40 @@
 #ifndef THREAD_H
 #define THREAD_H
 
+#include <stdint.h>
+
 /*
  * threads
  */
 typedef void *thread_t;
 typedef void *(*thread_fn)(void *);
 
+/* the name is optional, and shows up in debuggers and profilers */
 thread_t thread_create(thread_fn fn, const char *name, void *data);
 void thread_join(thread_t thread, void **result);
 
+/*
+ * scheduling, each of these applies to the calling thread and returns 0 if
+ * the host doesn't support or permit it
+ */
+enum thread_priority {
+  /* work that can wait, e.g. i/o or background compilation */
+  PRIORITY_BACKGROUND,
+  PRIORITY_NORMAL,
+  /* latency sensitive work */
+  PRIORITY_HIGH,
+  /* work with a hard deadline, e.g. filling the audio device's buffer. this
+     usually requires elevated privileges */
+  PRIORITY_REALTIME,
+};
+
+int thread_set_name(const char *name);
+
+/* restricts the thread to the cpus whose bits are set in the mask */
+int thread_set_affinity(uint64_t mask);
+
+int thread_set_priority(enum thread_priority priority);
+
 /*
  * synchronization
  */
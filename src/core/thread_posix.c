@@ -1,18 +1,53 @@
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <time.h>
 #include "core/core.h"
 #include "core/thread.h"
 
+#if PLATFORM_DARWIN
+#include <pthread/qos.h>
+#endif
+
+/* linux truncates thread names to 15 characters */
+#define MAX_THREAD_NAME 16
+
+struct thread_start {
+  thread_fn fn;
+  void *data;
+  char name[MAX_THREAD_NAME];
+};
+
+static void *thread_thunk(void *data) {
+  struct thread_start start = *(struct thread_start *)data;
+  free(data);
+
+  if (start.name[0]) {
+    thread_set_name(start.name);
+  }
+
+  return start.fn(start.data);
+}
+
 static void thread_destroy(pthread_t *pthread) {
   free(pthread);
 }
 
 thread_t thread_create(thread_fn fn, const char *name, void *data) {
   pthread_t *pthread = calloc(1, sizeof(pthread_t));
+  struct thread_start *start = calloc(1, sizeof(struct thread_start));
+
+  start->fn = fn;
+  start->data = data;
+  if (name) {
+    strncpy(start->name, name, sizeof(start->name) - 1);
+  }
 
-  if (pthread_create(pthread, NULL, fn, data)) {
+  if (pthread_create(pthread, NULL, &thread_thunk, start)) {
+    free(start);
     thread_destroy(pthread);
     return NULL;
   }
@@ -28,6 +63,64 @@ void thread_join(thread_t thread, void **result) {
   thread_destroy(pthread);
 }
 
+int thread_set_name(const char *name) {
+#if PLATFORM_DARWIN
+  return pthread_setname_np(name) == 0;
+#else
+  char truncated[MAX_THREAD_NAME];
+  strncpy(truncated, name, sizeof(truncated) - 1);
+  truncated[sizeof(truncated) - 1] = 0;
+  return pthread_setname_np(pthread_self(), truncated) == 0;
+#endif
+}
+
+int thread_set_affinity(uint64_t mask) {
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  for (int i = 0; i < 64; i++) {
+    if (mask & ((uint64_t)1 << i)) {
+      CPU_SET(i, &set);
+    }
+  }
+
+  /* a pid of 0 applies to the calling thread only */
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  /* darwin only supports affinity tags, which are hints that aren't honored
+     on all hardware */
+  return 0;
+#endif
+}
+
+int thread_set_priority(enum thread_priority priority) {
+#if PLATFORM_DARWIN
+  /* the scheduler is driven by quality of service classes */
+  static const qos_class_t classes[] = {
+      QOS_CLASS_UTILITY, QOS_CLASS_DEFAULT, QOS_CLASS_USER_INITIATED,
+      QOS_CLASS_USER_INTERACTIVE,
+  };
+  return pthread_set_qos_class_self_np(classes[priority], 0) == 0;
+#else
+  if (priority == PRIORITY_REALTIME) {
+    struct sched_param param = {0};
+    param.sched_priority = sched_get_priority_min(SCHED_RR);
+
+    if (pthread_setschedparam(pthread_self(), SCHED_RR, &param) == 0) {
+      return 1;
+    }
+
+    /* without the privileges for a realtime policy, settle for the highest
+       nice value allowed */
+  }
+
+  /* on linux, each thread has its own nice value */
+  static const int nice_values[] = {10, 0, -5, -10};
+  return setpriority(PRIO_PROCESS, 0, nice_values[priority]) == 0;
+#endif
+}
+
 mutex_t mutex_create() {
   pthread_mutex_t *pmutex = calloc(1, sizeof(pthread_mutex_t));
 
@@ -96,7 +189,11 @@ int cond_timedwait(cond_t cond, mutex_t mutex, int ms) {
   struct timespec wait;
   clock_gettime(CLOCK_REALTIME, &wait);
   wait.tv_sec += ms / 1000;
-  wait.tv_nsec += ms % 1000;
+  wait.tv_nsec += (ms % 1000) * 1000000;
+  if (wait.tv_nsec >= 1000000000) {
+    wait.tv_sec++;
+    wait.tv_nsec -= 1000000000;
+  }
 
   int res = pthread_cond_timedwait(pcond, pmutex, &wait);
   if (res == 0) {
@@ -1,17 +1,25 @@
 #include <stdlib.h>
+#include <string.h>
 #include <windows.h>
 #include "core/core.h"
 #include "core/thread.h"
 
+#define MAX_THREAD_NAME 64
+
 struct thread_wrapper {
   thread_fn fn;
   void *data;
+  char name[MAX_THREAD_NAME];
   HANDLE handle;
 };
 
 static DWORD thread_thunk(LPVOID data) {
   struct thread_wrapper *wrapper = data;
 
+  if (wrapper->name[0]) {
+    thread_set_name(wrapper->name);
+  }
+
   return (DWORD)(intptr_t)wrapper->fn(wrapper->data);
 }
 
@@ -24,6 +32,9 @@ thread_t thread_create(thread_fn fn, const char *name, void *data) {
 
   wrapper->fn = fn;
   wrapper->data = data;
+  if (name) {
+    strncpy(wrapper->name, name, sizeof(wrapper->name) - 1);
+  }
   wrapper->handle = CreateThread(NULL, 0, &thread_thunk, wrapper, 0, NULL);
 
   if (!wrapper->handle) {
@@ -42,6 +53,46 @@ void thread_join(thread_t thread, void **result) {
   thread_destroy(wrapper);
 }
 
+int thread_set_name(const char *name) {
+  /* SetThreadDescription is only available on windows 10 1607 and later */
+  typedef HRESULT(WINAPI * set_thread_description_fn)(HANDLE, PCWSTR);
+  set_thread_description_fn set_thread_description =
+      (set_thread_description_fn)GetProcAddress(
+          GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+
+  if (!set_thread_description) {
+    return 0;
+  }
+
+  WCHAR wname[MAX_THREAD_NAME];
+  if (!MultiByteToWideChar(CP_UTF8, 0, name, -1, wname, MAX_THREAD_NAME)) {
+    return 0;
+  }
+
+  return SUCCEEDED(set_thread_description(GetCurrentThread(), wname));
+}
+
+int thread_set_affinity(uint64_t mask) {
+  return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0;
+}
+
+int thread_set_priority(enum thread_priority priority) {
+  HANDLE thread = GetCurrentThread();
+
+  /* background mode also lowers the thread's i/o and memory priority */
+  if (priority == PRIORITY_BACKGROUND) {
+    return SetThreadPriority(thread, THREAD_MODE_BACKGROUND_BEGIN) != 0;
+  }
+
+  SetThreadPriority(thread, THREAD_MODE_BACKGROUND_END);
+
+  static const int priorities[] = {
+      THREAD_PRIORITY_LOWEST, THREAD_PRIORITY_NORMAL,
+      THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_TIME_CRITICAL,
+  };
+  return SetThreadPriority(thread, priorities[priority]) != 0;
+}
+
 mutex_t mutex_create() {
   CRITICAL_SECTION *wmutex = calloc(1, sizeof(CRITICAL_SECTION));
 
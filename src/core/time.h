@@ -9,4 +9,26 @@
 
 int64_t time_nanoseconds();
 
+/* sleeps for at least ns nanoseconds, though the os may oversleep by as much
+   as its scheduling granularity */
+void time_sleep(int64_t ns);
+
+/* cheap timestamp counter for timing short intervals. the rate it ticks at is
+   unspecified, so intervals must be calibrated against time_nanoseconds */
+#if ARCH_X64
+#if COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+static inline uint64_t time_ticks() {
+  return __rdtsc();
+}
+#else
+static inline uint64_t time_ticks() {
+  return (uint64_t)time_nanoseconds();
+}
+#endif
+
 #endif
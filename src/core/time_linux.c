@@ -6,3 +6,13 @@ int64_t time_nanoseconds() {
   clock_gettime(CLOCK_MONOTONIC, &tp);
   return (int64_t)tp.tv_sec * NS_PER_SEC + (int64_t)tp.tv_nsec;
 }
+
+void time_sleep(int64_t ns) {
+  struct timespec req;
+  req.tv_sec = (time_t)(ns / NS_PER_SEC);
+  req.tv_nsec = (long)(ns % NS_PER_SEC);
+
+  /* resume the sleep when interrupted by a signal */
+  while (nanosleep(&req, &req) == -1) {
+  }
+}
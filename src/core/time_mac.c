@@ -1,5 +1,6 @@
 #include <mach/mach.h>
 #include <mach/mach_time.h>
+#include <time.h>
 #include "core/core.h"
 #include "core/time.h"
 
@@ -14,3 +15,13 @@ int64_t time_nanoseconds() {
 
   return (int64_t)(result * timebase_info.numer / timebase_info.denom);
 }
+
+void time_sleep(int64_t ns) {
+  struct timespec req;
+  req.tv_sec = (time_t)(ns / NS_PER_SEC);
+  req.tv_nsec = (long)(ns % NS_PER_SEC);
+
+  /* resume the sleep when interrupted by a signal */
+  while (nanosleep(&req, &req) == -1) {
+  }
+}
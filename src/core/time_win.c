@@ -16,3 +16,8 @@ int64_t time_nanoseconds() {
 
   return (int64_t)((double)counter.QuadPart / scale);
 }
+
+void time_sleep(int64_t ns) {
+  /* sleeps are at a millisecond granularity at best */
+  Sleep((DWORD)((ns + NS_PER_MS - 1) / NS_PER_MS));
+}
@@ -12,9 +12,13 @@
  */
 
 #include "emulator.h"
+#include "core/exception_handler.h"
+#include "core/hash.h"
+#include "core/hash_map.h"
 #include "core/memory.h"
 #include "core/thread.h"
 #include "core/time.h"
+#include "file/capture.h"
 #include "file/trace.h"
 #include "guest/aica/aica.h"
 #include "guest/arm7/arm7.h"
@@ -23,14 +27,18 @@
 #include "guest/gdrom/gdrom.h"
 #include "guest/holly/holly.h"
 #include "guest/maple/maple.h"
+#include "guest/movie.h"
 #include "guest/pvr/pvr.h"
 #include "guest/pvr/ta.h"
 #include "guest/pvr/tr.h"
+#include "guest/reg_stats.h"
+#include "guest/rewind.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 #include "host/host.h"
 #include "imgui.h"
 #include "options.h"
+#include "profile.h"
 #include "render/render_backend.h"
 #include "stats.h"
 
@@ -55,6 +63,40 @@ enum {
   EMU_SOURCE_PXL,
 };
 
+/* converted contexts queued up between the emulation and video threads when
+   pipelined, enough for one being presented, one ready and one being
+   converted */
+#define EMU_MAX_FRAMES 3
+
+/* frames the emulation thread is allowed to have requested ahead of it, the
+   one being ran and one more */
+#define EMU_MAX_PENDING 2
+
+/* textures used within this many frames are never evicted, as they may still
+   be referenced by a converted frame waiting to be presented */
+#define EMU_TEXTURE_MIN_AGE 60
+
+/* textures are evicted once fewer than this many are free, keeping the pool
+   from running dry */
+#define EMU_TEXTURE_RESERVE 1024
+
+/* increments the resolution scale is adjusted in to meet the gpu budget */
+#define EMU_SCALE_STEP 0.25f
+
+enum {
+  EMU_FRAME_FREE,
+  EMU_FRAME_READY,
+  EMU_FRAME_SHOWN,
+};
+
+struct emu_frame {
+  int state;
+  unsigned seq;
+  struct tr_context rc;
+  /* key of the context converted into rc */
+  uint64_t key;
+};
+
 struct emu_framebuffer {
   uint8_t data[PVR_FRAMEBUFFER_SIZE];
   int width;
@@ -65,17 +107,29 @@ struct emu_texture {
   struct tr_texture;
   struct emu *emu;
   struct list_node free_it;
-  struct rb_node live_it;
+  struct list_node lru_it;
+
+  /* hash of the source data last accounted for as resident */
+  uint64_t resident_hash;
 
   struct memory_watch *texture_watch;
   struct memory_watch *palette_watch;
   struct list_node modified_it;
   int modified;
+
+  /* with precise watches, set when a write faulted inside of the texture's
+     source. otherwise, the write only hit the same page, and the source is
+     compared against its hash from when the watches were added */
+  int written;
+  uint64_t source_hash;
 };
 
+DEFINE_HASH_MAP(emu_texture_map, tr_texture_key_t, struct emu_texture *);
+
 struct emu {
   struct host *host;
   struct render_backend *r;
+  struct tr_converter *cvt;
 
   struct dreamcast *dc;
   int aspect_ratio;
@@ -100,17 +154,96 @@ struct emu {
   volatile int vid_disabled;
   volatile int vid_source;
   struct tr_context vid_rc;
+  uint64_t vid_key;
   struct emu_framebuffer vid_fb;
 
   /* latest context submitted to emu_start_render */
   struct ta_context *pending_ctx;
 
+  /* static scenes resubmit identical contexts each frame. each context is
+     keyed by a hash of everything its conversion depends on, and converting
+     is skipped when the target tr_context already holds the same key. the
+     generation is bumped whenever a texture is dirtied, allocated or evicted,
+     as the handles in a previous conversion may then be stale */
+  uint64_t pending_key;
+  uint64_t texture_gen;
+
+  /* when pipelined, the emulation thread runs each requested frame without the
+     video thread waiting on it. submitted contexts are converted into a small
+     queue, which the video thread presents from at its own pace, dropping or
+     repeating frames depending on the sync policy. this state is protected by
+     res_mutex */
+  int pipelined;
+  int frames_pending;
+  struct emu_frame *frames;
+
+  /* when running ahead, each frame requested is first ran for real, then the
+     machine is snapshotted and ran ahead a number of frames to present the
+     output the guest will produce that many frames later. the frames ran
+     ahead are then rolled back, hiding their latency to input. only the
+     video of the last frame ran ahead is converted, and only the audio of
+     the real frame is pushed */
+  int run_ahead;
+  struct snapshot *snapshot;
+  int hide_video;
+  int mute_audio;
+  int hidden_ended;
+  int ahead_converted;
+
+  /* the machine is periodically captured into the rewind buffer. while
+     rewinding, each frame steps back to an older capture, running a single
+     frame from it to present */
+  struct rewind *rewind;
+  volatile int rewinding;
+
+  /* while recording a movie, input is only applied at the start of each
+     frame, through the movie */
+  struct movie *movie;
+
+  /* with late latching, input events are held on to until the guest reads
+     the controllers, the emulation thread applying each button's latest
+     value right before its maple dma runs */
+  mutex_t input_mutex;
+  int16_t input[MAPLE_NUM_PORTS][K_CONT_RTRIG - K_CONT_C + 1];
+  uint32_t input_dirty[MAPLE_NUM_PORTS];
+
+  /* while fast-forwarding, the video of all but every Nth frame is hidden,
+     skipping its conversion and texture uploads, and all audio is dropped */
+  volatile int fast_forward;
+
+  /* when the video thread's conversion and rendering of a frame runs over the
+     frame's budget, the next frames are ran with their video hidden, keeping
+     emulated time at real-time pace while fewer frames are presented */
+  int64_t video_ns;
+  int frames_to_skip;
+
+  /* multiple of the native resolution contexts are rendered at, lowered from
+     the configured scale while the gpu runs over its budget. it's revisited
+     once a second, as often as the gpu timings are aggregated */
+  float render_scale;
+  int64_t render_scale_time;
+
+  /* timings of the last frame for the host's stats. the emulation time is
+     written by the emulation thread, the others by the video thread */
+  volatile int64_t emulate_ns;
+  volatile int64_t compile_ns;
+  int64_t convert_ns;
+  int64_t decode_ns;
+  int64_t render_ns;
+
   /* texture cache. the dreamcast interface calls into us when new contexts are
      available to be rendered. parsing the contexts, uploading their textures to
      the render backend, and managing the texture cache is our responsibility */
   struct emu_texture textures[8192];
   struct list free_textures;
-  struct rb_tree live_textures;
+  struct emu_texture_map live_textures;
+
+  /* live textures ordered from least to most recently registered. textures
+     not used in a while, or past the budget, are evicted by the emulation
+     thread, and their handles released by the video thread the next time it
+     converts a context */
+  struct list lru_textures;
+  struct list evicted_textures;
 
   /* textures for the current context are uploaded to the render backend by the
      video thread in parallel to the emulation thread executing. normally, this
@@ -124,60 +257,103 @@ struct emu {
 
   /* debugging */
   struct trace_writer *trace_writer;
+  struct capture *capture;
+  int gpu_timings;
 };
 
 /*
  * texture cache
  */
-static int emu_texture_cmp(const struct rb_node *rb_lhs,
-                           const struct rb_node *rb_rhs) {
-  const struct emu_texture *lhs =
-      rb_entry(rb_lhs, const struct emu_texture, live_it);
-  tr_texture_key_t lhs_key = tr_texture_key(lhs->tsp, lhs->tcw);
-
-  const struct emu_texture *rhs =
-      rb_entry(rb_rhs, const struct emu_texture, live_it);
-  tr_texture_key_t rhs_key = tr_texture_key(rhs->tsp, rhs->tcw);
-
-  if (lhs_key < rhs_key) {
-    return -1;
-  } else if (lhs_key > rhs_key) {
-    return 1;
-  } else {
-    return 0;
+static void emu_dirty_textures(struct emu *emu) {
+  LOG_INFO("emu_dirty_textures");
+
+  hash_map_for_each(i, &emu->live_textures, emu_texture_map) {
+    struct emu_texture *tex = *hash_map_value(&emu->live_textures, i);
+    tex->dirty = 1;
   }
+
+  emu->texture_gen++;
 }
 
-static struct rb_callbacks emu_texture_cb = {&emu_texture_cmp, NULL, NULL};
+static uint64_t emu_texture_source_hash(struct emu_texture *tex) {
+  uint64_t hash = hash_bytes(tex->texture, tex->texture_size, 0);
+  if (tex->palette && !tr_texture_indexed(tex->tcw)) {
+    hash = hash_bytes(tex->palette, tex->palette_size, hash);
+  }
+  return hash;
+}
 
-static void emu_dirty_textures(struct emu *emu) {
-  LOG_INFO("emu_dirty_textures");
+static void emu_texture_modified(const struct exception_state *ex, void *data);
+static void emu_palette_modified(const struct exception_state *ex, void *data);
+
+static struct memory_watch *emu_add_texture_watch(const void *ptr, int size,
+                                                  memory_watch_cb cb,
+                                                  struct emu_texture *tex) {
+  /* writes only need to be known about by the next time textures are
+     registered, letting the host track them without raising a fault for each
+     written page */
+  if (OPTION_deferred_texture_watches) {
+    return add_deferred_write_watch(ptr, size, cb, tex);
+  }
 
-  struct rb_node *it = rb_first(&emu->live_textures);
+  return add_single_write_watch(ptr, size, cb, tex);
+}
 
-  while (it) {
-    struct rb_node *next = rb_next(it);
-    struct emu_texture *tex = rb_entry(it, struct emu_texture, live_it);
+static void emu_watch_texture(struct emu *emu, struct emu_texture *tex) {
+#ifdef NDEBUG
+  /* add write callback in order to invalidate on future writes. the callback
+     address will be page aligned, therefore it will be triggered falsely in
+     some cases. over invalidate in these cases, unless watches are precise */
+  int armed = 0;
 
-    tex->dirty = 1;
+  if (!tex->texture_watch) {
+    tex->texture_watch = emu_add_texture_watch(
+        tex->texture, tex->texture_size, &emu_texture_modified, tex);
+    armed = 1;
+  }
 
-    it = next;
+  /* indexed textures have their palette copied each frame instead */
+  if (tex->palette && !tex->palette_watch && !tr_texture_indexed(tex->tcw)) {
+    tex->palette_watch = emu_add_texture_watch(
+        tex->palette, tex->palette_size, &emu_palette_modified, tex);
+    armed = 1;
   }
+
+  if (armed && OPTION_precise_texture_watches) {
+    tex->source_hash = emu_texture_source_hash(tex);
+  }
+#endif
 }
 
 static void emu_dirty_modified_textures(struct emu *emu) {
   list_for_each_entry(tex, &emu->modified_textures, struct emu_texture,
                       modified_it) {
-    tex->dirty = 1;
+    /* writes to the rest of the page went unwatched once the page faulted,
+       the source has to be checked for any that hit it since */
+    if (!OPTION_precise_texture_watches || tex->written ||
+        emu_texture_source_hash(tex) != tex->source_hash) {
+      tex->dirty = 1;
+      emu->texture_gen++;
+    } else {
+      emu_watch_texture(emu, tex);
+    }
+
     tex->modified = 0;
+    tex->written = 0;
   }
 
   list_clear(&emu->modified_textures);
 }
 
-static void emu_texture_modified(const struct exception_state *ex, void *data) {
-  struct emu_texture *tex = data;
-  tex->texture_watch = NULL;
+static void emu_source_modified(struct emu_texture *tex,
+                                const struct exception_state *ex,
+                                const uint8_t *src, int size) {
+  uintptr_t begin = (uintptr_t)src;
+  uintptr_t end = begin + size;
+
+  if (ex->fault_addr >= begin && ex->fault_addr < end) {
+    tex->written = 1;
+  }
 
   if (!tex->modified) {
     list_add(&tex->emu->modified_textures, &tex->modified_it);
@@ -185,19 +361,25 @@ static void emu_texture_modified(const struct exception_state *ex, void *data) {
   }
 }
 
+static void emu_texture_modified(const struct exception_state *ex, void *data) {
+  struct emu_texture *tex = data;
+  tex->texture_watch = NULL;
+
+  emu_source_modified(tex, ex, tex->texture, tex->texture_size);
+}
+
 static void emu_palette_modified(const struct exception_state *ex, void *data) {
   struct emu_texture *tex = data;
   tex->palette_watch = NULL;
 
-  if (!tex->modified) {
-    list_add(&tex->emu->modified_textures, &tex->modified_it);
-    tex->modified = 1;
-  }
+  emu_source_modified(tex, ex, tex->palette, tex->palette_size);
 }
 
 static void emu_free_texture(struct emu *emu, struct emu_texture *tex) {
-  /* remove from live tree */
-  rb_unlink(&emu->live_textures, &tex->live_it, &emu_texture_cb);
+  /* remove from live map */
+  emu_texture_map_remove(&emu->live_textures,
+                         tr_texture_key(tex->tsp, tex->tcw));
+  list_remove(&emu->lru_textures, &tex->lru_it);
 
   /* add back to free list */
   list_add(&emu->free_textures, &tex->free_it);
@@ -217,24 +399,110 @@ static struct emu_texture *emu_alloc_texture(struct emu *emu, union tsp tsp,
   tex->tsp = tsp;
   tex->tcw = tcw;
 
-  /* add to live tree */
-  rb_insert(&emu->live_textures, &tex->live_it, &emu_texture_cb);
+  /* add to live map */
+  emu_texture_map_insert(&emu->live_textures, tr_texture_key(tsp, tcw), tex);
+  list_add(&emu->lru_textures, &tex->lru_it);
 
   return tex;
 }
 
+static int emu_texture_size(const struct emu_texture *tex) {
+  if (!tex->handle) {
+    return 0;
+  }
+
+  /* textures are converted to at most 32-bits per texel, with mipmaps adding
+     another third */
+  int size = tex->width * tex->height * 4;
+  return ta_texture_mipmaps(tex->tcw) ? size + size / 3 : size;
+}
+
+static void emu_evict_texture(struct emu *emu, struct emu_texture *tex) {
+  if (tex->texture_watch) {
+    remove_memory_watch(tex->texture_watch);
+    tex->texture_watch = NULL;
+  }
+
+  if (tex->palette_watch) {
+    remove_memory_watch(tex->palette_watch);
+    tex->palette_watch = NULL;
+  }
+
+  if (tex->modified) {
+    list_remove(&emu->modified_textures, &tex->modified_it);
+    tex->modified = 0;
+    tex->written = 0;
+  }
+
+  emu_texture_map_remove(&emu->live_textures,
+                         tr_texture_key(tex->tsp, tex->tcw));
+  list_remove(&emu->lru_textures, &tex->lru_it);
+
+  list_add(&emu->evicted_textures, &tex->free_it);
+
+  prof_counter_add(COUNTER_texture_evictions, 1);
+}
+
+static void emu_evict_textures(struct emu *emu) {
+  int64_t budget = (int64_t)OPTION_texture_budget * 1024 * 1024;
+  int max_live = ARRAY_SIZE(emu->textures) - EMU_TEXTURE_RESERVE;
+  int64_t resident = 0;
+
+  /* the video thread isn't converting, the handles and sizes it left behind
+     for each texture are safe to read */
+  list_for_each_entry(tex, &emu->lru_textures, struct emu_texture, lru_it) {
+    resident += emu_texture_size(tex);
+
+    if (tex->handle && tex->hash != tex->resident_hash) {
+      if (tex->resident_hash) {
+        prof_counter_add(COUNTER_texture_reuploads, 1);
+      }
+      tex->resident_hash = tex->hash;
+    }
+  }
+
+  list_for_each_entry_safe(tex, &emu->lru_textures, struct emu_texture,
+                           lru_it) {
+    unsigned age = emu->frame - tex->frame;
+
+    /* textures past this point have each been used more recently */
+    if (age < EMU_TEXTURE_MIN_AGE) {
+      break;
+    }
+
+    int expired =
+        OPTION_texture_max_age && age > (unsigned)OPTION_texture_max_age;
+    int over_budget = OPTION_texture_budget && resident > budget;
+    int pool_low = emu->live_textures.num_entries > max_live;
+
+    if (!expired && !over_budget && !pool_low) {
+      break;
+    }
+
+    resident -= emu_texture_size(tex);
+    emu_evict_texture(emu, tex);
+    emu->texture_gen++;
+  }
+
+  prof_counter_set(COUNTER_texture_bytes, resident);
+}
+
+static void emu_release_evicted_textures(struct emu *emu) {
+  list_for_each_entry_safe(tex, &emu->evicted_textures, struct emu_texture,
+                           free_it) {
+    list_remove(&emu->evicted_textures, &tex->free_it);
+    tr_release_texture(emu->cvt, emu->r, (struct tr_texture *)tex);
+    list_add(&emu->free_textures, &tex->free_it);
+  }
+}
+
 static struct tr_texture *emu_find_texture(void *userdata, union tsp tsp,
                                            union tcw tcw) {
   struct emu *emu = userdata;
 
-  struct emu_texture search;
-  search.tsp = tsp;
-  search.tcw = tcw;
-
-  struct emu_texture *tex =
-      rb_find_entry(&emu->live_textures, &search, struct emu_texture, live_it,
-                    &emu_texture_cb);
-  return (struct tr_texture *)tex;
+  struct emu_texture **tex =
+      emu_texture_map_get(&emu->live_textures, tr_texture_key(tsp, tcw));
+  return tex ? (struct tr_texture *)*tex : NULL;
 }
 
 static void emu_register_texture_source(struct emu *emu, union tsp tsp,
@@ -245,12 +513,19 @@ static void emu_register_texture_source(struct emu *emu, union tsp tsp,
   if (!entry) {
     entry = emu_alloc_texture(emu, tsp, tcw);
     entry->dirty = 1;
+    emu->texture_gen++;
   }
 
   /* mark texture source valid for the current pending frame */
   int first_registration_this_frame = entry->frame != emu->frame;
   entry->frame = emu->frame;
 
+  /* move to the most recently used end of the lru */
+  if (first_registration_this_frame) {
+    list_remove(&emu->lru_textures, &entry->lru_it);
+    list_add(&emu->lru_textures, &entry->lru_it);
+  }
+
   /* set texture address */
   if (!entry->texture || !entry->palette) {
     ta_texture_info(emu->dc->ta, tsp, tcw, &entry->texture,
@@ -258,20 +533,7 @@ static void emu_register_texture_source(struct emu *emu, union tsp tsp,
                     &entry->palette_size);
   }
 
-#ifdef NDEBUG
-  /* add write callback in order to invalidate on future writes. the callback
-     address will be page aligned, therefore it will be triggered falsely in
-     some cases. over invalidate in these cases */
-  if (!entry->texture_watch) {
-    entry->texture_watch = add_single_write_watch(
-        entry->texture, entry->texture_size, &emu_texture_modified, entry);
-  }
-
-  if (entry->palette && !entry->palette_watch) {
-    entry->palette_watch = add_single_write_watch(
-        entry->palette, entry->palette_size, &emu_palette_modified, entry);
-  }
-#endif
+  emu_watch_texture(emu, entry);
 
   if (emu->trace_writer && entry->dirty && first_registration_this_frame) {
     trace_writer_insert_texture(emu->trace_writer, tsp, tcw, entry->frame,
@@ -313,6 +575,25 @@ static void emu_register_texture_sources(struct emu *emu,
   }
 }
 
+static uint64_t emu_context_key(struct emu *emu, struct ta_context *ctx) {
+  struct pvr *pvr = emu->dc->pvr;
+  int state[] = {ctx->autosort,     ctx->stride,       ctx->palette_fmt,
+                 ctx->video_width,  ctx->video_height, ctx->alpha_ref,
+                 ctx->bg_isp.full,  ctx->bg_tsp.full,  ctx->bg_tcw.full,
+                 ctx->shadow_intensity, ctx->shadow_scale, OPTION_oit};
+
+  uint64_t key = hash_bytes(state, sizeof(state), emu->texture_gen);
+  key = hash_bytes(&ctx->bg_depth, sizeof(ctx->bg_depth), key);
+  key = hash_bytes(ctx->bg_vertices, sizeof(ctx->bg_vertices), key);
+  key = hash_bytes(ctx->params, ctx->size, key);
+
+  /* indexed textures copy their palette into the context when converted */
+  key = hash_bytes(pvr->PALETTE_RAM000, PALETTE_NUM_ENTRIES * 4, key);
+
+  /* zero is reserved for a tr_context holding no conversion */
+  return key ? key : 1;
+}
+
 /*
  * trace recording
  */
@@ -349,12 +630,95 @@ static void emu_start_tracing(struct emu *emu) {
   LOG_INFO("begin tracing to %s", filename);
 }
 
+/*
+ * audio / video capture
+ */
+/* hands each frame the gpu has finished reading back over to the capture,
+   waiting on the rest when flushing */
+static void emu_capture_readbacks(struct emu *emu, int flush) {
+  const uint8_t *pixels;
+  int width, height;
+
+  while ((pixels = r_map_readback(emu->r, flush, &width, &height))) {
+    capture_push_video(emu->capture, pixels, width, height);
+    r_unmap_readback(emu->r);
+  }
+}
+
+/* frames are read back a few frames behind the one being rendered, so the
+   video thread never waits on the gpu to finish them */
+static void emu_capture_frame(struct emu *emu) {
+  if (!capture_active(emu->capture)) {
+    return;
+  }
+
+  emu_capture_readbacks(emu, 0);
+
+  if (!r_queue_readback(emu->r)) {
+    capture_skip_video(emu->capture);
+  }
+}
+
+static void emu_stop_capture(struct emu *emu) {
+  if (!capture_active(emu->capture)) {
+    return;
+  }
+
+  if (emu->r) {
+    emu_capture_readbacks(emu, 1);
+  }
+
+  capture_stop(emu->capture);
+}
+
+static void emu_start_capture(struct emu *emu) {
+  capture_start(emu->capture);
+}
+
 /*
  * dreamcast guest interface
  */
+static void emu_input(struct emu *emu, int port, int button, int16_t value) {
+  if (emu->movie) {
+    movie_input(emu->movie, port, button, value);
+  } else {
+    dc_input(emu->dc, port, button, value);
+  }
+}
+
+static void emu_poll_input(void *userdata) {
+  struct emu *emu = userdata;
+
+  if (!OPTION_input_late_latch) {
+    return;
+  }
+
+  input_poll(emu->host);
+
+  mutex_lock(emu->input_mutex);
+
+  for (int port = 0; port < MAPLE_NUM_PORTS; port++) {
+    uint32_t dirty = emu->input_dirty[port];
+
+    while (dirty) {
+      int button = ctz32(dirty);
+      emu_input(emu, port, button, emu->input[port][button]);
+      dirty &= ~(1u << button);
+    }
+
+    emu->input_dirty[port] = 0;
+  }
+
+  mutex_unlock(emu->input_mutex);
+}
+
 static void emu_vblank_in(void *userdata, int vid_disabled) {
   struct emu *emu = userdata;
 
+  if (emu->hide_video) {
+    return;
+  }
+
   if (emu->multi_threaded) {
     mutex_lock(emu->res_mutex);
   }
@@ -371,7 +735,20 @@ static void emu_vblank_in(void *userdata, int vid_disabled) {
 static void emu_vblank_out(void *userdata) {
   struct emu *emu = userdata;
 
-  emu->state = EMU_ENDFRAME;
+  if (emu->hide_video) {
+    emu->hidden_ended = 1;
+  } else if (emu->run_ahead && emu->multi_threaded) {
+    /* the video thread waits for the frame ran ahead to end */
+    mutex_lock(emu->res_mutex);
+    emu->state = EMU_ENDFRAME;
+    cond_signal(emu->res_cond);
+    mutex_unlock(emu->res_mutex);
+  } else {
+    emu->state = EMU_ENDFRAME;
+  }
+
+  /* return from dc_tick without running out the rest of the step */
+  dc_break(emu->dc);
 }
 
 static void emu_finish_render(void *userdata) {
@@ -384,6 +761,15 @@ static void emu_finish_render(void *userdata) {
        the yet-to-be-uploaded texture memory */
     mutex_lock(emu->res_mutex);
 
+    /* with video sync, a pipelined video thread is given the chance to convert
+       the context instead of dropping it. it may be busy presenting the
+       previous frame at this point, unlike in lockstep where it's waiting */
+    if (emu->pipelined && video_sync_enabled()) {
+      while (emu->pending_ctx) {
+        cond_wait(emu->res_cond, emu->res_mutex);
+      }
+    }
+
     /* if pending_ctx is non-NULL here, a frame is being skipped */
     emu->pending_ctx = NULL;
     cond_signal(emu->res_cond);
@@ -395,21 +781,33 @@ static void emu_finish_render(void *userdata) {
 static void emu_start_render(void *userdata, struct ta_context *ctx) {
   struct emu *emu = userdata;
 
+  if (emu->hide_video) {
+    return;
+  }
+
   /* incement internal frame number. this frame number is assigned to the each
      texture source registered to assert synchronization between the emulator
      and video thread is working as expected */
   emu->frame++;
 
   /* now that the video thread is sure to not be accessing the texture data,
-     mark any textures dirty that were invalidated by a memory watch */
+     mark any textures dirty that were invalidated by a memory watch. deferred
+     watches report the writes made since the last frame at this point */
+  poll_memory_watches();
   emu_dirty_modified_textures(emu);
 
+  /* evict textures before registering this context's, making room for any
+     new ones */
+  emu_evict_textures(emu);
+
   /* register the source of each texture referenced by the context with the
      tile renderer. note, uploading the texture to the render backend happens
      lazily while converting the context. this registration just lets the
      backend know where the texture's source data is */
   emu_register_texture_sources(emu, ctx);
 
+  uint64_t key = emu_context_key(emu, ctx);
+
   if (emu->trace_writer) {
     trace_writer_render_context(emu->trace_writer, ctx);
   }
@@ -419,18 +817,30 @@ static void emu_start_render(void *userdata, struct ta_context *ctx) {
     mutex_lock(emu->res_mutex);
 
     emu->pending_ctx = ctx;
+    emu->pending_key = key;
     cond_signal(emu->res_cond);
 
     mutex_unlock(emu->res_mutex);
   } else {
     emu->pending_ctx = ctx;
+    emu->pending_key = key;
+  }
+}
+
+static uint32_t *emu_map_pixels(void *userdata, int w, int h) {
+  struct emu *emu = userdata;
+
+  if (emu->hide_video || w * h * 4 > (int)sizeof(emu->vid_fb.data)) {
+    return NULL;
   }
+
+  return (uint32_t *)emu->vid_fb.data;
 }
 
-static void emu_push_pixels(void *userdata, const uint8_t *data, int w, int h) {
+static void emu_push_pixels(void *userdata, int w, int h) {
   struct emu *emu = userdata;
 
-  memcpy(emu->vid_fb.data, data, w * h * 4);
+  /* the pixels were written straight into the framebuffer as 32-bit rgbx */
   emu->vid_fb.width = w;
   emu->vid_fb.height = h;
 
@@ -439,6 +849,12 @@ static void emu_push_pixels(void *userdata, const uint8_t *data, int w, int h) {
 
 static void emu_push_audio(void *userdata, const int16_t *data, int frames) {
   struct emu *emu = userdata;
+
+  if (emu->mute_audio) {
+    return;
+  }
+
+  capture_push_audio(emu->capture, data, frames);
   audio_push(emu->host, data, frames);
 }
 
@@ -470,10 +886,46 @@ static void emu_set_aspect_ratio(struct emu *emu, const char *new_ratio) {
  * frame running logic
  */
 static void emu_run_until_vblank(struct emu *emu);
+static void emu_run_frame(struct emu *emu);
+
+static void emu_run_pipelined(struct emu *emu) {
+  mutex_lock(emu->res_mutex);
+
+  while (1) {
+    while (emu->state != EMU_SHUTDOWN && !emu->frames_pending) {
+      cond_wait(emu->res_cond, emu->res_mutex);
+    }
+
+    if (emu->state == EMU_SHUTDOWN) {
+      break;
+    }
+
+    /* let the video thread request more frames and convert contexts while
+       this one runs */
+    mutex_unlock(emu->res_mutex);
+
+    emu_run_frame(emu);
+
+    mutex_lock(emu->res_mutex);
+
+    emu->state = EMU_WAITING;
+    emu->frames_pending--;
+    cond_signal(emu->res_cond);
+  }
+
+  mutex_unlock(emu->res_mutex);
+}
 
 static void *emu_run_thread(void *data) {
   struct emu *emu = data;
 
+  apply_thread_options(ROLE_EMULATION);
+
+  if (emu->pipelined) {
+    emu_run_pipelined(emu);
+    return NULL;
+  }
+
   while (1) {
     /* wait for video thread to request a frame to be ran */
     mutex_lock(emu->req_mutex);
@@ -487,7 +939,7 @@ static void *emu_run_thread(void *data) {
       break;
     }
 
-    emu_run_until_vblank(emu);
+    emu_run_frame(emu);
 
     emu->state = EMU_WAITING;
 
@@ -498,7 +950,26 @@ static void *emu_run_thread(void *data) {
 }
 
 static void emu_run_until_vblank(struct emu *emu) {
-  const int64_t MACHINE_STEP = HZ_TO_NANO(1000);
+  /* the scheduler already runs devices up to each timer on its own, there's
+     no need to tick the machine at a finer granularity than a frame. the tick
+     is broken off early once the frame ends at vblank out */
+  const int64_t MACHINE_STEP = HZ_TO_NANO(60);
+
+  if (emu->movie) {
+    movie_begin_frame(emu->movie, emu->dc);
+  }
+
+  /* frames whose video is hidden don't advance the state the video thread is
+     waiting on */
+  if (emu->hide_video) {
+    emu->hidden_ended = 0;
+
+    while (!emu->hidden_ended) {
+      dc_tick(emu->dc, MACHINE_STEP);
+    }
+
+    return;
+  }
 
   emu->state = EMU_RUNFRAME;
 
@@ -507,9 +978,392 @@ static void emu_run_until_vblank(struct emu *emu) {
   }
 }
 
+/* converts the context, adding the time spent to the frame's conversion and
+   decode times, and returns the time spent */
+static int64_t emu_convert_context(struct emu *emu, struct ta_context *ctx,
+                                   struct tr_context *rc) {
+  struct tr_stats before, after;
+  tr_converter_stats(emu->cvt, &before);
+
+  int64_t start = time_nanoseconds();
+  tr_convert_context(emu->cvt, emu->r, emu, &emu_find_texture, ctx, rc);
+  int64_t elapsed = time_nanoseconds() - start;
+
+  tr_converter_stats(emu->cvt, &after);
+
+  emu->convert_ns += elapsed;
+  emu->decode_ns += after.decode_ns - before.decode_ns;
+
+  return elapsed;
+}
+
+static void emu_convert_pending(struct emu *emu) {
+  if (!emu->pending_ctx) {
+    return;
+  }
+
+  emu_release_evicted_textures(emu);
+
+  if (emu->vid_key != emu->pending_key) {
+    emu->video_ns += emu_convert_context(emu, emu->pending_ctx, &emu->vid_rc);
+    emu->vid_key = emu->pending_key;
+  }
+
+  emu->pending_ctx = NULL;
+
+  emu->vid_source = EMU_SOURCE_CTX;
+}
+
+static void emu_wait_ahead_converted(struct emu *emu) {
+  /* the context submitted by the frame ran ahead has to be converted before
+     its state is rolled back */
+  if (emu->multi_threaded) {
+    mutex_lock(emu->res_mutex);
+
+    while (!emu->ahead_converted) {
+      cond_wait(emu->res_cond, emu->res_mutex);
+    }
+    emu->ahead_converted = 0;
+
+    mutex_unlock(emu->res_mutex);
+  } else {
+    emu_convert_pending(emu);
+  }
+}
+
+static void emu_run_rewind(struct emu *emu) {
+  rewind_step(emu->rewind);
+
+  emu->mute_audio = 1;
+  emu_run_until_vblank(emu);
+  emu->mute_audio = 0;
+
+  /* the video thread waits on the frame the same as if it were ran ahead */
+  if (emu->run_ahead) {
+    emu_wait_ahead_converted(emu);
+  }
+}
+
+static void emu_run_fast_forward(struct emu *emu) {
+  emu->mute_audio = 1;
+  emu->hide_video = 1;
+
+  for (int i = 1; i < OPTION_fast_forward_skip; i++) {
+    emu_run_until_vblank(emu);
+
+    if (emu->rewind) {
+      rewind_end_frame(emu->rewind);
+    }
+  }
+
+  emu->hide_video = 0;
+  emu_run_until_vblank(emu);
+
+  if (emu->run_ahead) {
+    emu_wait_ahead_converted(emu);
+  }
+
+  emu->mute_audio = 0;
+
+  if (emu->rewind) {
+    rewind_end_frame(emu->rewind);
+  }
+}
+
+static void emu_skip_frames(struct emu *emu) {
+  emu->hide_video = 1;
+
+  for (int i = 0; i < emu->frames_to_skip; i++) {
+    emu_run_until_vblank(emu);
+    prof_counter_add(COUNTER_frames_skipped, 1);
+
+    if (emu->rewind) {
+      rewind_end_frame(emu->rewind);
+    }
+  }
+
+  emu->hide_video = 0;
+}
+
+static void emu_step_frame(struct emu *emu) {
+  if (emu->rewind && emu->rewinding) {
+    emu_run_rewind(emu);
+    return;
+  }
+
+  if (emu->fast_forward) {
+    emu_run_fast_forward(emu);
+    return;
+  }
+
+  emu_skip_frames(emu);
+
+  if (!emu->run_ahead) {
+    emu_run_until_vblank(emu);
+
+    if (emu->rewind) {
+      rewind_end_frame(emu->rewind);
+    }
+    return;
+  }
+
+  if (!emu->snapshot) {
+    emu->snapshot = dc_create_snapshot(emu->dc);
+  }
+
+  /* run the frame the latest input applies to for real. its video is
+     superseded by the frame ran ahead */
+  emu->hide_video = 1;
+  emu_run_until_vblank(emu);
+
+  dc_save_snapshot(emu->dc, emu->snapshot);
+
+  emu->mute_audio = 1;
+
+  for (int i = 1; i < emu->run_ahead; i++) {
+    emu_run_until_vblank(emu);
+  }
+
+  emu->hide_video = 0;
+  emu_run_until_vblank(emu);
+
+  emu_wait_ahead_converted(emu);
+
+  dc_load_snapshot(emu->dc, emu->snapshot);
+
+  emu->mute_audio = 0;
+
+  if (emu->rewind) {
+    rewind_end_frame(emu->rewind);
+  }
+}
+
+static void emu_run_frame(struct emu *emu) {
+  int64_t start = time_nanoseconds();
+  int64_t compile_start = prof_counter_total(COUNTER_jit_compile_ns);
+  emu_step_frame(emu);
+  emu->compile_ns = prof_counter_total(COUNTER_jit_compile_ns) - compile_start;
+  emu->emulate_ns = time_nanoseconds() - start;
+}
+
+static struct emu_frame *emu_alloc_frame(struct emu *emu) {
+  struct emu_frame *oldest = NULL;
+
+  for (int i = 0; i < EMU_MAX_FRAMES; i++) {
+    struct emu_frame *frame = &emu->frames[i];
+
+    if (frame->state == EMU_FRAME_FREE) {
+      return frame;
+    }
+
+    if (frame->state == EMU_FRAME_READY &&
+        (!oldest || (int)(frame->seq - oldest->seq) < 0)) {
+      oldest = frame;
+    }
+  }
+
+  /* the queue is full, drop the oldest frame which hasn't been presented */
+  CHECK_NOTNULL(oldest);
+  return oldest;
+}
+
+static void emu_queue_context(struct emu *emu) {
+  if (!emu->pending_ctx) {
+    return;
+  }
+
+  emu_release_evicted_textures(emu);
+
+  struct emu_frame *frame = emu_alloc_frame(emu);
+
+  /* frames are recycled in order, so a static scene finds its own context
+     already converted into the frame it was last queued in */
+  if (frame->key != emu->pending_key) {
+    emu_convert_context(emu, emu->pending_ctx, &frame->rc);
+    frame->key = emu->pending_key;
+  }
+  frame->state = EMU_FRAME_READY;
+  frame->seq = emu->frame;
+  emu->pending_ctx = NULL;
+
+  emu->vid_source = EMU_SOURCE_CTX;
+
+  /* wake up the emulation thread if it's waiting on the conversion */
+  cond_signal(emu->res_cond);
+}
+
+static struct emu_frame *emu_next_frame(struct emu *emu, int vsync) {
+  /* with video sync, every frame is presented in order. otherwise, the most
+     recent frame is presented and any older ones are dropped */
+  struct emu_frame *next = NULL;
+  struct emu_frame *shown = NULL;
+
+  for (int i = 0; i < EMU_MAX_FRAMES; i++) {
+    struct emu_frame *frame = &emu->frames[i];
+
+    if (frame->state == EMU_FRAME_SHOWN) {
+      shown = frame;
+    } else if (frame->state == EMU_FRAME_READY) {
+      int older = next && (int)(frame->seq - next->seq) < 0;
+
+      if (!next || older == vsync) {
+        next = frame;
+      }
+    }
+  }
+
+  /* repeat the last frame if a new one isn't ready yet */
+  if (!next) {
+    return shown;
+  }
+
+  for (int i = 0; i < EMU_MAX_FRAMES; i++) {
+    struct emu_frame *frame = &emu->frames[i];
+
+    if (frame->state == EMU_FRAME_SHOWN ||
+        (!vsync && frame->state == EMU_FRAME_READY)) {
+      frame->state = EMU_FRAME_FREE;
+    }
+  }
+
+  next->state = EMU_FRAME_SHOWN;
+
+  return next;
+}
+
+static void emu_drain_frames(struct emu *emu) {
+  /* wait for the emulation thread to run every frame requested of it,
+     converting any contexts it submits along the way */
+  mutex_lock(emu->res_mutex);
+
+  while (emu->frames_pending) {
+    if (emu->pending_ctx) {
+      emu_queue_context(emu);
+      continue;
+    }
+
+    cond_wait(emu->res_cond, emu->res_mutex);
+  }
+
+  mutex_unlock(emu->res_mutex);
+}
+
+static void emu_update_render_scale(struct emu *emu) {
+  float max_scale = (float)OPTION_resolution_scale;
+
+  if (!OPTION_resolution_budget || !emu->render_scale) {
+    emu->render_scale = max_scale;
+    return;
+  }
+
+  int64_t now = time_nanoseconds();
+  if (now - emu->render_scale_time < NS_PER_SEC) {
+    return;
+  }
+  emu->render_scale_time = now;
+
+  int64_t frames = prof_counter_load(COUNTER_frames);
+  int64_t ta_ns = prof_counter_load(COUNTER_gpu_opaque_ns) +
+                  prof_counter_load(COUNTER_gpu_punch_through_ns) +
+                  prof_counter_load(COUNTER_gpu_translucent_ns);
+
+  /* nothing was timed, e.g. the backend doesn't support timer queries */
+  if (!frames || !ta_ns) {
+    return;
+  }
+
+  /* the gpu's work grows with the pixels drawn, the square of the scale. aim
+     a little under the budget to not oscillate around it */
+  double frame_ns = (double)ta_ns / frames;
+  double budget_ns = OPTION_resolution_budget * (double)NS_PER_MS * 0.9;
+  float scale = emu->render_scale * (float)sqrt(budget_ns / frame_ns);
+  scale = floorf(scale / EMU_SCALE_STEP) * EMU_SCALE_STEP;
+  emu->render_scale = CLAMP(scale, 1.0f, max_scale);
+}
+
+/* renders the context offscreen at the configured multiple of its native
+   resolution, scaling it into the viewport after */
+static void emu_render_context(struct emu *emu, const struct tr_context *rc) {
+  if (!OPTION_resolution_scale) {
+    tr_render_context(emu->r, rc);
+    return;
+  }
+
+  emu_update_render_scale(emu);
+
+  int width = (int)(rc->width * emu->render_scale);
+  int height = (int)(rc->height * emu->render_scale);
+
+  r_begin_ta_target(emu->r, width, height);
+  tr_render_context(emu->r, rc);
+  r_end_ta_target(emu->r);
+}
+
+static void emu_render_pipelined(struct emu *emu) {
+  int vsync = video_sync_enabled();
+
+  mutex_lock(emu->res_mutex);
+
+  /* with video sync, wait for the emulation thread to catch up before
+     requesting another frame. otherwise, the request is skipped and the last
+     frame repeated */
+  while (vsync && emu->frames_pending >= EMU_MAX_PENDING) {
+    if (emu->pending_ctx) {
+      emu_queue_context(emu);
+      continue;
+    }
+
+    cond_wait(emu->res_cond, emu->res_mutex);
+  }
+
+  if (emu->frames_pending < EMU_MAX_PENDING) {
+    emu->frames_pending++;
+    cond_signal(emu->res_cond);
+  }
+
+  emu_queue_context(emu);
+
+  struct emu_frame *frame = emu_next_frame(emu, vsync);
+  int vid_source = emu->vid_source;
+  int vid_disabled = emu->vid_disabled;
+
+  mutex_unlock(emu->res_mutex);
+
+  /* the queue is only written to by this thread, the frame can be rendered
+     outside of the lock */
+  int64_t start = time_nanoseconds();
+
+  if (!vid_disabled) {
+    if (vid_source == EMU_SOURCE_PXL) {
+      r_draw_pixels(emu->r, emu->vid_fb.data, 0, 0, emu->vid_fb.width,
+                    emu->vid_fb.height);
+    } else if (vid_source == EMU_SOURCE_CTX && frame) {
+      emu_render_context(emu, &frame->rc);
+    }
+  }
+
+  emu->render_ns = time_nanoseconds() - start;
+}
+
+struct reg_stats *emu_reg_stats(struct emu *emu) {
+  return emu->dc->reg_stats;
+}
+
+void emu_frame_times(struct emu *emu, struct emu_frame_times *times) {
+  times->emulate_ns = emu->emulate_ns;
+  times->compile_ns = emu->compile_ns;
+  times->convert_ns = emu->convert_ns;
+  times->decode_ns = emu->decode_ns;
+  times->render_ns = emu->render_ns;
+}
+
 void emu_render_frame(struct emu *emu) {
   prof_counter_add(COUNTER_frames, 1);
 
+  emu->convert_ns = 0;
+  emu->decode_ns = 0;
+  emu->render_ns = 0;
+
   if (OPTION_aspect_dirty) {
     emu_set_aspect_ratio(emu, OPTION_aspect);
     OPTION_aspect_dirty = 0;
@@ -521,6 +1375,8 @@ void emu_render_frame(struct emu *emu) {
     /* since the host times itself based off of our audio output, it's important
        to pump out silent audio frames even when not running the dreamcast, else
        the host will render the ui completely unthrottled  */
+    emu->emulate_ns = 0;
+    emu->compile_ns = 0;
     uint32_t silence[AICA_SAMPLE_FREQ / 60] = {0};
     audio_push(emu->host, (int16_t *)silence, ARRAY_SIZE(silence));
     return;
@@ -566,7 +1422,8 @@ void emu_render_frame(struct emu *emu) {
      pending_ctx to be set              |
      ---------------------------------------------------------------------------
                                         | emu_start_render sets pending_ctx or
-                                        | emu_push_pixels copies off framebuffer
+                                        | pvr converts a framebuffer straight
+                                        | into vid_fb
      ---------------------------------------------------------------------------
      convert pending_ctx if set         |
      ---------------------------------------------------------------------------
@@ -574,7 +1431,18 @@ void emu_render_frame(struct emu *emu) {
      ---------------------------------------------------------------------------
      see EMU_DRAWFRAME, start drawing   |
      ---------------------------------------------------------------------------
-                                        | emu_vblank_out sets EMU_ENDFRAME */
+                                        | emu_vblank_out sets EMU_ENDFRAME
+
+     when pipelined, the main thread doesn't wait on the emulation thread at
+     all. it requests the next frame, converts whatever context is pending and
+     presents the next frame from the queue */
+  if (emu->pipelined) {
+    emu_render_pipelined(emu);
+    emu_capture_frame(emu);
+    return;
+  }
+
+  emu->video_ns = 0;
 
   /* request a frame to be ran */
   if (emu->multi_threaded) {
@@ -586,7 +1454,7 @@ void emu_render_frame(struct emu *emu) {
 
     mutex_unlock(emu->req_mutex);
   } else {
-    emu_run_until_vblank(emu);
+    emu_run_frame(emu);
   }
 
   /* process any context submitted during the frame */
@@ -598,12 +1466,25 @@ void emu_render_frame(struct emu *emu) {
     }
   }
 
-  if (emu->pending_ctx) {
-    tr_convert_context(emu->r, emu, &emu_find_texture, emu->pending_ctx,
-                       &emu->vid_rc);
-    emu->pending_ctx = NULL;
+  emu_convert_pending(emu);
+
+  /* when running ahead, the emulation thread rolls the machine back as soon as
+     the frame ran ahead ends. wait for it to end, converting each context it
+     submits along the way, and let the emulation thread know once done */
+  if (emu->multi_threaded && emu->run_ahead) {
+    while (emu->state != EMU_ENDFRAME) {
+      if (emu->pending_ctx) {
+        emu_convert_pending(emu);
+        continue;
+      }
+
+      cond_wait(emu->res_cond, emu->res_mutex);
+    }
 
-    emu->vid_source = EMU_SOURCE_CTX;
+    emu_convert_pending(emu);
+
+    emu->ahead_converted = 1;
+    cond_signal(emu->res_cond);
   }
 
   if (emu->multi_threaded) {
@@ -622,15 +1503,31 @@ void emu_render_frame(struct emu *emu) {
   }
 
   /* render the latest video source */
+  int64_t start = time_nanoseconds();
+
   if (!emu->vid_disabled) {
     if (emu->vid_source == EMU_SOURCE_PXL) {
       r_draw_pixels(emu->r, emu->vid_fb.data, 0, 0, emu->vid_fb.width,
                     emu->vid_fb.height);
     } else if (emu->vid_source == EMU_SOURCE_CTX) {
-      tr_render_context(emu->r, &emu->vid_rc);
+      emu_render_context(emu, &emu->vid_rc);
     }
   }
 
+  emu->render_ns = time_nanoseconds() - start;
+  emu->video_ns += emu->render_ns;
+
+  /* skip a frame for each whole frame the video work ran over by. the next
+     request is only made once the emulation thread is waiting again, so it's
+     safe to update this outside of the lock */
+  if (OPTION_frameskip > 0) {
+    const int64_t FRAME_BUDGET = HZ_TO_NANO(60);
+    int over = (int)(emu->video_ns / FRAME_BUDGET);
+    emu->frames_to_skip = MIN(over, OPTION_frameskip);
+  }
+
+  emu_capture_frame(emu);
+
   /* note, the emulation thread may still be running the code between vblank_in
      and vblank_out at this point, but there's no need to wait for it */
 }
@@ -638,7 +1535,9 @@ void emu_render_frame(struct emu *emu) {
 void emu_debug_menu(struct emu *emu) {
 #ifdef HAVE_IMGUI
   /* ensure the emulation thread isn't still executing a previous frame */
-  if (emu->multi_threaded) {
+  if (emu->pipelined) {
+    emu_drain_frames(emu);
+  } else if (emu->multi_threaded) {
     mutex_lock(emu->req_mutex);
     CHECK_EQ(emu->state, EMU_WAITING);
     mutex_unlock(emu->req_mutex);
@@ -655,16 +1554,84 @@ void emu_debug_menu(struct emu *emu) {
       if (emu->trace_writer && igMenuItem("stop trace", NULL, 1, 1)) {
         emu_stop_tracing(emu);
       }
+      if (!capture_active(emu->capture) &&
+          igMenuItem("start capture", NULL, 0, 1)) {
+        emu_start_capture(emu);
+      }
+      if (capture_active(emu->capture) &&
+          igMenuItem("stop capture", NULL, 1, 1)) {
+        emu_stop_capture(emu);
+      }
+      if (igMenuItem("gpu timings", NULL, emu->gpu_timings, 1)) {
+        emu->gpu_timings = !emu->gpu_timings;
+      }
       igEndMenu();
     }
 
     igEndMainMenuBar();
   }
 
+  if (emu->gpu_timings && igBegin("gpu timings", NULL, 0)) {
+    /* the counters are aggregated over the last second, average them out
+       over the frames presented in that time */
+    static const char *pass_names[NUM_GPU_PASSES] = {
+        "opaque", "punch-through", "translucent", "pixels", "ui",
+    };
+    int64_t pass_ns[NUM_GPU_PASSES] = {
+        prof_counter_load(COUNTER_gpu_opaque_ns),
+        prof_counter_load(COUNTER_gpu_punch_through_ns),
+        prof_counter_load(COUNTER_gpu_translucent_ns),
+        prof_counter_load(COUNTER_gpu_pixels_ns),
+        prof_counter_load(COUNTER_gpu_ui_ns),
+    };
+    double frames = (double)MAX(prof_counter_load(COUNTER_frames), 1);
+
+    igColumns(2, NULL, 0);
+
+    igText("pass");
+    igNextColumn();
+    igText("gpu ms/frame");
+    igNextColumn();
+
+    for (int i = 0; i < NUM_GPU_PASSES; i++) {
+      igText("%s", pass_names[i]);
+      igNextColumn();
+      igText("%.3f", pass_ns[i] / frames / NS_PER_MS);
+      igNextColumn();
+    }
+
+    igText("draws/frame");
+    igNextColumn();
+    igText("%.0f", prof_counter_load(COUNTER_gpu_draws) / frames);
+    igNextColumn();
+
+    igText("culled tris/frame");
+    igNextColumn();
+    igText("%.0f", prof_counter_load(COUNTER_culled_tris) / frames);
+    igNextColumn();
+
+    igText("state changes/frame");
+    igNextColumn();
+    igText("%.0f", prof_counter_load(COUNTER_gpu_state_changes) / frames);
+    igNextColumn();
+
+    igText("upload KB/frame");
+    igNextColumn();
+    igText("%.1f",
+           prof_counter_load(COUNTER_gpu_upload_bytes) / frames / 1024.0);
+    igNextColumn();
+
+    igColumns(1, NULL, 0);
+
+    igEnd();
+  }
+
   holly_debug_menu(emu->dc->holly);
   aica_debug_menu(emu->dc->aica);
   arm7_debug_menu(emu->dc->arm7);
   sh4_debug_menu(emu->dc->sh4);
+  sched_debug_menu(emu->dc->sched);
+  reg_stats_debug_menu(emu->dc->reg_stats);
 
   /* add status */
   if (igBeginMainMenuBar()) {
@@ -676,8 +1643,14 @@ void emu_debug_menu(struct emu *emu) {
     int arm7_instrs =
         (int)(prof_counter_load(COUNTER_arm7_instrs) / 1000000.0f);
 
-    snprintf(status, sizeof(status), "FPS %3d RPS %3d VBS %3d SH4 %4d ARM %d",
-             frames, ta_renders, pvr_vblanks, sh4_instrs, arm7_instrs);
+    int skipped = (int)prof_counter_load(COUNTER_frames_skipped);
+    int tex_mb = (int)(prof_counter_load(COUNTER_texture_bytes) >> 20);
+    int evictions = (int)prof_counter_load(COUNTER_texture_evictions);
+
+    snprintf(status, sizeof(status),
+             "FPS %3d SKP %3d RPS %3d VBS %3d SH4 %4d ARM %d TEX %3dMB EVC %d",
+             frames, skipped, ta_renders, pvr_vblanks, sh4_instrs, arm7_instrs,
+             tex_mb, evictions);
 
     /* right align */
     struct ImVec2 content;
@@ -692,23 +1665,118 @@ void emu_debug_menu(struct emu *emu) {
 #endif
 }
 
+static void emu_start_recording(struct emu *emu, const char *path) {
+  if (dc_running(emu->dc)) {
+    LOG_WARNING("movies can only be recorded from boot, not recording");
+    return;
+  }
+
+  struct movie_boot boot = {0};
+  snprintf(boot.disc, sizeof(boot.disc), "%s", path ? path : "");
+  snprintf(boot.region, sizeof(boot.region), "%s", OPTION_region);
+  snprintf(boot.language, sizeof(boot.language), "%s", OPTION_language);
+  snprintf(boot.broadcast, sizeof(boot.broadcast), "%s", OPTION_broadcast);
+  boot.clock = bios_local_time();
+  boot.checksum_interval = OPTION_record_checksums;
+
+  emu->movie = movie_record(OPTION_record, &boot);
+
+  if (!emu->movie) {
+    return;
+  }
+
+  /* boot with the clock recorded rather than whenever the bios was created */
+  bios_set_clock(emu->dc->bios, boot.clock);
+
+  /* both roll the machine back, running frames which never happened */
+  emu->run_ahead = 0;
+
+  /* a cached boot state would skip the bootstrap that replays run through */
+  OPTION_boot_cache = 0;
+
+  if (emu->rewind) {
+    rewind_destroy(emu->rewind);
+    emu->rewind = NULL;
+  }
+
+  if (OPTION_aica_thread) {
+    LOG_WARNING("aica_thread runs the arm7 nondeterministically, replays of "
+                "this movie may diverge");
+  }
+
+  LOG_INFO("recording movie to %s", OPTION_record);
+}
+
 int emu_load(struct emu *emu, const char *path) {
+  if (emu->pipelined) {
+    emu_drain_frames(emu);
+  }
+
+  if (OPTION_profiles) {
+    profile_load(path);
+  }
+
+  if (OPTION_record[0] && !emu->movie) {
+    emu_start_recording(emu, path);
+  }
+
   return dc_load(emu->dc, path);
 }
 
+void emu_set_fast_forward(struct emu *emu, int fast_forward) {
+  emu->fast_forward = fast_forward;
+}
+
 int emu_keydown(struct emu *emu, int port, int key, int16_t value) {
+  if (key == K_BACKSPACE && emu->rewind) {
+    emu->rewinding = value != 0;
+    return 1;
+  }
+
   if (key >= K_CONT_C && key <= K_CONT_RTRIG) {
-    dc_input(emu->dc, port, key - K_CONT_C, value);
+    int button = key - K_CONT_C;
+
+    if (OPTION_input_late_latch && port >= 0 && port < MAPLE_NUM_PORTS) {
+      mutex_lock(emu->input_mutex);
+      emu->input[port][button] = value;
+      emu->input_dirty[port] |= 1u << button;
+      mutex_unlock(emu->input_mutex);
+    } else {
+      emu_input(emu, port, button, value);
+    }
   }
 
   return 0;
 }
 
 void emu_vid_destroyed(struct emu *emu) {
-  rb_for_each_entry_safe(tex, &emu->live_textures, struct emu_texture,
-                         live_it) {
-    r_destroy_texture(emu->r, tex->handle);
-    emu_free_texture(emu, tex);
+  /* capturing ends with the backend, once the frames still being read back
+     have been handed over */
+  emu_stop_capture(emu);
+
+  /* the queued frames reference textures about to be destroyed */
+  if (emu->pipelined) {
+    if (emu->run_thread) {
+      emu_drain_frames(emu);
+    }
+
+    for (int i = 0; i < EMU_MAX_FRAMES; i++) {
+      emu->frames[i].state = EMU_FRAME_FREE;
+      emu->frames[i].key = 0;
+    }
+  }
+
+  emu->vid_key = 0;
+
+  emu_release_evicted_textures(emu);
+
+  /* freeing a texture shifts the entries after it back into its slot */
+  hash_map_for_each(i, &emu->live_textures, emu_texture_map) {
+    while (hash_map_occupied(&emu->live_textures, i)) {
+      struct emu_texture *tex = *hash_map_value(&emu->live_textures, i);
+      tr_release_texture(emu->cvt, emu->r, (struct tr_texture *)tex);
+      emu_free_texture(emu, tex);
+    }
   }
 
   emu->r = NULL;
@@ -720,14 +1788,24 @@ void emu_vid_created(struct emu *emu, struct render_backend *r) {
 
 void emu_destroy(struct emu *emu) {
   /* shutdown the emulation thread */
-  if (emu->multi_threaded) {
+  if (emu->pipelined) {
+    emu_drain_frames(emu);
+
+    mutex_lock(emu->res_mutex);
+    emu->state = EMU_SHUTDOWN;
+    cond_signal(emu->res_cond);
+    mutex_unlock(emu->res_mutex);
+  } else if (emu->multi_threaded) {
     mutex_lock(emu->req_mutex);
     emu->state = EMU_SHUTDOWN;
     cond_signal(emu->req_cond);
     mutex_unlock(emu->req_mutex);
+  }
 
+  if (emu->multi_threaded) {
     void *result;
     thread_join(emu->run_thread, &result);
+    emu->run_thread = NULL;
 
     mutex_destroy(emu->req_mutex);
     cond_destroy(emu->req_cond);
@@ -735,9 +1813,30 @@ void emu_destroy(struct emu *emu) {
     cond_destroy(emu->res_cond);
   }
 
+  mutex_destroy(emu->input_mutex);
+
   emu_stop_tracing(emu);
   emu_vid_destroyed(emu);
+  if (emu->snapshot) {
+    dc_destroy_snapshot(emu->dc, emu->snapshot);
+  }
+  if (emu->rewind) {
+    rewind_destroy(emu->rewind);
+  }
+  if (emu->movie) {
+    movie_destroy(emu->movie);
+  }
   dc_destroy(emu->dc);
+  if (emu->frames) {
+    for (int i = 0; i < EMU_MAX_FRAMES; i++) {
+      tr_free_context(&emu->frames[i].rc);
+    }
+    free(emu->frames);
+  }
+  tr_free_context(&emu->vid_rc);
+  tr_converter_destroy(emu->cvt);
+  capture_destroy(emu->capture);
+  emu_texture_map_destroy(&emu->live_textures);
   free(emu);
 }
 
@@ -745,16 +1844,22 @@ struct emu *emu_create(struct host *host) {
   struct emu *emu = calloc(1, sizeof(struct emu));
 
   emu->host = host;
+  emu->cvt = tr_converter_create();
+  emu->capture = capture_create(AICA_SAMPLE_FREQ, 60);
 
   /* create dreamcast, bind client callbacks */
   emu->dc = dc_create();
   emu->dc->userdata = emu;
   emu->dc->push_audio = &emu_push_audio;
+  emu->dc->map_pixels = &emu_map_pixels;
   emu->dc->push_pixels = &emu_push_pixels;
   emu->dc->start_render = &emu_start_render;
   emu->dc->finish_render = &emu_finish_render;
   emu->dc->vblank_in = &emu_vblank_in;
   emu->dc->vblank_out = &emu_vblank_out;
+  emu->dc->poll_input = &emu_poll_input;
+
+  emu->input_mutex = mutex_create();
 
   /* add all textures to free list by default */
   for (int i = 0; i < ARRAY_SIZE(emu->textures); i++) {
@@ -765,6 +1870,28 @@ struct emu *emu_create(struct host *host) {
   /* enable the cpu / gpu to be emulated in parallel */
   emu->multi_threaded = 1;
 
+  /* overlap emulating the next frame with presenting the current one */
+  emu->pipelined = emu->multi_threaded && OPTION_pipeline;
+
+  if (emu->pipelined) {
+    emu->frames = calloc(EMU_MAX_FRAMES, sizeof(struct emu_frame));
+  }
+
+  /* running ahead rolls the machine back at the end of each frame, which
+     can't overlap with the next frame being emulated */
+  if (OPTION_run_ahead > 0) {
+    if (emu->pipelined) {
+      LOG_WARNING("run_ahead isn't supported with pipeline, disabling it");
+    } else {
+      emu->run_ahead = OPTION_run_ahead;
+    }
+  }
+
+  if (OPTION_rewind > 0) {
+    emu->rewind = rewind_create(emu->dc, OPTION_rewind,
+                                OPTION_rewind_budget << 20);
+  }
+
   if (emu->multi_threaded) {
     emu->state = EMU_WAITING;
     emu->req_mutex = mutex_create();
@@ -772,7 +1899,7 @@ struct emu *emu_create(struct host *host) {
     emu->res_mutex = mutex_create();
     emu->res_cond = cond_create();
 
-    emu->run_thread = thread_create(&emu_run_thread, NULL, emu);
+    emu->run_thread = thread_create(&emu_run_thread, "emu", emu);
     CHECK_NOTNULL(emu->run_thread);
   }
 
@@ -5,17 +5,32 @@
 
 struct emu;
 struct host;
+struct reg_stats;
 struct render_backend;
 
+/* time spent on the last frame presented */
+struct emu_frame_times {
+  int64_t emulate_ns;
+  /* spent compiling code, included in the emulation time */
+  int64_t compile_ns;
+  int64_t convert_ns;
+  /* spent decoding textures, included in the conversion time */
+  int64_t decode_ns;
+  int64_t render_ns;
+};
+
 struct emu *emu_create(struct host *host);
 void emu_destroy(struct emu *emu);
 
 void emu_vid_created(struct emu *emu, struct render_backend *r);
 void emu_vid_destroyed(struct emu *emu);
 int emu_keydown(struct emu *emu, int port, int key, int16_t value);
+void emu_set_fast_forward(struct emu *emu, int fast_forward);
 
 int emu_load(struct emu *emu, const char *path);
 void emu_debug_menu(struct emu *emu);
 void emu_render_frame(struct emu *emu);
+void emu_frame_times(struct emu *emu, struct emu_frame_times *times);
+struct reg_stats *emu_reg_stats(struct emu *emu);
 
 #endif
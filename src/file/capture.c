@@ -0,0 +1,587 @@
+#include <limits.h>
+#include "file/capture.h"
+#include "core/atomic.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/ringbuf.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "options.h"
+
+/* files are split well before the 2 gb the original avi format's 32-bit
+   offsets allow for, as many players only handle up to 1 gb */
+#define CAPTURE_MAX_SEGMENT (1024 * 1024 * 1024)
+
+/* queue sizes, the video queue holding a few seconds of frames at the
+   guest's native resolution */
+#define CAPTURE_AUDIO_QUEUE (1024 * 1024)
+#define CAPTURE_VIDEO_QUEUE (64 * 1024 * 1024)
+
+/* how long the worker sleeps for once it's drained both queues */
+#define CAPTURE_POLL_NS (2 * NS_PER_MS)
+
+#define AVI_HEADER_SIZE 324
+#define AVI_KEYFRAME 0x10
+#define AVI_HASINDEX 0x10
+#define AVI_ISINTERLEAVED 0x100
+
+#define FOURCC(a, b, c, d) \
+  ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | \
+   ((uint32_t)(d) << 24))
+
+#define AVI_VIDEO_CHUNK FOURCC('0', '0', 'd', 'c')
+#define AVI_AUDIO_CHUNK FOURCC('0', '1', 'w', 'b')
+
+enum capture_type {
+  CAPTURE_AUDIO,
+  CAPTURE_VIDEO,
+};
+
+/* header of each record in the queues, followed by its data */
+struct capture_record {
+  int32_t type;
+  /* session the record was pushed during, records left over from a previous
+     session are discarded */
+  uint32_t session;
+  /* audio frames or video frames dropped right before this record */
+  int32_t dropped;
+  int32_t width;
+  int32_t height;
+  int32_t size;
+};
+
+struct avi_index_entry {
+  uint32_t id;
+  uint32_t flags;
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct capture {
+  int sample_rate;
+  int frame_rate;
+
+  struct ringbuf *audio;
+  struct ringbuf *video;
+
+  /* current session, 0 while not capturing */
+  volatile uint32_t session;
+  volatile uint32_t stopping;
+  uint32_t last_session;
+  thread_t thread;
+
+  /* owned by the audio and video producers respectively */
+  uint32_t audio_session;
+  int audio_dropped;
+  int video_dropped;
+
+  /* owned by the worker, the segment currently being written out */
+  FILE *file;
+  char filename[PATH_MAX];
+  int width;
+  int height;
+  int64_t movi_size;
+  uint32_t num_frames;
+  uint32_t num_samples;
+  struct avi_index_entry *index;
+  int num_index;
+  int max_index;
+  int failed;
+
+  /* totals for the session */
+  int64_t total_dropped_frames;
+  int64_t total_dropped_samples;
+};
+
+static void get_next_capture_filename(char *filename, size_t size) {
+  const char *appdir = fs_appdir();
+
+  for (int i = 0; i < INT_MAX; i++) {
+    snprintf(filename, size, "%s" PATH_SEPARATOR "capture%d.avi", appdir, i);
+
+    if (!fs_exists(filename)) {
+      return;
+    }
+  }
+
+  LOG_FATAL("unable to find available capture filename");
+}
+
+/*
+ * avi writer
+ */
+static uint8_t *avi_put32(uint8_t *ptr, uint32_t v) {
+  memcpy(ptr, &v, sizeof(v));
+  return ptr + sizeof(v);
+}
+
+static uint8_t *avi_put16(uint8_t *ptr, uint16_t v) {
+  memcpy(ptr, &v, sizeof(v));
+  return ptr + sizeof(v);
+}
+
+/* builds the headers of the segment with its current totals. they're written
+   out with zeroed totals when the segment is opened, and again once it's
+   closed */
+static void avi_build_header(struct capture *cap, uint8_t *header,
+                             uint32_t riff_size) {
+  uint32_t frame_size = cap->width * cap->height * 4;
+  uint32_t block_align = 4;
+  uint8_t *ptr = header;
+
+  memset(header, 0, AVI_HEADER_SIZE);
+
+  ptr = avi_put32(ptr, FOURCC('R', 'I', 'F', 'F'));
+  ptr = avi_put32(ptr, riff_size);
+  ptr = avi_put32(ptr, FOURCC('A', 'V', 'I', ' '));
+
+  ptr = avi_put32(ptr, FOURCC('L', 'I', 'S', 'T'));
+  ptr = avi_put32(ptr, 292);
+  ptr = avi_put32(ptr, FOURCC('h', 'd', 'r', 'l'));
+
+  /* main header */
+  ptr = avi_put32(ptr, FOURCC('a', 'v', 'i', 'h'));
+  ptr = avi_put32(ptr, 56);
+  ptr = avi_put32(ptr, 1000000 / cap->frame_rate);
+  ptr = avi_put32(ptr, frame_size * cap->frame_rate +
+                           cap->sample_rate * block_align);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, AVI_HASINDEX | AVI_ISINTERLEAVED);
+  ptr = avi_put32(ptr, cap->num_frames);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, 2);
+  ptr = avi_put32(ptr, frame_size);
+  ptr = avi_put32(ptr, cap->width);
+  ptr = avi_put32(ptr, cap->height);
+  ptr += 16;
+
+  /* video stream */
+  ptr = avi_put32(ptr, FOURCC('L', 'I', 'S', 'T'));
+  ptr = avi_put32(ptr, 116);
+  ptr = avi_put32(ptr, FOURCC('s', 't', 'r', 'l'));
+
+  ptr = avi_put32(ptr, FOURCC('s', 't', 'r', 'h'));
+  ptr = avi_put32(ptr, 56);
+  ptr = avi_put32(ptr, FOURCC('v', 'i', 'd', 's'));
+  ptr = avi_put32(ptr, FOURCC('D', 'I', 'B', ' '));
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, 1);
+  ptr = avi_put32(ptr, cap->frame_rate);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, cap->num_frames);
+  ptr = avi_put32(ptr, frame_size);
+  ptr = avi_put32(ptr, 0xffffffff);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put16(ptr, 0);
+  ptr = avi_put16(ptr, 0);
+  ptr = avi_put16(ptr, (uint16_t)cap->width);
+  ptr = avi_put16(ptr, (uint16_t)cap->height);
+
+  /* a positive height means the rows are stored bottom first, the same as
+     they're read back */
+  ptr = avi_put32(ptr, FOURCC('s', 't', 'r', 'f'));
+  ptr = avi_put32(ptr, 40);
+  ptr = avi_put32(ptr, 40);
+  ptr = avi_put32(ptr, cap->width);
+  ptr = avi_put32(ptr, cap->height);
+  ptr = avi_put16(ptr, 1);
+  ptr = avi_put16(ptr, 32);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, frame_size);
+  ptr += 16;
+
+  /* audio stream */
+  ptr = avi_put32(ptr, FOURCC('L', 'I', 'S', 'T'));
+  ptr = avi_put32(ptr, 92);
+  ptr = avi_put32(ptr, FOURCC('s', 't', 'r', 'l'));
+
+  ptr = avi_put32(ptr, FOURCC('s', 't', 'r', 'h'));
+  ptr = avi_put32(ptr, 56);
+  ptr = avi_put32(ptr, FOURCC('a', 'u', 'd', 's'));
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, block_align);
+  ptr = avi_put32(ptr, cap->sample_rate * block_align);
+  ptr = avi_put32(ptr, 0);
+  ptr = avi_put32(ptr, cap->num_samples);
+  ptr = avi_put32(ptr, cap->sample_rate * block_align);
+  ptr = avi_put32(ptr, 0xffffffff);
+  ptr = avi_put32(ptr, block_align);
+  ptr += 8;
+
+  ptr = avi_put32(ptr, FOURCC('s', 't', 'r', 'f'));
+  ptr = avi_put32(ptr, 16);
+  ptr = avi_put16(ptr, 1);
+  ptr = avi_put16(ptr, 2);
+  ptr = avi_put32(ptr, cap->sample_rate);
+  ptr = avi_put32(ptr, cap->sample_rate * block_align);
+  ptr = avi_put16(ptr, (uint16_t)block_align);
+  ptr = avi_put16(ptr, 16);
+
+  ptr = avi_put32(ptr, FOURCC('L', 'I', 'S', 'T'));
+  ptr = avi_put32(ptr, (uint32_t)(4 + cap->movi_size));
+  ptr = avi_put32(ptr, FOURCC('m', 'o', 'v', 'i'));
+
+  CHECK_EQ(ptr - header, AVI_HEADER_SIZE);
+}
+
+static void capture_close_segment(struct capture *cap) {
+  if (!cap->file) {
+    return;
+  }
+
+  uint32_t index_size = cap->num_index * (int)sizeof(struct avi_index_entry);
+  uint32_t id = FOURCC('i', 'd', 'x', '1');
+
+  cap->failed |= fwrite(&id, 4, 1, cap->file) != 1 ||
+                 fwrite(&index_size, 4, 1, cap->file) != 1 ||
+                 fwrite(cap->index, 1, index_size, cap->file) != index_size;
+
+  uint8_t header[AVI_HEADER_SIZE];
+  uint32_t riff_size =
+      (uint32_t)(AVI_HEADER_SIZE - 8 + cap->movi_size + 8 + index_size);
+  avi_build_header(cap, header, riff_size);
+
+  cap->failed |= fseek(cap->file, 0, SEEK_SET) != 0 ||
+                 fwrite(header, sizeof(header), 1, cap->file) != 1;
+
+  fclose(cap->file);
+  cap->file = NULL;
+
+  if (cap->failed) {
+    LOG_WARNING("capture_close_segment failed to write %s", cap->filename);
+  } else {
+    LOG_INFO("wrote %u frames to %s", cap->num_frames, cap->filename);
+  }
+}
+
+static void capture_open_segment(struct capture *cap, int width, int height) {
+  get_next_capture_filename(cap->filename, sizeof(cap->filename));
+
+  cap->file = fopen(cap->filename, "wb");
+  cap->width = width;
+  cap->height = height;
+  cap->movi_size = 0;
+  cap->num_frames = 0;
+  cap->num_samples = 0;
+  cap->num_index = 0;
+
+  if (!cap->file) {
+    LOG_WARNING("capture_open_segment failed to open %s", cap->filename);
+    cap->failed = 1;
+    return;
+  }
+
+  uint8_t header[AVI_HEADER_SIZE];
+  avi_build_header(cap, header, 0);
+  cap->failed |= fwrite(header, sizeof(header), 1, cap->file) != 1;
+}
+
+/* writes a chunk to the current segment, data being null for a chunk of
+   zeroes */
+static void capture_write_chunk(struct capture *cap, uint32_t id,
+                                const void *data, int size) {
+  static const uint8_t zeroes[4096];
+
+  if (!cap->file) {
+    return;
+  }
+
+  if (cap->num_index >= cap->max_index) {
+    cap->max_index = MAX(cap->max_index * 2, 1024);
+    cap->index = realloc(cap->index,
+                         cap->max_index * sizeof(struct avi_index_entry));
+  }
+
+  /* index offsets are relative to the movi list's fourcc */
+  struct avi_index_entry *entry = &cap->index[cap->num_index++];
+  entry->id = id;
+  entry->flags = AVI_KEYFRAME;
+  entry->offset = (uint32_t)(4 + cap->movi_size);
+  entry->size = size;
+
+  uint32_t chunk_size = size;
+  cap->failed |= fwrite(&id, 4, 1, cap->file) != 1 ||
+                 fwrite(&chunk_size, 4, 1, cap->file) != 1;
+
+  if (data) {
+    cap->failed |= fwrite(data, 1, size, cap->file) != (size_t)size;
+  } else {
+    for (int n = size; n > 0; n -= (int)sizeof(zeroes)) {
+      size_t len = MIN(n, (int)sizeof(zeroes));
+      cap->failed |= fwrite(zeroes, 1, len, cap->file) != len;
+    }
+  }
+
+  cap->movi_size += 8 + size;
+}
+
+static void capture_reserve_segment(struct capture *cap, int width,
+                                    int height, int size) {
+  /* the frame size is fixed for each segment, being that of the first frame
+     written to it */
+  int resized = width && cap->width && (width != cap->width ||
+                                        height != cap->height);
+  int full = cap->movi_size + size + 8 > CAPTURE_MAX_SEGMENT;
+
+  if (cap->file && (resized || full)) {
+    capture_close_segment(cap);
+  }
+
+  /* once a write fails, nothing more is written for the session */
+  if (!cap->file && !cap->failed) {
+    capture_open_segment(cap, width, height);
+  } else if (!cap->width) {
+    cap->width = width;
+    cap->height = height;
+  }
+}
+
+static void capture_write_record(struct capture *cap,
+                                 const struct capture_record *rec) {
+  const uint8_t *data = (const uint8_t *)(rec + 1);
+
+  if (rec->type == CAPTURE_AUDIO) {
+    int dropped_size = rec->dropped * 4;
+
+    if (dropped_size) {
+      capture_reserve_segment(cap, 0, 0, dropped_size);
+      capture_write_chunk(cap, AVI_AUDIO_CHUNK, NULL, dropped_size);
+      cap->num_samples += rec->dropped;
+      cap->total_dropped_samples += rec->dropped;
+    }
+
+    capture_reserve_segment(cap, 0, 0, rec->size);
+    capture_write_chunk(cap, AVI_AUDIO_CHUNK, data, rec->size);
+    cap->num_samples += rec->size / 4;
+  } else {
+    /* dropped frames are written as empty chunks, which players treat as
+       repeating the previous frame */
+    for (int i = 0; i < rec->dropped; i++) {
+      capture_reserve_segment(cap, 0, 0, 0);
+      capture_write_chunk(cap, AVI_VIDEO_CHUNK, NULL, 0);
+      cap->num_frames++;
+    }
+
+    cap->total_dropped_frames += rec->dropped;
+
+    if (rec->size) {
+      capture_reserve_segment(cap, rec->width, rec->height, rec->size);
+      capture_write_chunk(cap, AVI_VIDEO_CHUNK, data, rec->size);
+      cap->num_frames++;
+    }
+  }
+}
+
+/* writes out the next record of the queue, returning 0 if it's empty */
+static int capture_drain_one(struct capture *cap, struct ringbuf *rb,
+                             uint32_t session) {
+  if (!ringbuf_available(rb)) {
+    return 0;
+  }
+
+  /* records are only ever committed whole */
+  const struct capture_record *rec = ringbuf_read_ptr(rb);
+  int size = (int)sizeof(*rec) + rec->size;
+
+  if (rec->session == session) {
+    capture_write_record(cap, rec);
+  }
+
+  ringbuf_advance_read_ptr(rb, size);
+
+  return 1;
+}
+
+static void *capture_thread(void *data) {
+  struct capture *cap = data;
+  uint32_t session = cap->last_session;
+
+  apply_thread_options(ROLE_IO);
+
+  cap->failed = 0;
+
+  while (1) {
+    /* checked before draining, so everything pushed before the stop was
+       requested is written out */
+    int stopping = atomic_load32(&cap->stopping);
+
+    /* the queues are drained a record at a time from each, to keep the audio
+       and video interleaved in the file */
+    int drained = 0;
+    drained += capture_drain_one(cap, cap->video, session);
+    drained += capture_drain_one(cap, cap->audio, session);
+
+    if (drained) {
+      continue;
+    }
+
+    if (stopping) {
+      break;
+    }
+
+    time_sleep(CAPTURE_POLL_NS);
+  }
+
+  capture_close_segment(cap);
+
+  return NULL;
+}
+
+/*
+ * producers
+ */
+void capture_push_audio(struct capture *cap, const int16_t *data, int frames) {
+  uint32_t session = atomic_load32(&cap->session);
+
+  if (!session) {
+    return;
+  }
+
+  if (session != cap->audio_session) {
+    cap->audio_session = session;
+    cap->audio_dropped = 0;
+  }
+
+  int size = frames * 4;
+  struct capture_record *rec =
+      ringbuf_reserve(cap->audio, (int)sizeof(*rec) + size);
+
+  if (!rec) {
+    cap->audio_dropped += frames;
+    return;
+  }
+
+  rec->type = CAPTURE_AUDIO;
+  rec->session = session;
+  rec->dropped = cap->audio_dropped;
+  rec->width = 0;
+  rec->height = 0;
+  rec->size = size;
+  memcpy(rec + 1, data, size);
+  ringbuf_commit(cap->audio, (int)sizeof(*rec) + size);
+
+  cap->audio_dropped = 0;
+}
+
+void capture_skip_video(struct capture *cap) {
+  if (!cap->session) {
+    return;
+  }
+
+  cap->video_dropped++;
+}
+
+void capture_push_video(struct capture *cap, const uint8_t *pixels, int width,
+                        int height) {
+  if (!cap->session) {
+    return;
+  }
+
+  int size = width * height * 4;
+  struct capture_record *rec =
+      ringbuf_reserve(cap->video, (int)sizeof(*rec) + size);
+
+  if (!rec) {
+    cap->video_dropped++;
+    return;
+  }
+
+  rec->type = CAPTURE_VIDEO;
+  rec->session = cap->session;
+  rec->dropped = cap->video_dropped;
+  rec->width = width;
+  rec->height = height;
+  rec->size = size;
+  memcpy(rec + 1, pixels, size);
+  ringbuf_commit(cap->video, (int)sizeof(*rec) + size);
+
+  cap->video_dropped = 0;
+}
+
+int capture_active(struct capture *cap) {
+  return cap->session != 0;
+}
+
+void capture_stop(struct capture *cap) {
+  if (!cap->session) {
+    return;
+  }
+
+  /* the audio producer may still push a record or two for this session,
+     which the next session's worker discards */
+  atomic_store32(&cap->session, 0);
+  atomic_store32(&cap->stopping, 1);
+
+  thread_join(cap->thread, NULL);
+  cap->thread = NULL;
+
+  atomic_store32(&cap->stopping, 0);
+
+  if (cap->total_dropped_frames || cap->total_dropped_samples) {
+    LOG_WARNING("capture dropped %" PRId64 " frames and %" PRId64
+                " ms of audio",
+                cap->total_dropped_frames,
+                cap->total_dropped_samples * 1000 / cap->sample_rate);
+  }
+
+  LOG_INFO("stopped capture");
+}
+
+int capture_start(struct capture *cap) {
+  if (cap->session) {
+    return 1;
+  }
+
+  /* the queues are kept around between sessions once created */
+  if (!cap->audio) {
+    cap->audio = ringbuf_create(CAPTURE_AUDIO_QUEUE);
+    cap->video = ringbuf_create(CAPTURE_VIDEO_QUEUE);
+  }
+
+  cap->last_session = MAX(cap->last_session + 1, 1);
+  cap->video_dropped = 0;
+  cap->total_dropped_frames = 0;
+  cap->total_dropped_samples = 0;
+
+  cap->thread = thread_create(&capture_thread, "capture", cap);
+
+  if (!cap->thread) {
+    LOG_WARNING("capture_start failed to create thread");
+    return 0;
+  }
+
+  atomic_store32(&cap->session, cap->last_session);
+
+  LOG_INFO("started capture");
+
+  return 1;
+}
+
+void capture_destroy(struct capture *cap) {
+  capture_stop(cap);
+
+  if (cap->video) {
+    ringbuf_destroy(cap->video);
+  }
+
+  if (cap->audio) {
+    ringbuf_destroy(cap->audio);
+  }
+
+  free(cap->index);
+  free(cap);
+}
+
+struct capture *capture_create(int sample_rate, int frame_rate) {
+  struct capture *cap = calloc(1, sizeof(struct capture));
+
+  cap->sample_rate = sample_rate;
+  cap->frame_rate = frame_rate;
+
+  return cap;
+}
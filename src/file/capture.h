@@ -0,0 +1,38 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+/*
+ * captures the guest's audio and video to avi files, e.g. for attaching to
+ * bug reports
+ *
+ * audio batches are pushed by the emulation thread and frames by the video
+ * thread, each into a lock-free queue of its own. a worker thread drains the
+ * queues and writes them out, so neither side ever waits on the disk. when a
+ * queue is full, what's being pushed is dropped instead and written out as
+ * silence or an empty frame, keeping the audio and video in sync
+ *
+ * the video is stored as uncompressed 32-bit bgr. to stay within the limits
+ * of the original avi format, a new file is started every CAPTURE_MAX_SEGMENT
+ * bytes, as well as whenever the size of the frames changes
+ */
+struct capture;
+
+struct capture *capture_create(int sample_rate, int frame_rate);
+void capture_destroy(struct capture *cap);
+
+/* called from the thread pushing video, as are the functions below */
+int capture_start(struct capture *cap);
+void capture_stop(struct capture *cap);
+int capture_active(struct capture *cap);
+
+/* the pixels are 32-bit bgrx, bottom row first */
+void capture_push_video(struct capture *cap, const uint8_t *pixels, int width,
+                        int height);
+void capture_skip_video(struct capture *cap);
+
+/* called from the thread pushing audio, frames being interleaved stereo */
+void capture_push_audio(struct capture *cap, const int16_t *data, int frames);
+
+#endif
@@ -0,0 +1,130 @@
+#include "file/texture_pack.h"
+#include "core/core.h"
+#include "core/hash.h"
+#include "core/memory.h"
+
+struct texture_pack {
+  const uint8_t *data;
+  size_t size;
+  const struct texture_pack_entry *entries;
+  int num_entries;
+};
+
+static int texture_pack_validate(const struct texture_pack_entry *entry,
+                                 size_t file_size) {
+  if (entry->format >= NUM_COMPRESSED_FORMATS || !entry->num_levels ||
+      !entry->width || !entry->height) {
+    return 0;
+  }
+
+  if (entry->offset > file_size || entry->size > file_size - entry->offset) {
+    return 0;
+  }
+
+  /* the levels have to add up to exactly the entry's size */
+  int64_t size = 0;
+  int width = entry->width;
+  int height = entry->height;
+
+  for (int i = 0; i < entry->num_levels; i++) {
+    size += compressed_level_size(entry->format, width, height);
+    width = MAX(width / 2, 1);
+    height = MAX(height / 2, 1);
+  }
+
+  return size == entry->size;
+}
+
+uint64_t texture_pack_key(int texture_fmt, int pixel_fmt, int palette_fmt,
+                          int width, int height, int stride,
+                          const uint8_t *texture, int texture_size,
+                          const uint8_t *palette, int palette_size) {
+  int32_t params[] = {
+      texture_fmt, pixel_fmt, palette ? palette_fmt : 0, width, height, stride,
+  };
+  uint64_t key = hash_bytes(params, sizeof(params), 0);
+  key = hash_bytes(texture, texture_size, key);
+  if (palette) {
+    key = hash_bytes(palette, palette_size, key);
+  }
+  return key;
+}
+
+int texture_pack_find(const struct texture_pack *pack, uint64_t key,
+                      struct compressed_texture *replacement) {
+  int lo = 0;
+  int hi = pack->num_entries;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    const struct texture_pack_entry *entry = &pack->entries[mid];
+
+    if (entry->key < key) {
+      lo = mid + 1;
+    } else if (entry->key > key) {
+      hi = mid;
+    } else {
+      replacement->format = entry->format;
+      replacement->width = entry->width;
+      replacement->height = entry->height;
+      replacement->num_levels = entry->num_levels;
+      replacement->data = pack->data + entry->offset;
+      replacement->size = entry->size;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void texture_pack_close(struct texture_pack *pack) {
+  if (pack->data) {
+    unmap_file(pack->data, pack->size);
+  }
+
+  free(pack);
+}
+
+struct texture_pack *texture_pack_open(const char *path) {
+  struct texture_pack *pack = calloc(1, sizeof(struct texture_pack));
+
+  pack->data = map_file(path, &pack->size);
+
+  if (!pack->data) {
+    LOG_WARNING("texture_pack_open failed to map %s", path);
+    texture_pack_close(pack);
+    return NULL;
+  }
+
+  const struct texture_pack_header *header =
+      (const struct texture_pack_header *)pack->data;
+
+  if (pack->size < sizeof(*header) || header->magic != TEXTURE_PACK_MAGIC ||
+      header->version != TEXTURE_PACK_VERSION ||
+      header->num_entries > (pack->size - sizeof(*header)) /
+                                sizeof(struct texture_pack_entry)) {
+    LOG_WARNING("texture_pack_open %s isn't a valid texture pack", path);
+    texture_pack_close(pack);
+    return NULL;
+  }
+
+  pack->entries = (const struct texture_pack_entry *)(header + 1);
+  pack->num_entries = (int)header->num_entries;
+
+  /* validate the index up front, leaving lookups free to trust it */
+  for (int i = 0; i < pack->num_entries; i++) {
+    const struct texture_pack_entry *entry = &pack->entries[i];
+
+    if (!texture_pack_validate(entry, pack->size) ||
+        (i && entry->key <= pack->entries[i - 1].key)) {
+      LOG_WARNING("texture_pack_open %s has an invalid entry %d", path, i);
+      texture_pack_close(pack);
+      return NULL;
+    }
+  }
+
+  LOG_INFO("texture_pack_open loaded %d textures from %s", pack->num_entries,
+           path);
+
+  return pack;
+}
@@ -0,0 +1,69 @@
+#ifndef TEXTURE_PACK_H
+#define TEXTURE_PACK_H
+
+#include <stdint.h>
+#include "render/render_backend.h"
+
+/*
+ * texture replacement packs
+ *
+ * packs are a single file of textures already compressed to a format the gpu
+ * samples from directly, mapped into memory as a whole when opened. replacing
+ * a texture is then only a lookup and an upload, with no file access or image
+ * decoding at runtime. the file is laid out as:
+ *
+ *   struct texture_pack_header header
+ *   struct texture_pack_entry entries[header.num_entries]
+ *   uint8_t data[]
+ *
+ * with the entries sorted by key, and each entry's mip levels stored one after
+ * another at its offset from the start of the file. all fields are little
+ * endian
+ */
+#define TEXTURE_PACK_MAGIC 0x50585452 /* RTXP */
+#define TEXTURE_PACK_VERSION 1
+
+struct texture_pack_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_entries;
+  uint32_t reserved;
+};
+
+struct texture_pack_entry {
+  uint64_t key;
+  uint64_t offset;
+  uint32_t size;
+  uint16_t width;
+  uint16_t height;
+  uint8_t format;
+  uint8_t num_levels;
+  uint8_t reserved[6];
+};
+
+struct texture_pack;
+
+struct texture_pack *texture_pack_open(const char *path);
+void texture_pack_close(struct texture_pack *pack);
+
+/* original textures are keyed by a hash of their source data, along with the
+   parameters it's decoded with. chaining hash_bytes, each seeded with the
+   result of the previous, over:
+
+     int32_t params[] = {texture_fmt, pixel_fmt, palette_fmt, width, height,
+                         stride}
+     uint8_t texture[texture_size]
+     uint8_t palette[palette_size]
+
+   with palette_fmt being 0 and the palette being skipped when there isn't
+   one */
+uint64_t texture_pack_key(int texture_fmt, int pixel_fmt, int palette_fmt,
+                          int width, int height, int stride,
+                          const uint8_t *texture, int texture_size,
+                          const uint8_t *palette, int palette_size);
+
+/* fills out the replacement for the key, returning 0 if there isn't one */
+int texture_pack_find(const struct texture_pack *pack, uint64_t key,
+                      struct compressed_texture *replacement);
+
+#endif
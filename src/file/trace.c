@@ -1,66 +1,391 @@
 #include <limits.h>
+#include <zlib.h>
 #include "file/trace.h"
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "core/hash.h"
+#include "core/hash_map.h"
+#include "core/memory.h"
+#include "core/thread.h"
+#include "guest/pvr/ta.h"
 #include "guest/pvr/tr.h"
+#include "options.h"
+
+#define TRACE_MAGIC 0x32525452 /* RTR2 */
+
+/* chunks queued up for the writer thread before recording waits on it */
+#define TRACE_MAX_PENDING 8
+
+/* location of a payload inside of an inflated chunk */
+struct trace_ref {
+  int32_t chunk;
+  int32_t offset;
+};
+
+/* the header is rewritten when the writer is closed, until then the magic is
+   left zeroed so an incomplete trace isn't read */
+struct trace_header {
+  uint32_t magic;
+  int32_t num_cmds;
+  int32_t num_chunks;
+  int32_t num_frames;
+  uint64_t index_offset;
+  /* deflated size of the index */
+  uint32_t index_size;
+  uint32_t reserved;
+};
+
+struct trace_chunk {
+  uint64_t offset;
+  /* chunks which don't shrink when deflated are stored as is, in which case
+     size matches data_size */
+  uint32_t size;
+  uint32_t data_size;
+};
+
+struct trace_index_cmd {
+  int32_t type;
+
+  union {
+    struct {
+      union tsp tsp;
+      union tcw tcw;
+      uint32_t frame;
+      int32_t palette_size;
+      int32_t texture_size;
+      struct trace_ref palette;
+      struct trace_ref texture;
+    } texture;
+
+    struct {
+      uint32_t frame;
+      int32_t autosort;
+      int32_t stride;
+      int32_t palette_fmt;
+      int32_t video_width;
+      int32_t video_height;
+      int32_t alpha_ref;
+      union isp bg_isp;
+      union tsp bg_tsp;
+      union tcw bg_tcw;
+      float bg_depth;
+      int32_t bg_vertices_size;
+      int32_t params_size;
+      struct trace_ref bg_vertices;
+      struct trace_ref params;
+    } context;
+  };
+};
+
+DEFINE_HASH_MAP(trace_payload_map, uint64_t, struct trace_ref);
+DEFINE_HASH_MAP(trace_cmd_map, tr_texture_key_t, struct trace_cmd *);
+DEFINE_HASH_MAP(trace_texture_map, tr_texture_key_t, int);
+
+/*
+ * trace writer
+ */
+struct trace_pending {
+  uint8_t *data;
+  int size;
+};
+
+struct trace_writer {
+  FILE *file;
+
+  /* chunk being filled with the payloads of the current frame */
+  uint8_t *data;
+  int size;
+  int capacity;
+  int num_queued;
+
+  /* commands recorded so far, written out to the index on close */
+  struct trace_index_cmd *cmds;
+  int num_cmds;
+  int max_cmds;
+  int num_frames;
+
+  /* texture payloads already written, keyed by their content hash */
+  struct trace_payload_map payloads;
+
+  /* finished chunks are handed off to the writer thread, which deflates and
+     appends them to the file */
+  thread_t thread;
+  mutex_t mutex;
+  cond_t cond;
+  struct trace_pending pending[TRACE_MAX_PENDING];
+  int pending_head;
+  int pending_tail;
+  int shutdown;
+
+  /* owned by the writer thread until it's joined */
+  struct trace_chunk *chunks;
+  int num_chunks;
+  int max_chunks;
+  uint64_t offset;
+  int failed;
+};
+
+static void trace_writer_write_chunk(struct trace_writer *writer,
+                                     const uint8_t *data, int size) {
+  uLongf deflated_size = compressBound(size);
+  uint8_t *deflated = malloc(deflated_size);
+
+  struct trace_chunk chunk;
+  chunk.offset = writer->offset;
+  chunk.size = size;
+  chunk.data_size = size;
+
+  /* favor speed over size, the game is still running while recording */
+  const uint8_t *src = data;
+
+  if (compress2(deflated, &deflated_size, data, size, Z_BEST_SPEED) == Z_OK &&
+      deflated_size < (uLongf)size) {
+    src = deflated;
+    chunk.size = (uint32_t)deflated_size;
+  }
+
+  if (fwrite(src, 1, chunk.size, writer->file) != chunk.size) {
+    writer->failed = 1;
+  }
+
+  free(deflated);
+
+  writer->offset += chunk.size;
+
+  if (writer->num_chunks >= writer->max_chunks) {
+    writer->max_chunks = MAX(writer->max_chunks * 2, 64);
+    writer->chunks =
+        realloc(writer->chunks, writer->max_chunks * sizeof(struct trace_chunk));
+  }
+
+  writer->chunks[writer->num_chunks++] = chunk;
+}
+
+static void *trace_writer_thread(void *data) {
+  struct trace_writer *writer = data;
+
+  apply_thread_options(ROLE_IO);
+
+  mutex_lock(writer->mutex);
+
+  while (1) {
+    if (writer->pending_tail == writer->pending_head) {
+      if (writer->shutdown) {
+        break;
+      }
+
+      cond_wait(writer->cond, writer->mutex);
+      continue;
+    }
+
+    struct trace_pending pending =
+        writer->pending[writer->pending_tail % TRACE_MAX_PENDING];
+
+    mutex_unlock(writer->mutex);
+    trace_writer_write_chunk(writer, pending.data, pending.size);
+    free(pending.data);
+    mutex_lock(writer->mutex);
+
+    /* wake up the recording thread if it's waiting on the queue */
+    writer->pending_tail++;
+    cond_signal(writer->cond);
+  }
+
+  mutex_unlock(writer->mutex);
+
+  return NULL;
+}
+
+static void trace_writer_queue_chunk(struct trace_writer *writer) {
+  mutex_lock(writer->mutex);
+
+  /* with only the recording and writer threads waiting on the condition, and
+     never at the same time, a single signal always reaches the right one */
+  while (writer->pending_head - writer->pending_tail >= TRACE_MAX_PENDING) {
+    cond_wait(writer->cond, writer->mutex);
+  }
+
+  struct trace_pending *pending =
+      &writer->pending[writer->pending_head % TRACE_MAX_PENDING];
+  pending->data = writer->data;
+  pending->size = writer->size;
+  writer->pending_head++;
+  cond_signal(writer->cond);
+
+  mutex_unlock(writer->mutex);
+
+  writer->data = NULL;
+  writer->size = 0;
+  writer->capacity = 0;
+  writer->num_queued++;
+}
+
+static struct trace_ref trace_writer_append(struct trace_writer *writer,
+                                            const void *data, int size) {
+  struct trace_ref ref = {writer->num_queued, writer->size};
+
+  if (writer->size + size > writer->capacity) {
+    writer->capacity = MAX(writer->capacity * 2, writer->size + size);
+    writer->data = realloc(writer->data, writer->capacity);
+  }
+
+  if (size) {
+    memcpy(writer->data + writer->size, data, size);
+    writer->size += size;
+  }
+
+  return ref;
+}
+
+static struct trace_index_cmd *trace_writer_alloc_cmd(
+    struct trace_writer *writer) {
+  if (writer->num_cmds >= writer->max_cmds) {
+    writer->max_cmds = MAX(writer->max_cmds * 2, 256);
+    writer->cmds = realloc(writer->cmds,
+                           writer->max_cmds * sizeof(struct trace_index_cmd));
+  }
+
+  struct trace_index_cmd *cmd = &writer->cmds[writer->num_cmds++];
+  memset(cmd, 0, sizeof(*cmd));
+  return cmd;
+}
+
+static int trace_writer_write_index(struct trace_writer *writer) {
+  int cmds_size = writer->num_cmds * (int)sizeof(struct trace_index_cmd);
+  int chunks_size = writer->num_chunks * (int)sizeof(struct trace_chunk);
+  int size = cmds_size + chunks_size;
+
+  uint8_t *index = malloc(MAX(size, 1));
+  memcpy(index, writer->cmds, cmds_size);
+  memcpy(index + cmds_size, writer->chunks, chunks_size);
+
+  uLongf deflated_size = compressBound(size);
+  uint8_t *deflated = malloc(deflated_size);
+  int res = compress2(deflated, &deflated_size, index, size, Z_BEST_SPEED);
+  free(index);
+
+  if (res != Z_OK) {
+    free(deflated);
+    return 0;
+  }
+
+  struct trace_header header = {0};
+  header.magic = TRACE_MAGIC;
+  header.num_cmds = writer->num_cmds;
+  header.num_chunks = writer->num_chunks;
+  header.num_frames = writer->num_frames;
+  header.index_offset = writer->offset;
+  header.index_size = (uint32_t)deflated_size;
+
+  int written =
+      fwrite(deflated, 1, deflated_size, writer->file) == deflated_size &&
+      !fseek(writer->file, 0, SEEK_SET) &&
+      fwrite(&header, sizeof(header), 1, writer->file) == 1;
+
+  free(deflated);
+
+  return written;
+}
 
 void trace_writer_close(struct trace_writer *writer) {
+  if (writer->thread) {
+    /* flush out the payloads of any textures inserted after the last frame */
+    if (writer->size) {
+      trace_writer_queue_chunk(writer);
+    }
+
+    mutex_lock(writer->mutex);
+    writer->shutdown = 1;
+    cond_signal(writer->cond);
+    mutex_unlock(writer->mutex);
+
+    thread_join(writer->thread, NULL);
+
+    CHECK_EQ(writer->num_chunks, writer->num_queued);
+
+    if (writer->failed || !trace_writer_write_index(writer)) {
+      LOG_WARNING("trace_writer_close failed to write trace");
+    }
+  }
+
+  if (writer->cond) {
+    cond_destroy(writer->cond);
+  }
+
+  if (writer->mutex) {
+    mutex_destroy(writer->mutex);
+  }
+
   if (writer->file) {
     fclose(writer->file);
   }
 
+  trace_payload_map_destroy(&writer->payloads);
+  free(writer->chunks);
+  free(writer->cmds);
+  free(writer->data);
   free(writer);
 }
 
 void trace_writer_render_context(struct trace_writer *writer,
                                  struct ta_context *ctx) {
-  struct trace_cmd cmd = {0};
-  cmd.type = TRACE_CMD_CONTEXT;
-  cmd.context.autosort = ctx->autosort;
-  cmd.context.stride = ctx->stride;
-  cmd.context.palette_fmt = ctx->palette_fmt;
-  cmd.context.video_width = ctx->video_width;
-  cmd.context.video_height = ctx->video_height;
-  cmd.context.alpha_ref = ctx->alpha_ref;
-  cmd.context.bg_isp = ctx->bg_isp;
-  cmd.context.bg_tsp = ctx->bg_tsp;
-  cmd.context.bg_tcw = ctx->bg_tcw;
-  cmd.context.bg_depth = ctx->bg_depth;
-  cmd.context.bg_vertices_size = sizeof(ctx->bg_vertices);
-  cmd.context.bg_vertices = (const uint8_t *)(intptr_t)sizeof(cmd);
-  cmd.context.params_size = ctx->size;
-  cmd.context.params =
-      (const uint8_t *)(intptr_t)(sizeof(cmd) + sizeof(ctx->bg_vertices));
-
-  CHECK_EQ(fwrite(&cmd, sizeof(cmd), 1, writer->file), 1);
-  CHECK_EQ(fwrite(ctx->bg_vertices, sizeof(ctx->bg_vertices), 1, writer->file),
-           1);
-  if (ctx->size) {
-    CHECK_EQ(fwrite(ctx->params, ctx->size, 1, writer->file), 1);
-  }
+  struct trace_index_cmd *cmd = trace_writer_alloc_cmd(writer);
+  cmd->type = TRACE_CMD_CONTEXT;
+  cmd->context.frame = writer->num_frames;
+  cmd->context.autosort = ctx->autosort;
+  cmd->context.stride = ctx->stride;
+  cmd->context.palette_fmt = ctx->palette_fmt;
+  cmd->context.video_width = ctx->video_width;
+  cmd->context.video_height = ctx->video_height;
+  cmd->context.alpha_ref = ctx->alpha_ref;
+  cmd->context.bg_isp = ctx->bg_isp;
+  cmd->context.bg_tsp = ctx->bg_tsp;
+  cmd->context.bg_tcw = ctx->bg_tcw;
+  cmd->context.bg_depth = ctx->bg_depth;
+  cmd->context.bg_vertices_size = sizeof(ctx->bg_vertices);
+  cmd->context.bg_vertices =
+      trace_writer_append(writer, ctx->bg_vertices, sizeof(ctx->bg_vertices));
+  cmd->context.params_size = ctx->size;
+  cmd->context.params = trace_writer_append(writer, ctx->params, ctx->size);
+
+  writer->num_frames++;
+
+  /* each frame's payloads end up in a chunk of their own */
+  trace_writer_queue_chunk(writer);
 }
 
 void trace_writer_insert_texture(struct trace_writer *writer, union tsp tsp,
                                  union tcw tcw, unsigned frame,
                                  const uint8_t *palette, int palette_size,
                                  const uint8_t *texture, int texture_size) {
-  struct trace_cmd cmd = {0};
-  cmd.type = TRACE_CMD_TEXTURE;
-  cmd.texture.tsp = tsp;
-  cmd.texture.tcw = tcw;
-  cmd.texture.frame = frame;
-  cmd.texture.palette_size = palette_size;
-  cmd.texture.palette = (const uint8_t *)(intptr_t)sizeof(cmd);
-  cmd.texture.texture_size = texture_size;
-  cmd.texture.texture = (const uint8_t *)(intptr_t)(sizeof(cmd) + palette_size);
-
-  CHECK_EQ(fwrite(&cmd, sizeof(cmd), 1, writer->file), 1);
-  if (palette_size) {
-    CHECK_EQ(fwrite(palette, palette_size, 1, writer->file), 1);
-  }
-  if (texture_size) {
-    CHECK_EQ(fwrite(texture, texture_size, 1, writer->file), 1);
+  struct trace_index_cmd *cmd = trace_writer_alloc_cmd(writer);
+  cmd->type = TRACE_CMD_TEXTURE;
+  cmd->texture.tsp = tsp;
+  cmd->texture.tcw = tcw;
+  cmd->texture.frame = frame;
+  cmd->texture.palette_size = palette_size;
+  cmd->texture.texture_size = texture_size;
+
+  /* textures are commonly rewritten with the same data, or share it with
+     other textures, in which case the existing payload is referenced. the
+     palette is stored right before the texture data */
+  uint64_t hash = hash_bytes(texture, texture_size, 0);
+  hash = hash_bytes(palette, palette_size, hash);
+
+  struct trace_ref *existing = trace_payload_map_get(&writer->payloads, hash);
+  struct trace_ref ref;
+
+  if (existing) {
+    ref = *existing;
+  } else {
+    ref = trace_writer_append(writer, palette, palette_size);
+    trace_writer_append(writer, texture, texture_size);
+    trace_payload_map_insert(&writer->payloads, hash, ref);
   }
+
+  cmd->texture.palette = ref;
+  cmd->texture.texture = ref;
+  cmd->texture.texture.offset += palette_size;
 }
 
 struct trace_writer *trace_writer_open(const char *filename) {
@@ -73,46 +398,129 @@ struct trace_writer *trace_writer_open(const char *filename) {
     return NULL;
   }
 
+  /* write out a placeholder for the header, the chunks follow it */
+  struct trace_header header = {0};
+
+  if (fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+    trace_writer_close(writer);
+    return NULL;
+  }
+
+  writer->offset = sizeof(header);
+  writer->mutex = mutex_create();
+  writer->cond = cond_create();
+  writer->thread = thread_create(&trace_writer_thread, "trace", writer);
+
+  if (!writer->thread) {
+    trace_writer_close(writer);
+    return NULL;
+  }
+
   return writer;
 }
 
+/*
+ * trace reader
+ */
+
 /* for commands which mutate global state, the previous state needs to be
    tracked in order to support unwinding. To do so, each command is iterated
    and tagged with the previous command that it overrides */
 static int trace_patch_overrides(struct trace_cmd *cmd) {
+  struct trace_cmd_map last = {0};
+
   while (cmd) {
     if (cmd->type == TRACE_CMD_TEXTURE) {
       tr_texture_key_t texture_key =
           tr_texture_key(cmd->texture.tsp, cmd->texture.tcw);
 
-      /* walk backwards and see if this texture overrode a previous command
-         TODO could cache this information in a map */
-      struct trace_cmd *prev = cmd->prev;
-
-      while (prev) {
-        if (prev->type == TRACE_CMD_TEXTURE) {
-          tr_texture_key_t prev_texture_key =
-              tr_texture_key(prev->texture.tsp, prev->texture.tcw);
+      struct trace_cmd **prev = trace_cmd_map_get(&last, texture_key);
 
-          if (prev_texture_key == texture_key) {
-            cmd->override = prev;
-            break;
-          }
-        }
-
-        prev = prev->prev;
+      if (prev) {
+        cmd->override = *prev;
+        *prev = cmd;
+      } else {
+        trace_cmd_map_insert(&last, texture_key, cmd);
       }
     }
 
     cmd = cmd->next;
   }
 
+  trace_cmd_map_destroy(&last);
+
   return 1;
 }
 
-/* commands are written out with null list pointers, and pointers to data
-   are written out relative to the command itself. Set the list pointers,
-   and make the data pointers absolute */
+static int trace_index_frames(struct trace *trace) {
+  for (struct trace_cmd *cmd = trace->cmds; cmd; cmd = cmd->next) {
+    if (cmd->type == TRACE_CMD_CONTEXT) {
+      trace->num_frames++;
+    }
+  }
+
+  trace->frames = calloc(MAX(trace->num_frames, 1), sizeof(struct trace_cmd *));
+
+  int n = 0;
+  for (struct trace_cmd *cmd = trace->cmds; cmd; cmd = cmd->next) {
+    if (cmd->type == TRACE_CMD_CONTEXT) {
+      trace->frames[n++] = cmd;
+    } else if (cmd->type == TRACE_CMD_TEXTURE) {
+      trace->num_textures++;
+    }
+  }
+
+  return 1;
+}
+
+static int trace_index_textures(struct trace *trace) {
+  struct trace_texture_map last = {0};
+
+  trace->textures =
+      calloc(MAX(trace->num_textures, 1), sizeof(struct trace_texture));
+  trace->frame_textures = calloc(MAX(trace->num_frames, 1), sizeof(int));
+
+  int n = 0;
+  int frame = 0;
+
+  for (struct trace_cmd *cmd = trace->cmds; cmd; cmd = cmd->next) {
+    if (cmd->type == TRACE_CMD_CONTEXT) {
+      trace->frame_textures[frame++] = n;
+      continue;
+    }
+
+    if (cmd->type != TRACE_CMD_TEXTURE) {
+      continue;
+    }
+
+    tr_texture_key_t texture_key =
+        tr_texture_key(cmd->texture.tsp, cmd->texture.tcw);
+    int *prev = trace_texture_map_get(&last, texture_key);
+
+    struct trace_texture *tex = &trace->textures[n];
+    tex->cmd = cmd;
+    tex->prev = -1;
+    tex->next = -1;
+
+    if (prev) {
+      tex->prev = *prev;
+      trace->textures[*prev].next = n;
+      *prev = n;
+    } else {
+      trace_texture_map_insert(&last, texture_key, n);
+    }
+
+    n++;
+  }
+
+  trace_texture_map_destroy(&last);
+
+  return 1;
+}
+
+/* commands in traces written before chunking was added are written out with
+   null list pointers, and pointers to data relative to the command itself.
+   Set the list pointers, and make the data pointers absolute */
 static int trace_patch_pointers(void *begin, int size) {
   struct trace_cmd *prev_cmd = NULL;
   struct trace_cmd *curr_cmd = NULL;
@@ -156,14 +564,201 @@ static int trace_patch_pointers(void *begin, int size) {
   return 1;
 }
 
+static int trace_parse_legacy(struct trace *trace) {
+  /* the commands are patched in place, so they can't be left in the read-only
+     mapping */
+  trace->cmds = malloc(trace->map_size);
+  memcpy(trace->cmds, trace->map, trace->map_size);
+
+  unmap_file(trace->map, trace->map_size);
+  trace->map = NULL;
+
+  return trace_patch_pointers(trace->cmds, (int)trace->map_size);
+}
+
+static int trace_valid_ref(struct trace *trace, struct trace_ref ref,
+                           int size) {
+  return ref.chunk >= 0 && ref.chunk < trace->num_chunks && ref.offset >= 0 &&
+         size >= 0 &&
+         (int64_t)ref.offset + size <= trace->chunks[ref.chunk].data_size;
+}
+
+static int trace_parse_index(struct trace *trace) {
+  const struct trace_header *header = (const struct trace_header *)trace->map;
+
+  if (header->num_cmds < 0 || header->num_chunks < 0 ||
+      header->index_offset + header->index_size > trace->map_size) {
+    return 0;
+  }
+
+  /* inflate the index */
+  int cmds_size = header->num_cmds * (int)sizeof(struct trace_index_cmd);
+  int chunks_size = header->num_chunks * (int)sizeof(struct trace_chunk);
+  uLongf size = cmds_size + chunks_size;
+
+  trace->index_data = malloc(MAX(size, 1));
+
+  int res = uncompress(trace->index_data, &size,
+                       trace->map + header->index_offset, header->index_size);
+  if (res != Z_OK || size != (uLongf)(cmds_size + chunks_size)) {
+    return 0;
+  }
+
+  trace->index = (const struct trace_index_cmd *)trace->index_data;
+  trace->chunks = (const struct trace_chunk *)(trace->index_data + cmds_size);
+  trace->num_chunks = header->num_chunks;
+  trace->inflated = calloc(MAX(trace->num_chunks, 1), sizeof(uint8_t *));
+
+  for (int i = 0; i < trace->num_chunks; i++) {
+    const struct trace_chunk *chunk = &trace->chunks[i];
+
+    if (chunk->offset + chunk->size > trace->map_size) {
+      return 0;
+    }
+  }
+
+  /* create the commands, their payloads being loaded on demand */
+  trace->cmds = calloc(MAX(header->num_cmds, 1), sizeof(struct trace_cmd));
+
+  for (int i = 0; i < header->num_cmds; i++) {
+    const struct trace_index_cmd *entry = &trace->index[i];
+    struct trace_cmd *cmd = &trace->cmds[i];
+
+    cmd->type = entry->type;
+    cmd->prev = i > 0 ? &trace->cmds[i - 1] : NULL;
+    cmd->next = i < header->num_cmds - 1 ? &trace->cmds[i + 1] : NULL;
+
+    switch (cmd->type) {
+      case TRACE_CMD_TEXTURE: {
+        if (!trace_valid_ref(trace, entry->texture.palette,
+                             entry->texture.palette_size) ||
+            !trace_valid_ref(trace, entry->texture.texture,
+                             entry->texture.texture_size)) {
+          return 0;
+        }
+
+        cmd->texture.tsp = entry->texture.tsp;
+        cmd->texture.tcw = entry->texture.tcw;
+        cmd->texture.frame = entry->texture.frame;
+        cmd->texture.palette_size = entry->texture.palette_size;
+        cmd->texture.texture_size = entry->texture.texture_size;
+      } break;
+
+      case TRACE_CMD_CONTEXT: {
+        if (entry->context.bg_vertices_size > TA_BG_VERTEX_SIZE ||
+            !trace_valid_ref(trace, entry->context.bg_vertices,
+                             entry->context.bg_vertices_size) ||
+            !trace_valid_ref(trace, entry->context.params,
+                             entry->context.params_size)) {
+          return 0;
+        }
+
+        cmd->context.frame = entry->context.frame;
+        cmd->context.autosort = entry->context.autosort;
+        cmd->context.stride = entry->context.stride;
+        cmd->context.palette_fmt = entry->context.palette_fmt;
+        cmd->context.video_width = entry->context.video_width;
+        cmd->context.video_height = entry->context.video_height;
+        cmd->context.alpha_ref = entry->context.alpha_ref;
+        cmd->context.bg_isp = entry->context.bg_isp;
+        cmd->context.bg_tsp = entry->context.bg_tsp;
+        cmd->context.bg_tcw = entry->context.bg_tcw;
+        cmd->context.bg_depth = entry->context.bg_depth;
+        cmd->context.bg_vertices_size = entry->context.bg_vertices_size;
+        cmd->context.params_size = entry->context.params_size;
+      } break;
+
+      default:
+        LOG_INFO("Unexpected trace command type %d", cmd->type);
+        return 0;
+    }
+  }
+
+  if (!header->num_cmds) {
+    free(trace->cmds);
+    trace->cmds = NULL;
+  }
+
+  return 1;
+}
+
+static const uint8_t *trace_get_payload(struct trace *trace,
+                                        struct trace_ref ref) {
+  uint8_t *data = trace->inflated[ref.chunk];
+
+  if (!data) {
+    const struct trace_chunk *chunk = &trace->chunks[ref.chunk];
+    const uint8_t *src = trace->map + chunk->offset;
+
+    data = malloc(MAX(chunk->data_size, 1));
+
+    if (chunk->size == chunk->data_size) {
+      memcpy(data, src, chunk->data_size);
+    } else {
+      uLongf size = chunk->data_size;
+      int res = uncompress(data, &size, src, chunk->size);
+      CHECK(res == Z_OK && size == chunk->data_size,
+            "trace_get_payload failed to inflate chunk %d", ref.chunk);
+    }
+
+    trace->inflated[ref.chunk] = data;
+  }
+
+  return data + ref.offset;
+}
+
+void trace_load_cmd(struct trace *trace, struct trace_cmd *cmd) {
+  /* traces written before chunking was added are loaded entirely */
+  if (!trace->index) {
+    return;
+  }
+
+  const struct trace_index_cmd *entry = &trace->index[cmd - trace->cmds];
+
+  switch (cmd->type) {
+    case TRACE_CMD_TEXTURE: {
+      cmd->texture.palette = trace_get_payload(trace, entry->texture.palette);
+      cmd->texture.texture = trace_get_payload(trace, entry->texture.texture);
+    } break;
+
+    case TRACE_CMD_CONTEXT: {
+      cmd->context.bg_vertices =
+          trace_get_payload(trace, entry->context.bg_vertices);
+      cmd->context.params = trace_get_payload(trace, entry->context.params);
+    } break;
+
+    default:
+      LOG_FATAL("unexpected trace command type %d", cmd->type);
+      break;
+  }
+}
+
 void trace_destroy(struct trace *trace) {
+  if (trace->inflated) {
+    for (int i = 0; i < trace->num_chunks; i++) {
+      free(trace->inflated[i]);
+    }
+  }
+
+  if (trace->map) {
+    unmap_file(trace->map, trace->map_size);
+  }
+
+  free(trace->inflated);
+  free(trace->index_data);
+  free(trace->frame_textures);
+  free(trace->textures);
+  free(trace->frames);
   free(trace->cmds);
   free(trace);
 }
 
-void trace_copy_context(const struct trace_cmd *cmd, struct ta_context *ctx) {
+void trace_copy_context(struct trace *trace, struct trace_cmd *cmd,
+                        struct ta_context *ctx) {
   CHECK_EQ(cmd->type, TRACE_CMD_CONTEXT);
 
+  trace_load_cmd(trace, cmd);
+
   ctx->autosort = cmd->context.autosort;
   ctx->stride = cmd->context.stride;
   ctx->palette_fmt = cmd->context.palette_fmt;
@@ -176,6 +771,7 @@ void trace_copy_context(const struct trace_cmd *cmd, struct ta_context *ctx) {
   ctx->bg_depth = cmd->context.bg_depth;
   memcpy(ctx->bg_vertices, cmd->context.bg_vertices,
          cmd->context.bg_vertices_size);
+  ta_reserve_context(ctx, cmd->context.params_size);
   memcpy(ctx->params, cmd->context.params, cmd->context.params_size);
   ctx->size = cmd->context.params_size;
 }
@@ -183,21 +779,17 @@ void trace_copy_context(const struct trace_cmd *cmd, struct ta_context *ctx) {
 struct trace *trace_parse(const char *filename) {
   struct trace *trace = calloc(1, sizeof(struct trace));
 
-  FILE *fp = fopen(filename, "rb");
-  if (!fp) {
+  trace->map = map_file(filename, &trace->map_size);
+  if (!trace->map) {
     trace_destroy(trace);
     return NULL;
   }
 
-  fseek(fp, 0, SEEK_END);
-  int size = (int)ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-
-  trace->cmds = malloc(size);
-  CHECK_EQ(fread(trace->cmds, size, 1, fp), 1);
-  fclose(fp);
+  const struct trace_header *header = (const struct trace_header *)trace->map;
+  int chunked = trace->map_size >= sizeof(*header) &&
+                header->magic == TRACE_MAGIC;
 
-  if (!trace_patch_pointers(trace->cmds, size)) {
+  if (chunked ? !trace_parse_index(trace) : !trace_parse_legacy(trace)) {
     trace_destroy(trace);
     return NULL;
   }
@@ -207,17 +799,14 @@ struct trace *trace_parse(const char *filename) {
     return NULL;
   }
 
-  /* count max frames */
-  {
-    struct trace_cmd *cmd = trace->cmds;
-
-    while (cmd) {
-      if (cmd->type == TRACE_CMD_CONTEXT) {
-        trace->num_frames++;
-      }
+  if (!trace_index_frames(trace)) {
+    trace_destroy(trace);
+    return NULL;
+  }
 
-      cmd = cmd->next;
-    }
+  if (!trace_index_textures(trace)) {
+    trace_destroy(trace);
+    return NULL;
   }
 
   return trace;
@@ -18,8 +18,8 @@ struct trace_cmd {
   struct trace_cmd *next;
   struct trace_cmd *override;
 
-  /* the data pointers in these structs are written out relative to the cmd,
-     and patched to absolute pointers on read */
+  /* the data pointers in these structs are only valid once the command has
+     been loaded with trace_load_cmd */
   union {
     struct {
       union tsp tsp;
@@ -53,21 +53,73 @@ struct trace_cmd {
   };
 };
 
+/* a texture insert in a trace, linked to the other inserts of the same
+   texture */
+struct trace_texture {
+  struct trace_cmd *cmd;
+  /* indices of the previous and next insert of the texture, -1 if none */
+  int prev;
+  int next;
+};
+
+/*
+ * traces are written out as a chunk per frame, each deflated on its own. a
+ * chunk holds the payloads first referenced during its frame: the context's
+ * parameters and background vertices, and the data of any textures inserted.
+ * texture payloads are deduplicated by their content hash across the entire
+ * trace, so a texture rewritten with the same data is stored only once
+ *
+ * the commands themselves, along with where each of their payloads is stored,
+ * are deflated into an index at the end of the file. opening a trace maps the
+ * file and only inflates the index, each chunk being inflated once one of its
+ * payloads is first loaded
+ *
+ * the file is laid out as:
+ * trace_header
+ * chunk data
+ * index: trace_index_cmd cmds[num_cmds], trace_chunk chunks[num_chunks]
+ *
+ * traces written before chunking was added, which are simply each command
+ * followed by its payloads, are still read
+ */
 struct trace {
   struct trace_cmd *cmds;
   int num_frames;
-};
 
-struct trace_writer {
-  FILE *file;
+  /* context command of each frame, for seeking directly to it */
+  struct trace_cmd **frames;
+
+  /* texture inserts in the order they were made, for seeking between frames
+     without walking the commands. the textures live at a frame are the last
+     insert of each made before frame_textures[frame] */
+  struct trace_texture *textures;
+  int num_textures;
+  int *frame_textures;
+
+  /* private to the reader */
+  const uint8_t *map;
+  size_t map_size;
+  const struct trace_index_cmd *index;
+  uint8_t *index_data;
+  const struct trace_chunk *chunks;
+  int num_chunks;
+  uint8_t **inflated;
 };
 
+struct trace_writer;
+
 void get_next_trace_filename(char *filename, size_t size);
 
 struct trace *trace_parse(const char *filename);
-void trace_copy_context(const struct trace_cmd *cmd, struct ta_context *ctx);
+/* sets the payload pointers of the command, inflating the chunk they're in if
+   it hasn't been already. payloads stay loaded until the trace is destroyed */
+void trace_load_cmd(struct trace *trace, struct trace_cmd *cmd);
+void trace_copy_context(struct trace *trace, struct trace_cmd *cmd,
+                        struct ta_context *ctx);
 void trace_destroy(struct trace *trace);
 
+/* chunks are deflated and written out by a background thread, so recording
+   doesn't hold up the caller */
 struct trace_writer *trace_writer_open(const char *filename);
 void trace_writer_insert_texture(struct trace_writer *writer, union tsp tsp,
                                  union tcw tcw, unsigned frame,
@@ -1,6 +1,6 @@
 #include "guest/aica/aica.h"
 #include "core/core.h"
-#include "core/filesystem.h"
+#include "guest/aica/aica_dsp.h"
 #include "guest/aica/aica_types.h"
 #include "guest/arm7/arm7.h"
 #include "guest/dreamcast.h"
@@ -8,7 +8,9 @@
 #include "guest/memory.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
+#include "options.h"
 #include "stats.h"
 
 #if 0
@@ -20,6 +22,12 @@
 #define AICA_NUM_CHANNELS 64
 #define AICA_BATCH_SIZE 10
 #define AICA_TIMER_PERIOD 0xff
+#define AICA_DSP_INPUTS 16
+#define AICA_DSP_OUTPUTS 16
+
+/* when mixing lazily, the longest the samples can fall behind before they're
+   mixed regardless of registers being accessed */
+#define AICA_MIX_QUANTUM INT64_C(1000000)
 
 /* register access is performed with either 1 or 4 byte memory accesses. the
    physical registers however are only 2 bytes wide, with each one packing
@@ -37,6 +45,7 @@
 /* ADPCM decoding constants */
 #define ADPCM_QUANT_MIN 0x7f
 #define ADPCM_QUANT_MAX 0x6000
+#define ADPCM_CACHE_SIZE 32
 
 /* work with samples as 64-bit ints to avoid dealing with overflow issues
    during intermediate steps */
@@ -76,6 +85,16 @@ struct aica_channel {
   /* signals the the current channel has looped */
   int looped;
 
+  /* ADPCM samples decoded ahead of the play position, starting at
+     cache_phase. a copy of the wave memory they were decoded from is kept to
+     detect it being rewritten before they're played */
+  int16_t cache_sample[ADPCM_CACHE_SIZE];
+  int16_t cache_quant[ADPCM_CACHE_SIZE];
+  uint32_t cache_phase;
+  int cache_len;
+  uint8_t cache_src[ADPCM_CACHE_SIZE / 2 + 1];
+  int cache_src_len;
+
   /*struct aica_eg_state aeg;
   struct aica_eg_state feg;*/
 };
@@ -102,89 +121,97 @@ struct aica {
      registers, while the sh4 will only perform 32-bit accesses as they must
      go through the g2 bus's fifo buffer */
   struct aica_channel channels[AICA_NUM_CHANNELS];
+  /* bitmask of the channels currently keyed on, mirroring each's active flag
+     so the mixer only has to visit live channels */
+  uint64_t active_channels;
   struct common_data *common_data;
   struct timer *sample_timer;
 
+  /* effects processor, only present when it's enabled */
+  struct aica_dsp *dsp;
+
+  /* when mixing lazily, the aica is ran as a device, mixing the time handed to
+     it when synced. the time left over short of a batch is carried over,
+     scaled by the sample rate */
+  int64_t mix_remainder;
+
+  /* when the arm7 is running on its own thread, work it requests which touches
+     state owned by the emulation thread is deferred until it's next synced */
+  int deferred_sh_update;
+  int deferred_timers;
+  uint32_t deferred_periods[3];
+  int deferred_sample_timer;
+
   /* debugging */
-  FILE *recording;
   int stream_stats;
 };
 
-/* approximated lookup tables for MVOL / TL scaling */
-static sample_t mvol_scale[16];
-static sample_t tl_scale[256];
+/* approximated lookup tables for MVOL / TL scaling, generated at build time
+   by tools/gentables from the formulas below
 
-static char *aica_fmt_names[] = {
-    "PCMS16",       /* AICA_FMT_PCMS16 */
-    "PCMS8",        /* AICA_FMT_PCMS8 */
-    "ADPCM",        /* AICA_FMT_ADPCM */
-    "ADPCM_STREAM", /* AICA_FMT_ADPCM_STREAM */
-};
+   the MVOL register adjusts the output level based on the table:
 
-static char *aica_loop_names[] = {
-    "LOOP_NONE",    /* AICA_LOOP_NONE */
-    "LOOP_FORWARD", /* AICA_LOOP_FORWARD */
-};
-
-static void aica_init_tables() {
-  static int initialized = 0;
+   MVOL       ∆level
+   ----------------
+   0         -MAX db
+   1         -42 db
+   2         -39 db
+   ...
+   n         -42 + (n-1) db
 
-  if (initialized) {
-    return;
-  }
+   sound pressure level is defined as:
+   ∆level = 20 * log10(out / in)
 
-  initialized = 1;
+   out can therefor be calculated as:
+   out = in * pow(10, ∆level / 20)
 
-  /* the MVOL register adjusts the output level based on the table:
+   this can be approximated using MVOL instead of ∆level as:
+   out = in / pow(2, (MVOL - i) / 2)
 
-     MVOL       ∆level
-     ----------------
-     0         -MAX db
-     1         -42 db
-     2         -39 db
-     ...
-     n         -42 + (n-1) db
+   each channel's TL register adjusts the output level based on the table:
 
-     sound pressure level is defined as:
-     ∆level = 20 * log10(out / in)
+   TL          ∆level
+   --------------
+   bit 0      -0.4 db
+   bit 1      -0.8 db
+   bit 2      -1.5 db
+   bit 3      -3.0 db
+   bit 4      -6.0 db
+   bit 5      -12.0 db
+   bit 6      -24.0 db
+   bit 7      -48.0 db
 
-     out can therefor be calculated as:
-     out = in * pow(10, ∆level / 20)
+   this can be approximated using TL as:
+   out = in / pow(2, TL / 16)
 
-     this can be approximated using MVOL instead of ∆level as:
-     out = in / pow(2, (MVOL - i) / 2) */
+   the send levels used when routing through the effects processor (DISDL,
+   IMXL and EFSDL) follow the same -3 db steps as MVOL, and share its table.
+   the pan registers attenuate one side by -3 db a step, with 0xf muting it:
 
-  for (int i = 0; i < 16; i++) {
-    /* 0 is a special case that mutes the output */
-    if (i == 0) {
-      continue;
-    }
+   out = in / pow(2, PAN / 2)
 
-    /* a 32-bit int is used for the scale, leaving 15 bits for the fraction */
-    mvol_scale[i] = (sample_t)((1 << 15) / pow(2.0f, (15 - i) / 2.0f));
-  }
+   a 32-bit int is used for each scale, leaving 15 bits for the fraction */
+static const sample_t mvol_scale[16] = {
+#include "guest/aica/aica_mvol_scale.inc"
+};
+static const sample_t tl_scale[256] = {
+#include "guest/aica/aica_tl_scale.inc"
+};
+static const sample_t pan_scale[16] = {
+#include "guest/aica/aica_pan_scale.inc"
+};
 
-  /* each channel's TL register adjusts the output level based on the table:
+static char *aica_fmt_names[] = {
+    "PCMS16",       /* AICA_FMT_PCMS16 */
+    "PCMS8",        /* AICA_FMT_PCMS8 */
+    "ADPCM",        /* AICA_FMT_ADPCM */
+    "ADPCM_STREAM", /* AICA_FMT_ADPCM_STREAM */
+};
 
-     TL          ∆level
-     --------------
-     bit 0      -0.4 db
-     bit 1      -0.8 db
-     bit 2      -1.5 db
-     bit 3      -3.0 db
-     bit 4      -6.0 db
-     bit 5      -12.0 db
-     bit 6      -24.0 db
-     bit 7      -48.0 db
-
-     this can be approximated using TL as:
-     out = in / pow(2, TL / 16) */
-
-  for (int i = 0; i < 256; i++) {
-    /* a 32-bit int is used for the scale, leaving 15 bits for the fraction */
-    tl_scale[i] = (sample_t)((1 << 15) / pow(2.0f, i / 16.0f));
-  }
-}
+static char *aica_loop_names[] = {
+    "LOOP_NONE",    /* AICA_LOOP_NONE */
+    "LOOP_FORWARD", /* AICA_LOOP_FORWARD */
+};
 
 static inline sample_t aica_adjust_master_volume(struct aica *aica,
                                                  sample_t in) {
@@ -200,6 +227,22 @@ static inline sample_t aica_adjust_channel_volume(struct aica_channel *ch,
   return (in * y) >> 15;
 }
 
+/* mixes a sample into the output at the given send level. bit 4 of the pan
+   selects which side is attenuated, the left when set */
+static inline void aica_mix_panned(sample_t in, int level, int pan,
+                                   sample_t *l, sample_t *r) {
+  sample_t s = (in * mvol_scale[level]) >> 15;
+  sample_t attenuated = (s * pan_scale[pan & 0xf]) >> 15;
+
+  if (pan & 0x10) {
+    *l += attenuated;
+    *r += s;
+  } else {
+    *l += s;
+    *r += attenuated;
+  }
+}
+
 static void aica_decode_adpcm(uint8_t data, sample_t prev, sample_t prev_quant,
                               sample_t *next, sample_t *next_quant) {
   /* the decoded value (n) = (1 - 2 * l4) * (l3 + l2/2 + l1/4 + 1/8) * quantized
@@ -308,6 +351,11 @@ static void aica_update_arm(struct aica *aica) {
 
 static void aica_update_sh(struct aica *aica) {
   struct holly *hl = aica->dc->holly;
+
+  if (sched_in_worker(aica->dc->sched)) {
+    aica->deferred_sh_update = 1;
+    return;
+  }
   uint32_t enabled_intr = aica->common_data->MCIEB;
   uint32_t pending_intr = aica->common_data->MCIPD & enabled_intr;
 
@@ -319,8 +367,47 @@ static void aica_update_sh(struct aica *aica) {
 }
 
 static void aica_timer_reschedule(struct aica *aica, int n, uint32_t period);
+static void aica_update_sample_timer(struct aica *aica);
+
+static void aica_sync_arm(struct aica *aica) {
+  struct scheduler *sched = aica->dc->sched;
+
+  /* the registers are shared between the sh4 and arm7, make sure the arm7 is
+     caught up before the sh4 accesses them */
+  sched_sync(sched, (struct device *)aica->dc->arm7);
+
+  if (sched_in_worker(sched)) {
+    return;
+  }
+
+  /* run anything the arm7 deferred while running on its own thread */
+  for (int n = 0; n < 3; n++) {
+    if (aica->deferred_timers & (1 << n)) {
+      aica->deferred_timers &= ~(1 << n);
+      aica_timer_reschedule(aica, n, aica->deferred_periods[n]);
+    }
+  }
+
+  if (aica->deferred_sh_update) {
+    aica->deferred_sh_update = 0;
+    aica_update_sh(aica);
+  }
+
+  if (aica->deferred_sample_timer) {
+    aica->deferred_sample_timer = 0;
+    aica_update_sample_timer(aica);
+  }
+
+  /* when mixing lazily, catch the mixer up to the present before the registers
+     change what it would generate */
+  if (aica->runif.enabled) {
+    sched_sync(sched, (struct device *)aica);
+  }
+}
 
 static void aica_timer_expire(struct aica *aica, int n) {
+  aica_sync_arm(aica);
+
   /* reschedule timer as soon as it expires */
   aica->timers[n] = NULL;
   aica_timer_reschedule(aica, n, AICA_TIMER_PERIOD);
@@ -353,6 +440,12 @@ static uint32_t aica_timer_tctl(struct aica *aica, int n) {
 static uint32_t aica_timer_tcnt(struct aica *aica, int n) {
   struct scheduler *sched = aica->dc->sched;
   struct timer *timer = aica->timers[n];
+
+  /* the timer is restarted on the next sync, count from the new period */
+  if (aica->deferred_timers & (1 << n)) {
+    return aica->deferred_periods[n];
+  }
+
   if (!timer) {
     /* if no timer has been created, return the raw value */
     return n == 0 ? aica->common_data->TIMA
@@ -371,6 +464,12 @@ static void aica_timer_reschedule(struct aica *aica, int n, uint32_t period) {
   struct scheduler *sched = aica->dc->sched;
   struct timer **timer = &aica->timers[n];
 
+  if (sched_in_worker(sched)) {
+    aica->deferred_timers |= 1 << n;
+    aica->deferred_periods[n] = period;
+    return;
+  }
+
   int64_t freq = AICA_SAMPLE_FREQ >> aica_timer_tctl(aica, n);
   int64_t cycles = (int64_t)period;
   int64_t remaining = CYCLES_TO_NANO(cycles, freq);
@@ -472,6 +571,7 @@ static void aica_channel_key_off(struct aica *aica, struct aica_channel *ch) {
   }
 
   ch->active = 0;
+  aica->active_channels &= ~((uint64_t)1 << ch->id);
 
   /* this will already be cleared if the channel is stopped due to a key event.
      however, it will not be set when a non-looping channel is stopped */
@@ -486,6 +586,7 @@ static void aica_channel_key_on(struct aica *aica, struct aica_channel *ch) {
   }
 
   ch->active = 1;
+  aica->active_channels |= (uint64_t)1 << ch->id;
   ch->base = aica_channel_base(aica, ch);
   ch->phase = 0;
   ch->phasefrc = 0;
@@ -497,6 +598,7 @@ static void aica_channel_key_on(struct aica *aica, struct aica_channel *ch) {
   ch->next_quant = ADPCM_QUANT_MIN;
   ch->loop_sample = 0;
   ch->loop_quant = ADPCM_QUANT_MIN;
+  ch->cache_len = 0;
 
   LOG_AICA("aica_channel_key_on [%d] %s, %s, %.2f hz, %.2f sec", ch->id,
            aica_fmt_names[ch->data->PCMS], aica_loop_names[ch->data->LPCTL],
@@ -524,6 +626,33 @@ static void aica_channel_key_on_execute(struct aica *aica,
   ch->data->KYONEX = 0;
 }
 
+/* decodes the channel's ADPCM stream from the current phase up to the loop end,
+   continuing on from the current decoding state */
+static void aica_channel_fill_cache(struct aica *aica,
+                                    struct aica_channel *ch) {
+  uint32_t start = ch->phase;
+  uint32_t end = MAX(MIN(start + ADPCM_CACHE_SIZE, ch->data->LEA), start + 1);
+  sample_t prev = ch->prev_sample;
+  sample_t prev_quant = ch->prev_quant;
+
+  for (uint32_t phase = start; phase < end; phase++) {
+    int shift = (phase & 1) << 2;
+    uint8_t data = (ch->base[phase >> 1] >> shift) & 0xf;
+    sample_t next, next_quant;
+    aica_decode_adpcm(data, prev, prev_quant, &next, &next_quant);
+
+    ch->cache_sample[phase - start] = (int16_t)next;
+    ch->cache_quant[phase - start] = (int16_t)next_quant;
+    prev = next;
+    prev_quant = next_quant;
+  }
+
+  ch->cache_phase = start;
+  ch->cache_len = (int)(end - start);
+  ch->cache_src_len = (int)(((end - 1) >> 1) - (start >> 1)) + 1;
+  memcpy(ch->cache_src, &ch->base[start >> 1], ch->cache_src_len);
+}
+
 static void aica_channel_step_one(struct aica *aica, struct aica_channel *ch) {
   CHECK_GE(ch->phasefrc, AICA_PHASE_BASE);
 
@@ -542,10 +671,13 @@ static void aica_channel_step_one(struct aica *aica, struct aica_channel *ch) {
 
       case AICA_FMT_ADPCM:
       case AICA_FMT_ADPCM_STREAM: {
-        int shift = (ch->phase & 1) << 2;
-        uint8_t data = (ch->base[ch->phase >> 1] >> shift) & 0xf;
-        aica_decode_adpcm(data, ch->prev_sample, ch->prev_quant,
-                          &ch->next_sample, &ch->next_quant);
+        uint32_t i = ch->phase - ch->cache_phase;
+        if (i >= (uint32_t)ch->cache_len) {
+          aica_channel_fill_cache(aica, ch);
+          i = 0;
+        }
+        ch->next_sample = ch->cache_sample[i];
+        ch->next_quant = ch->cache_quant[i];
       } break;
 
       default:
@@ -580,6 +712,7 @@ static void aica_channel_step_one(struct aica *aica, struct aica_channel *ch) {
       case AICA_LOOP_FORWARD: {
         /* restart channel */
         ch->phase = ch->data->LSA;
+        ch->cache_len = 0;
 
         /* in ADPCM streaming mode, the loop is a ring buffer. don't reset the
            decoding state in this case
@@ -618,36 +751,84 @@ static sample_t aica_channel_step(struct aica *aica, struct aica_channel *ch) {
   return result;
 }
 
-static void aica_generate_frames(struct aica *aica) {
+/* steps the channel through an entire batch, mixing in each of its samples.
+   the channel stops contributing once it's keyed off partway through */
+static void aica_channel_mix(struct aica *aica, struct aica_channel *ch,
+                             sample_t *l, sample_t *r,
+                             int32_t (*mixs)[AICA_DSP_INPUTS]) {
+  /* samples decoded ahead are checked against wave memory once per batch,
+     picking up any rewrite of them made by the guest since the last batch */
+  if (ch->cache_len && memcmp(&ch->base[ch->cache_phase >> 1], ch->cache_src,
+                              ch->cache_src_len)) {
+    ch->cache_len = 0;
+  }
+
+  for (int frame = 0; frame < AICA_BATCH_SIZE && ch->active; frame++) {
+    sample_t s = aica_adjust_channel_volume(ch, aica_channel_step(aica, ch));
+
+    if (!aica->dsp) {
+      l[frame] += s;
+      r[frame] += s;
+      continue;
+    }
+
+    /* when the effects processor is running, the direct output is panned and
+       leveled, and the channel is additionally sent to one of its inputs. the
+       inputs are 20-bit, the 16-bit sample being scaled up into them */
+    aica_mix_panned(s, ch->data->DISDL, ch->data->DIPAN, &l[frame], &r[frame]);
+    mixs[frame][ch->data->ISEL] +=
+        (int32_t)((s * mvol_scale[ch->data->IMXL]) >> 13);
+  }
+}
+
+void aica_generate_frames(struct aica *aica) {
   struct dreamcast *dc = aica->dc;
   int16_t buffer[AICA_BATCH_SIZE * 2];
+  sample_t l[AICA_BATCH_SIZE] = {0};
+  sample_t r[AICA_BATCH_SIZE] = {0};
+  int32_t mixs[AICA_BATCH_SIZE][AICA_DSP_INPUTS] = {{0}};
 
-  for (int frame = 0; frame < AICA_BATCH_SIZE; frame++) {
-    sample_t l = 0;
-    sample_t r = 0;
+  /* channels are independent of one another while generating, so each is
+     mixed a batch at a time, with only those keyed on being visited */
+  uint64_t live = aica->active_channels;
+  int voices = 0;
 
-    for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
-      struct aica_channel *ch = &aica->channels[i];
-      sample_t s = aica_channel_step(aica, ch);
-      l += aica_adjust_channel_volume(ch, s);
-      r += aica_adjust_channel_volume(ch, s);
-    }
+  while (live) {
+    int i = ctz64(live);
+    live &= live - 1;
 
-    l = aica_adjust_master_volume(aica, l);
-    r = aica_adjust_master_volume(aica, r);
+    aica_channel_mix(aica, &aica->channels[i], l, r, mixs);
+    voices++;
+  }
+
+  /* the effects processor is ran once per frame over what the channels sent
+     to it, its outputs being mixed in through the EFSDL / EFPAN registers */
+  if (aica->dsp) {
+    for (int frame = 0; frame < AICA_BATCH_SIZE; frame++) {
+      int32_t efreg[AICA_DSP_OUTPUTS];
+
+      aica_dsp_run(aica->dsp, mixs[frame], efreg);
 
-    buffer[frame * 2 + 0] = (int16_t)CLAMP(l, INT16_MIN, INT16_MAX);
-    buffer[frame * 2 + 1] = (int16_t)CLAMP(r, INT16_MIN, INT16_MAX);
+      for (int i = 0; i < AICA_DSP_OUTPUTS; i++) {
+        uint32_t out = *(uint32_t *)&aica->reg[0x2000 + i * 4];
+        aica_mix_panned(efreg[i], (out >> 8) & 0xf, out & 0x1f, &l[frame],
+                        &r[frame]);
+      }
+    }
   }
 
-  dc_push_audio(dc, buffer, AICA_BATCH_SIZE);
+  for (int frame = 0; frame < AICA_BATCH_SIZE; frame++) {
+    sample_t fl = aica_adjust_master_volume(aica, l[frame]);
+    sample_t fr = aica_adjust_master_volume(aica, r[frame]);
 
-  /* save raw audio out while recording */
-  if (aica->recording) {
-    fwrite(buffer, 4, AICA_BATCH_SIZE, aica->recording);
+    buffer[frame * 2 + 0] = (int16_t)CLAMP(fl, INT16_MIN, INT16_MAX);
+    buffer[frame * 2 + 1] = (int16_t)CLAMP(fr, INT16_MIN, INT16_MAX);
   }
 
+  dc_push_audio(dc, buffer, AICA_BATCH_SIZE);
+
   prof_counter_add(COUNTER_aica_samples, AICA_BATCH_SIZE);
+  prof_counter_set(COUNTER_aica_voices, voices);
 }
 
 static uint32_t aica_channel_reg_read(struct aica *aica, uint32_t addr,
@@ -775,6 +956,7 @@ static void aica_common_reg_write(struct aica *aica, uint32_t addr,
     } break;
 
     case 0x9c: { /* SCIEB */
+      aica_update_sample_timer(aica);
       aica_update_arm(aica);
     } break;
 
@@ -791,6 +973,7 @@ static void aica_common_reg_write(struct aica *aica, uint32_t addr,
     } break;
 
     case 0xb4: { /* MCIEB */
+      aica_update_sample_timer(aica);
       aica_update_sh(aica);
     } break;
 
@@ -835,36 +1018,147 @@ static void aica_common_reg_write(struct aica *aica, uint32_t addr,
   }
 }
 
+static void aica_run(struct device *dev, int64_t ns) {
+  struct aica *aica = (struct aica *)dev;
+  const int64_t batch = NS_PER_SEC * AICA_BATCH_SIZE;
+
+  aica->mix_remainder += ns * AICA_SAMPLE_FREQ;
+
+  while (aica->mix_remainder >= batch) {
+    aica_generate_frames(aica);
+    aica->mix_remainder -= batch;
+  }
+}
+
 static void aica_next_sample(void *data) {
   struct aica *aica = data;
-  struct scheduler *sched = aica->dc->sched;
 
-  aica_generate_frames(aica);
+  aica->sample_timer = NULL;
+
+  /* when mixing lazily, syncing has already generated the batch */
+  aica_sync_arm(aica);
+
+  if (!aica->runif.enabled) {
+    aica_generate_frames(aica);
+  }
   aica_raise_interrupt(aica, AICA_INT_SAMPLE);
   aica_update_arm(aica);
   aica_update_sh(aica);
 
-  /* reschedule */
-  aica->sample_timer =
-      sched_start_timer(sched, &aica_next_sample, aica,
-                        HZ_TO_NANO(AICA_SAMPLE_FREQ / AICA_BATCH_SIZE));
+  aica_update_sample_timer(aica);
 }
 
-static void aica_toggle_recording(struct aica *aica) {
-  if (!aica->recording) {
-    char filename[PATH_MAX];
-    snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "aica.pcm",
-             fs_appdir());
+static const timer_cb aica_timer_cbs[] = {
+    &aica_timer_expire_0, &aica_timer_expire_1, &aica_timer_expire_2,
+    &aica_rtc_timer, &aica_next_sample};
 
-    aica->recording = fopen(filename, "w");
-    CHECK_NOTNULL(aica->recording, "Failed to open %s", filename);
+static void aica_load_channel(struct aica *aica, struct aica_channel *ch,
+                              struct snapshot *snap) {
+  struct channel_data *data = ch->data;
+  int64_t base;
 
-    LOG_INFO("started recording audio to %s", filename);
-  } else {
-    fclose(aica->recording);
-    aica->recording = NULL;
+  SNAP_READ(snap, *ch);
+  SNAP_READ(snap, base);
+
+  ch->data = data;
+  ch->base = base >= 0 ? &aica->aram[base] : NULL;
+}
+
+static void aica_save_channel(struct aica *aica, struct aica_channel *ch,
+                              struct snapshot *snap) {
+  /* the channel points into the registers and wave memory, the registers are
+     always at the same place while the wave memory's offset is saved */
+  struct aica_channel tmp = *ch;
+  int64_t base = ch->base ? ch->base - aica->aram : -1;
+
+  tmp.data = NULL;
+  tmp.base = NULL;
+
+  SNAP_WRITE(snap, tmp);
+  SNAP_WRITE(snap, base);
+}
+
+/* the sample timer generates each batch of samples and raises the sample
+   interrupt. when mixing lazily, it's only needed while the interrupt is
+   enabled for either the arm7 or the sh4 */
+static void aica_update_sample_timer(struct aica *aica) {
+  struct scheduler *sched = aica->dc->sched;
+  uint32_t enabled_intr = aica->common_data->SCIEB | aica->common_data->MCIEB;
+  int needed = !aica->runif.enabled || (enabled_intr & (1 << AICA_INT_SAMPLE));
+
+  if (sched_in_worker(sched)) {
+    aica->deferred_sample_timer = 1;
+    return;
+  }
+
+  if (needed && !aica->sample_timer) {
+    aica->sample_timer =
+        sched_start_timer(sched, &aica_next_sample, aica,
+                          HZ_TO_NANO(AICA_SAMPLE_FREQ / AICA_BATCH_SIZE));
+  } else if (!needed && aica->sample_timer) {
+    sched_cancel_timer(sched, aica->sample_timer);
+    aica->sample_timer = NULL;
+  }
+}
+
+static void aica_load(struct device *dev, struct snapshot *snap) {
+  struct aica *aica = (struct aica *)dev;
+  struct scheduler *sched = aica->dc->sched;
+
+  SNAP_READ(snap, aica->reg);
+  SNAP_READ(snap, aica->arm_resetting);
+  for (int i = 0; i < 3; i++) {
+    aica->timers[i] = sched_load_timer(sched, snap);
+  }
+  aica->rtc_timer = sched_load_timer(sched, snap);
+  SNAP_READ(snap, aica->rtc_write);
+  SNAP_READ(snap, aica->rtc);
+  for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
+    aica_load_channel(aica, &aica->channels[i], snap);
+  }
+  aica->sample_timer = sched_load_timer(sched, snap);
+  SNAP_READ(snap, aica->deferred_sh_update);
+  SNAP_READ(snap, aica->deferred_timers);
+  SNAP_READ(snap, aica->deferred_periods);
+  SNAP_READ(snap, aica->deferred_sample_timer);
+  SNAP_READ(snap, aica->mix_remainder);
+
+  if (aica->dsp) {
+    aica_dsp_load(aica->dsp, snap);
+  }
 
-    LOG_INFO("stopped recording audio");
+  aica->active_channels = 0;
+  for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
+    if (aica->channels[i].active) {
+      aica->active_channels |= (uint64_t)1 << i;
+    }
+  }
+}
+
+static void aica_save(struct device *dev, struct snapshot *snap) {
+  struct aica *aica = (struct aica *)dev;
+  struct scheduler *sched = aica->dc->sched;
+
+  SNAP_WRITE(snap, aica->reg);
+  SNAP_WRITE(snap, aica->arm_resetting);
+  for (int i = 0; i < 3; i++) {
+    sched_save_timer(sched, snap, aica->timers[i]);
+  }
+  sched_save_timer(sched, snap, aica->rtc_timer);
+  SNAP_WRITE(snap, aica->rtc_write);
+  SNAP_WRITE(snap, aica->rtc);
+  for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
+    aica_save_channel(aica, &aica->channels[i], snap);
+  }
+  sched_save_timer(sched, snap, aica->sample_timer);
+  SNAP_WRITE(snap, aica->deferred_sh_update);
+  SNAP_WRITE(snap, aica->deferred_timers);
+  SNAP_WRITE(snap, aica->deferred_periods);
+  SNAP_WRITE(snap, aica->deferred_sample_timer);
+  SNAP_WRITE(snap, aica->mix_remainder);
+
+  if (aica->dsp) {
+    aica_dsp_save(aica->dsp, snap);
   }
 }
 
@@ -875,6 +1169,10 @@ static int aica_init(struct device *dev) {
 
   aica->aram = mem_aram(mem, 0x0);
 
+  if (OPTION_aica_dsp) {
+    aica->dsp = aica_dsp_create(aica->reg, aica->aram, OPTION_aica_dsp > 1);
+  }
+
   /* init channels */
   {
     for (int i = 0; i < AICA_NUM_CHANNELS; i++) {
@@ -883,9 +1181,7 @@ static int aica_init(struct device *dev) {
           (struct channel_data *)(aica->reg + sizeof(struct channel_data) * i);
     }
     aica->common_data = (struct common_data *)(aica->reg + 0x2800);
-    aica->sample_timer =
-        sched_start_timer(sched, &aica_next_sample, aica,
-                          HZ_TO_NANO(AICA_SAMPLE_FREQ / AICA_BATCH_SIZE));
+    aica_update_sample_timer(aica);
   }
 
   /* init timers */
@@ -907,6 +1203,8 @@ static int aica_init(struct device *dev) {
 
 void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
                     uint32_t mask) {
+  aica_sync_arm(aica);
+
   if (addr < 0x2000) {
     aica_channel_reg_write(aica, addr, data, mask);
     return;
@@ -919,9 +1217,16 @@ void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
   }
 
   WRITE_DATA(&aica->reg[addr]);
+
+  /* the effects processor's program lives in the MPRO registers */
+  if (aica->dsp && addr >= 0x3400 && addr < 0x3c00) {
+    aica_dsp_invalidate(aica->dsp);
+  }
 }
 
 uint32_t aica_reg_read(struct aica *aica, uint32_t addr, uint32_t mask) {
+  aica_sync_arm(aica);
+
   if (addr < 0x2000) {
     return aica_channel_reg_read(aica, addr, mask);
   } else if (addr >= 0x2800 && addr < 0x2d08) {
@@ -960,13 +1265,6 @@ void aica_set_clock(struct aica *aica, uint32_t time) {
 void aica_debug_menu(struct aica *aica) {
   if (igBeginMainMenuBar()) {
     if (igBeginMenu("AICA", 1)) {
-      const char *recording_label =
-          aica->recording ? "stop recording" : "start recording";
-
-      if (igMenuItem(recording_label, NULL, aica->recording, 1)) {
-        aica_toggle_recording(aica);
-      }
-
       if (igMenuItem("stream stats", NULL, aica->stream_stats, 1)) {
         aica->stream_stats = !aica->stream_stats;
       }
@@ -1024,12 +1322,14 @@ void aica_destroy(struct aica *aica) {
     }
   }
 
+  if (aica->dsp) {
+    aica_dsp_destroy(aica->dsp);
+  }
+
   dc_destroy_device((struct device *)aica);
 }
 
 struct aica *aica_create(struct dreamcast *dc) {
-  aica_init_tables();
-
   struct aica *aica =
       dc_create_device(dc, sizeof(struct aica), "aica", &aica_init, NULL);
 
@@ -1039,5 +1339,23 @@ struct aica *aica_create(struct dreamcast *dc) {
     ch->id = i;
   }
 
+  /* rather than being mixed from the sample timer, samples can be mixed on
+     demand, when the registers are accessed and at the end of each tick */
+  if (OPTION_aica_lazy_mix) {
+    aica->runif.enabled = 1;
+    aica->runif.running = 1;
+    aica->runif.run = &aica_run;
+    aica->runif.quantum = AICA_MIX_QUANTUM;
+  }
+
+  /* setup snapshot interface */
+  aica->snapif.enabled = 1;
+  aica->snapif.save = &aica_save;
+  aica->snapif.load = &aica_load;
+
+  /* setup timer callbacks */
+  aica->timer_cbs = aica_timer_cbs;
+  aica->num_timer_cbs = ARRAY_SIZE(aica_timer_cbs);
+
   return aica;
 }
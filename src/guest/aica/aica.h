@@ -23,4 +23,8 @@ uint32_t aica_reg_read(struct aica *aica, uint32_t addr, uint32_t mask);
 void aica_reg_write(struct aica *aica, uint32_t addr, uint32_t data,
                     uint32_t mask);
 
+/* mixes the next batch of frames from each channel, and pushes them to the
+   client. normally ran on each sample timer, exposed for benchmarking */
+void aica_generate_frames(struct aica *aica);
+
 #endif
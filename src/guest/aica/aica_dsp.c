@@ -0,0 +1,204 @@
+#include "guest/aica/aica_dsp.h"
+#include "core/core.h"
+#include "guest/snapshot.h"
+#include "jit/frontend/aicadsp/aicadsp_context.h"
+#include "jit/frontend/aicadsp/aicadsp_fallback.h"
+#include "jit/frontend/aicadsp/aicadsp_frontend.h"
+#include "jit/jit.h"
+#include "jit/jit_guest.h"
+#include "options.h"
+
+#if ARCH_X64
+#include "jit/backend/x64/x64_backend.h"
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
+#endif
+
+/* the backends which generate host code. without one, the program is always
+   interpreted */
+#define AICA_DSP_JIT (ARCH_X64 || ARCH_A64)
+
+struct aica_dsp {
+  struct aicadsp_context ctx;
+
+  /* number of steps ran each sample, 0 when the program is empty */
+  int num_steps;
+
+  /* the program has been written to since it was last ran */
+  int dirty;
+
+  /* jit, only present when compiling */
+  struct jit *jit;
+  struct jit_guest *guest;
+  struct jit_frontend *frontend;
+  struct jit_backend *backend;
+};
+
+/* the registers holding the program are handed to the jit as the guest's
+   memory, addressed from the first step */
+static uint8_t aica_dsp_read8(struct memory *mem, uint32_t addr) {
+  struct aica_dsp *dsp = (struct aica_dsp *)mem;
+  return dsp->ctx.reg[AICADSP_MPRO + addr];
+}
+
+static uint16_t aica_dsp_read16(struct memory *mem, uint32_t addr) {
+  struct aica_dsp *dsp = (struct aica_dsp *)mem;
+  return *(const uint16_t *)&dsp->ctx.reg[AICADSP_MPRO + addr];
+}
+
+static uint32_t aica_dsp_read32(struct memory *mem, uint32_t addr) {
+  struct aica_dsp *dsp = (struct aica_dsp *)mem;
+  return *(const uint32_t *)&dsp->ctx.reg[AICADSP_MPRO + addr];
+}
+
+static void aica_dsp_lookup(struct memory *mem, uint32_t addr, void **userdata,
+                            uint8_t **ptr, mem_read_cb *read,
+                            mem_write_cb *write) {
+  /* the program is invalidated explicitly when its registers are written,
+     there's no memory for the jit to watch */
+  if (userdata) {
+    *userdata = NULL;
+  }
+  if (ptr) {
+    *ptr = NULL;
+  }
+  if (read) {
+    *read = NULL;
+  }
+  if (write) {
+    *write = NULL;
+  }
+}
+
+static void aica_dsp_link_code(struct aica_dsp *dsp, void *branch,
+                               uint32_t target) {
+  jit_link_code(dsp->jit, branch, target);
+}
+
+static void aica_dsp_uncache_code(struct aica_dsp *dsp, uint32_t addr) {
+  jit_uncache_code(dsp->jit, addr);
+}
+
+static void aica_dsp_compile_code(struct aica_dsp *dsp, uint32_t addr) {
+  jit_compile_code(dsp->jit, addr);
+}
+
+static void aica_dsp_check_interrupts(struct aica_dsp *dsp) {}
+
+static struct jit_guest *aica_dsp_guest_create(struct aica_dsp *dsp) {
+  struct jit_guest *guest = calloc(1, sizeof(struct jit_guest));
+
+  /* dispatch cache, the program only ever being entered at its first step.
+     the dispatch tables assume addresses at least 32-bit aligned */
+  guest->addr_mask = (AICADSP_MAX_STEPS * AICADSP_STEP_SIZE - 1) & ~0x3;
+
+  /* memory interface */
+  guest->ctx = &dsp->ctx;
+  guest->mem = (struct memory *)dsp;
+  guest->lookup = &aica_dsp_lookup;
+  guest->r8 = &aica_dsp_read8;
+  guest->r16 = &aica_dsp_read16;
+  guest->r32 = &aica_dsp_read32;
+
+  /* runtime interface */
+  guest->data = dsp;
+  guest->offset_pc = (int)offsetof(struct aicadsp_context, pc);
+  guest->offset_cycles = (int)offsetof(struct aicadsp_context, run_cycles);
+  guest->offset_instrs = (int)offsetof(struct aicadsp_context, ran_instrs);
+  guest->offset_interrupts =
+      (int)offsetof(struct aicadsp_context, pending_interrupts);
+  guest->compile_code = (jit_compile_cb)&aica_dsp_compile_code;
+  guest->link_code = (jit_link_cb)&aica_dsp_link_code;
+  guest->uncache_code = (jit_uncache_cb)&aica_dsp_uncache_code;
+  guest->check_interrupts = (jit_interrupt_cb)&aica_dsp_check_interrupts;
+
+  return guest;
+}
+
+void aica_dsp_save(struct aica_dsp *dsp, struct snapshot *snap) {
+  SNAP_WRITE(snap, dsp->ctx.temp);
+  SNAP_WRITE(snap, dsp->ctx.mems);
+  SNAP_WRITE(snap, dsp->ctx.dec);
+}
+
+void aica_dsp_load(struct aica_dsp *dsp, struct snapshot *snap) {
+  SNAP_READ(snap, dsp->ctx.temp);
+  SNAP_READ(snap, dsp->ctx.mems);
+  SNAP_READ(snap, dsp->ctx.dec);
+
+  /* the program is restored along with the rest of the registers */
+  dsp->dirty = 1;
+}
+
+void aica_dsp_run(struct aica_dsp *dsp, const int32_t *mixs, int32_t *efreg) {
+  struct aicadsp_context *ctx = &dsp->ctx;
+
+  if (dsp->dirty) {
+    dsp->num_steps = aicadsp_num_steps(ctx->reg);
+    dsp->dirty = 0;
+
+    if (dsp->jit) {
+      jit_free_code(dsp->jit);
+    }
+  }
+
+  if (!dsp->num_steps) {
+    memset(efreg, 0, sizeof(ctx->efreg));
+    return;
+  }
+
+  memcpy(ctx->mixs, mixs, sizeof(ctx->mixs));
+
+  if (dsp->jit) {
+    /* blocks run until the cycles handed to them run out, each pass of the
+       program costing a cycle per step. with none handed to it, it's ran
+       through a single time */
+    ctx->pc = 0;
+    jit_run(dsp->jit, 0);
+  } else {
+    aicadsp_fallback_run(ctx, dsp->num_steps);
+  }
+
+  memcpy(efreg, ctx->efreg, sizeof(ctx->efreg));
+}
+
+void aica_dsp_invalidate(struct aica_dsp *dsp) {
+  dsp->dirty = 1;
+}
+
+void aica_dsp_destroy(struct aica_dsp *dsp) {
+  if (dsp->jit) {
+    jit_destroy(dsp->jit);
+    free(dsp->guest);
+    dsp->frontend->destroy(dsp->frontend);
+    dsp->backend->destroy(dsp->backend);
+  }
+
+  free(dsp);
+}
+
+struct aica_dsp *aica_dsp_create(uint8_t *reg, uint8_t *aram, int compile) {
+  struct aica_dsp *dsp = calloc(1, sizeof(struct aica_dsp));
+
+  dsp->ctx.reg = reg;
+  dsp->ctx.aram = aram;
+  dsp->dirty = 1;
+
+#if AICA_DSP_JIT
+  if (compile) {
+    DEFINE_JIT_CODE_BUFFER(aica_dsp_code);
+
+    dsp->guest = aica_dsp_guest_create(dsp);
+    dsp->frontend = aicadsp_frontend_create(dsp->guest);
+#if ARCH_X64
+    dsp->backend = x64_backend_create(dsp->guest, &aica_dsp_code,
+                                      JIT_CODE_BUFFER_SIZE, OPTION_jit_wx, 0);
+#else
+    dsp->backend = a64_backend_create(dsp->guest, &aica_dsp_code);
+#endif
+    dsp->jit = jit_create("aicadsp", dsp->frontend, dsp->backend);
+  }
+#endif
+
+  return dsp;
+}
@@ -0,0 +1,30 @@
+#ifndef AICA_DSP_H
+#define AICA_DSP_H
+
+#include <stdint.h>
+
+struct aica_dsp;
+struct snapshot;
+
+/*
+ * aica effects processor
+ *
+ * each sample, the program in the MPRO registers is ran over the channel
+ * inputs mixed into MIXS, producing the effect outputs in EFREG. when
+ * compiling, the program is translated into host code through the jit,
+ * otherwise it's interpreted
+ */
+struct aica_dsp *aica_dsp_create(uint8_t *reg, uint8_t *aram, int compile);
+void aica_dsp_destroy(struct aica_dsp *dsp);
+
+/* called when the program is written to, it's retranslated the next time it's
+   ran */
+void aica_dsp_invalidate(struct aica_dsp *dsp);
+
+/* runs the program for a single sample */
+void aica_dsp_run(struct aica_dsp *dsp, const int32_t *mixs, int32_t *efreg);
+
+void aica_dsp_load(struct aica_dsp *dsp, struct snapshot *snap);
+void aica_dsp_save(struct aica_dsp *dsp, struct snapshot *snap);
+
+#endif
@@ -4,6 +4,7 @@
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
 #include "guest/scheduler.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
 #include "jit/frontend/armv3/armv3_context.h"
 #include "jit/frontend/armv3/armv3_fallback.h"
@@ -11,14 +12,21 @@
 #include "jit/frontend/armv3/armv3_guest.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
+#include "options.h"
 #include "stats.h"
 
 #if ARCH_X64
 #include "jit/backend/x64/x64_backend.h"
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
 #else
 #include "jit/backend/interp/interp_backend.h"
 #endif
 
+/* minimum slice of time worth entering the jit for. the arm7 is synced early
+   on interrupts and when the sh4 accesses the aica registers */
+#define ARM7_QUANTUM INT64_C(100000)
+
 struct arm7 {
   struct device;
 
@@ -32,10 +40,29 @@ struct arm7 {
 
   /* interrupts */
   uint32_t requested_interrupts;
+
+  /* debug */
+  int fallback_stats;
 };
 
 static void arm7_update_pending_interrupts(struct arm7 *arm);
 
+/* swaps a mode's banked registers with the active set, entering the mode if
+   the user registers were active, or leaving it if its own were */
+static void arm7_swap_bank(struct arm7 *arm, int mode) {
+  const int *bank = armv3_reg_table[mode];
+
+  /* only fiq banks more than r13 and r14 */
+  int first = mode == MODE_FIQ ? 8 : 13;
+
+  for (int n = first; n < 15; n++) {
+    int banked_n = bank[n];
+    uint32_t tmp = arm->ctx.r[n];
+    arm->ctx.r[n] = arm->ctx.r[banked_n];
+    arm->ctx.r[banked_n] = tmp;
+  }
+}
+
 static void arm7_swap_registers(struct arm7 *arm, int old_mode, int new_mode) {
   if (old_mode == new_mode) {
     return;
@@ -46,22 +73,10 @@ static void arm7_swap_registers(struct arm7 *arm, int old_mode, int new_mode) {
     arm->ctx.r[armv3_spsr_table[old_mode]] = arm->ctx.r[SPSR];
   }
 
-  /* write out active registers to the old mode's bank, and load the
-     new mode's bank into the active registers */
-  for (int n = 0; n < 16; n++) {
-    int old_n = armv3_reg_table[old_mode][n];
-    int new_n = armv3_reg_table[new_mode][n];
-    uint32_t tmp = arm->ctx.r[n];
-    arm->ctx.r[n] = arm->ctx.r[old_n];
-    arm->ctx.r[new_n] = arm->ctx.r[old_n];
-    arm->ctx.r[old_n] = tmp;
-  }
-
-  /* save off pointers to the user bank for the LDM / STM instructions */
-  for (int n = 0; n < 16; n++) {
-    int new_n = armv3_reg_table[new_mode][n];
-    arm->ctx.rusr[n] = &arm->ctx.r[new_n];
-  }
+  /* only the registers banked by either mode are touched, going through the
+     user registers in between */
+  arm7_swap_bank(arm, old_mode);
+  arm7_swap_bank(arm, new_mode);
 
   /* load SPSR for the new mode to virtual SPSR */
   if (armv3_spsr_table[new_mode]) {
@@ -71,6 +86,10 @@ static void arm7_swap_registers(struct arm7 *arm, int old_mode, int new_mode) {
 
 static void arm7_switch_mode(void *data, uint32_t new_sr) {
   struct arm7 *arm = data;
+
+  /* the old CPSR is saved off to the new mode's SPSR */
+  armv3_flush_flags(&arm->ctx);
+
   int old_mode = arm->ctx.r[CPSR] & M_MASK;
   int new_mode = new_sr & M_MASK;
 
@@ -83,6 +102,10 @@ static void arm7_switch_mode(void *data, uint32_t new_sr) {
 
 static void arm7_restore_mode(void *data) {
   struct arm7 *arm = data;
+
+  /* any pending flags belong to the CPSR being replaced */
+  arm->ctx.flags_op = FLAGS_NONE;
+
   int old_mode = arm->ctx.r[CPSR] & M_MASK;
   int new_mode = arm->ctx.r[SPSR] & M_MASK;
 
@@ -100,11 +123,24 @@ static void arm7_update_pending_interrupts(struct arm7 *arm) {
   }
 
   arm->ctx.pending_interrupts = arm->requested_interrupts & interrupt_mask;
+
+  /* yield to the interrupt at the next block */
+  if (arm->ctx.pending_interrupts && !arm->ctx.yielding) {
+    arm->ctx.yield_cycles = arm->ctx.run_cycles;
+    arm->ctx.run_cycles = -1;
+    arm->ctx.yielding = 1;
+  }
 }
 
 static void arm7_check_interrupts(void *data) {
   struct arm7 *arm = data;
 
+  /* restore the cycles remaining before a yield was forced */
+  if (arm->ctx.yielding) {
+    arm->ctx.run_cycles = arm->ctx.yield_cycles;
+    arm->ctx.yielding = 0;
+  }
+
   if (!arm->ctx.pending_interrupts) {
     return;
   }
@@ -112,6 +148,8 @@ static void arm7_check_interrupts(void *data) {
   if ((arm->ctx.pending_interrupts & ARM7_INT_FIQ)) {
     arm->requested_interrupts &= ~ARM7_INT_FIQ;
 
+    armv3_flush_flags(&arm->ctx);
+
     uint32_t newsr = (arm->ctx.r[CPSR] & ~M_MASK);
     newsr |= I_MASK | F_MASK | MODE_FIQ;
 
@@ -125,6 +163,10 @@ static void arm7_link_code(struct arm7 *arm, void *branch, uint32_t target) {
   jit_link_code(arm->jit, branch, target);
 }
 
+static void arm7_uncache_code(struct arm7 *arm, uint32_t addr) {
+  jit_uncache_code(arm->jit, addr);
+}
+
 static void arm7_compile_code(struct arm7 *arm, uint32_t addr) {
   jit_compile_code(arm->jit, addr);
 }
@@ -155,6 +197,9 @@ uint32_t arm7_mem_read(struct arm7 *arm, uint32_t addr, uint32_t mask) {
 }
 
 void arm7_raise_interrupt(struct arm7 *arm, enum arm7_interrupt intr) {
+  /* catch up to the time the interrupt is raised at before taking it */
+  sched_sync(arm->dc->sched, (struct device *)arm);
+
   arm->requested_interrupts |= intr;
   arm7_update_pending_interrupts(arm);
 }
@@ -175,6 +220,10 @@ void arm7_reset(struct arm7 *arm) {
   arm->runif.running = 1;
 }
 
+struct jit *arm7_get_jit(struct arm7 *arm) {
+  return arm->runif.threaded ? NULL : arm->jit;
+}
+
 void arm7_suspend(struct arm7 *arm) {
   arm->runif.running = 0;
 }
@@ -184,11 +233,39 @@ static void arm7_run(struct device *dev, int64_t ns) {
   static int64_t ARM7_CLOCK_FREQ = INT64_C(20000000);
   int cycles = (int)NANO_TO_CYCLES(ns, ARM7_CLOCK_FREQ);
 
+  /* take any interrupt raised in between runs before starting, the yield it
+     forced being superseded by the new run's cycles */
+  arm->ctx.yielding = 0;
+  arm7_check_interrupts(arm);
+
   jit_run(arm->jit, cycles);
 
+  /* keep the CPSR up to date outside of the jit */
+  armv3_flush_flags(&arm->ctx);
+
   prof_counter_add(COUNTER_arm7_instrs, arm->ctx.ran_instrs);
 }
 
+static int arm7_code_restored(struct arm7 *arm, uint32_t addr, int size) {
+  return arm7_restored(arm->dc->mem, addr, size);
+}
+
+static void arm7_load(struct device *dev, struct snapshot *snap) {
+  struct arm7 *arm = (struct arm7 *)dev;
+
+  SNAP_READ(snap, arm->ctx);
+  SNAP_READ(snap, arm->requested_interrupts);
+
+  jit_invalidate_blocks(arm->jit, (jit_modified_cb)&arm7_code_restored, arm);
+}
+
+static void arm7_save(struct device *dev, struct snapshot *snap) {
+  struct arm7 *arm = (struct arm7 *)dev;
+
+  SNAP_WRITE(snap, arm->ctx);
+  SNAP_WRITE(snap, arm->requested_interrupts);
+}
+
 static void arm7_guest_destroy(struct jit_guest *guest) {
   free((struct armv3_guest *)guest);
 }
@@ -220,6 +297,7 @@ static struct jit_guest *arm7_guest_create(struct arm7 *arm) {
       (int)offsetof(struct armv3_context, pending_interrupts);
   guest->compile_code = (jit_compile_cb)&arm7_compile_code;
   guest->link_code = (jit_link_cb)&arm7_link_code;
+  guest->uncache_code = (jit_uncache_cb)&arm7_uncache_code;
   guest->check_interrupts = (jit_interrupt_cb)&arm7_check_interrupts;
   guest->switch_mode = (armv3_switch_mode_cb)&arm7_switch_mode;
   guest->restore_mode = (armv3_restore_mode_cb)&arm7_restore_mode;
@@ -235,7 +313,12 @@ static int arm7_init(struct device *dev) {
   arm->frontend = armv3_frontend_create(arm->guest);
 #if ARCH_X64
   DEFINE_JIT_CODE_BUFFER(arm7_code);
-  arm->backend = x64_backend_create(arm->guest, arm7_code, sizeof(arm7_code));
+  arm->backend =
+      x64_backend_create(arm->guest, &arm7_code, OPTION_jit_code_budget << 20,
+                         OPTION_jit_wx, OPTION_huge_pages);
+#elif ARCH_A64
+  DEFINE_JIT_CODE_BUFFER(arm7_code);
+  arm->backend = a64_backend_create(arm->guest, &arm7_code);
 #else
   arm->backend = interp_backend_create(arm->guest, arm->frontend);
 #endif
@@ -245,11 +328,64 @@ static int arm7_init(struct device *dev) {
 }
 
 #ifdef HAVE_IMGUI
+#define ARM7_FALLBACK_STATS_ROWS 32
+
+static void arm7_fallback_stats_menu(struct arm7 *arm) {
+  struct jit *jit = arm->jit;
+
+  if (igBegin("arm7 fallback stats", NULL, 0)) {
+    if (!jit->profile_code) {
+      igText("start profiling code to collect fallback stats");
+    }
+
+    igColumns(2, NULL, 0);
+
+    igText("op");
+    igNextColumn();
+    igText("execs");
+    igNextColumn();
+
+    struct jit_fallback_stat stats[ARM7_FALLBACK_STATS_ROWS];
+    int num_stats = jit_fallback_report(jit, stats, ARM7_FALLBACK_STATS_ROWS);
+
+    for (int i = 0; i < num_stats; i++) {
+      igText("%s", stats[i].def->name);
+      igNextColumn();
+      igText("%" PRIu64, stats[i].num_execs);
+      igNextColumn();
+    }
+
+    igEnd();
+  }
+}
+
 void arm7_debug_menu(struct arm7 *arm) {
+  struct jit *jit = arm->jit;
+
   if (igBeginMainMenuBar()) {
     if (igBeginMenu("ARM7", 1)) {
       if (igMenuItem("clear cache", NULL, 0, 1)) {
-        jit_invalidate_code(arm->jit);
+        jit_invalidate_code(jit);
+      }
+
+      if (!jit->profile_code) {
+        if (igMenuItem("start profiling code", NULL, 0, 1)) {
+          jit->profile_code = 1;
+          jit_invalidate_code(jit);
+        }
+      } else {
+        if (igMenuItem("stop profiling code", NULL, 1, 1)) {
+          jit->profile_code = 0;
+          jit_invalidate_code(jit);
+        }
+      }
+
+      if (igMenuItem("fallback stats", NULL, arm->fallback_stats, 1)) {
+        arm->fallback_stats = !arm->fallback_stats;
+      }
+
+      if (igMenuItem("dump fallback stats", NULL, 0, 1)) {
+        jit_dump_fallbacks(jit, JIT_FALLBACK_MAX_OPS);
       }
 
       igEndMenu();
@@ -257,6 +393,10 @@ void arm7_debug_menu(struct arm7 *arm) {
 
     igEndMainMenuBar();
   }
+
+  if (arm->fallback_stats) {
+    arm7_fallback_stats_menu(arm);
+  }
 }
 #endif
 
@@ -275,6 +415,27 @@ struct arm7 *arm7_create(struct dreamcast *dc) {
   /* setup run interface */
   arm->runif.enabled = 1;
   arm->runif.run = &arm7_run;
+  arm->runif.quantum = ARM7_QUANTUM;
+
+  /* setup snapshot interface */
+  arm->snapif.enabled = 1;
+  arm->snapif.save = &arm7_save;
+  arm->snapif.load = &arm7_load;
+
+  /* the arm7 can run in parallel with the sh4, being handed time in chunks of
+     the requested interval. the aica's registers and interrupts still sync it
+     with the sh4 whenever they're accessed */
+  if (OPTION_aica_thread > 0) {
+    if (OPTION_jit_smc) {
+      /* code page watches are serviced by whichever thread writes to the page,
+         which would invalidate the arm7's code from under it */
+      LOG_WARNING("aica_thread isn't supported with jit_smc, running the arm7 "
+                  "on the emulation thread");
+    } else {
+      arm->runif.threaded = 1;
+      arm->runif.quantum = OPTION_aica_thread * INT64_C(1000);
+    }
+  }
 
   return arm;
 }
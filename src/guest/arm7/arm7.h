@@ -5,23 +5,29 @@
 
 struct arm7;
 struct dreamcast;
+struct jit;
 
 enum arm7_interrupt {
   ARM7_INT_FIQ = 0x1,
 };
 
 /* clang-format off */
-#define ARM7_AICA_MEM_BEGIN 0x00000000
-#define ARM7_AICA_MEM_END   0x001fffff
+#define ARM7_AICA_MEM_BEGIN      0x00000000
+#define ARM7_AICA_MEM_END        0x001fffff
+#define ARM7_AICA_MEM_MIRROR_END 0x007fffff
 
-#define ARM7_AICA_REG_BEGIN 0x00800000
-#define ARM7_AICA_REG_END   0x009fffff
+#define ARM7_AICA_REG_BEGIN      0x00800000
+#define ARM7_AICA_REG_END        0x009fffff
 /* clang-format on */
 
 struct arm7 *arm7_create(struct dreamcast *dc);
 void arm7_destroy(struct arm7 *arm);
 
 void arm7_debug_menu(struct arm7 *arm);
+
+/* returns the jit the arm7's code runs under, or NULL when it's ran on a
+   thread of its own */
+struct jit *arm7_get_jit(struct arm7 *arm);
 void arm7_suspend(struct arm7 *arm);
 void arm7_reset(struct arm7 *arm);
 void arm7_raise_interrupt(struct arm7 *arm, enum arm7_interrupt intr);
@@ -12,6 +12,8 @@
 #include "guest/rom/boot.h"
 #include "guest/rom/flash.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
+#include "jit/jit.h"
 #include "options.h"
 
 /* address of syscall vectors */
@@ -34,7 +36,13 @@ enum {
   SYSCALL_SYSTEM = 0x0c000800,
 };
 
-static uint32_t bios_local_time() {
+/* address IP.BIN and 1ST_READ.BIN are loaded to */
+enum {
+  BOOT1_ADDR = 0x8c008000,
+  BOOT2_ADDR = 0x8c010000,
+};
+
+uint32_t bios_local_time() {
   /* dreamcast system time is relative to 1/1/1950 00:00 UTC, while the libc
      time functions are relative to 1/1/1970 00:00 UTC. subtract 20 years and
      5 leap days from the current time to match them up. note, mktime / difftime
@@ -134,6 +142,24 @@ static void bios_override_settings(struct bios *bios) {
   aica_set_clock(dc->aica, time);
 }
 
+void bios_set_clock(struct bios *bios, uint32_t time) {
+  struct dreamcast *dc = bios->dc;
+  struct flash *flash = dc->flash;
+  struct flash_syscfg_block syscfg;
+
+  /* the user settings are always valid once overridden on init */
+  int res = flash_read_block(flash, FLASH_PT_USER, FLASH_USER_SYSCFG, &syscfg);
+  CHECK_EQ(res, 1);
+
+  syscfg.time_lo = time & 0xffff;
+  syscfg.time_hi = (time & 0xffff0000) >> 16;
+
+  res = flash_write_block(flash, FLASH_PT_USER, FLASH_USER_SYSCFG, &syscfg);
+  CHECK_EQ(res, 1);
+
+  aica_set_clock(dc->aica, time);
+}
+
 static void bios_validate_flash(struct bios *bios) {
   struct dreamcast *dc = bios->dc;
   struct flash *flash = dc->flash;
@@ -221,6 +247,16 @@ static int bios_post_init(struct device *dev) {
   boot_rom_write(boot, SYSCALL_SYSTEM - SH4_AREA3_BEGIN, 0x0, 0xffff);
 #endif
 
+  /* the same patching is used to have only the gdrom syscalls of a real bios
+     trap into their hle handlers, saving the guest from driving the emulated
+     drive through its command handshakes for every read. when no bios was
+     loaded, the rom is already empty and every syscall is handled anyway */
+  if (OPTION_gdrom_hle) {
+    struct boot *boot = bios->dc->boot;
+    boot_rom_write(boot, SYSCALL_GDROM - SH4_AREA3_BEGIN, 0x0, 0xffff);
+    boot_rom_write(boot, SYSCALL_GDROM2 - SH4_AREA3_BEGIN, 0x0, 0xffff);
+  }
+
   return 1;
 }
 
@@ -231,8 +267,6 @@ void bios_boot(struct bios *bios) {
   struct sh4 *sh4 = dc->sh4;
   struct sh4_context *ctx = &sh4->ctx;
 
-  const uint32_t BOOT1_ADDR = 0x8c008000;
-  const uint32_t BOOT2_ADDR = 0x8c010000;
   const uint32_t SYSINFO_ADDR = 0x8c000068;
 
   LOG_INFO("bios_boot using hle bootstrap");
@@ -289,6 +323,15 @@ void bios_boot(struct bios *bios) {
     free(tmp);
   }
 
+  /* trap on entering the bootfile, giving the machine a chance to keep its
+     state for resuming later loads of the disc from. the bootfile has only
+     just been written, so no code for it has been compiled yet */
+  if (OPTION_boot_cache) {
+    bios->boot_instr = sh4_read16(dc->mem, BOOT2_ADDR);
+    bios->boot_trap = 1;
+    sh4_write16(dc->mem, BOOT2_ADDR, 0);
+  }
+
   /* write system info */
   {
     uint8_t data[24] = {0};
@@ -335,6 +378,20 @@ int bios_invalid_instr(struct bios *bios) {
     return 1;
   }
 
+  if (bios->boot_trap && pc == (BOOT2_ADDR & 0x1cffffff)) {
+    /* restore the original instruction and throw out the block trapping on
+       it, code is still executing so it can't be freed outright */
+    sh4_write16(dc->mem, BOOT2_ADDR, bios->boot_instr);
+    jit_invalidate_code(dc->sh4->jit);
+    bios->boot_trap = 0;
+
+    /* force a break from dispatch */
+    ctx->run_cycles = 0;
+
+    dc_boot_entered(dc);
+    return 1;
+  }
+
   int handled = 1;
 
   switch (pc) {
@@ -371,8 +428,38 @@ void bios_destroy(struct bios *bios) {
   free(bios);
 }
 
+static void bios_load(struct device *dev, struct snapshot *snap) {
+  struct bios *bios = (struct bios *)dev;
+
+  SNAP_READ(snap, bios->status);
+  SNAP_READ(snap, bios->cmd_id);
+  SNAP_READ(snap, bios->cmd_code);
+  SNAP_READ(snap, bios->params);
+  SNAP_READ(snap, bios->result);
+  SNAP_READ(snap, bios->boot_trap);
+  SNAP_READ(snap, bios->boot_instr);
+}
+
+static void bios_save(struct device *dev, struct snapshot *snap) {
+  struct bios *bios = (struct bios *)dev;
+
+  SNAP_WRITE(snap, bios->status);
+  SNAP_WRITE(snap, bios->cmd_id);
+  SNAP_WRITE(snap, bios->cmd_code);
+  SNAP_WRITE(snap, bios->params);
+  SNAP_WRITE(snap, bios->result);
+  SNAP_WRITE(snap, bios->boot_trap);
+  SNAP_WRITE(snap, bios->boot_instr);
+}
+
 struct bios *bios_create(struct dreamcast *dc) {
   struct bios *bios =
       dc_create_device(dc, sizeof(struct bios), "bios", NULL, &bios_post_init);
+
+  /* setup snapshot interface */
+  bios->snapif.enabled = 1;
+  bios->snapif.save = &bios_save;
+  bios->snapif.load = &bios_load;
+
   return bios;
 }
@@ -13,6 +13,11 @@ struct bios {
   uint32_t cmd_code;
   uint32_t params[4];
   uint32_t result[4];
+
+  /* the boot file's first instruction, replaced with an invalid one to trap
+     on entering it */
+  int boot_trap;
+  uint16_t boot_instr;
 };
 
 struct bios *bios_create(struct dreamcast *dc);
@@ -21,4 +26,11 @@ void bios_destroy(struct bios *bios);
 int bios_invalid_instr(struct bios *bios);
 void bios_boot(struct bios *bios);
 
+/* current local time in seconds since 1/1/1950, as the system clock is set
+   to on init */
+uint32_t bios_local_time();
+
+/* sets the system clock, as if it had been set to time on init */
+void bios_set_clock(struct bios *bios, uint32_t time);
+
 #endif
@@ -13,6 +13,9 @@
 #define LOG_SYSCALL(...)
 #endif
 
+/* system ram, mirrored throughout area 3 */
+#define BIOS_RAM_SIZE 0x1000000
+
 /*
  * system syscalls
  */
@@ -195,13 +198,33 @@ static void bios_gdrom_mainloop(struct bios *bios) {
 
       int read = 0;
       int rem = 0;
-      uint8_t tmp[DISC_MAX_SECTOR_SIZE];
 
-      for (int i = fad; i < fad + num_sectors; i++) {
-        int n = gdrom_read_sectors(gd, i, 1, fmt, mask, tmp, sizeof(tmp));
-        sh4_memcpy_to_guest(dc->mem, dst + read, tmp, n);
-        read += n;
-        rem -= n;
+      /* when the destination lies in system ram, the whole request is read
+         straight into it with a single run of sectors */
+      uint32_t addr = dst & 0x1fffffff;
+      uint8_t *ram = NULL;
+      int ram_size = 0;
+
+      if (addr >= SH4_AREA3_BEGIN && addr <= SH4_AREA3_END) {
+        uint32_t offset = addr & (BIOS_RAM_SIZE - 1);
+        ram = mem_ram(dc->mem, offset);
+        ram_size = BIOS_RAM_SIZE - offset;
+      }
+
+      int size = num_sectors * DISC_MAX_SECTOR_SIZE;
+
+      if (ram && size <= ram_size) {
+        read = gdrom_read_sectors(gd, fad, num_sectors, fmt, mask, ram,
+                                  ram_size);
+      } else {
+        uint8_t tmp[DISC_MAX_SECTOR_SIZE];
+
+        for (int i = fad; i < fad + num_sectors; i++) {
+          int n = gdrom_read_sectors(gd, i, 1, fmt, mask, tmp, sizeof(tmp));
+          sh4_memcpy_to_guest(dc->mem, dst + read, tmp, n);
+          read += n;
+          rem -= n;
+        }
       }
 
       /* record size transferred */
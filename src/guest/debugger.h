@@ -6,6 +6,16 @@
 struct dreamcast;
 struct debugger;
 
+/* breakpoint types passed to each device's add_bp / rem_bp, matching the
+   types used by the gdb remote protocol */
+enum debugger_bp_type {
+  DEBUGGER_BP_SW,
+  DEBUGGER_BP_HW,
+  DEBUGGER_BP_WRITE,
+  DEBUGGER_BP_READ,
+  DEBUGGER_BP_ACCESS,
+};
+
 struct debugger *debugger_create(struct dreamcast *dc);
 void debugger_destroy(struct debugger *dbg);
 
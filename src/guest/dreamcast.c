@@ -1,8 +1,11 @@
 #include "guest/dreamcast.h"
 #include "core/core.h"
+#include "core/filesystem.h"
+#include "core/version.h"
 #include "guest/aica/aica.h"
 #include "guest/arm7/arm7.h"
 #include "guest/bios/bios.h"
+#include "guest/bios/flash.h"
 #include "guest/debugger.h"
 #include "guest/gdrom/gdrom.h"
 #include "guest/holly/holly.h"
@@ -10,10 +13,325 @@
 #include "guest/memory.h"
 #include "guest/pvr/pvr.h"
 #include "guest/pvr/ta.h"
+#include "guest/reg_stats.h"
 #include "guest/rom/boot.h"
 #include "guest/rom/flash.h"
+#include "guest/sample_profile.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
+#include "options.h"
+
+/* initial size of the device state arena, enough to hold the state of every
+   device along with a few frames of ta parameters */
+#define DC_SNAPSHOT_SIZE (4 * 1024 * 1024)
+
+/* snapshots don't refer to host memory, so besides being kept in memory for
+   the life of the machine, they're written out to the application directory
+   and resumed from on later runs */
+#define DC_BOOT_MAGIC 0x544f4f42
+
+struct dc_boot {
+  uint64_t key;
+  struct snapshot *snap;
+  struct list_node it;
+};
+
+struct dc_boot_header {
+  uint64_t key;
+  /* hash of the state and memory following the header */
+  uint64_t hash;
+  uint32_t magic;
+  int32_t size;
+  int32_t mem_size;
+};
+
+static uint64_t dc_boot_hash(struct snapshot *snap) {
+  uint64_t hash = hash_bytes(snap->data, snap->size, 0);
+  return hash_bytes(snap->mem, snap->mem_size, hash);
+}
+
+static uint64_t dc_boot_key(struct dreamcast *dc, struct disc *disc) {
+  uint8_t tmp[DISC_MAX_SECTOR_SIZE * 16];
+
+  /* the layout of the snapshot depends on the build, and on whether the aica
+     has a dsp to save the state of */
+  uint64_t key = hash_bytes(GIT_VERSION, (int)sizeof(GIT_VERSION), 0);
+  int aica_dsp = OPTION_aica_dsp != 0;
+  key = hash_bytes(&aica_dsp, sizeof(aica_dsp), key);
+
+  /* the disc is identified by its IP.BIN and the location of its boot file,
+     and the state it boots into further depends on the flash and boot roms */
+  key = hash_bytes(disc->uid, (int)strlen(disc->uid), key);
+
+  struct gd_session_info ses;
+  gdrom_get_session(dc->gdrom, 2, &ses);
+  int read = gdrom_read_sectors(dc->gdrom, ses.fad, 16, GD_SECTOR_ANY,
+                                GD_MASK_DATA, tmp, sizeof(tmp));
+  key = hash_bytes(tmp, read, key);
+
+  const struct disc_file *file = disc_lookup_file(disc, disc->bootnme);
+  if (file) {
+    key = hash_bytes(&file->fad, sizeof(file->fad), key);
+    key = hash_bytes(&file->len, sizeof(file->len), key);
+  }
+
+  /* the bios rewrites the clock in the user settings each time it's created,
+     moving them to a new block of the partition. hash the settings themselves
+     in place of that partition's raw contents, without the clock or the crc
+     covering it at the end of the block */
+  for (int part_id = 0; part_id < FLASH_PT_NUM; part_id++) {
+    if (part_id == FLASH_PT_USER) {
+      struct flash_syscfg_block syscfg;
+      memset(&syscfg, 0, sizeof(syscfg));
+      flash_read_block(dc->flash, FLASH_PT_USER, FLASH_USER_SYSCFG, &syscfg);
+      syscfg.time_lo = 0;
+      syscfg.time_hi = 0;
+      key = hash_bytes(&syscfg, (int)offsetof(struct flash_syscfg_block,
+                                              reserved), key);
+      continue;
+    }
+
+    int offset, size;
+    flash_partition_info(part_id, &offset, &size);
+
+    for (int i = 0; i < size; i += (int)sizeof(tmp)) {
+      int n = MIN(size - i, (int)sizeof(tmp));
+      flash_read(dc->flash, offset + i, tmp, n);
+      key = hash_bytes(tmp, n, key);
+    }
+  }
+
+  const int boot_size = 0x200000;
+  for (int i = 0; i < boot_size; i += (int)sizeof(tmp)) {
+    int n = MIN(boot_size - i, (int)sizeof(tmp));
+    boot_read(dc->boot, i, tmp, n);
+    key = hash_bytes(tmp, n, key);
+  }
+
+  return key;
+}
+
+static void dc_boot_dir(char *dir, size_t size) {
+  snprintf(dir, size, "%s" PATH_SEPARATOR "boot-cache", fs_appdir());
+  CHECK(fs_mkdir(dir));
+}
+
+static void dc_boot_path(uint64_t key, char *path, size_t size) {
+  char dir[PATH_MAX];
+  dc_boot_dir(dir, sizeof(dir));
+  snprintf(path, size, "%s" PATH_SEPARATOR "%016" PRIx64 ".bin", dir, key);
+}
+
+static struct dc_boot *dc_lookup_boot(struct dreamcast *dc, uint64_t key) {
+  list_for_each_entry(boot, &dc->boot_cache, struct dc_boot, it) {
+    if (boot->key == key) {
+      return boot;
+    }
+  }
+  return NULL;
+}
+
+static void dc_touch_boot(struct dreamcast *dc, struct dc_boot *boot) {
+  list_remove(&dc->boot_cache, &boot->it);
+  list_add(&dc->boot_cache, &boot->it);
+}
+
+static void dc_free_boot(struct dreamcast *dc, struct dc_boot *boot) {
+  list_remove(&dc->boot_cache, &boot->it);
+  dc->num_boot_cache--;
+  dc_destroy_snapshot(dc, boot->snap);
+  free(boot);
+}
+
+static struct dc_boot *dc_alloc_boot(struct dreamcast *dc, uint64_t key) {
+  struct dc_boot *boot = NULL;
+
+  if (dc->num_boot_cache < OPTION_boot_cache) {
+    boot = calloc(1, sizeof(struct dc_boot));
+    boot->snap = dc_create_snapshot(dc);
+    list_add(&dc->boot_cache, &boot->it);
+    dc->num_boot_cache++;
+  } else {
+    /* reuse the least recently used entry */
+    boot = list_first_entry(&dc->boot_cache, struct dc_boot, it);
+  }
+
+  boot->key = key;
+  dc_touch_boot(dc, boot);
+
+  return boot;
+}
+
+static void dc_prune_boots(struct dreamcast *dc) {
+  char dir[PATH_MAX];
+  dc_boot_dir(dir, sizeof(dir));
+
+  /* remove the oldest files until no more are left than are kept in memory */
+  while (1) {
+    char oldest[PATH_MAX] = {0};
+    int64_t oldest_mtime = INT64_MAX;
+    int num_files = 0;
+
+    DIR *dp = opendir(dir);
+    if (!dp) {
+      return;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dp))) {
+      if (!strstr(de->d_name, ".bin")) {
+        continue;
+      }
+
+      char path[PATH_MAX];
+      int64_t size, mtime;
+      snprintf(path, sizeof(path), "%s" PATH_SEPARATOR "%s", dir, de->d_name);
+      if (!fs_stat(path, &size, &mtime)) {
+        continue;
+      }
+
+      if (mtime < oldest_mtime) {
+        snprintf(oldest, sizeof(oldest), "%s", path);
+        oldest_mtime = mtime;
+      }
+      num_files++;
+    }
+
+    closedir(dp);
+
+    if (num_files <= OPTION_boot_cache) {
+      return;
+    }
+
+    if (remove(oldest)) {
+      LOG_WARNING("dc_prune_boots failed to remove %s", oldest);
+      return;
+    }
+  }
+}
+
+static void dc_write_boot(struct dreamcast *dc, struct dc_boot *boot) {
+  struct snapshot *snap = boot->snap;
+
+  /* the state at boot is nowhere near the arena's initial size, anything
+     larger isn't worth keeping around and wouldn't be read back in */
+  if (snap->size > DC_SNAPSHOT_SIZE) {
+    LOG_WARNING("dc_write_boot state too large, size=%d", snap->size);
+    return;
+  }
+
+  char path[PATH_MAX];
+  dc_boot_path(boot->key, path, sizeof(path));
+
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    LOG_WARNING("dc_write_boot failed to open %s", path);
+    return;
+  }
+
+  /* saves only copy the pages of memory modified since the last one, but the
+     snapshot's copy is always of all of it */
+  struct dc_boot_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.key = boot->key;
+  hdr.hash = dc_boot_hash(snap);
+  hdr.magic = DC_BOOT_MAGIC;
+  hdr.size = snap->size;
+  hdr.mem_size = snap->mem_size;
+  int res = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+            fwrite(snap->data, snap->size, 1, fp) == 1 &&
+            fwrite(snap->mem, snap->mem_size, 1, fp) == 1;
+  fclose(fp);
+
+  if (!res) {
+    LOG_WARNING("dc_write_boot failed to write %s", path);
+    remove(path);
+    return;
+  }
+
+  LOG_INFO("dc_write_boot wrote %s", path);
+
+  dc_prune_boots(dc);
+}
+
+static struct dc_boot *dc_read_boot(struct dreamcast *dc, uint64_t key) {
+  char path[PATH_MAX];
+  dc_boot_path(key, path, sizeof(path));
+
+  int64_t file_size, mtime;
+  if (!fs_stat(path, &file_size, &mtime)) {
+    return NULL;
+  }
+
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return NULL;
+  }
+
+  struct dc_boot_header hdr;
+  struct dc_boot *boot = NULL;
+
+  /* the sizes are checked against the file's before allocating anything, a
+     truncated or otherwise corrupt file is thrown out for a cold boot */
+  if (fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == DC_BOOT_MAGIC &&
+      hdr.key == key && hdr.size > 0 && hdr.size <= DC_SNAPSHOT_SIZE &&
+      hdr.mem_size > 0 &&
+      file_size == (int64_t)sizeof(hdr) + hdr.size + hdr.mem_size) {
+    boot = dc_alloc_boot(dc, key);
+
+    struct snapshot *snap = boot->snap;
+    snap_resize(snap, hdr.size);
+
+    if (hdr.mem_size != snap->mem_size ||
+        fread(snap->data, hdr.size, 1, fp) != 1 ||
+        fread(snap->mem, hdr.mem_size, 1, fp) != 1 ||
+        dc_boot_hash(snap) != hdr.hash) {
+      dc_free_boot(dc, boot);
+      boot = NULL;
+    } else {
+      /* nothing in memory is known to match the copy read in, mark every page
+         as modified for it to be restored in its entirety when loaded */
+      bitmap_set(snap->mem_dirty, 0, snap->mem_num_pages);
+      mem_invalidate_pages(dc->mem, snap->mem_dirty);
+      snap->mem_gen = 0;
+    }
+  }
+
+  fclose(fp);
+
+  if (!boot) {
+    LOG_WARNING("dc_read_boot discarding invalid %s", path);
+    remove(path);
+    return NULL;
+  }
+
+  LOG_INFO("dc_read_boot read %s", path);
+
+  return boot;
+}
+
+static void dc_cache_boot(struct dreamcast *dc) {
+  struct dc_boot *boot = dc_lookup_boot(dc, dc->boot_key);
+
+  if (boot) {
+    dc_touch_boot(dc, boot);
+  } else {
+    boot = dc_alloc_boot(dc, dc->boot_key);
+  }
+
+  dc_save_snapshot(dc, boot->snap);
+
+  LOG_INFO("dc_cache_boot saved boot state key=0x%" PRIx64, boot->key);
+
+  dc_write_boot(dc, boot);
+}
+
+static void dc_destroy_boot_cache(struct dreamcast *dc) {
+  list_for_each_entry_safe(boot, &dc->boot_cache, struct dc_boot, it) {
+    dc_free_boot(dc, boot);
+  }
+}
 
 void dc_vblank_out(struct dreamcast *dc) {
   if (!dc->vblank_out) {
@@ -31,6 +349,14 @@ void dc_vblank_in(struct dreamcast *dc, int video_disabled) {
   dc->vblank_in(dc->userdata, video_disabled);
 }
 
+void dc_poll_input(struct dreamcast *dc) {
+  if (!dc->poll_input) {
+    return;
+  }
+
+  dc->poll_input(dc->userdata);
+}
+
 void dc_finish_render(struct dreamcast *dc) {
   if (!dc->finish_render) {
     return;
@@ -47,12 +373,20 @@ void dc_start_render(struct dreamcast *dc, struct ta_context *ctx) {
   dc->start_render(dc->userdata, ctx);
 }
 
-void dc_push_pixels(struct dreamcast *dc, const uint8_t *data, int w, int h) {
+uint32_t *dc_map_pixels(struct dreamcast *dc, int w, int h) {
+  if (!dc->map_pixels) {
+    return NULL;
+  }
+
+  return dc->map_pixels(dc->userdata, w, h);
+}
+
+void dc_push_pixels(struct dreamcast *dc, int w, int h) {
   if (!dc->push_pixels) {
     return;
   }
 
-  dc->push_pixels(dc->userdata, data, w, h);
+  dc->push_pixels(dc->userdata, w, h);
 }
 
 void dc_push_audio(struct dreamcast *dc, const int16_t *data, int frames) {
@@ -86,12 +420,65 @@ void *dc_create_device(struct dreamcast *dc, size_t size, const char *name,
   dev->name = name;
   dev->init = init;
   dev->post_init = post_init;
+  /* counters and zones are shared by the same device of every machine */
+  char counter[64];
+  snprintf(counter, sizeof(counter), "%s_run_ns", name);
+  dev->run_ns = prof_get_aggregate_token(counter);
+  snprintf(counter, sizeof(counter), "%s_timer_ns", name);
+  dev->timer_ns = prof_get_aggregate_token(counter);
+  dev->run_zone = prof_get_zone_token(name);
 
   list_add(&dc->devices, &dev->it);
 
   return dev;
 }
 
+void dc_load_snapshot(struct dreamcast *dc, struct snapshot *snap) {
+  CHECK(snap->size, "dc_load_snapshot snapshot was never saved");
+
+  /* restore memory first, letting devices check what was overwritten by it
+     when loading their own state */
+  mem_load(dc->mem, snap);
+
+  snap_rewind(snap);
+  sched_load(dc->sched, snap);
+
+  list_for_each_entry(dev, &dc->devices, struct device, it) {
+    SNAP_READ(snap, dev->runif.running);
+
+    if (dev->snapif.enabled) {
+      dev->snapif.load(dev, snap);
+    }
+  }
+
+  CHECK_EQ(snap->cursor, snap->size);
+}
+
+void dc_save_snapshot(struct dreamcast *dc, struct snapshot *snap) {
+  snap_reset(snap);
+  sched_save(dc->sched, snap);
+
+  list_for_each_entry(dev, &dc->devices, struct device, it) {
+    SNAP_WRITE(snap, dev->runif.running);
+
+    if (dev->snapif.enabled) {
+      dev->snapif.save(dev, snap);
+    }
+  }
+
+  mem_save(dc->mem, snap);
+}
+
+void dc_destroy_snapshot(struct dreamcast *dc, struct snapshot *snap) {
+  snap_destroy(snap);
+}
+
+struct snapshot *dc_create_snapshot(struct dreamcast *dc) {
+  struct snapshot *snap = snap_create(DC_SNAPSHOT_SIZE);
+  mem_alloc_snapshot(dc->mem, snap);
+  return snap;
+}
+
 void dc_remove_serial_device(struct dreamcast *dc) {
   dc->serial = NULL;
 }
@@ -104,7 +491,16 @@ void dc_input(struct dreamcast *dc, int port, int button, int16_t value) {
   maple_handle_input(dc->maple, port, button, value);
 }
 
+DEFINE_ZONE(dc_tick);
+
 void dc_tick(struct dreamcast *dc, int64_t ns) {
+  PROF_ENTER(dc_tick);
+
+  /* the sampler is bound to the thread it's started on */
+  if (OPTION_sample_rate && !dc->sample_profile) {
+    dc->sample_profile = sample_profile_create(dc, OPTION_sample_rate);
+  }
+
   if (dc->debugger) {
     debugger_tick(dc->debugger);
   }
@@ -112,6 +508,28 @@ void dc_tick(struct dreamcast *dc, int64_t ns) {
   if (dc->running) {
     sched_tick(dc->sched, ns);
   }
+
+  if (dc->sample_profile) {
+    sample_profile_update(dc->sample_profile);
+  }
+
+  /* snapshots can only be saved in between ticks, the break on entering the
+     boot file leaves the machine right at its entry point */
+  if (dc->boot_entered) {
+    dc->boot_entered = 0;
+    dc_cache_boot(dc);
+  }
+
+  PROF_LEAVE(dc_tick);
+}
+
+void dc_boot_entered(struct dreamcast *dc) {
+  dc->boot_entered = 1;
+  dc_break(dc);
+}
+
+void dc_break(struct dreamcast *dc) {
+  sched_break(dc->sched);
 }
 
 void dc_resume(struct dreamcast *dc) {
@@ -120,6 +538,10 @@ void dc_resume(struct dreamcast *dc) {
 
 void dc_suspend(struct dreamcast *dc) {
   dc->running = 0;
+
+  /* make sure saves aren't lost if the process doesn't come back */
+  maple_sync(dc->maple);
+  flash_sync(dc->flash);
 }
 
 int dc_running(struct dreamcast *dc) {
@@ -160,8 +582,40 @@ static int dc_load_disc(struct dreamcast *dc, const char *path) {
     return 0;
   }
 
-  /* boot to bios bootstrap */
+  if (OPTION_disc_prefetch) {
+    disc_start_prefetch(disc, OPTION_disc_prefetch);
+  }
+
   gdrom_set_disc(dc->gdrom, disc);
+  dc->boot_resumed = 0;
+
+  /* resume from the state previously saved on entering the disc's boot file,
+     skipping the bootstrap entirely */
+  if (OPTION_boot_cache) {
+    dc->boot_key = dc_boot_key(dc, disc);
+
+    struct dc_boot *boot = dc_lookup_boot(dc, dc->boot_key);
+    if (boot) {
+      dc_touch_boot(dc, boot);
+    } else {
+      boot = dc_read_boot(dc, dc->boot_key);
+    }
+
+    if (boot) {
+      LOG_INFO("dc_load_disc resuming from boot state key=0x%" PRIx64,
+               boot->key);
+      dc_load_snapshot(dc, boot->snap);
+
+      /* the snapshot carries the clock from when it was taken */
+      bios_set_clock(dc->bios, bios_local_time());
+
+      dc->boot_resumed = 1;
+      dc_resume(dc);
+      return 1;
+    }
+  }
+
+  /* boot to bios bootstrap */
   sh4_reset(dc->sh4, 0xa0000000);
   dc_resume(dc);
 
@@ -213,6 +667,12 @@ int dc_init(struct dreamcast *dc) {
 }
 
 void dc_destroy(struct dreamcast *dc) {
+  if (dc->sample_profile) {
+    sample_profile_destroy(dc->sample_profile);
+  }
+
+  dc_destroy_boot_cache(dc);
+
   ta_destroy(dc->ta);
   pvr_destroy(dc->pvr);
   maple_destroy(dc->maple);
@@ -226,6 +686,7 @@ void dc_destroy(struct dreamcast *dc) {
   bios_destroy(dc->bios);
   sched_destroy(dc->sched);
   mem_destroy(dc->mem);
+  reg_stats_destroy(dc->reg_stats);
   if (dc->debugger) {
     debugger_destroy(dc->debugger);
   }
@@ -239,6 +700,7 @@ struct dreamcast *dc_create() {
 #ifndef NDEBUG
   dc->debugger = debugger_create(dc);
 #endif
+  dc->reg_stats = reg_stats_create();
   dc->mem = mem_create(dc);
   dc->sched = sched_create(dc);
   dc->bios = bios_create(dc);
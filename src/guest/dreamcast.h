@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include "core/constructor.h"
 #include "core/list.h"
+#include "core/profiler.h"
+#include "guest/scheduler.h"
 #include "host/keycode.h"
 
 struct aica;
@@ -20,8 +22,10 @@ struct holly;
 struct maple;
 struct memory;
 struct pvr;
+struct reg_stats;
 struct scheduler;
 struct sh4;
+struct snapshot;
 struct ta;
 struct ta_context;
 
@@ -74,11 +78,43 @@ struct dbgif {
 
 /* run interface */
 typedef void (*device_run_cb)(struct device *, int64_t);
+typedef int (*device_idle_cb)(struct device *);
 
 struct runif {
   int enabled;
   int running;
   device_run_cb run;
+
+  /* optional, returns true while the device has nothing to do until an
+     interrupt is raised on it. time handed to an idle device is dropped
+     instead of being ran */
+  device_idle_cb idle;
+
+  /* minimum amount of time worth running the device for. time is accumulated
+     until the quantum is reached, unless the scheduler is forced to sync the
+     device early */
+  int64_t quantum;
+
+  /* run the device on its own host thread. the scheduler hands it time a
+     quantum at a time without waiting for it to finish, and only blocks on it
+     when the device is synced */
+  int threaded;
+
+  /* bookkeeping owned by the scheduler */
+  int64_t pending;
+  int busy;
+  struct sched_worker *worker;
+};
+
+/* snapshot interface. devices write out their state in save, and read it
+   back in the same order in load */
+typedef void (*device_save_cb)(struct device *, struct snapshot *);
+typedef void (*device_load_cb)(struct device *, struct snapshot *);
+
+struct snapif {
+  int enabled;
+  device_save_cb save;
+  device_load_cb load;
 };
 
 /*
@@ -103,6 +139,23 @@ struct device {
   /* optional interfaces */
   struct dbgif dbgif;
   struct runif runif;
+  struct snapif snapif;
+
+  /* callbacks the device starts timers with, or otherwise hands to another
+     device (e.g. for the end of a dma transfer). timers are charged to the
+     device owning their callback, and snapshots refer to the callbacks by
+     their index in here */
+  const timer_cb *timer_cbs;
+  int num_timer_cbs;
+
+  /* host time spent running the device and its timers, accumulated by the
+     scheduler each tick and published through the profiler in nanoseconds */
+  uint64_t run_ticks;
+  uint64_t timer_ticks;
+  prof_token_t run_ns;
+  prof_token_t timer_ns;
+  /* zone each run of the device is recorded in */
+  prof_token_t run_zone;
 
   struct list_node it;
 };
@@ -111,11 +164,15 @@ struct device {
  * machine
  */
 typedef void (*push_audio_cb)(void *, const int16_t *, int);
-typedef void (*push_pixels_cb)(void *, const uint8_t *, int, int);
+/* a directly written framebuffer is converted to 32-bit rgbx straight into the
+   buffer the client maps for it, which may return NULL to skip the frame */
+typedef uint32_t *(*map_pixels_cb)(void *, int, int);
+typedef void (*push_pixels_cb)(void *, int, int);
 typedef void (*start_render_cb)(void *, struct ta_context *);
 typedef void (*finish_render_cb)(void *);
 typedef void (*vblank_in_cb)(void *, int);
 typedef void (*vblank_out_cb)(void *);
+typedef void (*poll_input_cb)(void *);
 
 struct dreamcast {
   int running;
@@ -124,6 +181,8 @@ struct dreamcast {
   struct debugger *debugger;
   struct memory *mem;
   struct scheduler *sched;
+  struct sample_profile *sample_profile;
+  struct reg_stats *reg_stats;
 
   /* devices */
   struct bios *bios;
@@ -140,14 +199,25 @@ struct dreamcast {
   struct serial *serial;
   struct list devices;
 
+  /* machine states saved on entering a disc's boot file, ordered from least
+     to most recently used */
+  struct list boot_cache;
+  int num_boot_cache;
+  uint64_t boot_key;
+  int boot_entered;
+  /* set when the last disc loaded resumed from a boot state */
+  int boot_resumed;
+
   /* client callbacks */
   void *userdata;
   push_audio_cb push_audio;
+  map_pixels_cb map_pixels;
   push_pixels_cb push_pixels;
   start_render_cb start_render;
   finish_render_cb finish_render;
   vblank_in_cb vblank_in;
   vblank_out_cb vblank_out;
+  poll_input_cb poll_input;
 };
 
 struct dreamcast *dc_create();
@@ -159,10 +229,20 @@ int dc_running(struct dreamcast *dc);
 void dc_suspend(struct dreamcast *dc);
 void dc_resume(struct dreamcast *dc);
 void dc_tick(struct dreamcast *dc, int64_t ns);
+void dc_break(struct dreamcast *dc);
+void dc_boot_entered(struct dreamcast *dc);
 void dc_input(struct dreamcast *dc, int port, int button, int16_t value);
 void dc_add_serial_device(struct dreamcast *dc, struct serial *serial);
 void dc_remove_serial_device(struct dreamcast *dc);
 
+/* snapshots may only be saved and loaded in between ticks. the state of the
+   host, e.g. caches of compiled code and converted textures, is kept across
+   loads, only what was invalidated by the restored state is thrown out */
+struct snapshot *dc_create_snapshot(struct dreamcast *dc);
+void dc_destroy_snapshot(struct dreamcast *dc, struct snapshot *snap);
+void dc_save_snapshot(struct dreamcast *dc, struct snapshot *snap);
+void dc_load_snapshot(struct dreamcast *dc, struct snapshot *snap);
+
 /* device registration */
 void *dc_create_device(struct dreamcast *dc, size_t size, const char *name,
                        device_init_cb init, device_post_init_cb post_init);
@@ -171,10 +251,12 @@ void dc_destroy_device(struct device *dev);
 
 /* client interface */
 void dc_push_audio(struct dreamcast *dc, const int16_t *data, int frames);
-void dc_push_pixels(struct dreamcast *dc, const uint8_t *data, int w, int h);
+uint32_t *dc_map_pixels(struct dreamcast *dc, int w, int h);
+void dc_push_pixels(struct dreamcast *dc, int w, int h);
 void dc_start_render(struct dreamcast *dc, struct ta_context *ctx);
 void dc_finish_render(struct dreamcast *dc);
 void dc_vblank_in(struct dreamcast *dc, int video_disabled);
 void dc_vblank_out(struct dreamcast *dc);
+void dc_poll_input(struct dreamcast *dc);
 
 #endif
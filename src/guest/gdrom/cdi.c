@@ -1,4 +1,5 @@
 #include "core/core.h"
+#include "core/memory.h"
 #include "guest/gdrom/disc.h"
 #include "guest/gdrom/gdrom_types.h"
 
@@ -21,28 +22,50 @@ static const uint8_t cdi_start_mark[] = {0, 0, 1, 0, 0, 0, 255, 255, 255, 255};
 
 struct cdi {
   struct disc;
+  /* only open while the header is being parsed */
   FILE *fp;
+  /* file mapped into memory, read from directly when mapping succeeds, else
+     through the async i/o queue */
+  char filename[PATH_MAX];
+  const uint8_t *map;
+  size_t map_size;
+  int map_tried;
+  struct fs_aio *aio;
+  struct fs_file *file;
   struct session sessions[DISC_MAX_SESSIONS];
   int num_sessions;
   struct track tracks[DISC_MAX_TRACKS];
   int num_tracks;
 };
 
-static void cdi_read_sector(struct disc *disc, struct track *track, int fad,
-                            void *dst) {
+static int cdi_read_sectors(struct disc *disc, struct track *track, int fad,
+                            int num_sectors, void *dst) {
   struct cdi *cdi = (struct cdi *)disc;
 
-  /* seek the to the starting fad */
-  int offset = track->file_offset + fad * track->sector_size;
-  int res = fseek(cdi->fp, offset, SEEK_SET);
-  CHECK_EQ(res, 0);
+  /* lazily map the file, falling back to reading it through the async i/o
+     queue when it can't be */
+  if (!cdi->map_tried) {
+    cdi->map = map_file(cdi->filename, &cdi->map_size);
+    cdi->map_tried = 1;
 
-  /* only read the data portion of the track */
-  res = fseek(cdi->fp, track->header_size, SEEK_CUR);
-  CHECK_EQ(res, 0);
+    if (cdi->map) {
+      advise_sequential(cdi->map, cdi->map_size);
+    }
+  }
+
+  if (cdi->map) {
+    return track_read_mapped(track, cdi->map, cdi->map_size, fad, num_sectors,
+                             dst);
+  }
 
-  res = (int)fread(dst, 1, track->data_size, cdi->fp);
-  CHECK_EQ(res, track->data_size);
+  if (!cdi->file) {
+    cdi->file = fs_open(cdi->filename, 0);
+    CHECK_NOTNULL(cdi->file, "cdi_read_sectors failed to open %s",
+                  cdi->filename);
+    cdi->aio = fs_aio_create(DISC_AIO_DEPTH);
+  }
+
+  return track_read_file(track, cdi->aio, cdi->file, fad, num_sectors, dst);
 }
 
 static void cdi_get_toc(struct disc *disc, int area, struct track **first_track,
@@ -92,9 +115,21 @@ static int cdi_get_format(struct disc *disc) {
 static void cdi_destroy(struct disc *disc) {
   struct cdi *cdi = (struct cdi *)disc;
 
+  if (cdi->aio) {
+    fs_aio_destroy(cdi->aio);
+  }
+
+  if (cdi->file) {
+    fs_close(cdi->file);
+  }
+
   if (cdi->fp) {
     fclose(cdi->fp);
   }
+
+  if (cdi->map) {
+    unmap_file(cdi->map, cdi->map_size);
+  }
 }
 
 static int cdi_parse_track(struct disc *disc, uint32_t version,
@@ -262,6 +297,7 @@ static int cdi_parse(struct disc *disc, const char *filename, int verbose) {
     return 0;
   }
   cdi->fp = fp;
+  snprintf(cdi->filename, sizeof(cdi->filename), "%s", filename);
 
   /* validate the cdi headers */
   uint32_t version;
@@ -345,7 +381,7 @@ struct disc *cdi_create(const char *filename, int verbose) {
   cdi->get_num_tracks = &cdi_get_num_tracks;
   cdi->get_track = &cdi_get_track;
   cdi->get_toc = &cdi_get_toc;
-  cdi->read_sector = &cdi_read_sector;
+  cdi->read_sectors = &cdi_read_sectors;
 
   struct disc *disc = (struct disc *)cdi;
 
@@ -354,5 +390,8 @@ struct disc *cdi_create(const char *filename, int verbose) {
     return NULL;
   }
 
+  fclose(cdi->fp);
+  cdi->fp = NULL;
+
   return disc;
 }
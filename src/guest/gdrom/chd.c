@@ -1,7 +1,34 @@
 #include <chd.h>
 #include "core/core.h"
+#include "core/thread.h"
 #include "guest/gdrom/disc.h"
 #include "guest/gdrom/gdrom_types.h"
+#include "options.h"
+
+/* hunks decompressed ahead of the one being read, once reads look sequential */
+#define CHD_PREFETCH_HUNKS 4
+#define CHD_MAX_WORKERS 8
+
+enum {
+  CHD_HUNK_FREE,
+  CHD_HUNK_QUEUED,
+  CHD_HUNK_BUSY,
+  CHD_HUNK_READY,
+};
+
+struct chd_hunk {
+  int num;
+  int state;
+  /* stamp of the last read or of being queued, the oldest is evicted first */
+  int64_t used;
+  uint8_t *data;
+};
+
+struct chd_worker {
+  struct chd *chd;
+  chd_file *file;
+  thread_t thread;
+};
 
 struct chd {
   struct disc;
@@ -12,28 +39,239 @@ struct chd {
   int num_tracks;
 
   chd_file *chd;
-  /* hunk data cache */
-  uint8_t *hunkmem;
-  /* last hunknum read */
-  int oldhunk;
+  char filename[PATH_MAX];
+
+  /* decompressed hunks, so interleaved reads from separate tracks don't
+     thrash each other */
+  struct chd_hunk *hunks;
+  int num_hunks;
+  int64_t stamp;
+
+  /* workers decompressing queued hunks, each with its own handle to the file
+     as decompression state can't be shared between threads. they're only
+     started once reads look sequential */
+  struct chd_worker workers[CHD_MAX_WORKERS];
+  int num_workers;
+  mutex_t mutex;
+  cond_t work_cond;
+  cond_t done_cond;
+  int shutdown;
 };
 
-static void chd_read_sector(struct disc *disc, struct track *track, int fad,
-                            void *dst) {
-  struct chd *chd = (struct chd *)disc;
+static struct chd_hunk *chd_find_hunk(struct chd *chd, int num) {
+  for (int i = 0; i < chd->num_hunks; i++) {
+    struct chd_hunk *hunk = &chd->hunks[i];
+
+    if (hunk->state != CHD_HUNK_FREE && hunk->num == num) {
+      return hunk;
+    }
+  }
+
+  return NULL;
+}
+
+static struct chd_hunk *chd_alloc_hunk(struct chd *chd, int num) {
+  const chd_header *head = chd_get_header(chd->chd);
+  struct chd_hunk *lru = NULL;
+
+  /* hunks being decompressed can't be evicted. queued hunks can, in case the
+     workers have fallen behind the reads they were queued for */
+  for (int i = 0; i < chd->num_hunks; i++) {
+    struct chd_hunk *hunk = &chd->hunks[i];
+
+    if (hunk->state == CHD_HUNK_FREE) {
+      lru = hunk;
+      break;
+    }
+
+    if (hunk->state != CHD_HUNK_BUSY && (!lru || hunk->used < lru->used)) {
+      lru = hunk;
+    }
+  }
+
+  if (!lru) {
+    return NULL;
+  }
+
+  /* storage is allocated as the cache fills up */
+  if (!lru->data) {
+    lru->data = malloc(head->hunkbytes);
+    CHECK_NOTNULL(lru->data);
+  }
+
+  lru->num = num;
+  lru->state = CHD_HUNK_BUSY;
+
+  return lru;
+}
+
+static void *chd_worker_thread(void *data) {
+  struct chd_worker *worker = data;
+  struct chd *chd = worker->chd;
+
+  apply_thread_options(ROLE_IO);
+
+  mutex_lock(chd->mutex);
+
+  while (1) {
+    struct chd_hunk *hunk = NULL;
+
+    while (!chd->shutdown) {
+      for (int i = 0; i < chd->num_hunks && !hunk; i++) {
+        if (chd->hunks[i].state == CHD_HUNK_QUEUED) {
+          hunk = &chd->hunks[i];
+        }
+      }
+
+      if (hunk) {
+        break;
+      }
+
+      cond_wait(chd->work_cond, chd->mutex);
+    }
+
+    if (chd->shutdown) {
+      break;
+    }
+
+    hunk->state = CHD_HUNK_BUSY;
+    mutex_unlock(chd->mutex);
+
+    int err = chd_read(worker->file, hunk->num, hunk->data);
+
+    mutex_lock(chd->mutex);
+    hunk->state = err == CHDERR_NONE ? CHD_HUNK_READY : CHD_HUNK_FREE;
+    cond_signal(chd->done_cond);
+  }
+
+  mutex_unlock(chd->mutex);
+
+  return NULL;
+}
+
+static void chd_start_workers(struct chd *chd) {
+  for (int i = 0; i < OPTION_chd_threads && i < CHD_MAX_WORKERS; i++) {
+    struct chd_worker *worker = &chd->workers[chd->num_workers];
+
+    chd_error err = chd_open(chd->filename, CHD_OPEN_READ, 0, &worker->file);
+    if (err != CHDERR_NONE) {
+      LOG_WARNING("chd_start_workers failed to open %s", chd->filename);
+      break;
+    }
+
+    worker->chd = chd;
+    worker->thread = thread_create(&chd_worker_thread, "chd", worker);
+    CHECK_NOTNULL(worker->thread);
+
+    chd->num_workers++;
+  }
+}
+
+static void chd_prefetch_hunks(struct chd *chd, int num) {
   const chd_header *head = chd_get_header(chd->chd);
 
-  int cad = fad - track->file_offset;
-  int hunknum = (cad * head->unitbytes) / head->hunkbytes;
-  int hunkofs = (cad * head->unitbytes) % head->hunkbytes;
+  if (!chd->num_workers) {
+    chd_start_workers(chd);
+  }
+
+  for (int i = 1; i <= CHD_PREFETCH_HUNKS && chd->num_workers; i++) {
+    int next = num + i;
+
+    if (next >= (int)head->totalhunks || chd_find_hunk(chd, next)) {
+      continue;
+    }
+
+    struct chd_hunk *hunk = chd_alloc_hunk(chd, next);
+    if (!hunk) {
+      break;
+    }
+
+    hunk->state = CHD_HUNK_QUEUED;
+    hunk->used = ++chd->stamp;
+    cond_signal(chd->work_cond);
+  }
+}
+
+/* returns the decompressed hunk, or NULL if it couldn't be decompressed. the
+   cache's mutex is expected to be held */
+static struct chd_hunk *chd_get_hunk(struct chd *chd, int num) {
+  /* if a worker is decompressing the hunk, wait on it. if it's only queued,
+     it's quicker to decompress it here than wait for a worker to be free */
+  struct chd_hunk *hunk = chd_find_hunk(chd, num);
+
+  while (hunk && hunk->state == CHD_HUNK_BUSY) {
+    cond_wait(chd->done_cond, chd->mutex);
+    hunk = chd_find_hunk(chd, num);
+  }
+
+  if (!hunk || hunk->state == CHD_HUNK_QUEUED) {
+    if (!hunk) {
+      hunk = chd_alloc_hunk(chd, num);
+      CHECK_NOTNULL(hunk);
+    }
+
+    hunk->state = CHD_HUNK_BUSY;
+    mutex_unlock(chd->mutex);
+
+    int err = chd_read(chd->chd, num, hunk->data);
+
+    mutex_lock(chd->mutex);
 
-  /* each hunk holds ~8 sectors, optimize when reading contiguous sectors */
-  if (hunknum != chd->oldhunk) {
-    int err = chd_read(chd->chd, hunknum, chd->hunkmem);
-    CHECK_EQ(err, CHDERR_NONE, "chd_read_sector failed fad=%d", fad);
+    if (err != CHDERR_NONE) {
+      hunk->state = CHD_HUNK_FREE;
+      return NULL;
+    }
+
+    hunk->state = CHD_HUNK_READY;
   }
 
-  memcpy(dst, chd->hunkmem + hunkofs + track->header_size, 2048);
+  hunk->used = ++chd->stamp;
+
+  /* when the previous hunk is cached as well, the reads are likely
+     sequential, have the workers decompress the ones following this one in
+     the background */
+  struct chd_hunk *prev = chd_find_hunk(chd, num - 1);
+
+  if (OPTION_chd_threads && prev && prev->state == CHD_HUNK_READY) {
+    chd_prefetch_hunks(chd, num);
+  }
+
+  return hunk;
+}
+
+static int chd_read_sectors(struct disc *disc, struct track *track, int fad,
+                            int num_sectors, void *dst) {
+  struct chd *chd = (struct chd *)disc;
+  const chd_header *head = chd_get_header(chd->chd);
+  uint8_t *out = dst;
+  int res = 1;
+
+  mutex_lock(chd->mutex);
+
+  /* each hunk holds ~8 sectors, copy out all of those requested from it at
+     once */
+  for (int i = 0; i < num_sectors;) {
+    int cad = fad + i - track->file_offset;
+    int hunknum = (cad * head->unitbytes) / head->hunkbytes;
+    int hunkofs = (cad * head->unitbytes) % head->hunkbytes;
+
+    struct chd_hunk *hunk = chd_get_hunk(chd, hunknum);
+    if (!hunk) {
+      res = 0;
+      break;
+    }
+
+    do {
+      memcpy(out, hunk->data + hunkofs + track->header_size, track->data_size);
+      out += track->data_size;
+      hunkofs += head->unitbytes;
+      i++;
+    } while (i < num_sectors && hunkofs < (int)head->hunkbytes);
+  }
+
+  mutex_unlock(chd->mutex);
+
+  return res;
 }
 
 static void chd_get_toc(struct disc *disc, int area, struct track **first_track,
@@ -79,9 +317,33 @@ static int chd_get_format(struct disc *disc) {
 static void chd_destroy(struct disc *disc) {
   struct chd *chd = (struct chd *)disc;
 
-  free(chd->hunkmem);
+  if (chd->mutex) {
+    mutex_lock(chd->mutex);
+    chd->shutdown = 1;
+    for (int i = 0; i < chd->num_workers; i++) {
+      cond_signal(chd->work_cond);
+    }
+    mutex_unlock(chd->mutex);
+
+    for (int i = 0; i < chd->num_workers; i++) {
+      struct chd_worker *worker = &chd->workers[i];
+      thread_join(worker->thread, NULL);
+      chd_close(worker->file);
+    }
+
+    cond_destroy(chd->done_cond);
+    cond_destroy(chd->work_cond);
+    mutex_destroy(chd->mutex);
+  }
+
+  for (int i = 0; i < chd->num_hunks; i++) {
+    free(chd->hunks[i].data);
+  }
+  free(chd->hunks);
 
-  chd_close(chd->chd);
+  if (chd->chd) {
+    chd_close(chd->chd);
+  }
 }
 
 static int chd_parse(struct disc *disc, const char *filename, int verbose) {
@@ -92,10 +354,19 @@ static int chd_parse(struct disc *disc, const char *filename, int verbose) {
     return 0;
   }
 
-  /* allocate storage for sector reads */
+  snprintf(chd->filename, sizeof(chd->filename), "%s", filename);
+
+  /* size the hunk cache by the memory budget, leaving room for at least the
+     hunk being read and one being decompressed by each worker */
   const chd_header *head = chd_get_header(chd->chd);
-  chd->hunkmem = malloc(head->hunkbytes);
-  chd->oldhunk = -1;
+  int budget = MAX(OPTION_chd_cache, 0) * 1024 * 1024;
+  chd->num_hunks = MAX(budget / (int)head->hunkbytes, CHD_MAX_WORKERS + 2);
+  chd->hunks = calloc(chd->num_hunks, sizeof(struct chd_hunk));
+  CHECK_NOTNULL(chd->hunks);
+
+  chd->mutex = mutex_create();
+  chd->work_cond = cond_create();
+  chd->done_cond = cond_create();
 
   /* parse tracks */
   char tmp[512];
@@ -225,7 +496,7 @@ struct disc *chd_create(const char *filename, int verbose) {
   chd->get_num_tracks = &chd_get_num_tracks;
   chd->get_track = &chd_get_track;
   chd->get_toc = &chd_get_toc;
-  chd->read_sector = &chd_read_sector;
+  chd->read_sectors = &chd_read_sectors;
 
   struct disc *disc = (struct disc *)chd;
 
@@ -1,9 +1,13 @@
 #include "guest/gdrom/disc.h"
 #include "core/core.h"
+#include "core/profiler.h"
+#include "core/thread.h"
 #include "guest/gdrom/cdi.h"
 #include "guest/gdrom/chd.h"
 #include "guest/gdrom/gdi.h"
 #include "guest/gdrom/iso.h"
+#include "guest/gdrom/rdz.h"
+#include "options.h"
 
 /* ip.bin layout */
 #define IP_OFFSET_META 0x0000    /* meta information */
@@ -13,6 +17,50 @@
 #define IP_OFFSET_BOOT1 0x3800   /* bootstrap 1 */
 #define IP_OFFSET_BOOT2 0x6000   /* bootstrap 2 */
 
+/* number of sequential reads in a row before reading ahead */
+#define DISC_PREFETCH_RUN 2
+
+/* limits on the directories indexed, guarding against corrupt images */
+#define DISC_MAX_DIR_DEPTH 8
+#define DISC_MAX_DIR_SIZE 0x100000
+
+DEFINE_AGGREGATE_COUNTER(disc_hits);
+DEFINE_AGGREGATE_COUNTER(disc_misses);
+
+struct disc_slot {
+  int fad;
+  uint8_t data[DISC_MAX_SECTOR_SIZE];
+};
+
+struct disc_prefetch {
+  struct disc *disc;
+
+  thread_t thread;
+  mutex_t mutex;
+  cond_t work_cond;
+  cond_t done_cond;
+  int shutdown;
+
+  /* the media's read callback is used by both threads, serialize access to
+     it as the formats keep file handles and decompression state around */
+  mutex_t read_mutex;
+
+  /* cached sectors, each stored in the slot at fad % num_slots */
+  struct disc_slot *slots;
+  int num_slots;
+
+  /* fad expected next for an access to be sequential, and the number of
+     sequential accesses leading up to it */
+  int next_fad;
+  int run;
+
+  /* range of sectors left for the worker to read, and the sector it's in the
+     middle of reading */
+  int fetch_fad;
+  int end_fad;
+  int busy_fad;
+};
+
 /* meta information found in the ip.bin */
 struct disc_meta {
   char hwareid[DISC_HWAREID_SIZE];
@@ -38,25 +86,33 @@ static void disc_get_meta(struct disc *disc, struct disc_meta *meta) {
   memcpy(meta, tmp, sizeof(*meta));
 }
 
-static void disc_patch_sector(struct disc *disc, int fad, uint8_t *data) {
+static void disc_patch_sectors(struct disc *disc, int fad, int num_sectors,
+                               int data_size, uint8_t *data) {
   /* patch discs to boot in all regions by patching data read from the disk. for
      a disc to be boot for a region, the region must be enabled in two places:
 
      1.) in the meta information section of the ip.bin
      2.) in the area protection symbols section of the ip.bin */
-  if (fad == disc->meta_fad) {
+  int endfad = fad + num_sectors;
+
+  if (disc->meta_fad >= fad && disc->meta_fad < endfad) {
     /* the area symbols in the meta information contains 8 characters, each of
        which is either a space, or the first letter of the area if supported */
-    struct disc_meta *meta = (struct disc_meta *)data;
+    uint8_t *sector = data + (disc->meta_fad - fad) * data_size;
+    struct disc_meta *meta = (struct disc_meta *)sector;
     strncpy_pad_spaces(meta->areasym, "JUE", sizeof(meta->areasym));
-  } else if (fad == disc->area_fad) {
+  }
+
+  if (disc->area_fad >= fad && disc->area_fad < endfad &&
+      disc->area_fad != disc->meta_fad) {
     /* the area protection symbols section contains 8 slots, each of which is
        either spaces, or the name of the area if supported. note, each slot
        has a 4-byte code prefix which jumps past it as part of the bootstrap
        control flow */
-    char *slot0 = (char *)(data + disc->area_off);
-    char *slot1 = (char *)(data + disc->area_off + 32);
-    char *slot2 = (char *)(data + disc->area_off + 64);
+    uint8_t *sector = data + (disc->area_fad - fad) * data_size;
+    char *slot0 = (char *)(sector + disc->area_off);
+    char *slot1 = (char *)(sector + disc->area_off + 32);
+    char *slot2 = (char *)(sector + disc->area_off + 64);
     strncpy_pad_spaces(slot0 + 4, "For JAPAN,TAIWAN,PHILIPINES.", 28);
     strncpy_pad_spaces(slot1 + 4, "For USA and CANADA.", 28);
     strncpy_pad_spaces(slot2 + 4, "For EUROPE.", 28);
@@ -118,56 +174,197 @@ int track_set_layout(struct track *track, int sector_mode, int sector_size) {
   return 1;
 }
 
+int track_read_mapped(struct track *track, const uint8_t *map, size_t size,
+                      int fad, int num_sectors, uint8_t *dst) {
+  int64_t offset = (int64_t)track->file_offset +
+                   (int64_t)fad * track->sector_size + track->header_size;
+  int64_t end = offset + (int64_t)(num_sectors - 1) * track->sector_size +
+                track->data_size;
+
+  if (offset < 0 || end > (int64_t)size) {
+    return 0;
+  }
+
+  const uint8_t *src = map + offset;
+
+  /* when the track only stores the data portion of each sector, the run is
+     contiguous */
+  if (track->data_size == track->sector_size) {
+    memcpy(dst, src, num_sectors * track->data_size);
+    return 1;
+  }
+
+  for (int i = 0; i < num_sectors; i++) {
+    memcpy(dst, src, track->data_size);
+    dst += track->data_size;
+    src += track->sector_size;
+  }
+
+  return 1;
+}
+
+struct track_read {
+  int size;
+  int failed;
+};
+
+static void track_read_done(void *data, int64_t res) {
+  struct track_read *rd = data;
+  rd->failed |= res != rd->size;
+}
+
+int track_read_file(struct track *track, struct fs_aio *aio,
+                    struct fs_file *file, int fad, int num_sectors,
+                    uint8_t *dst) {
+  /* start at the data portion of the fad's sector */
+  int64_t offset = (int64_t)track->file_offset +
+                   (int64_t)fad * track->sector_size + track->header_size;
+  struct track_read rd = {0};
+
+  if (track->data_size == track->sector_size) {
+    rd.size = num_sectors * track->data_size;
+    fs_aio_read(aio, file, offset, dst, rd.size, &track_read_done, &rd);
+  } else {
+    /* only the data portion of each sector is read, queue them all at once
+       rather than seeking past the header and trailer of each in turn */
+    rd.size = track->data_size;
+
+    for (int i = 0; i < num_sectors; i++) {
+      fs_aio_read(aio, file, offset + (int64_t)i * track->sector_size,
+                  dst + i * track->data_size, rd.size, &track_read_done, &rd);
+    }
+  }
+
+  fs_aio_drain(aio);
+
+  return !rd.failed;
+}
+
 int disc_read_bytes(struct disc *disc, int fad, int len, uint8_t *dst,
                     int dst_size) {
   CHECK_LE(len, dst_size);
 
-  uint8_t tmp[DISC_MAX_SECTOR_SIZE];
-  int rem = len;
+  struct track *track = disc_lookup_track(disc, fad);
+  CHECK_NOTNULL(track);
 
-  while (rem) {
-    int n = disc_read_sectors(disc, fad, 1, GD_SECTOR_ANY, GD_MASK_DATA, tmp,
-                              sizeof(tmp));
-    CHECK(n);
+  /* read the whole sectors straight into the destination, only going through
+     a temporary buffer for the trailing partial sector */
+  int num_sectors = len / track->data_size;
+  int read = 0;
 
-    /* don't overrun */
-    n = MIN(n, rem);
-    memcpy(dst, tmp, n);
+  if (num_sectors) {
+    read = disc_read_sectors(disc, fad, num_sectors, GD_SECTOR_ANY,
+                             GD_MASK_DATA, dst, dst_size);
+  }
 
-    rem -= n;
-    dst += n;
-    fad++;
+  if (read < len) {
+    uint8_t tmp[DISC_MAX_SECTOR_SIZE];
+    int n = disc_read_sectors(disc, fad + num_sectors, 1, GD_SECTOR_ANY,
+                              GD_MASK_DATA, tmp, sizeof(tmp));
+    CHECK_GE(n, len - read);
+    memcpy(dst + read, tmp, len - read);
   }
 
   return len;
 }
 
-int disc_read_sectors(struct disc *disc, int fad, int num_sectors,
-                      int sector_fmt, int sector_mask, uint8_t *dst,
-                      int dst_size) {
-  struct track *track = disc_lookup_track(disc, fad);
-  CHECK_NOTNULL(track);
-  CHECK(sector_fmt == GD_SECTOR_ANY || sector_fmt == track->sector_fmt);
-  CHECK(sector_mask == GD_MASK_DATA);
+/* paths are compared case-insensitively, ignoring any leading separator and
+   the version suffix of the last name */
+static void disc_normalize_path(const char *path, char *dst, int size) {
+  while (*path == '/' || *path == '\\') {
+    path++;
+  }
 
-  int read = 0;
-  int endfad = fad + num_sectors;
+  int n = 0;
+
+  for (; *path && *path != ';' && n < size - 1; path++) {
+    char c = *path == '\\' ? '/' : *path;
+    dst[n++] = (char)toupper(c);
+  }
 
-  for (int i = fad; i < endfad; i++) {
-    CHECK_LE(read + track->data_size, dst_size);
-    disc->read_sector(disc, track, i, dst + read);
+  /* names without an extension may be recorded with a trailing dot */
+  if (n && dst[n - 1] == '.') {
+    n--;
+  }
 
-    disc_patch_sector(disc, i, dst + read);
+  dst[n] = 0;
+}
 
-    read += track->data_size;
+static struct disc_file *disc_add_file(struct disc *disc, int *max_files) {
+  if (disc->num_iso_files >= *max_files) {
+    *max_files = MAX(*max_files * 2, 64);
+    disc->iso_files =
+        realloc(disc->iso_files, *max_files * sizeof(struct disc_file));
   }
 
-  return read;
+  struct disc_file *file = &disc->iso_files[disc->num_iso_files++];
+  memset(file, 0, sizeof(*file));
+  return file;
 }
 
-int disc_find_file(struct disc *disc, const char *filename, int *fad,
-                   int *len) {
-  uint8_t tmp[0x10000];
+static void disc_index_dir(struct disc *disc, const char *parent, int fad,
+                           int len, int depth, int *max_files) {
+  if (depth > DISC_MAX_DIR_DEPTH || len <= 0 || len > DISC_MAX_DIR_SIZE ||
+      !disc_lookup_track(disc, fad)) {
+    LOG_WARNING("disc_index_dir skipping invalid directory '%s'", parent);
+    return;
+  }
+
+  uint8_t *data = malloc(len);
+  int read = disc_read_bytes(disc, fad, len, data, len);
+  if (!read) {
+    LOG_WARNING("disc_index_dir failed to read directory '%s'", parent);
+    free(data);
+    return;
+  }
+
+  int off = 0;
+
+  while (off < len) {
+    struct iso_dir *dir = (struct iso_dir *)(data + off);
+
+    /* records don't cross sector boundaries, the remainder of each sector is
+       padded with zeros */
+    if (!dir->length) {
+      off = ALIGN_UP(off + 1, ISO_SECTOR_SIZE);
+      continue;
+    }
+
+    if (off + dir->length > len ||
+        (int)sizeof(*dir) + dir->name_len > dir->length) {
+      break;
+    }
+
+    off += dir->length;
+
+    /* skip the entries for the directory itself and its parent */
+    const char *name = (const char *)(dir + 1);
+    if (dir->name_len == 1 && (name[0] == 0 || name[0] == 1)) {
+      continue;
+    }
+
+    char path[DISC_MAX_PATH];
+    snprintf(path, sizeof(path), "%s%s%.*s", parent, *parent ? "/" : "",
+             (int)dir->name_len, name);
+
+    struct disc_file *file = disc_add_file(disc, max_files);
+    disc_normalize_path(path, file->path, sizeof(file->path));
+    file->fad = GDROM_PREGAP + dir->extent.le;
+    file->len = dir->size.le;
+    file->dir = (dir->file_flags & ISO_DIRECTORY) != 0;
+
+    /* the file array may move while indexing the subdirectory */
+    if (file->dir) {
+      snprintf(path, sizeof(path), "%s", file->path);
+      disc_index_dir(disc, path, file->fad, file->len, depth + 1, max_files);
+    }
+  }
+
+  free(data);
+}
+
+static void disc_build_index(struct disc *disc) {
+  uint8_t tmp[DISC_MAX_SECTOR_SIZE];
 
   /* get the session for the main data track */
   struct session *session = disc_get_session(disc, 1);
@@ -176,56 +373,237 @@ int disc_find_file(struct disc *disc, const char *filename, int *fad,
   /* read primary volume descriptor */
   int read = disc_read_sectors(disc, track->fad + ISO_PVD_SECTOR, 1,
                                GD_SECTOR_ANY, GD_MASK_DATA, tmp, sizeof(tmp));
-  if (!read) {
-    return 0;
-  }
-
   struct iso_pvd *pvd = (struct iso_pvd *)tmp;
-  CHECK(pvd->type == 1);
-  CHECK(memcmp(pvd->id, "CD001", 5) == 0);
-  CHECK(pvd->version == 1);
 
-  /* check root directory for the file
-     FIXME recurse subdirectories */
+  if (!read || pvd->type != 1 || memcmp(pvd->id, "CD001", 5) ||
+      pvd->version != 1) {
+    LOG_WARNING("disc_build_index failed to find primary volume descriptor");
+    return;
+  }
+
+  /* walk the whole tree, only adding the entries to the hash table once the
+     array holding them has stopped growing */
   struct iso_dir *root = &pvd->root_directory_record;
-  int root_len = root->size.le;
-  int root_fad = GDROM_PREGAP + root->extent.le;
-  read = disc_read_bytes(disc, root_fad, root_len, tmp, sizeof(tmp));
-  if (!read) {
-    return 0;
+  int max_files = 0;
+  disc_index_dir(disc, "", GDROM_PREGAP + root->extent.le, root->size.le, 0,
+                 &max_files);
+
+  for (int i = 0; i < disc->num_iso_files; i++) {
+    struct disc_file *file = &disc->iso_files[i];
+    file->hash = hash_bytes(file->path, (int)strlen(file->path), 0);
+    hash_add(hash_bkt(disc->iso_table, file->hash), &file->it);
   }
+}
 
-  uint8_t *ptr = tmp;
-  uint8_t *end = tmp + root_len;
-  struct iso_dir *found = NULL;
+static void *disc_prefetch_thread(void *data) {
+  struct disc_prefetch *pf = data;
+  struct disc *disc = pf->disc;
+  uint8_t tmp[DISC_MAX_SECTOR_SIZE];
 
-  while (ptr < end) {
-    struct iso_dir *dir = (struct iso_dir *)ptr;
+  apply_thread_options(ROLE_IO);
 
-    if (!dir->length) {
-      /* no more entries */
-      break;
+  mutex_lock(pf->mutex);
+
+  while (1) {
+    while (!pf->shutdown && pf->fetch_fad >= pf->end_fad) {
+      cond_wait(pf->work_cond, pf->mutex);
     }
 
-    const char *name = (const char *)(ptr + sizeof(*dir));
-    if (memcmp(name, filename, strlen(filename)) == 0) {
-      found = dir;
+    if (pf->shutdown) {
       break;
     }
 
-    ptr += dir->length;
+    int fad = pf->fetch_fad++;
+    struct disc_slot *slot = &pf->slots[fad % pf->num_slots];
+
+    if (slot->fad == fad) {
+      continue;
+    }
+
+    struct track *track = disc_lookup_track(disc, fad);
+
+    if (!track) {
+      pf->end_fad = fad;
+      continue;
+    }
+
+    pf->busy_fad = fad;
+    mutex_unlock(pf->mutex);
+
+    mutex_lock(pf->read_mutex);
+    int res = disc->read_sectors(disc, track, fad, 1, tmp);
+    mutex_unlock(pf->read_mutex);
+
+    mutex_lock(pf->mutex);
+
+    /* reading ahead can run past the end of the data backing a track, which
+       the game would never have read */
+    if (res) {
+      memcpy(slot->data, tmp, track->data_size);
+      slot->fad = fad;
+    }
+
+    pf->busy_fad = -1;
+    cond_signal(pf->done_cond);
+  }
+
+  mutex_unlock(pf->mutex);
+
+  return NULL;
+}
+
+static void disc_read_cached(struct disc *disc, struct track *track, int fad,
+                             uint8_t *dst) {
+  struct disc_prefetch *pf = disc->prefetch;
+
+  mutex_lock(pf->mutex);
+
+  /* if the worker is in the middle of reading the sector, wait on it rather
+     than reading it a second time */
+  while (pf->busy_fad == fad) {
+    cond_wait(pf->done_cond, pf->mutex);
+  }
+
+  struct disc_slot *slot = &pf->slots[fad % pf->num_slots];
+  int hit = slot->fad == fad;
+
+  if (hit) {
+    memcpy(dst, slot->data, track->data_size);
+  }
+
+  /* once the access looks sequential, have the worker fill in the window of
+     sectors following it. on a jump elsewhere, it starts over from there */
+  pf->run = fad == pf->next_fad ? pf->run + 1 : 0;
+  pf->next_fad = fad + 1;
+
+  if (pf->run >= DISC_PREFETCH_RUN) {
+    if (pf->fetch_fad <= fad || pf->fetch_fad > fad + pf->num_slots) {
+      pf->fetch_fad = fad + 1;
+    }
+    pf->end_fad = fad + pf->num_slots;
+    cond_signal(pf->work_cond);
+  }
+
+  mutex_unlock(pf->mutex);
+
+  prof_counter_add(hit ? COUNTER_disc_hits : COUNTER_disc_misses, 1);
+
+  if (hit) {
+    return;
   }
 
-  if (!found) {
+  mutex_lock(pf->read_mutex);
+  int res = disc->read_sectors(disc, track, fad, 1, dst);
+  mutex_unlock(pf->read_mutex);
+
+  CHECK(res, "disc_read_cached failed fad=%d", fad);
+}
+
+static void disc_stop_prefetch(struct disc *disc) {
+  struct disc_prefetch *pf = disc->prefetch;
+
+  mutex_lock(pf->mutex);
+  pf->shutdown = 1;
+  cond_signal(pf->work_cond);
+  mutex_unlock(pf->mutex);
+
+  thread_join(pf->thread, NULL);
+
+  mutex_destroy(pf->read_mutex);
+  cond_destroy(pf->done_cond);
+  cond_destroy(pf->work_cond);
+  mutex_destroy(pf->mutex);
+
+  free(pf->slots);
+  free(pf);
+
+  disc->prefetch = NULL;
+}
+
+void disc_start_prefetch(struct disc *disc, int num_sectors) {
+  CHECK(!disc->prefetch);
+  CHECK_GT(num_sectors, 0);
+
+  struct disc_prefetch *pf = calloc(1, sizeof(struct disc_prefetch));
+
+  pf->disc = disc;
+  pf->num_slots = num_sectors;
+  pf->slots = calloc(num_sectors, sizeof(struct disc_slot));
+  CHECK_NOTNULL(pf->slots);
+
+  for (int i = 0; i < num_sectors; i++) {
+    pf->slots[i].fad = -1;
+  }
+
+  pf->next_fad = -1;
+  pf->busy_fad = -1;
+
+  pf->mutex = mutex_create();
+  pf->work_cond = cond_create();
+  pf->done_cond = cond_create();
+  pf->read_mutex = mutex_create();
+  pf->thread = thread_create(&disc_prefetch_thread, "disc", pf);
+  CHECK_NOTNULL(pf->thread);
+
+  disc->prefetch = pf;
+}
+
+int disc_read_sectors(struct disc *disc, int fad, int num_sectors,
+                      int sector_fmt, int sector_mask, uint8_t *dst,
+                      int dst_size) {
+  struct track *track = disc_lookup_track(disc, fad);
+  CHECK_NOTNULL(track);
+  CHECK(sector_fmt == GD_SECTOR_ANY || sector_fmt == track->sector_fmt);
+  CHECK(sector_mask == GD_MASK_DATA);
+
+  int read = num_sectors * track->data_size;
+  CHECK_LE(read, dst_size);
+
+  /* the read-ahead cache is filled and looked up a sector at a time */
+  if (disc->prefetch) {
+    for (int i = 0; i < num_sectors; i++) {
+      disc_read_cached(disc, track, fad + i, dst + i * track->data_size);
+    }
+  } else {
+    int res = disc->read_sectors(disc, track, fad, num_sectors, dst);
+    CHECK(res, "disc_read_sectors failed [%d, %d)", fad, fad + num_sectors);
+  }
+
+  disc_patch_sectors(disc, fad, num_sectors, track->data_size, dst);
+
+  return read;
+}
+
+int disc_find_file(struct disc *disc, const char *filename, int *fad,
+                   int *len) {
+  const struct disc_file *file = disc_lookup_file(disc, filename);
+
+  if (!file || file->dir) {
     return 0;
   }
 
-  *fad = GDROM_PREGAP + found->extent.le;
-  *len = found->size.le;
+  *fad = file->fad;
+  *len = file->len;
 
   return 1;
 }
 
+const struct disc_file *disc_lookup_file(struct disc *disc, const char *path) {
+  char key[DISC_MAX_PATH];
+  disc_normalize_path(path, key, sizeof(key));
+
+  uint64_t hash = hash_bytes(key, (int)strlen(key), 0);
+  struct list *bkt = hash_bkt(disc->iso_table, hash);
+
+  hash_bkt_for_each_entry(file, bkt, struct disc_file, it) {
+    if (file->hash == hash && !strcmp(file->path, key)) {
+      return file;
+    }
+  }
+
+  return NULL;
+}
+
 void disc_get_toc(struct disc *disc, int area, struct track **first_track,
                   struct track **last_track, int *leadin_fad,
                   int *leadout_fad) {
@@ -277,6 +655,12 @@ int disc_get_format(struct disc *disc) {
 }
 
 void disc_destroy(struct disc *disc) {
+  if (disc->prefetch) {
+    disc_stop_prefetch(disc);
+  }
+
+  free(disc->iso_files);
+
   disc->destroy(disc);
 }
 
@@ -289,6 +673,8 @@ struct disc *disc_create(const char *filename, int verbose) {
     disc = chd_create(filename, verbose);
   } else if (strstr(filename, ".gdi")) {
     disc = gdi_create(filename, verbose);
+  } else if (strstr(filename, ".rdz")) {
+    disc = rdz_create(filename, verbose);
   }
 
   if (!disc) {
@@ -320,5 +706,11 @@ struct disc *disc_create(const char *filename, int verbose) {
     LOG_INFO("disc_create id=%s", disc->uid);
   }
 
+  disc_build_index(disc);
+
+  if (verbose) {
+    LOG_INFO("disc_create indexed %d files", disc->num_iso_files);
+  }
+
   return disc;
 }
@@ -2,12 +2,16 @@
 #define DISC_H
 
 #include "core/filesystem.h"
+#include "core/hash.h"
 #include "guest/gdrom/gdrom_types.h"
 
 #define DISC_MAX_SECTOR_SIZE 2352
 #define DISC_MAX_SESSIONS 2
 #define DISC_MAX_TRACKS 128
 #define DISC_UID_SIZE 256
+#define DISC_MAX_PATH 256
+/* depth of the async i/o queues reading the files which couldn't be mapped */
+#define DISC_AIO_DEPTH 64
 
 #define DISC_HWAREID_SIZE 16
 #define DISC_MAKERID_SIZE 16
@@ -54,6 +58,20 @@ struct session {
   int last_track;
 };
 
+struct disc_file {
+  /* path from the root of the filesystem, with each directory separated by a
+     forward slash and the version suffix removed */
+  char path[DISC_MAX_PATH];
+  int fad;
+  int len;
+  int dir;
+
+  uint64_t hash;
+  struct list_node it;
+};
+
+struct disc_prefetch;
+
 struct disc {
   /* information about the IP.BIN location on disc, cached to quickly patch
      region information */
@@ -82,12 +100,27 @@ struct disc {
 
   void (*get_toc)(struct disc *, int, struct track **, struct track **, int *,
                   int *);
-  void (*read_sector)(struct disc *, struct track *, int, void *);
+  /* reads the data portion of a run of sectors from a single track, returning
+     0 when they aren't all backed by the media */
+  int (*read_sectors)(struct disc *, struct track *, int, int, void *);
+
+  /* read-ahead cache, only present once prefetching has been started */
+  struct disc_prefetch *prefetch;
+
+  /* every file and directory in the data track's iso9660 filesystem, indexed
+     by path once at creation */
+  struct disc_file *iso_files;
+  int num_iso_files;
+  DECLARE_HASHTABLE(iso_table, 10);
 };
 
 struct disc *disc_create(const char *filename, int verbose);
 void disc_destroy(struct disc *disc);
 
+/* start a thread reading ahead of sequential accesses, keeping up to
+   num_sectors of the upcoming sectors cached */
+void disc_start_prefetch(struct disc *disc, int num_sectors);
+
 int disc_get_format(struct disc *disc);
 int disc_get_num_sessions(struct disc *disc);
 struct session *disc_get_session(struct disc *disc, int n);
@@ -97,6 +130,9 @@ struct track *disc_lookup_track(struct disc *disc, int fad);
 void disc_get_toc(struct disc *disc, int area, struct track **first_track,
                   struct track **last_track, int *leadin_fad, int *leadout_fad);
 
+/* look up a file or directory by its path, compared case-insensitively and
+   without a version suffix */
+const struct disc_file *disc_lookup_file(struct disc *disc, const char *path);
 int disc_find_file(struct disc *disc, const char *filename, int *fad, int *len);
 int disc_read_sectors(struct disc *disc, int fad, int num_sectors,
                       int sector_fmt, int sector_mask, uint8_t *dst,
@@ -106,4 +142,13 @@ int disc_read_bytes(struct disc *disc, int fad, int len, uint8_t *dst,
 
 int track_set_layout(struct track *track, int sector_mode, int sector_size);
 
+/* helpers for formats storing the raw sectors of a track in a file, read
+   either from a mapping of the file or through the async i/o queue, waiting
+   on the reads to complete */
+int track_read_mapped(struct track *track, const uint8_t *map, size_t size,
+                      int fad, int num_sectors, uint8_t *dst);
+int track_read_file(struct track *track, struct fs_aio *aio,
+                    struct fs_file *file, int fad, int num_sectors,
+                    uint8_t *dst);
+
 #endif
@@ -1,44 +1,57 @@
 #include "guest/gdrom/gdi.h"
 #include "core/core.h"
+#include "core/memory.h"
 #include "guest/gdrom/disc.h"
 
 struct gdi {
   struct disc;
-  FILE *files[DISC_MAX_TRACKS];
+  struct fs_aio *aio;
+  struct fs_file *files[DISC_MAX_TRACKS];
+  /* files mapped into memory, read from directly when mapping succeeds */
+  const uint8_t *maps[DISC_MAX_TRACKS];
+  size_t map_sizes[DISC_MAX_TRACKS];
+  int map_tried[DISC_MAX_TRACKS];
   struct session sessions[DISC_MAX_SESSIONS];
   int num_sessions;
   struct track tracks[DISC_MAX_TRACKS];
   int num_tracks;
 };
 
-static void gdi_read_sector(struct disc *disc, struct track *track, int fad,
-                            void *dst) {
+static int gdi_read_sectors(struct disc *disc, struct track *track, int fad,
+                            int num_sectors, void *dst) {
   struct gdi *gdi = (struct gdi *)disc;
 
   int n = (int)(track - gdi->tracks);
-  FILE *fp = gdi->files[n];
+  struct fs_file *file = gdi->files[n];
 
-  /* lazily open the file backing the track */
-  if (!fp) {
-    fp = fopen(track->filename, "rb");
-    CHECK_NOTNULL(fp, "gdi_read_sector failed to open %s", track->filename);
-    gdi->files[n] = fp;
+  /* lazily map the file backing the track, falling back to reading it through
+     the async i/o queue when it can't be */
+  if (!gdi->map_tried[n]) {
+    gdi->maps[n] = map_file(track->filename, &gdi->map_sizes[n]);
+    gdi->map_tried[n] = 1;
+
+    if (gdi->maps[n]) {
+      advise_sequential(gdi->maps[n], gdi->map_sizes[n]);
+    }
   }
 
-  /* seek the to the starting fad */
-  int offset = track->file_offset + fad * track->sector_size;
-  int res = fseek(fp, offset, SEEK_SET);
-  CHECK_EQ(res, 0);
+  if (gdi->maps[n]) {
+    return track_read_mapped(track, gdi->maps[n], gdi->map_sizes[n], fad,
+                             num_sectors, dst);
+  }
 
-  /* only read the data portion of the track */
-  res = fseek(fp, track->header_size, SEEK_CUR);
-  CHECK_EQ(res, 0);
+  /* lazily open the file backing the track */
+  if (!file) {
+    file = fs_open(track->filename, 0);
+    CHECK_NOTNULL(file, "gdi_read_sectors failed to open %s", track->filename);
+    gdi->files[n] = file;
+  }
 
-  res = (int)fread(dst, 1, track->data_size, fp);
-  CHECK_EQ(res, track->data_size);
+  if (!gdi->aio) {
+    gdi->aio = fs_aio_create(DISC_AIO_DEPTH);
+  }
 
-  res = fseek(fp, track->error_size, SEEK_CUR);
-  CHECK_EQ(res, 0);
+  return track_read_file(track, gdi->aio, file, fad, num_sectors, dst);
 }
 
 static void gdi_get_toc(struct disc *disc, int area, struct track **first_track,
@@ -84,12 +97,20 @@ static int gdi_get_format(struct disc *disc) {
 static void gdi_destroy(struct disc *disc) {
   struct gdi *gdi = (struct gdi *)disc;
 
+  if (gdi->aio) {
+    fs_aio_destroy(gdi->aio);
+  }
+
   /* cleanup file handles */
   for (int i = 0; i < gdi->num_tracks; i++) {
-    FILE *fp = gdi->files[i];
+    struct fs_file *file = gdi->files[i];
 
-    if (fp) {
-      fclose(fp);
+    if (file) {
+      fs_close(file);
+    }
+
+    if (gdi->maps[i]) {
+      unmap_file(gdi->maps[i], gdi->map_sizes[i]);
     }
   }
 }
@@ -204,7 +225,7 @@ struct disc *gdi_create(const char *filename, int verbose) {
   gdi->get_num_tracks = &gdi_get_num_tracks;
   gdi->get_track = &gdi_get_track;
   gdi->get_toc = &gdi_get_toc;
-  gdi->read_sector = &gdi_read_sector;
+  gdi->read_sectors = &gdi_read_sectors;
 
   struct disc *disc = (struct disc *)gdi;
 
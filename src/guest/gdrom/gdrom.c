@@ -4,7 +4,10 @@
 #include "guest/gdrom/gdrom_replies.inc"
 #include "guest/gdrom/gdrom_types.h"
 #include "guest/holly/holly.h"
+#include "guest/scheduler.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
+#include "options.h"
 
 #if 0
 #define LOG_GDROM LOG_INFO
@@ -50,6 +53,34 @@ gd_event_cb gd_transitions[MAX_STATES][MAX_EVENTS] = {
 };
 /* clang-format on */
 
+/* drive timing profiles, deciding how long the drive takes to have a run of
+   sectors read into its buffer. the data itself is always moved as soon as
+   it's requested, only the interrupts signalling that it's ready are held
+   back for the time it would have taken */
+struct gd_timing {
+  const char *name;
+  int64_t (*read_time)(struct gdrom *, int fad, int num_sectors);
+};
+
+/* the drive spins at up to 12x, with seeks costing from a few milliseconds
+   between neighbouring tracks to a couple hundred across the whole disc, and
+   on average half a revolution waiting for the sector to come around */
+#define GD_SECTORS_PER_SEC (75 * 12)
+#define GD_MAX_FAD 549150
+#define GD_SEEK_NS INT64_C(10000000)
+#define GD_FULL_SEEK_NS INT64_C(190000000)
+#define GD_LATENCY_NS INT64_C(5000000)
+
+static int64_t gdrom_instant_read_time(struct gdrom *gd, int fad,
+                                       int num_sectors);
+static int64_t gdrom_accurate_read_time(struct gdrom *gd, int fad,
+                                        int num_sectors);
+
+static struct gd_timing gd_timings[] = {
+    {"instant", &gdrom_instant_read_time},
+    {"accurate", &gdrom_accurate_read_time},
+};
+
 struct gdrom {
   struct device;
 
@@ -82,8 +113,33 @@ struct gdrom {
   uint8_t dma_buffer[0x10000];
   int dma_head;
   int dma_size;
+
+  /* timing state */
+  struct gd_timing *timing;
+  struct timer *ready_timer;
+  int head_fad;
+  /* time the drive has spent buffering the sectors of the current dma */
+  int64_t dma_time;
 };
 
+static int64_t gdrom_instant_read_time(struct gdrom *gd, int fad,
+                                       int num_sectors) {
+  return 0;
+}
+
+static int64_t gdrom_accurate_read_time(struct gdrom *gd, int fad,
+                                        int num_sectors) {
+  int64_t time = num_sectors * NS_PER_SEC / GD_SECTORS_PER_SEC;
+
+  /* reads continuing on from where the last left off don't need to seek */
+  if (fad != gd->head_fad) {
+    int dist = ABS(fad - gd->head_fad);
+    time += GD_SEEK_NS + dist * GD_FULL_SEEK_NS / GD_MAX_FAD + GD_LATENCY_NS;
+  }
+
+  return time;
+}
+
 static int gdrom_get_fad(uint8_t a, uint8_t b, uint8_t c, int msf) {
   if (msf) {
     /* MSF mode
@@ -114,9 +170,37 @@ static void gdrom_spi_end(struct gdrom *gd) {
   gd->state = STATE_READ_ATA_CMD;
 }
 
-static void gdrom_spi_cdread(struct gdrom *gd) {
+static void gdrom_spi_cdready(struct gdrom *gd) {
   struct holly *hl = gd->dc->holly;
 
+  gd->byte_count.full = gd->pio_size;
+  gd->ireason.IO = 1;
+  gd->ireason.CoD = 0;
+  gd->status.DRQ = 1;
+  gd->status.BSY = 0;
+
+  holly_raise_interrupt(hl, HOLLY_INT_G1GDINT);
+
+  gd->state = STATE_WRITE_SPI_DATA;
+}
+
+static void gdrom_ready_timer(void *data) {
+  struct gdrom *gd = data;
+
+  gd->ready_timer = NULL;
+
+  if (gd->cdr_dma) {
+    gdrom_spi_end(gd);
+  } else {
+    gdrom_spi_cdready(gd);
+  }
+}
+
+static const timer_cb gdrom_timer_cbs[] = {&gdrom_ready_timer};
+
+static void gdrom_spi_cdread(struct gdrom *gd) {
+  struct scheduler *sched = gd->dc->sched;
+
   if (gd->cdr_dma) {
     int max_dma_sectors = sizeof(gd->dma_buffer) / DISC_MAX_SECTOR_SIZE;
 
@@ -128,6 +212,11 @@ static void gdrom_spi_cdread(struct gdrom *gd) {
     gd->dma_size = res;
     gd->dma_head = 0;
 
+    /* the time is charged once the dma completes */
+    gd->dma_time +=
+        gd->timing->read_time(gd, gd->cdr_first_sector, num_sectors);
+    gd->head_fad = gd->cdr_first_sector + num_sectors;
+
     /* update sector read state */
     gd->cdr_first_sector += num_sectors;
     gd->cdr_num_sectors -= num_sectors;
@@ -145,20 +234,22 @@ static void gdrom_spi_cdread(struct gdrom *gd) {
     gd->pio_size = res;
     gd->pio_head = 0;
 
+    int64_t time =
+        gd->timing->read_time(gd, gd->cdr_first_sector, num_sectors);
+    gd->head_fad = gd->cdr_first_sector + num_sectors;
+
     /* update sector read state */
     gd->cdr_first_sector += num_sectors;
     gd->cdr_num_sectors -= num_sectors;
 
-    /* update gdrom state */
-    gd->byte_count.full = gd->pio_size;
-    gd->ireason.IO = 1;
-    gd->ireason.CoD = 0;
-    gd->status.DRQ = 1;
-    gd->status.BSY = 0;
-
-    holly_raise_interrupt(hl, HOLLY_INT_G1GDINT);
+    /* the drive stays busy until the sectors would have been read */
+    if (time) {
+      gd->status.BSY = 1;
+      gd->ready_timer = sched_start_timer(sched, &gdrom_ready_timer, gd, time);
+      return;
+    }
 
-    gd->state = STATE_WRITE_SPI_DATA;
+    gdrom_spi_cdready(gd);
   }
 }
 
@@ -605,6 +696,64 @@ static void gdrom_event(struct gdrom *gd, enum gd_event ev, int arg) {
   cb(gd, arg);
 }
 
+static void gdrom_load(struct device *dev, struct snapshot *snap) {
+  struct gdrom *gd = (struct gdrom *)dev;
+
+  /* the disc is owned by the host, and left as is */
+  SNAP_READ(snap, gd->state);
+  SNAP_READ(snap, gd->hw_info);
+  SNAP_READ(snap, gd->error);
+  SNAP_READ(snap, gd->features);
+  SNAP_READ(snap, gd->ireason);
+  SNAP_READ(snap, gd->sectnum);
+  SNAP_READ(snap, gd->byte_count);
+  SNAP_READ(snap, gd->status);
+  SNAP_READ(snap, gd->cdr_dma);
+  SNAP_READ(snap, gd->cdr_secfmt);
+  SNAP_READ(snap, gd->cdr_secmask);
+  SNAP_READ(snap, gd->cdr_first_sector);
+  SNAP_READ(snap, gd->cdr_num_sectors);
+  SNAP_READ(snap, gd->pio_head);
+  SNAP_READ(snap, gd->pio_size);
+  SNAP_READ(snap, gd->pio_offset);
+  snap_read(snap, gd->pio_buffer, gd->pio_size);
+  SNAP_READ(snap, gd->dma_head);
+  SNAP_READ(snap, gd->dma_size);
+  snap_read(snap, gd->dma_buffer, gd->dma_size);
+  gd->ready_timer = sched_load_timer(gd->dc->sched, snap);
+  SNAP_READ(snap, gd->head_fad);
+  SNAP_READ(snap, gd->dma_time);
+}
+
+static void gdrom_save(struct device *dev, struct snapshot *snap) {
+  struct gdrom *gd = (struct gdrom *)dev;
+
+  SNAP_WRITE(snap, gd->state);
+  SNAP_WRITE(snap, gd->hw_info);
+  SNAP_WRITE(snap, gd->error);
+  SNAP_WRITE(snap, gd->features);
+  SNAP_WRITE(snap, gd->ireason);
+  SNAP_WRITE(snap, gd->sectnum);
+  SNAP_WRITE(snap, gd->byte_count);
+  SNAP_WRITE(snap, gd->status);
+  SNAP_WRITE(snap, gd->cdr_dma);
+  SNAP_WRITE(snap, gd->cdr_secfmt);
+  SNAP_WRITE(snap, gd->cdr_secmask);
+  SNAP_WRITE(snap, gd->cdr_first_sector);
+  SNAP_WRITE(snap, gd->cdr_num_sectors);
+  /* only the valid portion of each buffer is saved */
+  SNAP_WRITE(snap, gd->pio_head);
+  SNAP_WRITE(snap, gd->pio_size);
+  SNAP_WRITE(snap, gd->pio_offset);
+  snap_write(snap, gd->pio_buffer, gd->pio_size);
+  SNAP_WRITE(snap, gd->dma_head);
+  SNAP_WRITE(snap, gd->dma_size);
+  snap_write(snap, gd->dma_buffer, gd->dma_size);
+  sched_save_timer(gd->dc->sched, snap, gd->ready_timer);
+  SNAP_WRITE(snap, gd->head_fad);
+  SNAP_WRITE(snap, gd->dma_time);
+}
+
 static int gdrom_init(struct device *dev) {
   struct gdrom *gd = (struct gdrom *)dev;
 
@@ -622,6 +771,11 @@ static int gdrom_init(struct device *dev) {
   strncpy_pad_spaces(gd->hw_info.system_date, "990408",
                      sizeof(gd->hw_info.system_date));
 
+  int num_timings = ARRAY_SIZE(gd_timings);
+  int timing = CLAMP(OPTION_gdrom_timing, 0, num_timings - 1);
+  gd->timing = &gd_timings[timing];
+  LOG_INFO("gdrom_init using %s drive timing", gd->timing->name);
+
   gdrom_set_disc(gd, NULL);
 
   return 1;
@@ -786,8 +940,12 @@ int gdrom_is_busy(struct gdrom *gd) {
   return gd->status.BSY;
 }
 
-void gdrom_dma_end(struct gdrom *gd) {
+int64_t gdrom_dma_end(struct gdrom *gd) {
   LOG_GDROM("gd_dma_end");
+
+  int64_t time = gd->dma_time;
+  gd->dma_time = 0;
+  return time;
 }
 
 int gdrom_dma_read(struct gdrom *gd, uint8_t *data, int n) {
@@ -795,6 +953,11 @@ int gdrom_dma_read(struct gdrom *gd, uint8_t *data, int n) {
   if (gd->dma_head >= gd->dma_size) {
     if (gd->cdr_num_sectors) {
       gdrom_spi_cdread(gd);
+    } else if (gd->dma_time) {
+      /* signal the end of the command along with the end of the dma */
+      struct scheduler *sched = gd->dc->sched;
+      gd->ready_timer =
+          sched_start_timer(sched, &gdrom_ready_timer, gd, gd->dma_time);
     } else {
       gdrom_spi_end(gd);
     }
@@ -828,6 +991,13 @@ void gdrom_set_disc(struct gdrom *gd, struct disc *disc) {
   }
 
   /* perform "soft reset" of internal state */
+  if (gd->ready_timer) {
+    sched_cancel_timer(gd->dc->sched, gd->ready_timer);
+    gd->ready_timer = NULL;
+  }
+  gd->head_fad = 0;
+  gd->dma_time = 0;
+
   gd->error.full = 0;
 
   gd->status.full = 0;
@@ -860,6 +1030,16 @@ void gdrom_destroy(struct gdrom *gd) {
 struct gdrom *gdrom_create(struct dreamcast *dc) {
   struct gdrom *gd =
       dc_create_device(dc, sizeof(struct gdrom), "gdrom", &gdrom_init, NULL);
+
+  /* setup snapshot interface */
+  gd->snapif.enabled = 1;
+  gd->snapif.save = &gdrom_save;
+  gd->snapif.load = &gdrom_load;
+
+  /* setup timer callbacks */
+  gd->timer_cbs = gdrom_timer_cbs;
+  gd->num_timer_cbs = ARRAY_SIZE(gdrom_timer_cbs);
+
   return gd;
 }
 
@@ -17,7 +17,7 @@ void gdrom_set_disc(struct gdrom *gd, struct disc *disc);
 
 void gdrom_dma_begin(struct gdrom *gd);
 int gdrom_dma_read(struct gdrom *gd, uint8_t *data, int n);
-void gdrom_dma_end(struct gdrom *gd);
+int64_t gdrom_dma_end(struct gdrom *gd);
 
 int gdrom_is_busy(struct gdrom *gd);
 void gdrom_get_mode(struct gdrom *gd, struct gd_hw_info *info);
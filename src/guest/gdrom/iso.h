@@ -3,6 +3,7 @@
 
 enum {
   ISO_PVD_SECTOR = 16,
+  ISO_SECTOR_SIZE = 2048,
 };
 
 /* iso 9660 file flags */
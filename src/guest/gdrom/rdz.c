@@ -0,0 +1,352 @@
+#include "guest/gdrom/rdz.h"
+#include <zlib.h>
+#include "core/core.h"
+#include "core/memory.h"
+#include "guest/gdrom/disc.h"
+
+#define RDZ_MAX_BLOCK_SIZE (RDZ_BLOCK_SECTORS * DISC_MAX_SECTOR_SIZE)
+
+struct rdz {
+  struct disc;
+  FILE *fp;
+  /* file mapped into memory, blocks are inflated from it directly when
+     mapping succeeds */
+  const uint8_t *map;
+  size_t map_size;
+  int format;
+  struct session sessions[DISC_MAX_SESSIONS];
+  int num_sessions;
+  struct session areas[DISC_MAX_SESSIONS];
+  int num_areas;
+  struct track tracks[DISC_MAX_TRACKS];
+  struct rdz_track entries[DISC_MAX_TRACKS];
+  int num_tracks;
+  struct rdz_block *blocks;
+  int num_blocks;
+  uint8_t *dict;
+  int dict_size;
+  z_stream strm;
+  /* compressed data of the block being inflated when reading through stdio */
+  uint8_t *compressed;
+  /* most recently inflated block */
+  int cur_block;
+  uint8_t data[RDZ_MAX_BLOCK_SIZE];
+};
+
+static int rdz_inflate(struct rdz *rdz, const uint8_t *src, int src_size,
+                       uint8_t *dst, int dst_size) {
+  z_stream *strm = &rdz->strm;
+
+  /* each block is deflated on its own, starting from the shared dictionary */
+  if (inflateReset(strm) != Z_OK) {
+    return 0;
+  }
+
+  if (rdz->dict_size &&
+      inflateSetDictionary(strm, rdz->dict, rdz->dict_size) != Z_OK) {
+    return 0;
+  }
+
+  strm->next_in = (Bytef *)src;
+  strm->avail_in = src_size;
+  strm->next_out = dst;
+  strm->avail_out = dst_size;
+
+  int res = inflate(strm, Z_FINISH);
+  return res == Z_STREAM_END && !strm->avail_out;
+}
+
+static const uint8_t *rdz_get_block(struct rdz *rdz, struct rdz_track *entry,
+                                    int n) {
+  int first = n - entry->first_block;
+  int num_sectors =
+      MIN(entry->num_sectors - first * RDZ_BLOCK_SECTORS, RDZ_BLOCK_SECTORS);
+  int size = num_sectors * entry->data_size;
+
+  if (rdz->cur_block == n) {
+    return rdz->data;
+  }
+
+  struct rdz_block *block = &rdz->blocks[n];
+  const uint8_t *src = NULL;
+
+  if (rdz->map) {
+    if (block->offset + block->size > rdz->map_size) {
+      return NULL;
+    }
+    src = rdz->map + block->offset;
+  } else {
+    if (fseek(rdz->fp, (long)block->offset, SEEK_SET) ||
+        fread(rdz->compressed, 1, block->size, rdz->fp) != block->size) {
+      return NULL;
+    }
+    src = rdz->compressed;
+  }
+
+  rdz->cur_block = -1;
+
+  if (block->size == (uint32_t)size) {
+    memcpy(rdz->data, src, size);
+  } else if (!rdz_inflate(rdz, src, block->size, rdz->data, size)) {
+    LOG_WARNING("rdz_get_block failed to inflate block %d", n);
+    return NULL;
+  }
+
+  rdz->cur_block = n;
+
+  return rdz->data;
+}
+
+static int rdz_read_sectors(struct disc *disc, struct track *track, int fad,
+                            int num_sectors, void *dst) {
+  struct rdz *rdz = (struct rdz *)disc;
+  struct rdz_track *entry = &rdz->entries[track - rdz->tracks];
+
+  int first = fad - track->fad;
+  if (first < 0 || first + num_sectors > entry->num_sectors) {
+    return 0;
+  }
+
+  uint8_t *ptr = dst;
+
+  while (num_sectors) {
+    int n = entry->first_block + first / RDZ_BLOCK_SECTORS;
+    int off = first % RDZ_BLOCK_SECTORS;
+    int count = MIN(num_sectors, RDZ_BLOCK_SECTORS - off);
+
+    const uint8_t *data = rdz_get_block(rdz, entry, n);
+    if (!data) {
+      return 0;
+    }
+
+    int size = count * track->data_size;
+    memcpy(ptr, data + off * track->data_size, size);
+    ptr += size;
+
+    first += count;
+    num_sectors -= count;
+  }
+
+  return 1;
+}
+
+static void rdz_get_toc(struct disc *disc, int area, struct track **first_track,
+                        struct track **last_track, int *leadin_fad,
+                        int *leadout_fad) {
+  struct rdz *rdz = (struct rdz *)disc;
+
+  /* the toc for each area is recorded from the original image */
+  CHECK_LT(area, rdz->num_areas);
+  struct session *toc = &rdz->areas[area];
+
+  *first_track = &rdz->tracks[toc->first_track];
+  *last_track = &rdz->tracks[toc->last_track];
+  *leadin_fad = toc->leadin_fad;
+  *leadout_fad = toc->leadout_fad;
+}
+
+static struct track *rdz_get_track(struct disc *disc, int n) {
+  struct rdz *rdz = (struct rdz *)disc;
+  CHECK_LT(n, rdz->num_tracks);
+  return &rdz->tracks[n];
+}
+
+static int rdz_get_num_tracks(struct disc *disc) {
+  struct rdz *rdz = (struct rdz *)disc;
+  return rdz->num_tracks;
+}
+
+static struct session *rdz_get_session(struct disc *disc, int n) {
+  struct rdz *rdz = (struct rdz *)disc;
+  CHECK_LT(n, rdz->num_sessions);
+  return &rdz->sessions[n];
+}
+
+static int rdz_get_num_sessions(struct disc *disc) {
+  struct rdz *rdz = (struct rdz *)disc;
+  return rdz->num_sessions;
+}
+
+static int rdz_get_format(struct disc *disc) {
+  struct rdz *rdz = (struct rdz *)disc;
+  return rdz->format;
+}
+
+static void rdz_destroy(struct disc *disc) {
+  struct rdz *rdz = (struct rdz *)disc;
+
+  inflateEnd(&rdz->strm);
+
+  if (rdz->map) {
+    unmap_file(rdz->map, rdz->map_size);
+  }
+
+  if (rdz->fp) {
+    fclose(rdz->fp);
+  }
+
+  free(rdz->compressed);
+  free(rdz->dict);
+  free(rdz->blocks);
+}
+
+static void rdz_read_toc(struct session *session, const struct rdz_toc *toc) {
+  session->leadin_fad = toc->leadin_fad;
+  session->leadout_fad = toc->leadout_fad;
+  session->first_track = toc->first_track;
+  session->last_track = toc->last_track;
+}
+
+static int rdz_valid_toc(struct rdz *rdz, const struct session *session) {
+  return session->first_track >= 0 &&
+         session->first_track <= session->last_track &&
+         session->last_track < rdz->num_tracks;
+}
+
+static int rdz_parse(struct disc *disc, const char *filename, int verbose) {
+  struct rdz *rdz = (struct rdz *)disc;
+
+  rdz->fp = fopen(filename, "rb");
+  if (!rdz->fp) {
+    return 0;
+  }
+
+  FILE *fp = rdz->fp;
+  struct rdz_header hdr;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != RDZ_MAGIC) {
+    LOG_WARNING("rdz_parse invalid header");
+    return 0;
+  }
+
+  if (hdr.num_sessions <= 0 || hdr.num_sessions > DISC_MAX_SESSIONS ||
+      hdr.num_areas <= 0 || hdr.num_areas > DISC_MAX_SESSIONS ||
+      hdr.num_tracks <= 0 || hdr.num_tracks > DISC_MAX_TRACKS ||
+      hdr.num_blocks < 0 || hdr.dict_size < 0 ||
+      hdr.dict_size > RDZ_MAX_DICT_SIZE) {
+    LOG_WARNING("rdz_parse invalid header");
+    return 0;
+  }
+
+  rdz->format = hdr.format;
+  rdz->num_sessions = hdr.num_sessions;
+  rdz->num_areas = hdr.num_areas;
+  rdz->num_tracks = hdr.num_tracks;
+  rdz->num_blocks = hdr.num_blocks;
+  rdz->dict_size = hdr.dict_size;
+
+  /* parse sessions and the toc for each area */
+  for (int i = 0; i < rdz->num_sessions + rdz->num_areas; i++) {
+    struct rdz_toc toc;
+    if (fread(&toc, sizeof(toc), 1, fp) != 1) {
+      LOG_WARNING("rdz_parse failed to read toc");
+      return 0;
+    }
+
+    struct session *session = i < rdz->num_sessions
+                                  ? &rdz->sessions[i]
+                                  : &rdz->areas[i - rdz->num_sessions];
+    rdz_read_toc(session, &toc);
+
+    if (!rdz_valid_toc(rdz, session)) {
+      LOG_WARNING("rdz_parse invalid toc");
+      return 0;
+    }
+  }
+
+  /* parse tracks */
+  for (int i = 0; i < rdz->num_tracks; i++) {
+    struct rdz_track *entry = &rdz->entries[i];
+    if (fread(entry, sizeof(*entry), 1, fp) != 1) {
+      LOG_WARNING("rdz_parse failed to read track");
+      return 0;
+    }
+
+    int num_blocks =
+        (entry->num_sectors + RDZ_BLOCK_SECTORS - 1) / RDZ_BLOCK_SECTORS;
+
+    if (entry->data_size <= 0 || entry->data_size > DISC_MAX_SECTOR_SIZE ||
+        entry->num_sectors < 0 || entry->first_block < 0 ||
+        entry->first_block + num_blocks > rdz->num_blocks) {
+      LOG_WARNING("rdz_parse invalid track");
+      return 0;
+    }
+
+    /* only the data portion of each sector is stored */
+    struct track *track = &rdz->tracks[i];
+    track->num = entry->num;
+    track->fad = entry->fad;
+    track->adr = entry->adr;
+    track->ctrl = entry->ctrl;
+    track->sector_fmt = entry->sector_fmt;
+    track->sector_size = entry->data_size;
+    track->header_size = 0;
+    track->error_size = 0;
+    track->data_size = entry->data_size;
+
+    if (verbose) {
+      LOG_INFO("rdz_parse track=%d fad=%d secfmt=%d datasz=%d sectors=%d",
+               track->num, track->fad, track->sector_fmt, track->data_size,
+               entry->num_sectors);
+    }
+  }
+
+  /* parse the block index and shared dictionary */
+  rdz->blocks = calloc(MAX(rdz->num_blocks, 1), sizeof(struct rdz_block));
+  if ((int)fread(rdz->blocks, sizeof(struct rdz_block), rdz->num_blocks, fp) !=
+      rdz->num_blocks) {
+    LOG_WARNING("rdz_parse failed to read block index");
+    return 0;
+  }
+
+  for (int i = 0; i < rdz->num_blocks; i++) {
+    if (rdz->blocks[i].size > RDZ_MAX_BLOCK_SIZE) {
+      LOG_WARNING("rdz_parse invalid block %d", i);
+      return 0;
+    }
+  }
+
+  rdz->dict = malloc(MAX(rdz->dict_size, 1));
+  if ((int)fread(rdz->dict, 1, rdz->dict_size, fp) != rdz->dict_size) {
+    LOG_WARNING("rdz_parse failed to read dictionary");
+    return 0;
+  }
+
+  /* blocks are raw deflate streams, without zlib headers */
+  if (inflateInit2(&rdz->strm, -MAX_WBITS) != Z_OK) {
+    LOG_WARNING("rdz_parse failed to initialize zlib");
+    return 0;
+  }
+
+  /* map the file to inflate blocks directly from it, falling back to reading
+     them through stdio when it can't be */
+  rdz->map = map_file(filename, &rdz->map_size);
+  if (!rdz->map) {
+    rdz->compressed = malloc(RDZ_MAX_BLOCK_SIZE);
+  }
+
+  rdz->cur_block = -1;
+
+  return 1;
+}
+
+struct disc *rdz_create(const char *filename, int verbose) {
+  struct rdz *rdz = calloc(1, sizeof(struct rdz));
+
+  rdz->destroy = &rdz_destroy;
+  rdz->get_format = &rdz_get_format;
+  rdz->get_num_sessions = &rdz_get_num_sessions;
+  rdz->get_session = &rdz_get_session;
+  rdz->get_num_tracks = &rdz_get_num_tracks;
+  rdz->get_track = &rdz_get_track;
+  rdz->get_toc = &rdz_get_toc;
+  rdz->read_sectors = &rdz_read_sectors;
+
+  struct disc *disc = (struct disc *)rdz;
+
+  if (!rdz_parse(disc, filename, verbose)) {
+    rdz_destroy(disc);
+    return NULL;
+  }
+
+  return disc;
+}
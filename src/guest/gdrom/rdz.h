@@ -0,0 +1,74 @@
+#ifndef RDZ_H
+#define RDZ_H
+
+#include <stdint.h>
+
+struct disc;
+
+/*
+ * compressed disc images built for random access
+ *
+ * the data portion of each track's sectors is split into small blocks, each
+ * deflated on its own against a dictionary shared by the whole image. a table
+ * of every block's location follows the track list, so a fad maps to the
+ * block holding it without scanning anything. images are produced from any
+ * other supported format with tools/repack
+ *
+ * the file is laid out as:
+ * rdz_header
+ * rdz_toc sessions[num_sessions]
+ * rdz_toc areas[num_areas]
+ * rdz_track tracks[num_tracks]
+ * rdz_block blocks[num_blocks]
+ * uint8_t dict[dict_size]
+ * block data
+ *
+ * all fields are little-endian
+ */
+#define RDZ_MAGIC 0x315a4452 /* RDZ1 */
+#define RDZ_BLOCK_SECTORS 32
+#define RDZ_MAX_DICT_SIZE 0x8000
+
+struct rdz_header {
+  uint32_t magic;
+  int32_t format;
+  int32_t num_sessions;
+  int32_t num_areas;
+  int32_t num_tracks;
+  int32_t num_blocks;
+  int32_t dict_size;
+  int32_t reserved;
+};
+
+/* used both for the sessions, and for the toc reported for each area */
+struct rdz_toc {
+  int32_t leadin_fad;
+  int32_t leadout_fad;
+  int32_t first_track;
+  int32_t last_track;
+};
+
+struct rdz_track {
+  int32_t num;
+  int32_t fad;
+  int32_t adr;
+  int32_t ctrl;
+  int32_t sector_fmt;
+  int32_t data_size;
+  /* sectors stored for the track, starting at fad */
+  int32_t num_sectors;
+  /* index of the block holding the first sector */
+  int32_t first_block;
+};
+
+struct rdz_block {
+  uint64_t offset;
+  /* blocks which don't shrink when deflated are stored as is, in which case
+     size matches the size of their sectors */
+  uint32_t size;
+  uint32_t reserved;
+};
+
+struct disc *rdz_create(const char *filename, int verbose);
+
+#endif
@@ -3,9 +3,12 @@
 #include "guest/gdrom/gdrom.h"
 #include "guest/maple/maple.h"
 #include "guest/memory.h"
+#include "guest/reg_stats.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
+#include "options.h"
 
 #if 0
 #define LOG_HOLLY LOG_INFO
@@ -15,26 +18,47 @@
 
 struct reg_cb holly_cb[NUM_HOLLY_REGS];
 
+static const struct reg_info holly_reg_info[] = {
+#define HOLLY_REG(addr, name, default, type) {name, addr, #name},
+#include "guest/holly/holly_regs.inc"
+#undef HOLLY_REG
+};
+
 /*
  * ch2 dma
  */
+static void holly_ch2_dma_end(void *data) {
+  struct holly *hl = data;
+
+  *hl->SB_C2DLEN = 0;
+  *hl->SB_C2DST = 0;
+  holly_raise_interrupt(hl, HOLLY_INT_DTDE2INT);
+}
+
 static void holly_ch2_dma(struct holly *hl) {
   struct sh4 *sh4 = hl->dc->sh4;
 
+  /* the transfer's data is written to its destination immediately, with its
+     end being signalled once the dmac finishes the transfer */
   struct sh4_dtr dtr = {0};
   dtr.channel = 2;
   dtr.dir = SH4_DMA_TO_ADDR;
   dtr.addr = *hl->SB_C2DSTAT;
+  dtr.end = &holly_ch2_dma_end;
+  dtr.end_data = hl;
   sh4_dmac_ddt(sh4, &dtr);
-
-  *hl->SB_C2DLEN = 0;
-  *hl->SB_C2DST = 0;
-  holly_raise_interrupt(hl, HOLLY_INT_DTDE2INT);
 }
 
 /*
  * gdrom dma
  */
+static void holly_gdrom_dma_end(void *data) {
+  struct holly *hl = data;
+
+  *hl->SB_GDST = 0;
+  holly_raise_interrupt(hl, HOLLY_INT_G1DEINT);
+}
+
 static void holly_gdrom_dma(struct holly *hl) {
   if (!*hl->SB_GDEN) {
     *hl->SB_GDST = 0;
@@ -75,17 +99,45 @@ static void holly_gdrom_dma(struct holly *hl) {
     addr += n;
   }
 
-  gdrom_dma_end(gd);
+  int64_t time = gdrom_dma_end(gd);
 
   *hl->SB_GDSTARD = addr;
   *hl->SB_GDLEND = transfer_size;
-  *hl->SB_GDST = 0;
-  holly_raise_interrupt(hl, HOLLY_INT_G1DEINT);
+
+  /* the transfer is reported complete once the drive would have read it. the
+     drive's own interrupt, if any, was scheduled first and fires first */
+  if (time) {
+    sched_start_timer(hl->dc->sched, &holly_gdrom_dma_end, hl, time);
+    return;
+  }
+
+  holly_gdrom_dma_end(hl);
 }
 
 /*
  * maple dma
  */
+static void *holly_maple_ram(struct holly *hl, uint32_t addr, int size) {
+  struct memory *mem = hl->dc->mem;
+
+  /* command lists and the frames they reference nearly always live in system
+     ram, resolve them to host pointers so frames can be read and responses
+     written in place */
+  addr &= 0x1fffffff;
+
+  if (addr < SH4_AREA3_RAM0_BEGIN || addr > SH4_AREA3_RAM0_END || (addr & 3)) {
+    return NULL;
+  }
+
+  uint32_t offset = addr & SH4_AREA3_ADDR_MASK;
+
+  if (offset + size > SH4_AREA3_ADDR_MASK + 1) {
+    return NULL;
+  }
+
+  return mem_ram(mem, offset);
+}
+
 static void holly_maple_dma(struct holly *hl) {
   if (!*hl->SB_MDEN) {
     *hl->SB_MDST = 0;
@@ -96,6 +148,10 @@ static void holly_maple_dma(struct holly *hl) {
   struct maple *mp = hl->dc->maple;
   uint32_t addr = *hl->SB_MDSTAR;
 
+  /* give the client a chance to hand over the latest input right before the
+     controllers are read */
+  dc_poll_input(hl->dc);
+
   while (1) {
     union maple_transfer desc;
     desc.full = sh4_read32(mem, addr);
@@ -106,24 +162,41 @@ static void holly_maple_dma(struct holly *hl) {
         uint32_t result_addr = sh4_read32(mem, addr);
         addr += 4;
 
+        int frame_size = (desc.length + 1) * 4;
+        int res_size = sizeof(union maple_frame);
+        union maple_frame *frame = holly_maple_ram(hl, addr, frame_size);
+        union maple_frame *res = holly_maple_ram(hl, result_addr, res_size);
+        union maple_frame tmp_frame, tmp_res;
+
+        /* the response can only be written in place when it doesn't overlap
+           the frame it's in response to */
+        if (frame && res && (uint8_t *)res < (uint8_t *)frame + frame_size &&
+            (uint8_t *)frame < (uint8_t *)res + res_size) {
+          res = NULL;
+        }
+
         /* read frame */
-        union maple_frame frame, res;
+        if (!frame) {
+          frame = &tmp_frame;
 
-        for (int i = 0; i < (int)desc.length + 1; i++) {
-          frame.data[i] = sh4_read32(mem, addr);
-          addr += 4;
+          for (int i = 0; i < (int)desc.length + 1; i++) {
+            frame->data[i] = sh4_read32(mem, addr + i * 4);
+          }
         }
 
+        addr += frame_size;
+
         /* process frame and write response */
-        int handled = maple_handle_frame(mp, desc.port, &frame, &res);
+        int handled =
+            maple_handle_frame(mp, desc.port, frame, res ? res : &tmp_res);
 
-        if (handled) {
-          for (int i = 0; i < (int)res.num_words + 1; i++) {
-            sh4_write32(mem, result_addr, res.data[i]);
+        if (!handled) {
+          sh4_write32(mem, result_addr, 0xffffffff);
+        } else if (!res) {
+          for (int i = 0; i < (int)tmp_res.num_words + 1; i++) {
+            sh4_write32(mem, result_addr, tmp_res.data[i]);
             result_addr += 4;
           }
-        } else {
-          sh4_write32(mem, result_addr, 0xffffffff);
         }
       } break;
 
@@ -158,40 +231,56 @@ static void holly_maple_dma(struct holly *hl) {
 #define SB_SUSP(ch) (hl->SB_ADSUSP + ((ch)*HOLLY_G2_NUM_REGS))
 #define HOLLY_INT_G2INT(ch) HOLLY_INTERRUPT(HOLLY_INT_NRM, (0x8000 << ch))
 
-static void (*g2_timers[4])(void *);
-
-#define DEFINE_G2_DMA_TIMER(ch)                                       \
-  static void holly_g2_dma_timer_channel##ch(void *data) {            \
-    struct holly *hl = data;                                          \
-    struct memory *mem = hl->dc->mem;                                 \
-    struct scheduler *sched = hl->dc->sched;                          \
-    struct holly_g2_dma *dma = &hl->dma[ch];                          \
-    int chunk_size = 0x1000;                                          \
-    int n = MIN(dma->len, chunk_size);                                \
-    sh4_memcpy(mem, dma->dst, dma->src, n);                           \
-    dma->dst += n;                                                    \
-    dma->src += n;                                                    \
-    dma->len -= n;                                                    \
-    if (!dma->len) {                                                  \
-      *SB_EN(ch) = dma->restart;                                      \
-      *SB_ST(ch) = 0;                                                 \
-      holly_raise_interrupt(hl, HOLLY_INT_G2INT(ch));                 \
-      return;                                                         \
-    }                                                                 \
-    /* g2 bus runs at 16-bits x 25mhz, loosely simulate this */       \
-    int64_t end = CYCLES_TO_NANO(chunk_size / 2, UINT64_C(25000000)); \
-    sched_start_timer(sched, g2_timers[ch], hl, end);                 \
-  }
-
-DEFINE_G2_DMA_TIMER(0);
-DEFINE_G2_DMA_TIMER(1);
-DEFINE_G2_DMA_TIMER(2);
-DEFINE_G2_DMA_TIMER(3);
-
-static void (*g2_timers[4])(void *) = {
-    &holly_g2_dma_timer_channel0, &holly_g2_dma_timer_channel1,
-    &holly_g2_dma_timer_channel2, &holly_g2_dma_timer_channel3,
-};
+/* g2 bus runs at 16-bits x 25mhz */
+#define HOLLY_G2_RATE INT64_C(50000000)
+
+static int holly_g2_dma_done(struct holly *hl, int ch) {
+  struct scheduler *sched = hl->dc->sched;
+  struct holly_g2_dma *dma = &hl->dma[ch];
+
+  if (!dma->timer) {
+    return dma->len;
+  }
+
+  /* the data is copied up front, derive how much of it would have been
+     transferred by now from the time remaining on the transfer */
+  int64_t remaining = sched_remaining_time(sched, dma->timer);
+  int pending = (int)(remaining * HOLLY_G2_RATE / NS_PER_SEC);
+  return MAX(dma->len - pending, 0);
+}
+
+static void holly_g2_dma_end(struct holly *hl, int ch) {
+  struct holly_g2_dma *dma = &hl->dma[ch];
+
+  dma->timer = NULL;
+  dma->dst += dma->len;
+  dma->src += dma->len;
+  dma->len = 0;
+
+  *SB_EN(ch) = dma->restart;
+  *SB_ST(ch) = 0;
+  holly_raise_interrupt(hl, HOLLY_INT_G2INT(ch));
+}
+
+static void holly_g2_dma_end_0(void *data) {
+  holly_g2_dma_end(data, 0);
+}
+
+static void holly_g2_dma_end_1(void *data) {
+  holly_g2_dma_end(data, 1);
+}
+
+static void holly_g2_dma_end_2(void *data) {
+  holly_g2_dma_end(data, 2);
+}
+
+static void holly_g2_dma_end_3(void *data) {
+  holly_g2_dma_end(data, 3);
+}
+
+static const timer_cb holly_timer_cbs[] = {
+    &holly_ch2_dma_end,  &holly_gdrom_dma_end, &holly_g2_dma_end_0,
+    &holly_g2_dma_end_1, &holly_g2_dma_end_2,  &holly_g2_dma_end_3};
 
 static void holly_g2_dma_suspend(struct holly *hl, int ch) {
   if (!*SB_EN(ch) || !*SB_ST(ch)) {
@@ -213,8 +302,17 @@ static void holly_g2_dma(struct holly *hl, int ch) {
   /* only sh4 -> g2 supported for now */
   CHECK_EQ(*SB_DIR(ch), 0);
 
-  /* latch register state */
+  struct memory *mem = hl->dc->mem;
+  struct scheduler *sched = hl->dc->sched;
   struct holly_g2_dma *dma = &hl->dma[ch];
+
+  /* a transfer restarted before the previous one ended finishes it first */
+  if (dma->timer) {
+    sched_cancel_timer(sched, dma->timer);
+    holly_g2_dma_end(hl, ch);
+  }
+
+  /* latch register state */
   dma->dst = *SB_STAG(ch);
   dma->src = *SB_STAR(ch);
   dma->restart = (*SB_LEN(ch) & 0x80000000) == 0;
@@ -223,44 +321,79 @@ static void holly_g2_dma(struct holly *hl, int ch) {
   LOG_HOLLY("holly_g2_dma dst=0x%08x src=0x%08x len=0x%08x", dma->dst, dma->src,
             dma->len);
 
-  /* kick off async dma */
-  g2_timers[ch](hl);
+  /* copy the entire transfer at once, with wave memory being mapped directly
+     into the sh4's address space this resolves to a single memcpy into aram.
+     the end of the transfer is then signalled once, after the time it would
+     have taken on the bus */
+  sh4_memcpy(mem, dma->dst, dma->src, dma->len);
+
+  static const timer_cb end_cbs[] = {&holly_g2_dma_end_0, &holly_g2_dma_end_1,
+                                     &holly_g2_dma_end_2, &holly_g2_dma_end_3};
+  int64_t end = (int64_t)dma->len * NS_PER_SEC / HOLLY_G2_RATE;
+  dma->timer = sched_start_timer(sched, end_cbs[ch], hl, end);
+}
+
+#define HOLLY_IRL_9 0x1
+#define HOLLY_IRL_11 0x2
+#define HOLLY_IRL_13 0x4
+
+static int holly_irl(struct holly *hl) {
+  int irl = 0;
+
+  if ((*hl->SB_ISTNRM & *hl->SB_IML6NRM) ||
+      (*hl->SB_ISTERR & *hl->SB_IML6ERR) ||
+      (*hl->SB_ISTEXT & *hl->SB_IML6EXT)) {
+    irl |= HOLLY_IRL_9;
+  }
+
+  if ((*hl->SB_ISTNRM & *hl->SB_IML4NRM) ||
+      (*hl->SB_ISTERR & *hl->SB_IML4ERR) ||
+      (*hl->SB_ISTEXT & *hl->SB_IML4EXT)) {
+    irl |= HOLLY_IRL_11;
+  }
+
+  if ((*hl->SB_ISTNRM & *hl->SB_IML2NRM) ||
+      (*hl->SB_ISTERR & *hl->SB_IML2ERR) ||
+      (*hl->SB_ISTEXT & *hl->SB_IML2EXT)) {
+    irl |= HOLLY_IRL_13;
+  }
+
+  return irl;
 }
 
 static void holly_update_interrupts(struct holly *hl) {
+  static const struct {
+    int irl;
+    enum sh4_interrupt intr;
+  } levels[] = {
+      {HOLLY_IRL_9, SH4_INT_IRL_9},
+      {HOLLY_IRL_11, SH4_INT_IRL_11},
+      {HOLLY_IRL_13, SH4_INT_IRL_13},
+  };
+
   struct sh4 *sh4 = hl->dc->sh4;
+  int irl = holly_irl(hl);
+  int changed = irl ^ hl->irl;
+
+  if (!changed) {
+    return;
+  }
 
   /* trigger the respective level-encoded interrupt on the sh4 interrupt
      controller */
-  {
-    if ((*hl->SB_ISTNRM & *hl->SB_IML6NRM) ||
-        (*hl->SB_ISTERR & *hl->SB_IML6ERR) ||
-        (*hl->SB_ISTEXT & *hl->SB_IML6EXT)) {
-      sh4_raise_interrupt(sh4, SH4_INT_IRL_9);
-    } else {
-      sh4_clear_interrupt(sh4, SH4_INT_IRL_9);
+  for (int i = 0; i < ARRAY_SIZE(levels); i++) {
+    if (!(changed & levels[i].irl)) {
+      continue;
     }
-  }
 
-  {
-    if ((*hl->SB_ISTNRM & *hl->SB_IML4NRM) ||
-        (*hl->SB_ISTERR & *hl->SB_IML4ERR) ||
-        (*hl->SB_ISTEXT & *hl->SB_IML4EXT)) {
-      sh4_raise_interrupt(sh4, SH4_INT_IRL_11);
+    if (irl & levels[i].irl) {
+      sh4_raise_interrupt(sh4, levels[i].intr);
     } else {
-      sh4_clear_interrupt(sh4, SH4_INT_IRL_11);
+      sh4_clear_interrupt(sh4, levels[i].intr);
     }
   }
 
-  {
-    if ((*hl->SB_ISTNRM & *hl->SB_IML2NRM) ||
-        (*hl->SB_ISTERR & *hl->SB_IML2ERR) ||
-        (*hl->SB_ISTEXT & *hl->SB_IML2EXT)) {
-      sh4_raise_interrupt(sh4, SH4_INT_IRL_13);
-    } else {
-      sh4_clear_interrupt(sh4, SH4_INT_IRL_13);
-    }
-  }
+  hl->irl = irl;
 }
 
 static uint32_t *holly_interrupt_status(struct holly *hl,
@@ -277,6 +410,39 @@ static uint32_t *holly_interrupt_status(struct holly *hl,
   }
 }
 
+static void holly_load(struct device *dev, struct snapshot *snap) {
+  struct holly *hl = (struct holly *)dev;
+
+  SNAP_READ(snap, hl->reg);
+
+  for (int i = 0; i < HOLLY_G2_NUM_CHAN; i++) {
+    struct holly_g2_dma *dma = &hl->dma[i];
+    SNAP_READ(snap, dma->dst);
+    SNAP_READ(snap, dma->src);
+    SNAP_READ(snap, dma->restart);
+    SNAP_READ(snap, dma->len);
+    dma->timer = sched_load_timer(hl->dc->sched, snap);
+  }
+
+  /* the sh4 restores the levels it had raised from the same snapshot */
+  hl->irl = holly_irl(hl);
+}
+
+static void holly_save(struct device *dev, struct snapshot *snap) {
+  struct holly *hl = (struct holly *)dev;
+
+  SNAP_WRITE(snap, hl->reg);
+
+  for (int i = 0; i < HOLLY_G2_NUM_CHAN; i++) {
+    struct holly_g2_dma *dma = &hl->dma[i];
+    SNAP_WRITE(snap, dma->dst);
+    SNAP_WRITE(snap, dma->src);
+    SNAP_WRITE(snap, dma->restart);
+    SNAP_WRITE(snap, dma->len);
+    sched_save_timer(hl->dc->sched, snap, dma->timer);
+  }
+}
+
 static int holly_init(struct device *dev) {
   struct holly *hl = (struct holly *)dev;
   return 1;
@@ -287,6 +453,9 @@ void holly_clear_interrupt(struct holly *hl, holly_interrupt_t intr) {
   uint32_t irq = HOLLY_INTERRUPT_IRQ(intr);
 
   uint32_t *status = holly_interrupt_status(hl, type);
+  if (!(*status & irq)) {
+    return;
+  }
   *status &= ~irq;
 
   holly_update_interrupts(hl);
@@ -297,9 +466,10 @@ void holly_raise_interrupt(struct holly *hl, holly_interrupt_t intr) {
   uint32_t irq = HOLLY_INTERRUPT_IRQ(intr);
 
   uint32_t *status = holly_interrupt_status(hl, type);
-  *status |= irq;
-
-  holly_update_interrupts(hl);
+  if ((*status & irq) != irq) {
+    *status |= irq;
+    holly_update_interrupts(hl);
+  }
 
   /* check for hardware dma initiation */
   if (intr == HOLLY_INT_PCVOINT && *hl->SB_MDTSEL && *hl->SB_MDEN) {
@@ -311,6 +481,7 @@ void holly_reg_write(struct holly *hl, uint32_t addr, uint32_t data,
                      uint32_t mask) {
   uint32_t offset = addr >> 2;
   reg_write_cb write = holly_cb[offset].write;
+  int64_t start = OPTION_reg_stats ? time_nanoseconds() : 0;
 
   if (hl->log_regs) {
     LOG_INFO("holly_reg_write addr=0x%08x data=0x%x", addr, data & mask);
@@ -318,15 +489,20 @@ void holly_reg_write(struct holly *hl, uint32_t addr, uint32_t data,
 
   if (write) {
     write(hl->dc, data);
-    return;
+  } else {
+    hl->reg[offset] = data;
   }
 
-  hl->reg[offset] = data;
+  if (start) {
+    reg_stats_count_write(&hl->reg_counts[offset],
+                          time_nanoseconds() - start);
+  }
 }
 
 uint32_t holly_reg_read(struct holly *hl, uint32_t addr, uint32_t mask) {
   uint32_t offset = addr >> 2;
   reg_read_cb read = holly_cb[offset].read;
+  int64_t start = OPTION_reg_stats ? time_nanoseconds() : 0;
 
   uint32_t data;
   if (read) {
@@ -335,6 +511,11 @@ uint32_t holly_reg_read(struct holly *hl, uint32_t addr, uint32_t mask) {
     data = hl->reg[offset];
   }
 
+  if (start) {
+    reg_stats_count_read(&hl->reg_counts[offset],
+                         time_nanoseconds() - start);
+  }
+
   if (hl->log_regs) {
     LOG_INFO("holly_reg_read addr=0x%08x data=0x%x", addr, data);
   }
@@ -395,6 +576,18 @@ struct holly *holly_create(struct dreamcast *dc) {
 #include "guest/holly/holly_regs.inc"
 #undef HOLLY_REG
 
+  /* setup snapshot interface */
+  hl->snapif.enabled = 1;
+  hl->snapif.save = &holly_save;
+  hl->snapif.load = &holly_load;
+
+  /* setup timer callbacks */
+  hl->timer_cbs = holly_timer_cbs;
+  hl->num_timer_cbs = ARRAY_SIZE(holly_timer_cbs);
+
+  reg_stats_register(dc->reg_stats, &hl->reg_block, "holly", holly_reg_info,
+                     ARRAY_SIZE(holly_reg_info), hl->reg_counts);
+
   return hl;
 }
 
@@ -583,19 +776,19 @@ REG_W32(holly_cb, SB_ADTSEL) {
 REG_R32(holly_cb, SB_ADSTAGD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[0];
-  return dma->dst;
+  return dma->dst + holly_g2_dma_done(hl, 0);
 }
 
 REG_R32(holly_cb, SB_ADSTARD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[0];
-  return dma->src;
+  return dma->src + holly_g2_dma_done(hl, 0);
 }
 
 REG_R32(holly_cb, SB_ADLEND) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[0];
-  return dma->len;
+  return dma->len - holly_g2_dma_done(hl, 0);
 }
 
 REG_W32(holly_cb, SB_E1ST) {
@@ -632,19 +825,19 @@ REG_W32(holly_cb, SB_E1TSEL) {
 REG_R32(holly_cb, SB_E1STAGD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[1];
-  return dma->dst;
+  return dma->dst + holly_g2_dma_done(hl, 1);
 }
 
 REG_R32(holly_cb, SB_E1STARD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[1];
-  return dma->src;
+  return dma->src + holly_g2_dma_done(hl, 1);
 }
 
 REG_R32(holly_cb, SB_E1LEND) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[1];
-  return dma->len;
+  return dma->len - holly_g2_dma_done(hl, 1);
 }
 
 REG_W32(holly_cb, SB_E2ST) {
@@ -681,19 +874,19 @@ REG_W32(holly_cb, SB_E2TSEL) {
 REG_R32(holly_cb, SB_E2STAGD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[2];
-  return dma->dst;
+  return dma->dst + holly_g2_dma_done(hl, 2);
 }
 
 REG_R32(holly_cb, SB_E2STARD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[2];
-  return dma->src;
+  return dma->src + holly_g2_dma_done(hl, 2);
 }
 
 REG_R32(holly_cb, SB_E2LEND) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[2];
-  return dma->len;
+  return dma->len - holly_g2_dma_done(hl, 2);
 }
 
 REG_W32(holly_cb, SB_DDST) {
@@ -730,19 +923,19 @@ REG_W32(holly_cb, SB_DDTSEL) {
 REG_R32(holly_cb, SB_DDSTAGD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[3];
-  return dma->dst;
+  return dma->dst + holly_g2_dma_done(hl, 3);
 }
 
 REG_R32(holly_cb, SB_DDSTARD) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[3];
-  return dma->src;
+  return dma->src + holly_g2_dma_done(hl, 3);
 }
 
 REG_R32(holly_cb, SB_DDLEND) {
   struct holly *hl = dc->holly;
   struct holly_g2_dma *dma = &hl->dma[3];
-  return dma->len;
+  return dma->len - holly_g2_dma_done(hl, 3);
 }
 
 REG_W32(holly_cb, SB_PDST) {
@@ -3,10 +3,12 @@
 
 #include "guest/dreamcast.h"
 #include "guest/holly/holly_types.h"
+#include "guest/reg_stats.h"
 
 struct gdrom;
 struct maple;
 struct sh4;
+struct timer;
 
 #define HOLLY_G2_NUM_CHAN 4
 #define HOLLY_G2_NUM_REGS 8
@@ -16,6 +18,8 @@ struct holly_g2_dma {
   uint32_t src;
   int restart;
   int len;
+  /* signals the end of the transfer in flight */
+  struct timer *timer;
 };
 
 struct holly {
@@ -26,8 +30,16 @@ struct holly {
 #include "guest/holly/holly_regs.inc"
 #undef HOLLY_REG
 
+  /* access counts for the machine's reg_stats, indexed by offset */
+  struct reg_counts reg_counts[NUM_HOLLY_REGS];
+  struct reg_block reg_block;
+
   struct holly_g2_dma dma[HOLLY_G2_NUM_CHAN];
 
+  /* irl levels last raised on the sh4, as a mask of HOLLY_IRL_* bits. bursts
+     of interrupts only reach the sh4 when they change the levels asserted */
+  int irl;
+
   /* debug */
   int log_regs;
 };
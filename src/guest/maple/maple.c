@@ -37,8 +37,8 @@ static void maple_register_dev(struct maple *mp, const char *device_type,
   }
 }
 
-int maple_handle_frame(struct maple *mp, int port, union maple_frame *req,
-                       union maple_frame *res) {
+int maple_handle_frame(struct maple *mp, int port,
+                       const union maple_frame *req, union maple_frame *res) {
   CHECK(port >= 0 && port < MAPLE_NUM_PORTS);
 
   struct maple_device *dev = mp->devs[port][MAPLE_MAX_UNITS - 1];
@@ -47,8 +47,9 @@ int maple_handle_frame(struct maple *mp, int port, union maple_frame *req,
     return 0;
   }
 
-  /* initialize response */
-  memset(res, 0, sizeof(*res));
+  /* initialize response header. the response may be written in place into
+     guest memory, so only the words the device fills in are touched */
+  res->data[0] = 0;
   res->dst_addr = req->src_addr;
   res->src_addr = req->dst_addr;
 
@@ -65,6 +66,18 @@ int maple_handle_frame(struct maple *mp, int port, union maple_frame *req,
   return 1;
 }
 
+void maple_sync(struct maple *mp) {
+  for (int i = 0; i < MAPLE_NUM_PORTS; i++) {
+    for (int j = 0; j < MAPLE_MAX_UNITS; j++) {
+      struct maple_device *dev = mp->devs[i][j];
+
+      if (dev && dev->sync) {
+        dev->sync(dev);
+      }
+    }
+  }
+}
+
 void maple_handle_input(struct maple *mp, int port, int button, int16_t value) {
   CHECK(port >= 0 && port < MAPLE_NUM_PORTS);
 
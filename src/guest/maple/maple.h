@@ -13,6 +13,8 @@ struct maple_device {
   int (*input)(struct maple_device *, int, int16_t);
   int (*frame)(struct maple_device *, const union maple_frame *,
                union maple_frame *);
+  /* write any state buffered by the device through to storage */
+  void (*sync)(struct maple_device *);
 };
 
 uint8_t maple_encode_addr(int port, int unit);
@@ -22,9 +24,12 @@ struct maple *maple_create(struct dreamcast *dc);
 void maple_destroy(struct maple *mp);
 
 struct maple_device *maple_get_device(struct maple *mp, int port, int unit);
+void maple_sync(struct maple *mp);
 void maple_handle_input(struct maple *mp, int port, int button, int16_t value);
-int maple_handle_frame(struct maple *mp, int port, union maple_frame *frame,
-                       union maple_frame *res);
+/* res may point directly into guest memory, only its header and the
+   num_words following it are written */
+int maple_handle_frame(struct maple *mp, int port,
+                       const union maple_frame *req, union maple_frame *res);
 
 struct maple_device *controller_create(struct maple *mp, int port);
 struct maple_device *vmu_create(struct maple *mp, int port);
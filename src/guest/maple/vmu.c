@@ -1,11 +1,24 @@
+#include "core/bitmap.h"
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "core/thread.h"
 #include "guest/maple/maple.h"
 #include "guest/maple/vmu_default.inc"
+#include "options.h"
 
 #define BLK_SIZE 512
 #define BLK_WORDS (512 >> 2)
 #define BLK_OFFSET(blk, phase) ((blk)*BLK_SIZE + (phase) * (BLK_SIZE >> 2))
+#define NUM_BLKS 256
+#define VMU_SIZE (NUM_BLKS * BLK_SIZE)
+
+/* delay from a block first being dirtied to it being flushed, letting the
+   rest of a save's writes accumulate into the same batch */
+#define FLUSH_DELAY_MS 500
+
+/* depth of the queue writing out each batch, runs of adjacent blocks are
+   written with a single request */
+#define FLUSH_AIO_DEPTH 16
 
 #define LCD_WIDTH 48
 #define LCD_HEIGHT 32
@@ -13,37 +26,158 @@
 struct vmu {
   struct maple_device;
 
-  /* note, a persistent file handle isn't kept open here, writes are instead
-     performed immediately to avoid corrupt saves in the event of a crash */
   char filename[PATH_MAX];
+
+  /* the image is served from memory, with the blocks written by the guest
+     being flushed back to the file in batches from a background thread, so
+     the emulation thread never waits on storage */
+  uint8_t data[VMU_SIZE];
+  DECLARE_BITMAP(dirty, NUM_BLKS);
+
+  mutex_t mutex;
+  cond_t cond;
+  thread_t thread;
+  int shutdown;
+
+  /* blocks being written out, owned by whoever holds io_mutex */
+  mutex_t io_mutex;
+  struct fs_aio *aio;
+  uint8_t pending[VMU_SIZE];
+  DECLARE_BITMAP(pending_dirty, NUM_BLKS);
+  int pending_failed;
 };
 
+static void vmu_write_done(void *data, int64_t res) {
+  struct vmu *vmu = data;
+  vmu->pending_failed |= res < 0;
+}
+
+static int vmu_write_pending(struct vmu *vmu) {
+  /* note, a persistent file handle isn't kept open here, each batch is synced
+     to storage before the file is closed to avoid corrupt saves in the event
+     of a crash */
+  struct fs_file *file = fs_open(vmu->filename, 1);
+  if (!file) {
+    return 0;
+  }
+
+  vmu->pending_failed = 0;
+
+  for (int i = 0; i < NUM_BLKS;) {
+    if (!bitmap_test(vmu->pending_dirty, i, 1)) {
+      i++;
+      continue;
+    }
+
+    int first = i;
+    while (i < NUM_BLKS && bitmap_test(vmu->pending_dirty, i, 1)) {
+      i++;
+    }
+
+    fs_aio_write(vmu->aio, file, first * BLK_SIZE,
+                 &vmu->pending[first * BLK_SIZE], (i - first) * BLK_SIZE,
+                 &vmu_write_done, vmu);
+  }
+
+  /* the fsync isn't started until the writes before it have completed */
+  fs_aio_fsync(vmu->aio, file, &vmu_write_done, vmu);
+  fs_aio_drain(vmu->aio);
+
+  fs_close(file);
+
+  return !vmu->pending_failed;
+}
+
+static void vmu_flush(struct vmu *vmu) {
+  mutex_lock(vmu->io_mutex);
+
+  /* grab a copy of the dirty blocks, letting the guest carry on writing to
+     the image while they're written out */
+  mutex_lock(vmu->mutex);
+  bitmap_copy(vmu->pending_dirty, vmu->dirty, NUM_BLKS);
+  bitmap_clear(vmu->dirty, 0, NUM_BLKS);
+  for (int i = 0; i < NUM_BLKS; i++) {
+    if (bitmap_test(vmu->pending_dirty, i, 1)) {
+      memcpy(&vmu->pending[i * BLK_SIZE], &vmu->data[i * BLK_SIZE], BLK_SIZE);
+    }
+  }
+  mutex_unlock(vmu->mutex);
+
+  if (bitmap_any(vmu->pending_dirty, 0, NUM_BLKS) && !vmu_write_pending(vmu)) {
+    LOG_WARNING("vmu_flush failed to write %s", vmu->filename);
+
+    /* leave the blocks dirty to retry them with the next batch */
+    mutex_lock(vmu->mutex);
+    bitmap_or(vmu->dirty, vmu->dirty, vmu->pending_dirty, NUM_BLKS);
+    mutex_unlock(vmu->mutex);
+  }
+
+  mutex_unlock(vmu->io_mutex);
+}
+
+static void *vmu_flush_thread(void *data) {
+  struct vmu *vmu = data;
+
+  apply_thread_options(ROLE_IO);
+
+  mutex_lock(vmu->mutex);
+
+  while (!vmu->shutdown) {
+    if (!bitmap_any(vmu->dirty, 0, NUM_BLKS)) {
+      cond_wait(vmu->cond, vmu->mutex);
+      continue;
+    }
+
+    cond_timedwait(vmu->cond, vmu->mutex, FLUSH_DELAY_MS);
+
+    if (vmu->shutdown) {
+      break;
+    }
+
+    mutex_unlock(vmu->mutex);
+    vmu_flush(vmu);
+    mutex_lock(vmu->mutex);
+  }
+
+  mutex_unlock(vmu->mutex);
+
+  return NULL;
+}
+
 static void vmu_write_bin(struct vmu *vmu, int block, int phase,
                           const void *buffer, int num_words) {
   int offset = BLK_OFFSET(block, phase);
   int size = num_words << 2;
+  CHECK_LE(offset + size, VMU_SIZE);
 
-  FILE *file = fopen(vmu->filename, "r+b");
-  CHECK_NOTNULL(file, "failed to open %s", vmu->filename);
-  int r = fseek(file, offset, SEEK_SET);
-  CHECK_NE(r, -1);
-  r = (int)fwrite(buffer, 1, size, file);
-  CHECK_EQ(r, size);
-  fclose(file);
+  if (!size) {
+    return;
+  }
+
+  int first = offset / BLK_SIZE;
+  int last = (offset + size - 1) / BLK_SIZE;
+
+  mutex_lock(vmu->mutex);
+
+  /* wake up the background thread when starting a new batch */
+  if (!bitmap_any(vmu->dirty, 0, NUM_BLKS)) {
+    cond_signal(vmu->cond);
+  }
+
+  memcpy(&vmu->data[offset], buffer, size);
+  bitmap_set(vmu->dirty, first, last - first + 1);
+
+  mutex_unlock(vmu->mutex);
 }
 
 static void vmu_read_bin(struct vmu *vmu, int block, int phase, void *buffer,
                          int num_words) {
   int offset = BLK_OFFSET(block, phase);
   int size = num_words << 2;
+  CHECK_LE(offset + size, VMU_SIZE);
 
-  FILE *file = fopen(vmu->filename, "rb");
-  CHECK_NOTNULL(file, "failed to open %s", vmu->filename);
-  int r = fseek(file, offset, SEEK_SET);
-  CHECK_NE(r, -1);
-  r = (int)fread(buffer, 1, size, file);
-  CHECK_EQ(r, size);
-  fclose(file);
+  /* the image is only ever modified from this thread, no need to lock */
+  memcpy(buffer, &vmu->data[offset], size);
 }
 
 static void vmu_parse_block_param(uint32_t data, int *partition, int *block,
@@ -201,8 +335,30 @@ static int vmu_frame(struct maple_device *dev, const union maple_frame *req,
   return 1;
 }
 
+static void vmu_sync(struct maple_device *dev) {
+  struct vmu *vmu = (struct vmu *)dev;
+  vmu_flush(vmu);
+}
+
 static void vmu_destroy(struct maple_device *dev) {
   struct vmu *vmu = (struct vmu *)dev;
+
+  mutex_lock(vmu->mutex);
+  vmu->shutdown = 1;
+  cond_signal(vmu->cond);
+  mutex_unlock(vmu->mutex);
+
+  void *result;
+  thread_join(vmu->thread, &result);
+
+  /* write out whatever the background thread hadn't gotten to */
+  vmu_flush(vmu);
+
+  fs_aio_destroy(vmu->aio);
+  mutex_destroy(vmu->io_mutex);
+  cond_destroy(vmu->cond);
+  mutex_destroy(vmu->mutex);
+
   free(vmu);
 }
 
@@ -212,6 +368,7 @@ struct maple_device *vmu_create(struct maple *mp, int port) {
   vmu->mp = mp;
   vmu->destroy = &vmu_destroy;
   vmu->frame = &vmu_frame;
+  vmu->sync = &vmu_sync;
 
   /* intialize default vmu if one doesn't exist */
   const char *appdir = fs_appdir();
@@ -227,5 +384,18 @@ struct maple_device *vmu_create(struct maple *mp, int port) {
     fclose(file);
   }
 
+  FILE *file = fopen(vmu->filename, "rb");
+  CHECK_NOTNULL(file, "failed to open %s", vmu->filename);
+  int r = (int)fread(vmu->data, 1, sizeof(vmu->data), file);
+  CHECK_EQ(r, (int)sizeof(vmu->data));
+  fclose(file);
+
+  vmu->mutex = mutex_create();
+  vmu->cond = cond_create();
+  vmu->io_mutex = mutex_create();
+  vmu->aio = fs_aio_create(FLUSH_AIO_DEPTH);
+  vmu->thread = thread_create(&vmu_flush_thread, "vmu", vmu);
+  CHECK_NOTNULL(vmu->thread);
+
   return (struct maple_device *)vmu;
 }
@@ -20,14 +20,25 @@
  * if accessed. this mechanic is used by the jit to optimistically compile code
  * to go the fast route, falling back to calling into *_read_bytes or
  * *_write_bytes if a segfault occurs
+ *
+ * for snapshots, the pages of physical memory modified between each snapshot
+ * are tracked. with fastmem, every host mapping of physical memory is write
+ * protected once a snapshot is taken, and the first write to each page is
+ * caught and recorded before lifting the protection from it. without
+ * fastmem, every page is assumed to be modified
  */
 
 #include <stdint.h>
 #include "guest/memory.h"
+#include "core/bitmap.h"
 #include "core/core.h"
+#include "core/exception_handler.h"
+#include "core/thread.h"
 #include "guest/arm7/arm7.h"
 #include "guest/dreamcast.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
+#include "options.h"
 
 /* physical memory constants */
 #define RAM_SIZE 16 * 1024 * 1024
@@ -38,6 +49,12 @@
 #define ARAM_OFFSET VRAM_OFFSET + VRAM_SIZE
 #define PHYSICAL_SIZE RAM_SIZE + VRAM_SIZE + ARAM_SIZE
 
+/* the half of the sh4's operand cache usable as ram. it's backed by the same
+   shared memory object as physical memory, so fastmem can map it directly,
+   but lives past the end of it so it's not tracked */
+#define OCRAM_SIZE SH4_ORA_SIZE
+#define OCRAM_OFFSET (PHYSICAL_SIZE)
+
 /* page table constants */
 #define MEM_PAGE_BITS 11
 #define MEM_OFFSET_BITS 21
@@ -45,6 +62,20 @@
 #define MEM_PAGE_SHIFT MEM_OFFSET_BITS
 #define MEM_OFFSET_MASK ((1 << MEM_OFFSET_BITS) - 1)
 
+/* modification tracking constants */
+#define MEM_TRACK_PAGE_SHIFT 12
+#define MEM_TRACK_PAGE_SIZE (1 << MEM_TRACK_PAGE_SHIFT)
+#define MEM_TRACK_NUM_PAGES ((PHYSICAL_SIZE) >> MEM_TRACK_PAGE_SHIFT)
+#define MEM_MAX_VIEWS 64
+#define MEM_MAX_UNPROTECTED 0x10000
+
+/* host mapping of a range of physical memory */
+struct mem_view {
+  uint8_t *ptr;
+  uint32_t offset;
+  uint32_t size;
+};
+
 /* address spaces provide different views of the same physical memory */
 struct address_space {
   uint8_t *base;
@@ -64,16 +95,48 @@ struct memory {
   /* shared memory object that backs the ram / vram / aram when using
      fastmem */
   shmem_handle_t shmem;
+
+  /* mappings of physical memory are advised to use huge pages */
+  int huge_pages;
 #endif
 
   /* the machine's physical memory */
   uint8_t *ram;
   uint8_t *vram;
   uint8_t *aram;
+  uint8_t *ocram;
 
   /* each cpu has a different address space */
   struct address_space arm7;
   struct address_space sh4;
+
+  /* the generation of modifications is bumped each time a snapshot is saved,
+     each page recording the generation it was last modified in */
+  uint32_t gen;
+  uint32_t page_gen[MEM_TRACK_NUM_PAGES];
+
+  /* pages overwritten by the last snapshot restore */
+  DECLARE_BITMAP(restored, MEM_TRACK_NUM_PAGES);
+
+#ifdef HAVE_FASTMEM
+  struct mem_view views[MEM_MAX_VIEWS];
+  int num_views;
+
+  /* bounds of every view, claimed as the exception handler's range */
+  uintptr_t views_begin;
+  uintptr_t views_end;
+
+  struct exception_handler *exc_handler;
+  int exc_range;
+  mutex_t track_mutex;
+  int tracking;
+
+  /* pages of each view whose write protection has been lifted since the last
+     snapshot, packed as view << 16 | page. if the log fills up, every view is
+     protected again in its entirety instead */
+  uint32_t unprotected[MEM_MAX_UNPROTECTED];
+  int num_unprotected;
+#endif
 };
 
 static int reserve_address_space(uint8_t **base) {
@@ -102,6 +165,248 @@ static int reserve_address_space(uint8_t **base) {
   return 0;
 }
 
+/*
+ * modification tracking
+ */
+static uint8_t *mem_physical_ptr(struct memory *mem, uint32_t offset) {
+  if (offset >= ARAM_OFFSET) {
+    return mem->aram + (offset - (ARAM_OFFSET));
+  } else if (offset >= VRAM_OFFSET) {
+    return mem->vram + (offset - VRAM_OFFSET);
+  }
+  return mem->ram + (offset - RAM_OFFSET);
+}
+
+static int mem_physical_page(struct memory *mem, const uint8_t *ptr) {
+  uint32_t offset;
+
+  if (ptr >= mem->aram && ptr < mem->aram + ARAM_SIZE) {
+    offset = (ARAM_OFFSET) + (uint32_t)(ptr - mem->aram);
+  } else if (ptr >= mem->vram && ptr < mem->vram + VRAM_SIZE) {
+    offset = VRAM_OFFSET + (uint32_t)(ptr - mem->vram);
+  } else {
+    CHECK(ptr >= mem->ram && ptr < mem->ram + RAM_SIZE);
+    offset = RAM_OFFSET + (uint32_t)(ptr - mem->ram);
+  }
+
+  return offset >> MEM_TRACK_PAGE_SHIFT;
+}
+
+static void mem_modify_all(struct memory *mem) {
+  for (int i = 0; i < MEM_TRACK_NUM_PAGES; i++) {
+    mem->page_gen[i] = mem->gen;
+  }
+}
+
+#ifdef HAVE_FASTMEM
+static void mem_add_view(struct memory *mem, uint8_t *ptr, uint32_t offset,
+                         uint32_t size) {
+  CHECK_LT(mem->num_views, MEM_MAX_VIEWS);
+  struct mem_view *view = &mem->views[mem->num_views++];
+  view->ptr = ptr;
+  view->offset = offset;
+  view->size = size;
+
+  uintptr_t begin = (uintptr_t)ptr;
+  uintptr_t end = begin + size;
+
+  if (mem->num_views == 1) {
+    mem->views_begin = begin;
+    mem->views_end = end;
+  } else {
+    mem->views_begin = MIN(mem->views_begin, begin);
+    mem->views_end = MAX(mem->views_end, end);
+  }
+
+  if (mem->exc_handler) {
+    exception_handler_update_range(mem->exc_handler, mem->exc_range,
+                                   mem->views_begin, mem->views_end);
+  }
+}
+
+static struct mem_view *mem_lookup_view(struct memory *mem, uintptr_t addr) {
+  for (int i = 0; i < mem->num_views; i++) {
+    struct mem_view *view = &mem->views[i];
+    uintptr_t begin = (uintptr_t)view->ptr;
+
+    if (addr >= begin && addr < begin + view->size) {
+      return view;
+    }
+  }
+  return NULL;
+}
+
+static void mem_protect_views(struct memory *mem) {
+  if (mem->num_unprotected > MEM_MAX_UNPROTECTED) {
+    for (int i = 0; i < mem->num_views; i++) {
+      struct mem_view *view = &mem->views[i];
+      CHECK(protect_pages(view->ptr, view->size, ACC_READONLY));
+    }
+  } else {
+    for (int i = 0; i < mem->num_unprotected; i++) {
+      uint32_t entry = mem->unprotected[i];
+      struct mem_view *view = &mem->views[entry >> 16];
+      uint8_t *ptr = view->ptr + ((entry & 0xffff) << MEM_TRACK_PAGE_SHIFT);
+      CHECK(protect_pages(ptr, MEM_TRACK_PAGE_SIZE, ACC_READONLY));
+    }
+  }
+
+  mem->num_unprotected = 0;
+}
+
+static int mem_handle_exception(void *data, struct exception_state *ex) {
+  struct memory *mem = data;
+
+  if (!mem->tracking || ex->type != EX_ACCESS_VIOLATION) {
+    return 0;
+  }
+
+  struct mem_view *view = mem_lookup_view(mem, ex->fault_addr);
+
+  if (!view) {
+    return 0;
+  }
+
+  uintptr_t view_begin = (uintptr_t)view->ptr;
+  uintptr_t view_end = view_begin + view->size;
+  uintptr_t begin = ALIGN_DOWN(ex->fault_addr, MEM_TRACK_PAGE_SIZE);
+  uintptr_t end = begin + MEM_TRACK_PAGE_SIZE;
+
+  /* if the page is being watched, the watch's handler lifts the protection
+     from the entire range it covers. record each page in the range as lifted,
+     and leave the exception to it */
+  uintptr_t watch_begin, watch_end;
+  int watched =
+      get_memory_watch_range((void *)ex->fault_addr, &watch_begin, &watch_end);
+
+  if (watched) {
+    begin = MAX(MIN(begin, watch_begin), view_begin);
+    end = MIN(MAX(end, watch_end), view_end);
+  }
+
+  /* cpus running on other host threads may fault at the same time */
+  mutex_lock(mem->track_mutex);
+
+  int view_index = (int)(view - mem->views);
+  int base_page = view->offset >> MEM_TRACK_PAGE_SHIFT;
+
+  for (uintptr_t addr = begin; addr < end; addr += MEM_TRACK_PAGE_SIZE) {
+    int page = (int)((addr - view_begin) >> MEM_TRACK_PAGE_SHIFT);
+    mem->page_gen[base_page + page] = mem->gen;
+
+    /* keep counting once the log is full to flag that it's overflowed */
+    if (mem->num_unprotected < MEM_MAX_UNPROTECTED) {
+      mem->unprotected[mem->num_unprotected] = (view_index << 16) | page;
+    }
+    mem->num_unprotected =
+        MIN(mem->num_unprotected + 1, MEM_MAX_UNPROTECTED + 1);
+  }
+
+  mutex_unlock(mem->track_mutex);
+
+  if (watched) {
+    return 0;
+  }
+
+  CHECK(protect_pages((void *)begin, MEM_TRACK_PAGE_SIZE, ACC_READWRITE));
+
+  return 1;
+}
+#endif
+
+static int mem_tracking(struct memory *mem) {
+#ifdef HAVE_FASTMEM
+  if (mem->tracking) {
+    return 1;
+  }
+
+  /* protections are lifted a page at a time */
+  if (get_page_size() != MEM_TRACK_PAGE_SIZE) {
+    return 0;
+  }
+
+  /* start tracking from the first snapshot on, protecting every view once it's
+     been taken */
+  mem->tracking = 1;
+  mem->num_unprotected = MEM_MAX_UNPROTECTED + 1;
+
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+void mem_alloc_snapshot(struct memory *mem, struct snapshot *snap) {
+  snap->mem = malloc(PHYSICAL_SIZE);
+  CHECK_NOTNULL(snap->mem);
+  snap->mem_size = PHYSICAL_SIZE;
+  snap->mem_gen = 0;
+  snap->mem_page_size = MEM_TRACK_PAGE_SIZE;
+  snap->mem_num_pages = MEM_TRACK_NUM_PAGES;
+  snap->mem_dirty = calloc(MEM_TRACK_NUM_PAGES, sizeof(bitmap_t));
+  CHECK_NOTNULL(snap->mem_dirty);
+}
+
+void mem_invalidate_pages(struct memory *mem, const bitmap_t *pages) {
+  for (int i = 0; i < MEM_TRACK_NUM_PAGES; i++) {
+    if (bitmap_test(pages, i, 1)) {
+      mem->page_gen[i] = mem->gen;
+    }
+  }
+}
+
+void mem_load(struct memory *mem, struct snapshot *snap) {
+  if (!mem_tracking(mem)) {
+    mem_modify_all(mem);
+  }
+
+  /* copy back each page modified since the snapshot was saved. the memory is
+     still write protected, so the writes go through the exception handlers,
+     recording the pages as modified again and notifying any watches */
+  bitmap_clear(mem->restored, 0, MEM_TRACK_NUM_PAGES);
+
+  for (int i = 0; i < MEM_TRACK_NUM_PAGES; i++) {
+    if (mem->page_gen[i] <= snap->mem_gen) {
+      continue;
+    }
+
+    uint32_t offset = i << MEM_TRACK_PAGE_SHIFT;
+    memcpy(mem_physical_ptr(mem, offset), snap->mem + offset,
+           MEM_TRACK_PAGE_SIZE);
+    bitmap_set(mem->restored, i, 1);
+  }
+}
+
+void mem_save(struct memory *mem, struct snapshot *snap) {
+  if (!mem_tracking(mem)) {
+    mem_modify_all(mem);
+  }
+
+  /* copy each page modified since the snapshot was last saved to. note, this
+     is only called in between ticks, so nothing is writing to memory on other
+     threads */
+  bitmap_clear(snap->mem_dirty, 0, MEM_TRACK_NUM_PAGES);
+
+  for (int i = 0; i < MEM_TRACK_NUM_PAGES; i++) {
+    if (mem->page_gen[i] <= snap->mem_gen) {
+      continue;
+    }
+
+    uint32_t offset = i << MEM_TRACK_PAGE_SHIFT;
+    memcpy(snap->mem + offset, mem_physical_ptr(mem, offset),
+           MEM_TRACK_PAGE_SIZE);
+    bitmap_set(snap->mem_dirty, i, 1);
+  }
+
+  snap->mem_gen = mem->gen++;
+
+#ifdef HAVE_FASTMEM
+  if (mem->tracking) {
+    mem_protect_views(mem);
+  }
+#endif
+}
+
 static uint32_t mem_unhandled_read(struct memory *mem, uint32_t addr,
                                    uint32_t data_mask) {
   LOG_WARNING("mem_unhandled_read addr=0x%08x", addr);
@@ -113,6 +418,82 @@ static void mem_unhandled_write(struct memory *mem, uint32_t addr,
   LOG_WARNING("mem_unhandled_write addr=0x%08x", addr);
 }
 
+/* fallbacks for copying to and from mmio regions without a string handler.
+   transfers are made 32-bits at a time while the addresses are aligned, only
+   the unaligned head and tail are copied a byte at a time */
+static void mem_read_chunked(void *userdata, mmio_read_cb read, uint8_t *dst,
+                             uint32_t src, int size) {
+  while (size && (src & 0x3)) {
+    *(dst++) = read(userdata, src++, 0xff);
+    size--;
+  }
+
+  while (size >= 4) {
+    uint32_t data = read(userdata, src, 0xffffffff);
+    memcpy(dst, &data, 4);
+    dst += 4;
+    src += 4;
+    size -= 4;
+  }
+
+  while (size) {
+    *(dst++) = read(userdata, src++, 0xff);
+    size--;
+  }
+}
+
+static void mem_write_chunked(void *userdata, mmio_write_cb write,
+                              uint32_t dst, const uint8_t *src, int size) {
+  while (size && (dst & 0x3)) {
+    write(userdata, dst++, *(src++), 0xff);
+    size--;
+  }
+
+  while (size >= 4) {
+    uint32_t data;
+    memcpy(&data, src, 4);
+    write(userdata, dst, data, 0xffffffff);
+    dst += 4;
+    src += 4;
+    size -= 4;
+  }
+
+  while (size) {
+    write(userdata, dst++, *(src++), 0xff);
+    size--;
+  }
+}
+
+static void mem_copy_chunked(void *userdata, mmio_read_cb read,
+                             mmio_read_string_cb read_string,
+                             mmio_write_cb write,
+                             mmio_write_string_cb write_string, uint32_t dst,
+                             uint32_t src, int size) {
+  /* bounce mmio to mmio copies through a temporary buffer, enabling either
+     side's string handler to be used */
+  uint8_t tmp[0x1000];
+
+  while (size) {
+    int n = MIN(size, (int)sizeof(tmp));
+
+    if (read_string) {
+      read_string(userdata, tmp, src, n);
+    } else {
+      mem_read_chunked(userdata, read, tmp, src, n);
+    }
+
+    if (write_string) {
+      write_string(userdata, dst, tmp, n);
+    } else {
+      mem_write_chunked(userdata, write, dst, tmp, n);
+    }
+
+    dst += n;
+    src += n;
+    size -= n;
+  }
+}
+
 /*
  * address space common
  */
@@ -129,12 +510,15 @@ enum {
   define_memcpy(space);                         \
   define_memcpy_to_host(space);                 \
   define_memcpy_to_guest(space);                \
+  define_write64(space);                        \
   define_write_bytes(space, write32, uint32_t); \
   define_write_bytes(space, write16, uint16_t); \
   define_write_bytes(space, write8, uint8_t);   \
+  define_read64(space);                         \
   define_read_bytes(space, read32, uint32_t);   \
   define_read_bytes(space, read16, uint16_t);   \
   define_read_bytes(space, read8, uint8_t);     \
+  define_restored(space);                       \
   define_base(space);
 
 #define define_lookup_ex(space)                                               \
@@ -191,27 +575,12 @@ enum {
     } else if (psrc && write_string) {                                         \
       write_string(mem->dc->space, dst, psrc, size);                           \
     } else if (pdst) {                                                         \
-      uint32_t end = src + size;                                               \
-      while (src < end) {                                                      \
-        *pdst = read(mem->dc->space, src, 0xff);                               \
-        pdst++;                                                                \
-        src++;                                                                 \
-      }                                                                        \
+      mem_read_chunked(mem->dc->space, read, pdst, src, size);                 \
     } else if (psrc) {                                                         \
-      uint32_t end = dst + size;                                               \
-      while (dst < end) {                                                      \
-        write(mem->dc->space, dst, *psrc, 0xff);                               \
-        psrc++;                                                                \
-        dst++;                                                                 \
-      }                                                                        \
+      mem_write_chunked(mem->dc->space, write, dst, psrc, size);               \
     } else {                                                                   \
-      uint32_t end = src + size;                                               \
-      while (src < end) {                                                      \
-        uint8_t data = read(mem->dc->space, src, 0xff);                        \
-        write(mem->dc->space, dst, data, 0xff);                                \
-        src++;                                                                 \
-        dst++;                                                                 \
-      }                                                                        \
+      mem_copy_chunked(mem->dc->space, read, read_string, write, write_string, \
+                       dst, src, size);                                        \
     }                                                                          \
   }
 
@@ -229,12 +598,7 @@ enum {
     } else if (read_string) {                                                  \
       read_string(mem->dc->space, pdst, src, size);                            \
     } else {                                                                   \
-      uint32_t end = src + size;                                               \
-      while (src < end) {                                                      \
-        *pdst = read(mem->dc->space, src, 0xff);                               \
-        pdst++;                                                                \
-        src++;                                                                 \
-      }                                                                        \
+      mem_read_chunked(mem->dc->space, read, pdst, src, size);                 \
     }                                                                          \
   }
 
@@ -253,12 +617,7 @@ enum {
     } else if (write_string) {                                   \
       write_string(mem->dc->space, dst, psrc, size);             \
     } else {                                                     \
-      uint32_t end = dst + size;                                 \
-      while (dst < end) {                                        \
-        write(mem->dc->space, dst, *psrc, 0xff);                 \
-        psrc++;                                                  \
-        dst++;                                                   \
-      }                                                          \
+      mem_write_chunked(mem->dc->space, write, dst, psrc, size); \
     }                                                            \
   }
 
@@ -289,6 +648,52 @@ enum {
     return read(mem->dc->space, addr, data_mask);                            \
   }
 
+/* the mmio callbacks only handle up to 32-bit accesses, 64-bit accesses to
+   regions not backed by memory are split into a pair of them. so are those
+   straddling the end of a page, each half may belong to a different region */
+#define define_write64(space)                                                \
+  void space##_write64(struct memory *mem, uint32_t addr, uint64_t data) {   \
+    int page = addr >> MEM_PAGE_SHIFT;                                       \
+    uint8_t *ptr = mem->space.ptrs[page];                                    \
+    if (ptr && (addr & MEM_OFFSET_MASK) <= MEM_OFFSET_MASK - 7) {            \
+      addr &= MEM_OFFSET_MASK;                                               \
+      *(uint64_t *)(ptr + addr) = data;                                      \
+      return;                                                                \
+    }                                                                        \
+    space##_write32(mem, addr, (uint32_t)data);                              \
+    space##_write32(mem, addr + 4, (uint32_t)(data >> 32));                  \
+  }
+
+#define define_read64(space)                                                 \
+  uint64_t space##_read64(struct memory *mem, uint32_t addr) {               \
+    int page = addr >> MEM_PAGE_SHIFT;                                       \
+    uint8_t *ptr = mem->space.ptrs[page];                                    \
+    if (ptr && (addr & MEM_OFFSET_MASK) <= MEM_OFFSET_MASK - 7) {            \
+      addr &= MEM_OFFSET_MASK;                                               \
+      return *(uint64_t *)(ptr + addr);                                      \
+    }                                                                        \
+    uint64_t lo = space##_read32(mem, addr);                                 \
+    uint64_t hi = space##_read32(mem, addr + 4);                             \
+    return lo | (hi << 32);                                                  \
+  }
+
+#define define_restored(space)                                                 \
+  int space##_restored(struct memory *mem, uint32_t addr, int size) {          \
+    uint64_t end = (uint64_t)addr + size;                                      \
+    for (uint64_t page_addr = ALIGN_DOWN(addr, MEM_TRACK_PAGE_SIZE);           \
+         page_addr < end; page_addr += MEM_TRACK_PAGE_SIZE) {                  \
+      uint8_t *ptr = mem->space.ptrs[page_addr >> MEM_PAGE_SHIFT];             \
+      if (!ptr) {                                                              \
+        continue;                                                              \
+      }                                                                        \
+      ptr += (page_addr & MEM_OFFSET_MASK);                                    \
+      if (bitmap_test(mem->restored, mem_physical_page(mem, ptr), 1)) {        \
+        return 1;                                                              \
+      }                                                                        \
+    }                                                                          \
+    return 0;                                                                  \
+  }
+
 #define define_base(space)                    \
   uint8_t *space##_base(struct memory *mem) { \
     return mem->space.base;                   \
@@ -348,6 +753,14 @@ static void as_map(struct memory *mem, struct address_space *space,
   if (offset >= 0) {
     /* map physical memory into the address space */
     res = map_shared_memory(mem->shmem, offset, target, size, ACC_READWRITE);
+
+    if (mem->huge_pages && res != SHMEM_MAP_FAILED) {
+      advise_huge_pages(res, size);
+    }
+
+    if (res != SHMEM_MAP_FAILED) {
+      mem_add_view(mem, res, offset, size);
+    }
   } else {
     /* disable access to mmio areas */
     res = map_shared_memory(mem->shmem, 0x0, target, size, ACC_NONE);
@@ -390,9 +803,15 @@ int arm7_init(struct memory *mem) {
   uint32_t ARM7_AICA_MEM_SIZE = ARM7_AICA_MEM_END - ARM7_AICA_MEM_BEGIN + 1;
   uint32_t ARM7_AICA_REG_SIZE = ARM7_AICA_REG_END - ARM7_AICA_REG_BEGIN + 1;
 
-  as_map(mem, space, ARM7_AICA_MEM_BEGIN, ARM7_AICA_MEM_SIZE, MAP_ARAM, NULL,
-         NULL, NULL, NULL);
-  as_map(mem, space, ARM7_AICA_REG_BEGIN, ARM7_AICA_MEM_SIZE, MAP_MMIO,
+  /* wave memory is mirrored up until the registers. map each mirror directly
+     so sound drivers streaming through them don't go through a callback */
+  for (uint32_t begin = ARM7_AICA_MEM_BEGIN; begin < ARM7_AICA_MEM_MIRROR_END;
+       begin += ARM7_AICA_MEM_SIZE) {
+    as_map(mem, space, begin, ARM7_AICA_MEM_SIZE, MAP_ARAM, NULL, NULL, NULL,
+           NULL);
+  }
+
+  as_map(mem, space, ARM7_AICA_REG_BEGIN, ARM7_AICA_REG_SIZE, MAP_MMIO,
          (mmio_read_cb)&arm7_mem_read, (mmio_write_cb)&arm7_mem_write, NULL,
          NULL);
 
@@ -477,8 +896,9 @@ int sh4_init(struct memory *mem) {
 
   /* area 1 */
   sh4_map(mem, SH4_AREA1_BEGIN, SH4_AREA1_END, P0 | P1 | P2 | P3 | P4, MAP_MMIO,
-          (mmio_read_cb)&sh4_area1_read, (mmio_write_cb)&sh4_area1_write, NULL,
-          NULL);
+          (mmio_read_cb)&sh4_area1_read, (mmio_write_cb)&sh4_area1_write,
+          (mmio_read_string_cb)&sh4_area1_read_string,
+          (mmio_write_string_cb)&sh4_area1_write_string);
 #if 0
   /* TODO make texture watches monitor all mirrors such that the 64-bit access
      area can be directly mapped, no callback */
@@ -532,10 +952,39 @@ int sh4_init(struct memory *mem) {
   return 1;
 }
 
+void sh4_map_ocram(struct memory *mem, int enabled, int oix) {
+#ifdef HAVE_FASTMEM
+  struct address_space *space = &mem->sh4;
+  uint8_t *target = space->base + SH4_CACHE_BEGIN;
+  uint32_t size = SH4_CACHE_END - SH4_CACHE_BEGIN + 1;
+  void *res = NULL;
+
+  /* each bank of the cache ram is mirrored throughout the region, which can
+     only be mapped directly when the host's pages are the size of a bank */
+  if (!enabled || get_page_size() != SH4_ORA_BANK_SIZE) {
+    res = map_shared_memory(mem->shmem, 0x0, target, size, ACC_NONE);
+    CHECK_NE(res, SHMEM_MAP_FAILED);
+    return;
+  }
+
+  /* with OIX, bit 25, rather than bit 13, selects the bank */
+  for (uint32_t offset = 0; offset < size; offset += SH4_ORA_BANK_SIZE) {
+    uint32_t bank = oix ? (offset >> 25) & 1 : (offset >> 13) & 1;
+    res = map_shared_memory(mem->shmem, OCRAM_OFFSET + bank * SH4_ORA_BANK_SIZE,
+                            target + offset, SH4_ORA_BANK_SIZE, ACC_READWRITE);
+    CHECK_NE(res, SHMEM_MAP_FAILED);
+  }
+#endif
+}
+
 uint8_t *mem_vram(struct memory *mem, uint32_t offset) {
   return mem->vram + offset;
 }
 
+struct dreamcast *mem_dc(struct memory *mem) {
+  return mem->dc;
+}
+
 uint8_t *mem_aram(struct memory *mem, uint32_t offset) {
   return mem->aram + offset;
 }
@@ -544,13 +993,21 @@ uint8_t *mem_ram(struct memory *mem, uint32_t offset) {
   return mem->ram + offset;
 }
 
+uint8_t *mem_ocram(struct memory *mem, uint32_t offset) {
+  return mem->ocram + offset;
+}
+
 int mem_init(struct memory *mem) {
 #ifdef HAVE_FASTMEM
   /* create the shared memory object to back the physical memory. note, because
      mmio regions also map this shared memory object when disabling permissions,
      the object has to at least be the size of an entire mmio region */
-  size_t shmem_size = MAX(PHYSICAL_SIZE, SH4_AREA_SIZE);
-  mem->shmem = create_shared_memory("/redream", shmem_size, ACC_READWRITE);
+  size_t shmem_size = MAX(PHYSICAL_SIZE + OCRAM_SIZE, SH4_AREA_SIZE);
+  /* the object is named after the instance, so concurrently created
+     instances don't unlink or open each other's */
+  char filename[64];
+  snprintf(filename, sizeof(filename), "/redream_%p", (void *)mem);
+  mem->shmem = create_shared_memory(filename, shmem_size, ACC_READWRITE);
 
   if (mem->shmem == SHMEM_INVALID) {
     LOG_WARNING("mem_init failed to create shared memory object");
@@ -568,10 +1025,38 @@ int mem_init(struct memory *mem) {
   mem->aram = map_shared_memory(mem->shmem, ARAM_OFFSET, NULL, ARAM_SIZE,
                                 ACC_READWRITE);
   CHECK_NE(mem->aram, SHMEM_MAP_FAILED);
+
+  mem->ocram = map_shared_memory(mem->shmem, OCRAM_OFFSET, NULL, OCRAM_SIZE,
+                                 ACC_READWRITE);
+  CHECK_NE(mem->ocram, SHMEM_MAP_FAILED);
+
+  if (OPTION_huge_pages) {
+    mem->huge_pages = advise_huge_pages(mem->ram, RAM_SIZE) &&
+                      advise_huge_pages(mem->vram, VRAM_SIZE) &&
+                      advise_huge_pages(mem->aram, ARAM_SIZE);
+
+    if (mem->huge_pages) {
+      LOG_INFO("mem_init backing physical memory with huge pages");
+    } else {
+      LOG_WARNING("mem_init huge pages unavailable, using regular pages");
+    }
+  }
+
+  mem_add_view(mem, mem->ram, RAM_OFFSET, RAM_SIZE);
+  mem_add_view(mem, mem->vram, VRAM_OFFSET, VRAM_SIZE);
+  mem_add_view(mem, mem->aram, ARAM_OFFSET, ARAM_SIZE);
+
+  /* registered before any of the devices, so writes to tracked pages are
+     recorded before any other handler sees them */
+  mem->track_mutex = mutex_create();
+  mem->exc_handler = exception_handler_add(mem, &mem_handle_exception);
+  mem->exc_range = exception_handler_add_range(
+      mem->exc_handler, EX_RANGE_FAULT, mem->views_begin, mem->views_end);
 #else
   mem->ram = calloc(RAM_SIZE, 1);
   mem->vram = calloc(VRAM_SIZE, 1);
   mem->aram = calloc(ARAM_SIZE, 1);
+  mem->ocram = calloc(OCRAM_SIZE, 1);
 #endif
 
   if (!sh4_init(mem)) {
@@ -587,11 +1072,18 @@ int mem_init(struct memory *mem) {
 
 void mem_destroy(struct memory *mem) {
 #ifdef HAVE_FASTMEM
+  if (mem->exc_handler) {
+    exception_handler_remove(mem->exc_handler);
+  }
+  if (mem->track_mutex) {
+    mutex_destroy(mem->track_mutex);
+  }
   destroy_shared_memory(mem->shmem);
 #else
   free(mem->ram);
   free(mem->vram);
   free(mem->aram);
+  free(mem->ocram);
 #endif
 
   free(mem);
@@ -601,6 +1093,8 @@ struct memory *mem_create(struct dreamcast *dc) {
   struct memory *mem = calloc(1, sizeof(struct memory));
 
   mem->dc = dc;
+  mem->gen = 1;
+  mem_modify_all(mem);
 
 #ifdef HAVE_FASTMEM
   mem->shmem = SHMEM_INVALID;
@@ -2,10 +2,12 @@
 #define MEMORY_H
 
 #include <stdint.h>
+#include "core/bitmap.h"
 #include "core/memory.h"
 
 struct dreamcast;
 struct memory;
+struct snapshot;
 
 /*
  * mmio callbacks and helpers
@@ -25,9 +27,11 @@ typedef void (*mmio_write_string_cb)(void *, uint32_t, const uint8_t *, int);
   uint8_t space##_read8(struct memory *mem, uint32_t addr);                \
   uint16_t space##_read16(struct memory *mem, uint32_t addr);              \
   uint32_t space##_read32(struct memory *mem, uint32_t addr);              \
+  uint64_t space##_read64(struct memory *mem, uint32_t addr);              \
   void space##_write8(struct memory *mem, uint32_t addr, uint8_t data);    \
   void space##_write16(struct memory *mem, uint32_t addr, uint16_t data);  \
   void space##_write32(struct memory *mem, uint32_t addr, uint32_t data);  \
+  void space##_write64(struct memory *mem, uint32_t addr, uint64_t data);  \
   void space##_memcpy_to_guest(struct memory *mem, uint32_t dst,           \
                                const void *ptr, int size);                 \
   void space##_memcpy_to_host(struct memory *mem, void *ptr, uint32_t src, \
@@ -36,11 +40,16 @@ typedef void (*mmio_write_string_cb)(void *, uint32_t, const uint8_t *, int);
                       int size);                                           \
   void space##_lookup(struct memory *mem, uint32_t addr, void **userdata,  \
                       uint8_t **ptr, mmio_read_cb *read,                   \
-                      mmio_write_cb *write);
+                      mmio_write_cb *write);                               \
+  int space##_restored(struct memory *mem, uint32_t addr, int size);
 
 DECLARE_ADDRESS_SPACE(sh4);
 DECLARE_ADDRESS_SPACE(arm7);
 
+/* maps the operand cache's ram into the sh4's address space for fastmem
+   accesses while it's enabled, or traps accesses to it while it isn't */
+void sh4_map_ocram(struct memory *mem, int enabled, int oix);
+
 struct memory *mem_create(struct dreamcast *dc);
 void mem_destroy(struct memory *mem);
 
@@ -49,5 +58,18 @@ int mem_init(struct memory *mem);
 uint8_t *mem_ram(struct memory *mem, uint32_t offset);
 uint8_t *mem_aram(struct memory *mem, uint32_t offset);
 uint8_t *mem_vram(struct memory *mem, uint32_t offset);
+uint8_t *mem_ocram(struct memory *mem, uint32_t offset);
+struct dreamcast *mem_dc(struct memory *mem);
+
+/* snapshots of physical memory are incremental, only the pages modified since
+   the snapshot was last saved to are copied. after a restore, *_restored
+   reports if any of the memory backing a guest range was overwritten */
+void mem_alloc_snapshot(struct memory *mem, struct snapshot *snap);
+void mem_save(struct memory *mem, struct snapshot *snap);
+void mem_load(struct memory *mem, struct snapshot *snap);
+
+/* marks pages as modified, forcing them to be copied by the next load of any
+   snapshot. used when a snapshot's copy of memory is changed after saving */
+void mem_invalidate_pages(struct memory *mem, const bitmap_t *pages);
 
 #endif
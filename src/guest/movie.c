@@ -0,0 +1,254 @@
+#include "guest/movie.h"
+#include "core/core.h"
+#include "core/hash.h"
+#include "core/thread.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+
+#define MOVIE_MAGIC 0x45564f4d /* MOVE */
+#define MOVIE_VERSION 1
+
+/* inputs queued while recording before the next frame begins */
+#define MOVIE_MAX_PENDING 256
+
+/* the main system ram, at the start of physical memory */
+#define MOVIE_CHECKSUM_SIZE (16 * 1024 * 1024)
+
+/* a movie is laid out as:
+
+     uint32_t magic
+     uint32_t version
+     struct movie_boot boot
+     struct movie_event events[]
+
+   with the events ordered by frame, and ended by a MOVIE_END event */
+enum {
+  MOVIE_INPUT,
+  MOVIE_CHECKSUM,
+  MOVIE_END,
+};
+
+struct movie_event {
+  uint32_t frame;
+  uint16_t type;
+  uint8_t port;
+  uint8_t button;
+  /* the input's value, or the checksum */
+  uint64_t data;
+};
+
+struct movie {
+  struct movie_boot boot;
+  int recording;
+  int frame;
+
+  /* recording state */
+  FILE *fp;
+  mutex_t mutex;
+  struct movie_event pending[MOVIE_MAX_PENDING];
+  int num_pending;
+
+  /* playback state */
+  struct movie_event *events;
+  int num_events;
+  int next_event;
+};
+
+static uint64_t movie_checksum(struct dreamcast *dc) {
+  return hash_bytes(mem_ram(dc->mem, 0), MOVIE_CHECKSUM_SIZE, 0);
+}
+
+static void movie_write_event(struct movie *movie, int type, int port,
+                              int button, uint64_t data) {
+  struct movie_event ev = {0};
+  ev.frame = (uint32_t)movie->frame;
+  ev.type = (uint16_t)type;
+  ev.port = (uint8_t)port;
+  ev.button = (uint8_t)button;
+  ev.data = data;
+  fwrite(&ev, sizeof(ev), 1, movie->fp);
+}
+
+static int movie_record_frame(struct movie *movie, struct dreamcast *dc) {
+  int interval = movie->boot.checksum_interval;
+
+  if (interval && movie->frame % interval == 0) {
+    movie_write_event(movie, MOVIE_CHECKSUM, 0, 0, movie_checksum(dc));
+  }
+
+  mutex_lock(movie->mutex);
+
+  for (int i = 0; i < movie->num_pending; i++) {
+    struct movie_event *ev = &movie->pending[i];
+    int16_t value = (int16_t)ev->data;
+
+    dc_input(dc, ev->port, ev->button, value);
+    movie_write_event(movie, MOVIE_INPUT, ev->port, ev->button,
+                      (uint64_t)(uint16_t)value);
+  }
+
+  movie->num_pending = 0;
+
+  mutex_unlock(movie->mutex);
+
+  movie->frame++;
+
+  return 1;
+}
+
+static int movie_play_frame(struct movie *movie, struct dreamcast *dc) {
+  while (movie->next_event < movie->num_events) {
+    struct movie_event *ev = &movie->events[movie->next_event];
+
+    if ((int)ev->frame != movie->frame) {
+      break;
+    }
+
+    switch (ev->type) {
+      case MOVIE_INPUT:
+        dc_input(dc, ev->port, ev->button, (int16_t)ev->data);
+        break;
+
+      case MOVIE_CHECKSUM: {
+        uint64_t checksum = movie_checksum(dc);
+
+        if (checksum != ev->data) {
+          LOG_WARNING("movie diverged at frame %d, checksum 0x%016" PRIx64
+                      " expected 0x%016" PRIx64,
+                      movie->frame, checksum, ev->data);
+          return 0;
+        }
+      } break;
+
+      case MOVIE_END:
+        return 0;
+    }
+
+    movie->next_event++;
+  }
+
+  movie->frame++;
+
+  return 1;
+}
+
+int movie_begin_frame(struct movie *movie, struct dreamcast *dc) {
+  if (movie->recording) {
+    return movie_record_frame(movie, dc);
+  }
+
+  return movie_play_frame(movie, dc);
+}
+
+void movie_input(struct movie *movie, int port, int button, int16_t value) {
+  if (!movie->recording) {
+    return;
+  }
+
+  mutex_lock(movie->mutex);
+
+  /* a later change to the same button replaces the one still queued */
+  struct movie_event *ev = NULL;
+
+  for (int i = 0; i < movie->num_pending; i++) {
+    if (movie->pending[i].port == port && movie->pending[i].button == button) {
+      ev = &movie->pending[i];
+      break;
+    }
+  }
+
+  if (!ev && movie->num_pending < MOVIE_MAX_PENDING) {
+    ev = &movie->pending[movie->num_pending++];
+    ev->port = (uint8_t)port;
+    ev->button = (uint8_t)button;
+  }
+
+  if (ev) {
+    ev->data = (uint64_t)(uint16_t)value;
+  }
+
+  mutex_unlock(movie->mutex);
+}
+
+int movie_frames(struct movie *movie) {
+  if (movie->recording || !movie->num_events) {
+    return movie->frame;
+  }
+
+  return (int)movie->events[movie->num_events - 1].frame;
+}
+
+const struct movie_boot *movie_boot(struct movie *movie) {
+  return &movie->boot;
+}
+
+void movie_destroy(struct movie *movie) {
+  if (movie->recording) {
+    movie_write_event(movie, MOVIE_END, 0, 0, 0);
+    fclose(movie->fp);
+    mutex_destroy(movie->mutex);
+
+    LOG_INFO("movie_destroy recorded %d frames", movie->frame);
+  }
+
+  free(movie->events);
+  free(movie);
+}
+
+struct movie *movie_play(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    LOG_WARNING("movie_play failed to open %s", path);
+    return NULL;
+  }
+
+  uint32_t magic = 0, version = 0;
+  struct movie_boot boot;
+
+  if (fread(&magic, sizeof(magic), 1, fp) != 1 ||
+      fread(&version, sizeof(version), 1, fp) != 1 ||
+      fread(&boot, sizeof(boot), 1, fp) != 1 || magic != MOVIE_MAGIC ||
+      version != MOVIE_VERSION) {
+    LOG_WARNING("movie_play %s isn't a valid movie", path);
+    fclose(fp);
+    return NULL;
+  }
+
+  long start = ftell(fp);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp) - start;
+  fseek(fp, start, SEEK_SET);
+
+  struct movie *movie = calloc(1, sizeof(struct movie));
+  movie->boot = boot;
+  movie->num_events = (int)(size / sizeof(struct movie_event));
+  movie->events = calloc(MAX(movie->num_events, 1), sizeof(struct movie_event));
+  movie->num_events = (int)fread(movie->events, sizeof(struct movie_event),
+                                 movie->num_events, fp);
+
+  fclose(fp);
+
+  return movie;
+}
+
+struct movie *movie_record(const char *path, const struct movie_boot *boot) {
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    LOG_WARNING("movie_record failed to open %s", path);
+    return NULL;
+  }
+
+  uint32_t magic = MOVIE_MAGIC;
+  uint32_t version = MOVIE_VERSION;
+  fwrite(&magic, sizeof(magic), 1, fp);
+  fwrite(&version, sizeof(version), 1, fp);
+  fwrite(boot, sizeof(*boot), 1, fp);
+
+  struct movie *movie = calloc(1, sizeof(struct movie));
+  movie->boot = *boot;
+  movie->recording = 1;
+  movie->fp = fp;
+  movie->mutex = mutex_create();
+
+  return movie;
+}
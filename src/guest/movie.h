@@ -0,0 +1,51 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+
+struct dreamcast;
+struct movie;
+
+/*
+ * input movies
+ *
+ * a movie holds every change in input fed to the machine over a run, each
+ * stamped with the frame it was applied at the start of, along with the
+ * configuration the machine was booted with. input is only ever applied at
+ * the start of a frame, both while recording and playing back, so playing a
+ * movie back reproduces the guest's execution exactly. the main ram may also
+ * be checksummed every so often while recording, for playback to detect
+ * where it diverged
+ */
+struct movie_boot {
+  char disc[1024];
+  char region[32];
+  char language[32];
+  char broadcast[32];
+  /* system clock on boot, in seconds since 1/1/1950 */
+  uint32_t clock;
+  /* booted with the hle bootstrap rather than the bios */
+  int32_t fast_boot;
+  /* frames between each checksum, 0 for none */
+  int32_t checksum_interval;
+};
+
+struct movie *movie_record(const char *path, const struct movie_boot *boot);
+struct movie *movie_play(const char *path);
+void movie_destroy(struct movie *movie);
+
+const struct movie_boot *movie_boot(struct movie *movie);
+
+/* frames recorded, or for a movie being played back, the frames it runs for */
+int movie_frames(struct movie *movie);
+
+/* queues a change in input while recording, to be applied at the start of the
+   next frame. it may be called from any thread */
+void movie_input(struct movie *movie, int port, int button, int16_t value);
+
+/* called in between ticks at the start of each frame, applying the input for
+   the frame. returns 0 once playback has ended, or diverged from the run
+   recorded */
+int movie_begin_frame(struct movie *movie, struct dreamcast *dc);
+
+#endif
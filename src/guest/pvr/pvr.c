@@ -4,12 +4,25 @@
 #include "guest/holly/holly.h"
 #include "guest/memory.h"
 #include "guest/pvr/ta.h"
+#include "guest/reg_stats.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
+#include "options.h"
 #include "stats.h"
 
+#if ARCH_X64
+#include <emmintrin.h>
+#endif
+
 static struct reg_cb pvr_cb[PVR_NUM_REGS];
 
+static const struct reg_info pvr_reg_info[] = {
+#define PVR_REG(addr, name, default, type) {name, addr, #name},
+#include "guest/pvr/pvr_regs.inc"
+#undef PVR_REG
+};
+
 /* the dreamcast has 8MB of vram, split into two 4MB banks, with two ways of
    accessing it:
 
@@ -22,6 +35,12 @@ static struct reg_cb pvr_cb[PVR_NUM_REGS];
    poly and texture transfers. due to this being the default for the ta, our
    internal vram layout matches the 64-bit access paths view, meaning 32-bit
    accesses will have to be converted to an interleaved address */
+#define PVR_VRAM_SIZE 0x00800000
+
+/* largest line the framebuffer can be read out with, FB_R_SIZE's 10-bit x in
+   32-bit units */
+#define PVR_FB_MAX_LINE 4096
+
 static uint32_t VRAM64(uint32_t addr32) {
   const uint32_t bank_size = 0x00400000;
   uint32_t bank = addr32 & bank_size;
@@ -101,7 +120,159 @@ static void pvr_mark_framebuffer(struct pvr *pvr, uint32_t addr) {
   }
 }
 
+/* copies a line of the framebuffer out of vram into its 32-bit view. the
+   line's consecutive words are every other word of vram, gathered four at a
+   time. the vector path stops short of the end of a bank, as its reads run a
+   word past the last one gathered */
+static void pvr_fb_read_line(const uint8_t *vram, uint32_t addr, uint8_t *dst,
+                             int size) {
+  int i = 0;
+
+#if ARCH_X64
+  for (; i + 16 <= size; i += 16) {
+    uint32_t src = VRAM64(addr + i);
+    if (VRAM64(addr + i + 12) != src + 24 || src + 32 > PVR_VRAM_SIZE) {
+      break;
+    }
+
+    __m128i lo = _mm_loadu_si128((const __m128i *)&vram[src]);
+    __m128i hi = _mm_loadu_si128((const __m128i *)&vram[src + 16]);
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)&dst[i], _mm_unpacklo_epi64(lo, hi));
+  }
+#endif
+
+  for (; i < size; i += 4) {
+    memcpy(&dst[i], &vram[VRAM64(addr + i)], 4);
+  }
+}
+
+/* the converters write 32-bit rgbx pixels, with the color bits left aligned
+   and the low bits and x byte cleared */
+static void pvr_fb_convert_0555(const uint8_t *src, uint32_t *dst, int n) {
+  int i = 0;
+
+#if ARCH_X64
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i r_mask = _mm_set1_epi32(0xf8);
+  const __m128i g_mask = _mm_set1_epi32(0xf800);
+  const __m128i b_mask = _mm_set1_epi32(0xf80000);
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&src[i * 2]);
+    __m128i p[2] = {_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)};
+
+    for (int j = 0; j < 2; j++) {
+      __m128i r = _mm_and_si128(_mm_srli_epi32(p[j], 7), r_mask);
+      __m128i g = _mm_and_si128(_mm_slli_epi32(p[j], 6), g_mask);
+      __m128i b = _mm_and_si128(_mm_slli_epi32(p[j], 19), b_mask);
+      __m128i rgb = _mm_or_si128(_mm_or_si128(r, g), b);
+      _mm_storeu_si128((__m128i *)&dst[i + j * 4], rgb);
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    uint32_t p = *(const uint16_t *)&src[i * 2];
+    dst[i] = ((p >> 7) & 0xf8) | ((p << 6) & 0xf800) | ((p << 19) & 0xf80000);
+  }
+}
+
+static void pvr_fb_convert_565(const uint8_t *src, uint32_t *dst, int n) {
+  int i = 0;
+
+#if ARCH_X64
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i r_mask = _mm_set1_epi32(0xf8);
+  const __m128i g_mask = _mm_set1_epi32(0xfc00);
+  const __m128i b_mask = _mm_set1_epi32(0xf80000);
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&src[i * 2]);
+    __m128i p[2] = {_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)};
+
+    for (int j = 0; j < 2; j++) {
+      __m128i r = _mm_and_si128(_mm_srli_epi32(p[j], 8), r_mask);
+      __m128i g = _mm_and_si128(_mm_slli_epi32(p[j], 5), g_mask);
+      __m128i b = _mm_and_si128(_mm_slli_epi32(p[j], 19), b_mask);
+      __m128i rgb = _mm_or_si128(_mm_or_si128(r, g), b);
+      _mm_storeu_si128((__m128i *)&dst[i + j * 4], rgb);
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    uint32_t p = *(const uint16_t *)&src[i * 2];
+    dst[i] = ((p >> 8) & 0xf8) | ((p << 5) & 0xfc00) | ((p << 19) & 0xf80000);
+  }
+}
+
+/* swaps the bgr words of vram to rgb */
+static inline uint32_t pvr_fb_swap_rb(uint32_t p) {
+  return ((p >> 16) & 0xff) | (p & 0xff00) | ((p << 16) & 0xff0000);
+}
+
+#if ARCH_X64
+static inline __m128i pvr_fb_swap_rb_sse2(__m128i p) {
+  const __m128i byte_mask = _mm_set1_epi32(0xff);
+  const __m128i g_mask = _mm_set1_epi32(0xff00);
+  __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), byte_mask);
+  __m128i g = _mm_and_si128(p, g_mask);
+  __m128i b = _mm_slli_epi32(_mm_and_si128(p, byte_mask), 16);
+  return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+#endif
+
+/* src is expected to have 16 bytes of slack past the last pixel */
+static void pvr_fb_convert_888(const uint8_t *src, uint32_t *dst, int n) {
+  int i = 0;
+
+#if ARCH_X64
+  /* without a byte shuffle, the four 3 byte pixels are spread out to a word
+     each by selecting word k from the vector shifted up by k bytes */
+  const __m128i m0 = _mm_setr_epi32(0xffffff, 0, 0, 0);
+  const __m128i m1 = _mm_setr_epi32(0, 0xffffff, 0, 0);
+  const __m128i m2 = _mm_setr_epi32(0, 0, 0xffffff, 0);
+  const __m128i m3 = _mm_setr_epi32(0, 0, 0, 0xffffff);
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&src[i * 3]);
+    __m128i p = _mm_and_si128(v, m0);
+    p = _mm_or_si128(p, _mm_and_si128(_mm_slli_si128(v, 1), m1));
+    p = _mm_or_si128(p, _mm_and_si128(_mm_slli_si128(v, 2), m2));
+    p = _mm_or_si128(p, _mm_and_si128(_mm_slli_si128(v, 3), m3));
+    _mm_storeu_si128((__m128i *)&dst[i], pvr_fb_swap_rb_sse2(p));
+  }
+#endif
+
+  for (; i < n; i++) {
+    const uint8_t *p = &src[i * 3];
+    dst[i] = p[2] | (p[1] << 8) | (p[0] << 16);
+  }
+}
+
+static void pvr_fb_convert_0888(const uint8_t *src, uint32_t *dst, int n) {
+  int i = 0;
+
+#if ARCH_X64
+  for (; i + 4 <= n; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *)&src[i * 4]);
+    _mm_storeu_si128((__m128i *)&dst[i], pvr_fb_swap_rb_sse2(p));
+  }
+#endif
+
+  for (; i < n; i++) {
+    dst[i] = pvr_fb_swap_rb(*(const uint32_t *)&src[i * 4]);
+  }
+}
+
 static int pvr_update_framebuffer(struct pvr *pvr) {
+  static void (*const converters[])(const uint8_t *, uint32_t *, int) = {
+      &pvr_fb_convert_0555, &pvr_fb_convert_565, &pvr_fb_convert_888,
+      &pvr_fb_convert_0888,
+  };
+
   uint32_t fields[2] = {*pvr->FB_R_SOF1, *pvr->FB_R_SOF2};
   int num_fields = pvr->SPG_CONTROL->interlace ? 2 : 1;
   int field = pvr->SPG_STATUS->fieldnum;
@@ -115,89 +286,46 @@ static int pvr_update_framebuffer(struct pvr *pvr) {
     return 0;
   }
 
-  pvr_framebuffer_size(pvr, &pvr->framebuffer_w, &pvr->framebuffer_h);
+  int width, height;
+  pvr_framebuffer_size(pvr, &width, &height);
 
-  /* convert framebuffer into a 24-bit RGB pixel buffer */
-  uint8_t *dst = pvr->framebuffer;
-  uint8_t *src = pvr->vram;
+  /* progressive framebuffers may have each line output twice */
+  int line_scale = num_fields == 1 && pvr->FB_R_CTRL->fb_line_double ? 2 : 1;
+
+  /* convert straight into the client's buffer, skipping the conversion
+     entirely when it doesn't want the pixels */
+  uint32_t *dst = dc_map_pixels(pvr->dc, width, height * line_scale);
+  if (!dst) {
+    return 0;
+  }
 
   /* values in FB_R_SIZE are in 32-bit units */
+  int line_size = (pvr->FB_R_SIZE->x + 1) << 2;
   int line_mod = (pvr->FB_R_SIZE->mod << 2) - 4;
-  int x_size = (pvr->FB_R_SIZE->x + 1) << 2;
   int y_size = (pvr->FB_R_SIZE->y + 1);
 
   /* TODO use fb_concat */
 
-  switch (pvr->FB_R_CTRL->fb_depth) {
-    case 0: {
-      for (int y = 0; y < y_size; y++) {
-        for (int n = 0; n < num_fields; n++) {
-          for (int x = 0; x < x_size; x += 2) {
-            uint16_t rgb = *(uint16_t *)&src[VRAM64(fields[n])];
-            dst[0] = (rgb & 0b0111110000000000) >> 7;
-            dst[1] = (rgb & 0b0000001111100000) >> 2;
-            dst[2] = (rgb & 0b0000000000011111) << 3;
-            fields[n] += 2;
-            dst += 3;
-          }
-          fields[n] += line_mod;
-        }
-      }
-    } break;
-
-    case 1: {
-      for (int y = 0; y < y_size; y++) {
-        for (int n = 0; n < num_fields; n++) {
-          for (int x = 0; x < x_size; x += 2) {
-            uint16_t rgb = *(uint16_t *)&src[VRAM64(fields[n])];
-            dst[0] = (rgb & 0b1111100000000000) >> 8;
-            dst[1] = (rgb & 0b0000011111100000) >> 3;
-            dst[2] = (rgb & 0b0000000000011111) << 3;
-            fields[n] += 2;
-            dst += 3;
-          }
-          fields[n] += line_mod;
-        }
-      }
-    } break;
-    case 2: {
-      for (int y = 0; y < y_size; y++) {
-        for (int n = 0; n < num_fields; n++) {
-          for (int x = 0; x < x_size; x += 3) {
-            uint8_t *rgb = &src[VRAM64(fields[n])];
-            dst[0] = rgb[2];
-            dst[1] = rgb[1];
-            dst[2] = rgb[0];
-            fields[n] += 3;
-            dst += 3;
-          }
-          fields[n] += line_mod;
-        }
-      }
-    } break;
-    case 3: {
-      for (int y = 0; y < y_size; y++) {
-        for (int n = 0; n < num_fields; n++) {
-          for (int x = 0; x < x_size; x += 4) {
-            uint8_t *krgb = &src[VRAM64(fields[n])];
-            dst[0] = krgb[2];
-            dst[1] = krgb[1];
-            dst[2] = krgb[0];
-            fields[n] += 4;
-            dst += 3;
-          }
-          fields[n] += line_mod;
-        }
+  void (*convert)(const uint8_t *, uint32_t *, int) =
+      converters[pvr->FB_R_CTRL->fb_depth];
+  uint8_t line[PVR_FB_MAX_LINE + 16];
+
+  for (int y = 0; y < y_size; y++) {
+    for (int n = 0; n < num_fields; n++) {
+      pvr_fb_read_line(pvr->vram, fields[n], line, line_size);
+      fields[n] += line_size + line_mod;
+
+      convert(line, dst, width);
+      dst += width;
+
+      if (line_scale == 2) {
+        memcpy(dst, dst - width, width * 4);
+        dst += width;
       }
-    } break;
-    default:
-      LOG_FATAL("pvr_push_framebuffer unexpected fb_depth %d",
-                pvr->FB_R_CTRL->fb_depth);
-      break;
+    }
   }
 
-  dc_push_pixels(pvr->dc, pvr->framebuffer, pvr->framebuffer_w,
-                 pvr->framebuffer_h);
+  dc_push_pixels(pvr->dc, width, height * line_scale);
 
   return 1;
 }
@@ -227,13 +355,99 @@ static void pvr_vblank_in(struct pvr *pvr) {
   dc_vblank_in(pvr->dc, pvr->VO_CONTROL->blank_video);
 }
 
-static void pvr_next_scanline(void *data) {
+static int64_t pvr_line_elapsed(struct pvr *pvr) {
+  struct scheduler *sched = pvr->dc->sched;
+
+  if (!pvr->line_timer) {
+    return 0;
+  }
+
+  /* the time into current_line, based on the time remaining until the next
+     event's line. while a device's slice is being ran, the scheduler's time
+     may have already reached the event, clamp to the line before it as the
+     event hasn't been processed yet */
+  int64_t remaining = sched_remaining_time(sched, pvr->line_timer);
+  int64_t elapsed = pvr->next_lines * pvr->line_ns - remaining;
+  int64_t max_elapsed = pvr->next_lines * pvr->line_ns - 1;
+  return CLAMP(elapsed, 0, max_elapsed);
+}
+
+static uint32_t pvr_scanline(struct pvr *pvr) {
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+  uint32_t lines = (uint32_t)(pvr_line_elapsed(pvr) / pvr->line_ns);
+  return (pvr->current_line + lines) % num_lines;
+}
+
+static int pvr_lines_until(struct pvr *pvr, uint32_t line, int next) {
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+
+  /* lines past the end of the frame are never reached */
+  if (line >= num_lines) {
+    return next;
+  }
+
+  int lines = (int)((line + num_lines - pvr->current_line) % num_lines);
+  if (!lines) {
+    lines = (int)num_lines;
+  }
+
+  return MIN(lines, next);
+}
+
+static void pvr_next_event(void *data);
+
+static void pvr_schedule_event(struct pvr *pvr, int64_t elapsed) {
+  struct scheduler *sched = pvr->dc->sched;
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+
+  /* find the next line with an interrupt or a vblank transition on it */
+  int next = (int)num_lines;
+
+  switch (pvr->SPG_HBLANK_INT->hblank_int_mode) {
+    case 0x0:
+      next = pvr_lines_until(pvr, pvr->SPG_HBLANK_INT->line_comp_val, next);
+      break;
+    case 0x2:
+      next = 1;
+      break;
+    default:
+      LOG_FATAL("unsupported hblank interrupt mode");
+      break;
+  }
+
+  next = pvr_lines_until(pvr, pvr->SPG_VBLANK_INT->vblank_in_line_number, next);
+  next = pvr_lines_until(pvr, pvr->SPG_VBLANK_INT->vblank_out_line_number, next);
+  next = pvr_lines_until(pvr, pvr->SPG_VBLANK->vbstart, next);
+  next = pvr_lines_until(pvr, pvr->SPG_VBLANK->vbend, next);
+
+  if (pvr->line_timer) {
+    sched_cancel_timer(sched, pvr->line_timer);
+  }
+
+  pvr->next_lines = next;
+  pvr->line_timer = sched_start_timer(sched, &pvr_next_event, pvr,
+                                      next * pvr->line_ns - elapsed);
+}
+
+static void pvr_reschedule_event(struct pvr *pvr) {
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+
+  /* catch current_line up to now, keeping the time into it, before searching
+     for the next event with the updated registers */
+  int64_t elapsed = pvr_line_elapsed(pvr);
+  uint32_t lines = (uint32_t)(elapsed / pvr->line_ns);
+  pvr->current_line = (pvr->current_line + lines) % num_lines;
+
+  pvr_schedule_event(pvr, elapsed % pvr->line_ns);
+}
+
+static void pvr_next_event(void *data) {
   struct pvr *pvr = data;
   struct holly *hl = pvr->dc->holly;
-  struct scheduler *sched = pvr->dc->sched;
 
   uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
-  pvr->current_line = (pvr->current_line + 1) % num_lines;
+  pvr->current_line = (pvr->current_line + pvr->next_lines) % num_lines;
+  pvr->line_timer = NULL;
 
   /* hblank in */
   switch (pvr->SPG_HBLANK_INT->hblank_int_mode) {
@@ -277,12 +491,19 @@ static void pvr_next_scanline(void *data) {
   }
 
   /* reschedule */
-  pvr->line_timer = sched_start_timer(sched, &pvr_next_scanline, pvr,
-                                      HZ_TO_NANO(pvr->line_clock));
+  pvr_schedule_event(pvr, 0);
 }
 
+static const timer_cb pvr_timer_cbs[] = {&pvr_next_event};
+
 static void pvr_reconfigure_spg(struct pvr *pvr) {
-  struct scheduler *sched = pvr->dc->sched;
+  uint32_t num_lines = pvr->SPG_LOAD->vcount + 1;
+
+  /* bring current_line up to date with the previous line clock */
+  if (pvr->line_timer) {
+    uint32_t lines = (uint32_t)(pvr_line_elapsed(pvr) / pvr->line_ns);
+    pvr->current_line = (pvr->current_line + lines) % num_lines;
+  }
 
   /* scale pixel clock frequency */
   int pixel_clock = 13500000;
@@ -295,6 +516,7 @@ static void pvr_reconfigure_spg(struct pvr *pvr) {
   if (pvr->SPG_CONTROL->interlace) {
     pvr->line_clock *= 2;
   }
+  pvr->line_ns = HZ_TO_NANO(pvr->line_clock);
 
   const char *mode = "vga";
   if (pvr->SPG_CONTROL->NTSC == 1) {
@@ -310,13 +532,34 @@ static void pvr_reconfigure_spg(struct pvr *pvr) {
       pvr->SPG_LOAD->hcount, pvr->SPG_HBLANK->hbstart, pvr->SPG_HBLANK->hbend,
       pvr->SPG_LOAD->vcount, pvr->SPG_VBLANK->vbstart, pvr->SPG_VBLANK->vbend);
 
-  if (pvr->line_timer) {
-    sched_cancel_timer(sched, pvr->line_timer);
-    pvr->line_timer = NULL;
-  }
+  /* the line in progress restarts with the new clock */
+  pvr_schedule_event(pvr, 0);
+}
+
+static void pvr_load(struct device *dev, struct snapshot *snap) {
+  struct pvr *pvr = (struct pvr *)dev;
+
+  /* note, the framebuffer copy is regenerated from texture memory each time
+     it's presented, so it isn't saved */
+  SNAP_READ(snap, pvr->reg);
+  pvr->line_timer = sched_load_timer(pvr->dc->sched, snap);
+  SNAP_READ(snap, pvr->line_clock);
+  SNAP_READ(snap, pvr->line_ns);
+  SNAP_READ(snap, pvr->current_line);
+  SNAP_READ(snap, pvr->next_lines);
+  SNAP_READ(snap, pvr->got_startrender);
+}
 
-  pvr->line_timer = sched_start_timer(sched, &pvr_next_scanline, pvr,
-                                      HZ_TO_NANO(pvr->line_clock));
+static void pvr_save(struct device *dev, struct snapshot *snap) {
+  struct pvr *pvr = (struct pvr *)dev;
+
+  SNAP_WRITE(snap, pvr->reg);
+  sched_save_timer(pvr->dc->sched, snap, pvr->line_timer);
+  SNAP_WRITE(snap, pvr->line_clock);
+  SNAP_WRITE(snap, pvr->line_ns);
+  SNAP_WRITE(snap, pvr->current_line);
+  SNAP_WRITE(snap, pvr->next_lines);
+  SNAP_WRITE(snap, pvr->got_startrender);
 }
 
 static int pvr_init(struct device *dev) {
@@ -361,6 +604,52 @@ uint32_t pvr_vram64_read(struct pvr *pvr, uint32_t addr, uint32_t mask) {
   return READ_DATA(&pvr->vram[addr]);
 }
 
+void pvr_vram32_write_string(struct pvr *pvr, uint32_t addr,
+                             const uint8_t *ptr, int size) {
+  /* each 32-bit word is contiguous in the interleaved layout, so copy a word
+     at a time */
+  while (size) {
+    int n = MIN(4 - (int)(addr & 0x3), size);
+    memcpy(&pvr->vram[VRAM64(addr)], ptr, n);
+    addr += n;
+    ptr += n;
+    size -= n;
+  }
+}
+
+void pvr_vram32_read_string(struct pvr *pvr, uint8_t *ptr, uint32_t addr,
+                            int size) {
+  while (size) {
+    int n = MIN(4 - (int)(addr & 0x3), size);
+    memcpy(ptr, &pvr->vram[VRAM64(addr)], n);
+    addr += n;
+    ptr += n;
+    size -= n;
+  }
+}
+
+void pvr_vram64_write_string(struct pvr *pvr, uint32_t addr,
+                             const uint8_t *ptr, int size) {
+  CHECK_LT(addr, PVR_VRAM_SIZE);
+  CHECK_LE(size, PVR_VRAM_SIZE);
+
+  /* a copy running off the end of video ram wraps around to its start, the
+     same as it would continuing into the next mirror */
+  int n = MIN(size, (int)(PVR_VRAM_SIZE - addr));
+  memcpy(&pvr->vram[addr], ptr, n);
+  memcpy(&pvr->vram[0], ptr + n, size - n);
+}
+
+void pvr_vram64_read_string(struct pvr *pvr, uint8_t *ptr, uint32_t addr,
+                            int size) {
+  CHECK_LT(addr, PVR_VRAM_SIZE);
+  CHECK_LE(size, PVR_VRAM_SIZE);
+
+  int n = MIN(size, (int)(PVR_VRAM_SIZE - addr));
+  memcpy(ptr, &pvr->vram[addr], n);
+  memcpy(ptr + n, &pvr->vram[0], size - n);
+}
+
 void pvr_reg_write(struct pvr *pvr, uint32_t addr, uint32_t data,
                    uint32_t mask) {
   uint32_t offset = addr >> 2;
@@ -372,23 +661,36 @@ void pvr_reg_write(struct pvr *pvr, uint32_t addr, uint32_t data,
     return;
   }
 
+  int64_t start = OPTION_reg_stats ? time_nanoseconds() : 0;
+
   if (write) {
     write(pvr->dc, data);
-    return;
+  } else {
+    pvr->reg[offset] = data;
   }
 
-  pvr->reg[offset] = data;
+  if (start) {
+    reg_stats_count_write(&pvr->reg_counts[offset], time_nanoseconds() - start);
+  }
 }
 
 uint32_t pvr_reg_read(struct pvr *pvr, uint32_t addr, uint32_t mask) {
   uint32_t offset = addr >> 2;
   reg_read_cb read = pvr_cb[offset].read;
+  int64_t start = OPTION_reg_stats ? time_nanoseconds() : 0;
 
+  uint32_t data;
   if (read) {
-    return read(pvr->dc);
+    data = read(pvr->dc);
+  } else {
+    data = pvr->reg[offset];
+  }
+
+  if (start) {
+    reg_stats_count_read(&pvr->reg_counts[offset], time_nanoseconds() - start);
   }
 
-  return pvr->reg[offset];
+  return data;
 }
 
 void pvr_video_size(struct pvr *pvr, int *width, int *height) {
@@ -427,6 +729,18 @@ struct pvr *pvr_create(struct dreamcast *dc) {
   struct pvr *pvr =
       dc_create_device(dc, sizeof(struct pvr), "pvr", &pvr_init, NULL);
 
+  /* setup snapshot interface */
+  pvr->snapif.enabled = 1;
+  pvr->snapif.save = &pvr_save;
+  pvr->snapif.load = &pvr_load;
+
+  /* setup timer callbacks */
+  pvr->timer_cbs = pvr_timer_cbs;
+  pvr->num_timer_cbs = ARRAY_SIZE(pvr_timer_cbs);
+
+  reg_stats_register(dc->reg_stats, &pvr->reg_block, "pvr", pvr_reg_info,
+                     ARRAY_SIZE(pvr_reg_info), pvr->reg_counts);
+
   return pvr;
 }
 
@@ -487,6 +801,40 @@ REG_W32(pvr_cb, TA_YUV_TEX_BASE) {
   ta_yuv_init(ta);
 }
 
+REG_R32(pvr_cb, SPG_STATUS) {
+  struct pvr *pvr = dc->pvr;
+
+  /* the scanline is only updated on lines with an event, derive the line
+     currently being output when read */
+  pvr->SPG_STATUS->scanline = pvr_scanline(pvr);
+
+  return pvr->SPG_STATUS->full;
+}
+
+REG_W32(pvr_cb, SPG_HBLANK_INT) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr->SPG_HBLANK_INT->full = value;
+
+  pvr_reschedule_event(pvr);
+}
+
+REG_W32(pvr_cb, SPG_VBLANK_INT) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr->SPG_VBLANK_INT->full = value;
+
+  pvr_reschedule_event(pvr);
+}
+
+REG_W32(pvr_cb, SPG_VBLANK) {
+  struct pvr *pvr = dc->pvr;
+
+  pvr->SPG_VBLANK->full = value;
+
+  pvr_reschedule_event(pvr);
+}
+
 REG_W32(pvr_cb, SPG_LOAD) {
   struct pvr *pvr = dc->pvr;
 
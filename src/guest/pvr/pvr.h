@@ -3,27 +3,34 @@
 
 #include "guest/dreamcast.h"
 #include "guest/pvr/pvr_types.h"
+#include "guest/reg_stats.h"
 
 struct dreamcast;
 struct holly;
 struct timer;
 
-#define PVR_FRAMEBUFFER_SIZE 640 * 640 * 4
+/* largest framebuffer pushed to the client, 640x480 with its lines doubled, as
+   32-bit rgbx */
+#define PVR_FRAMEBUFFER_SIZE (640 * 960 * 4)
 
 struct pvr {
   struct device;
   uint8_t *vram;
   uint32_t reg[PVR_NUM_REGS];
 
-  /* raster progress */
+  /* access counts for the machine's reg_stats, indexed by offset */
+  struct reg_counts reg_counts[PVR_NUM_REGS];
+  struct reg_block reg_block;
+
+  /* raster progress. rather than stepping through every line, a timer is
+     only scheduled for the next line with an event on it, such as an
+     interrupt or the start or end of vblank. the line being output in between
+     is derived from the time remaining until it */
   struct timer *line_timer;
   int line_clock;
+  int64_t line_ns;
   uint32_t current_line;
-
-  /* copy of deinterlaced framebuffer from texture memory */
-  uint8_t framebuffer[PVR_FRAMEBUFFER_SIZE];
-  int framebuffer_w;
-  int framebuffer_h;
+  int next_lines;
 
   /* tracks if a STARTRENDER was received for the current frame */
   int got_startrender;
@@ -50,4 +57,13 @@ uint32_t pvr_vram32_read(struct pvr *pvr, uint32_t addr, uint32_t mask);
 void pvr_vram32_write(struct pvr *pvr, uint32_t addr, uint32_t data,
                       uint32_t mask);
 
+void pvr_vram64_read_string(struct pvr *pvr, uint8_t *ptr, uint32_t addr,
+                            int size);
+void pvr_vram64_write_string(struct pvr *pvr, uint32_t addr,
+                             const uint8_t *ptr, int size);
+void pvr_vram32_read_string(struct pvr *pvr, uint8_t *ptr, uint32_t addr,
+                            int size);
+void pvr_vram32_write_string(struct pvr *pvr, uint32_t addr,
+                             const uint8_t *ptr, int size);
+
 #endif
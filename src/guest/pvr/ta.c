@@ -29,8 +29,13 @@
 #include "guest/pvr/tr.h"
 #include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
+#include "guest/snapshot.h"
 #include "stats.h"
 
+#if ARCH_X64
+#include <emmintrin.h>
+#endif
+
 struct ta {
   struct device;
   uint8_t *vram;
@@ -197,126 +202,16 @@ uint32_t ta_texture_addr(union tsp tsp, union tcw tcw, int *size) {
 /*
  * parameter stream processing helpers
  */
-int ta_param_sizes[0x100 * TA_NUM_PARAMS * TA_NUM_VERTS];
-int ta_poly_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS];
-int ta_vert_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS];
-
-static int ta_poly_type_raw(union pcw pcw) {
-  if (pcw.list_type == TA_LIST_OPAQUE_MODVOL ||
-      pcw.list_type == TA_LIST_TRANSLUCENT_MODVOL) {
-    return 6;
-  }
-
-  if (pcw.para_type == TA_PARAM_SPRITE) {
-    return 5;
-  }
-
-  if (pcw.volume) {
-    if (pcw.col_type == 0) {
-      return 3;
-    }
-    if (pcw.col_type == 2) {
-      return 4;
-    }
-    if (pcw.col_type == 3) {
-      return 3;
-    }
-  }
-
-  if (pcw.col_type == 0 || pcw.col_type == 1 || pcw.col_type == 3) {
-    return 0;
-  }
-  if (pcw.col_type == 2 && pcw.texture && !pcw.offset) {
-    return 1;
-  }
-  if (pcw.col_type == 2 && pcw.texture && pcw.offset) {
-    return 2;
-  }
-  if (pcw.col_type == 2 && !pcw.texture) {
-    return 1;
-  }
-
-  return 0;
-}
-
-static int ta_vert_type_raw(union pcw pcw) {
-  if (pcw.list_type == TA_LIST_OPAQUE_MODVOL ||
-      pcw.list_type == TA_LIST_TRANSLUCENT_MODVOL) {
-    return 17;
-  }
-
-  if (pcw.para_type == TA_PARAM_SPRITE) {
-    return pcw.texture ? 16 : 15;
-  }
-
-  if (pcw.volume) {
-    if (pcw.texture) {
-      if (pcw.col_type == 0) {
-        return pcw.uv_16bit ? 12 : 11;
-      }
-      if (pcw.col_type == 2 || pcw.col_type == 3) {
-        return pcw.uv_16bit ? 14 : 13;
-      }
-    }
-
-    if (pcw.col_type == 0) {
-      return 9;
-    }
-    if (pcw.col_type == 2 || pcw.col_type == 3) {
-      return 10;
-    }
-  }
-
-  if (pcw.texture) {
-    if (pcw.col_type == 0) {
-      return pcw.uv_16bit ? 4 : 3;
-    }
-    if (pcw.col_type == 1) {
-      return pcw.uv_16bit ? 6 : 5;
-    }
-    if (pcw.col_type == 2 || pcw.col_type == 3) {
-      return pcw.uv_16bit ? 8 : 7;
-    }
-  }
-
-  if (pcw.col_type == 0) {
-    return 0;
-  }
-  if (pcw.col_type == 1) {
-    return 1;
-  }
-  if (pcw.col_type == 2 || pcw.col_type == 3) {
-    return 2;
-  }
-
-  return 0;
-}
-
-static int ta_param_size_raw(union pcw pcw, int vert_type) {
-  switch (pcw.para_type) {
-    case TA_PARAM_END_OF_LIST:
-      return 32;
-    case TA_PARAM_USER_TILE_CLIP:
-      return 32;
-    case TA_PARAM_OBJ_LIST_SET:
-      return 32;
-    case TA_PARAM_POLY_OR_VOL: {
-      int type = ta_poly_type_raw(pcw);
-      return type == 0 || type == 1 || type == 3 ? 32 : 64;
-    }
-    case TA_PARAM_SPRITE:
-      return 32;
-    case TA_PARAM_VERTEX: {
-      return vert_type == 0 || vert_type == 1 || vert_type == 2 ||
-                     vert_type == 3 || vert_type == 4 || vert_type == 7 ||
-                     vert_type == 8 || vert_type == 9 || vert_type == 10
-                 ? 32
-                 : 64;
-    }
-    default:
-      return 0;
-  }
-}
+/* generated at build time by tools/gentables */
+const int ta_param_sizes[0x100 * TA_NUM_PARAMS * TA_NUM_VERTS] = {
+#include "guest/pvr/ta_param_sizes.inc"
+};
+const int ta_poly_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS] = {
+#include "guest/pvr/ta_poly_types.inc"
+};
+const int ta_vert_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS] = {
+#include "guest/pvr/ta_vert_types.inc"
+};
 
 /*
  * ta parameter handling
@@ -348,6 +243,10 @@ static holly_interrupt_t list_interrupts[] = {
     HOLLY_INT_TAEPTIN   /* TA_LIST_PUNCH_THROUGH */
 };
 
+/* initial size of each context's parameter buffer, enough for most 2d scenes
+   to never have to grow it */
+#define TA_MIN_PARAMS_SIZE (64 * 1024)
+
 static struct ta_context *ta_get_context(struct ta *ta, uint32_t addr) {
   for (int i = 0; i < ta->num_contexts; i++) {
     struct ta_context *ctx = &ta->contexts[i];
@@ -394,21 +293,23 @@ static void ta_write_context(struct ta *ta, struct ta_context *ctx,
                              const void *ptr, int size) {
   struct holly *hl = ta->dc->holly;
 
-  CHECK_LT(ctx->size + size, (int)sizeof(ctx->params));
+  /* the whole write is copied in at once, and then each command it completes
+     is processed in order, the same as if it had been received 32 bytes at a
+     time */
+  ta_reserve_context(ctx, ctx->size + size);
   memcpy(&ctx->params[ctx->size], ptr, size);
   ctx->size += size;
 
   /* each TA command is either 32 or 64 bytes, with the pcw being in the first
-     32 bytes always. check every 32 bytes to see if the command has been
-     completely received or not */
-  if (ctx->size % 32 == 0) {
+     32 bytes always */
+  while (ctx->size - ctx->cursor >= 32) {
     void *param = &ctx->params[ctx->cursor];
     union pcw pcw = *(union pcw *)param;
 
-    int size = ta_param_size(pcw, ctx->vert_type);
+    int param_size = ta_param_size(pcw, ctx->vert_type);
     int recv = ctx->size - ctx->cursor;
 
-    if (recv < size) {
+    if (recv < param_size) {
       /* wait for the entire command */
       return;
     }
@@ -451,7 +352,7 @@ static void ta_write_context(struct ta *ta, struct ta_context *ctx,
         break;
     }
 
-    ctx->cursor += recv;
+    ctx->cursor += param_size;
   }
 }
 
@@ -493,6 +394,10 @@ static void ta_save_state(struct ta *ta, struct ta_context *ctx) {
   /* get the punch through polygon alpha test value */
   ctx->alpha_ref = pvr->PT_ALPHA_REF->alpha_ref;
 
+  /* get how modifier volumes affect the surfaces they shadow */
+  ctx->shadow_intensity = pvr->FPU_SHAD_SCALE->intensity_volume_mode;
+  ctx->shadow_scale = pvr->FPU_SHAD_SCALE->scale_factor;
+
   /* according to the hardware docs, this is the correct calculation of the
      background ISP address. however, in practice, the second TA buffer's ISP
      address comes out to be 0x800000 when booting the bios and the vram is
@@ -554,6 +459,8 @@ static void ta_render_context_end(void *data) {
   holly_raise_interrupt(hl, HOLLY_INT_PCEOTINT);
 }
 
+static const timer_cb ta_timer_cbs[] = {&ta_render_context_end};
+
 static void ta_render_context(struct ta *ta, struct ta_context *ctx) {
   struct scheduler *sched = ta->dc->sched;
 
@@ -571,7 +478,6 @@ static void ta_render_context(struct ta *ta, struct ta_context *ctx) {
   /* give each frame 10 ms to finish rendering
      TODO figure out a heuristic involving the number of polygons rendered */
   int64_t end = INT64_C(10000000);
-  ctx->userdata = ta;
   sched_start_timer(sched, &ta_render_context_end, ctx, end);
 }
 
@@ -606,8 +512,9 @@ static void ta_yuv_reset(struct ta *ta) {
   pvr->TA_YUV_TEX_CNT->num = 0;
 }
 
-static void ta_yuv_process_block(struct ta *ta, const uint8_t *in_uv,
-                                 const uint8_t *in_y, uint8_t *out_uyvy) {
+static inline void ta_yuv_process_block(struct ta *ta, const uint8_t *in_uv,
+                                        const uint8_t *in_y,
+                                        uint8_t *out_uyvy) {
   uint8_t *out_row0 = out_uyvy;
   uint8_t *out_row1 = out_uyvy + (ta->yuv_width << 1);
 
@@ -645,19 +552,39 @@ static void ta_yuv_process_block(struct ta *ta, const uint8_t *in_uv,
   }
 }
 
-static void ta_yuv_process_macroblock(struct ta *ta, const void *data) {
-  struct pvr *pvr = ta->dc->pvr;
-  struct holly *hl = ta->dc->holly;
+/* on x64, the macroblock is converted a full 16 pixel row at a time with sse2,
+   interleaving the row's 8 u and v samples together and then with its 16 y
+   samples. the per-subblock routine is kept around as the reference for this */
+#if ARCH_X64
+static inline void ta_yuv_convert_row(const uint8_t *in_u, const uint8_t *in_y,
+                                      uint8_t *out_uyvy) {
+  __m128i u = _mm_loadl_epi64((const __m128i *)in_u);
+  __m128i v = _mm_loadl_epi64((const __m128i *)(in_u + 64));
+  /* the row's y samples are split between two horizontally adjacent
+     subblocks */
+  __m128i y = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)in_y),
+                                 _mm_loadl_epi64((const __m128i *)(in_y + 64)));
+  __m128i uv = _mm_unpacklo_epi8(u, v);
+  _mm_storeu_si128((__m128i *)out_uyvy, _mm_unpacklo_epi8(uv, y));
+  _mm_storeu_si128((__m128i *)(out_uyvy + 16), _mm_unpackhi_epi8(uv, y));
+}
+#endif
 
+static void ta_yuv_convert_macroblock(struct ta *ta, const uint8_t *in,
+                                      uint8_t *out) {
   /* YUV420 data comes in as a series 16x16 macroblocks that need to be
-     converted into a single UYVY422 texture */
-  const uint8_t *in = data;
-  uint32_t out_x =
-      (pvr->TA_YUV_TEX_CNT->num % (pvr->TA_YUV_TEX_CTRL->u_size + 1)) * 16;
-  uint32_t out_y =
-      (pvr->TA_YUV_TEX_CNT->num / (pvr->TA_YUV_TEX_CTRL->u_size + 1)) * 16;
-  uint8_t *out = &ta->yuv_data[(out_y * ta->yuv_width + out_x) << 1];
-
+     converted into a single UYVY422 texture. each macroblock is made up of an
+     8x8 block of u samples, an 8x8 block of v samples and four 8x8 subblocks
+     of y samples */
+#if ARCH_X64
+  int stride = ta->yuv_width << 1;
+
+  for (int j = 0; j < 16; j++) {
+    const uint8_t *in_u = &in[(j >> 1) * 8];
+    const uint8_t *in_y = &in[128 + (j >> 3) * 128 + (j & 7) * 8];
+    ta_yuv_convert_row(in_u, in_y, &out[j * stride]);
+  }
+#else
   /* process each 8x8 subblock individually */
   /* (0, 0) */
   ta_yuv_process_block(ta, &in[0], &in[128], &out[0]);
@@ -667,69 +594,169 @@ static void ta_yuv_process_macroblock(struct ta *ta, const void *data) {
   ta_yuv_process_block(ta, &in[32], &in[256], &out[ta->yuv_width * 16]);
   /* (8, 8) */
   ta_yuv_process_block(ta, &in[36], &in[320], &out[ta->yuv_width * 16 + 16]);
+#endif
+}
+
+static void ta_yuv_process_macroblocks(struct ta *ta, const uint8_t *in,
+                                       int num) {
+  struct pvr *pvr = ta->dc->pvr;
+  struct holly *hl = ta->dc->holly;
+
+  while (num) {
+    /* convert the run of macroblocks up to the end of the current texture,
+       stepping through the output a macroblock at a time */
+    int count = pvr->TA_YUV_TEX_CNT->num;
+    int run = MIN(num, MAX(ta->yuv_macroblock_count - count, 1));
+    int u_size = pvr->TA_YUV_TEX_CTRL->u_size + 1;
+    int out_x = (count % u_size) * 16;
+    int out_y = (count / u_size) * 16;
+
+    for (int i = 0; i < run; i++) {
+      uint8_t *out = &ta->yuv_data[(out_y * ta->yuv_width + out_x) << 1];
+      ta_yuv_convert_macroblock(ta, in, out);
+      in += ta->yuv_macroblock_size;
+
+      out_x += 16;
+      if (out_x >= ta->yuv_width) {
+        out_x = 0;
+        out_y += 16;
+      }
+    }
+
+    num -= run;
 
-  /* reset state once all macroblocks have been processed */
-  pvr->TA_YUV_TEX_CNT->num++;
+    /* reset state once all macroblocks have been processed */
+    pvr->TA_YUV_TEX_CNT->num = count + run;
 
-  if ((int)pvr->TA_YUV_TEX_CNT->num >= ta->yuv_macroblock_count) {
-    ta_yuv_reset(ta);
+    if ((int)pvr->TA_YUV_TEX_CNT->num >= ta->yuv_macroblock_count) {
+      ta_yuv_reset(ta);
 
-    /* raise DMA end interrupt */
-    holly_raise_interrupt(hl, HOLLY_INT_TAYUVINT);
+      /* raise DMA end interrupt */
+      holly_raise_interrupt(hl, HOLLY_INT_TAYUVINT);
+    }
   }
 }
 
 /*
  * ta device interface
  */
-static int ta_init(struct device *dev) {
+static void ta_load_context(struct ta_context *ctx, struct snapshot *snap) {
+  /* the host owns the userdata and rendering state */
+  SNAP_READ(snap, ctx->addr);
+  SNAP_READ(snap, ctx->autosort);
+  SNAP_READ(snap, ctx->stride);
+  SNAP_READ(snap, ctx->palette_fmt);
+  SNAP_READ(snap, ctx->video_width);
+  SNAP_READ(snap, ctx->video_height);
+  SNAP_READ(snap, ctx->alpha_ref);
+  SNAP_READ(snap, ctx->bg_isp);
+  SNAP_READ(snap, ctx->bg_tsp);
+  SNAP_READ(snap, ctx->bg_tcw);
+  SNAP_READ(snap, ctx->bg_depth);
+  SNAP_READ(snap, ctx->bg_vertices);
+  SNAP_READ(snap, ctx->cursor);
+  SNAP_READ(snap, ctx->size);
+  SNAP_READ(snap, ctx->list_type);
+  SNAP_READ(snap, ctx->vert_type);
+  ta_reserve_context(ctx, ctx->size);
+  snap_read(snap, ctx->params, ctx->size);
+}
+
+static void ta_save_context(struct ta_context *ctx, struct snapshot *snap) {
+  SNAP_WRITE(snap, ctx->addr);
+  SNAP_WRITE(snap, ctx->autosort);
+  SNAP_WRITE(snap, ctx->stride);
+  SNAP_WRITE(snap, ctx->palette_fmt);
+  SNAP_WRITE(snap, ctx->video_width);
+  SNAP_WRITE(snap, ctx->video_height);
+  SNAP_WRITE(snap, ctx->alpha_ref);
+  SNAP_WRITE(snap, ctx->bg_isp);
+  SNAP_WRITE(snap, ctx->bg_tsp);
+  SNAP_WRITE(snap, ctx->bg_tcw);
+  SNAP_WRITE(snap, ctx->bg_depth);
+  SNAP_WRITE(snap, ctx->bg_vertices);
+  SNAP_WRITE(snap, ctx->cursor);
+  SNAP_WRITE(snap, ctx->size);
+  SNAP_WRITE(snap, ctx->list_type);
+  SNAP_WRITE(snap, ctx->vert_type);
+  /* only the parameters received so far are saved */
+  snap_write(snap, ctx->params, ctx->size);
+}
+
+static void ta_load(struct device *dev, struct snapshot *snap) {
   struct ta *ta = (struct ta *)dev;
-  struct dreamcast *dc = ta->dc;
+  int yuv_offset;
+  int curr_context;
 
-  ta->vram = mem_vram(dc->mem, 0x0);
+  SNAP_READ(snap, yuv_offset);
+  SNAP_READ(snap, ta->yuv_width);
+  SNAP_READ(snap, ta->yuv_height);
+  SNAP_READ(snap, ta->yuv_macroblock_size);
+  SNAP_READ(snap, ta->yuv_macroblock_count);
+  SNAP_READ(snap, ta->num_contexts);
+  SNAP_READ(snap, curr_context);
 
-  return 1;
+  for (int i = 0; i < ta->num_contexts; i++) {
+    ta_load_context(&ta->contexts[i], snap);
+  }
+
+  ta->yuv_data = yuv_offset >= 0 ? &ta->vram[yuv_offset] : NULL;
+  ta->curr_context = curr_context >= 0 ? &ta->contexts[curr_context] : NULL;
 }
 
-void ta_init_tables() {
-  static int initialized = 0;
+static void ta_save(struct device *dev, struct snapshot *snap) {
+  struct ta *ta = (struct ta *)dev;
+  int yuv_offset = ta->yuv_data ? (int)(ta->yuv_data - ta->vram) : -1;
+  int curr_context =
+      ta->curr_context ? (int)(ta->curr_context - ta->contexts) : -1;
+
+  SNAP_WRITE(snap, yuv_offset);
+  SNAP_WRITE(snap, ta->yuv_width);
+  SNAP_WRITE(snap, ta->yuv_height);
+  SNAP_WRITE(snap, ta->yuv_macroblock_size);
+  SNAP_WRITE(snap, ta->yuv_macroblock_count);
+  SNAP_WRITE(snap, ta->num_contexts);
+  SNAP_WRITE(snap, curr_context);
 
-  if (initialized) {
-    return;
+  for (int i = 0; i < ta->num_contexts; i++) {
+    ta_save_context(&ta->contexts[i], snap);
   }
+}
 
-  initialized = 1;
-
-  for (int i = 0; i < 0x100; i++) {
-    union pcw pcw = *(union pcw *)&i;
+static int ta_init(struct device *dev) {
+  struct ta *ta = (struct ta *)dev;
+  struct dreamcast *dc = ta->dc;
 
-    for (int j = 0; j < TA_NUM_PARAMS; j++) {
-      pcw.para_type = j;
+  ta->vram = mem_vram(dc->mem, 0x0);
 
-      for (int k = 0; k < TA_NUM_VERTS; k++) {
-        int param_idx = i * TA_NUM_PARAMS * TA_NUM_VERTS + j * TA_NUM_VERTS + k;
-        ta_param_sizes[param_idx] = ta_param_size_raw(pcw, k);
-      }
-    }
+  /* the render timer is only handed the context, which finds the ta through
+     its userdata. this is set up front, as it isn't saved in snapshots */
+  for (int i = 0; i < (int)ARRAY_SIZE(ta->contexts); i++) {
+    ta->contexts[i].userdata = ta;
   }
 
-  for (int i = 0; i < 0x100; i++) {
-    union pcw pcw = *(union pcw *)&i;
+  return 1;
+}
 
-    for (int j = 0; j < TA_NUM_PARAMS; j++) {
-      pcw.para_type = j;
+void ta_free_context(struct ta_context *ctx) {
+  free(ctx->params);
+  ctx->params = NULL;
+  ctx->max_size = 0;
+}
 
-      for (int k = 0; k < TA_NUM_LISTS; k++) {
-        pcw.list_type = k;
+void ta_reserve_context(struct ta_context *ctx, int size) {
+  if (size <= ctx->max_size) {
+    return;
+  }
 
-        int poly_idx = i * TA_NUM_PARAMS * TA_NUM_LISTS + j * TA_NUM_LISTS + k;
-        ta_poly_types[poly_idx] = ta_poly_type_raw(pcw);
+  CHECK_LE(size, TA_MAX_PARAMS * 32);
 
-        int vert_idx = i * TA_NUM_PARAMS * TA_NUM_LISTS + j * TA_NUM_LISTS + k;
-        ta_vert_types[vert_idx] = ta_vert_type_raw(pcw);
-      }
-    }
-  }
+  /* grow geometrically, as the buffer is grown while the guest is writing to
+     it */
+  ctx->max_size = MAX(MAX(ctx->max_size * 2, size), TA_MIN_PARAMS_SIZE);
+  ctx->max_size = MIN(ctx->max_size, TA_MAX_PARAMS * 32);
+  ctx->params = realloc(ctx->params, ctx->max_size);
+  CHECK_NOTNULL(ctx->params);
 }
 
 /* ta data handlers
@@ -755,11 +782,7 @@ void ta_yuv_write(struct ta *ta, uint32_t dst, const uint8_t *src, int size) {
   CHECK(*hl->SB_LMMODE0 == 0);
   CHECK(size % ta->yuv_macroblock_size == 0);
 
-  const uint8_t *end = src + size;
-  while (src < end) {
-    ta_yuv_process_macroblock(ta, src);
-    src += ta->yuv_macroblock_size;
-  }
+  ta_yuv_process_macroblocks(ta, src, size / ta->yuv_macroblock_size);
 }
 
 void ta_poly_write(struct ta *ta, uint32_t dst, const uint8_t *src, int size) {
@@ -768,11 +791,7 @@ void ta_poly_write(struct ta *ta, uint32_t dst, const uint8_t *src, int size) {
   CHECK(*hl->SB_LMMODE0 == 0);
   CHECK(size % 32 == 0);
 
-  const uint8_t *end = src + size;
-  while (src < end) {
-    ta_write_context(ta, ta->curr_context, src, 32);
-    src += 32;
-  }
+  ta_write_context(ta, ta->curr_context, src, size);
 }
 
 void ta_texture_info(struct ta *ta, union tsp tsp, union tcw tcw,
@@ -820,13 +839,24 @@ void ta_soft_reset(struct ta *ta) {
 }
 
 void ta_destroy(struct ta *ta) {
+  for (int i = 0; i < (int)ARRAY_SIZE(ta->contexts); i++) {
+    ta_free_context(&ta->contexts[i]);
+  }
+
   dc_destroy_device((struct device *)ta);
 }
 
 struct ta *ta_create(struct dreamcast *dc) {
-  ta_init_tables();
-
   struct ta *ta = dc_create_device(dc, sizeof(struct ta), "ta", &ta_init, NULL);
 
+  /* setup snapshot interface */
+  ta->snapif.enabled = 1;
+  ta->snapif.save = &ta_save;
+  ta->snapif.load = &ta_load;
+
+  /* setup timer callbacks */
+  ta->timer_cbs = ta_timer_cbs;
+  ta->num_timer_cbs = ARRAY_SIZE(ta_timer_cbs);
+
   return ta;
 }
@@ -27,9 +27,9 @@ void ta_texture_write(struct ta *ta, uint32_t dst, const uint8_t *src,
 /*
  * parameter stream processing helpers, shared by both the ta and tr
  */
-extern int ta_param_sizes[0x100 * TA_NUM_PARAMS * TA_NUM_VERTS];
-extern int ta_poly_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS];
-extern int ta_vert_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS];
+extern const int ta_param_sizes[0x100 * TA_NUM_PARAMS * TA_NUM_VERTS];
+extern const int ta_poly_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS];
+extern const int ta_vert_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS];
 
 static inline int ta_param_size(union pcw pcw, int vert_type) {
   return ta_param_sizes[pcw.obj_control * TA_NUM_PARAMS * TA_NUM_VERTS +
@@ -55,7 +55,10 @@ static inline int ta_pcw_list_type_valid(union pcw pcw, int current_list_type) {
           pcw.para_type == TA_PARAM_SPRITE);
 }
 
-void ta_init_tables();
+/* grows the context's parameter buffer to hold at least size bytes, the buffer
+   being reused by each render of the context from then on */
+void ta_reserve_context(struct ta_context *ctx, int size);
+void ta_free_context(struct ta_context *ctx);
 
 /*
  * texture info helpers, shared by both the ta and tr
@@ -77,6 +77,12 @@ union isp {
     uint32_t culling_mode : 2;
     uint32_t depth_compare_mode : 3;
   };
+  /* modifier volumes hold their volume instruction in place of the depth
+     compare mode */
+  struct {
+    uint32_t : 29;
+    uint32_t volume_instr : 3;
+  };
   uint32_t full;
 };
 
@@ -409,6 +415,12 @@ union vert_param {
     uint32_t ignore_2;
   } sprite0;
 
+  struct {
+    union pcw pcw;
+    float xyz[3][3];
+    uint32_t ignore[6];
+  } modvol;
+
   struct {
     union pcw pcw;
     float xyz[4][3];
@@ -434,8 +446,16 @@ struct ta_context {
   float bg_depth;
   uint8_t bg_vertices[TA_BG_VERTEX_SIZE];
 
-  /* parameter buffer */
-  uint8_t params[TA_MAX_PARAMS * 32];
+  /* when intensity volume mode is enabled, modifier volumes darken the
+     surfaces inside of them with the shadow bit set by shadow_scale / 256.
+     otherwise, they select a second set of params for the surfaces */
+  int shadow_intensity;
+  int shadow_scale;
+
+  /* parameter buffer, grown as parameters are received up to a maximum of
+     TA_MAX_PARAMS * 32 bytes */
+  uint8_t *params;
+  int max_size;
   int cursor;
   int size;
 
@@ -2,6 +2,17 @@
 #include "core/core.h"
 #include "render/render_backend.h"
 
+/* the sse2 paths may be disabled by defining TEX_SIMD to 0 before including
+   this file, which tools/retex does to build the scalar decoders it validates
+   the others against */
+#ifndef TEX_SIMD
+#define TEX_SIMD ARCH_X64
+#endif
+
+#if TEX_SIMD
+#include <emmintrin.h>
+#endif
+
 /*
  * pixel formats
  */
@@ -46,6 +57,44 @@ static inline uint8_t COLOR_EXTEND_6(uint8_t c) {
   return c | (c >> 6);
 }
 
+/* on x64, each routine unpacking 4 texels at a time has an sse2 version, with
+   each texel held in a 32-bit lane and all 4 being unpacked at once. sse2 is
+   part of the base x64 instruction set, so no runtime selection is required.
+   the per-texel unpack routines are kept around as the reference for these */
+#if TEX_SIMD
+static inline __m128i tex_load_16x4(const uint16_t *src) {
+  __m128i v = _mm_loadl_epi64((const __m128i *)src);
+  return _mm_unpacklo_epi16(v, _mm_setzero_si128());
+}
+
+static inline __m128i tex_load_32x4(const uint32_t *src) {
+  return _mm_loadu_si128((const __m128i *)src);
+}
+
+static inline __m128i tex_load_pal4(const uint8_t *src, const uint32_t *pal) {
+  return _mm_setr_epi32(pal[src[0] & 15], pal[src[0] >> 4], pal[src[1] & 15],
+                        pal[src[1] >> 4]);
+}
+
+static inline __m128i tex_load_pal8(const uint8_t *src, const uint32_t *pal) {
+  return _mm_setr_epi32(pal[src[0]], pal[src[1]], pal[src[2]], pal[src[3]]);
+}
+
+static inline void tex_store_rgba(uint8_t *rgba, __m128i v) {
+  _mm_storeu_si128((__m128i *)rgba, v);
+}
+
+static inline __m128i tex_mask(__m128i v, uint32_t mask) {
+  return _mm_and_si128(v, _mm_set1_epi32(mask));
+}
+
+/* COLOR_EXTEND_N for each channel selected by mask, the low bits of each
+   channel being known to be zero */
+static inline __m128i tex_extend(__m128i v, int n, uint32_t mask) {
+  return _mm_or_si128(v, tex_mask(_mm_srli_epi32(v, n), mask));
+}
+#endif
+
 /* ARGB1555 */
 typedef uint16_t ARGB1555_type;
 
@@ -56,36 +105,63 @@ static inline void ARGB1555_unpack(ARGB1555_type src, uint8_t *rgba) {
   rgba[3] = COLOR_EXTEND_1((src & 0b1000000000000000) >> 8);
 }
 
+#if TEX_SIMD
+static inline __m128i ARGB1555_unpack4(__m128i src) {
+  __m128i r = tex_mask(_mm_srli_epi32(src, 7), 0x000000f8);
+  __m128i g = tex_mask(_mm_slli_epi32(src, 6), 0x0000f800);
+  __m128i b = tex_mask(_mm_slli_epi32(src, 19), 0x00f80000);
+  __m128i a = _mm_srai_epi32(_mm_slli_epi32(src, 16), 31);
+  __m128i rgb = tex_extend(_mm_or_si128(_mm_or_si128(r, g), b), 5, 0x070707);
+  return _mm_or_si128(rgb, tex_mask(a, 0xff000000));
+}
+#endif
+
 static inline void ARGB1555_unpack_bitmap(const ARGB1555_type *src,
                                           uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB1555_unpack4(tex_load_16x4(src)));
+#else
   ARGB1555_unpack(src[0], rgba + 0x0);
   ARGB1555_unpack(src[1], rgba + 0x4);
   ARGB1555_unpack(src[2], rgba + 0x8);
   ARGB1555_unpack(src[3], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB1555_unpack_twiddled(const ARGB1555_type *src,
                                             uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB1555_unpack4(tex_load_16x4(src)));
+#else
   ARGB1555_unpack(src[0], rgba + 0x0);
   ARGB1555_unpack(src[1], rgba + 0x4);
   ARGB1555_unpack(src[2], rgba + 0x8);
   ARGB1555_unpack(src[3], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB1555_unpack_pal4(const uint8_t *src, const uint32_t *pal,
                                         uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB1555_unpack4(tex_load_pal4(src, pal)));
+#else
   ARGB1555_unpack((ARGB1555_type)pal[src[0] & 15], rgba + 0x0);
   ARGB1555_unpack((ARGB1555_type)pal[src[0] >> 4], rgba + 0x4);
   ARGB1555_unpack((ARGB1555_type)pal[src[1] & 15], rgba + 0x8);
   ARGB1555_unpack((ARGB1555_type)pal[src[1] >> 4], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB1555_unpack_pal8(const uint8_t *src, const uint32_t *pal,
                                         uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB1555_unpack4(tex_load_pal8(src, pal)));
+#else
   ARGB1555_unpack((ARGB1555_type)pal[src[0]], rgba + 0x0);
   ARGB1555_unpack((ARGB1555_type)pal[src[1]], rgba + 0x4);
   ARGB1555_unpack((ARGB1555_type)pal[src[2]], rgba + 0x8);
   ARGB1555_unpack((ARGB1555_type)pal[src[3]], rgba + 0xc);
+#endif
 }
 
 /* RGB565 */
@@ -98,35 +174,62 @@ static inline void RGB565_unpack(const RGB565_type src, uint8_t *rgba) {
   rgba[3] = 0xff;
 }
 
+#if TEX_SIMD
+static inline __m128i RGB565_unpack4(__m128i src) {
+  __m128i r = tex_mask(_mm_srli_epi32(src, 8), 0x000000f8);
+  __m128i g = tex_mask(_mm_slli_epi32(src, 5), 0x0000fc00);
+  __m128i b = tex_mask(_mm_slli_epi32(src, 19), 0x00f80000);
+  __m128i rgb = _mm_or_si128(_mm_or_si128(r, g), b);
+  rgb = _mm_or_si128(tex_extend(rgb, 5, 0x070007), tex_extend(g, 6, 0x0300));
+  return _mm_or_si128(rgb, _mm_set1_epi32(0xff000000));
+}
+#endif
+
 static inline void RGB565_unpack_bitmap(const RGB565_type *src, uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, RGB565_unpack4(tex_load_16x4(src)));
+#else
   RGB565_unpack(src[0], rgba + 0x0);
   RGB565_unpack(src[1], rgba + 0x4);
   RGB565_unpack(src[2], rgba + 0x8);
   RGB565_unpack(src[3], rgba + 0xc);
+#endif
 }
 
 static inline void RGB565_unpack_twiddled(const RGB565_type *src,
                                           uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, RGB565_unpack4(tex_load_16x4(src)));
+#else
   RGB565_unpack(src[0], rgba + 0x0);
   RGB565_unpack(src[1], rgba + 0x4);
   RGB565_unpack(src[2], rgba + 0x8);
   RGB565_unpack(src[3], rgba + 0xc);
+#endif
 }
 
 static inline void RGB565_unpack_pal4(const uint8_t *src, const uint32_t *pal,
                                       uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, RGB565_unpack4(tex_load_pal4(src, pal)));
+#else
   RGB565_unpack((RGB565_type)pal[src[0] & 15], rgba + 0x0);
   RGB565_unpack((RGB565_type)pal[src[0] >> 4], rgba + 0x4);
   RGB565_unpack((RGB565_type)pal[src[1] & 15], rgba + 0x8);
   RGB565_unpack((RGB565_type)pal[src[1] >> 4], rgba + 0xc);
+#endif
 }
 
 static inline void RGB565_unpack_pal8(const uint8_t *src, const uint32_t *pal,
                                       uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, RGB565_unpack4(tex_load_pal8(src, pal)));
+#else
   RGB565_unpack((RGB565_type)pal[src[0]], rgba + 0x0);
   RGB565_unpack((RGB565_type)pal[src[1]], rgba + 0x4);
   RGB565_unpack((RGB565_type)pal[src[2]], rgba + 0x8);
   RGB565_unpack((RGB565_type)pal[src[3]], rgba + 0xc);
+#endif
 }
 
 /* UYVY422 */
@@ -163,16 +266,73 @@ static inline void UYVY422_unpack(UYVY422_type src0, UYVY422_type src1,
   b[3] = 0xff;
 }
 
+#if TEX_SIMD
+/* divides each lane by 1 << shift, rounding toward zero like c does */
+static inline __m128i tex_div_trunc(__m128i v, int shift) {
+  __m128i bias = _mm_srli_epi32(_mm_srai_epi32(v, 31), 32 - shift);
+  return _mm_srai_epi32(_mm_add_epi32(v, bias), shift);
+}
+
+/* the low byte of each texel shifted down to be signed, holding the u or v
+   shared by the pair the texel is in */
+static inline __m128i UYVY422_uv(__m128i src) {
+  return _mm_sub_epi32(tex_mask(src, 0xff), _mm_set1_epi32(128));
+}
+
+static inline __m128i UYVY422_unpack4(__m128i src, __m128i u, __m128i v) {
+  __m128i y = _mm_srli_epi32(src, 8);
+
+  /* 11 * u, 11 * v and 55 * u */
+  __m128i u11 = _mm_add_epi32(_mm_slli_epi32(u, 3), _mm_slli_epi32(u, 1));
+  u11 = _mm_add_epi32(u11, u);
+  __m128i v11 = _mm_add_epi32(_mm_slli_epi32(v, 3), _mm_slli_epi32(v, 1));
+  v11 = _mm_add_epi32(v11, v);
+  __m128i u55 = _mm_sub_epi32(_mm_slli_epi32(u, 6), _mm_slli_epi32(u, 3));
+  u55 = _mm_sub_epi32(u55, u);
+
+  __m128i r = _mm_add_epi32(y, tex_div_trunc(v11, 3));
+  __m128i g = _mm_add_epi32(u11, _mm_slli_epi32(v11, 1));
+  g = _mm_sub_epi32(y, tex_div_trunc(g, 5));
+  __m128i b = _mm_add_epi32(y, tex_div_trunc(u55, 5));
+
+  /* clamp each channel while narrowing them to bytes, and then interleave the
+     planes of r, g, b and a into rgba texels */
+  __m128i rg = _mm_packs_epi32(r, g);
+  __m128i ba = _mm_packs_epi32(b, _mm_set1_epi32(0xff));
+  __m128i planes = _mm_packus_epi16(rg, ba);
+  __m128i lo = _mm_unpacklo_epi8(planes, _mm_srli_si128(planes, 4));
+  __m128i hi = _mm_unpacklo_epi8(_mm_srli_si128(planes, 8),
+                                 _mm_srli_si128(planes, 12));
+  return _mm_unpacklo_epi16(lo, hi);
+}
+#endif
+
 static inline void UYVY422_unpack_bitmap(const UYVY422_type *src,
                                          uint8_t *rgba) {
+#if TEX_SIMD
+  __m128i s = tex_load_16x4(src);
+  __m128i uv = UYVY422_uv(s);
+  __m128i u = _mm_shuffle_epi32(uv, _MM_SHUFFLE(2, 2, 0, 0));
+  __m128i v = _mm_shuffle_epi32(uv, _MM_SHUFFLE(3, 3, 1, 1));
+  tex_store_rgba(rgba, UYVY422_unpack4(s, u, v));
+#else
   UYVY422_unpack(src[0], src[1], rgba + 0x0, rgba + 0x4);
   UYVY422_unpack(src[2], src[3], rgba + 0x8, rgba + 0xc);
+#endif
 }
 
 static inline void UYVY422_unpack_twiddled(const UYVY422_type *src,
                                            uint8_t *rgba) {
+#if TEX_SIMD
+  __m128i s = tex_load_16x4(src);
+  __m128i uv = UYVY422_uv(s);
+  __m128i u = _mm_shuffle_epi32(uv, _MM_SHUFFLE(1, 0, 1, 0));
+  __m128i v = _mm_shuffle_epi32(uv, _MM_SHUFFLE(3, 2, 3, 2));
+  tex_store_rgba(rgba, UYVY422_unpack4(s, u, v));
+#else
   UYVY422_unpack(src[0], src[2], rgba + 0x0, rgba + 0x8);
   UYVY422_unpack(src[1], src[3], rgba + 0x4, rgba + 0xc);
+#endif
 }
 
 /* ARGB4444 */
@@ -185,36 +345,63 @@ static inline void ARGB4444_unpack(const ARGB4444_type src, uint8_t *rgba) {
   rgba[3] = COLOR_EXTEND_4((src & 0b1111000000000000) >> 8);
 }
 
+#if TEX_SIMD
+static inline __m128i ARGB4444_unpack4(__m128i src) {
+  __m128i r = tex_mask(_mm_srli_epi32(src, 4), 0x000000f0);
+  __m128i g = tex_mask(_mm_slli_epi32(src, 8), 0x0000f000);
+  __m128i b = tex_mask(_mm_slli_epi32(src, 20), 0x00f00000);
+  __m128i a = tex_mask(_mm_slli_epi32(src, 16), 0xf0000000);
+  __m128i rgba = _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a));
+  return tex_extend(rgba, 4, 0x0f0f0f0f);
+}
+#endif
+
 static inline void ARGB4444_unpack_bitmap(const ARGB4444_type *src,
                                           uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB4444_unpack4(tex_load_16x4(src)));
+#else
   ARGB4444_unpack(src[0], rgba + 0x0);
   ARGB4444_unpack(src[1], rgba + 0x4);
   ARGB4444_unpack(src[2], rgba + 0x8);
   ARGB4444_unpack(src[3], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB4444_unpack_twiddled(const ARGB4444_type *src,
                                             uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB4444_unpack4(tex_load_16x4(src)));
+#else
   ARGB4444_unpack(src[0], rgba + 0x0);
   ARGB4444_unpack(src[1], rgba + 0x4);
   ARGB4444_unpack(src[2], rgba + 0x8);
   ARGB4444_unpack(src[3], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB4444_unpack_pal4(const uint8_t *src, const uint32_t *pal,
                                         uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB4444_unpack4(tex_load_pal4(src, pal)));
+#else
   ARGB4444_unpack((ARGB4444_type)pal[src[0] & 15], rgba + 0x0);
   ARGB4444_unpack((ARGB4444_type)pal[src[0] >> 4], rgba + 0x4);
   ARGB4444_unpack((ARGB4444_type)pal[src[1] & 15], rgba + 0x8);
   ARGB4444_unpack((ARGB4444_type)pal[src[1] >> 4], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB4444_unpack_pal8(const uint8_t *src, const uint32_t *pal,
                                         uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB4444_unpack4(tex_load_pal8(src, pal)));
+#else
   ARGB4444_unpack((ARGB4444_type)pal[src[0]], rgba + 0x0);
   ARGB4444_unpack((ARGB4444_type)pal[src[1]], rgba + 0x4);
   ARGB4444_unpack((ARGB4444_type)pal[src[2]], rgba + 0x8);
   ARGB4444_unpack((ARGB4444_type)pal[src[3]], rgba + 0xc);
+#endif
 }
 
 /* ARGB8888 */
@@ -227,36 +414,61 @@ static inline void ARGB8888_unpack(ARGB8888_type src, uint8_t *rgba) {
   rgba[3] = (src >> 24) & 0xff;
 }
 
+#if TEX_SIMD
+static inline __m128i ARGB8888_unpack4(__m128i src) {
+  __m128i r = tex_mask(_mm_srli_epi32(src, 16), 0x000000ff);
+  __m128i ga = tex_mask(src, 0xff00ff00);
+  __m128i b = tex_mask(_mm_slli_epi32(src, 16), 0x00ff0000);
+  return _mm_or_si128(_mm_or_si128(r, ga), b);
+}
+#endif
+
 static inline void ARGB8888_unpack_bitmap(const ARGB8888_type *src,
                                           uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB8888_unpack4(tex_load_32x4(src)));
+#else
   ARGB8888_unpack(src[0], rgba + 0x0);
   ARGB8888_unpack(src[1], rgba + 0x4);
   ARGB8888_unpack(src[2], rgba + 0x8);
   ARGB8888_unpack(src[3], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB8888_unpack_twiddled(const ARGB8888_type *src,
                                             uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB8888_unpack4(tex_load_32x4(src)));
+#else
   ARGB8888_unpack(src[0], rgba + 0x0);
   ARGB8888_unpack(src[1], rgba + 0x4);
   ARGB8888_unpack(src[2], rgba + 0x8);
   ARGB8888_unpack(src[3], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB8888_unpack_pal4(const uint8_t *src, const uint32_t *pal,
                                         uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB8888_unpack4(tex_load_pal4(src, pal)));
+#else
   ARGB8888_unpack((ARGB8888_type)pal[src[0] & 15], rgba + 0x0);
   ARGB8888_unpack((ARGB8888_type)pal[src[0] >> 4], rgba + 0x4);
   ARGB8888_unpack((ARGB8888_type)pal[src[1] & 15], rgba + 0x8);
   ARGB8888_unpack((ARGB8888_type)pal[src[1] >> 4], rgba + 0xc);
+#endif
 }
 
 static inline void ARGB8888_unpack_pal8(const uint8_t *src, const uint32_t *pal,
                                         uint8_t *rgba) {
+#if TEX_SIMD
+  tex_store_rgba(rgba, ARGB8888_unpack4(tex_load_pal8(src, pal)));
+#else
   ARGB8888_unpack((ARGB8888_type)pal[src[0]], rgba + 0x0);
   ARGB8888_unpack((ARGB8888_type)pal[src[1]], rgba + 0x4);
   ARGB8888_unpack((ARGB8888_type)pal[src[2]], rgba + 0x8);
   ARGB8888_unpack((ARGB8888_type)pal[src[3]], rgba + 0xc);
+#endif
 }
 
 /* RGBA */
@@ -268,20 +480,115 @@ static inline void RGBA_pack(RGBA_type *dst, uint8_t *rgba) {
 
 static inline void RGBA_pack_bitmap(RGBA_type *dst, int x, int y, int stride,
                                     uint8_t *rgba) {
+#if TEX_SIMD
+  __m128i v = _mm_loadu_si128((const __m128i *)rgba);
+  _mm_storeu_si128((__m128i *)&dst[y * stride + x], v);
+#else
   RGBA_pack(&dst[y * stride + (x + 0)], rgba + 0x0);
   RGBA_pack(&dst[y * stride + (x + 1)], rgba + 0x4);
   RGBA_pack(&dst[y * stride + (x + 2)], rgba + 0x8);
   RGBA_pack(&dst[y * stride + (x + 3)], rgba + 0xc);
+#endif
 }
 
 static inline void RGBA_pack_twiddled(RGBA_type *dst, int x, int y, int stride,
                                       uint8_t *rgba) {
+#if TEX_SIMD
+  /* gather the texels of each row into the low half */
+  __m128i v = _mm_loadu_si128((const __m128i *)rgba);
+  __m128i rows = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+  _mm_storel_epi64((__m128i *)&dst[(y + 0) * stride + x], rows);
+  _mm_storel_epi64((__m128i *)&dst[(y + 1) * stride + x],
+                   _mm_unpackhi_epi64(rows, rows));
+#else
   RGBA_pack(&dst[(y + 0) * stride + (x + 0)], rgba + 0x0);
   RGBA_pack(&dst[(y + 1) * stride + (x + 0)], rgba + 0x4);
   RGBA_pack(&dst[(y + 0) * stride + (x + 1)], rgba + 0x8);
   RGBA_pack(&dst[(y + 1) * stride + (x + 1)], rgba + 0xc);
+#endif
+}
+
+/* RAW16
+
+   16-bit texels which are uploaded in their packed form rather than being
+   expanded to RGBA. the texels are passed through to the pack routines as is,
+   which only shuffle their bits into the order expected by the render
+   backend */
+typedef uint16_t RAW16_type;
+
+static inline void RAW16_unpack_bitmap(const RAW16_type *src, uint8_t *texels) {
+  memcpy(texels, src, 4 * sizeof(RAW16_type));
+}
+
+static inline void RAW16_unpack_twiddled(const RAW16_type *src,
+                                         uint8_t *texels) {
+  memcpy(texels, src, 4 * sizeof(RAW16_type));
+}
+
+static inline void RAW16_unpack_pal4(const uint8_t *src, const uint32_t *pal,
+                                     uint8_t *texels) {
+  RAW16_type raw[4] = {
+      (RAW16_type)pal[src[0] & 15], (RAW16_type)pal[src[0] >> 4],
+      (RAW16_type)pal[src[1] & 15], (RAW16_type)pal[src[1] >> 4],
+  };
+  memcpy(texels, raw, sizeof(raw));
+}
+
+static inline void RAW16_unpack_pal8(const uint8_t *src, const uint32_t *pal,
+                                     uint8_t *texels) {
+  RAW16_type raw[4] = {
+      (RAW16_type)pal[src[0]], (RAW16_type)pal[src[1]],
+      (RAW16_type)pal[src[2]], (RAW16_type)pal[src[3]],
+  };
+  memcpy(texels, raw, sizeof(raw));
 }
 
+#define define_pack_raw16(TO)                                                 \
+  static inline void TO##_pack_bitmap(TO##_type *dst, int x, int y,          \
+                                      int stride, uint8_t *texels) {         \
+    RAW16_type raw[4];                                                       \
+    memcpy(raw, texels, sizeof(raw));                                        \
+    dst[y * stride + (x + 0)] = TO##_swizzle(raw[0]);                        \
+    dst[y * stride + (x + 1)] = TO##_swizzle(raw[1]);                        \
+    dst[y * stride + (x + 2)] = TO##_swizzle(raw[2]);                        \
+    dst[y * stride + (x + 3)] = TO##_swizzle(raw[3]);                        \
+  }                                                                          \
+                                                                             \
+  static inline void TO##_pack_twiddled(TO##_type *dst, int x, int y,        \
+                                        int stride, uint8_t *texels) {       \
+    RAW16_type raw[4];                                                       \
+    memcpy(raw, texels, sizeof(raw));                                        \
+    dst[(y + 0) * stride + (x + 0)] = TO##_swizzle(raw[0]);                  \
+    dst[(y + 1) * stride + (x + 0)] = TO##_swizzle(raw[1]);                  \
+    dst[(y + 0) * stride + (x + 1)] = TO##_swizzle(raw[2]);                  \
+    dst[(y + 1) * stride + (x + 1)] = TO##_swizzle(raw[3]);                  \
+  }
+
+/* RGBA5551, from ARGB1555 */
+typedef uint16_t RGBA5551_type;
+
+static inline RGBA5551_type RGBA5551_swizzle(RAW16_type src) {
+  return (RGBA5551_type)((src << 1) | (src >> 15));
+}
+
+define_pack_raw16(RGBA5551);
+
+/* RGB565, from RGB565 which already matches */
+static inline RGB565_type RGB565_swizzle(RAW16_type src) {
+  return src;
+}
+
+define_pack_raw16(RGB565);
+
+/* RGBA4444, from ARGB4444 */
+typedef uint16_t RGBA4444_type;
+
+static inline RGBA4444_type RGBA4444_swizzle(RAW16_type src) {
+  return (RGBA4444_type)((src << 4) | (src >> 12));
+}
+
+define_pack_raw16(RGBA4444);
+
 /*
  * texture formats
  *
@@ -305,119 +612,79 @@ static inline void RGBA_pack_twiddled(RGBA_type *dst, int x, int y, int stride,
          |
    05 07 | 13 15
 
-   a lookup table is generated to match an (x,y) pair to its twiddled index */
-static int twitbl[1024];
-static int twitbl_init = 0;
-
-void pvr_init_twiddle_table() {
-  if (twitbl_init) {
-    return;
-  }
-
-  twitbl_init = 1;
-
-  for (int i = 0; i < ARRAY_SIZE(twitbl); i++) {
-    twitbl[i] = 0;
-
-    for (int j = 0, k = 1; k <= i; j++, k <<= 1) {
-      twitbl[i] |= (i & k) << j;
-    }
-  }
-}
+   a lookup table, generated at build time by tools/gentables, spreads the
+   bits of each coordinate out to the even bit positions, matching an (x,y)
+   pair to its twiddled index */
+static const int twitbl[1024] = {
+#include "guest/pvr/tex_twiddle.inc"
+};
 
 static int pvr_twiddle_pos(int x, int y) {
   return (twitbl[x] << 1) | twitbl[y];
 }
 
-#define define_convert_bitmap(FROM, TO)                                     \
-  void convert_bitmap_##FROM##_##TO(const FROM##_type *src, TO##_type *dst, \
-                                    int width, int height, int stride) {    \
-    uint8_t rgba[4 * 4];                                                    \
-                                                                            \
-    for (int y = 0; y < height; y++) {                                      \
-      for (int x = 0; x < width; x += 4) {                                  \
-        FROM##_unpack_bitmap(&src[y * stride + x], rgba);                   \
-        TO##_pack_bitmap(dst, x, y, width, rgba);                           \
-      }                                                                     \
-    }                                                                       \
-  }
-
-#define define_convert_twiddled(FROM, TO)                                     \
-  void convert_twiddled_##FROM##_##TO(const FROM##_type *src, TO##_type *dst, \
-                                      int width, int height) {                \
-    pvr_init_twiddle_table();                                                 \
-                                                                              \
-    uint8_t rgba[4 * 4];                                                      \
-    int size = MIN(width, height);                                            \
-    int base = 0;                                                             \
-                                                                              \
-    for (int y = 0; y < height; y += size) {                                  \
-      for (int x = 0; x < width; x += size) {                                 \
-        for (int y2 = 0; y2 < size; y2 += 2) {                                \
-          for (int x2 = 0; x2 < size; x2 += 2) {                              \
-            int pos = base + pvr_twiddle_pos(x2, y2);                         \
-            FROM##_unpack_twiddled(&src[pos], rgba);                          \
-            TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);             \
-          }                                                                   \
-        }                                                                     \
-        base += size * size;                                                  \
-      }                                                                       \
-    }                                                                         \
-  }
-
-#define define_convert_pal4(FROM, TO)                                 \
-  void convert_pal4_##FROM##_##TO(const uint8_t *src, TO##_type *dst, \
-                                  const uint32_t *palette, int width, \
-                                  int height) {                       \
-    pvr_init_twiddle_table();                                         \
-                                                                      \
+#define define_convert_bitmap(FROM, TO)                               \
+  static void convert_bitmap_##FROM##_##TO(const FROM##_type *src,    \
+                                           TO##_type *dst, int width, \
+                                           int height, int stride) {  \
     uint8_t rgba[4 * 4];                                              \
-    int size = MIN(width, height);                                    \
-    int base = 0;                                                     \
                                                                       \
-    for (int y = 0; y < height; y += size) {                          \
-      for (int x = 0; x < width; x += size) {                         \
-        for (int y2 = 0; y2 < size; y2 += 2) {                        \
-          for (int x2 = 0; x2 < size; x2 += 2) {                      \
-            int pos = base + pvr_twiddle_pos(x2, y2);                 \
-            FROM##_unpack_pal4(&src[pos >> 1], palette, rgba);        \
-            TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);     \
-          }                                                           \
-        }                                                             \
-        base += size * size;                                          \
+    for (int y = 0; y < height; y++) {                                \
+      for (int x = 0; x < width; x += 4) {                            \
+        FROM##_unpack_bitmap(&src[y * stride + x], rgba);             \
+        TO##_pack_bitmap(dst, x, y, width, rgba);                     \
       }                                                               \
     }                                                                 \
   }
 
-#define define_convert_pal8(FROM, TO)                                 \
-  void convert_pal8_##FROM##_##TO(const uint8_t *src, TO##_type *dst, \
-                                  const uint32_t *palette, int width, \
-                                  int height) {                       \
-    pvr_init_twiddle_table();                                         \
-                                                                      \
-    uint8_t rgba[4 * 4];                                              \
-    int size = MIN(width, height);                                    \
-    int base = 0;                                                     \
-                                                                      \
-    for (int y = 0; y < height; y += size) {                          \
-      for (int x = 0; x < width; x += size) {                         \
-        for (int y2 = 0; y2 < size; y2 += 2) {                        \
-          for (int x2 = 0; x2 < size; x2 += 2) {                      \
-            int pos = base + pvr_twiddle_pos(x2, y2);                 \
-            FROM##_unpack_pal8(&src[pos], palette, rgba);             \
-            TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);     \
-          }                                                           \
-        }                                                             \
-        base += size * size;                                          \
-      }                                                               \
-    }                                                                 \
+#define define_convert_twiddled(FROM, TO)                               \
+  static void convert_twiddled_##FROM##_##TO(const FROM##_type *src,    \
+                                             TO##_type *dst, int width, \
+                                             int height) {              \
+    uint8_t rgba[4 * 4];                                                \
+    int size = MIN(width, height);                                      \
+    int base = 0;                                                       \
+                                                                        \
+    for (int y = 0; y < height; y += size) {                            \
+      for (int x = 0; x < width; x += size) {                           \
+        for (int y2 = 0; y2 < size; y2 += 2) {                          \
+          for (int x2 = 0; x2 < size; x2 += 2) {                        \
+            int pos = base + pvr_twiddle_pos(x2, y2);                   \
+            FROM##_unpack_twiddled(&src[pos], rgba);                    \
+            TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);       \
+          }                                                             \
+        }                                                               \
+        base += size * size;                                            \
+      }                                                                 \
+    }                                                                   \
   }
 
-#define define_convert_vq(FROM, TO)                                          \
-  void convert_vq_##FROM##_##TO(const uint8_t *src, const uint8_t *codebook, \
-                                TO##_type *dst, int width, int height) {     \
-    pvr_init_twiddle_table();                                                \
+#define define_convert_pal4(FROM, TO)                                        \
+  static void convert_pal4_##FROM##_##TO(const uint8_t *src, TO##_type *dst, \
+                                         const uint32_t *palette, int width, \
+                                         int height) {                       \
+    uint8_t rgba[4 * 4];                                                     \
+    int size = MIN(width, height);                                           \
+    int base = 0;                                                            \
                                                                              \
+    for (int y = 0; y < height; y += size) {                                 \
+      for (int x = 0; x < width; x += size) {                                \
+        for (int y2 = 0; y2 < size; y2 += 2) {                               \
+          for (int x2 = 0; x2 < size; x2 += 2) {                             \
+            int pos = base + pvr_twiddle_pos(x2, y2);                        \
+            FROM##_unpack_pal4(&src[pos >> 1], palette, rgba);               \
+            TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);            \
+          }                                                                  \
+        }                                                                    \
+        base += size * size;                                                 \
+      }                                                                      \
+    }                                                                        \
+  }
+
+#define define_convert_pal8(FROM, TO)                                        \
+  static void convert_pal8_##FROM##_##TO(const uint8_t *src, TO##_type *dst, \
+                                         const uint32_t *palette, int width, \
+                                         int height) {                       \
     uint8_t rgba[4 * 4];                                                     \
     int size = MIN(width, height);                                           \
     int base = 0;                                                            \
@@ -427,10 +694,7 @@ static int pvr_twiddle_pos(int x, int y) {
         for (int y2 = 0; y2 < size; y2 += 2) {                               \
           for (int x2 = 0; x2 < size; x2 += 2) {                             \
             int pos = base + pvr_twiddle_pos(x2, y2);                        \
-            /* each codebook entry is 4x2 bytes long */                      \
-            int idx = src[pos / 4] * 8;                                      \
-            const FROM##_type *code = (const FROM##_type *)&codebook[idx];   \
-            FROM##_unpack_twiddled(code, rgba);                              \
+            FROM##_unpack_pal8(&src[pos], palette, rgba);                    \
             TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);            \
           }                                                                  \
         }                                                                    \
@@ -439,6 +703,32 @@ static int pvr_twiddle_pos(int x, int y) {
     }                                                                        \
   }
 
+#define define_convert_vq(FROM, TO)                                        \
+  static void convert_vq_##FROM##_##TO(const uint8_t *src,                 \
+                                       const uint8_t *codebook,            \
+                                       TO##_type *dst, int width,          \
+                                       int height) {                       \
+    uint8_t rgba[4 * 4];                                                   \
+    int size = MIN(width, height);                                         \
+    int base = 0;                                                          \
+                                                                           \
+    for (int y = 0; y < height; y += size) {                               \
+      for (int x = 0; x < width; x += size) {                              \
+        for (int y2 = 0; y2 < size; y2 += 2) {                             \
+          for (int x2 = 0; x2 < size; x2 += 2) {                           \
+            int pos = base + pvr_twiddle_pos(x2, y2);                      \
+            /* each codebook entry is 4x2 bytes long */                    \
+            int idx = src[pos / 4] * 8;                                    \
+            const FROM##_type *code = (const FROM##_type *)&codebook[idx]; \
+            FROM##_unpack_twiddled(code, rgba);                            \
+            TO##_pack_twiddled(dst, x + x2, y + y2, width, rgba);          \
+          }                                                                \
+        }                                                                  \
+        base += size * size;                                               \
+      }                                                                    \
+    }                                                                      \
+  }
+
 define_convert_bitmap(ARGB1555, RGBA);
 define_convert_bitmap(RGB565, RGBA);
 define_convert_bitmap(UYVY422, RGBA);
@@ -464,6 +754,26 @@ define_convert_vq(RGB565, RGBA);
 define_convert_vq(ARGB4444, RGBA);
 define_convert_vq(UYVY422, RGBA);
 
+define_convert_bitmap(RAW16, RGBA5551);
+define_convert_bitmap(RAW16, RGB565);
+define_convert_bitmap(RAW16, RGBA4444);
+
+define_convert_twiddled(RAW16, RGBA5551);
+define_convert_twiddled(RAW16, RGB565);
+define_convert_twiddled(RAW16, RGBA4444);
+
+define_convert_pal4(RAW16, RGBA5551);
+define_convert_pal4(RAW16, RGB565);
+define_convert_pal4(RAW16, RGBA4444);
+
+define_convert_pal8(RAW16, RGBA5551);
+define_convert_pal8(RAW16, RGB565);
+define_convert_pal8(RAW16, RGBA4444);
+
+define_convert_vq(RAW16, RGBA5551);
+define_convert_vq(RAW16, RGB565);
+define_convert_vq(RAW16, RGBA4444);
+
 /*
  * texture loading
  */
@@ -574,16 +884,17 @@ const uint8_t *pvr_tex_data(const uint8_t *src) {
   return data;
 }
 
-void pvr_tex_decode(const uint8_t *src, int width, int height, int stride,
-                    int texture_fmt, int pixel_fmt, const uint8_t *palette,
-                    int palette_fmt, uint8_t *dst, int size) {
-  int twiddled = pvr_tex_twiddled(texture_fmt);
+/* returns the texel data of the highest res level, or the index data for vq
+   compressed textures */
+static const uint8_t *pvr_tex_top_level(const uint8_t *src, int width,
+                                        int texture_fmt, int pixel_fmt) {
   int compressed = pvr_tex_compressed(texture_fmt);
   int mipmaps = pvr_tex_mipmaps(texture_fmt);
 
   /* used by vq compressed textures */
-  const uint8_t *codebook = src;
-  const uint8_t *index = src + PVR_CODEBOOK_SIZE;
+  if (compressed) {
+    src += PVR_CODEBOOK_SIZE;
+  }
 
   /* mipmap textures contain data for 1 x 1 up to width x height. skip to the
      highest res and let the renderer backend generate its own mipmaps */
@@ -593,7 +904,7 @@ void pvr_tex_decode(const uint8_t *src, int width, int height, int stride,
     if (compressed) {
       /* for vq compressed textures the offset is only for the index data, the
          codebook is the same for all levels */
-      index += compressed_mipmap_offsets[u_size];
+      src += compressed_mipmap_offsets[u_size];
     } else if (pixel_fmt == PVR_PXL_4BPP) {
       src += paletted_4bpp_mipmap_offsets[u_size];
     } else if (pixel_fmt == PVR_PXL_8BPP) {
@@ -603,6 +914,161 @@ void pvr_tex_decode(const uint8_t *src, int width, int height, int stride,
     }
   }
 
+  return src;
+}
+
+enum pxl_format pvr_tex_native_format(int pixel_fmt, int palette_fmt) {
+  if (pixel_fmt == PVR_PXL_4BPP || pixel_fmt == PVR_PXL_8BPP) {
+    switch (palette_fmt) {
+      case PVR_PAL_ARGB1555:
+        return PXL_RGBA5551;
+      case PVR_PAL_RGB565:
+        return PXL_RGB565;
+      case PVR_PAL_ARGB4444:
+        return PXL_RGBA4444;
+      default:
+        return PXL_RGBA;
+    }
+  }
+
+  switch (pixel_fmt) {
+    case PVR_PXL_ARGB1555:
+    case PVR_PXL_RESERVED:
+      return PXL_RGBA5551;
+    case PVR_PXL_RGB565:
+      return PXL_RGB565;
+    case PVR_PXL_ARGB4444:
+      return PXL_RGBA4444;
+    default:
+      return PXL_RGBA;
+  }
+}
+
+enum pxl_format pvr_tex_decode_native(const uint8_t *src, int width,
+                                      int height, int stride, int texture_fmt,
+                                      int pixel_fmt, const uint8_t *palette,
+                                      int palette_fmt, uint8_t *dst,
+                                      int size) {
+  enum pxl_format format = pvr_tex_native_format(pixel_fmt, palette_fmt);
+
+  if (format == PXL_RGBA) {
+    pvr_tex_decode(src, width, height, stride, texture_fmt, pixel_fmt,
+                   palette, palette_fmt, dst, size);
+    return format;
+  }
+
+  int twiddled = pvr_tex_twiddled(texture_fmt);
+  int compressed = pvr_tex_compressed(texture_fmt);
+  int paletted = pixel_fmt == PVR_PXL_4BPP || pixel_fmt == PVR_PXL_8BPP;
+  const uint8_t *codebook = src;
+  const uint8_t *data = pvr_tex_top_level(src, width, texture_fmt, pixel_fmt);
+
+  /* aliases to cut down on copy and paste */
+  const uint16_t *data16 = (const uint16_t *)data;
+  const uint32_t *pal32 = (const uint32_t *)palette;
+  uint16_t *dst16 = (uint16_t *)dst;
+
+#define CONVERT_RAW16(TO)                                                     \
+  if (pixel_fmt == PVR_PXL_4BPP) {                                            \
+    convert_pal4_RAW16_##TO(data, dst16, pal32, width, height);               \
+  } else if (pixel_fmt == PVR_PXL_8BPP) {                                     \
+    convert_pal8_RAW16_##TO(data, dst16, pal32, width, height);               \
+  } else if (compressed) {                                                    \
+    convert_vq_RAW16_##TO(data, codebook, dst16, width, height);              \
+  } else if (twiddled) {                                                      \
+    convert_twiddled_RAW16_##TO(data16, dst16, width, height);                \
+  } else {                                                                    \
+    convert_bitmap_RAW16_##TO(data16, dst16, width, height, stride);          \
+  }
+
+  CHECK(!compressed || !paletted);
+
+  switch (format) {
+    case PXL_RGBA5551:
+      CONVERT_RAW16(RGBA5551);
+      break;
+    case PXL_RGB565:
+      CONVERT_RAW16(RGB565);
+      break;
+    case PXL_RGBA4444:
+      CONVERT_RAW16(RGBA4444);
+      break;
+    default:
+      LOG_FATAL("pvr_tex_decode_native unsupported format %d", format);
+      break;
+  }
+
+#undef CONVERT_RAW16
+
+  return format;
+}
+
+int pvr_tex_raw(const uint8_t *src, int width, int height, int stride,
+                int texture_fmt, int pixel_fmt, const uint8_t *palette,
+                int palette_fmt, struct raw_texture *raw) {
+  int paletted = pixel_fmt == PVR_PXL_4BPP || pixel_fmt == PVR_PXL_8BPP;
+
+  switch (pvr_tex_native_format(pixel_fmt, palette_fmt)) {
+    case PXL_RGBA5551:
+      raw->format = RAW_ARGB1555;
+      break;
+    case PXL_RGB565:
+      raw->format = RAW_RGB565;
+      break;
+    case PXL_RGBA4444:
+      raw->format = RAW_ARGB4444;
+      break;
+    default:
+      /* YUV422 textures aren't supported */
+      if (!paletted || palette_fmt != PVR_PAL_ARGB8888) {
+        return 0;
+      }
+      raw->format = RAW_ARGB8888;
+      break;
+  }
+
+  raw->width = width;
+  raw->height = height;
+  raw->stride = stride;
+  raw->data = pvr_tex_top_level(src, width, texture_fmt, pixel_fmt);
+  raw->codebook = src;
+  raw->palette = palette;
+  raw->num_palette_entries = 0;
+
+  if (pixel_fmt == PVR_PXL_4BPP) {
+    raw->layout = RAW_PAL4;
+    raw->size = width * height / 2;
+    raw->num_palette_entries = 16;
+  } else if (pixel_fmt == PVR_PXL_8BPP) {
+    raw->layout = RAW_PAL8;
+    raw->size = width * height;
+    raw->num_palette_entries = 256;
+  } else if (pvr_tex_compressed(texture_fmt)) {
+    raw->layout = RAW_VQ;
+    raw->size = width * height / 4;
+  } else if (pvr_tex_twiddled(texture_fmt)) {
+    raw->layout = RAW_TWIDDLED;
+    raw->size = width * height * 2;
+  } else {
+    raw->layout = RAW_BITMAP;
+    raw->size = stride * height * 2;
+  }
+
+  return 1;
+}
+
+void pvr_tex_decode(const uint8_t *src, int width, int height, int stride,
+                    int texture_fmt, int pixel_fmt, const uint8_t *palette,
+                    int palette_fmt, uint8_t *dst, int size) {
+  int twiddled = pvr_tex_twiddled(texture_fmt);
+  int compressed = pvr_tex_compressed(texture_fmt);
+
+  /* the codebook is only used by vq compressed textures, for which the top
+     level is their index data */
+  const uint8_t *codebook = src;
+  const uint8_t *index = pvr_tex_top_level(src, width, texture_fmt, pixel_fmt);
+  src = index;
+
   /* aliases to cut down on copy and paste */
   const uint16_t *src16 = (const uint16_t *)src;
   const uint32_t *pal32 = (const uint32_t *)palette;
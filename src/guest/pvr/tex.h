@@ -2,6 +2,7 @@
 #define TEX_H
 
 #include <stdint.h>
+#include "render/render_backend.h"
 
 #define PVR_CODEBOOK_SIZE (256 * 8)
 
@@ -78,4 +79,19 @@ void pvr_tex_decode(const uint8_t *data, int width, int height, int stride,
                     int texture_fmt, int pixel_fmt, const uint8_t *palette,
                     int pal_pixel_fmt, uint8_t *out, int size);
 
+/* describes the texture for the render backend to decode itself, returning 0
+   if it's in a format the backend can't decode */
+int pvr_tex_raw(const uint8_t *data, int width, int height, int stride,
+                int texture_fmt, int pixel_fmt, const uint8_t *palette,
+                int pal_pixel_fmt, struct raw_texture *raw);
+
+/* 16-bit textures are decoded to their packed counterpart, saving upload
+   bandwidth and texture memory over expanding them to RGBA */
+enum pxl_format pvr_tex_native_format(int pixel_fmt, int pal_pixel_fmt);
+enum pxl_format pvr_tex_decode_native(const uint8_t *data, int width,
+                                      int height, int stride, int texture_fmt,
+                                      int pixel_fmt, const uint8_t *palette,
+                                      int pal_pixel_fmt, uint8_t *out,
+                                      int size);
+
 #endif
@@ -6,16 +6,53 @@
  */
 
 #include "guest/pvr/tr.h"
+#include "core/atomic.h"
 #include "core/core.h"
+#include "core/hash.h"
+#include "core/profiler.h"
 #include "core/sort.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "file/texture_pack.h"
 #include "guest/pvr/ta.h"
 #include "guest/pvr/tex.h"
+#include "options.h"
+#include "stats.h"
+
+/* contexts smaller than this are converted serially, the cost of handing the
+   work off outweighing the parsing itself */
+#define TR_PARALLEL_MIN_SIZE 0x8000
+#define TR_MAX_SEGMENTS 16
+#define TR_NUM_WORKERS 2
+#define TR_MAX_DECODES 1024
+#define TR_MAX_DECODE_BUFFER (1024 * 1024 * 16)
+
+/* palette ram is copied for indexed textures in banks of 16 entries, the size
+   of a 4bpp texture's palette */
+#define TR_PALETTE_BANK_SIZE 64
+
+DEFINE_ZONE(tr_convert_context);
+DEFINE_ZONE(tr_decode_texture);
+DEFINE_ZONE(tr_render_context);
 
 struct tr {
+  struct tr_converter *cvt;
   struct render_backend *r;
   void *userdata;
   tr_find_texture_cb find_texture;
 
+  /* context being converted into, whose palette is filled in by the indexed
+     textures converted */
+  struct tr_context *rc;
+
+  /* translucent surfaces are blended order independently when rendered, in
+     which case they're committed as strips rather than split up for sorting */
+  int oit;
+
+  /* textures converted ahead of parsing for each param, or NULL to convert
+     them while parsing */
+  const texture_handle_t *textures;
+
   /* current global state */
   const union vert_param *last_vertex;
   int list_type;
@@ -26,8 +63,113 @@ struct tr {
   /* sprite params */
   uint8_t sprite_color[4];
   uint8_t sprite_offset_color[4];
+
+  /* ranges of the context's surfs, verts and list surfs being written to. when
+     converting serially, these span the entire context. when converting in
+     parallel, each segment of the param stream is parsed into its own range,
+     with the ranges being compacted once each has been parsed */
+  int surf_base;
+  int num_surfs;
+  int max_surfs;
+  int vert_base;
+  int num_verts;
+  int max_verts;
+  int list_base[TA_NUM_LISTS];
+  int num_list_surfs[TA_NUM_LISTS];
+  int num_orig_surfs[TA_NUM_LISTS];
+  int num_params;
+
+  /* set while the surf following the last committed one holds the current
+     global params, and hasn't been committed itself */
+  int reserved;
+
+  /* each modifier volume's triangles are parsed into a single surf, which is
+     held reserved until the triangle following a param with a volume
+     instruction closes it */
+  int modvol_open;
+  int modvol_instr;
+
+  /* bits of each uv parsed, ORed together */
+  uint32_t uv_bits;
+};
+
+/* a run of the param stream up to and including an end of list param, which
+   resets all global state making it safe to parse independent of the params
+   before it */
+struct tr_segment {
+  struct tr tr;
+  const struct ta_context *ctx;
+  struct tr_context *rc;
+  const uint8_t *begin;
+  const uint8_t *end;
+  int first_param;
+  int num_params;
+  int list_type;
+};
+
+typedef void (*tr_job_cb)(void *, int);
+
+struct tr_worker {
+  thread_t thread;
+  mutex_t mutex;
+  cond_t work_cond;
+  cond_t done_cond;
+  int pending;
+  int shutdown;
+
+  /* jobs are striped across the workers and the calling thread */
+  tr_job_cb job;
+  void *data;
+  int first_job;
+  int num_jobs;
+  int stride;
+
+  /* the first of the worker's jobs not yet completed */
+  int next_job;
+};
+
+/* a texture being decoded, either ahead of time by the workers, or inline
+   when it's first referenced */
+struct tr_decode {
+  struct tr_converter *cvt;
+  struct tr_texture *entry;
+  const struct ta_context *ctx;
+  union tcw tcw;
+  uint64_t key;
+  uint64_t hash;
+
+  int texture_fmt;
+  int indexed;
+  int palette_base;
+  int mipmaps;
+  int width;
+  int height;
+  int stride;
+  enum filter_mode filter;
+  enum wrap_mode wrap_u;
+  enum wrap_mode wrap_v;
+
+  /* decoded output */
+  int decoded;
+  int replaced;
+  struct compressed_texture replacement;
+  int raw;
+  struct raw_texture raw_tex;
+  enum pxl_format format;
+  uint8_t *data;
+  int offset;
+};
+
+/* each worker decodes into its own buffer, with each of the worker's decodes
+   being given its own range of the buffer */
+struct tr_decode_buffer {
+  uint8_t *data;
+  int size;
+  int used;
 };
 
+static void tr_wait_job(struct tr_converter *cvt, int index);
+
 static int compressed_mipmap_offsets[] = {
     0x00006, /* 8 x 8 */
     0x00016, /* 16 x 16 */
@@ -103,96 +245,405 @@ static inline enum blend_func translate_dst_blend_func(uint32_t blend_func) {
   return dst_blend_funcs[blend_func];
 }
 
+static inline enum raw_format translate_palette_format(uint32_t palette_fmt) {
+  static enum raw_format palette_formats[] = {RAW_ARGB1555, RAW_RGB565,
+                                              RAW_ARGB4444, RAW_ARGB8888};
+  return palette_formats[palette_fmt];
+}
+
 static inline enum shade_mode translate_shade_mode(uint32_t shade_mode) {
   static enum shade_mode shade_modes[] = {
       SHADE_DECAL, SHADE_MODULATE, SHADE_DECAL_ALPHA, SHADE_MODULATE_ALPHA};
   return shade_modes[shade_mode];
 }
 
-static texture_handle_t tr_convert_texture(struct tr *tr,
-                                           const struct ta_context *ctx,
-                                           union tsp tsp, union tcw tcw) {
+/* textures whose source data hashes the same, such as the same texture
+   uploaded to multiple addresses, share a single handle. each handle's entry
+   here is indexed by the handle itself */
+struct tr_shared_texture {
+  struct render_backend *r;
+  uint64_t hash;
+  int refs;
+  struct list_node it;
+};
+
+/* all state which outlives a single conversion is kept per converter, so
+   each emulator instance in the process converts independently of the
+   others */
+struct tr_converter {
+  /* workers, created on first use */
+  struct tr_worker workers[TR_NUM_WORKERS];
+  int workers_created;
+
+  struct tr_decode decodes[TR_MAX_DECODES];
+  struct tr_decode_buffer decode_buffers[TR_NUM_WORKERS];
+  int num_decodes;
+
+  /* replacement pack, opened on first use. only replacements in formats the
+     render backend supports are used */
+  struct texture_pack *pack;
+  int pack_loaded;
+  int pack_formats[NUM_COMPRESSED_FORMATS];
+
+  struct tr_segment segments[TR_MAX_SEGMENTS];
+  texture_handle_t textures[TA_MAX_PARAMS];
+
+  struct tr_shared_texture shared_textures[MAX_TEXTURES];
+  DECLARE_HASHTABLE(shared_table, 10);
+
+  uint64_t sort_keys[TR_MAX_SURFS];
+  uint64_t sort_tmp[TR_MAX_SURFS];
+
+  /* textures converted inline are decoded here */
+  uint8_t converted[1024 * 1024 * 4];
+
+  /* updated by each thread decoding */
+  volatile int64_t textures_decoded;
+  volatile int64_t decode_ns;
+};
+
+static texture_handle_t tr_acquire_shared_texture(struct tr_converter *cvt,
+                                                  struct render_backend *r,
+                                                  uint64_t hash) {
+  struct list *bkt = hash_bkt(cvt->shared_table, hash);
+
+  hash_bkt_for_each_entry(shared, bkt, struct tr_shared_texture, it) {
+    if (shared->r == r && shared->hash == hash) {
+      shared->refs++;
+      return (texture_handle_t)(shared - cvt->shared_textures);
+    }
+  }
+
+  return 0;
+}
+
+static void tr_share_texture(struct tr_converter *cvt,
+                             struct render_backend *r, texture_handle_t handle,
+                             uint64_t hash) {
+  struct tr_shared_texture *shared = &cvt->shared_textures[handle];
+  CHECK_EQ(shared->refs, 0);
+
+  shared->r = r;
+  shared->hash = hash;
+  shared->refs = 1;
+  hash_add(hash_bkt(cvt->shared_table, hash), &shared->it);
+}
+
+void tr_release_texture(struct tr_converter *cvt, struct render_backend *r,
+                        struct tr_texture *entry) {
+  texture_handle_t handle = entry->handle;
+
+  if (!handle) {
+    return;
+  }
+
+  entry->handle = 0;
+
+  struct tr_shared_texture *shared = &cvt->shared_textures[handle];
+
+  if (shared->refs) {
+    if (--shared->refs) {
+      return;
+    }
+
+    hash_del(hash_bkt(cvt->shared_table, shared->hash), &shared->it);
+  }
+
+  r_destroy_texture(r, handle);
+}
+
+static void tr_load_texture_pack(struct tr_converter *cvt,
+                                 struct render_backend *r) {
+  if (cvt->pack_loaded) {
+    return;
+  }
+
+  cvt->pack_loaded = 1;
+
+  if (!OPTION_texture_pack[0]) {
+    return;
+  }
+
+  cvt->pack = texture_pack_open(OPTION_texture_pack);
+
+  for (int i = 0; i < NUM_COMPRESSED_FORMATS; i++) {
+    cvt->pack_formats[i] = r && r_compressed_format_supported(r, i);
+  }
+}
+
+int tr_texture_indexed(union tcw tcw) {
+  /* replacements are keyed on the palette, and mipmaps would be generated
+     from the indices */
+  return OPTION_gpu_palettes && !OPTION_texture_pack[0] &&
+         (tcw.pixel_fmt == PVR_PXL_4BPP || tcw.pixel_fmt == PVR_PXL_8BPP) &&
+         !ta_texture_mipmaps(tcw);
+}
+
+static void tr_init_decode(struct tr_converter *cvt, struct tr_decode *dec,
+                           struct tr_texture *entry,
+                           const struct ta_context *ctx, union tsp tsp,
+                           union tcw tcw, uint8_t *data) {
   /* TODO it's bad that textures are only cached based off tsp / tcw yet the
      TEXT_CONTROL registers and PAL_RAM_CTRL registers are used here to control
      texture generation */
+  dec->cvt = cvt;
+  dec->entry = entry;
+  dec->ctx = ctx;
+  dec->tcw = tcw;
+  dec->data = data;
+  dec->decoded = 0;
+
+  /* get texture dimensions */
+  dec->texture_fmt = ta_texture_format(tcw);
+  dec->indexed = tr_texture_indexed(tcw);
+  dec->palette_base = (int)ta_palette_addr(tcw, NULL) / 4;
+  dec->mipmaps = ta_texture_mipmaps(tcw);
+  dec->width = ta_texture_width(tsp, tcw);
+  dec->height = ta_texture_height(tsp, tcw);
+  dec->stride = ta_texture_stride(tsp, tcw, ctx->stride);
+
+  /* ignore trilinear filtering for now */
+  dec->filter = tsp.filter_mode == 0 ? FILTER_NEAREST : FILTER_BILINEAR;
+  dec->wrap_u = tsp.clamp_u ? WRAP_CLAMP_TO_EDGE
+                            : (tsp.flip_u ? WRAP_MIRRORED_REPEAT : WRAP_REPEAT);
+  dec->wrap_v = tsp.clamp_v ? WRAP_CLAMP_TO_EDGE
+                            : (tsp.flip_v ? WRAP_MIRRORED_REPEAT : WRAP_REPEAT);
+}
+
+/* decoded textures are at most 32-bits per texel, with only the top level
+   being decoded */
+static int tr_decode_size(const struct tr_decode *dec) {
+  return dec->width * dec->height * 4;
+}
+
+static void tr_hash_texture(struct tr_decode *dec) {
+  const struct tr_texture *entry = dec->entry;
+  const uint8_t *palette = dec->indexed ? NULL : entry->palette;
+  int palette_size = dec->indexed ? 0 : entry->palette_size;
+
+  /* the source data is keyed the same as replacements are, with the sampler
+     state the handle is created with hashed on top */
+  dec->key = texture_pack_key(dec->texture_fmt, dec->tcw.pixel_fmt,
+                              dec->ctx->palette_fmt, dec->width, dec->height,
+                              dec->stride, entry->texture, entry->texture_size,
+                              palette, palette_size);
+
+  int params[] = {
+      dec->mipmaps, dec->filter,       dec->wrap_u,
+      dec->wrap_v,  dec->indexed,      dec->palette_base,
+  };
+  dec->hash = hash_bytes(params, sizeof(params), dec->key);
+}
+
+static int tr_texture_unchanged(const struct tr_decode *dec) {
+  /* a dirty texture is commonly rewritten with the same data, or only had
+     data next to it on the same page written, in which case there's nothing
+     to convert */
+  return dec->entry->handle && dec->entry->hash == dec->hash;
+}
+
+static void tr_decode_texture(struct tr_decode *dec) {
+  const struct tr_texture *entry = dec->entry;
+  const struct ta_context *ctx = dec->ctx;
+  struct tr_converter *cvt = dec->cvt;
+
+  /* replacements are uploaded as is, there's nothing to decode */
+  dec->replaced = cvt->pack &&
+                  texture_pack_find(cvt->pack, dec->key, &dec->replacement) &&
+                  cvt->pack_formats[dec->replacement.format];
+
+  if (dec->replaced) {
+    dec->decoded = 1;
+    return;
+  }
+
+  PROF_ENTER(tr_decode_texture);
+
+  int64_t start = time_nanoseconds();
+
+  dec->raw = (OPTION_gpu_textures || dec->indexed) &&
+             pvr_tex_raw(entry->texture, dec->width, dec->height, dec->stride,
+                         dec->texture_fmt, dec->tcw.pixel_fmt, entry->palette,
+                         ctx->palette_fmt, &dec->raw_tex);
+
+  if (!dec->raw) {
+    dec->format = pvr_tex_decode_native(
+        entry->texture, dec->width, dec->height, dec->stride, dec->texture_fmt,
+        dec->tcw.pixel_fmt, entry->palette, ctx->palette_fmt, dec->data,
+        tr_decode_size(dec));
+  }
+
+  dec->decoded = 1;
+
+  atomic_add64(&cvt->textures_decoded, 1);
+  atomic_add64(&cvt->decode_ns, time_nanoseconds() - start);
+
+  PROF_LEAVE(tr_decode_texture);
+}
+
+static void tr_decode_job(void *data, int index) {
+  struct tr_decode *dec = &((struct tr_decode *)data)[index];
+
+  tr_hash_texture(dec);
 
+  if (!tr_texture_unchanged(dec)) {
+    tr_decode_texture(dec);
+  }
+}
+
+static texture_handle_t tr_upload_texture(struct tr *tr,
+                                          struct tr_decode *dec) {
+  struct tr_texture *entry = dec->entry;
+
+  if (tr_texture_unchanged(dec)) {
+    entry->dirty = 0;
+    return entry->handle;
+  }
+
+  tr_release_texture(tr->cvt, tr->r, entry);
+
+  entry->handle = tr_acquire_shared_texture(tr->cvt, tr->r, dec->hash);
+
+  if (!entry->handle) {
+    if (!dec->decoded) {
+      tr_decode_texture(dec);
+    }
+
+    if (dec->replaced) {
+      entry->handle =
+          r_create_compressed_texture(tr->r, &dec->replacement, dec->filter,
+                                      dec->wrap_u, dec->wrap_v);
+    } else if (dec->indexed) {
+      entry->handle = r_create_indexed_texture(tr->r, &dec->raw_tex,
+                                               dec->palette_base, dec->filter,
+                                               dec->wrap_u, dec->wrap_v);
+    } else if (dec->raw) {
+      entry->handle = r_create_raw_texture(tr->r, &dec->raw_tex, dec->filter,
+                                           dec->wrap_u, dec->wrap_v,
+                                           dec->mipmaps);
+    } else {
+      entry->handle = r_create_texture(
+          tr->r, dec->format, dec->filter, dec->wrap_u, dec->wrap_v,
+          dec->mipmaps, dec->width, dec->height, dec->data);
+    }
+
+    tr_share_texture(tr->cvt, tr->r, entry->handle, dec->hash);
+  }
+
+  entry->hash = dec->hash;
+  entry->filter = dec->filter;
+  entry->wrap_u = dec->wrap_u;
+  entry->wrap_v = dec->wrap_v;
+  entry->format = dec->texture_fmt;
+  entry->width = dec->width;
+  entry->height = dec->height;
+  entry->dirty = 0;
+
+  return entry->handle;
+}
+
+/* copies the banks of palette ram an indexed texture looks up its colors in
+   into the context, if they haven't been already */
+static void tr_copy_palette(struct tr *tr, const struct tr_texture *entry,
+                            union tcw tcw) {
+  struct tr_context *rc = tr->rc;
+  int size;
+  uint32_t addr = ta_palette_addr(tcw, &size);
+  int first_bank = addr / TR_PALETTE_BANK_SIZE;
+  int num_banks = size / TR_PALETTE_BANK_SIZE;
+  uint64_t banks = ((1ull << num_banks) - 1) << first_bank;
+
+  if ((rc->palette_banks & banks) == banks) {
+    return;
+  }
+
+  memcpy((uint8_t *)rc->palette + addr, entry->palette, size);
+  rc->palette_banks |= banks;
+}
+
+static texture_handle_t tr_convert_texture(struct tr *tr,
+                                           const struct ta_context *ctx,
+                                           union tsp tsp, union tcw tcw) {
   struct tr_texture *entry = tr->find_texture(tr->userdata, tsp, tcw);
   CHECK_NOTNULL(entry);
 
+  if (tr_texture_indexed(tcw)) {
+    tr_copy_palette(tr, entry, tcw);
+  }
+
   /* if there's a non-dirty handle, return it */
   if (entry->handle && !entry->dirty) {
     return entry->handle;
   }
 
-  /* if there's a dirty handle, destroy it before creating the new one */
-  if (entry->handle && entry->dirty) {
-    r_destroy_texture(tr->r, entry->handle);
-    entry->handle = 0;
+  /* if the texture was queued to be decoded ahead of time, wait for it to
+     finish */
+  if (entry->decode) {
+    int index = entry->decode - 1;
+    entry->decode = 0;
+    tr_wait_job(tr->cvt, index);
+    return tr_upload_texture(tr, &tr->cvt->decodes[index]);
   }
 
-  static uint8_t converted[1024 * 1024 * 4];
-  const uint8_t *palette = entry->palette;
-  const uint8_t *texture = entry->texture;
-
-  /* get texture dimensions */
-  int texture_fmt = ta_texture_format(tcw);
-  int mipmaps = ta_texture_mipmaps(tcw);
-  int width = ta_texture_width(tsp, tcw);
-  int height = ta_texture_height(tsp, tcw);
-  int stride = ta_texture_stride(tsp, tcw, ctx->stride);
+  struct tr_decode dec;
+  tr_init_decode(tr->cvt, &dec, entry, ctx, tsp, tcw, tr->cvt->converted);
+  tr_hash_texture(&dec);
 
-  /* figure out the texture format */
-  pvr_tex_decode(texture, width, height, stride, texture_fmt, tcw.pixel_fmt,
-                 palette, ctx->palette_fmt, converted, sizeof(converted));
+  return tr_upload_texture(tr, &dec);
+}
 
-  /* ignore trilinear filtering for now */
-  enum filter_mode filter =
-      tsp.filter_mode == 0 ? FILTER_NEAREST : FILTER_BILINEAR;
-  enum wrap_mode wrap_u =
-      tsp.clamp_u ? WRAP_CLAMP_TO_EDGE
-                  : (tsp.flip_u ? WRAP_MIRRORED_REPEAT : WRAP_REPEAT);
-  enum wrap_mode wrap_v =
-      tsp.clamp_v ? WRAP_CLAMP_TO_EDGE
-                  : (tsp.flip_v ? WRAP_MIRRORED_REPEAT : WRAP_REPEAT);
-
-  entry->handle = r_create_texture(tr->r, PXL_RGBA, filter, wrap_u, wrap_v,
-                                   mipmaps, width, height, converted);
-  entry->filter = filter;
-  entry->wrap_u = wrap_u;
-  entry->wrap_v = wrap_v;
-  entry->format = texture_fmt;
-  entry->width = width;
-  entry->height = height;
-  entry->dirty = 0;
+/* contexts converted without a render backend have no textures to look up */
+static inline int tr_texture_array(struct tr *tr, texture_handle_t handle,
+                                   int *layer) {
+  if (!tr->r || !handle) {
+    return 0;
+  }
 
-  return entry->handle;
+  return r_texture_array(tr->r, handle, layer);
 }
 
 static struct ta_surface *tr_reserve_surf(struct tr *tr, struct tr_context *rc,
                                           int copy_from_prev) {
-  int surf_index = rc->num_surfs;
+  int surf_index = tr->num_surfs;
 
-  CHECK_LT(surf_index, ARRAY_SIZE(rc->surfs));
+  CHECK_LT(surf_index, tr->max_surfs);
   struct ta_surface *surf = &rc->surfs[surf_index];
 
-  if (copy_from_prev) {
-    CHECK(rc->num_surfs);
-    *surf = rc->surfs[rc->num_surfs - 1];
-  } else {
+  /* a strip too short to commit a surf leaves its surf reserved, in which
+     case it's reused as is. this keeps the copy from reaching back into the
+     surfs of a previous list, which may belong to another segment */
+  if (copy_from_prev && !tr->reserved) {
+    CHECK_GT(tr->num_surfs, tr->surf_base);
+    *surf = rc->surfs[tr->num_surfs - 1];
+  } else if (!copy_from_prev) {
     memset(surf, 0, sizeof(*surf));
   }
 
-  surf->first_vert = rc->num_verts;
+  surf->first_vert = tr->num_verts;
   surf->num_verts = 0;
+  tr->reserved = 1;
 
   return surf;
 }
 
+/* reserves num verts for the current surf, left uninitialized for the caller
+   to write each of their fields */
+static struct ta_vertex *tr_reserve_verts(struct tr *tr, struct tr_context *rc,
+                                          int num) {
+  struct ta_surface *curr_surf = &rc->surfs[tr->num_surfs];
+
+  int vert_index = tr->num_verts + curr_surf->num_verts;
+  CHECK_LE(vert_index + num, tr->max_verts);
+  curr_surf->num_verts += num;
+
+  return &rc->verts[vert_index];
+}
+
 static struct ta_vertex *tr_reserve_vert(struct tr *tr, struct tr_context *rc) {
-  struct ta_surface *curr_surf = &rc->surfs[rc->num_surfs];
+  struct ta_surface *curr_surf = &rc->surfs[tr->num_surfs];
 
-  int vert_index = rc->num_verts + curr_surf->num_verts;
-  CHECK_LT(vert_index, ARRAY_SIZE(rc->verts));
+  int vert_index = tr->num_verts + curr_surf->num_verts;
+  CHECK_LT(vert_index, tr->max_verts);
   struct ta_vertex *vert = &rc->verts[vert_index];
 
   memset(vert, 0, sizeof(*vert));
@@ -204,13 +655,25 @@ static struct ta_vertex *tr_reserve_vert(struct tr *tr, struct tr_context *rc) {
 
 static void tr_commit_surf(struct tr *tr, struct tr_context *rc) {
   struct tr_list *list = &rc->lists[tr->list_type];
-  struct ta_surface *new_surf = &rc->surfs[rc->num_surfs];
+  int *num_list_surfs = &tr->num_list_surfs[tr->list_type];
+  struct ta_surface *new_surf = &rc->surfs[tr->num_surfs];
 
   /* track original number of surfaces, before sorting, merging, etc. */
-  list->num_orig_surfs++;
+  tr->num_orig_surfs[tr->list_type]++;
+
+  /* surfs textured from an array pass the texture's layer to the shader in
+     the alpha of their offset color, which is otherwise unused */
+  int layer;
+  if (tr_texture_array(tr, new_surf->params.texture, &layer)) {
+    struct ta_vertex *verts = &rc->verts[tr->num_verts];
+
+    for (int i = 0; i < new_surf->num_verts; i++) {
+      ((uint8_t *)&verts[i].offset_color)[3] = (uint8_t)layer;
+    }
+  }
 
   /* for translucent lists, commit a surf for each tri to make sorting easier */
-  if (tr->list_type == TA_LIST_TRANSLUCENT ||
+  if ((tr->list_type == TA_LIST_TRANSLUCENT && !tr->oit) ||
       tr->list_type == TA_LIST_PUNCH_THROUGH) {
     /* ignore the last two verts as polygons are fed to the TA as tristrips */
     int num_verts = new_surf->num_verts;
@@ -226,28 +689,30 @@ static void tr_commit_surf(struct tr *tr, struct tr_context *rc) {
       /* track triangle strip offset so winding order can be consistent when
          generating indices */
       surf->strip_offset = i;
-      surf->first_vert = rc->num_verts;
+      surf->first_vert = tr->num_verts;
       surf->num_verts = 3;
 
       /* default sort the new surface */
-      list->surfs[list->num_surfs++] = rc->num_surfs;
+      list->surfs[(*num_list_surfs)++] = tr->num_surfs;
 
       /* commit the new surface */
-      rc->num_verts += 1;
-      rc->num_surfs++;
+      tr->num_verts += 1;
+      tr->num_surfs++;
+      tr->reserved = 0;
     }
 
     /* commit the last two verts */
-    rc->num_verts += 2;
+    tr->num_verts += 2;
   }
   /* for opaque lists, commit surface as is */
   else {
     /* default sort the new surface */
-    list->surfs[list->num_surfs++] = rc->num_surfs;
+    list->surfs[(*num_list_surfs)++] = tr->num_surfs;
 
     /* commit the new surface */
-    rc->num_verts += new_surf->num_verts;
-    rc->num_surfs += 1;
+    tr->num_verts += new_surf->num_verts;
+    tr->num_surfs += 1;
+    tr->reserved = 0;
   }
 }
 
@@ -277,6 +742,13 @@ static inline uint8_t fmulu8(uint8_t a, uint8_t b) {
     (out)[1] = (uv)[1];   \
   }
 
+#define TRACK_UV(tr, uv)                \
+  {                                     \
+    uint32_t bits[2];                   \
+    memcpy(bits, (uv), sizeof(bits));   \
+    (tr)->uv_bits |= bits[0] | bits[1]; \
+  }
+
 #define PARSE_UV16(uv, out)     \
   {                             \
     uint32_t u = (uv)[1] << 16; \
@@ -433,6 +905,11 @@ static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
   vec2_add(vd->uv, vb->uv, uv_ba);
   vec2_add(vd->uv, vd->uv, uv_bc);
 
+  TRACK_UV(tr, va->uv);
+  TRACK_UV(tr, vb->uv);
+  TRACK_UV(tr, vc->uv);
+  TRACK_UV(tr, vd->uv);
+
   /* TODO interpolate this properly when a game is found to test with */
   vd->color = va->color;
   vd->offset_color = va->offset_color;
@@ -442,6 +919,44 @@ static void tr_parse_bg(struct tr *tr, const struct ta_context *ctx,
   tr->list_type = TA_NUM_LISTS;
 }
 
+static void tr_parse_modvol_param(struct tr *tr, const struct ta_context *ctx,
+                                  struct tr_context *rc,
+                                  const union poly_param *param) {
+  if (!tr->modvol_open) {
+    tr_reserve_surf(tr, rc, 0);
+    tr->modvol_open = 1;
+  }
+
+  tr->modvol_instr = param->modvol.isp.volume_instr;
+}
+
+static void tr_parse_modvol_vert(struct tr *tr, const struct ta_context *ctx,
+                                 struct tr_context *rc,
+                                 const union vert_param *param) {
+  if (!tr->modvol_open) {
+    return;
+  }
+
+  /* only the positions of the volume's triangles are used */
+  struct ta_vertex *verts = tr_reserve_verts(tr, rc, 3);
+  memset(verts, 0, sizeof(*verts) * 3);
+
+  for (int i = 0; i < 3; i++) {
+    verts[i].xyz[0] = param->modvol.xyz[i][0];
+    verts[i].xyz[1] = param->modvol.xyz[i][1];
+    verts[i].xyz[2] = param->modvol.xyz[i][2];
+  }
+
+  if (tr->modvol_instr == VOLUME_INSIDE || tr->modvol_instr == VOLUME_OUTSIDE) {
+    struct ta_surface *surf = &rc->surfs[tr->num_surfs];
+    surf->params.volume = tr->modvol_instr;
+    tr_commit_surf(tr, rc);
+
+    tr->modvol_open = 0;
+    tr->modvol_instr = 0;
+  }
+}
+
 /* this offset color implementation is not correct at all, see the
    Texture/Shading Instruction in the union tsp instruction word */
 static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
@@ -455,7 +970,7 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
   int poly_type = ta_poly_type(param->type0.pcw);
 
   if (poly_type == 6) {
-    /* FIXME handle modifier volumes */
+    tr_parse_modvol_param(tr, ctx, rc, param);
     return;
   }
 
@@ -505,6 +1020,7 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
   surf->params.offset_color = param->type0.pcw.offset;
   surf->params.alpha_test = tr->list_type == TA_LIST_PUNCH_THROUGH;
   surf->params.alpha_ref = ctx->alpha_ref;
+  surf->params.shadow = ctx->shadow_intensity && param->type0.pcw.shadow;
 
   /* override a few surface parameters based on the list type */
   if (tr->list_type != TA_LIST_TRANSLUCENT &&
@@ -519,10 +1035,14 @@ static void tr_parse_poly_param(struct tr *tr, const struct ta_context *ctx,
     surf->params.depth_func = DEPTH_GEQUAL;
   }
 
-  surf->params.texture =
-      param->type0.pcw.texture
-          ? tr_convert_texture(tr, ctx, param->type0.tsp, param->type0.tcw)
-          : 0;
+  if (!param->type0.pcw.texture) {
+    surf->params.texture = 0;
+  } else if (tr->textures) {
+    surf->params.texture = tr->textures[tr->num_params];
+  } else {
+    surf->params.texture =
+        tr_convert_texture(tr, ctx, param->type0.tsp, param->type0.tcw);
+  }
 }
 
 static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
@@ -530,7 +1050,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
   const union vert_param *param = (const union vert_param *)data;
 
   if (tr->vert_type == 17) {
-    /* FIXME handle modifier volumes */
+    tr_parse_modvol_vert(tr, ctx, rc, param);
     return;
   }
 
@@ -565,6 +1085,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
       struct ta_vertex *vert = tr_reserve_vert(tr, rc);
       PARSE_XYZ(param->type3.xyz, vert->xyz);
       PARSE_UV(param->type3.uv, vert->uv);
+      TRACK_UV(tr, vert->uv);
       PARSE_PACKED_COLOR(param->type3.base_color, &vert->color);
       PARSE_PACKED_COLOR(param->type3.offset_color, &vert->offset_color);
     } break;
@@ -581,6 +1102,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
       struct ta_vertex *vert = tr_reserve_vert(tr, rc);
       PARSE_XYZ(param->type5.xyz, vert->xyz);
       PARSE_UV(param->type5.uv, vert->uv);
+      TRACK_UV(tr, vert->uv);
       PARSE_FLOAT_COLOR(param->type5.base_color, &vert->color);
       PARSE_FLOAT_COLOR(param->type5.offset_color, &vert->offset_color);
     } break;
@@ -597,6 +1119,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
       struct ta_vertex *vert = tr_reserve_vert(tr, rc);
       PARSE_XYZ(param->type7.xyz, vert->xyz);
       PARSE_UV(param->type7.uv, vert->uv);
+      TRACK_UV(tr, vert->uv);
       PARSE_BASE_INTENSITY(param->type7.base_intensity, &vert->color);
       PARSE_OFFSET_INTENSITY(param->type7.offset_intensity,
                              &vert->offset_color);
@@ -629,57 +1152,64 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
        * these need to be calculated, and the quad needs to be converted into a
        * tristrip to match the rest of the ta input
        */
-      struct ta_vertex *va = tr_reserve_vert(tr, rc); /* bottom left */
-      struct ta_vertex *vb = tr_reserve_vert(tr, rc); /* top left */
-      struct ta_vertex *vd = tr_reserve_vert(tr, rc); /* bottom right */
-      struct ta_vertex *vc = tr_reserve_vert(tr, rc); /* top right */
+      struct ta_vertex *quad = tr_reserve_verts(tr, rc, 4);
+      struct ta_vertex *va = &quad[0]; /* bottom left */
+      struct ta_vertex *vb = &quad[1]; /* top left */
+      struct ta_vertex *vd = &quad[2]; /* bottom right */
+      struct ta_vertex *vc = &quad[3]; /* top right */
+      uint32_t color = *(uint32_t *)&tr->sprite_color;
+      uint32_t offset_color = *(uint32_t *)&tr->sprite_offset_color;
 
       PARSE_XYZ(param->sprite1.xyz[0], va->xyz);
-      PARSE_UV16(param->sprite1.uv[0], va->uv);
-      va->color = *(uint32_t *)&tr->sprite_color;
-      va->offset_color = *(uint32_t *)&tr->sprite_offset_color;
-
       PARSE_XYZ(param->sprite1.xyz[1], vb->xyz);
-      PARSE_UV16(param->sprite1.uv[1], vb->uv);
-      vb->color = *(uint32_t *)&tr->sprite_color;
-      vb->offset_color = *(uint32_t *)&tr->sprite_offset_color;
-
       PARSE_XYZ(param->sprite1.xyz[2], vc->xyz);
-      PARSE_UV16(param->sprite1.uv[2], vc->uv);
-      vc->color = *(uint32_t *)&tr->sprite_color;
-      vc->offset_color = *(uint32_t *)&tr->sprite_offset_color;
-
       vd->xyz[0] = param->sprite1.xyz[3][0];
       vd->xyz[1] = param->sprite1.xyz[3][1];
-      vd->color = *(uint32_t *)&tr->sprite_color;
-      vd->offset_color = *(uint32_t *)&tr->sprite_offset_color;
-
-      /* calculate the sprite's plane from the three complete vertices */
-      float xyz_ba[3], xyz_bc[3];
-      float n[3], len, d;
-      vec3_sub(xyz_ba, va->xyz, vb->xyz);
-      vec3_sub(xyz_bc, vc->xyz, vb->xyz);
-      vec3_cross(n, xyz_ba, xyz_bc);
-      len = vec3_normalize(n);
-      d = vec3_dot(n, vb->xyz);
 
-      /* don't commit surf if quad is degenerate or perpendicular to our view */
-      if (len == 0.0f || n[2] == 0.0f) {
-        return;
-      }
+      va->color = vb->color = vc->color = vd->color = color;
+      va->offset_color = vb->offset_color = vc->offset_color =
+          vd->offset_color = offset_color;
 
       /*
-       * for all points on a plane, the following must hold true:
+       * for all points on the sprite's plane, the following must hold true:
        * dot(n, p) - d = 0
        *
        * using this, the missing corner's z can be solved with:
        * n.x * p.x + n.y * p.y + n.z * p.z - d = 0
        * n.x * p.x + n.y * p.y + n.z * p.z = d
        * n.z * p.z = d - n.x * p.x - n.y * p.y
-       * p.z = (d - n.x * p.y - n.y * p.y) / n.z
+       * p.z = (d - n.x * p.x - n.y * p.y) / n.z
+       *
+       * the solution doesn't depend on the length of n, so it's left
+       * unnormalized
        */
+      float xyz_ba[3], xyz_bc[3];
+      float n[3], d;
+      vec3_sub(xyz_ba, va->xyz, vb->xyz);
+      vec3_sub(xyz_bc, vc->xyz, vb->xyz);
+      vec3_cross(n, xyz_ba, xyz_bc);
+      d = vec3_dot(n, vb->xyz);
+
+      /* don't commit surf if quad is degenerate or perpendicular to our view.
+         a degenerate quad's normal is zero, failing the same test */
+      if (n[2] == 0.0f) {
+        return;
+      }
+
       vd->xyz[2] = (d - n[0] * vd->xyz[0] - n[1] * vd->xyz[1]) / n[2];
 
+      /* the untextured sprite0 has no uvs, the words they'd occupy being
+         ignored */
+      if (tr->vert_type == 15) {
+        va->uv[0] = va->uv[1] = vb->uv[0] = vb->uv[1] = 0.0f;
+        vc->uv[0] = vc->uv[1] = vd->uv[0] = vd->uv[1] = 0.0f;
+        break;
+      }
+
+      PARSE_UV16(param->sprite1.uv[0], va->uv);
+      PARSE_UV16(param->sprite1.uv[1], vb->uv);
+      PARSE_UV16(param->sprite1.uv[2], vc->uv);
+
       /* calculate the missing corner's uv */
       float uv_ba[2], uv_bc[2];
       vec2_sub(uv_ba, va->uv, vb->uv);
@@ -687,6 +1217,7 @@ static void tr_parse_vert_param(struct tr *tr, const struct ta_context *ctx,
 
       vec2_add(vd->uv, vb->uv, uv_ba);
       vec2_add(vd->uv, vd->uv, uv_bc);
+      TRACK_UV(tr, vd->uv);
     } break;
 
     default:
@@ -709,15 +1240,130 @@ static void tr_parse_eol(struct tr *tr, const struct ta_context *ctx,
   tr->last_vertex = NULL;
   tr->list_type = TA_NUM_LISTS;
   tr->vert_type = TA_NUM_VERTS;
+
+  /* a volume left open by the end of the list is dropped along with its
+     reserved surf */
+  tr->modvol_open = 0;
+  tr->modvol_instr = 0;
 }
 
-static inline int tr_can_merge_surfs(struct ta_surface *a,
+static inline int tr_can_merge_surfs(struct tr *tr, struct ta_surface *a,
                                      struct ta_surface *b) {
-  return a->params.full == b->params.full;
+  if (a->params.full == b->params.full) {
+    return 1;
+  }
+
+  /* surfs textured from the same array can be drawn together, as they each
+     carry their own layer in their vertices */
+  struct ta_surface tmp;
+  tmp.params.full = b->params.full;
+  tmp.params.texture = a->params.texture;
+
+  if (tmp.params.full != a->params.full) {
+    return 0;
+  }
+
+  int array = tr_texture_array(tr, a->params.texture, NULL);
+  return array && array == tr_texture_array(tr, b->params.texture, NULL);
+}
+
+/* finds the end of the run of surfs starting at first which can be merged into
+   a single draw, along with the number of indices needed to draw the run as
+   triangles and as strips */
+static int tr_merge_run(struct tr *tr, struct tr_context *rc,
+                        struct tr_list *list, int first, int *tri_indices,
+                        int *strip_indices) {
+  struct ta_surface *root = &rc->surfs[list->surfs[first]];
+  int num_strips = 0;
+  int i;
+
+  *tri_indices = 0;
+  *strip_indices = 0;
+
+  for (i = first; i < list->num_surfs; i++) {
+    struct ta_surface *surf = &rc->surfs[list->surfs[i]];
+
+    if (surf != root && !tr_can_merge_surfs(tr, root, surf)) {
+      break;
+    }
+
+    if (surf->num_verts < 3) {
+      continue;
+    }
+
+    /* strips starting on an even offset are lead by a degenerate triangle to
+       flip their winding order, with each strip after the first being
+       preceded by a restart index */
+    *tri_indices += (surf->num_verts - 2) * 3;
+    *strip_indices +=
+        surf->num_verts + !(surf->strip_offset & 1) + (num_strips > 0);
+    num_strips++;
+  }
+
+  return i;
+}
+
+static inline void tr_set_index(struct tr_context *rc, int i, uint32_t v) {
+  if (rc->index_size == 2) {
+    ((uint16_t *)rc->indices)[i] = (uint16_t)v;
+  } else {
+    ((uint32_t *)rc->indices)[i] = v;
+  }
+}
+
+/* triangles are culled when they can't produce any fragments, being either
+   entirely behind the eye, entirely outside of one edge of the video, or of
+   zero area. verts with a negative w are collapsed by the vertex shader, so
+   the xy tests only apply when each is in front */
+static inline int tr_cull_tri(const struct tr_context *rc,
+                              const struct ta_vertex *a,
+                              const struct ta_vertex *b,
+                              const struct ta_vertex *c) {
+  float width = (float)rc->width;
+  float height = (float)rc->height;
+
+  if (!(a->xyz[2] > 0.0f && b->xyz[2] > 0.0f && c->xyz[2] > 0.0f)) {
+    return a->xyz[2] < 0.0f && b->xyz[2] < 0.0f && c->xyz[2] < 0.0f;
+  }
+
+  int outside =
+      (a->xyz[0] < 0.0f && b->xyz[0] < 0.0f && c->xyz[0] < 0.0f) |
+      (a->xyz[0] > width && b->xyz[0] > width && c->xyz[0] > width) |
+      (a->xyz[1] < 0.0f && b->xyz[1] < 0.0f && c->xyz[1] < 0.0f) |
+      (a->xyz[1] > height && b->xyz[1] > height && c->xyz[1] > height);
+
+  float area = (b->xyz[0] - a->xyz[0]) * (c->xyz[1] - a->xyz[1]) -
+               (c->xyz[0] - a->xyz[0]) * (b->xyz[1] - a->xyz[1]);
+
+  return outside | (area == 0.0f);
+}
+
+/* strips are only culled whole, when each of their verts is behind the eye or
+   outside of the same edge of the video */
+static int tr_cull_strip(const struct tr_context *rc,
+                         const struct ta_vertex *verts, int num_verts) {
+  float width = (float)rc->width;
+  float height = (float)rc->height;
+  int behind = 1, front = 1;
+  int left = 1, right = 1, top = 1, bottom = 1;
+
+  for (int i = 0; i < num_verts; i++) {
+    const float *xyz = verts[i].xyz;
+    behind &= xyz[2] < 0.0f;
+    front &= xyz[2] > 0.0f;
+    left &= xyz[0] < 0.0f;
+    right &= xyz[0] > width;
+    top &= xyz[1] < 0.0f;
+    bottom &= xyz[1] > height;
+  }
+
+  return behind | (front & (left | right | top | bottom));
 }
 
-static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
-                                int list_type) {
+/* generates the list's indices starting at first_index, returning the index
+   following the last generated */
+static int tr_generate_indices(struct tr *tr, struct tr_context *rc,
+                               int list_type, int first_index) {
   /* polygons are fed to the TA as triangle strips, with the vertices being fed
      in a CW order, so a given quad looks like:
 
@@ -729,99 +1375,264 @@ static void tr_generate_indices(struct tr *tr, struct tr_context *rc,
      0----2----4
 
      convert from these triangle strips to triangles, and convert to CCW to
-     match OpenGL defaults */
+     match OpenGL defaults. runs of merged surfaces it's cheaper to draw as
+     strips, generally those made up of long strips in the opaque lists, are
+     instead kept as strips with a restart index in between each. triangles
+     which won't be visible are culled along the way */
   struct tr_list *list = &rc->lists[list_type];
 
   int num_merged = 0;
+  int num_indices = first_index;
+  int num_culled = 0;
 
   for (int i = 0, j = 0; i < list->num_surfs; i = j) {
     struct ta_surface *root = &rc->surfs[list->surfs[i]];
-    int first_index = rc->num_indices;
+    int root_index = num_indices;
+    int tri_indices, strip_indices;
 
     /* merge adjacent surfaces at this time */
-    for (j = i; j < list->num_surfs; j++) {
-      struct ta_surface *surf = &rc->surfs[list->surfs[j]];
+    j = tr_merge_run(tr, rc, list, i, &tri_indices, &strip_indices);
+    num_merged += j - i - 1;
+
+    int strips = strip_indices < tri_indices;
+    CHECK_LE(num_indices + MIN(tri_indices, strip_indices), rc->max_indices);
+
+    for (int k = i; k < j; k++) {
+      struct ta_surface *surf = &rc->surfs[list->surfs[k]];
+
+      if (surf->num_verts < 3) {
+        continue;
+      }
+
+      if (strips) {
+        if (tr_cull_strip(rc, &rc->verts[surf->first_vert], surf->num_verts)) {
+          num_culled += surf->num_verts - 2;
+          continue;
+        }
+
+        /* a GL strip's first triangle is wound the same as the TA strip's
+           even triangles, being CW. skip ahead to the odd triangles of the GL
+           strip when the TA strip starts on an even triangle */
+        if (num_indices != root_index) {
+          tr_set_index(rc, num_indices++, 0xffffffff);
+        }
 
-      if (surf != root) {
-        if (!tr_can_merge_surfs(root, surf)) {
-          break;
+        if (!(surf->strip_offset & 1)) {
+          tr_set_index(rc, num_indices++, surf->first_vert);
         }
 
-        num_merged++;
+        for (int v = 0; v < surf->num_verts; v++) {
+          tr_set_index(rc, num_indices++, surf->first_vert + v);
+        }
+        continue;
       }
 
-      int num_indices = (surf->num_verts - 2) * 3;
-      CHECK_LT(rc->num_indices + num_indices, ARRAY_SIZE(rc->indices));
+      for (int v = 0; v < surf->num_verts - 2; v++) {
+        int strip_offset = surf->strip_offset + v;
+        int vertex_offset = surf->first_vert + v;
+        const struct ta_vertex *tri = &rc->verts[vertex_offset];
 
-      for (int j = 0; j < surf->num_verts - 2; j++) {
-        int strip_offset = surf->strip_offset + j;
-        int vertex_offset = surf->first_vert + j;
+        if (tr_cull_tri(rc, &tri[0], &tri[1], &tri[2])) {
+          num_culled++;
+          continue;
+        }
 
         /* be careful to maintain a CCW winding order */
         if (strip_offset & 1) {
-          rc->indices[rc->num_indices++] = vertex_offset + 0;
-          rc->indices[rc->num_indices++] = vertex_offset + 1;
-          rc->indices[rc->num_indices++] = vertex_offset + 2;
+          tr_set_index(rc, num_indices++, vertex_offset + 0);
+          tr_set_index(rc, num_indices++, vertex_offset + 1);
+          tr_set_index(rc, num_indices++, vertex_offset + 2);
         } else {
-          rc->indices[rc->num_indices++] = vertex_offset + 0;
-          rc->indices[rc->num_indices++] = vertex_offset + 2;
-          rc->indices[rc->num_indices++] = vertex_offset + 1;
+          tr_set_index(rc, num_indices++, vertex_offset + 0);
+          tr_set_index(rc, num_indices++, vertex_offset + 2);
+          tr_set_index(rc, num_indices++, vertex_offset + 1);
         }
       }
     }
 
-    /* update to point at triangle indices instead of the raw tristrip verts */
-    root->first_vert = first_index;
-    root->num_verts = rc->num_indices - first_index;
+    /* update to point at the generated indices instead of the raw tristrip
+       verts */
+    root->first_vert = root_index;
+    root->num_verts = num_indices - root_index;
+    root->prim_type = strips ? PRIM_TRIANGLE_STRIP : PRIM_TRIANGLES;
+
+    /* runs culled entirely are dropped like the surfs merged into others */
+    if (num_indices == root_index) {
+      num_merged++;
+      continue;
+    }
 
     /* shift the list to account for merges */
     list->surfs[j - num_merged - 1] = list->surfs[i];
   }
 
   list->num_surfs -= num_merged;
+
+  prof_counter_add(COUNTER_culled_tris, num_culled);
+
+  return num_indices;
+}
+
+/* modifier volumes are drawn straight from their verts, and aren't indexed */
+static inline int tr_list_modvol(int list_type) {
+  return list_type == TA_LIST_OPAQUE_MODVOL ||
+         list_type == TA_LIST_TRANSLUCENT_MODVOL;
 }
 
-static int sort_tmp[TR_MAX_SURFS];
-static float sort_minz[TR_MAX_SURFS];
+/* the list's surfs are only ever reordered by sorting, which only applies to
+   lists made up entirely of triangles. as triangles are always drawn as such,
+   the count is the same before and after sorting */
+static int tr_count_indices(struct tr *tr, struct tr_context *rc,
+                            int list_type) {
+  struct tr_list *list = &rc->lists[list_type];
+  int num_indices = 0;
+
+  if (tr_list_modvol(list_type)) {
+    return 0;
+  }
+
+  for (int i = 0; i < list->num_surfs;) {
+    int tri_indices, strip_indices;
+    i = tr_merge_run(tr, rc, list, i, &tri_indices, &strip_indices);
+    num_indices += MIN(tri_indices, strip_indices);
+  }
 
-static int tr_compare_surf(const void *a, const void *b) {
-  int i = *(const int *)a;
-  int j = *(const int *)b;
-  return sort_minz[i] <= sort_minz[j];
+  return num_indices;
 }
 
 static void tr_sort_surfaces(struct tr *tr, struct tr_context *rc,
-                             int list_type) {
+                             int list_type, int first_sort) {
   struct tr_list *list = &rc->lists[list_type];
+  uint64_t *keys = &tr->cvt->sort_keys[first_sort];
 
-  /* sort each surface from back to front based on its minz */
+  /* sort each surface from back to front based on its minz, with the minz
+     embedded above the surf index in each key */
   for (int i = 0; i < list->num_surfs; i++) {
     int surf_index = list->surfs[i];
     struct ta_surface *surf = &rc->surfs[surf_index];
-    float *minz = &sort_minz[surf_index];
 
     struct ta_vertex *verts = &rc->verts[surf->first_vert];
     CHECK_EQ(surf->num_verts, 3);
 
-    *minz = MIN(verts[0].xyz[2], verts[1].xyz[2]);
-    *minz = MIN(*minz, verts[2].xyz[2]);
+    float minz = MIN(verts[0].xyz[2], verts[1].xyz[2]);
+    minz = MIN(minz, verts[2].xyz[2]);
+
+    keys[i] = ((uint64_t)rsort_float_key(minz) << 32) | (uint32_t)surf_index;
   }
 
-  msort_noalloc(list->surfs, sort_tmp, list->num_surfs, sizeof(int),
-                &tr_compare_surf);
+  rsort_noalloc(keys, &tr->cvt->sort_tmp[first_sort], list->num_surfs);
+
+  for (int i = 0; i < list->num_surfs; i++) {
+    list->surfs[i] = (int)(uint32_t)keys[i];
+  }
 }
 
-static void tr_reset(struct tr *tr, struct tr_context *rc) {
-  /* reset global state */
-  tr->last_vertex = NULL;
-  tr->list_type = TA_NUM_LISTS;
+/* the opaque list is depth tested, so its surfaces can generally be drawn in
+   any order. they're sorted by the render state they're drawn with, the
+   program first, followed by the texture and then the remaining state, to
+   both merge more of them and minimize the state changes between draws. the
+   key doesn't hold all of the state, which only costs some merges */
+static void tr_sort_opaque(struct tr_converter *cvt, struct tr_context *rc) {
+  struct tr_list *list = &rc->lists[TA_LIST_OPAQUE];
+  uint64_t *keys = cvt->sort_keys;
+
+  for (int i = 0; i < list->num_surfs; i++) {
+    int surf_index = list->surfs[i];
+    struct ta_surface *surf = &rc->surfs[surf_index];
+
+    uint32_t program = (surf->params.shade << 5) |
+                       ((surf->params.texture != 0) << 4) |
+                       (surf->params.ignore_alpha << 3) |
+                       (surf->params.ignore_texture_alpha << 2) |
+                       (surf->params.offset_color << 1) |
+                       surf->params.alpha_test;
+    uint32_t key = (program << 24) | ((uint32_t)surf->params.texture << 11) |
+                   (surf->params.depth_func << 7) |
+                   (surf->params.depth_write << 6) | (surf->params.cull << 4) |
+                   surf->params.src_blend;
+
+    keys[i] = ((uint64_t)key << 32) | (uint32_t)surf_index;
+  }
+
+  rsort_noalloc(keys, cvt->sort_tmp, list->num_surfs);
+
+  for (int i = 0; i < list->num_surfs; i++) {
+    list->surfs[i] = (int)(uint32_t)keys[i];
+  }
+}
+
+static void tr_reset(struct tr *tr, struct tr_context *rc) {
+  /* reset global state */
+  tr->last_vertex = NULL;
+  tr->list_type = TA_NUM_LISTS;
   tr->vert_type = TA_NUM_VERTS;
   memset(tr->face_color, 0, sizeof(tr->face_color));
   memset(tr->face_offset_color, 0, sizeof(tr->face_offset_color));
   memset(tr->sprite_color, 0, sizeof(tr->sprite_color));
   memset(tr->sprite_offset_color, 0, sizeof(tr->sprite_offset_color));
 
-  /* reset render context state */
+  /* reset ranges to span the entire context */
+  tr->surf_base = tr->num_surfs = rc->num_surfs;
+  tr->max_surfs = rc->max_surfs;
+  tr->vert_base = tr->num_verts = rc->num_verts;
+  tr->max_verts = rc->max_verts;
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    tr->list_base[i] = tr->num_list_surfs[i] = rc->lists[i].num_surfs;
+    tr->num_orig_surfs[i] = 0;
+  }
+  tr->num_params = rc->num_params;
+  tr->reserved = 0;
+  tr->modvol_open = 0;
+  tr->modvol_instr = 0;
+  tr->uv_bits = 0;
+}
+
+/* grows array to hold at least num elements, up to limit. the array's contents
+   aren't preserved, each array being reset before a context is converted */
+static void *tr_reserve_array(void *data, int *max, int num, int limit,
+                              int elem_size) {
+  if (num <= *max) {
+    return data;
+  }
+
+  *max = MIN(MAX(*max * 2, num), limit);
+
+  free(data);
+  data = malloc(*max * elem_size);
+  CHECK_NOTNULL(data);
+
+  return data;
+}
+
+/* sizes the context's arrays from an upper bound of what the param stream can
+   generate. each param is at least 32 bytes, and generates at most 4 verts,
+   with each vert committing at most a surf */
+static void tr_reserve_context(struct tr_context *rc,
+                               const struct ta_context *ctx) {
+  int num_params = MIN(ctx->size / 32 + 1, TA_MAX_PARAMS);
+  /* the background adds a surf and 4 verts on top of the params */
+  int num_verts = MIN(num_params * 4 + 4, TR_MAX_VERTS);
+  int num_surfs = MIN(num_verts + num_params + 1, TR_MAX_SURFS);
+  int max_surfs = rc->max_surfs;
+
+  rc->params = tr_reserve_array(rc->params, &rc->max_params, num_params,
+                                TA_MAX_PARAMS, sizeof(rc->params[0]));
+  rc->verts = tr_reserve_array(rc->verts, &rc->max_verts, num_verts,
+                               TR_MAX_VERTS, sizeof(rc->verts[0]));
+  rc->surfs = tr_reserve_array(rc->surfs, &rc->max_surfs, num_surfs,
+                               TR_MAX_SURFS, sizeof(rc->surfs[0]));
+
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    struct tr_list *list = &rc->lists[i];
+    int max_list_surfs = max_surfs;
+    list->surfs = tr_reserve_array(list->surfs, &max_list_surfs, rc->max_surfs,
+                                   TR_MAX_SURFS, sizeof(list->surfs[0]));
+  }
+}
+
+static void tr_reset_context(struct tr_context *rc) {
+  rc->palette_banks = 0;
+  rc->uv_bits = 0;
   rc->num_params = 0;
   rc->num_surfs = 0;
   rc->num_verts = 0;
@@ -833,13 +1644,597 @@ static void tr_reset(struct tr *tr, struct tr_context *rc) {
   }
 }
 
+/* moves the ranges written to by tr onto the end of the context */
+static void tr_commit_ranges(struct tr *tr, struct tr_context *rc) {
+  int num_surfs = tr->num_surfs - tr->surf_base;
+  int num_verts = tr->num_verts - tr->vert_base;
+  int surf_delta = rc->num_surfs - tr->surf_base;
+  int vert_delta = rc->num_verts - tr->vert_base;
+
+  if (surf_delta) {
+    memmove(&rc->surfs[rc->num_surfs], &rc->surfs[tr->surf_base],
+            num_surfs * sizeof(rc->surfs[0]));
+  }
+
+  if (vert_delta) {
+    memmove(&rc->verts[rc->num_verts], &rc->verts[tr->vert_base],
+            num_verts * sizeof(rc->verts[0]));
+
+    for (int i = 0; i < num_surfs; i++) {
+      rc->surfs[rc->num_surfs + i].first_vert += vert_delta;
+    }
+  }
+
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    struct tr_list *list = &rc->lists[i];
+    int num_list_surfs = tr->num_list_surfs[i] - tr->list_base[i];
+    int *src = &list->surfs[tr->list_base[i]];
+    int *dst = &list->surfs[list->num_surfs];
+
+    for (int j = 0; j < num_list_surfs; j++) {
+      dst[j] = src[j] + surf_delta;
+    }
+
+    list->num_surfs += num_list_surfs;
+    list->num_orig_surfs += tr->num_orig_surfs[i];
+  }
+
+  if (surf_delta || vert_delta) {
+    for (int i = rc->num_params; i < tr->num_params; i++) {
+      struct tr_param *rp = &rc->params[i];
+      rp->last_surf += surf_delta;
+      rp->last_vert += vert_delta;
+    }
+  }
+
+  rc->num_surfs += num_surfs;
+  rc->num_verts += num_verts;
+  rc->num_params = tr->num_params;
+  rc->uv_bits |= tr->uv_bits;
+}
+
+static void tr_parse_params(struct tr *tr, const struct ta_context *ctx,
+                            struct tr_context *rc, const uint8_t *data,
+                            const uint8_t *end) {
+  while (data < end) {
+    union pcw pcw = *(union pcw *)data;
+
+    if (ta_pcw_list_type_valid(pcw, tr->list_type)) {
+      tr->list_type = pcw.list_type;
+    }
+
+    switch (pcw.para_type) {
+      /* control params */
+      case TA_PARAM_END_OF_LIST:
+        tr_parse_eol(tr, ctx, rc, data);
+        break;
+
+      case TA_PARAM_USER_TILE_CLIP:
+        break;
+
+      case TA_PARAM_OBJ_LIST_SET:
+        LOG_FATAL("TA_PARAM_OBJ_LIST_SET unsupported");
+        break;
+
+      /* global params */
+      case TA_PARAM_POLY_OR_VOL:
+      case TA_PARAM_SPRITE:
+        tr_parse_poly_param(tr, ctx, rc, data);
+        break;
+
+      /* vertex params */
+      case TA_PARAM_VERTEX:
+        tr_parse_vert_param(tr, ctx, rc, data);
+        break;
+    }
+
+    /* track info about the parse state for tracer debugging */
+    struct tr_param *rp = &rc->params[tr->num_params++];
+    rp->offset = (int)(data - ctx->params);
+    rp->list_type = tr->list_type;
+    rp->vert_type = tr->vert_type;
+    rp->last_surf = tr->num_surfs - 1;
+    rp->last_vert = tr->num_verts - 1;
+
+    data += ta_param_size(pcw, tr->vert_type);
+  }
+}
+
+/*
+ * parallel conversion
+ */
+static void *tr_worker_thread(void *data) {
+  struct tr_worker *worker = data;
+
+  mutex_lock(worker->mutex);
+
+  while (1) {
+    while (!worker->shutdown && !worker->pending) {
+      cond_wait(worker->work_cond, worker->mutex);
+    }
+
+    if (worker->shutdown) {
+      break;
+    }
+
+    mutex_unlock(worker->mutex);
+
+    for (int i = worker->first_job; i < worker->num_jobs;
+         i += worker->stride) {
+      worker->job(worker->data, i);
+
+      mutex_lock(worker->mutex);
+      worker->next_job = i + worker->stride;
+      cond_signal(worker->done_cond);
+      mutex_unlock(worker->mutex);
+    }
+
+    mutex_lock(worker->mutex);
+    worker->pending = 0;
+    cond_signal(worker->done_cond);
+  }
+
+  mutex_unlock(worker->mutex);
+
+  return NULL;
+}
+
+static void tr_create_workers(struct tr_converter *cvt) {
+  if (cvt->workers_created) {
+    return;
+  }
+
+  for (int i = 0; i < TR_NUM_WORKERS; i++) {
+    struct tr_worker *worker = &cvt->workers[i];
+    worker->mutex = mutex_create();
+    worker->work_cond = cond_create();
+    worker->done_cond = cond_create();
+    worker->thread = thread_create(&tr_worker_thread, NULL, worker);
+    CHECK_NOTNULL(worker->thread);
+  }
+
+  cvt->workers_created = 1;
+}
+
+static void tr_destroy_workers(struct tr_converter *cvt) {
+  if (!cvt->workers_created) {
+    return;
+  }
+
+  for (int i = 0; i < TR_NUM_WORKERS; i++) {
+    struct tr_worker *worker = &cvt->workers[i];
+
+    mutex_lock(worker->mutex);
+    worker->shutdown = 1;
+    cond_signal(worker->work_cond);
+    mutex_unlock(worker->mutex);
+
+    thread_join(worker->thread, NULL);
+
+    cond_destroy(worker->done_cond);
+    cond_destroy(worker->work_cond);
+    mutex_destroy(worker->mutex);
+  }
+
+  cvt->workers_created = 0;
+}
+
+/* runs each job, striped across the workers and the calling thread, returning
+   once they've all completed */
+static void tr_run_jobs(struct tr_converter *cvt, tr_job_cb job, void *data,
+                        int num_jobs) {
+  int num_threads = MIN(num_jobs, TR_NUM_WORKERS + 1);
+
+  tr_create_workers(cvt);
+
+  for (int i = 1; i < num_threads; i++) {
+    struct tr_worker *worker = &cvt->workers[i - 1];
+
+    mutex_lock(worker->mutex);
+    worker->job = job;
+    worker->data = data;
+    worker->first_job = i;
+    worker->num_jobs = num_jobs;
+    worker->stride = num_threads;
+    worker->next_job = i;
+    worker->pending = 1;
+    cond_signal(worker->work_cond);
+    mutex_unlock(worker->mutex);
+  }
+
+  for (int i = 0; i < num_jobs; i += num_threads) {
+    job(data, i);
+  }
+
+  for (int i = 1; i < num_threads; i++) {
+    struct tr_worker *worker = &cvt->workers[i - 1];
+
+    mutex_lock(worker->mutex);
+    while (worker->pending) {
+      cond_wait(worker->done_cond, worker->mutex);
+    }
+    mutex_unlock(worker->mutex);
+  }
+}
+
+/* starts each job, striped across the workers alone, returning immediately.
+   the calling thread is free to go on with other work, waiting on each job's
+   result with tr_wait_job */
+static void tr_start_jobs(struct tr_converter *cvt, tr_job_cb job,
+                          void *data, int num_jobs) {
+  tr_create_workers(cvt);
+
+  for (int i = 0; i < TR_NUM_WORKERS; i++) {
+    struct tr_worker *worker = &cvt->workers[i];
+
+    mutex_lock(worker->mutex);
+    worker->job = job;
+    worker->data = data;
+    worker->first_job = i;
+    worker->num_jobs = num_jobs;
+    worker->stride = TR_NUM_WORKERS;
+    worker->next_job = i;
+    worker->pending = 1;
+    cond_signal(worker->work_cond);
+    mutex_unlock(worker->mutex);
+  }
+}
+
+static void tr_wait_job(struct tr_converter *cvt, int index) {
+  struct tr_worker *worker = &cvt->workers[index % TR_NUM_WORKERS];
+
+  mutex_lock(worker->mutex);
+  while (worker->pending && worker->next_job <= index) {
+    cond_wait(worker->done_cond, worker->mutex);
+  }
+  mutex_unlock(worker->mutex);
+}
+
+static void tr_wait_jobs(struct tr_converter *cvt) {
+  for (int i = 0; i < TR_NUM_WORKERS; i++) {
+    struct tr_worker *worker = &cvt->workers[i];
+
+    mutex_lock(worker->mutex);
+    while (worker->pending) {
+      cond_wait(worker->done_cond, worker->mutex);
+    }
+    mutex_unlock(worker->mutex);
+  }
+}
+
+static void tr_queue_decode(struct tr *tr, const struct ta_context *ctx,
+                            union tsp tsp, union tcw tcw) {
+  struct tr_converter *cvt = tr->cvt;
+  struct tr_texture *entry = tr->find_texture(tr->userdata, tsp, tcw);
+  CHECK_NOTNULL(entry);
+
+  if ((entry->handle && !entry->dirty) || entry->decode ||
+      cvt->num_decodes >= TR_MAX_DECODES) {
+    return;
+  }
+
+  /* textures that don't fit in the worker's buffer are left to be decoded
+     inline */
+  int index = cvt->num_decodes;
+  struct tr_decode *dec = &cvt->decodes[index];
+  struct tr_decode_buffer *buf = &cvt->decode_buffers[index % TR_NUM_WORKERS];
+
+  tr_init_decode(cvt, dec, entry, ctx, tsp, tcw, NULL);
+
+  int size = tr_decode_size(dec);
+  if (buf->used + size > TR_MAX_DECODE_BUFFER) {
+    return;
+  }
+
+  dec->offset = buf->used;
+  buf->used += size;
+
+  entry->decode = ++cvt->num_decodes;
+}
+
+/* queues up each new or dirty texture referenced by the context's poly params
+   to be decoded by the workers, while the context is parsed. returns the
+   number of textures queued */
+static int tr_queue_decodes(struct tr *tr, const struct ta_context *ctx) {
+  struct tr_converter *cvt = tr->cvt;
+  const uint8_t *data = ctx->params;
+  const uint8_t *end = ctx->params + ctx->size;
+  int vert_type = TA_NUM_VERTS;
+
+  cvt->num_decodes = 0;
+
+  for (int i = 0; i < TR_NUM_WORKERS; i++) {
+    cvt->decode_buffers[i].used = 0;
+  }
+
+  while (data < end) {
+    union pcw pcw = *(union pcw *)data;
+
+    if (pcw.para_type == TA_PARAM_POLY_OR_VOL ||
+        pcw.para_type == TA_PARAM_SPRITE) {
+      const union poly_param *param = (const union poly_param *)data;
+      vert_type = ta_vert_type(pcw);
+
+      if (ta_poly_type(pcw) != 6 && pcw.texture) {
+        tr_queue_decode(tr, ctx, param->type0.tsp, param->type0.tcw);
+      }
+    }
+
+    data += ta_param_size(pcw, vert_type);
+
+    if (pcw.para_type == TA_PARAM_END_OF_LIST) {
+      vert_type = TA_NUM_VERTS;
+    }
+  }
+
+  if (!cvt->num_decodes) {
+    return 0;
+  }
+
+  /* the buffers only ever grow, the decodes are pointed into them once
+     they've been sized for this context */
+  for (int i = 0; i < TR_NUM_WORKERS; i++) {
+    struct tr_decode_buffer *buf = &cvt->decode_buffers[i];
+
+    if (buf->used > buf->size) {
+      buf->size = buf->used;
+      buf->data = realloc(buf->data, buf->size);
+      CHECK_NOTNULL(buf->data);
+    }
+  }
+
+  for (int i = 0; i < cvt->num_decodes; i++) {
+    struct tr_decode *dec = &cvt->decodes[i];
+    dec->data = cvt->decode_buffers[i % TR_NUM_WORKERS].data + dec->offset;
+  }
+
+  tr_start_jobs(cvt, &tr_decode_job, cvt->decodes, cvt->num_decodes);
+
+  return cvt->num_decodes;
+}
+
+/* uploads any queued textures that weren't referenced while parsing */
+static void tr_finish_decodes(struct tr *tr) {
+  struct tr_converter *cvt = tr->cvt;
+
+  tr_wait_jobs(cvt);
+
+  for (int i = 0; i < cvt->num_decodes; i++) {
+    struct tr_decode *dec = &cvt->decodes[i];
+
+    if (dec->entry->decode) {
+      dec->entry->decode = 0;
+      tr_upload_texture(tr, dec);
+    }
+  }
+
+  cvt->num_decodes = 0;
+}
+
+/* splits the param stream into segments at each end of list param, converting
+   textures ahead of time so the segments can be parsed without calling into
+   the render backend. ranges are carved out of the context for each
+   segment from an upper bound of the surfs and verts it could write. returns
+   0 if the stream can't be split */
+static int tr_split_params(struct tr *tr, const struct ta_context *ctx,
+                           struct tr_context *rc, int *num_segments) {
+  const uint8_t *data = ctx->params;
+  const uint8_t *end = ctx->params + ctx->size;
+  int list_type = TA_NUM_LISTS;
+  int vert_type = TA_NUM_VERTS;
+  int param_index = rc->num_params;
+  int surf_base = rc->num_surfs;
+  int vert_base = rc->num_verts;
+  int list_base[TA_NUM_LISTS];
+  int n = 0;
+
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    list_base[i] = rc->lists[i].num_surfs;
+  }
+
+  while (data < end) {
+    if (n >= TR_MAX_SEGMENTS) {
+      return 0;
+    }
+
+    struct tr_segment *seg = &tr->cvt->segments[n++];
+    int max_verts = 0;
+    int strip_verts = 0;
+
+    seg->ctx = ctx;
+    seg->rc = rc;
+    seg->begin = data;
+    seg->first_param = param_index;
+    seg->list_type = TA_NUM_LISTS;
+
+    while (data < end) {
+      union pcw pcw = *(union pcw *)data;
+
+      if (ta_pcw_list_type_valid(pcw, list_type)) {
+        list_type = pcw.list_type;
+        seg->list_type = list_type;
+      }
+
+      if (pcw.para_type == TA_PARAM_POLY_OR_VOL ||
+          pcw.para_type == TA_PARAM_SPRITE) {
+        const union poly_param *param = (const union poly_param *)data;
+        vert_type = ta_vert_type(pcw);
+
+        if (ta_poly_type(pcw) != 6 && pcw.texture) {
+          tr->cvt->textures[param_index] =
+              tr_convert_texture(tr, ctx, param->type0.tsp, param->type0.tcw);
+        }
+
+        /* verts of an unterminated strip are overwritten by the next */
+        max_verts += strip_verts;
+        strip_verts = 0;
+      } else if (pcw.para_type == TA_PARAM_VERTEX && vert_type != 17) {
+        strip_verts += (vert_type == 15 || vert_type == 16) ? 4 : 1;
+
+        /* strips shorter than a triangle still commit two verts */
+        if (pcw.end_of_strip) {
+          max_verts += MAX(strip_verts, 2);
+          strip_verts = 0;
+        }
+      }
+
+      param_index++;
+      data += ta_param_size(pcw, vert_type);
+
+      if (pcw.para_type == TA_PARAM_END_OF_LIST) {
+        list_type = TA_NUM_LISTS;
+        vert_type = TA_NUM_VERTS;
+        break;
+      }
+    }
+
+    max_verts += strip_verts;
+
+    /* each strip commits at most a surf per vert, with a final surf being
+       reserved but never committed */
+    int max_surfs = max_verts + 1;
+
+    seg->end = data;
+    seg->num_params = param_index - seg->first_param;
+
+    struct tr *str = &seg->tr;
+    *str = *tr;
+    str->textures = tr->cvt->textures;
+    str->surf_base = str->num_surfs = surf_base;
+    str->max_surfs = surf_base + max_surfs;
+    str->vert_base = str->num_verts = vert_base;
+    str->max_verts = vert_base + max_verts;
+    str->num_params = seg->first_param;
+    for (int i = 0; i < TA_NUM_LISTS; i++) {
+      str->list_base[i] = str->num_list_surfs[i] = list_base[i];
+      str->num_orig_surfs[i] = 0;
+    }
+
+    surf_base += max_surfs;
+    vert_base += max_verts;
+    if (seg->list_type != TA_NUM_LISTS) {
+      list_base[seg->list_type] += max_surfs;
+    }
+
+    if (surf_base > rc->max_surfs || vert_base > rc->max_verts ||
+        param_index > rc->max_params) {
+      return 0;
+    }
+  }
+
+  *num_segments = n;
+
+  return 1;
+}
+
+static void tr_parse_segment(void *data, int index) {
+  struct tr_segment *seg = &((struct tr_segment *)data)[index];
+  tr_parse_params(&seg->tr, seg->ctx, seg->rc, seg->begin, seg->end);
+}
+
+struct tr_list_jobs {
+  struct tr *tr;
+  const struct ta_context *ctx;
+  struct tr_context *rc;
+  int first_index[TA_NUM_LISTS];
+  int end_index[TA_NUM_LISTS];
+  int first_sort[TA_NUM_LISTS];
+};
+
+static void tr_finish_list(void *data, int list_type) {
+  struct tr_list_jobs *jobs = data;
+
+  if (tr_list_modvol(list_type)) {
+    jobs->end_index[list_type] = jobs->first_index[list_type];
+    return;
+  }
+
+  /* sort surfaces if requested */
+  if (jobs->ctx->autosort &&
+      ((list_type == TA_LIST_TRANSLUCENT && !jobs->rc->oit) ||
+       list_type == TA_LIST_PUNCH_THROUGH)) {
+    tr_sort_surfaces(jobs->tr, jobs->rc, list_type,
+                     jobs->first_sort[list_type]);
+  }
+
+  jobs->end_index[list_type] = tr_generate_indices(
+      jobs->tr, jobs->rc, list_type, jobs->first_index[list_type]);
+}
+
+/* each list is sorted and indexed independently, with each being given its
+   own range of the context's indices */
+static void tr_finish_lists(struct tr *tr, const struct ta_context *ctx,
+                            struct tr_context *rc, int parallel) {
+  struct tr_list_jobs jobs;
+  jobs.tr = tr;
+  jobs.ctx = ctx;
+  jobs.rc = rc;
+
+  int num_indices = 0;
+  int num_sorted = 0;
+
+  /* unlike the other sorts, this changes which surfs are merged, so it has to
+     happen before the indices are counted */
+  if (OPTION_sort_opaque) {
+    tr_sort_opaque(tr->cvt, rc);
+  }
+
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    jobs.first_index[i] = num_indices;
+    jobs.first_sort[i] = num_sorted;
+    num_indices += tr_count_indices(tr, rc, i);
+    num_sorted += rc->lists[i].num_surfs;
+  }
+
+  CHECK_LE(num_indices, TR_MAX_INDICES);
+  rc->indices = tr_reserve_array(rc->indices, &rc->max_indices, num_indices,
+                                 TR_MAX_INDICES, sizeof(uint32_t));
+
+  /* the maximum index of each size is reserved for restarting strips */
+  rc->index_size = rc->num_verts <= 0xffff ? 2 : 4;
+
+  if (parallel) {
+    tr_run_jobs(tr->cvt, &tr_finish_list, &jobs, TA_NUM_LISTS);
+  } else {
+    for (int i = 0; i < TA_NUM_LISTS; i++) {
+      tr_finish_list(&jobs, i);
+    }
+  }
+
+  /* each list was given room for all of its indices, close the gaps left
+     between them by those culled */
+  num_indices = 0;
+
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    struct tr_list *list = &rc->lists[i];
+    int first = jobs.first_index[i];
+    int count = jobs.end_index[i] - first;
+
+    if (first != num_indices && !tr_list_modvol(i)) {
+      uint8_t *indices = rc->indices;
+      memmove(indices + num_indices * rc->index_size,
+              indices + first * rc->index_size, count * rc->index_size);
+
+      for (int j = 0; j < list->num_surfs; j++) {
+        rc->surfs[list->surfs[j]].first_vert -= first - num_indices;
+      }
+    }
+
+    num_indices += count;
+  }
+
+  rc->num_indices = num_indices;
+}
+
 static void tr_render_list(struct render_backend *r,
                            const struct tr_context *rc, int list_type,
-                           int end_surf, int *stopped) {
+                           enum gpu_pass pass, int end_surf, int *stopped) {
   if (*stopped) {
     return;
   }
 
+  r_begin_ta_pass(r, pass);
+
   const struct tr_list *list = &rc->lists[list_type];
   const int *sorted_surf = list->surfs;
   const int *sorted_surf_end = list->surfs + list->num_surfs;
@@ -856,94 +2251,223 @@ static void tr_render_list(struct render_backend *r,
   }
 }
 
+/* the opaque list's modifier volumes shadow the opaque and punch through
+   surfaces drawn before them. those of the translucent list aren't drawn */
+static void tr_render_modvols(struct render_backend *r,
+                              const struct tr_context *rc, int end_surf,
+                              int *stopped) {
+  const struct tr_list *list = &rc->lists[TA_LIST_OPAQUE_MODVOL];
+
+  r_begin_ta_modvols(r);
+
+  for (int i = 0; i < list->num_surfs && !*stopped; i++) {
+    int surf = list->surfs[i];
+
+    r_draw_ta_modvol(r, &rc->surfs[surf]);
+
+    if (surf == end_surf) {
+      *stopped = 1;
+    }
+  }
+
+  r_end_ta_modvols(r, rc->shadow_scale);
+}
+
+static inline int tr_surf_oit(const struct ta_surface *surf) {
+  return surf->params.src_blend == BLEND_SRC_ALPHA &&
+         surf->params.dst_blend == BLEND_ONE_MINUS_SRC_ALPHA;
+}
+
+/* alpha blended surfaces are blended order independently, the rest being
+   drawn over them afterwards. these are commonly additive, which is order
+   independent itself, but is no longer correctly ordered against the alpha
+   blended surfaces */
+static void tr_render_oit_list(struct render_backend *r,
+                               const struct tr_context *rc, int end_surf,
+                               int *stopped) {
+  if (*stopped) {
+    return;
+  }
+
+  r_begin_ta_pass(r, GPU_PASS_TRANSLUCENT);
+
+  const struct tr_list *list = &rc->lists[TA_LIST_TRANSLUCENT];
+  int num_surfs = list->num_surfs;
+
+  for (int i = 0; i < list->num_surfs; i++) {
+    if (list->surfs[i] == end_surf) {
+      num_surfs = i + 1;
+      *stopped = 1;
+      break;
+    }
+  }
+
+  r_begin_ta_oit(r);
+
+  for (int i = 0; i < num_surfs; i++) {
+    const struct ta_surface *surf = &rc->surfs[list->surfs[i]];
+
+    if (tr_surf_oit(surf)) {
+      r_draw_ta_surface(r, surf);
+    }
+  }
+
+  r_end_ta_oit(r);
+
+  for (int i = 0; i < num_surfs; i++) {
+    const struct ta_surface *surf = &rc->surfs[list->surfs[i]];
+
+    if (!tr_surf_oit(surf)) {
+      r_draw_ta_surface(r, surf);
+    }
+  }
+}
+
 void tr_render_context_until(struct render_backend *r,
                              const struct tr_context *rc, int end_surf) {
   int stopped = 0;
 
+  PROF_ENTER(tr_render_context);
+
+  if (rc->palette_banks) {
+    r_upload_palette(r, rc->palette, rc->palette_format);
+  }
+
   r_begin_ta_surfaces(r, rc->width, rc->height, rc->verts, rc->num_verts,
-                      rc->indices, rc->num_indices);
+                      rc->compact, rc->indices, rc->num_indices,
+                      rc->index_size);
 
-  tr_render_list(r, rc, TA_LIST_OPAQUE, end_surf, &stopped);
-  tr_render_list(r, rc, TA_LIST_PUNCH_THROUGH, end_surf, &stopped);
-  tr_render_list(r, rc, TA_LIST_TRANSLUCENT, end_surf, &stopped);
+  int shadows = rc->shadows && r_begin_ta_shadows(r);
+
+  tr_render_list(r, rc, TA_LIST_OPAQUE, GPU_PASS_OPAQUE, end_surf, &stopped);
+  tr_render_list(r, rc, TA_LIST_PUNCH_THROUGH, GPU_PASS_PUNCH_THROUGH,
+                 end_surf, &stopped);
+  if (shadows) {
+    tr_render_modvols(r, rc, end_surf, &stopped);
+  }
+  if (rc->oit) {
+    tr_render_oit_list(r, rc, end_surf, &stopped);
+  } else {
+    tr_render_list(r, rc, TA_LIST_TRANSLUCENT, GPU_PASS_TRANSLUCENT, end_surf,
+                   &stopped);
+  }
 
   r_end_ta_surfaces(r);
+
+  PROF_LEAVE(tr_render_context);
 }
 
 void tr_render_context(struct render_backend *r, const struct tr_context *rc) {
   tr_render_context_until(r, rc, -1);
 }
 
-void tr_convert_context(struct render_backend *r, void *userdata,
-                        tr_find_texture_cb find_texture,
+void tr_free_context(struct tr_context *rc) {
+  for (int i = 0; i < TA_NUM_LISTS; i++) {
+    free(rc->lists[i].surfs);
+  }
+  free(rc->params);
+  free(rc->indices);
+  free(rc->verts);
+  free(rc->surfs);
+  memset(rc, 0, sizeof(*rc));
+}
+
+void tr_convert_context(struct tr_converter *cvt, struct render_backend *r,
+                        void *userdata, tr_find_texture_cb find_texture,
                         const struct ta_context *ctx, struct tr_context *rc) {
+  PROF_ENTER(tr_convert_context);
+
   struct tr tr;
+  tr.cvt = cvt;
   tr.r = r;
   tr.userdata = userdata;
   tr.find_texture = find_texture;
+  tr.rc = rc;
+  tr.oit = OPTION_oit && ctx->autosort && r && r_oit_supported(r);
+  tr.textures = NULL;
 
-  const uint8_t *data = ctx->params;
-  const uint8_t *end = ctx->params + ctx->size;
+  tr_load_texture_pack(cvt, r);
 
-  ta_init_tables();
-
-  tr_reset(&tr, rc);
+  tr_reserve_context(rc, ctx);
+  tr_reset_context(rc);
 
   rc->width = ctx->video_width;
   rc->height = ctx->video_height;
+  rc->palette_format = translate_palette_format(ctx->palette_fmt);
+  rc->oit = tr.oit;
+
+  /* new and dirty textures are decoded by the workers while the context is
+     parsed, with parsing only waiting on those not yet decoded once they're
+     referenced */
+  int decoding = OPTION_parallel_convert && tr_queue_decodes(&tr, ctx);
 
+  tr_reset(&tr, rc);
   tr_parse_bg(&tr, ctx, rc);
+  tr_commit_ranges(&tr, rc);
+
+  /* large contexts are split at each list, and the lists parsed in parallel */
+  int num_segments = 0;
+  int split = OPTION_parallel_convert && ctx->size >= TR_PARALLEL_MIN_SIZE &&
+              tr_split_params(&tr, ctx, rc, &num_segments);
+  int parallel = split && num_segments > 1;
+
+  /* textures have all been converted by the split, and the workers are
+     needed to parse the segments */
+  if (decoding && split) {
+    tr_finish_decodes(&tr);
+    decoding = 0;
+  }
 
-  while (data < end) {
-    union pcw pcw = *(union pcw *)data;
+  if (parallel) {
+    tr_run_jobs(cvt, &tr_parse_segment, cvt->segments, num_segments);
 
-    if (ta_pcw_list_type_valid(pcw, tr.list_type)) {
-      tr.list_type = pcw.list_type;
+    for (int i = 0; i < num_segments; i++) {
+      tr_commit_ranges(&cvt->segments[i].tr, rc);
     }
+  } else {
+    tr_reset(&tr, rc);
+    tr.textures = split ? cvt->textures : NULL;
+    tr_parse_params(&tr, ctx, rc, ctx->params, ctx->params + ctx->size);
+    tr_commit_ranges(&tr, rc);
+  }
 
-    switch (pcw.para_type) {
-      /* control params */
-      case TA_PARAM_END_OF_LIST:
-        tr_parse_eol(&tr, ctx, rc, data);
-        break;
+  if (decoding) {
+    tr_finish_decodes(&tr);
+  }
 
-      case TA_PARAM_USER_TILE_CLIP:
-        break;
+  tr_finish_lists(&tr, ctx, rc, parallel);
 
-      case TA_PARAM_OBJ_LIST_SET:
-        LOG_FATAL("TA_PARAM_OBJ_LIST_SET unsupported");
-        break;
+  rc->compact = OPTION_compact_vertices && !(rc->uv_bits & 0xffff);
 
-      /* global params */
-      case TA_PARAM_POLY_OR_VOL:
-      case TA_PARAM_SPRITE:
-        tr_parse_poly_param(&tr, ctx, rc, data);
-        break;
+  /* volumes selecting a second set of params aren't supported, leaving their
+     surfaces drawn with the first */
+  rc->shadows = ctx->shadow_intensity &&
+                rc->lists[TA_LIST_OPAQUE_MODVOL].num_surfs > 0;
+  rc->shadow_scale = ctx->shadow_scale / 256.0f;
 
-      /* vertex params */
-      case TA_PARAM_VERTEX:
-        tr_parse_vert_param(&tr, ctx, rc, data);
-        break;
-    }
+  PROF_LEAVE(tr_convert_context);
+}
 
-    /* track info about the parse state for tracer debugging */
-    struct tr_param *rp = &rc->params[rc->num_params++];
-    rp->offset = (int)(data - ctx->params);
-    rp->list_type = tr.list_type;
-    rp->vert_type = tr.vert_type;
-    rp->last_surf = rc->num_surfs - 1;
-    rp->last_vert = rc->num_verts - 1;
+void tr_converter_stats(struct tr_converter *cvt, struct tr_stats *stats) {
+  stats->textures_decoded = atomic_add64(&cvt->textures_decoded, 0);
+  stats->decode_ns = atomic_add64(&cvt->decode_ns, 0);
+}
 
-    data += ta_param_size(pcw, tr.vert_type);
-  }
+void tr_converter_destroy(struct tr_converter *cvt) {
+  tr_destroy_workers(cvt);
 
-  /* sort surfaces if requested */
-  if (ctx->autosort) {
-    tr_sort_surfaces(&tr, rc, TA_LIST_TRANSLUCENT);
-    tr_sort_surfaces(&tr, rc, TA_LIST_PUNCH_THROUGH);
+  for (int i = 0; i < TR_NUM_WORKERS; i++) {
+    free(cvt->decode_buffers[i].data);
   }
 
-  for (int i = 0; i < TA_NUM_LISTS; i++) {
-    tr_generate_indices(&tr, rc, i);
+  if (cvt->pack) {
+    texture_pack_close(cvt->pack);
   }
+
+  free(cvt);
+}
+
+struct tr_converter *tr_converter_create() {
+  struct tr_converter *cvt = calloc(1, sizeof(struct tr_converter));
+  return cvt;
 }
@@ -7,6 +7,8 @@
 struct tr;
 
 #define TR_MAX_SURFS (1024 * 64)
+#define TR_MAX_VERTS (1024 * 256)
+#define TR_MAX_INDICES (TR_MAX_VERTS * 3)
 
 typedef uint64_t tr_texture_key_t;
 
@@ -22,6 +24,9 @@ struct tr_texture {
   const uint8_t *palette;
   int palette_size;
 
+  /* hash of the source data the handle was created from */
+  uint64_t hash;
+
   /* backend info */
   enum filter_mode filter;
   enum wrap_mode wrap_u;
@@ -30,6 +35,10 @@ struct tr_texture {
   int width;
   int height;
   texture_handle_t handle;
+
+  /* 1-based index of the decode queued for the texture while converting a
+     context, 0 if none is queued */
+  int decode;
 };
 
 struct tr_param {
@@ -46,7 +55,8 @@ struct tr_param {
 };
 
 struct tr_list {
-  int surfs[TR_MAX_SURFS];
+  /* sized the same as the context's surfs */
+  int *surfs;
   int num_surfs;
 
   /* debug info */
@@ -58,22 +68,52 @@ struct tr_context {
   int width;
   int height;
 
-  /* parsed surfaces and vertices, ready to be passed to the render backend */
-  struct ta_surface surfs[TR_MAX_SURFS];
+  /* parsed surfaces and vertices, ready to be passed to the render backend.
+     each array is sized from the largest context converted so far, and reused
+     for each context converted after it */
+  struct ta_surface *surfs;
   int num_surfs;
+  int max_surfs;
 
-  struct ta_vertex verts[TR_MAX_SURFS];
+  struct ta_vertex *verts;
   int num_verts;
+  int max_verts;
 
-  uint16_t indices[TR_MAX_SURFS * 3];
+  /* indices are 16-bit unless there are too many verts to index with them, in
+     which case they're 32-bit */
+  void *indices;
+  int index_size;
   int num_indices;
+  int max_indices;
 
   /* sorted list of surfaces corresponding to each of the ta's polygon lists */
   struct tr_list lists[TA_NUM_LISTS];
 
   /* debug structures for stepping through the param stream in the tracer */
-  struct tr_param params[TA_MAX_PARAMS];
+  struct tr_param *params;
   int num_params;
+  int max_params;
+
+  /* copy of palette ram indexed textures look up their colors in, only the
+     banks referenced by the context's textures being copied into it */
+  uint32_t palette[PALETTE_NUM_ENTRIES];
+  uint64_t palette_banks;
+  enum raw_format palette_format;
+
+  /* set when the translucent list is left unsorted, to be blended order
+     independently when rendered */
+  int oit;
+
+  /* bits of every uv ORed together. the uvs of 16-bit uv vertices only set
+     the upper 16 bits, and when the lower bits are clear for the rest as well
+     compact is set for the verts to be uploaded as ta_compact_vertex */
+  uint32_t uv_bits;
+  int compact;
+
+  /* set when the opaque list's modifier volumes darken the surfaces inside of
+     them by shadow_scale, rather than selecting their second set of params */
+  int shadows;
+  float shadow_scale;
 };
 
 static inline tr_texture_key_t tr_texture_key(union tsp tsp, union tcw tcw) {
@@ -82,8 +122,37 @@ static inline tr_texture_key_t tr_texture_key(union tsp tsp, union tcw tcw) {
 
 typedef struct tr_texture *(*tr_find_texture_cb)(void *, union tsp, union tcw);
 
-void tr_convert_context(struct render_backend *r, void *userdata,
-                        tr_find_texture_cb find_texture,
+/* holds the state kept between conversions, e.g. the conversion workers and
+   the handles shared between textures. each emulator instance owns its own */
+struct tr_converter;
+
+/* running totals kept by each converter, for benchmarking it */
+struct tr_stats {
+  int64_t textures_decoded;
+  /* summed across each thread decoding, so it may exceed the wall time spent
+     converting when decoding in parallel */
+  int64_t decode_ns;
+};
+
+struct tr_converter *tr_converter_create();
+void tr_converter_destroy(struct tr_converter *cvt);
+void tr_converter_stats(struct tr_converter *cvt, struct tr_stats *stats);
+
+/* paletted textures are converted to indexed textures when their colors are
+   looked up on the gpu, in which case their palette isn't part of their
+   source data */
+int tr_texture_indexed(union tcw tcw);
+
+/* releases the entry's handle, which may be shared with other entries */
+void tr_release_texture(struct tr_converter *cvt, struct render_backend *r,
+                        struct tr_texture *entry);
+
+/* frees the arrays of a context, the context itself being owned by the
+   caller */
+void tr_free_context(struct tr_context *rc);
+
+void tr_convert_context(struct tr_converter *cvt, struct render_backend *r,
+                        void *userdata, tr_find_texture_cb find_texture,
                         const struct ta_context *ctx, struct tr_context *rc);
 void tr_render_context(struct render_backend *r, const struct tr_context *rc);
 void tr_render_context_until(struct render_backend *r,
@@ -0,0 +1,169 @@
+#include "guest/reg_stats.h"
+#include "core/sort.h"
+#include "core/time.h"
+#include "imgui.h"
+#include "options.h"
+
+/* registers listed in the debug menu */
+#define REG_STATS_MENU_ROWS 64
+
+struct reg_stats {
+  struct reg_block *blocks;
+};
+
+static int64_t reg_stat_cost(const struct reg_stat *stat) {
+  return stat->counts.read_ns + stat->counts.write_ns;
+}
+
+static int reg_stat_cmp(const void *a, const void *b) {
+  return reg_stat_cost(a) >= reg_stat_cost(b);
+}
+
+void reg_stats_register(struct reg_stats *rs, struct reg_block *block,
+                        const char *name, const struct reg_info *regs,
+                        int num_regs, struct reg_counts *counts) {
+  block->name = name;
+  block->regs = regs;
+  block->num_regs = num_regs;
+  block->counts = counts;
+  block->next = rs->blocks;
+  rs->blocks = block;
+}
+
+int reg_stats_top(struct reg_stats *rs, struct reg_stat *stats, int max) {
+  int num_regs = 0;
+  for (struct reg_block *block = rs->blocks; block; block = block->next) {
+    num_regs += block->num_regs;
+  }
+
+  struct reg_stat *all = calloc(MAX(num_regs, 1), sizeof(struct reg_stat));
+  int num_all = 0;
+
+  for (struct reg_block *block = rs->blocks; block; block = block->next) {
+    for (int i = 0; i < block->num_regs; i++) {
+      const struct reg_info *info = &block->regs[i];
+      struct reg_counts *counts = &block->counts[info->offset];
+
+      if (!counts->reads && !counts->writes) {
+        continue;
+      }
+
+      struct reg_stat *stat = &all[num_all++];
+      stat->block = block->name;
+      stat->name = info->name;
+      stat->addr = info->addr;
+      stat->counts = *counts;
+    }
+  }
+
+  msort(all, num_all, sizeof(struct reg_stat), &reg_stat_cmp);
+
+  int n = MIN(num_all, max);
+  memcpy(stats, all, n * sizeof(struct reg_stat));
+  free(all);
+
+  return n;
+}
+
+void reg_stats_reset(struct reg_stats *rs) {
+  for (struct reg_block *block = rs->blocks; block; block = block->next) {
+    for (int i = 0; i < block->num_regs; i++) {
+      const struct reg_info *info = &block->regs[i];
+      memset(&block->counts[info->offset], 0, sizeof(struct reg_counts));
+    }
+  }
+}
+
+void reg_stats_write(struct reg_stats *rs, FILE *fp, int max) {
+  struct reg_stat *stats = calloc(MAX(max, 1), sizeof(struct reg_stat));
+  int n = reg_stats_top(rs, stats, max);
+
+  for (int i = 0; i < n; i++) {
+    struct reg_stat *stat = &stats[i];
+    fprintf(fp,
+            "%s{\"block\":\"%s\",\"name\":\"%s\",\"addr\":%u,\"reads\":%" PRId64
+            ",\"writes\":%" PRId64 ",\"read_ns\":%" PRId64
+            ",\"write_ns\":%" PRId64 "}",
+            i ? "," : "", stat->block, stat->name, stat->addr,
+            stat->counts.reads, stat->counts.writes, stat->counts.read_ns,
+            stat->counts.write_ns);
+  }
+
+  free(stats);
+}
+
+#ifdef HAVE_IMGUI
+void reg_stats_debug_menu(struct reg_stats *rs) {
+  if (igBeginMainMenuBar()) {
+    if (igBeginMenu("EMU", 1)) {
+      if (igMenuItem("register stats", NULL, OPTION_reg_stats, 1)) {
+        OPTION_reg_stats = !OPTION_reg_stats;
+      }
+      igEndMenu();
+    }
+
+    igEndMainMenuBar();
+  }
+
+  if (!OPTION_reg_stats) {
+    return;
+  }
+
+  if (igBegin("register stats", NULL, 0)) {
+    struct reg_stat stats[REG_STATS_MENU_ROWS];
+    int n = reg_stats_top(rs, stats, REG_STATS_MENU_ROWS);
+
+    struct ImVec2 btn_size = {0.0f, 0.0f};
+    if (igButton("reset", btn_size)) {
+      reg_stats_reset(rs);
+    }
+
+    igColumns(6, NULL, 0);
+
+    igText("register");
+    igNextColumn();
+    igText("addr");
+    igNextColumn();
+    igText("reads");
+    igNextColumn();
+    igText("writes");
+    igNextColumn();
+    igText("host ms");
+    igNextColumn();
+    igText("ns/access");
+    igNextColumn();
+
+    for (int i = 0; i < n; i++) {
+      struct reg_stat *stat = &stats[i];
+      int64_t accesses = stat->counts.reads + stat->counts.writes;
+      int64_t cost = reg_stat_cost(stat);
+
+      igText("%s.%s", stat->block, stat->name);
+      igNextColumn();
+      igText("0x%08x", stat->addr);
+      igNextColumn();
+      igText("%" PRId64, stat->counts.reads);
+      igNextColumn();
+      igText("%" PRId64, stat->counts.writes);
+      igNextColumn();
+      igText("%.3f", cost / (double)NS_PER_MS);
+      igNextColumn();
+      igText("%.0f", cost / (double)MAX(accesses, 1));
+      igNextColumn();
+    }
+
+    igColumns(1, NULL, 0);
+
+    igEnd();
+  }
+}
+#endif
+
+void reg_stats_destroy(struct reg_stats *rs) {
+  free(rs);
+}
+
+struct reg_stats *reg_stats_create() {
+  struct reg_stats *rs = calloc(1, sizeof(struct reg_stats));
+  return rs;
+}
@@ -0,0 +1,77 @@
+#ifndef REG_STATS_H
+#define REG_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "core/core.h"
+
+/*
+ * per-register access counts
+ *
+ * the sh4, holly and pvr register dispatch count the reads and writes of each
+ * register, along with the host time spent handling them, while
+ * OPTION_reg_stats is set. each device owns the counts for its registers and
+ * registers them with its machine's reg_stats on creation
+ */
+struct reg_info {
+  int offset;
+  uint32_t addr;
+  const char *name;
+};
+
+struct reg_counts {
+  int64_t reads;
+  int64_t writes;
+  int64_t read_ns;
+  int64_t write_ns;
+};
+
+struct reg_block {
+  const char *name;
+  const struct reg_info *regs;
+  int num_regs;
+  /* indexed by register offset */
+  struct reg_counts *counts;
+  struct reg_block *next;
+};
+
+struct reg_stat {
+  const char *block;
+  const char *name;
+  uint32_t addr;
+  struct reg_counts counts;
+};
+
+struct reg_stats;
+
+struct reg_stats *reg_stats_create();
+void reg_stats_destroy(struct reg_stats *rs);
+
+/* the block and its counts are owned by the caller, and must outlive rs */
+void reg_stats_register(struct reg_stats *rs, struct reg_block *block,
+                        const char *name, const struct reg_info *regs,
+                        int num_regs, struct reg_counts *counts);
+
+/* fills in up to max of the accessed registers, most costly first, returning
+   the number filled in */
+int reg_stats_top(struct reg_stats *rs, struct reg_stat *stats, int max);
+void reg_stats_reset(struct reg_stats *rs);
+
+/* writes out the top registers as the elements of a json array */
+void reg_stats_write(struct reg_stats *rs, FILE *fp, int max);
+
+void reg_stats_debug_menu(struct reg_stats *rs);
+
+static inline void reg_stats_count_read(struct reg_counts *counts,
+                                        int64_t ns) {
+  counts->reads++;
+  counts->read_ns += ns;
+}
+
+static inline void reg_stats_count_write(struct reg_counts *counts,
+                                         int64_t ns) {
+  counts->writes++;
+  counts->write_ns += ns;
+}
+
+#endif
@@ -0,0 +1,364 @@
+#include "guest/rewind.h"
+#include "core/core.h"
+#include "core/ringbuf.h"
+#include "core/thread.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/snapshot.h"
+
+/* deltas are the xor of two captures, run-length encoded a word at a time. the
+   encoded stream is a sequence of tokens, each holding a count of zero words
+   to skip in its low half and a count of the literal words following it in its
+   high half. each delta is laid out in the ring as:
+
+     uint32_t size
+     uint32_t arena_size
+     uint32_t num_pages
+     uint32_t pages[num_pages]
+     uint32_t stream[]
+     uint32_t size
+
+   with the size repeated at the end so the newest delta can be found from the
+   ring's write pointer */
+#define REWIND_MAX_RUN 0xffff
+#define REWIND_HEADER_WORDS 3
+
+struct rewind {
+  struct dreamcast *dc;
+  int interval;
+
+  /* frames ran forward since the latest capture, or since it was restored */
+  int frames;
+
+  /* the machine is saved into capture on the emulation thread, which is then
+     folded into head by the worker, head always holding the latest capture
+     once the worker is idle */
+  struct snapshot *capture;
+  struct snapshot *head;
+  int have_head;
+
+  struct ringbuf *deltas;
+  int num_deltas;
+
+  /* worker state */
+  thread_t thread;
+  mutex_t mutex;
+  cond_t work_cond;
+  cond_t done_cond;
+  int pending;
+  int shutdown;
+
+  uint32_t *scratch;
+  int scratch_words;
+  uint32_t *page;
+};
+
+static uint32_t *rewind_encode(uint32_t *dst, const uint32_t *src, int n) {
+  int i = 0;
+
+  while (i < n) {
+    int zeros = 0;
+    while (i < n && !src[i] && zeros < REWIND_MAX_RUN) {
+      zeros++;
+      i++;
+    }
+
+    int literals = 0;
+    uint32_t *token = dst++;
+    while (i < n && src[i] && literals < REWIND_MAX_RUN) {
+      *(dst++) = src[i++];
+      literals++;
+    }
+
+    *token = (uint32_t)zeros | ((uint32_t)literals << 16);
+  }
+
+  return dst;
+}
+
+static const uint32_t *rewind_decode(uint32_t *dst, const uint32_t *src,
+                                     int n) {
+  int i = 0;
+
+  while (i < n) {
+    uint32_t token = *(src++);
+    int zeros = token & 0xffff;
+    int literals = token >> 16;
+
+    i += zeros;
+
+    while (literals--) {
+      dst[i++] ^= *(src++);
+    }
+  }
+
+  CHECK_EQ(i, n);
+
+  return src;
+}
+
+static void rewind_xor(uint8_t *dst, const uint8_t *src, int size) {
+  int i = 0;
+
+  for (; i + 4 <= size; i += 4) {
+    uint32_t a, b;
+    memcpy(&a, dst + i, 4);
+    memcpy(&b, src + i, 4);
+    a ^= b;
+    memcpy(dst + i, &a, 4);
+  }
+
+  for (; i < size; i++) {
+    dst[i] ^= src[i];
+  }
+}
+
+static void rewind_reserve_scratch(struct rewind *rw, int words) {
+  if (words <= rw->scratch_words) {
+    return;
+  }
+
+  rw->scratch_words = MAX(rw->scratch_words * 2, words);
+  rw->scratch = realloc(rw->scratch, rw->scratch_words * sizeof(uint32_t));
+  CHECK_NOTNULL(rw->scratch);
+}
+
+static void rewind_drop_oldest(struct rewind *rw) {
+  uint32_t size = *(uint32_t *)ringbuf_read_ptr(rw->deltas);
+  ringbuf_advance_read_ptr(rw->deltas, size);
+  rw->num_deltas--;
+}
+
+static void rewind_push(struct rewind *rw, const uint32_t *delta, int size) {
+  /* an oversized delta leaves nothing older to step back to */
+  if (size > ringbuf_size(rw->deltas)) {
+    LOG_WARNING("rewind_push delta of %d bytes exceeds budget", size);
+
+    while (rw->num_deltas) {
+      rewind_drop_oldest(rw);
+    }
+    return;
+  }
+
+  while (ringbuf_remaining(rw->deltas) < size) {
+    rewind_drop_oldest(rw);
+  }
+
+  memcpy(ringbuf_reserve(rw->deltas, size), delta, size);
+  ringbuf_commit(rw->deltas, size);
+  rw->num_deltas++;
+}
+
+static void rewind_fold(struct rewind *rw) {
+  struct snapshot *capture = rw->capture;
+  struct snapshot *head = rw->head;
+  int page_words = capture->mem_page_size / 4;
+  int capture_size = capture->size;
+  int arena_size = ALIGN_UP(MAX(head->size, capture_size), 4);
+
+  /* the first capture has nothing before it to delta against, it's only
+     copied to head */
+  if (!rw->have_head) {
+    snap_resize(head, 0);
+    snap_write(head, capture->data, capture_size);
+    memcpy(head->mem, capture->mem,
+           capture->mem_num_pages * capture->mem_page_size);
+    head->mem_gen = capture->mem_gen;
+    rw->have_head = 1;
+    return;
+  }
+
+  int num_pages = 0;
+  for (int i = 0; i < capture->mem_num_pages; i++) {
+    num_pages += bitmap_test(capture->mem_dirty, i, 1);
+  }
+
+  /* worst case, every other word differs, each token carrying a single
+     literal */
+  int max_words = REWIND_HEADER_WORDS + num_pages +
+                  (arena_size / 4 + num_pages * page_words) * 2 + 1;
+  rewind_reserve_scratch(rw, max_words);
+
+  uint32_t *delta = rw->scratch;
+  uint32_t *pages = delta + REWIND_HEADER_WORDS;
+  uint32_t *stream = pages + num_pages;
+
+  delta[1] = head->size;
+  delta[2] = num_pages;
+
+  /* xor the arena in place, encode it, and then take the capture's copy */
+  snap_resize(head, arena_size);
+  rewind_xor(head->data, capture->data, capture_size);
+  stream = rewind_encode(stream, (uint32_t *)head->data, arena_size / 4);
+  memcpy(head->data, capture->data, capture_size);
+  snap_resize(head, capture_size);
+
+  /* only the pages copied by the capture can differ */
+  for (int i = 0; i < capture->mem_num_pages; i++) {
+    if (!bitmap_test(capture->mem_dirty, i, 1)) {
+      continue;
+    }
+
+    uint8_t *dst = head->mem + i * capture->mem_page_size;
+    const uint8_t *src = capture->mem + i * capture->mem_page_size;
+
+    memcpy(rw->page, dst, capture->mem_page_size);
+    rewind_xor((uint8_t *)rw->page, src, capture->mem_page_size);
+    stream = rewind_encode(stream, rw->page, page_words);
+    memcpy(dst, src, capture->mem_page_size);
+
+    *(pages++) = i;
+  }
+
+  head->mem_gen = capture->mem_gen;
+
+  int words = (int)(stream - delta) + 1;
+  *stream = delta[0] = words * sizeof(uint32_t);
+  rewind_push(rw, delta, words * sizeof(uint32_t));
+}
+
+static void rewind_pop(struct rewind *rw) {
+  struct snapshot *head = rw->head;
+
+  ringbuf_retreat_write_ptr(rw->deltas, sizeof(uint32_t));
+  uint32_t size = *(uint32_t *)ringbuf_write_ptr(rw->deltas);
+  ringbuf_retreat_write_ptr(rw->deltas, size - sizeof(uint32_t));
+  rw->num_deltas--;
+
+  const uint32_t *delta = ringbuf_write_ptr(rw->deltas);
+  int arena_size = (int)delta[1];
+  int num_pages = (int)delta[2];
+  const uint32_t *pages = delta + REWIND_HEADER_WORDS;
+  const uint32_t *stream = pages + num_pages;
+
+  snap_resize(head, ALIGN_UP(MAX(head->size, arena_size), 4));
+  stream = rewind_decode((uint32_t *)head->data, stream, head->size / 4);
+  snap_resize(head, arena_size);
+
+  /* head's dirty map is otherwise unused, it's reused to record the pages
+     changed here, which the memory system has to be told to restore */
+  bitmap_clear(head->mem_dirty, 0, head->mem_num_pages);
+
+  for (int i = 0; i < num_pages; i++) {
+    uint32_t *dst = (uint32_t *)(head->mem + pages[i] * head->mem_page_size);
+    stream = rewind_decode(dst, stream, head->mem_page_size / 4);
+    bitmap_set(head->mem_dirty, pages[i], 1);
+  }
+
+  mem_invalidate_pages(rw->dc->mem, head->mem_dirty);
+}
+
+static void *rewind_worker_thread(void *data) {
+  struct rewind *rw = data;
+
+  mutex_lock(rw->mutex);
+
+  while (1) {
+    while (!rw->shutdown && !rw->pending) {
+      cond_wait(rw->work_cond, rw->mutex);
+    }
+
+    if (rw->shutdown) {
+      break;
+    }
+
+    mutex_unlock(rw->mutex);
+
+    rewind_fold(rw);
+
+    mutex_lock(rw->mutex);
+    rw->pending = 0;
+    cond_signal(rw->done_cond);
+  }
+
+  mutex_unlock(rw->mutex);
+
+  return NULL;
+}
+
+static void rewind_wait_worker(struct rewind *rw) {
+  mutex_lock(rw->mutex);
+  while (rw->pending) {
+    cond_wait(rw->done_cond, rw->mutex);
+  }
+  mutex_unlock(rw->mutex);
+}
+
+int rewind_step(struct rewind *rw) {
+  rewind_wait_worker(rw);
+
+  if (!rw->have_head) {
+    return 0;
+  }
+
+  /* once out of deltas, hold at the oldest capture */
+  int stepped = rw->frames || rw->num_deltas;
+
+  if (!rw->frames && rw->num_deltas) {
+    rewind_pop(rw);
+  }
+
+  dc_load_snapshot(rw->dc, rw->head);
+  rw->frames = 0;
+
+  return stepped;
+}
+
+void rewind_end_frame(struct rewind *rw) {
+  if (++rw->frames < rw->interval) {
+    return;
+  }
+
+  /* rather than stalling the emulation thread, the capture is put off until
+     the worker has finished compressing the previous one */
+  mutex_lock(rw->mutex);
+
+  if (!rw->pending) {
+    dc_save_snapshot(rw->dc, rw->capture);
+    rw->frames = 0;
+    rw->pending = 1;
+    cond_signal(rw->work_cond);
+  }
+
+  mutex_unlock(rw->mutex);
+}
+
+void rewind_destroy(struct rewind *rw) {
+  mutex_lock(rw->mutex);
+  rw->shutdown = 1;
+  cond_signal(rw->work_cond);
+  mutex_unlock(rw->mutex);
+
+  thread_join(rw->thread, NULL);
+
+  cond_destroy(rw->done_cond);
+  cond_destroy(rw->work_cond);
+  mutex_destroy(rw->mutex);
+
+  ringbuf_destroy(rw->deltas);
+  dc_destroy_snapshot(rw->dc, rw->head);
+  dc_destroy_snapshot(rw->dc, rw->capture);
+  free(rw->page);
+  free(rw->scratch);
+  free(rw);
+}
+
+struct rewind *rewind_create(struct dreamcast *dc, int interval, int budget) {
+  struct rewind *rw = calloc(1, sizeof(struct rewind));
+
+  rw->dc = dc;
+  rw->interval = MAX(interval, 1);
+  rw->capture = dc_create_snapshot(dc);
+  rw->head = dc_create_snapshot(dc);
+  rw->deltas = ringbuf_create(budget);
+  rw->page = malloc(rw->capture->mem_page_size);
+  CHECK_NOTNULL(rw->page);
+
+  rw->mutex = mutex_create();
+  rw->work_cond = cond_create();
+  rw->done_cond = cond_create();
+  rw->thread = thread_create(&rewind_worker_thread, NULL, rw);
+  CHECK_NOTNULL(rw->thread);
+
+  return rw;
+}
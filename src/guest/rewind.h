@@ -0,0 +1,27 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+struct dreamcast;
+struct rewind;
+
+/*
+ * rewind buffer
+ *
+ * the machine is captured every interval frames. each capture is compressed
+ * on a worker thread into a delta against the capture before it, and pushed
+ * into a ring buffer of a fixed budget, the oldest deltas being dropped to
+ * make room for new ones. stepping backward pops the newest delta, applying
+ * it to the latest capture to recover the one before it
+ */
+struct rewind *rewind_create(struct dreamcast *dc, int interval, int budget);
+void rewind_destroy(struct rewind *rw);
+
+/* called in between ticks at the end of each frame ran forward */
+void rewind_end_frame(struct rewind *rw);
+
+/* restores the latest capture, or the one before it if the machine hasn't
+   ran forward since the latest was restored. returns 0 once there's no older
+   capture to step back to, restoring the oldest again */
+int rewind_step(struct rewind *rw);
+
+#endif
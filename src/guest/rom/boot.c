@@ -1,12 +1,20 @@
 #include "guest/rom/boot.h"
 #include "core/filesystem.h"
 #include "core/md5.h"
+#include "core/memory.h"
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
 
+#define BOOT_SIZE 0x00200000
+
 struct boot {
   struct device;
-  uint8_t rom[0x00200000];
+
+  /* the rom is mapped copy-on-write, sharing its pages with every other
+     instance mapping it until one is patched by the hle bios. when there's
+     no valid rom to map, a zeroed buffer stands in for it */
+  uint8_t *rom;
+  size_t map_size;
 };
 
 static const char *boot_bin_path() {
@@ -32,7 +40,7 @@ static int boot_validate(struct boot *boot) {
   /* compare the rom's md5 against known good bios roms */
   MD5_CTX md5_ctx;
   MD5_Init(&md5_ctx);
-  MD5_Update(&md5_ctx, boot->rom, sizeof(boot->rom));
+  MD5_Update(&md5_ctx, boot->rom, BOOT_SIZE);
   char result[33];
   MD5_Final(result, &md5_ctx);
 
@@ -45,34 +53,42 @@ static int boot_validate(struct boot *boot) {
   return 0;
 }
 
+static void boot_unmap_rom(struct boot *boot) {
+  if (boot->map_size) {
+    unmap_file(boot->rom, boot->map_size);
+  } else {
+    free(boot->rom);
+  }
+
+  boot->rom = NULL;
+  boot->map_size = 0;
+}
+
 static int boot_load_rom(struct boot *boot) {
   const char *filename = boot_bin_path();
 
   LOG_INFO("boot_load_rom path=%s", filename);
 
-  FILE *fp = fopen(filename, "rb");
-  if (!fp) {
+  size_t size = 0;
+  uint8_t *rom = map_file_private(filename, &size);
+  if (!rom) {
     LOG_WARNING("boot_load_rom failed to open");
     return 0;
   }
 
-  fseek(fp, 0, SEEK_END);
-  int size = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-
-  if (size != (int)sizeof(boot->rom)) {
-    LOG_WARNING("boot_load_rom size mismatch size=%d expected=%d", size,
-                sizeof(boot->rom));
-    fclose(fp);
+  if (size != BOOT_SIZE) {
+    LOG_WARNING("boot_load_rom size mismatch size=%d expected=%d", (int)size,
+                BOOT_SIZE);
+    unmap_file(rom, size);
     return 0;
   }
 
-  int n = (int)fread(boot->rom, sizeof(uint8_t), size, fp);
-  CHECK_EQ(n, size);
-  fclose(fp);
+  boot->rom = rom;
+  boot->map_size = size;
 
   if (!boot_validate(boot)) {
     LOG_WARNING("boot_load_rom failed to validate");
+    boot_unmap_rom(boot);
     return 0;
   }
 
@@ -83,11 +99,19 @@ static int boot_init(struct device *dev) {
   struct boot *boot = (struct boot *)dev;
 
   /* attempt to load the boot rom, if this fails, the bios code will hle it */
-  boot_load_rom(boot);
+  if (!boot_load_rom(boot)) {
+    boot->rom = calloc(1, BOOT_SIZE);
+  }
 
   return 1;
 }
 
+void boot_read(struct boot *boot, int offset, void *data, int n) {
+  CHECK(offset >= 0 && (offset + n) <= BOOT_SIZE);
+
+  memcpy(data, &boot->rom[offset], n);
+}
+
 void boot_rom_write(struct boot *boot, uint32_t addr, uint32_t data,
                     uint32_t mask) {
   WRITE_DATA(&boot->rom[addr]);
@@ -98,6 +122,7 @@ uint32_t boot_rom_read(struct boot *boot, uint32_t addr, uint32_t mask) {
 }
 
 void boot_destroy(struct boot *boot) {
+  boot_unmap_rom(boot);
   dc_destroy_device((struct device *)boot);
 }
 
@@ -9,6 +9,8 @@ struct boot;
 struct boot *boot_create(struct dreamcast *dc);
 void boot_destroy(struct boot *boot);
 
+void boot_read(struct boot *boot, int offset, void *data, int n);
+
 uint32_t boot_rom_read(struct boot *boot, uint32_t addr, uint32_t mask);
 void boot_rom_write(struct boot *boot, uint32_t addr, uint32_t data,
                     uint32_t mask);
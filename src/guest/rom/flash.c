@@ -1,9 +1,19 @@
 #include "guest/rom/flash.h"
+#include "core/bitmap.h"
 #include "core/filesystem.h"
+#include "core/thread.h"
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
+#include "guest/snapshot.h"
+#include "options.h"
 
+#define FLASH_SIZE 0x00020000
 #define FLASH_SECTOR_SIZE 0x4000
+#define FLASH_NUM_SECTORS (FLASH_SIZE / FLASH_SECTOR_SIZE)
+
+/* delay from a sector first being dirtied to it being flushed, letting the
+   rest of a settings save's writes accumulate into the same batch */
+#define FLUSH_DELAY_MS 500
 
 /* there doesn't seem to be any documentation on the flash rom used by the
    dreamcast, but it appears to implement the JEDEC CFI standard */
@@ -16,7 +26,21 @@
 struct flash {
   struct device;
 
-  uint8_t rom[0x00020000];
+  /* the rom is served from memory, with the sectors written by the guest
+     being flushed back to the file from a background thread, so the
+     emulation thread never waits on storage */
+  uint8_t rom[FLASH_SIZE];
+  DECLARE_BITMAP(dirty, FLASH_NUM_SECTORS);
+
+  mutex_t mutex;
+  cond_t cond;
+  thread_t thread;
+  int shutdown;
+
+  /* sectors being written out, owned by whoever holds io_mutex */
+  mutex_t io_mutex;
+  uint8_t pending[FLASH_SIZE];
+  DECLARE_BITMAP(pending_dirty, FLASH_NUM_SECTORS);
 
   /* cmd parsing state */
   int cmd;
@@ -35,13 +59,110 @@ static const char *flash_bin_path() {
   return filename;
 }
 
-static void flash_save_rom(struct flash *flash) {
+static int flash_write_pending(struct flash *flash) {
   const char *filename = flash_bin_path();
 
-  FILE *fp = fopen(filename, "wb");
-  int n = (int)fwrite(flash->rom, 1, sizeof(flash->rom), fp);
-  CHECK_EQ(n, (int)sizeof(flash->rom));
+  /* when every sector is being written, the file is recreated instead of
+     updated in place. this is always the case for the first flush after the
+     rom failed to load, as it starts out entirely dirty */
+  int whole = bitmap_test(flash->pending_dirty, 0, FLASH_NUM_SECTORS);
+  FILE *fp = fopen(filename, whole ? "wb" : "r+b");
+  if (!fp) {
+    return 0;
+  }
+
+  int res = 1;
+
+  for (int i = 0; i < FLASH_NUM_SECTORS && res; i++) {
+    if (!bitmap_test(flash->pending_dirty, i, 1)) {
+      continue;
+    }
+
+    int offset = i * FLASH_SECTOR_SIZE;
+    res = !fseek(fp, offset, SEEK_SET) &&
+          fwrite(&flash->pending[offset], 1, FLASH_SECTOR_SIZE, fp) ==
+              FLASH_SECTOR_SIZE;
+  }
+
+  res = res && fs_sync(fp);
   fclose(fp);
+
+  return res;
+}
+
+static void flash_flush(struct flash *flash) {
+  mutex_lock(flash->io_mutex);
+
+  /* grab a copy of the dirty sectors, letting the guest carry on writing to
+     the rom while they're written out */
+  mutex_lock(flash->mutex);
+  bitmap_copy(flash->pending_dirty, flash->dirty, FLASH_NUM_SECTORS);
+  bitmap_clear(flash->dirty, 0, FLASH_NUM_SECTORS);
+  for (int i = 0; i < FLASH_NUM_SECTORS; i++) {
+    if (bitmap_test(flash->pending_dirty, i, 1)) {
+      int offset = i * FLASH_SECTOR_SIZE;
+      memcpy(&flash->pending[offset], &flash->rom[offset], FLASH_SECTOR_SIZE);
+    }
+  }
+  mutex_unlock(flash->mutex);
+
+  if (bitmap_any(flash->pending_dirty, 0, FLASH_NUM_SECTORS) &&
+      !flash_write_pending(flash)) {
+    LOG_WARNING("flash_flush failed to write %s", flash_bin_path());
+
+    /* leave the sectors dirty to retry them with the next batch */
+    mutex_lock(flash->mutex);
+    bitmap_or(flash->dirty, flash->dirty, flash->pending_dirty,
+              FLASH_NUM_SECTORS);
+    mutex_unlock(flash->mutex);
+  }
+
+  mutex_unlock(flash->io_mutex);
+}
+
+static void *flash_flush_thread(void *data) {
+  struct flash *flash = data;
+
+  apply_thread_options(ROLE_IO);
+
+  mutex_lock(flash->mutex);
+
+  while (!flash->shutdown) {
+    if (!bitmap_any(flash->dirty, 0, FLASH_NUM_SECTORS)) {
+      cond_wait(flash->cond, flash->mutex);
+      continue;
+    }
+
+    cond_timedwait(flash->cond, flash->mutex, FLUSH_DELAY_MS);
+
+    if (flash->shutdown) {
+      break;
+    }
+
+    mutex_unlock(flash->mutex);
+    flash_flush(flash);
+    mutex_lock(flash->mutex);
+  }
+
+  mutex_unlock(flash->mutex);
+
+  return NULL;
+}
+
+/* must be called with the mutex held */
+static void flash_dirty(struct flash *flash, int offset, int n) {
+  if (!n) {
+    return;
+  }
+
+  /* wake up the background thread when starting a new batch */
+  if (!bitmap_any(flash->dirty, 0, FLASH_NUM_SECTORS)) {
+    cond_signal(flash->cond);
+  }
+
+  int first = offset / FLASH_SECTOR_SIZE;
+  int last = (offset + n - 1) / FLASH_SECTOR_SIZE;
+  bitmap_set(flash->dirty, first, last - first + 1);
 }
 
 static int flash_load_rom(struct flash *flash) {
@@ -86,8 +207,7 @@ static void flash_cmd_program(struct flash *flash, uint32_t addr, uint32_t data,
 }
 
 static void flash_cmd_erase_chip(struct flash *flash) {
-  int size = sizeof(flash->rom);
-  flash_erase(flash, 0, size);
+  flash_erase(flash, 0, FLASH_SIZE);
 }
 
 static void flash_cmd_erase_sector(struct flash *flash, uint32_t addr) {
@@ -97,42 +217,89 @@ static void flash_cmd_erase_sector(struct flash *flash, uint32_t addr) {
   flash_erase(flash, addr, FLASH_SECTOR_SIZE);
 }
 
+static void flash_load(struct device *dev, struct snapshot *snap) {
+  struct flash *flash = (struct flash *)dev;
+
+  /* snapshots are loaded every frame when running ahead or rewinding, only
+     dirty the sectors which actually changed */
+  mutex_lock(flash->mutex);
+  for (int i = 0; i < FLASH_NUM_SECTORS; i++) {
+    uint8_t sector[FLASH_SECTOR_SIZE];
+    int offset = i * FLASH_SECTOR_SIZE;
+
+    SNAP_READ(snap, sector);
+
+    if (memcmp(&flash->rom[offset], sector, FLASH_SECTOR_SIZE)) {
+      memcpy(&flash->rom[offset], sector, FLASH_SECTOR_SIZE);
+      flash_dirty(flash, offset, FLASH_SECTOR_SIZE);
+    }
+  }
+  mutex_unlock(flash->mutex);
+
+  SNAP_READ(snap, flash->cmd);
+  SNAP_READ(snap, flash->cmd_state);
+}
+
+static void flash_save(struct device *dev, struct snapshot *snap) {
+  struct flash *flash = (struct flash *)dev;
+
+  SNAP_WRITE(snap, flash->rom);
+  SNAP_WRITE(snap, flash->cmd);
+  SNAP_WRITE(snap, flash->cmd_state);
+}
+
 static int flash_init(struct device *dev) {
   struct flash *flash = (struct flash *)dev;
 
-  /* attempt to load the flash rom, if this fails the bios will reset it */
-  flash_load_rom(flash);
+  /* attempt to load the flash rom, if this fails the bios will reset it and
+     the whole rom is written out with the first flush */
+  if (!flash_load_rom(flash)) {
+    bitmap_set(flash->dirty, 0, FLASH_NUM_SECTORS);
+  }
+
+  flash->thread = thread_create(&flash_flush_thread, "flash", flash);
+  CHECK_NOTNULL(flash->thread);
 
   return 1;
 }
 
 void flash_erase(struct flash *flash, int offset, int n) {
-  CHECK(offset >= 0 && (offset + n) <= (int)sizeof(flash->rom));
+  CHECK(offset >= 0 && (offset + n) <= FLASH_SIZE);
 
   /* erasing resets bits to 1 */
+  mutex_lock(flash->mutex);
   memset(&flash->rom[offset], 0xff, n);
+  flash_dirty(flash, offset, n);
+  mutex_unlock(flash->mutex);
 }
 
 void flash_program(struct flash *flash, int offset, const void *data, int n) {
-  CHECK(offset >= 0 && (offset + n) <= (int)sizeof(flash->rom));
+  CHECK(offset >= 0 && (offset + n) <= FLASH_SIZE);
 
   const uint8_t *bytes = data;
 
   /* programming can only clear bits to 0 */
+  mutex_lock(flash->mutex);
   for (int i = 0; i < n; i++) {
     flash->rom[offset + i] &= bytes[i];
   }
+  flash_dirty(flash, offset, n);
+  mutex_unlock(flash->mutex);
 }
 
 void flash_write(struct flash *flash, int offset, const void *data, int n) {
-  CHECK(offset >= 0 && (offset + n) <= (int)sizeof(flash->rom));
+  CHECK(offset >= 0 && (offset + n) <= FLASH_SIZE);
 
+  mutex_lock(flash->mutex);
   memcpy(&flash->rom[offset], data, n);
+  flash_dirty(flash, offset, n);
+  mutex_unlock(flash->mutex);
 }
 
 void flash_read(struct flash *flash, int offset, void *data, int n) {
-  CHECK(offset >= 0 && (offset + n) <= (int)sizeof(flash->rom));
+  CHECK(offset >= 0 && (offset + n) <= FLASH_SIZE);
 
+  /* the rom is only ever modified from this thread, no need to lock */
   memcpy(data, &flash->rom[offset], n);
 }
 
@@ -194,8 +361,29 @@ uint32_t flash_rom_read(struct flash *flash, uint32_t addr, uint32_t mask) {
   return flash_cmd_read(flash, addr, mask);
 }
 
+void flash_sync(struct flash *flash) {
+  flash_flush(flash);
+}
+
 void flash_destroy(struct flash *flash) {
-  flash_save_rom(flash);
+  /* the thread is only started once the device is initialized */
+  if (flash->thread) {
+    mutex_lock(flash->mutex);
+    flash->shutdown = 1;
+    cond_signal(flash->cond);
+    mutex_unlock(flash->mutex);
+
+    void *result;
+    thread_join(flash->thread, &result);
+
+    /* write out whatever the background thread hadn't gotten to */
+    flash_flush(flash);
+  }
+
+  mutex_destroy(flash->io_mutex);
+  cond_destroy(flash->cond);
+  mutex_destroy(flash->mutex);
+
   dc_destroy_device((struct device *)flash);
 }
 
@@ -203,5 +391,14 @@ struct flash *flash_create(struct dreamcast *dc) {
   struct flash *flash =
       dc_create_device(dc, sizeof(struct flash), "flash", &flash_init, NULL);
 
+  flash->mutex = mutex_create();
+  flash->cond = cond_create();
+  flash->io_mutex = mutex_create();
+
+  /* setup snapshot interface */
+  flash->snapif.enabled = 1;
+  flash->snapif.save = &flash_save;
+  flash->snapif.load = &flash_load;
+
   return flash;
 }
@@ -9,6 +9,9 @@ struct flash;
 struct flash *flash_create(struct dreamcast *dc);
 void flash_destroy(struct flash *flash);
 
+/* blocks until the sectors written so far are flushed to storage */
+void flash_sync(struct flash *flash);
+
 uint32_t flash_rom_read(struct flash *flash, uint32_t addr, uint32_t mask);
 void flash_rom_write(struct flash *flash, uint32_t addr, uint32_t data,
                      uint32_t mask);
@@ -0,0 +1,224 @@
+#include "guest/sample_profile.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/hash.h"
+#include "core/sampler.h"
+#include "core/sort.h"
+#include "guest/arm7/arm7.h"
+#include "guest/dreamcast.h"
+#include "guest/sh4/sh4.h"
+#include "jit/jit.h"
+
+#define SAMPLE_PROFILE_MIN_SIZE 1024
+#define SAMPLE_PROFILE_MAX_FUNCS 256
+
+struct host_sample {
+  uintptr_t pc;
+  uint64_t num_samples;
+};
+
+struct host_func {
+  char name[128];
+  uint64_t num_samples;
+};
+
+struct sample_profile {
+  struct dreamcast *dc;
+  int running;
+
+  uint64_t total_samples;
+  uint64_t sh4_samples;
+  uint64_t arm7_samples;
+  uint64_t host_samples;
+
+  /* open-addressing hash table of samples outside of compiled code, keyed by
+     host pc. they're only symbolized once the report is written */
+  struct host_sample *samples;
+  int samples_size;
+  int num_samples;
+};
+
+static struct host_sample *sample_profile_insert_slot(struct sample_profile *sp,
+                                                      uintptr_t pc) {
+  uint32_t mask = sp->samples_size - 1;
+  uint32_t i = (uint32_t)hash_key(pc, ctz32(sp->samples_size));
+
+  while (sp->samples[i].num_samples) {
+    if (sp->samples[i].pc == pc) {
+      break;
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  return &sp->samples[i];
+}
+
+static void sample_profile_grow(struct sample_profile *sp) {
+  struct host_sample *old_samples = sp->samples;
+  int old_size = sp->samples_size;
+
+  sp->samples_size = old_samples ? old_size * 2 : SAMPLE_PROFILE_MIN_SIZE;
+  sp->samples = calloc(sp->samples_size, sizeof(struct host_sample));
+
+  for (int i = 0; i < old_size; i++) {
+    if (old_samples[i].num_samples) {
+      *sample_profile_insert_slot(sp, old_samples[i].pc) = old_samples[i];
+    }
+  }
+
+  free(old_samples);
+}
+
+static void sample_profile_add_host(struct sample_profile *sp, uintptr_t pc) {
+  if ((sp->num_samples + 1) * 2 > sp->samples_size) {
+    sample_profile_grow(sp);
+  }
+
+  struct host_sample *s = sample_profile_insert_slot(sp, pc);
+
+  if (!s->num_samples) {
+    s->pc = pc;
+    sp->num_samples++;
+  }
+
+  s->num_samples++;
+  sp->host_samples++;
+}
+
+void sample_profile_update(struct sample_profile *sp) {
+  uintptr_t pcs[256];
+  int n;
+
+  struct jit *sh4_jit = sp->dc->sh4->jit;
+  struct jit *arm7_jit = arm7_get_jit(sp->dc->arm7);
+
+  while ((n = sampler_read(pcs, ARRAY_SIZE(pcs)))) {
+    for (int i = 0; i < n; i++) {
+      uintptr_t pc = pcs[i];
+
+      if (jit_add_sample(sh4_jit, pc)) {
+        sp->sh4_samples++;
+      } else if (arm7_jit && jit_add_sample(arm7_jit, pc)) {
+        sp->arm7_samples++;
+      } else {
+        sample_profile_add_host(sp, pc);
+      }
+    }
+
+    sp->total_samples += n;
+  }
+}
+
+static int sample_profile_name_cmp(const void *a, const void *b) {
+  const struct host_func *fa = a;
+  const struct host_func *fb = b;
+  return strcmp(fa->name, fb->name) <= 0;
+}
+
+static int sample_profile_count_cmp(const void *a, const void *b) {
+  const struct host_func *fa = a;
+  const struct host_func *fb = b;
+
+  /* most sampled first */
+  return fa->num_samples >= fb->num_samples;
+}
+
+static void sample_profile_write(struct sample_profile *sp) {
+  const char *appdir = fs_appdir();
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "samples.txt",
+           appdir);
+
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    LOG_WARNING("sample_profile_write failed to open %s", filename);
+    return;
+  }
+
+  /* symbolize the host samples, merging those in the same function */
+  struct host_func *funcs =
+      malloc(MAX(sp->num_samples, 1) * sizeof(struct host_func));
+  int num_funcs = 0;
+
+  for (int i = 0; i < sp->samples_size; i++) {
+    struct host_sample *s = &sp->samples[i];
+
+    if (!s->num_samples) {
+      continue;
+    }
+
+    struct host_func *func = &funcs[num_funcs++];
+    func->num_samples = s->num_samples;
+
+    if (!sampler_symbolize(s->pc, func->name, sizeof(func->name))) {
+      snprintf(func->name, sizeof(func->name), "0x%" PRIxPTR, s->pc);
+    }
+  }
+
+  msort(funcs, num_funcs, sizeof(struct host_func), &sample_profile_name_cmp);
+
+  int num_merged = 0;
+
+  for (int i = 0; i < num_funcs; i++) {
+    if (num_merged && !strcmp(funcs[num_merged - 1].name, funcs[i].name)) {
+      funcs[num_merged - 1].num_samples += funcs[i].num_samples;
+      continue;
+    }
+
+    funcs[num_merged++] = funcs[i];
+  }
+
+  msort(funcs, num_merged, sizeof(struct host_func),
+        &sample_profile_count_cmp);
+  num_merged = MIN(num_merged, SAMPLE_PROFILE_MAX_FUNCS);
+
+  double total = (double)MAX(sp->total_samples, 1);
+
+  fprintf(file, "%" PRIu64 " samples, %d dropped\n\n", sp->total_samples,
+          sampler_dropped());
+  fprintf(file, "%-48s %-16s %-8s\n", "source", "samples", "percent");
+  fprintf(file, "%-48s %-16" PRIu64 " %-8.2f\n", "sh4 code", sp->sh4_samples,
+          sp->sh4_samples * 100.0 / total);
+  fprintf(file, "%-48s %-16" PRIu64 " %-8.2f\n", "arm7 code", sp->arm7_samples,
+          sp->arm7_samples * 100.0 / total);
+  fprintf(file, "%-48s %-16" PRIu64 " %-8.2f\n", "host", sp->host_samples,
+          sp->host_samples * 100.0 / total);
+
+  fprintf(file, "\n%-48s %-16s %-8s\n", "host function", "samples", "percent");
+
+  for (int i = 0; i < num_merged; i++) {
+    struct host_func *func = &funcs[i];
+    fprintf(file, "%-48s %-16" PRIu64 " %-8.2f\n", func->name,
+            func->num_samples, func->num_samples * 100.0 / total);
+  }
+
+  free(funcs);
+  fclose(file);
+
+  LOG_INFO("sample_profile_write wrote %s", filename);
+}
+
+void sample_profile_destroy(struct sample_profile *sp) {
+  if (sp->running) {
+    sampler_stop();
+    sample_profile_write(sp);
+  }
+
+  free(sp->samples);
+  free(sp);
+}
+
+struct sample_profile *sample_profile_create(struct dreamcast *dc, int rate) {
+  struct sample_profile *sp = calloc(1, sizeof(struct sample_profile));
+
+  sp->dc = dc;
+  sp->running = sampler_start(rate);
+
+  if (!sp->running) {
+    LOG_WARNING("sample_profile_create failed to start sampling");
+  }
+
+  return sp;
+}
@@ -0,0 +1,23 @@
+#ifndef SAMPLE_PROFILE_H
+#define SAMPLE_PROFILE_H
+
+struct dreamcast;
+struct sample_profile;
+
+/*
+ * sampling profile of the emulation thread
+ *
+ * the host pc is sampled at a fixed rate of the thread's cpu time. samples
+ * landing in compiled code are attributed to the guest instruction they were
+ * compiled from, while the rest are attributed to the emulator's own
+ * functions. reports are written to the application directory once the
+ * profile is destroyed
+ */
+struct sample_profile *sample_profile_create(struct dreamcast *dc, int rate);
+void sample_profile_destroy(struct sample_profile *sp);
+
+/* called from the emulation thread after each tick, while the code the
+   samples were taken in is still around */
+void sample_profile_update(struct sample_profile *sp);
+
+#endif
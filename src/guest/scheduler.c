@@ -2,33 +2,183 @@
 #include "guest/scheduler.h"
 #include "core/core.h"
 #include "core/list.h"
+#include "core/thread.h"
 #include "guest/dreamcast.h"
+#include "guest/snapshot.h"
+#include "imgui.h"
+#include "stats.h"
 
-#define MAX_TIMERS 128
+/* timers are allocated in pools of this many, a new pool being added each time
+   the free list runs dry */
+#define TIMER_POOL_SIZE 128
 
 struct timer {
   int active;
   int64_t expire;
+  /* order the timer was started in, breaking ties between timers expiring at
+     the same time so they run first in, first out */
+  uint64_t order;
+  /* position in the scheduler's heap while active */
+  int index;
+  /* position across every pool, timers are referred to by it in snapshots */
+  int id;
   timer_cb cb;
   void *data;
+  /* device owning the callback, its host time is charged to it */
+  struct device *owner;
   struct list_node it;
 };
 
 struct scheduler {
   struct dreamcast *dc;
-  struct timer timers[MAX_TIMERS];
+
+  /* each pool is allocated separately so timer addresses remain stable */
+  struct timer **pools;
+  int num_pools;
   struct list free_timers;
-  struct list live_timers;
+
+  /* live timers, kept in a binary min-heap ordered by expiration */
+  struct timer **heap;
+  int heap_size;
+
+  uint64_t next_order;
   int64_t base_time;
+
+  /* set to end the current tick early, once the running timer returns */
+  int breaking;
+
+  /* host threads running threaded devices */
+  struct list workers;
+
+  /* host time accounting. sections may nest, e.g. when a device is synced
+     from inside of another device's run callback. the self time of every
+     section measured so far is summed up, so each section can subtract out
+     the time of those nested inside of it */
+  uint64_t self_ticks;
+  uint64_t other_ticks;
+  int timings;
+};
+
+struct sched_worker {
+  struct device *dev;
+
+  thread_t thread;
+  mutex_t mutex;
+  cond_t work_cond;
+  cond_t done_cond;
+  int shutdown;
+
+  /* time handed to the worker to run the device for, reset to zero once the
+     worker has finished running it */
+  int64_t work;
+
+  /* host time spent running the device, charged to it when next waited on */
+  uint64_t ticks;
+
+  struct list_node it;
 };
 
+/* worker the current thread belongs to, if any */
+static _Thread_local struct sched_worker *sched_current_worker;
+
+static int sched_timer_before(const struct timer *a, const struct timer *b) {
+  if (a->expire != b->expire) {
+    return a->expire < b->expire;
+  }
+  return a->order < b->order;
+}
+
+static void sched_heap_set(struct scheduler *sched, int i,
+                           struct timer *timer) {
+  sched->heap[i] = timer;
+  timer->index = i;
+}
+
+static void sched_heap_up(struct scheduler *sched, int i) {
+  struct timer *timer = sched->heap[i];
+
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+
+    if (!sched_timer_before(timer, sched->heap[parent])) {
+      break;
+    }
+
+    sched_heap_set(sched, i, sched->heap[parent]);
+    i = parent;
+  }
+
+  sched_heap_set(sched, i, timer);
+}
+
+static void sched_heap_down(struct scheduler *sched, int i) {
+  struct timer *timer = sched->heap[i];
+
+  while (1) {
+    int child = 2 * i + 1;
+
+    if (child >= sched->heap_size) {
+      break;
+    }
+
+    if (child + 1 < sched->heap_size &&
+        sched_timer_before(sched->heap[child + 1], sched->heap[child])) {
+      child++;
+    }
+
+    if (!sched_timer_before(sched->heap[child], timer)) {
+      break;
+    }
+
+    sched_heap_set(sched, i, sched->heap[child]);
+    i = child;
+  }
+
+  sched_heap_set(sched, i, timer);
+}
+
+static void sched_heap_remove(struct scheduler *sched, struct timer *timer) {
+  struct timer *last = sched->heap[--sched->heap_size];
+
+  if (last == timer) {
+    return;
+  }
+
+  /* move the last timer into the hole, and restore the heap property in
+     whichever direction it was broken */
+  sched_heap_set(sched, timer->index, last);
+  sched_heap_up(sched, last->index);
+  sched_heap_down(sched, last->index);
+}
+
+static void sched_alloc_timers(struct scheduler *sched) {
+  struct timer *pool = calloc(TIMER_POOL_SIZE, sizeof(struct timer));
+  CHECK_NOTNULL(pool);
+
+  sched->num_pools++;
+  sched->pools =
+      realloc(sched->pools, sched->num_pools * sizeof(struct timer *));
+  sched->pools[sched->num_pools - 1] = pool;
+
+  /* the heap is sized to hold every timer, so starting one never has to grow
+     it */
+  int max_timers = sched->num_pools * TIMER_POOL_SIZE;
+  sched->heap = realloc(sched->heap, max_timers * sizeof(struct timer *));
+  CHECK(sched->pools && sched->heap);
+
+  for (int i = 0; i < TIMER_POOL_SIZE; i++) {
+    pool[i].id = (sched->num_pools - 1) * TIMER_POOL_SIZE + i;
+    list_add(&sched->free_timers, &pool[i].it);
+  }
+}
+
 void sched_cancel_timer(struct scheduler *sched, struct timer *timer) {
   if (!timer->active) {
     return;
   }
 
   timer->active = 0;
-  list_remove(&sched->live_timers, &timer->it);
+  sched_heap_remove(sched, timer);
   list_add(&sched->free_timers, &timer->it);
 }
 
@@ -36,44 +186,247 @@ int64_t sched_remaining_time(struct scheduler *sched, struct timer *timer) {
   return timer->expire - sched->base_time;
 }
 
+int64_t sched_current_time(struct scheduler *sched) {
+  return sched->base_time;
+}
+
+static struct device *sched_cb_owner(struct scheduler *sched, timer_cb cb,
+                                     int *index) {
+  list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
+    for (int i = 0; i < dev->num_timer_cbs; i++) {
+      if (dev->timer_cbs[i] == cb) {
+        if (index) {
+          *index = i;
+        }
+        return dev;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* returns the self time of the section started at start, given the total self
+   time of all sections at its start */
+static uint64_t sched_end_section(struct scheduler *sched, uint64_t start,
+                                  uint64_t start_self) {
+  uint64_t elapsed = time_ticks() - start;
+  uint64_t nested = sched->self_ticks - start_self;
+  uint64_t self = elapsed - nested;
+  sched->self_ticks += self;
+  return self;
+}
+
 struct timer *sched_start_timer(struct scheduler *sched, timer_cb cb,
                                 void *data, int64_t ns) {
+  if (list_empty(&sched->free_timers)) {
+    sched_alloc_timers(sched);
+  }
+
   struct timer *timer = list_first_entry(&sched->free_timers, struct timer, it);
-  CHECK_NOTNULL(timer);
   timer->active = 1;
   timer->expire = sched->base_time + ns;
+  timer->order = sched->next_order++;
   timer->cb = cb;
   timer->data = data;
+  timer->owner = sched_cb_owner(sched, cb, NULL);
 
   /* remove from free list */
   list_remove(&sched->free_timers, &timer->it);
 
-  /* add to sorted live list */
-  struct list_node *after = NULL;
+  /* add to live heap */
+  int i = sched->heap_size++;
+  sched_heap_set(sched, i, timer);
+  sched_heap_up(sched, i);
+
+  return timer;
+}
+
+static void *sched_worker_thread(void *data) {
+  struct sched_worker *worker = data;
+  struct device *dev = worker->dev;
 
-  list_for_each(&sched->live_timers, it) {
-    struct timer *entry = list_entry(it, struct timer, it);
+  sched_current_worker = worker;
 
-    if (entry->expire > timer->expire) {
+  mutex_lock(worker->mutex);
+
+  while (1) {
+    while (!worker->shutdown && !worker->work) {
+      cond_wait(worker->work_cond, worker->mutex);
+    }
+
+    if (worker->shutdown) {
       break;
     }
 
-    after = it;
+    int64_t ns = worker->work;
+    mutex_unlock(worker->mutex);
+
+    uint64_t start = time_ticks();
+    prof_enter(dev->run_zone);
+    dev->runif.run(dev, ns);
+    prof_leave(dev->run_zone);
+    uint64_t elapsed = time_ticks() - start;
+
+    mutex_lock(worker->mutex);
+    worker->work = 0;
+    worker->ticks += elapsed;
+    cond_signal(worker->done_cond);
   }
 
-  list_add_after(&sched->live_timers, after, &timer->it);
+  mutex_unlock(worker->mutex);
 
-  return timer;
+  return NULL;
+}
+
+static void sched_wait_worker(struct sched_worker *worker) {
+  /* note, locking the mutex also makes everything the device wrote while
+     running visible to the emulation thread */
+  mutex_lock(worker->mutex);
+  while (worker->work) {
+    cond_wait(worker->done_cond, worker->mutex);
+  }
+  worker->dev->run_ticks += worker->ticks;
+  worker->ticks = 0;
+  mutex_unlock(worker->mutex);
+}
+
+static void sched_queue_worker(struct sched_worker *worker, int64_t ns) {
+  sched_wait_worker(worker);
+
+  mutex_lock(worker->mutex);
+  worker->work = ns;
+  cond_signal(worker->work_cond);
+  mutex_unlock(worker->mutex);
+}
+
+static void sched_destroy_worker(struct sched_worker *worker) {
+  mutex_lock(worker->mutex);
+  worker->shutdown = 1;
+  cond_signal(worker->work_cond);
+  mutex_unlock(worker->mutex);
+
+  thread_join(worker->thread, NULL);
+
+  cond_destroy(worker->done_cond);
+  cond_destroy(worker->work_cond);
+  mutex_destroy(worker->mutex);
+  free(worker);
+}
+
+static struct sched_worker *sched_create_worker(struct scheduler *sched,
+                                                struct device *dev) {
+  struct sched_worker *worker = calloc(1, sizeof(struct sched_worker));
+
+  worker->dev = dev;
+  worker->mutex = mutex_create();
+  worker->work_cond = cond_create();
+  worker->done_cond = cond_create();
+  worker->thread = thread_create(&sched_worker_thread, NULL, worker);
+  CHECK_NOTNULL(worker->thread);
+
+  list_add(&sched->workers, &worker->it);
+
+  return worker;
+}
+
+static void sched_run_device(struct scheduler *sched, struct device *dev) {
+  struct runif *runif = &dev->runif;
+
+  /* a device can't be synced from inside of its own run callback */
+  if (runif->busy || !runif->pending) {
+    return;
+  }
+
+  int64_t ns = runif->pending;
+  runif->pending = 0;
+
+  if (!runif->running) {
+    return;
+  }
+
+  /* hand the time off to the device's own thread and carry on without waiting
+     for it */
+  if (runif->threaded) {
+    if (!runif->worker) {
+      runif->worker = sched_create_worker(sched, dev);
+    }
+
+    sched_queue_worker(runif->worker, ns);
+    return;
+  }
+
+  /* skip over the time an idle device would otherwise spend spinning */
+  if (runif->idle && runif->idle(dev)) {
+    return;
+  }
+
+  uint64_t start = time_ticks();
+  uint64_t start_self = sched->self_ticks;
+
+  runif->busy = 1;
+  prof_enter(dev->run_zone);
+  runif->run(dev, ns);
+  prof_leave(dev->run_zone);
+  runif->busy = 0;
+
+  dev->run_ticks += sched_end_section(sched, start, start_self);
+}
+
+int sched_in_worker(struct scheduler *sched) {
+  return sched_current_worker != NULL;
+}
+
+void sched_sync(struct scheduler *sched, struct device *dev) {
+  /* scheduler state and every other device is owned by the emulation thread,
+     nothing can be synced from a threaded device. synchronization happens
+     from the other side, when the emulation thread waits on the device */
+  if (sched_in_worker(sched)) {
+    return;
+  }
+
+  sched_run_device(sched, dev);
+
+  if (dev->runif.worker) {
+    sched_wait_worker(dev->runif.worker);
+  }
+}
+
+void sched_break(struct scheduler *sched) {
+  sched->breaking = 1;
+}
+
+static void sched_publish_timings(struct scheduler *sched, uint64_t ticks,
+                                  int64_t ns) {
+  /* convert each device's ticks to nanoseconds using the rate the counter ran
+     at over the course of the tick */
+  double scale = ticks ? ns / (double)ticks : 0.0;
+
+  list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
+    prof_counter_add(dev->run_ns, (int64_t)(dev->run_ticks * scale));
+    prof_counter_add(dev->timer_ns, (int64_t)(dev->timer_ticks * scale));
+    dev->run_ticks = 0;
+    dev->timer_ticks = 0;
+  }
+
+  prof_counter_add(COUNTER_sched_other_ns,
+                   (int64_t)(sched->other_ticks * scale));
+  prof_counter_add(COUNTER_sched_ns, ns);
+  sched->other_ticks = 0;
 }
 
 void sched_tick(struct scheduler *sched, int64_t ns) {
   int64_t target_time = sched->base_time + ns;
+  int64_t start_ns = time_nanoseconds();
+  uint64_t start = time_ticks();
 
-  while (sched->dc->running && sched->base_time < target_time) {
+  sched->breaking = 0;
+
+  while (sched->dc->running && !sched->breaking &&
+         sched->base_time < target_time) {
     /* run devices up to the next timer */
     int64_t next_time = target_time;
-    struct timer *next_timer =
-        list_first_entry(&sched->live_timers, struct timer, it);
+    struct timer *next_timer = sched->heap_size ? sched->heap[0] : NULL;
 
     if (next_timer && next_timer->expire < next_time) {
       next_time = next_timer->expire;
@@ -84,32 +437,289 @@ void sched_tick(struct scheduler *sched, int64_t ns) {
     int64_t slice = next_time - sched->base_time;
     sched->base_time += slice;
 
-    /* execute each device */
+    /* execute each device once it has accumulated at least its quantum.
+       devices behind on time are synced early by raising an interrupt on them,
+       or by accessing state they share with another device */
     list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
       if (dev->runif.enabled && dev->runif.running) {
-        dev->runif.run(dev, slice);
+        dev->runif.pending += slice;
+
+        if (dev->runif.pending >= dev->runif.quantum) {
+          sched_run_device(sched, dev);
+        }
       }
     }
 
     /* execute expired timers */
-    while (1) {
-      struct timer *timer =
-          list_first_entry(&sched->live_timers, struct timer, it);
+    while (sched->heap_size) {
+      struct timer *timer = sched->heap[0];
 
-      if (!timer || timer->expire > sched->base_time) {
+      if (timer->expire > sched->base_time) {
         break;
       }
 
       sched_cancel_timer(sched, timer);
 
       /* run the timer */
+      struct device *owner = timer->owner;
+      uint64_t timer_start = time_ticks();
+      uint64_t timer_start_self = sched->self_ticks;
+
       timer->cb(timer->data);
+
+      uint64_t self = sched_end_section(sched, timer_start, timer_start_self);
+      if (owner) {
+        owner->timer_ticks += self;
+      } else {
+        sched->other_ticks += self;
+      }
     }
   }
+
+  /* bring every device up to date before returning */
+  list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
+    if (dev->runif.enabled) {
+      sched_sync(sched, dev);
+    }
+  }
+
+  sched_publish_timings(sched, time_ticks() - start,
+                        time_nanoseconds() - start_ns);
 }
 
-void sched_destroy(struct scheduler *sch) {
-  free(sch);
+#ifdef HAVE_IMGUI
+void sched_debug_menu(struct scheduler *sched) {
+  if (igBeginMainMenuBar()) {
+    if (igBeginMenu("SCHED", 1)) {
+      if (igMenuItem("device timings", NULL, sched->timings, 1)) {
+        sched->timings = !sched->timings;
+      }
+
+      igEndMenu();
+    }
+
+    igEndMainMenuBar();
+  }
+
+  if (!sched->timings) {
+    return;
+  }
+
+  if (igBegin("device timings", NULL, 0)) {
+    /* the counters are aggregated over the last second, average them out
+       over the frames ran in that time */
+    int64_t frames = MAX(prof_counter_load(COUNTER_frames), 1);
+    int64_t total = MAX(prof_counter_load(COUNTER_sched_ns), 1);
+
+    igColumns(4, NULL, 0);
+
+    igText("device");
+    igNextColumn();
+    igText("run ms/frame");
+    igNextColumn();
+    igText("timers ms/frame");
+    igNextColumn();
+    igText("share");
+    igNextColumn();
+
+    list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
+      int64_t run = prof_counter_load(dev->run_ns);
+      int64_t timer = prof_counter_load(dev->timer_ns);
+
+      igText("%s", dev->name);
+      igNextColumn();
+      igText("%.3f", run / (double)frames / NS_PER_MS);
+      igNextColumn();
+      igText("%.3f", timer / (double)frames / NS_PER_MS);
+      igNextColumn();
+      igText("%.1f%%", (run + timer) * 100.0 / total);
+      igNextColumn();
+    }
+
+    int64_t other = prof_counter_load(COUNTER_sched_other_ns);
+    igText("other");
+    igNextColumn();
+    igText("-");
+    igNextColumn();
+    igText("%.3f", other / (double)frames / NS_PER_MS);
+    igNextColumn();
+    igText("%.1f%%", other * 100.0 / total);
+    igNextColumn();
+
+    igColumns(1, NULL, 0);
+
+    igEnd();
+  }
+}
+#endif
+
+/*
+ * snapshots
+ *
+ * nothing saved refers to host memory, so snapshots remain valid across runs.
+ * timers are saved by id, and callbacks by the device owning them, as the
+ * index of the device, the index of the callback in its table and the offset
+ * of their data from the device
+ */
+struct sched_cb_ref {
+  int32_t dev;
+  int32_t cb;
+  int64_t data;
+};
+
+void sched_save_cb(struct scheduler *sched, struct snapshot *snap, timer_cb cb,
+                   void *data) {
+  struct sched_cb_ref ref = {-1, -1, 0};
+
+  if (cb) {
+    struct device *owner = sched_cb_owner(sched, cb, &ref.cb);
+    CHECK_NOTNULL(owner, "sched_save_cb callback isn't owned by a device");
+
+    ref.dev = 0;
+    list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
+      if (dev == owner) {
+        break;
+      }
+      ref.dev++;
+    }
+
+    ref.data = (uint8_t *)data - (uint8_t *)owner;
+  }
+
+  SNAP_WRITE(snap, ref);
+}
+
+void sched_load_cb(struct scheduler *sched, struct snapshot *snap,
+                   timer_cb *cb, void **data) {
+  struct sched_cb_ref ref;
+  SNAP_READ(snap, ref);
+
+  *cb = NULL;
+  *data = NULL;
+
+  if (ref.dev < 0) {
+    return;
+  }
+
+  int i = 0;
+  list_for_each_entry(dev, &sched->dc->devices, struct device, it) {
+    if (i++ != ref.dev) {
+      continue;
+    }
+
+    CHECK_LT(ref.cb, dev->num_timer_cbs);
+    *cb = dev->timer_cbs[ref.cb];
+    *data = (uint8_t *)dev + ref.data;
+    return;
+  }
+
+  LOG_FATAL("sched_load_cb no device at index %d", ref.dev);
+}
+
+void sched_save_timer(struct scheduler *sched, struct snapshot *snap,
+                      struct timer *timer) {
+  int id = timer ? timer->id : -1;
+  SNAP_WRITE(snap, id);
+}
+
+struct timer *sched_load_timer(struct scheduler *sched,
+                               struct snapshot *snap) {
+  int id;
+  SNAP_READ(snap, id);
+
+  if (id < 0) {
+    return NULL;
+  }
+
+  CHECK_LT(id, sched->num_pools * TIMER_POOL_SIZE);
+  return &sched->pools[id / TIMER_POOL_SIZE][id % TIMER_POOL_SIZE];
+}
+
+void sched_load(struct scheduler *sched, struct snapshot *snap) {
+  int num_pools;
+  SNAP_READ(snap, num_pools);
+
+  /* timers keep their ids, so the pools the snapshot was saved with are
+     allocated before restoring them */
+  while (sched->num_pools < num_pools) {
+    sched_alloc_timers(sched);
+  }
+
+  /* rebuild the heap and the free list, nothing restored references timers
+     from pools allocated since the snapshot was saved */
+  list_clear(&sched->free_timers);
+  sched->heap_size = 0;
+
+  for (int i = 0; i < sched->num_pools; i++) {
+    struct timer *pool = sched->pools[i];
+
+    for (int j = 0; j < TIMER_POOL_SIZE; j++) {
+      struct timer *timer = &pool[j];
+
+      timer->active = 0;
+      if (i < num_pools) {
+        SNAP_READ(snap, timer->active);
+      }
+
+      if (!timer->active) {
+        list_add(&sched->free_timers, &timer->it);
+        continue;
+      }
+
+      SNAP_READ(snap, timer->expire);
+      SNAP_READ(snap, timer->order);
+      sched_load_cb(sched, snap, &timer->cb, &timer->data);
+
+      timer->owner = sched_cb_owner(sched, timer->cb, NULL);
+
+      int n = sched->heap_size++;
+      sched_heap_set(sched, n, timer);
+      sched_heap_up(sched, n);
+    }
+  }
+
+  SNAP_READ(snap, sched->next_order);
+  SNAP_READ(snap, sched->base_time);
+
+  sched->breaking = 0;
+}
+
+void sched_save(struct scheduler *sched, struct snapshot *snap) {
+  SNAP_WRITE(snap, sched->num_pools);
+
+  for (int i = 0; i < sched->num_pools; i++) {
+    struct timer *pool = sched->pools[i];
+
+    for (int j = 0; j < TIMER_POOL_SIZE; j++) {
+      struct timer *timer = &pool[j];
+
+      SNAP_WRITE(snap, timer->active);
+
+      if (!timer->active) {
+        continue;
+      }
+
+      SNAP_WRITE(snap, timer->expire);
+      SNAP_WRITE(snap, timer->order);
+      sched_save_cb(sched, snap, timer->cb, timer->data);
+    }
+  }
+
+  SNAP_WRITE(snap, sched->next_order);
+  SNAP_WRITE(snap, sched->base_time);
+}
+
+void sched_destroy(struct scheduler *sched) {
+  list_for_each_entry_safe(worker, &sched->workers, struct sched_worker, it) {
+    sched_destroy_worker(worker);
+  }
+
+  for (int i = 0; i < sched->num_pools; i++) {
+    free(sched->pools[i]);
+  }
+  free(sched->pools);
+  free(sched->heap);
+  free(sched);
 }
 
 struct scheduler *sched_create(struct dreamcast *dc) {
@@ -117,11 +727,8 @@ struct scheduler *sched_create(struct dreamcast *dc) {
 
   sched->dc = dc;
 
-  /* add all timers to the free list initially */
-  for (int i = 0; i < MAX_TIMERS; i++) {
-    struct timer *timer = &sched->timers[i];
-    list_add(&sched->free_timers, &timer->it);
-  }
+  /* allocate the initial pool of timers */
+  sched_alloc_timers(sched);
 
   return sched;
 }
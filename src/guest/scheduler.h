@@ -4,7 +4,9 @@
 #include <stdint.h>
 #include "core/time.h"
 
+struct device;
 struct dreamcast;
+struct snapshot;
 struct timer;
 struct scheduler;
 
@@ -19,10 +21,32 @@ struct scheduler *sched_create(struct dreamcast *dc);
 void sched_destroy(struct scheduler *sch);
 
 void sched_tick(struct scheduler *sch, int64_t ns);
+void sched_break(struct scheduler *sch);
+
+void sched_debug_menu(struct scheduler *sch);
+void sched_sync(struct scheduler *sch, struct device *dev);
+int sched_in_worker(struct scheduler *sch);
+
+void sched_save(struct scheduler *sch, struct snapshot *snap);
+void sched_load(struct scheduler *sch, struct snapshot *snap);
+
+/* devices save the timers and callbacks they hold onto through these, rather
+   than their addresses. callbacks must be in the table of the device owning
+   them, with their data pointing into that device, see device.timer_cbs */
+void sched_save_timer(struct scheduler *sch, struct snapshot *snap,
+                      struct timer *timer);
+struct timer *sched_load_timer(struct scheduler *sch, struct snapshot *snap);
+void sched_save_cb(struct scheduler *sch, struct snapshot *snap, timer_cb cb,
+                   void *data);
+void sched_load_cb(struct scheduler *sch, struct snapshot *snap, timer_cb *cb,
+                   void **data);
 
 struct timer *sched_start_timer(struct scheduler *sch, timer_cb cb, void *data,
                                 int64_t ns);
 int64_t sched_remaining_time(struct scheduler *sch, struct timer *);
+
+/* time the scheduler has advanced devices to */
+int64_t sched_current_time(struct scheduler *sch);
 void sched_cancel_timer(struct scheduler *sch, struct timer *);
 
 #endif
@@ -1,18 +1,23 @@
 #include "guest/sh4/sh4.h"
 #include "core/core.h"
+#include "core/time.h"
 #include "guest/bios/bios.h"
 #include "guest/dreamcast.h"
 #include "guest/memory.h"
 #include "guest/scheduler.h"
+#include "guest/snapshot.h"
 #include "imgui.h"
 #include "jit/frontend/sh4/sh4_fallback.h"
 #include "jit/frontend/sh4/sh4_frontend.h"
 #include "jit/frontend/sh4/sh4_guest.h"
 #include "jit/jit.h"
+#include "options.h"
 #include "stats.h"
 
 #if ARCH_X64
 #include "jit/backend/x64/x64_backend.h"
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
 #else
 #include "jit/backend/interp/interp_backend.h"
 #endif
@@ -20,6 +25,12 @@
 /* callbacks to service sh4_reg_read / sh4_reg_write calls */
 struct reg_cb sh4_cb[SH4_NUM_REGS];
 
+static const struct reg_info sh4_reg_info[] = {
+#define SH4_REG(addr, name, default, type) {name, addr, #name},
+#include "guest/sh4/sh4_regs.inc"
+#undef SH4_REG
+};
+
 struct sh4_exception_info sh4_exceptions[SH4_NUM_EXCEPTIONS] = {
 #define SH4_EXC(name, expevt, offset, prilvl, priord) \
   {expevt, offset, prilvl, priord},
@@ -70,7 +81,7 @@ static void sh4_sleep(void *data) {
   sh4->ctx.sleep_mode = 1;
 }
 
-static void sh4_exception(struct sh4 *sh4, enum sh4_exception exc) {
+void sh4_raise_exception(struct sh4 *sh4, enum sh4_exception exc) {
   struct sh4_exception_info *exc_info = &sh4_exceptions[exc];
 
   /* let the custom exception handler have a first chance */
@@ -91,6 +102,18 @@ static void sh4_exception(struct sh4 *sh4, enum sh4_exception exc) {
 }
 
 static void sh4_check_interrupts(struct sh4 *sh4) {
+  /* restore the cycles remaining before a yield was forced */
+  if (sh4->ctx.yielding) {
+    sh4->ctx.run_cycles = sh4->ctx.yield_cycles;
+    sh4->ctx.yielding = 0;
+  }
+
+  /* watchpoints force a yield as well when their page is written to, stop
+     before taking any interrupt if one was hit */
+  if (sh4->watchpoint_fired && sh4_dbg_watchpoint_fired(sh4)) {
+    return;
+  }
+
   if (!sh4->ctx.pending_interrupts) {
     return;
   }
@@ -117,7 +140,18 @@ static void sh4_link_code(struct sh4 *sh4, void *branch, uint32_t target) {
   jit_link_code(sh4->jit, branch, target);
 }
 
+static void sh4_uncache_code(struct sh4 *sh4, uint32_t addr) {
+  jit_uncache_code(sh4->jit, addr);
+}
+
 static void sh4_compile_code(struct sh4 *sh4, uint32_t addr) {
+  /* blocks don't cross a page while translating, raise an instruction tlb
+     miss up front for a block whose page has no translation, compiling its
+     handler instead */
+  if (sh4->mmu_enabled && !sh4_mmu_fetch(sh4, addr)) {
+    addr = sh4->ctx.pc;
+  }
+
   jit_compile_code(sh4->jit, addr);
 }
 
@@ -158,7 +192,7 @@ static void sh4_invalid_instr(struct sh4 *sh4) {
 
   CHECK_EQ(def->op, SH4_OP_INVALID);
 
-  sh4_exception(sh4, exc);
+  sh4_raise_exception(sh4, exc);
 }
 
 static void sh4_run(struct device *dev, int64_t ns) {
@@ -169,11 +203,23 @@ static void sh4_run(struct device *dev, int64_t ns) {
   int cycles = (int)NANO_TO_CYCLES(ns, SH4_CLOCK_FREQ);
   cycles = MAX(cycles, 1);
 
+  /* take any interrupt raised in between runs before starting, the yield it
+     forced being superseded by the new run's cycles */
+  ctx->yielding = 0;
+  sh4_check_interrupts(sh4);
+
   jit_run(sh4->jit, cycles);
 
   prof_counter_add(COUNTER_sh4_instrs, sh4->ctx.ran_instrs);
 }
 
+static int sh4_idle(struct device *dev) {
+  struct sh4 *sh4 = (struct sh4 *)dev;
+
+  /* while sleeping, nothing is executed until an interrupt wakes it up */
+  return sh4->ctx.sleep_mode && !sh4->ctx.pending_interrupts;
+}
+
 static void sh4_guest_destroy(struct jit_guest *guest) {
   free((struct sh4_guest *)guest);
 }
@@ -189,12 +235,15 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
   guest->membase = sh4_base(sh4->dc->mem);
   guest->mem = sh4->dc->mem;
   guest->lookup = &sh4_lookup;
+  guest->immutable = &sh4_immutable;
   guest->r8 = &sh4_read8;
   guest->r16 = &sh4_read16;
   guest->r32 = &sh4_read32;
+  guest->r64 = &sh4_read64;
   guest->w8 = &sh4_write8;
   guest->w16 = &sh4_write16;
   guest->w32 = &sh4_write32;
+  guest->w64 = &sh4_write64;
 
   /* runtime interface */
   guest->data = sh4;
@@ -205,6 +254,7 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
       (int)offsetof(struct sh4_context, pending_interrupts);
   guest->compile_code = (jit_compile_cb)&sh4_compile_code;
   guest->link_code = (jit_link_cb)&sh4_link_code;
+  guest->uncache_code = (jit_uncache_cb)&sh4_uncache_code;
   guest->check_interrupts = (jit_interrupt_cb)&sh4_check_interrupts;
   guest->invalid_instr = (sh4_invalid_instr_cb)&sh4_invalid_instr;
   guest->ltlb = (sh4_ltlb_cb)&sh4_mmu_ltlb;
@@ -216,6 +266,84 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
   return (struct jit_guest *)guest;
 }
 
+static int sh4_code_restored(struct sh4 *sh4, uint32_t addr, int size) {
+  return sh4_restored(sh4->dc->mem, addr, size);
+}
+
+static const timer_cb sh4_timer_cbs[] = {
+    &sh4_tmu_expire_0, &sh4_tmu_expire_1, &sh4_tmu_expire_2,
+    &sh4_dmac_end_0,   &sh4_dmac_end_1,   &sh4_dmac_end_2,
+    &sh4_dmac_end_3};
+
+static void sh4_load(struct device *dev, struct snapshot *snap) {
+  struct sh4 *sh4 = (struct sh4 *)dev;
+  struct scheduler *sched = sh4->dc->sched;
+
+  SNAP_READ(snap, sh4->ctx);
+  SNAP_READ(snap, sh4->reg);
+  SNAP_READ(snap, sh4->sq);
+  SNAP_READ(snap, sh4->sorted_interrupts);
+  SNAP_READ(snap, sh4->sort_id);
+  SNAP_READ(snap, sh4->priority_mask);
+  SNAP_READ(snap, sh4->requested_interrupts);
+  SNAP_READ(snap, sh4->utlb_sq_map);
+  SNAP_READ(snap, sh4->utlb);
+  SNAP_READ(snap, sh4->SCFSR2_last_read);
+  SNAP_READ(snap, sh4->receive_fifo);
+  SNAP_READ(snap, sh4->transmit_fifo);
+  SNAP_READ(snap, sh4->tmu_base);
+  SNAP_READ(snap, sh4->tmu_underflows);
+  for (int i = 0; i < 3; i++) {
+    sh4->tmu_timers[i] = sched_load_timer(sched, snap);
+  }
+  for (int i = 0; i < 4; i++) {
+    sh4->dma_timers[i] = sched_load_timer(sched, snap);
+    sched_load_cb(sched, snap, &sh4->dma_end[i], &sh4->dma_end_data[i]);
+  }
+  snap_read(snap, mem_ocram(sh4->dc->mem, 0), SH4_ORA_SIZE);
+
+  sh4_ccn_map_ocram(sh4);
+
+  /* switch the guest's accessors over if the restored MMUCR changed whether
+     addresses are translated, and drop any cached translations */
+  sh4_mmu_update(sh4);
+  sh4_mmu_flush(sh4);
+
+  /* with address translation enabled, blocks are keyed by virtual address and
+     have already been invalidated by the flush */
+  if (!sh4->mmu_enabled) {
+    jit_invalidate_blocks(sh4->jit, (jit_modified_cb)&sh4_code_restored, sh4);
+  }
+}
+
+static void sh4_save(struct device *dev, struct snapshot *snap) {
+  struct sh4 *sh4 = (struct sh4 *)dev;
+  struct scheduler *sched = sh4->dc->sched;
+
+  SNAP_WRITE(snap, sh4->ctx);
+  SNAP_WRITE(snap, sh4->reg);
+  SNAP_WRITE(snap, sh4->sq);
+  SNAP_WRITE(snap, sh4->sorted_interrupts);
+  SNAP_WRITE(snap, sh4->sort_id);
+  SNAP_WRITE(snap, sh4->priority_mask);
+  SNAP_WRITE(snap, sh4->requested_interrupts);
+  SNAP_WRITE(snap, sh4->utlb_sq_map);
+  SNAP_WRITE(snap, sh4->utlb);
+  SNAP_WRITE(snap, sh4->SCFSR2_last_read);
+  SNAP_WRITE(snap, sh4->receive_fifo);
+  SNAP_WRITE(snap, sh4->transmit_fifo);
+  SNAP_WRITE(snap, sh4->tmu_base);
+  SNAP_WRITE(snap, sh4->tmu_underflows);
+  for (int i = 0; i < 3; i++) {
+    sched_save_timer(sched, snap, sh4->tmu_timers[i]);
+  }
+  for (int i = 0; i < 4; i++) {
+    sched_save_timer(sched, snap, sh4->dma_timers[i]);
+    sched_save_cb(sched, snap, sh4->dma_end[i], sh4->dma_end_data[i]);
+  }
+  snap_write(snap, mem_ocram(sh4->dc->mem, 0), SH4_ORA_SIZE);
+}
+
 static int sh4_init(struct device *dev) {
   struct sh4 *sh4 = (struct sh4 *)dev;
   struct dreamcast *dc = sh4->dc;
@@ -225,12 +353,24 @@ static int sh4_init(struct device *dev) {
   sh4->frontend = sh4_frontend_create(sh4->guest);
 #if ARCH_X64
   DEFINE_JIT_CODE_BUFFER(sh4_code);
-  sh4->backend = x64_backend_create(sh4->guest, sh4_code, sizeof(sh4_code));
+  sh4->backend =
+      x64_backend_create(sh4->guest, &sh4_code, OPTION_jit_code_budget << 20,
+                         OPTION_jit_wx, OPTION_huge_pages);
+#elif ARCH_A64
+  DEFINE_JIT_CODE_BUFFER(sh4_code);
+  sh4->backend = a64_backend_create(sh4->guest, &sh4_code);
 #else
   sh4->backend = interp_backend_create(sh4->guest, sh4->frontend);
 #endif
   sh4->jit = jit_create("sh4", sh4->frontend, sh4->backend);
 
+/* bind the registers to their storage. this is done once here rather than on
+   reset, as a snapshot may be loaded without the cpu ever having been reset */
+#define SH4_REG(addr, name, default, type) \
+  sh4->name = (type *)&sh4->reg[name];
+#include "guest/sh4/sh4_regs.inc"
+#undef SH4_REG
+
   return 1;
 }
 
@@ -240,6 +380,9 @@ void sh4_clear_interrupt(struct sh4 *sh4, enum sh4_interrupt intr) {
 }
 
 void sh4_raise_interrupt(struct sh4 *sh4, enum sh4_interrupt intr) {
+  /* catch up to the time the interrupt is raised at before taking it */
+  sched_sync(sh4->dc->sched, (struct device *)sh4);
+
   sh4->requested_interrupts |= sh4->sort_id[intr];
   sh4_intc_update_pending(sh4);
 }
@@ -263,15 +406,16 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc) {
   sh4_explode_sr(&sh4->ctx);
 
 /* initialize registers */
-#define SH4_REG(addr, name, default, type) \
-  sh4->reg[name] = default;                \
-  sh4->name = (type *)&sh4->reg[name];
+#define SH4_REG(addr, name, default, type) sh4->reg[name] = default;
 #include "guest/sh4/sh4_regs.inc"
 #undef SH4_REG
 
   /* reset tlb */
-  memset(sh4->utlb_sq_map, 0, sizeof(sh4->utlb_sq_map));
-  memset(sh4->utlb, 0, sizeof(sh4->utlb));
+  sh4_mmu_reset(sh4);
+
+  /* reset cache ram */
+  memset(mem_ocram(sh4->dc->mem, 0), 0, SH4_ORA_SIZE);
+  sh4_ccn_map_ocram(sh4);
 
   /* reset interrupts */
   sh4_intc_reprioritize(sh4);
@@ -280,6 +424,93 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc) {
 }
 
 #ifdef HAVE_IMGUI
+#define SH4_BLOCK_STATS_ROWS 32
+
+static void sh4_block_stats_menu(struct sh4 *sh4) {
+  struct jit *jit = sh4->jit;
+
+  if (igBegin("block stats", NULL, 0)) {
+    if (!jit->profile_code) {
+      igText("start profiling code to collect block stats");
+    }
+
+    igColumns(7, NULL, 0);
+
+    igText("guest addr");
+    igNextColumn();
+    igText("guest size");
+    igNextColumn();
+    igText("host size");
+    igNextColumn();
+    igText("fallbacks");
+    igNextColumn();
+    igText("entries");
+    igNextColumn();
+    igText("est. ms");
+    igNextColumn();
+    igText("branch hits");
+    igNextColumn();
+
+    struct jit_block *blocks[SH4_BLOCK_STATS_ROWS];
+    int num_blocks = jit_profile_report(jit, blocks, SH4_BLOCK_STATS_ROWS);
+
+    for (int i = 0; i < num_blocks; i++) {
+      struct jit_block *block = blocks[i];
+      struct jit_profile *prof = block->profile;
+
+      igText("0x%08x", block->guest_addr);
+      igNextColumn();
+      igText("%d", block->guest_size);
+      igNextColumn();
+      igText("%d", block->host_size);
+      igNextColumn();
+      igText("%d", block->num_fallbacks);
+      igNextColumn();
+      igText("%" PRIu64, prof->num_entries);
+      igNextColumn();
+      igText("%.3f", prof->sampled_ns * (double)JIT_PROFILE_SAMPLE_RATE /
+                         (double)NS_PER_MS);
+      igNextColumn();
+      igText("%" PRIu64 " / %" PRIu64, prof->branch_hits,
+             prof->branch_hits + prof->branch_misses);
+      igNextColumn();
+    }
+
+    igEnd();
+  }
+}
+
+#define SH4_FALLBACK_STATS_ROWS 32
+
+static void sh4_fallback_stats_menu(struct sh4 *sh4) {
+  struct jit *jit = sh4->jit;
+
+  if (igBegin("fallback stats", NULL, 0)) {
+    if (!jit->profile_code) {
+      igText("start profiling code to collect fallback stats");
+    }
+
+    igColumns(2, NULL, 0);
+
+    igText("op");
+    igNextColumn();
+    igText("execs");
+    igNextColumn();
+
+    struct jit_fallback_stat stats[SH4_FALLBACK_STATS_ROWS];
+    int num_stats = jit_fallback_report(jit, stats, SH4_FALLBACK_STATS_ROWS);
+
+    for (int i = 0; i < num_stats; i++) {
+      igText("%s", stats[i].def->name);
+      igNextColumn();
+      igText("%" PRIu64, stats[i].num_execs);
+      igNextColumn();
+    }
+
+    igEnd();
+  }
+}
+
 void sh4_debug_menu(struct sh4 *sh4) {
   struct jit *jit = sh4->jit;
 
@@ -300,6 +531,34 @@ void sh4_debug_menu(struct sh4 *sh4) {
         }
       }
 
+      if (!jit->profile_code) {
+        if (igMenuItem("start profiling code", NULL, 0, 1)) {
+          jit->profile_code = 1;
+          jit_invalidate_code(jit);
+        }
+      } else {
+        if (igMenuItem("stop profiling code", NULL, 1, 1)) {
+          jit->profile_code = 0;
+          jit_invalidate_code(jit);
+        }
+      }
+
+      if (igMenuItem("block stats", NULL, sh4->block_stats, 1)) {
+        sh4->block_stats = !sh4->block_stats;
+      }
+
+      if (igMenuItem("dump block stats", NULL, 0, 1)) {
+        jit_dump_profile(jit, JIT_PROFILE_MAX_BLOCKS);
+      }
+
+      if (igMenuItem("fallback stats", NULL, sh4->fallback_stats, 1)) {
+        sh4->fallback_stats = !sh4->fallback_stats;
+      }
+
+      if (igMenuItem("dump fallback stats", NULL, 0, 1)) {
+        jit_dump_fallbacks(jit, JIT_FALLBACK_MAX_OPS);
+      }
+
       if (igMenuItem("log reg access", NULL, sh4->log_regs, 1)) {
         sh4->log_regs = !sh4->log_regs;
       }
@@ -317,10 +576,19 @@ void sh4_debug_menu(struct sh4 *sh4) {
   if (sh4->tmu_stats) {
     sh4_tmu_debug_menu(sh4);
   }
+
+  if (sh4->block_stats) {
+    sh4_block_stats_menu(sh4);
+  }
+
+  if (sh4->fallback_stats) {
+    sh4_fallback_stats_menu(sh4);
+  }
 }
 #endif
 
 void sh4_destroy(struct sh4 *sh4) {
+  sh4_dbg_destroy(sh4);
   jit_destroy(sh4->jit);
   sh4_guest_destroy(sh4->guest);
   sh4->frontend->destroy(sh4->frontend);
@@ -344,6 +612,20 @@ struct sh4 *sh4_create(struct dreamcast *dc) {
   /* setup run interface */
   sh4->runif.enabled = 1;
   sh4->runif.run = &sh4_run;
+  sh4->runif.idle = &sh4_idle;
+  sh4->runif.quantum = SH4_QUANTUM;
+
+  /* setup snapshot interface */
+  sh4->snapif.enabled = 1;
+  sh4->snapif.save = &sh4_save;
+  sh4->snapif.load = &sh4_load;
+
+  /* setup timer callbacks */
+  sh4->timer_cbs = sh4_timer_cbs;
+  sh4->num_timer_cbs = ARRAY_SIZE(sh4_timer_cbs);
+
+  reg_stats_register(dc->reg_stats, &sh4->reg_block, "sh4", sh4_reg_info,
+                     ARRAY_SIZE(sh4_reg_info), sh4->reg_counts);
 
   return sh4;
 }
@@ -2,6 +2,7 @@
 #define SH4_H
 
 #include "guest/dreamcast.h"
+#include "guest/reg_stats.h"
 #include "guest/sh4/sh4_ccn.h"
 #include "guest/sh4/sh4_dbg.h"
 #include "guest/sh4/sh4_dmac.h"
@@ -22,6 +23,10 @@ struct jit_guest;
 
 #define SH4_CLOCK_FREQ INT64_C(200000000)
 
+/* minimum slice of time worth entering the jit for. interrupts sync the cpu
+   early, so this only bounds how stale polled state can be */
+#define SH4_QUANTUM INT64_C(20000)
+
 typedef int (*sh4_exception_handler_cb)(void *, enum sh4_exception);
 
 struct sh4 {
@@ -33,6 +38,10 @@ struct sh4 {
 #include "guest/sh4/sh4_regs.inc"
 #undef SH4_REG
 
+  /* access counts for the machine's reg_stats, indexed by offset */
+  struct reg_counts reg_counts[SH4_NUM_REGS];
+  struct reg_block reg_block;
+
   /* custom exception handler */
   sh4_exception_handler_cb exc_handler;
   void *exc_handler_data;
@@ -46,7 +55,11 @@ struct sh4 {
   /* dbg */
   int log_regs;
   int tmu_stats;
+  int block_stats;
+  int fallback_stats;
   struct list breakpoints;
+  struct list watchpoints;
+  int watchpoint_fired;
 
   /* ccn */
   uint32_t sq[2][8];
@@ -61,14 +74,25 @@ struct sh4 {
   /* mmu */
   uint32_t utlb_sq_map[64];
   struct sh4_tlb_entry utlb[64];
+  struct jit_tlb_entry tlb_cache[JIT_TLB_SIZE];
+  int mmu_enabled;
 
   /* scif */
   uint32_t SCFSR2_last_read;
   struct sh4_scif_fifo receive_fifo;
   struct sh4_scif_fifo transmit_fifo;
 
-  /* tmu */
+  /* tmu. a running channel's count is derived from the time elapsed since it
+     was last written, with TCNT holding the count at that time. underflows
+     are only scheduled for channels generating interrupts on them */
+  int64_t tmu_base[3];
+  int64_t tmu_underflows[3];
   struct timer *tmu_timers[3];
+
+  /* dmac, transfers in flight on each channel */
+  struct timer *dma_timers[4];
+  void (*dma_end[4])(void *);
+  void *dma_end_data[4];
 };
 
 extern struct reg_cb sh4_cb[SH4_NUM_REGS];
@@ -82,6 +106,7 @@ void sh4_reset(struct sh4 *sh4, uint32_t pc);
 
 void sh4_set_exception_handler(struct sh4 *sh4,
                                sh4_exception_handler_cb handler, void *data);
+void sh4_raise_exception(struct sh4 *sh4, enum sh4_exception exc);
 
 void sh4_raise_interrupt(struct sh4 *sh4, enum sh4_interrupt intr);
 void sh4_clear_interrupt(struct sh4 *sh4, enum sh4_interrupt intr);
@@ -1,4 +1,5 @@
 #include "guest/memory.h"
+#include "guest/pvr/ta.h"
 #include "guest/sh4/sh4.h"
 #include "jit/jit.h"
 
@@ -26,7 +27,13 @@ static void sh4_ccn_reset(struct sh4 *sh4) {
      end the block */
   LOG_INFO("sh4_ccn_reset");
 
-  jit_invalidate_code(sh4->jit);
+  jit_invalidate_modified_code(sh4->jit);
+}
+
+void sh4_ccn_map_ocram(struct sh4 *sh4) {
+  /* when enabled, the cache ram is mapped directly into the address space
+     such that fastmem accesses to it don't go through the callbacks below */
+  sh4_map_ocram(sh4->dc->mem, sh4->CCR->ORA, sh4->CCR->OIX);
 }
 
 void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr) {
@@ -39,12 +46,11 @@ void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr) {
   uint32_t sqi = (addr & 0x20) >> 5;
 
   if (sh4->MMUCR->AT) {
-    /* get upper 12 bits from UTLB */
+    /* offset the lower 20 bits of the original address by the translation
+       of its 1mb slot */
     uint32_t vpn = addr >> 20;
     dst = sh4->utlb_sq_map[vpn & 0x3f];
-
-    /* get lower 20 bits from original address */
-    dst |= addr & 0xfffe0;
+    dst += addr & 0xfffe0;
   } else {
     /* get upper 6 bits from QACR* registers */
     if (sqi) {
@@ -57,6 +63,19 @@ void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr) {
     dst |= addr & 0x3ffffe0;
   }
 
+  /* the bulk of store queue flushes are polygons headed for the ta fifo. hand
+     these straight to the ta, skipping the address space lookup */
+  uint32_t area4 = dst & SH4_ADDR_MASK;
+
+  if (area4 >= SH4_AREA4_BEGIN && area4 <= SH4_AREA4_END) {
+    area4 &= SH4_AREA4_ADDR_MASK;
+
+    if (area4 >= SH4_TA_POLY_BEGIN && area4 <= SH4_TA_POLY_END) {
+      ta_poly_write(sh4->dc->ta, area4, (const uint8_t *)sh4->sq[sqi], 32);
+      return;
+    }
+  }
+
   sh4_memcpy_to_guest(mem, dst, sh4->sq[sqi], 32);
 }
 
@@ -69,7 +88,7 @@ uint32_t sh4_ccn_cache_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
   }
 
   addr = CACHE_OFFSET(addr, sh4->CCR->OIX);
-  return READ_DATA(&sh4->ctx.cache[addr]);
+  return READ_DATA(mem_ocram(sh4->dc->mem, addr));
 }
 
 void sh4_ccn_cache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
@@ -81,7 +100,7 @@ void sh4_ccn_cache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
 
   CHECK_EQ(sh4->CCR->ORA, 1u);
   addr = CACHE_OFFSET(addr, sh4->CCR->OIX);
-  WRITE_DATA(&sh4->ctx.cache[addr]);
+  WRITE_DATA(mem_ocram(sh4->dc->mem, addr));
 }
 
 uint32_t sh4_ccn_sq_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
@@ -132,18 +151,31 @@ REG_W32(sh4_cb, MMUCR) {
 
   sh4->MMUCR->full = value;
 
-  if (sh4->MMUCR->AT) {
-    LOG_WARNING("MMU not fully supported");
+  sh4_mmu_update(sh4);
+}
+
+REG_W32(sh4_cb, PTEH) {
+  struct sh4 *sh4 = dc->sh4;
+  uint32_t old_asid = sh4->PTEH->ASID;
+
+  sh4->PTEH->full = value;
+
+  /* cached translations are only valid for the current asid */
+  if (sh4->PTEH->ASID != old_asid) {
+    sh4_mmu_asid_changed(sh4, old_asid);
   }
 }
 
 REG_W32(sh4_cb, CCR) {
   struct sh4 *sh4 = dc->sh4;
 
-  /* TODO check for cache toggle
-  union ccr CCR_OLD = *sh4->CCR;*/
+  union ccr old = *sh4->CCR;
   sh4->CCR->full = value;
 
+  if (sh4->CCR->ORA != old.ORA || sh4->CCR->OIX != old.OIX) {
+    sh4_ccn_map_ocram(sh4);
+  }
+
   if (sh4->CCR->ICI) {
     sh4_ccn_reset(sh4);
   }
@@ -1,6 +1,7 @@
 #ifndef SH4_CCN_H
 #define SH4_CCN_H
 
+void sh4_ccn_map_ocram(struct sh4 *sh4);
 void sh4_ccn_pref(struct sh4 *sh4, uint32_t addr);
 uint32_t sh4_ccn_cache_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_ccn_cache_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
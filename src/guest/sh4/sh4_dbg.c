@@ -1,4 +1,6 @@
 #include "guest/debugger.h"
+#include "core/exception_handler.h"
+#include "core/memory.h"
 #include "guest/memory.h"
 #include "guest/sh4/sh4.h"
 #include "jit/frontend/sh4/sh4_disasm.h"
@@ -10,6 +12,23 @@ struct breakpoint {
   struct list_node it;
 };
 
+/* write watchpoints are implemented with a single-write watch on both the
+   fastmem mapping of the watched address and the guest memory backing it,
+   leaving compiled code running at full speed until the page is written to.
+   as with the jit's code watches, writes through the address's mirrors
+   aren't caught
+
+   the gdb protocol doesn't pass the size being watched down to the device,
+   so each watchpoint covers the aligned 32-bit word containing its address */
+struct watchpoint {
+  struct sh4 *sh4;
+  uint32_t addr;
+  uint8_t *ptrs[2];
+  struct memory_watch *watches[2];
+  int hit;
+  struct list_node it;
+};
+
 static struct breakpoint *lookup_breakpoint(struct sh4 *sh4, uint32_t addr) {
   list_for_each_entry(bp, &sh4->breakpoints, struct breakpoint, it) {
     if (bp->addr == addr) {
@@ -33,6 +52,141 @@ static struct breakpoint *create_breakpoint(struct sh4 *sh4, uint32_t addr,
   return bp;
 }
 
+static struct watchpoint *lookup_watchpoint(struct sh4 *sh4, uint32_t addr) {
+  list_for_each_entry(wp, &sh4->watchpoints, struct watchpoint, it) {
+    if (wp->addr == addr) {
+      return wp;
+    }
+  }
+  return NULL;
+}
+
+static void watchpoint_written(const struct exception_state *ex, void *data) {
+  struct watchpoint *wp = data;
+  struct sh4 *sh4 = wp->sh4;
+  uintptr_t page_size = get_page_size();
+
+  /* the watcher removes the watch after this returns, figure out which of
+     the watchpoint's watches it was */
+  for (int i = 0; i < 2; i++) {
+    uintptr_t ptr = (uintptr_t)wp->ptrs[i];
+    uintptr_t page = ALIGN_DOWN(ptr, page_size);
+
+    if (!wp->watches[i] || ex->fault_addr < page ||
+        ex->fault_addr >= page + page_size) {
+      continue;
+    }
+
+    wp->watches[i] = NULL;
+
+    if (ALIGN_DOWN(ex->fault_addr, 4) == ALIGN_DOWN(ptr, 4)) {
+      wp->hit = 1;
+    }
+  }
+
+  /* this is called from inside of the exception handler, so the watches
+     can't be placed again until the faulting write has completed. force a
+     yield like a pending interrupt would, having sh4_dbg_watchpoint_fired
+     called before the next block */
+  if (!sh4->ctx.yielding) {
+    sh4->ctx.yield_cycles = sh4->ctx.run_cycles;
+    sh4->ctx.run_cycles = -1;
+    sh4->ctx.yielding = 1;
+  }
+
+  sh4->watchpoint_fired = 1;
+}
+
+static void watch_watchpoint(struct watchpoint *wp) {
+  for (int i = 0; i < 2; i++) {
+    if (!wp->ptrs[i] || wp->watches[i]) {
+      continue;
+    }
+
+    wp->watches[i] =
+        add_single_write_watch(wp->ptrs[i], 4, &watchpoint_written, wp);
+  }
+}
+
+static void unwatch_watchpoint(struct watchpoint *wp) {
+  uintptr_t page_size = get_page_size();
+
+  for (int i = 0; i < 2; i++) {
+    if (!wp->watches[i]) {
+      continue;
+    }
+
+    /* removing a watch doesn't restore the page's permissions */
+    void *ptr = (void *)ALIGN_DOWN((uintptr_t)wp->ptrs[i], page_size);
+    CHECK(protect_pages(ptr, page_size, ACC_READWRITE));
+    remove_memory_watch(wp->watches[i]);
+    wp->watches[i] = NULL;
+  }
+}
+
+static void destroy_watchpoint(struct sh4 *sh4, struct watchpoint *wp) {
+  unwatch_watchpoint(wp);
+  list_remove(&sh4->watchpoints, &wp->it);
+  free(wp);
+}
+
+static struct watchpoint *create_watchpoint(struct sh4 *sh4, uint32_t addr) {
+  struct memory *mem = sh4->dc->mem;
+  struct watchpoint *wp = calloc(1, sizeof(struct watchpoint));
+  wp->sh4 = sh4;
+  wp->addr = addr;
+
+  /* only addresses backed by memory can be watched */
+  sh4_lookup(mem, addr, NULL, &wp->ptrs[1], NULL, NULL);
+
+  if (wp->ptrs[1] && sh4_base(mem)) {
+    wp->ptrs[0] = sh4_base(mem) + addr;
+  }
+
+  list_add(&sh4->watchpoints, &wp->it);
+  return wp;
+}
+
+static int block_contains(void *data, uint32_t addr, int size) {
+  uint32_t bp_addr = *(uint32_t *)data;
+  return bp_addr >= addr && bp_addr < addr + size;
+}
+
+int sh4_dbg_watchpoint_fired(struct sh4 *sh4) {
+  int hit = 0;
+
+  sh4->watchpoint_fired = 0;
+
+  /* place the watches which fired again, now that the write has completed */
+  list_for_each_entry(wp, &sh4->watchpoints, struct watchpoint, it) {
+    hit |= wp->hit;
+    wp->hit = 0;
+    watch_watchpoint(wp);
+  }
+
+  if (!hit) {
+    return 0;
+  }
+
+  /* force a break from dispatch */
+  sh4->ctx.run_cycles = -1;
+
+  /* let the debugger know execution has stopped */
+  debugger_trap(sh4->dc->debugger);
+
+  return 1;
+}
+
+void sh4_dbg_destroy(struct sh4 *sh4) {
+  list_for_each_entry_safe(wp, &sh4->watchpoints, struct watchpoint, it) {
+    destroy_watchpoint(sh4, wp);
+  }
+
+  list_for_each_entry_safe(bp, &sh4->breakpoints, struct breakpoint, it) {
+    destroy_breakpoint(sh4, bp);
+  }
+}
+
 int sh4_dbg_invalid_instr(struct sh4 *sh4) {
   uint32_t pc = sh4->ctx.pc;
 
@@ -107,14 +261,26 @@ void sh4_dbg_remove_breakpoint(struct device *dev, int type, uint32_t addr) {
   struct sh4 *sh4 = (struct sh4 *)dev;
   struct memory *mem = sh4->dc->mem;
 
+  if (type == DEBUGGER_BP_WRITE) {
+    struct watchpoint *wp = lookup_watchpoint(sh4, addr);
+    CHECK_NOTNULL(wp);
+    destroy_watchpoint(sh4, wp);
+    return;
+  }
+
+  if (type != DEBUGGER_BP_SW && type != DEBUGGER_BP_HW) {
+    return;
+  }
+
   struct breakpoint *bp = lookup_breakpoint(sh4, addr);
   CHECK_NOTNULL(bp);
 
   /* restore the original instruction */
   sh4_write16(mem, addr, bp->instr);
 
-  /* free code cache to remove block containing the invalid instruction  */
-  jit_free_code(sh4->jit);
+  /* invalidate only the blocks containing the invalid instruction, the rest
+     of the code cache is left intact */
+  jit_invalidate_blocks(sh4->jit, &block_contains, &addr);
 
   destroy_breakpoint(sh4, bp);
 }
@@ -123,14 +289,32 @@ void sh4_dbg_add_breakpoint(struct device *dev, int type, uint32_t addr) {
   struct sh4 *sh4 = (struct sh4 *)dev;
   struct memory *mem = sh4->dc->mem;
 
+  if (type == DEBUGGER_BP_WRITE) {
+    struct watchpoint *wp = create_watchpoint(sh4, addr);
+
+    if (!wp->ptrs[0] && !wp->ptrs[1]) {
+      LOG_WARNING("sh4_dbg_add_breakpoint can't watch mmio address 0x%08x",
+                  addr);
+    }
+
+    watch_watchpoint(wp);
+    return;
+  }
+
+  if (type != DEBUGGER_BP_SW && type != DEBUGGER_BP_HW) {
+    LOG_WARNING("sh4_dbg_add_breakpoint unsupported watchpoint type %d", type);
+    return;
+  }
+
   uint16_t instr = sh4_read16(mem, addr);
   struct breakpoint *bp = create_breakpoint(sh4, addr, instr);
 
   /* write out an invalid instruction */
   sh4_write16(mem, addr, 0);
 
-  /* free code cache to remove block containing the original instruction  */
-  jit_free_code(sh4->jit);
+  /* invalidate only the blocks containing the original instruction, they're
+     recompiled with the invalid instruction trapping to the debugger */
+  jit_invalidate_blocks(sh4->jit, &block_contains, &addr);
 }
 
 void sh4_dbg_step(struct device *dev) {
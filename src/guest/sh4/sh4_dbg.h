@@ -10,5 +10,7 @@ void sh4_dbg_read_memory(struct device *dev, uint32_t addr, uint8_t *buffer,
 void sh4_dbg_read_register(struct device *dev, int n, uint64_t *value,
                            int *size);
 int sh4_dbg_invalid_instr(struct sh4 *sh4);
+int sh4_dbg_watchpoint_fired(struct sh4 *sh4);
+void sh4_dbg_destroy(struct sh4 *sh4);
 
 #endif
@@ -1,6 +1,11 @@
 #include "guest/memory.h"
+#include "guest/scheduler.h"
 #include "guest/sh4/sh4.h"
 
+/* rate dual address mode transfers move data at, 32-byte blocks over the
+   64-bit bus at the 100mhz bus clock */
+#define SH4_DMA_RATE INT64_C(800000000)
+
 static void sh4_dmac_check(struct sh4 *sh4, int channel) {
   union chcr *chcr = NULL;
 
@@ -26,79 +31,142 @@ static void sh4_dmac_check(struct sh4 *sh4, int channel) {
         "sh4_dmac_check only DDT DMA unsupported");
 }
 
+static void sh4_dmac_channel(struct sh4 *sh4, int channel, uint32_t **sar,
+                             uint32_t **dar, uint32_t **dmatcr,
+                             union chcr **chcr, enum sh4_interrupt *dmte) {
+  switch (channel) {
+    case 0:
+      *sar = sh4->SAR0;
+      *dar = sh4->DAR0;
+      *dmatcr = sh4->DMATCR0;
+      *chcr = sh4->CHCR0;
+      *dmte = SH4_INT_DMTE0;
+      break;
+    case 1:
+      *sar = sh4->SAR1;
+      *dar = sh4->DAR1;
+      *dmatcr = sh4->DMATCR1;
+      *chcr = sh4->CHCR1;
+      *dmte = SH4_INT_DMTE1;
+      break;
+    case 2:
+      *sar = sh4->SAR2;
+      *dar = sh4->DAR2;
+      *dmatcr = sh4->DMATCR2;
+      *chcr = sh4->CHCR2;
+      *dmte = SH4_INT_DMTE2;
+      break;
+    case 3:
+      *sar = sh4->SAR3;
+      *dar = sh4->DAR3;
+      *dmatcr = sh4->DMATCR3;
+      *chcr = sh4->CHCR3;
+      *dmte = SH4_INT_DMTE3;
+      break;
+    default:
+      LOG_FATAL("Unexpected DMA channel");
+      break;
+  }
+}
+
+static void sh4_dmac_end(struct sh4 *sh4, int channel) {
+  uint32_t *sar;
+  uint32_t *dar;
+  uint32_t *dmatcr;
+  union chcr *chcr;
+  enum sh4_interrupt dmte;
+  sh4_dmac_channel(sh4, channel, &sar, &dar, &dmatcr, &chcr, &dmte);
+
+  void (*end)(void *) = sh4->dma_end[channel];
+  void *end_data = sh4->dma_end_data[channel];
+
+  sh4->dma_timers[channel] = NULL;
+  sh4->dma_end[channel] = NULL;
+  sh4->dma_end_data[channel] = NULL;
+
+  *dmatcr = 0;
+
+  /* signal transfer end */
+  chcr->TE = 1;
+
+  /* raise interrupt if requested */
+  if (chcr->IE) {
+    sh4_raise_interrupt(sh4, dmte);
+  }
+
+  if (end) {
+    end(end_data);
+  }
+}
+
+void sh4_dmac_end_0(void *data) {
+  sh4_dmac_end(data, 0);
+}
+
+void sh4_dmac_end_1(void *data) {
+  sh4_dmac_end(data, 1);
+}
+
+void sh4_dmac_end_2(void *data) {
+  sh4_dmac_end(data, 2);
+}
+
+void sh4_dmac_end_3(void *data) {
+  sh4_dmac_end(data, 3);
+}
+
 void sh4_dmac_ddt(struct sh4 *sh4, struct sh4_dtr *dtr) {
   struct memory *mem = sh4->dc->mem;
-
-  /* FIXME this should be made asynchronous, at which point the significance
-     of the registers / interrupts should be more obvious */
+  struct scheduler *sched = sh4->dc->sched;
 
   if (dtr->data) {
-    /* single address mode transfer */
+    /* single address mode transfer. these are made on behalf of a device
+       which models the transfer's timing itself */
     if (dtr->dir == SH4_DMA_FROM_ADDR) {
       sh4_memcpy_to_host(mem, dtr->data, dtr->addr, dtr->size);
     } else {
       sh4_memcpy_to_guest(mem, dtr->addr, dtr->data, dtr->size);
     }
-  } else {
-    /* dual address mode transfer */
-    uint32_t *sar;
-    uint32_t *dar;
-    uint32_t *dmatcr;
-    union chcr *chcr;
-    enum sh4_interrupt dmte;
-
-    switch (dtr->channel) {
-      case 0:
-        sar = sh4->SAR0;
-        dar = sh4->DAR0;
-        dmatcr = sh4->DMATCR0;
-        chcr = sh4->CHCR0;
-        dmte = SH4_INT_DMTE0;
-        break;
-      case 1:
-        sar = sh4->SAR1;
-        dar = sh4->DAR1;
-        dmatcr = sh4->DMATCR1;
-        chcr = sh4->CHCR1;
-        dmte = SH4_INT_DMTE1;
-        break;
-      case 2:
-        sar = sh4->SAR2;
-        dar = sh4->DAR2;
-        dmatcr = sh4->DMATCR2;
-        chcr = sh4->CHCR2;
-        dmte = SH4_INT_DMTE2;
-        break;
-      case 3:
-        sar = sh4->SAR3;
-        dar = sh4->DAR3;
-        dmatcr = sh4->DMATCR3;
-        chcr = sh4->CHCR3;
-        dmte = SH4_INT_DMTE3;
-        break;
-      default:
-        LOG_FATAL("Unexpected DMA channel");
-        break;
-    }
-
-    uint32_t src = dtr->dir == SH4_DMA_FROM_ADDR ? dtr->addr : *sar;
-    uint32_t dst = dtr->dir == SH4_DMA_FROM_ADDR ? *dar : dtr->addr;
-    int size = *dmatcr * 32;
-    sh4_memcpy(mem, dst, src, size);
-
-    /* update src / addresses as well as remaining count */
-    *sar = src + size;
-    *dar = dst + size;
-    *dmatcr = 0;
-
-    /* signal transfer end */
-    chcr->TE = 1;
+    return;
+  }
 
-    /* raise interrupt if requested */
-    if (chcr->IE) {
-      sh4_raise_interrupt(sh4, dmte);
-    }
+  /* dual address mode transfer */
+  uint32_t *sar;
+  uint32_t *dar;
+  uint32_t *dmatcr;
+  union chcr *chcr;
+  enum sh4_interrupt dmte;
+  sh4_dmac_channel(sh4, dtr->channel, &sar, &dar, &dmatcr, &chcr, &dmte);
+
+  /* a channel only runs one transfer at a time, finish off the previous one
+     if it's still in flight */
+  if (sh4->dma_timers[dtr->channel]) {
+    sched_cancel_timer(sched, sh4->dma_timers[dtr->channel]);
+    sh4_dmac_end(sh4, dtr->channel);
   }
+
+  /* the data is moved all at once. the source and destination are resolved
+     a single time for the entire transfer, with a span written to a device,
+     e.g. the ta's fifos, being handed to it in one call */
+  uint32_t src = dtr->dir == SH4_DMA_FROM_ADDR ? dtr->addr : *sar;
+  uint32_t dst = dtr->dir == SH4_DMA_FROM_ADDR ? *dar : dtr->addr;
+  int size = *dmatcr * 32;
+  sh4_memcpy(mem, dst, src, size);
+
+  /* update src / dst addresses */
+  *sar = src + size;
+  *dar = dst + size;
+
+  /* the remaining count and the end of the transfer are signalled once the
+     time it would have taken has elapsed */
+  static const timer_cb end_cbs[] = {&sh4_dmac_end_0, &sh4_dmac_end_1,
+                                     &sh4_dmac_end_2, &sh4_dmac_end_3};
+  int64_t time = (int64_t)size * NS_PER_SEC / SH4_DMA_RATE;
+
+  sh4->dma_end[dtr->channel] = dtr->end;
+  sh4->dma_end_data[dtr->channel] = dtr->end_data;
+  sh4->dma_timers[dtr->channel] =
+      sched_start_timer(sched, end_cbs[dtr->channel], sh4, time);
 }
 
 REG_W32(sh4_cb, CHCR0) {
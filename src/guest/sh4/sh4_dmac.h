@@ -19,8 +19,19 @@ struct sh4_dtr {
   /* size is only valid for single address mode transfers, dual address mode
      transfers honor DMATCR */
   int size;
+  /* dual address mode transfers complete asynchronously, once the time the
+     transfer would have taken has elapsed. end is called with end_data after
+     the channel signals its completion */
+  void (*end)(void *);
+  void *end_data;
 };
 
 void sh4_dmac_ddt(struct sh4 *sh, struct sh4_dtr *dtr);
 
+/* timer callbacks for the end of each channel's transfer */
+void sh4_dmac_end_0(void *data);
+void sh4_dmac_end_1(void *data);
+void sh4_dmac_end_2(void *data);
+void sh4_dmac_end_3(void *data);
+
 #endif
@@ -62,6 +62,13 @@ void sh4_intc_update_pending(struct sh4 *sh4) {
   }
 
   sh4->ctx.pending_interrupts = sh4->requested_interrupts & mask;
+
+  /* yield to the interrupt at the next block */
+  if (sh4->ctx.pending_interrupts && !sh4->ctx.yielding) {
+    sh4->ctx.yield_cycles = sh4->ctx.run_cycles;
+    sh4->ctx.run_cycles = -1;
+    sh4->ctx.yielding = 1;
+  }
 }
 
 REG_W32(sh4_cb, IPRA) {
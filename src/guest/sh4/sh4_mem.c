@@ -1,3 +1,4 @@
+#include "core/time.h"
 #include "guest/aica/aica.h"
 #include "guest/holly/holly.h"
 #include "guest/memory.h"
@@ -6,10 +7,12 @@
 #include "guest/rom/boot.h"
 #include "guest/rom/flash.h"
 #include "guest/sh4/sh4.h"
+#include "options.h"
 
 static uint32_t sh4_reg_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
   uint32_t offset = SH4_REG_OFFSET(addr);
   reg_read_cb read = sh4_cb[offset].read;
+  int64_t start = OPTION_reg_stats ? time_nanoseconds() : 0;
 
   uint32_t data;
   if (read) {
@@ -18,6 +21,10 @@ static uint32_t sh4_reg_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
     data = sh4->reg[offset];
   }
 
+  if (start) {
+    reg_stats_count_read(&sh4->reg_counts[offset], time_nanoseconds() - start);
+  }
+
   if (sh4->log_regs) {
     LOG_INFO("sh4_reg_read addr=0x%08x data=0x%x", addr, data);
   }
@@ -29,6 +36,7 @@ static void sh4_reg_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                           uint32_t mask) {
   uint32_t offset = SH4_REG_OFFSET(addr);
   reg_write_cb write = sh4_cb[offset].write;
+  int64_t start = OPTION_reg_stats ? time_nanoseconds() : 0;
 
   if (sh4->log_regs) {
     LOG_INFO("sh4_reg_write addr=0x%08x data=0x%x", addr, data & mask);
@@ -36,10 +44,13 @@ static void sh4_reg_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
 
   if (write) {
     write(sh4->dc, data);
-    return;
+  } else {
+    sh4->reg[offset] = data;
   }
 
-  sh4->reg[offset] = data;
+  if (start) {
+    reg_stats_count_write(&sh4->reg_counts[offset], time_nanoseconds() - start);
+  }
 }
 
 void sh4_p4_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
@@ -174,6 +185,42 @@ uint32_t sh4_area1_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
   }
 }
 
+void sh4_area1_write_string(struct sh4 *sh4, uint32_t addr, const uint8_t *ptr,
+                            int size) {
+  struct dreamcast *dc = sh4->dc;
+
+  addr &= SH4_ADDR_MASK;
+
+  /* create the mirror */
+  addr &= SH4_AREA1_ADDR_MASK;
+
+  if (addr >= SH4_PVR_VRAM64_BEGIN && addr <= SH4_PVR_VRAM64_END) {
+    pvr_vram64_write_string(dc->pvr, addr - SH4_PVR_VRAM64_BEGIN, ptr, size);
+  } else if (addr >= SH4_PVR_VRAM32_BEGIN && addr <= SH4_PVR_VRAM32_END) {
+    pvr_vram32_write_string(dc->pvr, addr - SH4_PVR_VRAM32_BEGIN, ptr, size);
+  } else {
+    LOG_FATAL("sh4_area1_write_string unexpected addr 0x%08x", addr);
+  }
+}
+
+void sh4_area1_read_string(struct sh4 *sh4, uint8_t *ptr, uint32_t addr,
+                           int size) {
+  struct dreamcast *dc = sh4->dc;
+
+  addr &= SH4_ADDR_MASK;
+
+  /* create the mirror */
+  addr &= SH4_AREA1_ADDR_MASK;
+
+  if (addr >= SH4_PVR_VRAM64_BEGIN && addr <= SH4_PVR_VRAM64_END) {
+    pvr_vram64_read_string(dc->pvr, ptr, addr - SH4_PVR_VRAM64_BEGIN, size);
+  } else if (addr >= SH4_PVR_VRAM32_BEGIN && addr <= SH4_PVR_VRAM32_END) {
+    pvr_vram32_read_string(dc->pvr, ptr, addr - SH4_PVR_VRAM32_BEGIN, size);
+  } else {
+    LOG_FATAL("sh4_area1_read_string unexpected addr 0x%08x", addr);
+  }
+}
+
 void sh4_area0_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                      uint32_t mask) {
   struct dreamcast *dc = sh4->dc;
@@ -209,6 +256,18 @@ void sh4_area0_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
   }
 }
 
+int sh4_immutable(struct memory *mem, uint32_t addr, int size) {
+  /* p4 masks down to the store queues, not area 0 */
+  if (addr >= SH4_P4_BEGIN) {
+    return 0;
+  }
+
+  /* the flash rom is programmed by the bios and games, leaving only the boot
+     rom */
+  uint32_t begin = addr & SH4_ADDR_MASK;
+  return begin + size - 1 <= SH4_BOOT_ROM_END;
+}
+
 uint32_t sh4_area0_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
   struct dreamcast *dc = sh4->dc;
 
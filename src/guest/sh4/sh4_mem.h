@@ -78,6 +78,8 @@
 #define SH4_REG_END          0x1fffffff
 #define SH4_CACHE_BEGIN      0x7c000000
 #define SH4_CACHE_END        0x7fffffff
+#define SH4_ORA_SIZE         0x2000
+#define SH4_ORA_BANK_SIZE    0x1000
 
 /* p0 */
 #define SH4_P0_00_BEGIN      0x00000000
@@ -119,6 +121,12 @@
 #define SH4_UTLB_END         0xf7ffffff
 /* clang-format on */
 
+struct memory;
+
+/* the boot rom is the only memory code can't modify, see
+   jit_guest.immutable */
+int sh4_immutable(struct memory *mem, uint32_t addr, int size);
+
 uint32_t sh4_area0_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_area0_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                      uint32_t mask);
@@ -126,6 +134,10 @@ void sh4_area0_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
 uint32_t sh4_area1_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_area1_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
                      uint32_t mask);
+void sh4_area1_read_string(struct sh4 *sh4, uint8_t *ptr, uint32_t addr,
+                           int size);
+void sh4_area1_write_string(struct sh4 *sh4, uint32_t addr, const uint8_t *ptr,
+                            int size);
 
 uint32_t sh4_area4_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 void sh4_area4_write(struct sh4 *sh4, uint32_t addr, const uint8_t *ptr,
@@ -1,4 +1,6 @@
 #include "guest/sh4/sh4.h"
+#include "guest/memory.h"
+#include "jit/jit.h"
 
 #if 0
 #define LOG_MMU LOG_INFO
@@ -8,7 +10,7 @@
 
 #define TLB_INDEX(addr) (((addr) >> 8) & 0x3f)
 
-/*#define PAGE_SIZE(entry) (((entry)->lo.SZ1 << 1) | (entry)->lo.SZ0)*/
+#define TLB_PAGE_SIZE(entry) (((entry)->lo.SZ1 << 1) | (entry)->lo.SZ0)
 
 enum {
   PAGE_SIZE_1KB,
@@ -17,33 +19,422 @@ enum {
   PAGE_SIZE_1MB,
 };
 
-static void sh4_mmu_utlb_sync(struct sh4 *sh4, struct sh4_tlb_entry *entry) {
+static const uint32_t tlb_page_bytes[] = {0x400, 0x1000, 0x10000, 0x100000};
+
+/* translations are tracked by the page of the smallest size */
+#define TLB_MIN_PAGE_MASK 0x3ff
+
+#define TLB_CACHE_INDEX(addr) (((addr) >> JIT_TLB_PAGE_SHIFT) % JIT_TLB_SIZE)
+
+/* virtual address ranges whose translation has changed */
+struct sh4_mmu_stale {
+  uint32_t begin[64];
+  uint32_t bytes[64];
+  int num;
+};
+
+/* only u0 / p0 (0x00000000-0x7fffffff) and p3 (0xc0000000-0xdfffffff) are
+   translated, p1, p2 and p4 always map directly to the physical address */
+static int sh4_mmu_translated(uint32_t addr) {
+  return addr < 0x80000000 || (addr >= 0xc0000000 && addr < 0xe0000000);
+}
+
+static int sh4_mmu_translate_miss(struct sh4 *sh4, uint32_t addr,
+                                  uint32_t *paddr) {
+  struct jit_tlb_entry *cached = &sh4->tlb_cache[TLB_CACHE_INDEX(addr)];
+
+  if (!sh4_mmu_translated(addr)) {
+    cached->vaddr = addr & ~JIT_TLB_PAGE_MASK;
+    cached->paddr = addr & ~JIT_TLB_PAGE_MASK;
+    *paddr = addr;
+    return 1;
+  }
+
+  uint32_t asid = sh4->PTEH->ASID;
+  int ignore_asid = sh4->MMUCR->SV && (sh4->ctx.sr & MD_MASK);
+
+  for (int i = 0; i < ARRAY_SIZE(sh4->utlb); i++) {
+    struct sh4_tlb_entry *entry = &sh4->utlb[i];
+
+    if (!entry->lo.V) {
+      continue;
+    }
+
+    int asid_match = entry->lo.SH || entry->hi.ASID == asid;
+
+    if (!asid_match && !ignore_asid) {
+      continue;
+    }
+
+    uint32_t bytes = tlb_page_bytes[TLB_PAGE_SIZE(entry)];
+    uint32_t mask = ~(bytes - 1);
+    uint32_t vpn = (entry->hi.VPN << 10) & mask;
+
+    if ((addr & mask) != vpn) {
+      continue;
+    }
+
+    /* translated addresses are returned in their p1 form, which maps directly
+       to the physical address. fastmem accesses index the address space with
+       them, and they aren't translated again when passed back in */
+    uint32_t phys = ((entry->lo.PPN << 10) & mask) | (addr & ~mask);
+    *paddr = 0x80000000 | (phys & 0x1fffffff);
+
+    /* 1kb pages are smaller than the cache's granularity, and can't be cached
+       without aliasing their neighbors. matches relying on MMUCR.SV depend on
+       the privilege mode, and are looked up again on each access */
+    if (bytes > JIT_TLB_PAGE_MASK && asid_match) {
+      cached->vaddr = addr & ~JIT_TLB_PAGE_MASK;
+      cached->paddr = *paddr & ~JIT_TLB_PAGE_MASK;
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
+
+static inline int sh4_mmu_translate(struct sh4 *sh4, uint32_t addr,
+                                    uint32_t *paddr) {
+  struct jit_tlb_entry *cached = &sh4->tlb_cache[TLB_CACHE_INDEX(addr)];
+
+  if (cached->vaddr == (addr & ~JIT_TLB_PAGE_MASK)) {
+    *paddr = cached->paddr | (addr & JIT_TLB_PAGE_MASK);
+    return 1;
+  }
+
+  return sh4_mmu_translate_miss(sh4, addr, paddr);
+}
+
+static void sh4_mmu_raise_miss(struct sh4 *sh4, uint32_t addr,
+                               enum sh4_exception exc) {
+  *sh4->TEA = addr;
+  sh4->PTEH->VPN = addr >> 10;
+  sh4_raise_exception(sh4, exc);
+}
+
+/* raise a tlb miss for an access made by the running code, abandoning the
+   rest of its block. accesses made while the jit is reading code can't raise
+   one, and see unmapped memory */
+static void sh4_mmu_miss(struct sh4 *sh4, uint32_t addr,
+                         enum sh4_exception exc) {
+  if (!jit_can_abort(sh4->jit)) {
+    LOG_WARNING("sh4_mmu_miss no utlb entry for 0x%08x", addr);
+    return;
+  }
+
+  sh4_mmu_raise_miss(sh4, addr, exc);
+  jit_abort_code(sh4->jit);
+}
+
+/* memory accessors bound to the jit guest while address translation is
+   enabled */
+#define define_mmu_read(name, data_type)                                 \
+  static data_type sh4_mmu_##name(struct memory *mem, uint32_t addr) {   \
+    struct sh4 *sh4 = mem_dc(mem)->sh4;                                  \
+    uint32_t paddr;                                                      \
+    if (!sh4_mmu_translate(sh4, addr, &paddr)) {                         \
+      sh4_mmu_miss(sh4, addr, SH4_EXC_DTLBMISSR);                        \
+      return 0;                                                          \
+    }                                                                    \
+    return sh4_##name(mem, paddr);                                       \
+  }
+
+#define define_mmu_write(name, data_type)                                \
+  static void sh4_mmu_##name(struct memory *mem, uint32_t addr,          \
+                             data_type data) {                           \
+    struct sh4 *sh4 = mem_dc(mem)->sh4;                                  \
+    uint32_t paddr;                                                      \
+    if (!sh4_mmu_translate(sh4, addr, &paddr)) {                         \
+      sh4_mmu_miss(sh4, addr, SH4_EXC_DTLBMISSW);                        \
+      return;                                                            \
+    }                                                                    \
+    sh4_##name(mem, paddr, data);                                        \
+  }
+
+define_mmu_read(read8, uint8_t);
+define_mmu_read(read16, uint16_t);
+define_mmu_read(read32, uint32_t);
+define_mmu_write(write8, uint8_t);
+define_mmu_write(write16, uint16_t);
+define_mmu_write(write32, uint32_t);
+
+/* 64-bit accesses are made by merged pairs of 32-bit accesses as well, whose
+   halves may straddle a page. each half is translated on its own */
+static int sh4_mmu_straddles(uint32_t addr) {
+  return ((addr + 7) ^ addr) & ~TLB_MIN_PAGE_MASK;
+}
+
+static uint64_t sh4_mmu_read64(struct memory *mem, uint32_t addr) {
+  struct sh4 *sh4 = mem_dc(mem)->sh4;
+  uint32_t paddr;
+
+  if (sh4_mmu_straddles(addr)) {
+    uint64_t lo = sh4_mmu_read32(mem, addr);
+    uint64_t hi = sh4_mmu_read32(mem, addr + 4);
+    return lo | (hi << 32);
+  }
+
+  if (!sh4_mmu_translate(sh4, addr, &paddr)) {
+    sh4_mmu_miss(sh4, addr, SH4_EXC_DTLBMISSR);
+    return 0;
+  }
+
+  return sh4_read64(mem, paddr);
+}
+
+static void sh4_mmu_write64(struct memory *mem, uint32_t addr,
+                            uint64_t data) {
+  struct sh4 *sh4 = mem_dc(mem)->sh4;
+  uint32_t paddr;
+
+  if (sh4_mmu_straddles(addr)) {
+    sh4_mmu_write32(mem, addr, (uint32_t)data);
+    sh4_mmu_write32(mem, addr + 4, (uint32_t)(data >> 32));
+    return;
+  }
+
+  if (!sh4_mmu_translate(sh4, addr, &paddr)) {
+    sh4_mmu_miss(sh4, addr, SH4_EXC_DTLBMISSW);
+    return;
+  }
+
+  sh4_write64(mem, paddr, data);
+}
+
+static void sh4_mmu_lookup(struct memory *mem, uint32_t addr, void **userdata,
+                           uint8_t **ptr, mmio_read_cb *read,
+                           mmio_write_cb *write) {
+  struct sh4 *sh4 = mem_dc(mem)->sh4;
+  uint32_t paddr;
+
+  /* lookups only probe the address space, an address without a translation
+     is reported as unmapped */
+  if (!sh4_mmu_translate(sh4, addr, &paddr)) {
+    if (userdata) {
+      *userdata = NULL;
+    }
+    if (ptr) {
+      *ptr = NULL;
+    }
+    if (read) {
+      *read = NULL;
+    }
+    if (write) {
+      *write = NULL;
+    }
+    return;
+  }
+
+  sh4_lookup(mem, paddr, userdata, ptr, read, write);
+}
+
+static void sh4_mmu_flush_cache(struct sh4 *sh4) {
+  for (int i = 0; i < JIT_TLB_SIZE; i++) {
+    sh4->tlb_cache[i].vaddr = JIT_TLB_INVALID;
+  }
+}
+
+static void sh4_mmu_add_stale(struct sh4_mmu_stale *stale,
+                              struct sh4_tlb_entry *entry) {
+  if (!entry->lo.V) {
+    return;
+  }
+
+  uint32_t bytes = tlb_page_bytes[TLB_PAGE_SIZE(entry)];
+  uint32_t begin = (entry->hi.VPN << 10) & ~(bytes - 1);
+
+  CHECK_LT(stale->num, (int)ARRAY_SIZE(stale->begin));
+  stale->begin[stale->num] = begin;
+  stale->bytes[stale->num] = bytes;
+  stale->num++;
+}
+
+static int sh4_mmu_block_stale(struct sh4_mmu_stale *stale, uint32_t addr,
+                               int size) {
+  for (int i = 0; i < stale->num; i++) {
+    uint32_t begin = stale->begin[i];
+
+    if (addr - begin < stale->bytes[i] || begin - addr < (uint32_t)size) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* drop the cached translations and compiled code of the stale ranges. blocks
+   are keyed by virtual address, and have the translation of their own code
+   baked in. their data accesses check the translation cache on each access */
+static void sh4_mmu_invalidate(struct sh4 *sh4, struct sh4_mmu_stale *stale) {
+  for (int i = 0; i < stale->num; i++) {
+    for (uint32_t off = 0; off < stale->bytes[i]; off += JIT_TLB_PAGE_MASK + 1) {
+      uint32_t page = (stale->begin[i] + off) & ~JIT_TLB_PAGE_MASK;
+      struct jit_tlb_entry *cached = &sh4->tlb_cache[TLB_CACHE_INDEX(page)];
+
+      if (cached->vaddr == page) {
+        cached->vaddr = JIT_TLB_INVALID;
+      }
+    }
+  }
+
+  if (sh4->mmu_enabled && stale->num) {
+    jit_invalidate_blocks(sh4->jit, (jit_modified_cb)&sh4_mmu_block_stale,
+                          stale);
+  }
+}
+
+void sh4_mmu_asid_changed(struct sh4 *sh4, uint32_t old_asid) {
+  uint32_t new_asid = sh4->PTEH->ASID;
+  struct sh4_mmu_stale stale = {0};
+
+  /* the cache holds translations that matched on the old asid */
+  sh4_mmu_flush_cache(sh4);
+
+  /* code compiled through a non-shared entry of the old asid is stale, as is
+     code compiled previously at an address the new asid's entries map */
+  for (int i = 0; i < ARRAY_SIZE(sh4->utlb); i++) {
+    struct sh4_tlb_entry *entry = &sh4->utlb[i];
+
+    if (entry->lo.SH) {
+      continue;
+    }
+
+    if (entry->hi.ASID != old_asid && entry->hi.ASID != new_asid) {
+      continue;
+    }
+
+    sh4_mmu_add_stale(&stale, entry);
+  }
+
+  sh4_mmu_invalidate(sh4, &stale);
+}
+
+int sh4_mmu_fetch(struct sh4 *sh4, uint32_t addr) {
+  uint32_t paddr;
+
+  if (!sh4_mmu_translate(sh4, addr, &paddr)) {
+    sh4_mmu_raise_miss(sh4, addr, SH4_EXC_ITLBMISS);
+    return 0;
+  }
+
+  return 1;
+}
+
+void sh4_mmu_flush(struct sh4 *sh4) {
+  sh4_mmu_flush_cache(sh4);
+
+  /* compiled code has the translations of its own addresses baked in */
+  if (sh4->mmu_enabled) {
+    jit_invalidate_code(sh4->jit);
+  }
+}
+
+void sh4_mmu_update(struct sh4 *sh4) {
+  struct jit_guest *guest = sh4->guest;
+  struct memory *mem = sh4->dc->mem;
+
+  /* invalidate all entries */
+  if (sh4->MMUCR->TI) {
+    struct sh4_mmu_stale stale = {0};
+
+    for (int i = 0; i < ARRAY_SIZE(sh4->utlb); i++) {
+      sh4_mmu_add_stale(&stale, &sh4->utlb[i]);
+      sh4->utlb[i].lo.V = 0;
+    }
+    sh4->MMUCR->TI = 0;
+    sh4_mmu_invalidate(sh4, &stale);
+  }
+
+  int enabled = sh4->MMUCR->AT;
+
+  if (enabled == sh4->mmu_enabled) {
+    return;
+  }
+
+  LOG_INFO("sh4_mmu_update address translation %s",
+           enabled ? "enabled" : "disabled");
+
+  /* accesses are made through the translating accessors, or through fastmem
+     once the backend has found the page in the translation cache */
+  if (enabled) {
+    guest->membase = sh4_base(mem);
+    guest->tlb = sh4->tlb_cache;
+    guest->lookup = &sh4_mmu_lookup;
+    guest->immutable = NULL;
+    guest->r8 = &sh4_mmu_read8;
+    guest->r16 = &sh4_mmu_read16;
+    guest->r32 = &sh4_mmu_read32;
+    guest->r64 = &sh4_mmu_read64;
+    guest->w8 = &sh4_mmu_write8;
+    guest->w16 = &sh4_mmu_write16;
+    guest->w32 = &sh4_mmu_write32;
+    guest->w64 = &sh4_mmu_write64;
+  } else {
+    guest->membase = sh4_base(mem);
+    guest->tlb = NULL;
+    guest->lookup = &sh4_lookup;
+    guest->immutable = &sh4_immutable;
+    guest->r8 = &sh4_read8;
+    guest->r16 = &sh4_read16;
+    guest->r32 = &sh4_read32;
+    guest->r64 = &sh4_read64;
+    guest->w8 = &sh4_write8;
+    guest->w16 = &sh4_write16;
+    guest->w32 = &sh4_write32;
+    guest->w64 = &sh4_write64;
+  }
+
+  sh4->mmu_enabled = enabled;
+  sh4_mmu_flush(sh4);
+
+  /* code compiled while translating is just as stale once disabled */
+  if (!enabled) {
+    jit_invalidate_code(sh4->jit);
+  }
+}
+
+void sh4_mmu_reset(struct sh4 *sh4) {
+  memset(sh4->utlb_sq_map, 0, sizeof(sh4->utlb_sq_map));
+  memset(sh4->utlb, 0, sizeof(sh4->utlb));
+
+  sh4_mmu_update(sh4);
+  sh4_mmu_flush(sh4);
+}
+
+static void sh4_mmu_utlb_sync(struct sh4 *sh4, struct sh4_tlb_entry *entry,
+                              struct sh4_tlb_entry *old) {
   int n = (int)(entry - sh4->utlb);
+  struct sh4_mmu_stale stale = {0};
 
   /* check if entry maps to sq region [0xe0000000, 0xe3ffffff] */
   if ((entry->hi.VPN & (0xfc000000 >> 10)) == (0xe0000000 >> 10)) {
-    /* assume page size is 1MB
-       FIXME support all page sizes */
-    uint32_t vpn = entry->hi.VPN >> 10;
-    uint32_t ppn = entry->lo.PPN << 10;
+    /* the map has a slot per 1mb of the region, holding the offset from the
+       virtual to the physical address. pages smaller than 1mb share their
+       slot with the rest of it, the most recently loaded one winning */
+    uint32_t mask = ~(tlb_page_bytes[TLB_PAGE_SIZE(entry)] - 1);
+    uint32_t vaddr = (entry->hi.VPN << 10) & mask;
+    uint32_t paddr = (entry->lo.PPN << 10) & mask;
+    uint32_t slot = (vaddr >> 20) & 0x3f;
 
-    sh4->utlb_sq_map[vpn & 0x3f] = ppn;
+    sh4->utlb_sq_map[slot] = paddr - (vaddr & 0xfffff);
 
-    LOG_INFO("sh4_mmu_utlb_sync sq map (%d) 0x%x -> 0x%x", n, vpn, ppn);
-  } else {
-    LOG_WARNING("sh4_mmu_utlb_sync memory mapping not supported");
+    LOG_INFO("sh4_mmu_utlb_sync sq map (%d) 0x%x -> 0x%x", n, vaddr, paddr);
   }
-}
 
-static void sh4_mmu_translate(struct sh4 *sh4, uint32_t addr) {}
+  sh4_mmu_add_stale(&stale, old);
+  sh4_mmu_add_stale(&stale, entry);
+  sh4_mmu_invalidate(sh4, &stale);
+}
 
 void sh4_mmu_ltlb(struct sh4 *sh4) {
   uint32_t n = sh4->MMUCR->URC;
   struct sh4_tlb_entry *entry = &sh4->utlb[n];
+  struct sh4_tlb_entry old = *entry;
   entry->lo = *sh4->PTEL;
   entry->hi = *sh4->PTEH;
 
-  sh4_mmu_utlb_sync(sh4, entry);
+  sh4_mmu_utlb_sync(sh4, entry, &old);
 }
 
 uint32_t sh4_mmu_itlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask) {
@@ -100,11 +491,12 @@ void sh4_mmu_utlb_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
       LOG_MMU("sh4_mmu_utlb_write address array %08x %08x", addr, data);
 
       struct sh4_tlb_entry *entry = &sh4->utlb[TLB_INDEX(addr)];
+      struct sh4_tlb_entry old = *entry;
       entry->hi.full = data & 0xfffffcff;
       entry->lo.D = (data >> 9) & 1;
       entry->lo.V = (data >> 8) & 1;
 
-      sh4_mmu_utlb_sync(sh4, entry);
+      sh4_mmu_utlb_sync(sh4, entry, &old);
     }
   } else {
     if (addr & 0x800000) {
@@ -113,9 +505,10 @@ void sh4_mmu_utlb_write(struct sh4 *sh4, uint32_t addr, uint32_t data,
       LOG_MMU("sh4_mmu_utlb_write data array 1 %08x %08x", addr, data);
 
       struct sh4_tlb_entry *entry = &sh4->utlb[TLB_INDEX(addr)];
+      struct sh4_tlb_entry old = *entry;
       entry->lo.full = data;
 
-      sh4_mmu_utlb_sync(sh4, entry);
+      sh4_mmu_utlb_sync(sh4, entry, &old);
     }
   }
 }
@@ -8,6 +8,11 @@ struct sh4_tlb_entry {
   union ptel lo;
 };
 
+void sh4_mmu_reset(struct sh4 *sh4);
+void sh4_mmu_update(struct sh4 *sh4);
+int sh4_mmu_fetch(struct sh4 *sh4, uint32_t addr);
+void sh4_mmu_flush(struct sh4 *sh4);
+void sh4_mmu_asid_changed(struct sh4 *sh4, uint32_t old_asid);
 void sh4_mmu_ltlb(struct sh4 *sh4);
 uint32_t sh4_mmu_itlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
 uint32_t sh4_mmu_utlb_read(struct sh4 *sh4, uint32_t addr, uint32_t mask);
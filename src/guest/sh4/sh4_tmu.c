@@ -13,115 +13,179 @@ static const int PERIPHERAL_SCALE[] = {2, 4, 6, 8, 10, 0, 0, 0};
 #define TUNI(n) \
   (n == 0 ? SH4_INT_TUNI0 : n == 1 ? SH4_INT_TUNI1 : SH4_INT_TUNI2)
 
-static void sh4_tmu_reschedule(struct sh4 *sh4, int n, uint32_t tcnt,
-                               uint32_t tcr);
+static int64_t sh4_tmu_freq(struct sh4 *sh4, int n) {
+  return PERIPHERAL_CLOCK_FREQ >> PERIPHERAL_SCALE[*TCR(n) & 7];
+}
 
-static uint32_t sh4_tmu_tcnt(struct sh4 *sh4, int n) {
+/* the counts are converted in integer math, as the channels may run for
+   hours without being written */
+static int64_t sh4_tmu_elapsed(struct sh4 *sh4, int n) {
   struct scheduler *sched = sh4->dc->sched;
+  int64_t ns = sched_current_time(sched) - sh4->tmu_base[n];
+  int64_t freq = sh4_tmu_freq(sh4, n);
+  return (ns / NS_PER_SEC) * freq + (ns % NS_PER_SEC) * freq / NS_PER_SEC;
+}
+
+static int64_t sh4_tmu_cycles_to_ns(struct sh4 *sh4, int n, int64_t cycles) {
+  /* rounded up, landing on or just after the cycle */
+  int64_t freq = sh4_tmu_freq(sh4, n);
+  return (cycles / freq) * NS_PER_SEC +
+         ((cycles % freq) * NS_PER_SEC + freq - 1) / freq;
+}
+
+/* the count underflows once it's counted down from TCNT, and then every time
+   it's counted down again from TCOR */
+static int64_t sh4_tmu_period(struct sh4 *sh4, int n) {
+  return MAX((int64_t)*TCOR(n), 1);
+}
+
+static int64_t sh4_tmu_underflows_at(struct sh4 *sh4, int n, int64_t elapsed) {
+  int64_t tcnt = *TCNT(n);
+  if (elapsed < tcnt) {
+    return 0;
+  }
+  return 1 + (elapsed - tcnt) / sh4_tmu_period(sh4, n);
+}
 
-  /* TCNT values aren't updated in real time. if a timer is enabled, query
-     the scheduler to figure out how many cycles are remaining for the given
-     timer */
-  struct timer *timer = sh4->tmu_timers[n];
-  if (!timer) {
+static uint32_t sh4_tmu_count_at(struct sh4 *sh4, int n, int64_t elapsed) {
+  int64_t tcnt = *TCNT(n);
+  if (elapsed < tcnt) {
+    return (uint32_t)(tcnt - elapsed);
+  }
+  return *TCOR(n) - (uint32_t)((elapsed - tcnt) % sh4_tmu_period(sh4, n));
+}
+
+static uint32_t sh4_tmu_tcnt(struct sh4 *sh4, int n) {
+  if (!TSTR(n)) {
     return *TCNT(n);
   }
 
   /* FIXME should the number of SH4 cycles that've been executed be considered
      here? this would prevent an entire SH4 slice from just busy waiting on
      this to change */
-  uint32_t tcr = *TCR(n);
-  int64_t freq = PERIPHERAL_CLOCK_FREQ >> PERIPHERAL_SCALE[tcr & 7];
-  int64_t remaining = sched_remaining_time(sched, timer);
-  int64_t cycles = NANO_TO_CYCLES(remaining, freq);
-
-  return (uint32_t)cycles;
+  return sh4_tmu_count_at(sh4, n, sh4_tmu_elapsed(sh4, n));
 }
 
-static void sh4_tmu_expire(struct sh4 *sh4, int n) {
-  uint32_t *tcor = TCOR(n);
-  uint32_t *tcnt = TCNT(n);
-  uint32_t *tcr = TCR(n);
+/* flag the underflows which have occurred since last checked */
+static void sh4_tmu_catch_up(struct sh4 *sh4, int n) {
+  if (!TSTR(n)) {
+    return;
+  }
+
+  int64_t underflows = sh4_tmu_underflows_at(sh4, n, sh4_tmu_elapsed(sh4, n));
+  if (underflows == sh4->tmu_underflows[n]) {
+    return;
+  }
 
 #if 0
-  LOG_INFO("sh4_tmu_expire %d", n);
+  LOG_INFO("sh4_tmu_catch_up %d underflowed", n);
 #endif
 
+  sh4->tmu_underflows[n] = underflows;
+
   /* timer expired, set the underflow flag */
-  *tcr |= 0x100;
+  *TCR(n) |= 0x100;
 
   /* if interrupt generation on underflow is enabled, do so */
-  if (*tcr & 0x20) {
+  if (*TCR(n) & 0x20) {
     sh4_raise_interrupt(sh4, TUNI(n));
   }
+}
 
-  /* reset TCNT with the value from TCOR */
-  *tcnt = *tcor;
+/* restarts counting from the current count, for when the rate or the reload
+   count are about to change */
+static void sh4_tmu_rebase(struct sh4 *sh4, int n) {
+  struct scheduler *sched = sh4->dc->sched;
 
-  /* reschedule the timer with the new count */
-  sh4->tmu_timers[n] = NULL;
-  sh4_tmu_reschedule(sh4, n, *tcnt, *tcr);
+  if (!TSTR(n)) {
+    return;
+  }
+
+  sh4_tmu_catch_up(sh4, n);
+
+  *TCNT(n) = sh4_tmu_tcnt(sh4, n);
+  sh4->tmu_base[n] = sched_current_time(sched);
+  sh4->tmu_underflows[n] = 0;
 }
 
-static void sh4_tmu_expire_0(void *data) {
+static void sh4_tmu_expire(struct sh4 *sh4, int n);
+
+void sh4_tmu_expire_0(void *data) {
   sh4_tmu_expire(data, 0);
 }
 
-static void sh4_tmu_expire_1(void *data) {
+void sh4_tmu_expire_1(void *data) {
   sh4_tmu_expire(data, 1);
 }
 
-static void sh4_tmu_expire_2(void *data) {
+void sh4_tmu_expire_2(void *data) {
   sh4_tmu_expire(data, 2);
 }
 
-static void sh4_tmu_reschedule(struct sh4 *sh4, int n, uint32_t tcnt,
-                               uint32_t tcr) {
+static void sh4_tmu_reschedule(struct sh4 *sh4, int n) {
   struct scheduler *sched = sh4->dc->sched;
   struct timer **timer = &sh4->tmu_timers[n];
 
-  int64_t freq = PERIPHERAL_CLOCK_FREQ >> PERIPHERAL_SCALE[tcr & 7];
-  int64_t cycles = (int64_t)tcnt;
-  int64_t remaining = CYCLES_TO_NANO(cycles, freq);
-
   if (*timer) {
     sched_cancel_timer(sched, *timer);
     *timer = NULL;
   }
 
-  timer_cb cb = (n == 0 ? &sh4_tmu_expire_0
-                        : n == 1 ? &sh4_tmu_expire_1 : &sh4_tmu_expire_2);
-  *timer = sched_start_timer(sched, cb, sh4, remaining);
+  /* underflows are otherwise only flagged when the guest goes looking */
+  if (!TSTR(n) || !(*TCR(n) & 0x20)) {
+    return;
+  }
+
+  int64_t next = *TCNT(n) + sh4->tmu_underflows[n] * sh4_tmu_period(sh4, n);
+  int64_t expire = sh4->tmu_base[n] + sh4_tmu_cycles_to_ns(sh4, n, next);
+  int64_t remaining = MAX(expire - sched_current_time(sched), 0);
+
+  static const timer_cb cbs[] = {&sh4_tmu_expire_0, &sh4_tmu_expire_1,
+                                 &sh4_tmu_expire_2};
+  *timer = sched_start_timer(sched, cbs[n], sh4, remaining);
 }
 
-static void sh4_tmu_update_tstr(struct sh4 *sh4) {
+static void sh4_tmu_expire(struct sh4 *sh4, int n) {
+  sh4->tmu_timers[n] = NULL;
+  sh4_tmu_catch_up(sh4, n);
+  sh4_tmu_reschedule(sh4, n);
+}
+
+static void sh4_tmu_update_tstr(struct sh4 *sh4, uint32_t value) {
   struct scheduler *sched = sh4->dc->sched;
 
   for (int i = 0; i < 3; i++) {
-    struct timer **timer = &sh4->tmu_timers[i];
-
-    if (TSTR(i)) {
-      /* schedule the timer if not already started */
-      if (!*timer) {
-        sh4_tmu_reschedule(sh4, i, *TCNT(i), *TCR(i));
-      }
-    } else if (*timer) {
-      /* save off progress */
-      *TCNT(i) = sh4_tmu_tcnt(sh4, i);
+    int started = (value >> i) & 1;
+    if (started == !!TSTR(i)) {
+      continue;
+    }
 
-      /* disable the timer */
-      sched_cancel_timer(sched, *timer);
-      *timer = NULL;
+    if (started) {
+      sh4->tmu_base[i] = sched_current_time(sched);
+      sh4->tmu_underflows[i] = 0;
+    } else {
+      /* save off progress */
+      sh4_tmu_rebase(sh4, i);
     }
+
+    *sh4->TSTR ^= 1 << i;
+    sh4_tmu_reschedule(sh4, i);
   }
+
+  *sh4->TSTR = value;
 }
 
-static void sh4_tmu_update_tcr(struct sh4 *sh4, uint32_t n) {
-  if (TSTR(n)) {
-    /* timer is already scheduled, reschedule it with the current cycle
-       count, but the new TCR value */
-    sh4_tmu_reschedule(sh4, n, sh4_tmu_tcnt(sh4, n), *TCR(n));
-  }
+static uint32_t sh4_tmu_read_tcr(struct sh4 *sh4, int n) {
+  sh4_tmu_catch_up(sh4, n);
+  return *TCR(n);
+}
+
+static void sh4_tmu_update_tcr(struct sh4 *sh4, int n, uint32_t value) {
+  /* flag any underflows before the write, and carry on counting from the
+     current count at the new rate */
+  sh4_tmu_rebase(sh4, n);
+  *TCR(n) = value;
+  sh4_tmu_reschedule(sh4, n);
 
   /* if the timer no longer cares about underflow interrupts, unrequest */
   if (!(*TCR(n) & 0x20) || !(*TCR(n) & 0x100)) {
@@ -129,10 +193,20 @@ static void sh4_tmu_update_tcr(struct sh4 *sh4, uint32_t n) {
   }
 }
 
-static void sh4_tmu_update_tcnt(struct sh4 *sh4, uint32_t n) {
-  if (TSTR(n)) {
-    sh4_tmu_reschedule(sh4, n, *TCNT(n), *TCR(n));
-  }
+static void sh4_tmu_update_tcnt(struct sh4 *sh4, int n, uint32_t value) {
+  struct scheduler *sched = sh4->dc->sched;
+
+  sh4_tmu_catch_up(sh4, n);
+  *TCNT(n) = value;
+  sh4->tmu_base[n] = sched_current_time(sched);
+  sh4->tmu_underflows[n] = 0;
+  sh4_tmu_reschedule(sh4, n);
+}
+
+static void sh4_tmu_update_tcor(struct sh4 *sh4, int n, uint32_t value) {
+  sh4_tmu_rebase(sh4, n);
+  *TCOR(n) = value;
+  sh4_tmu_reschedule(sh4, n);
 }
 
 #ifdef HAVE_IMGUI
@@ -175,26 +249,22 @@ void sh4_tmu_debug_menu(struct sh4 *sh4) {
 
 REG_W32(sh4_cb, TSTR) {
   struct sh4 *sh4 = dc->sh4;
-  *sh4->TSTR = value;
-  sh4_tmu_update_tstr(sh4);
+  sh4_tmu_update_tstr(sh4, value);
 }
 
-REG_W32(sh4_cb, TCR0) {
+REG_W32(sh4_cb, TCOR0) {
   struct sh4 *sh4 = dc->sh4;
-  *sh4->TCR0 = value;
-  sh4_tmu_update_tcr(sh4, 0);
+  sh4_tmu_update_tcor(sh4, 0, value);
 }
 
-REG_W32(sh4_cb, TCR1) {
+REG_R32(sh4_cb, TCR0) {
   struct sh4 *sh4 = dc->sh4;
-  *sh4->TCR1 = value;
-  sh4_tmu_update_tcr(sh4, 1);
+  return sh4_tmu_read_tcr(sh4, 0);
 }
 
-REG_W32(sh4_cb, TCR2) {
+REG_W32(sh4_cb, TCR0) {
   struct sh4 *sh4 = dc->sh4;
-  *sh4->TCR2 = value;
-  sh4_tmu_update_tcr(sh4, 2);
+  sh4_tmu_update_tcr(sh4, 0, value);
 }
 
 REG_R32(sh4_cb, TCNT0) {
@@ -204,8 +274,22 @@ REG_R32(sh4_cb, TCNT0) {
 
 REG_W32(sh4_cb, TCNT0) {
   struct sh4 *sh4 = dc->sh4;
-  *sh4->TCNT0 = value;
-  sh4_tmu_update_tcnt(sh4, 0);
+  sh4_tmu_update_tcnt(sh4, 0, value);
+}
+
+REG_W32(sh4_cb, TCOR1) {
+  struct sh4 *sh4 = dc->sh4;
+  sh4_tmu_update_tcor(sh4, 1, value);
+}
+
+REG_R32(sh4_cb, TCR1) {
+  struct sh4 *sh4 = dc->sh4;
+  return sh4_tmu_read_tcr(sh4, 1);
+}
+
+REG_W32(sh4_cb, TCR1) {
+  struct sh4 *sh4 = dc->sh4;
+  sh4_tmu_update_tcr(sh4, 1, value);
 }
 
 REG_R32(sh4_cb, TCNT1) {
@@ -215,8 +299,22 @@ REG_R32(sh4_cb, TCNT1) {
 
 REG_W32(sh4_cb, TCNT1) {
   struct sh4 *sh4 = dc->sh4;
-  *sh4->TCNT1 = value;
-  sh4_tmu_update_tcnt(sh4, 1);
+  sh4_tmu_update_tcnt(sh4, 1, value);
+}
+
+REG_W32(sh4_cb, TCOR2) {
+  struct sh4 *sh4 = dc->sh4;
+  sh4_tmu_update_tcor(sh4, 2, value);
+}
+
+REG_R32(sh4_cb, TCR2) {
+  struct sh4 *sh4 = dc->sh4;
+  return sh4_tmu_read_tcr(sh4, 2);
+}
+
+REG_W32(sh4_cb, TCR2) {
+  struct sh4 *sh4 = dc->sh4;
+  sh4_tmu_update_tcr(sh4, 2, value);
 }
 
 REG_R32(sh4_cb, TCNT2) {
@@ -226,6 +324,5 @@ REG_R32(sh4_cb, TCNT2) {
 
 REG_W32(sh4_cb, TCNT2) {
   struct sh4 *sh4 = dc->sh4;
-  *sh4->TCNT2 = value;
-  sh4_tmu_update_tcnt(sh4, 2);
+  sh4_tmu_update_tcnt(sh4, 2, value);
 }
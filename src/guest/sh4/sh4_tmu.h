@@ -5,4 +5,9 @@ struct sh4;
 
 void sh4_tmu_debug_menu(struct sh4 *sh4);
 
+/* timer callbacks for each channel's underflow */
+void sh4_tmu_expire_0(void *data);
+void sh4_tmu_expire_1(void *data);
+void sh4_tmu_expire_2(void *data);
+
 #endif
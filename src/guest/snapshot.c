@@ -0,0 +1,61 @@
+#include "guest/snapshot.h"
+#include "core/core.h"
+
+void snap_read(struct snapshot *snap, void *ptr, int size) {
+  CHECK_LE(snap->cursor + size, snap->size);
+  memcpy(ptr, snap->data + snap->cursor, size);
+  snap->cursor += size;
+}
+
+void snap_write(struct snapshot *snap, const void *ptr, int size) {
+  if (snap->size + size > snap->capacity) {
+    snap->capacity = MAX(snap->capacity * 2, snap->size + size);
+    snap->data = realloc(snap->data, snap->capacity);
+    CHECK_NOTNULL(snap->data);
+  }
+
+  memcpy(snap->data + snap->size, ptr, size);
+  snap->size += size;
+}
+
+void snap_resize(struct snapshot *snap, int size) {
+  if (size > snap->capacity) {
+    snap->capacity = MAX(snap->capacity * 2, size);
+    snap->data = realloc(snap->data, snap->capacity);
+    CHECK_NOTNULL(snap->data);
+  }
+
+  /* bytes past the old end are zeroed */
+  if (size > snap->size) {
+    memset(snap->data + snap->size, 0, size - snap->size);
+  }
+
+  snap->size = size;
+  snap->cursor = 0;
+}
+
+void snap_rewind(struct snapshot *snap) {
+  snap->cursor = 0;
+}
+
+void snap_reset(struct snapshot *snap) {
+  snap->size = 0;
+  snap->cursor = 0;
+}
+
+void snap_destroy(struct snapshot *snap) {
+  free(snap->mem_dirty);
+  free(snap->mem);
+  free(snap->data);
+  free(snap);
+}
+
+struct snapshot *snap_create(int capacity) {
+  struct snapshot *snap = calloc(1, sizeof(struct snapshot));
+
+  snap->data = malloc(capacity);
+  CHECK_NOTNULL(snap->data);
+  snap->capacity = capacity;
+
+  return snap;
+}
@@ -0,0 +1,46 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "core/bitmap.h"
+
+/*
+ * machine snapshots
+ *
+ * each device serializes its state into the snapshot's arena, which is
+ * allocated up front and only grows if the machine ever writes out more state
+ * than it's sized for. physical memory is kept in its own buffer, which is
+ * updated incrementally by the memory system, see mem_save
+ */
+struct snapshot {
+  /* device state arena */
+  uint8_t *data;
+  int size;
+  int capacity;
+  int cursor;
+
+  /* copy of physical memory, and the generation of modifications it was last
+     brought up to date with */
+  uint8_t *mem;
+  int mem_size;
+  uint32_t mem_gen;
+
+  /* pages of physical memory copied by the last save */
+  int mem_page_size;
+  int mem_num_pages;
+  bitmap_t *mem_dirty;
+};
+
+#define SNAP_WRITE(snap, v) snap_write(snap, &(v), (int)sizeof(v))
+#define SNAP_READ(snap, v) snap_read(snap, &(v), (int)sizeof(v))
+
+struct snapshot *snap_create(int capacity);
+void snap_destroy(struct snapshot *snap);
+
+void snap_reset(struct snapshot *snap);
+void snap_rewind(struct snapshot *snap);
+void snap_resize(struct snapshot *snap, int size);
+void snap_write(struct snapshot *snap, const void *ptr, int size);
+void snap_read(struct snapshot *snap, void *ptr, int size);
+
+#endif
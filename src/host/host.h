@@ -14,6 +14,10 @@ void audio_push(struct host *host, const int16_t *data, int frames);
 int input_max_controllers(struct host *host);
 const char *input_controller_name(struct host *host, int port);
 
+/* called from the emulation thread to have the latest input sent through
+   emu_keydown */
+void input_poll(struct host *host);
+
 /* ui */
 int ui_load_game(struct host *host, const char *path);
 void ui_opened(struct host *host);
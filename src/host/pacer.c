@@ -0,0 +1,259 @@
+#include "host/pacer.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "stats.h"
+
+#define PACER_FRAME_NS (NS_PER_SEC / 60)
+
+/* waits sleep until shortly before their deadline and spin the rest of the
+   way, by however late the os has recently been waking up from sleeps */
+#define PACER_INIT_SPIN_NS (NS_PER_MS / 2)
+#define PACER_MAX_SPIN_NS (2 * NS_PER_MS)
+
+struct pacer {
+  enum pacing_mode mode;
+  int swap_interval;
+
+  /* wait and present time of the current frame */
+  int64_t wait_ns;
+  int64_t sleep_ns;
+  int64_t overshoot_ns;
+
+  /* running average of how late sleeps wake up */
+  int64_t spin_ns;
+  int64_t present_start;
+  int64_t present_ns;
+
+  /* target time of the next present in adaptive mode */
+  int64_t next_present;
+
+  /* slow frames are logged at most once a second */
+  int64_t last_slow_log;
+
+  struct pacer_times history[PACER_HISTORY];
+  int num_history;
+  int history_pos;
+};
+
+const char *PACER_COSTS[] = {
+    "emulate", "compile", "convert", "decode", "render", "present",
+};
+
+int64_t pacer_costs(const struct pacer_times *times,
+                    int64_t costs[NUM_PACER_COSTS]) {
+  int64_t compile = MIN(times->compile_ns, times->emulate_ns);
+  int64_t decode = MIN(times->decode_ns, times->convert_ns);
+
+  costs[COST_EMULATE] = times->emulate_ns - compile;
+  costs[COST_COMPILE] = compile;
+  costs[COST_CONVERT] = times->convert_ns - decode;
+  costs[COST_DECODE] = decode;
+  costs[COST_RENDER] = times->render_ns;
+  costs[COST_PRESENT] = times->present_ns;
+
+  int64_t total = 0;
+  for (int i = 0; i < NUM_PACER_COSTS; i++) {
+    total += costs[i];
+  }
+  return total;
+}
+
+int64_t pacer_budget(struct pacer *pacer) {
+  return PACER_FRAME_NS * pacer->swap_interval;
+}
+
+enum pacing_mode pacer_mode(struct pacer *pacer) {
+  return pacer->mode;
+}
+
+int pacer_swap_interval(struct pacer *pacer) {
+  return pacer->swap_interval;
+}
+
+int pacer_resample_audio(struct pacer *pacer) {
+  /* only when audio is the master clock is it consumed at its native rate */
+  return pacer->mode != PACING_AUDIO;
+}
+
+/* waits until the deadline, returning the time afterwards */
+static int64_t pacer_wait_until(struct pacer *pacer, int64_t deadline) {
+  int64_t start = time_nanoseconds();
+  int64_t now = start;
+
+  int64_t wake = deadline - pacer->spin_ns;
+
+  if (wake > now) {
+    time_sleep(wake - now);
+    now = time_nanoseconds();
+    pacer->sleep_ns += now - start;
+
+    /* adjust the spin to how late the sleep woke up */
+    int64_t late = MIN(MAX(now - wake, 0), PACER_MAX_SPIN_NS);
+    pacer->spin_ns += (late - pacer->spin_ns) / 8;
+  }
+
+  while (now < deadline) {
+    now = time_nanoseconds();
+  }
+
+  pacer->wait_ns += now - start;
+  pacer->overshoot_ns += now - deadline;
+
+  return now;
+}
+
+int pacer_frame_due(struct pacer *pacer, int64_t audio_ns) {
+  if (pacer->mode != PACING_AUDIO || audio_ns <= 0) {
+    return 1;
+  }
+
+  /* wait until the buffered audio is predicted to hit its low-water mark,
+     though no longer than a frame for host events to keep being polled */
+  int64_t now = time_nanoseconds();
+  pacer_wait_until(pacer, now + MIN(audio_ns, PACER_FRAME_NS));
+
+  return 0;
+}
+
+void pacer_begin_present(struct pacer *pacer) {
+  int64_t now = time_nanoseconds();
+
+  if (pacer->mode == PACING_ADAPTIVE) {
+    int64_t target = pacer->next_present + PACER_FRAME_NS;
+
+    /* when running more than a frame behind, start over from now instead of
+       rushing out frames to catch up */
+    if (now - target > PACER_FRAME_NS) {
+      target = now;
+    }
+
+    if (target > now) {
+      now = pacer_wait_until(pacer, target);
+    }
+
+    pacer->next_present = target;
+  }
+
+  pacer->present_start = now;
+}
+
+void pacer_end_present(struct pacer *pacer) {
+  pacer->present_ns = time_nanoseconds() - pacer->present_start;
+}
+
+void pacer_end_frame(struct pacer *pacer, struct pacer_times *times) {
+  times->wait_ns = pacer->wait_ns;
+  times->sleep_ns = pacer->sleep_ns;
+  times->overshoot_ns = pacer->overshoot_ns;
+  times->present_ns = pacer->present_ns;
+
+  prof_counter_add(COUNTER_pacer_sleep_ns, pacer->sleep_ns);
+  prof_counter_add(COUNTER_pacer_overshoot_ns, pacer->overshoot_ns);
+
+  /* name what the time of frames running over their budget mostly went to.
+     the costs are summed as if they ran serially, though emulation may run
+     alongside the others on its own thread */
+  int64_t costs[NUM_PACER_COSTS];
+  int64_t total = pacer_costs(times, costs);
+  int64_t budget = pacer_budget(pacer);
+
+  int64_t now = time_nanoseconds();
+
+  if (total > budget && now - pacer->last_slow_log >= NS_PER_SEC) {
+    int worst = 0;
+    for (int i = 1; i < NUM_PACER_COSTS; i++) {
+      if (costs[i] > costs[worst]) {
+        worst = i;
+      }
+    }
+
+    LOG_WARNING("frame took %.2f ms of its %.2f ms budget, %.2f ms on %s",
+                total / (float)NS_PER_MS, budget / (float)NS_PER_MS,
+                costs[worst] / (float)NS_PER_MS, PACER_COSTS[worst]);
+
+    pacer->last_slow_log = now;
+  }
+
+  pacer->history[pacer->history_pos] = *times;
+  pacer->history_pos = (pacer->history_pos + 1) % PACER_HISTORY;
+  pacer->num_history = MIN(pacer->num_history + 1, PACER_HISTORY);
+
+  pacer->wait_ns = 0;
+  pacer->sleep_ns = 0;
+  pacer->overshoot_ns = 0;
+  pacer->present_ns = 0;
+}
+
+void pacer_stats(struct pacer *pacer, struct pacer_times *avg,
+                 struct pacer_times *max) {
+  memset(avg, 0, sizeof(*avg));
+  memset(max, 0, sizeof(*max));
+
+  for (int i = 0; i < pacer->num_history; i++) {
+    struct pacer_times *times = &pacer->history[i];
+
+    avg->wait_ns += times->wait_ns;
+    avg->sleep_ns += times->sleep_ns;
+    avg->overshoot_ns += times->overshoot_ns;
+    avg->emulate_ns += times->emulate_ns;
+    avg->compile_ns += times->compile_ns;
+    avg->convert_ns += times->convert_ns;
+    avg->decode_ns += times->decode_ns;
+    avg->render_ns += times->render_ns;
+    avg->present_ns += times->present_ns;
+
+    max->wait_ns = MAX(max->wait_ns, times->wait_ns);
+    max->sleep_ns = MAX(max->sleep_ns, times->sleep_ns);
+    max->overshoot_ns = MAX(max->overshoot_ns, times->overshoot_ns);
+    max->emulate_ns = MAX(max->emulate_ns, times->emulate_ns);
+    max->compile_ns = MAX(max->compile_ns, times->compile_ns);
+    max->convert_ns = MAX(max->convert_ns, times->convert_ns);
+    max->decode_ns = MAX(max->decode_ns, times->decode_ns);
+    max->render_ns = MAX(max->render_ns, times->render_ns);
+    max->present_ns = MAX(max->present_ns, times->present_ns);
+  }
+
+  if (pacer->num_history) {
+    avg->wait_ns /= pacer->num_history;
+    avg->sleep_ns /= pacer->num_history;
+    avg->overshoot_ns /= pacer->num_history;
+    avg->emulate_ns /= pacer->num_history;
+    avg->compile_ns /= pacer->num_history;
+    avg->convert_ns /= pacer->num_history;
+    avg->decode_ns /= pacer->num_history;
+    avg->render_ns /= pacer->num_history;
+    avg->present_ns /= pacer->num_history;
+  }
+}
+
+int pacer_history(struct pacer *pacer, struct pacer_times *times) {
+  int begin = pacer->history_pos - pacer->num_history + PACER_HISTORY;
+
+  for (int i = 0; i < pacer->num_history; i++) {
+    times[i] = pacer->history[(begin + i) % PACER_HISTORY];
+  }
+
+  return pacer->num_history;
+}
+
+void pacer_destroy(struct pacer *pacer) {
+  free(pacer);
+}
+
+struct pacer *pacer_create(enum pacing_mode mode, int refresh_rate) {
+  struct pacer *pacer = calloc(1, sizeof(struct pacer));
+
+  pacer->mode = mode;
+  pacer->swap_interval = 1;
+
+  /* present every Nth vblank on displays refreshing at a multiple of the
+     guest's rate */
+  if (mode == PACING_VIDEO && refresh_rate > 0) {
+    pacer->swap_interval = MAX((refresh_rate + 30) / 60, 1);
+  }
+
+  pacer->next_present = time_nanoseconds();
+  pacer->spin_ns = PACER_INIT_SPIN_NS;
+
+  return pacer;
+}
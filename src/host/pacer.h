@@ -0,0 +1,105 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+
+/*
+ * decides when the host steps the emulator and presents its frames
+ *
+ * audio    - frames are ran whenever the buffered audio runs low, syncing
+ *            emulation to the audio clock. the display shows whichever frame
+ *            was last presented, duplicating it on vblanks where no new frame
+ *            is ready
+ * video    - a frame is ran for every swap, syncing emulation to the
+ *            display's vblank. the swap interval is the whole number of
+ *            vblanks closest to a guest frame, with the audio being resampled
+ *            to absorb the difference between the two clocks
+ * adaptive - for variable refresh rate displays, frames are ran back to back
+ *            and each present is delayed until its target time, a guest frame
+ *            after the last, for the display to refresh at the guest's rate.
+ *            the audio is resampled the same as with video
+ */
+enum pacing_mode {
+  PACING_AUDIO,
+  PACING_VIDEO,
+  PACING_ADAPTIVE,
+  NUM_PACING_MODES,
+};
+
+/* where the time of a single host frame went, measured on the host's own
+   thread apart from emulate_ns */
+struct pacer_times {
+  /* time spent waiting before the frame was ran or presented */
+  int64_t wait_ns;
+  /* part of the wait spent sleeping, the rest was spun */
+  int64_t sleep_ns;
+  /* how far past their deadlines the waits ended */
+  int64_t overshoot_ns;
+  /* running the guest, on the emulation thread */
+  int64_t emulate_ns;
+  /* compiling code, within the emulation time */
+  int64_t compile_ns;
+  /* converting the guest's contexts to render commands */
+  int64_t convert_ns;
+  /* decoding textures, within the conversion time. it's summed across the
+     threads decoding, so may exceed the conversion time */
+  int64_t decode_ns;
+  /* submitting the frame to the render backend */
+  int64_t render_ns;
+  /* swapping the window */
+  int64_t present_ns;
+};
+
+/* what the time of a frame went to, for attributing slow frames. the times
+   which include others have them subtracted out */
+enum pacer_cost {
+  COST_EMULATE,
+  COST_COMPILE,
+  COST_CONVERT,
+  COST_DECODE,
+  COST_RENDER,
+  COST_PRESENT,
+  NUM_PACER_COSTS,
+};
+
+extern const char *PACER_COSTS[];
+
+#define PACER_HISTORY 120
+
+struct pacer;
+
+struct pacer *pacer_create(enum pacing_mode mode, int refresh_rate);
+void pacer_destroy(struct pacer *pacer);
+
+enum pacing_mode pacer_mode(struct pacer *pacer);
+int pacer_swap_interval(struct pacer *pacer);
+int pacer_resample_audio(struct pacer *pacer);
+
+/* audio_ns is how much more audio is buffered than the host aims to keep. in
+   audio mode, returns 0 after briefly sleeping while it's positive, else
+   returns 1 for the next frame to be ran */
+int pacer_frame_due(struct pacer *pacer, int64_t audio_ns);
+
+/* called around the swap of each frame. in adaptive mode, the beginning
+   sleeps until the frame's target present time */
+void pacer_begin_present(struct pacer *pacer);
+void pacer_end_present(struct pacer *pacer);
+
+/* records the times of the frame just presented. the wait and present times
+   are filled in by the pacer */
+void pacer_end_frame(struct pacer *pacer, struct pacer_times *times);
+void pacer_stats(struct pacer *pacer, struct pacer_times *avg,
+                 struct pacer_times *max);
+
+/* copies out the times of up to the last PACER_HISTORY frames, from oldest to
+   newest, returning the number copied */
+int pacer_history(struct pacer *pacer, struct pacer_times *times);
+
+/* splits the times of a frame into each cost, returning their total */
+int64_t pacer_costs(const struct pacer_times *times,
+                    int64_t costs[NUM_PACER_COSTS]);
+
+/* budget a frame's costs are to fit within, a guest frame per present */
+int64_t pacer_budget(struct pacer *pacer);
+
+#endif
@@ -93,13 +93,14 @@ struct host *g_host;
  * audio
  */
 void audio_push(struct host *host, const int16_t *data, int frames) {
+  /* data is the aica's own batch buffer, hand it to retroarch as is */
   audio_batch_cb(data, frames);
 }
 
 /*
  * input
  */
-static void input_poll(struct host *host) {
+void input_poll(struct host *host) {
   input_poll_cb();
 
   /* send updates for any inputs that've changed */
@@ -147,6 +148,15 @@ static void video_context_reset() {
   int res = gladLoadGLLoader((GLADloadproc)hw_render.get_proc_address);
   CHECK_EQ(res, 1, "GL initialization failed");
 
+  /* program binaries are core past 4.1, but are commonly exposed to older
+     contexts through GL_ARB_get_program_binary */
+  retro_hw_get_proc_address_t get_proc = hw_render.get_proc_address;
+  glad_glGetProgramBinary =
+      (PFNGLGETPROGRAMBINARYPROC)get_proc("glGetProgramBinary");
+  glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)get_proc("glProgramBinary");
+  glad_glProgramParameteri =
+      (PFNGLPROGRAMPARAMETERIPROC)get_proc("glProgramParameteri");
+
   CHECK(!g_host->video.r);
   g_host->video.r = r_create(VIDEO_WIDTH, VIDEO_HEIGHT);
 
@@ -166,7 +176,11 @@ static int host_init(struct host *host) {
   hw_render.context_reset = &video_context_reset;
   hw_render.context_destroy = &video_context_destroyed;
   hw_render.depth = true;
+  hw_render.stencil = true;
   hw_render.bottom_left_origin = true;
+  /* keep the context, and the textures and programs created in it, alive
+     across video driver reinits such as toggling fullscreen */
+  hw_render.cache_context = true;
 
   bool ret = env_cb(RETRO_ENVIRONMENT_SET_HW_RENDER, &hw_render);
   if (!ret) {
@@ -203,9 +217,14 @@ void retro_init() {
   char config[PATH_MAX] = {0};
   snprintf(config, sizeof(config), "%s" PATH_SEPARATOR "config", appdir);
   options_read(config);
+
+  log_set_async(OPTION_log_async);
 }
 
-void retro_deinit() {}
+void retro_deinit() {
+  /* drain the queue before the core is unloaded */
+  log_set_async(0);
+}
 
 unsigned retro_api_version() {
   return RETRO_API_VERSION;
@@ -214,7 +233,7 @@ unsigned retro_api_version() {
 void retro_get_system_info(struct retro_system_info *info) {
   info->library_name = "redream";
   info->library_version = "0.0";
-  info->valid_extensions = "cdi|chd|gdi";
+  info->valid_extensions = "cdi|chd|gdi|rdz";
   info->need_fullpath = true;
   info->block_extract = false;
 }
@@ -260,10 +279,12 @@ void retro_reset() {}
 void retro_run() {
   input_poll(g_host);
 
-  /* bind the framebuffer provided by retroarch before calling into the
+  /* contexts are rendered straight into the framebuffer provided by
+     retroarch, which may change between frames. the render backend draws to
+     whichever framebuffer is bound, so bind it before calling into the
      emulator */
   uintptr_t fb = hw_render.get_current_framebuffer();
-  glBindFramebuffer(GL_FRAMEBUFFER, fb);
+  glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)fb);
 
   emu_render_frame(g_host->emu);
 
@@ -5,14 +5,17 @@
 #include "core/filesystem.h"
 #include "core/profiler.h"
 #include "core/ringbuf.h"
+#include "core/thread.h"
 #include "core/time.h"
 #include "core/version.h"
 #include "emulator.h"
 #include "guest/aica/aica.h"
 #include "host/host.h"
+#include "host/pacer.h"
 #include "imgui.h"
 #include "options.h"
 #include "render/render_backend.h"
+#include "stats.h"
 #include "tracer.h"
 #include "ui.h"
 
@@ -30,14 +33,26 @@
 #define MS_TO_AUDIO_FRAMES(ms) (int)(((float)(ms) / 1000.0f) * AUDIO_FREQ)
 #define NS_TO_AUDIO_FRAMES(ns) (int)(((float)(ns) / NS_PER_SEC) * AUDIO_FREQ)
 
+/* largest fraction the rate control is allowed to speed up or slow down the
+   rate input frames are consumed at */
+#define AUDIO_MAX_RATE_DELTA 0.005
+
+/* recent history of profiler zones written out when dumping a trace */
+#define TRACE_DURATION (10 * NS_PER_SEC)
+
 struct host {
   struct SDL_Window *win;
   int closed;
 
+  /* while fast-forwarding, the emulator is stepped without waiting on the
+     host's audio or video clocks */
+  int fast_forward;
+
   struct ui *ui;
   struct emu *emu;
   struct tracer *tracer;
   struct imgui *imgui;
+  struct stats_sink *stats;
 
   struct {
     SDL_AudioDeviceID dev;
@@ -45,6 +60,15 @@ struct host {
     int playing;
     struct ringbuf *frames;
     volatile int64_t last_cb;
+    /* the device's callback thread is created by sdl, so its scheduling is
+       configured on the first callback */
+    int thread_configured;
+
+    /* resampler state for rate control. the last four input frames are kept,
+       with the output being interpolated between the middle two, phase being
+       the position in between them of the next output frame */
+    int16_t history[4][2];
+    double phase;
   } audio;
 
   struct {
@@ -52,6 +76,7 @@ struct host {
     struct render_backend *r;
     int width;
     int height;
+    struct pacer *pacer;
   } video;
 
   struct {
@@ -89,9 +114,10 @@ static void audio_write_frames(struct host *host, const void *data,
   int size = MIN(remaining, num_frames * AUDIO_FRAME_SIZE);
   CHECK_EQ(size % AUDIO_FRAME_SIZE, 0);
 
-  void *write_ptr = ringbuf_write_ptr(host->audio.frames);
+  void *write_ptr = ringbuf_reserve(host->audio.frames, size);
+  CHECK_NOTNULL(write_ptr);
   memcpy(write_ptr, data, size);
-  ringbuf_advance_write_ptr(host->audio.frames, size);
+  ringbuf_commit(host->audio.frames, size);
 }
 
 static int audio_buffered_frames(struct host *host) {
@@ -99,11 +125,77 @@ static int audio_buffered_frames(struct host *host) {
   return buffered / AUDIO_FRAME_SIZE;
 }
 
-static int audio_buffer_low(struct host *host) {
+static int audio_estimated_frames(struct host *host) {
+  int64_t now = time_nanoseconds();
+  int64_t since_last_cb = now - host->audio.last_cb;
+  int frames_buffered = audio_buffered_frames(host);
+  return frames_buffered - NS_TO_AUDIO_FRAMES(since_last_cb);
+}
+
+static int audio_low_water_mark(struct host *host) {
+  return host->audio.spec.samples / 2;
+}
+
+static int16_t audio_interpolate(int16_t history[4][2], int c, double t) {
+  /* catmull-rom spline through the four frames, evaluated in between the
+     middle two */
+  double p0 = history[0][c];
+  double p1 = history[1][c];
+  double p2 = history[2][c];
+  double p3 = history[3][c];
+  double a = -0.5 * p0 + 1.5 * p1 - 1.5 * p2 + 0.5 * p3;
+  double b = p0 - 2.5 * p1 + 2.0 * p2 - 0.5 * p3;
+  double d = -0.5 * p0 + 0.5 * p2;
+  double v = ((a * t + b) * t + d) * t + p1;
+  return (int16_t)CLAMP(v, INT16_MIN, INT16_MAX);
+}
+
+static void audio_resample_frames(struct host *host, const int16_t *data,
+                                  int num_frames) {
+  /* the rate the input is consumed at is nudged up while more is buffered
+     than the main loop aims to keep, and down while less is, holding the
+     level steady instead of it swinging between underruns and bursts of
+     frames being ran to catch up */
+  int target = audio_low_water_mark(host);
+  double fill = (audio_estimated_frames(host) - target) / (double)target;
+  double step = 1.0 + AUDIO_MAX_RATE_DELTA * CLAMP(fill, -1.0, 1.0);
+
+  int max_frames = (int)(num_frames / (1.0 - AUDIO_MAX_RATE_DELTA)) + 1;
+  int remaining = ringbuf_remaining(host->audio.frames) / AUDIO_FRAME_SIZE;
+  int out_frames = MIN(max_frames, remaining);
+  int16_t *out =
+      ringbuf_reserve(host->audio.frames, out_frames * AUDIO_FRAME_SIZE);
+  CHECK_NOTNULL(out);
+
+  int16_t(*history)[2] = host->audio.history;
+  int written = 0;
+
+  for (int i = 0; i < num_frames; i++) {
+    memmove(history[0], history[1], sizeof(history[0]) * 3);
+    history[3][0] = data[i * 2 + 0];
+    history[3][1] = data[i * 2 + 1];
+
+    /* frames which don't fit in the ring are dropped */
+    while (host->audio.phase < 1.0) {
+      if (written < out_frames) {
+        out[written * 2 + 0] = audio_interpolate(history, 0, host->audio.phase);
+        out[written * 2 + 1] = audio_interpolate(history, 1, host->audio.phase);
+        written++;
+      }
+      host->audio.phase += step;
+    }
+
+    host->audio.phase -= 1.0;
+  }
+
+  ringbuf_commit(host->audio.frames, written * AUDIO_FRAME_SIZE);
+}
+
+static int64_t audio_time_until_low(struct host *host) {
   if (!host->audio.dev) {
     /* lie and say the audio buffer is low, forcing the emulator to run as fast
        as possible */
-    return 1;
+    return 0;
   }
 
   /* SDL's write callback is called very coarsely, seemingly, only each time
@@ -123,13 +215,8 @@ static int audio_buffer_low(struct host *host) {
      in order to smooth out the video frame timings when the audio latency is
      high, the host clock is used to interpolate the amount of buffered audio
      data between callbacks */
-  int64_t now = time_nanoseconds();
-  int64_t since_last_cb = now - host->audio.last_cb;
-  int frames_buffered = audio_buffered_frames(host);
-  frames_buffered -= NS_TO_AUDIO_FRAMES(since_last_cb);
-
-  int low_water_mark = host->audio.spec.samples / 2;
-  return frames_buffered < low_water_mark;
+  int frames = audio_estimated_frames(host) - audio_low_water_mark(host);
+  return (int64_t)frames * NS_PER_SEC / AUDIO_FREQ;
 }
 
 static void audio_write_cb(void *userdata, Uint8 *stream, int len) {
@@ -137,6 +224,12 @@ static void audio_write_cb(void *userdata, Uint8 *stream, int len) {
   Sint32 *buf = (Sint32 *)stream;
   int frame_count_max = len / AUDIO_FRAME_SIZE;
 
+  if (!host->audio.thread_configured) {
+    thread_set_name("audio");
+    apply_thread_options(ROLE_AUDIO);
+    host->audio.thread_configured = 1;
+  }
+
   static uint32_t tmp[AUDIO_FREQ];
   int frames_buffered = audio_buffered_frames(host);
   int frames_remaining = MIN(frames_buffered, frame_count_max);
@@ -151,6 +244,10 @@ static void audio_write_cb(void *userdata, Uint8 *stream, int len) {
     memcpy(buf, tmp, n * AUDIO_FRAME_SIZE);
   }
 
+  if (frames_buffered < frame_count_max && host->audio.playing) {
+    prof_counter_add(COUNTER_audio_underruns, 1);
+  }
+
   host->audio.last_cb = time_nanoseconds();
 }
 
@@ -167,6 +264,15 @@ static int audio_create_device(struct host *host) {
   /* SDL expects the number of buffered frames to be a power of two */
   int target_frames = 1 << 12;
 
+  if (OPTION_audio_latency > 0) {
+    int latency_frames = MS_TO_AUDIO_FRAMES(OPTION_audio_latency);
+
+    target_frames = 1 << 8;
+    while (target_frames < latency_frames) {
+      target_frames <<= 1;
+    }
+  }
+
   /* match AICA output format */
   SDL_AudioSpec want;
   SDL_zero(want);
@@ -196,7 +302,11 @@ void audio_push(struct host *host, const int16_t *data, int num_frames) {
     return;
   }
 
-  audio_write_frames(host, data, num_frames);
+  if (OPTION_audio_rate_control || pacer_resample_audio(host->video.pacer)) {
+    audio_resample_frames(host, data, num_frames);
+  } else {
+    audio_write_frames(host, data, num_frames);
+  }
 
   /* start playback once some audio is queued */
   if (!host->audio.playing) {
@@ -248,6 +358,49 @@ static int audio_restart(struct host *host) {
 /*
  * video
  */
+static int video_swap_interval(struct host *host) {
+  if (host->fast_forward || !video_sync_enabled()) {
+    return 0;
+  }
+
+  return pacer_swap_interval(host->video.pacer);
+}
+
+static struct pacer *video_create_pacer(struct host *host) {
+  enum pacing_mode mode = PACING_AUDIO;
+
+  for (int i = 0; i < NUM_PACINGS; i++) {
+    if (!strcmp(PACINGS[i], OPTION_pacing)) {
+      mode = (enum pacing_mode)i;
+      break;
+    }
+  }
+
+  /* pacing to the display's vblank relies on swaps blocking on it */
+  if (mode == PACING_VIDEO && !video_sync_enabled()) {
+    LOG_WARNING("video_create_pacer video pacing requires video sync, falling "
+                "back to audio pacing");
+    mode = PACING_AUDIO;
+  }
+
+  SDL_DisplayMode display;
+  int refresh_rate = 60;
+  int display_index = SDL_GetWindowDisplayIndex(host->win);
+
+  if (display_index >= 0 &&
+      SDL_GetCurrentDisplayMode(display_index, &display) == 0 &&
+      display.refresh_rate > 0) {
+    refresh_rate = display.refresh_rate;
+  }
+
+  struct pacer *pacer = pacer_create(mode, refresh_rate);
+
+  LOG_INFO("video_create_pacer pacing=%s refresh_rate=%d swap_interval=%d",
+           PACINGS[mode], refresh_rate, pacer_swap_interval(pacer));
+
+  return pacer;
+}
+
 static void video_destroy_context(struct host *host, SDL_GLContext ctx) {
   /* make sure the context is no longer active before deleting */
   int res = SDL_GL_MakeCurrent(host->win, NULL);
@@ -272,18 +425,29 @@ static SDL_GLContext video_create_context(struct host *host) {
      coordinates to OpenGL */
   SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
 
+  /* modifier volumes are drawn into the stencil buffer */
+  SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+
   SDL_GLContext ctx = SDL_GL_CreateContext(host->win);
   CHECK_NOTNULL(ctx, "video_create_context failed: %s", SDL_GetError());
 
   /* force vsync */
-  int vsync = video_sync_enabled();
-  int res = SDL_GL_SetSwapInterval(vsync);
+  int res = SDL_GL_SetSwapInterval(video_swap_interval(host));
   CHECK_EQ(res, 0, "video_create_context failed to set swap interval");
 
   /* link in gl functions at runtime */
   res = gladLoadGLLoader((GLADloadproc)&SDL_GL_GetProcAddress);
   CHECK_EQ(res, 1, "video_create_context failed to link");
 
+  /* program binaries are core past 4.1, but are commonly exposed to older
+     contexts through GL_ARB_get_program_binary */
+  glad_glGetProgramBinary =
+      (PFNGLGETPROGRAMBINARYPROC)SDL_GL_GetProcAddress("glGetProgramBinary");
+  glad_glProgramBinary =
+      (PFNGLPROGRAMBINARYPROC)SDL_GL_GetProcAddress("glProgramBinary");
+  glad_glProgramParameteri =
+      (PFNGLPROGRAMPARAMETERIPROC)SDL_GL_GetProcAddress("glProgramParameteri");
+
   return ctx;
 }
 
@@ -319,6 +483,8 @@ static void video_shutdown(struct host *host) {
   r_destroy(host->video.r);
 
   video_destroy_context(host, host->video.ctx);
+
+  pacer_destroy(host->video.pacer);
 }
 
 static int video_init(struct host *host) {
@@ -329,6 +495,7 @@ static int video_init(struct host *host) {
      starts fullscreen, ignoring the default width and height */
   SDL_GetWindowSize(host->win, &host->video.width, &host->video.height);
 
+  host->video.pacer = video_create_pacer(host);
   host->video.ctx = video_create_context(host);
   host->video.r = r_create(host->video.width, host->video.height);
 
@@ -553,6 +720,19 @@ static void input_mousemove(struct host *host, int port, int x, int y) {
   imgui_mousemove(host->imgui, x, y);
 }
 
+static void host_write_trace(struct host *host) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s" PATH_SEPARATOR "trace-%" PRId64 ".json",
+           fs_appdir(), (int64_t)time(NULL));
+
+  if (!prof_write_trace(path, TRACE_DURATION)) {
+    LOG_WARNING("host_write_trace failed to write %s", path);
+    return;
+  }
+
+  LOG_INFO("host_write_trace wrote %s", path);
+}
+
 static void input_keydown(struct host *host, int port, int key, int16_t value) {
   /* send event for both the key as well the button it's mapped to (if any) */
   struct button_map *mapping = host->input.keymap[key];
@@ -572,6 +752,18 @@ static void input_keydown(struct host *host, int port, int key, int16_t value) {
     return;
   }
 
+  if (key == K_F12 && value) {
+    host_write_trace(host);
+    return;
+  }
+
+  if (key == K_TAB && host->emu) {
+    host->fast_forward = value != 0;
+    emu_set_fast_forward(host->emu, host->fast_forward);
+    SDL_GL_SetSwapInterval(video_swap_interval(host));
+    return;
+  }
+
   for (int i = 0; i < 2; i++) {
     if (key == K_UNKNOWN) {
       break;
@@ -645,6 +837,12 @@ static int input_init(struct host *host) {
   return 1;
 }
 
+void input_poll(struct host *host) {
+  /* events can only be pumped from the main thread. it polls them whenever
+     it isn't busy presenting, with emu_keydown holding on to what changed
+     until the emulation thread picks it up */
+}
+
 int input_max_controllers(struct host *host) {
   return INPUT_MAX_CONTROLLERS;
 }
@@ -671,7 +869,13 @@ int ui_load_game(struct host *host, const char *path) {
  * internal
  */
 static void host_swap_window(struct host *host) {
-  SDL_GL_SwapWindow(host->win);
+  if (host->fast_forward) {
+    SDL_GL_SwapWindow(host->win);
+  } else {
+    pacer_begin_present(host->video.pacer);
+    SDL_GL_SwapWindow(host->win);
+    pacer_end_present(host->video.pacer);
+  }
 
   /* keep track of the time between swaps */
   int64_t now = time_nanoseconds();
@@ -686,6 +890,58 @@ static void host_swap_window(struct host *host) {
   host->dbg.frame++;
 }
 
+#ifdef HAVE_IMGUI
+static const struct ImVec4 cost_colors[NUM_PACER_COSTS] = {
+    {0.30f, 0.60f, 1.00f, 1.00f}, {1.00f, 0.30f, 0.30f, 1.00f},
+    {0.40f, 0.90f, 0.40f, 1.00f}, {1.00f, 0.80f, 0.20f, 1.00f},
+    {0.80f, 0.40f, 1.00f, 1.00f}, {0.60f, 0.60f, 0.60f, 1.00f},
+};
+
+/* draws the costs of each recent frame as a stacked bar, with a line marking
+   the frame budget at the middle of the graph */
+static void host_cost_graph(struct host *host, struct ImVec2 size) {
+  struct pacer_times times[PACER_HISTORY];
+  int num_times = pacer_history(host->video.pacer, times);
+  float budget = (float)pacer_budget(host->video.pacer);
+  float bar_width = size.x / PACER_HISTORY;
+
+  struct ImDrawList *list = igGetWindowDrawList();
+  struct ImVec2 origin;
+  igGetCursorScreenPos(&origin);
+
+  for (int i = 0; i < num_times; i++) {
+    int64_t costs[NUM_PACER_COSTS];
+    pacer_costs(&times[i], costs);
+
+    float x = origin.x + (PACER_HISTORY - num_times + i) * bar_width;
+    float y = origin.y + size.y;
+
+    for (int j = 0; j < NUM_PACER_COSTS; j++) {
+      float height = costs[j] / (budget * 2.0f) * size.y;
+      struct ImVec2 max = {x + bar_width, y};
+      struct ImVec2 min = {x, MAX(y - height, origin.y)};
+      ImDrawList_AddRectFilled(list, min, max,
+                               igColorConvertFloat4ToU32(cost_colors[j]), 0.0f,
+                               0);
+      y = min.y;
+    }
+  }
+
+  struct ImVec2 line_min = {origin.x, origin.y + size.y / 2.0f};
+  struct ImVec2 line_max = {origin.x + size.x, line_min.y + 1.0f};
+  ImDrawList_AddRectFilled(list, line_min, line_max, 0xffffffff, 0.0f, 0);
+
+  igDummy(&size);
+
+  for (int j = 0; j < NUM_PACER_COSTS; j++) {
+    if (j) {
+      igSameLine(0.0f, -1.0f);
+    }
+    igTextColored(cost_colors[j], "%s", PACER_COSTS[j]);
+  }
+}
+#endif
+
 static void host_debug_menu(struct host *host) {
 #ifdef HAVE_IMGUI
   if (!host->dbg.show_menu) {
@@ -728,6 +984,32 @@ static void host_debug_menu(struct host *host) {
       igPlotLines("", host->dbg.swap_times, num_times,
                   host->dbg.frame % num_times, NULL, 0.0f, 60.0f, graph_size,
                   sizeof(float));
+
+      /* where the time of each frame went, as avg / max in milliseconds */
+      struct pacer_times avg, max;
+      pacer_stats(host->video.pacer, &avg, &max);
+
+      igText("pacing: %s", PACINGS[pacer_mode(host->video.pacer)]);
+      igText("wait:     %6.2f / %6.2f", avg.wait_ns / (float)NS_PER_MS,
+             max.wait_ns / (float)NS_PER_MS);
+      igText(" sleep:   %6.2f / %6.2f", avg.sleep_ns / (float)NS_PER_MS,
+             max.sleep_ns / (float)NS_PER_MS);
+      igText(" over:    %6.2f / %6.2f", avg.overshoot_ns / (float)NS_PER_MS,
+             max.overshoot_ns / (float)NS_PER_MS);
+      igText("emulate:  %6.2f / %6.2f", avg.emulate_ns / (float)NS_PER_MS,
+             max.emulate_ns / (float)NS_PER_MS);
+      igText(" compile: %6.2f / %6.2f", avg.compile_ns / (float)NS_PER_MS,
+             max.compile_ns / (float)NS_PER_MS);
+      igText("convert:  %6.2f / %6.2f", avg.convert_ns / (float)NS_PER_MS,
+             max.convert_ns / (float)NS_PER_MS);
+      igText(" decode:  %6.2f / %6.2f", avg.decode_ns / (float)NS_PER_MS,
+             max.decode_ns / (float)NS_PER_MS);
+      igText("render:   %6.2f / %6.2f", avg.render_ns / (float)NS_PER_MS,
+             max.render_ns / (float)NS_PER_MS);
+      igText("present:  %6.2f / %6.2f", avg.present_ns / (float)NS_PER_MS,
+             max.present_ns / (float)NS_PER_MS);
+
+      host_cost_graph(host, graph_size);
     }
     igEnd();
 
@@ -912,6 +1194,12 @@ static void host_poll_events(struct host *host) {
     OPTION_sync_dirty = 0;
   }
 
+  if (OPTION_pacing_dirty) {
+    int res = video_restart(host);
+    CHECK(res, "video_restart failed");
+    OPTION_pacing_dirty = 0;
+  }
+
   /* update reverse button map when options change */
   int dirty_map = 0;
 
@@ -1013,11 +1301,21 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  log_set_async(OPTION_log_async);
+
   const char *load = argc > 1 ? argv[1] : NULL;
   struct host *host = host_create();
 
   host->imgui = imgui_create();
 
+  if (OPTION_stats_file[0]) {
+    host->stats = stats_sink_create(OPTION_stats_file);
+
+    if (!host->stats) {
+      LOG_WARNING("failed to open stats file %s", OPTION_stats_file);
+    }
+  }
+
   if (load && strstr(load, ".trace")) {
     host->tracer = tracer_create(host);
   } else {
@@ -1028,6 +1326,9 @@ int main(int argc, char **argv) {
   /* init host after creating emulator / tracer client, so host can notify them
      them that the audio / video / input subsystems have been initialized */
   if (host_init(host)) {
+    /* the main thread drives the video output */
+    apply_thread_options(ROLE_VIDEO);
+
     if (host->tracer) {
       if (tracer_load(host->tracer, load)) {
         while (!host->closed) {
@@ -1063,10 +1364,12 @@ int main(int argc, char **argv) {
            close event is received */
         host_poll_events(host);
 
-        /* only step the emulator if the available audio is running low. this
-           syncs the emulation speed with the host audio clock. note however,
-           if audio is disabled, the emulator will run unthrottled */
-        if (!audio_buffer_low(host)) {
+        /* when pacing to the audio, only step the emulator once the available
+           audio is running low. this syncs the emulation speed with the host
+           audio clock. note however, if audio is disabled, the emulator will
+           run unthrottled. the other modes are throttled by the swap */
+        if (!host->fast_forward &&
+            !pacer_frame_due(host->video.pacer, audio_time_until_low(host))) {
           continue;
         }
 
@@ -1086,6 +1389,21 @@ int main(int argc, char **argv) {
         prof_flip(time_nanoseconds());
 
         host_swap_window(host);
+
+        struct emu_frame_times emu_times;
+        emu_frame_times(host->emu, &emu_times);
+
+        struct pacer_times times = {0};
+        times.emulate_ns = emu_times.emulate_ns;
+        times.compile_ns = emu_times.compile_ns;
+        times.convert_ns = emu_times.convert_ns;
+        times.decode_ns = emu_times.decode_ns;
+        times.render_ns = emu_times.render_ns;
+        pacer_end_frame(host->video.pacer, &times);
+
+        if (host->stats) {
+          stats_sink_frame(host->stats, emu_reg_stats(host->emu), now);
+        }
       }
     }
   }
@@ -1107,10 +1425,16 @@ int main(int argc, char **argv) {
 
   imgui_destroy(host->imgui);
 
+  if (host->stats) {
+    stats_sink_destroy(host->stats);
+  }
+
   host_destroy(host);
 
   /* persist options for next run */
   options_write(config);
 
+  log_set_async(0);
+
   return EXIT_SUCCESS;
 }
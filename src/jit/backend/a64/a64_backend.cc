@@ -0,0 +1,1019 @@
+#include "jit/backend/a64/a64_local.h"
+#include <aarch64/disasm-aarch64.h>
+#include <stdexcept>
+
+extern "C" {
+#include "core/exception_handler.h"
+#include "core/memory.h"
+#include "jit/backend/a64/a64_backend.h"
+#include "jit/backend/a64/a64_disassembler.h"
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+#include "jit/jit_backend.h"
+#include "jit/jit_guest.h"
+}
+
+using namespace vixl::aarch64;
+
+/*
+ * a64 register layout
+ */
+
+/* x0-x10 are used for arguments and as scratch registers inside of emitters.
+   x16 / x17 are reserved for vixl's macro assembler, and x18 is the platform
+   register on some operating systems. the guest context and memory base are
+   pinned to the last two callee-saved registers
+
+   note, only the low 64 bits of v8-v15 are preserved across calls, so the
+   vector registers available to the allocator are limited to v16-v31 */
+const Register arg0 = x0;
+const Register arg1 = x1;
+const Register arg2 = x2;
+const Register arg3 = x3;
+const Register tmp0 = x9;
+const Register tmp1 = x10;
+const Register guestctx = x27;
+const Register guestmem = x28;
+const VRegister vtmp0 = v0;
+
+/* clang-format off */
+const struct jit_register a64_registers[] = {
+    {"x0",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x0},
+    {"x1",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x1},
+    {"x2",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x2},
+    {"x3",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x3},
+    {"x4",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x4},
+    {"x5",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x5},
+    {"x6",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x6},
+    {"x7",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x7},
+    {"x8",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x8},
+    {"x9",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x9},
+    {"x10", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x10},
+    {"x11", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x11},
+    {"x12", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x12},
+    {"x13", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x13},
+    {"x14", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x14},
+    {"x15", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x15},
+    {"x16", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x16},
+    {"x17", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x17},
+    {"x18", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x18},
+    {"x19", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x19},
+    {"x20", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x20},
+    {"x21", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x21},
+    {"x22", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x22},
+    {"x23", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x23},
+    {"x24", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x24},
+    {"x25", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x25},
+    {"x26", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x26},
+    {"x27", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x27},
+    {"x28", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x28},
+    {"x29", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x29},
+    {"x30", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x30},
+    {"v0",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v0},
+    {"v1",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v1},
+    {"v2",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v2},
+    {"v3",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v3},
+    {"v4",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v4},
+    {"v5",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v5},
+    {"v6",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v6},
+    {"v7",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v7},
+    {"v8",  JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v8},
+    {"v9",  JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v9},
+    {"v10", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v10},
+    {"v11", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v11},
+    {"v12", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v12},
+    {"v13", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v13},
+    {"v14", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v14},
+    {"v15", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v15},
+    {"v16", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v16},
+    {"v17", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v17},
+    {"v18", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v18},
+    {"v19", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v19},
+    {"v20", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v20},
+    {"v21", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v21},
+    {"v22", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v22},
+    {"v23", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v23},
+    {"v24", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v24},
+    {"v25", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v25},
+    {"v26", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v26},
+    {"v27", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v27},
+    {"v28", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v28},
+    {"v29", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v29},
+    {"v30", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v30},
+    {"v31", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v31},
+};
+
+const int a64_num_registers = ARRAY_SIZE(a64_registers);
+/* clang-format on */
+
+Register a64_backend_reg(struct a64_backend *backend,
+                         const struct ir_value *v) {
+  CHECK(v->reg >= 0 && v->reg < a64_num_registers);
+  const CPURegister *reg = (const CPURegister *)a64_registers[v->reg].data;
+  CHECK(reg->IsRegister());
+
+  /* there are no 8 or 16-bit registers, these live in the bottom of a 32-bit
+     register. the upper bits of these values are undefined, see the notes in
+     a64_emitters.cc on how each emitter deals with this */
+  switch (v->type) {
+    case VALUE_I8:
+    case VALUE_I16:
+    case VALUE_I32:
+      return Register::GetWRegFromCode(reg->GetCode());
+    case VALUE_I64:
+      return Register::GetXRegFromCode(reg->GetCode());
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+
+  return NoReg;
+}
+
+VRegister a64_backend_vreg(struct a64_backend *backend,
+                           const struct ir_value *v) {
+  CHECK(v->reg >= 0 && v->reg < a64_num_registers);
+  const CPURegister *reg = (const CPURegister *)a64_registers[v->reg].data;
+  CHECK(reg->IsVRegister());
+
+  switch (v->type) {
+    case VALUE_F32:
+      return VRegister::GetSRegFromCode(reg->GetCode());
+    case VALUE_F64:
+      return VRegister::GetDRegFromCode(reg->GetCode());
+    case VALUE_V128:
+      return VRegister::GetQRegFromCode(reg->GetCode());
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+
+  return NoVReg;
+}
+
+static int a64_backend_regs_size(int mask) {
+  int size = 0;
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    size += (r->flags & JIT_REG_I64) ? 8 : 16;
+  }
+
+  /* the stack pointer must always be 16-byte aligned */
+  return ALIGN_UP(size, 16);
+}
+
+int a64_backend_push_regs(struct a64_backend *backend, int mask) {
+  auto &e = *backend->codegen;
+
+  /* there's no red zone to write into, allocate the space up front */
+  int size = a64_backend_regs_size(mask);
+  int offset = 0;
+
+  e.Sub(sp, sp, size);
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    const CPURegister *reg = (const CPURegister *)r->data;
+
+    if (r->flags & JIT_REG_I64) {
+      e.Str(Register::GetXRegFromCode(reg->GetCode()), MemOperand(sp, offset));
+      offset += 8;
+    } else {
+      /* keep the 128-bit stores aligned */
+      offset = ALIGN_UP(offset, 16);
+      e.Str(VRegister::GetQRegFromCode(reg->GetCode()), MemOperand(sp, offset));
+      offset += 16;
+    }
+  }
+
+  return size;
+}
+
+void a64_backend_pop_regs(struct a64_backend *backend, int mask) {
+  auto &e = *backend->codegen;
+
+  int size = a64_backend_regs_size(mask);
+  int offset = 0;
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    const CPURegister *reg = (const CPURegister *)r->data;
+
+    if (r->flags & JIT_REG_I64) {
+      e.Ldr(Register::GetXRegFromCode(reg->GetCode()), MemOperand(sp, offset));
+      offset += 8;
+    } else {
+      offset = ALIGN_UP(offset, 16);
+      e.Ldr(VRegister::GetQRegFromCode(reg->GetCode()), MemOperand(sp, offset));
+      offset += 16;
+    }
+  }
+
+  e.Add(sp, sp, size);
+}
+
+void a64_backend_load_mem(struct a64_backend *backend,
+                          const struct ir_value *dst, const MemOperand &src) {
+  auto &e = *backend->codegen;
+
+  switch (dst->type) {
+    case VALUE_I8:
+      e.Ldrb(a64_backend_reg(backend, dst), src);
+      break;
+    case VALUE_I16:
+      e.Ldrh(a64_backend_reg(backend, dst), src);
+      break;
+    case VALUE_I32:
+    case VALUE_I64:
+      e.Ldr(a64_backend_reg(backend, dst), src);
+      break;
+    case VALUE_F32:
+    case VALUE_F64:
+    case VALUE_V128:
+      e.Ldr(a64_backend_vreg(backend, dst), src);
+      break;
+    default:
+      LOG_FATAL("unexpected load result type");
+      break;
+  }
+}
+
+void a64_backend_store_mem(struct a64_backend *backend, const MemOperand &dst,
+                           const struct ir_value *src) {
+  auto &e = *backend->codegen;
+
+  if (ir_is_constant(src)) {
+    /* there are no immediate stores, move the constant into a scratch register
+       first. zero stores directly from the zero register */
+    uint64_t imm = ir_zext_constant(src);
+    int size = ir_type_size(src->type);
+    Register data = size == 8 ? Register(xzr) : Register(wzr);
+
+    if (imm) {
+      data = size == 8 ? tmp0 : tmp0.W();
+      e.Mov(data, imm);
+    }
+
+    switch (size) {
+      case 1:
+        e.Strb(data, dst);
+        break;
+      case 2:
+        e.Strh(data, dst);
+        break;
+      case 4:
+      case 8:
+        e.Str(data, dst);
+        break;
+      default:
+        LOG_FATAL("unexpected value type");
+        break;
+    }
+    return;
+  }
+
+  switch (src->type) {
+    case VALUE_I8:
+      e.Strb(a64_backend_reg(backend, src), dst);
+      break;
+    case VALUE_I16:
+      e.Strh(a64_backend_reg(backend, src), dst);
+      break;
+    case VALUE_I32:
+    case VALUE_I64:
+      e.Str(a64_backend_reg(backend, src), dst);
+      break;
+    case VALUE_F32:
+    case VALUE_F64:
+    case VALUE_V128:
+      e.Str(a64_backend_vreg(backend, src), dst);
+      break;
+    default:
+      LOG_FATAL("unexpected store value type");
+      break;
+  }
+}
+
+void a64_backend_load_mem_ext(struct a64_backend *backend,
+                              const struct ir_value *dst, const MemOperand &src,
+                              const struct ir_value *ext) {
+  auto &e = *backend->codegen;
+
+  Register rd = a64_backend_reg(backend, dst);
+  int sext = ir_zext_constant(ext) != 0;
+
+  switch (ext->type) {
+    case VALUE_I8:
+      if (sext) {
+        e.Ldrsb(rd, src);
+      } else {
+        e.Ldrb(rd.W(), src);
+      }
+      break;
+    case VALUE_I16:
+      if (sext) {
+        e.Ldrsh(rd, src);
+      } else {
+        e.Ldrh(rd.W(), src);
+      }
+      break;
+    case VALUE_I32:
+      if (sext) {
+        e.Ldrsw(rd.X(), src);
+      } else {
+        /* loading a w register zero fills the upper 32-bits */
+        e.Ldr(rd.W(), src);
+      }
+      break;
+    default:
+      LOG_FATAL("unexpected load memory type");
+      break;
+  }
+}
+
+void a64_backend_store_mem_trunc(struct a64_backend *backend,
+                                 const MemOperand &dst,
+                                 const struct ir_value *src,
+                                 const struct ir_value *trunc) {
+  auto &e = *backend->codegen;
+
+  Register ra = a64_backend_reg(backend, src);
+
+  switch (trunc->type) {
+    case VALUE_I8:
+      e.Strb(ra.W(), dst);
+      break;
+    case VALUE_I16:
+      e.Strh(ra.W(), dst);
+      break;
+    case VALUE_I32:
+      e.Str(ra.W(), dst);
+      break;
+    default:
+      LOG_FATAL("unexpected store memory type");
+      break;
+  }
+}
+
+void a64_backend_mov_ext(struct a64_backend *backend, const Register &dst,
+                         const Register &src, const struct ir_value *ext) {
+  auto &e = *backend->codegen;
+
+  int sext = ir_zext_constant(ext) != 0;
+  Register rn = dst.Is64Bits() ? src.X() : src.W();
+
+  switch (ext->type) {
+    case VALUE_I8:
+      if (sext) {
+        e.Sxtb(dst, rn);
+      } else {
+        e.Uxtb(dst.W(), src.W());
+      }
+      break;
+    case VALUE_I16:
+      if (sext) {
+        e.Sxth(dst, rn);
+      } else {
+        e.Uxth(dst.W(), src.W());
+      }
+      break;
+    case VALUE_I32:
+      if (sext) {
+        e.Sxtw(dst.X(), src.X());
+      } else {
+        e.Mov(dst.W(), src.W());
+      }
+      break;
+    default:
+      LOG_FATAL("unexpected memory type");
+      break;
+  }
+}
+
+void a64_backend_mov_value(struct a64_backend *backend, const Register &dst,
+                           const struct ir_value *v) {
+  auto &e = *backend->codegen;
+
+  Register rd = v->type == VALUE_I64 ? dst.X() : dst.W();
+
+  if (ir_is_constant(v)) {
+    e.Mov(rd, ir_zext_constant(v));
+    return;
+  }
+
+  Register rn = a64_backend_reg(backend, v);
+  e.Mov(rd, rn);
+}
+
+void a64_backend_load_guest_constant(struct a64_backend *backend,
+                                     const struct ir_value *dst, uint32_t addr,
+                                     const struct ir_value *ext) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  /* peel away one layer of abstraction and directly access the backing
+     memory or directly invoke the callback when the address is constant */
+  void *userdata;
+  uint8_t *ptr;
+  mem_read_cb read;
+  guest->lookup(guest->mem, addr, &userdata, &ptr, &read, NULL);
+
+  if (ptr && ext) {
+    e.Mov(tmp1, (uint64_t)ptr);
+    a64_backend_load_mem_ext(backend, dst, MemOperand(tmp1), ext);
+  } else if (ptr) {
+    e.Mov(tmp1, (uint64_t)ptr);
+    a64_backend_load_mem(backend, dst, MemOperand(tmp1));
+  } else {
+    enum ir_type mem_type = ext ? ext->type : dst->type;
+    int data_size = ir_type_size(mem_type);
+    uint32_t data_mask = (uint32_t)((UINT64_C(1) << (data_size * 8)) - 1);
+
+    e.Mov(arg0, (uint64_t)userdata);
+    e.Mov(arg1.W(), addr);
+    e.Mov(arg2.W(), data_mask);
+    a64_backend_call(backend, (void *)read);
+
+    Register rd = a64_backend_reg(backend, dst);
+
+    if (ext) {
+      a64_backend_mov_ext(backend, rd, x0, ext);
+    } else {
+      e.Mov(rd, rd.Is64Bits() ? x0.X() : x0.W());
+    }
+  }
+}
+
+void a64_backend_store_guest_constant(struct a64_backend *backend,
+                                      uint32_t addr, const struct ir_value *src,
+                                      const struct ir_value *trunc) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  void *userdata;
+  uint8_t *ptr;
+  mem_write_cb write;
+  guest->lookup(guest->mem, addr, &userdata, &ptr, NULL, &write);
+
+  if (ptr && trunc) {
+    e.Mov(tmp1, (uint64_t)ptr);
+    a64_backend_store_mem_trunc(backend, MemOperand(tmp1), src, trunc);
+  } else if (ptr) {
+    e.Mov(tmp1, (uint64_t)ptr);
+    a64_backend_store_mem(backend, MemOperand(tmp1), src);
+  } else {
+    enum ir_type mem_type = trunc ? trunc->type : src->type;
+    int data_size = ir_type_size(mem_type);
+    uint32_t data_mask = (uint32_t)((UINT64_C(1) << (data_size * 8)) - 1);
+
+    a64_backend_mov_value(backend, arg2, src);
+    e.Mov(arg0, (uint64_t)userdata);
+    e.Mov(arg1.W(), addr);
+    e.Mov(arg3.W(), data_mask);
+    a64_backend_call(backend, (void *)write);
+  }
+}
+
+void a64_backend_call(struct a64_backend *backend, const void *fn) {
+  auto &e = *backend->codegen;
+
+  /* host functions are generally out of range of a direct bl */
+  e.Mov(tmp0, (uint64_t)fn);
+  e.Blr(tmp0);
+}
+
+void a64_backend_jump(struct a64_backend *backend, const void *dst) {
+  auto &e = *backend->codegen;
+
+  /* thunks and compiled code share the same 1 MB buffer, so they're always in
+     range of a direct branch */
+  int64_t offset = (const uint8_t *)dst - e.GetCursorAddress<uint8_t *>();
+  vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+  e.b(offset >> kInstructionSizeLog2);
+}
+
+void a64_backend_jump_cond(struct a64_backend *backend, Condition cond,
+                           const void *dst) {
+  auto &e = *backend->codegen;
+
+  int64_t offset = (const uint8_t *)dst - e.GetCursorAddress<uint8_t *>();
+  CHECK(Instruction::IsValidImmPCOffset(CondBranchType,
+                                        offset >> kInstructionSizeLog2));
+  vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+  e.b(offset >> kInstructionSizeLog2, cond);
+}
+
+static void a64_backend_emit_thunks(struct a64_backend *backend) {
+  auto &e = *backend->codegen;
+
+  /* common routine to invoke an mmio handler on behalf of a fastmem access.
+     the handler's address is expected in tmp0, with its arguments already in
+     place */
+  Label call_handler;
+
+  {
+    e.Bind(&call_handler);
+
+    /* save caller-saved registers that our code uses, the stack is kept
+       16-byte aligned by push_regs */
+    int save_mask = JIT_ALLOCATE | JIT_CALLER_SAVE;
+    e.Str(x30, MemOperand(sp, -16, PreIndex));
+    a64_backend_push_regs(backend, save_mask);
+
+    /* call the mmio handler */
+    e.Blr(tmp0);
+
+    /* restore caller-saved registers */
+    a64_backend_pop_regs(backend, save_mask);
+    e.Ldr(x30, MemOperand(sp, 16, PostIndex));
+    e.Ret();
+  }
+
+  /* the exception handler enters these thunks with the link register set to
+     the instruction following the faulting access */
+  for (int i = 0; i < (int)ARRAY_SIZE(backend->load_thunk); i++) {
+    /* the stack pointer and zero register share encoding 31 */
+    if (i == 31) {
+      continue;
+    }
+
+    backend->load_thunk[i] = e.GetCursorAddress<void *>();
+
+    e.Str(x30, MemOperand(sp, -16, PreIndex));
+    e.Bl(&call_handler);
+    e.Ldr(x30, MemOperand(sp, 16, PostIndex));
+
+    /* save mmio handler result */
+    e.Mov(Register::GetXRegFromCode(i), x0);
+
+    /* return to jit code */
+    e.Ret();
+  }
+
+  {
+    backend->store_thunk = e.GetCursorAddress<void *>();
+
+    e.Str(x30, MemOperand(sp, -16, PreIndex));
+    e.Bl(&call_handler);
+    e.Ldr(x30, MemOperand(sp, 16, PostIndex));
+    e.Ret();
+  }
+}
+
+/* mmio handlers for fastmem loads. MEM is the type of the data in memory, REG
+   the width of the register being loaded into. these are used for all loads,
+   as the upper bits of a register returned from a function returning a
+   smaller type are undefined */
+template <typename MEM, typename REG>
+static uint64_t a64_backend_load_ext(void *data, uint32_t addr) {
+  struct jit_guest *guest = (struct jit_guest *)data;
+  MEM value;
+
+  switch (sizeof(MEM)) {
+    case 1:
+      value = (MEM)guest->r8(guest->mem, addr);
+      break;
+    case 2:
+      value = (MEM)guest->r16(guest->mem, addr);
+      break;
+    case 4:
+      value = (MEM)guest->r32(guest->mem, addr);
+      break;
+    default:
+      value = (MEM)guest->r64(guest->mem, addr);
+      break;
+  }
+
+  return (uint64_t)(REG)value;
+}
+
+static void *a64_backend_load_handler(const struct a64_mem *mem) {
+  int is64 = mem->reg_size == 8;
+
+  if (!mem->ext_signed) {
+    /* writing a w register implicitly clears the upper 32-bits */
+    switch (mem->operand_size) {
+      case 1:
+        return (void *)&a64_backend_load_ext<uint8_t, uint64_t>;
+      case 2:
+        return (void *)&a64_backend_load_ext<uint16_t, uint64_t>;
+      case 4:
+        return (void *)&a64_backend_load_ext<uint32_t, uint64_t>;
+      case 8:
+        return (void *)&a64_backend_load_ext<uint64_t, uint64_t>;
+    }
+  } else {
+    switch (mem->operand_size) {
+      case 1:
+        return is64 ? (void *)&a64_backend_load_ext<int8_t, uint64_t>
+                    : (void *)&a64_backend_load_ext<int8_t, uint32_t>;
+      case 2:
+        return is64 ? (void *)&a64_backend_load_ext<int16_t, uint64_t>
+                    : (void *)&a64_backend_load_ext<int16_t, uint32_t>;
+      case 4:
+        return (void *)&a64_backend_load_ext<int32_t, uint64_t>;
+    }
+  }
+
+  LOG_FATAL("unexpected load");
+  return NULL;
+}
+
+static int a64_backend_handle_exception(struct jit_backend *base,
+                                        struct exception_state *ex) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  struct jit_guest *guest = backend->base.guest;
+
+  /* it's assumed a load / store relative to the memory base has triggered the
+     exception */
+  struct a64_mem mem;
+  if (!a64_decode_mem((const uint8_t *)ex->thread_state.pc, &mem)) {
+    return 0;
+  }
+
+  if (mem.base != (int)guestmem.GetCode()) {
+    return 0;
+  }
+
+  /* figure out the guest address that was being accessed */
+  const uint8_t *fault_addr = (const uint8_t *)ex->fault_addr;
+  const uint8_t *protected_start = (const uint8_t *)ex->thread_state.r28;
+  uint32_t guest_addr = (uint32_t)(fault_addr - protected_start);
+
+  /* ensure it was an mmio address that caused the exception */
+  uint8_t *ptr;
+  guest->lookup(guest->mem, guest_addr, NULL, &ptr, NULL, NULL);
+
+  if (ptr) {
+    return 0;
+  }
+
+  /* a 64-bit access straddling the end of a page may fault on the next page
+     rather than its own address, see x64_backend_handle_exception. the
+     access is a zero-extended register offset from the memory base */
+  if (mem.operand_size == 8) {
+    guest_addr = (uint32_t)ex->thread_state.r[mem.index];
+  }
+
+  /* instead of handling the mmio callback from inside of the exception
+     handler, force pc to the beginning of a thunk which will invoke the
+     callback once the exception handler has exited. this frees the callbacks
+     from any restrictions imposed by an exception handler, and also prevents
+     a possible recursive exception
+
+     the link register is free inside of compiled code, point it at the next
+     instruction after the current access for the thunk to return to */
+  ex->thread_state.r30 = ex->thread_state.pc + kInstructionSize;
+
+  if (mem.is_load) {
+    /* prep argument registers (guest, guest_addr) for the read function */
+    ex->thread_state.r[arg0.GetCode()] = (uint64_t)guest;
+    ex->thread_state.r[arg1.GetCode()] = (uint64_t)guest_addr;
+    ex->thread_state.r[tmp0.GetCode()] =
+        (uint64_t)a64_backend_load_handler(&mem);
+
+    /* resume execution in the thunk once the exception handler exits */
+    CHECK_NOTNULL(backend->load_thunk[mem.reg]);
+    ex->thread_state.pc = (uint64_t)backend->load_thunk[mem.reg];
+  } else {
+    /* register 31 is the zero register */
+    uint64_t data = mem.reg == 31 ? 0 : ex->thread_state.r[mem.reg];
+
+    /* prep argument registers (memory object, guest_addr, value) for write
+       function */
+    ex->thread_state.r[arg0.GetCode()] = (uint64_t)guest->mem;
+    ex->thread_state.r[arg1.GetCode()] = (uint64_t)guest_addr;
+    ex->thread_state.r[arg2.GetCode()] = data;
+
+    /* prep function call address for thunk */
+    switch (mem.operand_size) {
+      case 1:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->w8;
+        break;
+      case 2:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->w16;
+        break;
+      case 4:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->w32;
+        break;
+      case 8:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->w64;
+        break;
+    }
+
+    /* resume execution in the thunk once the exception handler exits */
+    ex->thread_state.pc = (uint64_t)backend->store_thunk;
+  }
+
+  return 1;
+}
+
+static void a64_backend_dump_code(struct jit_backend *base, const uint8_t *addr,
+                                  int size, FILE *output) {
+  Decoder decoder;
+  Disassembler disasm;
+  decoder.AppendVisitor(&disasm);
+
+  fprintf(output, "#==--------------------------------------------------==#\n");
+  fprintf(output, "# a64\n");
+  fprintf(output, "#==--------------------------------------------------==#\n");
+
+  for (int offset = 0; offset < size; offset += kInstructionSize) {
+    const Instruction *instr = (const Instruction *)(addr + offset);
+    decoder.Decode(instr);
+    fprintf(output, "# 0x%08x  %s\n", offset, disasm.GetOutput());
+  }
+}
+
+void a64_backend_emit_branch(struct a64_backend *backend, struct ir *ir,
+                             const ir_value *target) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  MemOperand pc(guestctx, guest->offset_pc);
+  Label *block_label = NULL;
+  int dispatch_type = 0;
+
+  /* update guest pc */
+  if (target) {
+    if (ir_is_constant(target)) {
+      if (target->type == VALUE_BLOCK) {
+        block_label = &backend->block_labels[target->blk->tag];
+
+        struct ir_value *addr = ir_get_meta(ir, target->blk, IR_META_ADDR);
+        e.Mov(tmp0.W(), addr->i32);
+        e.Str(tmp0.W(), pc);
+        dispatch_type = 0;
+      } else {
+        uint32_t addr = target->i32;
+        e.Mov(tmp0.W(), addr);
+        e.Str(tmp0.W(), pc);
+        dispatch_type = 1;
+      }
+    } else {
+      Register addr = a64_backend_reg(backend, target);
+      e.Str(addr.W(), pc);
+      dispatch_type = 2;
+    }
+  } else {
+    dispatch_type = 2;
+  }
+
+  /* jump directly to the block / to dispatch */
+  switch (dispatch_type) {
+    case 0:
+      e.B(block_label);
+      break;
+    case 1: {
+      /* the static dispatch thunk patches this exact instruction, see
+         a64_dispatch_patch_edge */
+      int64_t offset = (const uint8_t *)backend->dispatch_static -
+                       e.GetCursorAddress<uint8_t *>();
+      vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+      e.bl(offset >> kInstructionSizeLog2);
+    } break;
+    case 2:
+      a64_backend_jump(backend, backend->dispatch_dynamic);
+      break;
+  }
+}
+
+static void a64_backend_emit_epilog(struct a64_backend *backend, struct ir *ir,
+                                    struct ir_block *block) {
+  /* if the block didn't branch to another address, return to dispatch */
+  struct ir_instr *last_instr =
+      list_last_entry(&block->instrs, struct ir_instr, it);
+
+  if (last_instr->op != OP_BRANCH && last_instr->op != OP_BRANCH_COND) {
+    a64_backend_emit_branch(backend, ir, NULL);
+  }
+}
+
+static void a64_backend_emit_prolog(struct a64_backend *backend, struct ir *ir,
+                                    struct ir_block *block) {
+  struct jit_guest *guest = backend->base.guest;
+
+  auto &e = *backend->codegen;
+
+  /* count number of instrs / cycles in the block */
+  int num_instrs = 0;
+  int num_cycles = 0;
+
+  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+    if (instr->op == OP_SOURCE_INFO) {
+      num_instrs += 1;
+      num_cycles += instr->arg[1]->i32;
+    }
+  }
+
+  MemOperand cycles(guestctx, guest->offset_cycles);
+  MemOperand instrs(guestctx, guest->offset_instrs);
+
+  /* yield control once remaining cycles are executed. pending interrupts
+     force the remaining cycles negative as well, so a single check covers
+     both */
+  e.Ldr(tmp0.W(), cycles);
+  e.Cmp(tmp0.W(), 0);
+  a64_backend_jump_cond(backend, mi, backend->dispatch_interrupt);
+
+  /* update debug run counts */
+  e.Sub(tmp0.W(), tmp0.W(), num_cycles);
+  e.Str(tmp0.W(), cycles);
+  e.Ldr(tmp1.W(), instrs);
+  e.Add(tmp1.W(), tmp1.W(), num_instrs);
+  e.Str(tmp1.W(), instrs);
+}
+
+static void a64_backend_emit(struct a64_backend *backend, struct ir *ir,
+                             jit_emit_cb emit_cb, void *emit_data) {
+  auto &e = *backend->codegen;
+
+  CHECK_LT(ir->locals_size, A64_STACK_SIZE);
+
+  /* vixl labels can't be created by name, assign each block an index into a
+     table of labels for local branches */
+  int num_blocks = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    block->tag = num_blocks++;
+  }
+
+  Label *block_labels = new Label[num_blocks];
+  backend->block_labels = block_labels;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    int first = 1;
+    uint8_t *block_addr = e.GetCursorAddress<uint8_t *>();
+
+    e.Bind(&block_labels[block->tag]);
+
+    a64_backend_emit_prolog(backend, ir, block);
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      /* call emit callback for each guest block / instruction enabling users
+         to map each to their corresponding host address */
+      if (emit_cb && instr->op == OP_SOURCE_INFO) {
+        uint32_t guest_addr = instr->arg[0]->i32;
+
+        if (first) {
+          emit_cb(emit_data, JIT_EMIT_BLOCK, guest_addr, block_addr);
+          first = 0;
+        }
+
+        uint8_t *instr_addr = e.GetCursorAddress<uint8_t *>();
+        emit_cb(emit_data, JIT_EMIT_INSTR, guest_addr, instr_addr);
+      }
+
+      struct jit_emitter *emitter = &a64_emitters[instr->op];
+      a64_emit_cb emit = (a64_emit_cb)emitter->func;
+      CHECK_NOTNULL(emit);
+      emit(backend, e, ir, instr);
+    }
+
+    a64_backend_emit_epilog(backend, ir, block);
+  }
+
+  backend->block_labels = NULL;
+  delete[] block_labels;
+}
+
+static int a64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
+                                     uint8_t **addr, int *size,
+                                     jit_emit_cb emit_cb, void *emit_data) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  int res = 1;
+  uint8_t *code = backend->codegen_ptr;
+  MacroAssembler e(code, backend->codegen_end - code);
+  backend->codegen = &e;
+
+  /* try to generate the a64 code. if the code buffer overflows let the backend
+     know so it can reset the cache and try again */
+  try {
+    a64_backend_emit(backend, ir, emit_cb, emit_data);
+    e.FinalizeCode();
+  } catch (const std::runtime_error &) {
+    e.GetBuffer()->SetClean();
+    res = 0;
+  }
+
+  backend->codegen = NULL;
+
+  /* return code address */
+  *addr = code;
+  *size = res ? (int)e.GetSizeOfCodeGenerated() : 0;
+
+  if (res) {
+    backend->codegen_ptr += *size;
+    CPU::EnsureIAndDCacheCoherency(code, *size);
+  }
+
+  return res;
+}
+
+static void a64_backend_reset(struct jit_backend *base) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  /* avoid reemitting thunks by just resetting the write pointer to a safe spot
+     after the thunks */
+  backend->codegen_ptr = backend->codegen_begin + A64_THUNK_SIZE;
+}
+
+static void a64_backend_destroy(struct jit_backend *base) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  a64_dispatch_shutdown(backend);
+
+  if (backend->code_mapped) {
+    release_pages(backend->code_mapped, backend->code_buffer->size);
+  } else {
+    jit_release_code_buffer(backend->code_buffer);
+  }
+
+  free(backend);
+}
+
+struct jit_backend *a64_backend_create(struct jit_guest *guest,
+                                       struct jit_code_buffer *buf) {
+  struct a64_backend *backend =
+      (struct a64_backend *)calloc(1, sizeof(struct a64_backend));
+
+  backend->base.guest = guest;
+  backend->base.destroy = &a64_backend_destroy;
+
+  /* compile interface */
+  backend->base.registers = a64_registers;
+  backend->base.num_registers = ARRAY_SIZE(a64_registers);
+  backend->base.emitters = a64_emitters;
+  backend->base.num_emitters = ARRAY_SIZE(a64_emitters);
+  backend->base.reset = &a64_backend_reset;
+  backend->base.assemble_code = &a64_backend_assemble_code;
+  backend->base.dump_code = &a64_backend_dump_code;
+  backend->base.handle_exception = &a64_backend_handle_exception;
+
+  /* dispatch interface */
+  backend->base.run_code = &a64_dispatch_run_code;
+  backend->base.lookup_code = &a64_dispatch_lookup_code;
+  backend->base.cache_code = &a64_dispatch_cache_code;
+  backend->base.invalidate_code = &a64_dispatch_invalidate_code;
+  backend->base.patch_edge = &a64_dispatch_patch_edge;
+  backend->base.restore_edge = &a64_dispatch_restore_edge;
+  backend->base.abort_code = &a64_dispatch_abort_code;
+
+  /* setup codegen buffer, mapping one of the same size when the static one is
+     in use by another instance */
+  int code_size = buf->size;
+  uint8_t *code = buf->data;
+  int r;
+
+  backend->code_buffer = buf;
+
+  if (jit_claim_code_buffer(buf)) {
+    r = protect_pages(code, code_size, ACC_READWRITEEXEC);
+  } else {
+    code = (uint8_t *)reserve_pages(NULL, code_size);
+    CHECK_NOTNULL(code, "failed to reserve a code buffer for another instance");
+    r = commit_pages(code, code_size, ACC_READWRITEEXEC);
+    backend->code_mapped = code;
+  }
+  CHECK(r);
+
+  backend->codegen_begin = (uint8_t *)code;
+  backend->codegen_end = (uint8_t *)code + code_size;
+
+  /* emit initial thunks */
+  MacroAssembler e(backend->codegen_begin, A64_THUNK_SIZE);
+  backend->codegen = &e;
+
+  a64_dispatch_init(backend);
+  a64_dispatch_emit_thunks(backend);
+  a64_backend_emit_thunks(backend);
+  e.FinalizeCode();
+  CHECK_LT(e.GetSizeOfCodeGenerated(), A64_THUNK_SIZE);
+  CPU::EnsureIAndDCacheCoherency(code, e.GetSizeOfCodeGenerated());
+
+  backend->codegen = NULL;
+
+  /* compiled code starts after the thunks, see a64_backend_reset */
+  backend->base.code = (uint8_t *)code + A64_THUNK_SIZE;
+  backend->base.code_size = code_size - A64_THUNK_SIZE;
+  a64_backend_reset(&backend->base);
+
+  return &backend->base;
+}
@@ -0,0 +1,56 @@
+#include <string.h>
+#include "jit/backend/a64/a64_disassembler.h"
+
+int a64_decode_mem(const uint8_t *data, struct a64_mem *mem) {
+  uint32_t instr;
+  memcpy(&instr, data, sizeof(instr));
+
+  /* test for the general purpose load / store (register offset) encoding
+     size 111 0 00 opc 1 Rm option S 10 Rn Rt, which is what all fastmem
+     accesses are emitted as */
+  if ((instr & 0x3f200c00) != 0x38200800) {
+    return 0;
+  }
+
+  int size = (instr >> 30) & 0x3;
+  int opc = (instr >> 22) & 0x3;
+
+  memset(mem, 0, sizeof(*mem));
+  mem->operand_size = 1 << size;
+  mem->reg = instr & 0x1f;
+  mem->base = (instr >> 5) & 0x1f;
+  mem->index = (instr >> 16) & 0x1f;
+
+  switch (opc) {
+    /* STRB / STRH / STR */
+    case 0:
+      mem->is_load = 0;
+      mem->reg_size = size == 3 ? 8 : 4;
+      break;
+    /* LDRB / LDRH / LDR */
+    case 1:
+      mem->is_load = 1;
+      mem->reg_size = size == 3 ? 8 : 4;
+      break;
+    /* LDRSB / LDRSH / LDRSW into a 64-bit register, size 3 is PRFM */
+    case 2:
+      if (size == 3) {
+        return 0;
+      }
+      mem->is_load = 1;
+      mem->reg_size = 8;
+      mem->ext_signed = 1;
+      break;
+    /* LDRSB / LDRSH into a 32-bit register */
+    case 3:
+      if (size >= 2) {
+        return 0;
+      }
+      mem->is_load = 1;
+      mem->reg_size = 4;
+      mem->ext_signed = 1;
+      break;
+  }
+
+  return 1;
+}
@@ -0,0 +1,19 @@
+#ifndef A64_DISASSEMBLER_H
+#define A64_DISASSEMBLER_H
+
+#include <stdint.h>
+
+struct a64_mem {
+  int is_load;
+  int operand_size;
+  /* for extending loads, the size of the register being extended into */
+  int reg_size;
+  int ext_signed;
+  int reg;
+  int base;
+  int index;
+};
+
+int a64_decode_mem(const uint8_t *data, struct a64_mem *mem);
+
+#endif
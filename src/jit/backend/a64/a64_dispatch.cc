@@ -0,0 +1,236 @@
+#include "jit/backend/a64/a64_local.h"
+
+extern "C" {
+#include "core/core.h"
+#include "jit/jit.h"
+#include "jit/jit_guest.h"
+}
+
+using namespace vixl::aarch64;
+
+/* log out pc each time dispatch is entered for debugging */
+#define LOG_DISPATCH_EVERY_N 0
+
+/* controls if edges are added and managed between static branches. the first
+   time each branch is hit, its destination block will be dynamically looked
+   up. if this is enabled, an edge will be added between the two blocks, and
+   the branch will be patched to directly branch to the destination block,
+   avoiding the need for redundant lookups */
+#define LINK_STATIC_BRANCHES !LOG_DISPATCH_EVERY_N
+
+#if LOG_DISPATCH_EVERY_N
+static void a64_dispatch_log(void *data) {
+  static uint64_t num;
+
+  if ((num++ % LOG_DISPATCH_EVERY_N) == 0) {
+    LOG_INFO("a64_log_dispatch");
+  }
+}
+#endif
+
+static void a64_dispatch_patch(void *code, void *dst, int link) {
+  /* edges are always a single b / bl instruction, see
+     a64_backend_emit_branch */
+  int64_t offset = (uint8_t *)dst - (uint8_t *)code;
+
+  Assembler e((vixl::byte *)code, kInstructionSize);
+  if (link) {
+    e.bl(offset >> kInstructionSizeLog2);
+  } else {
+    e.b(offset >> kInstructionSizeLog2);
+  }
+  e.FinalizeCode();
+
+  CPU::EnsureIAndDCacheCoherency(code, kInstructionSize);
+}
+
+void a64_dispatch_restore_edge(struct jit_backend *base, void *code,
+                               uint32_t dst) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  a64_dispatch_patch(code, backend->dispatch_static, 1);
+}
+
+void a64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst) {
+  a64_dispatch_patch(code, dst, 0);
+}
+
+void a64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  *entry = backend->dispatch_compile;
+}
+
+void a64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
+                             void *code) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  CHECK_EQ(*entry, backend->dispatch_compile);
+  *entry = code;
+}
+
+void *a64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  return *entry;
+}
+
+void a64_dispatch_abort_code(struct jit_backend *base) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  backend->dispatch_abort();
+}
+
+void a64_dispatch_run_code(struct jit_backend *base, int cycles) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  backend->dispatch_enter(cycles);
+}
+
+void a64_dispatch_emit_thunks(struct a64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+
+  auto &e = *backend->codegen;
+  int stack_offset = 0;
+
+  MemOperand pc(guestctx, guest->offset_pc);
+
+  /* emit dispatch thunks */
+  {
+    /* called after a dynamic branch instruction stores the next pc to the
+       context. looks up the host block for it jumps to it */
+    backend->dispatch_dynamic = e.GetCursorAddress<void *>();
+
+#if LOG_DISPATCH_EVERY_N
+    e.Mov(arg0, (uint64_t)guest->data);
+    a64_backend_call(backend, (void *)&a64_dispatch_log);
+#endif
+
+    /* invasively look into the jit's cache */
+    e.Ldr(tmp0.W(), pc);
+    e.And(tmp0.W(), tmp0.W(), backend->cache_mask);
+    e.Lsr(tmp0.W(), tmp0.W(), backend->cache_shift);
+    e.Mov(tmp1, (uint64_t)backend->cache);
+    e.Ldr(tmp0, MemOperand(tmp1, tmp0, LSL, 3));
+    e.Br(tmp0);
+  }
+
+  {
+    /* called after a static branch instruction stores the next pc to the
+       context. the thunk calls jit_add_edge which adds an edge between the
+       calling block and the branch destination block, and then falls through
+       to the above dynamic branch thunk. on the second run through this code
+       jit_add_edge will call a64_dispatch_patch_edge, patching the caller to
+       directly branch to the destination block
+
+       note, this thunk is entered with a raw bl, leaving the address of the
+       instruction following the branch in the link register */
+    backend->dispatch_static = e.GetCursorAddress<void *>();
+
+#if LINK_STATIC_BRANCHES
+    e.Mov(arg0, (uint64_t)guest->data);
+    e.Sub(arg1, x30, kInstructionSize);
+    e.Ldr(arg2.W(), pc);
+    a64_backend_call(backend, (void *)guest->link_code);
+#endif
+    a64_backend_jump(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* default cache entry for all blocks. compiles the desired pc before
+       jumping to the block through the dynamic dispatch thunk */
+    backend->dispatch_compile = e.GetCursorAddress<void *>();
+
+    e.Mov(arg0, (uint64_t)guest->data);
+    e.Ldr(arg1.W(), pc);
+    a64_backend_call(backend, (void *)guest->compile_code);
+    a64_backend_jump(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* entry point to the compiled a64 code. sets up the stack frame, sets up
+       fixed registers (context and memory base) and then jumps to the current
+       pc through the dynamic dispatch thunk */
+    backend->dispatch_enter = e.GetCursorAddress<void (*)(int)>();
+
+    /* create stack frame, push_regs keeps the stack 16-byte aligned */
+    a64_backend_push_regs(backend, JIT_CALLEE_SAVE);
+    stack_offset = ALIGN_UP(A64_STACK_SIZE, 16);
+    e.Sub(sp, sp, stack_offset);
+    e.Mov(tmp0, (uint64_t)&backend->dispatch_sp);
+    e.Mov(tmp1, sp);
+    e.Str(tmp1, MemOperand(tmp0));
+
+    /* assign fixed registers */
+    e.Mov(guestctx, (uint64_t)guest->ctx);
+    e.Mov(guestmem, (uint64_t)guest->membase);
+
+    /* reset run state */
+    e.Str(arg0.W(), MemOperand(guestctx, guest->offset_cycles));
+    e.Str(wzr, MemOperand(guestctx, guest->offset_instrs));
+
+    a64_backend_jump(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* exit point for the compiled a64 code, tears down the stack frame and
+       returns */
+    backend->dispatch_exit = e.GetCursorAddress<void *>();
+
+    /* destroy stack frame */
+    e.Add(sp, sp, stack_offset);
+    a64_backend_pop_regs(backend, JIT_CALLEE_SAVE);
+
+    e.Ret();
+  }
+
+  {
+    /* called from inside of a guest memory accessor once it has raised an
+       exception, abandoning the instruction making the access. the frames
+       above compiled code are discarded by restoring the stack pointer it
+       runs with, and execution resumes at the exception handler's pc through
+       the dynamic dispatch thunk. the fixed registers may have been clobbered
+       by the callee, reassign them */
+    backend->dispatch_abort = e.GetCursorAddress<void (*)()>();
+
+    e.Mov(tmp0, (uint64_t)&backend->dispatch_sp);
+    e.Ldr(tmp1, MemOperand(tmp0));
+    e.Mov(sp, tmp1);
+    e.Mov(guestctx, (uint64_t)guest->ctx);
+    e.Mov(guestmem, (uint64_t)guest->membase);
+    a64_backend_jump(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* called by a block once the remaining cycles go negative, either due to
+       running out of them or due to the guest forcing a yield for a pending
+       interrupt. processes any pending interrupt, which restores the cycles
+       of a forced yield, and then either exits or jumps to the new pc through
+       the dynamic dispatch thunk */
+    backend->dispatch_interrupt = e.GetCursorAddress<void *>();
+
+    e.Mov(arg0, (uint64_t)guest->data);
+    a64_backend_call(backend, (void *)guest->check_interrupts);
+    e.Ldr(arg0.W(), MemOperand(guestctx, guest->offset_cycles));
+    e.Cmp(arg0.W(), 0);
+    a64_backend_jump_cond(backend, mi, backend->dispatch_exit);
+    a64_backend_jump(backend, backend->dispatch_dynamic);
+  }
+
+  /* reset cache entries to point to the new compile thunk */
+  for (int i = 0; i < backend->cache_size; i++) {
+    backend->cache[i] = backend->dispatch_compile;
+  }
+}
+
+void a64_dispatch_shutdown(struct a64_backend *backend) {
+  free(backend->cache);
+}
+
+void a64_dispatch_init(struct a64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+
+  /* initialize code cache, one entry per possible block begin */
+  backend->cache_mask = guest->addr_mask;
+  backend->cache_shift = ctz32(guest->addr_mask);
+  backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
+  backend->cache = (void **)malloc(backend->cache_size * sizeof(void *));
+}
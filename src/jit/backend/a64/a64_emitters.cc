@@ -0,0 +1,980 @@
+#include "jit/backend/a64/a64_local.h"
+
+extern "C" {
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+#include "jit/jit_guest.h"
+}
+
+using namespace vixl::aarch64;
+
+#define EMITTER(op, constraints)                                          \
+  void a64_emit_##op(struct a64_backend *, MacroAssembler &, struct ir *, \
+                     struct ir_instr *);                                  \
+  static struct _a64_##op##_init {                                        \
+    _a64_##op##_init() {                                                  \
+      a64_emitters[OP_##op] = {(void *)&a64_emit_##op, constraints};      \
+    }                                                                     \
+  } a64_##op##_init;                                                      \
+  void a64_emit_##op(struct a64_backend *backend, MacroAssembler &e,      \
+                     struct ir *ir, struct ir_instr *instr)
+
+#define CONSTRAINTS(result_flags, ...) \
+  result_flags, {                      \
+    __VA_ARGS__                        \
+  }
+
+#define RES instr->result
+#define ARG0 instr->arg[0]
+#define ARG1 instr->arg[1]
+#define ARG2 instr->arg[2]
+#define ARG3 instr->arg[3]
+
+#define RES_REG a64_backend_reg(backend, RES)
+#define ARG0_REG a64_backend_reg(backend, ARG0)
+#define ARG1_REG a64_backend_reg(backend, ARG1)
+#define ARG2_REG a64_backend_reg(backend, ARG2)
+#define ARG3_REG a64_backend_reg(backend, ARG3)
+
+#define RES_VREG a64_backend_vreg(backend, RES)
+#define ARG0_VREG a64_backend_vreg(backend, ARG0)
+#define ARG1_VREG a64_backend_vreg(backend, ARG1)
+#define ARG2_VREG a64_backend_vreg(backend, ARG2)
+#define ARG3_VREG a64_backend_vreg(backend, ARG3)
+
+/* note, unlike x64, the a64 instruction set is three-operand, so none of the
+   emitters require the result to share a register with the first argument */
+enum {
+  NONE = 0,
+  REG_I64 = JIT_REG_I64,
+  REG_F64 = JIT_REG_F64,
+  REG_V128 = JIT_REG_V128,
+  REG_ALL = REG_I64 | REG_F64 | REG_V128,
+  IMM_I32 = JIT_IMM_I32,
+  IMM_I64 = JIT_IMM_I64,
+  IMM_F32 = JIT_IMM_F32,
+  IMM_F64 = JIT_IMM_F64,
+  IMM_BLK = JIT_IMM_BLK,
+  IMM_ALL = IMM_I32 | IMM_I64 | IMM_F32 | IMM_F64 | IMM_BLK,
+  VAL_I64 = REG_I64 | IMM_I64,
+  VAL_ALL = REG_ALL | IMM_ALL,
+  OPT = JIT_OPTIONAL,
+  OPT_I64 = OPT | VAL_I64,
+};
+
+struct jit_emitter a64_emitters[IR_NUM_OPS];
+
+/* 8 and 16-bit values live in the bottom of a w register, and the emitters
+   below don't bother to keep the unused upper bits clear. any operation whose
+   result depends on those bits (comparisons, right shifts, extensions and
+   tests against zero) must extend the value first */
+static void a64_emit_extend(MacroAssembler &e, const Register &rd,
+                            const Register &rn, enum ir_type type, int sext) {
+  switch (type) {
+    case VALUE_I8:
+      if (sext) {
+        e.Sxtb(rd, rn);
+      } else {
+        e.Uxtb(rd, rn);
+      }
+      break;
+    case VALUE_I16:
+      if (sext) {
+        e.Sxth(rd, rn);
+      } else {
+        e.Uxth(rd, rn);
+      }
+      break;
+    default:
+      if (!rd.Is(rn)) {
+        e.Mov(rd, rn);
+      }
+      break;
+  }
+}
+
+static void a64_emit_test(MacroAssembler &e, const Register &cond,
+                          enum ir_type type) {
+  switch (type) {
+    case VALUE_I8:
+      e.Tst(cond, 0xff);
+      break;
+    case VALUE_I16:
+      e.Tst(cond, 0xffff);
+      break;
+    default:
+      e.Cmp(cond, 0);
+      break;
+  }
+}
+
+/* stores the pc of the instruction being emitted, for accesses which may raise
+   an exception while the guest is translating addresses */
+static void a64_emit_store_pc(struct a64_backend *backend, MacroAssembler &e,
+                              uint32_t addr) {
+  struct jit_guest *guest = backend->base.guest;
+
+  if (!guest->tlb) {
+    return;
+  }
+
+  e.Mov(tmp0.W(), addr);
+  e.Str(tmp0.W(), MemOperand(guestctx, guest->offset_pc));
+}
+
+EMITTER(SOURCE_INFO, CONSTRAINTS(NONE, IMM_I32, IMM_I32)) {
+  backend->source_addr = ARG0->i32;
+}
+
+EMITTER(FALLBACK, CONSTRAINTS(NONE, IMM_I64, IMM_I32, IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
+  void *fallback = (void *)ARG0->i64;
+  uint32_t addr = ARG1->i32;
+  uint32_t raw_instr = ARG2->i32;
+
+  a64_emit_store_pc(backend, e, addr);
+
+  e.Mov(arg0, (uint64_t)guest);
+  e.Mov(arg1.W(), addr);
+  e.Mov(arg2.W(), raw_instr);
+  a64_backend_call(backend, fallback);
+}
+
+EMITTER(LOAD_HOST, CONSTRAINTS(REG_ALL, REG_I64)) {
+  struct ir_value *dst = RES;
+  Register src = ARG0_REG;
+
+  a64_backend_load_mem(backend, dst, MemOperand(src));
+}
+
+EMITTER(STORE_HOST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
+  Register dst = ARG0_REG;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(dst), data);
+}
+
+EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32, OPT | IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
+  struct ir_value *addr = ARG0;
+  struct ir_value *ext = ARG1;
+  enum ir_type mem_type = ext ? ext->type : RES->type;
+
+  /* while the guest is translating addresses, the translation of a constant
+     one can change after compiling */
+  if (ir_is_constant(addr) && !guest->tlb) {
+    a64_backend_load_guest_constant(backend, RES, addr->i32, ext);
+    return;
+  }
+
+  void *fn = nullptr;
+  switch (mem_type) {
+    case VALUE_I8:
+      fn = (void *)guest->r8;
+      break;
+    case VALUE_I16:
+      fn = (void *)guest->r16;
+      break;
+    case VALUE_I32:
+      fn = (void *)guest->r32;
+      break;
+    case VALUE_I64:
+      fn = (void *)guest->r64;
+      break;
+    default:
+      LOG_FATAL("unexpected load result type");
+      break;
+  }
+
+  a64_emit_store_pc(backend, e, backend->source_addr);
+
+  if (ir_is_constant(addr)) {
+    e.Mov(arg1.W(), addr->i32);
+  } else {
+    e.Mov(arg1.W(), a64_backend_reg(backend, addr).W());
+  }
+  e.Mov(arg0, (uint64_t)guest->mem);
+  a64_backend_call(backend, fn);
+
+  Register rd = RES_REG;
+
+  if (ext) {
+    a64_backend_mov_ext(backend, rd, x0, ext);
+  } else {
+    e.Mov(rd, rd.Is64Bits() ? x0.X() : x0.W());
+  }
+}
+
+EMITTER(STORE_GUEST,
+        CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL, OPT | IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
+  struct ir_value *addr = ARG0;
+  struct ir_value *data = ARG1;
+  struct ir_value *trunc = ARG2;
+  enum ir_type mem_type = trunc ? trunc->type : data->type;
+
+  if (ir_is_constant(addr) && !guest->tlb) {
+    a64_backend_store_guest_constant(backend, addr->i32, data, trunc);
+    return;
+  }
+
+  void *fn = nullptr;
+  switch (mem_type) {
+    case VALUE_I8:
+      fn = (void *)guest->w8;
+      break;
+    case VALUE_I16:
+      fn = (void *)guest->w16;
+      break;
+    case VALUE_I32:
+      fn = (void *)guest->w32;
+      break;
+    case VALUE_I64:
+      fn = (void *)guest->w64;
+      break;
+    default:
+      LOG_FATAL("unexpected store value type");
+      break;
+  }
+
+  /* the argument registers are never allocated, so there's no need to worry
+     about clobbering the address or data while setting up the call */
+  a64_emit_store_pc(backend, e, backend->source_addr);
+
+  if (ir_is_constant(addr)) {
+    e.Mov(arg1.W(), addr->i32);
+  } else {
+    e.Mov(arg1.W(), a64_backend_reg(backend, addr).W());
+  }
+  a64_backend_mov_value(backend, arg2, data);
+  e.Mov(arg0, (uint64_t)guest->mem);
+  a64_backend_call(backend, fn);
+}
+
+EMITTER(LOAD_FAST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32, OPT | IMM_I32)) {
+  struct ir_value *dst = RES;
+  struct ir_value *ext = ARG1;
+
+  /* fastmem is selected before the address is known to be constant. resolve
+     these at compile time as well, mmio accesses would otherwise fault */
+  if (ir_is_constant(ARG0)) {
+    a64_backend_load_guest_constant(backend, dst, ARG0->i32, ext);
+    return;
+  }
+
+  /* the exception handler expects a register offset access relative to the
+     memory base, see a64_backend_handle_exception */
+  Register addr = ARG0_REG;
+  MemOperand mem(guestmem, addr.W(), UXTW);
+
+  if (ext) {
+    a64_backend_load_mem_ext(backend, dst, mem, ext);
+  } else {
+    a64_backend_load_mem(backend, dst, mem);
+  }
+}
+
+EMITTER(STORE_FAST,
+        CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL, OPT | IMM_I32)) {
+  struct ir_value *data = ARG1;
+  struct ir_value *trunc = ARG2;
+
+  if (ir_is_constant(ARG0)) {
+    a64_backend_store_guest_constant(backend, ARG0->i32, data, trunc);
+    return;
+  }
+
+  Register addr = ARG0_REG;
+  MemOperand mem(guestmem, addr.W(), UXTW);
+
+  if (trunc) {
+    a64_backend_store_mem_trunc(backend, mem, data, trunc);
+  } else {
+    a64_backend_store_mem(backend, mem, data);
+  }
+}
+
+EMITTER(LOAD_CONTEXT, CONSTRAINTS(REG_ALL, IMM_I32)) {
+  struct ir_value *dst = RES;
+  int offset = ARG0->i32;
+
+  a64_backend_load_mem(backend, dst, MemOperand(guestctx, offset));
+}
+
+EMITTER(STORE_CONTEXT, CONSTRAINTS(NONE, IMM_I32, VAL_ALL)) {
+  int offset = ARG0->i32;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(guestctx, offset), data);
+}
+
+EMITTER(LOAD_LOCAL, CONSTRAINTS(REG_ALL, IMM_I32)) {
+  struct ir_value *dst = RES;
+  int offset = ARG0->i32;
+
+  a64_backend_load_mem(backend, dst, MemOperand(sp, offset));
+}
+
+EMITTER(STORE_LOCAL, CONSTRAINTS(NONE, IMM_I32, VAL_ALL)) {
+  int offset = ARG0->i32;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(sp, offset), data);
+}
+
+EMITTER(FTOI, CONSTRAINTS(REG_I64, REG_F64)) {
+  Register rd = RES_REG;
+  VRegister ra = ARG0_VREG;
+
+  switch (RES->type) {
+    case VALUE_I32:
+      /* fcvtzs already saturates underflows to INT32_MIN and overflows to
+         INT32_MAX, but converts NaN to zero. match the x64 backend, which
+         produces INT32_MIN for NaN */
+      e.Fcvtzs(rd, ra);
+      e.Fcmp(ra, ra);
+      e.Mov(tmp0.W(), INT32_MIN);
+      e.Csel(rd, rd, tmp0.W(), vc);
+      break;
+    default:
+      LOG_FATAL("unexpected result type");
+      break;
+  }
+}
+
+EMITTER(ITOF, CONSTRAINTS(REG_F64, REG_I64)) {
+  VRegister rd = RES_VREG;
+  Register ra = ARG0_REG;
+
+  switch (RES->type) {
+    case VALUE_F32:
+      CHECK_EQ(ARG0->type, VALUE_I32);
+      e.Scvtf(rd, ra);
+      break;
+    case VALUE_F64:
+      CHECK_EQ(ARG0->type, VALUE_I64);
+      e.Scvtf(rd, ra);
+      break;
+    default:
+      LOG_FATAL("unexpected result type");
+      break;
+  }
+}
+
+EMITTER(SEXT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  switch (ARG0->type) {
+    case VALUE_I8:
+      e.Sxtb(rd, rd.Is64Bits() ? ra.X() : ra);
+      break;
+    case VALUE_I16:
+      e.Sxth(rd, rd.Is64Bits() ? ra.X() : ra);
+      break;
+    case VALUE_I32:
+      e.Sxtw(rd, ra.X());
+      break;
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+}
+
+EMITTER(ZEXT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  /* writing a w register always zero fills the upper 32-bits, so only the
+     narrower types need an explicit extension */
+  switch (ARG0->type) {
+    case VALUE_I8:
+      e.Uxtb(rd.W(), ra);
+      break;
+    case VALUE_I16:
+      e.Uxth(rd.W(), ra);
+      break;
+    case VALUE_I32:
+      if (ra.GetCode() != rd.GetCode()) {
+        e.Mov(rd.W(), ra);
+      }
+      break;
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+}
+
+EMITTER(TRUNC, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ra.GetCode() == rd.GetCode()) {
+    /* noop if already the same register. as with the x64 backend, the high
+       order bits of the result won't be cleared */
+    return;
+  }
+
+  e.Mov(rd.W(), ra.W());
+}
+
+EMITTER(FEXT, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fcvt(rd, ra);
+}
+
+EMITTER(FTRUNC, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fcvt(rd, ra);
+}
+
+EMITTER(SELECT, CONSTRAINTS(REG_I64, REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register t = ARG0_REG;
+  Register f = ARG1_REG;
+  Register cond = ARG2_REG;
+
+  a64_emit_test(e, cond, ARG2->type);
+  e.Csel(rd, t, f, ne);
+}
+
+EMITTER(CMP, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32, IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  enum ir_cmp cmp = (enum ir_cmp)ARG2->i32;
+  enum ir_type type = ARG0->type;
+
+  int sext = cmp == CMP_SGE || cmp == CMP_SGT || cmp == CMP_SLE ||
+             cmp == CMP_SLT;
+  int narrow = type == VALUE_I8 || type == VALUE_I16;
+
+  if (narrow) {
+    a64_emit_extend(e, tmp0.W(), ra, type, sext);
+    ra = tmp0.W();
+  }
+
+  if (ir_is_constant(ARG1)) {
+    int64_t imm = (int64_t)ir_zext_constant(ARG1);
+
+    if (narrow && sext) {
+      imm = type == VALUE_I8 ? (int8_t)imm : (int16_t)imm;
+    }
+
+    e.Cmp(ra, imm);
+  } else {
+    Register rb = ARG1_REG;
+
+    if (narrow) {
+      a64_emit_extend(e, tmp1.W(), rb, type, sext);
+      rb = tmp1.W();
+    }
+
+    e.Cmp(ra, rb);
+  }
+
+  switch (cmp) {
+    case CMP_EQ:
+      e.Cset(rd, eq);
+      break;
+    case CMP_NE:
+      e.Cset(rd, ne);
+      break;
+    case CMP_SGE:
+      e.Cset(rd, ge);
+      break;
+    case CMP_SGT:
+      e.Cset(rd, gt);
+      break;
+    case CMP_UGE:
+      e.Cset(rd, hs);
+      break;
+    case CMP_UGT:
+      e.Cset(rd, hi);
+      break;
+    case CMP_SLE:
+      e.Cset(rd, le);
+      break;
+    case CMP_SLT:
+      e.Cset(rd, lt);
+      break;
+    case CMP_ULE:
+      e.Cset(rd, ls);
+      break;
+    case CMP_ULT:
+      e.Cset(rd, lo);
+      break;
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+EMITTER(FCMP, CONSTRAINTS(REG_I64, REG_F64, REG_F64, IMM_I32)) {
+  Register rd = RES_REG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fcmp(ra, rb);
+
+  /* an unordered comparison sets the c and v flags, which makes each of these
+     conditions produce the same result as the x64 backend for NaN */
+  enum ir_cmp cmp = (enum ir_cmp)ARG2->i32;
+  switch (cmp) {
+    case CMP_EQ:
+      e.Cset(rd, eq);
+      break;
+    case CMP_NE:
+      e.Cset(rd, ne);
+      break;
+    case CMP_SGE:
+      e.Cset(rd, ge);
+      break;
+    case CMP_SGT:
+      e.Cset(rd, gt);
+      break;
+    case CMP_SLE:
+      e.Cset(rd, le);
+      break;
+    case CMP_SLT:
+      e.Cset(rd, lt);
+      break;
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+EMITTER(ADD, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Add(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Add(rd, ra, rb);
+  }
+}
+
+EMITTER(SUB, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Sub(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Sub(rd, ra, rb);
+  }
+}
+
+EMITTER(SMUL, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Mul(rd, ra, rb);
+}
+
+EMITTER(UMUL, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Mul(rd, ra, rb);
+}
+
+EMITTER(SDIV, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Sdiv(rd, ra, rb);
+}
+
+EMITTER(UDIV, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Udiv(rd, ra, rb);
+}
+
+EMITTER(NEG, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Neg(rd, ra);
+}
+
+EMITTER(ABS, CONSTRAINTS(NONE)) {
+  LOG_FATAL("unsupported");
+}
+
+EMITTER(FADD, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fadd(rd, ra, rb);
+}
+
+EMITTER(FSUB, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fsub(rd, ra, rb);
+}
+
+EMITTER(FMUL, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fmul(rd, ra, rb);
+}
+
+EMITTER(FDIV, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fdiv(rd, ra, rb);
+}
+
+EMITTER(FNEG, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fneg(rd, ra);
+}
+
+EMITTER(FABS, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fabs(rd, ra);
+}
+
+EMITTER(SQRT, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fsqrt(rd, ra);
+}
+
+EMITTER(VBROADCAST, CONSTRAINTS(REG_V128, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Dup(rd.V4S(), ra.V4S(), 0);
+}
+
+EMITTER(VADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fadd(rd.V4S(), ra.V4S(), rb.V4S());
+}
+
+EMITTER(VDOT, CONSTRAINTS(REG_F64, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  /* multiply, then reduce the four products with two pairwise adds */
+  e.Fmul(vtmp0.V4S(), ra.V4S(), rb.V4S());
+  e.Faddp(vtmp0.V4S(), vtmp0.V4S(), vtmp0.V4S());
+  e.Faddp(rd.S(), vtmp0.V2S());
+}
+
+EMITTER(VMUL, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fmul(rd.V4S(), ra.V4S(), rb.V4S());
+}
+
+EMITTER(VMADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+  VRegister rc = ARG2_VREG;
+
+  /* fmla accumulates into its destination, so the addend must be moved into
+     the result register first unless that would clobber a multiplicand */
+  if (rd.Is(rc)) {
+    e.Fmla(rd.V4S(), ra.V4S(), rb.V4S());
+  } else if (!rd.Is(ra) && !rd.Is(rb)) {
+    e.Mov(rd.V16B(), rc.V16B());
+    e.Fmla(rd.V4S(), ra.V4S(), rb.V4S());
+  } else {
+    e.Mov(vtmp0.V16B(), rc.V16B());
+    e.Fmla(vtmp0.V4S(), ra.V4S(), rb.V4S());
+    e.Mov(rd.V16B(), vtmp0.V16B());
+  }
+}
+
+EMITTER(AND, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.And(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.And(rd, ra, rb);
+  }
+}
+
+EMITTER(OR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Orr(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Orr(rd, ra, rb);
+  }
+}
+
+EMITTER(XOR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Eor(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Eor(rd, ra, rb);
+  }
+}
+
+EMITTER(NOT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Mvn(rd, ra);
+}
+
+EMITTER(SHL, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Lsl(rd, ra, (int)ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Lsl(rd, ra, rd.Is64Bits() ? rb.X() : rb.W());
+  }
+}
+
+EMITTER(ASHR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  /* shift the narrower types in from their own sign bit */
+  if (ARG0->type == VALUE_I8 || ARG0->type == VALUE_I16) {
+    a64_emit_extend(e, tmp0.W(), ra, ARG0->type, 1);
+    ra = tmp0.W();
+  }
+
+  if (ir_is_constant(ARG1)) {
+    e.Asr(rd, ra, (int)ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Asr(rd, ra, rd.Is64Bits() ? rb.X() : rb.W());
+  }
+}
+
+EMITTER(LSHR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ARG0->type == VALUE_I8 || ARG0->type == VALUE_I16) {
+    a64_emit_extend(e, tmp0.W(), ra, ARG0->type, 0);
+    ra = tmp0.W();
+  }
+
+  if (ir_is_constant(ARG1)) {
+    e.Lsr(rd, ra, (int)ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Lsr(rd, ra, rd.Is64Bits() ? rb.X() : rb.W());
+  }
+}
+
+/* branchless form of the sh4's dynamic shifts, mirroring the bmi2 path of the
+   x64 backend. a negative count shifts right by (~count & 0x1f) + 1, which is
+   done as a shift by ~count followed by a shift by one so that the count of 32
+   produced by a count of -32 is handled without a special case */
+static void a64_emit_dynamic_shift(MacroAssembler &e, const Register &rd,
+                                   const Register &ra, const Register &rb,
+                                   int arithmetic) {
+  e.Mvn(tmp0.W(), rb);
+  if (arithmetic) {
+    e.Asr(tmp0.W(), ra, tmp0.W());
+    e.Asr(tmp0.W(), tmp0.W(), 1);
+  } else {
+    e.Lsr(tmp0.W(), ra, tmp0.W());
+    e.Lsr(tmp0.W(), tmp0.W(), 1);
+  }
+  e.Lsl(tmp1.W(), ra, rb);
+  e.Cmp(rb, 0);
+  e.Csel(rd, tmp0.W(), tmp1.W(), lt);
+}
+
+EMITTER(ASHD, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  a64_emit_dynamic_shift(e, rd, ra, rb, 1);
+}
+
+EMITTER(LSHD, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  a64_emit_dynamic_shift(e, rd, ra, rb, 0);
+}
+
+EMITTER(BRANCH, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK, OPT | IMM_I32,
+                            OPT | IMM_I32, OPT | IMM_I64)) {
+  /* the branch hints and profiling counters are only used by the x64
+     backend's return stack and inline caches for now */
+  a64_backend_emit_branch(backend, ir, ARG0);
+}
+
+EMITTER(BRANCH_COND, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK,
+                                 REG_I64 | IMM_I32 | IMM_BLK, REG_I64)) {
+  Register cond = ARG2_REG;
+  Label next;
+
+  a64_emit_test(e, cond, ARG2->type);
+  e.B(&next, eq);
+  a64_backend_emit_branch(backend, ir, ARG0);
+  e.Bind(&next);
+  a64_backend_emit_branch(backend, ir, ARG1);
+}
+
+EMITTER(CALL, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
+  /* move the target out of the way before the arguments are set up */
+  if (!ir_is_constant(ARG0)) {
+    e.Mov(tmp1, ARG0_REG);
+  }
+
+  if (ARG1) {
+    a64_backend_mov_value(backend, arg0, ARG1);
+  }
+  if (ARG2) {
+    a64_backend_mov_value(backend, arg1, ARG2);
+  }
+
+  if (ir_is_constant(ARG0)) {
+    a64_backend_call(backend, (void *)ARG0->i64);
+  } else {
+    e.Blr(tmp1);
+  }
+}
+
+EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
+  Register cond = ARG1_REG;
+  Label skip;
+
+  a64_emit_test(e, cond, ARG1->type);
+  e.B(&skip, eq);
+
+  if (!ir_is_constant(ARG0)) {
+    e.Mov(tmp1, ARG0_REG);
+  }
+
+  if (ARG2) {
+    a64_backend_mov_value(backend, arg0, ARG2);
+  }
+  if (ARG3) {
+    a64_backend_mov_value(backend, arg1, ARG3);
+  }
+
+  if (ir_is_constant(ARG0)) {
+    a64_backend_call(backend, (void *)ARG0->i64);
+  } else {
+    e.Blr(tmp1);
+  }
+
+  e.Bind(&skip);
+}
+
+EMITTER(DEBUG_BREAK, CONSTRAINTS(NONE)) {
+  e.Brk(0);
+}
+
+static void debug_log(uint64_t a, uint64_t b, uint64_t c) {
+  LOG_INFO("DEBUG_LOG a=0x%" PRIx64 " b=0x%" PRIx64 " c=0x%" PRIx64, a, b, c);
+}
+
+EMITTER(DEBUG_LOG, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
+  a64_backend_mov_value(backend, arg0, ARG0);
+  a64_backend_mov_value(backend, arg1, ARG1);
+  a64_backend_mov_value(backend, arg2, ARG2);
+  a64_backend_call(backend, (void *)&debug_log);
+}
+
+EMITTER(ASSERT_EQ, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+  Label skip;
+
+  e.Cmp(ra, rb);
+  e.B(&skip, eq);
+  e.Brk(0);
+  e.Bind(&skip);
+}
+
+EMITTER(ASSERT_LT, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+  Label skip;
+
+  e.Cmp(ra, rb);
+  e.B(&skip, lt);
+  e.Brk(0);
+  e.Bind(&skip);
+}
+
+EMITTER(COPY, CONSTRAINTS(REG_ALL, VAL_ALL)) {
+  if (ir_is_float(RES->type) || ir_is_vector(RES->type)) {
+    VRegister rd = RES_VREG;
+
+    if (ir_is_constant(ARG0)) {
+      /* copy constant into reg */
+      if (ARG0->type == VALUE_F32) {
+        e.Fmov(rd, ARG0->f32);
+      } else {
+        e.Fmov(rd, ARG0->f64);
+      }
+    } else {
+      /* copy reg to reg */
+      VRegister rn = ARG0_VREG;
+      e.Mov(rd.V16B(), rn.V16B());
+    }
+  } else {
+    Register rd = RES_REG;
+
+    if (ir_is_constant(ARG0)) {
+      /* copy constant into reg */
+      e.Mov(rd, ir_zext_constant(ARG0));
+    } else {
+      /* copy reg to reg */
+      Register rn = ARG0_REG;
+      e.Mov(rd, rd.Is64Bits() ? rn.X() : rn.W());
+    }
+  }
+}
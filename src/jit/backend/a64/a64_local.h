@@ -0,0 +1,136 @@
+#ifndef A64_LOCAL_H
+#define A64_LOCAL_H
+
+#include <inttypes.h>
+#include <aarch64/cpu-aarch64.h>
+#include <aarch64/macro-assembler-aarch64.h>
+
+extern "C" {
+#include "jit/jit_backend.h"
+}
+
+struct a64_backend {
+  struct jit_backend base;
+
+  /* code cache */
+  uint32_t cache_mask;
+  int cache_shift;
+  int cache_size;
+  void **cache;
+
+  /* static code buffer passed to the backend, or when it's in use by another
+     backend, pages mapped for this backend alone */
+  struct jit_code_buffer *code_buffer;
+  uint8_t *code_mapped;
+
+  /* codegen state. a new assembler is created over the unused portion of the
+     code buffer for each block of code emitted, codegen_ptr tracks where the
+     next one begins */
+  uint8_t *codegen_begin;
+  uint8_t *codegen_end;
+  uint8_t *codegen_ptr;
+  vixl::aarch64::MacroAssembler *codegen;
+  vixl::aarch64::Label *block_labels;
+  void *dispatch_dynamic;
+  void *dispatch_static;
+  void *dispatch_compile;
+  void *dispatch_interrupt;
+  void (*dispatch_enter)(int32_t);
+  void *dispatch_exit;
+  void (*dispatch_abort)();
+  /* stack pointer compiled code runs with, restored when aborting it */
+  uint64_t dispatch_sp;
+  /* guest address of the instruction being emitted */
+  uint32_t source_addr;
+  void *load_thunk[32];
+  void *store_thunk;
+};
+
+/*
+ * backend functionality used by emitters
+ */
+#define A64_THUNK_SIZE 4096
+#define A64_STACK_SIZE 1024
+
+struct ir_value;
+
+extern const vixl::aarch64::Register arg0;
+extern const vixl::aarch64::Register arg1;
+extern const vixl::aarch64::Register arg2;
+extern const vixl::aarch64::Register arg3;
+extern const vixl::aarch64::Register tmp0;
+extern const vixl::aarch64::Register tmp1;
+extern const vixl::aarch64::Register guestctx;
+extern const vixl::aarch64::Register guestmem;
+extern const vixl::aarch64::VRegister vtmp0;
+
+vixl::aarch64::Register a64_backend_reg(struct a64_backend *backend,
+                                        const struct ir_value *v);
+vixl::aarch64::VRegister a64_backend_vreg(struct a64_backend *backend,
+                                          const struct ir_value *v);
+int a64_backend_push_regs(struct a64_backend *backend, int mask);
+void a64_backend_pop_regs(struct a64_backend *backend, int mask);
+void a64_backend_load_mem(struct a64_backend *backend,
+                          const struct ir_value *dst,
+                          const vixl::aarch64::MemOperand &src);
+void a64_backend_store_mem(struct a64_backend *backend,
+                           const vixl::aarch64::MemOperand &dst,
+                           const struct ir_value *src);
+void a64_backend_load_mem_ext(struct a64_backend *backend,
+                              const struct ir_value *dst,
+                              const vixl::aarch64::MemOperand &src,
+                              const struct ir_value *ext);
+void a64_backend_store_mem_trunc(struct a64_backend *backend,
+                                 const vixl::aarch64::MemOperand &dst,
+                                 const struct ir_value *src,
+                                 const struct ir_value *trunc);
+void a64_backend_mov_ext(struct a64_backend *backend,
+                         const vixl::aarch64::Register &dst,
+                         const vixl::aarch64::Register &src,
+                         const struct ir_value *ext);
+void a64_backend_mov_value(struct a64_backend *backend,
+                           const vixl::aarch64::Register &dst,
+                           const struct ir_value *v);
+void a64_backend_load_guest_constant(struct a64_backend *backend,
+                                     const struct ir_value *dst, uint32_t addr,
+                                     const struct ir_value *ext);
+void a64_backend_store_guest_constant(struct a64_backend *backend,
+                                      uint32_t addr, const struct ir_value *src,
+                                      const struct ir_value *trunc);
+void a64_backend_call(struct a64_backend *backend, const void *fn);
+void a64_backend_jump(struct a64_backend *backend, const void *dst);
+void a64_backend_jump_cond(struct a64_backend *backend,
+                           vixl::aarch64::Condition cond, const void *dst);
+void a64_backend_emit_branch(struct a64_backend *backend, struct ir *ir,
+                             const ir_value *target);
+
+/*
+ * dispatch
+ */
+static inline void **a64_dispatch_code_ptr(struct a64_backend *backend,
+                                           uint32_t addr) {
+  return &backend->cache[(addr & backend->cache_mask) >> backend->cache_shift];
+}
+
+void a64_dispatch_init(struct a64_backend *backend);
+void a64_dispatch_shutdown(struct a64_backend *backend);
+void a64_dispatch_emit_thunks(struct a64_backend *backend);
+void a64_dispatch_run_code(struct jit_backend *base, int cycles);
+void *a64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr);
+void a64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
+                             void *code);
+void a64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr);
+void a64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst);
+void a64_dispatch_abort_code(struct jit_backend *base);
+void a64_dispatch_restore_edge(struct jit_backend *base, void *code,
+                               uint32_t dst);
+
+/*
+ * emitters
+ */
+typedef void (*a64_emit_cb)(struct a64_backend *,
+                            vixl::aarch64::MacroAssembler &, struct ir *,
+                            struct ir_instr *);
+extern struct jit_emitter a64_emitters[IR_NUM_OPS];
+
+#endif
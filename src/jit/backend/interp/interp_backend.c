@@ -1,16 +1,143 @@
+#include <setjmp.h>
 #include <stdlib.h>
+#include <string.h>
+#include "core/core.h"
 #include "jit/jit.h"
 #include "jit/jit_backend.h"
 #include "jit/jit_frontend.h"
 #include "jit/jit_guest.h"
 
+/* pre-decoded guest instruction, executed by directly invoking its fallback */
+struct interp_cell {
+  jit_fallback fallback;
+  uint32_t addr;
+  uint32_t data;
+  int cycles;
+};
+
+/* each block is decoded once into an array of cells. the guest code it was
+   decoded from is copied after the cells, so writes to it can be detected by
+   comparing against the backing memory. this is done the first time the block
+   is entered in each run slice, so a modification is picked up no later than
+   the next time interrupts are checked
+
+   blocks whose code isn't backed by directly accessible memory have no cells,
+   and are always interpreted one instruction at a time */
+struct interp_block {
+  uint32_t guest_addr;
+  int guest_size;
+  const uint8_t *guest_ptr;
+  int validated;
+  int num_cells;
+  struct interp_cell cells[];
+};
+
 struct interp_backend {
   struct jit_backend;
 
   /* used to resolve the fallback handler for each instruction */
   struct jit_frontend *frontend;
+
+  /* decoded blocks, one entry per possible block begin */
+  uint32_t cache_mask;
+  int cache_shift;
+  int cache_size;
+  struct interp_block **cache;
+  int slice;
+
+  /* instructions abandoned due to a guest exception unwind back to the run
+     loop, discarding the rest of the slice being ran */
+  jmp_buf abort_env;
+  int run_slice;
 };
 
+static inline struct interp_block **interp_backend_block_ptr(
+    struct interp_backend *backend, uint32_t addr) {
+  return &backend->cache[(addr & backend->cache_mask) >> backend->cache_shift];
+}
+
+static inline const uint8_t *interp_block_code(struct interp_block *block) {
+  return (const uint8_t *)&block->cells[block->num_cells];
+}
+
+static struct interp_block *interp_backend_decode_block(
+    struct interp_backend *backend, uint32_t addr) {
+  struct jit_frontend *frontend = backend->frontend;
+  struct jit_guest *guest = backend->guest;
+
+  int size = 0;
+  frontend->analyze_code(frontend, addr, &size);
+
+  /* the block can only be validated if all of its code is directly accessible
+     through a single host pointer */
+  uint8_t *begin_ptr = NULL;
+  uint8_t *end_ptr = NULL;
+  guest->lookup(guest->mem, addr, NULL, &begin_ptr, NULL, NULL);
+  guest->lookup(guest->mem, addr + size - 1, NULL, &end_ptr, NULL, NULL);
+
+  if (!begin_ptr || end_ptr != begin_ptr + size - 1) {
+    struct interp_block *block = calloc(1, sizeof(struct interp_block));
+    block->guest_addr = addr;
+    return block;
+  }
+
+  /* guest instructions are fixed-width, and block addresses are aligned to
+     their width */
+  int instr_size = 1 << backend->cache_shift;
+  int num_cells = size / instr_size;
+
+  struct interp_block *block =
+      malloc(sizeof(struct interp_block) +
+             num_cells * sizeof(struct interp_cell) + size);
+  block->guest_addr = addr;
+  block->guest_size = size;
+  block->guest_ptr = begin_ptr;
+  block->validated = backend->slice;
+  block->num_cells = num_cells;
+
+  for (int i = 0; i < num_cells; i++) {
+    struct interp_cell *cell = &block->cells[i];
+    uint32_t instr_addr = addr + i * instr_size;
+    uint32_t data = guest->r32(guest->mem, instr_addr);
+    const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
+
+    cell->fallback = def->fallback;
+    cell->addr = instr_addr;
+    cell->data = data;
+    cell->cycles = def->cycles;
+  }
+
+  memcpy((uint8_t *)interp_block_code(block), begin_ptr, size);
+
+  return block;
+}
+
+static struct interp_block *interp_backend_lookup_block(
+    struct interp_backend *backend, uint32_t addr) {
+  struct interp_block **entry = interp_backend_block_ptr(backend, addr);
+  struct interp_block *block = *entry;
+
+  /* redecode the block if a different mirror of the address was cached, or if
+     its guest code has been modified since it was decoded */
+  if (block && block->guest_addr == addr) {
+    if (!block->num_cells || block->validated == backend->slice) {
+      return block;
+    }
+
+    if (!memcmp(block->guest_ptr, interp_block_code(block),
+                block->guest_size)) {
+      block->validated = backend->slice;
+      return block;
+    }
+  }
+
+  free(block);
+  block = interp_backend_decode_block(backend, addr);
+  *entry = block;
+
+  return block;
+}
+
 static void interp_backend_run_code(struct jit_backend *base, int cycles) {
   struct interp_backend *backend = (struct interp_backend *)base;
   struct jit_frontend *frontend = backend->frontend;
@@ -23,27 +150,65 @@ static void interp_backend_run_code(struct jit_backend *base, int cycles) {
   *run_cycles = cycles;
   *ran_instrs = 0;
 
+  /* how far the aborted slice got isn't known, charge the entire slice */
+  if (setjmp(backend->abort_env)) {
+    guest->check_interrupts(guest->data);
+    *run_cycles -= backend->run_slice;
+  }
+
   while (*run_cycles > 0) {
     int RUN_SLICE = MIN(*run_cycles, 64);
     int cycles = 0;
     int instrs = 0;
+    struct interp_block *block = NULL;
+
+    backend->slice++;
+    backend->run_slice = RUN_SLICE;
 
     do {
       uint32_t addr = *pc;
-      uint32_t data = guest->r32(guest->mem, addr);
-      const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
-      def->fallback(guest, addr, data);
-      cycles += def->cycles;
-      instrs += 1;
+
+      /* loops branching back to the start of the same block are common enough
+         to avoid the lookup for */
+      if (!block || block->guest_addr != addr) {
+        block = interp_backend_lookup_block(backend, addr);
+      }
+
+      if (!block->num_cells) {
+        uint32_t data = guest->r32(guest->mem, addr);
+        const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
+        def->fallback(guest, addr, data);
+        cycles += def->cycles;
+        instrs += 1;
+        continue;
+      }
+
+      /* run through the block's cells until one of them branches away */
+      struct interp_cell *cell = block->cells;
+      struct interp_cell *end = cell + block->num_cells;
+
+      do {
+        cell->fallback(guest, cell->addr, cell->data);
+        cycles += cell->cycles;
+        instrs += 1;
+        cell++;
+      } while (cell < end && *pc == cell->addr && cycles < RUN_SLICE);
     } while (cycles < RUN_SLICE);
 
+    /* check for interrupts first, as a yield forced by one restores the
+       cycles remaining from before it */
+    guest->check_interrupts(guest->data);
+
     *run_cycles -= cycles;
     *ran_instrs += instrs;
-
-    guest->check_interrupts(guest->data);
   }
 }
 
+static void interp_backend_abort_code(struct jit_backend *base) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  longjmp(backend->abort_env, 1);
+}
+
 static int interp_backend_handle_exception(struct jit_backend *base,
                                            struct exception_state *ex) {
   return 0;
@@ -53,11 +218,20 @@ static void interp_backend_dump_code(struct jit_backend *base,
                                      const uint8_t *addr, int size,
                                      FILE *output) {}
 
-static void interp_backend_reset(struct jit_backend *base) {}
+static void interp_backend_reset(struct jit_backend *base) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+
+  for (int i = 0; i < backend->cache_size; i++) {
+    free(backend->cache[i]);
+    backend->cache[i] = NULL;
+  }
+}
 
 static void interp_backend_destroy(struct jit_backend *base) {
   struct interp_backend *backend = (struct interp_backend *)base;
 
+  interp_backend_reset(base);
+  free(backend->cache);
   free(backend);
 }
 
@@ -74,6 +248,7 @@ struct jit_backend *interp_backend_create(struct jit_guest *guest,
   backend->num_registers = 0;
   backend->reset = &interp_backend_reset;
   backend->assemble_code = NULL;
+  backend->grow_code = NULL;
   backend->dump_code = &interp_backend_dump_code;
   backend->handle_exception = &interp_backend_handle_exception;
 
@@ -84,6 +259,13 @@ struct jit_backend *interp_backend_create(struct jit_guest *guest,
   backend->invalidate_code = NULL;
   backend->patch_edge = NULL;
   backend->restore_edge = NULL;
+  backend->abort_code = &interp_backend_abort_code;
+
+  /* initialize block cache, one entry per possible block begin */
+  backend->cache_mask = guest->addr_mask;
+  backend->cache_shift = ctz32(guest->addr_mask);
+  backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
+  backend->cache = calloc(backend->cache_size, sizeof(struct interp_block *));
 
   return (struct jit_backend *)backend;
 }
@@ -1,3 +1,4 @@
+#include <new>
 #include "jit/backend/x64/x64_local.h"
 
 extern "C" {
@@ -301,6 +302,102 @@ void x64_backend_store_mem(struct x64_backend *backend,
   }
 }
 
+void x64_backend_load_mem_ext(struct x64_backend *backend,
+                              const struct ir_value *dst,
+                              const Xbyak::RegExp &src_exp,
+                              const struct ir_value *ext) {
+  auto &e = *backend->codegen;
+
+  Xbyak::Reg rd = x64_backend_reg(backend, dst);
+  int sext = ir_zext_constant(ext) != 0;
+
+  switch (ext->type) {
+    case VALUE_I8:
+      if (sext) {
+        e.movsx(rd, e.byte[src_exp]);
+      } else {
+        e.movzx(rd.cvt32(), e.byte[src_exp]);
+      }
+      break;
+    case VALUE_I16:
+      if (sext) {
+        e.movsx(rd, e.word[src_exp]);
+      } else {
+        e.movzx(rd.cvt32(), e.word[src_exp]);
+      }
+      break;
+    case VALUE_I32:
+      if (sext) {
+        e.movsxd(rd.cvt64(), e.dword[src_exp]);
+      } else {
+        /* mov will automatically zero fill the upper 32-bits */
+        e.mov(rd.cvt32(), e.dword[src_exp]);
+      }
+      break;
+    default:
+      LOG_FATAL("unexpected load memory type");
+      break;
+  }
+}
+
+void x64_backend_store_mem_trunc(struct x64_backend *backend,
+                                 const Xbyak::RegExp &dst_exp,
+                                 const struct ir_value *src,
+                                 const struct ir_value *trunc) {
+  auto &e = *backend->codegen;
+
+  Xbyak::Reg ra = x64_backend_reg(backend, src);
+
+  switch (trunc->type) {
+    case VALUE_I8:
+      e.mov(e.byte[dst_exp], ra.cvt8());
+      break;
+    case VALUE_I16:
+      e.mov(e.word[dst_exp], ra.cvt16());
+      break;
+    case VALUE_I32:
+      e.mov(e.dword[dst_exp], ra.cvt32());
+      break;
+    default:
+      LOG_FATAL("unexpected store memory type");
+      break;
+  }
+}
+
+void x64_backend_mov_ext(struct x64_backend *backend, const Xbyak::Reg &dst,
+                         const Xbyak::Reg &src, const struct ir_value *ext) {
+  auto &e = *backend->codegen;
+
+  int sext = ir_zext_constant(ext) != 0;
+
+  switch (ext->type) {
+    case VALUE_I8:
+      if (sext) {
+        e.movsx(dst, src.cvt8());
+      } else {
+        e.movzx(dst.cvt32(), src.cvt8());
+      }
+      break;
+    case VALUE_I16:
+      if (sext) {
+        e.movsx(dst, src.cvt16());
+      } else {
+        e.movzx(dst.cvt32(), src.cvt16());
+      }
+      break;
+    case VALUE_I32:
+      if (sext) {
+        e.movsxd(dst.cvt64(), src.cvt32());
+      } else {
+        e.mov(dst.cvt32(), src.cvt32());
+      }
+      break;
+    default:
+      LOG_FATAL("unexpected memory type");
+      break;
+  }
+}
+
 void x64_backend_mov_value(struct x64_backend *backend, const Xbyak::Reg &dst,
                            const struct ir_value *v) {
   auto &e = *backend->codegen;
@@ -345,6 +442,300 @@ void x64_backend_mov_value(struct x64_backend *backend, const Xbyak::Reg &dst,
   }
 }
 
+void x64_backend_load_guest_constant(struct x64_backend *backend,
+                                     const struct ir_value *dst, uint32_t addr,
+                                     const struct ir_value *ext) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  /* peel away one layer of abstraction and directly access the backing
+     memory or directly invoke the callback when the address is constant */
+  void *userdata;
+  uint8_t *ptr;
+  mem_read_cb read;
+  guest->lookup(guest->mem, addr, &userdata, &ptr, &read, NULL);
+
+  if (ptr && ext) {
+    e.mov(e.rax, (uint64_t)ptr);
+    x64_backend_load_mem_ext(backend, dst, e.rax, ext);
+  } else if (ptr) {
+    e.mov(e.rax, (uint64_t)ptr);
+    x64_backend_load_mem(backend, dst, e.rax);
+  } else {
+    enum ir_type mem_type = ext ? ext->type : dst->type;
+    int data_size = ir_type_size(mem_type);
+    uint32_t data_mask = (uint32_t)((UINT64_C(1) << (data_size * 8)) - 1);
+
+    e.mov(arg0, (uint64_t)userdata);
+    e.mov(arg1, addr);
+    e.mov(arg2, data_mask);
+    e.call((void *)read);
+
+    if (ext) {
+      x64_backend_mov_ext(backend, x64_backend_reg(backend, dst), e.rax, ext);
+    } else {
+      e.mov(x64_backend_reg(backend, dst), e.rax);
+    }
+  }
+}
+
+void x64_backend_store_guest_constant(struct x64_backend *backend,
+                                      uint32_t addr, const struct ir_value *src,
+                                      const struct ir_value *trunc) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  void *userdata;
+  uint8_t *ptr;
+  mem_write_cb write;
+  guest->lookup(guest->mem, addr, &userdata, &ptr, NULL, &write);
+
+  if (ptr && trunc) {
+    e.mov(e.rax, (uint64_t)ptr);
+    x64_backend_store_mem_trunc(backend, e.rax, src, trunc);
+  } else if (ptr) {
+    e.mov(e.rax, (uint64_t)ptr);
+    x64_backend_store_mem(backend, e.rax, src);
+  } else {
+    enum ir_type mem_type = trunc ? trunc->type : src->type;
+    int data_size = ir_type_size(mem_type);
+    uint32_t data_mask = (uint32_t)((UINT64_C(1) << (data_size * 8)) - 1);
+
+    e.mov(arg0, (uint64_t)userdata);
+    e.mov(arg1, addr);
+    x64_backend_mov_value(backend, arg2, src);
+    e.mov(arg3, data_mask);
+    e.call((void *)write);
+  }
+}
+
+/* accesses made while the guest is translating addresses look up the page in
+   its tlb, branching to the miss path when it isn't cached. on a hit, the
+   translated address is left in rax. rcx and rdx are clobbered. accesses
+   straddling a page always miss, as the tag compared against is that of their
+   last byte */
+static void x64_backend_emit_tlb_lookup(struct x64_backend *backend,
+                                        const struct ir_value *addr, int size,
+                                        struct x64_cold *miss) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  int vaddr = (int)offsetof(struct jit_tlb_entry, vaddr);
+  int paddr = (int)offsetof(struct jit_tlb_entry, paddr);
+
+  if (ir_is_constant(addr)) {
+    /* the entry can be resolved at compile time, but not its contents */
+    uint32_t a = (uint32_t)addr->i32;
+    uint32_t tag = (a + size - 1) & ~JIT_TLB_PAGE_MASK;
+    uint32_t i = (a >> JIT_TLB_PAGE_SHIFT) & (JIT_TLB_SIZE - 1);
+
+    e.mov(e.rcx, (uint64_t)&guest->tlb[i]);
+    e.cmp(e.dword[e.rcx + vaddr], tag);
+    e.jne(miss->label, x64_codegen::T_NEAR);
+    e.mov(e.eax, e.dword[e.rcx + paddr]);
+    if (a & JIT_TLB_PAGE_MASK) {
+      e.or_(e.eax, a & JIT_TLB_PAGE_MASK);
+    }
+    return;
+  }
+
+  Xbyak::Reg ra = x64_backend_reg(backend, addr);
+
+  e.mov(e.eax, ra.cvt32());
+  e.shr(e.eax, JIT_TLB_PAGE_SHIFT);
+  e.and_(e.eax, JIT_TLB_SIZE - 1);
+  e.mov(e.rcx, (uint64_t)guest->tlb);
+  e.lea(e.rcx, e.ptr[e.rcx + e.rax * sizeof(struct jit_tlb_entry)]);
+  e.lea(e.edx, e.ptr[ra.cvt64() + (size - 1)]);
+  e.and_(e.edx, ~JIT_TLB_PAGE_MASK);
+  e.cmp(e.edx, e.dword[e.rcx + vaddr]);
+  e.jne(miss->label, x64_codegen::T_NEAR);
+  e.mov(e.eax, ra.cvt32());
+  e.and_(e.eax, JIT_TLB_PAGE_MASK);
+  e.or_(e.eax, e.dword[e.rcx + paddr]);
+}
+
+/* tlb misses call the guest's accessor, which translates the address and
+   refills the tlb, or raises an exception at the instruction's pc. the
+   caller-saved registers in use are preserved through the mmio thunks, with
+   the accessor's result left in rax */
+static void x64_backend_emit_tlb_call(struct x64_backend *backend,
+                                      struct x64_cold *cold, void *fn) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+  const struct ir_value *addr = cold->args[1];
+  uint32_t pc = (uint32_t)(uintptr_t)cold->data;
+
+  e.mov(e.dword[guestctx + guest->offset_pc], pc);
+  e.mov(arg0, (uint64_t)guest->mem);
+  x64_backend_mov_value(backend, arg1, addr);
+  e.mov(e.rax, (uint64_t)fn);
+}
+
+static void x64_backend_emit_load_miss(struct x64_backend *backend,
+                                       struct x64_cold *cold) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+  const struct ir_value *dst = cold->args[0];
+  const struct ir_value *ext = cold->args[2];
+  enum ir_type mem_type = ext ? ext->type : dst->type;
+
+  void *fn = nullptr;
+  switch (ir_type_size(mem_type)) {
+    case 1:
+      fn = (void *)guest->r8;
+      break;
+    case 2:
+      fn = (void *)guest->r16;
+      break;
+    case 4:
+      fn = (void *)guest->r32;
+      break;
+    case 8:
+      fn = (void *)guest->r64;
+      break;
+    default:
+      LOG_FATAL("unexpected load result type");
+      break;
+  }
+
+  x64_backend_emit_tlb_call(backend, cold, fn);
+  e.call(backend->load_thunk[Xbyak::Operand::RAX]);
+
+  if (ir_is_float(dst->type)) {
+    Xbyak::Xmm rd = x64_backend_xmm(backend, dst);
+
+    if (dst->type == VALUE_F32) {
+      if (X64_USE_AVX) {
+        e.vmovd(rd, e.eax);
+      } else {
+        e.movd(rd, e.eax);
+      }
+    } else {
+      if (X64_USE_AVX) {
+        e.vmovq(rd, e.rax);
+      } else {
+        e.movq(rd, e.rax);
+      }
+    }
+  } else if (ext) {
+    x64_backend_mov_ext(backend, x64_backend_reg(backend, dst), e.rax, ext);
+  } else {
+    e.mov(x64_backend_reg(backend, dst), e.rax);
+  }
+
+  e.jmp(cold->ret, x64_codegen::T_NEAR);
+}
+
+static void x64_backend_emit_store_miss(struct x64_backend *backend,
+                                        struct x64_cold *cold) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+  const struct ir_value *src = cold->args[0];
+  const struct ir_value *trunc = cold->args[2];
+  enum ir_type mem_type = trunc ? trunc->type : src->type;
+
+  void *fn = nullptr;
+  switch (ir_type_size(mem_type)) {
+    case 1:
+      fn = (void *)guest->w8;
+      break;
+    case 2:
+      fn = (void *)guest->w16;
+      break;
+    case 4:
+      fn = (void *)guest->w32;
+      break;
+    case 8:
+      fn = (void *)guest->w64;
+      break;
+    default:
+      LOG_FATAL("unexpected store value type");
+      break;
+  }
+
+  x64_backend_emit_tlb_call(backend, cold, fn);
+
+  if (ir_is_float(src->type) && ir_is_constant(src)) {
+    if (src->type == VALUE_F32) {
+      e.mov(arg2.cvt32(), *(int32_t *)&src->f32);
+    } else {
+      e.mov(arg2, *(int64_t *)&src->f64);
+    }
+  } else if (ir_is_float(src->type)) {
+    Xbyak::Xmm rs = x64_backend_xmm(backend, src);
+
+    if (src->type == VALUE_F32) {
+      if (X64_USE_AVX) {
+        e.vmovd(arg2.cvt32(), rs);
+      } else {
+        e.movd(arg2.cvt32(), rs);
+      }
+    } else {
+      if (X64_USE_AVX) {
+        e.vmovq(arg2, rs);
+      } else {
+        e.movq(arg2, rs);
+      }
+    }
+  } else {
+    x64_backend_mov_value(backend, arg2, src);
+  }
+
+  e.call(backend->store_thunk);
+  e.jmp(cold->ret, x64_codegen::T_NEAR);
+}
+
+void x64_backend_load_tlb(struct x64_backend *backend,
+                          const struct ir_value *dst,
+                          const struct ir_value *addr,
+                          const struct ir_value *ext) {
+  auto &e = *backend->codegen;
+  enum ir_type mem_type = ext ? ext->type : dst->type;
+
+  struct x64_cold *miss =
+      x64_backend_add_cold(backend, &x64_backend_emit_load_miss);
+  miss->args[0] = dst;
+  miss->args[1] = addr;
+  miss->args[2] = ext;
+  miss->data = (void *)(uintptr_t)backend->source_addr;
+
+  x64_backend_emit_tlb_lookup(backend, addr, ir_type_size(mem_type), miss);
+
+  if (ext) {
+    x64_backend_load_mem_ext(backend, dst, e.rax + guestmem, ext);
+  } else {
+    x64_backend_load_mem(backend, dst, e.rax + guestmem);
+  }
+
+  e.L(miss->ret);
+}
+
+void x64_backend_store_tlb(struct x64_backend *backend,
+                           const struct ir_value *addr,
+                           const struct ir_value *src,
+                           const struct ir_value *trunc) {
+  auto &e = *backend->codegen;
+  enum ir_type mem_type = trunc ? trunc->type : src->type;
+
+  struct x64_cold *miss =
+      x64_backend_add_cold(backend, &x64_backend_emit_store_miss);
+  miss->args[0] = src;
+  miss->args[1] = addr;
+  miss->args[2] = trunc;
+  miss->data = (void *)(uintptr_t)backend->source_addr;
+
+  x64_backend_emit_tlb_lookup(backend, addr, ir_type_size(mem_type), miss);
+
+  if (trunc) {
+    x64_backend_store_mem_trunc(backend, e.rax + guestmem, src, trunc);
+  } else {
+    x64_backend_store_mem(backend, e.rax + guestmem, src);
+  }
+
+  e.L(miss->ret);
+}
+
 const Xbyak::Address x64_backend_xmm_constant(struct x64_backend *backend,
                                               enum xmm_constant c) {
   auto &e = *backend->codegen;
@@ -452,6 +843,57 @@ static void x64_backend_emit_constants(struct x64_backend *backend) {
   e.dq(*(uint64_t *)&dbl_max_i32);
 }
 
+/* mmio handlers for fastmem loads which sign or zero extend the data read
+   (movsx / movzx). MEM is the type of the data in memory, REG the width of the
+   register being loaded into */
+template <typename MEM, typename REG>
+static uint64_t x64_backend_load_ext(void *data, uint32_t addr) {
+  struct jit_guest *guest = (struct jit_guest *)data;
+  MEM value;
+
+  switch (sizeof(MEM)) {
+    case 1:
+      value = (MEM)guest->r8(guest->mem, addr);
+      break;
+    case 2:
+      value = (MEM)guest->r16(guest->mem, addr);
+      break;
+    default:
+      value = (MEM)guest->r32(guest->mem, addr);
+      break;
+  }
+
+  return (uint64_t)(REG)value;
+}
+
+static void *x64_backend_load_ext_handler(const struct x64_mov *mov) {
+  int is64 = mov->ext_size == 8;
+
+  if (!mov->ext_signed) {
+    /* zero extending to 32-bits implicitly clears the upper 32-bits */
+    switch (mov->operand_size) {
+      case 1:
+        return (void *)&x64_backend_load_ext<uint8_t, uint64_t>;
+      case 2:
+        return (void *)&x64_backend_load_ext<uint16_t, uint64_t>;
+    }
+  } else {
+    switch (mov->operand_size) {
+      case 1:
+        return is64 ? (void *)&x64_backend_load_ext<int8_t, uint64_t>
+                    : (void *)&x64_backend_load_ext<int8_t, uint32_t>;
+      case 2:
+        return is64 ? (void *)&x64_backend_load_ext<int16_t, uint64_t>
+                    : (void *)&x64_backend_load_ext<int16_t, uint32_t>;
+      case 4:
+        return (void *)&x64_backend_load_ext<int32_t, uint64_t>;
+    }
+  }
+
+  LOG_FATAL("unexpected extended load");
+  return NULL;
+}
+
 static int x64_backend_handle_exception(struct jit_backend *base,
                                         struct exception_state *ex) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
@@ -478,6 +920,20 @@ static int x64_backend_handle_exception(struct jit_backend *base,
     return 0;
   }
 
+  /* a 64-bit access straddling the end of a page faults on the first byte
+     of the next page rather than its own address. these are made by the
+     memory access coalescing pass, which doesn't know the alignment of the
+     base address, so recover the address from the mov's operands. the read64
+     / write64 handlers split the access between the pages */
+  if (mov.operand_size == 8 && mov.is_indirect) {
+    uint64_t addr = mov.has_base ? ex->thread_state.r[mov.base] : 0;
+    if (mov.has_index) {
+      addr += ex->thread_state.r[mov.index] << mov.scale;
+    }
+    addr += (int64_t)mov.disp;
+    guest_addr = (uint32_t)(addr - (uint64_t)protected_start);
+  }
+
   /* instead of handling the mmio callback from inside of the exception
      handler, force rip to the beginning of a thunk which will invoke the
      callback once the exception handler has exited. this frees the callbacks
@@ -491,7 +947,16 @@ static int x64_backend_handle_exception(struct jit_backend *base,
   *(uint64_t *)(ex->thread_state.rsp) = ex->thread_state.rip + mov.length;
   CHECK(ex->thread_state.rsp % 16 == 8);
 
-  if (mov.is_load) {
+  if (mov.is_load && mov.ext_size) {
+    /* prep argument registers (guest, guest_addr) for the extending read
+       function */
+    ex->thread_state.r[x64_arg0_idx] = (uint64_t)guest;
+    ex->thread_state.r[x64_arg1_idx] = (uint64_t)guest_addr;
+    ex->thread_state.rax = (uint64_t)x64_backend_load_ext_handler(&mov);
+
+    /* resume execution in the thunk once the exception handler exits */
+    ex->thread_state.rip = (uint64_t)backend->load_thunk[mov.reg];
+  } else if (mov.is_load) {
     /* prep argument registers (memory object, guest_addr) for read function */
     ex->thread_state.r[x64_arg0_idx] = (uint64_t)guest->mem;
     ex->thread_state.r[x64_arg1_idx] = (uint64_t)guest_addr;
@@ -612,6 +1077,170 @@ void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
   }
 }
 
+void x64_backend_emit_call(struct x64_backend *backend, uint32_t ret_addr) {
+  auto &e = *backend->codegen;
+
+  void **code = x64_dispatch_alloc_code_ptr(backend, ret_addr);
+  int top = (int)offsetof(struct x64_ras, top);
+  int addrs = (int)offsetof(struct x64_ras, addr);
+  int codes = (int)offsetof(struct x64_ras, code);
+
+  /* push the return address onto the shadow stack, overwriting the oldest
+     entry once full */
+  e.mov(e.rax, (uint64_t)&backend->ras);
+  e.mov(e.ecx, e.dword[e.rax + top]);
+  e.inc(e.ecx);
+  e.and_(e.ecx, X64_RAS_SIZE - 1);
+  e.mov(e.dword[e.rax + top], e.ecx);
+  e.mov(e.dword[e.rax + e.rcx * 4 + addrs], ret_addr);
+  e.mov(e.rdx, (uint64_t)code);
+  e.mov(e.qword[e.rax + e.rcx * 8 + codes], e.rdx);
+}
+
+static void x64_backend_count_prediction(struct x64_backend *backend,
+                                         const ir_value *counters, int hit) {
+  auto &e = *backend->codegen;
+
+  if (!counters) {
+    return;
+  }
+
+  /* rax is in use by the callers, use the other scratch register */
+  e.mov(e.rdx, (uint64_t)counters->i64);
+  e.inc(e.qword[e.rdx + (hit ? 0 : 8)]);
+}
+
+static void x64_backend_reset_cold(struct x64_backend *backend) {
+  /* labels can't be redefined, recreate them for the next unit */
+  for (int i = 0; i < backend->num_cold; i++) {
+    struct x64_cold *cold = &backend->cold[i];
+    cold->label.~Label();
+    cold->ret.~Label();
+    new (&cold->label) Xbyak::Label();
+    new (&cold->ret) Xbyak::Label();
+  }
+
+  backend->num_cold = 0;
+}
+
+static void x64_backend_emit_cold(struct x64_backend *backend) {
+  auto &e = *backend->codegen;
+
+  for (int i = 0; i < backend->num_cold; i++) {
+    struct x64_cold *cold = &backend->cold[i];
+    e.L(cold->label);
+    cold->emit(backend, cold);
+  }
+
+  x64_backend_reset_cold(backend);
+}
+
+struct x64_cold *x64_backend_add_cold(struct x64_backend *backend,
+                                      x64_cold_cb emit) {
+  auto &e = *backend->codegen;
+
+  /* if the unit has run out of cold paths, emit the pending ones in place,
+     jumping over them */
+  if (backend->num_cold == X64_MAX_COLD) {
+    Xbyak::Label skip;
+    e.jmp(skip, x64_codegen::T_NEAR);
+    x64_backend_emit_cold(backend);
+    e.L(skip);
+  }
+
+  struct x64_cold *cold = &backend->cold[backend->num_cold++];
+  cold->emit = emit;
+  cold->args[0] = NULL;
+  cold->args[1] = NULL;
+  cold->args[2] = NULL;
+  cold->data = NULL;
+  return cold;
+}
+
+static void x64_backend_emit_return_miss(struct x64_backend *backend,
+                                         struct x64_cold *cold) {
+  auto &e = *backend->codegen;
+  x64_backend_count_prediction(backend, cold->args[0], 0);
+  e.jmp(backend->dispatch_dynamic);
+}
+
+void x64_backend_emit_return(struct x64_backend *backend,
+                             const ir_value *target, const ir_value *counters) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  Xbyak::Reg addr = x64_backend_reg(backend, target);
+  int top = (int)offsetof(struct x64_ras, top);
+  int addrs = (int)offsetof(struct x64_ras, addr);
+  int codes = (int)offsetof(struct x64_ras, code);
+
+  e.mov(e.dword[guestctx + guest->offset_pc], addr);
+
+  /* if the return matches the prediction, pop it and jump directly through
+     its cache slot, giving the host a distinct indirect branch per return
+     site. on a mismatch, leave the stack alone and take the dynamic path */
+  e.mov(e.rax, (uint64_t)&backend->ras);
+  e.mov(e.ecx, e.dword[e.rax + top]);
+  e.cmp(addr.cvt32(), e.dword[e.rax + e.rcx * 4 + addrs]);
+
+  if (counters) {
+    struct x64_cold *miss =
+        x64_backend_add_cold(backend, &x64_backend_emit_return_miss);
+    miss->args[0] = counters;
+    e.jne(miss->label, x64_codegen::T_NEAR);
+  } else {
+    e.jne(backend->dispatch_dynamic);
+  }
+
+  x64_backend_count_prediction(backend, counters, 1);
+  e.mov(e.rdx, e.qword[e.rax + e.rcx * 8 + codes]);
+  e.dec(e.ecx);
+  e.and_(e.ecx, X64_RAS_SIZE - 1);
+  e.mov(e.dword[e.rax + top], e.ecx);
+  e.jmp(e.qword[e.rdx]);
+}
+
+static void x64_backend_emit_dynamic_miss(struct x64_backend *backend,
+                                          struct x64_cold *cold) {
+  auto &e = *backend->codegen;
+  Xbyak::Reg addr = x64_backend_reg(backend, cold->args[0]);
+
+  /* record the new destination and perform the same lookup as the dynamic
+     dispatch thunk. rax still points to the inline cache */
+  x64_backend_count_prediction(backend, cold->args[1], 0);
+  e.mov(e.dword[e.rax + offsetof(struct x64_ic, addr)], addr.cvt32());
+  x64_dispatch_emit_code_ptr(backend, addr.cvt32());
+  e.mov(e.qword[e.rax + offsetof(struct x64_ic, code)], e.rdx);
+  e.jmp(e.qword[e.rdx]);
+}
+
+void x64_backend_emit_dynamic_branch(struct x64_backend *backend,
+                                     const ir_value *target,
+                                     const ir_value *counters) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  Xbyak::Reg addr = x64_backend_reg(backend, target);
+  struct x64_ic *ic = &backend->ics[backend->next_ic];
+  backend->next_ic = (backend->next_ic + 1) & (X64_IC_SIZE - 1);
+
+  e.mov(e.dword[guestctx + guest->offset_pc], addr);
+
+  /* if the destination matches the last one seen by this site, jump directly
+     through its cache slot */
+  struct x64_cold *miss =
+      x64_backend_add_cold(backend, &x64_backend_emit_dynamic_miss);
+  miss->args[0] = target;
+  miss->args[1] = counters;
+
+  e.mov(e.rax, (uint64_t)ic);
+  e.cmp(addr.cvt32(), e.dword[e.rax + offsetof(struct x64_ic, addr)]);
+  e.jne(miss->label, x64_codegen::T_NEAR);
+  x64_backend_count_prediction(backend, counters, 1);
+  e.mov(e.rdx, e.qword[e.rax + offsetof(struct x64_ic, code)]);
+  e.jmp(e.qword[e.rdx]);
+}
+
 static void x64_backend_emit_epilog(struct x64_backend *backend, struct ir *ir,
                                     struct ir_block *block) {
   auto &e = *backend->codegen;
@@ -642,15 +1271,12 @@ static void x64_backend_emit_prolog(struct x64_backend *backend, struct ir *ir,
     }
   }
 
-  /* yield control once remaining cycles are executed */
+  /* yield control once remaining cycles are executed. pending interrupts
+     force the remaining cycles negative as well, so a single check covers
+     both */
   e.mov(e.eax, e.dword[guestctx + guest->offset_cycles]);
   e.test(e.eax, e.eax);
-  e.js(backend->dispatch_exit);
-
-  /* yield control to any pending interrupts */
-  e.mov(e.rax, e.qword[guestctx + guest->offset_interrupts]);
-  e.test(e.rax, e.rax);
-  e.jnz(backend->dispatch_interrupt);
+  e.js(backend->dispatch_interrupt);
 
   /* update debug run counts */
   e.sub(e.dword[guestctx + guest->offset_cycles], num_cycles);
@@ -700,6 +1326,8 @@ static void x64_backend_emit(struct x64_backend *backend, struct ir *ir,
     x64_backend_emit_epilog(backend, ir, block);
   }
 
+  x64_backend_emit_cold(backend);
+
   e.outLocalLabel();
 }
 
@@ -723,6 +1351,12 @@ static int x64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
     res = 0;
   }
 
+  /* rewind over any partially emitted code */
+  if (!res) {
+    e.setSize(code - e.getCode<uint8_t *>());
+    x64_backend_reset_cold(backend);
+  }
+
   /* return code address */
   *addr = code;
   *size = (int)(e.getCurr<uint8_t *>() - code);
@@ -730,6 +1364,39 @@ static int x64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
   return res;
 }
 
+static int x64_backend_grow_code(struct jit_backend *base) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  if (!backend->code_reserved) {
+    return 0;
+  }
+
+  /* double the accessible size of the reservation */
+  int size = MIN(backend->code_committed * 2, backend->code_reserved_size);
+
+  if (size == backend->code_committed) {
+    return 0;
+  }
+
+  /* views of shared memory are mapped in full up front */
+  if (!backend->code_shmem) {
+    uint8_t *ptr = backend->code_reserved + backend->code_committed;
+    int size_delta = size - backend->code_committed;
+    int r = commit_pages(ptr, size_delta, ACC_READWRITEEXEC);
+
+    if (!r) {
+      LOG_WARNING("failed to grow code buffer to %d bytes", size);
+      return 0;
+    }
+  }
+
+  backend->codegen->grow(size);
+  backend->code_committed = size;
+  backend->base.code_size = size - X64_THUNK_SIZE;
+
+  return 1;
+}
+
 static void x64_backend_reset(struct jit_backend *base) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
 
@@ -745,13 +1412,81 @@ static void x64_backend_destroy(struct jit_backend *base) {
 
   delete backend->codegen;
 
+  if (backend->code_shmem) {
+    unmap_shared_memory(backend->code_shmem, backend->code_reserved,
+                        backend->code_reserved_size);
+    unmap_shared_memory(backend->code_shmem, backend->code_writable,
+                        backend->code_reserved_size);
+    destroy_shared_memory(backend->code_shmem);
+  } else if (backend->code_reserved) {
+    release_pages(backend->code_reserved, backend->code_reserved_size);
+  }
+
+  if (backend->code_claimed) {
+    jit_release_code_buffer(backend->code_buffer);
+  }
+
   x64_dispatch_shutdown(backend);
 
   free(backend);
 }
 
-struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
-                                       int code_size) {
+static uint8_t *x64_backend_reserve_code(struct x64_backend *backend,
+                                         void *code, int size, int wx) {
+  uint8_t *ptr = (uint8_t *)reserve_pages_near(code, size, X64_CODE_RANGE);
+
+  if (!ptr) {
+    LOG_WARNING("failed to reserve %d byte code buffer", size);
+    return NULL;
+  }
+
+  if (!wx) {
+    return ptr;
+  }
+
+  /* map an executable view of shared memory over the reservation, and a
+     second writable view of it anywhere */
+  char filename[64];
+  snprintf(filename, sizeof(filename), "/redream_code_%p", (void *)backend);
+
+  shmem_handle_t shmem =
+      create_shared_memory(filename, size, ACC_READWRITEEXEC);
+
+  if (shmem == SHMEM_INVALID) {
+    LOG_WARNING("failed to create shared memory for code buffer");
+    release_pages(ptr, size);
+    return NULL;
+  }
+
+  /* release the reservation so the shared memory can be mapped into it */
+  release_pages(ptr, size);
+
+  void *exec = map_shared_memory(shmem, 0, ptr, size, ACC_READEXEC);
+  void *write = map_shared_memory(shmem, 0, NULL, size, ACC_READWRITE);
+
+  if (exec == SHMEM_MAP_FAILED || write == SHMEM_MAP_FAILED) {
+    LOG_WARNING("failed to map code buffer views");
+
+    if (exec != SHMEM_MAP_FAILED) {
+      unmap_shared_memory(shmem, exec, size);
+    }
+    if (write != SHMEM_MAP_FAILED) {
+      unmap_shared_memory(shmem, write, size);
+    }
+    destroy_shared_memory(shmem);
+    return NULL;
+  }
+
+  backend->code_shmem = shmem;
+  backend->code_writable = (uint8_t *)write;
+
+  return ptr;
+}
+
+struct jit_backend *x64_backend_create(struct jit_guest *guest,
+                                       struct jit_code_buffer *code,
+                                       int max_code_size, int wx,
+                                       int huge_pages) {
   struct x64_backend *backend =
       (struct x64_backend *)calloc(1, sizeof(struct x64_backend));
   Xbyak::util::Cpu cpu;
@@ -766,8 +1501,10 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   backend->base.num_emitters = ARRAY_SIZE(x64_emitters);
   backend->base.reset = &x64_backend_reset;
   backend->base.assemble_code = &x64_backend_assemble_code;
+  backend->base.grow_code = &x64_backend_grow_code;
   backend->base.dump_code = &x64_backend_dump_code;
   backend->base.handle_exception = &x64_backend_handle_exception;
+  backend->base.tlb_fastmem = 1;
 
   /* dispatch interface */
   backend->base.run_code = &x64_dispatch_run_code;
@@ -776,17 +1513,79 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   backend->base.invalidate_code = &x64_dispatch_invalidate_code;
   backend->base.patch_edge = &x64_dispatch_patch_edge;
   backend->base.restore_edge = &x64_dispatch_restore_edge;
+  backend->base.abort_code = &x64_dispatch_abort_code;
+
+  /* setup codegen buffer. a buffer reserved near the static one is preferred,
+     as it can grow beyond it and be mapped w^x. it must be near the static
+     buffer to stay in range of rip-relative calls into the binary */
+  int code_size = code->size;
+  uint8_t *exec = code->data;
+  uint8_t *write = code->data;
+  int r = 1;
+
+  backend->code_buffer = code;
+  backend->code_claimed = jit_claim_code_buffer(code);
+
+  if (max_code_size > code_size || wx || huge_pages ||
+      !backend->code_claimed) {
+    int size = MAX(code_size, max_code_size);
+    backend->code_reserved =
+        x64_backend_reserve_code(backend, code->data, size, wx);
+    backend->code_reserved_size = size;
+    backend->code_committed = code_size;
+  }
+
+  /* with the static buffer in use, there's nothing to fall back to */
+  CHECK(backend->code_claimed || backend->code_reserved,
+        "failed to reserve a code buffer for another instance");
+
+  /* the static buffer isn't used when a buffer could be reserved */
+  if (backend->code_claimed && backend->code_reserved) {
+    jit_release_code_buffer(code);
+    backend->code_claimed = 0;
+  }
 
-  /* setup codegen buffer */
-  int r = protect_pages(code, code_size, ACC_READWRITEEXEC);
+  if (backend->code_shmem) {
+    exec = backend->code_reserved;
+    write = backend->code_writable;
+  } else if (backend->code_reserved) {
+    exec = write = backend->code_reserved;
+    r = commit_pages(exec, code_size, ACC_READWRITEEXEC);
+  } else {
+    if (wx) {
+      LOG_WARNING("w^x code buffer unavailable, mapping code rwx");
+    }
+    r = protect_pages(code->data, code_size, ACC_READWRITEEXEC);
+  }
   CHECK(r);
 
+  if (huge_pages) {
+    int size = backend->code_reserved_size;
+    int advised = backend->code_reserved &&
+                  advise_huge_pages(backend->code_reserved, size) &&
+                  (!backend->code_shmem ||
+                   advise_huge_pages(backend->code_writable, size));
+
+    if (advised) {
+      LOG_INFO("backing %d byte code buffer with huge pages", size);
+    } else {
+      LOG_WARNING("huge pages unavailable for code buffer, using regular "
+                  "pages");
+    }
+  }
+
   int have_avx2 = cpu.has(Xbyak::util::Cpu::tAVX2);
   int have_sse2 = cpu.has(Xbyak::util::Cpu::tSSE2);
+  int have_sse41 = cpu.has(Xbyak::util::Cpu::tSSE41);
+  int have_fma = cpu.has(Xbyak::util::Cpu::tFMA);
+  int have_bmi2 = cpu.has(Xbyak::util::Cpu::tBMI2);
   CHECK(have_avx2 || have_sse2, "CPU must support either AVX2 or SSE2");
 
-  backend->codegen = new Xbyak::CodeGenerator(code_size, code);
+  backend->codegen = new x64_codegen(code_size, write, exec - write);
   backend->use_avx = have_avx2;
+  backend->use_fma = have_avx2 && have_fma;
+  backend->use_sse41 = have_sse41;
+  backend->use_bmi2 = have_bmi2;
 
   /* create disassembler */
   int res = cs_open(CS_ARCH_X86, CS_MODE_64, &backend->capstone_handle);
@@ -799,5 +1598,9 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   x64_backend_emit_constants(backend);
   CHECK_LT(backend->codegen->getSize(), X64_THUNK_SIZE);
 
+  /* compiled code starts after the thunks, see x64_backend_reset */
+  backend->base.code = exec + X64_THUNK_SIZE;
+  backend->base.code_size = code_size - X64_THUNK_SIZE;
+
   return &backend->base;
 }
@@ -5,7 +5,16 @@
 
 struct jit_guest;
 
-struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
-                                       int code_size);
+/* code is a statically allocated buffer. the backend first attempts to
+   reserve a buffer near it which can grow up to max_code_size, initially
+   committing only the static buffer's size of it. if wx is set, the
+   reservation is mapped twice, once writable and once executable, instead of
+   as both. if huge_pages is set, the reservation is advised to be backed by
+   huge pages. the static buffer is only fallen back to if it isn't in use by
+   another backend */
+struct jit_backend *x64_backend_create(struct jit_guest *guest,
+                                       struct jit_code_buffer *code,
+                                       int max_code_size, int wx,
+                                       int huge_pages);
 
 #endif
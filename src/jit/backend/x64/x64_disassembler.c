@@ -33,6 +33,8 @@ int x64_decode_mov(const uint8_t *data, struct x64_mov *mov) {
   int is_load = 0;
   int has_imm = 0;
   int operand_size = 0;
+  int ext_size = 0;
+  int ext_signed = 0;
 
   /* MOV r8,r/m8
      MOV r16,r/m16
@@ -72,6 +74,28 @@ int x64_decode_mov(const uint8_t *data, struct x64_mov *mov) {
     operand_size = *data == 0xc6 ? 1 : (has_opprefix ? 2 : 4);
     data++;
   }
+  /* MOVZX r32,r/m8
+     MOVZX r32,r/m16
+     MOVSX r32,r/m8
+     MOVSX r32,r/m16 (and their r64 forms) */
+  else if (data[0] == 0x0f && (data[1] == 0xb6 || data[1] == 0xb7 ||
+                               data[1] == 0xbe || data[1] == 0xbf)) {
+    is_load = 1;
+    has_imm = 0;
+    operand_size = (data[1] == 0xb6 || data[1] == 0xbe) ? 1 : 2;
+    ext_size = has_opprefix ? 2 : (rex_w ? 8 : 4);
+    ext_signed = data[1] == 0xbe || data[1] == 0xbf;
+    data += 2;
+  }
+  /* MOVSXD r64,r/m32 */
+  else if (*data == 0x63 && rex_w) {
+    is_load = 1;
+    has_imm = 0;
+    operand_size = 4;
+    ext_size = 8;
+    ext_signed = 1;
+    data++;
+  }
   /* not a supported MOV instruction */
   else {
     return 0;
@@ -90,6 +114,8 @@ int x64_decode_mov(const uint8_t *data, struct x64_mov *mov) {
   mov->has_base = 0;
   mov->has_index = 0;
   mov->operand_size = operand_size;
+  mov->ext_size = ext_size;
+  mov->ext_signed = ext_signed;
   mov->reg = modrm_reg + (rex_r ? 8 : 0);
   mov->base = 0;
   mov->index = 0;
@@ -106,7 +132,8 @@ int x64_decode_mov(const uint8_t *data, struct x64_mov *mov) {
     data++;
 
     mov->has_base = (modrm_mod != 0b00 || sib_base != 0b101);
-    mov->has_index = (sib_index != 0b100);
+    /* an index of 0b100 means none, unless extended to r12 */
+    mov->has_index = (sib_index != 0b100 || rex_x);
     mov->base = sib_base + (rex_b ? 8 : 0);
     mov->index = sib_index + (rex_x ? 8 : 0);
     mov->scale = sib_scale;
@@ -11,6 +11,9 @@ struct x64_mov {
   int has_base;
   int has_index;
   int operand_size;
+  /* for movsx / movzx, the size of the register being extended into */
+  int ext_size;
+  int ext_signed;
   int reg;
   int base;
   int index;
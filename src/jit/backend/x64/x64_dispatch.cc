@@ -16,11 +16,6 @@ extern "C" {
    avoiding the need for redundant lookups */
 #define LINK_STATIC_BRANCHES !LOG_DISPATCH_EVERY_N
 
-static inline void **x64_dispatch_code_ptr(struct x64_backend *backend,
-                                           uint32_t addr) {
-  return &backend->cache[(addr & backend->cache_mask) >> backend->cache_shift];
-}
-
 #if LOG_DISPATCH_EVERY_N
 static void x64_dispatch_log(struct x64_ctx *ctx) {
   static uint64_t num;
@@ -35,17 +30,65 @@ void x64_dispatch_restore_edge(struct jit_backend *base, void *code,
                                uint32_t dst) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
 
-  Xbyak::CodeGenerator e(32, code);
+  x64_codegen e(32, x64_backend_writable(backend, code),
+                backend->codegen->exec_offset);
   e.call(backend->dispatch_static);
 }
 
 void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
 
-  Xbyak::CodeGenerator e(32, code);
+  x64_codegen e(32, x64_backend_writable(backend, code),
+                backend->codegen->exec_offset);
   e.jmp(dst);
 }
 
+void **x64_dispatch_alloc_code_ptr(struct x64_backend *backend,
+                                   uint32_t addr) {
+  uint32_t i = (addr & backend->cache_mask) >> backend->cache_shift;
+  void ***page = &backend->cache[i >> X64_CACHE_PAGE_BITS];
+
+  if (*page == backend->cache_default) {
+    *page = (void **)malloc(X64_CACHE_PAGE_SIZE * sizeof(void *));
+    memcpy(*page, backend->cache_default, X64_CACHE_PAGE_SIZE * sizeof(void *));
+
+    /* inline caches which missed on an address in the page have recorded its
+       entry in the default page, reset them so they're refilled from the new
+       page */
+    void **begin = backend->cache_default;
+    void **end = backend->cache_default + X64_CACHE_PAGE_SIZE;
+
+    for (int j = 0; j < X64_IC_SIZE; j++) {
+      struct x64_ic *ic = &backend->ics[j];
+
+      if (ic->code >= begin && ic->code < end) {
+        ic->addr = 0x1;
+      }
+    }
+  }
+
+  return &(*page)[i & (X64_CACHE_PAGE_SIZE - 1)];
+}
+
+void x64_dispatch_emit_code_ptr(struct x64_backend *backend,
+                                const Xbyak::Reg32 &addr) {
+  auto &e = *backend->codegen;
+  uint32_t page_mask =
+      ((X64_CACHE_PAGE_SIZE - 1) << backend->cache_shift) & backend->cache_mask;
+
+  /* look up the page */
+  e.mov(e.ecx, addr);
+  e.and_(e.ecx, backend->cache_mask);
+  e.shr(e.ecx, backend->cache_shift + X64_CACHE_PAGE_BITS);
+  e.mov(e.rdx, (uint64_t)backend->cache);
+  e.mov(e.rdx, e.qword[e.rdx + e.rcx * sizeof(void *)]);
+
+  /* and the entry within it */
+  e.mov(e.ecx, addr);
+  e.and_(e.ecx, page_mask);
+  e.lea(e.rdx, e.ptr[e.rdx + e.rcx * (sizeof(void *) >> backend->cache_shift)]);
+}
+
 void x64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
   void **entry = x64_dispatch_code_ptr(backend, addr);
@@ -55,7 +98,7 @@ void x64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr) {
 void x64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
                              void *code) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
-  void **entry = x64_dispatch_code_ptr(backend, addr);
+  void **entry = x64_dispatch_alloc_code_ptr(backend, addr);
   CHECK_EQ(*entry, backend->dispatch_compile);
   *entry = code;
 }
@@ -66,6 +109,11 @@ void *x64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr) {
   return *entry;
 }
 
+void x64_dispatch_abort_code(struct jit_backend *base) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+  backend->dispatch_abort();
+}
+
 void x64_dispatch_run_code(struct jit_backend *base, int cycles) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
   backend->dispatch_enter(cycles);
@@ -91,10 +139,9 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
 #endif
 
     /* invasively look into the jit's cache */
-    e.mov(e.rax, (uint64_t)backend->cache);
-    e.mov(e.ecx, e.dword[guestctx + guest->offset_pc]);
-    e.and_(e.ecx, backend->cache_mask);
-    e.jmp(e.qword[e.rax + e.rcx * (sizeof(void *) >> backend->cache_shift)]);
+    e.mov(e.eax, e.dword[guestctx + guest->offset_pc]);
+    x64_dispatch_emit_code_ptr(backend, e.eax);
+    e.jmp(e.qword[e.rdx]);
   }
 
   {
@@ -133,18 +180,6 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.jmp(backend->dispatch_dynamic);
   }
 
-  {
-    /* processes the pending interrupt request, and then jumps to the new pc
-       through the dynamic dispatch thunk */
-    e.align(32);
-
-    backend->dispatch_interrupt = e.getCurr<void *>();
-
-    e.mov(arg0, (uint64_t)guest->data);
-    e.call(guest->check_interrupts);
-    e.jmp(backend->dispatch_dynamic);
-  }
-
   {
     /* entry point to the compiled x64 code. sets up the stack frame, sets up
        fixed registers (context and memory base) and then jumps to the current
@@ -159,6 +194,8 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     stack_offset = x64_backend_push_regs(backend, JIT_CALLEE_SAVE);
     stack_offset = ALIGN_UP(stack_offset + X64_STACK_SIZE + 8, 16) - 8;
     e.sub(e.rsp, stack_offset);
+    e.mov(e.rax, (uint64_t)&backend->dispatch_rsp);
+    e.mov(e.qword[e.rax], e.rsp);
 
     /* assign fixed registers */
     e.mov(guestctx, (uint64_t)guest->ctx);
@@ -185,22 +222,102 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.ret();
   }
 
-  /* reset cache entries to point to the new compile thunk */
-  for (int i = 0; i < backend->cache_size; i++) {
-    backend->cache[i] = backend->dispatch_compile;
+  {
+    /* called from inside of a guest memory accessor once it has raised an
+       exception, abandoning the instruction making the access. the frames
+       above compiled code are discarded by restoring the stack pointer it
+       runs with, and execution resumes at the exception handler's pc through
+       the dynamic dispatch thunk. the fixed registers may have been clobbered
+       by the callee, reassign them */
+    e.align(32);
+
+    backend->dispatch_abort = e.getCurr<void (*)()>();
+
+    e.mov(e.rax, (uint64_t)&backend->dispatch_rsp);
+    e.mov(e.rsp, e.qword[e.rax]);
+    e.mov(guestctx, (uint64_t)guest->ctx);
+    e.mov(guestmem, (uint64_t)guest->membase);
+    e.jmp(backend->dispatch_dynamic);
+  }
+
+  {
+    /* called by a block once the remaining cycles go negative, either due to
+       running out of them or due to the guest forcing a yield for a pending
+       interrupt. processes any pending interrupt, which restores the cycles
+       of a forced yield, and then either exits or jumps to the new pc through
+       the dynamic dispatch thunk */
+    e.align(32);
+
+    backend->dispatch_interrupt = e.getCurr<void *>();
+
+    e.mov(arg0, (uint64_t)guest->data);
+    e.call(guest->check_interrupts);
+    e.mov(e.eax, e.dword[guestctx + guest->offset_cycles]);
+    e.test(e.eax, e.eax);
+    e.js(backend->dispatch_exit);
+    e.jmp(backend->dispatch_dynamic);
+  }
+
+  /* reset cache entries to point to the new compile thunk. pages already
+     allocated are kept, as the inline caches and return stack may still
+     reference their entries */
+  for (int i = 0; i < X64_CACHE_PAGE_SIZE; i++) {
+    backend->cache_default[i] = backend->dispatch_compile;
+  }
+
+  for (int i = 0; i < backend->cache_num_pages; i++) {
+    void **page = backend->cache[i];
+
+    if (page == backend->cache_default) {
+      continue;
+    }
+
+    for (int j = 0; j < X64_CACHE_PAGE_SIZE; j++) {
+      page[j] = backend->dispatch_compile;
+    }
   }
 }
 
 void x64_dispatch_shutdown(struct x64_backend *backend) {
+  free(backend->ics);
+
+  for (int i = 0; i < backend->cache_num_pages; i++) {
+    if (backend->cache[i] != backend->cache_default) {
+      free(backend->cache[i]);
+    }
+  }
+
+  free(backend->cache_default);
   free(backend->cache);
 }
 
 void x64_dispatch_init(struct x64_backend *backend) {
   struct jit_guest *guest = backend->base.guest;
 
-  /* initialize code cache, one entry per possible block begin */
+  /* initialize code cache, one entry per possible block begin, with every page
+     starting out as the default page */
   backend->cache_mask = guest->addr_mask;
   backend->cache_shift = ctz32(guest->addr_mask);
-  backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
-  backend->cache = (void **)malloc(backend->cache_size * sizeof(void *));
+
+  int cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
+  backend->cache_num_pages = MAX(cache_size >> X64_CACHE_PAGE_BITS, 1);
+  backend->cache = (void ***)malloc(backend->cache_num_pages * sizeof(void **));
+  backend->cache_default = (void **)calloc(X64_CACHE_PAGE_SIZE, sizeof(void *));
+
+  for (int i = 0; i < backend->cache_num_pages; i++) {
+    backend->cache[i] = backend->cache_default;
+  }
+
+  /* initialize the return stack with entries that never match, guest code is
+     always at least 2-byte aligned */
+  for (int i = 0; i < X64_RAS_SIZE; i++) {
+    backend->ras.addr[i] = 0x1;
+    backend->ras.code[i] = &backend->cache_default[0];
+  }
+
+  backend->ics = (struct x64_ic *)malloc(X64_IC_SIZE * sizeof(struct x64_ic));
+  for (int i = 0; i < X64_IC_SIZE; i++) {
+    backend->ics[i].addr = 0x1;
+    backend->ics[i].code = &backend->cache_default[0];
+  }
 }
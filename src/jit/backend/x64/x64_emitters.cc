@@ -7,14 +7,14 @@ extern "C" {
 }
 
 #define EMITTER(op, constraints)                                           \
-  void x64_emit_##op(struct x64_backend *, Xbyak::CodeGenerator &,         \
-                     struct ir *, struct ir_instr *);                      \
+  void x64_emit_##op(struct x64_backend *, x64_codegen &, struct ir *,     \
+                     struct ir_instr *);                                   \
   static struct _x64_##op##_init {                                         \
     _x64_##op##_init() {                                                   \
       x64_emitters[OP_##op] = {(void *)&x64_emit_##op, constraints};       \
     }                                                                      \
   } x64_##op##_init;                                                       \
-  void x64_emit_##op(struct x64_backend *backend, Xbyak::CodeGenerator &e, \
+  void x64_emit_##op(struct x64_backend *backend, x64_codegen &e,          \
                      struct ir *ir, struct ir_instr *instr)
 
 #define CONSTRAINTS(result_flags, ...) \
@@ -62,6 +62,8 @@ enum {
 struct jit_emitter x64_emitters[IR_NUM_OPS];
 
 EMITTER(SOURCE_INFO, CONSTRAINTS(NONE, IMM_I32, IMM_I32)) {
+  backend->source_addr = ARG0->i32;
+
 #if 0
   /* encode the guest address of each instruction in the generated code for
      debugging purposes */
@@ -78,6 +80,11 @@ EMITTER(FALLBACK, CONSTRAINTS(NONE, IMM_I64, IMM_I32, IMM_I32)) {
   uint32_t addr = ARG1->i32;
   uint32_t raw_instr = ARG2->i32;
 
+  /* the fallback's accesses may raise an exception at its pc */
+  if (guest->tlb) {
+    e.mov(e.dword[guestctx + guest->offset_pc], addr);
+  }
+
   e.mov(arg0, (uint64_t)guest);
   e.mov(arg1, addr);
   e.mov(arg2, raw_instr);
@@ -98,37 +105,21 @@ EMITTER(STORE_HOST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
   x64_backend_store_mem(backend, dst, data);
 }
 
-EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
+EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32, OPT | IMM_I32)) {
   struct jit_guest *guest = backend->base.guest;
   Xbyak::Reg dst = RES_REG;
   struct ir_value *addr = ARG0;
-
-  if (ir_is_constant(addr)) {
-    /* peel away one layer of abstraction and directly access the backing
-       memory or directly invoke the callback when the address is constant */
-    void *userdata;
-    uint8_t *ptr;
-    mem_read_cb read;
-    guest->lookup(guest->mem, addr->i32, &userdata, &ptr, &read, NULL);
-
-    if (ptr) {
-      e.mov(e.rax, (uint64_t)ptr);
-      x64_backend_load_mem(backend, RES, e.rax);
-    } else {
-      int data_size = ir_type_size(RES->type);
-      uint32_t data_mask = (1 << (data_size * 8)) - 1;
-
-      e.mov(arg0, (uint64_t)userdata);
-      e.mov(arg1, (uint32_t)addr->i32);
-      e.mov(arg2, data_mask);
-      e.call((void *)read);
-      e.mov(dst, e.rax);
-    }
+  struct ir_value *ext = ARG1;
+  enum ir_type mem_type = ext ? ext->type : RES->type;
+
+  /* while the guest is translating addresses, the translation of a constant
+     one can change after compiling, and the access may raise an exception at
+     the current pc */
+  if (ir_is_constant(addr) && !guest->tlb) {
+    x64_backend_load_guest_constant(backend, RES, addr->i32, ext);
   } else {
-    Xbyak::Reg ra = x64_backend_reg(backend, addr);
-
     void *fn = nullptr;
-    switch (RES->type) {
+    switch (mem_type) {
       case VALUE_I8:
         fn = (void *)guest->r8;
         break;
@@ -146,44 +137,35 @@ EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
         break;
     }
 
+    if (guest->tlb) {
+      e.mov(e.dword[guestctx + guest->offset_pc], backend->source_addr);
+    }
+
     e.mov(arg0, (uint64_t)guest->mem);
-    e.mov(arg1, ra);
+    x64_backend_mov_value(backend, arg1, addr);
     e.call((void *)fn);
-    e.mov(dst, e.rax);
+
+    if (ext) {
+      x64_backend_mov_ext(backend, dst, e.rax, ext);
+    } else {
+      e.mov(dst, e.rax);
+    }
   }
 }
 
-EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
+EMITTER(STORE_GUEST,
+        CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL, OPT | IMM_I32)) {
   struct jit_guest *guest = backend->base.guest;
   struct ir_value *addr = ARG0;
   struct ir_value *data = ARG1;
+  struct ir_value *trunc = ARG2;
+  enum ir_type mem_type = trunc ? trunc->type : data->type;
 
-  if (ir_is_constant(addr)) {
-    /* peel away one layer of abstraction and directly access the backing
-       memory or directly invoke the callback when the address is constant */
-    void *userdata;
-    uint8_t *ptr;
-    mem_write_cb write;
-    guest->lookup(guest->mem, addr->i32, &userdata, &ptr, NULL, &write);
-
-    if (ptr) {
-      e.mov(e.rax, (uint64_t)ptr);
-      x64_backend_store_mem(backend, e.rax, data);
-    } else {
-      int data_size = ir_type_size(data->type);
-      uint32_t data_mask = (1 << (data_size * 8)) - 1;
-
-      e.mov(arg0, (uint64_t)userdata);
-      e.mov(arg1, (uint32_t)addr->i32);
-      x64_backend_mov_value(backend, arg2, data);
-      e.mov(arg3, data_mask);
-      e.call((void *)write);
-    }
+  if (ir_is_constant(addr) && !guest->tlb) {
+    x64_backend_store_guest_constant(backend, addr->i32, data, trunc);
   } else {
-    Xbyak::Reg ra = x64_backend_reg(backend, addr);
-
     void *fn = nullptr;
-    switch (data->type) {
+    switch (mem_type) {
       case VALUE_I8:
         fn = (void *)guest->w8;
         break;
@@ -201,25 +183,66 @@ EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
         break;
     }
 
+    if (guest->tlb) {
+      e.mov(e.dword[guestctx + guest->offset_pc], backend->source_addr);
+    }
+
     e.mov(arg0, (uint64_t)guest->mem);
-    e.mov(arg1, ra);
+    x64_backend_mov_value(backend, arg1, addr);
     x64_backend_mov_value(backend, arg2, data);
     e.call((void *)fn);
   }
 }
 
-EMITTER(LOAD_FAST, CONSTRAINTS(REG_ALL, REG_I64)) {
+EMITTER(LOAD_FAST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32, OPT | IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
   struct ir_value *dst = RES;
+  struct ir_value *ext = ARG1;
+
+  if (guest->tlb) {
+    x64_backend_load_tlb(backend, dst, ARG0, ext);
+    return;
+  }
+
+  /* fastmem is selected before the address is known to be constant. resolve
+     these at compile time as well, mmio accesses would otherwise fault */
+  if (ir_is_constant(ARG0)) {
+    x64_backend_load_guest_constant(backend, dst, ARG0->i32, ext);
+    return;
+  }
+
   Xbyak::Reg addr = ARG0_REG;
 
-  x64_backend_load_mem(backend, dst, addr.cvt64() + guestmem);
+  if (ext) {
+    x64_backend_load_mem_ext(backend, dst, addr.cvt64() + guestmem, ext);
+  } else {
+    x64_backend_load_mem(backend, dst, addr.cvt64() + guestmem);
+  }
 }
 
-EMITTER(STORE_FAST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
-  Xbyak::Reg addr = ARG0_REG;
+EMITTER(STORE_FAST,
+        CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL, OPT | IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
   struct ir_value *data = ARG1;
+  struct ir_value *trunc = ARG2;
 
-  x64_backend_store_mem(backend, addr.cvt64() + guestmem, data);
+  if (guest->tlb) {
+    x64_backend_store_tlb(backend, ARG0, data, trunc);
+    return;
+  }
+
+  if (ir_is_constant(ARG0)) {
+    x64_backend_store_guest_constant(backend, ARG0->i32, data, trunc);
+    return;
+  }
+
+  Xbyak::Reg addr = ARG0_REG;
+
+  if (trunc) {
+    x64_backend_store_mem_trunc(backend, addr.cvt64() + guestmem, data, trunc);
+  } else {
+    x64_backend_store_mem(backend, addr.cvt64() + guestmem, data);
+  }
 }
 
 EMITTER(LOAD_CONTEXT, CONSTRAINTS(REG_ALL, IMM_I32)) {
@@ -527,8 +550,38 @@ EMITTER(UMUL, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64)) {
   e.imul(rd, rb);
 }
 
-EMITTER(DIV, CONSTRAINTS(NONE)) {
-  LOG_FATAL("unsupported");
+EMITTER(SDIV, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64)) {
+  Xbyak::Reg rd = RES_REG;
+  Xbyak::Reg rb = ARG1_REG;
+
+  /* the dividend is sign extended into rdx:rax */
+  if (RES->type == VALUE_I32) {
+    e.mov(e.eax, rd);
+    e.cdq();
+    e.idiv(rb);
+    e.mov(rd, e.eax);
+  } else {
+    e.mov(e.rax, rd);
+    e.cqo();
+    e.idiv(rb);
+    e.mov(rd, e.rax);
+  }
+}
+
+EMITTER(UDIV, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64)) {
+  Xbyak::Reg rd = RES_REG;
+  Xbyak::Reg rb = ARG1_REG;
+
+  e.xor_(e.edx, e.edx);
+  if (RES->type == VALUE_I32) {
+    e.mov(e.eax, rd);
+    e.div(rb);
+    e.mov(rd, e.eax);
+  } else {
+    e.mov(e.rax, rd);
+    e.div(rb);
+    e.mov(rd, e.rax);
+  }
 }
 
 EMITTER(NEG, CONSTRAINTS(REG_ARG0, REG_I64)) {
@@ -760,6 +813,11 @@ EMITTER(VDOT, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
 
   if (X64_USE_AVX) {
     e.vdpps(rd, ra, rb, 0b11110001);
+  } else if (X64_USE_SSE41) {
+    if (rd != ra) {
+      e.movaps(rd, ra);
+    }
+    e.dpps(rd, rb, 0b11110001);
   } else {
     if (rd != ra) {
       e.movaps(rd, ra);
@@ -785,6 +843,35 @@ EMITTER(VMUL, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
   }
 }
 
+EMITTER(VMADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128, REG_V128)) {
+  Xbyak::Xmm rd = RES_XMM;
+  Xbyak::Xmm ra = ARG0_XMM;
+  Xbyak::Xmm rb = ARG1_XMM;
+  Xbyak::Xmm rc = ARG2_XMM;
+
+  if (X64_USE_FMA) {
+    /* pick the fma form whose destination operand is already in rd */
+    if (rd == rc) {
+      e.vfmadd231ps(rd, ra, rb);
+    } else if (rd == ra) {
+      e.vfmadd213ps(rd, rb, rc);
+    } else if (rd == rb) {
+      e.vfmadd213ps(rd, ra, rc);
+    } else {
+      e.vmovaps(rd, rc);
+      e.vfmadd231ps(rd, ra, rb);
+    }
+  } else if (X64_USE_AVX) {
+    e.vmulps(e.xmm0, ra, rb);
+    e.vaddps(rd, e.xmm0, rc);
+  } else {
+    e.movaps(e.xmm0, ra);
+    e.mulps(e.xmm0, rb);
+    e.addps(e.xmm0, rc);
+    e.movaps(rd, e.xmm0);
+  }
+}
+
 EMITTER(AND, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64 | IMM_I32)) {
   Xbyak::Reg rd = RES_REG;
 
@@ -824,11 +911,68 @@ EMITTER(NOT, CONSTRAINTS(REG_ARG0, REG_I64)) {
   e.not_(rd);
 }
 
+/* bmi2's shlx / sarx / shrx take the count in any register, avoiding the move
+   to cl, but only operate on 32 and 64-bit registers of matching width */
+static void x64_backend_emit_shiftx(struct x64_backend *backend,
+                                    enum ir_op op, const Xbyak::Reg &rd,
+                                    const Xbyak::Reg &rb) {
+  auto &e = *backend->codegen;
+
+  int bits = rd.getBit() == 64 ? 64 : 32;
+  Xbyak::Reg32e dst(rd.getIdx(), bits);
+  Xbyak::Reg32e cnt(rb.getIdx(), bits);
+
+  switch (op) {
+    case OP_SHL:
+      e.shlx(dst, dst, cnt);
+      break;
+    case OP_ASHR:
+      e.sarx(dst, dst, cnt);
+      break;
+    case OP_LSHR:
+      e.shrx(dst, dst, cnt);
+      break;
+    default:
+      LOG_FATAL("unexpected shift op");
+      break;
+  }
+}
+
+/* branchless form of the sh4's dynamic shifts. a negative count shifts right
+   by (~count & 0x1f) + 1, which is done as a shift by ~count followed by a
+   shift by one so that the count of 32 produced by a count of -32 is handled
+   without a special case. shlx / sarx / shrx don't modify the flags, so the
+   sign test can be issued before rd is overwritten, covering rd == rb */
+static void x64_backend_emit_dynamic_shift(struct x64_backend *backend,
+                                           const Xbyak::Reg &rd,
+                                           const Xbyak::Reg &rb,
+                                           int arithmetic) {
+  auto &e = *backend->codegen;
+
+  Xbyak::Reg32 dst = rd.cvt32();
+  Xbyak::Reg32 cnt = rb.cvt32();
+
+  e.mov(e.eax, cnt);
+  e.not_(e.eax);
+  if (arithmetic) {
+    e.sarx(e.eax, dst, e.eax);
+    e.sar(e.eax, 1);
+  } else {
+    e.shrx(e.eax, dst, e.eax);
+    e.shr(e.eax, 1);
+  }
+  e.test(cnt, cnt);
+  e.shlx(dst, dst, cnt);
+  e.cmovs(dst, e.eax);
+}
+
 EMITTER(SHL, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64 | IMM_I32)) {
   Xbyak::Reg rd = RES_REG;
 
   if (ir_is_constant(ARG1)) {
     e.shl(rd, (int)ir_zext_constant(ARG1));
+  } else if (X64_USE_BMI2 && rd.getBit() >= 32) {
+    x64_backend_emit_shiftx(backend, OP_SHL, rd, ARG1_REG);
   } else {
     Xbyak::Reg rb = ARG1_REG;
     e.mov(e.cl, rb);
@@ -841,6 +985,8 @@ EMITTER(ASHR, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64 | IMM_I32)) {
 
   if (ir_is_constant(ARG1)) {
     e.sar(rd, (int)ir_zext_constant(ARG1));
+  } else if (X64_USE_BMI2 && rd.getBit() >= 32) {
+    x64_backend_emit_shiftx(backend, OP_ASHR, rd, ARG1_REG);
   } else {
     Xbyak::Reg rb = ARG1_REG;
     e.mov(e.cl, rb);
@@ -853,6 +999,8 @@ EMITTER(LSHR, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64 | IMM_I32)) {
 
   if (ir_is_constant(ARG1)) {
     e.shr(rd, (int)ir_zext_constant(ARG1));
+  } else if (X64_USE_BMI2 && rd.getBit() >= 32) {
+    x64_backend_emit_shiftx(backend, OP_LSHR, rd, ARG1_REG);
   } else {
     Xbyak::Reg rb = ARG1_REG;
     e.mov(e.cl, rb);
@@ -864,6 +1012,11 @@ EMITTER(ASHD, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64)) {
   Xbyak::Reg rd = RES_REG;
   Xbyak::Reg rb = ARG1_REG;
 
+  if (X64_USE_BMI2) {
+    x64_backend_emit_dynamic_shift(backend, rd, rb, 1);
+    return;
+  }
+
   e.inLocalLabel();
 
   /* check if we're shifting left or right */
@@ -898,6 +1051,11 @@ EMITTER(LSHD, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64)) {
   Xbyak::Reg rd = RES_REG;
   Xbyak::Reg rb = ARG1_REG;
 
+  if (X64_USE_BMI2) {
+    x64_backend_emit_dynamic_shift(backend, rd, rb, 0);
+    return;
+  }
+
   e.inLocalLabel();
 
   /* check if we're shifting left or right */
@@ -928,18 +1086,108 @@ EMITTER(LSHD, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64)) {
   e.outLocalLabel();
 }
 
-EMITTER(BRANCH, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK)) {
-  x64_backend_emit_branch(backend, ir, ARG0);
+EMITTER(BRANCH, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK, OPT | IMM_I32,
+                            OPT | IMM_I32, OPT | IMM_I64)) {
+  struct ir_value *hint = ARG1;
+  struct ir_value *counters = ARG3;
+
+  if (hint && hint->i32 == IR_BRANCH_CALL) {
+    x64_backend_emit_call(backend, ARG2->i32);
+  }
+
+  if (ir_is_constant(ARG0)) {
+    x64_backend_emit_branch(backend, ir, ARG0);
+  } else if (hint && hint->i32 == IR_BRANCH_RETURN) {
+    x64_backend_emit_return(backend, ARG0, counters);
+  } else {
+    x64_backend_emit_dynamic_branch(backend, ARG0, counters);
+  }
+}
+
+/* find the integer comparison a branch condition was produced by, if the host
+   flags it set are still intact by the time the branch is emitted. this is
+   common for guest code which compares and branches on the result, where the
+   result is only stored to the context in between */
+static struct ir_instr *x64_branch_cmp(struct ir_instr *instr) {
+  struct ir_instr *def = instr->arg[2]->def;
+
+  if (def && def->op == OP_ZEXT) {
+    def = def->arg[0]->def;
+  }
+
+  if (!def || def->op != OP_CMP || def->block != instr->block) {
+    return NULL;
+  }
+
+  /* make sure nothing emitted in between modifies the flags */
+  struct ir_instr *it = list_prev_entry(instr, struct ir_instr, it);
+
+  for (; it != def; it = list_prev_entry(it, struct ir_instr, it)) {
+    switch (it->op) {
+      case OP_SOURCE_INFO:
+      case OP_LOAD_CONTEXT:
+      case OP_STORE_CONTEXT:
+      case OP_LOAD_LOCAL:
+      case OP_STORE_LOCAL:
+      case OP_COPY:
+      case OP_ZEXT:
+        break;
+      default:
+        return NULL;
+    }
+  }
+
+  return def;
 }
 
 EMITTER(BRANCH_COND, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK,
                                  REG_I64 | IMM_I32 | IMM_BLK, REG_I64)) {
   struct jit_guest *guest = backend->base.guest;
-
-  Xbyak::Reg cond = ARG2_REG;
+  struct ir_instr *cmp = x64_branch_cmp(instr);
   Xbyak::Label next;
-  e.test(cond, cond);
-  e.jz(next);
+
+  if (cmp) {
+    /* skip the branch when the comparison is false */
+    switch ((enum ir_cmp)cmp->arg[2]->i32) {
+      case CMP_EQ:
+        e.jne(next);
+        break;
+      case CMP_NE:
+        e.je(next);
+        break;
+      case CMP_SGE:
+        e.jl(next);
+        break;
+      case CMP_SGT:
+        e.jle(next);
+        break;
+      case CMP_UGE:
+        e.jb(next);
+        break;
+      case CMP_UGT:
+        e.jbe(next);
+        break;
+      case CMP_SLE:
+        e.jg(next);
+        break;
+      case CMP_SLT:
+        e.jge(next);
+        break;
+      case CMP_ULE:
+        e.ja(next);
+        break;
+      case CMP_ULT:
+        e.jae(next);
+        break;
+      default:
+        LOG_FATAL("unexpected comparison type");
+    }
+  } else {
+    Xbyak::Reg cond = ARG2_REG;
+    e.test(cond, cond);
+    e.jz(next);
+  }
+
   x64_backend_emit_branch(backend, ir, ARG0);
   e.L(next);
   x64_backend_emit_branch(backend, ir, ARG1);
@@ -962,33 +1210,41 @@ EMITTER(CALL, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
   }
 }
 
-EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
-  e.inLocalLabel();
-
-  Xbyak::Reg cond = ARG1_REG;
-
-  e.test(cond, cond);
-
-  e.jz(".skip");
+static void x64_emit_call_cond(struct x64_backend *backend,
+                               struct x64_cold *cold) {
+  auto &e = *backend->codegen;
+  const struct ir_value *fn = cold->args[0];
 
-  if (ARG2) {
-    x64_backend_mov_value(backend, arg0, ARG2);
+  if (cold->args[1]) {
+    x64_backend_mov_value(backend, arg0, cold->args[1]);
   }
-  if (ARG3) {
-    x64_backend_mov_value(backend, arg1, ARG3);
+  if (cold->args[2]) {
+    x64_backend_mov_value(backend, arg1, cold->args[2]);
   }
 
-  if (ir_is_constant(ARG0)) {
-    void *addr = (void *)ARG0->i64;
+  if (ir_is_constant(fn)) {
+    void *addr = (void *)fn->i64;
     e.call(addr);
   } else {
-    const Xbyak::Reg addr = ARG0_REG;
+    const Xbyak::Reg addr = x64_backend_reg(backend, fn);
     e.call(addr);
   }
 
-  e.L(".skip");
+  e.jmp(cold->ret, x64_codegen::T_NEAR);
+}
 
-  e.outLocalLabel();
+EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
+  Xbyak::Reg cond = ARG1_REG;
+
+  /* the call is rarely taken, move it out of line */
+  struct x64_cold *cold = x64_backend_add_cold(backend, &x64_emit_call_cond);
+  cold->args[0] = ARG0;
+  cold->args[1] = ARG2;
+  cold->args[2] = ARG3;
+
+  e.test(cond, cond);
+  e.jnz(cold->label, x64_codegen::T_NEAR);
+  e.L(cold->ret);
 }
 
 EMITTER(DEBUG_BREAK, CONSTRAINTS(NONE)) {
@@ -1006,28 +1262,28 @@ EMITTER(DEBUG_LOG, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
   e.call(debug_log);
 }
 
+static void x64_emit_assert_fail(struct x64_backend *backend,
+                                 struct x64_cold *cold) {
+  auto &e = *backend->codegen;
+  e.db(0xcc);
+}
+
 EMITTER(ASSERT_EQ, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
   Xbyak::Reg ra = ARG0_REG;
   Xbyak::Reg rb = ARG1_REG;
 
-  e.inLocalLabel();
+  struct x64_cold *fail = x64_backend_add_cold(backend, &x64_emit_assert_fail);
   e.cmp(ra, rb);
-  e.je(".skip");
-  e.db(0xcc);
-  e.L(".skip");
-  e.outLocalLabel();
+  e.jne(fail->label, x64_codegen::T_NEAR);
 }
 
 EMITTER(ASSERT_LT, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
   Xbyak::Reg ra = ARG0_REG;
   Xbyak::Reg rb = ARG1_REG;
 
-  e.inLocalLabel();
+  struct x64_cold *fail = x64_backend_add_cold(backend, &x64_emit_assert_fail);
   e.cmp(ra, rb);
-  e.jl(".skip");
-  e.db(0xcc);
-  e.L(".skip");
-  e.outLocalLabel();
+  e.jge(fail->label, x64_codegen::T_NEAR);
 }
 
 EMITTER(COPY, CONSTRAINTS(REG_ALL, VAL_ALL)) {
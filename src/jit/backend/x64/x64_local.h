@@ -9,6 +9,7 @@
 #include <xbyak/xbyak_util.h>
 
 extern "C" {
+#include "core/memory.h"
 #include "jit/jit_backend.h"
 }
 
@@ -22,18 +23,148 @@ enum xmm_constant {
   NUM_XMM_CONST,
 };
 
+/* shadow stack of guest return addresses pushed by call-type branches. each
+   entry references the dispatch cache slot for the address, not the code
+   itself, so entries never go stale as code is invalidated */
+#define X64_RAS_SIZE 16
+
+struct x64_ras {
+  uint32_t top;
+  uint32_t addr[X64_RAS_SIZE];
+  void **code[X64_RAS_SIZE];
+};
+
+/* inline caches for dynamic branches, each recording the last destination
+   seen by a single branch site. like the return stack, entries reference the
+   destination's dispatch cache slot. entries are handed out round-robin, as
+   evicted code never releases its entries. a recycled entry being shared by
+   two sites only costs hits, it's never incorrect */
+#define X64_IC_SIZE 4096
+
+/* the dispatch cache has an entry for every possible block begin, but is only
+   sparsely populated. it's split into a two-level table of pages, with each
+   page only being allocated once code is cached in it. until then, its
+   first-level entry references a single default page, whose entries all point
+   to the compile thunk */
+#define X64_CACHE_PAGE_BITS 12
+#define X64_CACHE_PAGE_SIZE (1 << X64_CACHE_PAGE_BITS)
+
+/* cold paths, e.g. inline cache misses and conditional calls, are emitted out
+   of line after the hot code of every block being assembled, keeping the hot
+   paths dense and falling through. the hot path branches to the cold path's
+   label, and the cold path jumps back to its ret label if it returns */
+#define X64_MAX_COLD 256
+
+struct x64_backend;
+struct x64_cold;
+
+typedef void (*x64_cold_cb)(struct x64_backend *, struct x64_cold *);
+
+struct x64_cold {
+  x64_cold_cb emit;
+  const struct ir_value *args[3];
+  void *data;
+  Xbyak::Label label;
+  Xbyak::Label ret;
+};
+
+struct x64_ic {
+  uint32_t addr;
+  void **code;
+};
+
+/* xbyak only supports growing buffers by moving them, which would break the
+   rip-relative offsets in compiled code. this instead extends the size of a
+   user buffer in place, as the backend commits more of its reservation
+
+   further, when code is mapped w^x it's emitted through a writable view of
+   the buffer, but executed from a separate view exec_offset bytes away. code
+   addresses handed out are always in the executable view, and absolute
+   branch targets are translated back so xbyak computes their displacements
+   relative to where the code actually executes */
+struct x64_codegen : public Xbyak::CodeGenerator {
+  x64_codegen(size_t size, void *code, ptrdiff_t exec_offset = 0)
+      : Xbyak::CodeGenerator(size, code), exec_offset(exec_offset) {}
+
+  void grow(size_t size) {
+    maxSize_ = size;
+  }
+
+  template <class F>
+  const F getCode() const {
+    return Xbyak::CastTo<F>(top_ + exec_offset);
+  }
+
+  template <class F>
+  const F getCurr() const {
+    return Xbyak::CastTo<F>(top_ + size_ + exec_offset);
+  }
+
+  using Xbyak::CodeGenerator::call;
+  using Xbyak::CodeGenerator::jmp;
+  using Xbyak::CodeGenerator::jnz;
+  using Xbyak::CodeGenerator::js;
+
+  template <class Ret, class... Params>
+  void call(Ret (*func)(Params...)) {
+    call(Xbyak::CastTo<const void *>(func));
+  }
+
+  void call(const void *addr) {
+    Xbyak::CodeGenerator::call(emit_addr(addr));
+  }
+
+  void jmp(const void *addr, LabelType type = T_AUTO) {
+    Xbyak::CodeGenerator::jmp(emit_addr(addr), type);
+  }
+
+  void jnz(const void *addr) {
+    Xbyak::CodeGenerator::jnz(emit_addr(addr));
+  }
+
+  void js(const void *addr) {
+    Xbyak::CodeGenerator::js(emit_addr(addr));
+  }
+
+  ptrdiff_t exec_offset;
+
+  const void *emit_addr(const void *addr) const {
+    return (const uint8_t *)addr - exec_offset;
+  }
+};
+
 struct x64_backend {
   struct jit_backend base;
 
   /* code cache */
   uint32_t cache_mask;
   int cache_shift;
-  int cache_size;
-  void **cache;
+  int cache_num_pages;
+  void ***cache;
+  void **cache_default;
+
+  /* static code buffer passed to the backend, and whether the backend has
+     claimed it. a reservation is required when it's in use by another */
+  struct jit_code_buffer *code_buffer;
+  int code_claimed;
+
+  /* code buffer reserved by the backend, when one could be. only the first
+     code_committed bytes of it are accessible */
+  uint8_t *code_reserved;
+  int code_reserved_size;
+  int code_committed;
+
+  /* when code is mapped w^x, the shared memory backing the reservation. code
+     executes from code_reserved, and is written through code_writable */
+  shmem_handle_t code_shmem;
+  uint8_t *code_writable;
 
   /* codegen state */
-  Xbyak::CodeGenerator *codegen;
+  x64_codegen *codegen;
   int use_avx;
+  int use_fma;
+  int use_bmi2;
+  int use_sse41;
   Xbyak::Label xmm_const[NUM_XMM_CONST];
   void *dispatch_dynamic;
   void *dispatch_static;
@@ -41,8 +172,18 @@ struct x64_backend {
   void *dispatch_interrupt;
   void (*dispatch_enter)(int32_t);
   void *dispatch_exit;
+  void (*dispatch_abort)();
+  /* stack pointer compiled code runs with, restored when aborting it */
+  uint64_t dispatch_rsp;
   void (*load_thunk[16])();
   void (*store_thunk)();
+  struct x64_ras ras;
+  struct x64_ic *ics;
+  int next_ic;
+  struct x64_cold cold[X64_MAX_COLD];
+  int num_cold;
+  /* guest address of the instruction being emitted */
+  uint32_t source_addr;
 
   /* debug stats */
   csh capstone_handle;
@@ -51,7 +192,16 @@ struct x64_backend {
 /*
  * backend functionality used by emitters
  */
+static inline void *x64_backend_writable(struct x64_backend *backend,
+                                         void *code) {
+  return (uint8_t *)code - backend->codegen->exec_offset;
+}
+
 #define X64_THUNK_SIZE 8192
+/* maximum distance from the static code buffer a larger one is reserved at.
+   the static buffer lives in the data segment, keeping the reservation well
+   within the 2 GB reach of rip-relative calls into the binary */
+#define X64_CODE_RANGE 0x40000000
 #define X64_STACK_SIZE 1024
 
 #if PLATFORM_WINDOWS
@@ -63,6 +213,9 @@ struct x64_backend {
 #define X64_STACK_LOCALS (X64_STACK_SHADOW_SPACE + 8)
 
 #define X64_USE_AVX backend->use_avx
+#define X64_USE_FMA backend->use_fma
+#define X64_USE_BMI2 backend->use_bmi2
+#define X64_USE_SSE41 backend->use_sse41
 
 struct ir_value;
 
@@ -87,17 +240,66 @@ void x64_backend_load_mem(struct x64_backend *backend,
 void x64_backend_store_mem(struct x64_backend *backend,
                            const Xbyak::RegExp &dst_exp,
                            const struct ir_value *src);
+void x64_backend_load_mem_ext(struct x64_backend *backend,
+                              const struct ir_value *dst,
+                              const Xbyak::RegExp &src_exp,
+                              const struct ir_value *ext);
+void x64_backend_store_mem_trunc(struct x64_backend *backend,
+                                 const Xbyak::RegExp &dst_exp,
+                                 const struct ir_value *src,
+                                 const struct ir_value *trunc);
+void x64_backend_mov_ext(struct x64_backend *backend, const Xbyak::Reg &dst,
+                         const Xbyak::Reg &src, const struct ir_value *ext);
 void x64_backend_mov_value(struct x64_backend *backend, const Xbyak::Reg &dst,
                            const struct ir_value *v);
+void x64_backend_load_guest_constant(struct x64_backend *backend,
+                                     const struct ir_value *dst, uint32_t addr,
+                                     const struct ir_value *ext);
+void x64_backend_store_guest_constant(struct x64_backend *backend,
+                                      uint32_t addr, const struct ir_value *src,
+                                      const struct ir_value *trunc);
+void x64_backend_load_tlb(struct x64_backend *backend,
+                          const struct ir_value *dst,
+                          const struct ir_value *addr,
+                          const struct ir_value *ext);
+void x64_backend_store_tlb(struct x64_backend *backend,
+                           const struct ir_value *addr,
+                           const struct ir_value *src,
+                           const struct ir_value *trunc);
 const Xbyak::Address x64_backend_xmm_constant(struct x64_backend *backend,
                                               enum xmm_constant c);
 void x64_backend_block_label(char *name, size_t size, struct ir_block *block);
 void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
                              const ir_value *target);
+void x64_backend_emit_call(struct x64_backend *backend, uint32_t ret_addr);
+void x64_backend_emit_return(struct x64_backend *backend,
+                             const ir_value *target, const ir_value *counters);
+void x64_backend_emit_dynamic_branch(struct x64_backend *backend,
+                                     const ir_value *target,
+                                     const ir_value *counters);
+struct x64_cold *x64_backend_add_cold(struct x64_backend *backend,
+                                      x64_cold_cb emit);
 
 /*
  * dispatch
  */
+static inline void **x64_dispatch_code_ptr(struct x64_backend *backend,
+                                           uint32_t addr) {
+  uint32_t i = (addr & backend->cache_mask) >> backend->cache_shift;
+  void **page = backend->cache[i >> X64_CACHE_PAGE_BITS];
+  return &page[i & (X64_CACHE_PAGE_SIZE - 1)];
+}
+
+/* entries referenced by compiled code must not live in the default page, as
+   they'd go stale once their page is allocated. this allocates the page for
+   the address if it hasn't been already */
+void **x64_dispatch_alloc_code_ptr(struct x64_backend *backend, uint32_t addr);
+
+/* emits a lookup of the cache entry for addr, leaving it in rdx. rcx is
+   clobbered */
+void x64_dispatch_emit_code_ptr(struct x64_backend *backend,
+                                const Xbyak::Reg32 &addr);
+
 void x64_dispatch_init(struct x64_backend *backend);
 void x64_dispatch_shutdown(struct x64_backend *backend);
 void x64_dispatch_emit_thunks(struct x64_backend *backend);
@@ -109,12 +311,13 @@ void x64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr);
 void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst);
 void x64_dispatch_restore_edge(struct jit_backend *base, void *code,
                                uint32_t dst);
+void x64_dispatch_abort_code(struct jit_backend *base);
 
 /*
  * emitters
  */
-typedef void (*x64_emit_cb)(struct x64_backend *, Xbyak::CodeGenerator &,
-                            struct ir *, struct ir_instr *);
+typedef void (*x64_emit_cb)(struct x64_backend *, x64_codegen &, struct ir *,
+                            struct ir_instr *);
 extern struct jit_emitter x64_emitters[IR_NUM_OPS];
 
 #endif
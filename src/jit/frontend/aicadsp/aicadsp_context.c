@@ -0,0 +1,88 @@
+#include "jit/frontend/aicadsp/aicadsp_context.h"
+
+void aicadsp_decode(const uint16_t *words, struct aicadsp_instr *i) {
+  i->tra = (words[0] >> 8) & 0x7f;
+  i->twt = (words[0] >> 7) & 0x1;
+  i->twa = words[0] & 0x7f;
+
+  i->xsel = (words[1] >> 15) & 0x1;
+  i->ysel = (words[1] >> 13) & 0x3;
+  i->ira = (words[1] >> 7) & 0x3f;
+  i->iwt = (words[1] >> 6) & 0x1;
+  i->iwa = (words[1] >> 1) & 0x1f;
+
+  i->table = (words[2] >> 15) & 0x1;
+  i->mwt = (words[2] >> 14) & 0x1;
+  i->mrd = (words[2] >> 13) & 0x1;
+  i->ewt = (words[2] >> 12) & 0x1;
+  i->ewa = (words[2] >> 8) & 0xf;
+  i->adrl = (words[2] >> 7) & 0x1;
+  i->frcl = (words[2] >> 6) & 0x1;
+  i->shift = (words[2] >> 4) & 0x3;
+  i->yrl = (words[2] >> 3) & 0x1;
+  i->negb = (words[2] >> 2) & 0x1;
+  i->zero = (words[2] >> 1) & 0x1;
+  i->bsel = words[2] & 0x1;
+
+  i->nofl = (words[3] >> 15) & 0x1;
+  i->masa = (words[3] >> 9) & 0x1f;
+  i->adreb = (words[3] >> 8) & 0x1;
+  i->nxadr = (words[3] >> 7) & 0x1;
+}
+
+int aicadsp_num_steps(const uint8_t *reg) {
+  const uint32_t *mpro = (const uint32_t *)(reg + AICADSP_MPRO);
+
+  for (int step = AICADSP_MAX_STEPS - 1; step >= 0; step--) {
+    const uint32_t *words = &mpro[step * 4];
+
+    if ((words[0] | words[1] | words[2] | words[3]) & 0xffff) {
+      return step + 1;
+    }
+  }
+
+  return 0;
+}
+
+int32_t aicadsp_unpack(uint16_t val) {
+  int sign = (val >> 15) & 0x1;
+  int exponent = (val >> 11) & 0xf;
+  int mantissa = val & 0x7ff;
+  int32_t uval = mantissa << 11;
+
+  /* exponents past 11 denormalize the mantissa */
+  if (exponent > 11) {
+    exponent = 11;
+    uval |= sign << 22;
+  } else {
+    uval |= (sign ^ 1) << 22;
+  }
+
+  uval |= sign << 23;
+  uval = (int32_t)((uint32_t)uval << 8) >> 8;
+  return uval >> exponent;
+}
+
+uint16_t aicadsp_pack(int32_t val) {
+  int sign = (val >> 23) & 0x1;
+  uint32_t temp = ((uint32_t)val ^ ((uint32_t)val << 1)) & 0xffffff;
+  int exponent = 0;
+
+  /* count the redundant sign bits, up to 12 of them */
+  while (exponent < 12 && !(temp & 0x800000)) {
+    temp <<= 1;
+    exponent++;
+  }
+
+  if (exponent < 12) {
+    val = (int32_t)(((uint32_t)val << exponent) & 0x3fffff);
+  } else {
+    val = (int32_t)((uint32_t)val << 11);
+  }
+
+  val >>= 11;
+  val &= 0x7ff;
+  val |= sign << 15;
+  val |= exponent << 11;
+  return (uint16_t)val;
+}
@@ -0,0 +1,69 @@
+#ifndef AICADSP_CONTEXT_H
+#define AICADSP_CONTEXT_H
+
+#include <stdint.h>
+
+/* the program and its parameters live in the aica's register block, each
+   16-bit register laid out on a 32-bit boundary */
+#define AICADSP_RING 0x2804
+#define AICADSP_COEF 0x3000
+#define AICADSP_MADRS 0x3200
+#define AICADSP_MPRO 0x3400
+
+#define AICADSP_MAX_STEPS 128
+
+/* each step is made up of 4 registers */
+#define AICADSP_STEP_SIZE 16
+
+/* the ring buffer is addressed in 16-bit words */
+#define AICADSP_ARAM_MASK 0xfffff
+
+struct aicadsp_context {
+  /* runtime interface for the jit. the program is translated as a single
+     block at address 0, which branches back to itself */
+  uint32_t pc;
+  uint64_t pending_interrupts;
+  int32_t run_cycles;
+  int32_t ran_instrs;
+
+  /* the ring buffer's write pointer, decremented once per sample */
+  uint32_t dec;
+
+  /* work registers, persisting in between samples. the temp registers are
+     placed last, as they're indexed relative to dec through a host pointer
+     rather than loaded from the context */
+  int32_t mems[32];
+
+  /* inputs mixed in from each channel for the current sample, cleared once
+     the program has ran */
+  int32_t mixs[16];
+
+  /* effect outputs for the current sample */
+  int32_t efreg[16];
+
+  /* registers and wave memory the program runs against */
+  const uint8_t *reg;
+  uint8_t *aram;
+
+  int32_t temp[128];
+};
+
+struct aicadsp_instr {
+  int tra, twt, twa;
+  int xsel, ysel, ira, iwt, iwa;
+  int table, mwt, mrd, ewt, ewa, adrl, frcl, shift, yrl, negb, zero, bsel;
+  int nofl, masa, adreb, nxadr;
+};
+
+void aicadsp_decode(const uint16_t *words, struct aicadsp_instr *i);
+
+/* returns the number of steps up to and including the last one which isn't
+   empty, 0 when the dsp has nothing to run */
+int aicadsp_num_steps(const uint8_t *reg);
+
+/* conversions between the 24-bit samples used by the dsp and the 16-bit
+   floating point format they are stored to wave memory in */
+int32_t aicadsp_unpack(uint16_t val);
+uint16_t aicadsp_pack(int32_t val);
+
+#endif
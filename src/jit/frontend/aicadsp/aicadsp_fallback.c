@@ -0,0 +1,146 @@
+#include "jit/frontend/aicadsp/aicadsp_fallback.h"
+#include "core/core.h"
+#include "jit/frontend/aicadsp/aicadsp_context.h"
+
+#define REG16(offset) (*(const uint16_t *)&ctx->reg[offset])
+#define SEXT24(v) ((int32_t)((uint32_t)(v) << 8) >> 8)
+#define SEXT13(v) ((int32_t)((uint32_t)(v) << 19) >> 19)
+
+void aicadsp_fallback_run(struct aicadsp_context *ctx, int num_steps) {
+  /* everything other than the work registers starts out clear each sample */
+  int32_t acc = 0;
+  int32_t frc_reg = 0;
+  int32_t y_reg = 0;
+  uint32_t adrs_reg = 0;
+  int32_t memval[4] = {0};
+
+  uint16_t ring = REG16(AICADSP_RING);
+  uint32_t ring_base = (ring & 0xfff) << 10;
+  uint32_t ring_mask = (0x2000u << ((ring >> 13) & 0x3)) - 1;
+
+  memset(ctx->efreg, 0, sizeof(ctx->efreg));
+
+  for (int step = 0; step < num_steps; step++) {
+    struct aicadsp_instr i;
+    uint16_t words[4];
+
+    for (int n = 0; n < 4; n++) {
+      words[n] = REG16(AICADSP_MPRO + step * AICADSP_STEP_SIZE + n * 4);
+    }
+
+    aicadsp_decode(words, &i);
+
+    /* input selection, external inputs aren't emulated and read as 0 */
+    int32_t inputs = 0;
+
+    if (i.ira < 0x20) {
+      inputs = ctx->mems[i.ira];
+    } else if (i.ira < 0x30) {
+      inputs = ctx->mixs[i.ira - 0x20] << 4;
+    }
+
+    inputs = SEXT24(inputs);
+
+    /* the value read from memory two steps earlier is made available */
+    if (i.iwt) {
+      ctx->mems[i.iwa] = memval[step & 3];
+
+      if (i.ira == i.iwa) {
+        inputs = memval[step & 3];
+      }
+    }
+
+    int32_t temp = SEXT24(ctx->temp[(i.tra + ctx->dec) & 0x7f]);
+
+    int32_t b = 0;
+
+    if (!i.zero) {
+      b = i.bsel ? acc : temp;
+
+      if (i.negb) {
+        b = -b;
+      }
+    }
+
+    int32_t x = i.xsel ? inputs : temp;
+
+    int32_t y = 0;
+
+    if (i.ysel == 0) {
+      y = frc_reg;
+    } else if (i.ysel == 1) {
+      y = (int16_t)REG16(AICADSP_COEF + step * 4) >> 3;
+    } else if (i.ysel == 2) {
+      y = (y_reg >> 11) & 0x1fff;
+    } else {
+      y = (y_reg >> 4) & 0xfff;
+    }
+
+    if (i.yrl) {
+      y_reg = inputs;
+    }
+
+    int32_t shifted = 0;
+
+    if (i.shift == 0) {
+      shifted = CLAMP(acc, -0x800000, 0x7fffff);
+    } else if (i.shift == 1) {
+      shifted = CLAMP(acc * 2, -0x800000, 0x7fffff);
+    } else if (i.shift == 2) {
+      shifted = SEXT24(acc * 2);
+    } else {
+      shifted = SEXT24(acc);
+    }
+
+    acc = (int32_t)(((int64_t)x * SEXT13(y)) >> 12) + b;
+
+    if (i.twt) {
+      ctx->temp[(i.twa + ctx->dec) & 0x7f] = shifted;
+    }
+
+    if (i.frcl) {
+      frc_reg = i.shift == 3 ? shifted & 0xfff : (shifted >> 11) & 0x1fff;
+    }
+
+    /* memory may only be accessed on odd steps */
+    if ((i.mrd || i.mwt) && (step & 1)) {
+      uint32_t addr = REG16(AICADSP_MADRS + i.masa * 4);
+
+      if (!i.table) {
+        addr += ctx->dec;
+      }
+      if (i.adreb) {
+        addr += adrs_reg & 0xfff;
+      }
+      if (i.nxadr) {
+        addr++;
+      }
+
+      addr &= i.table ? 0xffff : ring_mask;
+      addr = (addr + ring_base) & AICADSP_ARAM_MASK;
+
+      uint16_t *data = (uint16_t *)&ctx->aram[addr << 1];
+
+      if (i.mrd) {
+        memval[(step + 2) & 3] =
+            i.nofl ? (int16_t)*data * 256 : aicadsp_unpack(*data);
+      }
+
+      if (i.mwt) {
+        *data = i.nofl ? (uint16_t)(shifted >> 8) : aicadsp_pack(shifted);
+      }
+    }
+
+    if (i.adrl) {
+      adrs_reg = i.shift == 3 ? (shifted >> 12) & 0xfff : inputs >> 16;
+    }
+
+    if (i.ewt) {
+      ctx->efreg[i.ewa] += shifted >> 8;
+    }
+  }
+
+  ctx->dec--;
+
+  memset(ctx->mixs, 0, sizeof(ctx->mixs));
+}
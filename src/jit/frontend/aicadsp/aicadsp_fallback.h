@@ -0,0 +1,9 @@
+#ifndef AICADSP_FALLBACK_H
+#define AICADSP_FALLBACK_H
+
+struct aicadsp_context;
+
+/* interprets the first num_steps of the program, producing a single sample */
+void aicadsp_fallback_run(struct aicadsp_context *ctx, int num_steps);
+
+#endif
@@ -0,0 +1,340 @@
+#include "jit/frontend/aicadsp/aicadsp_frontend.h"
+#include "core/core.h"
+#include "jit/frontend/aicadsp/aicadsp_context.h"
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+#include "jit/jit_guest.h"
+
+#define CTX_OFFSET(field) offsetof(struct aicadsp_context, field)
+
+struct aicadsp_frontend {
+  struct jit_frontend;
+};
+
+static void aicadsp_store_float(uint16_t *data, int32_t val) {
+  *data = aicadsp_pack(val);
+}
+
+static void aicadsp_read_instr(struct jit_guest *guest, uint32_t addr,
+                               struct aicadsp_instr *i) {
+  uint16_t words[4];
+
+  for (int n = 0; n < 4; n++) {
+    words[n] = guest->r16(guest->mem, addr + n * 4);
+  }
+
+  aicadsp_decode(words, i);
+}
+
+static struct ir_value *aicadsp_load_reg(struct ir *ir,
+                                         struct aicadsp_context *ctx,
+                                         int offset) {
+  struct ir_value *addr = ir_alloc_ptr(ir, (void *)&ctx->reg[offset]);
+  return ir_load_host(ir, addr, VALUE_I16);
+}
+
+static struct ir_value *aicadsp_sext(struct ir *ir, struct ir_value *v,
+                                     int bits) {
+  return ir_ashri(ir, ir_shli(ir, v, 32 - bits), 32 - bits);
+}
+
+static struct ir_value *aicadsp_clamp(struct ir *ir, struct ir_value *v) {
+  struct ir_value *hi = ir_alloc_i32(ir, 0x7fffff);
+  struct ir_value *lo = ir_alloc_i32(ir, -0x800000);
+  v = ir_select(ir, ir_cmp_sgt(ir, v, hi), hi, v);
+  return ir_select(ir, ir_cmp_slt(ir, v, lo), lo, v);
+}
+
+/* returns the host address of the temp register indexed relative to DEC */
+static struct ir_value *aicadsp_temp_addr(struct ir *ir,
+                                          struct aicadsp_context *ctx,
+                                          struct ir_value *dec, int n) {
+  struct ir_value *idx = ir_and(ir, ir_add(ir, dec, ir_alloc_i32(ir, n)),
+                                ir_alloc_i32(ir, 0x7f));
+  struct ir_value *offset = ir_zext(ir, ir_shli(ir, idx, 2), VALUE_I64);
+  return ir_add(ir, ir_alloc_ptr(ir, ctx->temp), offset);
+}
+
+static struct ir_value *aicadsp_unpack_ir(struct ir *ir, struct ir_value *v) {
+  struct ir_value *sign = ir_and(ir, ir_lshri(ir, v, 15), ir_alloc_i32(ir, 1));
+  struct ir_value *exponent =
+      ir_and(ir, ir_lshri(ir, v, 11), ir_alloc_i32(ir, 0xf));
+  struct ir_value *mantissa = ir_and(ir, v, ir_alloc_i32(ir, 0x7ff));
+  struct ir_value *denormal =
+      ir_cmp_ugt(ir, exponent, ir_alloc_i32(ir, 11));
+
+  struct ir_value *lead = ir_select(
+      ir, denormal, sign, ir_xor(ir, sign, ir_alloc_i32(ir, 1)));
+  exponent = ir_select(ir, denormal, ir_alloc_i32(ir, 11), exponent);
+
+  struct ir_value *uval = ir_shli(ir, mantissa, 11);
+  uval = ir_or(ir, uval, ir_shli(ir, lead, 22));
+  uval = ir_or(ir, uval, ir_shli(ir, sign, 23));
+  uval = aicadsp_sext(ir, uval, 24);
+  return ir_ashr(ir, uval, exponent);
+}
+
+static void aicadsp_frontend_dump_code(struct jit_frontend *base,
+                                       uint32_t begin_addr, int size,
+                                       FILE *output) {
+  struct aicadsp_frontend *frontend = (struct aicadsp_frontend *)base;
+  struct jit_guest *guest = frontend->guest;
+
+  fprintf(output, "#==--------------------------------------------------==#\n");
+  fprintf(output, "# aicadsp\n");
+  fprintf(output, "#==--------------------------------------------------==#\n");
+
+  for (int offset = 0; offset < size; offset += AICADSP_STEP_SIZE) {
+    uint32_t addr = begin_addr + offset;
+
+    fprintf(output, "# %3d: %04x %04x %04x %04x\n", offset / AICADSP_STEP_SIZE,
+            guest->r16(guest->mem, addr), guest->r16(guest->mem, addr + 4),
+            guest->r16(guest->mem, addr + 8),
+            guest->r16(guest->mem, addr + 12));
+  }
+}
+
+static uint32_t aicadsp_frontend_translate_code(struct jit_frontend *base,
+                                                uint32_t begin_addr, int size,
+                                                struct ir *ir) {
+  struct aicadsp_frontend *frontend = (struct aicadsp_frontend *)base;
+  struct jit_guest *guest = frontend->guest;
+  struct aicadsp_context *ctx = guest->ctx;
+
+  /* everything other than the work registers starts out clear each sample,
+     so they're kept in values for the duration of the program */
+  struct ir_value *zero = ir_alloc_i32(ir, 0);
+  struct ir_value *acc = zero;
+  struct ir_value *frc_reg = zero;
+  struct ir_value *y_reg = zero;
+  struct ir_value *adrs_reg = zero;
+  struct ir_value *memval[4] = {zero, zero, zero, zero};
+  struct ir_value *efreg[16];
+
+  for (int n = 0; n < 16; n++) {
+    efreg[n] = zero;
+  }
+
+  struct ir_value *dec = ir_load_context(ir, CTX_OFFSET(dec), VALUE_I32);
+
+  /* the ring buffer's registers are read at runtime, along with the
+     coefficients and addresses. only the program itself is compiled in */
+  struct ir_value *ring =
+      ir_zext(ir, aicadsp_load_reg(ir, ctx, AICADSP_RING), VALUE_I32);
+  struct ir_value *ring_base =
+      ir_shli(ir, ir_and(ir, ring, ir_alloc_i32(ir, 0xfff)), 10);
+  struct ir_value *ring_size =
+      ir_shl(ir, ir_alloc_i32(ir, 0x2000),
+             ir_and(ir, ir_lshri(ir, ring, 13), ir_alloc_i32(ir, 0x3)));
+  struct ir_value *ring_mask = ir_sub(ir, ring_size, ir_alloc_i32(ir, 1));
+
+  for (int offset = 0; offset < size; offset += AICADSP_STEP_SIZE) {
+    uint32_t addr = begin_addr + offset;
+    int step = offset / AICADSP_STEP_SIZE;
+    struct aicadsp_instr i;
+
+    aicadsp_read_instr(guest, addr, &i);
+
+    ir_source_info(ir, addr, 1);
+
+    /* input selection, external inputs aren't emulated and read as 0 */
+    struct ir_value *inputs = zero;
+
+    if (i.ira < 0x20) {
+      inputs = ir_load_context(ir, CTX_OFFSET(mems[i.ira]), VALUE_I32);
+    } else if (i.ira < 0x30) {
+      inputs = ir_load_context(ir, CTX_OFFSET(mixs[i.ira - 0x20]), VALUE_I32);
+      inputs = ir_shli(ir, inputs, 4);
+    }
+
+    inputs = aicadsp_sext(ir, inputs, 24);
+
+    /* the value read from memory two steps earlier is made available */
+    if (i.iwt) {
+      ir_store_context(ir, CTX_OFFSET(mems[i.iwa]), memval[step & 3]);
+
+      if (i.ira == i.iwa) {
+        inputs = memval[step & 3];
+      }
+    }
+
+    struct ir_value *temp = NULL;
+
+    if ((!i.zero && !i.bsel) || !i.xsel) {
+      temp = ir_load_host(ir, aicadsp_temp_addr(ir, ctx, dec, i.tra),
+                          VALUE_I32);
+      temp = aicadsp_sext(ir, temp, 24);
+    }
+
+    struct ir_value *b = zero;
+
+    if (!i.zero) {
+      b = i.bsel ? acc : temp;
+
+      if (i.negb) {
+        b = ir_neg(ir, b);
+      }
+    }
+
+    struct ir_value *x = i.xsel ? inputs : temp;
+
+    struct ir_value *y = NULL;
+
+    if (i.ysel == 0) {
+      y = frc_reg;
+    } else if (i.ysel == 1) {
+      y = aicadsp_load_reg(ir, ctx, AICADSP_COEF + step * 4);
+      y = ir_ashri(ir, ir_sext(ir, y, VALUE_I32), 3);
+    } else if (i.ysel == 2) {
+      y = ir_and(ir, ir_ashri(ir, y_reg, 11), ir_alloc_i32(ir, 0x1fff));
+    } else {
+      y = ir_and(ir, ir_ashri(ir, y_reg, 4), ir_alloc_i32(ir, 0xfff));
+    }
+
+    if (i.yrl) {
+      y_reg = inputs;
+    }
+
+    struct ir_value *shifted = NULL;
+
+    if (i.shift == 0) {
+      shifted = aicadsp_clamp(ir, acc);
+    } else if (i.shift == 1) {
+      shifted = aicadsp_clamp(ir, ir_shli(ir, acc, 1));
+    } else if (i.shift == 2) {
+      shifted = aicadsp_sext(ir, ir_shli(ir, acc, 1), 24);
+    } else {
+      shifted = aicadsp_sext(ir, acc, 24);
+    }
+
+    struct ir_value *product =
+        ir_smul(ir, ir_sext(ir, x, VALUE_I64),
+                ir_sext(ir, aicadsp_sext(ir, y, 13), VALUE_I64));
+    product = ir_trunc(ir, ir_ashri(ir, product, 12), VALUE_I32);
+    acc = ir_add(ir, product, b);
+
+    if (i.twt) {
+      ir_store_host(ir, aicadsp_temp_addr(ir, ctx, dec, i.twa), shifted);
+    }
+
+    if (i.frcl) {
+      if (i.shift == 3) {
+        frc_reg = ir_and(ir, shifted, ir_alloc_i32(ir, 0xfff));
+      } else {
+        frc_reg =
+            ir_and(ir, ir_ashri(ir, shifted, 11), ir_alloc_i32(ir, 0x1fff));
+      }
+    }
+
+    /* memory may only be accessed on odd steps */
+    if ((i.mrd || i.mwt) && (step & 1)) {
+      struct ir_value *ea = ir_zext(
+          ir, aicadsp_load_reg(ir, ctx, AICADSP_MADRS + i.masa * 4), VALUE_I32);
+
+      if (!i.table) {
+        ea = ir_add(ir, ea, dec);
+      }
+      if (i.adreb) {
+        ea = ir_add(ir, ea, ir_and(ir, adrs_reg, ir_alloc_i32(ir, 0xfff)));
+      }
+      if (i.nxadr) {
+        ea = ir_add(ir, ea, ir_alloc_i32(ir, 1));
+      }
+
+      ea = ir_and(ir, ea, i.table ? ir_alloc_i32(ir, 0xffff) : ring_mask);
+      ea = ir_and(ir, ir_add(ir, ea, ring_base),
+                  ir_alloc_i32(ir, AICADSP_ARAM_MASK));
+
+      struct ir_value *data =
+          ir_add(ir, ir_alloc_ptr(ir, ctx->aram),
+                 ir_zext(ir, ir_shli(ir, ea, 1), VALUE_I64));
+
+      if (i.mrd) {
+        struct ir_value *v = ir_load_host(ir, data, VALUE_I16);
+
+        if (i.nofl) {
+          v = ir_shli(ir, ir_sext(ir, v, VALUE_I32), 8);
+        } else {
+          v = aicadsp_unpack_ir(ir, ir_zext(ir, v, VALUE_I32));
+        }
+
+        memval[(step + 2) & 3] = v;
+      }
+
+      if (i.mwt) {
+        if (i.nofl) {
+          ir_store_host(ir, data,
+                        ir_trunc(ir, ir_ashri(ir, shifted, 8), VALUE_I16));
+        } else {
+          ir_call_2(ir, ir_alloc_ptr(ir, &aicadsp_store_float), data,
+                    shifted);
+        }
+      }
+    }
+
+    if (i.adrl) {
+      if (i.shift == 3) {
+        adrs_reg =
+            ir_and(ir, ir_ashri(ir, shifted, 12), ir_alloc_i32(ir, 0xfff));
+      } else {
+        adrs_reg = ir_ashri(ir, inputs, 16);
+      }
+    }
+
+    if (i.ewt) {
+      efreg[i.ewa] = ir_add(ir, efreg[i.ewa], ir_ashri(ir, shifted, 8));
+    }
+  }
+
+  for (int n = 0; n < 16; n++) {
+    ir_store_context(ir, CTX_OFFSET(efreg[n]), efreg[n]);
+    ir_store_context(ir, CTX_OFFSET(mixs[n]), zero);
+  }
+
+  ir_store_context(ir, CTX_OFFSET(dec), ir_sub(ir, dec, ir_alloc_i32(ir, 1)));
+
+  /* run the program again on the next sample */
+  ir_branch(ir, ir_alloc_i32(ir, begin_addr));
+
+  return 0;
+}
+
+static void aicadsp_frontend_analyze_code(struct jit_frontend *base,
+                                          uint32_t begin_addr, int *size) {
+  struct aicadsp_frontend *frontend = (struct aicadsp_frontend *)base;
+  struct jit_guest *guest = frontend->guest;
+
+  /* the program is ran through once per sample, from its first step up to
+     the last one which isn't empty */
+  *size = AICADSP_STEP_SIZE;
+
+  for (int step = 0; step < AICADSP_MAX_STEPS; step++) {
+    uint32_t addr = begin_addr + step * AICADSP_STEP_SIZE;
+
+    for (int n = 0; n < 4; n++) {
+      if (guest->r16(guest->mem, addr + n * 4)) {
+        *size = (step + 1) * AICADSP_STEP_SIZE;
+        break;
+      }
+    }
+  }
+}
+
+void aicadsp_frontend_destroy(struct jit_frontend *base) {
+  struct aicadsp_frontend *frontend = (struct aicadsp_frontend *)base;
+
+  free(frontend);
+}
+
+struct jit_frontend *aicadsp_frontend_create(struct jit_guest *guest) {
+  struct aicadsp_frontend *frontend =
+      calloc(1, sizeof(struct aicadsp_frontend));
+
+  frontend->guest = guest;
+  frontend->destroy = &aicadsp_frontend_destroy;
+  frontend->analyze_code = &aicadsp_frontend_analyze_code;
+  frontend->translate_code = &aicadsp_frontend_translate_code;
+  frontend->dump_code = &aicadsp_frontend_dump_code;
+
+  return (struct jit_frontend *)frontend;
+}
@@ -0,0 +1,10 @@
+#ifndef AICADSP_FRONTEND_H
+#define AICADSP_FRONTEND_H
+
+#include "jit/jit_frontend.h"
+
+struct jit_guest;
+
+struct jit_frontend *aicadsp_frontend_create(struct jit_guest *guest);
+
+#endif
@@ -15,9 +15,10 @@ enum {
 
 enum {
   /*
-   * indices 0-15 represent the registers for the current mode. during each
-   * mode switch, the old mode's banked registers are stored out, while the
-   * new mode's banked registers are loaded in to the active set
+   * indices 0-15 represent the registers for the current mode. each mode's
+   * banked registers are swapped with the active set when entering and again
+   * when leaving it. while a mode is active, its bank holds the user bank's
+   * values, so armv3_reg_table always locates the user bank r0-15
    */
   CPSR = 16,
 
@@ -81,6 +82,8 @@ enum {
 #define Z_SET(sr) (((sr)&Z_MASK) == Z_MASK)
 #define N_SET(sr) (((sr)&N_MASK) == N_MASK)
 
+#define NZCV_MASK (N_MASK | Z_MASK | C_MASK | V_MASK)
+
 #define F_CLEAR(sr) (!F_SET(sr))
 #define I_CLEAR(sr) (!I_SET(sr))
 #define V_CLEAR(sr) (!V_SET(sr))
@@ -88,17 +91,38 @@ enum {
 #define Z_CLEAR(sr) (!Z_SET(sr))
 #define N_CLEAR(sr) (!N_SET(sr))
 
+/* operations which can produce the condition flags lazily */
+enum {
+  FLAGS_NONE,
+  FLAGS_LOGICAL,
+  FLAGS_ADD,
+  FLAGS_SUB,
+};
+
 struct armv3_context {
   uint32_t r[NUM_ARMV3_REGS];
 
-  /* points directly to the user bank r0-15 no matter the mode */
-  uint32_t *rusr[16];
+  /* data processing instructions record the operation and operands which set
+     the condition flags, instead of computing them into the CPSR right away.
+     most are overwritten before ever being read, so they're only computed once
+     something needs the CPSR. for logical operations, flags_lhs holds the
+     shifter's carry out */
+  int flags_op;
+  uint32_t flags_lhs;
+  uint32_t flags_rhs;
+  uint32_t flags_res;
 
   uint64_t pending_interrupts;
 
   /* the main dispatch loop is ran until run_cycles is <= 0 */
   int32_t run_cycles;
 
+  /* when an interrupt becomes pending while running, the remaining cycles are
+     stashed here and run_cycles is forced negative, yielding to the interrupt
+     at the next block */
+  int32_t yield_cycles;
+  int32_t yielding;
+
   /* debug information */
   int32_t ran_instrs;
 };
@@ -107,4 +131,48 @@ struct armv3_context {
 extern const int armv3_spsr_table[0x20];
 extern const int armv3_reg_table[0x20][16];
 
+static inline uint32_t armv3_carry_flag(const struct armv3_context *ctx) {
+  uint32_t lhs = ctx->flags_lhs;
+  uint32_t rhs = ctx->flags_rhs;
+  uint32_t res = ctx->flags_res;
+
+  switch (ctx->flags_op) {
+    case FLAGS_LOGICAL:
+      return lhs;
+    case FLAGS_ADD:
+      return ((lhs & rhs) | ((lhs | rhs) & ~res)) >> 31;
+    case FLAGS_SUB:
+      return ~((~lhs & rhs) | ((~lhs | rhs) & res)) >> 31;
+    default:
+      return C_SET(ctx->r[CPSR]);
+  }
+}
+
+/* compute any pending condition flags into the CPSR */
+static inline void armv3_flush_flags(struct armv3_context *ctx) {
+  uint32_t lhs = ctx->flags_lhs;
+  uint32_t rhs = ctx->flags_rhs;
+  uint32_t res = ctx->flags_res;
+  uint32_t v = 0;
+
+  switch (ctx->flags_op) {
+    case FLAGS_NONE:
+      return;
+    case FLAGS_ADD:
+      v = ((res ^ lhs) & (res ^ rhs)) >> 31;
+      break;
+    case FLAGS_SUB:
+      v = ((lhs ^ rhs) & (res ^ lhs)) >> 31;
+      break;
+  }
+
+  uint32_t n = res >> 31;
+  uint32_t z = res ? 0 : 1;
+  uint32_t c = armv3_carry_flag(ctx);
+
+  ctx->r[CPSR] = (ctx->r[CPSR] & ~NZCV_MASK) | (n << N_BIT) | (z << Z_BIT) |
+                 (c << C_BIT) | (v << V_BIT);
+  ctx->flags_op = FLAGS_NONE;
+}
+
 #endif
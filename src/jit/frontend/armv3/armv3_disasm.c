@@ -1,9 +1,12 @@
 #include "jit/frontend/armv3/armv3_disasm.h"
-#include "core/constructor.h"
 #include "core/core.h"
 #include "jit/frontend/armv3/armv3_fallback.h"
 
-int armv3_optable[ARMV3_LOOKUP_SIZE];
+/* generated at build time by tools/gentables from the signatures in
+   armv3_instr.inc */
+const int armv3_optable[ARMV3_LOOKUP_SIZE] = {
+#include "jit/frontend/armv3/armv3_optable.inc"
+};
 
 struct jit_opdef armv3_opdefs[NUM_ARMV3_OPS] = {
 #define ARMV3_INSTR(name, desc, sig, cycles, flags) \
@@ -18,68 +21,6 @@ struct jit_opdef armv3_opdefs[NUM_ARMV3_OPS] = {
 #undef ARMV3_INSTR
 };
 
-static void armv3_disasm_init_lookup() {
-  static int initialized = 0;
-
-  if (initialized) {
-    return;
-  }
-
-  initialized = 1;
-
-  /* extract each opcode / opcode mask from the signature string */
-  uint32_t opcodes[NUM_ARMV3_OPS] = {0};
-  uint32_t opcode_masks[NUM_ARMV3_OPS] = {0};
-
-  for (int i = 1; i < NUM_ARMV3_OPS; i++) {
-    struct jit_opdef *def = &armv3_opdefs[i];
-
-    size_t len = strlen(def->sig);
-
-    /* 0 or 1 represents part of the opcode, anything else is a flag */
-    for (size_t j = 0; j < len; j++) {
-      char c = def->sig[len - j - 1];
-
-      if (c == '0' || c == '1') {
-        opcodes[i] |= (uint32_t)(c - '0') << j;
-        opcode_masks[i] |= (uint32_t)1 << j;
-      }
-    }
-
-    /* ignore bits outside of lookup mask */
-    opcodes[i] &= ARMV3_LOOKUP_MASK;
-    opcode_masks[i] &= ARMV3_LOOKUP_MASK;
-  }
-
-  /* iterate all possible lookup values, mapping a description to each */
-  for (int hi = 0; hi < ARMV3_LOOKUP_SIZE_HI; hi++) {
-    for (int lo = 0; lo < ARMV3_LOOKUP_SIZE_LO; lo++) {
-      uint32_t instr = ARMV3_LOOKUP_INSTR(hi, lo);
-
-      /* some operations are differentiated by having a fixed set of flags in
-         the lower bits (while sharing the same encoding in the upper bits).
-         due to this, operations with a more specific mask take precedence */
-      int prev_bits = 0;
-
-      for (int i = 1; i < NUM_ARMV3_OPS; i++) {
-        uint32_t opcode = opcodes[i];
-        uint32_t opcode_mask = opcode_masks[i];
-
-        if ((instr & opcode_mask) == opcode) {
-          int bits = popcnt32(opcode_mask);
-
-          CHECK_NE(bits, prev_bits);
-
-          if (bits > prev_bits) {
-            armv3_optable[ARMV3_LOOKUP_INDEX(instr)] = i;
-            prev_bits = bits;
-          }
-        }
-      }
-    }
-  }
-}
-
 int32_t armv3_disasm_offset(uint32_t offset) {
   int32_t res = offset;
   if (res & 0x00800000) {
@@ -325,7 +266,3 @@ void armv3_format(uint32_t addr, uint32_t instr, char *buffer,
     /* TODO */
   }
 }
-
-CONSTRUCTOR(armv3_disasm_init) {
-  armv3_disasm_init_lookup();
-}
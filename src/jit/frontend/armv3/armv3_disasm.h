@@ -255,7 +255,7 @@ struct armv3_desc {
 #define ARMV3_LOOKUP_INDEX(instr) \
   (((instr & 0x0fff0000) >> 12) | ((instr & 0xf0) >> 4))
 
-extern int armv3_optable[ARMV3_LOOKUP_SIZE];
+extern const int armv3_optable[ARMV3_LOOKUP_SIZE];
 extern struct jit_opdef armv3_opdefs[NUM_ARMV3_OPS];
 
 static inline int armv3_get_op(uint32_t instr) {
@@ -12,7 +12,7 @@
 #define CTX ((struct armv3_context *)guest->ctx)
 #define MODE() (CTX->r[CPSR] & M_MASK)
 #define REG(n) (CTX->r[n])
-#define REG_USR(n) (*CTX->rusr[n])
+#define REG_USR(n) (armv3_reg_table[MODE()][n])
 
 #define CHECK_COND()                                  \
   if (!armv3_fallback_cond_check(CTX, i.raw >> 28)) { \
@@ -25,6 +25,10 @@
 
 static inline int armv3_fallback_cond_check(struct armv3_context *ctx,
                                             uint32_t cond) {
+  if (cond != COND_AL) {
+    armv3_flush_flags(ctx);
+  }
+
   switch (cond) {
     case COND_EQ:
       return Z_SET(ctx->r[CPSR]);
@@ -115,7 +119,7 @@ static void armv3_fallback_shift(const struct armv3_context *ctx,
                                  enum armv3_shift_type type, uint32_t in,
                                  uint32_t n, uint32_t *out, uint32_t *carry) {
   *out = in;
-  *carry = C_SET(ctx->r[CPSR]);
+  *carry = armv3_carry_flag(ctx);
 
   if (src == SHIFT_REG) {
     n = ctx->r[n];
@@ -213,7 +217,7 @@ FALLBACK(BL) {
 #define PARSE_OP2(value, carry) \
   armv3_fallback_parse_op2(CTX, addr, i, value, carry)
 
-#define CARRY() (C_SET(CTX->r[CPSR]))
+#define CARRY() (armv3_carry_flag(CTX))
 
 #define UPDATE_FLAGS_LOGICAL()                            \
   if (i.data.s) {                                         \
@@ -239,10 +243,6 @@ FALLBACK(BL) {
     }                                                    \
   }
 
-#define MAKE_CPSR(cpsr, n, z, c, v)                                   \
-  (((cpsr) & ~(N_MASK | Z_MASK | C_MASK | V_MASK)) | ((n) << N_BIT) | \
-   ((z) << Z_BIT) | ((c) << C_BIT) | ((v) << V_BIT))
-
 static inline void armv3_fallback_parse_op2(struct armv3_context *ctx,
                                             uint32_t addr, union armv3_instr i,
                                             uint32_t *value, uint32_t *carry) {
@@ -254,7 +254,7 @@ static inline void armv3_fallback_parse_op2(struct armv3_context *ctx,
       armv3_fallback_shift_ror(i.data_imm.imm, n, value, carry);
     } else {
       *value = i.data_imm.imm;
-      *carry = C_SET(ctx->r[CPSR]);
+      *carry = armv3_carry_flag(ctx);
     }
   } else {
     /* op2 is as shifted register */
@@ -263,33 +263,30 @@ static inline void armv3_fallback_parse_op2(struct armv3_context *ctx,
   }
 }
 
+/* the flags are computed lazily by armv3_flush_flags */
 static inline void armv3_fallback_update_flags_logical(
     struct armv3_context *ctx, uint32_t res, uint32_t carry) {
-  int n = (res & 0x80000000) ? 1 : 0;
-  int z = res ? 0 : 1;
-  int c = carry;
-  int v = 0;
-  ctx->r[CPSR] = MAKE_CPSR(ctx->r[CPSR], n, z, c, v);
+  ctx->flags_op = FLAGS_LOGICAL;
+  ctx->flags_lhs = carry;
+  ctx->flags_res = res;
 }
 
 static inline void armv3_fallback_update_flags_sub(struct armv3_context *ctx,
                                                    uint32_t lhs, uint32_t rhs,
                                                    uint32_t res) {
-  int n = res & 0x80000000 ? 1 : 0;
-  int z = res ? 0 : 1;
-  int c = ~((~lhs & rhs) | ((~lhs | rhs) & res)) >> 31;
-  int v = ((lhs ^ rhs) & (res ^ lhs)) >> 31;
-  ctx->r[CPSR] = MAKE_CPSR(ctx->r[CPSR], n, z, c, v);
+  ctx->flags_op = FLAGS_SUB;
+  ctx->flags_lhs = lhs;
+  ctx->flags_rhs = rhs;
+  ctx->flags_res = res;
 }
 
 static inline void armv3_fallback_update_flags_add(struct armv3_context *ctx,
                                                    uint32_t lhs, uint32_t rhs,
                                                    uint32_t res) {
-  int n = res & 0x80000000 ? 1 : 0;
-  int z = res ? 0 : 1;
-  int c = ((lhs & rhs) | ((lhs | rhs) & ~res)) >> 31;
-  int v = ((res ^ lhs) & (res ^ rhs)) >> 31;
-  ctx->r[CPSR] = MAKE_CPSR(ctx->r[CPSR], n, z, c, v);
+  ctx->flags_op = FLAGS_ADD;
+  ctx->flags_lhs = lhs;
+  ctx->flags_rhs = rhs;
+  ctx->flags_res = res;
 }
 
 FALLBACK(INVALID) {}
@@ -504,6 +501,7 @@ FALLBACK(MRS) {
   if (i.mrs.src_psr) {
     REG(i.mrs.rd) = REG(SPSR);
   } else {
+    armv3_flush_flags(CTX);
     REG(i.mrs.rd) = REG(CPSR);
   }
 
@@ -534,6 +532,8 @@ FALLBACK(MSR) {
       REG(SPSR) = newsr;
     }
   } else {
+    armv3_flush_flags(CTX);
+
     uint32_t oldsr = REG(CPSR);
 
     /* control flags can't be modified when all bit isn't set / in user mode */
@@ -562,6 +562,7 @@ static void armv3_fallback_update_flags_mul(struct armv3_context *ctx,
                                             uint32_t res) {
   int n = res & 0x80000000 ? 1 : 0;
   int z = res ? 0 : 1;
+  armv3_flush_flags(ctx);
   ctx->r[CPSR] = MAKE_CPSR_NZ(ctx->r[CPSR], n, z);
 }
 
@@ -782,6 +783,8 @@ FALLBACK(SWP) {
 FALLBACK(SWI) {
   CHECK_COND();
 
+  armv3_flush_flags(CTX);
+
   uint32_t oldsr = REG(CPSR);
   uint32_t newsr = (oldsr & ~M_MASK) | I_MASK | MODE_SVC;
 
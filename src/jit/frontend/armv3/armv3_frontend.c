@@ -16,6 +16,159 @@ static const struct jit_opdef *armv3_frontend_lookup_op(
   return armv3_get_opdef(*(const uint32_t *)instr);
 }
 
+/* register masks used when analyzing idle loops, bits 0-15 map to r0-r15 */
+#define ARMV3_IDLE_R(n) (1u << (n))
+
+static int armv3_frontend_idle_regs(union armv3_instr i, struct jit_opdef *def,
+                                    uint32_t *reads, uint32_t *writes) {
+  enum armv3_shift_source src;
+  enum armv3_shift_type type;
+  uint32_t n;
+
+  *reads = 0;
+  *writes = 0;
+
+  /* the terminating branch is checked by the caller */
+  if (def->op == ARMV3_OP_B) {
+    return 1;
+  }
+
+  /* conditionally executed instructions may or may not overwrite their
+     destination, making it hard to reason about. pc is constant for each
+     instruction, so it's never tracked */
+  if (i.data.cond != COND_AL) {
+    return 0;
+  }
+
+  /* only loads and data processing instructions without side effects outside
+     of the general registers and the condition flags may be part of an idle
+     loop. instructions reading the carry flag are left out, as it may be
+     carried over from the previous iteration */
+  switch (def->op) {
+    case ARMV3_OP_AND:
+    case ARMV3_OP_EOR:
+    case ARMV3_OP_SUB:
+    case ARMV3_OP_RSB:
+    case ARMV3_OP_ADD:
+    case ARMV3_OP_TST:
+    case ARMV3_OP_TEQ:
+    case ARMV3_OP_CMP:
+    case ARMV3_OP_CMN:
+    case ARMV3_OP_ORR:
+    case ARMV3_OP_MOV:
+    case ARMV3_OP_BIC:
+    case ARMV3_OP_MVN:
+      if (i.data.rd == 15) {
+        return 0;
+      }
+      if (!i.data.i) {
+        armv3_disasm_shift(i.data_reg.shift, &src, &type, &n);
+        if (type == SHIFT_RRX) {
+          return 0;
+        }
+        *reads |= ARMV3_IDLE_R(i.data_reg.rm);
+        if (src == SHIFT_REG) {
+          *reads |= ARMV3_IDLE_R(n);
+        }
+      }
+      if (def->op != ARMV3_OP_MOV && def->op != ARMV3_OP_MVN) {
+        *reads |= ARMV3_IDLE_R(i.data.rn);
+      }
+      if (def->op < ARMV3_OP_TST || def->op > ARMV3_OP_CMN) {
+        *writes |= ARMV3_IDLE_R(i.data.rd);
+      }
+      break;
+    case ARMV3_OP_LDR:
+      /* post-indexed and write-back addressing modify the base register */
+      if (i.xfr.rd == 15 || !i.xfr.p || i.xfr.w) {
+        return 0;
+      }
+      if (i.xfr.i) {
+        armv3_disasm_shift(i.xfr_reg.shift, &src, &type, &n);
+        if (type == SHIFT_RRX) {
+          return 0;
+        }
+        *reads |= ARMV3_IDLE_R(i.xfr_reg.rm);
+      }
+      *reads |= ARMV3_IDLE_R(i.xfr.rn);
+      *writes |= ARMV3_IDLE_R(i.xfr.rd);
+      break;
+    default:
+      return 0;
+  }
+
+  *reads &= ~ARMV3_IDLE_R(15);
+  return 1;
+}
+
+static int armv3_frontend_is_idle_loop(struct armv3_frontend *frontend,
+                                       uint32_t begin_addr, int size) {
+  struct jit_guest *guest = frontend->guest;
+
+  /* an idle loop is a block which branches back to itself, only polling
+     memory and testing the result. sound drivers commonly spin like this on a
+     word in wave memory until the sh4 or an interrupt hands them work, so
+     every iteration until then is equivalent and can be skipped */
+  int loads = 0;
+  int offset = 0;
+
+  /* for an iteration to be equivalent to the previous one, no register may be
+     read before being written if it's also written by the loop */
+  uint32_t live_in = 0;
+  uint32_t written = 0;
+
+  while (offset < size) {
+    uint32_t addr = begin_addr + offset;
+    uint32_t data = guest->r32(guest->mem, addr);
+    union armv3_instr i = {data};
+    struct jit_opdef *def = armv3_get_opdef(data);
+    uint32_t reads, writes;
+
+    if (!armv3_frontend_idle_regs(i, def, &reads, &writes)) {
+      return 0;
+    }
+
+    offset += 4;
+    loads += def->op == ARMV3_OP_LDR;
+
+    live_in |= reads & ~written;
+    written |= writes;
+
+    if (def->op == ARMV3_OP_B) {
+      /* if the block doesn't poll memory, disqualify */
+      if (!loads) {
+        return 0;
+      }
+
+      /* if the loop carries state between iterations, disqualify */
+      if (live_in & written) {
+        return 0;
+      }
+
+      /* if the branch doesn't loop back to the block's start, disqualify */
+      uint32_t branch_addr = addr + 8 + armv3_disasm_offset(i.branch.offset);
+      return offset == size && branch_addr == begin_addr;
+    }
+  }
+
+  return 0;
+}
+
+static void armv3_frontend_yield_idle_loop(struct ir *ir, uint32_t begin_addr) {
+  /* exhaust the remaining cycles when the branch loops back, exiting to
+     dispatch and idling out the rest of the time slice. the loop polls again
+     the next time the arm7 is ran */
+  size_t pc_offset = offsetof(struct armv3_context, r[15]);
+  size_t offset = offsetof(struct armv3_context, run_cycles);
+
+  struct ir_value *pc = ir_load_context(ir, pc_offset, VALUE_I32);
+  struct ir_value *looped = ir_cmp_eq(ir, pc, ir_alloc_i32(ir, begin_addr));
+  struct ir_value *run = ir_load_context(ir, offset, VALUE_I32);
+  struct ir_value *idle = ir_alloc_i32(ir, -1);
+
+  ir_store_context(ir, offset, ir_select(ir, looped, idle, run));
+}
+
 static void armv3_frontend_dump_code(struct jit_frontend *base,
                                      uint32_t begin_addr, int size,
                                      FILE *output) {
@@ -40,12 +193,13 @@ static void armv3_frontend_dump_code(struct jit_frontend *base,
   }
 }
 
-static void armv3_frontend_translate_code(struct jit_frontend *base,
-                                          uint32_t begin_addr, int size,
-                                          struct ir *ir) {
+static uint32_t armv3_frontend_translate_code(struct jit_frontend *base,
+                                              uint32_t begin_addr, int size,
+                                              struct ir *ir) {
   struct armv3_frontend *frontend = (struct armv3_frontend *)base;
   struct armv3_guest *guest = (struct armv3_guest *)frontend->guest;
 
+  int idle_loop = armv3_frontend_is_idle_loop(frontend, begin_addr, size);
   int offset = 0;
 
   while (offset < size) {
@@ -58,6 +212,12 @@ static void armv3_frontend_translate_code(struct jit_frontend *base,
 
     offset += 4;
   }
+
+  if (idle_loop) {
+    armv3_frontend_yield_idle_loop(ir, begin_addr);
+  }
+
+  return 0;
 }
 
 static void armv3_frontend_analyze_code(struct jit_frontend *base,
@@ -106,6 +266,8 @@ struct jit_frontend *armv3_frontend_create(struct jit_guest *guest) {
   frontend->translate_code = &armv3_frontend_translate_code;
   frontend->dump_code = &armv3_frontend_dump_code;
   frontend->lookup_op = &armv3_frontend_lookup_op;
+  frontend->num_ops = NUM_ARMV3_OPS;
+  frontend->instr_size = 4;
 
   return (struct jit_frontend *)frontend;
 }
@@ -1,9 +1,12 @@
 #include "jit/frontend/sh4/sh4_disasm.h"
-#include "core/constructor.h"
 #include "core/core.h"
 #include "jit/frontend/sh4/sh4_fallback.h"
 
-int sh4_optable[UINT16_MAX + 1];
+/* generated at build time by tools/gentables from the signatures in
+   sh4_instr.inc */
+const int sh4_optable[UINT16_MAX + 1] = {
+#include "jit/frontend/sh4/sh4_optable.inc"
+};
 
 struct jit_opdef sh4_opdefs[NUM_SH4_OPS] = {
 #define SH4_INSTR(name, desc, sig, cycles, flags) \
@@ -18,44 +21,6 @@ struct jit_opdef sh4_opdefs[NUM_SH4_OPS] = {
 #undef SH4_INSTR
 };
 
-static void sh4_disasm_init_lookup() {
-  static int initialized = 0;
-
-  if (initialized) {
-    return;
-  }
-
-  initialized = 1;
-
-  uint16_t opcodes[NUM_SH4_OPS] = {0};
-  uint16_t opcode_masks[NUM_SH4_OPS] = {0};
-
-  for (int i = 1; i < NUM_SH4_OPS; i++) {
-    struct jit_opdef *def = &sh4_opdefs[i];
-    size_t len = strlen(def->sig);
-
-    /* 0 or 1 represents part of the opcode, anything else is a flag */
-    for (size_t j = 0; j < len; j++) {
-      char c = def->sig[len - j - 1];
-
-      if (c == '0' || c == '1') {
-        opcodes[i] |= (uint32_t)(c - '0') << j;
-        opcode_masks[i] |= (uint32_t)1 << j;
-      }
-    }
-  }
-
-  /* initialize lookup table */
-  for (int value = 0; value <= UINT16_MAX; value++) {
-    for (int i = 1 /* skip SH4_OP_INVALID */; i < NUM_SH4_OPS; i++) {
-      if ((value & opcode_masks[i]) == opcodes[i]) {
-        sh4_optable[value] = i;
-        break;
-      }
-    }
-  }
-}
-
 void sh4_format(uint32_t addr, union sh4_instr i, char *buffer,
                 size_t buffer_size) {
   struct jit_opdef *def = sh4_get_opdef(i.raw);
@@ -212,7 +177,3 @@ void sh4_branch_info(uint32_t addr, union sh4_instr i, int *branch_type,
     LOG_FATAL("unexpected branch op %s", def->name);
   }
 }
-
-CONSTRUCTOR(sh4_disasm_init) {
-  sh4_disasm_init_lookup();
-}
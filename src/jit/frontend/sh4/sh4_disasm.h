@@ -61,7 +61,7 @@ union sh4_instr {
   } disp_12;
 };
 
-extern int sh4_optable[UINT16_MAX + 1];
+extern const int sh4_optable[UINT16_MAX + 1];
 extern struct jit_opdef sh4_opdefs[NUM_SH4_OPS];
 
 static inline int sh4_get_op(uint16_t instr) {
@@ -28,6 +28,10 @@ static void store_fpscr(struct sh4_guest *guest, struct sh4_context *ctx,
   guest->fpscr_updated(guest->data, old_fpscr);
 }
 
+static inline int64_t swap_pair(int64_t v) {
+  return (int64_t)(((uint64_t)v << 32) | ((uint64_t)v >> 32));
+}
+
 static inline int32_t vadd_f32_el(int32_t a, int32_t b) {
   float r = *(float *)&a + *(float *)&b;
   return *(int32_t *)&r;
@@ -38,6 +42,11 @@ static inline int32_t vmul_f32_el(int32_t a, int32_t b) {
   return *(int32_t *)&r;
 }
 
+static inline int32_t vmadd_f32_el(int32_t a, int32_t b, int32_t c) {
+  float r = *(float *)&a * *(float *)&b + *(float *)&c;
+  return *(int32_t *)&r;
+}
+
 static inline float vdot_f32(int32_t *a, int32_t *b) {
   return *(float *)&a[0] * *(float *)&b[0] + *(float *)&a[1] * *(float *)&b[1] +
          *(float *)&a[2] * *(float *)&b[2] + *(float *)&a[3] * *(float *)&b[3];
@@ -177,6 +186,9 @@ typedef int32_t int128_t[4];
 
 #define LOAD_HOST_F32(addr)          (*(float *)(uintptr_t)addr)
 #define LOAD_HOST_F64(addr)          (*(double *)(uintptr_t)addr)
+#define LOAD_HOST_I64(addr)          (*(int64_t *)(uintptr_t)addr)
+
+#define SWAP_PAIR_I64(v)             swap_pair(v)
 
 #define FTOI_F32_I32(v)              ((v) > (float)INT32_MAX ? INT32_MAX : (v) < (float)INT32_MIN ? INT32_MIN : (int32_t)(v))
 #define FTOI_F64_I32(v)              ((v) > (double)INT32_MAX ? INT32_MAX : (v) < (double)INT32_MIN ? INT32_MIN : (int32_t)(v))
@@ -309,6 +321,10 @@ typedef int32_t int128_t[4];
                                       vmul_f32_el((a)[2], (b)[2]), \
                                       vmul_f32_el((a)[3], (b)[3])}
 #define VDOT_F32(a, b)               vdot_f32(a, b)
+#define VMADD_F32(a, b, c)           {vmadd_f32_el((a)[0], (b)[0], (c)[0]), \
+                                      vmadd_f32_el((a)[1], (b)[1], (c)[1]), \
+                                      vmadd_f32_el((a)[2], (b)[2], (c)[2]), \
+                                      vmadd_f32_el((a)[3], (b)[3], (c)[3])}
 
 #define AND_I8(a, b)                 ((a) & (b))
 #define AND_I16                      AND_I8
@@ -375,6 +391,9 @@ typedef int32_t int128_t[4];
 #define BRANCH_I32(d)                (CTX->pc = d)
 #define BRANCH_IMM_I32               BRANCH_I32
 #define BRANCH_COND_IMM_I32(c, t, f) { CTX->pc = c ? t : f; return; }
+#define CALL_I32(d, r)               BRANCH_I32(d)
+#define CALL_IMM_I32                 CALL_I32
+#define RETURN_I32                   BRANCH_I32
 
 #define INVALID_INSTR()              guest->invalid_instr(guest->data)
 
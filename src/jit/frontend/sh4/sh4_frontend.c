@@ -2,21 +2,32 @@
 #include "jit/frontend/sh4/sh4_disasm.h"
 #include "jit/frontend/sh4/sh4_fallback.h"
 #include "jit/frontend/sh4/sh4_guest.h"
+#include "jit/frontend/sh4/sh4_runtime.h"
 #include "jit/frontend/sh4/sh4_translate.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
 #include "jit/jit_frontend.h"
 #include "jit/jit_guest.h"
+#include "options.h"
 
 /*
- * fsca estimate lookup table, used by the jit and interpreter
+ * fsca estimate lookup table, used by the jit and interpreter. each entry is
+ * stored as {cos, sin}, matching the swizzled layout of the fr pair it's
+ * written to, so the pair can be written with a single 64-bit move
  */
-uint32_t sh4_fsca_table[0x20000] = {
+const uint32_t sh4_fsca_table[0x20000] = {
 #include "jit/frontend/sh4/sh4_fsca.inc"
 };
 
+/* maximum number of guest basic blocks chained together into a single trace */
+#define SH4_MAX_TRACE_BLOCKS 4
+
+/* maximum size in bytes of a guest function compiled as a single unit */
+#define SH4_MAX_FUNCTION_SIZE 1024
+
 struct sh4_frontend {
   struct jit_frontend;
+  struct sh4_runtime *runtime;
 };
 
 static const struct jit_opdef *sh4_frontend_lookup_op(struct jit_frontend *base,
@@ -38,20 +49,137 @@ static int sh4_frontend_is_terminator(struct jit_opdef *def) {
   return 0;
 }
 
+static int sh4_frontend_is_trace_branch(struct jit_opdef *def) {
+  /* conditional branches without a delay slot are followed through their
+     fallthrough path when forming traces, with the taken path becoming a side
+     exit. branches with delay slots aren't followed, as the delay slot is
+     emitted on both paths of the branch */
+  return def->op == SH4_OP_BT || def->op == SH4_OP_BF;
+}
+
+/* register masks used when analyzing idle loops, bits 0-15 map to r0-r15 */
+#define SH4_IDLE_R(n) (1u << (n))
+#define SH4_IDLE_T (1u << 16)
+
+static int sh4_frontend_idle_regs(union sh4_instr instr, struct jit_opdef *def,
+                                  uint32_t *reads, uint32_t *writes) {
+  uint32_t rm = SH4_IDLE_R(instr.def.rm);
+  uint32_t rn = SH4_IDLE_R(instr.def.rn);
+  uint32_t r0 = SH4_IDLE_R(0);
+
+  *reads = 0;
+  *writes = 0;
+
+  /* only instructions without side effects outside of the general registers
+     and the t bit may be part of an idle loop */
+  switch (def->op) {
+    case SH4_OP_NOP:
+    case SH4_OP_BRA:
+      return 1;
+    case SH4_OP_BT:
+    case SH4_OP_BF:
+    case SH4_OP_BTS:
+    case SH4_OP_BFS:
+      *reads = SH4_IDLE_T;
+      return 1;
+    case SH4_OP_MOVI:
+    case SH4_OP_MOVWL_PCR:
+    case SH4_OP_MOVLL_PCR:
+      *writes = rn;
+      return 1;
+    case SH4_OP_MOV:
+    case SH4_OP_MOVBL_IND:
+    case SH4_OP_MOVWL_IND:
+    case SH4_OP_MOVLL_IND:
+    case SH4_OP_MOVLL_OFF:
+    case SH4_OP_EXTSB:
+    case SH4_OP_EXTSW:
+    case SH4_OP_EXTUB:
+    case SH4_OP_EXTUW:
+      *reads = rm;
+      *writes = rn;
+      return 1;
+    case SH4_OP_MOVBL_OFF:
+    case SH4_OP_MOVWL_OFF:
+      *reads = rm;
+      *writes = r0;
+      return 1;
+    case SH4_OP_MOVBL_IDX:
+    case SH4_OP_MOVWL_IDX:
+    case SH4_OP_MOVLL_IDX:
+      *reads = r0 | rm;
+      *writes = rn;
+      return 1;
+    case SH4_OP_MOVBL_GBR:
+    case SH4_OP_MOVWL_GBR:
+    case SH4_OP_MOVLL_GBR:
+      *writes = r0;
+      return 1;
+    case SH4_OP_MOVT:
+      *reads = SH4_IDLE_T;
+      *writes = rn;
+      return 1;
+    case SH4_OP_AND:
+      *reads = rm | rn;
+      *writes = rn;
+      return 1;
+    case SH4_OP_ANDI:
+      *reads = r0;
+      *writes = r0;
+      return 1;
+    case SH4_OP_CMPEQ:
+    case SH4_OP_CMPHS:
+    case SH4_OP_CMPGE:
+    case SH4_OP_CMPHI:
+    case SH4_OP_CMPGT:
+    case SH4_OP_CMPSTR:
+    case SH4_OP_TST:
+      *reads = rm | rn;
+      *writes = SH4_IDLE_T;
+      return 1;
+    case SH4_OP_CMPPZ:
+    case SH4_OP_CMPPL:
+      *reads = rn;
+      *writes = SH4_IDLE_T;
+      return 1;
+    case SH4_OP_CMPEQI:
+    case SH4_OP_TSTI:
+      *reads = r0;
+      *writes = SH4_IDLE_T;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
 static int sh4_frontend_is_idle_loop(struct sh4_frontend *frontend,
                                      uint32_t begin_addr) {
   struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
 
-  /* look ahead to see if the current basic block is an idle loop */
+  /* look ahead to see if the current basic block is an idle loop. an idle loop
+     is a block which branches back to itself, only polling memory and testing
+     the result. control can only leave the loop once the polled memory is
+     changed by another device, so every iteration until the next scheduled
+     event is equivalent and can be skipped */
   static int IDLE_MASK = SH4_FLAG_LOAD | SH4_FLAG_COND | SH4_FLAG_CMP;
-  int idle_loop = 1;
   int all_flags = 0;
   int offset = 0;
 
+  /* for an iteration to be equivalent to the previous one, no register may be
+     read before being written if it's also written by the loop */
+  uint32_t live_in = 0;
+  uint32_t written = 0;
+
   while (1) {
     uint32_t addr = begin_addr + offset;
     uint16_t data = guest->r16(guest->mem, addr);
+    union sh4_instr instr = {data};
     struct jit_opdef *def = sh4_get_opdef(data);
+    uint32_t reads, writes;
+
+    if (!sh4_frontend_idle_regs(instr, def, &reads, &writes)) {
+      return 0;
+    }
 
     offset += 2;
     all_flags |= def->flags;
@@ -59,33 +187,74 @@ static int sh4_frontend_is_idle_loop(struct sh4_frontend *frontend,
     if (def->flags & SH4_FLAG_DELAYED) {
       uint32_t delay_addr = begin_addr + offset;
       uint16_t delay_data = guest->r16(guest->mem, delay_addr);
+      union sh4_instr delay_instr = {delay_data};
       struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
+      uint32_t delay_reads, delay_writes;
+
+      if (!sh4_frontend_idle_regs(delay_instr, delay_def, &delay_reads,
+                                  &delay_writes)) {
+        return 0;
+      }
+
+      /* the delay slot executes before the branch reads the t bit */
+      live_in |= delay_reads & ~written;
+      written |= delay_writes;
 
       offset += 2;
       all_flags |= delay_def->flags;
     }
 
+    live_in |= reads & ~written;
+    written |= writes;
+
     if (sh4_frontend_is_terminator(def)) {
       /* if the block doesn't contain the required flags, disqualify */
-      idle_loop &= (all_flags & IDLE_MASK) == IDLE_MASK;
-
-      /* if the branch isn't a short back edge, disqualify */
-      if (def->flags & SH4_FLAG_STORE_PC) {
-        union sh4_instr instr = {data};
-
-        int branch_type;
-        uint32_t branch_addr;
-        uint32_t next_addr;
-        sh4_branch_info(addr, instr, &branch_type, &branch_addr, &next_addr);
+      if ((all_flags & IDLE_MASK) != IDLE_MASK) {
+        return 0;
+      }
 
-        idle_loop &= (begin_addr - branch_addr) <= 32;
+      /* if the loop carries state between iterations, disqualify */
+      if (live_in & written) {
+        return 0;
       }
 
-      break;
+      /* if the branch doesn't loop back to the block's start, disqualify */
+      int branch_type;
+      uint32_t branch_addr;
+      uint32_t next_addr;
+      sh4_branch_info(addr, instr, &branch_type, &branch_addr, &next_addr);
+
+      return branch_addr == begin_addr;
     }
   }
+}
+
+static void sh4_frontend_yield_idle_loop(struct ir *ir, uint32_t begin_addr) {
+  struct ir_block *block = list_last_entry(&ir->blocks, struct ir_block, it);
+  struct ir_instr *tail = list_last_entry(&block->instrs, struct ir_instr, it);
+  struct ir_instr *prev = list_prev_entry(tail, struct ir_instr, it);
+
+  /* exhaust the remaining cycles when taking the back edge, exiting to
+     dispatch on the next iteration and fast-forwarding to the next scheduled
+     event */
+  ir_set_current_instr(ir, prev);
+
+  size_t offset = offsetof(struct sh4_context, run_cycles);
+  struct ir_value *idle = ir_alloc_i32(ir, -1);
+
+  if (tail->op == OP_BRANCH) {
+    ir_store_context(ir, offset, idle);
+    return;
+  }
+
+  CHECK_EQ(tail->op, OP_BRANCH_COND);
+
+  struct ir_value *run = ir_load_context(ir, offset, VALUE_I32);
+  struct ir_value *cond = tail->arg[2];
+  int taken = (uint32_t)tail->arg[0]->i32 == begin_addr;
 
-  return idle_loop;
+  ir_store_context(ir, offset, taken ? ir_select(ir, cond, idle, run)
+                                     : ir_select(ir, cond, run, idle));
 }
 
 static void sh4_frontend_dump_code(struct jit_frontend *base,
@@ -125,19 +294,417 @@ static void sh4_frontend_dump_code(struct jit_frontend *base,
   }
 }
 
-static void sh4_frontend_translate_code(struct jit_frontend *base,
-                                        uint32_t begin_addr, int size,
-                                        struct ir *ir) {
+static uint32_t sh4_frontend_translate_flags(struct jit_frontend *base) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
+
+  return ctx->fpscr & (PR_MASK | SZ_MASK);
+}
+
+enum {
+  SH4_LABEL_INSTR = 0x1,
+  SH4_LABEL_TARGET = 0x2,
+};
+
+static void sh4_frontend_label_code(struct sh4_frontend *frontend,
+                                    uint32_t begin_addr, int size,
+                                    int8_t *labels) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+
+  int offset = 0;
+
+  /* flag each instruction (excluding delay slots) that is the target of a
+     static branch inside of the trace. these instructions begin their own ir
+     block, enabling the branch to be made locally */
+  while (offset < size) {
+    uint32_t addr = begin_addr + offset;
+    uint16_t data = guest->r16(guest->mem, addr);
+    union sh4_instr instr = {data};
+    struct jit_opdef *def = sh4_get_opdef(data);
+
+    labels[offset / 2] |= SH4_LABEL_INSTR;
+
+    if (def->flags & SH4_FLAG_STORE_PC) {
+      int branch_type;
+      uint32_t branch_addr;
+      uint32_t next_addr;
+      sh4_branch_info(addr, instr, &branch_type, &branch_addr, &next_addr);
+
+      if (branch_type == SH4_BRANCH_STATIC ||
+          branch_type == SH4_BRANCH_STATIC_TRUE ||
+          branch_type == SH4_BRANCH_STATIC_FALSE) {
+        if (branch_addr >= begin_addr && branch_addr < begin_addr + size) {
+          labels[(branch_addr - begin_addr) / 2] |= SH4_LABEL_TARGET;
+        }
+      }
+    }
+
+    offset += 2;
+
+    if (def->flags & SH4_FLAG_DELAYED) {
+      offset += 2;
+    }
+  }
+}
+
+static void sh4_frontend_begin_block(struct ir *ir, uint32_t addr) {
+  struct ir_block *block = list_last_entry(&ir->blocks, struct ir_block, it);
+  struct ir_instr *tail = list_last_entry(&block->instrs, struct ir_instr, it);
+
+  /* terminate the current block, falling through to the new one */
+  if (tail) {
+    if (tail->op != OP_BRANCH && tail->op != OP_BRANCH_COND) {
+      ir_branch(ir, ir_alloc_i32(ir, addr));
+    }
+
+    block = ir_append_block(ir);
+  }
+
+  ir_set_meta(ir, block, IR_META_ADDR, ir_alloc_i32(ir, addr));
+}
+
+static void sh4_frontend_link_blocks(struct ir *ir) {
+  /* convert static branches to addresses inside of the trace into local
+     branches */
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    struct ir_instr *tail =
+        list_last_entry(&block->instrs, struct ir_instr, it);
+
+    if (!tail || (tail->op != OP_BRANCH && tail->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    int num_targets = tail->op == OP_BRANCH ? 1 : 2;
+
+    for (int i = 0; i < num_targets; i++) {
+      struct ir_value *target = tail->arg[i];
+
+      if (!ir_is_constant(target) || target->type != VALUE_I32) {
+        continue;
+      }
+
+      list_for_each_entry(other, &ir->blocks, struct ir_block, it) {
+        struct ir_value *addr = ir_get_meta(ir, other, IR_META_ADDR);
+
+        if (addr && addr->i32 == target->i32) {
+          ir_set_arg(ir, tail, i, ir_alloc_block_ref(ir, other));
+          break;
+        }
+      }
+    }
+  }
+}
+
+static void sh4_frontend_guard_fpscr(struct sh4_frontend *frontend,
+                                     struct ir *ir, uint32_t begin_addr) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
+
+  struct ir_block *body = list_first_entry(&ir->blocks, struct ir_block, it);
+  struct ir_block *guard = ir_insert_block(ir, NULL);
+  struct ir_block *miss = ir_insert_block(ir, guard);
+
+  /* neither block has executed any guest code yet when branched to */
+  struct ir_value *addr = ir_alloc_i32(ir, begin_addr);
+  ir_set_meta(ir, guard, IR_META_ADDR, addr);
+  ir_set_meta(ir, miss, IR_META_ADDR, addr);
+
+  /* check that the run-time fpscr state matches the compile-time state */
+  ir_set_current_block(ir, guard);
+
+  struct ir_value *actual =
+      ir_load_context(ir, offsetof(struct sh4_context, fpscr), VALUE_I32);
+  actual = ir_and(ir, actual, ir_alloc_i32(ir, PR_MASK | SZ_MASK));
+  struct ir_value *expected =
+      ir_alloc_i32(ir, ctx->fpscr & (PR_MASK | SZ_MASK));
+  struct ir_value *match = ir_cmp_eq(ir, actual, expected);
+  ir_branch_cond(ir, match, ir_alloc_block_ref(ir, body),
+                 ir_alloc_block_ref(ir, miss));
+
+  /* if it doesn't, have the dispatch select the version of the block compiled
+     for the current state */
+  ir_set_current_block(ir, miss);
+
+  struct ir_value *uncache = ir_alloc_ptr(ir, guest->uncache_code);
+  struct ir_value *data = ir_alloc_ptr(ir, guest->data);
+  ir_call_2(ir, uncache, data, addr);
+  ir_branch(ir, addr);
+}
+
+/*
+ * division idiom
+ *
+ * the sh4 has no divide instruction, compilers instead emit a div0u / div0s
+ * followed by 32 rotcl / div1 pairs, each shifting a quotient bit into the
+ * low word of the dividend, and a final rotcl. translated step by step, that's
+ * hundreds of ir instructions for a single divide
+ *
+ * when the high word of the dividend starts out smaller in magnitude than the
+ * divisor, the steps perform a true division and the registers and flags they
+ * leave behind have a closed form in terms of a single native divide. the
+ * sequence is still translated step by step as a slow path for other inputs,
+ * e.g. code using it for a 64-bit dividend
+ */
+#define SH4_DIV_STEPS 32
+#define SH4_DIV_SIZE ((SH4_DIV_STEPS * 2 + 1) * 2)
+
+#define SH4_LOAD_GPR(n) \
+  ir_load_context(ir, offsetof(struct sh4_context, r[n]), VALUE_I32)
+#define SH4_STORE_GPR(n, v) \
+  ir_store_context(ir, offsetof(struct sh4_context, r[n]), v)
+
+static int sh4_frontend_match_div(struct sh4_frontend *frontend,
+                                  uint32_t begin_addr, int offset, int size,
+                                  const int8_t *labels, union sh4_instr div0,
+                                  int *rq, int *rd, int *rr) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+
+  /* the sequence must be followed by at least one more instruction, leaving
+     the block it ends in non-empty */
+  if (offset + SH4_DIV_SIZE >= size) {
+    return 0;
+  }
+
+  union sh4_instr rotcl = {guest->r16(guest->mem, begin_addr + offset)};
+  union sh4_instr div1 = {guest->r16(guest->mem, begin_addr + offset + 2)};
+
+  if (sh4_get_op(rotcl.raw) != SH4_OP_ROTCL ||
+      sh4_get_op(div1.raw) != SH4_OP_DIV1) {
+    return 0;
+  }
+
+  *rq = rotcl.def.rn;
+  *rd = div1.def.rm;
+  *rr = div1.def.rn;
+
+  if (*rq == *rd || *rq == *rr || *rd == *rr) {
+    return 0;
+  }
+
+  if (sh4_get_op(div0.raw) == SH4_OP_DIV0S &&
+      (div0.def.rm != *rd || div0.def.rn != *rr)) {
+    return 0;
+  }
+
+  if (!sh4_get_translator(rotcl.raw) || !sh4_get_translator(div1.raw)) {
+    return 0;
+  }
+
+  /* nothing may branch into the middle of the sequence */
+  for (int i = 0; i < SH4_DIV_STEPS * 2 + 1; i++) {
+    int instr_offset = offset + i * 2;
+    uint16_t data = guest->r16(guest->mem, begin_addr + instr_offset);
+
+    if (data != ((i & 1) ? div1.raw : rotcl.raw) ||
+        (labels[instr_offset / 2] & SH4_LABEL_TARGET)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void sh4_frontend_translate_udiv(struct ir *ir, int rq, int rd,
+                                        int rr) {
+  /* the quotient lands in the low word. the remainder is left in the high
+     word, minus the divisor when the quotient is even as the last step
+     didn't restore it */
+  struct ir_value *d = ir_zext(ir, SH4_LOAD_GPR(rd), VALUE_I64);
+  struct ir_value *hi = ir_zext(ir, SH4_LOAD_GPR(rr), VALUE_I64);
+  struct ir_value *lo = ir_zext(ir, SH4_LOAD_GPR(rq), VALUE_I64);
+  struct ir_value *n = ir_or(ir, ir_shli(ir, hi, 32), lo);
+  struct ir_value *q = ir_udiv(ir, n, d);
+  struct ir_value *r = ir_trunc(ir, ir_sub(ir, n, ir_umul(ir, q, d)),
+                                VALUE_I32);
+
+  q = ir_trunc(ir, q, VALUE_I32);
+  struct ir_value *odd = ir_and(ir, q, ir_alloc_i32(ir, 1));
+  struct ir_value *even_mask = ir_sub(ir, odd, ir_alloc_i32(ir, 1));
+  r = ir_sub(ir, r, ir_and(ir, ir_trunc(ir, d, VALUE_I32), even_mask));
+
+  SH4_STORE_GPR(rq, q);
+  SH4_STORE_GPR(rr, r);
+  ir_store_context(ir, offsetof(struct sh4_context, sr_m), ir_alloc_i32(ir, 0));
+  ir_store_context(ir, offsetof(struct sh4_context, sr_qm),
+                   ir_shli(ir, odd, 31));
+  ir_store_context(ir, offsetof(struct sh4_context, sr_t), ir_alloc_i32(ir, 0));
+}
+
+static void sh4_frontend_translate_sdiv(struct ir *ir, int rq, int rd,
+                                        int rr) {
+  /* the steps divide by the divisor's magnitude e, rounding the quotient to
+     an odd number. with n the dividend, the odd quotient is 2k - 1 for
+     k = floor(n / 2e) + 1. biasing n by e << 32 keeps the divide unsigned,
+     with the bias contributing exactly 1 << 31 to the quotient */
+  struct ir_value *d32 = SH4_LOAD_GPR(rd);
+  struct ir_value *hi32 = SH4_LOAD_GPR(rr);
+  struct ir_value *d = ir_sext(ir, d32, VALUE_I64);
+  struct ir_value *hi = ir_sext(ir, hi32, VALUE_I64);
+  struct ir_value *lo = ir_zext(ir, SH4_LOAD_GPR(rq), VALUE_I64);
+  struct ir_value *sign = ir_ashri(ir, d, 63);
+  struct ir_value *e = ir_sub(ir, ir_xor(ir, d, sign), sign);
+  struct ir_value *n = ir_add(ir, ir_shli(ir, hi, 32), lo);
+  struct ir_value *k = ir_udiv(ir, ir_add(ir, n, ir_shli(ir, e, 32)),
+                               ir_shli(ir, e, 1));
+  struct ir_value *odd = ir_sub(ir, ir_shli(ir, k, 1),
+                                ir_alloc_i64(ir, 0xffffffff));
+
+  /* the remainder is relative to the odd quotient, negative when n was
+     below it. the quotient register ends up holding the signed quotient,
+     minus one unless the sign of the remainder matches the divisor's */
+  struct ir_value *r = ir_sub(ir, n, ir_umul(ir, e, odd));
+  struct ir_value *m = ir_lshri(ir, d32, 31);
+  struct ir_value *qn = ir_trunc(ir, ir_lshri(ir, r, 63), VALUE_I32);
+  struct ir_value *qm = ir_xor(ir, ir_xor(ir, qn, m), ir_alloc_i32(ir, 1));
+  struct ir_value *q = ir_trunc(ir, ir_sub(ir, ir_xor(ir, odd, sign), sign),
+                                VALUE_I32);
+  q = ir_add(ir, ir_sub(ir, q, ir_alloc_i32(ir, 1)), qm);
+
+  SH4_STORE_GPR(rq, q);
+  SH4_STORE_GPR(rr, ir_trunc(ir, r, VALUE_I32));
+  ir_store_context(ir, offsetof(struct sh4_context, sr_m), m);
+  ir_store_context(ir, offsetof(struct sh4_context, sr_qm),
+                   ir_shli(ir, qm, 31));
+  ir_store_context(ir, offsetof(struct sh4_context, sr_t),
+                   ir_xor(ir, ir_lshri(ir, hi32, 31), m));
+}
+
+static int sh4_frontend_translate_div(struct sh4_frontend *frontend,
+                                      struct ir *ir, uint32_t begin_addr,
+                                      int offset, int size,
+                                      const int8_t *labels,
+                                      union sh4_instr div0, int flags) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  int sign = sh4_get_op(div0.raw) == SH4_OP_DIV0S;
+  int rq, rd, rr;
+
+  if (!sh4_frontend_match_div(frontend, begin_addr, offset, size, labels, div0,
+                              &rq, &rd, &rr)) {
+    return 0;
+  }
+
+  uint32_t addr = begin_addr + offset;
+  uint32_t end_addr = addr + SH4_DIV_SIZE;
+
+  /* check that the closed form applies */
+  struct ir_value *valid = NULL;
+
+  if (sign) {
+    struct ir_value *d = ir_sext(ir, SH4_LOAD_GPR(rd), VALUE_I64);
+    struct ir_value *hi = ir_sext(ir, SH4_LOAD_GPR(rr), VALUE_I64);
+    struct ir_value *mask = ir_ashri(ir, d, 63);
+    struct ir_value *e = ir_sub(ir, ir_xor(ir, d, mask), mask);
+    valid = ir_cmp_ult(ir, ir_add(ir, hi, e), ir_shli(ir, e, 1));
+  } else {
+    valid = ir_cmp_ult(ir, SH4_LOAD_GPR(rr), SH4_LOAD_GPR(rd));
+  }
+
+  struct ir_insert_point point = ir_get_insert_point(ir);
+  struct ir_block *fast = ir_append_block(ir);
+  struct ir_block *slow = ir_append_block(ir);
+  struct ir_block *join = ir_append_block(ir);
+  ir_set_meta(ir, fast, IR_META_ADDR, ir_alloc_i32(ir, addr));
+  ir_set_meta(ir, slow, IR_META_ADDR, ir_alloc_i32(ir, addr));
+  ir_set_meta(ir, join, IR_META_ADDR, ir_alloc_i32(ir, end_addr));
+
+  ir_set_insert_point(ir, &point);
+  ir_branch_cond(ir, valid, ir_alloc_block_ref(ir, fast),
+                 ir_alloc_block_ref(ir, slow));
+
+  /* both paths account for each instruction of the sequence, keeping the
+     cycle counts exact */
+  ir_set_current_block(ir, fast);
+
+  for (int i = 0; i < SH4_DIV_STEPS * 2 + 1; i++) {
+    uint32_t instr_addr = addr + i * 2;
+    uint16_t data = guest->r16(guest->mem, instr_addr);
+    ir_source_info(ir, instr_addr, sh4_get_opdef(data)->cycles);
+  }
+
+  if (sign) {
+    sh4_frontend_translate_sdiv(ir, rq, rd, rr);
+  } else {
+    sh4_frontend_translate_udiv(ir, rq, rd, rr);
+  }
+
+  ir_branch(ir, ir_alloc_i32(ir, end_addr));
+
+  ir_set_current_block(ir, slow);
+
+  for (int i = 0; i < SH4_DIV_STEPS * 2 + 1; i++) {
+    uint32_t instr_addr = addr + i * 2;
+    uint16_t data = guest->r16(guest->mem, instr_addr);
+    union sh4_instr instr = {data};
+    struct ir_insert_point delay_point;
+
+    ir_source_info(ir, instr_addr, sh4_get_opdef(data)->cycles);
+    sh4_get_translator(data)(guest, ir, instr_addr, instr, flags,
+                             &delay_point);
+  }
+
+  ir_branch(ir, ir_alloc_i32(ir, end_addr));
+
+  ir_set_current_block(ir, join);
+
+  return SH4_DIV_SIZE;
+}
+
+static int sh4_frontend_lookup_routine(struct sh4_frontend *frontend,
+                                       uint32_t begin_addr, int *size) {
+  if (!OPTION_jit_runtime) {
+    return -1;
+  }
+
+  return sh4_runtime_lookup(frontend->runtime, frontend->guest, begin_addr,
+                            size);
+}
+
+static void sh4_frontend_translate_routine(struct sh4_frontend *frontend,
+                                           uint32_t begin_addr, int routine,
+                                           struct ir *ir) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+
+  /* run the native implementation in place of the routine, returning to its
+     caller like its rts would have. fallbacks are counted by the op their
+     instruction decodes to, the routine's index is passed above its first
+     instruction */
+  uint16_t data = guest->r16(guest->mem, begin_addr);
+  ir_source_info(ir, begin_addr, 1);
+  ir_fallback(ir, &sh4_runtime_call, begin_addr,
+              ((uint32_t)routine << 16) | data);
+
+  struct ir_value *dest_addr =
+      ir_load_context(ir, offsetof(struct sh4_context, pr), VALUE_I32);
+  ir_branch_return(ir, dest_addr);
+}
+
+static uint32_t sh4_frontend_translate_code(struct jit_frontend *base,
+                                            uint32_t begin_addr, int size,
+                                            struct ir *ir) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
   struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
   struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
 
   int offset = 0;
   int use_fpscr = 0;
-  int was_delay = 0;
 
   /* append inital block */
   struct ir_block *block = ir_append_block(ir);
+  ir_set_meta(ir, block, IR_META_ADDR, ir_alloc_i32(ir, begin_addr));
+
+  int routine_size;
+  int routine = sh4_frontend_lookup_routine(frontend, begin_addr,
+                                            &routine_size);
+
+  if (!guest->tlb && routine >= 0 && routine_size == size) {
+    sh4_frontend_translate_routine(frontend, begin_addr, routine, ir);
+    return 0;
+  }
+
+  /* find the instructions which need to start a new block */
+  int8_t *labels = calloc(size / 2, sizeof(int8_t));
+  sh4_frontend_label_code(frontend, begin_addr, size, labels);
 
   /* generate code specialized for the current fpscr state */
   int flags = 0;
@@ -148,32 +715,38 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     flags |= SH4_DOUBLE_SZ;
   }
 
-  /* cheap idle skip. in an idle loop, the block is just spinning, waiting for
-     an interrupt such as vblank before it'll exit. scale the block's number of
-     cycles in order to yield execution faster, enabling the interrupt to
-     actually be generated */
-  int idle_loop = sh4_frontend_is_idle_loop(frontend, begin_addr);
-  int cycle_scale = idle_loop ? 8 : 1;
+  /* in an idle loop, the block is just spinning, waiting for an interrupt such
+     as vblank before it'll exit. rather than burning through the remaining
+     cycles, yield execution so the next event is generated immediately. each
+     guest basic block starting a new ir block is checked, as traces can lead
+     into an idle loop */
+  int begin_block = 1;
+  int idle_loop = 0;
+  uint32_t idle_addr = 0;
 
   while (offset < size) {
-    /* if a branch instruction / delay slot was just emitted, rewind and emit
-       the delay slot as its own instruction */
-    if (was_delay) {
-      offset -= 2;
-      was_delay = 0;
-    }
-
     uint32_t addr = begin_addr + offset;
     uint16_t data = guest->r16(guest->mem, addr);
     union sh4_instr instr = {data};
     struct jit_opdef *def = sh4_get_opdef(data);
 
+    if (offset && (labels[offset / 2] & SH4_LABEL_TARGET)) {
+      sh4_frontend_begin_block(ir, addr);
+      begin_block = 1;
+    }
+
+    if (begin_block && !idle_loop) {
+      idle_loop = sh4_frontend_is_idle_loop(frontend, addr);
+      idle_addr = addr;
+    }
+    begin_block = 0;
+
     use_fpscr |= (def->flags & SH4_FLAG_USE_FPSCR) == SH4_FLAG_USE_FPSCR;
 
     /* emit meta information for the current guest instruction. this info is
        essential to the jit, and is used to map guest instructions to host
        addresses for branching and fastmem access */
-    ir_source_info(ir, addr, def->cycles * cycle_scale);
+    ir_source_info(ir, addr, def->cycles);
 
     /* the pc is normally only written to the context at the end of the block,
        sync now for any instruction which needs to read the correct pc */
@@ -224,7 +797,6 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
         ir_set_insert_point(ir, &original);
 
         offset += 2;
-        was_delay = 1;
       }
     } else {
       ir_fallback(ir, def->fallback, addr, data);
@@ -235,10 +807,19 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
          execute it */
       if (def->flags & SH4_FLAG_DELAYED) {
         offset += 2;
-        was_delay = 1;
       }
     }
 
+    if (def->op == SH4_OP_DIV0U || def->op == SH4_OP_DIV0S) {
+      offset += sh4_frontend_translate_div(frontend, ir, begin_addr, offset,
+                                           size, labels, instr, flags);
+    }
+
+    if (idle_loop && sh4_frontend_is_terminator(def)) {
+      sh4_frontend_yield_idle_loop(ir, idle_addr);
+      idle_loop = 0;
+    }
+
     /* there are 3 possible block endings:
 
        1.) the block terminates due to an unconditional branch; nothing needs to
@@ -251,42 +832,188 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
            not a branch (e.g. an invalid instruction trap); nothing needs to be
            done dispatch will always implicitly branch to the next pc */
     int store_pc = (def->flags & SH4_FLAG_STORE_PC) == SH4_FLAG_STORE_PC;
-    int end_of_block = sh4_frontend_is_terminator(def) || offset >= size;
-
-    if (end_of_block) {
-      if (!store_pc) {
-        struct ir_block *tail_block =
-            list_last_entry(&ir->blocks, struct ir_block, it);
-        struct ir_instr *tail_instr =
-            list_last_entry(&tail_block->instrs, struct ir_instr, it);
-        ir_set_current_instr(ir, tail_instr);
-
-        uint32_t next_addr = begin_addr + offset;
-        ir_branch(ir, ir_alloc_i32(ir, next_addr));
-      }
+    int terminator = sh4_frontend_is_terminator(def);
+    int end_of_block = terminator || offset >= size;
+
+    if (end_of_block && !store_pc) {
+      struct ir_block *tail_block =
+          list_last_entry(&ir->blocks, struct ir_block, it);
+      struct ir_instr *tail_instr =
+          list_last_entry(&tail_block->instrs, struct ir_instr, it);
+      ir_set_current_instr(ir, tail_instr);
+
+      uint32_t next_addr = begin_addr + offset;
+      ir_branch(ir, ir_alloc_i32(ir, next_addr));
     }
+
+    /* code after a terminator inside of the trace is either a conditional
+       branch's fallthrough path, or the target of another branch inside of
+       a function. either way, it begins a new block */
+    if (terminator && offset < size) {
+      sh4_frontend_begin_block(ir, begin_addr + offset);
+      begin_block = 1;
+    }
+  }
+
+  sh4_frontend_link_blocks(ir);
+  free(labels);
+
+  /* if the block makes optimizations based on the fpscr state, it's
+     versioned on it */
+  if (!use_fpscr) {
+    return 0;
+  }
+
+  sh4_frontend_guard_fpscr(frontend, ir, begin_addr);
+
+  return PR_MASK | SZ_MASK;
+}
+
+static int sh4_frontend_is_call_target(struct sh4_frontend *frontend,
+                                       uint32_t addr) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
+
+  /* code is compiled when it's first branched to, if the guest just called
+     the address the call sits right before the return address in pr. pr may
+     be stale, only look at it if it's directly accessible */
+  uint32_t call_addr = ctx->pr - 4;
+  uint8_t *ptr = NULL;
+  guest->lookup(guest->mem, call_addr, NULL, &ptr, NULL, NULL);
+
+  if (!ptr) {
+    return 0;
   }
 
-  /* if the block makes optimizations based on the fpscr state, assert that the
-     run-time fpscr state matches the compile-time state */
-  if (use_fpscr) {
-    /* insert after the first guest marker */
-    struct ir_instr *after = NULL;
-    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
-      if (instr->op == OP_SOURCE_INFO) {
-        after = instr;
+  union sh4_instr instr = {*(uint16_t *)ptr};
+  struct jit_opdef *def = sh4_get_opdef(instr.raw);
+
+  switch (def->op) {
+    case SH4_OP_BSR: {
+      int branch_type;
+      uint32_t branch_addr;
+      uint32_t next_addr;
+      sh4_branch_info(call_addr, instr, &branch_type, &branch_addr,
+                      &next_addr);
+      return branch_addr == addr;
+    }
+    case SH4_OP_BSRF:
+      return ctx->pr + ctx->r[instr.def.rn] == addr;
+    case SH4_OP_JSR:
+      return ctx->r[instr.def.rn] == addr;
+    default:
+      return 0;
+  }
+}
+
+enum {
+  SH4_CFG_INSTR = 0x1,
+  SH4_CFG_DELAY = 0x2,
+  SH4_CFG_EXIT = 0x4,
+};
+
+static int sh4_frontend_analyze_function(struct sh4_frontend *frontend,
+                                         uint32_t begin_addr) {
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+
+  /* discover the function's control flow graph by following its static
+     branches, marking each instruction reached. calls and dynamic branches
+     end a path, with the function eventually being left through its rts */
+  int8_t cfg[SH4_MAX_FUNCTION_SIZE / 2] = {0};
+  int worklist[SH4_MAX_FUNCTION_SIZE / 2];
+  int num_work = 0;
+
+  worklist[num_work++] = 0;
+
+  while (num_work) {
+    int offset = worklist[--num_work];
+
+    /* leave room for a delay slot */
+    while (offset + 4 <= SH4_MAX_FUNCTION_SIZE) {
+      uint32_t addr = begin_addr + offset;
+      uint16_t data = guest->r16(guest->mem, addr);
+      union sh4_instr instr = {data};
+      struct jit_opdef *def = sh4_get_opdef(data);
+      int idx = offset / 2;
+
+      /* a delay slot can't be branched to, as it would need to be emitted
+         both as part of its branch and on its own */
+      if (cfg[idx] & SH4_CFG_DELAY) {
+        return 0;
+      }
+
+      if (cfg[idx]) {
+        break;
+      }
+
+      cfg[idx] = SH4_CFG_INSTR;
+      offset += 2;
+
+      if (def->flags & SH4_FLAG_DELAYED) {
+        uint16_t delay_data = guest->r16(guest->mem, begin_addr + offset);
+        struct jit_opdef *delay_def = sh4_get_opdef(delay_data);
+
+        if (cfg[idx + 1] || (delay_def->flags & SH4_FLAG_DELAYED)) {
+          return 0;
+        }
+
+        cfg[idx + 1] = SH4_CFG_DELAY;
+        offset += 2;
+      }
+
+      if (!sh4_frontend_is_terminator(def)) {
+        continue;
+      }
+
+      /* code following an instruction which changes fpscr or doesn't end in
+         a branch can't be part of the same unit, exiting through it */
+      if (!(def->flags & SH4_FLAG_STORE_PC) || def->op == SH4_OP_RTE ||
+          def->op == SH4_OP_SLEEP || def->op == SH4_OP_TRAPA ||
+          def->op == SH4_OP_INVALID) {
+        cfg[idx] |= SH4_CFG_EXIT;
+        break;
+      }
+
+      int branch_type;
+      uint32_t branch_addr;
+      uint32_t next_addr;
+      sh4_branch_info(addr, instr, &branch_type, &branch_addr, &next_addr);
+
+      if (branch_type == SH4_BRANCH_DYNAMIC || def->op == SH4_OP_BSR) {
         break;
       }
+
+      /* branches backwards out of the function are left to dispatch */
+      if (branch_addr >= begin_addr &&
+          branch_addr - begin_addr < SH4_MAX_FUNCTION_SIZE) {
+        worklist[num_work++] = (int)(branch_addr - begin_addr);
+      }
+
+      if (branch_type == SH4_BRANCH_STATIC) {
+        break;
+      }
+    }
+  }
+
+  /* the unit has to be a contiguous range of guest code, end it at the first
+     instruction not reached, e.g. a literal pool after the rts */
+  int size = 0;
+
+  while (size < SH4_MAX_FUNCTION_SIZE && cfg[size / 2]) {
+    int exit = cfg[size / 2] & SH4_CFG_EXIT;
+
+    size += 2;
+
+    if (size < SH4_MAX_FUNCTION_SIZE && (cfg[size / 2] & SH4_CFG_DELAY)) {
+      size += 2;
     }
-    ir_set_current_instr(ir, after);
 
-    struct ir_value *actual =
-        ir_load_context(ir, offsetof(struct sh4_context, fpscr), VALUE_I32);
-    actual = ir_and(ir, actual, ir_alloc_i32(ir, PR_MASK | SZ_MASK));
-    struct ir_value *expected =
-        ir_alloc_i32(ir, ctx->fpscr & (PR_MASK | SZ_MASK));
-    ir_assert_eq(ir, actual, expected);
+    if (exit) {
+      break;
+    }
   }
+
+  return size;
 }
 
 static void sh4_frontend_analyze_code(struct jit_frontend *base,
@@ -294,6 +1021,33 @@ static void sh4_frontend_analyze_code(struct jit_frontend *base,
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
   struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
 
+  /* while translating, blocks are kept within a single page, the page's
+     translation being checked as the block is compiled. routines and function
+     units may span several */
+  int translated = guest->tlb != NULL;
+
+  /* recognized runtime routines are compiled as a whole into a call to their
+     native implementation */
+  if (!translated &&
+      sh4_frontend_lookup_routine(frontend, begin_addr, size) >= 0) {
+    return;
+  }
+
+  /* idle loops are left as a single block, as their back edge yields */
+  int idle_loop = sh4_frontend_is_idle_loop(frontend, begin_addr);
+  int num_blocks = 1;
+
+  /* functions entered through a call are compiled as a single unit, turning
+     their internal branches into local ones */
+  if (OPTION_jit_functions && !idle_loop && !translated &&
+      sh4_frontend_is_call_target(frontend, begin_addr)) {
+    *size = sh4_frontend_analyze_function(frontend, begin_addr);
+
+    if (*size) {
+      return;
+    }
+  }
+
   *size = 0;
 
   while (1) {
@@ -314,7 +1068,19 @@ static void sh4_frontend_analyze_code(struct jit_frontend *base,
       CHECK(!(delay_def->flags & SH4_FLAG_DELAYED));
     }
 
+    /* pages are at least 1kb */
+    if (translated && !((begin_addr + *size) & 0x3ff)) {
+      break;
+    }
+
     if (sh4_frontend_is_terminator(def)) {
+      /* extend the trace through static conditional branches */
+      if (!idle_loop && sh4_frontend_is_trace_branch(def) &&
+          num_blocks < SH4_MAX_TRACE_BLOCKS) {
+        num_blocks++;
+        continue;
+      }
+
       break;
     }
   }
@@ -323,6 +1089,7 @@ static void sh4_frontend_analyze_code(struct jit_frontend *base,
 static void sh4_frontend_destroy(struct jit_frontend *base) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
 
+  sh4_runtime_destroy(frontend->runtime);
   free(frontend);
 }
 
@@ -330,11 +1097,18 @@ struct jit_frontend *sh4_frontend_create(struct jit_guest *guest) {
   struct sh4_frontend *frontend = calloc(1, sizeof(struct sh4_frontend));
 
   frontend->guest = guest;
+  frontend->runtime = sh4_runtime_create();
   frontend->destroy = &sh4_frontend_destroy;
   frontend->analyze_code = &sh4_frontend_analyze_code;
   frontend->translate_code = &sh4_frontend_translate_code;
+  frontend->translate_flags = &sh4_frontend_translate_flags;
   frontend->dump_code = &sh4_frontend_dump_code;
   frontend->lookup_op = &sh4_frontend_lookup_op;
+  frontend->num_ops = NUM_SH4_OPS;
+  frontend->instr_size = 2;
+  /* mov.l @(disp,pc) loads 4 bytes from up to 255 * 4 + 4 bytes past the
+     last instruction */
+  frontend->literal_range = 1028;
 
   return (struct jit_frontend *)frontend;
 }
@@ -10,7 +10,7 @@ enum {
   SH4_DOUBLE_SZ = 0x2,
 };
 
-extern uint32_t sh4_fsca_table[];
+extern const uint32_t sh4_fsca_table[];
 
 struct jit_frontend *sh4_frontend_create(struct jit_guest *guest);
 
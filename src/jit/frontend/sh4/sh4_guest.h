@@ -121,10 +121,14 @@ struct sh4_context {
   /* the main dispatch loop is ran until run_cycles is <= 0 */
   int32_t run_cycles;
 
+  /* when an interrupt becomes pending while running, the remaining cycles are
+     stashed here and run_cycles is forced negative, yielding to the interrupt
+     at the next block */
+  int32_t yield_cycles;
+  int32_t yielding;
+
   /* debug information */
   int32_t ran_instrs;
-
-  uint8_t cache[0x2000];
 };
 
 static inline void sh4_swap_gpr_bank(struct sh4_context *ctx) {
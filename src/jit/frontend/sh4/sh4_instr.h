@@ -90,10 +90,10 @@ INSTR(MOVBS_DEC) {
   /* decrease Rn by 1 */
   I32 ea = LOAD_GPR_I32(i.def.rn);
   ea = SUB_IMM_I32(ea, 1);
-  STORE_GPR_I32(i.def.rn, ea);
 
-  /* store Rm at (Rn) */
+  /* store Rm at (Rn), Rn is left as is if the store raises a tlb miss */
   STORE_I8(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -105,10 +105,10 @@ INSTR(MOVWS_DEC) {
   /* decrease Rn by 2 */
   I32 ea = LOAD_GPR_I32(i.def.rn);
   ea = SUB_IMM_I32(ea, 2);
-  STORE_GPR_I32(i.def.rn, ea);
 
-  /* store Rm at (Rn) */
+  /* store Rm at (Rn), Rn is left as is if the store raises a tlb miss */
   STORE_I16(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -120,10 +120,10 @@ INSTR(MOVLS_DEC) {
   /* decrease Rn by 4 */
   I32 ea = LOAD_GPR_I32(i.def.rn);
   ea = SUB_IMM_I32(ea, 4);
-  STORE_GPR_I32(i.def.rn, ea);
 
-  /* store Rm at (Rn) */
+  /* store Rm at (Rn), Rn is left as is if the store raises a tlb miss */
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -1093,7 +1093,7 @@ INSTR(BSR) {
   uint32_t dest_addr = ret_addr + disp * 2;
   DELAY_INSTR();
   STORE_PR_IMM_I32(ret_addr);
-  BRANCH_IMM_I32(dest_addr);
+  CALL_IMM_I32(dest_addr, ret_addr);
 }
 
 /* BSRF    Rn */
@@ -1103,7 +1103,7 @@ INSTR(BSRF) {
   I32 dest_addr = ADD_IMM_I32(rn, ret_addr);
   DELAY_INSTR();
   STORE_PR_IMM_I32(ret_addr);
-  BRANCH_I32(dest_addr);
+  CALL_I32(dest_addr, ret_addr);
 }
 
 /* JMP     @Rn */
@@ -1119,14 +1119,14 @@ INSTR(JSR) {
   uint32_t ret_addr = addr + 4;
   DELAY_INSTR();
   STORE_PR_IMM_I32(ret_addr);
-  BRANCH_I32(dest_addr);
+  CALL_I32(dest_addr, ret_addr);
 }
 
 /* RTS */
 INSTR(RTS) {
   I32 dest_addr = LOAD_PR_I32();
   DELAY_INSTR();
-  BRANCH_I32(dest_addr);
+  RETURN_I32(dest_addr);
 }
 
 /* CLRMAC */
@@ -1258,8 +1258,8 @@ INSTR(LDCMDBR) {
 INSTR(LDCMRBANK) {
   int reg = i.def.rm & 0x7;
   I32 ea = LOAD_GPR_I32(i.def.rn);
-  STORE_GPR_I32(i.def.rn, ADD_IMM_I32(ea, 4));
   I32 v = LOAD_I32(ea);
+  STORE_GPR_I32(i.def.rn, ADD_IMM_I32(ea, 4));
   STORE_GPR_ALT_I32(reg, v);
   NEXT_INSTR();
 }
@@ -1451,63 +1451,63 @@ INSTR(STCRBANK) {
 /* STC.L   SR,@-Rn */
 INSTR(STCMSR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_SR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   GBR,@-Rn */
 INSTR(STCMGBR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_GBR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   VBR,@-Rn */
 INSTR(STCMVBR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_VBR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   SSR,@-Rn */
 INSTR(STCMSSR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_SSR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   SPC,@-Rn */
 INSTR(STCMSPC) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_SPC_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   SGR,@-Rn */
 INSTR(STCMSGR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_SGR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STC.L   DBR,@-Rn */
 INSTR(STCMDBR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_DBR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -1515,9 +1515,9 @@ INSTR(STCMDBR) {
 INSTR(STCMRBANK) {
   int reg = i.def.rm & 0x7;
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_GPR_ALT_I32(reg);
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -1545,27 +1545,27 @@ INSTR(STSPR) {
 /* STS.L   MACH,@-Rn */
 INSTR(STSMMACH) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_MACH_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STS.L   MACL,@-Rn */
 INSTR(STSMMACL) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_MACL_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STS.L   PR,@-Rn */
 INSTR(STSMPR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_PR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -1623,14 +1623,11 @@ INSTR(FMOV_LOAD) {
   I32 ea = LOAD_GPR_I32(i.def.rm);
 
   if (FPU_DOUBLE_SZ) {
-    I32 v_lo = LOAD_I32(ea);
-    I32 v_hi = LOAD_I32(ADD_IMM_I32(ea, 4));
+    I64 v = SWAP_PAIR_I64(LOAD_I64(ea));
     if (i.def.rn & 1) {
-      STORE_XFR_I32(i.def.rn & 0xe, v_lo);
-      STORE_XFR_I32(i.def.rn, v_hi);
+      STORE_XFR_I64(i.def.rn & 0xe, v);
     } else {
-      STORE_FPR_I32(i.def.rn, v_lo);
-      STORE_FPR_I32(i.def.rn | 0x1, v_hi);
+      STORE_FPR_I64(i.def.rn, v);
     }
   } else {
     I32 v = LOAD_I32(ea);
@@ -1647,14 +1644,11 @@ INSTR(FMOV_INDEX_LOAD) {
   I32 ea = ADD_I32(LOAD_GPR_I32(0), LOAD_GPR_I32(i.def.rm));
 
   if (FPU_DOUBLE_SZ) {
-    I32 v_lo = LOAD_I32(ea);
-    I32 v_hi = LOAD_I32(ADD_IMM_I32(ea, 4));
+    I64 v = SWAP_PAIR_I64(LOAD_I64(ea));
     if (i.def.rn & 1) {
-      STORE_XFR_I32(i.def.rn & 0xe, v_lo);
-      STORE_XFR_I32(i.def.rn, v_hi);
+      STORE_XFR_I64(i.def.rn & 0xe, v);
     } else {
-      STORE_FPR_I32(i.def.rn, v_lo);
-      STORE_FPR_I32(i.def.rn | 0x1, v_hi);
+      STORE_FPR_I64(i.def.rn, v);
     }
   } else {
     I32 v = LOAD_I32(ea);
@@ -1671,14 +1665,10 @@ INSTR(FMOV_STORE) {
   I32 ea = LOAD_GPR_I32(i.def.rn);
 
   if (FPU_DOUBLE_SZ) {
-    I32 ea_lo = ea;
-    I32 ea_hi = ADD_IMM_I32(ea, 4);
     if (i.def.rm & 1) {
-      STORE_I32(ea_lo, LOAD_XFR_I32(i.def.rm & 0xe));
-      STORE_I32(ea_hi, LOAD_XFR_I32(i.def.rm));
+      STORE_I64(ea, SWAP_PAIR_I64(LOAD_XFR_I64(i.def.rm & 0xe)));
     } else {
-      STORE_I32(ea_lo, LOAD_FPR_I32(i.def.rm));
-      STORE_I32(ea_hi, LOAD_FPR_I32(i.def.rm | 0x1));
+      STORE_I64(ea, SWAP_PAIR_I64(LOAD_FPR_I64(i.def.rm)));
     }
   } else {
     I32 v = LOAD_FPR_I32(i.def.rm);
@@ -1695,14 +1685,10 @@ INSTR(FMOV_INDEX_STORE) {
   I32 ea = ADD_I32(LOAD_GPR_I32(0), LOAD_GPR_I32(i.def.rn));
 
   if (FPU_DOUBLE_SZ) {
-    I32 ea_lo = ea;
-    I32 ea_hi = ADD_IMM_I32(ea, 4);
     if (i.def.rm & 1) {
-      STORE_I32(ea_lo, LOAD_XFR_I32(i.def.rm & 0xe));
-      STORE_I32(ea_hi, LOAD_XFR_I32(i.def.rm));
+      STORE_I64(ea, SWAP_PAIR_I64(LOAD_XFR_I64(i.def.rm & 0xe)));
     } else {
-      STORE_I32(ea_lo, LOAD_FPR_I32(i.def.rm));
-      STORE_I32(ea_hi, LOAD_FPR_I32(i.def.rm | 0x1));
+      STORE_I64(ea, SWAP_PAIR_I64(LOAD_FPR_I64(i.def.rm)));
     }
   } else {
     I32 v = LOAD_FPR_I32(i.def.rm);
@@ -1718,22 +1704,18 @@ INSTR(FMOV_INDEX_STORE) {
 INSTR(FMOV_SAVE) {
   if (FPU_DOUBLE_SZ) {
     I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 8);
-    STORE_GPR_I32(i.def.rn, ea);
-
-    I32 ea_lo = ea;
-    I32 ea_hi = ADD_IMM_I32(ea_lo, 4);
 
     if (i.def.rm & 1) {
-      STORE_I32(ea_lo, LOAD_XFR_I32(i.def.rm & 0xe));
-      STORE_I32(ea_hi, LOAD_XFR_I32(i.def.rm));
+      STORE_I64(ea, SWAP_PAIR_I64(LOAD_XFR_I64(i.def.rm & 0xe)));
     } else {
-      STORE_I32(ea_lo, LOAD_FPR_I32(i.def.rm));
-      STORE_I32(ea_hi, LOAD_FPR_I32(i.def.rm | 0x1));
+      STORE_I64(ea, SWAP_PAIR_I64(LOAD_FPR_I64(i.def.rm)));
     }
+
+    STORE_GPR_I32(i.def.rn, ea);
   } else {
     I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-    STORE_GPR_I32(i.def.rn, ea);
     STORE_I32(ea, LOAD_FPR_I32(i.def.rm));
+    STORE_GPR_I32(i.def.rn, ea);
   }
 
   NEXT_INSTR();
@@ -1746,14 +1728,11 @@ INSTR(FMOV_RESTORE) {
   I32 ea = LOAD_GPR_I32(i.def.rm);
 
   if (FPU_DOUBLE_SZ) {
-    I32 v_lo = LOAD_I32(ea);
-    I32 v_hi = LOAD_I32(ADD_IMM_I32(ea, 4));
+    I64 v = SWAP_PAIR_I64(LOAD_I64(ea));
     if (i.def.rn & 1) {
-      STORE_XFR_I32(i.def.rn & 0xe, v_lo);
-      STORE_XFR_I32(i.def.rn, v_hi);
+      STORE_XFR_I64(i.def.rn & 0xe, v);
     } else {
-      STORE_FPR_I32(i.def.rn, v_lo);
-      STORE_FPR_I32(i.def.rn | 0x1, v_hi);
+      STORE_FPR_I64(i.def.rn, v);
     }
     STORE_GPR_I32(i.def.rm, ADD_IMM_I32(ea, 8));
   } else {
@@ -2085,18 +2064,18 @@ INSTR(STSFPUL) {
 /* STS.L   FPSCR,@-Rn */
 INSTR(STSMFPSCR) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_FPSCR_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
 /* STS.L   FPUL,@-Rn */
 INSTR(STSMFPUL) {
   I32 ea = SUB_IMM_I32(LOAD_GPR_I32(i.def.rn), 4);
-  STORE_GPR_I32(i.def.rn, ea);
   I32 v = LOAD_FPUL_I32();
   STORE_I32(ea, v);
+  STORE_GPR_I32(i.def.rn, ea);
   NEXT_INSTR();
 }
 
@@ -2118,8 +2097,7 @@ INSTR(FSCA) {
   fsca_offset = SHL_IMM_I64(fsca_offset, 3);
 
   I64 ea = ADD_IMM_I64(fsca_offset, (int64_t)sh4_fsca_table);
-  STORE_FPR_F32(i.def.rn, LOAD_HOST_F32(ea));
-  STORE_FPR_F32(i.def.rn + 1, LOAD_HOST_F32(ADD_IMM_I64(ea, 4)));
+  STORE_FPR_I64(i.def.rn, LOAD_HOST_I64(ea));
   NEXT_INSTR();
 }
 
@@ -2135,20 +2113,17 @@ INSTR(FTRV) {
   F32 el1 = LOAD_FPR_F32(n + 1);
   V128 col1 = LOAD_XFR_V128(4);
   V128 row1 = VBROADCAST_F32(el1);
-  V128 prod1 = VMUL_F32(col1, row1);
-  V128 result1 = VADD_F32(result0, prod1);
+  V128 result1 = VMADD_F32(col1, row1, result0);
 
   F32 el2 = LOAD_FPR_F32(n + 2);
   V128 col2 = LOAD_XFR_V128(8);
   V128 row2 = VBROADCAST_F32(el2);
-  V128 prod2 = VMUL_F32(col2, row2);
-  V128 result2 = VADD_F32(result1, prod2);
+  V128 result2 = VMADD_F32(col2, row2, result1);
 
   F32 el3 = LOAD_FPR_F32(n + 3);
   V128 col3 = LOAD_XFR_V128(12);
   V128 row3 = VBROADCAST_F32(el3);
-  V128 prod3 = VMUL_F32(col3, row3);
-  V128 result3 = VADD_F32(result2, prod3);
+  V128 result3 = VMADD_F32(col3, row3, result2);
 
   STORE_FPR_V128(n, result3);
   NEXT_INSTR();
@@ -0,0 +1,260 @@
+#include "jit/frontend/sh4/sh4_runtime.h"
+#include "core/core.h"
+#include "core/hash.h"
+#include "jit/frontend/sh4/sh4_guest.h"
+#include "jit/jit_guest.h"
+
+/* number of bytes hashed to find the candidates for a block, every routine's
+   code is at least this long */
+#define SH4_RUNTIME_PREFIX_SIZE 16
+
+/* smallest page mapped by the mmu, the host memory backing a guest address is
+   only known to be contiguous within it */
+#define SH4_RUNTIME_PAGE_SIZE 1024
+
+typedef int (*sh4_native_cb)(struct jit_guest *, struct sh4_context *);
+
+struct sh4_routine {
+  const char *name;
+  const uint16_t *code;
+  int size;
+  int loop_cycles;
+  sh4_native_cb native;
+};
+
+struct sh4_routine_entry {
+  const struct sh4_routine *routine;
+  uint64_t hash;
+  struct list_node it;
+};
+
+struct sh4_runtime {
+  struct sh4_routine_entry *entries;
+  DECLARE_HASHTABLE(table, 6);
+};
+
+/*
+ * guest memory access. accesses are split at each page, going through host
+ * memory directly when the page is backed by it, and through the guest's
+ * accessors otherwise
+ */
+static int sh4_runtime_chunk(uint32_t addr, uint32_t n) {
+  uint32_t left = SH4_RUNTIME_PAGE_SIZE - (addr & (SH4_RUNTIME_PAGE_SIZE - 1));
+  return (int)MIN(n, left);
+}
+
+static uint8_t *sh4_runtime_ptr(struct jit_guest *guest, uint32_t addr) {
+  uint8_t *ptr = NULL;
+  guest->lookup(guest->mem, addr, NULL, &ptr, NULL, NULL);
+  return ptr;
+}
+
+static void sh4_runtime_memset(struct jit_guest *guest, uint32_t dst,
+                               uint8_t c, uint32_t n) {
+  while (n) {
+    int size = sh4_runtime_chunk(dst, n);
+    uint8_t *ptr = sh4_runtime_ptr(guest, dst);
+
+    if (ptr) {
+      memset(ptr, c, size);
+    } else {
+      for (int i = 0; i < size; i++) {
+        guest->w8(guest->mem, dst + i, c);
+      }
+    }
+
+    dst += size;
+    n -= size;
+  }
+}
+
+static void sh4_runtime_memcpy(struct jit_guest *guest, uint32_t dst,
+                               uint32_t src, uint32_t n) {
+  /* the routines copy a byte at a time from the start, if the destination
+     begins inside of the source the copy repeats the bytes in between */
+  if (dst - src - 1 < n - 1) {
+    for (uint32_t i = 0; i < n; i++) {
+      guest->w8(guest->mem, dst + i, guest->r8(guest->mem, src + i));
+    }
+    return;
+  }
+
+  while (n) {
+    int size = MIN(sh4_runtime_chunk(dst, n), sh4_runtime_chunk(src, n));
+    uint8_t *pdst = sh4_runtime_ptr(guest, dst);
+    uint8_t *psrc = sh4_runtime_ptr(guest, src);
+
+    if (pdst && psrc) {
+      memmove(pdst, psrc, size);
+    } else {
+      for (int i = 0; i < size; i++) {
+        guest->w8(guest->mem, dst + i, guest->r8(guest->mem, src + i));
+      }
+    }
+
+    dst += size;
+    src += size;
+    n -= size;
+  }
+}
+
+static uint32_t sh4_runtime_strlen(struct jit_guest *guest, uint32_t src) {
+  uint32_t len = 0;
+
+  while (1) {
+    int size = sh4_runtime_chunk(src + len, SH4_RUNTIME_PAGE_SIZE);
+    uint8_t *ptr = sh4_runtime_ptr(guest, src + len);
+
+    if (ptr) {
+      int n = (int)strnlen((const char *)ptr, size);
+      if (n < size) {
+        return len + n;
+      }
+    } else {
+      for (int i = 0; i < size; i++) {
+        if (!guest->r8(guest->mem, src + len + i)) {
+          return len + i;
+        }
+      }
+    }
+
+    len += size;
+  }
+}
+
+/*
+ * native implementations, each returning the number of loop iterations ran
+ */
+static int sh4_runtime_memset_u8(struct jit_guest *guest,
+                                 struct sh4_context *ctx) {
+  uint32_t dst = ctx->r[4];
+  uint32_t n = ctx->r[6];
+
+  ctx->r[0] = dst;
+  ctx->sr_t = 1;
+
+  if (!n) {
+    return 0;
+  }
+
+  sh4_runtime_memset(guest, dst, (uint8_t)ctx->r[5], n);
+
+  ctx->r[1] = dst + n;
+  ctx->r[6] = 0;
+
+  return (int)MIN(n, INT32_MAX);
+}
+
+static int sh4_runtime_memcpy_u8(struct jit_guest *guest,
+                                 struct sh4_context *ctx) {
+  uint32_t dst = ctx->r[4];
+  uint32_t src = ctx->r[5];
+  uint32_t n = ctx->r[6];
+
+  ctx->r[0] = dst;
+  ctx->sr_t = 1;
+
+  if (!n) {
+    return 0;
+  }
+
+  sh4_runtime_memcpy(guest, dst, src, n);
+
+  ctx->r[1] = dst + n;
+  ctx->r[2] = (int32_t)(int8_t)guest->r8(guest->mem, dst + n - 1);
+  ctx->r[5] = src + n;
+  ctx->r[6] = 0;
+
+  return (int)MIN(n, INT32_MAX);
+}
+
+static int sh4_runtime_strlen_u8(struct jit_guest *guest,
+                                 struct sh4_context *ctx) {
+  uint32_t len = sh4_runtime_strlen(guest, ctx->r[4]);
+
+  ctx->r[0] = len;
+  ctx->r[1] = 0;
+  ctx->sr_t = 1;
+
+  return (int)MIN(len, INT32_MAX);
+}
+
+#define SH4_ROUTINE(id, name, loop_cycles, native, ...) \
+  static const uint16_t id##_code[] = {__VA_ARGS__};
+#include "jit/frontend/sh4/sh4_runtime.inc"
+#undef SH4_ROUTINE
+
+static const struct sh4_routine sh4_routines[] = {
+#define SH4_ROUTINE(id, name, loop_cycles, native, ...) \
+  {name, id##_code, (int)sizeof(id##_code), loop_cycles, &native},
+#include "jit/frontend/sh4/sh4_runtime.inc"
+#undef SH4_ROUTINE
+};
+
+void sh4_runtime_call(struct jit_guest *guest, uint32_t addr, uint32_t instr) {
+  struct sh4_context *ctx = guest->ctx;
+  const struct sh4_routine *routine = &sh4_routines[instr >> 16];
+
+  int iterations = routine->native(guest, ctx);
+
+  /* charge for the loop the routine would have ran through */
+  int64_t cycles = (int64_t)iterations * routine->loop_cycles;
+  ctx->run_cycles -= (int32_t)MIN(cycles, INT32_MAX);
+}
+
+int sh4_runtime_lookup(struct sh4_runtime *rt, struct jit_guest *guest,
+                       uint32_t addr, int *size) {
+  uint16_t prefix[SH4_RUNTIME_PREFIX_SIZE / 2];
+
+  for (int i = 0; i < ARRAY_SIZE(prefix); i++) {
+    prefix[i] = guest->r16(guest->mem, addr + i * 2);
+  }
+
+  uint64_t hash = hash_bytes(prefix, sizeof(prefix), 0);
+  struct list *bkt = hash_bkt(rt->table, hash);
+
+  hash_bkt_for_each_entry(entry, bkt, struct sh4_routine_entry, it) {
+    const struct sh4_routine *routine = entry->routine;
+
+    if (entry->hash != hash) {
+      continue;
+    }
+
+    int match = 1;
+
+    for (int i = ARRAY_SIZE(prefix); i < routine->size / 2 && match; i++) {
+      match = guest->r16(guest->mem, addr + i * 2) == routine->code[i];
+    }
+
+    if (match) {
+      *size = routine->size;
+      return (int)(routine - sh4_routines);
+    }
+  }
+
+  return -1;
+}
+
+void sh4_runtime_destroy(struct sh4_runtime *rt) {
+  free(rt->entries);
+  free(rt);
+}
+
+struct sh4_runtime *sh4_runtime_create() {
+  struct sh4_runtime *rt = calloc(1, sizeof(struct sh4_runtime));
+
+  rt->entries = calloc(ARRAY_SIZE(sh4_routines), sizeof(*rt->entries));
+
+  for (int i = 0; i < ARRAY_SIZE(sh4_routines); i++) {
+    const struct sh4_routine *routine = &sh4_routines[i];
+    struct sh4_routine_entry *entry = &rt->entries[i];
+
+    CHECK_GE(routine->size, SH4_RUNTIME_PREFIX_SIZE);
+
+    entry->routine = routine;
+    entry->hash = hash_bytes(routine->code, SH4_RUNTIME_PREFIX_SIZE, 0);
+    hash_add(hash_bkt(rt->table, entry->hash), &entry->it);
+  }
+
+  return rt;
+}
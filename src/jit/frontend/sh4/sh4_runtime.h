@@ -0,0 +1,30 @@
+#ifndef SH4_RUNTIME_H
+#define SH4_RUNTIME_H
+
+#include <stdint.h>
+
+struct jit_guest;
+struct sh4_runtime;
+
+/*
+ * native replacements for routines from the runtime libraries guest code is
+ * statically linked against
+ *
+ * blocks are matched against the known routines when they're compiled, by
+ * hashing the first few bytes of their code to narrow down the candidates
+ * before comparing the rest. a block found to be one of them is compiled into
+ * a call to its native implementation followed by a return to pr
+ */
+struct sh4_runtime *sh4_runtime_create();
+void sh4_runtime_destroy(struct sh4_runtime *rt);
+
+/* returns the index of the routine whose code starts at addr, -1 if none
+   does. size is set to the size of its code */
+int sh4_runtime_lookup(struct sh4_runtime *rt, struct jit_guest *guest,
+                       uint32_t addr, int *size);
+
+/* fallback which runs the native implementation of a routine, instr holds
+   the routine's index in its upper 16 bits */
+void sh4_runtime_call(struct jit_guest *guest, uint32_t addr, uint32_t instr);
+
+#endif
@@ -65,6 +65,35 @@ static void store_sr(struct sh4_guest *guest, struct ir *ir,
   ir_call_2(ir, sr_updated, data, old_sr);
 }
 
+/* 64-bit fmovs access a register pair with its high word first, while the
+   pair is stored in the context with the words swapped */
+static struct ir_value *swap_pair(struct ir *ir, struct ir_value *v) {
+  CHECK_EQ(v->type, VALUE_I64);
+  return ir_or(ir, ir_shli(ir, v, 32), ir_lshri(ir, v, 32));
+}
+
+/* loads from a constant address in immutable memory (e.g. literal pools in the
+   boot rom) are folded into constants */
+static struct ir_value *load_imm(struct sh4_guest *guest, struct ir *ir,
+                                 uint32_t ea, enum ir_type type) {
+  int size = ir_type_size(type);
+
+  if (!guest->immutable || !guest->immutable(guest->mem, ea, size)) {
+    return ir_load_guest(ir, ir_alloc_i32(ir, ea), type);
+  }
+
+  switch (size) {
+    case 1:
+      return ir_alloc_int(ir, guest->r8(guest->mem, ea), type);
+    case 2:
+      return ir_alloc_int(ir, guest->r16(guest->mem, ea), type);
+    case 4:
+      return ir_alloc_int(ir, guest->r32(guest->mem, ea), type);
+    default:
+      return ir_alloc_int(ir, (int64_t)guest->r64(guest->mem, ea), type);
+  }
+}
+
 static struct ir_value *load_fpscr(struct ir *ir) {
   struct ir_value *fpscr =
       ir_load_context(ir, offsetof(struct sh4_context, fpscr), VALUE_I32);
@@ -212,10 +241,10 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 #define LOAD_I16(ea)                 ir_load_guest(ir, ea, VALUE_I16)
 #define LOAD_I32(ea)                 ir_load_guest(ir, ea, VALUE_I32)
 #define LOAD_I64(ea)                 ir_load_guest(ir, ea, VALUE_I64)
-#define LOAD_IMM_I8(ea)              LOAD_I8(ir_alloc_i32(ir, ea))
-#define LOAD_IMM_I16(ea)             LOAD_I16(ir_alloc_i32(ir, ea))
-#define LOAD_IMM_I32(ea)             LOAD_I32(ir_alloc_i32(ir, ea))
-#define LOAD_IMM_I64(ea)             LOAD_I64(ir_alloc_i32(ir, ea))
+#define LOAD_IMM_I8(ea)              load_imm(guest, ir, ea, VALUE_I8)
+#define LOAD_IMM_I16(ea)             load_imm(guest, ir, ea, VALUE_I16)
+#define LOAD_IMM_I32(ea)             load_imm(guest, ir, ea, VALUE_I32)
+#define LOAD_IMM_I64(ea)             load_imm(guest, ir, ea, VALUE_I64)
 
 #define STORE_I8(ea, v)              ir_store_guest(ir, ea, v)
 #define STORE_I16                    STORE_I8
@@ -224,6 +253,9 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 
 #define LOAD_HOST_F32(ea)            ir_load_host(ir, ea, VALUE_F32)
 #define LOAD_HOST_F64(ea)            ir_load_host(ir, ea, VALUE_F64)
+#define LOAD_HOST_I64(ea)            ir_load_host(ir, ea, VALUE_I64)
+
+#define SWAP_PAIR_I64(v)             swap_pair(ir, v)
 
 #define FTOI_F32_I32(v)              ir_ftoi(ir, v, VALUE_I32)
 #define FTOI_F64_I32(v)              ir_ftoi(ir, v, VALUE_I32)
@@ -351,6 +383,7 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 #define VADD_F32(a, b)               ir_vadd(ir, a, b, VALUE_F32)
 #define VMUL_F32(a, b)               ir_vmul(ir, a, b, VALUE_F32)
 #define VDOT_F32(a, b)               ir_vdot(ir, a, b, VALUE_F32)
+#define VMADD_F32(a, b, c)           ir_vmadd(ir, a, b, c, VALUE_F32)
 
 #define AND_I8(a, b)                 ir_and(ir, a, b)
 #define AND_I16                      AND_I8
@@ -417,6 +450,9 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 #define BRANCH_I32(d)                ir_branch(ir, d)
 #define BRANCH_IMM_I32(d)            BRANCH_I32(ir_alloc_i32(ir, d))
 #define BRANCH_COND_IMM_I32(c, t, f) ir_branch_cond(ir, c, ir_alloc_i32(ir, t), ir_alloc_i32(ir, f))
+#define CALL_I32(d, r)               ir_branch_call(ir, d, ir_alloc_i32(ir, r))
+#define CALL_IMM_I32(d, r)           CALL_I32(ir_alloc_i32(ir, d), r)
+#define RETURN_I32(d)                ir_branch_return(ir, d)
 
 #define INVALID_INSTR()              {                                                                                     \
                                         struct ir_value *invalid_instr = ir_alloc_i64(ir, (uint64_t)guest->invalid_instr); \
@@ -12,27 +12,36 @@ const char *ir_meta_names[IR_NUM_META] = {
     "addr", "cycles",
 };
 
-static void *ir_calloc(struct ir *ir, int size) {
+/* allocations are bumped off of the buffer without being cleared, each object
+   is fully initialized by the function allocating it instead */
+static void *ir_alloc(struct ir *ir, int size) {
   CHECK_LE(ir->used + size, ir->capacity);
   uint8_t *ptr = ir->buffer + ir->used;
-  memset(ptr, 0, size);
   ir->used += size;
   return ptr;
 }
 
 static struct ir_block *ir_alloc_block(struct ir *ir) {
-  struct ir_block *block = ir_calloc(ir, sizeof(struct ir_block));
+  struct ir_block *block = ir_alloc(ir, sizeof(struct ir_block));
+  list_clear(&block->instrs);
+  list_clear(&block->outgoing);
+  list_clear(&block->incoming);
+  block->tag = 0;
   return block;
 }
 
 static struct ir_instr *ir_alloc_instr(struct ir *ir, enum ir_op op) {
-  struct ir_instr *instr = ir_calloc(ir, sizeof(struct ir_instr));
+  struct ir_instr *instr = ir_alloc(ir, sizeof(struct ir_instr));
 
   instr->op = op;
+  instr->result = NULL;
+  instr->block = NULL;
+  instr->tag = 0;
 
   /* initialize use links */
   for (int i = 0; i < IR_MAX_ARGS; i++) {
     struct ir_use *use = &instr->used[i];
+    instr->arg[i] = NULL;
     use->instr = instr;
     use->parg = &instr->arg[i];
   }
@@ -40,6 +49,17 @@ static struct ir_instr *ir_alloc_instr(struct ir *ir, enum ir_op op) {
   return instr;
 }
 
+static struct ir_value *ir_alloc_value(struct ir *ir, enum ir_type type) {
+  struct ir_value *v = ir_alloc(ir, sizeof(struct ir_value));
+  v->type = type;
+  v->i64 = 0;
+  v->def = NULL;
+  list_clear(&v->uses);
+  v->reg = 0;
+  v->tag = 0;
+  return v;
+}
+
 static void ir_add_use(struct ir_value *v, struct ir_use *use) {
   list_add(&v->uses, &use->it);
 }
@@ -48,6 +68,21 @@ static void ir_remove_use(struct ir_value *v, struct ir_use *use) {
   list_remove(&v->uses, &use->it);
 }
 
+void ir_init(struct ir *ir, uint8_t *buffer, int capacity) {
+  ir->buffer = buffer;
+  ir->capacity = capacity;
+  ir->used = 0;
+  ir->cursor.block = NULL;
+  ir->cursor.instr = NULL;
+  list_clear(&ir->blocks);
+  ir->locals_size = 0;
+  ir->precise_memory = 0;
+
+  /* the meta data is keyed by pointers into the buffer, stale entries from a
+     previous unit can't be left around */
+  memset(ir->meta, 0, sizeof(ir->meta));
+}
+
 struct ir_insert_point ir_get_insert_point(struct ir *ir) {
   return ir->cursor;
 }
@@ -140,27 +175,44 @@ void ir_remove_block(struct ir *ir, struct ir_block *block) {
 void ir_add_edge(struct ir *ir, struct ir_block *src, struct ir_block *dst) {
   /* linked list data is intrusive, need to allocate two edge objects */
   {
-    struct ir_edge *edge = ir_calloc(ir, sizeof(struct ir_edge));
+    struct ir_edge *edge = ir_alloc(ir, sizeof(struct ir_edge));
     edge->src = src;
     edge->dst = dst;
     list_add(&src->outgoing, &edge->it);
   }
   {
-    struct ir_edge *edge = ir_calloc(ir, sizeof(struct ir_edge));
+    struct ir_edge *edge = ir_alloc(ir, sizeof(struct ir_edge));
     edge->src = src;
     edge->dst = dst;
     list_add(&dst->incoming, &edge->it);
   }
 }
 
+int ir_is_extended_block(struct ir *ir, struct ir_block *block) {
+  /* an extended block is only entered from the block laid out directly before
+     it, meaning everything defined by the predecessor dominates it */
+  struct ir_block *prev = list_prev_entry(block, struct ir_block, it);
+
+  if (!prev || list_empty(&block->incoming)) {
+    return 0;
+  }
+
+  list_for_each_entry(edge, &block->incoming, struct ir_edge, it) {
+    if (edge->src != prev) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
 struct ir_instr *ir_append_instr(struct ir *ir, enum ir_op op,
                                  enum ir_type result_type) {
   /* allocate instruction and its result if needed */
   struct ir_instr *instr = ir_alloc_instr(ir, op);
 
   if (result_type != VALUE_V) {
-    struct ir_value *result = ir_calloc(ir, sizeof(struct ir_value));
-    result->type = result_type;
+    struct ir_value *result = ir_alloc_value(ir, result_type);
     result->def = instr;
     instr->result = result;
   }
@@ -204,8 +256,7 @@ void ir_remove_instr(struct ir *ir, struct ir_instr *instr) {
 }
 
 struct ir_value *ir_alloc_int(struct ir *ir, int64_t c, enum ir_type type) {
-  struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
-  v->type = type;
+  struct ir_value *v = ir_alloc_value(ir, type);
   switch (type) {
     case VALUE_I8:
       v->i8 = (int8_t)c;
@@ -227,43 +278,37 @@ struct ir_value *ir_alloc_int(struct ir *ir, int64_t c, enum ir_type type) {
 }
 
 struct ir_value *ir_alloc_i8(struct ir *ir, int8_t c) {
-  struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
-  v->type = VALUE_I8;
+  struct ir_value *v = ir_alloc_value(ir, VALUE_I8);
   v->i8 = c;
   return v;
 }
 
 struct ir_value *ir_alloc_i16(struct ir *ir, int16_t c) {
-  struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
-  v->type = VALUE_I16;
+  struct ir_value *v = ir_alloc_value(ir, VALUE_I16);
   v->i16 = c;
   return v;
 }
 
 struct ir_value *ir_alloc_i32(struct ir *ir, int32_t c) {
-  struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
-  v->type = VALUE_I32;
+  struct ir_value *v = ir_alloc_value(ir, VALUE_I32);
   v->i32 = c;
   return v;
 }
 
 struct ir_value *ir_alloc_i64(struct ir *ir, int64_t c) {
-  struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
-  v->type = VALUE_I64;
+  struct ir_value *v = ir_alloc_value(ir, VALUE_I64);
   v->i64 = c;
   return v;
 }
 
 struct ir_value *ir_alloc_f32(struct ir *ir, float c) {
-  struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
-  v->type = VALUE_F32;
+  struct ir_value *v = ir_alloc_value(ir, VALUE_F32);
   v->f32 = c;
   return v;
 }
 
 struct ir_value *ir_alloc_f64(struct ir *ir, double c) {
-  struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
-  v->type = VALUE_F64;
+  struct ir_value *v = ir_alloc_value(ir, VALUE_F64);
   v->f64 = c;
   return v;
 }
@@ -273,8 +318,7 @@ struct ir_value *ir_alloc_ptr(struct ir *ir, void *c) {
 }
 
 struct ir_value *ir_alloc_block_ref(struct ir *ir, struct ir_block *block) {
-  struct ir_value *v = ir_calloc(ir, sizeof(struct ir_value));
-  v->type = VALUE_BLOCK;
+  struct ir_value *v = ir_alloc_value(ir, VALUE_BLOCK);
   v->blk = block;
   return v;
 }
@@ -284,7 +328,7 @@ struct ir_local *ir_alloc_local(struct ir *ir, enum ir_type type) {
   int type_size = ir_type_size(type);
   ir->locals_size = ALIGN_UP(ir->locals_size, type_size);
 
-  struct ir_local *l = ir_calloc(ir, sizeof(struct ir_local));
+  struct ir_local *l = ir_alloc(ir, sizeof(struct ir_local));
   l->type = type;
   l->offset = ir_alloc_i32(ir, ir->locals_size);
 
@@ -295,7 +339,7 @@ struct ir_local *ir_alloc_local(struct ir *ir, enum ir_type type) {
 
 struct ir_local *ir_reuse_local(struct ir *ir, struct ir_value *offset,
                                 enum ir_type type) {
-  struct ir_local *l = ir_calloc(ir, sizeof(struct ir_local));
+  struct ir_local *l = ir_alloc(ir, sizeof(struct ir_local));
   l->type = type;
   l->offset = offset;
 
@@ -389,7 +433,7 @@ void ir_set_meta(struct ir *ir, const void *obj, int kind,
   }
 
   if (!meta) {
-    meta = ir_calloc(ir, sizeof(struct ir_meta));
+    meta = ir_alloc(ir, sizeof(struct ir_meta));
     meta->key = obj;
     hash_add(bkt, &meta->it);
   }
@@ -708,10 +752,21 @@ struct ir_value *ir_umul(struct ir *ir, struct ir_value *a,
   return instr->result;
 }
 
-struct ir_value *ir_div(struct ir *ir, struct ir_value *a, struct ir_value *b) {
-  CHECK(ir_is_int(a->type) && a->type == b->type);
+struct ir_value *ir_sdiv(struct ir *ir, struct ir_value *a,
+                         struct ir_value *b) {
+  CHECK((a->type == VALUE_I32 || a->type == VALUE_I64) && a->type == b->type);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_SDIV, a->type);
+  ir_set_arg0(ir, instr, a);
+  ir_set_arg1(ir, instr, b);
+  return instr->result;
+}
+
+struct ir_value *ir_udiv(struct ir *ir, struct ir_value *a,
+                         struct ir_value *b) {
+  CHECK((a->type == VALUE_I32 || a->type == VALUE_I64) && a->type == b->type);
 
-  struct ir_instr *instr = ir_append_instr(ir, OP_DIV, a->type);
+  struct ir_instr *instr = ir_append_instr(ir, OP_UDIV, a->type);
   ir_set_arg0(ir, instr, a);
   ir_set_arg1(ir, instr, b);
   return instr->result;
@@ -838,6 +893,19 @@ struct ir_value *ir_vdot(struct ir *ir, struct ir_value *a, struct ir_value *b,
   return instr->result;
 }
 
+struct ir_value *ir_vmadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
+                          struct ir_value *c, enum ir_type el_type) {
+  CHECK(ir_is_vector(a->type) && ir_is_vector(b->type) &&
+        ir_is_vector(c->type));
+  CHECK_EQ(el_type, VALUE_F32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_VMADD, a->type);
+  ir_set_arg0(ir, instr, a);
+  ir_set_arg1(ir, instr, b);
+  ir_set_arg2(ir, instr, c);
+  return instr->result;
+}
+
 struct ir_value *ir_and(struct ir *ir, struct ir_value *a, struct ir_value *b) {
   CHECK(ir_is_int(a->type) && a->type == b->type);
 
@@ -941,6 +1009,25 @@ void ir_branch(struct ir *ir, struct ir_value *dst) {
   ir_set_arg0(ir, instr, dst);
 }
 
+void ir_branch_call(struct ir *ir, struct ir_value *dst,
+                    struct ir_value *ret) {
+  CHECK(dst->type == VALUE_I32);
+  CHECK(ir_is_constant(ret) && ret->type == VALUE_I32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_BRANCH, VALUE_V);
+  ir_set_arg0(ir, instr, dst);
+  ir_set_arg1(ir, instr, ir_alloc_i32(ir, IR_BRANCH_CALL));
+  ir_set_arg2(ir, instr, ret);
+}
+
+void ir_branch_return(struct ir *ir, struct ir_value *dst) {
+  CHECK(dst->type == VALUE_I32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_BRANCH, VALUE_V);
+  ir_set_arg0(ir, instr, dst);
+  ir_set_arg1(ir, instr, ir_alloc_i32(ir, IR_BRANCH_RETURN));
+}
+
 void ir_branch_cond(struct ir *ir, struct ir_value *cond, struct ir_value *t,
                     struct ir_value *f) {
   struct ir_instr *instr = ir_append_instr(ir, OP_BRANCH_COND, VALUE_V);
@@ -45,6 +45,16 @@ enum ir_cmp {
   CMP_ULT
 };
 
+/* branches describing a guest call or return carry one of these as a constant
+   second argument, enabling the backend to predict their destination. calls
+   additionally carry their return address as the third argument. when
+   profiling, dynamic branches carry a pointer to a pair of hit / miss counters
+   for the backend's branch prediction as the fourth argument */
+enum ir_branch_hint {
+  IR_BRANCH_CALL = 1,
+  IR_BRANCH_RETURN,
+};
+
 enum ir_meta_type {
   IR_META_ADDR,
   IR_META_CYCLES,
@@ -179,6 +189,10 @@ struct ir {
   /* total size of locals allocated */
   int locals_size;
 
+  /* guest memory accesses may raise exceptions, abandoning the instruction
+     making them. the context must be up to date at each of them */
+  int precise_memory;
+
   /* hashtables for each kind of meta data, keyed by each user's pointer */
   DECLARE_HASHTABLE(meta[IR_NUM_META], 7);
 };
@@ -225,8 +239,21 @@ static inline int ir_is_constant(const struct ir_value *v) {
   return !v->def;
 }
 
+/* the binary format is a compact alternative to the text format, meant for
+   the code cache and for tooling processing large numbers of blocks. files
+   begin with the magic, followed by the format version as a varint */
+#define IR_BINARY_MAGIC "rirb"
+#define IR_BINARY_MAGIC_SIZE 4
+#define IR_BINARY_VERSION 2
+
+/* resets the ir to allocate from the buffer. the buffer itself isn't cleared,
+   so this is cheap to call before each compile */
+void ir_init(struct ir *ir, uint8_t *buffer, int capacity);
+
 int ir_read(FILE *input, struct ir *ir);
 void ir_write(struct ir *ir, FILE *output);
+int ir_read_binary(const uint8_t *data, int size, struct ir *ir);
+void ir_write_binary(struct ir *ir, FILE *output);
 
 struct ir_insert_point ir_get_insert_point(struct ir *ir);
 void ir_set_insert_point(struct ir *ir, struct ir_insert_point *point);
@@ -238,6 +265,7 @@ struct ir_block *ir_append_block(struct ir *ir);
 struct ir_block *ir_split_block(struct ir *ir, struct ir_instr *before);
 void ir_remove_block(struct ir *ir, struct ir_block *block);
 void ir_add_edge(struct ir *ir, struct ir_block *src, struct ir_block *dst);
+int ir_is_extended_block(struct ir *ir, struct ir_block *block);
 
 struct ir_instr *ir_append_instr(struct ir *ir, enum ir_op op,
                                  enum ir_type result_type);
@@ -285,7 +313,11 @@ struct ir_value *ir_load_host(struct ir *ir, struct ir_value *addr,
                               enum ir_type type);
 void ir_store_host(struct ir *ir, struct ir_value *addr, struct ir_value *v);
 
-/* guest memory operations */
+/* guest memory operations. the conversion elimination pass may fold a sign /
+   zero extension into a load, or a truncation into a store, by appending an
+   extra constant argument whose type is the type of the memory being accessed
+   (arg1 for loads, arg2 for stores). for loads, the constant is non-zero when
+   the data is sign extended */
 struct ir_value *ir_load_guest(struct ir *ir, struct ir_value *addr,
                                enum ir_type type);
 void ir_store_guest(struct ir *ir, struct ir_value *addr, struct ir_value *v);
@@ -360,7 +392,10 @@ struct ir_value *ir_add(struct ir *ir, struct ir_value *a, struct ir_value *b);
 struct ir_value *ir_sub(struct ir *ir, struct ir_value *a, struct ir_value *b);
 struct ir_value *ir_smul(struct ir *ir, struct ir_value *a, struct ir_value *b);
 struct ir_value *ir_umul(struct ir *ir, struct ir_value *a, struct ir_value *b);
-struct ir_value *ir_div(struct ir *ir, struct ir_value *a, struct ir_value *b);
+/* the divides round toward zero and are only defined for 32 and 64-bit
+   operands. dividing by zero, or the most negative value by -1, is undefined */
+struct ir_value *ir_sdiv(struct ir *ir, struct ir_value *a, struct ir_value *b);
+struct ir_value *ir_udiv(struct ir *ir, struct ir_value *a, struct ir_value *b);
 struct ir_value *ir_neg(struct ir *ir, struct ir_value *a);
 struct ir_value *ir_abs(struct ir *ir, struct ir_value *a);
 
@@ -381,6 +416,9 @@ struct ir_value *ir_vmul(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type);
 struct ir_value *ir_vdot(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type);
+/* computes a * b + c, the backend is free to fuse the multiply and add */
+struct ir_value *ir_vmadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
+                          struct ir_value *c, enum ir_type el_type);
 
 /* bitwise operations */
 struct ir_value *ir_and(struct ir *ir, struct ir_value *a, struct ir_value *b);
@@ -398,6 +436,9 @@ struct ir_value *ir_lshd(struct ir *ir, struct ir_value *a, struct ir_value *n);
 
 /* branches */
 void ir_branch(struct ir *ir, struct ir_value *dst);
+void ir_branch_call(struct ir *ir, struct ir_value *dst,
+                    struct ir_value *ret);
+void ir_branch_return(struct ir *ir, struct ir_value *dst);
 void ir_branch_cond(struct ir *ir, struct ir_value *cond, struct ir_value *t,
                     struct ir_value *f);
 void ir_branch_false(struct ir *ir, struct ir_value *cond,
@@ -410,11 +451,11 @@ void ir_call_1(struct ir *ir, struct ir_value *fn, struct ir_value *arg0);
 void ir_call_2(struct ir *ir, struct ir_value *fn, struct ir_value *arg0,
                struct ir_value *arg1);
 
-void ir_call_cond(struct ir *ir, struct ir_value *fn, struct ir_value *cond);
-void ir_call_cond_1(struct ir *ir, struct ir_value *fn, struct ir_value *arg0,
-                    struct ir_value *cond);
-void ir_call_cond_2(struct ir *ir, struct ir_value *fn, struct ir_value *arg0,
-                    struct ir_value *arg1, struct ir_value *cond);
+void ir_call_cond(struct ir *ir, struct ir_value *cond, struct ir_value *fn);
+void ir_call_cond_1(struct ir *ir, struct ir_value *cond, struct ir_value *fn,
+                    struct ir_value *arg0);
+void ir_call_cond_2(struct ir *ir, struct ir_value *cond, struct ir_value *fn,
+                    struct ir_value *arg0, struct ir_value *arg1);
 
 /* debug */
 void ir_debug_break(struct ir *ir);
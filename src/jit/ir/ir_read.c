@@ -557,3 +557,345 @@ int ir_read(FILE *input, struct ir *ir) {
 
   return res;
 }
+
+/*
+ * binary format, see ir_write.c for its layout. the reader works on a memory
+ * buffer, letting callers map files directly
+ */
+#define IR_BINARY_REF 0x80
+
+struct ir_binary_ref {
+  struct ir_instr *instr;
+  int arg;
+  enum ir_type type;
+  int64_t index;
+};
+
+struct ir_binary_reader {
+  const uint8_t *ptr;
+  const uint8_t *end;
+  struct ir *ir;
+
+  struct ir_binary_ref *refs;
+  int num_refs;
+};
+
+static int ir_read_byte(struct ir_binary_reader *r, int *v) {
+  if (r->ptr >= r->end) {
+    LOG_INFO("unexpected end of binary ir");
+    return 0;
+  }
+
+  *v = *r->ptr++;
+
+  return 1;
+}
+
+static int ir_read_varint(struct ir_binary_reader *r, uint64_t *v) {
+  *v = 0;
+
+  for (int shift = 0; shift < 64; shift += 7) {
+    int b;
+    if (!ir_read_byte(r, &b)) {
+      return 0;
+    }
+
+    *v |= (uint64_t)(b & 0x7f) << shift;
+
+    if (!(b & 0x80)) {
+      return 1;
+    }
+  }
+
+  LOG_INFO("varint too long in binary ir");
+  return 0;
+}
+
+static int ir_read_fixed(struct ir_binary_reader *r, int size, uint64_t *v) {
+  *v = 0;
+
+  for (int i = 0; i < size; i++) {
+    int b;
+    if (!ir_read_byte(r, &b)) {
+      return 0;
+    }
+
+    *v |= (uint64_t)b << (i * 8);
+  }
+
+  return 1;
+}
+
+static int ir_read_constant(struct ir_binary_reader *r, enum ir_type type,
+                            struct ir_value **value) {
+  uint64_t v;
+
+  switch (type) {
+    case VALUE_I8:
+    case VALUE_I16:
+    case VALUE_I32:
+    case VALUE_I64:
+      if (!ir_read_varint(r, &v)) {
+        return 0;
+      }
+      break;
+    case VALUE_F32:
+      if (!ir_read_fixed(r, 4, &v)) {
+        return 0;
+      }
+      break;
+    case VALUE_F64:
+      if (!ir_read_fixed(r, 8, &v)) {
+        return 0;
+      }
+      break;
+    default:
+      LOG_INFO("unexpected constant type %d in binary ir", type);
+      return 0;
+  }
+
+  switch (type) {
+    case VALUE_I8:
+      *value = ir_alloc_i8(r->ir, (int8_t)v);
+      break;
+    case VALUE_I16:
+      *value = ir_alloc_i16(r->ir, (int16_t)v);
+      break;
+    case VALUE_I32:
+      *value = ir_alloc_i32(r->ir, (int32_t)v);
+      break;
+    case VALUE_I64:
+      *value = ir_alloc_i64(r->ir, (int64_t)v);
+      break;
+    case VALUE_F32: {
+      uint32_t bits = (uint32_t)v;
+      *value = ir_alloc_f32(r->ir, *(float *)&bits);
+    } break;
+    case VALUE_F64:
+      *value = ir_alloc_f64(r->ir, *(double *)&v);
+      break;
+    default:
+      break;
+  }
+
+  return 1;
+}
+
+static int ir_read_binary_meta(struct ir_binary_reader *r, void *obj) {
+  int mask;
+  if (!ir_read_byte(r, &mask)) {
+    return 0;
+  }
+
+  for (int kind = 0; kind < IR_NUM_META; kind++) {
+    if (!(mask & (1 << kind))) {
+      continue;
+    }
+
+    int type;
+    if (!ir_read_byte(r, &type)) {
+      return 0;
+    }
+
+    struct ir_value *value = NULL;
+    if (!ir_read_constant(r, type, &value)) {
+      return 0;
+    }
+
+    ir_set_meta(r->ir, obj, kind, value);
+  }
+
+  return 1;
+}
+
+static int ir_read_binary_arg(struct ir_binary_reader *r,
+                              struct ir_instr *instr, int arg, int index) {
+  int kind;
+  if (!ir_read_byte(r, &kind)) {
+    return 0;
+  }
+
+  enum ir_type type = kind & ~IR_BINARY_REF;
+
+  if (type <= VALUE_V || type >= VALUE_NUM) {
+    LOG_INFO("unexpected value type %d in binary ir", type);
+    return 0;
+  }
+
+  /* references to instructions and blocks are resolved once everything has
+     been read */
+  if ((kind & IR_BINARY_REF) || type == VALUE_BLOCK) {
+    if ((kind & IR_BINARY_REF) && type == VALUE_BLOCK) {
+      LOG_INFO("unexpected block result referenced in binary ir");
+      return 0;
+    }
+
+    uint64_t v;
+    if (!ir_read_varint(r, &v)) {
+      return 0;
+    }
+
+    struct ir_binary_ref *ref = &r->refs[r->num_refs++];
+    ref->instr = instr;
+    ref->arg = arg;
+    ref->type = type;
+
+    if (type == VALUE_BLOCK) {
+      ref->index = (int64_t)v;
+    } else {
+      int64_t delta = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+      ref->index = index - delta;
+    }
+
+    return 1;
+  }
+
+  struct ir_value *value = NULL;
+  if (!ir_read_constant(r, type, &value)) {
+    return 0;
+  }
+
+  ir_set_arg(r->ir, instr, arg, value);
+
+  return 1;
+}
+
+static int ir_read_binary_instr(struct ir_binary_reader *r, int index,
+                                struct ir_instr **instrs) {
+  int op, types;
+  if (!ir_read_byte(r, &op) || !ir_read_byte(r, &types)) {
+    return 0;
+  }
+
+  int has_meta = op >> 7;
+  int arg_mask = types >> 4;
+  enum ir_type type = types & 0xf;
+  op &= 0x7f;
+
+  if (op >= IR_NUM_OPS || type >= VALUE_BLOCK) {
+    LOG_INFO("unexpected op %d / result type %d in binary ir", op, type);
+    return 0;
+  }
+
+  struct ir_instr *instr = ir_append_instr(r->ir, op, type);
+  instrs[index] = instr;
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    if (!(arg_mask & (1 << i))) {
+      continue;
+    }
+
+    if (!ir_read_binary_arg(r, instr, i, index)) {
+      return 0;
+    }
+  }
+
+  if (has_meta && !ir_read_binary_meta(r, instr)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+static int ir_resolve_binary_refs(struct ir_binary_reader *r,
+                                  struct ir_block **blocks, int num_blocks,
+                                  struct ir_instr **instrs, int num_instrs) {
+  for (int i = 0; i < r->num_refs; i++) {
+    struct ir_binary_ref *ref = &r->refs[i];
+    struct ir_value *value = NULL;
+
+    if (ref->type == VALUE_BLOCK) {
+      if (ref->index >= num_blocks) {
+        LOG_INFO("failed to resolve reference to block %" PRId64, ref->index);
+        return 0;
+      }
+
+      value = ir_alloc_block_ref(r->ir, blocks[ref->index]);
+    } else {
+      if (ref->index < 0 || ref->index >= num_instrs ||
+          !instrs[ref->index]->result ||
+          instrs[ref->index]->result->type != ref->type) {
+        LOG_INFO("failed to resolve reference to instr %" PRId64, ref->index);
+        return 0;
+      }
+
+      value = instrs[ref->index]->result;
+    }
+
+    ir_set_arg(r->ir, ref->instr, ref->arg, value);
+  }
+
+  return 1;
+}
+
+int ir_read_binary(const uint8_t *data, int size, struct ir *ir) {
+  struct ir_binary_reader r = {0};
+  r.ptr = data;
+  r.end = data + size;
+  r.ir = ir;
+
+  if (size < IR_BINARY_MAGIC_SIZE ||
+      memcmp(data, IR_BINARY_MAGIC, IR_BINARY_MAGIC_SIZE)) {
+    LOG_INFO("missing binary ir magic");
+    return 0;
+  }
+  r.ptr += IR_BINARY_MAGIC_SIZE;
+
+  uint64_t version, num_blocks, num_instrs;
+  if (!ir_read_varint(&r, &version) || !ir_read_varint(&r, &num_blocks) ||
+      !ir_read_varint(&r, &num_instrs)) {
+    return 0;
+  }
+
+  if (version != IR_BINARY_VERSION) {
+    LOG_INFO("unsupported binary ir version %" PRIu64, version);
+    return 0;
+  }
+
+  /* each block and instruction takes up at least two bytes */
+  if (num_blocks + num_instrs > (uint64_t)size) {
+    LOG_INFO("invalid binary ir counts");
+    return 0;
+  }
+
+  struct ir_block **blocks = malloc(num_blocks * sizeof(struct ir_block *));
+  struct ir_instr **instrs = malloc(num_instrs * sizeof(struct ir_instr *));
+  r.refs = malloc(num_instrs * IR_MAX_ARGS * sizeof(struct ir_binary_ref));
+
+  int res = 1;
+  int index = 0;
+
+  for (int i = 0; res && i < (int)num_blocks; i++) {
+    struct ir_block *block = ir_append_block(ir);
+    ir_set_current_block(ir, block);
+    blocks[i] = block;
+
+    uint64_t block_instrs;
+    res = ir_read_binary_meta(&r, block) && ir_read_varint(&r, &block_instrs);
+
+    if (res && block_instrs > num_instrs - index) {
+      LOG_INFO("too many instrs in binary ir block");
+      res = 0;
+    }
+
+    for (int j = 0; res && j < (int)block_instrs; j++) {
+      res = ir_read_binary_instr(&r, index++, instrs);
+    }
+  }
+
+  if (res && (index != (int)num_instrs || r.ptr != r.end)) {
+    LOG_INFO("binary ir size mismatch");
+    res = 0;
+  }
+
+  if (res) {
+    res = ir_resolve_binary_refs(&r, blocks, (int)num_blocks, instrs,
+                                 (int)num_instrs);
+  }
+
+  free(r.refs);
+  free(instrs);
+  free(blocks);
+
+  return res;
+}
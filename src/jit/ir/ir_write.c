@@ -245,3 +245,174 @@ void ir_write(struct ir *ir, FILE *output) {
 
   ir_destroy_writer(&w);
 }
+
+/*
+ * binary format
+ *
+ * header:  magic, varint version, varint num_blocks, varint num_instrs
+ * block:   meta, varint num_instrs, instrs
+ * instr:   u8 op | has_meta << 7, u8 result_type | arg_mask << 4, args,
+ *          meta if has_meta
+ * meta:    u8 kind_mask, a constant value for each kind set
+ * value:   u8 type | is_ref << 7, followed by either the zigzag encoded
+ *          distance to the defining instruction, the index of the referenced
+ *          block, an integer constant as a varint or a float constant's bits
+ *          in little-endian order
+ */
+#define IR_BINARY_REF 0x80
+
+static void ir_write_varint(uint64_t v, FILE *output) {
+  while (v >= 0x80) {
+    fputc((int)(v & 0x7f) | 0x80, output);
+    v >>= 7;
+  }
+  fputc((int)v, output);
+}
+
+static void ir_write_fixed(uint64_t v, int size, FILE *output) {
+  for (int i = 0; i < size; i++) {
+    fputc((int)(v & 0xff), output);
+    v >>= 8;
+  }
+}
+
+static void ir_write_binary_value(struct ir_writer *w,
+                                  const struct ir_value *value, int index,
+                                  FILE *output) {
+  if (!ir_is_constant(value)) {
+    int64_t delta = index - ir_get_instr_label(w, value->def);
+    fputc(value->type | IR_BINARY_REF, output);
+    ir_write_varint((uint64_t)(delta << 1) ^ (uint64_t)(delta >> 63), output);
+    return;
+  }
+
+  fputc(value->type, output);
+
+  switch (value->type) {
+    case VALUE_I8:
+      ir_write_varint((uint8_t)value->i8, output);
+      break;
+    case VALUE_I16:
+      ir_write_varint((uint16_t)value->i16, output);
+      break;
+    case VALUE_I32:
+      ir_write_varint((uint32_t)value->i32, output);
+      break;
+    case VALUE_I64:
+      ir_write_varint((uint64_t)value->i64, output);
+      break;
+    case VALUE_F32: {
+      float v = value->f32;
+      ir_write_fixed(*(uint32_t *)&v, 4, output);
+    } break;
+    case VALUE_F64: {
+      double v = value->f64;
+      ir_write_fixed(*(uint64_t *)&v, 8, output);
+    } break;
+    case VALUE_BLOCK:
+      ir_write_varint(ir_get_block_label(w, value->blk), output);
+      break;
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+}
+
+static int ir_get_meta_mask(struct ir_writer *w, const void *obj) {
+  int mask = 0;
+
+  for (int kind = 0; kind < IR_NUM_META; kind++) {
+    if (ir_get_meta(w->ir, obj, kind)) {
+      mask |= 1 << kind;
+    }
+  }
+
+  return mask;
+}
+
+static void ir_write_binary_meta(struct ir_writer *w, const void *obj,
+                                 FILE *output) {
+  fputc(ir_get_meta_mask(w, obj), output);
+
+  for (int kind = 0; kind < IR_NUM_META; kind++) {
+    struct ir_value *value = ir_get_meta(w->ir, obj, kind);
+
+    if (value) {
+      ir_write_binary_value(w, value, 0, output);
+    }
+  }
+}
+
+static void ir_write_binary_instr(struct ir_writer *w,
+                                  const struct ir_instr *instr,
+                                  FILE *output) {
+  int index = ir_get_instr_label(w, instr);
+  int has_meta = ir_get_meta_mask(w, instr) != 0;
+  int type = instr->result ? instr->result->type : VALUE_V;
+  int arg_mask = 0;
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    if (instr->arg[i]) {
+      arg_mask |= 1 << i;
+    }
+  }
+
+  fputc(instr->op | (has_meta << 7), output);
+  fputc(type | (arg_mask << 4), output);
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    if (instr->arg[i]) {
+      ir_write_binary_value(w, instr->arg[i], index, output);
+    }
+  }
+
+  if (has_meta) {
+    ir_write_binary_meta(w, instr, output);
+  }
+}
+
+void ir_write_binary(struct ir *ir, FILE *output) {
+  /* the op and type have to fit in the bits left to them */
+  CHECK_LE(IR_NUM_OPS, 0x80);
+  CHECK_LE(VALUE_NUM, 0x10);
+
+  struct ir_writer w = {0};
+  w.ir = ir;
+  w.labels = malloc(sizeof(int) * ir->capacity);
+
+  /* number blocks and instructions separately, so both can be looked up
+     through an array when reading */
+  int num_blocks = 0;
+  int num_instrs = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    ir_insert_block_label(&w, block, num_blocks++);
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ir_insert_instr_label(&w, instr, num_instrs++);
+    }
+  }
+
+  fwrite(IR_BINARY_MAGIC, 1, IR_BINARY_MAGIC_SIZE, output);
+  ir_write_varint(IR_BINARY_VERSION, output);
+  ir_write_varint(num_blocks, output);
+  ir_write_varint(num_instrs, output);
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    int block_instrs = 0;
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ((void)instr);
+      block_instrs++;
+    }
+
+    ir_write_binary_meta(&w, block, output);
+    ir_write_varint(block_instrs, output);
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ir_write_binary_instr(&w, instr, output);
+    }
+  }
+
+  ir_destroy_writer(&w);
+}
@@ -2,86 +2,191 @@
 #include "core/core.h"
 #include "core/exception_handler.h"
 #include "core/filesystem.h"
+#include "core/hash.h"
+#include "core/md5.h"
+#include "core/memory.h"
+#include "core/profiler.h"
+#include "core/slab.h"
+#include "core/sort.h"
+#include "core/thread.h"
+#include "core/time.h"
+#include "core/version.h"
 #include "jit/ir/ir.h"
 #include "jit/jit_backend.h"
 #include "jit/jit_frontend.h"
+#include "jit/jit_guest.h"
+#include "jit/pass_stats.h"
 #include "jit/passes/constant_propagation_pass.h"
 #include "jit/passes/control_flow_analysis_pass.h"
+#include "jit/passes/conversion_elimination_pass.h"
 #include "jit/passes/dead_code_elimination_pass.h"
 #include "jit/passes/expression_simplification_pass.h"
+#include "jit/passes/global_value_numbering_pass.h"
 #include "jit/passes/load_store_elimination_pass.h"
+#include "jit/passes/memory_access_coalescing_pass.h"
 #include "jit/passes/register_allocation_pass.h"
 #include "options.h"
+#include "stats.h"
 
 #if PLATFORM_DARWIN || PLATFORM_LINUX
 #include <unistd.h>
 #endif
 
-static int block_map_cmp(const struct rb_node *rb_lhs,
-                         const struct rb_node *rb_rhs) {
-  const struct jit_block *lhs =
-      container_of(rb_lhs, const struct jit_block, it);
-  const struct jit_block *rhs =
-      container_of(rb_rhs, const struct jit_block, it);
+/*
+ * block lookup maps
+ *
+ * blocks are looked up by their guest address on each compile and link, and by
+ * their host address on each link and fastmem exception. the guest address
+ * map holds every version of a block under the same key, while the host
+ * address map buckets each block by the host pages its code spans, keeping each
+ * bucket sorted by host address so it can be binary searched
+ */
+#define JIT_PAGE_SHIFT 12
+#define JIT_CODE_REGIONS 8
+#define JIT_SLAB_CHUNK_SIZE (64 * 1024)
+
+static inline int jit_block_matches(struct jit_block *block,
+                                    uint32_t guest_addr, uint32_t flags) {
+  return block->guest_addr == guest_addr &&
+         (block->flags & block->flags_mask) == (flags & block->flags_mask);
+}
 
-  if (lhs->guest_addr < rhs->guest_addr) {
-    return -1;
-  } else if (lhs->guest_addr > rhs->guest_addr) {
-    return 1;
-  } else {
-    return 0;
+/* versioned blocks share the same guest address, and are distinguished by the
+   flags they were specialized on. if multiple versions match, e.g. when an
+   invalidated version is left behind, the valid one is preferred */
+static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr,
+                                       uint32_t flags) {
+  struct jit_block_map *map = &jit->blocks;
+  struct jit_block *stale = NULL;
+
+  for (int i = jit_block_map_find(map, guest_addr); i >= 0;
+       i = jit_block_map_find_next(map, guest_addr, i)) {
+    struct jit_block *block = *hash_map_value(map, i);
+
+    if (jit_block_matches(block, guest_addr, flags)) {
+      if (block->state == JIT_STATE_VALID) {
+        return block;
+      }
+
+      stale = stale ? stale : block;
+    }
   }
+
+  return stale;
 }
 
-static int reverse_block_map_cmp(const struct rb_node *rb_lhs,
-                                 const struct rb_node *rb_rhs) {
-  const struct jit_block *lhs =
-      container_of(rb_lhs, const struct jit_block, rit);
-  const struct jit_block *rhs =
-      container_of(rb_rhs, const struct jit_block, rit);
+static void jit_insert_block(struct jit *jit, struct jit_block *block) {
+  jit_block_map_insert(&jit->blocks, block->guest_addr, block);
+}
 
-  if (lhs->host_addr < rhs->host_addr) {
-    return -1;
-  } else if (lhs->host_addr > rhs->host_addr) {
-    return 1;
-  } else {
-    return 0;
+static void jit_remove_block(struct jit *jit, struct jit_block *block) {
+  struct jit_block_map *map = &jit->blocks;
+  int i = jit_block_map_find(map, block->guest_addr);
+
+  while (*hash_map_value(map, i) != block) {
+    i = jit_block_map_find_next(map, block->guest_addr, i);
+    CHECK_GE(i, 0);
   }
+
+  jit_block_map_remove_slot(map, i);
 }
 
-static struct rb_callbacks block_map_cb = {
-    &block_map_cmp, NULL, NULL,
-};
+static struct jit_page *jit_get_page(struct jit *jit, uintptr_t page) {
+  return jit_page_map_get(&jit->pages, page);
+}
 
-static struct rb_callbacks reverse_block_map_cb = {
-    &reverse_block_map_cmp, NULL, NULL,
-};
+static struct jit_page *jit_alloc_page(struct jit *jit, uintptr_t page) {
+  struct jit_page *p = jit_get_page(jit, page);
+
+  if (p) {
+    return p;
+  }
+
+  /* note, page buckets are never removed once allocated. the number of them is
+     bounded by the size of the backend's code buffer, and they're reused each
+     time the buffer is reset */
+  struct jit_page bucket;
+  bucket.num_blocks = 0;
+  bucket.max_blocks = 8;
+  bucket.blocks = malloc(bucket.max_blocks * sizeof(struct jit_block *));
+  jit_page_map_insert(&jit->pages, page, bucket);
+
+  return jit_get_page(jit, page);
+}
+
+/* returns the index of the first block in the page whose host address is
+   greater than host_addr */
+static int jit_page_upper_bound(struct jit_page *p, const uint8_t *host_addr) {
+  int lo = 0;
+  int hi = p->num_blocks;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+
+    if (p->blocks[mid]->host_addr <= host_addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+static void jit_insert_block_reverse(struct jit *jit, struct jit_block *block) {
+  uintptr_t begin = (uintptr_t)block->host_addr >> JIT_PAGE_SHIFT;
+  uintptr_t end = ((uintptr_t)block->host_addr + MAX(block->host_size, 1) - 1) >>
+                  JIT_PAGE_SHIFT;
+
+  for (uintptr_t page = begin; page <= end; page++) {
+    struct jit_page *p = jit_alloc_page(jit, page);
+
+    if (p->num_blocks == p->max_blocks) {
+      p->max_blocks *= 2;
+      p->blocks = realloc(p->blocks, p->max_blocks * sizeof(struct jit_block *));
+    }
+
+    int n = jit_page_upper_bound(p, block->host_addr);
+    memmove(&p->blocks[n + 1], &p->blocks[n],
+            (p->num_blocks - n) * sizeof(struct jit_block *));
+    p->blocks[n] = block;
+    p->num_blocks++;
+  }
+}
 
-static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr) {
-  struct jit_block search;
-  search.guest_addr = guest_addr;
+static void jit_remove_block_reverse(struct jit *jit, struct jit_block *block) {
+  uintptr_t begin = (uintptr_t)block->host_addr >> JIT_PAGE_SHIFT;
+  uintptr_t end = ((uintptr_t)block->host_addr + MAX(block->host_size, 1) - 1) >>
+                  JIT_PAGE_SHIFT;
 
-  return rb_find_entry(&jit->blocks, &search, struct jit_block, it,
-                       &block_map_cb);
+  for (uintptr_t page = begin; page <= end; page++) {
+    struct jit_page *p = jit_get_page(jit, page);
+    CHECK_NOTNULL(p);
+
+    int n = jit_page_upper_bound(p, block->host_addr) - 1;
+    CHECK(n >= 0 && p->blocks[n] == block);
+    memmove(&p->blocks[n], &p->blocks[n + 1],
+            (p->num_blocks - n - 1) * sizeof(struct jit_block *));
+    p->num_blocks--;
+  }
 }
 
 static struct jit_block *jit_lookup_block_reverse(struct jit *jit,
                                                   void *host_addr) {
-  struct jit_block search;
-  search.host_addr = host_addr;
+  struct jit_page *p =
+      jit_get_page(jit, (uintptr_t)host_addr >> JIT_PAGE_SHIFT);
 
-  struct rb_node *first = rb_first(&jit->reverse_blocks);
-  struct rb_node *last = rb_last(&jit->reverse_blocks);
-  struct rb_node *rit =
-      rb_upper_bound(&jit->reverse_blocks, &search.rit, &reverse_block_map_cb);
-
-  if (rit == first) {
+  if (!p) {
     return NULL;
   }
 
-  rit = rit ? rb_prev(rit) : last;
+  int n = jit_page_upper_bound(p, host_addr);
+
+  if (!n) {
+    return NULL;
+  }
 
-  struct jit_block *block = container_of(rit, struct jit_block, rit);
+  struct jit_block *block = p->blocks[n - 1];
   if ((uint8_t *)host_addr < (uint8_t *)block->host_addr ||
       (uint8_t *)host_addr >=
           ((uint8_t *)block->host_addr + block->host_size)) {
@@ -140,13 +245,13 @@ static void jit_invalidate_block(struct jit *jit, struct jit_block *block,
   list_for_each_entry_safe(edge, &block->in_edges, struct jit_edge, in_it) {
     list_remove(&edge->src->out_edges, &edge->out_it);
     list_remove(&block->in_edges, &edge->in_it);
-    free(edge);
+    slab_free(&jit->edge_slab, edge);
   }
 
   list_for_each_entry_safe(edge, &block->out_edges, struct jit_edge, out_it) {
     list_remove(&block->out_edges, &edge->out_it);
     list_remove(&edge->dst->in_edges, &edge->in_it);
-    free(edge);
+    slab_free(&jit->edge_slab, edge);
   }
 }
 
@@ -157,45 +262,129 @@ static void jit_cache_block(struct jit *jit, struct jit_block *block) {
   CHECK(list_empty(&block->out_edges));
 }
 
-static void jit_free_block(struct jit *jit, struct jit_block *block) {
+static void jit_cancel_code(struct jit *jit, struct jit_block *block);
+static void jit_watch_block(struct jit *jit, struct jit_block *block);
+
+static int jit_meta_class(int size) {
+  int shift = 32 - clz32((uint32_t)MAX(size, 2) - 1);
+  return MAX(shift, JIT_META_MIN_SHIFT) - JIT_META_MIN_SHIFT;
+}
+
+static void *jit_alloc_meta(struct jit *jit, int size) {
+  int cls = jit_meta_class(size);
+
+  if (cls >= JIT_META_CLASSES) {
+    return calloc(1, size);
+  }
+
+  return slab_alloc(&jit->meta_slabs[cls]);
+}
+
+static void jit_free_meta(struct jit *jit, void *ptr, int size) {
+  int cls = jit_meta_class(size);
+
+  if (cls >= JIT_META_CLASSES) {
+    free(ptr);
+    return;
+  }
+
+  slab_free(&jit->meta_slabs[cls], ptr);
+}
+
+static int jit_meta_size(struct jit_block *block) {
+  return block->num_instrs * (int)(sizeof(void *) + sizeof(int8_t));
+}
+
+/* returns the index of the last instruction whose code starts at or before
+   the host pc */
+static int jit_lookup_instr(struct jit_block *block, uintptr_t pc) {
+  int found = 0;
+
+  for (int i = 0; i < block->num_instrs; i++) {
+    /* ignore empty entries */
+    if (!block->source_map[i]) {
+      continue;
+    }
+    if ((uintptr_t)block->source_map[i] > pc) {
+      break;
+    }
+    found = i;
+  }
+
+  return found;
+}
+
+static inline int jit_instr_index(struct jit *jit, struct jit_block *block,
+                                  uint32_t guest_addr) {
+  return (int)(guest_addr - block->guest_addr) / jit->frontend->instr_size;
+}
+
+/* tears down everything referencing the block, without returning its memory
+   or removing it from the lookup maps */
+static void jit_release_block(struct jit *jit, struct jit_block *block) {
   jit_invalidate_block(jit, block, 0);
+  jit_cancel_code(jit, block);
+
+  if (block->hot) {
+    list_remove(&jit->hot_blocks, &block->hot_it);
+  }
+
+  if (block->profile) {
+    if (jit->prof_sample == block->profile) {
+      jit->prof_sample = NULL;
+    }
+    free(block->profile);
+  }
+}
 
-  free(block->source_map);
-  free(block->fastmem);
+static void jit_free_block(struct jit *jit, struct jit_block *block) {
+  jit_release_block(jit, block);
 
-  rb_unlink(&jit->blocks, &block->it, &block_map_cb);
-  rb_unlink(&jit->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  jit_remove_block(jit, block);
+  jit_remove_block_reverse(jit, block);
 
-  free(block);
+  jit_free_meta(jit, block->source_map, jit_meta_size(block));
+  slab_free(&jit->block_slab, block);
 }
 
 static void jit_finalize_block(struct jit *jit, struct jit_block *block) {
   CHECK(list_empty(&block->in_edges) && list_empty(&block->out_edges),
         "code shouldn't have any existing edges");
-  CHECK(rb_empty_node(&block->it) && rb_empty_node(&block->rit),
+  struct jit_block *existing =
+      jit_get_block(jit, block->guest_addr, block->flags);
+  CHECK(!existing || existing->state != JIT_STATE_VALID,
         "code was already inserted in lookup tables");
 
   jit_cache_block(jit, block);
 
-  rb_insert(&jit->blocks, &block->it, &block_map_cb);
-  rb_insert(&jit->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  jit_insert_block(jit, block);
+  jit_insert_block_reverse(jit, block);
+
+  if (OPTION_jit_smc) {
+    jit_watch_block(jit, block);
+  }
 }
 
 static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr,
                                          int guest_size) {
-  struct jit_block *block = calloc(1, sizeof(struct jit_block));
+  struct jit_guest *guest = jit->frontend->guest;
+  int instr_size = jit->frontend->instr_size;
+  struct jit_block *block = slab_alloc(&jit->block_slab);
 
   block->guest_addr = guest_addr;
   block->guest_size = guest_size;
+  block->immutable =
+      guest->immutable && guest->immutable(guest->mem, guest_addr, guest_size);
+  block->num_instrs = (guest_size + instr_size - 1) / instr_size;
 
-  /* allocate meta data structs for the original guest code */
-  block->source_map = calloc(block->guest_size, sizeof(void *));
-  block->fastmem = calloc(block->guest_size, sizeof(int8_t));
+  /* allocate meta data for each instruction of the original guest code */
+  block->source_map = jit_alloc_meta(jit, jit_meta_size(block));
+  block->fastmem = (int8_t *)(block->source_map + block->num_instrs);
 
 #ifdef HAVE_FASTMEM
   /* enable fastmem for all accesses by default, falling back to the slow route
      only after a segfault occurs. see jit_handle_exception */
-  for (int i = 0; i < block->guest_size; i++) {
+  for (int i = 0; i < block->num_instrs; i++) {
     block->fastmem[i] = 1;
   }
 #endif
@@ -203,50 +392,358 @@ static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr,
   return block;
 }
 
+/*
+ * code buffer eviction
+ *
+ * the backend's code buffer is split into equally sized regions which are
+ * filled in order, wrapping back around to the first region once the buffer
+ * is full. the region after the one being emitted to is always kept empty,
+ * so that a block which crosses into it never overwrites live code. as the
+ * emitter moves into a new region, the next one is evicted by freeing every
+ * block overlapping it. this way, only the oldest code is thrown out when the
+ * buffer fills up
+ *
+ * backends which can grow their buffer are given the chance to before it
+ * wraps, in which case nothing is evicted
+ */
+static int jit_code_region_size(struct jit *jit) {
+  return jit->backend->code_size / JIT_CODE_REGIONS;
+}
+
+static int jit_code_region(struct jit *jit, const uint8_t *host_addr) {
+  int offset = (int)(host_addr - jit->backend->code);
+  int region = offset / jit_code_region_size(jit);
+  return MIN(region, JIT_CODE_REGIONS - 1);
+}
+
+static void jit_evict_region(struct jit *jit, int region) {
+  int region_size = jit_code_region_size(jit);
+  uint8_t *begin = jit->backend->code + region * region_size;
+  uint8_t *end = region == JIT_CODE_REGIONS - 1
+                     ? jit->backend->code + jit->backend->code_size
+                     : begin + region_size;
+
+  uintptr_t first = (uintptr_t)begin >> JIT_PAGE_SHIFT;
+  uintptr_t last = (uintptr_t)(end - 1) >> JIT_PAGE_SHIFT;
+
+  for (uintptr_t page = first; page <= last; page++) {
+    struct jit_page *p = jit_get_page(jit, page);
+
+    if (!p) {
+      continue;
+    }
+
+    /* freeing a block removes it from each page bucket it overlaps, and
+       restores any edges branching into it from other regions */
+    while (p->num_blocks) {
+      jit_free_block(jit, p->blocks[0]);
+    }
+  }
+}
+
+static void jit_advance_region(struct jit *jit, struct jit_block *block) {
+  if (!jit->backend->code) {
+    return;
+  }
+
+  /* a block must never span more than the empty region ahead of it */
+  CHECK_LT(block->host_size, jit_code_region_size(jit));
+
+  int region = jit_code_region(jit, block->host_addr + block->host_size);
+
+  while (jit->code_region != region) {
+    jit->code_region = (jit->code_region + 1) % JIT_CODE_REGIONS;
+    jit_evict_region(jit, (jit->code_region + 1) % JIT_CODE_REGIONS);
+  }
+}
+
+static int jit_grow_region(struct jit *jit, struct jit_block *block) {
+  struct jit_backend *backend = jit->backend;
+
+  if (!backend->grow_code || !backend->grow_code(backend)) {
+    return 0;
+  }
+
+  /* the regions grow along with the buffer, leaving the code emitted so far
+     packed into the lower ones. the emitter resumes from where the block
+     that overflowed began */
+  jit->code_region = jit_code_region(jit, block->host_addr);
+  jit_evict_region(jit, (jit->code_region + 1) % JIT_CODE_REGIONS);
+
+  exception_handler_update_range(
+      jit->exc_handler, jit->exc_range, (uintptr_t)backend->code,
+      (uintptr_t)(backend->code + backend->code_size));
+
+  return 1;
+}
+
+static void jit_wrap_region(struct jit *jit) {
+  /* move the emitter back to the start of the code buffer. the first region
+     was the region ahead of the last, so it should already be empty */
+  jit->backend->reset(jit->backend);
+  jit->code_region = 0;
+
+  if (jit->backend->code) {
+    jit_evict_region(jit, 0);
+    jit_evict_region(jit, 1);
+  }
+}
+
+/*
+ * self-modifying code tracking
+ *
+ * when enabled, each guest page code is compiled from has a single-write watch
+ * placed on both its fastmem mapping and the guest memory backing it. once a
+ * watch fires, only the blocks overlapping that page are invalidated. pages
+ * which are written to repeatedly, e.g. due to the guest storing data next to
+ * its code, stop being watched to avoid constantly faulting, leaving their
+ * blocks to be validated by checksum when the guest flushes its instruction
+ * cache. this is also what catches writes made through the page's other
+ * mirrors, which aren't watched
+ */
+#define JIT_SMC_MAX_WRITES 8
+#define JIT_SMC_MAX_WATCHES 4096
+
+static uint32_t jit_checksum_code(struct jit *jit, struct jit_block *block) {
+  struct jit_guest *guest = jit->frontend->guest;
+
+  /* fnv-1a */
+  uint32_t hash = 0x811c9dc5;
+
+  for (int i = 0; i < block->guest_size; i++) {
+    hash ^= guest->r8(guest->mem, block->guest_addr + i);
+    hash *= 0x01000193;
+  }
+
+  return hash;
+}
+
+static struct jit_code_page *jit_alloc_code_page(struct jit *jit,
+                                                 uint32_t page) {
+  struct jit_code_page **existing =
+      jit_code_page_map_get(&jit->code_pages, page);
+
+  if (existing) {
+    return *existing;
+  }
+
+  /* note, like the host page buckets, code pages are never removed. they're
+     bounded by the size of the guest's memory */
+  struct jit_guest *guest = jit->frontend->guest;
+  uint32_t addr = page << JIT_PAGE_SHIFT;
+
+  struct jit_code_page *p = calloc(1, sizeof(struct jit_code_page));
+  p->jit = jit;
+  p->guest_page = page;
+  guest->lookup(guest->mem, addr, NULL, &p->ptrs[1], NULL, NULL);
+
+  /* only pages backed by memory can be watched, code in mmio regions is
+     assumed to be read-only. the fastmem mapping is indexed by physical
+     address, so it's only the page's own while the guest isn't translating */
+  if (p->ptrs[1] && guest->membase && !guest->tlb) {
+    p->ptrs[0] = (uint8_t *)guest->membase + addr;
+  }
+
+  jit_code_page_map_insert(&jit->code_pages, page, p);
+
+  return p;
+}
+
+static void jit_invalidate_page(struct jit *jit, struct jit_code_page *p) {
+  uint32_t begin = p->guest_page << JIT_PAGE_SHIFT;
+  uint32_t end = begin + (1 << JIT_PAGE_SHIFT);
+
+  /* writes to code are rare enough that it's not worth maintaining a list of
+     the blocks overlapping each page */
+  hash_map_for_each(i, &jit->blocks, jit_block_map) {
+    struct jit_block *block = *hash_map_value(&jit->blocks, i);
+
+    if (block->state == JIT_STATE_INVALID) {
+      continue;
+    }
+
+    if (block->guest_addr < end &&
+        block->guest_addr + block->guest_size > begin) {
+      jit_invalidate_block(jit, block, 0);
+    }
+  }
+}
+
+static void jit_code_page_written(const struct exception_state *ex,
+                                  void *data) {
+  struct jit_code_page *p = data;
+  struct jit *jit = p->jit;
+  uintptr_t page_size = get_page_size();
+
+  /* the watcher removes the watch after this returns, figure out which of
+     the page's watches it was */
+  for (int i = 0; i < 2; i++) {
+    uintptr_t ptr = ALIGN_DOWN((uintptr_t)p->ptrs[i], page_size);
+
+    if (p->watches[i] && ex->fault_addr >= ptr &&
+        ex->fault_addr < ptr + page_size) {
+      p->watches[i] = NULL;
+      jit->num_code_watches--;
+    }
+  }
+
+  p->num_writes++;
+
+  /* note, this is called while code may be executing, so blocks are only
+     invalidated and not freed */
+  jit_invalidate_page(jit, p);
+}
+
+static void jit_watch_block(struct jit *jit, struct jit_block *block) {
+  uint32_t first = block->guest_addr >> JIT_PAGE_SHIFT;
+  uint32_t last = (block->guest_addr + block->guest_size - 1) >> JIT_PAGE_SHIFT;
+
+  for (uint32_t page = first; page <= last; page++) {
+    struct jit_code_page *p = jit_alloc_code_page(jit, page);
+
+    if (p->num_writes >= JIT_SMC_MAX_WRITES) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      if (!p->ptrs[i] || p->watches[i] ||
+          jit->num_code_watches >= JIT_SMC_MAX_WATCHES) {
+        continue;
+      }
+
+      p->watches[i] = add_single_write_watch(
+          p->ptrs[i], 1 << JIT_PAGE_SHIFT, &jit_code_page_written, p);
+      jit->num_code_watches++;
+    }
+  }
+}
+
+static void jit_unwatch_code(struct jit *jit) {
+  uintptr_t page_size = get_page_size();
+
+  hash_map_for_each(i, &jit->code_pages, jit_code_page_map) {
+    struct jit_code_page *p = *hash_map_value(&jit->code_pages, i);
+
+    for (int j = 0; j < 2; j++) {
+      if (!p->watches[j]) {
+        continue;
+      }
+
+      /* removing a watch doesn't restore the page's permissions */
+      void *ptr = (void *)ALIGN_DOWN((uintptr_t)p->ptrs[j], page_size);
+      CHECK(protect_pages(ptr, page_size, ACC_READWRITE));
+      remove_memory_watch(p->watches[j]);
+    }
+
+    free(p);
+  }
+
+  jit_code_page_map_destroy(&jit->code_pages);
+}
+
 void jit_free_code(struct jit *jit) {
-  /* invalidate code pointers and remove block entries from lookup maps. this
-     is only safe to use when no code is currently executing */
-  struct rb_node *it = rb_first(&jit->blocks);
+  /* invalidate code pointers and clear the lookup maps. this is only safe to
+     use when no code is currently executing */
+  hash_map_for_each(i, &jit->blocks, jit_block_map) {
+    struct jit_block *block = *hash_map_value(&jit->blocks, i);
+    jit_release_block(jit, block);
+
+    /* only meta data too large for the slabs needs to be freed individually */
+    if (jit_meta_class(jit_meta_size(block)) >= JIT_META_CLASSES) {
+      free(block->source_map);
+    }
+  }
 
-  while (it) {
-    struct rb_node *next = rb_next(it);
+  jit_block_map_clear(&jit->blocks);
 
-    struct jit_block *block = container_of(it, struct jit_block, it);
-    jit_free_block(jit, block);
+  hash_map_for_each(i, &jit->pages, jit_page_map) {
+    hash_map_value(&jit->pages, i)->num_blocks = 0;
+  }
 
-    it = next;
+  /* with every block gone, their memory can be reclaimed at once */
+  slab_reset(&jit->block_slab);
+  slab_reset(&jit->edge_slab);
+  for (int i = 0; i < JIT_META_CLASSES; i++) {
+    slab_reset(&jit->meta_slabs[i]);
   }
 
   /* have the backend reset its code buffers */
   jit->backend->reset(jit->backend);
+  jit->code_region = 0;
 }
 
 void jit_invalidate_code(struct jit *jit) {
   /* invalidate code pointers, but don't remove block entries from lookup maps.
      this is used when clearing the jit while code is currently executing */
-  struct rb_node *it = rb_first(&jit->blocks);
+  hash_map_for_each(i, &jit->blocks, jit_block_map) {
+    jit_invalidate_block(jit, *hash_map_value(&jit->blocks, i), 0);
+  }
+
+  /* don't reset backend code buffers, code is still running */
+}
 
-  while (it) {
-    struct rb_node *next = rb_next(it);
+void jit_invalidate_modified_code(struct jit *jit) {
+  /* blocks translated from immutable memory can't have been modified. without
+     smc detection, every other block is assumed to have been, else only those
+     whose guest code no longer matches what was translated are */
+  jit->reading_code = 1;
 
-    struct jit_block *block = container_of(it, struct jit_block, it);
-    jit_invalidate_block(jit, block, 0);
+  hash_map_for_each(i, &jit->blocks, jit_block_map) {
+    struct jit_block *block = *hash_map_value(&jit->blocks, i);
+
+    if (block->state == JIT_STATE_INVALID || block->immutable) {
+      continue;
+    }
 
-    it = next;
+    if (!OPTION_jit_smc || jit_checksum_code(jit, block) != block->checksum) {
+      jit_invalidate_block(jit, block, 0);
+    }
   }
 
-  /* don't reset backend code buffers, code is still running */
+  jit->reading_code = 0;
+}
+
+void jit_invalidate_blocks(struct jit *jit, jit_modified_cb modified,
+                           void *data) {
+  /* like jit_invalidate_modified_code, but the caller knows which guest code
+     has been modified */
+  hash_map_for_each(i, &jit->blocks, jit_block_map) {
+    struct jit_block *block = *hash_map_value(&jit->blocks, i);
+
+    if (block->state == JIT_STATE_INVALID) {
+      continue;
+    }
+
+    if (modified(data, block->guest_addr, block->guest_size)) {
+      jit_invalidate_block(jit, block, 0);
+    }
+  }
+}
+
+static uint32_t jit_translate_flags(struct jit *jit) {
+  if (!jit->frontend->translate_flags) {
+    return 0;
+  }
+
+  return jit->frontend->translate_flags(jit->frontend);
 }
 
 void jit_link_code(struct jit *jit, void *branch, uint32_t addr) {
   struct jit_block *src = jit_lookup_block_reverse(jit, branch);
-  struct jit_block *dst = jit_get_block(jit, addr);
+  struct jit_block *dst = jit_get_block(jit, addr, jit_translate_flags(jit));
 
-  if (jit_is_stale(jit, src) || !dst) {
+  if (jit_is_stale(jit, src) || !dst || jit_is_stale(jit, dst)) {
     return;
   }
 
-  struct jit_edge *edge = calloc(1, sizeof(struct jit_edge));
+  /* a versioned block only branches to another version of itself when its
+     guard fails. this must go through dispatch each time, to select the
+     version for the current guest state */
+  if (dst != src && dst->guest_addr == src->guest_addr) {
+    return;
+  }
+
+  struct jit_edge *edge = slab_alloc(&jit->edge_slab);
   edge->src = src;
   edge->dst = dst;
   edge->branch = branch;
@@ -256,6 +753,12 @@ void jit_link_code(struct jit *jit, void *branch, uint32_t addr) {
   jit_patch_edges(jit, src);
 }
 
+void jit_uncache_code(struct jit *jit, uint32_t guest_addr) {
+  /* the next branch to the address goes through jit_compile_code, which
+     selects the version of the block for the current guest state */
+  jit->backend->invalidate_code(jit->backend, guest_addr);
+}
+
 static void jit_write_block(struct jit *jit, struct jit_block *block,
                             struct ir *ir, FILE *output) {
   ir_write(ir, output);
@@ -288,103 +791,915 @@ static void jit_dump_block(struct jit *jit, const char *type,
   fclose(file);
 }
 
-static void jit_emit_callback(struct jit *jit, int type, uint32_t guest_addr,
-                              uint8_t *host_addr) {
-  struct jit_block *block = jit->curr_block;
+/*
+ * persistent code cache
+ *
+ * optimized ir is written out to the application directory as blocks are
+ * compiled, and read back in on future runs to skip translation and the bulk
+ * of the optimization passes. host pointers embedded in the ir are rewritten
+ * relative to the executable image or the guest's runtime data, enabling the
+ * cached ir to survive address space randomization. only the targets of calls
+ * and fallbacks are known to point into the image, a block holding any other
+ * host pointer (e.g. one to heap memory) isn't cached
+ */
+#define JIT_RELOC_MASK UINT64_C(0xffff000000000000)
+#define JIT_RELOC_IMAGE UINT64_C(0x5a5a000000000000)
+#define JIT_RELOC_DATA UINT64_C(0x5a5b000000000000)
+#define JIT_RELOC_RANGE INT64_C(0x80000000)
+
+static void jit_cache_path(struct jit *jit, const char *key, char *path,
+                           size_t size) {
+  const char *appdir = fs_appdir();
 
-  switch (type) {
-    case JIT_EMIT_INSTR:
-      block->source_map[guest_addr - block->guest_addr] = host_addr;
-      break;
-  }
+  char cachedir[PATH_MAX];
+  snprintf(cachedir, sizeof(cachedir), "%s" PATH_SEPARATOR "%s-cache", appdir,
+           jit->tag);
+  CHECK(fs_mkdir(cachedir));
+
+  /* entries are stored in the binary ir format */
+  snprintf(path, size, "%s" PATH_SEPARATOR "%s.bin", cachedir, key);
 }
 
-static void jit_promote_fastmem(struct jit *jit, struct jit_block *block,
-                                struct ir *ir) {
-  uint32_t last_addr = block->guest_addr;
+static void jit_cache_key(struct jit *jit, struct jit_block *block,
+                          char *key) {
+  struct jit_guest *guest = jit->frontend->guest;
+  uint32_t flags = 0;
 
-  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
-    list_for_each_entry_safe(instr, &blk->instrs, struct ir_instr, it) {
-      int fastmem = block->fastmem[last_addr - block->guest_addr];
+  if (jit->frontend->translate_flags) {
+    flags = jit->frontend->translate_flags(jit->frontend);
+  }
 
-      if (instr->op == OP_SOURCE_INFO) {
-        last_addr = instr->arg[0]->i32;
-      } else if (instr->op == OP_LOAD_GUEST && fastmem) {
-        instr->op = OP_LOAD_FAST;
-      } else if (instr->op == OP_STORE_GUEST && fastmem) {
-        instr->op = OP_STORE_FAST;
-      }
-    }
+  /* key the ir on everything that the translation depends on. the build
+     version is included as any change to the frontend or passes invalidates
+     previously cached ir */
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+  MD5_Update(&md5_ctx, GIT_VERSION, sizeof(GIT_VERSION));
+  MD5_Update(&md5_ctx, &block->guest_addr, sizeof(block->guest_addr));
+  MD5_Update(&md5_ctx, &block->guest_size, sizeof(block->guest_size));
+  MD5_Update(&md5_ctx, &flags, sizeof(flags));
+  MD5_Update(&md5_ctx, block->fastmem, block->num_instrs);
+
+  /* ir translated while the guest translates its addresses keeps its memory
+     accesses precise, and is only valid under the same mode */
+  uint8_t translated = guest->tlb != NULL;
+  MD5_Update(&md5_ctx, &translated, sizeof(translated));
+
+  /* immutable blocks have their pc-relative loads folded into the ir, so the
+     literals following the block are part of the key as well */
+  int size = block->guest_size;
+  if (block->immutable) {
+    size += jit->frontend->literal_range;
   }
-}
 
-void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
-#if 0
-  LOG_INFO("jit_compile_block %s 0x%08x", jit->tag, guest_addr);
-#endif
+  for (int i = 0; i < size; i++) {
+    uint8_t data = guest->r8(guest->mem, block->guest_addr + i);
+    MD5_Update(&md5_ctx, &data, sizeof(data));
+  }
 
-  /* analyze the guest code to get its extents */
-  int guest_size;
-  jit->frontend->analyze_code(jit->frontend, guest_addr, &guest_size);
+  MD5_Final(key, &md5_ctx);
+}
 
-  /* create block */
-  struct jit_block *block = jit_alloc_block(jit, guest_addr, guest_size);
-  jit->curr_block = block;
+static int jit_cache_is_code_ptr(struct ir_instr *instr, int arg) {
+  return arg == 0 && (instr->op == OP_CALL || instr->op == OP_CALL_COND ||
+                      instr->op == OP_FALLBACK);
+}
 
-  /* if the block had previously been invalidated, finish removing it now */
-  struct jit_block *existing = jit_get_block(jit, guest_addr);
+static int jit_cache_relocate(struct jit *jit, struct ir *ir, int restore) {
+  struct jit_guest *guest = jit->frontend->guest;
+  int64_t image = (int64_t)(intptr_t)&jit_compile_code;
+  int64_t data = (int64_t)(intptr_t)guest->data;
 
-  if (existing) {
-    /* if the block was invalidated due to a fastmem exception, persist its
-       fastmem state */
-    if (existing->state != JIT_STATE_INVALID) {
-      CHECK_EQ(block->guest_size, existing->guest_size);
-      memcpy(block->fastmem, existing->fastmem,
-             block->guest_size * sizeof(int8_t));
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        struct ir_value *arg = instr->arg[i];
+
+        if (!arg || !ir_is_constant(arg) || arg->type != VALUE_I64) {
+          continue;
+        }
+
+        int64_t v = arg->i64;
+        uint64_t reloc = (uint64_t)v & JIT_RELOC_MASK;
+
+        if (restore) {
+          if (reloc == JIT_RELOC_DATA) {
+            v = data;
+          } else if (reloc == JIT_RELOC_IMAGE) {
+            /* sign extend the 48-bit offset */
+            v = image + ((int64_t)((uint64_t)v << 16) >> 16);
+          } else {
+            continue;
+          }
+        } else {
+          if (v == data) {
+            v = (int64_t)JIT_RELOC_DATA;
+          } else if (v >= INT32_MIN && v <= UINT32_MAX) {
+            /* constants derived from guest values aren't pointers */
+            continue;
+          } else if (jit_cache_is_code_ptr(instr, i) &&
+                     ABS(v - image) < JIT_RELOC_RANGE) {
+            uint64_t offset = (uint64_t)(v - image) & ~JIT_RELOC_MASK;
+            v = (int64_t)(JIT_RELOC_IMAGE | offset);
+          } else {
+            /* a heap pointer, or a pointer outside of the image, the ir
+               can't be cached */
+            return 0;
+          }
+        }
+
+        ir_set_arg(ir, instr, i, ir_alloc_i64(ir, v));
+      }
     }
-
-    jit_free_block(jit, existing);
   }
 
-  /* translate guest code into ir */
-  struct ir ir = {0};
-  ir.buffer = jit->ir_buffer;
-  ir.capacity = sizeof(jit->ir_buffer);
-  jit->frontend->translate_code(jit->frontend, guest_addr, guest_size, &ir);
+  return 1;
+}
 
-  /* dump raw ir */
-  if (jit->dump_code) {
-    jit_dump_block(jit, "raw", block, &ir);
+static int jit_cache_load(struct jit *jit, const char *key, struct ir *ir) {
+  char filename[PATH_MAX];
+  jit_cache_path(jit, key, filename, sizeof(filename));
+
+  FILE *input = fopen(filename, "rb");
+  if (!input) {
+    return 0;
   }
 
-  /* run optimization passes */
-  jit_promote_fastmem(jit, block, &ir);
-  cfa_run(jit->cfa, &ir);
-  lse_run(jit->lse, &ir);
-  cprop_run(jit->cprop, &ir);
-  esimp_run(jit->esimp, &ir);
-  dce_run(jit->dce, &ir);
-  ra_run(jit->ra, &ir);
+  fseek(input, 0, SEEK_END);
+  long size = ftell(input);
+  fseek(input, 0, SEEK_SET);
 
-  /* assemble the ir into native code */
-  int res = jit->backend->assemble_code(jit->backend, &ir, &block->host_addr,
-                                        &block->host_size,
-                                        (jit_emit_cb)jit_emit_callback, jit);
+  uint8_t *data = malloc(MAX(size, 1));
+  int res = size > 0 && (long)fread(data, 1, size, input) == size &&
+            ir_read_binary(data, (int)size, ir);
+  free(data);
+  fclose(input);
 
   if (!res) {
-    /* if the backend overflowed, completely free the cache and let dispatch
-       try to compile again */
+    LOG_WARNING("jit_cache_load failed to parse %s", filename);
+
+    /* reset the partially parsed ir */
+    ir_init(ir, ir->buffer, ir->capacity);
+    return 0;
+  }
+
+  jit_cache_relocate(jit, ir, 1);
+
+  return 1;
+}
+
+static void jit_cache_store(struct jit *jit, const char *key, struct ir *ir) {
+  if (jit_cache_relocate(jit, ir, 0)) {
+    char filename[PATH_MAX];
+    jit_cache_path(jit, key, filename, sizeof(filename));
+
+    /* write to a temporary file first to avoid ever reading a partial entry */
+    char tmpname[PATH_MAX];
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+    FILE *output = fopen(tmpname, "wb");
+
+    if (output) {
+      ir_write_binary(ir, output);
+      fclose(output);
+
+      if (rename(tmpname, filename)) {
+        remove(tmpname);
+      }
+    }
+  }
+
+  /* always restore, relocation may have partially succeeded */
+  jit_cache_relocate(jit, ir, 1);
+}
+
+static void jit_destroy_passes(struct jit_passes *passes) {
+  if (passes->ra) {
+    ra_destroy(passes->ra);
+  }
+
+  if (passes->dce) {
+    dce_destroy(passes->dce);
+  }
+
+  if (passes->cve) {
+    cve_destroy(passes->cve);
+  }
+
+  if (passes->mac) {
+    mac_destroy(passes->mac);
+  }
+
+  if (passes->gvn) {
+    gvn_destroy(passes->gvn);
+  }
+
+  if (passes->esimp) {
+    esimp_destroy(passes->esimp);
+  }
+
+  if (passes->cprop) {
+    cprop_destroy(passes->cprop);
+  }
+
+  if (passes->lse) {
+    lse_destroy(passes->lse);
+  }
+
+  if (passes->cfa) {
+    cfa_destroy(passes->cfa);
+  }
+}
+
+static void jit_create_passes(struct jit *jit, struct jit_passes *passes) {
+  passes->cfa = cfa_create();
+  passes->lse = lse_create();
+  passes->cprop = cprop_create();
+  passes->esimp = esimp_create();
+  passes->gvn = gvn_create();
+  passes->mac = mac_create();
+  passes->cve = cve_create();
+  passes->dce = dce_create();
+  passes->ra = ra_create(jit->backend->registers, jit->backend->num_registers,
+                         jit->backend->emitters, jit->backend->num_emitters);
+}
+
+static void jit_emit_callback(struct jit *jit, int type, uint32_t guest_addr,
+                              uint8_t *host_addr) {
+  struct jit_block *block = jit->curr_block;
+
+  switch (type) {
+    case JIT_EMIT_INSTR:
+      block->source_map[jit_instr_index(jit, block, guest_addr)] = host_addr;
+      break;
+  }
+}
+
+/*
+ * fastmem fault tracking
+ *
+ * each fastmem exception is counted against the guest page it faulted on.
+ * when a block is recompiled after faulting, each of its accesses made
+ * relative to the same base as an access which faulted is assumed to hit the
+ * same page, and is moved to the slow path along with it. accesses to
+ * constant addresses are instead checked against the address space, and the
+ * pages which have faulted before. this stops a block touching an mmio region
+ * from faulting, and being recompiled, once for each of its accesses
+ */
+#define JIT_FAULT_PAGE_SHIFT 12
+#define JIT_MAX_SLOW_BASES 16
+
+DEFINE_AGGREGATE_COUNTER(fastmem_faults);
+DEFINE_AGGREGATE_COUNTER(fastmem_recompiles);
+
+static void jit_add_fault(struct jit *jit, uint32_t guest_addr) {
+  uint32_t page = guest_addr >> JIT_FAULT_PAGE_SHIFT;
+  int *num_faults = jit_fault_map_get(&jit->fault_pages, page);
+
+  /* like the code pages, fault pages are never removed. they're bounded by the
+     number of mmio pages in the guest's address space */
+  if (num_faults) {
+    (*num_faults)++;
+  } else {
+    jit_fault_map_insert(&jit->fault_pages, page, 1);
+  }
+
+  prof_counter_add(COUNTER_fastmem_faults, 1);
+}
+
+/* find the value an address was computed from, ignoring any constant offset
+   applied to it. guest registers are loaded from the context separately for
+   each access at this point, so they're identified by their context offset */
+static intptr_t jit_fastmem_base(const struct ir_value *addr) {
+  while (addr->def &&
+         (addr->def->op == OP_ADD || addr->def->op == OP_SUB) &&
+         ir_is_constant(addr->def->arg[1])) {
+    addr = addr->def->arg[0];
+  }
+
+  if (addr->def && addr->def->op == OP_LOAD_CONTEXT) {
+    return -(intptr_t)addr->def->arg[0]->i32 - 1;
+  }
+
+  return (intptr_t)addr;
+}
+
+static int jit_fastmem_slow_addr(struct jit *jit, uint32_t addr) {
+  struct jit_guest *guest = jit->frontend->guest;
+
+  /* pages without directly accessible memory are mmio */
+  uint8_t *ptr;
+  guest->lookup(guest->mem, addr, NULL, &ptr, NULL, NULL);
+
+  if (!ptr) {
+    return 1;
+  }
+
+  return jit_fault_map_find(&jit->fault_pages, addr >> JIT_FAULT_PAGE_SHIFT) >=
+         0;
+}
+
+static void jit_promote_fastmem(struct jit *jit, struct jit_block *block,
+                                struct ir *ir) {
+  struct jit_guest *guest = jit->frontend->guest;
+  intptr_t slow_bases[JIT_MAX_SLOW_BASES];
+  int num_slow_bases = 0;
+
+  /* the guest has disabled direct access to its address space, or is
+     translating the addresses it accesses without the backend checking its
+     tlb inline */
+  if (!guest->membase || (guest->tlb && !jit->backend->tlb_fastmem)) {
+    return;
+  }
+
+  /* collect the bases of accesses which have faulted */
+  if (block->num_faults) {
+    uint32_t last_addr = block->guest_addr;
+
+    list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+      list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+        int fastmem = block->fastmem[jit_instr_index(jit, block, last_addr)];
+
+        if (instr->op == OP_SOURCE_INFO) {
+          last_addr = instr->arg[0]->i32;
+        } else if ((instr->op == OP_LOAD_GUEST ||
+                    instr->op == OP_STORE_GUEST) &&
+                   !fastmem && num_slow_bases < JIT_MAX_SLOW_BASES) {
+          slow_bases[num_slow_bases++] = jit_fastmem_base(instr->arg[0]);
+        }
+      }
+    }
+  }
+
+  uint32_t last_addr = block->guest_addr;
+
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry_safe(instr, &blk->instrs, struct ir_instr, it) {
+      int fastmem = block->fastmem[jit_instr_index(jit, block, last_addr)];
+
+      if (instr->op == OP_SOURCE_INFO) {
+        last_addr = instr->arg[0]->i32;
+        continue;
+      }
+
+      if (instr->op != OP_LOAD_GUEST && instr->op != OP_STORE_GUEST) {
+        continue;
+      }
+
+      const struct ir_value *addr = instr->arg[0];
+
+      if (fastmem && ir_is_constant(addr)) {
+        fastmem = !jit_fastmem_slow_addr(jit, addr->i32);
+      } else if (fastmem) {
+        intptr_t base = jit_fastmem_base(addr);
+
+        for (int i = 0; i < num_slow_bases && fastmem; i++) {
+          fastmem = slow_bases[i] != base;
+        }
+      }
+
+      if (!fastmem) {
+        continue;
+      }
+
+      instr->op = instr->op == OP_LOAD_GUEST ? OP_LOAD_FAST : OP_STORE_FAST;
+    }
+  }
+}
+
+static void jit_profile_block(struct jit *jit, struct jit_block *block,
+                              struct ir *ir);
+
+static void jit_translate_code(struct jit *jit, struct jit_block *block,
+                               struct ir *ir) {
+  struct jit_guest *guest = jit->frontend->guest;
+
+  block->flags = jit_translate_flags(jit);
+
+  if (OPTION_jit_smc) {
+    block->checksum = jit_checksum_code(jit, block);
+  }
+
+  /* accesses made while the guest translates addresses may raise exceptions,
+     the passes must keep the context up to date at each of them */
+  ir->precise_memory = guest->tlb != NULL;
+
+  /* translate guest code into ir */
+  struct pass_timer timer;
+  pass_timer_begin(&timer, PASS_TRANSLATE, ir);
+  block->flags_mask = jit->frontend->translate_code(
+      jit->frontend, block->guest_addr, block->guest_size, ir);
+  pass_timer_end(&timer, ir);
+
+  /* dump raw ir */
+  if (jit->dump_code) {
+    jit_dump_block(jit, "raw", block, ir);
+  }
+
+  jit_promote_fastmem(jit, block, ir);
+
+  if (jit->profile_code) {
+    jit_profile_block(jit, block, ir);
+  }
+}
+
+static void jit_hot_block(struct jit *jit, struct jit_block *block) {
+  /* called from compiled code, the block can't be recompiled until control
+     returns to jit_run */
+  if (block->hot) {
+    return;
+  }
+
+  block->hot = 1;
+  list_add(&jit->hot_blocks, &block->hot_it);
+}
+
+static void jit_set_prologue(struct ir *ir) {
+  /* insert after the first guest marker. blocks beginning with a guard have
+     none in their head, insert ahead of the guard instead */
+  struct ir_block *head = list_first_entry(&ir->blocks, struct ir_block, it);
+  struct ir_instr *after = NULL;
+  list_for_each_entry(instr, &head->instrs, struct ir_instr, it) {
+    if (instr->op == OP_SOURCE_INFO) {
+      after = instr;
+      break;
+    }
+  }
+
+  if (after) {
+    ir_set_current_instr(ir, after);
+  } else {
+    ir_set_current_block(ir, head);
+  }
+}
+
+static void jit_count_execs(struct jit *jit, struct jit_block *block,
+                            struct ir *ir) {
+  jit_set_prologue(ir);
+
+  /* bump the execution counter, flagging the block as hot once it reaches
+     the threshold */
+  struct ir_value *addr = ir_alloc_ptr(ir, &block->num_execs);
+  struct ir_value *num_execs = ir_load_host(ir, addr, VALUE_I32);
+  num_execs = ir_add(ir, num_execs, ir_alloc_i32(ir, 1));
+  ir_store_host(ir, addr, num_execs);
+
+  struct ir_value *hot =
+      ir_cmp_eq(ir, num_execs, ir_alloc_i32(ir, OPTION_jit_tier_threshold));
+  ir_call_cond_2(ir, hot, ir_alloc_ptr(ir, &jit_hot_block),
+                 ir_alloc_ptr(ir, jit), ir_alloc_ptr(ir, block));
+}
+
+/*
+ * block profiling
+ *
+ * when profiling, each block's prologue bumps an entry counter. one out of
+ * every JIT_PROFILE_SAMPLE_RATE entries also starts a sample, which is ended
+ * by the next block entry or when control returns to jit_run. the time
+ * between the two is attributed to the sampled block
+ */
+static void jit_begin_sample(struct jit *jit, struct jit_profile *prof) {
+  jit->prof_sample = prof;
+  jit->prof_sample_start = time_nanoseconds();
+}
+
+static void jit_end_sample(struct jit *jit) {
+  struct jit_profile *prof = jit->prof_sample;
+
+  prof->sampled_ns += time_nanoseconds() - jit->prof_sample_start;
+  prof->num_samples++;
+
+  jit->prof_sample = NULL;
+}
+
+static void jit_count_fallback(struct jit *jit, struct ir *ir,
+                               struct ir_instr *instr) {
+  struct jit_frontend *frontend = jit->frontend;
+  uint32_t data = instr->arg[2]->i32;
+  const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
+  struct jit_fallback_stat *stat = &jit->fallback_stats[def->op];
+
+  stat->def = def;
+
+  /* bump the op's counter right before the fallback is invoked */
+  struct ir_instr *prev = list_prev_entry(instr, struct ir_instr, it);
+  struct ir_insert_point point = {instr->block, prev};
+  ir_set_insert_point(ir, &point);
+
+  struct ir_value *addr = ir_alloc_ptr(ir, &stat->num_execs);
+  struct ir_value *num_execs = ir_load_host(ir, addr, VALUE_I64);
+  num_execs = ir_add(ir, num_execs, ir_alloc_i64(ir, 1));
+  ir_store_host(ir, addr, num_execs);
+}
+
+static void jit_profile_block(struct jit *jit, struct jit_block *block,
+                              struct ir *ir) {
+  if (!block->profile) {
+    block->profile = calloc(1, sizeof(struct jit_profile));
+  }
+
+  struct jit_profile *prof = block->profile;
+
+  block->num_fallbacks = 0;
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+      if (instr->op == OP_FALLBACK) {
+        jit_count_fallback(jit, ir, instr);
+        block->num_fallbacks++;
+      }
+
+      /* have the backend count its predictions for dynamic branches */
+      if (instr->op == OP_BRANCH && !ir_is_constant(instr->arg[0])) {
+        ir_set_arg3(ir, instr, ir_alloc_ptr(ir, &prof->branch_hits));
+      }
+    }
+  }
+
+  jit_set_prologue(ir);
+
+  /* end the sample of the previous block */
+  struct ir_value *sample = ir_load_host(
+      ir, ir_alloc_ptr(ir, &jit->prof_sample), VALUE_I64);
+  struct ir_value *sampling = ir_cmp_ne(ir, sample, ir_alloc_i64(ir, 0));
+  ir_call_cond_1(ir, sampling, ir_alloc_ptr(ir, &jit_end_sample),
+                 ir_alloc_ptr(ir, jit));
+
+  /* bump the entry counter, periodically starting a new sample */
+  struct ir_value *addr = ir_alloc_ptr(ir, &prof->num_entries);
+  struct ir_value *num_entries = ir_load_host(ir, addr, VALUE_I64);
+  num_entries = ir_add(ir, num_entries, ir_alloc_i64(ir, 1));
+  ir_store_host(ir, addr, num_entries);
+
+  struct ir_value *phase = ir_and(
+      ir, num_entries, ir_alloc_i64(ir, JIT_PROFILE_SAMPLE_RATE - 1));
+  struct ir_value *begin = ir_cmp_eq(ir, phase, ir_alloc_i64(ir, 0));
+  ir_call_cond_2(ir, begin, ir_alloc_ptr(ir, &jit_begin_sample),
+                 ir_alloc_ptr(ir, jit), ir_alloc_ptr(ir, prof));
+}
+
+static int jit_profile_cmp(const void *a, const void *b) {
+  const struct jit_profile *pa = (*(struct jit_block **)a)->profile;
+  const struct jit_profile *pb = (*(struct jit_block **)b)->profile;
+
+  /* most expensive first, ties broken by the number of entries */
+  if (pa->sampled_ns != pb->sampled_ns) {
+    return pa->sampled_ns > pb->sampled_ns;
+  }
+
+  return pa->num_entries >= pb->num_entries;
+}
+
+int jit_profile_report(struct jit *jit, struct jit_block **blocks,
+                       int max_blocks) {
+  struct jit_block **profiled =
+      malloc(MAX(jit->blocks.num_entries, 1) * sizeof(struct jit_block *));
+  int num_profiled = 0;
+
+  hash_map_for_each(i, &jit->blocks, jit_block_map) {
+    struct jit_block *block = *hash_map_value(&jit->blocks, i);
+
+    if (block->profile) {
+      profiled[num_profiled++] = block;
+    }
+  }
+
+  msort(profiled, num_profiled, sizeof(struct jit_block *), &jit_profile_cmp);
+
+  int n = MIN(num_profiled, max_blocks);
+  memcpy(blocks, profiled, n * sizeof(struct jit_block *));
+  free(profiled);
+
+  return n;
+}
+
+void jit_dump_profile(struct jit *jit, int max_blocks) {
+  const char *appdir = fs_appdir();
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s-profile.txt",
+           appdir, jit->tag);
+
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    LOG_WARNING("jit_dump_profile failed to open %s", filename);
+    return;
+  }
+
+  struct jit_block **blocks = malloc(max_blocks * sizeof(struct jit_block *));
+  int num_blocks = jit_profile_report(jit, blocks, max_blocks);
+
+  fprintf(file, "%-12s %-10s %-9s %-9s %-9s %-16s %-16s %-16s %-16s\n",
+          "guest_addr", "guest_size", "host_size", "fallbacks", "faults",
+          "entries", "est_ns", "branch_hits", "branch_misses");
+
+  for (int i = 0; i < num_blocks; i++) {
+    struct jit_block *block = blocks[i];
+    struct jit_profile *prof = block->profile;
+
+    fprintf(file,
+            "0x%08x   %-10d %-9d %-9d %-9d %-16" PRIu64 " %-16" PRId64
+            " %-16" PRIu64 " %-16" PRIu64 "\n",
+            block->guest_addr, block->guest_size, block->host_size,
+            block->num_fallbacks, block->num_faults, prof->num_entries,
+            prof->sampled_ns * JIT_PROFILE_SAMPLE_RATE, prof->branch_hits,
+            prof->branch_misses);
+  }
+
+  free(blocks);
+  fclose(file);
+
+  LOG_INFO("jit_dump_profile wrote %s", filename);
+}
+
+static int jit_fallback_cmp(const void *a, const void *b) {
+  const struct jit_fallback_stat *sa = a;
+  const struct jit_fallback_stat *sb = b;
+
+  /* most executed first */
+  return sa->num_execs >= sb->num_execs;
+}
+
+int jit_fallback_report(struct jit *jit, struct jit_fallback_stat *stats,
+                        int max_stats) {
+  int num_ops = jit->frontend->num_ops;
+  struct jit_fallback_stat *executed =
+      malloc(MAX(num_ops, 1) * sizeof(struct jit_fallback_stat));
+  int num_executed = 0;
+
+  for (int i = 0; i < num_ops; i++) {
+    struct jit_fallback_stat *stat = &jit->fallback_stats[i];
+
+    if (stat->num_execs) {
+      executed[num_executed++] = *stat;
+    }
+  }
+
+  msort(executed, num_executed, sizeof(struct jit_fallback_stat),
+        &jit_fallback_cmp);
+
+  int n = MIN(num_executed, max_stats);
+  memcpy(stats, executed, n * sizeof(struct jit_fallback_stat));
+  free(executed);
+
+  return n;
+}
+
+void jit_dump_fallbacks(struct jit *jit, int max_stats) {
+  const char *appdir = fs_appdir();
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s-fallbacks.txt",
+           appdir, jit->tag);
+
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    LOG_WARNING("jit_dump_fallbacks failed to open %s", filename);
+    return;
+  }
+
+  struct jit_fallback_stat *stats =
+      malloc(max_stats * sizeof(struct jit_fallback_stat));
+  int num_stats = jit_fallback_report(jit, stats, max_stats);
+
+  uint64_t total = 0;
+  for (int i = 0; i < num_stats; i++) {
+    total += stats[i].num_execs;
+  }
+
+  fprintf(file, "%-16s %-16s %-8s %s\n", "op", "execs", "percent", "desc");
+
+  for (int i = 0; i < num_stats; i++) {
+    struct jit_fallback_stat *stat = &stats[i];
+
+    fprintf(file, "%-16s %-16" PRIu64 " %-8.2f %s\n", stat->def->name,
+            stat->num_execs, stat->num_execs * 100.0 / (double)total,
+            stat->def->desc);
+  }
+
+  free(stats);
+  fclose(file);
+
+  LOG_INFO("jit_dump_fallbacks wrote %s", filename);
+}
+
+/*
+ * host pc sampling
+ */
+int jit_add_sample(struct jit *jit, uintptr_t pc) {
+  struct jit_block *block = jit_lookup_block_reverse(jit, (void *)pc);
+
+  if (!block) {
+    return 0;
+  }
+
+  int offset = jit_lookup_instr(block, pc) * jit->frontend->instr_size;
+
+  uint32_t guest_addr = block->guest_addr + offset;
+  uint64_t key = ((uint64_t)block->guest_addr << 32) | guest_addr;
+  uint64_t *num_samples = jit_sample_map_get(&jit->samples, key);
+
+  if (num_samples) {
+    (*num_samples)++;
+  } else {
+    jit_sample_map_insert(&jit->samples, key, 1);
+  }
+
+  jit->total_samples++;
+
+  return 1;
+}
+
+struct jit_sample_block {
+  uint32_t block_addr;
+  uint64_t num_samples;
+  /* range of the block's instructions in the sorted samples */
+  int first;
+  int num_instrs;
+};
+
+static int jit_sample_addr_cmp(const void *a, const void *b) {
+  const struct jit_sample *sa = a;
+  const struct jit_sample *sb = b;
+
+  /* grouped by block, each block's instructions in address order */
+  if (sa->block_addr != sb->block_addr) {
+    return sa->block_addr < sb->block_addr;
+  }
+
+  return sa->guest_addr <= sb->guest_addr;
+}
+
+static int jit_sample_block_cmp(const void *a, const void *b) {
+  const struct jit_sample_block *sa = a;
+  const struct jit_sample_block *sb = b;
+
+  /* most sampled first */
+  return sa->num_samples >= sb->num_samples;
+}
+
+void jit_dump_samples(struct jit *jit, int max_blocks) {
+  if (!jit->total_samples) {
+    return;
+  }
+
+  const char *appdir = fs_appdir();
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s-samples.txt",
+           appdir, jit->tag);
+
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    LOG_WARNING("jit_dump_samples failed to open %s", filename);
+    return;
+  }
+
+  /* group the samples by block, with each block's instructions in order */
+  int max_samples = jit->samples.num_entries;
+  struct jit_sample *samples = malloc(max_samples * sizeof(struct jit_sample));
+  struct jit_sample_block *blocks =
+      malloc(max_samples * sizeof(struct jit_sample_block));
+  int num_samples = 0;
+  int num_blocks = 0;
+
+  hash_map_for_each(i, &jit->samples, jit_sample_map) {
+    uint64_t key = jit->samples.entries[i].key;
+    struct jit_sample *s = &samples[num_samples++];
+    s->block_addr = (uint32_t)(key >> 32);
+    s->guest_addr = (uint32_t)key;
+    s->num_samples = *hash_map_value(&jit->samples, i);
+  }
+
+  msort(samples, num_samples, sizeof(struct jit_sample), &jit_sample_addr_cmp);
+
+  for (int i = 0; i < num_samples; i++) {
+    struct jit_sample_block *block =
+        num_blocks ? &blocks[num_blocks - 1] : NULL;
+
+    if (!block || block->block_addr != samples[i].block_addr) {
+      block = &blocks[num_blocks++];
+      block->block_addr = samples[i].block_addr;
+      block->num_samples = 0;
+      block->first = i;
+      block->num_instrs = 0;
+    }
+
+    block->num_samples += samples[i].num_samples;
+    block->num_instrs++;
+  }
+
+  msort(blocks, num_blocks, sizeof(struct jit_sample_block),
+        &jit_sample_block_cmp);
+  num_blocks = MIN(num_blocks, max_blocks);
+
+  double total = (double)jit->total_samples;
+
+  /* flat profile of the hottest blocks, followed by the breakdown of each by
+     instruction */
+  fprintf(file, "%" PRIu64 " samples\n\n", jit->total_samples);
+  fprintf(file, "%-12s %-16s %-8s\n", "block_addr", "samples", "percent");
+
+  for (int i = 0; i < num_blocks; i++) {
+    struct jit_sample_block *block = &blocks[i];
+    fprintf(file, "0x%08x   %-16" PRIu64 " %-8.2f\n", block->block_addr,
+            block->num_samples, block->num_samples * 100.0 / total);
+  }
+
+  for (int i = 0; i < num_blocks; i++) {
+    struct jit_sample_block *block = &blocks[i];
+
+    fprintf(file, "\nblock 0x%08x\n", block->block_addr);
+    fprintf(file, "%-12s %-16s %-8s\n", "guest_addr", "samples", "percent");
+
+    for (int j = 0; j < block->num_instrs; j++) {
+      struct jit_sample *s = &samples[block->first + j];
+      fprintf(file, "0x%08x   %-16" PRIu64 " %-8.2f\n", s->guest_addr,
+              s->num_samples, s->num_samples * 100.0 / total);
+    }
+  }
+
+  free(blocks);
+  free(samples);
+  fclose(file);
+
+  LOG_INFO("jit_dump_samples wrote %s", filename);
+}
+
+/* run a single pass, accounting for its compile time and ir size */
+#define JIT_RUN_PASS(stage, run, pass, ir) \
+  do {                                     \
+    struct pass_timer timer;               \
+    pass_timer_begin(&timer, stage, ir);   \
+    run(pass, ir);                         \
+    pass_timer_end(&timer, ir);            \
+  } while (0)
+
+static void jit_optimize_code(struct jit *jit, struct jit_passes *passes,
+                              struct ir *ir, const char *cache_key) {
+  /* run optimization passes */
+  JIT_RUN_PASS(PASS_CFA, cfa_run, passes->cfa, ir);
+  JIT_RUN_PASS(PASS_LSE, lse_run, passes->lse, ir);
+  JIT_RUN_PASS(PASS_CPROP, cprop_run, passes->cprop, ir);
+  JIT_RUN_PASS(PASS_ESIMP, esimp_run, passes->esimp, ir);
+  JIT_RUN_PASS(PASS_GVN, gvn_run, passes->gvn, ir);
+  JIT_RUN_PASS(PASS_MAC, mac_run, passes->mac, ir);
+  JIT_RUN_PASS(PASS_CVE, cve_run, passes->cve, ir);
+  JIT_RUN_PASS(PASS_DCE, dce_run, passes->dce, ir);
+
+  if (cache_key) {
+    jit_cache_store(jit, cache_key, ir);
+  }
+
+  JIT_RUN_PASS(PASS_RA, ra_run, passes->ra, ir);
+}
+
+static int jit_assemble_code(struct jit *jit, struct jit_block *block,
+                             struct ir *ir) {
+  jit->curr_block = block;
+
+  struct pass_timer timer;
+  pass_timer_begin(&timer, PASS_ASSEMBLE, ir);
+
+  /* assemble the ir into native code */
+  int res = jit->backend->assemble_code(jit->backend, ir, &block->host_addr,
+                                        &block->host_size,
+                                        (jit_emit_cb)jit_emit_callback, jit);
+
+  if (!res) {
+    /* if the backend overflowed, try to grow the code buffer. once it can't
+       grow any further, wrap around to the start of it instead, evicting only
+       the oldest code. either way, try again */
+    if (!jit_grow_region(jit, block)) {
+      jit_wrap_region(jit);
+    }
+
+    memset(block->source_map, 0, block->num_instrs * sizeof(void *));
+    res = jit->backend->assemble_code(jit->backend, ir, &block->host_addr,
+                                      &block->host_size,
+                                      (jit_emit_cb)jit_emit_callback, jit);
+  }
+
+  pass_timer_end(&timer, ir);
+
+  if (!res) {
+    /* if the backend still overflowed, completely free the cache and let
+       dispatch try to compile again */
     LOG_INFO("backend overflow, resetting code cache");
+    jit_cancel_code(jit, block);
+    jit_free_meta(jit, block->source_map, jit_meta_size(block));
     jit_free_code(jit);
-    return;
+    return 0;
   }
 
+  /* evict old code as the emitter moves through the code buffer */
+  jit_advance_region(jit, block);
+
   /* finish by adding code to caches */
   jit_finalize_block(jit, block);
 
   /* dump optimized ir */
   if (jit->dump_code) {
-    jit_dump_block(jit, "opt", block, &ir);
+    jit_dump_block(jit, "opt", block, ir);
   }
 
   /* write out to perf map if enabled */
@@ -393,11 +1708,419 @@ void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
             (uintptr_t)block->host_addr, block->host_size, jit->tag,
             block->guest_addr);
   }
+
+  return 1;
 }
 
+static int jit_replace_block(struct jit *jit, struct jit_block *existing,
+                             struct ir *ir) {
+  struct jit_block *block =
+      jit_alloc_block(jit, existing->guest_addr, existing->guest_size);
+
+  block->tier = JIT_TIER_OPTIMIZED;
+  block->flags = existing->flags;
+  block->flags_mask = existing->flags_mask;
+  block->checksum = existing->checksum;
+  block->num_fallbacks = existing->num_fallbacks;
+  block->num_faults = existing->num_faults;
+  block->profile = existing->profile;
+  existing->profile = NULL;
+  memcpy(block->fastmem, existing->fastmem,
+         block->num_instrs * sizeof(int8_t));
+
+  jit_free_block(jit, existing);
+
+  return jit_assemble_code(jit, block, ir);
+}
+
+/*
+ * background compilation
+ *
+ * when enabled, blocks missing from the cache are translated and compiled
+ * without optimizations on the emulation thread, while a copy of their ir is
+ * handed off to a worker thread to be optimized. once the worker finishes,
+ * the ir is assembled on the emulation thread the next time jit_run is
+ * called, replacing the baseline block
+ */
+#define JIT_MAX_JOBS 8
+
+struct jit_job {
+  /* block being optimized, cleared if the block is freed before the job has
+     been published */
+  struct jit_block *block;
+
+  /* persistent cache key, or an empty string if the optimized ir shouldn't
+     be cached */
+  char cache_key[33];
+
+  struct ir ir;
+  uint8_t *ir_buffer;
+
+  struct list_node it;
+};
+
+struct jit_worker {
+  struct jit *jit;
+  struct jit_passes passes;
+
+  thread_t thread;
+  mutex_t mutex;
+  cond_t cond;
+  int shutdown;
+
+  struct jit_job jobs[JIT_MAX_JOBS];
+
+  /* free jobs are only accessed by the emulation thread, pending and done
+     jobs are shared with the worker and must be accessed under the mutex */
+  struct list free_jobs;
+  struct list pending_jobs;
+  struct list done_jobs;
+};
+
+static void *jit_worker_thread(void *data) {
+  struct jit_worker *worker = data;
+
+  apply_thread_options(ROLE_COMPILE);
+
+  while (1) {
+    mutex_lock(worker->mutex);
+
+    while (!worker->shutdown && list_empty(&worker->pending_jobs)) {
+      cond_wait(worker->cond, worker->mutex);
+    }
+
+    if (worker->shutdown) {
+      mutex_unlock(worker->mutex);
+      break;
+    }
+
+    struct jit_job *job =
+        list_first_entry(&worker->pending_jobs, struct jit_job, it);
+    list_remove(&worker->pending_jobs, &job->it);
+
+    mutex_unlock(worker->mutex);
+
+    /* note, the job's block must not be accessed here, it's owned by the
+       emulation thread and may be freed at any point */
+    const char *cache_key = job->cache_key[0] ? job->cache_key : NULL;
+    jit_optimize_code(worker->jit, &worker->passes, &job->ir, cache_key);
+
+    mutex_lock(worker->mutex);
+    list_add(&worker->done_jobs, &job->it);
+    mutex_unlock(worker->mutex);
+  }
+
+  return NULL;
+}
+
+static void jit_cancel_code(struct jit *jit, struct jit_block *block) {
+  struct jit_worker *worker = jit->worker;
+
+  if (!worker) {
+    return;
+  }
+
+  /* job blocks are only accessed by the emulation thread, no need to lock */
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    struct jit_job *job = &worker->jobs[i];
+
+    if (job->block == block) {
+      job->block = NULL;
+    }
+  }
+}
+
+static int jit_queue_code(struct jit *jit, struct jit_block *block,
+                          const char *cache_key) {
+  struct jit_worker *worker = jit->worker;
+
+  struct jit_job *job =
+      list_first_entry(&worker->free_jobs, struct jit_job, it);
+
+  if (!job) {
+    return 0;
+  }
+
+  list_remove(&worker->free_jobs, &job->it);
+
+  if (!job->ir_buffer) {
+    job->ir_buffer = malloc(sizeof(jit->ir_buffer));
+  }
+
+  job->block = block;
+
+  if (cache_key) {
+    snprintf(job->cache_key, sizeof(job->cache_key), "%s", cache_key);
+  } else {
+    job->cache_key[0] = 0;
+  }
+
+  /* the ir is translated here as opposed to on the worker, as translation
+     depends on the guest's current state */
+  ir_init(&job->ir, job->ir_buffer, sizeof(jit->ir_buffer));
+  jit_translate_code(jit, block, &job->ir);
+
+  mutex_lock(worker->mutex);
+  list_add(&worker->pending_jobs, &job->it);
+  cond_signal(worker->cond);
+  mutex_unlock(worker->mutex);
+
+  return 1;
+}
+
+static void jit_publish_code(struct jit *jit) {
+  struct jit_worker *worker = jit->worker;
+
+  /* don't stall the emulation thread if the worker has the lock, any
+     finished jobs will be picked up on the next run */
+  if (!mutex_trylock(worker->mutex)) {
+    return;
+  }
+
+  struct list done = worker->done_jobs;
+  list_clear(&worker->done_jobs);
+
+  mutex_unlock(worker->mutex);
+
+  list_for_each_entry_safe(job, &done, struct jit_job, it) {
+    struct jit_block *baseline = job->block;
+
+    /* if the baseline block was invalidated while the job was running, the
+       optimized code is stale and must be thrown out */
+    if (baseline && baseline->state == JIT_STATE_VALID) {
+      jit_replace_block(jit, baseline, &job->ir);
+    }
+
+    job->block = NULL;
+    list_remove(&done, &job->it);
+    list_add(&worker->free_jobs, &job->it);
+  }
+}
+
+static void jit_destroy_worker(struct jit_worker *worker) {
+  if (worker->thread) {
+    mutex_lock(worker->mutex);
+    worker->shutdown = 1;
+    cond_signal(worker->cond);
+    mutex_unlock(worker->mutex);
+
+    void *result;
+    thread_join(worker->thread, &result);
+  }
+
+  if (worker->cond) {
+    cond_destroy(worker->cond);
+  }
+
+  if (worker->mutex) {
+    mutex_destroy(worker->mutex);
+  }
+
+  jit_destroy_passes(&worker->passes);
+
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    free(worker->jobs[i].ir_buffer);
+  }
+
+  free(worker);
+}
+
+static struct jit_worker *jit_create_worker(struct jit *jit) {
+  struct jit_worker *worker = calloc(1, sizeof(struct jit_worker));
+
+  worker->jit = jit;
+  jit_create_passes(jit, &worker->passes);
+
+  for (int i = 0; i < JIT_MAX_JOBS; i++) {
+    list_add(&worker->free_jobs, &worker->jobs[i].it);
+  }
+
+  worker->mutex = mutex_create();
+  worker->cond = cond_create();
+  worker->thread = thread_create(&jit_worker_thread, "jit", worker);
+  CHECK_NOTNULL(worker->thread);
+
+  return worker;
+}
+
+static void jit_promote_code(struct jit *jit) {
+  uint32_t flags = jit_translate_flags(jit);
+
+  struct jit_block *block =
+      list_first_entry(&jit->hot_blocks, struct jit_block, hot_it);
+
+  while (block) {
+    /* translation is specialized on the current guest state, wait until it
+       matches the state the baseline block was compiled under */
+    if (!jit_block_matches(block, block->guest_addr, flags) ||
+        block->state != JIT_STATE_VALID) {
+      block = list_next_entry(block, struct jit_block, hot_it);
+      continue;
+    }
+
+    char cache_key[33];
+    if (OPTION_jit_cache) {
+      jit_cache_key(jit, block, cache_key);
+    }
+
+    const char *key = OPTION_jit_cache ? cache_key : NULL;
+
+    if (jit->worker) {
+      /* if the worker is busy, try again on the next run */
+      if (!jit_queue_code(jit, block, key)) {
+        break;
+      }
+
+      block->hot = 0;
+      list_remove(&jit->hot_blocks, &block->hot_it);
+    } else {
+      struct ir ir;
+      ir_init(&ir, jit->ir_buffer, sizeof(jit->ir_buffer));
+
+      jit_translate_code(jit, block, &ir);
+      jit_optimize_code(jit, &jit->passes, &ir, key);
+      jit_replace_block(jit, block, &ir);
+    }
+
+    /* assembling code may have evicted other hot blocks, start over */
+    block = list_first_entry(&jit->hot_blocks, struct jit_block, hot_it);
+  }
+}
+
+DEFINE_ZONE(jit_compile_code);
+
+void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
+#if 0
+  LOG_INFO("jit_compile_block %s 0x%08x", jit->tag, guest_addr);
+#endif
+
+  uint32_t flags = jit_translate_flags(jit);
+  struct jit_block *existing = jit_get_block(jit, guest_addr, flags);
+
+  /* the dispatch entry for a versioned block is reset whenever a different
+     version of it is entered. if the version for the current guest state is
+     still valid, switch the entry back to it */
+  if (existing && existing->state == JIT_STATE_VALID) {
+    jit->backend->cache_code(jit->backend, guest_addr, existing->host_addr);
+    return;
+  }
+
+  PROF_ENTER(jit_compile_code);
+  int64_t compile_start = time_nanoseconds();
+  jit->reading_code = 1;
+
+  /* analyze the guest code to get its extents */
+  int guest_size;
+  jit->frontend->analyze_code(jit->frontend, guest_addr, &guest_size);
+
+  /* create block */
+  struct jit_block *block = jit_alloc_block(jit, guest_addr, guest_size);
+
+  /* blocks start out at the baseline tier when tiered compilation is enabled,
+     and are promoted once they've executed enough times */
+  int tier = OPTION_jit_tier_threshold > 0 ? JIT_TIER_BASELINE
+                                           : JIT_TIER_OPTIMIZED;
+
+  /* immutable blocks are never thrown out by code modifications, so their
+     optimization is never wasted. optimize them up front, which also makes
+     them eligible for the persistent cache right away */
+  if (block->immutable) {
+    tier = JIT_TIER_OPTIMIZED;
+  }
+
+  /* if the block had previously been invalidated, finish removing it now */
+  if (existing) {
+    /* if the block was invalidated due to a fastmem exception, persist its
+       fastmem state and tier */
+    if (existing->state != JIT_STATE_INVALID) {
+      CHECK_EQ(block->guest_size, existing->guest_size);
+      memcpy(block->fastmem, existing->fastmem,
+             block->num_instrs * sizeof(int8_t));
+      block->num_faults = existing->num_faults;
+      tier = MAX(tier, existing->tier);
+
+      prof_counter_add(COUNTER_fastmem_recompiles, 1);
+    }
+
+    /* keep accumulating statistics for the guest address */
+    block->profile = existing->profile;
+    existing->profile = NULL;
+
+    jit_free_block(jit, existing);
+  }
+
+  struct ir ir;
+  ir_init(&ir, jit->ir_buffer, sizeof(jit->ir_buffer));
+
+  /* check the persistent cache for previously optimized ir */
+  char cache_key[33];
+  int cached = 0;
+
+  if (OPTION_jit_cache) {
+    jit_cache_key(jit, block, cache_key);
+    cached = jit_cache_load(jit, cache_key, &ir);
+  }
+
+  const char *key = OPTION_jit_cache ? cache_key : NULL;
+
+  if (cached) {
+    /* control flow edges aren't serialized, rebuild them */
+    block->tier = JIT_TIER_OPTIMIZED;
+    block->flags = flags;
+    /* which flags the cached ir was specialized on isn't known, assume all
+       of them */
+    block->flags_mask = ~0u;
+    if (OPTION_jit_smc) {
+      block->checksum = jit_checksum_code(jit, block);
+    }
+    if (jit->profile_code) {
+      jit_profile_block(jit, block, &ir);
+    }
+    JIT_RUN_PASS(PASS_CFA, cfa_run, jit->passes.cfa, &ir);
+    JIT_RUN_PASS(PASS_RA, ra_run, jit->passes.ra, &ir);
+  } else if (tier == JIT_TIER_BASELINE) {
+    /* compile quickly, and count executions to find out if the block is worth
+       optimizing */
+    block->tier = JIT_TIER_BASELINE;
+    jit_translate_code(jit, block, &ir);
+    jit_count_execs(jit, block, &ir);
+    JIT_RUN_PASS(PASS_CFA, cfa_run, jit->passes.cfa, &ir);
+    JIT_RUN_PASS(PASS_RA, ra_run, jit->passes.ra, &ir);
+  } else if (jit->worker && jit_queue_code(jit, block, key)) {
+    /* the optimized code is being compiled in the background, quickly compile
+       a baseline version to run in the meantime */
+    block->tier = JIT_TIER_BASELINE;
+    jit_translate_code(jit, block, &ir);
+    JIT_RUN_PASS(PASS_CFA, cfa_run, jit->passes.cfa, &ir);
+    JIT_RUN_PASS(PASS_RA, ra_run, jit->passes.ra, &ir);
+  } else {
+    block->tier = JIT_TIER_OPTIMIZED;
+    jit_translate_code(jit, block, &ir);
+    jit_optimize_code(jit, &jit->passes, &ir, key);
+  }
+
+  jit_assemble_code(jit, block, &ir);
+
+  jit->reading_code = 0;
+  prof_counter_add(COUNTER_jit_compiles, 1);
+  prof_counter_add(COUNTER_jit_compile_ns, time_nanoseconds() - compile_start);
+
+  PROF_LEAVE(jit_compile_code);
+}
+
+/* jit whose code is running on the current thread. guests may run on separate
+   threads, in which case another jit's lookup maps can't safely be searched */
+static _Thread_local struct jit *jit_current;
+
 static int jit_handle_exception(void *data, struct exception_state *ex) {
   struct jit *jit = data;
 
+  /* exceptions are only ever raised by the code running on the current
+     thread */
+  if (jit != jit_current) {
+    return 0;
+  }
+
   /* see if there is a cached block corresponding to the current pc */
   struct jit_block *block = jit_lookup_block_reverse(jit, (void *)ex->pc);
 
@@ -410,31 +2133,70 @@ static int jit_handle_exception(void *data, struct exception_state *ex) {
     return 0;
   }
 
-  /* disable fastmem optimizations for it on future compiles */
-  int found = 0;
-  for (int i = 0; i < block->guest_size; i++) {
-    /* ignore empty entries */
-    if (!block->source_map[i]) {
-      continue;
-    }
-    if ((uintptr_t)block->source_map[i] > ex->pc) {
-      break;
-    }
-    found = i;
+  struct jit_guest *guest = jit->frontend->guest;
+  uint8_t *fault_addr = (uint8_t *)ex->fault_addr;
+  if (guest->membase) {
+    jit_add_fault(jit, (uint32_t)(fault_addr - (uint8_t *)guest->membase));
   }
-  block->fastmem[found] = 0;
+  block->num_faults++;
+
+  /* disable fastmem optimizations for it on future compiles */
+  block->fastmem[jit_lookup_instr(block, ex->pc)] = 0;
 
   /* invalidate the block so it's recompiled on the next access */
   jit_invalidate_block(jit, block, 1);
 
+  /* the stale code may keep looping on itself through local branches, faulting
+     on every iteration until its cycles run out. redirect its entry to the now
+     invalidated cache entry so the loop exits to be recompiled instead */
+  struct jit_backend *backend = jit->backend;
+  void *compile = backend->lookup_code(backend, block->guest_addr);
+  backend->patch_edge(backend, block->host_addr, compile);
+
   return 1;
 }
 
+int jit_can_abort(struct jit *jit) {
+  return jit == jit_current && !jit->reading_code && jit->backend->abort_code;
+}
+
+void jit_abort_code(struct jit *jit) {
+  CHECK(jit_can_abort(jit));
+  jit->backend->abort_code(jit->backend);
+}
+
 void jit_run(struct jit *jit, int cycles) {
+  /* recompile any baseline code which has become hot */
+  if (!list_empty(&jit->hot_blocks)) {
+    jit_promote_code(jit);
+  }
+
+  /* swap in any code which finished optimizing in the background */
+  if (jit->worker) {
+    jit_publish_code(jit);
+  }
+
+  /* guests may be nested, e.g. when the sh4 syncs the arm7 from inside of an
+     mmio handler */
+  struct jit *prev = jit_current;
+  jit_current = jit;
   jit->backend->run_code(jit->backend, cycles);
+  jit_current = prev;
+
+  /* don't attribute time spent outside of compiled code to the last block */
+  if (jit->prof_sample) {
+    jit_end_sample(jit);
+  }
 }
 
 void jit_destroy(struct jit *jit) {
+  if (jit->profile_code && jit->backend) {
+    jit_dump_profile(jit, JIT_PROFILE_MAX_BLOCKS);
+    jit_dump_fallbacks(jit, JIT_FALLBACK_MAX_OPS);
+  }
+
+  jit_dump_samples(jit, JIT_SAMPLE_MAX_BLOCKS);
+
   if (OPTION_perf) {
     if (jit->perf_map) {
       fclose(jit->perf_map);
@@ -445,29 +2207,30 @@ void jit_destroy(struct jit *jit) {
     jit_free_code(jit);
   }
 
-  if (jit->dce) {
-    dce_destroy(jit->dce);
+  if (jit->worker) {
+    jit_destroy_worker(jit->worker);
   }
 
-  if (jit->esimp) {
-    esimp_destroy(jit->esimp);
-  }
+  jit_destroy_passes(&jit->passes);
 
-  if (jit->cprop) {
-    cprop_destroy(jit->cprop);
+  if (jit->exc_handler) {
+    exception_handler_remove(jit->exc_handler);
   }
 
-  if (jit->lse) {
-    lse_destroy(jit->lse);
+  hash_map_for_each(i, &jit->pages, jit_page_map) {
+    free(hash_map_value(&jit->pages, i)->blocks);
   }
-
-  if (jit->cfa) {
-    cfa_destroy(jit->cfa);
-  }
-
-  if (jit->exc_handler) {
-    exception_handler_remove(jit->exc_handler);
+  free(jit->fallback_stats);
+  jit_fault_map_destroy(&jit->fault_pages);
+  jit_sample_map_destroy(&jit->samples);
+  jit_page_map_destroy(&jit->pages);
+  jit_block_map_destroy(&jit->blocks);
+  slab_destroy(&jit->block_slab);
+  slab_destroy(&jit->edge_slab);
+  for (int i = 0; i < JIT_META_CLASSES; i++) {
+    slab_destroy(&jit->meta_slabs[i]);
   }
+  jit_unwatch_code(jit);
 
   free(jit);
 }
@@ -480,19 +2243,36 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
   jit->frontend = frontend;
   jit->backend = backend;
 
+  /* allocate block memory */
+  slab_init(&jit->block_slab, sizeof(struct jit_block), JIT_SLAB_CHUNK_SIZE);
+  slab_init(&jit->edge_slab, sizeof(struct jit_edge), JIT_SLAB_CHUNK_SIZE);
+  for (int i = 0; i < JIT_META_CLASSES; i++) {
+    int size = 1 << (JIT_META_MIN_SHIFT + i);
+    slab_init(&jit->meta_slabs[i], size, MAX(size, JIT_SLAB_CHUNK_SIZE));
+  }
+
+  jit->fallback_stats =
+      calloc(frontend->num_ops, sizeof(struct jit_fallback_stat));
+  jit->profile_code = OPTION_jit_profile;
+
   /* create optimization passes */
-  jit->cfa = cfa_create();
-  jit->lse = lse_create();
-  jit->cprop = cprop_create();
-  jit->esimp = esimp_create();
-  jit->dce = dce_create();
-  jit->ra = ra_create(jit->backend->registers, jit->backend->num_registers,
-                      jit->backend->emitters, jit->backend->num_emitters);
+  jit_create_passes(jit, &jit->passes);
+
+  /* start background compilation thread if enabled */
+  if (OPTION_jit_async) {
+    jit->worker = jit_create_worker(jit);
+  }
 
   /* setup exception handler to deal with self-modifying code and fastmem
      related exceptions */
   jit->exc_handler = exception_handler_add(jit, &jit_handle_exception);
 
+  /* they're only ever raised by compiled code, skip the block lookup for
+     exceptions raised anywhere else */
+  jit->exc_range = exception_handler_add_range(
+      jit->exc_handler, EX_RANGE_PC, (uintptr_t)backend->code,
+      (uintptr_t)(backend->code + backend->code_size));
+
   /* open perf map if enabled */
   if (OPTION_perf) {
 #if PLATFORM_DARWIN || PLATFORM_LINUX
@@ -2,15 +2,23 @@
 #define JIT_H
 
 #include <stdio.h>
+#include "core/hash_map.h"
 #include "core/list.h"
-#include "core/rb_tree.h"
+#include "core/slab.h"
 
 struct address_space;
 struct cfa;
 struct cprop;
+struct cve;
 struct dce;
+struct esimp;
+struct gvn;
 struct ir;
+struct jit_profile;
+struct jit_worker;
 struct lse;
+struct mac;
+struct memory_watch;
 struct ra;
 struct val;
 
@@ -20,13 +28,52 @@ enum {
   JIT_STATE_RECOMPILE,
 };
 
+enum {
+  /* compiled with a minimal set of passes, and instrumented to count its
+     executions so it can be promoted once hot */
+  JIT_TIER_BASELINE,
+  /* compiled with the full optimization pipeline */
+  JIT_TIER_OPTIMIZED,
+};
+
 struct jit_block {
   int state;
+  int tier;
+
+  /* frontend-specific flags describing the guest state the block was
+     translated under, see jit_frontend.translate_flags */
+  uint32_t flags;
+
+  /* subset of flags the translation was specialized on. a separate version
+     of the block is compiled for each combination of them it's entered
+     under */
+  uint32_t flags_mask;
+
+  /* number of times a baseline block has executed */
+  uint32_t num_execs;
+
+  /* is the block queued to be promoted to the optimized tier */
+  int hot;
+  struct list_node hot_it;
 
   /* address of source block in guest memory */
   uint32_t guest_addr;
   int guest_size;
 
+  /* checksum of the guest code taken when the block was translated, used to
+     detect modifications that weren't caught by the page write watches */
+  uint32_t checksum;
+
+  /* was the block translated from guest memory that can never be modified,
+     see jit_guest.immutable. these blocks survive jit_invalidate_modified_code
+     and skip straight to the optimized tier */
+  int immutable;
+
+  /* per-instruction meta data, indexed by the instruction's offset from
+     guest_addr divided by the frontend's instruction size. both arrays are
+     carved out of a single allocation from the jit's meta data slabs */
+  int num_instrs;
+
   /* maps guest instructions to host instructions */
   void **source_map;
 
@@ -37,13 +84,63 @@ struct jit_block {
   uint8_t *host_addr;
   int host_size;
 
+  /* number of instructions falling back to the interpreter */
+  int num_fallbacks;
+
+  /* number of fastmem exceptions raised by the block, carried over each time
+     it's recompiled */
+  int num_faults;
+
+  /* runtime statistics, only present while profiling */
+  struct jit_profile *profile;
+
   /* edges to other blocks */
   struct list in_edges;
   struct list out_edges;
+};
+
+/* one out of every JIT_PROFILE_SAMPLE_RATE block entries is timed */
+#define JIT_PROFILE_SAMPLE_RATE 64
+
+/* max number of blocks written out by jit_dump_profile */
+#define JIT_PROFILE_MAX_BLOCKS 256
+
+/* runtime statistics for a block, carried over each time the block is
+   recompiled */
+struct jit_profile {
+  uint64_t num_entries;
 
-  /* lookup map iterators */
-  struct rb_node it;
-  struct rb_node rit;
+  /* host time spent in the block, measured on one out of every
+     JIT_PROFILE_SAMPLE_RATE entries */
+  int64_t sampled_ns;
+  int num_samples;
+
+  /* predictions made for the block's dynamic branches. these are adjacent, as
+     the backend increments them through a single pointer */
+  uint64_t branch_hits;
+  uint64_t branch_misses;
+};
+
+/* max number of blocks written out by jit_dump_samples */
+#define JIT_SAMPLE_MAX_BLOCKS 256
+
+/* samples of the host pc landing in the code compiled for a guest
+   instruction. samples are attributed to the block they were taken in, as an
+   instruction may be compiled into more than one */
+struct jit_sample {
+  uint32_t block_addr;
+  uint32_t guest_addr;
+  uint64_t num_samples;
+};
+
+/* max number of ops written out by jit_dump_fallbacks */
+#define JIT_FALLBACK_MAX_OPS 64
+
+/* number of times a frontend op fell back to the interpreter, only collected
+   while profiling */
+struct jit_fallback_stat {
+  const struct jit_opdef *def;
+  uint64_t num_execs;
 };
 
 struct jit_edge {
@@ -61,45 +158,172 @@ struct jit_edge {
   struct list_node out_it;
 };
 
-struct jit {
-  char tag[32];
+/* bucket of blocks whose host code overlaps a given host page, sorted by their
+   host address */
+struct jit_page {
+  struct jit_block **blocks;
+  int num_blocks;
+  int max_blocks;
+};
 
-  struct jit_frontend *frontend;
-  struct jit_backend *backend;
-  struct exception_handler *exc_handler;
+DEFINE_HASH_MAP(jit_block_map, uint32_t, struct jit_block *);
+DEFINE_HASH_MAP(jit_page_map, uintptr_t, struct jit_page);
 
-  /* passes */
+/* guest page containing compiled code. while code exists in the page, writes
+   to it are caught with a single-write watch on each host mapping of it */
+struct jit_code_page {
+  struct jit *jit;
+  uint32_t guest_page;
+
+  /* host pointers to the page through the fastmem mapping and the guest's
+     backing memory, along with the watches on each */
+  uint8_t *ptrs[2];
+  struct memory_watch *watches[2];
+
+  /* number of times the page has been written to after code was compiled
+     from it */
+  int num_writes;
+};
+
+DEFINE_HASH_MAP(jit_code_page_map, uint32_t, struct jit_code_page *);
+
+/* number of fastmem exceptions raised, keyed by the guest page faulted on */
+DEFINE_HASH_MAP(jit_fault_map, uint32_t, int);
+
+/* number of host pc samples, keyed by the block address in the upper 32 bits
+   and the guest instruction's address in the lower */
+DEFINE_HASH_MAP(jit_sample_map, uint64_t, uint64_t);
+
+/* optimization passes. passes maintain internal state while running, so each
+   thread compiling code needs its own instances */
+struct jit_passes {
   struct cfa *cfa;
   struct lse *lse;
   struct cprop *cprop;
   struct esimp *esimp;
+  struct gvn *gvn;
+  struct mac *mac;
+  struct cve *cve;
   struct dce *dce;
   struct ra *ra;
+};
+
+/* per-instruction meta data is allocated from slabs of power of two sizes,
+   starting at 1 << JIT_META_MIN_SHIFT bytes. larger allocations are made
+   directly with malloc */
+#define JIT_META_MIN_SHIFT 6
+#define JIT_META_CLASSES 10
+
+struct jit {
+  char tag[32];
+
+  struct jit_frontend *frontend;
+  struct jit_backend *backend;
+  struct exception_handler *exc_handler;
+  int exc_range;
+
+  /* passes */
+  struct jit_passes passes;
+
+  /* background compilation thread, only present when async compilation is
+     enabled */
+  struct jit_worker *worker;
 
   /* scratch compilation buffer */
   uint8_t ir_buffer[1024 * 1024 * 2];
 
   /* compiled blocks */
   struct jit_block *curr_block;
-  struct rb_tree blocks;
-  struct rb_tree reverse_blocks;
+
+  /* baseline blocks which have crossed the execution threshold and are
+     waiting to be recompiled with the full optimization pipeline */
+  struct list hot_blocks;
+
+  /* blocks, keyed by guest address */
+  struct jit_block_map blocks;
+
+  /* blocks, edges and their meta data are allocated from slabs, which are all
+     reset at once when the entire code cache is freed */
+  struct slab block_slab;
+  struct slab edge_slab;
+  struct slab meta_slabs[JIT_META_CLASSES];
+
+  /* host page buckets, used to map a host address back to the block
+     containing it */
+  struct jit_page_map pages;
+
+  /* guest pages containing code, keyed by guest page. only populated when
+     self-modifying code tracking is enabled */
+  struct jit_code_page_map code_pages;
+  int num_code_watches;
+
+  /* fastmem exception counts, keyed by the guest page faulted on */
+  struct jit_fault_map fault_pages;
+
+  /* set while the jit itself reads guest memory, e.g. to translate or
+     checksum code. no guest exception can be raised for these reads */
+  int reading_code;
+
+  /* region of the backend's code buffer currently being emitted to */
+  int code_region;
 
   /* compiled block perf map */
   FILE *perf_map;
 
   /* dump ir to application directory as blocks compile */
   int dump_code;
+
+  /* instrument blocks as they compile to collect runtime statistics */
+  int profile_code;
+
+  /* block whose execution time is currently being sampled */
+  struct jit_profile *prof_sample;
+  int64_t prof_sample_start;
+
+  /* fallback execution counts, indexed by frontend op */
+  struct jit_fallback_stat *fallback_stats;
+
+  /* host pc samples, keyed by the block and guest instruction they were
+     attributed to */
+  struct jit_sample_map samples;
+  uint64_t total_samples;
 };
 
+/* reports if the guest code in [addr, addr + size) has been modified */
+typedef int (*jit_modified_cb)(void *, uint32_t, int);
+
 struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
                        struct jit_backend *backend);
 void jit_destroy(struct jit *jit);
 
 void jit_run(struct jit *jit, int cycles);
 
+/* called by the guest's memory accessors to raise an exception for the access
+   being made. this is only possible for accesses made by the code running on
+   the current thread, and only when the backend supports aborting it */
+int jit_can_abort(struct jit *jit);
+void jit_abort_code(struct jit *jit);
+
 void jit_compile_code(struct jit *jit, uint32_t guest_addr);
 void jit_link_code(struct jit *jit, void *code, uint32_t target);
+void jit_uncache_code(struct jit *jit, uint32_t guest_addr);
 void jit_invalidate_code(struct jit *jit);
+void jit_invalidate_modified_code(struct jit *jit);
+void jit_invalidate_blocks(struct jit *jit, jit_modified_cb modified,
+                           void *data);
 void jit_free_code(struct jit *jit);
 
+int jit_profile_report(struct jit *jit, struct jit_block **blocks,
+                       int max_blocks);
+void jit_dump_profile(struct jit *jit, int max_blocks);
+int jit_fallback_report(struct jit *jit, struct jit_fallback_stat *stats,
+                        int max_stats);
+void jit_dump_fallbacks(struct jit *jit, int max_stats);
+
+/* attributes a sampled host pc to the guest instruction whose code contains
+   it, returning 0 if it isn't inside of a compiled block. must be called from
+   the thread running the jit's code */
+int jit_add_sample(struct jit *jit, uintptr_t pc);
+void jit_dump_samples(struct jit *jit, int max_blocks);
+
 #endif
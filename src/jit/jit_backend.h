@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include "core/atomic.h"
 #include "jit/ir/ir.h"
 
 struct exception_state;
@@ -19,13 +20,41 @@ struct jit_guest;
    backend can use conditional branches to thunks without trampolining
 
    finally, the code buffer needs to be aligned to a 4kb page so it's easy to
-   mprotect */
+   mprotect
+
+   the x64 backend will instead try to reserve a buffer which can grow beyond
+   this near the static one, only falling back to it if that fails
+
+   the static buffer can only back a single backend at a time. when running
+   multiple emulator instances in the same process, the backends created for
+   each instance after the first map a buffer of their own, with the x64
+   backend reserving it near the static one */
 #if ARCH_A64
-#define DEFINE_JIT_CODE_BUFFER(name) static uint8_t ALIGNED(4096) name[0x100000]
+#define JIT_CODE_BUFFER_SIZE 0x100000
 #else
-#define DEFINE_JIT_CODE_BUFFER(name) static uint8_t ALIGNED(4096) name[0x800000]
+#define JIT_CODE_BUFFER_SIZE 0x800000
 #endif
 
+#define DEFINE_JIT_CODE_BUFFER(name)                                     \
+  static uint8_t ALIGNED(4096) name##_data[JIT_CODE_BUFFER_SIZE];        \
+  static struct jit_code_buffer name = {name##_data, JIT_CODE_BUFFER_SIZE, \
+                                        0}
+
+struct jit_code_buffer {
+  uint8_t *data;
+  int size;
+  volatile uint32_t claimed;
+};
+
+/* returns 1 if the caller now has sole use of the static buffer */
+static inline int jit_claim_code_buffer(struct jit_code_buffer *buf) {
+  return atomic_cas32(&buf->claimed, 0, 1);
+}
+
+static inline void jit_release_code_buffer(struct jit_code_buffer *buf) {
+  atomic_store32(&buf->claimed, 0);
+}
+
 enum {
   /* allocate to this register */
   JIT_ALLOCATE = 0x1,
@@ -88,6 +117,12 @@ struct jit_emitter {
 struct jit_backend {
   struct jit_guest *guest;
 
+  /* host memory available to compiled blocks, excluding any thunks. the jit
+     uses this to evict blocks incrementally as the buffer wraps around. the
+     size increases each time the buffer is grown */
+  uint8_t *code;
+  int code_size;
+
   const struct jit_register *registers;
   int num_registers;
 
@@ -100,8 +135,14 @@ struct jit_backend {
   void (*reset)(struct jit_backend *);
   int (*assemble_code)(struct jit_backend *, struct ir *, uint8_t **, int *,
                        jit_emit_cb, void *);
+  /* optional, extends the code buffer in place when it overflows. returns 0
+     once the buffer can't grow any further */
+  int (*grow_code)(struct jit_backend *);
   void (*dump_code)(struct jit_backend *, const uint8_t *, int, FILE *);
   int (*handle_exception)(struct jit_backend *, struct exception_state *);
+  /* nonzero if fastmem accesses check jit_guest.tlb inline. backends which
+     don't have every access go through the guest's accessors while it's set */
+  int tlb_fastmem;
 
   /* dispatch interface */
   void (*run_code)(struct jit_backend *, int);
@@ -110,6 +151,11 @@ struct jit_backend {
   void (*invalidate_code)(struct jit_backend *, uint32_t);
   void (*patch_edge)(struct jit_backend *, void *, void *);
   void (*restore_edge)(struct jit_backend *, void *, uint32_t);
+  /* optional, abandons the guest instruction being executed and resumes
+     execution at the guest's current pc. while jit_guest.tlb is set, backends
+     providing it store the pc before each access which may raise a guest
+     exception. doesn't return */
+  void (*abort_code)(struct jit_backend *);
 };
 
 #endif
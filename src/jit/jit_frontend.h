@@ -27,10 +27,29 @@ struct jit_frontend {
   void (*destroy)(struct jit_frontend *);
 
   void (*analyze_code)(struct jit_frontend *, uint32_t, int *);
-  void (*translate_code)(struct jit_frontend *, uint32_t, int, struct ir *);
+  /* returns the subset of translate_flags the translation was specialized
+     on. if any, the translation must check they still match when entered,
+     leaving through jit_guest.uncache_code if they don't */
+  uint32_t (*translate_code)(struct jit_frontend *, uint32_t, int,
+                             struct ir *);
+
+  /* optional, returns the current guest state that translations are being
+     specialized for (e.g. fpscr precision on the sh4). used to key cached
+     code */
+  uint32_t (*translate_flags)(struct jit_frontend *);
   void (*dump_code)(struct jit_frontend *, uint32_t, int, FILE *output);
 
   const struct jit_opdef *(*lookup_op)(struct jit_frontend *, const void *);
+
+  /* number of distinct ops returned by lookup_op, used to size per-op stats */
+  int num_ops;
+
+  /* size of each guest instruction, used to size per-instruction meta data */
+  int instr_size;
+
+  /* how far past the end of a block its pc-relative loads may read. these are
+     folded for immutable blocks, so their cache keys must cover this range */
+  int literal_range;
 };
 
 #endif
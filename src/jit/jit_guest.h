@@ -7,11 +7,27 @@ typedef uint32_t (*mem_read_cb)(void *, uint32_t, uint32_t);
 typedef void (*mem_write_cb)(void *, uint32_t, uint32_t, uint32_t);
 
 typedef void (*jit_compile_cb)(void *, uint32_t);
-typedef void (*jit_link_cb)(void *, uint32_t);
+typedef void (*jit_link_cb)(void *, void *, uint32_t);
+typedef void (*jit_uncache_cb)(void *, uint32_t);
 typedef void (*jit_interrupt_cb)(void *);
 
 struct memory;
 
+/* software tlb for guests translating virtual addresses. each entry caches
+   the translation of a single page, indexed by the low bits of its virtual
+   page number. the tag is the page aligned virtual address, with the low bit
+   set for entries caching nothing, and fastmem accesses to the page are made
+   to membase plus the translated address */
+#define JIT_TLB_PAGE_SHIFT 12
+#define JIT_TLB_PAGE_MASK ((1u << JIT_TLB_PAGE_SHIFT) - 1)
+#define JIT_TLB_SIZE 4096
+#define JIT_TLB_INVALID 0x1
+
+struct jit_tlb_entry {
+  uint32_t vaddr;
+  uint32_t paddr;
+};
+
 struct jit_guest {
   /* mask used to directly map each guest address to a block of code */
   uint32_t addr_mask;
@@ -30,6 +46,17 @@ struct jit_guest {
   void (*w16)(struct memory *, uint32_t, uint16_t);
   void (*w32)(struct memory *, uint32_t, uint32_t);
   void (*w64)(struct memory *, uint32_t, uint64_t);
+  /* optional, returns nonzero if the size bytes at addr can never be modified
+     (e.g. a boot rom), meaning code translated from them never needs to be
+     invalidated and loads from them may be folded at translation time */
+  int (*immutable)(struct memory *, uint32_t, int);
+  /* optional, set while the guest translates the addresses it accesses. the
+     accessors above take virtual addresses, translating them and refilling
+     the tlb on a miss. backends check it inline for fastmem accesses, falling
+     back to the accessors when the page isn't cached. an accessor may raise a
+     guest exception for an address without a translation, see
+     jit_abort_code */
+  struct jit_tlb_entry *tlb;
 
   /* runtime interface used by the backend and dispatch */
   void *data;
@@ -39,6 +66,11 @@ struct jit_guest {
   int offset_interrupts;
   jit_compile_cb compile_code;
   jit_link_cb link_code;
+  jit_uncache_cb uncache_code;
+  /* compiled code only checks the remaining cycles at the start of each
+     block, calling check_interrupts once they go negative. guests make their
+     pending interrupts get taken by forcing the cycles negative as soon as
+     one is pending, with check_interrupts restoring them */
   jit_interrupt_cb check_interrupts;
 };
 
@@ -1,5 +1,8 @@
 #include "jit/pass_stats.h"
 #include "core/core.h"
+#include "core/profiler.h"
+#include "core/time.h"
+#include "jit/ir/ir.h"
 
 static struct list stats;
 
@@ -28,3 +31,93 @@ void pass_stats_dump() {
 
   LOG_INFO("");
 }
+
+static const char *pass_stage_names[PASS_NUM_STAGES] = {
+    "translate", "cfa", "lse", "cprop", "esimp", "gvn", "mac", "cve", "dce",
+    "ra", "assemble",
+};
+
+static prof_token_t pass_stage_ns[PASS_NUM_STAGES];
+static prof_token_t pass_stage_runs[PASS_NUM_STAGES];
+static prof_token_t pass_stage_instrs_in[PASS_NUM_STAGES];
+static prof_token_t pass_stage_instrs_out[PASS_NUM_STAGES];
+
+CONSTRUCTOR(PASS_STAGES_REGISTER) {
+  char name[64];
+
+  for (int i = 0; i < PASS_NUM_STAGES; i++) {
+    snprintf(name, sizeof(name), "%s_ns", pass_stage_names[i]);
+    pass_stage_ns[i] = prof_get_counter_token(name);
+    snprintf(name, sizeof(name), "%s_runs", pass_stage_names[i]);
+    pass_stage_runs[i] = prof_get_counter_token(name);
+    snprintf(name, sizeof(name), "%s_instrs_in", pass_stage_names[i]);
+    pass_stage_instrs_in[i] = prof_get_counter_token(name);
+    snprintf(name, sizeof(name), "%s_instrs_out", pass_stage_names[i]);
+    pass_stage_instrs_out[i] = prof_get_counter_token(name);
+  }
+}
+
+static int pass_num_instrs(const struct ir *ir) {
+  int n = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ((void)instr);
+      n++;
+    }
+  }
+
+  return n;
+}
+
+void pass_timer_begin(struct pass_timer *timer, enum pass_stage stage,
+                      const struct ir *ir) {
+  timer->stage = stage;
+  timer->num_instrs = pass_num_instrs(ir);
+  timer->start = time_nanoseconds();
+}
+
+void pass_timer_end(struct pass_timer *timer, const struct ir *ir) {
+  int64_t elapsed = time_nanoseconds() - timer->start;
+  enum pass_stage stage = timer->stage;
+
+  prof_counter_add(pass_stage_ns[stage], elapsed);
+  prof_counter_add(pass_stage_runs[stage], 1);
+  prof_counter_add(pass_stage_instrs_in[stage], timer->num_instrs);
+  prof_counter_add(pass_stage_instrs_out[stage], pass_num_instrs(ir));
+}
+
+const char *pass_stage_name(enum pass_stage stage) {
+  return pass_stage_names[stage];
+}
+
+void pass_timings_get(enum pass_stage stage, struct pass_timing *timing) {
+  timing->ns = prof_counter_load(pass_stage_ns[stage]);
+  timing->runs = prof_counter_load(pass_stage_runs[stage]);
+  timing->instrs_in = prof_counter_load(pass_stage_instrs_in[stage]);
+  timing->instrs_out = prof_counter_load(pass_stage_instrs_out[stage]);
+}
+
+void pass_timings_dump() {
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("pass timings");
+  LOG_INFO("===-----------------------------------------------------===");
+
+  LOG_INFO("%-10s  %8s  %12s  %10s  %12s  %12s", "stage", "runs", "total ms",
+           "avg us", "instrs in", "instrs out");
+
+  for (int i = 0; i < PASS_NUM_STAGES; i++) {
+    struct pass_timing t;
+    pass_timings_get(i, &t);
+
+    if (!t.runs) {
+      continue;
+    }
+
+    LOG_INFO("%-10s  %8" PRId64 "  %12.3f  %10.3f  %12" PRId64 "  %12" PRId64,
+             pass_stage_names[i], t.runs, t.ns / (double)NS_PER_MS,
+             (t.ns / (double)t.runs) / 1000.0, t.instrs_in, t.instrs_out);
+  }
+
+  LOG_INFO("");
+}
@@ -1,9 +1,12 @@
 #ifndef PASS_STATS_H
 #define PASS_STATS_H
 
+#include <stdint.h>
 #include "core/constructor.h"
 #include "core/list.h"
 
+struct ir;
+
 #define DEFINE_PASS_STAT(name, desc)                                        \
   static int STAT_##name;                                                   \
   static struct pass_stat STAT_T_##name = {#name, desc, &STAT_##name, {0}}; \
@@ -25,4 +28,46 @@ void pass_stats_register(struct pass_stat *stat);
 void pass_stats_unregister(struct pass_stat *stat);
 void pass_stats_dump();
 
+/*
+ * compile time accounting
+ *
+ * wall time and ir size are tracked for each stage of compilation, and
+ * exposed through the profiler's counters. note, the counters aren't updated
+ * atomically, so stages run concurrently on multiple threads may lose counts
+ */
+enum pass_stage {
+  PASS_TRANSLATE,
+  PASS_CFA,
+  PASS_LSE,
+  PASS_CPROP,
+  PASS_ESIMP,
+  PASS_GVN,
+  PASS_MAC,
+  PASS_CVE,
+  PASS_DCE,
+  PASS_RA,
+  PASS_ASSEMBLE,
+  PASS_NUM_STAGES,
+};
+
+struct pass_timer {
+  enum pass_stage stage;
+  int64_t start;
+  int num_instrs;
+};
+
+struct pass_timing {
+  int64_t ns;
+  int64_t runs;
+  int64_t instrs_in;
+  int64_t instrs_out;
+};
+
+void pass_timer_begin(struct pass_timer *timer, enum pass_stage stage,
+                      const struct ir *ir);
+void pass_timer_end(struct pass_timer *timer, const struct ir *ir);
+const char *pass_stage_name(enum pass_stage stage);
+void pass_timings_get(enum pass_stage stage, struct pass_timing *timing);
+void pass_timings_dump();
+
 #endif
@@ -27,8 +27,11 @@ static void cprop_run_block(struct cprop *cprop, struct ir *ir,
         case OP_AND:
           folded = ir_alloc_int(ir, lhs & rhs, result->type);
           break;
-        case OP_DIV:
-          folded = ir_alloc_int(ir, lhs / rhs, result->type);
+        case OP_UDIV:
+          /* leave division by zero to fault at runtime like the guest's */
+          if (rhs) {
+            folded = ir_alloc_int(ir, lhs / rhs, result->type);
+          }
           break;
         case OP_LSHR:
           folded = ir_alloc_int(ir, lhs >> rhs, result->type);
@@ -6,65 +6,128 @@ DEFINE_PASS_STAT(sext_removed, "sign extends eliminated");
 DEFINE_PASS_STAT(zext_removed, "zero extends eliminated");
 DEFINE_PASS_STAT(trunc_removed, "truncations eliminated");
 
-static void cve_run_block(struct ir *ir, struct ir_block *block) {
+static void cve_count_removed(enum ir_op op) {
+  if (op == OP_SEXT) {
+    STAT_sext_removed++;
+  } else if (op == OP_ZEXT) {
+    STAT_zext_removed++;
+  } else if (op == OP_TRUNC) {
+    STAT_trunc_removed++;
+  }
+}
+
+static int cve_is_load(const struct ir_instr *instr) {
+  return instr && (instr->op == OP_LOAD_GUEST || instr->op == OP_LOAD_FAST);
+}
+
+static int cve_is_ext(const struct ir_instr *instr) {
+  return instr && (instr->op == OP_SEXT || instr->op == OP_ZEXT);
+}
+
+static void cve_fold_load_ext(struct cve *cve, struct ir *ir,
+                              struct ir_instr *load, struct ir_instr *ext) {
+  struct ir_value *result = load->result;
+
+  /* only fold if every use of the loaded data extends it the same way, the
+     narrow value isn't available once folded */
+  list_for_each_entry(use, &result->uses, struct ir_use, it) {
+    struct ir_instr *use_instr = use->instr;
+
+    if (use_instr->op != ext->op ||
+        use_instr->result->type != ext->result->type) {
+      return;
+    }
+  }
+
+  /* load the data directly into the extended type, recording the type of the
+     memory being accessed */
+  enum ir_type mem_type = result->type;
+  int sext = ext->op == OP_SEXT;
+
+  result->type = ext->result->type;
+  ir_set_arg1(ir, load, ir_alloc_int(ir, sext, mem_type));
+}
+
+static void cve_run_block(struct cve *cve, struct ir *ir,
+                          struct ir_block *block) {
   list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
-    /* eliminate unnecessary sext / zext operations */
-    if (instr->op == OP_LOAD_HOST || instr->op == OP_LOAD_GUEST ||
-        instr->op == OP_LOAD_FAST || instr->op == OP_LOAD_CONTEXT) {
-      enum ir_type memory_type = VALUE_V;
-      int same_type = 1;
-      int all_sext = 1;
-      int all_zext = 1;
-
-      list_for_each_entry(use, &instr->result->uses, struct ir_use, it) {
-        struct ir_instr *use_instr = use->instr;
-        struct ir_value *use_result = use_instr->result;
-
-        if (use_instr->op == OP_SEXT || use_instr->op == OP_ZEXT) {
-          if (memory_type == VALUE_V) {
-            memory_type = use_result->type;
-          }
-
-          if (memory_type != use_result->type) {
-            same_type = 0;
-          }
-        }
+    if (cve_is_ext(instr)) {
+      struct ir_value *arg = instr->arg[0];
+      struct ir_instr *def = arg->def;
 
-        if (use_instr->op != OP_SEXT) {
-          all_sext = 0;
-        }
+      /* fold sign / zero extensions into guest memory loads */
+      if (cve_is_load(def) && !def->arg[1]) {
+        cve_fold_load_ext(cve, ir, def, instr);
+      }
 
-        if (use_instr->op != OP_ZEXT) {
-          all_zext = 0;
-        }
+      if (cve_is_load(def) && def->arg[1] &&
+          arg->type == instr->result->type) {
+        cve_count_removed(instr->op);
+        ir_replace_uses(instr->result, arg);
+        ir_remove_instr(ir, instr);
+        continue;
       }
 
-      if (same_type && all_sext) {
-        /* TODO implement */
+      /* collapse sext(sext(x)) into sext(x) and zext(zext(x)) into zext(x) */
+      if (def && def->op == instr->op) {
+        ir_set_arg0(ir, instr, def->arg[0]);
+        cve_count_removed(def->op);
+      }
+    } else if (instr->op == OP_TRUNC) {
+      struct ir_value *arg = instr->arg[0];
+      struct ir_instr *def = arg->def;
 
-        STAT_sext_removed++;
-      } else if (same_type && all_zext) {
-        /* TODO implement */
+      if (def && def->op == OP_TRUNC) {
+        /* collapse trunc(trunc(x)) into trunc(x) */
+        ir_set_arg0(ir, instr, def->arg[0]);
+        cve_count_removed(def->op);
+      } else if (cve_is_ext(def)) {
+        struct ir_value *src = def->arg[0];
+        int src_size = ir_type_size(src->type);
+        int dst_size = ir_type_size(instr->result->type);
 
-        STAT_zext_removed++;
+        if (src_size == dst_size) {
+          /* trunc(ext(x)) back to the original type is just x */
+          ir_replace_uses(instr->result, src);
+          ir_remove_instr(ir, instr);
+          cve_count_removed(def->op);
+          cve_count_removed(OP_TRUNC);
+          continue;
+        } else if (src_size > dst_size) {
+          /* the extension is entirely truncated away */
+          ir_set_arg0(ir, instr, src);
+          cve_count_removed(def->op);
+        } else {
+          /* the truncation only partially undoes the extension */
+          instr->op = def->op;
+          ir_set_arg0(ir, instr, src);
+          cve_count_removed(OP_TRUNC);
+        }
       }
-    } else if (instr->op == OP_STORE_HOST || instr->op == OP_STORE_GUEST ||
-               instr->op == OP_STORE_FAST || instr->op == OP_STORE_CONTEXT) {
-      struct ir_value *store_value = instr->arg[1];
-
-      if (store_value->def && store_value->def->op == OP_TRUNC) {
-        /* TODO implement */
+    } else if (instr->op == OP_STORE_GUEST || instr->op == OP_STORE_FAST) {
+      struct ir_value *data = instr->arg[1];
+      struct ir_instr *def = data->def;
 
-        /* note, don't actually remove the truncation as other values may
-           reference it. let DCE clean it up */
+      /* fold truncations into guest memory stores. note, don't actually remove
+         the truncation as other values may reference it. let DCE clean it up */
+      if (def && def->op == OP_TRUNC && !ir_is_constant(def->arg[0]) &&
+          !instr->arg[2]) {
+        ir_set_arg1(ir, instr, def->arg[0]);
+        ir_set_arg2(ir, instr, ir_alloc_int(ir, 0, data->type));
         STAT_trunc_removed++;
       }
     }
   }
 }
 
-void cve_run(struct ir *ir) {
+void cve_run(struct cve *cve, struct ir *ir) {
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
-    cve_run_block(ir, block);
+    cve_run_block(cve, ir, block);
   }
 }
+
+void cve_destroy(struct cve *cve) {}
+
+struct cve *cve_create() {
+  return NULL;
+}
@@ -1,8 +1,11 @@
 #ifndef CONVERSION_ELIMINATION_PASS_H
 #define CONVERSION_ELIMINATION_PASS_H
 
+struct cve;
 struct ir;
 
-void cve_run(struct ir *ir);
+struct cve *cve_create();
+void cve_destroy(struct cve *cve);
+void cve_run(struct cve *cve, struct ir *ir);
 
 #endif
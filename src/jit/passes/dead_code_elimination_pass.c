@@ -15,6 +15,13 @@ static void dce_run_block(struct dce *dce, struct ir *ir,
       continue;
     }
 
+    /* loads whose result is unused still raise any exception for their
+       address */
+    if (ir->precise_memory &&
+        (instr->op == OP_LOAD_GUEST || instr->op == OP_LOAD_FAST)) {
+      continue;
+    }
+
     if (list_empty(&result->uses)) {
       ir_remove_instr(ir, instr);
 
@@ -49,7 +49,7 @@ static void esimp_run_block(struct esimp *esimp, struct ir *ir,
 
       /* simplify binary ops where 1 is an identity */
       else if ((instr->op == OP_UMUL || instr->op == OP_SMUL ||
-                instr->op == OP_DIV) &&
+                instr->op == OP_SDIV || instr->op == OP_UDIV) &&
                rhs == 1) {
         ir_replace_uses(instr->result, lhs);
         STAT_one_identities_removed++;
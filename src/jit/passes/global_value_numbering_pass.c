@@ -0,0 +1,206 @@
+#include "jit/passes/global_value_numbering_pass.h"
+#include "core/hash.h"
+#include "jit/ir/ir.h"
+#include "jit/pass_stats.h"
+
+/* value numbering pass which removes redundant pure expressions. expressions
+   are numbered over chains of extended blocks, the same scope the register
+   allocator works in, as the first occurrence of an expression in a chain
+   always dominates the later ones */
+
+DEFINE_PASS_STAT(exprs_numbered, "expressions numbered");
+DEFINE_PASS_STAT(exprs_removed, "redundant expressions removed");
+
+#define GVN_TABLE_BITS 12
+#define GVN_TABLE_SIZE (1 << GVN_TABLE_BITS)
+
+struct gvn_entry {
+  /* cache token when this entry was added */
+  uint64_t token;
+
+  uint64_t hash;
+  struct ir_instr *instr;
+};
+
+struct gvn {
+  /* current cache token */
+  uint64_t token;
+
+  struct gvn_entry table[GVN_TABLE_SIZE];
+};
+
+static void gvn_clear(struct gvn *gvn) {
+  do {
+    gvn->token++;
+  } while (gvn->token == 0);
+}
+
+static int gvn_is_pure(enum ir_op op) {
+  /* operations whose result depends only on their arguments */
+  return op >= OP_FTOI && op <= OP_LSHD;
+}
+
+static int gvn_is_commutative(enum ir_op op) {
+  /* note, floating point ops are left out as the nan they produce depends on
+     operand order */
+  return op == OP_ADD || op == OP_SMUL || op == OP_UMUL || op == OP_AND ||
+         op == OP_OR || op == OP_XOR;
+}
+
+static uint64_t gvn_value_key(const struct ir_value *v) {
+  if (!v) {
+    return 0;
+  }
+
+  if (!ir_is_constant(v)) {
+    return (uint64_t)(uintptr_t)v;
+  }
+
+  /* constants are allocated per use, key them by their contents */
+  uint64_t bits = 0;
+
+  switch (v->type) {
+    case VALUE_F32:
+      memcpy(&bits, &v->f32, sizeof(v->f32));
+      break;
+    case VALUE_F64:
+      memcpy(&bits, &v->f64, sizeof(v->f64));
+      break;
+    case VALUE_BLOCK:
+      bits = (uint64_t)(uintptr_t)v->blk;
+      break;
+    default:
+      bits = ir_zext_constant(v);
+      break;
+  }
+
+  return (bits * GOLDEN_RATIO_64) ^ v->type;
+}
+
+static int gvn_value_equal(const struct ir_value *a, const struct ir_value *b) {
+  if (a == b) {
+    return 1;
+  }
+
+  if (!a || !b || !ir_is_constant(a) || !ir_is_constant(b)) {
+    return 0;
+  }
+
+  return a->type == b->type && gvn_value_key(a) == gvn_value_key(b);
+}
+
+static uint64_t gvn_hash(const struct ir_instr *instr) {
+  uint64_t keys[IR_MAX_ARGS];
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    keys[i] = gvn_value_key(instr->arg[i]);
+  }
+
+  /* hash commutative operations the same regardless of argument order */
+  if (gvn_is_commutative(instr->op) && keys[0] > keys[1]) {
+    uint64_t tmp = keys[0];
+    keys[0] = keys[1];
+    keys[1] = tmp;
+  }
+
+  uint64_t hash = ((uint64_t)instr->op << 8) | instr->result->type;
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    hash = (hash ^ keys[i]) * GOLDEN_RATIO_64;
+  }
+
+  return hash;
+}
+
+static int gvn_equal(const struct ir_instr *a, const struct ir_instr *b) {
+  if (a->op != b->op || a->result->type != b->result->type) {
+    return 0;
+  }
+
+  int equal = 1;
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    equal &= gvn_value_equal(a->arg[i], b->arg[i]);
+  }
+
+  if (!equal && gvn_is_commutative(a->op)) {
+    equal = gvn_value_equal(a->arg[0], b->arg[1]) &&
+            gvn_value_equal(a->arg[1], b->arg[0]);
+
+    for (int i = 2; i < IR_MAX_ARGS; i++) {
+      equal &= gvn_value_equal(a->arg[i], b->arg[i]);
+    }
+  }
+
+  return equal;
+}
+
+static struct ir_instr *gvn_lookup_or_insert(struct gvn *gvn,
+                                             struct ir_instr *instr) {
+  uint64_t hash = gvn_hash(instr);
+  uint64_t idx = hash_key(hash, GVN_TABLE_BITS);
+
+  /* linear probe for an existing entry, or the first free one */
+  for (int n = 0; n < GVN_TABLE_SIZE; n++) {
+    struct gvn_entry *entry = &gvn->table[idx];
+
+    if (entry->token != gvn->token) {
+      entry->token = gvn->token;
+      entry->hash = hash;
+      entry->instr = instr;
+      STAT_exprs_numbered++;
+      return NULL;
+    }
+
+    if (entry->hash == hash && gvn_equal(entry->instr, instr)) {
+      return entry->instr;
+    }
+
+    idx = (idx + 1) & (GVN_TABLE_SIZE - 1);
+  }
+
+  /* table is full, leave the expression be */
+  return NULL;
+}
+
+static void gvn_run_block(struct gvn *gvn, struct ir *ir,
+                          struct ir_block *block) {
+  /* expressions from the previous block are only available if this block can
+     only be reached from it */
+  if (!ir_is_extended_block(ir, block)) {
+    gvn_clear(gvn);
+  }
+
+  list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
+    if (!instr->result || !gvn_is_pure(instr->op)) {
+      continue;
+    }
+
+    struct ir_instr *existing = gvn_lookup_or_insert(gvn, instr);
+
+    if (!existing) {
+      continue;
+    }
+
+    ir_replace_uses(instr->result, existing->result);
+    ir_remove_instr(ir, instr);
+
+    STAT_exprs_removed++;
+  }
+}
+
+void gvn_run(struct gvn *gvn, struct ir *ir) {
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    gvn_run_block(gvn, ir, block);
+  }
+}
+
+void gvn_destroy(struct gvn *gvn) {
+  free(gvn);
+}
+
+struct gvn *gvn_create() {
+  struct gvn *gvn = calloc(1, sizeof(struct gvn));
+
+  return gvn;
+}
@@ -0,0 +1,11 @@
+#ifndef GLOBAL_VALUE_NUMBERING_PASS_H
+#define GLOBAL_VALUE_NUMBERING_PASS_H
+
+struct gvn;
+struct ir;
+
+struct gvn *gvn_create();
+void gvn_destroy(struct gvn *gvn);
+void gvn_run(struct gvn *gvn, struct ir *ir);
+
+#endif
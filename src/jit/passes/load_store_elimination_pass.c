@@ -101,13 +101,15 @@ static int lse_test_available(struct lse *lse, int offset, int size) {
 
 static void lse_eliminate_loads(struct lse *lse, struct ir *ir,
                                 struct ir_block *block) {
-  lse_clear_available(lse);
+  /* values available at the end of the previous block are still available if
+     this block can only be reached from it */
+  if (!ir_is_extended_block(ir, block)) {
+    lse_clear_available(lse);
+  }
 
   list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
     if (instr->op == OP_FALLBACK || instr->op == OP_CALL) {
       lse_clear_available(lse);
-    } else if (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND) {
-      lse_clear_available(lse);
     } else if (instr->op == OP_LOAD_CONTEXT) {
       /* if there is already a value available for this offset, reuse it and
          remove this redundant load */;
@@ -142,6 +144,12 @@ static void lse_eliminate_stores(struct lse *lse, struct ir *ir,
       lse_clear_available(lse);
     } else if (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND) {
       lse_clear_available(lse);
+    } else if (ir->precise_memory &&
+               (instr->op == OP_LOAD_GUEST || instr->op == OP_STORE_GUEST ||
+                instr->op == OP_LOAD_FAST || instr->op == OP_STORE_FAST)) {
+      /* the access may raise an exception, which must see the stores made
+         ahead of it */
+      lse_clear_available(lse);
     } else if (instr->op == OP_LOAD_CONTEXT) {
       int offset = instr->arg[0]->i32;
       int size = ir_type_size(instr->result->type);
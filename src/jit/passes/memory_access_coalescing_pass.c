@@ -0,0 +1,290 @@
+#include "jit/passes/memory_access_coalescing_pass.h"
+#include "jit/ir/ir.h"
+#include "jit/pass_stats.h"
+
+/* merges pairs of 32-bit fastmem accesses to adjacent addresses, relative to
+   the same base, into a single 64-bit access
+
+   loads are merged when no write or call happens between them, with the
+   merged load taking the place of the first one. stores are only merged when
+   they write back both halves of the same 64-bit value (e.g. copying out a
+   pair of merged loads), as packing two unrelated values together would cost
+   as much as the store saved
+
+   the alignment of the base isn't known, sh4 code commonly accesses 4-byte
+   aligned stack slots through r15, so the merged access may straddle the end
+   of a page. when the next page isn't mapped, the access faults where neither
+   half would have. the backends' exception handlers recover the address of
+   the access for this, and the guest's read64 / write64 handlers split it
+   into a pair of 32-bit accesses, one for each page. pairs are still only
+   merged when aligned relative to the base, as that's the one most likely to
+   be aligned in memory */
+
+DEFINE_PASS_STAT(loads_merged, "fastmem loads merged");
+DEFINE_PASS_STAT(stores_merged, "fastmem stores merged");
+
+#define MAC_MAX_LOADS 8
+
+struct mac_access {
+  struct ir_instr *instr;
+  struct ir_value *base;
+  uint32_t offset;
+};
+
+struct mac {
+  /* loads which a later load can be merged into */
+  struct mac_access loads[MAC_MAX_LOADS];
+  int num_loads;
+
+  /* store which the next store can be merged with, only valid while no other
+     memory access has been seen after it */
+  struct mac_access store;
+};
+
+static struct mac_access mac_split_access(struct ir_instr *instr) {
+  struct mac_access access = {instr, instr->arg[0], 0};
+
+  /* peel off constant offsets the address is computed with */
+  while (access.base->def) {
+    struct ir_instr *def = access.base->def;
+
+    if ((def->op != OP_ADD && def->op != OP_SUB) ||
+        !ir_is_constant(def->arg[1])) {
+      break;
+    }
+
+    uint32_t n = (uint32_t)def->arg[1]->i32;
+    access.offset += def->op == OP_ADD ? n : -n;
+    access.base = def->arg[0];
+  }
+
+  return access;
+}
+
+static int mac_is_candidate(struct ir_instr *instr) {
+  /* accesses with a constant address are resolved at compile time by the
+     backends, and ext / trunc arguments are only set later on by cve */
+  if (ir_is_constant(instr->arg[0])) {
+    return 0;
+  }
+
+  if (instr->op == OP_LOAD_FAST) {
+    return instr->result->type == VALUE_I32 && !instr->arg[1];
+  }
+
+  return instr->arg[1]->type == VALUE_I32 && !instr->arg[2];
+}
+
+static int mac_is_pair(const struct mac_access *a,
+                       const struct mac_access *b) {
+  if (a->base != b->base) {
+    return 0;
+  }
+
+  if (a->offset - b->offset != 4 && b->offset - a->offset != 4) {
+    return 0;
+  }
+
+  /* prefer the pair which is 8-byte aligned relative to the base. note, the
+     offsets may wrap around when subtracted from the base */
+  uint32_t lo = a->offset + 4 == b->offset ? a->offset : b->offset;
+  return (lo & 0x7) == 0;
+}
+
+static struct ir_value *mac_access_addr(struct ir *ir,
+                                        const struct mac_access *access) {
+  if (!access->offset) {
+    return access->base;
+  }
+
+  return ir_add(ir, access->base, ir_alloc_i32(ir, access->offset));
+}
+
+static int mac_is_high_half(const struct ir_value *v,
+                            const struct ir_value *wide) {
+  const struct ir_instr *def = v->def;
+
+  if (!def || def->op != OP_TRUNC) {
+    return 0;
+  }
+
+  const struct ir_instr *shift = def->arg[0]->def;
+
+  return shift && shift->op == OP_LSHR && shift->arg[0] == wide &&
+         ir_is_constant(shift->arg[1]) && shift->arg[1]->i32 == 32;
+}
+
+static struct ir_value *mac_low_half(const struct ir_value *v) {
+  const struct ir_instr *def = v->def;
+
+  if (!def || def->op != OP_TRUNC || def->arg[0]->type != VALUE_I64) {
+    return NULL;
+  }
+
+  return def->arg[0];
+}
+
+static void mac_merge_loads(struct ir *ir, struct mac_access *first,
+                            struct mac_access *second) {
+  struct mac_access *lo = first->offset + 4 == second->offset ? first : second;
+  struct mac_access *hi = lo == first ? second : first;
+
+  /* insert the merged load before the first load */
+  struct ir_instr *prev = list_prev_entry(first->instr, struct ir_instr, it);
+  struct ir_insert_point point = {first->instr->block, prev};
+  ir_set_insert_point(ir, &point);
+
+  struct ir_value *addr =
+      lo == first ? first->instr->arg[0] : mac_access_addr(ir, lo);
+  struct ir_value *wide = ir_load_fast(ir, addr, VALUE_I64);
+  struct ir_value *lo_data = ir_trunc(ir, wide, VALUE_I32);
+  struct ir_value *hi_data = ir_trunc(ir, ir_lshri(ir, wide, 32), VALUE_I32);
+
+  ir_replace_uses(lo->instr->result, lo_data);
+  ir_replace_uses(hi->instr->result, hi_data);
+  ir_remove_instr(ir, first->instr);
+  ir_remove_instr(ir, second->instr);
+
+  STAT_loads_merged++;
+}
+
+static int mac_try_merge_loads(struct mac *mac, struct ir *ir,
+                               struct mac_access *access) {
+  for (int i = 0; i < mac->num_loads; i++) {
+    struct mac_access *other = &mac->loads[i];
+
+    if (!mac_is_pair(other, access)) {
+      continue;
+    }
+
+    mac_merge_loads(ir, other, access);
+
+    /* the merged load can't be merged again */
+    mac->loads[i] = mac->loads[--mac->num_loads];
+    return 1;
+  }
+
+  return 0;
+}
+
+static int mac_try_merge_stores(struct mac *mac, struct ir *ir,
+                                struct mac_access *access) {
+  struct mac_access *first = &mac->store;
+
+  /* the merged store takes the place of the second one. an exception raised
+     by it would be taken after the instructions in between had run */
+  if (ir->precise_memory) {
+    return 0;
+  }
+
+  if (!first->instr || !mac_is_pair(first, access)) {
+    return 0;
+  }
+
+  struct mac_access *lo = first->offset + 4 == access->offset ? first : access;
+  struct mac_access *hi = lo == first ? access : first;
+  struct ir_value *wide = mac_low_half(lo->instr->arg[1]);
+
+  if (!wide || !mac_is_high_half(hi->instr->arg[1], wide)) {
+    return 0;
+  }
+
+  /* both addresses are available at the second store, insert the merged store
+     there */
+  struct ir_insert_point point = {access->instr->block, access->instr};
+  ir_set_insert_point(ir, &point);
+
+  ir_store_fast(ir, lo->instr->arg[0], wide);
+  ir_remove_instr(ir, first->instr);
+  ir_remove_instr(ir, access->instr);
+
+  STAT_stores_merged++;
+
+  return 1;
+}
+
+static void mac_run_block(struct mac *mac, struct ir *ir,
+                          struct ir_block *block) {
+  mac->num_loads = 0;
+  mac->store.instr = NULL;
+
+  list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
+    const struct ir_opdef *def = &ir_opdefs[instr->op];
+
+    if (def->flags & IR_FLAG_CALL) {
+      mac->num_loads = 0;
+      mac->store.instr = NULL;
+      continue;
+    }
+
+    switch (instr->op) {
+      case OP_LOAD_FAST: {
+        mac->store.instr = NULL;
+
+        if (!mac_is_candidate(instr)) {
+          break;
+        }
+
+        struct mac_access access = mac_split_access(instr);
+
+        if (mac_try_merge_loads(mac, ir, &access)) {
+          break;
+        }
+
+        if (mac->num_loads == MAC_MAX_LOADS) {
+          mac->num_loads--;
+          memmove(&mac->loads[0], &mac->loads[1],
+                  mac->num_loads * sizeof(mac->loads[0]));
+        }
+
+        mac->loads[mac->num_loads++] = access;
+      } break;
+
+      case OP_STORE_FAST: {
+        mac->num_loads = 0;
+
+        if (!mac_is_candidate(instr)) {
+          mac->store.instr = NULL;
+          break;
+        }
+
+        struct mac_access access = mac_split_access(instr);
+
+        if (mac_try_merge_stores(mac, ir, &access)) {
+          mac->store.instr = NULL;
+          break;
+        }
+
+        mac->store = access;
+      } break;
+
+      case OP_LOAD_HOST:
+        mac->store.instr = NULL;
+        break;
+
+      case OP_STORE_HOST:
+        mac->num_loads = 0;
+        mac->store.instr = NULL;
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+void mac_run(struct mac *mac, struct ir *ir) {
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    mac_run_block(mac, ir, block);
+  }
+}
+
+void mac_destroy(struct mac *mac) {
+  free(mac);
+}
+
+struct mac *mac_create() {
+  struct mac *mac = calloc(1, sizeof(struct mac));
+
+  return mac;
+}
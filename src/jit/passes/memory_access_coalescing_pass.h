@@ -0,0 +1,11 @@
+#ifndef MEMORY_ACCESS_COALESCING_PASS_H
+#define MEMORY_ACCESS_COALESCING_PASS_H
+
+struct mac;
+struct ir;
+
+struct mac *mac_create();
+void mac_destroy(struct mac *mac);
+void mac_run(struct mac *mac, struct ir *ir);
+
+#endif
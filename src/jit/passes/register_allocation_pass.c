@@ -8,10 +8,17 @@
 
 /* second-chance binpacking register allocator based off of the paper "Quality
    and Speed in Linear-scan Register Allocation" by Omri Traub, Glenn Holloway
-   and Michael D. Smith */
+   and Michael D. Smith
+
+   allocation is performed over chains of extended blocks, enabling values to
+   stay in a register when control falls through to a block whose only
+   predecessor is the previous block. since the chain is only ever entered at
+   its head, the registers hold the same values whichever path reaches a block
+   and no moves need to be resolved on the edges between them */
 
 DEFINE_PASS_STAT(gprs_spilled, "gprs spilled");
 DEFINE_PASS_STAT(fprs_spilled, "fprs spilled");
+DEFINE_PASS_STAT(slots_reused, "spill slots reused");
 
 struct ra_tmp;
 
@@ -37,8 +44,11 @@ struct ra_bin {
 
    before the temporary's next use, a fill back from the stack is inserted,
    producing a new non-NULL value to allocate for, but not touching the stack
-   slot. slots are not reused by different temporaries, so once it has spilled
-   once, it should not be spilled again */
+   slot. this effectively splits the temporary's live range at each use, with
+   each piece being allocated a register independently. the slot is owned by
+   the temporary until its last use, so once it has spilled once, it doesn't
+   need to be stored again. after its last use, the slot may be handed to
+   another temporary of the same type */
 struct ra_tmp {
   int first_use_idx;
   int last_use_idx;
@@ -71,6 +81,11 @@ struct ra {
   struct ra_use *uses;
   int num_uses;
   int max_uses;
+
+  /* spill slots released by previously allocated chains */
+  struct ir_local **slots;
+  int num_slots;
+  int max_slots;
 };
 
 #define NO_REGISTER -1
@@ -86,6 +101,10 @@ struct ra {
   ((b)->tmp_idx == NO_TMP ? NULL : &ra->tmps[(b)->tmp_idx])
 #define ra_set_packed(b, t) (b)->tmp_idx = (t) ? (int)((t)-ra->tmps) : NO_TMP
 
+#define ra_for_each_block(block, head, end) \
+  for (struct ir_block *block = (head); block != (end); \
+       block = list_next_entry(block, struct ir_block, it))
+
 #define ra_get_tmp(v) (&ra->tmps[(v)->tag])
 #define ra_set_tmp(v, t) (v)->tag = (int)((t)-ra->tmps)
 
@@ -198,13 +217,10 @@ static int ra_validate_value(struct ra *ra, struct ir_value *v, int flags) {
   return valid;
 }
 
-static void ra_validate(struct ra *ra, struct ir *ir, struct ir_block *block) {
+static void ra_validate(struct ra *ra, struct ir *ir, struct ir_block *block,
+                        struct ir_value **active) {
   /* validate that overlapping allocations weren't made */
   {
-    size_t active_size = sizeof(struct ir_value *) * ra->num_registers;
-    struct ir_value **active = alloca(active_size);
-    memset(active, 0, active_size);
-
     list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
       for (int i = 0; i < IR_MAX_ARGS; i++) {
         struct ir_value *arg = instr->arg[i];
@@ -273,6 +289,50 @@ static void ra_pack_bin(struct ra *ra, struct ra_bin *bin,
   ra_set_packed(bin, new_tmp);
 }
 
+static struct ir_local *ra_alloc_slot(struct ra *ra, struct ir *ir,
+                                      struct ra_tmp *tmp, int ordinal) {
+  enum ir_type type = tmp->value->type;
+
+  /* reuse the slot of a temporary whose live range has ended */
+  for (int i = 0; i < ra->num_tmps; i++) {
+    struct ra_tmp *other = &ra->tmps[i];
+
+    if (!other->slot || other->slot->type != type) {
+      continue;
+    }
+
+    struct ra_use *last_use = &ra->uses[other->last_use_idx];
+
+    if (last_use->ordinal >= ordinal) {
+      continue;
+    }
+
+    struct ir_local *slot = other->slot;
+    other->slot = NULL;
+
+    STAT_slots_reused++;
+
+    return slot;
+  }
+
+  /* reuse a slot from a previous chain */
+  for (int i = 0; i < ra->num_slots; i++) {
+    struct ir_local *slot = ra->slots[i];
+
+    if (slot->type != type) {
+      continue;
+    }
+
+    ra->slots[i] = ra->slots[--ra->num_slots];
+
+    STAT_slots_reused++;
+
+    return slot;
+  }
+
+  return ir_alloc_local(ir, type);
+}
+
 static void ra_spill_tmp(struct ra *ra, struct ir *ir, struct ra_tmp *tmp,
                          struct ir_instr *before) {
   if (!tmp->slot) {
@@ -280,7 +340,7 @@ static void ra_spill_tmp(struct ra *ra, struct ir *ir, struct ra_tmp *tmp,
     struct ir_insert_point point = {before->block, after};
     ir_set_insert_point(ir, &point);
 
-    tmp->slot = ir_alloc_local(ir, tmp->value->type);
+    tmp->slot = ra_alloc_slot(ra, ir, tmp, ra_get_ordinal(before));
     ir_store_local(ir, tmp->slot, tmp->value);
 
     /* track spill stats */
@@ -343,11 +403,41 @@ static void ra_spill_tmps(struct ra *ra, struct ir *ir,
   }
 }
 
+static int64_t ra_spill_cost(struct ra *ra, struct ra_tmp *tmp, int ordinal) {
+  struct ra_use *next_use = &ra->uses[tmp->next_use_idx];
+  int distance = next_use->ordinal - ordinal;
+
+  /* never evict a value being used by the current instruction unless there is
+     no other choice. fills are ordered before the instruction they're for, so
+     anything within IR_MAX_ARGS of them is still in use */
+  if (distance <= IR_MAX_ARGS) {
+    return INT64_MAX;
+  }
+
+  /* every remaining use is a potential fill if the temporary keeps getting
+     evicted, weight the cost by them */
+  int64_t num_uses = 0;
+
+  for (int idx = tmp->next_use_idx; idx != NO_USE;
+       idx = ra->uses[idx].next_idx) {
+    num_uses++;
+  }
+
+  /* temporaries which already have a slot don't need to be stored again */
+  int64_t cost = tmp->slot ? num_uses : num_uses + 1;
+
+  /* prefer evicting temporaries whose next use is far away */
+  return (cost << 16) / distance;
+}
+
 static int ra_alloc_blocked_reg(struct ra *ra, struct ir *ir,
                                 struct ra_tmp *tmp) {
-  /* find the register who's next use is furthest away */
+  /* find the register who's temporary is cheapest to spill, breaking ties by
+     choosing the one who's next use is furthest away */
   struct ra_bin *spill_bin = NULL;
+  int64_t lowest_cost = INT64_MAX;
   int furthest_use = INT_MIN;
+  int ordinal = ra_get_ordinal(tmp->value->def);
 
   for (int i = 0; i < ra->num_registers; i++) {
     struct ra_bin *bin = ra_get_bin(i);
@@ -362,8 +452,11 @@ static int ra_alloc_blocked_reg(struct ra *ra, struct ir *ir,
     }
 
     struct ra_use *next_use = &ra->uses[packed->next_use_idx];
+    int64_t cost = ra_spill_cost(ra, packed, ordinal);
 
-    if (next_use->ordinal > furthest_use) {
+    if (!spill_bin || cost < lowest_cost ||
+        (cost == lowest_cost && next_use->ordinal > furthest_use)) {
+      lowest_cost = cost;
       furthest_use = next_use->ordinal;
       spill_bin = bin;
     }
@@ -593,12 +686,11 @@ static void ra_create_tmps(struct ra *ra, struct ir *ir,
   }
 }
 
-static void ra_assign_ordinals(struct ra *ra, struct ir *ir,
-                               struct ir_block *block) {
-  int ordinal = 0;
-
+static int ra_assign_ordinals(struct ra *ra, struct ir *ir,
+                              struct ir_block *block, int ordinal) {
   /* assign each instruction an ordinal. these ordinals are used to describe
-     the live range of a particular value */
+     the live range of a particular value. ordinals continue from the previous
+     block in the chain, so ranges extend across block boundaries */
   list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
     ra_set_ordinal(instr, ordinal);
 
@@ -606,6 +698,8 @@ static void ra_assign_ordinals(struct ra *ra, struct ir *ir,
        enough to allow for this */
     ordinal += 1 + IR_MAX_ARGS;
   }
+
+  return ordinal;
 }
 
 static void ra_legalize_args(struct ra *ra, struct ir *ir,
@@ -653,7 +747,31 @@ static void ra_legalize_args(struct ra *ra, struct ir *ir,
   }
 }
 
-static void ra_reset(struct ra *ra, struct ir *ir, struct ir_block *block) {
+static void ra_release_slots(struct ra *ra) {
+  /* values never live across chains, so every slot owned by the previous
+     chain's temporaries is free once it's been allocated */
+  for (int i = 0; i < ra->num_tmps; i++) {
+    struct ra_tmp *tmp = &ra->tmps[i];
+
+    if (!tmp->slot) {
+      continue;
+    }
+
+    if (ra->num_slots >= ra->max_slots) {
+      ra->max_slots = MAX(32, ra->max_slots * 2);
+      ra->slots =
+          realloc(ra->slots, ra->max_slots * sizeof(struct ir_local *));
+    }
+
+    ra->slots[ra->num_slots++] = tmp->slot;
+    tmp->slot = NULL;
+  }
+}
+
+static void ra_reset(struct ra *ra, struct ir *ir, struct ir_block *head,
+                     struct ir_block *end) {
+  ra_release_slots(ra);
+
   /* reset allocation state */
   for (int i = 0; i < ra->num_registers; i++) {
     struct ra_bin *bin = &ra->bins[i];
@@ -664,27 +782,75 @@ static void ra_reset(struct ra *ra, struct ir *ir, struct ir_block *block) {
   ra->num_uses = 0;
 
   /* reset register state */
-  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
-    if (instr->result) {
-      instr->result->reg = NO_REGISTER;
+  ra_for_each_block(block, head, end) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      if (instr->result) {
+        instr->result->reg = NO_REGISTER;
+      }
     }
   }
 }
 
-void ra_run(struct ra *ra, struct ir *ir) {
-  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
-    ra_reset(ra, ir, block);
+static struct ir_block *ra_chain_end(struct ra *ra, struct ir *ir,
+                                     struct ir_block *head) {
+  /* find the first block after head which doesn't extend the chain */
+  struct ir_block *end = list_next_entry(head, struct ir_block, it);
+
+  while (end && ir_is_extended_block(ir, end)) {
+    end = list_next_entry(end, struct ir_block, it);
+  }
+
+  return end;
+}
+
+static void ra_alloc_chain(struct ra *ra, struct ir *ir, struct ir_block *head,
+                           struct ir_block *end) {
+  int ordinal = 0;
+
+  ra_reset(ra, ir, head, end);
+
+  ra_for_each_block(block, head, end) {
     ra_legalize_args(ra, ir, block);
-    ra_assign_ordinals(ra, ir, block);
+    ordinal = ra_assign_ordinals(ra, ir, block, ordinal);
+  }
+
+  /* every use in the chain must be known before allocating, otherwise values
+     live out of a block would appear to expire at its end */
+  ra_for_each_block(block, head, end) {
     ra_create_tmps(ra, ir, block);
+  }
+
+  ra_for_each_block(block, head, end) {
     ra_alloc_bins(ra, ir, block);
+  }
+
 #if 1
-    ra_validate(ra, ir, block);
+  size_t active_size = sizeof(struct ir_value *) * ra->num_registers;
+  struct ir_value **active = alloca(active_size);
+  memset(active, 0, active_size);
+
+  ra_for_each_block(block, head, end) {
+    ra_validate(ra, ir, block, active);
+  }
 #endif
+}
+
+void ra_run(struct ra *ra, struct ir *ir) {
+  struct ir_block *head = list_first_entry(&ir->blocks, struct ir_block, it);
+
+  /* temporaries and slots left over from the previous ir are stale */
+  ra->num_tmps = 0;
+  ra->num_slots = 0;
+
+  while (head) {
+    struct ir_block *end = ra_chain_end(ra, ir, head);
+    ra_alloc_chain(ra, ir, head, end);
+    head = end;
   }
 }
 
 void ra_destroy(struct ra *ra) {
+  free(ra->slots);
   free(ra->uses);
   free(ra->tmps);
   free(ra->bins);
@@ -1,5 +1,7 @@
+#include <stdlib.h>
 #include "options.h"
 #include "core/core.h"
+#include "core/thread.h"
 #include "host/keycode.h"
 
 /* default deadzone taken from: https://forums.libsdl.org/viewtopic.php?p=39985
@@ -41,6 +43,14 @@ const char *TIMESYNCS[] = {
 };
 const int NUM_TIMESYNCS = ARRAY_SIZE(TIMESYNCS);
 
+/* indexed by enum pacing_mode */
+const char *PACINGS[] = {
+  "audio",
+  "video",
+  "adaptive",
+};
+const int NUM_PACINGS = ARRAY_SIZE(PACINGS);
+
 const char *ASPECT_RATIOS[] = {
   "stretch",
   "16:9",
@@ -77,7 +87,19 @@ int *DEADZONES[] = {
 /* host */
 DEFINE_OPTION_INT(bios,                    0,                 "Boot to bios");
 DEFINE_PERSISTENT_OPTION_STRING(sync,      "audio and video", "Time sync");
+DEFINE_PERSISTENT_OPTION_STRING(pacing,    "audio",           "Frame pacing, audio to sync to the audio clock, video to the display's vblank or adaptive for variable refresh rate displays");
 DEFINE_PERSISTENT_OPTION_INT(fullscreen,   0,                 "Start window fullscreen");
+DEFINE_OPTION_INT(audio_latency,           0,                 "Size in milliseconds of the host's audio buffer, rounded up to a power of two frames, 0 for the default of 4096 frames");
+DEFINE_OPTION_INT(audio_rate_control,      0,                 "Resample audio by up to 0.5% to hold the amount buffered steady, avoiding underruns with a low audio_latency");
+DEFINE_OPTION_STRING(stats_file,           "",                "Path to append a json line of every profiler counter and the frame time percentiles to each second, empty to disable");
+DEFINE_OPTION_INT(reg_stats,               0,                 "Count the accesses to each sh4, holly and pvr register and the host time spent on them, for the debug menu and stats_file");
+DEFINE_OPTION_INT(log_async,               1,                 "Write log messages from a background thread, collapsing repeats and rate limiting bursts of them");
+DEFINE_OPTION_STRING(emu_cpus,             "",                "Cpus the emulation thread may run on, e.g. \"2,3\" or \"4-7\", empty for any");
+DEFINE_OPTION_STRING(video_cpus,           "",                "Cpus the video thread may run on, empty for any");
+DEFINE_OPTION_STRING(audio_cpus,           "",                "Cpus the audio thread may run on, empty for any");
+DEFINE_OPTION_STRING(compile_cpus,         "",                "Cpus the background compilation thread may run on, empty for any");
+DEFINE_OPTION_STRING(io_cpus,              "",                "Cpus the disc, chd, vmu and flash threads may run on, empty for any");
+DEFINE_OPTION_INT(thread_priorities,       0,                 "Raise the priority of the emulation, video and audio threads, and lower that of the compilation and i/o threads");
 DEFINE_PERSISTENT_OPTION_INT(key_a,        'l',               "A button mapping");
 DEFINE_PERSISTENT_OPTION_INT(key_b,        'p',               "B button mapping");
 DEFINE_PERSISTENT_OPTION_INT(key_x,        'k',               "X button mapping");
@@ -101,14 +123,61 @@ DEFINE_PERSISTENT_OPTION_INT(deadzone_3,   DEFAULT_DEADZONE,  "Deadzone for cont
 
 /* emulator */
 DEFINE_PERSISTENT_OPTION_STRING(aspect,    "4:3",             "Video aspect ratio");
+DEFINE_OPTION_INT(pipeline,                0,                 "Emulate the next frame while the current one is presented");
+DEFINE_OPTION_INT(run_ahead,               0,                 "Frames to run ahead of the one presented to hide input latency, 0 to disable");
+DEFINE_OPTION_INT(input_late_latch,        0,                 "Pull the latest input from the host right as the guest's maple dma reads the controllers, rather than once per frame");
+DEFINE_OPTION_INT(rewind,                  0,                 "Frames between captures saved for rewinding with backspace, 0 to disable");
+DEFINE_OPTION_INT(rewind_budget,           64,                "Size in MB of the buffer rewind captures are compressed into");
+DEFINE_OPTION_INT(profiles,                1,                 "Apply the options saved in the profile of the disc loaded, which rerun can tune");
+DEFINE_OPTION_STRING(record,               "",                "Path to record a movie of the input fed to the disc loaded to, for replaying with rerun");
+DEFINE_OPTION_INT(record_checksums,        60,                "Frames between the checksums of main ram recorded in movies, for detecting when replays diverge, 0 to disable");
+DEFINE_OPTION_INT(frameskip,               0,                 "Frames that may be skipped in a row when presenting falls behind real time, 0 to disable");
+DEFINE_OPTION_INT(fast_forward_skip,       8,                 "Frames ran for each one presented while fast-forwarding with tab");
+DEFINE_OPTION_INT(aica_thread,             0,                 "Run the arm7 on its own thread, handing it this many microseconds of time at once, 0 to disable");
+DEFINE_OPTION_INT(aica_lazy_mix,           0,                 "Mix audio when the aica's registers are accessed and at the end of each frame, rather than from a timer every few samples");
+DEFINE_OPTION_INT(aica_dsp,                0,                 "Run the aica's effects processor, 1 to interpret its program, 2 to compile it into host code");
+DEFINE_OPTION_INT(gdrom_timing,            0,                 "Drive timing model, 0 to complete reads instantly, 1 to model seek, rotation and transfer times");
+DEFINE_OPTION_INT(disc_prefetch,           0,                 "Sectors to read ahead of sequential disc accesses on a background thread, 0 to disable");
+DEFINE_OPTION_INT(chd_cache,               16,                "Size in MB of decompressed chd hunks kept cached");
+DEFINE_OPTION_INT(chd_threads,             0,                 "Threads decompressing the chd hunks following sequential reads ahead of time, 0 to disable");
+DEFINE_OPTION_INT(parallel_convert,        0,                 "Parse the display lists of large frames on worker threads");
+DEFINE_OPTION_INT(gpu_textures,            0,                 "Decode textures on the gpu rather than the cpu");
+DEFINE_OPTION_INT(gpu_palettes,            0,                 "Look up the colors of paletted textures on the gpu, so palette changes don't require converting them again");
+DEFINE_OPTION_INT(texture_budget,          256,               "Size in MB of converted textures kept resident before the least recently used are evicted, 0 to disable");
+DEFINE_OPTION_INT(texture_max_age,         600,               "Frames a texture can go unused before it's evicted, 0 to disable");
+DEFINE_OPTION_INT(precise_texture_watches, 0,                 "Only invalidate textures overlapping the write that faults their page, checking the rest for changes by hash");
+DEFINE_OPTION_INT(deferred_texture_watches, 1,                "Track writes to textures without faulting when the host supports it, checking for them once per frame");
+DEFINE_OPTION_STRING(texture_pack,         "",                "Path to a pack of replacement textures");
+DEFINE_OPTION_INT(oit,                     0,                 "Blend autosorted translucent lists per pixel on the gpu rather than sorting them per triangle, keeping their strips batched");
+DEFINE_OPTION_INT(resolution_scale,        0,                 "Render at this multiple of the native resolution before scaling to the window, 0 to render at the window's resolution");
+DEFINE_OPTION_INT(resolution_budget,       0,                 "Gpu milliseconds per frame rendering is kept under by lowering the resolution scale, 0 to keep it fixed");
+DEFINE_OPTION_INT(compact_vertices,        1,                 "Upload vertices whose uvs all fit in 16 bits in a smaller format");
+DEFINE_OPTION_INT(texture_arrays,          0,                 "Pack small textures into texture arrays, letting surfaces drawn from the same array be merged into one draw");
+DEFINE_OPTION_INT(sort_opaque,             0,                 "Reorder the opaque list by render state to batch its draws, which can change the result of surfaces at equal depths");
+DEFINE_OPTION_INT(shader_cache,            1,                 "Save linked shader programs to the application directory to skip compiling them on future runs");
+DEFINE_OPTION_INT(precompile_shaders,      0,                 "Compile every shader variant at startup rather than on first use");
+DEFINE_OPTION_INT(async_shaders,           1,                 "Draw with an ubershader while shader variants compile in the background rather than waiting on them");
 
 /* bios */
 DEFINE_PERSISTENT_OPTION_STRING(region,    "usa",             "System region");
 DEFINE_PERSISTENT_OPTION_STRING(language,  "english",         "System language");
 DEFINE_PERSISTENT_OPTION_STRING(broadcast, "ntsc",            "System broadcast mode");
+DEFINE_OPTION_INT(gdrom_hle,               0,                 "Handle the gdrom syscalls of a real bios at a high level, reading requests straight into guest memory rather than through the emulated drive");
+DEFINE_OPTION_INT(boot_cache,              0,                 "Discs whose machine state on entering their boot file is kept, in memory and under the app directory, resuming later loads of them from it when booting without a bios, 0 to disable");
 
 /* jit */
 DEFINE_OPTION_INT(perf,                    0,                 "Create maps for compiled code for use with perf");
+DEFINE_OPTION_INT(jit_cache,               0,                 "Cache optimized code to disk between runs");
+DEFINE_OPTION_INT(jit_async,               0,                 "Optimize code on a background thread");
+DEFINE_OPTION_INT(jit_tier_threshold,      0,                 "Executions before a block is fully optimized, 0 to always optimize");
+DEFINE_OPTION_INT(jit_smc,                 0,                 "Track writes to compiled code per page instead of flushing all code on cache resets");
+DEFINE_OPTION_INT(jit_profile,             0,                 "Profile compiled code, writing a report of the hottest blocks on exit");
+DEFINE_OPTION_INT(sample_rate,             0,                 "Samples per second taken of the emulation thread, attributed to guest code and emulator functions in reports written on exit, 0 to disable");
+DEFINE_OPTION_INT(jit_code_budget,         64,                "Size in MB each code buffer can grow to before old code is evicted");
+DEFINE_OPTION_INT(jit_wx,                  0,                 "Map compiled code through separate writable and executable views");
+DEFINE_OPTION_INT(jit_functions,           0,                 "Compile guest functions entered through a call as a single unit");
+DEFINE_OPTION_INT(jit_runtime,             0,                 "Replace recognized guest runtime routines, e.g. memcpy, with native implementations");
+DEFINE_OPTION_INT(huge_pages,              0,                 "Back guest memory and compiled code with huge pages when available");
 
 /* ui */
 DEFINE_PERSISTENT_OPTION_STRING(gamedir,   "",                "Directories to scan for games");
@@ -125,6 +194,63 @@ int audio_sync_enabled() {
   return 0;
 }
 
+static uint64_t parse_cpu_list(const char *list) {
+  uint64_t mask = 0;
+  const char *ptr = list;
+
+  while (*ptr) {
+    char *end;
+    long first = strtol(ptr, &end, 10);
+    long last = first;
+
+    if (end == ptr) {
+      LOG_WARNING("parse_cpu_list invalid cpu list '%s'", list);
+      return 0;
+    }
+    ptr = end;
+
+    if (*ptr == '-') {
+      ptr++;
+      last = strtol(ptr, &end, 10);
+      if (end == ptr) {
+        LOG_WARNING("parse_cpu_list invalid cpu list '%s'", list);
+        return 0;
+      }
+      ptr = end;
+    }
+
+    for (long i = MAX(first, 0); i <= MIN(last, 63); i++) {
+      mask |= (uint64_t)1 << i;
+    }
+
+    if (*ptr == ',') {
+      ptr++;
+    }
+  }
+
+  return mask;
+}
+
+void apply_thread_options(enum thread_role role) {
+  static const char *names[] = {"emu", "video", "audio", "compile", "io"};
+  const char *cpus[] = {OPTION_emu_cpus, OPTION_video_cpus, OPTION_audio_cpus,
+                        OPTION_compile_cpus, OPTION_io_cpus};
+  static const enum thread_priority priorities[] = {
+      PRIORITY_HIGH, PRIORITY_HIGH, PRIORITY_REALTIME, PRIORITY_BACKGROUND,
+      PRIORITY_BACKGROUND};
+
+  uint64_t mask = parse_cpu_list(cpus[role]);
+  if (mask && !thread_set_affinity(mask)) {
+    LOG_WARNING("apply_thread_options failed to pin %s thread to cpus '%s'",
+                names[role], cpus[role]);
+  }
+
+  if (OPTION_thread_priorities && !thread_set_priority(priorities[role])) {
+    LOG_WARNING("apply_thread_options failed to set %s thread's priority",
+                names[role]);
+  }
+}
+
 int video_sync_enabled() {
   const char *ptr = OPTION_sync;
   while (*ptr) {
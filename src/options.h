@@ -28,6 +28,9 @@ extern const int NUM_REGIONS;
 extern const char *TIMESYNCS[];
 extern const int NUM_TIMESYNCS;
 
+extern const char *PACINGS[];
+extern const int NUM_PACINGS;
+
 extern const char *ASPECT_RATIOS[];
 extern const int NUM_ASPECT_RATIOS;
 
@@ -38,8 +41,20 @@ extern int *DEADZONES[];
 
 /* host */
 DECLARE_OPTION_STRING(sync);
+DECLARE_OPTION_STRING(pacing);
 DECLARE_OPTION_INT(bios);
 DECLARE_OPTION_INT(fullscreen);
+DECLARE_OPTION_INT(audio_latency);
+DECLARE_OPTION_INT(audio_rate_control);
+DECLARE_OPTION_STRING(stats_file);
+DECLARE_OPTION_INT(reg_stats);
+DECLARE_OPTION_INT(log_async);
+DECLARE_OPTION_STRING(emu_cpus);
+DECLARE_OPTION_STRING(video_cpus);
+DECLARE_OPTION_STRING(audio_cpus);
+DECLARE_OPTION_STRING(compile_cpus);
+DECLARE_OPTION_STRING(io_cpus);
+DECLARE_OPTION_INT(thread_priorities);
 DECLARE_OPTION_INT(key_a);
 DECLARE_OPTION_INT(key_b);
 DECLARE_OPTION_INT(key_x);
@@ -62,19 +77,79 @@ DECLARE_OPTION_INT(deadzone_3);
 
 /* emulator */
 DECLARE_OPTION_STRING(aspect);
+DECLARE_OPTION_INT(pipeline);
+DECLARE_OPTION_INT(run_ahead);
+DECLARE_OPTION_INT(input_late_latch);
+DECLARE_OPTION_INT(rewind);
+DECLARE_OPTION_INT(rewind_budget);
+DECLARE_OPTION_INT(profiles);
+DECLARE_OPTION_STRING(record);
+DECLARE_OPTION_INT(record_checksums);
+DECLARE_OPTION_INT(frameskip);
+DECLARE_OPTION_INT(fast_forward_skip);
+DECLARE_OPTION_INT(aica_thread);
+DECLARE_OPTION_INT(aica_lazy_mix);
+DECLARE_OPTION_INT(aica_dsp);
+DECLARE_OPTION_INT(gdrom_timing);
+DECLARE_OPTION_INT(disc_prefetch);
+DECLARE_OPTION_INT(chd_cache);
+DECLARE_OPTION_INT(chd_threads);
+DECLARE_OPTION_INT(parallel_convert);
+DECLARE_OPTION_INT(gpu_textures);
+DECLARE_OPTION_INT(gpu_palettes);
+DECLARE_OPTION_INT(texture_budget);
+DECLARE_OPTION_INT(texture_max_age);
+DECLARE_OPTION_INT(precise_texture_watches);
+DECLARE_OPTION_INT(deferred_texture_watches);
+DECLARE_OPTION_STRING(texture_pack);
+DECLARE_OPTION_INT(oit);
+DECLARE_OPTION_INT(resolution_scale);
+DECLARE_OPTION_INT(resolution_budget);
+DECLARE_OPTION_INT(compact_vertices);
+DECLARE_OPTION_INT(texture_arrays);
+DECLARE_OPTION_INT(sort_opaque);
+DECLARE_OPTION_INT(shader_cache);
+DECLARE_OPTION_INT(precompile_shaders);
+DECLARE_OPTION_INT(async_shaders);
 
 /* bios */
 DECLARE_OPTION_STRING(region);
 DECLARE_OPTION_STRING(language);
 DECLARE_OPTION_STRING(broadcast);
+DECLARE_OPTION_INT(gdrom_hle);
+DECLARE_OPTION_INT(boot_cache);
 
 /* jit */
 DECLARE_OPTION_INT(perf);
+DECLARE_OPTION_INT(jit_cache);
+DECLARE_OPTION_INT(jit_async);
+DECLARE_OPTION_INT(jit_tier_threshold);
+DECLARE_OPTION_INT(jit_smc);
+DECLARE_OPTION_INT(jit_profile);
+DECLARE_OPTION_INT(sample_rate);
+DECLARE_OPTION_INT(jit_code_budget);
+DECLARE_OPTION_INT(jit_wx);
+DECLARE_OPTION_INT(jit_functions);
+DECLARE_OPTION_INT(jit_runtime);
+DECLARE_OPTION_INT(huge_pages);
 
 /* ui */
 DECLARE_OPTION_STRING(gamedir);
 
+/* the threads whose scheduling can be configured */
+enum thread_role {
+  ROLE_EMULATION,
+  ROLE_VIDEO,
+  ROLE_AUDIO,
+  ROLE_COMPILE,
+  ROLE_IO,
+};
+
 int audio_sync_enabled();
 int video_sync_enabled();
 
+/* pins the calling thread and adjusts its priority per the options for its
+   role */
+void apply_thread_options(enum thread_role role);
+
 #endif
@@ -0,0 +1,110 @@
+#include "profile.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/option.h"
+#include "guest/gdrom/disc.h"
+
+#define PROFILE_MAX_SIZE (64 * 1024)
+
+static void profile_sanitize(char *dst, const char *src, int size) {
+  int i = 0;
+
+  for (; src[i] && i < size - 1; i++) {
+    char c = src[i];
+    int valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                (c >= '0' && c <= '9') || c == '.' || c == '-';
+    dst[i] = valid ? c : '_';
+  }
+
+  dst[i] = 0;
+}
+
+int profile_path(const char *disc_path, char *path, int size) {
+  /* the disc is only opened to read its meta information */
+  struct disc *disc = disc_create(disc_path, 0);
+
+  if (!disc) {
+    return 0;
+  }
+
+  char prodnum[sizeof(disc->prodnum)];
+  char prodver[sizeof(disc->prodver)];
+  profile_sanitize(prodnum, disc->prodnum, sizeof(prodnum));
+  profile_sanitize(prodver, disc->prodver, sizeof(prodver));
+
+  disc_destroy(disc);
+
+  char profiledir[PATH_MAX];
+  snprintf(profiledir, sizeof(profiledir), "%s" PATH_SEPARATOR "profiles",
+           fs_appdir());
+  CHECK(fs_mkdir(profiledir));
+
+  snprintf(path, size, "%s" PATH_SEPARATOR "%s_%s.cfg", profiledir, prodnum,
+           prodver);
+
+  return 1;
+}
+
+int profile_load(const char *disc_path) {
+  char path[PATH_MAX];
+
+  if (!disc_path || !profile_path(disc_path, path, sizeof(path)) ||
+      !fs_exists(path)) {
+    return 0;
+  }
+
+  if (!options_read_overrides(path)) {
+    LOG_WARNING("profile_load failed to read %s", path);
+    return 0;
+  }
+
+  LOG_INFO("profile_load applied %s", path);
+
+  return 1;
+}
+
+int profile_save(const char *disc_path, const char *name) {
+  const char *value = option_get(name);
+  char path[PATH_MAX];
+
+  if (!value || !profile_path(disc_path, path, sizeof(path))) {
+    return 0;
+  }
+
+  /* keep every line but the option's own */
+  static char existing[PROFILE_MAX_SIZE];
+  int existing_size = 0;
+  int name_len = (int)strlen(name);
+
+  FILE *fp = fopen(path, "r");
+
+  if (fp) {
+    char line[1024];
+
+    while (fgets(line, sizeof(line), fp)) {
+      int len = (int)strlen(line);
+      int same = !strncmp(line, name, name_len) &&
+                 (line[name_len] == ':' || line[name_len] == '=' ||
+                  line[name_len] == ' ');
+
+      if (!same && existing_size + len < PROFILE_MAX_SIZE) {
+        memcpy(existing + existing_size, line, len);
+        existing_size += len;
+      }
+    }
+
+    fclose(fp);
+  }
+
+  fp = fopen(path, "w");
+
+  if (!fp) {
+    return 0;
+  }
+
+  fwrite(existing, 1, existing_size, fp);
+  fprintf(fp, "%s: %s\n", name, value);
+  fclose(fp);
+
+  return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * per-title profiles
+ *
+ * options tuned for a particular title are kept in the application directory,
+ * in a file named after the product number and version of its disc. they're
+ * applied on top of the config once the disc is known, but never written back
+ * to it. options which are only read when the machine is created take effect
+ * for the tools which load the profile before creating it
+ */
+int profile_path(const char *disc_path, char *path, int size);
+
+/* returns 0 if the disc has no profile */
+int profile_load(const char *disc_path);
+
+/* writes the current value of the named option into the disc's profile,
+   keeping the others already in it */
+int profile_save(const char *disc_path, const char *name);
+
+#endif
@@ -0,0 +1,108 @@
+static const char *decode_vp =
+"void main() {\n"
+"  // a single triangle covering the entire viewport\n"
+"  vec2 xy = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+"  gl_Position = vec4(xy * 2.0 - 1.0, 0.0, 1.0);\n"
+"}";
+
+static const char *decode_fp =
+"uniform highp usampler2D u_data;\n"
+"uniform highp usampler2D u_codebook;\n"
+"uniform highp usampler2D u_palette;\n"
+
+"// layout, format, width and height\n"
+"uniform highp ivec4 u_layout;\n"
+"uniform highp int u_stride;\n"
+
+"layout(location = 0) out mediump vec4 fragcolor;\n"
+
+"// the texels are uploaded as 16-bit values, DATA_WIDTH to a row\n"
+"highp uint fetch16(highp uint i) {\n"
+"  highp ivec2 pos = ivec2(int(i % DATA_WIDTH), int(i / DATA_WIDTH));\n"
+"  return texelFetch(u_data, pos, 0).r;\n"
+"}\n"
+
+"highp uint fetch8(highp uint i) {\n"
+"  return (fetch16(i >> 1u) >> ((i & 1u) << 3u)) & 0xffu;\n"
+"}\n"
+
+"highp uint fetch_codebook(highp uint i) {\n"
+"  return texelFetch(u_codebook, ivec2(int(i), 0), 0).r;\n"
+"}\n"
+
+"highp uint fetch_palette(highp uint i) {\n"
+"  return texelFetch(u_palette, ivec2(int(i), 0), 0).r;\n"
+"}\n"
+
+"// spreads the low 10 bits of v out to the even bits\n"
+"highp uint spread(highp uint v) {\n"
+"  v = (v | (v << 8u)) & 0x00ff00ffu;\n"
+"  v = (v | (v << 4u)) & 0x0f0f0f0fu;\n"
+"  v = (v | (v << 2u)) & 0x33333333u;\n"
+"  v = (v | (v << 1u)) & 0x55555555u;\n"
+"  return v;\n"
+"}\n"
+
+"highp uint twiddle(highp uint x, highp uint y) {\n"
+"  highp uint width = uint(u_layout.z);\n"
+"  highp uint size = uint(min(u_layout.z, u_layout.w));\n"
+"  highp uint block = (y / size) * (width / size) + x / size;\n"
+"  highp uint pos = (spread(x % size) << 1u) | spread(y % size);\n"
+"  return block * size * size + pos;\n"
+"}\n"
+
+"// channels are extended to 8 bits the same as when decoding on the cpu, by\n"
+"// repeating their high bits in the low bits\n"
+"mediump vec4 unpack(highp uint v) {\n"
+"  highp uvec4 c;\n"
+"  if (u_layout.y == RAW_ARGB1555) {\n"
+"    c = uvec4((v >> 10u) & 31u, (v >> 5u) & 31u, v & 31u, 0u);\n"
+"    c = (c << 3u) | (c >> 2u);\n"
+"    c.a = (v & 0x8000u) != 0u ? 255u : 0u;\n"
+"  } else if (u_layout.y == RAW_RGB565) {\n"
+"    c = uvec4((v >> 11u) & 31u, (v >> 5u) & 63u, v & 31u, 255u);\n"
+"    c.rb = (c.rb << 3u) | (c.rb >> 2u);\n"
+"    c.g = (c.g << 2u) | (c.g >> 4u);\n"
+"  } else if (u_layout.y == RAW_ARGB4444) {\n"
+"    c = uvec4((v >> 8u) & 15u, (v >> 4u) & 15u, v & 15u, (v >> 12u) & 15u);\n"
+"    c = (c << 4u) | c;\n"
+"  } else {\n"
+"    c = uvec4((v >> 16u) & 255u, (v >> 8u) & 255u, v & 255u, v >> 24u);\n"
+"  }\n"
+"  return vec4(c) / 255.0;\n"
+"}\n"
+
+"void main() {\n"
+"  highp uint x = uint(gl_FragCoord.x);\n"
+"  highp uint y = uint(gl_FragCoord.y);\n"
+"  highp uint v;\n"
+
+"  if (u_layout.x == RAW_BITMAP) {\n"
+"    v = fetch16(y * uint(u_stride) + x);\n"
+"  } else {\n"
+"    highp uint pos = twiddle(x, y);\n"
+"    if (u_layout.x == RAW_TWIDDLED) {\n"
+"      v = fetch16(pos);\n"
+"    } else if (u_layout.x == RAW_VQ) {\n"
+"      // each codebook entry holds the 4 texels of a 2x2 block\n"
+"      v = fetch_codebook(fetch8(pos >> 2u) * 4u + (pos & 3u));\n"
+"    } else if (u_layout.x == RAW_PAL4) {\n"
+"      highp uint idx = fetch8(pos >> 1u);\n"
+"      v = (pos & 1u) != 0u ? idx >> 4u : idx & 15u;\n"
+"    } else {\n"
+"      v = fetch8(pos);\n"
+"    }\n"
+"  }\n"
+
+"  // indexed textures keep the palette index, to be looked up when sampled\n"
+"  if (u_layout.y == RAW_INDEX8) {\n"
+"    fragcolor = vec4(float(v) / 255.0, 0.0, 0.0, 1.0);\n"
+"    return;\n"
+"  }\n"
+
+"  if (u_layout.x == RAW_PAL4 || u_layout.x == RAW_PAL8) {\n"
+"    v = fetch_palette(v);\n"
+"  }\n"
+
+"  fragcolor = unpack(v);\n"
+"}";
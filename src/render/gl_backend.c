@@ -1,10 +1,79 @@
 #include <glad/glad.h>
 #include "core/core.h"
+#include "core/filesystem.h"
+#include "core/md5.h"
+#include "core/version.h"
 #include "host/host.h"
+#include "options.h"
 #include "render/render_backend.h"
+#include "stats.h"
+
+/* raw texture data is uploaded as rows of 16-bit values for decoding */
+#define DECODE_DATA_WIDTH 1024
+#define DECODE_DATA_HEIGHT 1024
+#define DECODE_CODEBOOK_WIDTH 1024
+#define DECODE_PALETTE_WIDTH 1024
+
+/* vertex and index streams are split into regions that are written to in turn,
+   each being fenced once drawn from so it isn't overwritten until the gpu is
+   done with it */
+#define STREAM_NUM_REGIONS 3
+#define STREAM_MIN_REGION_SIZE (1024 * 256)
+#define STREAM_WAIT_TIMEOUT 1000000000ull
+
+/* pairs of timestamp queries issued around each gpu pass. results are only
+   read once available, the ring being sized to cover several frames of
+   passes in flight */
+#define TIMER_NUM_PAIRS 64
+
+/* pixel buffers the framebuffer is read back into, each only being mapped
+   once its fence has signaled so reading back never stalls on the gpu */
+#define READBACK_NUM_BUFFERS 3
+
+/* small raw textures are packed into arrays of textures sharing their size
+   and sampler state when texture_arrays is enabled. surfaces drawn from the
+   same array only bind it once, each reading its layer from the alpha of its
+   offset color, which also lets the converter merge surfaces differing only
+   by their texture into a single draw */
+#define MAX_TEXTURE_ARRAYS 64
+#define TEXTURE_ARRAY_LAYERS 32
+#define TEXTURE_ARRAY_MAX_SIZE 256
+
+/* stencil bits used to shadow surfaces with modifier volumes. the parity bit
+   is flipped for each face of a volume in front of a pixel, being left set
+   for those inside of it. each volume is then merged into the inside bit,
+   with the pixels having both it and the receiver bit set being shadowed */
+#define STENCIL_PARITY 0x1
+#define STENCIL_INSIDE 0x2
+#define STENCIL_RECEIVER 0x4
+
+/* compressed formats are all extensions to the core profile */
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83f1
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83f3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8e8c
+#endif
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR 0x93b0
+#endif
+
+/* from GL_KHR_parallel_shader_compile, which glad wasn't generated with */
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91b1
+#endif
 
 enum texture_map {
   MAP_DIFFUSE,
+  MAP_DATA,
+  MAP_CODEBOOK,
+  MAP_PALETTE,
+  MAP_ACCUM,
+  MAP_WEIGHT,
+  MAP_ARRAY,
 };
 
 enum uniform_attr {
@@ -12,11 +81,26 @@ enum uniform_attr {
   UNIFORM_DIFFUSE,
   UNIFORM_VIDEO_SCALE,
   UNIFORM_ALPHA_REF,
+  UNIFORM_DATA,
+  UNIFORM_CODEBOOK,
+  UNIFORM_PALETTE,
+  UNIFORM_LAYOUT,
+  UNIFORM_STRIDE,
+  UNIFORM_PALETTE_INFO,
+  UNIFORM_ACCUM,
+  UNIFORM_WEIGHT,
+  UNIFORM_COMPACT,
+  UNIFORM_ATTRS,
+  UNIFORM_DIFFUSE_ARRAY,
+  UNIFORM_SHADOW_SCALE,
   UNIFORM_NUM_UNIFORMS,
 };
 
 static const char *uniform_names[] = {
-    "u_proj", "u_diffuse", "u_video_scale", "u_alpha_ref",
+    "u_proj",     "u_diffuse",  "u_video_scale", "u_alpha_ref",
+    "u_data",     "u_codebook", "u_palette",     "u_layout",
+    "u_stride",   "u_palette_info", "u_accum",   "u_weight",
+    "u_compact",  "u_attrs",    "u_diffuse_array", "u_shadow_scale",
 };
 
 enum shader_attr {
@@ -33,7 +117,10 @@ enum shader_attr {
   ATTR_OFFSET_COLOR = 0x20,
   ATTR_ALPHA_TEST = 0x40,
   ATTR_DEBUG_DEPTH_BUFFER = 0x80,
-  ATTR_COUNT = 0x100
+  ATTR_PALETTE = 0x100,
+  ATTR_OIT = 0x200,
+  ATTR_ARRAY = 0x400,
+  ATTR_COUNT = 0x800
 };
 
 struct shader_program {
@@ -44,16 +131,75 @@ struct shader_program {
 
   /* the last global uniforms bound to this program */
   uint64_t uniform_token;
+
+  /* the last alpha_ref bound to this program, -1 if none has been */
+  int alpha_ref;
+
+  /* the last palette info bound to this program, packed the same as it's
+     compared in r_draw_ta_surface, -1 if none has been */
+  int palette_info;
+
+  /* the last attributes bound to an ubershader, -1 if none have been */
+  int attrs;
+
+  /* set while the program's link has been issued but not yet checked, along
+     with the uniform token at the time it was issued */
+  int linking;
+  uint64_t link_token;
 };
 
 struct texture {
+  /* for textures packed into an array, this is the array's texture */
+  GLuint texture;
+  int array;
+  int layer;
+
+  /* indexed textures look up their colors starting at palette_base, filtering
+     them in the shader rather than filtering the indices */
+  int indexed;
+  int palette_base;
+  int bilinear;
+};
+
+struct texture_array {
   GLuint texture;
+  int width, height;
+  enum filter_mode filter;
+  enum wrap_mode wrap_u, wrap_v;
+
+  /* mask of the layers in use, the array being deleted once none are */
+  uint32_t layers;
+};
+
+struct stream_buffer {
+  GLenum target;
+  GLuint buffer;
+  int region_size;
+  int region;
+  GLsync fences[STREAM_NUM_REGIONS];
 };
 
 struct viewport {
   int x, y, w, h;
 };
 
+struct readback {
+  GLuint buffer;
+  int size;
+  int width, height;
+  GLsync fence;
+};
+
+struct gpu_timer {
+  GLuint queries[2];
+  enum gpu_pass pass;
+};
+
+static prof_token_t *gpu_pass_counters[NUM_GPU_PASSES] = {
+    &COUNTER_gpu_opaque_ns, &COUNTER_gpu_punch_through_ns,
+    &COUNTER_gpu_translucent_ns, &COUNTER_gpu_pixels_ns, &COUNTER_gpu_ui_ns,
+};
+
 struct render_backend {
   struct host *host;
   int width, height;
@@ -64,19 +210,77 @@ struct render_backend {
   /* default assets created during intitialization */
   GLuint white_texture;
   struct shader_program ta_programs[ATTR_COUNT];
+  struct shader_program uber_programs[2];
   struct shader_program ui_program;
-
-  /* offscreen framebuffer for blitting raw pixels */
+  struct shader_program decode_program;
+  struct shader_program oit_program;
+  struct shader_program modvol_program;
+
+  /* linked ta programs are cached to disk when the driver supports retrieving
+     their binaries, keyed on the build and driver they're valid for */
+  int program_binaries;
+  char program_key[16];
+
+  /* ta programs are linked in the background, with surfaces being drawn with
+     the ubershader matching their oit output until they're ready. with
+     GL_KHR_parallel_shader_compile the driver can be asked if they are,
+     else they're assumed to be a frame after being issued */
+  int parallel_compile;
+
+  /* offscreen framebuffer for blitting raw pixels, the pixels being streamed
+     through a pixel buffer so their upload doesn't stall the caller */
   GLuint pixel_fbo;
   GLuint pixel_texture;
+  int pixel_width, pixel_height;
+  struct stream_buffer pixel_pbo;
+
+  /* offscreen framebuffer raw textures are decoded into, and the textures
+     their data is uploaded to */
+  GLuint decode_fbo;
+  GLuint decode_vao;
+  GLuint decode_data;
+  GLuint decode_codebook;
+  GLuint decode_palette;
+
+  /* palette indexed textures look up their colors in */
+  GLuint ta_palette;
+  enum raw_format ta_palette_format;
+
+  /* offscreen framebuffer surfaces blended order independently accumulate
+     into, depth tested against a copy of the depth buffer drawn to before
+     them. it's sized to cover the viewport, and composited over the
+     framebuffer drawn to once they've all been drawn */
+  int oit_supported;
+  GLuint oit_fbo;
+  GLuint oit_accum;
+  GLuint oit_weight;
+  GLuint oit_depth;
+  GLenum oit_depth_format;
+  int oit_width, oit_height;
+  GLint oit_prev_fbo;
+
+  /* offscreen framebuffer ta surfaces are drawn into when rendering at a
+     resolution other than the viewport's, scaled into the viewport once
+     they've all been drawn */
+  GLuint target_fbo;
+  GLuint target_color;
+  GLuint target_depth;
+  int target_width, target_height;
+  GLint target_prev_fbo;
+  struct viewport target_prev_viewport;
 
   /* texture cache */
   struct texture textures[MAX_TEXTURES];
+  struct texture_array texture_arrays[MAX_TEXTURE_ARRAYS];
+  int compressed_formats[NUM_COMPRESSED_FORMATS];
 
   /* surface render state */
   GLuint ta_vao;
-  GLuint ta_vbo;
-  GLuint ta_ibo;
+  struct stream_buffer ta_vbo;
+  struct stream_buffer ta_ibo;
+  int ta_index_offset;
+  int ta_index_size;
+  GLenum ta_index_type;
   GLuint ui_vao;
   GLuint ui_vbo;
   GLuint ui_ibo;
@@ -86,8 +290,38 @@ struct render_backend {
      to begin_surfaces and end_surfaces */
   uint64_t uniform_token;
   float uniform_video_scale[4];
+  int uniform_compact;
+
+  /* shadowed state of the last ta surface drawn, used to skip redundant state
+     changes between surfaces. it's reset at the start of each call to
+     begin_ta_surfaces, as the state is changed outside of them */
+  int ta_depth_mask;
+  int ta_depth_func;
+  int ta_cull;
+  int ta_blend;
+  struct shader_program *ta_program;
+  texture_handle_t ta_texture;
+  GLuint ta_array;
+  int ta_oit;
+  int ta_shadows;
+  int ta_shadow;
+
+  /* timestamp queries, written at head and read back from tail */
+  int timer_queries;
+  struct gpu_timer timers[TIMER_NUM_PAIRS];
+  unsigned timer_head;
+  unsigned timer_tail;
+  int timer_active;
+
+  /* framebuffer readbacks, issued at head and mapped from tail */
+  struct readback readbacks[READBACK_NUM_BUFFERS];
+  unsigned readback_head;
+  unsigned readback_tail;
 };
 
+#include "render/decode.glsl"
+#include "render/modvol.glsl"
+#include "render/oit.glsl"
 #include "render/ta.glsl"
 #include "render/ui.glsl"
 
@@ -135,11 +369,23 @@ static GLenum blend_funcs[] = {GL_NONE,
                                GL_ONE_MINUS_DST_COLOR};
 
 static GLenum prim_types[] = {
-    GL_TRIANGLES, /* PRIM_TRIANGLES */
-    GL_LINES,     /* PRIM_LINES */
+    GL_TRIANGLES,      /* PRIM_TRIANGLES */
+    GL_LINES,          /* PRIM_LINES */
+    GL_TRIANGLE_STRIP, /* PRIM_TRIANGLE_STRIP */
 };
 
+/* the packed formats are given sized internal formats, so they're stored in
+   as many bits as they're uploaded in. GL_RGB565 is left out as it's only
+   valid in core from GL 4.1 */
 static GLuint internal_formats[] = {
+    GL_RGB,     /* PXL_RGB */
+    GL_RGBA,    /* PXL_RGBA */
+    GL_RGB5_A1, /* PXL_RGBA5551 */
+    GL_RGB,     /* PXL_RGB565 */
+    GL_RGBA4,   /* PXL_RGBA4444 */
+};
+
+static GLuint formats[] = {
     GL_RGB,  /* PXL_RGB */
     GL_RGBA, /* PXL_RGBA */
     GL_RGBA, /* PXL_RGBA5551 */
@@ -155,6 +401,20 @@ static GLuint pixel_formats[] = {
     GL_UNSIGNED_SHORT_4_4_4_4, /* PXL_RGBA4444 */
 };
 
+static GLenum compressed_formats[] = {
+    GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, /* COMPRESSED_BC1 */
+    GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, /* COMPRESSED_BC3 */
+    GL_COMPRESSED_RGBA_BPTC_UNORM,    /* COMPRESSED_BC7 */
+    GL_COMPRESSED_RGBA_ASTC_4x4_KHR,  /* COMPRESSED_ASTC_4X4 */
+};
+
+static const char *compressed_extensions[] = {
+    "GL_EXT_texture_compression_s3tc",     /* COMPRESSED_BC1 */
+    "GL_EXT_texture_compression_s3tc",     /* COMPRESSED_BC3 */
+    "GL_ARB_texture_compression_bptc",     /* COMPRESSED_BC7 */
+    "GL_KHR_texture_compression_astc_ldr", /* COMPRESSED_ASTC_4X4 */
+};
+
 static inline void r_bind_texture(struct render_backend *r,
                                   enum texture_map map, GLuint tex) {
   glActiveTexture(GL_TEXTURE0 + map);
@@ -171,21 +431,26 @@ static void r_print_shader_log(GLuint shader) {
   free(info_log);
 }
 
-static int r_compile_shader(const char *source, GLenum shader_type,
-                            GLuint *shader) {
+static void r_compile_shader(const char *source, GLenum shader_type,
+                             GLuint *shader) {
   size_t sourceLength = strlen(source);
 
   *shader = glCreateShader(shader_type);
   glShaderSource(*shader, 1, (const GLchar **)&source,
                  (const GLint *)&sourceLength);
   glCompileShader(*shader);
+}
+
+static int r_check_shader(GLuint shader) {
+  if (!shader) {
+    return 1;
+  }
 
   GLint compiled;
-  glGetShaderiv(*shader, GL_COMPILE_STATUS, &compiled);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
 
   if (!compiled) {
-    r_print_shader_log(*shader);
-    glDeleteShader(*shader);
+    r_print_shader_log(shader);
     return 0;
   }
 
@@ -206,10 +471,30 @@ static void r_destroy_program(struct shader_program *program) {
   }
 }
 
-static int r_compile_program(struct render_backend *r,
-                             struct shader_program *program, const char *header,
-                             const char *vertex_source,
-                             const char *fragment_source) {
+static void r_init_program(struct shader_program *program) {
+  program->alpha_ref = -1;
+  program->palette_info = -1;
+  program->attrs = -1;
+
+  for (int i = 0; i < UNIFORM_NUM_UNIFORMS; i++) {
+    program->loc[i] = glGetUniformLocation(program->prog, uniform_names[i]);
+  }
+
+  /* bind samplers once after compile, these currently never change */
+  glUseProgram(program->prog);
+  glUniform1i(program->loc[UNIFORM_DIFFUSE], MAP_DIFFUSE);
+  glUniform1i(program->loc[UNIFORM_PALETTE], MAP_PALETTE);
+  glUniform1i(program->loc[UNIFORM_DIFFUSE_ARRAY], MAP_ARRAY);
+  glUseProgram(0);
+}
+
+/* compiles and links the program without waiting on the result, letting
+   drivers which compile in the background do so until r_link_program checks
+   it */
+static void r_issue_program(struct render_backend *r,
+                            struct shader_program *program, const char *header,
+                            const char *vertex_source,
+                            const char *fragment_source) {
   char buffer[16384] = {0};
 
 #if PLATFORM_ANDROID
@@ -228,11 +513,7 @@ static int r_compile_program(struct render_backend *r,
              header ? header : "", vertex_source);
     buffer[sizeof(buffer) - 1] = 0;
 
-    if (!r_compile_shader(buffer, GL_VERTEX_SHADER, &program->vertex_shader)) {
-      r_destroy_program(program);
-      return 0;
-    }
-
+    r_compile_shader(buffer, GL_VERTEX_SHADER, &program->vertex_shader);
     glAttachShader(program->prog, program->vertex_shader);
   }
 
@@ -243,294 +524,1086 @@ static int r_compile_program(struct render_backend *r,
              header ? header : "", fragment_source);
     buffer[sizeof(buffer) - 1] = 0;
 
-    if (!r_compile_shader(buffer, GL_FRAGMENT_SHADER,
-                          &program->fragment_shader)) {
-      r_destroy_program(program);
-      return 0;
-    }
-
+    r_compile_shader(buffer, GL_FRAGMENT_SHADER, &program->fragment_shader);
     glAttachShader(program->prog, program->fragment_shader);
   }
 
+  if (r->program_binaries) {
+    glProgramParameteri(program->prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+  }
+
   glLinkProgram(program->prog);
+}
+
+static int r_link_program(struct shader_program *program) {
+  int compiled = r_check_shader(program->vertex_shader) &&
+                 r_check_shader(program->fragment_shader);
 
-  GLint linked;
-  glGetProgramiv(program->prog, GL_LINK_STATUS, &linked);
+  GLint linked = 0;
+  if (compiled) {
+    glGetProgramiv(program->prog, GL_LINK_STATUS, &linked);
+  }
 
   if (!linked) {
     r_destroy_program(program);
     return 0;
   }
 
-  for (int i = 0; i < UNIFORM_NUM_UNIFORMS; i++) {
-    program->loc[i] = glGetUniformLocation(program->prog, uniform_names[i]);
-  }
-
-  /* bind diffuse sampler once after compile, this currently never changes */
-  glUseProgram(program->prog);
-  glUniform1i(program->loc[UNIFORM_DIFFUSE], MAP_DIFFUSE);
-  glUseProgram(0);
+  r_init_program(program);
 
   return 1;
 }
 
-static void r_destroy_shaders(struct render_backend *r) {
-  for (int i = 0; i < ATTR_COUNT; i++) {
-    r_destroy_program(&r->ta_programs[i]);
-  }
-
-  r_destroy_program(&r->ui_program);
-}
-
-static void r_create_shaders(struct render_backend *r) {
-  /* ta shaders are lazy-compiled in r_get_ta_program to improve startup time */
-
-  if (!r_compile_program(r, &r->ui_program, NULL, ui_vp, ui_fp)) {
-    LOG_FATAL("failed to compile ui shader");
-  }
+static int r_compile_program(struct render_backend *r,
+                             struct shader_program *program, const char *header,
+                             const char *vertex_source,
+                             const char *fragment_source) {
+  r_issue_program(r, program, header, vertex_source, fragment_source);
+  return r_link_program(program);
 }
 
-static void r_destroy_textures(struct render_backend *r) {
-  glDeleteTextures(1, &r->white_texture);
+static void r_program_cache_path(int idx, char *path, size_t size) {
+  const char *appdir = fs_appdir();
 
-  glDeleteFramebuffers(1, &r->pixel_fbo);
-  glDeleteTextures(1, &r->pixel_texture);
+  char cachedir[PATH_MAX];
+  snprintf(cachedir, sizeof(cachedir), "%s" PATH_SEPARATOR "shader-cache",
+           appdir);
+  CHECK(fs_mkdir(cachedir));
 
-  for (int i = 0; i < MAX_TEXTURES; i++) {
-    struct texture *tex = &r->textures[i];
+  snprintf(path, size, "%s" PATH_SEPARATOR "ta-%02x.bin", cachedir, idx);
+}
 
-    if (!tex->texture) {
-      continue;
-    }
+/* each cache entry is laid out as the key it was written with, followed by
+   the binary's format and the binary itself */
+static int r_load_program_binary(struct render_backend *r,
+                                 struct shader_program *program, int idx) {
+  char path[PATH_MAX];
+  r_program_cache_path(idx, path, sizeof(path));
 
-    glDeleteTextures(1, &tex->texture);
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return 0;
   }
-}
 
-static void r_create_textures(struct render_backend *r) {
-  /* create default all white texture */
-  uint8_t pixels[64 * 64 * 4];
-  memset(pixels, 0xff, sizeof(pixels));
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
 
-  glGenTextures(1, &r->white_texture);
-  glBindTexture(GL_TEXTURE_2D, r->white_texture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 64, 64, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-               pixels);
-  glBindTexture(GL_TEXTURE_2D, 0);
+  int header_size = (int)sizeof(r->program_key) + (int)sizeof(uint32_t);
+  uint8_t *data = NULL;
+  int loaded = 0;
 
-  /* create fbo for blitting raw framebuffers to */
-  glGenFramebuffers(1, &r->pixel_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, r->pixel_fbo);
+  if (size > header_size) {
+    data = malloc(size);
+    CHECK_NOTNULL(data);
+    loaded = fread(data, 1, size, fp) == (size_t)size &&
+             !memcmp(data, r->program_key, sizeof(r->program_key));
+  }
 
-  glGenTextures(1, &r->pixel_texture);
-  glBindTexture(GL_TEXTURE_2D, r->pixel_texture);
+  fclose(fp);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB,
-               GL_UNSIGNED_SHORT_5_6_5, 0);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  if (loaded) {
+    uint32_t format;
+    memcpy(&format, data + sizeof(r->program_key), sizeof(format));
 
-  GLenum buffers[] = {GL_COLOR_ATTACHMENT0};
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, r->pixel_texture,
-                       0);
-  glDrawBuffers(ARRAY_SIZE(buffers), buffers);
+    memset(program, 0, sizeof(*program));
+    program->prog = glCreateProgram();
+    glProgramBinary(program->prog, (GLenum)format, data + header_size,
+                    (GLsizei)(size - header_size));
 
-  GLenum res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-  CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+    /* the driver is free to reject binaries, in which case the program is
+       compiled and the entry rewritten */
+    GLint linked;
+    glGetProgramiv(program->prog, GL_LINK_STATUS, &linked);
 
-  glBindTexture(GL_TEXTURE_2D, 0);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
+    if (linked) {
+      r_init_program(program);
+    } else {
+      r_destroy_program(program);
+      memset(program, 0, sizeof(*program));
+      loaded = 0;
+    }
+  }
 
-static void r_destroy_vertex_arrays(struct render_backend *r) {
-  glDeleteBuffers(1, &r->ui_ibo);
-  glDeleteBuffers(1, &r->ui_vbo);
-  glDeleteVertexArrays(1, &r->ui_vao);
+  free(data);
 
-  glDeleteBuffers(1, &r->ta_ibo);
-  glDeleteBuffers(1, &r->ta_vbo);
-  glDeleteVertexArrays(1, &r->ta_vao);
+  return loaded;
 }
 
-static void r_create_vertex_arrays(struct render_backend *r) {
-  /* ui vao */
-  {
-    glGenVertexArrays(1, &r->ui_vao);
-    glBindVertexArray(r->ui_vao);
+static void r_save_program_binary(struct render_backend *r,
+                                  struct shader_program *program, int idx) {
+  GLint size = 0;
+  glGetProgramiv(program->prog, GL_PROGRAM_BINARY_LENGTH, &size);
 
-    glGenBuffers(1, &r->ui_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, r->ui_vbo);
+  if (size <= 0) {
+    return;
+  }
 
-    glGenBuffers(1, &r->ui_ibo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ui_ibo);
+  uint8_t *data = malloc(size);
+  CHECK_NOTNULL(data);
 
-    /* xy */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct ui_vertex),
-                          (void *)offsetof(struct ui_vertex, xy));
+  GLsizei length = 0;
+  GLenum format = 0;
+  glGetProgramBinary(program->prog, size, &length, &format, data);
 
-    /* texcoord */
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct ui_vertex),
-                          (void *)offsetof(struct ui_vertex, uv));
+  char path[PATH_MAX];
+  r_program_cache_path(idx, path, sizeof(path));
 
-    /* color */
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-                          sizeof(struct ui_vertex),
-                          (void *)offsetof(struct ui_vertex, color));
+  FILE *fp = fopen(path, "wb");
 
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  if (fp) {
+    uint32_t format32 = (uint32_t)format;
+    fwrite(r->program_key, 1, sizeof(r->program_key), fp);
+    fwrite(&format32, 1, sizeof(format32), fp);
+    fwrite(data, 1, length, fp);
+    fclose(fp);
+  } else {
+    LOG_WARNING("r_save_program_binary failed to open %s", path);
   }
 
-  /* ta vao */
-  {
-    glGenVertexArrays(1, &r->ta_vao);
-    glBindVertexArray(r->ta_vao);
-
-    glGenBuffers(1, &r->ta_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, r->ta_vbo);
+  free(data);
+}
 
-    glGenBuffers(1, &r->ta_ibo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ta_ibo);
+/* ubershaders are keyed on ATTR_COUNT plus their oit bit, with the rest of
+   their attributes being passed as a uniform */
+static void r_issue_ta_program(struct render_backend *r,
+                               struct shader_program *program, int idx) {
+  if (r->program_binaries && r_load_program_binary(r, program, idx)) {
+    return;
+  }
 
-    /* xyz */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct ta_vertex),
-                          (void *)offsetof(struct ta_vertex, xyz));
+  char header[1024];
+  snprintf(header, sizeof(header),
+           "#define ATTR_SHADE_DECAL %d\n"
+           "#define ATTR_SHADE_MODULATE %d\n"
+           "#define ATTR_SHADE_DECAL_ALPHA %d\n"
+           "#define ATTR_SHADE_MASK %d\n"
+           "#define ATTR_TEXTURE %d\n"
+           "#define ATTR_IGNORE_ALPHA %d\n"
+           "#define ATTR_IGNORE_TEXTURE_ALPHA %d\n"
+           "#define ATTR_OFFSET_COLOR %d\n"
+           "#define ATTR_ALPHA_TEST %d\n"
+           "#define ATTR_DEBUG_DEPTH_BUFFER %d\n"
+           "#define ATTR_PALETTE %d\n"
+           "#define ATTR_ARRAY %d\n",
+           ATTR_SHADE_DECAL, ATTR_SHADE_MODULATE, ATTR_SHADE_DECAL_ALPHA,
+           ATTR_SHADE_MASK, ATTR_TEXTURE, ATTR_IGNORE_ALPHA,
+           ATTR_IGNORE_TEXTURE_ALPHA, ATTR_OFFSET_COLOR, ATTR_ALPHA_TEST,
+           ATTR_DEBUG_DEPTH_BUFFER, ATTR_PALETTE, ATTR_ARRAY);
+
+  char defines[256];
+  if (idx & ATTR_COUNT) {
+    strcat(header, "#define UBER\n");
+  } else {
+    snprintf(defines, sizeof(defines), "#define ATTRS %d\n", idx);
+    strcat(header, defines);
+  }
+  if (idx & ATTR_OIT) {
+    strcat(header, "#define OIT\n");
+  }
+  if (idx & (ATTR_PALETTE | ATTR_COUNT)) {
+    snprintf(defines, sizeof(defines),
+             "#define PALETTE\n"
+             "#define RAW_ARGB1555 %d\n"
+             "#define RAW_RGB565 %d\n"
+             "#define RAW_ARGB4444 %d\n",
+             RAW_ARGB1555, RAW_RGB565, RAW_ARGB4444);
+    strcat(header, defines);
+  }
 
-    /* texcoord */
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct ta_vertex),
-                          (void *)offsetof(struct ta_vertex, uv));
+  r_issue_program(r, program, header, ta_vp, ta_fp);
+  program->linking = 1;
+  program->link_token = r->uniform_token;
+}
 
-    /* color */
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-                          sizeof(struct ta_vertex),
-                          (void *)offsetof(struct ta_vertex, color));
+static void r_link_ta_program(struct render_backend *r,
+                              struct shader_program *program, int idx) {
+  int res = r_link_program(program);
+  CHECK(res, "failed to compile ta shader");
 
-    /* offset color */
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-                          sizeof(struct ta_vertex),
-                          (void *)offsetof(struct ta_vertex, offset_color));
+  program->linking = 0;
 
-    glBindVertexArray(0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  if (r->program_binaries) {
+    r_save_program_binary(r, program, idx);
   }
 }
 
-static void r_set_initial_state(struct render_backend *r) {
-  glDepthMask(1);
-  glDisable(GL_DEPTH_TEST);
-
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
+static int r_ta_program_ready(struct render_backend *r,
+                              struct shader_program *program) {
+  if (r->parallel_compile) {
+    GLint completed = 0;
+    glGetProgramiv(program->prog, GL_COMPLETION_STATUS_KHR, &completed);
+    return completed;
+  }
 
-  glDisable(GL_BLEND);
+  return program->link_token != r->uniform_token;
 }
 
-static struct shader_program *r_get_ta_program(struct render_backend *r,
-                                               const struct ta_surface *surf) {
-  int idx = (int)surf->params.shade;
-  if (surf->params.texture) {
-    idx |= ATTR_TEXTURE;
+static void r_init_program_cache(struct render_backend *r) {
+  if (!OPTION_shader_cache || !glGetProgramBinary || !glProgramBinary ||
+      !glProgramParameteri) {
+    return;
   }
-  if (surf->params.ignore_alpha) {
-    idx |= ATTR_IGNORE_ALPHA;
+
+  /* the entry points may resolve on contexts without GL_ARB_get_program_binary,
+     in which case the query fails and no formats are reported */
+  GLint num_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  while (glGetError() != GL_NO_ERROR) {
   }
-  if (surf->params.ignore_texture_alpha) {
-    idx |= ATTR_IGNORE_TEXTURE_ALPHA;
+
+  if (num_formats <= 0) {
+    return;
   }
-  if (surf->params.offset_color) {
-    idx |= ATTR_OFFSET_COLOR;
+
+  /* binaries are only valid for the driver they were retrieved from */
+  const char *strings[] = {
+      GIT_VERSION,
+      ta_vp,
+      ta_fp,
+      (const char *)glGetString(GL_VENDOR),
+      (const char *)glGetString(GL_RENDERER),
+      (const char *)glGetString(GL_VERSION),
+  };
+
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+  for (int i = 0; i < ARRAY_SIZE(strings); i++) {
+    if (strings[i]) {
+      MD5_Update(&md5_ctx, (void *)strings[i], strlen(strings[i]) + 1);
+    }
   }
-  if (surf->params.alpha_test) {
-    idx |= ATTR_ALPHA_TEST;
+  MD5_Final(r->program_key, &md5_ctx);
+
+  r->program_binaries = 1;
+}
+
+static void r_destroy_shaders(struct render_backend *r) {
+  for (int i = 0; i < ATTR_COUNT; i++) {
+    r_destroy_program(&r->ta_programs[i]);
   }
-  if (surf->params.debug_depth) {
-    idx |= ATTR_DEBUG_DEPTH_BUFFER;
+
+  for (int i = 0; i < ARRAY_SIZE(r->uber_programs); i++) {
+    r_destroy_program(&r->uber_programs[i]);
   }
 
-  struct shader_program *program = &r->ta_programs[idx];
+  r_destroy_program(&r->ui_program);
+  r_destroy_program(&r->decode_program);
+  r_destroy_program(&r->oit_program);
+  r_destroy_program(&r->modvol_program);
+}
 
-  /* lazy-compile the ta programs */
-  if (!program->prog) {
-    char header[1024];
-
-    header[0] = 0;
-
-    if ((idx & ATTR_SHADE_MASK) == ATTR_SHADE_DECAL) {
-      strcat(header, "#define SHADE_DECAL\n");
-    } else if ((idx & ATTR_SHADE_MASK) == ATTR_SHADE_MODULATE) {
-      strcat(header, "#define SHADE_MODULATE\n");
-    } else if ((idx & ATTR_SHADE_MASK) == ATTR_SHADE_DECAL_ALPHA) {
-      strcat(header, "#define SHADE_DECAL_ALPHA\n");
-    } else if ((idx & ATTR_SHADE_MASK) == ATTR_SHADE_MODULATE_ALPHA) {
-      strcat(header, "#define SHADE_MODULATE_ALPHA\n");
+static void r_create_shaders(struct render_backend *r) {
+  r_init_program_cache(r);
+
+  /* ta shaders are lazy-compiled in r_get_ta_program to improve startup time,
+     unless they're all requested up front to avoid stalls mid-game. when
+     requested, each is issued before any are checked so that drivers
+     compiling in the background can work on them all at once */
+  if (OPTION_precompile_shaders) {
+    for (int i = 0; i < ATTR_COUNT; i++) {
+      r_issue_ta_program(r, &r->ta_programs[i], i);
     }
 
-    if (idx & ATTR_TEXTURE) {
-      strcat(header, "#define TEXTURE\n");
-    }
-    if (idx & ATTR_IGNORE_ALPHA) {
-      strcat(header, "#define IGNORE_ALPHA\n");
-    }
-    if (idx & ATTR_IGNORE_TEXTURE_ALPHA) {
-      strcat(header, "#define IGNORE_TEXTURE_ALPHA\n");
-    }
-    if (idx & ATTR_OFFSET_COLOR) {
-      strcat(header, "#define OFFSET_COLOR\n");
-    }
-    if (idx & ATTR_ALPHA_TEST) {
-      strcat(header, "#define ALPHA_TEST\n");
+    for (int i = 0; i < ATTR_COUNT; i++) {
+      if (r->ta_programs[i].linking) {
+        r_link_ta_program(r, &r->ta_programs[i], i);
+      }
     }
-    if (idx & ATTR_DEBUG_DEPTH_BUFFER) {
-      strcat(header, "#define DEBUG_DEPTH_BUFFER\n");
-    }
-
-    int res = r_compile_program(r, program, header, ta_vp, ta_fp);
-    CHECK(res, "failed to compile ta shader");
   }
 
-  return program;
-}
+  /* the ubershaders are drawn with while the other programs link, so they're
+     always linked up front */
+  if (OPTION_async_shaders) {
+    for (int oit = 0; oit <= r->oit_supported; oit++) {
+      int idx = ATTR_COUNT | (oit ? ATTR_OIT : 0);
+      struct shader_program *program = &r->uber_programs[oit];
 
-void r_end_ui_surfaces(struct render_backend *r) {
-  glDisable(GL_SCISSOR_TEST);
-}
+      r_issue_ta_program(r, program, idx);
 
-void r_draw_ui_surface(struct render_backend *r,
-                       const struct ui_surface *surf) {
-  if (surf->scissor) {
-    glEnable(GL_SCISSOR_TEST);
-    glScissor((int)surf->scissor_rect[0], (int)surf->scissor_rect[1],
-              (int)surf->scissor_rect[2], (int)surf->scissor_rect[3]);
-  } else {
-    glDisable(GL_SCISSOR_TEST);
+      if (program->linking) {
+        r_link_ta_program(r, program, idx);
+      }
+    }
   }
 
-  if (surf->src_blend == BLEND_NONE || surf->dst_blend == BLEND_NONE) {
-    glDisable(GL_BLEND);
-  } else {
-    glEnable(GL_BLEND);
-    glBlendFunc(blend_funcs[surf->src_blend], blend_funcs[surf->dst_blend]);
+  if (!r_compile_program(r, &r->ui_program, NULL, ui_vp, ui_fp)) {
+    LOG_FATAL("failed to compile ui shader");
   }
 
-  if (surf->texture) {
-    struct texture *tex = &r->textures[surf->texture];
+  char header[1024];
+  snprintf(header, sizeof(header),
+           "#define DATA_WIDTH %du\n"
+           "#define RAW_BITMAP %d\n"
+           "#define RAW_TWIDDLED %d\n"
+           "#define RAW_VQ %d\n"
+           "#define RAW_PAL4 %d\n"
+           "#define RAW_PAL8 %d\n"
+           "#define RAW_ARGB1555 %d\n"
+           "#define RAW_RGB565 %d\n"
+           "#define RAW_ARGB4444 %d\n"
+           "#define RAW_INDEX8 %d\n",
+           DECODE_DATA_WIDTH, RAW_BITMAP, RAW_TWIDDLED, RAW_VQ, RAW_PAL4,
+           RAW_PAL8, RAW_ARGB1555, RAW_RGB565, RAW_ARGB4444, RAW_INDEX8);
+
+  struct shader_program *program = &r->decode_program;
+  if (!r_compile_program(r, program, header, decode_vp, decode_fp)) {
+    LOG_FATAL("failed to compile decode shader");
+  }
+
+  glUseProgram(program->prog);
+  glUniform1i(program->loc[UNIFORM_DATA], MAP_DATA);
+  glUniform1i(program->loc[UNIFORM_CODEBOOK], MAP_CODEBOOK);
+  glUseProgram(0);
+
+  program = &r->oit_program;
+  if (!r_compile_program(r, program, NULL, oit_vp, oit_fp)) {
+    LOG_FATAL("failed to compile oit shader");
+  }
+
+  glUseProgram(program->prog);
+  glUniform1i(program->loc[UNIFORM_ACCUM], MAP_ACCUM);
+  glUniform1i(program->loc[UNIFORM_WEIGHT], MAP_WEIGHT);
+  glUseProgram(0);
+
+  if (!r_compile_program(r, &r->modvol_program, NULL, modvol_vp,
+                         modvol_fp)) {
+    LOG_FATAL("failed to compile modvol shader");
+  }
+}
+
+static void r_create_stream(struct stream_buffer *stream, GLenum target) {
+  memset(stream, 0, sizeof(*stream));
+  stream->target = target;
+  glGenBuffers(1, &stream->buffer);
+  glBindBuffer(target, stream->buffer);
+}
+
+static void r_destroy_stream(struct stream_buffer *stream) {
+  for (int i = 0; i < STREAM_NUM_REGIONS; i++) {
+    if (stream->fences[i]) {
+      glDeleteSync(stream->fences[i]);
+    }
+  }
+
+  glDeleteBuffers(1, &stream->buffer);
+}
+
+/* blocks until the gpu has finished drawing from the region */
+static void r_wait_stream(struct stream_buffer *stream, int region) {
+  GLsync fence = stream->fences[region];
+
+  if (!fence) {
+    return;
+  }
+
+  GLenum res;
+  do {
+    res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                           STREAM_WAIT_TIMEOUT);
+  } while (res == GL_TIMEOUT_EXPIRED);
+
+  glDeleteSync(fence);
+  stream->fences[region] = NULL;
+}
+
+/* maps size bytes of the next region of the stream, which must already be
+   bound, for writing. as the region is known to be idle, it's mapped
+   unsynchronized, saving the driver from either stalling or reallocating the
+   buffer as it would for glBufferData. the region's offset in the buffer is
+   written to offset, and NULL is returned when size is 0 */
+static void *r_map_stream(struct stream_buffer *stream, int size,
+                          int *offset) {
+  stream->region = (stream->region + 1) % STREAM_NUM_REGIONS;
+
+  if (size > stream->region_size) {
+    for (int i = 0; i < STREAM_NUM_REGIONS; i++) {
+      r_wait_stream(stream, i);
+    }
+
+    stream->region_size = MAX(stream->region_size * 2, STREAM_MIN_REGION_SIZE);
+    stream->region_size = MAX(stream->region_size, ALIGN_UP(size, 256));
+    stream->region = 0;
+    glBufferData(stream->target, stream->region_size * STREAM_NUM_REGIONS,
+                 NULL, GL_STREAM_DRAW);
+  }
+
+  r_wait_stream(stream, stream->region);
+
+  *offset = stream->region * stream->region_size;
+
+  prof_counter_add(COUNTER_gpu_upload_bytes, size);
+
+  if (!size) {
+    return NULL;
+  }
+
+  GLbitfield access =
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+  void *ptr = glMapBufferRange(stream->target, *offset, size, access);
+  CHECK_NOTNULL(ptr);
+  return ptr;
+}
+
+static void r_unmap_stream(struct stream_buffer *stream) {
+  glUnmapBuffer(stream->target);
+}
+
+/* copies data into the next region of the stream, returning the region's
+   offset in the buffer */
+static int r_write_stream(struct stream_buffer *stream, const void *data,
+                          int size) {
+  int offset;
+  void *ptr = r_map_stream(stream, size, &offset);
+
+  if (ptr) {
+    memcpy(ptr, data, size);
+    r_unmap_stream(stream);
+  }
+
+  return offset;
+}
+
+/* packs the verts into the stream as they're written, the uvs being known to
+   fit in 16 bits each */
+static int r_write_compact_verts(struct stream_buffer *stream,
+                                 const struct ta_vertex *verts,
+                                 int num_verts) {
+  int offset;
+  struct ta_compact_vertex *dst = r_map_stream(
+      stream, sizeof(struct ta_compact_vertex) * num_verts, &offset);
+
+  if (!dst) {
+    return offset;
+  }
+
+  for (int i = 0; i < num_verts; i++) {
+    const struct ta_vertex *src = &verts[i];
+    uint32_t uv[2];
+    memcpy(uv, src->uv, sizeof(uv));
+
+    dst[i].xyz[0] = src->xyz[0];
+    dst[i].xyz[1] = src->xyz[1];
+    dst[i].xyz[2] = src->xyz[2];
+    dst[i].uv[0] = uv[0] >> 16;
+    dst[i].uv[1] = uv[1] >> 16;
+    dst[i].color = src->color;
+    dst[i].offset_color = src->offset_color;
+  }
+
+  r_unmap_stream(stream);
+
+  return offset;
+}
+
+/* called once the draws from the last region written have been issued */
+static void r_fence_stream(struct stream_buffer *stream) {
+  CHECK(!stream->fences[stream->region]);
+  stream->fences[stream->region] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static void r_poll_timers(struct render_backend *r) {
+  while (r->timer_tail != r->timer_head) {
+    struct gpu_timer *timer = &r->timers[r->timer_tail % TIMER_NUM_PAIRS];
+
+    /* the queries complete in order, stop at the first still pending */
+    GLint available = 0;
+    glGetQueryObjectiv(timer->queries[1], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+
+    if (!available) {
+      break;
+    }
+
+    GLuint64 start, end;
+    glGetQueryObjectui64v(timer->queries[0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(timer->queries[1], GL_QUERY_RESULT, &end);
+    prof_counter_add(*gpu_pass_counters[timer->pass], (int64_t)(end - start));
+
+    r->timer_tail++;
+  }
+}
+
+static void r_end_timer(struct render_backend *r) {
+  if (!r->timer_active) {
+    return;
+  }
+
+  struct gpu_timer *timer = &r->timers[r->timer_head % TIMER_NUM_PAIRS];
+  glQueryCounter(timer->queries[1], GL_TIMESTAMP);
+  r->timer_head++;
+  r->timer_active = 0;
+
+  r_poll_timers(r);
+}
+
+static void r_begin_timer(struct render_backend *r, enum gpu_pass pass) {
+  r_end_timer(r);
+
+  /* rather than waiting on the results, passes go unmeasured while the ring
+     is full */
+  if (!r->timer_queries || r->timer_head - r->timer_tail >= TIMER_NUM_PAIRS) {
+    return;
+  }
+
+  struct gpu_timer *timer = &r->timers[r->timer_head % TIMER_NUM_PAIRS];
+  glQueryCounter(timer->queries[0], GL_TIMESTAMP);
+  timer->pass = pass;
+  r->timer_active = 1;
+}
+
+static void r_destroy_timers(struct render_backend *r) {
+  if (!r->timer_queries) {
+    return;
+  }
+
+  for (int i = 0; i < TIMER_NUM_PAIRS; i++) {
+    glDeleteQueries(2, r->timers[i].queries);
+  }
+}
+
+static void r_create_timers(struct render_backend *r) {
+  /* timestamp queries aren't part of gles */
+#if PLATFORM_ANDROID
+  r->timer_queries = 0;
+#else
+  r->timer_queries = glQueryCounter && glGetQueryObjectui64v;
+#endif
+
+  if (!r->timer_queries) {
+    return;
+  }
+
+  for (int i = 0; i < TIMER_NUM_PAIRS; i++) {
+    glGenQueries(2, r->timers[i].queries);
+  }
+}
+
+static void r_destroy_oit(struct render_backend *r) {
+  if (!r->oit_fbo) {
+    return;
+  }
+
+  glDeleteFramebuffers(1, &r->oit_fbo);
+  glDeleteTextures(1, &r->oit_accum);
+  glDeleteTextures(1, &r->oit_weight);
+  glDeleteRenderbuffers(1, &r->oit_depth);
+  r->oit_fbo = 0;
+}
+
+static void r_reserve_oit(struct render_backend *r, int width, int height,
+                          GLenum depth_format) {
+  if (r->oit_fbo && r->oit_width == width && r->oit_height == height &&
+      r->oit_depth_format == depth_format) {
+    return;
+  }
+
+  r_destroy_oit(r);
+
+  r->oit_width = width;
+  r->oit_height = height;
+  r->oit_depth_format = depth_format;
+
+  glGenFramebuffers(1, &r->oit_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->oit_fbo);
+
+  struct {
+    GLuint *texture;
+    GLenum internal_fmt;
+    GLenum fmt;
+  } oit_textures[] = {
+      {&r->oit_accum, GL_RGBA16F, GL_RGBA},
+      {&r->oit_weight, GL_R16F, GL_RED},
+  };
+
+  for (int i = 0; i < ARRAY_SIZE(oit_textures); i++) {
+    glGenTextures(1, oit_textures[i].texture);
+    glBindTexture(GL_TEXTURE_2D, *oit_textures[i].texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, oit_textures[i].internal_fmt, width, height,
+                 0, oit_textures[i].fmt, GL_HALF_FLOAT, NULL);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                         *oit_textures[i].texture, 0);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  int stencil = depth_format == GL_DEPTH24_STENCIL8 ||
+                depth_format == GL_DEPTH32F_STENCIL8;
+  GLenum attachment =
+      stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+  glGenRenderbuffers(1, &r->oit_depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, r->oit_depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, depth_format, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER,
+                            r->oit_depth);
+
+  GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(ARRAY_SIZE(buffers), buffers);
+
+  GLenum res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+}
+
+static void r_destroy_target(struct render_backend *r) {
+  if (!r->target_fbo) {
+    return;
+  }
+
+  glDeleteFramebuffers(1, &r->target_fbo);
+  glDeleteTextures(1, &r->target_color);
+  glDeleteRenderbuffers(1, &r->target_depth);
+  r->target_fbo = 0;
+}
+
+static void r_reserve_target(struct render_backend *r, int width, int height) {
+  if (r->target_fbo && r->target_width == width &&
+      r->target_height == height) {
+    return;
+  }
+
+  r_destroy_target(r);
+
+  r->target_width = width;
+  r->target_height = height;
+
+  glGenFramebuffers(1, &r->target_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->target_fbo);
+
+  glGenTextures(1, &r->target_color);
+  glBindTexture(GL_TEXTURE_2D, r->target_color);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, r->target_color,
+                       0);
+
+  glGenRenderbuffers(1, &r->target_depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, r->target_depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, r->target_depth);
+
+  GLenum res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+}
+
+/* depth can only be blitted between buffers of the same format, the format of
+   the framebuffer's depth buffer is matched from its sizes */
+static GLenum r_depth_format(GLint fbo) {
+  GLenum depth = fbo ? GL_DEPTH_ATTACHMENT : GL_DEPTH;
+  GLenum stencil = fbo ? GL_STENCIL_ATTACHMENT : GL_STENCIL;
+  GLint depth_type = GL_NONE, stencil_type = GL_NONE;
+  GLint depth_size = 0, component_type = GL_NONE;
+
+  glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depth,
+                                        GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE,
+                                        &depth_type);
+  glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, stencil,
+                                        GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE,
+                                        &stencil_type);
+
+  if (depth_type != GL_NONE) {
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depth,
+                                          GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE,
+                                          &depth_size);
+    glGetFramebufferAttachmentParameteriv(
+        GL_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE,
+        &component_type);
+  }
+
+  if (component_type == GL_FLOAT) {
+    return stencil_type != GL_NONE ? GL_DEPTH32F_STENCIL8
+                                   : GL_DEPTH_COMPONENT32F;
+  }
+
+  if (stencil_type != GL_NONE) {
+    return GL_DEPTH24_STENCIL8;
+  }
+
+  return depth_size == 16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT24;
+}
+
+static void r_destroy_textures(struct render_backend *r) {
+  r_destroy_oit(r);
+  r_destroy_target(r);
+
+  glDeleteTextures(1, &r->white_texture);
+
+  r_destroy_stream(&r->pixel_pbo);
+  glDeleteFramebuffers(1, &r->pixel_fbo);
+
+  for (int i = 0; i < READBACK_NUM_BUFFERS; i++) {
+    struct readback *rb = &r->readbacks[i];
+
+    if (rb->fence) {
+      glDeleteSync(rb->fence);
+    }
+
+    glDeleteBuffers(1, &rb->buffer);
+  }
+  glDeleteTextures(1, &r->pixel_texture);
+
+  glDeleteFramebuffers(1, &r->decode_fbo);
+  glDeleteTextures(1, &r->decode_data);
+  glDeleteTextures(1, &r->decode_codebook);
+  glDeleteTextures(1, &r->decode_palette);
+
+  glDeleteTextures(1, &r->ta_palette);
+
+  for (int i = 0; i < MAX_TEXTURES; i++) {
+    struct texture *tex = &r->textures[i];
+
+    if (!tex->texture || tex->array) {
+      continue;
+    }
+
+    glDeleteTextures(1, &tex->texture);
+  }
+
+  for (int i = 0; i < MAX_TEXTURE_ARRAYS; i++) {
+    struct texture_array *array = &r->texture_arrays[i];
+
+    if (!array->texture) {
+      continue;
+    }
+
+    glDeleteTextures(1, &array->texture);
+  }
+}
+
+static void r_detect_extensions(struct render_backend *r) {
+  GLint num_extensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+
+  /* half float color buffers are core on desktop gl, but an extension on
+     gles */
+#if PLATFORM_ANDROID
+  r->oit_supported = 0;
+#else
+  r->oit_supported = 1;
+#endif
+
+  for (GLint i = 0; i < num_extensions; i++) {
+    const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+
+    if (!strcmp(ext, "GL_EXT_color_buffer_float")) {
+      r->oit_supported = 1;
+    }
+
+    if (!strcmp(ext, "GL_KHR_parallel_shader_compile") ||
+        !strcmp(ext, "GL_ARB_parallel_shader_compile")) {
+      r->parallel_compile = 1;
+    }
+
+    for (int j = 0; j < NUM_COMPRESSED_FORMATS; j++) {
+      if (!strcmp(ext, compressed_extensions[j])) {
+        r->compressed_formats[j] = 1;
+      }
+    }
+  }
+}
+
+static void r_create_textures(struct render_backend *r) {
+  r_detect_extensions(r);
+
+  /* create default all white texture */
+  uint8_t pixels[64 * 64 * 4];
+  memset(pixels, 0xff, sizeof(pixels));
+
+  glGenTextures(1, &r->white_texture);
+  glBindTexture(GL_TEXTURE_2D, r->white_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 64, 64, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               pixels);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  /* create fbo for blitting raw framebuffers to */
+  glGenFramebuffers(1, &r->pixel_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->pixel_fbo);
+
+  glGenTextures(1, &r->pixel_texture);
+  glBindTexture(GL_TEXTURE_2D, r->pixel_texture);
+
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB,
+               GL_UNSIGNED_SHORT_5_6_5, 0);
+  r->pixel_width = 1;
+  r->pixel_height = 1;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  GLenum buffers[] = {GL_COLOR_ATTACHMENT0};
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, r->pixel_texture,
+                       0);
+  glDrawBuffers(ARRAY_SIZE(buffers), buffers);
+
+  GLenum res = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  CHECK_EQ(res, GL_FRAMEBUFFER_COMPLETE);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  /* a bound unpack buffer would redirect every other texture upload, it's only
+     bound while drawing pixels */
+  r_create_stream(&r->pixel_pbo, GL_PIXEL_UNPACK_BUFFER);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  /* the same goes for pack buffers and reading back pixels */
+  for (int i = 0; i < READBACK_NUM_BUFFERS; i++) {
+    struct readback *rb = &r->readbacks[i];
+    memset(rb, 0, sizeof(*rb));
+    glGenBuffers(1, &rb->buffer);
+  }
+
+  r->readback_head = 0;
+  r->readback_tail = 0;
+
+  /* create fbo and integer textures for decoding raw textures */
+  glGenFramebuffers(1, &r->decode_fbo);
+
+  struct {
+    GLuint *texture;
+    GLenum internal_fmt;
+    GLenum pixel_fmt;
+    int width;
+    int height;
+  } decode_textures[] = {
+      {&r->decode_data, GL_R16UI, GL_UNSIGNED_SHORT, DECODE_DATA_WIDTH,
+       DECODE_DATA_HEIGHT},
+      {&r->decode_codebook, GL_R16UI, GL_UNSIGNED_SHORT, DECODE_CODEBOOK_WIDTH,
+       1},
+      {&r->decode_palette, GL_R32UI, GL_UNSIGNED_INT, DECODE_PALETTE_WIDTH, 1},
+      {&r->ta_palette, GL_R32UI, GL_UNSIGNED_INT, PALETTE_NUM_ENTRIES, 1},
+  };
+
+  for (int i = 0; i < ARRAY_SIZE(decode_textures); i++) {
+    glGenTextures(1, decode_textures[i].texture);
+    glBindTexture(GL_TEXTURE_2D, *decode_textures[i].texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, decode_textures[i].internal_fmt,
+                 decode_textures[i].width, decode_textures[i].height, 0,
+                 GL_RED_INTEGER, decode_textures[i].pixel_fmt, NULL);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/* the vertex attributes are rebound to the region of the vertex stream being
+   drawn from */
+static void r_bind_ta_attribs(struct render_backend *r, int offset,
+                              int compact) {
+  int stride = sizeof(struct ta_vertex);
+  int xyz = offsetof(struct ta_vertex, xyz);
+  int uv = offsetof(struct ta_vertex, uv);
+  int color = offsetof(struct ta_vertex, color);
+  int offset_color = offsetof(struct ta_vertex, offset_color);
+  GLenum uv_type = GL_FLOAT;
+
+  if (compact) {
+    stride = sizeof(struct ta_compact_vertex);
+    xyz = offsetof(struct ta_compact_vertex, xyz);
+    uv = offsetof(struct ta_compact_vertex, uv);
+    color = offsetof(struct ta_compact_vertex, color);
+    offset_color = offsetof(struct ta_compact_vertex, offset_color);
+    uv_type = GL_UNSIGNED_SHORT;
+  }
+
+  /* xyz */
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                        (void *)(intptr_t)(offset + xyz));
+
+  /* texcoord. compact uvs are read as whole numbers, their bits being
+     reinterpreted by the shader */
+  glVertexAttribPointer(1, 2, uv_type, GL_FALSE, stride,
+                        (void *)(intptr_t)(offset + uv));
+
+  /* color */
+  glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                        (void *)(intptr_t)(offset + color));
+
+  /* offset color */
+  glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                        (void *)(intptr_t)(offset + offset_color));
+}
+
+static void r_destroy_vertex_arrays(struct render_backend *r) {
+  glDeleteBuffers(1, &r->ui_ibo);
+  glDeleteBuffers(1, &r->ui_vbo);
+  glDeleteVertexArrays(1, &r->ui_vao);
+
+  r_destroy_stream(&r->ta_ibo);
+  r_destroy_stream(&r->ta_vbo);
+  glDeleteVertexArrays(1, &r->ta_vao);
+
+  glDeleteVertexArrays(1, &r->decode_vao);
+}
+
+static void r_create_vertex_arrays(struct render_backend *r) {
+  /* ui vao */
+  {
+    glGenVertexArrays(1, &r->ui_vao);
+    glBindVertexArray(r->ui_vao);
+
+    glGenBuffers(1, &r->ui_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, r->ui_vbo);
+
+    glGenBuffers(1, &r->ui_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ui_ibo);
+
+    /* xy */
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct ui_vertex),
+                          (void *)offsetof(struct ui_vertex, xy));
+
+    /* texcoord */
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct ui_vertex),
+                          (void *)offsetof(struct ui_vertex, uv));
+
+    /* color */
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                          sizeof(struct ui_vertex),
+                          (void *)offsetof(struct ui_vertex, color));
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  /* ta vao */
+  {
+    glGenVertexArrays(1, &r->ta_vao);
+    glBindVertexArray(r->ta_vao);
+
+    r_create_stream(&r->ta_vbo, GL_ARRAY_BUFFER);
+    r_create_stream(&r->ta_ibo, GL_ELEMENT_ARRAY_BUFFER);
+
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    r_bind_ta_attribs(r, 0, 0);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  /* decode vao, the vertices are generated from gl_VertexID though a vao
+     still has to be bound to draw them */
+  glGenVertexArrays(1, &r->decode_vao);
+}
+
+static void r_set_initial_state(struct render_backend *r) {
+  glDepthMask(1);
+  glDisable(GL_DEPTH_TEST);
+
+  glEnable(GL_CULL_FACE);
+  glCullFace(GL_BACK);
+
+  glDisable(GL_BLEND);
+}
+
+static int r_get_ta_attrs(struct render_backend *r,
+                          const struct ta_surface *surf) {
+  int idx = (int)surf->params.shade;
+  if (surf->params.texture) {
+    idx |= ATTR_TEXTURE;
+  }
+  if (surf->params.ignore_alpha) {
+    idx |= ATTR_IGNORE_ALPHA;
+  }
+  if (surf->params.ignore_texture_alpha) {
+    idx |= ATTR_IGNORE_TEXTURE_ALPHA;
+  }
+  if (surf->params.offset_color) {
+    idx |= ATTR_OFFSET_COLOR;
+  }
+  if (surf->params.alpha_test) {
+    idx |= ATTR_ALPHA_TEST;
+  }
+  if (surf->params.debug_depth) {
+    idx |= ATTR_DEBUG_DEPTH_BUFFER;
+  }
+  if (surf->params.texture && r->textures[surf->params.texture].indexed) {
+    idx |= ATTR_PALETTE;
+  }
+  if (surf->params.texture && r->textures[surf->params.texture].array) {
+    idx |= ATTR_ARRAY;
+  }
+  if (r->ta_oit) {
+    idx |= ATTR_OIT;
+  }
+
+  return idx;
+}
+
+static struct shader_program *r_get_ta_program(struct render_backend *r,
+                                               int idx) {
+  struct shader_program *program = &r->ta_programs[idx];
+
+  /* lazy-compile the ta programs, drawing with the ubershader until they've
+     linked when compiling in the background */
+  if (!program->prog) {
+    r_issue_ta_program(r, program, idx);
+  }
+
+  if (program->linking) {
+    if (OPTION_async_shaders && !r_ta_program_ready(r, program)) {
+      return &r->uber_programs[(idx & ATTR_OIT) ? 1 : 0];
+    }
+
+    r_link_ta_program(r, program, idx);
+  }
+
+  return program;
+}
+
+void r_end_ui_surfaces(struct render_backend *r) {
+  glDisable(GL_SCISSOR_TEST);
+
+  r_end_timer(r);
+}
+
+void r_draw_ui_surface(struct render_backend *r,
+                       const struct ui_surface *surf) {
+  if (surf->scissor) {
+    glEnable(GL_SCISSOR_TEST);
+    glScissor((int)surf->scissor_rect[0], (int)surf->scissor_rect[1],
+              (int)surf->scissor_rect[2], (int)surf->scissor_rect[3]);
+  } else {
+    glDisable(GL_SCISSOR_TEST);
+  }
+
+  if (surf->src_blend == BLEND_NONE || surf->dst_blend == BLEND_NONE) {
+    glDisable(GL_BLEND);
+  } else {
+    glEnable(GL_BLEND);
+    glBlendFunc(blend_funcs[surf->src_blend], blend_funcs[surf->dst_blend]);
+  }
+
+  /* the ui shader only samples plain textures, leaving textures packed into
+     arrays drawn as white */
+  if (surf->texture && !r->textures[surf->texture].array) {
+    struct texture *tex = &r->textures[surf->texture];
     r_bind_texture(r, MAP_DIFFUSE, tex->texture);
   } else {
     r_bind_texture(r, MAP_DIFFUSE, r->white_texture);
   }
 
+  prof_counter_add(COUNTER_gpu_draws, 1);
+
   if (r->ui_use_ibo) {
     glDrawElements(prim_types[surf->prim_type], surf->num_verts,
                    GL_UNSIGNED_SHORT,
@@ -541,145 +1614,583 @@ void r_draw_ui_surface(struct render_backend *r,
   }
 }
 
-void r_begin_ui_surfaces(struct render_backend *r,
-                         const struct ui_vertex *verts, int num_verts,
-                         const uint16_t *indices, int num_indices) {
-  /* setup projection matrix */
-  float ortho[16];
-  ortho[0] = 2.0f / (float)r->viewport.w;
-  ortho[4] = 0.0f;
-  ortho[8] = 0.0f;
-  ortho[12] = -1.0f;
+void r_begin_ui_surfaces(struct render_backend *r,
+                         const struct ui_vertex *verts, int num_verts,
+                         const uint16_t *indices, int num_indices) {
+  /* setup projection matrix */
+  float ortho[16];
+  ortho[0] = 2.0f / (float)r->viewport.w;
+  ortho[4] = 0.0f;
+  ortho[8] = 0.0f;
+  ortho[12] = -1.0f;
+
+  ortho[1] = 0.0f;
+  ortho[5] = -2.0f / (float)r->viewport.h;
+  ortho[9] = 0.0f;
+  ortho[13] = 1.0f;
+
+  ortho[2] = 0.0f;
+  ortho[6] = 0.0f;
+  ortho[10] = 0.0f;
+  ortho[14] = 0.0f;
+
+  ortho[3] = 0.0f;
+  ortho[7] = 0.0f;
+  ortho[11] = 0.0f;
+  ortho[15] = 1.0f;
+
+  r_begin_timer(r, GPU_PASS_UI);
+
+  glDepthMask(0);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+
+  struct shader_program *program = &r->ui_program;
+  glBindVertexArray(r->ui_vao);
+  glUseProgram(program->prog);
+  glUniformMatrix4fv(program->loc[UNIFORM_PROJ], 1, GL_FALSE, ortho);
+
+  /* bind buffers */
+  glBindBuffer(GL_ARRAY_BUFFER, r->ui_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(struct ui_vertex) * num_verts, verts,
+               GL_DYNAMIC_DRAW);
+  prof_counter_add(COUNTER_gpu_upload_bytes,
+                   sizeof(struct ui_vertex) * num_verts);
+
+  if (indices) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ui_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * num_indices,
+                 indices, GL_DYNAMIC_DRAW);
+    prof_counter_add(COUNTER_gpu_upload_bytes, sizeof(uint16_t) * num_indices);
+    r->ui_use_ibo = 1;
+  } else {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    r->ui_use_ibo = 0;
+  }
+}
+
+void r_end_ta_surfaces(struct render_backend *r) {
+  r_end_timer(r);
+
+  r_fence_stream(&r->ta_vbo);
+  r_fence_stream(&r->ta_ibo);
+
+  glDisable(GL_STENCIL_TEST);
+  r->ta_shadows = 0;
+
+#if PLATFORM_ANDROID
+  glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+#else
+  glDisable(GL_PRIMITIVE_RESTART);
+#endif
+}
+
+void r_begin_ta_pass(struct render_backend *r, enum gpu_pass pass) {
+  r_begin_timer(r, pass);
+}
+
+void r_end_ta_oit(struct render_backend *r) {
+  r->ta_oit = 0;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, r->oit_prev_fbo);
+
+  /* composite the accumulated surfaces over the framebuffer, the state
+     changed here is all reset by the next surface drawn */
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glUseProgram(r->oit_program.prog);
+  r_bind_texture(r, MAP_ACCUM, r->oit_accum);
+  r_bind_texture(r, MAP_WEIGHT, r->oit_weight);
+  glActiveTexture(GL_TEXTURE0);
+
+  glBindVertexArray(r->decode_vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(r->ta_vao);
+
+  prof_counter_add(COUNTER_gpu_draws, 1);
+
+  r->ta_depth_mask = -1;
+  r->ta_depth_func = -1;
+  r->ta_cull = -1;
+  r->ta_blend = -1;
+  r->ta_program = NULL;
+}
+
+void r_begin_ta_oit(struct render_backend *r) {
+  CHECK(r->oit_supported);
+
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &r->oit_prev_fbo);
+
+  /* the framebuffer covers the viewport from the origin, so it can be drawn
+     to with the same viewport */
+  struct viewport *v = &r->viewport;
+  r_reserve_oit(r, v->x + v->w, v->y + v->h,
+                r_depth_format(r->oit_prev_fbo));
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, r->oit_prev_fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->oit_fbo);
+  glBlitFramebuffer(v->x, v->y, v->x + v->w, v->y + v->h, v->x, v->y,
+                    v->x + v->w, v->y + v->h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->oit_fbo);
+
+  static const GLfloat accum_clear[] = {0.0f, 0.0f, 0.0f, 1.0f};
+  static const GLfloat weight_clear[] = {0.0f, 0.0f, 0.0f, 0.0f};
+  glClearBufferfv(GL_COLOR, 0, accum_clear);
+  glClearBufferfv(GL_COLOR, 1, weight_clear);
+
+  /* color and weights are summed, while alpha is multiplied by 1 - alpha.
+     only alpha blended surfaces are drawn until the end, which have their
+     blend state shadowed as already set, and the depth buffer is left as is */
+  glEnable(GL_BLEND);
+  glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+  r->ta_blend = (BLEND_SRC_ALPHA << 4) | BLEND_ONE_MINUS_SRC_ALPHA;
+
+  glDepthMask(0);
+  r->ta_depth_mask = 0;
+
+  r->ta_program = NULL;
+  r->ta_oit = 1;
+}
+
+/* binds the program along with its global uniforms, and the attributes the
+   ubershader is to draw with, returning the number of changes made */
+static int r_bind_ta_program(struct render_backend *r,
+                             struct shader_program *program, int attrs) {
+  int changes = 0;
+
+  if (program != r->ta_program) {
+    glUseProgram(program->prog);
+    r->ta_program = program;
+    changes++;
+  }
+
+  /* bind global uniforms if they've changed */
+  if (program->uniform_token != r->uniform_token) {
+    glUniform4fv(program->loc[UNIFORM_VIDEO_SCALE], 1, r->uniform_video_scale);
+    glUniform1i(program->loc[UNIFORM_COMPACT], r->uniform_compact);
+    program->uniform_token = r->uniform_token;
+  }
+
+  if (program->loc[UNIFORM_ATTRS] != -1 && attrs != program->attrs) {
+    glUniform1i(program->loc[UNIFORM_ATTRS], attrs);
+    program->attrs = attrs;
+    changes++;
+  }
+
+  return changes;
+}
+
+void r_end_ta_modvols(struct render_backend *r, float scale) {
+  /* multiply the color of each shadowed pixel by the scale. the state changed
+     here is all reset by the next surface drawn */
+  glColorMask(1, 1, 1, 1);
+  glDisable(GL_DEPTH_TEST);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ZERO, GL_SRC_COLOR);
+  glStencilMask(0);
+  glStencilFunc(GL_EQUAL, STENCIL_INSIDE | STENCIL_RECEIVER,
+                STENCIL_INSIDE | STENCIL_RECEIVER);
+
+  struct shader_program *program = &r->modvol_program;
+  glUseProgram(program->prog);
+  glUniform1f(program->loc[UNIFORM_SHADOW_SCALE], scale);
+
+  glBindVertexArray(r->decode_vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(r->ta_vao);
+
+  prof_counter_add(COUNTER_gpu_draws, 1);
+
+  glStencilMask(0xff);
+  glDisable(GL_STENCIL_TEST);
+  r->ta_shadows = 0;
+
+  r->ta_depth_mask = -1;
+  r->ta_depth_func = -1;
+  r->ta_cull = -1;
+  r->ta_blend = -1;
+  r->ta_program = NULL;
+}
+
+void r_draw_ta_modvol(struct render_backend *r,
+                      const struct ta_surface *surf) {
+  /* flip the parity of each pixel for every face of the volume in front of
+     it, leaving it set for the pixels inside of the volume */
+  glEnable(GL_DEPTH_TEST);
+  glStencilMask(STENCIL_PARITY);
+  glStencilFunc(GL_ALWAYS, 0, 0);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_INVERT);
+  glDrawArrays(GL_TRIANGLES, surf->first_vert, surf->num_verts);
+
+  /* merge the shadowed side of the volume into the inside bit, which holds
+     the pixels shadowed by every volume drawn so far */
+  glDisable(GL_DEPTH_TEST);
+  glStencilMask(STENCIL_INSIDE);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
 
-  ortho[1] = 0.0f;
-  ortho[5] = -2.0f / (float)r->viewport.h;
-  ortho[9] = 0.0f;
-  ortho[13] = 1.0f;
+  if (surf->params.volume == VOLUME_OUTSIDE) {
+    glStencilFunc(GL_EQUAL, STENCIL_INSIDE, STENCIL_PARITY);
+    glBindVertexArray(r->decode_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(r->ta_vao);
+  } else {
+    glStencilFunc(GL_EQUAL, STENCIL_PARITY | STENCIL_INSIDE, STENCIL_PARITY);
+    glDrawArrays(GL_TRIANGLES, surf->first_vert, surf->num_verts);
+  }
 
-  ortho[2] = 0.0f;
-  ortho[6] = 0.0f;
-  ortho[10] = 0.0f;
-  ortho[14] = 0.0f;
+  /* the parity is only ever set within the volume's bounds, so it can be
+     reset for the next volume by drawing over them again */
+  glStencilMask(STENCIL_PARITY);
+  glStencilFunc(GL_ALWAYS, 0, 0);
+  glDrawArrays(GL_TRIANGLES, surf->first_vert, surf->num_verts);
 
-  ortho[3] = 0.0f;
-  ortho[7] = 0.0f;
-  ortho[11] = 0.0f;
-  ortho[15] = 1.0f;
+  prof_counter_add(COUNTER_gpu_draws, 3);
+}
 
+void r_begin_ta_modvols(struct render_backend *r) {
+  /* volumes are drawn with the same depth as the surfaces they shadow, only
+     writing to the stencil buffer */
+  glColorMask(0, 0, 0, 0);
   glDepthMask(0);
-  glDisable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LESS);
   glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
 
-  struct shader_program *program = &r->ui_program;
-  glBindVertexArray(r->ui_vao);
-  glUseProgram(program->prog);
-  glUniformMatrix4fv(program->loc[UNIFORM_PROJ], 1, GL_FALSE, ortho);
+  r_bind_ta_program(r, r_get_ta_program(r, 0), 0);
+}
 
-  /* bind buffers */
-  glBindBuffer(GL_ARRAY_BUFFER, r->ui_vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(struct ui_vertex) * num_verts, verts,
-               GL_DYNAMIC_DRAW);
+int r_begin_ta_shadows(struct render_backend *r) {
+  GLint fbo = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
 
-  if (indices) {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ui_ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * num_indices,
-                 indices, GL_DYNAMIC_DRAW);
-    r->ui_use_ibo = 1;
-  } else {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    r->ui_use_ibo = 0;
+  GLint stencil_type = GL_NONE;
+  glGetFramebufferAttachmentParameteriv(
+      GL_FRAMEBUFFER, fbo ? GL_STENCIL_ATTACHMENT : GL_STENCIL,
+      GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &stencil_type);
+
+  if (stencil_type == GL_NONE) {
+    return 0;
   }
-}
 
-void r_end_ta_surfaces(struct render_backend *r) {}
+  glStencilMask(0xff);
+  glClear(GL_STENCIL_BUFFER_BIT);
+
+  /* each surface drawn marks whether or not it receives shadows */
+  glEnable(GL_STENCIL_TEST);
+  glStencilMask(STENCIL_RECEIVER);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+
+  r->ta_shadows = 1;
+  r->ta_shadow = -1;
+
+  return 1;
+}
 
 void r_draw_ta_surface(struct render_backend *r,
                        const struct ta_surface *surf) {
-  glDepthMask(!!surf->params.depth_write);
+  int depth_mask = surf->params.depth_write && !r->ta_oit;
+  int depth_func = surf->params.depth_func;
+  int cull = surf->params.cull;
+  int blend = (surf->params.src_blend << 4) | surf->params.dst_blend;
+  int changes = 0;
+
+  if (depth_mask != r->ta_depth_mask) {
+    glDepthMask(depth_mask);
+    r->ta_depth_mask = depth_mask;
+    changes++;
+  }
 
-  if (surf->params.depth_func == DEPTH_NONE) {
-    glDisable(GL_DEPTH_TEST);
-  } else {
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(depth_funcs[surf->params.depth_func]);
+  if (depth_func != r->ta_depth_func) {
+    if (depth_func == DEPTH_NONE) {
+      glDisable(GL_DEPTH_TEST);
+    } else {
+      glEnable(GL_DEPTH_TEST);
+      glDepthFunc(depth_funcs[depth_func]);
+    }
+    r->ta_depth_func = depth_func;
+    changes++;
   }
 
-  if (surf->params.cull == CULL_NONE) {
-    glDisable(GL_CULL_FACE);
-  } else {
-    glEnable(GL_CULL_FACE);
-    glCullFace(cull_face[surf->params.cull]);
+  if (cull != r->ta_cull) {
+    if (cull == CULL_NONE) {
+      glDisable(GL_CULL_FACE);
+    } else {
+      glEnable(GL_CULL_FACE);
+      glCullFace(cull_face[cull]);
+    }
+    r->ta_cull = cull;
+    changes++;
   }
 
-  if (surf->params.src_blend == BLEND_NONE ||
-      surf->params.dst_blend == BLEND_NONE) {
-    glDisable(GL_BLEND);
-  } else {
-    glEnable(GL_BLEND);
-    glBlendFunc(blend_funcs[surf->params.src_blend],
-                blend_funcs[surf->params.dst_blend]);
+  if (blend != r->ta_blend) {
+    if (surf->params.src_blend == BLEND_NONE ||
+        surf->params.dst_blend == BLEND_NONE) {
+      glDisable(GL_BLEND);
+    } else {
+      glEnable(GL_BLEND);
+      glBlendFunc(blend_funcs[surf->params.src_blend],
+                  blend_funcs[surf->params.dst_blend]);
+    }
+    r->ta_blend = blend;
+    changes++;
   }
 
-  struct shader_program *program = r_get_ta_program(r, surf);
+  if (r->ta_shadows && surf->params.shadow != r->ta_shadow) {
+    int ref = surf->params.shadow ? STENCIL_RECEIVER : 0;
+    glStencilFunc(GL_ALWAYS, ref, STENCIL_RECEIVER);
+    r->ta_shadow = surf->params.shadow;
+    changes++;
+  }
 
-  glUseProgram(program->prog);
+  int attrs = r_get_ta_attrs(r, surf);
+  struct shader_program *program = r_get_ta_program(r, attrs);
+  changes += r_bind_ta_program(r, program, attrs);
 
-  /* bind global uniforms if they've changed */
-  if (program->uniform_token != r->uniform_token) {
-    glUniform4fv(program->loc[UNIFORM_VIDEO_SCALE], 1, r->uniform_video_scale);
-    program->uniform_token = r->uniform_token;
+  /* non-global uniforms are bound whenever they differ from what the program
+     last had bound */
+  int alpha_ref = surf->params.alpha_ref;
+
+  if (alpha_ref != program->alpha_ref) {
+    glUniform1f(program->loc[UNIFORM_ALPHA_REF], alpha_ref / 255.0f);
+    program->alpha_ref = alpha_ref;
+    changes++;
   }
 
-  /* bind non-global uniforms every time */
-  float alpha_ref = surf->params.alpha_ref / 255.0f;
-  glUniform1f(program->loc[UNIFORM_ALPHA_REF], alpha_ref);
+  if (attrs & ATTR_PALETTE) {
+    struct texture *tex = &r->textures[surf->params.texture];
+    int palette_info = tex->palette_base | (r->ta_palette_format << 10) |
+                       (tex->bilinear << 12);
+
+    if (palette_info != program->palette_info) {
+      glUniform4i(program->loc[UNIFORM_PALETTE_INFO], tex->palette_base,
+                  r->ta_palette_format, tex->bilinear, 0);
+      program->palette_info = palette_info;
+      changes++;
+    }
+  }
 
-  if (surf->params.texture) {
+  /* surfaces drawn from an array are tracked by the array, so switching
+     between textures in the same one doesn't rebind it */
+  if (attrs & ATTR_ARRAY) {
+    struct texture *tex = &r->textures[surf->params.texture];
+
+    if (tex->texture != r->ta_array) {
+      glActiveTexture(GL_TEXTURE0 + MAP_ARRAY);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, tex->texture);
+      r->ta_array = tex->texture;
+      changes++;
+    }
+  } else if (surf->params.texture && surf->params.texture != r->ta_texture) {
     struct texture *tex = &r->textures[surf->params.texture];
     r_bind_texture(r, MAP_DIFFUSE, tex->texture);
+    r->ta_texture = surf->params.texture;
+    changes++;
   }
 
-  glDrawElements(GL_TRIANGLES, surf->num_verts, GL_UNSIGNED_SHORT,
-                 (void *)(intptr_t)(sizeof(uint16_t) * surf->first_vert));
+  prof_counter_add(COUNTER_gpu_state_changes, changes);
+  prof_counter_add(COUNTER_gpu_draws, 1);
+
+  glDrawElements(prim_types[surf->prim_type], surf->num_verts,
+                 r->ta_index_type,
+                 (void *)(intptr_t)(r->ta_index_offset +
+                                    r->ta_index_size * surf->first_vert));
 }
 
 void r_begin_ta_surfaces(struct render_backend *r, int video_width,
                          int video_height, const struct ta_vertex *verts,
-                         int num_verts, const uint16_t *indices,
-                         int num_indices) {
+                         int num_verts, int compact, const void *indices,
+                         int num_indices, int index_size) {
   /* uniforms will be lazily bound for each program inside of r_draw_surface */
   r->uniform_token++;
+  r->uniform_compact = compact;
   r->uniform_video_scale[0] = 2.0f / (float)video_width;
   r->uniform_video_scale[1] = -1.0f;
   r->uniform_video_scale[2] = -2.0f / (float)video_height;
   r->uniform_video_scale[3] = 1.0f;
 
+  r->ta_depth_mask = -1;
+  r->ta_depth_func = -1;
+  r->ta_cull = -1;
+  r->ta_blend = -1;
+  r->ta_program = NULL;
+  r->ta_texture = 0;
+  r->ta_array = 0;
+
+  r_bind_texture(r, MAP_PALETTE, r->ta_palette);
+  glActiveTexture(GL_TEXTURE0);
+
   glBindVertexArray(r->ta_vao);
 
-  glBindBuffer(GL_ARRAY_BUFFER, r->ta_vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(struct ta_vertex) * num_verts, verts,
-               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, r->ta_vbo.buffer);
+  int vert_offset =
+      compact ? r_write_compact_verts(&r->ta_vbo, verts, num_verts)
+              : r_write_stream(&r->ta_vbo, verts,
+                               sizeof(struct ta_vertex) * num_verts);
+  r_bind_ta_attribs(r, vert_offset, compact);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ta_ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * num_indices, indices,
-               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->ta_ibo.buffer);
+  r->ta_index_offset =
+      r_write_stream(&r->ta_ibo, indices, index_size * num_indices);
+
+  r->ta_index_size = index_size;
+  r->ta_index_type = index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+  /* the restart index is fixed to the maximum index on gles, and has to be
+     set to match on desktop gl */
+#if PLATFORM_ANDROID
+  glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+#else
+  glEnable(GL_PRIMITIVE_RESTART);
+  glPrimitiveRestartIndex(index_size == 2 ? 0xffff : 0xffffffff);
+#endif
+}
+
+void r_upload_palette(struct render_backend *r, const uint32_t *palette,
+                      enum raw_format format) {
+  glBindTexture(GL_TEXTURE_2D, r->ta_palette);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PALETTE_NUM_ENTRIES, 1,
+                  GL_RED_INTEGER, GL_UNSIGNED_INT, palette);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  prof_counter_add(COUNTER_gpu_upload_bytes, PALETTE_NUM_ENTRIES * 4);
+
+  r->ta_palette_format = format;
 }
 
 void r_draw_pixels(struct render_backend *r, const uint8_t *pixels, int x,
                    int y, int width, int height) {
+  r_begin_timer(r, GPU_PASS_PIXELS);
+
+  /* the copy into the pixel buffer returns immediately, the transfer to the
+     texture is then performed asynchronously by the driver */
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r->pixel_pbo.buffer);
+  int offset = r_write_stream(&r->pixel_pbo, pixels, width * height * 4);
+
   glBindTexture(GL_TEXTURE_2D, r->pixel_texture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-               GL_UNSIGNED_BYTE, pixels);
+  if (width != r->pixel_width || height != r->pixel_height) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, (void *)(intptr_t)offset);
+    r->pixel_width = width;
+    r->pixel_height = height;
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA,
+                    GL_UNSIGNED_BYTE, (void *)(intptr_t)offset);
+  }
   glBindTexture(GL_TEXTURE_2D, 0);
 
+  r_fence_stream(&r->pixel_pbo);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  /* blit to whichever framebuffer the host is presenting from, which isn't
+     the default framebuffer for the libretro core */
+  GLint prev_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+
   glBindFramebuffer(GL_READ_FRAMEBUFFER, r->pixel_fbo);
   glReadBuffer(GL_COLOR_ATTACHMENT0);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prev_fbo);
   glBlitFramebuffer(x, y + height, x + width, y, r->viewport.x, r->viewport.y,
                     r->viewport.x + r->viewport.w,
                     r->viewport.y + r->viewport.h, GL_COLOR_BUFFER_BIT,
                     GL_LINEAR);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+
+  r_end_timer(r);
+}
+
+void r_end_ta_target(struct render_backend *r) {
+  /* the scale isn't attributed to the last pass drawn */
+  r_end_timer(r);
+
+  struct viewport *v = &r->target_prev_viewport;
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, r->target_fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->target_prev_fbo);
+  glBlitFramebuffer(0, 0, r->target_width, r->target_height, v->x, v->y,
+                    v->x + v->w, v->y + v->h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, r->target_prev_fbo);
+
+  r_viewport(r, v->x, v->y, v->w, v->h);
+}
+
+void r_begin_ta_target(struct render_backend *r, int width, int height) {
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &r->target_prev_fbo);
+  r->target_prev_viewport = r->viewport;
+
+  r_reserve_target(r, width, height);
+
+  /* the target covers the viewport from the origin, as the oit framebuffer
+     expects of whatever it's drawn over */
+  glBindFramebuffer(GL_FRAMEBUFFER, r->target_fbo);
+  r_viewport(r, 0, 0, width, height);
+  r_clear(r);
+}
+
+void r_unmap_readback(struct render_backend *r) {
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  r->readback_tail++;
+}
+
+const uint8_t *r_map_readback(struct render_backend *r, int wait, int *width,
+                              int *height) {
+  if (r->readback_tail == r->readback_head) {
+    return NULL;
+  }
+
+  struct readback *rb = &r->readbacks[r->readback_tail % READBACK_NUM_BUFFERS];
+
+  GLenum res;
+  do {
+    res = glClientWaitSync(rb->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                           wait ? STREAM_WAIT_TIMEOUT : 0);
+  } while (wait && res == GL_TIMEOUT_EXPIRED);
+
+  if (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED) {
+    return NULL;
+  }
+
+  glDeleteSync(rb->fence);
+  rb->fence = NULL;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->buffer);
+  void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                               rb->width * rb->height * 4, GL_MAP_READ_BIT);
+  CHECK_NOTNULL(ptr);
+
+  *width = rb->width;
+  *height = rb->height;
+  return ptr;
+}
+
+int r_queue_readback(struct render_backend *r) {
+  if (r->readback_head - r->readback_tail >= READBACK_NUM_BUFFERS) {
+    return 0;
+  }
+
+  struct readback *rb = &r->readbacks[r->readback_head % READBACK_NUM_BUFFERS];
+  int size = r->viewport.w * r->viewport.h * 4;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->buffer);
+
+  if (size > rb->size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    rb->size = size;
+  }
+
+  /* read from whichever framebuffer the host is presenting from. the copy
+     into the buffer is performed asynchronously by the driver */
+  glReadPixels(r->viewport.x, r->viewport.y, r->viewport.w, r->viewport.h,
+               GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  rb->width = r->viewport.w;
+  rb->height = r->viewport.h;
+  rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  r->readback_head++;
+
+  return 1;
 }
 
 void r_viewport(struct render_backend *r, int x, int y, int width, int height) {
@@ -702,16 +2213,36 @@ void r_destroy_texture(struct render_backend *r, texture_handle_t handle) {
   }
 
   struct texture *tex = &r->textures[handle];
+
+  if (tex->array) {
+    struct texture_array *array = &r->texture_arrays[tex->array - 1];
+    array->layers &= ~(1u << tex->layer);
+
+    if (!array->layers) {
+      glDeleteTextures(1, &array->texture);
+      memset(array, 0, sizeof(*array));
+    }
+
+    memset(tex, 0, sizeof(*tex));
+    return;
+  }
+
   glDeleteTextures(1, &tex->texture);
   tex->texture = 0;
 }
 
-texture_handle_t r_create_texture(struct render_backend *r,
-                                  enum pxl_format format,
-                                  enum filter_mode filter,
-                                  enum wrap_mode wrap_u, enum wrap_mode wrap_v,
-                                  int mipmaps, int width, int height,
-                                  const uint8_t *buffer) {
+int r_texture_array(struct render_backend *r, texture_handle_t handle,
+                    int *layer) {
+  struct texture *tex = &r->textures[handle];
+
+  if (layer) {
+    *layer = tex->layer;
+  }
+
+  return tex->array;
+}
+
+static texture_handle_t r_alloc_handle(struct render_backend *r) {
   /* find next open texture entry */
   texture_handle_t handle;
   for (handle = 1; handle < MAX_TEXTURES; handle++) {
@@ -722,9 +2253,17 @@ texture_handle_t r_create_texture(struct render_backend *r,
   }
   CHECK_LT(handle, MAX_TEXTURES);
 
-  GLuint internal_fmt = internal_formats[format];
-  GLuint pixel_fmt = pixel_formats[format];
+  struct texture *tex = &r->textures[handle];
+  memset(tex, 0, sizeof(*tex));
 
+  return handle;
+}
+
+static texture_handle_t r_alloc_texture(struct render_backend *r,
+                                        enum filter_mode filter,
+                                        enum wrap_mode wrap_u,
+                                        enum wrap_mode wrap_v, int mipmaps) {
+  texture_handle_t handle = r_alloc_handle(r);
   struct texture *tex = &r->textures[handle];
   glGenTextures(1, &tex->texture);
   glBindTexture(GL_TEXTURE_2D, tex->texture);
@@ -733,7 +2272,237 @@ texture_handle_t r_create_texture(struct render_backend *r,
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter_funcs[filter]);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_modes[wrap_u]);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_modes[wrap_v]);
-  glTexImage2D(GL_TEXTURE_2D, 0, internal_fmt, width, height, 0, internal_fmt,
+
+  return handle;
+}
+
+/* finds a free layer in an array matching the texture's size and sampler
+   state, creating a new array if none have one. returns 0 if there's no room
+   for a new array */
+static texture_handle_t r_alloc_array_texture(struct render_backend *r,
+                                              int width, int height,
+                                              enum filter_mode filter,
+                                              enum wrap_mode wrap_u,
+                                              enum wrap_mode wrap_v) {
+  struct texture_array *array = NULL;
+  struct texture_array *unused = NULL;
+
+  for (int i = 0; i < MAX_TEXTURE_ARRAYS; i++) {
+    struct texture_array *it = &r->texture_arrays[i];
+
+    if (!it->texture) {
+      unused = unused ? unused : it;
+      continue;
+    }
+
+    if (it->width == width && it->height == height && it->filter == filter &&
+        it->wrap_u == wrap_u && it->wrap_v == wrap_v &&
+        it->layers != (1ull << TEXTURE_ARRAY_LAYERS) - 1) {
+      array = it;
+      break;
+    }
+  }
+
+  if (!array) {
+    if (!unused) {
+      return 0;
+    }
+
+    array = unused;
+    array->width = width;
+    array->height = height;
+    array->filter = filter;
+    array->wrap_u = wrap_u;
+    array->wrap_v = wrap_v;
+    array->layers = 0;
+
+    glGenTextures(1, &array->texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    filter_funcs[filter]);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER,
+                    filter_funcs[filter]);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,
+                    wrap_modes[wrap_u]);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,
+                    wrap_modes[wrap_v]);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height,
+                 TEXTURE_ARRAY_LAYERS, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  }
+
+  int layer = ctz32(~array->layers);
+  array->layers |= 1u << layer;
+
+  texture_handle_t handle = r_alloc_handle(r);
+  struct texture *tex = &r->textures[handle];
+  tex->texture = array->texture;
+  tex->array = (int)(array - r->texture_arrays) + 1;
+  tex->layer = layer;
+
+  return handle;
+}
+
+static void r_upload_decode_data(struct render_backend *r,
+                                 const struct raw_texture *raw) {
+  /* the data is uploaded a row at a time, with the final row being partial */
+  int num_values = raw->size / 2;
+  int num_rows = num_values / DECODE_DATA_WIDTH;
+  int remaining = num_values % DECODE_DATA_WIDTH;
+  CHECK_LE(num_rows + !!remaining, DECODE_DATA_HEIGHT);
+
+  glActiveTexture(GL_TEXTURE0 + MAP_DATA);
+  glBindTexture(GL_TEXTURE_2D, r->decode_data);
+
+  if (num_rows) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DECODE_DATA_WIDTH, num_rows,
+                    GL_RED_INTEGER, GL_UNSIGNED_SHORT, raw->data);
+  }
+
+  if (remaining) {
+    const uint8_t *row = raw->data + num_rows * DECODE_DATA_WIDTH * 2;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, num_rows, remaining, 1,
+                    GL_RED_INTEGER, GL_UNSIGNED_SHORT, row);
+  }
+
+  if (raw->layout == RAW_VQ) {
+    glActiveTexture(GL_TEXTURE0 + MAP_CODEBOOK);
+    glBindTexture(GL_TEXTURE_2D, r->decode_codebook);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DECODE_CODEBOOK_WIDTH, 1,
+                    GL_RED_INTEGER, GL_UNSIGNED_SHORT, raw->codebook);
+  }
+
+  /* indexed textures are decoded without their palette */
+  if ((raw->layout == RAW_PAL4 || raw->layout == RAW_PAL8) &&
+      raw->format != RAW_INDEX8) {
+    CHECK_LE(raw->num_palette_entries, DECODE_PALETTE_WIDTH);
+    glActiveTexture(GL_TEXTURE0 + MAP_PALETTE);
+    glBindTexture(GL_TEXTURE_2D, r->decode_palette);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, raw->num_palette_entries, 1,
+                    GL_RED_INTEGER, GL_UNSIGNED_INT, raw->palette);
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+}
+
+static void r_decode_texture(struct render_backend *r, struct texture *tex,
+                             const struct raw_texture *raw) {
+  r_upload_decode_data(r, raw);
+
+  /* decode the texture by drawing over all of it. the state changed here is
+     all reset by the next surface drawn, other than the framebuffer and
+     viewport which are restored */
+  GLint prev_fbo;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, r->decode_fbo);
+  if (tex->array) {
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              tex->texture, 0, tex->layer);
+  } else {
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex->texture,
+                         0);
+  }
+  GLenum buffers[] = {GL_COLOR_ATTACHMENT0};
+  glDrawBuffers(ARRAY_SIZE(buffers), buffers);
+
+  glViewport(0, 0, raw->width, raw->height);
+  glDisable(GL_SCISSOR_TEST);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
+  glDepthMask(0);
+
+  struct shader_program *program = &r->decode_program;
+  glUseProgram(program->prog);
+  glUniform4i(program->loc[UNIFORM_LAYOUT], raw->layout, raw->format,
+              raw->width, raw->height);
+  glUniform1i(program->loc[UNIFORM_STRIDE], raw->stride);
+
+  glBindVertexArray(r->decode_vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+  glViewport(r->viewport.x, r->viewport.y, r->viewport.w, r->viewport.h);
+}
+
+texture_handle_t r_create_indexed_texture(struct render_backend *r,
+                                          const struct raw_texture *raw,
+                                          int palette_base,
+                                          enum filter_mode filter,
+                                          enum wrap_mode wrap_u,
+                                          enum wrap_mode wrap_v) {
+  CHECK(raw->layout == RAW_PAL4 || raw->layout == RAW_PAL8);
+
+  /* the indices themselves are always sampled unfiltered */
+  texture_handle_t handle =
+      r_alloc_texture(r, FILTER_NEAREST, wrap_u, wrap_v, 0);
+  struct texture *tex = &r->textures[handle];
+  tex->indexed = 1;
+  tex->palette_base = palette_base;
+  tex->bilinear = filter == FILTER_BILINEAR;
+
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, raw->width, raw->height, 0, GL_RED,
+               GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  struct raw_texture indices = *raw;
+  indices.format = RAW_INDEX8;
+  r_decode_texture(r, tex, &indices);
+
+  return handle;
+}
+
+texture_handle_t r_create_raw_texture(struct render_backend *r,
+                                      const struct raw_texture *raw,
+                                      enum filter_mode filter,
+                                      enum wrap_mode wrap_u,
+                                      enum wrap_mode wrap_v, int mipmaps) {
+  if (OPTION_texture_arrays && !mipmaps &&
+      raw->width <= TEXTURE_ARRAY_MAX_SIZE &&
+      raw->height <= TEXTURE_ARRAY_MAX_SIZE) {
+    texture_handle_t handle = r_alloc_array_texture(
+        r, raw->width, raw->height, filter, wrap_u, wrap_v);
+
+    if (handle) {
+      r_decode_texture(r, &r->textures[handle], raw);
+      return handle;
+    }
+  }
+
+  texture_handle_t handle = r_alloc_texture(r, filter, wrap_u, wrap_v, mipmaps);
+  struct texture *tex = &r->textures[handle];
+
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, raw->width, raw->height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  r_decode_texture(r, tex, raw);
+
+  if (mipmaps) {
+    glBindTexture(GL_TEXTURE_2D, tex->texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  return handle;
+}
+
+texture_handle_t r_create_texture(struct render_backend *r,
+                                  enum pxl_format format,
+                                  enum filter_mode filter,
+                                  enum wrap_mode wrap_u, enum wrap_mode wrap_v,
+                                  int mipmaps, int width, int height,
+                                  const uint8_t *buffer) {
+  texture_handle_t handle = r_alloc_texture(r, filter, wrap_u, wrap_v, mipmaps);
+
+  GLuint internal_fmt = internal_formats[format];
+  GLuint fmt = formats[format];
+  GLuint pixel_fmt = pixel_formats[format];
+
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_fmt, width, height, 0, fmt,
                pixel_fmt, buffer);
 
   if (mipmaps) {
@@ -745,6 +2514,47 @@ texture_handle_t r_create_texture(struct render_backend *r,
   return handle;
 }
 
+int r_oit_supported(struct render_backend *r) {
+  return r->oit_supported;
+}
+
+int r_compressed_format_supported(struct render_backend *r,
+                                  enum compressed_format format) {
+  return r->compressed_formats[format];
+}
+
+texture_handle_t r_create_compressed_texture(
+    struct render_backend *r, const struct compressed_texture *compressed,
+    enum filter_mode filter, enum wrap_mode wrap_u, enum wrap_mode wrap_v) {
+  CHECK(r->compressed_formats[compressed->format]);
+
+  int mipmaps = compressed->num_levels > 1;
+  texture_handle_t handle = r_alloc_texture(r, filter, wrap_u, wrap_v, mipmaps);
+
+  GLenum internal_fmt = compressed_formats[compressed->format];
+  const uint8_t *data = compressed->data;
+  int width = compressed->width;
+  int height = compressed->height;
+
+  /* mipmaps are provided rather than generated, which may not go all the way
+     down to a single texel */
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                  compressed->num_levels - 1);
+
+  for (int i = 0; i < compressed->num_levels; i++) {
+    int size = compressed_level_size(compressed->format, width, height);
+    glCompressedTexImage2D(GL_TEXTURE_2D, i, internal_fmt, width, height, 0,
+                           size, data);
+    data += size;
+    width = MAX(width / 2, 1);
+    height = MAX(height / 2, 1);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  return handle;
+}
+
 int r_height(struct render_backend *r) {
   return r->height;
 }
@@ -754,6 +2564,7 @@ int r_width(struct render_backend *r) {
 }
 
 void r_destroy(struct render_backend *r) {
+  r_destroy_timers(r);
   r_destroy_vertex_arrays(r);
   r_destroy_shaders(r);
   r_destroy_textures(r);
@@ -770,6 +2581,7 @@ struct render_backend *r_create(int width, int height) {
   r_create_textures(r);
   r_create_shaders(r);
   r_create_vertex_arrays(r);
+  r_create_timers(r);
   r_set_initial_state(r);
 
   return r;
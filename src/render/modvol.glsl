@@ -0,0 +1,16 @@
+static const char *modvol_vp =
+"void main() {\n"
+"  // a single triangle covering the entire viewport\n"
+"  vec2 xy = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+"  gl_Position = vec4(xy * 2.0 - 1.0, 0.0, 1.0);\n"
+"}";
+
+static const char *modvol_fp =
+"uniform mediump float u_shadow_scale;\n"
+
+"layout(location = 0) out mediump vec4 fragcolor;\n"
+
+"void main() {\n"
+"  // multiplied with the color of each shadowed pixel by the blend\n"
+"  fragcolor = vec4(vec3(u_shadow_scale), 1.0);\n"
+"}";
@@ -0,0 +1,23 @@
+static const char *oit_vp =
+"void main() {\n"
+"  // a single triangle covering the entire viewport\n"
+"  vec2 xy = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+"  gl_Position = vec4(xy * 2.0 - 1.0, 0.0, 1.0);\n"
+"}";
+
+static const char *oit_fp =
+"uniform highp sampler2D u_accum;\n"
+"uniform highp sampler2D u_weight;\n"
+
+"layout(location = 0) out mediump vec4 fragcolor;\n"
+
+"void main() {\n"
+"  highp ivec2 pos = ivec2(gl_FragCoord.xy);\n"
+"  highp vec4 accum = texelFetch(u_accum, pos, 0);\n"
+"  highp float weight = texelFetch(u_weight, pos, 0).r;\n"
+
+"  // the accumulated color is normalized by the accumulated weights, and\n"
+"  // blended over what's behind it by the product of each surface's\n"
+"  // transparency held in the accumulated alpha\n"
+"  fragcolor = vec4(accum.rgb / max(weight, 0.00001), 1.0 - accum.a);\n"
+"}";
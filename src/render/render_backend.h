@@ -8,6 +8,9 @@ struct host;
 /* note, this can't be larger than the width of ta_surface's texture param */
 #define MAX_TEXTURES (1 << 13)
 
+/* entries in the palette indexed textures look up their colors in */
+#define PALETTE_NUM_ENTRIES 1024
+
 typedef int texture_handle_t;
 
 enum pxl_format {
@@ -18,6 +21,34 @@ enum pxl_format {
   PXL_RGBA4444,
 };
 
+/* layouts of raw textures, decoded by the backend itself */
+enum raw_layout {
+  RAW_BITMAP,
+  RAW_TWIDDLED,
+  RAW_VQ,
+  RAW_PAL4,
+  RAW_PAL8,
+};
+
+/* packed texel formats of raw textures, with alpha in the high bits */
+enum raw_format {
+  RAW_ARGB1555,
+  RAW_RGB565,
+  RAW_ARGB4444,
+  RAW_ARGB8888,
+  /* palette indices, decoded into indexed textures as is */
+  RAW_INDEX8,
+};
+
+/* block compressed formats, each block covering 4x4 texels */
+enum compressed_format {
+  COMPRESSED_BC1,
+  COMPRESSED_BC3,
+  COMPRESSED_BC7,
+  COMPRESSED_ASTC_4X4,
+  NUM_COMPRESSED_FORMATS,
+};
+
 enum filter_mode {
   FILTER_NEAREST,
   FILTER_BILINEAR,
@@ -72,6 +103,14 @@ enum shade_mode {
 enum prim_type {
   PRIM_TRIANGLES,
   PRIM_LINES,
+  PRIM_TRIANGLE_STRIP,
+};
+
+/* which side of a modifier volume the pixels it shadows are on */
+enum volume_mode {
+  VOLUME_NONE,
+  VOLUME_INSIDE,
+  VOLUME_OUTSIDE,
 };
 
 struct ta_vertex {
@@ -81,6 +120,16 @@ struct ta_vertex {
   uint32_t offset_color;
 };
 
+/* layout ta vertices are uploaded in when each of their uvs fits in the upper
+   16 bits of a float, as those of 16-bit uv vertices do. the uvs are stored as
+   just those bits */
+struct ta_compact_vertex {
+  float xyz[3];
+  uint16_t uv[2];
+  uint32_t color;
+  uint32_t offset_color;
+};
+
 struct ta_surface {
   union {
     uint64_t full;
@@ -99,7 +148,9 @@ struct ta_surface {
       uint64_t alpha_test : 1;
       uint64_t alpha_ref : 8;
       uint64_t debug_depth : 1;
-      uint64_t : 19;
+      uint64_t shadow : 1;
+      uint64_t volume : 2;
+      uint64_t : 16;
     };
   } params;
 
@@ -109,6 +160,11 @@ struct ta_surface {
   /* first vertex's offset from start of original tristrip, used to control
      winding order when generating indices */
   int strip_offset;
+
+  /* once indices are generated, first_vert and num_verts refer to the range of
+     indices drawn with prim_type. strips are separated by the maximum index
+     of the index size, each starting a new strip */
+  enum prim_type prim_type;
 };
 
 struct ui_vertex {
@@ -117,6 +173,17 @@ struct ui_vertex {
   uint32_t color;
 };
 
+/* passes whose gpu time is measured, reported through the gpu_*_ns counters
+   once the results are available, a few frames after the pass was drawn */
+enum gpu_pass {
+  GPU_PASS_OPAQUE,
+  GPU_PASS_PUNCH_THROUGH,
+  GPU_PASS_TRANSLUCENT,
+  GPU_PASS_PIXELS,
+  GPU_PASS_UI,
+  NUM_GPU_PASSES,
+};
+
 struct ui_surface {
   enum prim_type prim_type;
   texture_handle_t texture;
@@ -129,6 +196,45 @@ struct ui_surface {
   int num_verts;
 };
 
+/* twiddled textures are laid out as square blocks the size of their shorter
+   side, each block's texels being stored in a reverse N order. vq textures
+   index a codebook of 2x2 twiddled texels, and paletted textures index a
+   palette of 32-bit entries */
+struct raw_texture {
+  enum raw_layout layout;
+  enum raw_format format;
+  int width;
+  int height;
+
+  /* row length in texels of bitmap textures */
+  int stride;
+
+  /* texels, or indices for vq and paletted textures */
+  const uint8_t *data;
+  int size;
+
+  const uint8_t *codebook;
+  const uint8_t *palette;
+  int num_palette_entries;
+};
+
+/* block compressed texture, with each mip level following the one before it,
+   halving in size down to a single texel */
+struct compressed_texture {
+  enum compressed_format format;
+  int width;
+  int height;
+  int num_levels;
+  const uint8_t *data;
+  int size;
+};
+
+static inline int compressed_level_size(enum compressed_format format,
+                                        int width, int height) {
+  int block_size = format == COMPRESSED_BC1 ? 8 : 16;
+  return ((width + 3) / 4) * ((height + 3) / 4) * block_size;
+}
+
 struct render_backend;
 
 struct render_backend *r_create(int width, int height);
@@ -143,19 +249,78 @@ texture_handle_t r_create_texture(struct render_backend *r,
                                   enum wrap_mode wrap_u, enum wrap_mode wrap_v,
                                   int mipmaps, int width, int height,
                                   const uint8_t *buffer);
+texture_handle_t r_create_raw_texture(struct render_backend *r,
+                                      const struct raw_texture *raw,
+                                      enum filter_mode filter,
+                                      enum wrap_mode wrap_u,
+                                      enum wrap_mode wrap_v, int mipmaps);
+/* indexed textures hold the palette indices of a paletted raw texture, their
+   colors being looked up in the palette when drawn, starting at palette_base.
+   bilinear filtering is done on the colors looked up */
+texture_handle_t r_create_indexed_texture(struct render_backend *r,
+                                          const struct raw_texture *raw,
+                                          int palette_base,
+                                          enum filter_mode filter,
+                                          enum wrap_mode wrap_u,
+                                          enum wrap_mode wrap_v);
+int r_compressed_format_supported(struct render_backend *r,
+                                  enum compressed_format format);
+texture_handle_t r_create_compressed_texture(
+    struct render_backend *r, const struct compressed_texture *compressed,
+    enum filter_mode filter, enum wrap_mode wrap_u, enum wrap_mode wrap_v);
 void r_destroy_texture(struct render_backend *r, texture_handle_t handle);
+/* returns nonzero if the texture is packed into an array, the same value for
+   each texture in the array, along with the layer the texture is at */
+int r_texture_array(struct render_backend *r, texture_handle_t handle,
+                    int *layer);
 
 void r_clear(struct render_backend *r);
 void r_viewport(struct render_backend *r, int x, int y, int width, int height);
 
+/* pixels are 32-bit rgbx */
 void r_draw_pixels(struct render_backend *r, const uint8_t *pixels, int x,
                    int y, int width, int height);
 
+/* starts reading back the viewport without waiting on the gpu, returning 0
+   if every readback buffer is still in use. the oldest readback is mapped
+   once the gpu has finished it, or is waited on if wait is set, returning
+   null if it isn't ready. its pixels are 32-bit bgrx, bottom row first, and
+   stay mapped until it's unmapped */
+int r_queue_readback(struct render_backend *r);
+const uint8_t *r_map_readback(struct render_backend *r, int wait, int *width,
+                              int *height);
+void r_unmap_readback(struct render_backend *r);
+
+/* palette of PALETTE_NUM_ENTRIES entries, each holding a texel of format */
+void r_upload_palette(struct render_backend *r, const uint32_t *palette,
+                      enum raw_format format);
+
+/* when compact is set, the verts are uploaded as ta_compact_vertex */
 void r_begin_ta_surfaces(struct render_backend *r, int video_width,
                          int video_height, const struct ta_vertex *verts,
-                         int num_verts, const uint16_t *indices,
-                         int num_indices);
+                         int num_verts, int compact, const void *indices,
+                         int num_indices, int index_size);
+/* surfaces drawn in between are rendered offscreen at width x height, and
+   scaled into the viewport at the end */
+void r_begin_ta_target(struct render_backend *r, int width, int height);
+void r_end_ta_target(struct render_backend *r);
+void r_begin_ta_pass(struct render_backend *r, enum gpu_pass pass);
+/* surfaces drawn in between are blended order independently, and must all be
+   alpha blended. they're composited over the framebuffer at the end */
+int r_oit_supported(struct render_backend *r);
+void r_begin_ta_oit(struct render_backend *r);
+void r_end_ta_oit(struct render_backend *r);
 void r_draw_ta_surface(struct render_backend *r, const struct ta_surface *surf);
+/* surfaces drawn after beginning shadows with their shadow param set have
+   their pixels darkened by scale where they end up inside of the modifier
+   volumes drawn afterwards. returns 0 if the framebuffer has no stencil
+   buffer to track them with */
+int r_begin_ta_shadows(struct render_backend *r);
+void r_begin_ta_modvols(struct render_backend *r);
+/* the surface's verts are drawn unindexed as a closed volume of triangles,
+   the side of which is shadowed being given by its volume param */
+void r_draw_ta_modvol(struct render_backend *r, const struct ta_surface *surf);
+void r_end_ta_modvols(struct render_backend *r, float scale);
 void r_end_ta_surfaces(struct render_backend *r);
 
 void r_begin_ui_surfaces(struct render_backend *r,
@@ -1,5 +1,6 @@
 static const char *ta_vp =
 "uniform vec4 u_video_scale;\n"
+"uniform int u_compact;\n"
 
 "layout(location = 0) in vec3 attr_xyz;\n"
 "layout(location = 1) in vec2 attr_texcoord;\n"
@@ -15,6 +16,11 @@ static const char *ta_vp =
 "  var_offset_color = attr_offset_color;\n"
 "  var_texcoord = attr_texcoord;\n"
 
+"  // compact vertices supply only the upper 16 bits of each uv\n"
+"  if (u_compact != 0) {\n"
+"    var_texcoord = uintBitsToFloat(uvec2(attr_texcoord) << 16u);\n"
+"  }\n"
+
 "  // the z coordinate is actually 1/w, convert to w. note, there is no\n"
 "  // actual z coordinate provided to the ta, just this\n"
 "  highp float w = 1.0 / attr_xyz.z;\n"
@@ -44,6 +50,7 @@ static const char *ta_vp =
 
 static const char *ta_fp =
 "uniform sampler2D u_diffuse;\n"
+"uniform mediump sampler2DArray u_diffuse_array;\n"
 "uniform mediump float u_alpha_ref;\n"
 
 "in mediump vec4 var_color;\n"
@@ -51,46 +58,118 @@ static const char *ta_fp =
 "in mediump vec2 var_texcoord;\n"
 
 "layout(location = 0) out mediump vec4 fragcolor;\n"
+"#ifdef OIT\n"
+"layout(location = 1) out mediump vec4 fragweight;\n"
+"#endif\n"
+
+"// specialized programs define ATTRS as the constant set of attributes they\n"
+"// were compiled for, letting the compiler strip the branches on them. the\n"
+"// ubershader instead branches on the attributes of each surface at runtime\n"
+"#ifdef UBER\n"
+"uniform int u_attrs;\n"
+"#define ATTRS u_attrs\n"
+"#endif\n"
+"#define HAS(attr) ((ATTRS & (attr)) != 0)\n"
+
+"#ifdef PALETTE\n"
+"uniform highp usampler2D u_palette;\n"
+
+"// palette base, format and whether or not to filter bilinearly\n"
+"uniform highp ivec4 u_palette_info;\n"
+
+"// channels are extended to 8 bits the same as when decoding textures\n"
+"mediump vec4 unpack(highp uint v) {\n"
+"  highp uvec4 c;\n"
+"  if (u_palette_info.y == RAW_ARGB1555) {\n"
+"    c = uvec4((v >> 10u) & 31u, (v >> 5u) & 31u, v & 31u, 0u);\n"
+"    c = (c << 3u) | (c >> 2u);\n"
+"    c.a = (v & 0x8000u) != 0u ? 255u : 0u;\n"
+"  } else if (u_palette_info.y == RAW_RGB565) {\n"
+"    c = uvec4((v >> 11u) & 31u, (v >> 5u) & 63u, v & 31u, 255u);\n"
+"    c.rb = (c.rb << 3u) | (c.rb >> 2u);\n"
+"    c.g = (c.g << 2u) | (c.g >> 4u);\n"
+"  } else if (u_palette_info.y == RAW_ARGB4444) {\n"
+"    c = uvec4((v >> 8u) & 15u, (v >> 4u) & 15u, v & 15u, (v >> 12u) & 15u);\n"
+"    c = (c << 4u) | c;\n"
+"  } else {\n"
+"    c = uvec4((v >> 16u) & 255u, (v >> 8u) & 255u, v & 255u, v >> 24u);\n"
+"  }\n"
+"  return vec4(c) / 255.0;\n"
+"}\n"
+
+"mediump vec4 lookup(highp vec2 uv) {\n"
+"  highp uint idx = uint(texture(u_diffuse, uv).r * 255.0 + 0.5);\n"
+"  highp ivec2 pos = ivec2(u_palette_info.x + int(idx), 0);\n"
+"  return unpack(texelFetch(u_palette, pos, 0).r);\n"
+"}\n"
+
+"// the indices are sampled unfiltered, with the colors they look up being\n"
+"// filtered instead\n"
+"mediump vec4 sample_palette(highp vec2 uv) {\n"
+"  if (u_palette_info.z == 0) {\n"
+"    return lookup(uv);\n"
+"  }\n"
+"  highp vec2 size = vec2(textureSize(u_diffuse, 0));\n"
+"  highp vec2 pos = uv * size - 0.5;\n"
+"  highp vec2 f = fract(pos);\n"
+"  highp vec2 st = (floor(pos) + 0.5) / size;\n"
+"  highp vec2 dx = vec2(1.0 / size.x, 0.0);\n"
+"  highp vec2 dy = vec2(0.0, 1.0 / size.y);\n"
+"  mediump vec4 top = mix(lookup(st), lookup(st + dx), f.x);\n"
+"  mediump vec4 bottom = mix(lookup(st + dy), lookup(st + dx + dy), f.x);\n"
+"  return mix(top, bottom, f.y);\n"
+"}\n"
+"#endif\n"
 
 "void main() {\n"
 "  mediump vec4 col = var_color;\n"
-"  #ifdef IGNORE_ALPHA\n"
+"  if (HAS(ATTR_IGNORE_ALPHA)) {\n"
 "    col.a = 1.0;\n"
-"  #endif\n"
-"  #ifdef TEXTURE\n"
-"    mediump vec4 tex = texture(u_diffuse, var_texcoord);\n"
-"    #ifdef IGNORE_TEXTURE_ALPHA\n"
-"      tex.a = 1.0;\n"
-"    #endif\n"
-"    #ifdef ALPHA_TEST\n"
-"      if (tex.a < u_alpha_ref)\n"
-"        discard;\n"
+"  }\n"
+"  if (HAS(ATTR_TEXTURE)) {\n"
+"    mediump vec4 tex;\n"
+"    if (HAS(ATTR_ARRAY)) {\n"
+"      // the layer of textures packed into an array is passed in the offset\n"
+"      // color's alpha, which is otherwise unused\n"
+"      highp float layer = var_offset_color.a * 255.0;\n"
+"      tex = texture(u_diffuse_array, vec3(var_texcoord, layer));\n"
+"    } else {\n"
+"      tex = texture(u_diffuse, var_texcoord);\n"
+"    }\n"
+"    #ifdef PALETTE\n"
+"    if (HAS(ATTR_PALETTE)) {\n"
+"      tex = sample_palette(var_texcoord);\n"
+"    }\n"
 "    #endif\n"
-"    #ifdef SHADE_DECAL\n"
+"    if (HAS(ATTR_IGNORE_TEXTURE_ALPHA)) {\n"
+"      tex.a = 1.0;\n"
+"    }\n"
+"    if (HAS(ATTR_ALPHA_TEST) && tex.a < u_alpha_ref) {\n"
+"      discard;\n"
+"    }\n"
+"    int shade = ATTRS & ATTR_SHADE_MASK;\n"
+"    if (shade == ATTR_SHADE_DECAL) {\n"
 "      fragcolor = tex;\n"
-"    #endif\n"
-"    #ifdef SHADE_MODULATE\n"
+"    } else if (shade == ATTR_SHADE_MODULATE) {\n"
 "      fragcolor.rgb = tex.rgb * col.rgb;\n"
 "      fragcolor.a = tex.a;\n"
-"    #endif\n"
-"    #ifdef SHADE_DECAL_ALPHA\n"
-"      fragcolor.rgb = tex.rgb * tex.a + col.rgb * (1 - tex.a);\n"
+"    } else if (shade == ATTR_SHADE_DECAL_ALPHA) {\n"
+"      fragcolor.rgb = tex.rgb * tex.a + col.rgb * (1.0 - tex.a);\n"
 "      fragcolor.a = col.a;\n"
-"    #endif\n"
-"    #ifdef SHADE_MODULATE_ALPHA\n"
+"    } else {\n"
 "      fragcolor = tex * col;\n"
-"    #endif\n"
-"  #else\n"
+"    }\n"
+"  } else {\n"
 "    fragcolor = col;\n"
-"  #endif\n"
-"  #ifdef OFFSET_COLOR\n"
+"  }\n"
+"  if (HAS(ATTR_OFFSET_COLOR)) {\n"
 "    fragcolor.rgb += var_offset_color.rgb;\n"
-"  #endif\n"
+"  }\n"
 
-"  #ifdef ALPHA_TEST\n"
+"  if (HAS(ATTR_ALPHA_TEST)) {\n"
 "    // punch through polys are always drawn with an alpha value of 1.0\n"
-"    fragcolor.a = 1.0f;\n"
-"  #endif\n"
+"    fragcolor.a = 1.0;\n"
+"  }\n"
 
 "  // gl_FragCoord.w is 1/clip.w aka the original 1/w passed to the TA,\n"
 "  // interpolated in screen space. this value is normally between [0,1],\n"
@@ -112,7 +191,17 @@ static const char *ta_fp =
 "  highp float w = 1.0 / gl_FragCoord.w;\n"
 "  gl_FragDepth = log2(1.0 + w) / 17.0;\n"
 
-"  #ifdef DEBUG_DEPTH_BUFFER\n"
+"  if (HAS(ATTR_DEBUG_DEPTH_BUFFER)) {\n"
 "    fragcolor.rgb = vec3(gl_FragDepth);\n"
+"  }\n"
+
+"  #ifdef OIT\n"
+"    // weighted blended order independent transparency. the color is\n"
+"    // accumulated weighted by its alpha and a weight falling off with\n"
+"    // depth, with alpha being blended as the product of 1 - alpha\n"
+"    highp float weight = fragcolor.a *\n"
+"        clamp(3000.0 * pow(1.0 - gl_FragDepth, 3.0), 0.01, 3000.0);\n"
+"    fragweight = vec4(weight, 0.0, 0.0, 0.0);\n"
+"    fragcolor = vec4(fragcolor.rgb * weight, fragcolor.a);\n"
 "  #endif\n"
 "}";
@@ -1,10 +1,124 @@
 #include "stats.h"
+#include "core/core.h"
+#include "core/sort.h"
+#include "core/time.h"
+#include "guest/reg_stats.h"
+#include "options.h"
+
+/* registers written out with each line when counting register accesses */
+#define STATS_MAX_REGS 32
+
+/* frame times recorded per second, any beyond this are dropped */
+#define STATS_MAX_FRAMES 1024
+
+struct stats_sink {
+  FILE *fp;
+  int64_t start;
+  int64_t last_frame;
+  int64_t last_write;
+  int64_t frames[STATS_MAX_FRAMES];
+  int num_frames;
+};
 
 DEFINE_AGGREGATE_COUNTER(frames);
+DEFINE_AGGREGATE_COUNTER(frames_skipped);
 DEFINE_AGGREGATE_COUNTER(aica_samples);
+DEFINE_COUNTER(aica_voices);
 DEFINE_AGGREGATE_COUNTER(arm7_instrs);
 DEFINE_AGGREGATE_COUNTER(pvr_vblanks);
 DEFINE_AGGREGATE_COUNTER(ta_renders);
 DEFINE_AGGREGATE_COUNTER(sh4_instrs);
 DEFINE_AGGREGATE_COUNTER(mmio_read);
 DEFINE_AGGREGATE_COUNTER(mmio_write);
+DEFINE_AGGREGATE_COUNTER(sched_ns);
+DEFINE_AGGREGATE_COUNTER(sched_other_ns);
+DEFINE_COUNTER(texture_bytes);
+DEFINE_AGGREGATE_COUNTER(texture_evictions);
+DEFINE_AGGREGATE_COUNTER(texture_reuploads);
+DEFINE_AGGREGATE_COUNTER(culled_tris);
+DEFINE_AGGREGATE_COUNTER(gpu_opaque_ns);
+DEFINE_AGGREGATE_COUNTER(gpu_punch_through_ns);
+DEFINE_AGGREGATE_COUNTER(gpu_translucent_ns);
+DEFINE_AGGREGATE_COUNTER(gpu_pixels_ns);
+DEFINE_AGGREGATE_COUNTER(gpu_ui_ns);
+DEFINE_AGGREGATE_COUNTER(gpu_draws);
+DEFINE_AGGREGATE_COUNTER(gpu_state_changes);
+DEFINE_AGGREGATE_COUNTER(gpu_upload_bytes);
+DEFINE_AGGREGATE_COUNTER(audio_underruns);
+DEFINE_AGGREGATE_COUNTER(jit_compiles);
+DEFINE_AGGREGATE_COUNTER(jit_compile_ns);
+DEFINE_AGGREGATE_COUNTER(pacer_sleep_ns);
+DEFINE_AGGREGATE_COUNTER(pacer_overshoot_ns);
+
+static int stats_frame_cmp(const void *a, const void *b) {
+  return *(const int64_t *)a <= *(const int64_t *)b;
+}
+
+static double stats_percentile(struct stats_sink *sink, int pct) {
+  if (!sink->num_frames) {
+    return 0.0;
+  }
+
+  int i = MIN(sink->num_frames * pct / 100, sink->num_frames - 1);
+  return sink->frames[i] / (double)NS_PER_MS;
+}
+
+static void stats_sink_write(struct stats_sink *sink, struct reg_stats *rs,
+                             int64_t now) {
+  msort(sink->frames, sink->num_frames, sizeof(int64_t), &stats_frame_cmp);
+
+  fprintf(sink->fp, "{\"time\":%.3f,\"counters\":{",
+          (now - sink->start) / (double)NS_PER_SEC);
+  prof_write_counters(sink->fp);
+  fprintf(sink->fp,
+          "},\"frame_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,"
+          "\"max\":%.3f}",
+          stats_percentile(sink, 50), stats_percentile(sink, 90),
+          stats_percentile(sink, 99), stats_percentile(sink, 100));
+
+  /* the register counts are running totals rather than per second */
+  if (OPTION_reg_stats) {
+    fprintf(sink->fp, ",\"regs\":[");
+    reg_stats_write(rs, sink->fp, STATS_MAX_REGS);
+    fprintf(sink->fp, "]");
+  }
+
+  fprintf(sink->fp, "}\n");
+
+  /* flush each line for the file to be tailed while running */
+  fflush(sink->fp);
+
+  sink->num_frames = 0;
+  sink->last_write = now;
+}
+
+void stats_sink_frame(struct stats_sink *sink, struct reg_stats *rs,
+                      int64_t now) {
+  if (sink->last_frame && sink->num_frames < STATS_MAX_FRAMES) {
+    sink->frames[sink->num_frames++] = now - sink->last_frame;
+  }
+  sink->last_frame = now;
+
+  if (now - sink->last_write >= NS_PER_SEC) {
+    stats_sink_write(sink, rs, now);
+  }
+}
+
+void stats_sink_destroy(struct stats_sink *sink) {
+  fclose(sink->fp);
+  free(sink);
+}
+
+struct stats_sink *stats_sink_create(const char *path) {
+  FILE *fp = fopen(path, "a");
+  if (!fp) {
+    return NULL;
+  }
+
+  struct stats_sink *sink = calloc(1, sizeof(struct stats_sink));
+  sink->fp = fp;
+  sink->start = time_nanoseconds();
+  sink->last_write = sink->start;
+
+  return sink;
+}
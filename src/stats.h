@@ -4,12 +4,48 @@
 #include "core/profiler.h"
 
 DECLARE_COUNTER(frames);
+DECLARE_COUNTER(frames_skipped);
 DECLARE_COUNTER(aica_samples);
+DECLARE_COUNTER(aica_voices);
 DECLARE_COUNTER(arm7_instrs);
 DECLARE_COUNTER(pvr_vblanks);
 DECLARE_COUNTER(ta_renders);
 DECLARE_COUNTER(sh4_instrs);
 DECLARE_COUNTER(mmio_read);
 DECLARE_COUNTER(mmio_write);
+DECLARE_COUNTER(sched_ns);
+DECLARE_COUNTER(sched_other_ns);
+DECLARE_COUNTER(texture_bytes);
+DECLARE_COUNTER(texture_evictions);
+DECLARE_COUNTER(texture_reuploads);
+DECLARE_COUNTER(culled_tris);
+DECLARE_COUNTER(gpu_opaque_ns);
+DECLARE_COUNTER(gpu_punch_through_ns);
+DECLARE_COUNTER(gpu_translucent_ns);
+DECLARE_COUNTER(gpu_pixels_ns);
+DECLARE_COUNTER(gpu_ui_ns);
+DECLARE_COUNTER(gpu_draws);
+DECLARE_COUNTER(gpu_state_changes);
+DECLARE_COUNTER(gpu_upload_bytes);
+DECLARE_COUNTER(audio_underruns);
+DECLARE_COUNTER(jit_compiles);
+DECLARE_COUNTER(jit_compile_ns);
+DECLARE_COUNTER(pacer_sleep_ns);
+DECLARE_COUNTER(pacer_overshoot_ns);
+
+/* appends a json line to a file once per second, holding every counter along
+   with the percentiles of the host's frame times over that second, for
+   performance to be tracked outside of the debug overlay */
+struct stats_sink;
+struct reg_stats;
+
+struct stats_sink *stats_sink_create(const char *path);
+void stats_sink_destroy(struct stats_sink *sink);
+
+/* called at the end of each host frame, after the profiler has been flipped.
+   rs is the running machine's register stats, written out with each line
+   while OPTION_reg_stats is set */
+void stats_sink_frame(struct stats_sink *sink, struct reg_stats *rs,
+                      int64_t now);
 
 #endif
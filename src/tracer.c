@@ -9,6 +9,9 @@
 
 #define SCRUBBER_WINDOW_HEIGHT 20.0f
 
+/* converted contexts kept around for scrubbing back and forth through them */
+#define TRACER_MAX_CONTEXTS 8
+
 static const char *param_names[] = {
     "TA_PARAM_END_OF_LIST", "TA_PARAM_USER_TILE_CLIP", "TA_PARAM_OBJ_LIST_SET",
     "TA_PARAM_RESERVED0",   "TA_PARAM_POLY_OR_VOL",    "TA_PARAM_SPRITE",
@@ -88,28 +91,48 @@ static const struct ImVec4 zero_vec4 = {0.0f, 0.0f, 0.0f, 0.0f};
 
 struct tracer_texture {
   struct tr_texture;
+  /* insert the texture was last set from */
+  struct trace_cmd *cmd;
   struct rb_node live_it;
   struct list_node free_it;
 };
 
+/* a converted context, cached by the frame it was converted from. they
+   reference the handles of the textures live when converted, so are only
+   valid until one of those textures changes */
+struct tracer_context {
+  int frame;
+  int textures_gen;
+  struct tr_context rc;
+  struct list_node it;
+};
+
 struct tracer {
   struct host *host;
   struct render_backend *r;
+  struct tr_converter *cvt;
 
   /* trace state */
   struct trace *trace;
   struct ta_context ctx;
-  struct trace_cmd *current_cmd;
+  /* -1 until a frame's context has been loaded */
   int frame;
   int current_param;
   int scroll_to_param;
 
   /* render state */
-  struct tr_context rc;
   int debug_depth;
   struct tracer_texture textures[1024];
   struct rb_tree live_textures;
   struct list free_textures;
+
+  /* incremented each time a live texture changes */
+  int textures_gen;
+
+  /* context of the current frame, null until it's converted */
+  struct tr_context *rc;
+  struct tracer_context contexts[TRACER_MAX_CONTEXTS];
+  struct list lru_contexts;
 };
 
 static int tracer_texture_cmp(const struct rb_node *rb_lhs,
@@ -176,8 +199,7 @@ static struct tr_texture *tracer_find_texture(void *userdata, union tsp tsp,
   return (struct tr_texture *)tex;
 }
 
-static void tracer_add_texture(struct tracer *tracer,
-                               const struct trace_cmd *cmd) {
+static void tracer_add_texture(struct tracer *tracer, struct trace_cmd *cmd) {
   CHECK_EQ(cmd->type, TRACE_CMD_TEXTURE);
 
   struct tracer_texture *tex = (struct tracer_texture *)tracer_find_texture(
@@ -187,6 +209,16 @@ static void tracer_add_texture(struct tracer *tracer,
     tex = tracer_alloc_texture(tracer, cmd->texture.tsp, cmd->texture.tcw);
   }
 
+  /* nothing to do if the texture is already set from the insert */
+  if (tex->cmd == cmd) {
+    return;
+  }
+
+  trace_load_cmd(tracer->trace, cmd);
+
+  tracer->textures_gen++;
+
+  tex->cmd = cmd;
   tex->frame = cmd->texture.frame;
   tex->dirty = 1;
   tex->texture = cmd->texture.texture;
@@ -195,6 +227,53 @@ static void tracer_add_texture(struct tracer *tracer,
   tex->palette_size = cmd->texture.palette_size;
 }
 
+static void tracer_invalidate_contexts(struct tracer *tracer) {
+  for (int i = 0; i < TRACER_MAX_CONTEXTS; i++) {
+    tracer->contexts[i].frame = -1;
+  }
+
+  tracer->rc = NULL;
+}
+
+/* returns the converted context of the current frame, converting it only if
+   it isn't cached. the selected param only limits how much of the context is
+   rendered, so scrubbing through the params doesn't convert anything */
+static struct tr_context *tracer_convert_context(struct tracer *tracer) {
+  if (tracer->rc) {
+    return tracer->rc;
+  }
+
+  struct tracer_context *entry = NULL;
+
+  list_for_each_entry(cached, &tracer->lru_contexts, struct tracer_context,
+                      it) {
+    if (cached->frame >= 0 && cached->frame == tracer->frame &&
+        cached->textures_gen == tracer->textures_gen) {
+      entry = cached;
+      break;
+    }
+  }
+
+  /* convert into the least recently used entry on a miss */
+  if (!entry) {
+    entry =
+        list_first_entry(&tracer->lru_contexts, struct tracer_context, it);
+
+    tr_convert_context(tracer->cvt, tracer->r, tracer, &tracer_find_texture,
+                       &tracer->ctx, &entry->rc);
+
+    entry->frame = tracer->frame;
+    entry->textures_gen = tracer->textures_gen;
+  }
+
+  list_remove(&tracer->lru_contexts, &entry->it);
+  list_add(&tracer->lru_contexts, &entry->it);
+
+  tracer->rc = &entry->rc;
+
+  return tracer->rc;
+}
+
 static void tracer_prev_param(struct tracer *tracer) {
   int i = tracer->current_param;
 
@@ -206,95 +285,75 @@ static void tracer_prev_param(struct tracer *tracer) {
 }
 
 static void tracer_next_param(struct tracer *tracer) {
+  struct tr_context *rc = tracer_convert_context(tracer);
   int i = tracer->current_param;
 
-  while (++i < tracer->rc.num_params) {
+  while (++i < rc->num_params) {
     tracer->current_param = i;
     tracer->scroll_to_param = 1;
     break;
   }
 }
 
-static void tracer_prev_context(struct tracer *tracer) {
-  struct trace_cmd *begin = tracer->current_cmd->prev;
-
-  /* ensure that there is a prev context */
-  struct trace_cmd *prev = begin;
-
-  while (prev) {
-    if (prev->type == TRACE_CMD_CONTEXT) {
-      break;
-    }
-
-    prev = prev->prev;
-  }
+static void tracer_seek_context(struct tracer *tracer, int frame) {
+  struct trace *trace = tracer->trace;
 
-  if (!prev) {
+  if (frame < 0 || frame >= trace->num_frames || frame == tracer->frame) {
     return;
   }
 
-  /* walk back to the prev context, reverting any textures that've been added */
-  struct trace_cmd *curr = begin;
+  /* only the inserts between the two frames are visited, and of those only
+     the ones live at the new frame are loaded */
+  int from = tracer->frame >= 0 ? trace->frame_textures[tracer->frame] : 0;
+  int to = trace->frame_textures[frame];
 
-  while (curr != prev) {
-    if (curr->type == TRACE_CMD_TEXTURE) {
-      struct trace_cmd *override = curr->override;
+  if (from <= to) {
+    /* add the last insert of each texture made on the way to the frame */
+    for (int i = from; i < to; i++) {
+      struct trace_texture *tex = &trace->textures[i];
 
-      if (override) {
-        tracer_add_texture(tracer, override);
+      if (tex->next < 0 || tex->next >= to) {
+        tracer_add_texture(tracer, tex->cmd);
       }
     }
+  } else {
+    /* revert the textures inserted since the frame to the inserts live at
+       it, any first inserted since are left as is */
+    for (int i = to; i < from; i++) {
+      struct trace_texture *tex = &trace->textures[i];
 
-    curr = curr->prev;
+      if (tex->prev >= 0 && tex->prev < to) {
+        tracer_add_texture(tracer, trace->textures[tex->prev].cmd);
+      }
+    }
   }
 
-  tracer->frame = MAX(tracer->frame - 1, 0);
-  tracer->current_cmd = prev;
+  tracer->frame = frame;
   tracer->current_param = -1;
   tracer->scroll_to_param = 0;
-  trace_copy_context(tracer->current_cmd, &tracer->ctx);
+  tracer->rc = NULL;
+  trace_copy_context(trace, trace->frames[frame], &tracer->ctx);
 }
 
-static void tracer_next_context(struct tracer *tracer) {
-  struct trace_cmd *begin =
-      tracer->current_cmd ? tracer->current_cmd->next : tracer->trace->cmds;
-
-  /* ensure that there is a next context */
-  struct trace_cmd *next = begin;
-
-  while (next) {
-    if (next->type == TRACE_CMD_CONTEXT) {
-      break;
-    }
-
-    next = next->next;
-  }
-
-  if (!next) {
-    return;
-  }
-
-  /* walk towards to the next context, adding any new textures */
-  struct trace_cmd *curr = begin;
-
-  while (curr != next) {
-    if (curr->type == TRACE_CMD_TEXTURE) {
-      tracer_add_texture(tracer, curr);
-    }
-
-    curr = curr->next;
-  }
+static void tracer_prev_context(struct tracer *tracer) {
+  tracer_seek_context(tracer, tracer->frame - 1);
+}
 
-  tracer->frame = MIN(tracer->frame + 1, tracer->trace->num_frames - 1);
-  tracer->current_cmd = next;
-  tracer->current_param = -1;
-  tracer->scroll_to_param = 0;
-  trace_copy_context(tracer->current_cmd, &tracer->ctx);
+static void tracer_next_context(struct tracer *tracer) {
+  tracer_seek_context(tracer, tracer->frame + 1);
 }
 
 static void tracer_reset_context(struct tracer *tracer) {
-  tracer->current_cmd = NULL;
-  tracer_next_context(tracer);
+  /* the live textures were set from the previous trace's inserts */
+  rb_for_each_entry(tex, &tracer->live_textures, struct tracer_texture,
+                    live_it) {
+    tex->cmd = NULL;
+  }
+
+  tracer->textures_gen++;
+  tracer->frame = -1;
+  tracer_invalidate_contexts(tracer);
+  tracer_seek_context(tracer, 0);
 }
 
 static void tracer_render_debug_menu(struct tracer *tracer) {
@@ -325,17 +384,11 @@ static void tracer_render_scrubber_menu(struct tracer *tracer) {
   igSetWindowPos(pos, 0);
   igPushItemWidth(-1.0f);
 
-  int frame = tracer->frame;
+  int frame = MAX(tracer->frame, 0);
   int num_frames = tracer->trace->num_frames;
 
   if (igSliderInt("", &frame, 0, num_frames - 1, NULL)) {
-    while (tracer->frame != (int)frame) {
-      if (tracer->frame < (int)frame) {
-        tracer_next_context(tracer);
-      } else {
-        tracer_prev_context(tracer);
-      }
-    }
+    tracer_seek_context(tracer, frame);
   }
 
   igPopItemWidth();
@@ -485,7 +538,7 @@ static void tracer_param_tooltip(struct tracer *tracer, struct tr_param *rp) {
   /* always render translated surface information. new surfaces can be created
      without receiving a new TA_PARAM_POLY_OR_VOL / TA_PARAM_SPRITE */
   if (rp->last_surf >= 0) {
-    struct ta_surface *surf = &tracer->rc.surfs[rp->last_surf];
+    struct ta_surface *surf = &tracer->rc->surfs[rp->last_surf];
 
     igSeparator();
 
@@ -513,7 +566,7 @@ static void tracer_param_tooltip(struct tracer *tracer, struct tr_param *rp) {
 
   /* render translated vert only when rendering a vertex tooltip */
   if (rp->last_vert >= 0) {
-    struct ta_vertex *vert = &tracer->rc.verts[rp->last_vert];
+    struct ta_vertex *vert = &tracer->rc->verts[rp->last_vert];
 
     igSeparator();
 
@@ -529,6 +582,7 @@ static void tracer_param_tooltip(struct tracer *tracer, struct tr_param *rp) {
 
 static void tracer_render_side_menu(struct tracer *tracer) {
   struct ImGuiIO *io = igGetIO();
+  struct tr_context *rc = tracer_convert_context(tracer);
 
   char label[128];
 
@@ -540,8 +594,8 @@ static void tracer_render_side_menu(struct tracer *tracer) {
     igSetWindowPos(pos, ImGuiCond_Once);
 
     /* render params */
-    for (int i = 0; i < tracer->rc.num_params; i++) {
-      struct tr_param *rp = &tracer->rc.params[i];
+    for (int i = 0; i < rc->num_params; i++) {
+      struct tr_param *rp = &rc->params[i];
       union pcw pcw = *(const union pcw *)(tracer->ctx.params + rp->offset);
 
       int selected = (i == tracer->current_param);
@@ -652,7 +706,7 @@ static void tracer_render_side_menu(struct tracer *tracer) {
     int total_surfs = 0;
 
     for (int i = 0; i < TA_NUM_LISTS; i++) {
-      struct tr_list *list = &tracer->rc.lists[i];
+      struct tr_list *list = &rc->lists[i];
       igText(list_names[i]);
       igText("%d original surfaces", list->num_orig_surfs);
       igText("%d draw surfaces", list->num_surfs);
@@ -664,7 +718,8 @@ static void tracer_render_side_menu(struct tracer *tracer) {
 
     igText("%d total original surfaces", total_orig_surfs);
     igText("%d total draw surfaces", total_surfs);
-    igText("%.2f kb index buffer", (tracer->rc.num_indices * 2.0f) / 1024.0f);
+    igText("%.2f kb index buffer",
+           (rc->num_indices * rc->index_size) / 1024.0f);
 
     igEnd();
   }
@@ -678,8 +733,9 @@ void tracer_render_frame(struct tracer *tracer) {
   tracer_render_scrubber_menu(tracer);
   tracer_render_debug_menu(tracer);
 
-  /* render context up to the surface of the currently selected param */
-  struct tr_context *rc = &tracer->rc;
+  /* render context up to the surface of the currently selected param. the
+     scrubber may have moved to another frame since the menus were built */
+  struct tr_context *rc = tracer_convert_context(tracer);
   int end_surf = -1;
 
   if (tracer->current_param >= 0) {
@@ -687,9 +743,6 @@ void tracer_render_frame(struct tracer *tracer) {
     end_surf = rp->last_surf;
   }
 
-  tr_convert_context(tracer->r, tracer, &tracer_find_texture, &tracer->ctx,
-                     &tracer->rc);
-
   for (int i = 0; i < rc->num_surfs; i++) {
     struct ta_surface *surf = &rc->surfs[i];
     surf->params.debug_depth = tracer->debug_depth;
@@ -733,15 +786,16 @@ int tracer_keydown(struct tracer *tracer, int key, int16_t value) {
 void tracer_vid_destroyed(struct tracer *tracer) {
   rb_for_each_entry_safe(tex, &tracer->live_textures, struct tracer_texture,
                          live_it) {
-    r_destroy_texture(tracer->r, tex->handle);
-    tex->handle = 0;
+    tr_release_texture(tracer->cvt, tracer->r, (struct tr_texture *)tex);
   }
 
   tracer->r = NULL;
+  tracer_invalidate_contexts(tracer);
 }
 
 void tracer_vid_created(struct tracer *tracer, struct render_backend *r) {
   tracer->r = r;
+  tracer_invalidate_contexts(tracer);
 }
 
 void tracer_destroy(struct tracer *tracer) {
@@ -751,6 +805,12 @@ void tracer_destroy(struct tracer *tracer) {
 
   tracer_vid_destroyed(tracer);
 
+  for (int i = 0; i < TRACER_MAX_CONTEXTS; i++) {
+    tr_free_context(&tracer->contexts[i].rc);
+  }
+
+  tr_converter_destroy(tracer->cvt);
+  ta_free_context(&tracer->ctx);
   free(tracer);
 }
 
@@ -758,6 +818,7 @@ struct tracer *tracer_create(struct host *host) {
   struct tracer *tracer = calloc(1, sizeof(struct tracer));
 
   tracer->host = host;
+  tracer->cvt = tr_converter_create();
 
   /* add all textures to free list */
   for (int i = 0, n = ARRAY_SIZE(tracer->textures); i < n; i++) {
@@ -765,5 +826,13 @@ struct tracer *tracer_create(struct host *host) {
     list_add(&tracer->free_textures, &tex->free_it);
   }
 
+  for (int i = 0; i < TRACER_MAX_CONTEXTS; i++) {
+    struct tracer_context *entry = &tracer->contexts[i];
+    entry->frame = -1;
+    list_add(&tracer->lru_contexts, &entry->it);
+  }
+
+  tracer->frame = -1;
+
   return tracer;
 }
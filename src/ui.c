@@ -20,6 +20,8 @@ struct ui;
 #define UI_MAX_VOLUMES 32
 #define UI_MAX_ENTRIES 512
 #define UI_MAX_GAMEDIRS 32
+#define UI_SCAN_THREADS 4
+#define UI_LIBRARY_VERSION 1
 
 enum {
   UI_DLG_NEW,
@@ -46,6 +48,41 @@ struct game {
   char prodname[256];
   char prodmeta[256];
   texture_handle_t tex;
+
+  /* size and modification time of the file when it was last opened. files
+     unchanged since then are added from the library index */
+  int64_t size;
+  int64_t mtime;
+
+  /* did the file open as a disc. entries are kept for those that didn't as
+     well, so they aren't reopened on every scan */
+  int valid;
+
+  /* location of the cover art, 0GDTEX.PVR, with a length of 0 if the disc
+     has none */
+  int tex_fad;
+  int tex_len;
+};
+
+/* state for a single scan of the game directories. files whose entry in the
+   library index is stale are opened by a small pool of workers */
+struct scan {
+  struct ui *ui;
+
+  /* entries from the previous scan, sorted by filename */
+  struct game *index;
+  int num_index;
+
+  /* entries for the files found by this scan, written out as the new index
+     once it's finished */
+  struct game *files;
+  int num_files;
+
+  /* files which need to be opened, and the next one for a worker to take */
+  int *pending;
+  int num_pending;
+  int next_pending;
+  mutex_t mutex;
 };
 
 struct file_dlg {
@@ -129,7 +166,7 @@ static struct page pages[UI_NUM_PAGES];
 /* clang-format off */
 #define UI_STR_TAB_GAMES     "GAMES"
 #define UI_STR_TAB_OPTIONS   "OPTIONS"
-#define UI_STR_NO_GAMES      "Your game library is currently empty. Add a directory containing valid .cdi, .chd or .gdi image(s) to get started."
+#define UI_STR_NO_GAMES      "Your game library is currently empty. Add a directory containing valid .cdi, .chd, .gdi or .rdz image(s) to get started."
 #define UI_STR_GO_TO_LIBRARY "Go to Library"
 #define UI_STR_BTN_CANCEL    "Cancel"
 #define UI_STR_BTN_ADD       "Add"
@@ -464,7 +501,7 @@ static void ui_begin_page(struct ui *ui, struct page *page) {
 /*
  * game scanning
  */
-static const char *game_exts[] = {".cdi", ".chd", ".gdi"};
+static const char *game_exts[] = {".cdi", ".chd", ".gdi", ".rdz"};
 
 static int ui_has_game_ext(const char *filename, const char **exts,
                            int num_exts) {
@@ -511,32 +548,232 @@ static void ui_insert_game(struct ui *ui, struct game *new_game) {
   *game = *new_game;
 }
 
-static void ui_scan_games_f(struct ui *ui, const char *filename) {
+static int ui_library_cmp(const void *a, const void *b) {
+  const struct game *game_a = a;
+  const struct game *game_b = b;
+  return strcmp(game_a->filename, game_b->filename);
+}
+
+static void ui_library_path(char *path, size_t size) {
+  snprintf(path, size, "%s" PATH_SEPARATOR "library.idx", fs_appdir());
+}
+
+/* each line of the index is an entry's tab-separated size, mtime, valid,
+   tex_fad, tex_len, filename, prodname and prodmeta */
+static int ui_parse_library_entry(char *line, struct game *game) {
+  memset(game, 0, sizeof(*game));
+
+  line[strcspn(line, "\r\n")] = 0;
+
+  int n = 0;
+  int res = sscanf(line, "%" SCNd64 "\t%" SCNd64 "\t%d\t%d\t%d\t%n",
+                   &game->size, &game->mtime, &game->valid, &game->tex_fad,
+                   &game->tex_len, &n);
+  if (res != 5 || !n) {
+    return 0;
+  }
+
+  char *fields[3];
+  char *ptr = line + n;
+
+  for (int i = 0; i < 3; i++) {
+    if (!ptr) {
+      return 0;
+    }
+
+    fields[i] = ptr;
+    ptr = strchr(ptr, '\t');
+
+    if (ptr) {
+      *(ptr++) = 0;
+    }
+  }
+
+  snprintf(game->filename, sizeof(game->filename), "%s", fields[0]);
+  snprintf(game->prodname, sizeof(game->prodname), "%s", fields[1]);
+  snprintf(game->prodmeta, sizeof(game->prodmeta), "%s", fields[2]);
+
+  return 1;
+}
+
+static void ui_read_library(struct scan *scan) {
+  char filename[PATH_MAX];
+  ui_library_path(filename, sizeof(filename));
+
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    return;
+  }
+
+  char line[PATH_MAX + 1024];
+  int version = 0;
+
+  if (fgets(line, sizeof(line), fp)) {
+    version = atoi(line);
+  }
+
+  /* entries from other versions are simply rebuilt */
+  if (version == UI_LIBRARY_VERSION) {
+    while (scan->num_index < UI_MAX_GAMES && fgets(line, sizeof(line), fp)) {
+      struct game *game = &scan->index[scan->num_index];
+
+      if (ui_parse_library_entry(line, game)) {
+        scan->num_index++;
+      }
+    }
+  }
+
+  fclose(fp);
+
+  qsort(scan->index, scan->num_index, sizeof(struct game), &ui_library_cmp);
+}
+
+static void ui_write_library(struct scan *scan) {
+  char filename[PATH_MAX];
+  ui_library_path(filename, sizeof(filename));
+
+  /* write to a temporary file first to avoid ever reading a partial index */
+  char tmpname[PATH_MAX];
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+  FILE *fp = fopen(tmpname, "w");
+  if (!fp) {
+    LOG_WARNING("ui_write_library failed to open %s", tmpname);
+    return;
+  }
+
+  fprintf(fp, "%d\n", UI_LIBRARY_VERSION);
+
+  for (int i = 0; i < scan->num_files; i++) {
+    struct game *game = &scan->files[i];
+
+    /* filenames which can't be represented are just reopened next time */
+    if (strpbrk(game->filename, "\t\r\n")) {
+      continue;
+    }
+
+    fprintf(fp, "%" PRId64 "\t%" PRId64 "\t%d\t%d\t%d\t%s\t%s\t%s\n",
+            game->size, game->mtime, game->valid, game->tex_fad,
+            game->tex_len, game->filename, game->prodname, game->prodmeta);
+  }
+
+  fclose(fp);
+
+  if (rename(tmpname, filename)) {
+    /* windows won't rename over an existing file */
+    remove(filename);
+
+    if (rename(tmpname, filename)) {
+      LOG_WARNING("ui_write_library failed to write %s", filename);
+      remove(tmpname);
+    }
+  }
+}
+
+static void ui_sanitize_meta(char *str) {
+  for (; *str; str++) {
+    if (*str == '\t' || *str == '\r' || *str == '\n') {
+      *str = ' ';
+    }
+  }
+}
+
+/* opens the file to fill in its entry, this is the slow path which the index
+   exists to avoid */
+static void ui_open_game(struct game *game) {
+  struct disc *disc = disc_create(game->filename, 0);
+
+  if (!disc) {
+    return;
+  }
+
+  game->valid = 1;
+  strncpy(game->prodname, disc->prodnme, sizeof(game->prodname));
+  snprintf(game->prodmeta, sizeof(game->prodmeta), "%s / %s", disc->prodver,
+           disc->prodnum);
+  ui_sanitize_meta(game->prodname);
+  ui_sanitize_meta(game->prodmeta);
+
+  if (!disc_find_file(disc, "0GDTEX.PVR", &game->tex_fad, &game->tex_len)) {
+    game->tex_fad = 0;
+    game->tex_len = 0;
+  }
+
+  disc_destroy(disc);
+}
+
+static void ui_add_game(struct ui *ui, struct game *game) {
   mutex_lock(ui->scan_mutex);
 
   /* update status */
-  snprintf(ui->scan_status, sizeof(ui->scan_status), "scanning %s", filename);
+  snprintf(ui->scan_status, sizeof(ui->scan_status), "scanning %s",
+           game->filename);
+
+  if (game->valid) {
+    struct game copy = *game;
+    copy.tex = 0;
+    ui_insert_game(ui, &copy);
+  }
+
+  mutex_unlock(ui->scan_mutex);
+}
+
+static void *ui_scan_worker(void *data) {
+  struct scan *scan = data;
 
-  if (ui_has_game_ext(filename, game_exts, ARRAY_SIZE(game_exts))) {
-    struct disc *disc = disc_create(filename, 0);
+  apply_thread_options(ROLE_IO);
 
-    if (disc) {
-      struct game game = {0};
-      strncpy(game.filename, filename, sizeof(game.filename));
-      strncpy(game.prodname, disc->prodnme, sizeof(game.prodname));
-      snprintf(game.prodmeta, sizeof(game.prodmeta), "%s / %s", disc->prodver,
-               disc->prodnum);
-      ui_insert_game(ui, &game);
+  while (1) {
+    mutex_lock(scan->mutex);
+    int next = scan->next_pending++;
+    mutex_unlock(scan->mutex);
 
-      disc_destroy(disc);
+    if (next >= scan->num_pending) {
+      break;
     }
+
+    struct game *game = &scan->files[scan->pending[next]];
+    ui_open_game(game);
+    ui_add_game(scan->ui, game);
   }
 
-  mutex_unlock(ui->scan_mutex);
+  return NULL;
 }
 
-static void ui_scan_games_d(struct ui *ui, const char *path) {
-  struct games_page *page = &ui->games_page;
+static void ui_scan_games_f(struct scan *scan, const char *filename) {
+  if (!ui_has_game_ext(filename, game_exts, ARRAY_SIZE(game_exts))) {
+    return;
+  }
+
+  if (scan->num_files >= UI_MAX_GAMES) {
+    return;
+  }
+
+  struct game *game = &scan->files[scan->num_files];
+  memset(game, 0, sizeof(*game));
+  strncpy(game->filename, filename, sizeof(game->filename));
+
+  if (!fs_stat(filename, &game->size, &game->mtime)) {
+    return;
+  }
+
+  scan->num_files++;
+
+  /* files which haven't changed since the last scan are added straight from
+     the index, without being opened */
+  struct game *cached = bsearch(game, scan->index, scan->num_index,
+                                sizeof(struct game), &ui_library_cmp);
+
+  if (cached && cached->size == game->size && cached->mtime == game->mtime) {
+    *game = *cached;
+    ui_add_game(scan->ui, game);
+    return;
+  }
+
+  scan->pending[scan->num_pending++] = scan->num_files - 1;
+}
+
+static void ui_scan_games_d(struct scan *scan, const char *path) {
   DIR *dir = opendir(path);
 
   if (!dir) {
@@ -558,9 +795,9 @@ static void ui_scan_games_d(struct ui *ui, const char *path) {
     snprintf(abspath, sizeof(abspath), "%s" PATH_SEPARATOR "%s", path, dname);
 
     if (ent->d_type & DT_DIR) {
-      ui_scan_games_d(ui, abspath);
+      ui_scan_games_d(scan, abspath);
     } else if (ent->d_type & DT_REG) {
-      ui_scan_games_f(ui, abspath);
+      ui_scan_games_f(scan, abspath);
     }
   }
 
@@ -568,12 +805,45 @@ static void ui_scan_games_d(struct ui *ui, const char *path) {
 }
 
 static void ui_scan_games(struct ui *ui) {
+  struct scan scan = {0};
+  scan.ui = ui;
+  scan.index = calloc(UI_MAX_GAMES, sizeof(struct game));
+  scan.files = calloc(UI_MAX_GAMES, sizeof(struct game));
+  scan.pending = calloc(UI_MAX_GAMES, sizeof(int));
+  scan.mutex = mutex_create();
+
+  ui_read_library(&scan);
+
+  /* walk the directories first, adding the files that are unchanged */
   char dirs[UI_MAX_GAMEDIRS][PATH_MAX];
   int num_dirs = ui_explode_gamedir(ui, dirs[0], UI_MAX_GAMEDIRS, PATH_MAX);
 
   for (int i = 0; i < num_dirs; i++) {
-    ui_scan_games_d(ui, dirs[i]);
+    ui_scan_games_d(&scan, dirs[i]);
+  }
+
+  /* open the rest in parallel, each is added as soon as it's opened */
+  thread_t workers[UI_SCAN_THREADS];
+  int num_workers = MIN(scan.num_pending, UI_SCAN_THREADS);
+
+  for (int i = 0; i < num_workers; i++) {
+    workers[i] = thread_create(&ui_scan_worker, "scan", &scan);
+    CHECK_NOTNULL(workers[i]);
+  }
+
+  for (int i = 0; i < num_workers; i++) {
+    void *result;
+    thread_join(workers[i], &result);
   }
+
+  if (scan.num_pending || scan.num_files != scan.num_index) {
+    ui_write_library(&scan);
+  }
+
+  mutex_destroy(scan.mutex);
+  free(scan.pending);
+  free(scan.files);
+  free(scan.index);
 }
 
 static void *ui_scan_thread(void *data) {
@@ -974,6 +1244,20 @@ static void ui_system_build(struct ui *ui) {
     }
   }
 
+  {
+    if (igOptionString("Frame pacing", OPTION_pacing, btn_size)) {
+      int next = 0;
+      for (int i = 0; i < NUM_PACINGS; i++) {
+        if (!strcmp(PACINGS[i], OPTION_pacing)) {
+          next = (i + 1) % NUM_PACINGS;
+          break;
+        }
+      }
+      snprintf(OPTION_pacing, sizeof(OPTION_pacing), "%s", PACINGS[next]);
+      OPTION_pacing_dirty = 1;
+    }
+  }
+
   {
     if (igOptionString("Region", OPTION_region, btn_size)) {
       int next = 0;
@@ -1157,17 +1441,20 @@ enum {
 };
 
 static texture_handle_t ui_load_disc_texture(struct ui *ui, struct game *game) {
-  struct disc *disc = disc_create(game->filename, 0);
-  if (!disc) {
+  /* the cover art was located when the game was scanned, only open the disc
+     if it has any */
+  if (!game->tex_len) {
     return ui->disc_tex;
   }
 
-  int fad, len;
-  int res = disc_find_file(disc, "0GDTEX.PVR", &fad, &len);
-  if (!res) {
+  struct disc *disc = disc_create(game->filename, 0);
+  if (!disc) {
     return ui->disc_tex;
   }
 
+  int fad = game->tex_fad;
+  int len = game->tex_len;
+
   uint8_t *converted = malloc(1024 * 1024 * 4);
   uint8_t *pvrt = malloc(len);
   int read = disc_read_bytes(disc, fad, len, pvrt, len);
@@ -1175,12 +1462,12 @@ static texture_handle_t ui_load_disc_texture(struct ui *ui, struct game *game) {
 
   const struct pvr_tex_header *header = pvr_tex_header(pvrt);
   const uint8_t *data = pvr_tex_data(pvrt);
-  pvr_tex_decode(data, header->width, header->height, header->width,
-                 header->texture_fmt, header->pixel_fmt, NULL, 0, converted,
-                 sizeof(converted));
+  enum pxl_format format = pvr_tex_decode_native(
+      data, header->width, header->height, header->width, header->texture_fmt,
+      header->pixel_fmt, NULL, 0, converted, sizeof(converted));
 
   texture_handle_t tex = r_create_texture(
-      ui->r, PXL_RGBA, FILTER_BILINEAR, WRAP_CLAMP_TO_EDGE, WRAP_CLAMP_TO_EDGE,
+      ui->r, format, FILTER_BILINEAR, WRAP_CLAMP_TO_EDGE, WRAP_CLAMP_TO_EDGE,
       0, header->width, header->height, converted);
 
   free(pvrt);
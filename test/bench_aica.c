@@ -0,0 +1,33 @@
+#include "rebench.h"
+#include "guest/aica/aica.h"
+#include "guest/dreamcast.h"
+
+#define NUM_CHANNELS 64
+
+/* each iteration mixes a batch of frames with every channel keyed on,
+   looping over a sample of random data in each of the sample formats */
+BENCH(aica_generate_frames) {
+  struct dreamcast *dc = bench_dreamcast();
+  struct aica *aica = dc->aica;
+
+  for (int i = 0; i < 0x10000; i += 4) {
+    aica_mem_write(aica, i, rand(), 0xffffffff);
+  }
+
+  for (int i = 0; i < NUM_CHANNELS; i++) {
+    uint32_t base = i << 7;
+    int pcms = i % 3;
+
+    /* LEA */
+    aica_reg_write(aica, base + 0xc, 0x1000, 0xffff);
+    /* FNS, OCT */
+    aica_reg_write(aica, base + 0x18, (i % 8) << 11 | (i * 16), 0xffff);
+    /* SA_hi, PCMS, LPCTL, KYONB, KYONEX */
+    aica_reg_write(aica, base + 0x0,
+                   (1 << 15) | (1 << 14) | (1 << 9) | (pcms << 7), 0xffff);
+  }
+
+  for (int i = 0; i < n; i++) {
+    aica_generate_frames(aica);
+  }
+}
@@ -0,0 +1,200 @@
+#include "rebench.h"
+#include "core/hash_map.h"
+#include "core/interval_tree.h"
+#include "core/rb_tree.h"
+#include "core/sort.h"
+
+#define MAX_NODES 0x1000
+#define HIGH 0x10000
+#define INTERVAL 0x200
+
+struct bench_node {
+  struct rb_node it;
+  int key;
+};
+
+DEFINE_HASH_MAP(bench_map, int, struct bench_node *);
+
+static struct bench_node nodes[MAX_NODES];
+static struct interval_node intervals[MAX_NODES];
+
+static int bench_node_cmp(const struct rb_node *rb_lhs,
+                          const struct rb_node *rb_rhs) {
+  const struct bench_node *lhs = rb_entry(rb_lhs, const struct bench_node, it);
+  const struct bench_node *rhs = rb_entry(rb_rhs, const struct bench_node, it);
+  return lhs->key - rhs->key;
+}
+
+static struct rb_callbacks bench_node_cb = {&bench_node_cmp, NULL, NULL};
+
+static void init_rb_tree(struct rb_tree *t) {
+  for (int i = 0; i < MAX_NODES; i++) {
+    struct bench_node *n = &nodes[i];
+    n->key = rand() % HIGH;
+    rb_insert(t, &n->it, &bench_node_cb);
+  }
+}
+
+static void init_interval_tree(struct rb_tree *t) {
+  for (int i = 0; i < MAX_NODES; i++) {
+    struct interval_node *n = &intervals[i];
+    n->low = rand() % HIGH;
+    n->high = n->low + INTERVAL;
+    interval_tree_insert(t, n);
+  }
+}
+
+/* each iteration moves one node of a full tree to a new key */
+BENCH(rb_tree_reinsert) {
+  struct rb_tree tree = {0};
+  init_rb_tree(&tree);
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    struct bench_node *node = &nodes[i % MAX_NODES];
+    rb_unlink(&tree, &node->it, &bench_node_cb);
+    node->key = rand() % HIGH;
+    rb_insert(&tree, &node->it, &bench_node_cb);
+  }
+
+  bench_stop();
+}
+
+BENCH(rb_tree_find) {
+  struct rb_tree tree = {0};
+  init_rb_tree(&tree);
+
+  int found = 0;
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    struct bench_node search;
+    search.key = nodes[(i * 7) % MAX_NODES].key;
+    found += rb_find(&tree, &search.it, &bench_node_cb) != NULL;
+  }
+
+  bench_stop();
+
+  CHECK_EQ(found, n);
+}
+
+static void init_hash_map(struct bench_map *map) {
+  for (int i = 0; i < MAX_NODES; i++) {
+    struct bench_node *n = &nodes[i];
+    n->key = rand() % HIGH;
+    bench_map_insert(map, n->key, n);
+  }
+}
+
+/* the same workloads as rb_tree_reinsert and rb_tree_find, for comparison */
+BENCH(hash_map_reinsert) {
+  struct bench_map map = {0};
+  init_hash_map(&map);
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    struct bench_node *node = &nodes[i % MAX_NODES];
+    int slot = bench_map_find(&map, node->key);
+    while (*hash_map_value(&map, slot) != node) {
+      slot = bench_map_find_next(&map, node->key, slot);
+    }
+    bench_map_remove_slot(&map, slot);
+    node->key = rand() % HIGH;
+    bench_map_insert(&map, node->key, node);
+  }
+
+  bench_stop();
+
+  bench_map_destroy(&map);
+}
+
+BENCH(hash_map_find) {
+  struct bench_map map = {0};
+  init_hash_map(&map);
+
+  int found = 0;
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    int key = nodes[(i * 7) % MAX_NODES].key;
+    found += bench_map_get(&map, key) != NULL;
+  }
+
+  bench_stop();
+
+  CHECK_EQ(found, n);
+
+  bench_map_destroy(&map);
+}
+
+BENCH(interval_tree_reinsert) {
+  struct rb_tree tree = {0};
+  init_interval_tree(&tree);
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    struct interval_node *node = &intervals[i % MAX_NODES];
+    interval_tree_remove(&tree, node);
+    node->low = rand() % HIGH;
+    node->high = node->low + INTERVAL;
+    interval_tree_insert(&tree, node);
+  }
+
+  bench_stop();
+}
+
+/* each iteration visits every interval overlapping a random range, the way
+   memory watches are looked up when a page is written to */
+BENCH(interval_tree_query) {
+  struct rb_tree tree = {0};
+  init_interval_tree(&tree);
+
+  int found = 0;
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    interval_type_t low = rand() % HIGH;
+    interval_type_t high = low + INTERVAL;
+
+    struct interval_tree_it it;
+    struct interval_node *node =
+        interval_tree_iter_first(&tree, low, high, &it);
+
+    while (node) {
+      found++;
+      node = interval_tree_iter_next(&it);
+    }
+  }
+
+  bench_stop();
+
+  CHECK_GT(found, 0);
+}
+
+static int bench_int_cmp(const void *lhs, const void *rhs) {
+  return *(const int *)lhs <= *(const int *)rhs;
+}
+
+/* each iteration sorts MAX_NODES random keys */
+BENCH(msort) {
+  static int src[MAX_NODES];
+  static int data[MAX_NODES];
+
+  for (int i = 0; i < MAX_NODES; i++) {
+    src[i] = rand() % HIGH;
+  }
+
+  for (int i = 0; i < n; i++) {
+    memcpy(data, src, sizeof(data));
+
+    bench_start();
+    msort(data, MAX_NODES, sizeof(int), &bench_int_cmp);
+    bench_stop();
+  }
+}
@@ -0,0 +1,163 @@
+#include "rebench.h"
+#include "guest/dreamcast.h"
+#include "guest/memory.h"
+#include "guest/sh4/sh4.h"
+#include "jit/jit.h"
+
+#define BLOCK_ADDR 0x0c010000
+#define BLOCK_REPEAT 16
+
+/* mov.l @r1+, r2
+   add r2, r3
+   xor r3, r5
+   mov.l r3, @r4
+   add #4, r4 */
+static const uint16_t alu_body[] = {0x6216, 0x332c, 0x253a, 0x2432, 0x7404};
+
+/* fmov.s @r1+, fr2
+   fmul fr2, fr3
+   fadd fr3, fr0 */
+static const uint16_t fpu_body[] = {0xf219, 0xf322, 0xf030};
+
+/* rts
+   nop */
+static const uint16_t block_tail[] = {0x000b, 0x0009};
+
+/* each iteration compiles a block of BLOCK_REPEAT copies of body, and then
+   frees the code cache */
+static void bench_compile(int n, const uint16_t *body, int body_size) {
+  struct dreamcast *dc = bench_dreamcast();
+  struct jit *jit = dc->sh4->jit;
+
+  uint8_t *ram = mem_ram(dc->mem, BLOCK_ADDR & 0xffffff);
+  for (int i = 0; i < BLOCK_REPEAT; i++) {
+    memcpy(ram, body, body_size);
+    ram += body_size;
+  }
+  memcpy(ram, block_tail, sizeof(block_tail));
+
+  sh4_reset(dc->sh4, BLOCK_ADDR);
+  jit_free_code(jit);
+
+  for (int i = 0; i < n; i++) {
+    bench_start();
+    jit_compile_code(jit, BLOCK_ADDR);
+    bench_stop();
+
+    jit_free_code(jit);
+  }
+}
+
+BENCH(jit_compile_alu) {
+  bench_compile(n, alu_body, sizeof(alu_body));
+}
+
+BENCH(jit_compile_fpu) {
+  bench_compile(n, fpu_body, sizeof(fpu_body));
+}
+
+#define DISPATCH_BLOCKS 2048
+#define DISPATCH_STRIDE 0x100
+#define DISPATCH_CYCLES 100000
+
+/* mov.l @(1, pc), r2
+   mov.l @r2, r0
+   jmp @r0
+   nop
+   .long <address of the next block's address>
+   .long <next block's address> */
+static const uint16_t dispatch_body[] = {0xd201, 0x6022, 0x402b, 0x0009};
+
+/* each iteration runs a ring of blocks spread across system ram, with each
+   block dynamically branching to the next in a shuffled order, stressing the
+   lookups of code scattered throughout the address space */
+BENCH(jit_dispatch) {
+  struct dreamcast *dc = bench_dreamcast();
+  struct jit *jit = dc->sh4->jit;
+
+  int order[DISPATCH_BLOCKS];
+  for (int i = 0; i < DISPATCH_BLOCKS; i++) {
+    order[i] = i;
+  }
+  for (int i = DISPATCH_BLOCKS - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    int tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  for (int i = 0; i < DISPATCH_BLOCKS; i++) {
+    uint32_t addr = BLOCK_ADDR + order[i] * DISPATCH_STRIDE;
+    uint32_t next =
+        BLOCK_ADDR + order[(i + 1) % DISPATCH_BLOCKS] * DISPATCH_STRIDE;
+    uint8_t *ram = mem_ram(dc->mem, addr & 0xffffff);
+    uint32_t data[2] = {addr + 12, next};
+    memcpy(ram, dispatch_body, sizeof(dispatch_body));
+    memcpy(ram + 8, data, sizeof(data));
+  }
+
+  sh4_reset(dc->sh4, BLOCK_ADDR + order[0] * DISPATCH_STRIDE);
+  jit_free_code(jit);
+
+  /* compile each block before timing */
+  jit_run(jit, DISPATCH_CYCLES);
+
+  for (int i = 0; i < n; i++) {
+    bench_start();
+    jit_run(jit, DISPATCH_CYCLES);
+    bench_stop();
+  }
+
+  jit_free_code(jit);
+}
+
+#define DIVIDE_CYCLES 100000
+
+/* div0u
+   rotcl r0
+   div1 r1, r2
+   ... repeated 32 times
+   rotcl r0
+   mov #0, r2
+   bra <div0u>
+   nop */
+static void bench_divide_code(uint16_t *code) {
+  int i = 0;
+  code[i++] = 0x0019;
+  for (int j = 0; j < 32; j++) {
+    code[i++] = 0x4024;
+    code[i++] = 0x3214;
+  }
+  code[i++] = 0x4024;
+  code[i++] = 0xe200;
+  code[i] = 0xa000 | ((-(i + 2)) & 0xfff);
+  code[i + 1] = 0x0009;
+}
+
+/* each iteration runs a loop of unsigned divides, as emitted by compilers for
+   32-bit integer division */
+BENCH(jit_divide) {
+  struct dreamcast *dc = bench_dreamcast();
+  struct jit *jit = dc->sh4->jit;
+
+  uint16_t code[69];
+  bench_divide_code(code);
+  memcpy(mem_ram(dc->mem, BLOCK_ADDR & 0xffffff), code, sizeof(code));
+
+  sh4_reset(dc->sh4, BLOCK_ADDR);
+  jit_free_code(jit);
+
+  dc->sh4->ctx.r[0] = 0x12345678;
+  dc->sh4->ctx.r[1] = 1000;
+
+  /* compile the loop before timing */
+  jit_run(jit, DIVIDE_CYCLES);
+
+  for (int i = 0; i < n; i++) {
+    bench_start();
+    jit_run(jit, DIVIDE_CYCLES);
+    bench_stop();
+  }
+
+  jit_free_code(jit);
+}
@@ -0,0 +1,136 @@
+#include "rebench.h"
+#include "core/option.h"
+#include "file/trace.h"
+#include "guest/pvr/ta.h"
+#include "guest/pvr/tex.h"
+#include "guest/pvr/tr.h"
+
+DEFINE_OPTION_STRING(trace, "", "Trace to convert the contexts of");
+
+#define TEX_WIDTH 256
+#define TEX_HEIGHT 256
+#define MAX_CONTEXTS 16
+
+/*
+ * texture decoding
+ */
+static void bench_tex_decode(int n, int texture_fmt, int pixel_fmt,
+                             int palette_fmt) {
+  static uint8_t src[PVR_CODEBOOK_SIZE + TEX_WIDTH * TEX_HEIGHT * 2];
+  static uint8_t palette[1024 * 4];
+  static uint8_t dst[TEX_WIDTH * TEX_HEIGHT * 4];
+
+  for (int i = 0; i < (int)sizeof(src); i++) {
+    src[i] = rand();
+  }
+  for (int i = 0; i < (int)sizeof(palette); i++) {
+    palette[i] = rand();
+  }
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    pvr_tex_decode(src, TEX_WIDTH, TEX_HEIGHT, TEX_WIDTH, texture_fmt,
+                   pixel_fmt, palette, palette_fmt, dst, sizeof(dst));
+  }
+
+  bench_stop();
+}
+
+#define BENCH_TEX(name, texture_fmt, pixel_fmt, palette_fmt)  \
+  BENCH(tex_##name) {                                         \
+    bench_tex_decode(n, texture_fmt, pixel_fmt, palette_fmt); \
+  }
+
+BENCH_TEX(twiddled_argb1555, PVR_TEX_TWIDDLED, PVR_PXL_ARGB1555, 0);
+BENCH_TEX(twiddled_rgb565, PVR_TEX_TWIDDLED, PVR_PXL_RGB565, 0);
+BENCH_TEX(twiddled_argb4444, PVR_TEX_TWIDDLED, PVR_PXL_ARGB4444, 0);
+BENCH_TEX(twiddled_yuv422, PVR_TEX_TWIDDLED, PVR_PXL_YUV422, 0);
+BENCH_TEX(bitmap_argb1555, PVR_TEX_BITMAP, PVR_PXL_ARGB1555, 0);
+BENCH_TEX(bitmap_rgb565, PVR_TEX_BITMAP, PVR_PXL_RGB565, 0);
+BENCH_TEX(bitmap_argb4444, PVR_TEX_BITMAP, PVR_PXL_ARGB4444, 0);
+BENCH_TEX(bitmap_yuv422, PVR_TEX_BITMAP, PVR_PXL_YUV422, 0);
+BENCH_TEX(vq_argb1555, PVR_TEX_VQ, PVR_PXL_ARGB1555, 0);
+BENCH_TEX(vq_rgb565, PVR_TEX_VQ, PVR_PXL_RGB565, 0);
+BENCH_TEX(vq_argb4444, PVR_TEX_VQ, PVR_PXL_ARGB4444, 0);
+BENCH_TEX(vq_yuv422, PVR_TEX_VQ, PVR_PXL_YUV422, 0);
+BENCH_TEX(pal4_argb1555, PVR_TEX_PALETTE_4BPP, PVR_PXL_4BPP, PVR_PAL_ARGB1555);
+BENCH_TEX(pal4_argb8888, PVR_TEX_PALETTE_4BPP, PVR_PXL_4BPP, PVR_PAL_ARGB8888);
+BENCH_TEX(pal8_argb1555, PVR_TEX_PALETTE_8BPP, PVR_PXL_8BPP, PVR_PAL_ARGB1555);
+BENCH_TEX(pal8_argb8888, PVR_TEX_PALETTE_8BPP, PVR_PXL_8BPP, PVR_PAL_ARGB8888);
+
+/*
+ * context conversion
+ */
+static struct trace *trace;
+static struct ta_context *contexts[MAX_CONTEXTS];
+static int num_contexts;
+
+/* textures are only being looked up, not converted. a non-zero handle is
+   enough for every lookup to be considered converted already */
+static struct tr_texture *bench_find_texture(void *userdata, union tsp tsp,
+                                             union tcw tcw) {
+  static struct tr_texture tex;
+  tex.handle = 1;
+  tex.dirty = 0;
+  return &tex;
+}
+
+static int bench_load_trace() {
+  if (trace) {
+    return 1;
+  }
+
+  if (!OPTION_trace[0]) {
+    return 0;
+  }
+
+  trace = trace_parse(OPTION_trace);
+  if (!trace) {
+    LOG_WARNING("failed to parse %s", OPTION_trace);
+    return 0;
+  }
+
+  for (struct trace_cmd *cmd = trace->cmds;
+       cmd && num_contexts < MAX_CONTEXTS; cmd = cmd->next) {
+    if (cmd->type != TRACE_CMD_CONTEXT) {
+      continue;
+    }
+
+    struct ta_context *ctx = calloc(1, sizeof(struct ta_context));
+    trace_copy_context(trace, cmd, ctx);
+    contexts[num_contexts++] = ctx;
+  }
+
+  return num_contexts > 0;
+}
+
+/* each iteration converts one of the first MAX_CONTEXTS contexts in the
+   trace, cycling through them */
+BENCH(tr_convert_context) {
+  static struct tr_context rc;
+
+  if (!bench_load_trace()) {
+    bench_skip("no trace, pass one with --trace=<file>");
+    return;
+  }
+
+  struct tr_converter *cvt = tr_converter_create();
+
+  for (int i = 0; i < n; i++) {
+    tr_convert_context(cvt, NULL, NULL, &bench_find_texture,
+                       contexts[i % num_contexts], &rc);
+  }
+
+  tr_converter_destroy(cvt);
+}
+
+DESTRUCTOR(BENCH_TRACE_DESTROY) {
+  for (int i = 0; i < num_contexts; i++) {
+    ta_free_context(contexts[i]);
+    free(contexts[i]);
+  }
+  if (trace) {
+    trace_destroy(trace);
+  }
+}
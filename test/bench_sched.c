@@ -0,0 +1,70 @@
+#include "rebench.h"
+#include "guest/dreamcast.h"
+#include "guest/scheduler.h"
+
+#define NUM_TIMERS 256
+
+/* the scheduler is ran on a machine without any devices, leaving only the
+   cost of managing and expiring timers */
+struct bench_timer {
+  struct scheduler *sched;
+  struct timer *timer;
+  int64_t period;
+};
+
+static struct bench_timer timers[NUM_TIMERS];
+
+static void bench_timer_expired(void *data) {
+  struct bench_timer *t = data;
+  t->timer = sched_start_timer(t->sched, &bench_timer_expired, t, t->period);
+}
+
+static struct scheduler *bench_sched_create(struct dreamcast *dc) {
+  dc->running = 1;
+
+  struct scheduler *sched = sched_create(dc);
+
+  for (int i = 0; i < NUM_TIMERS; i++) {
+    struct bench_timer *t = &timers[i];
+    t->sched = sched;
+    t->period = 1000 + rand() % 100000;
+    t->timer = sched_start_timer(sched, &bench_timer_expired, t, t->period);
+  }
+
+  return sched;
+}
+
+/* each iteration restarts one of the pending timers */
+BENCH(sched_start_timer) {
+  struct dreamcast dc = {0};
+  struct scheduler *sched = bench_sched_create(&dc);
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    struct bench_timer *t = &timers[i % NUM_TIMERS];
+    sched_cancel_timer(sched, t->timer);
+    t->timer = sched_start_timer(sched, &bench_timer_expired, t, t->period);
+  }
+
+  bench_stop();
+
+  sched_destroy(sched);
+}
+
+/* each iteration advances the scheduler a microsecond, each timer expiring
+   every 1 - 100 microseconds */
+BENCH(sched_tick) {
+  struct dreamcast dc = {0};
+  struct scheduler *sched = bench_sched_create(&dc);
+
+  bench_start();
+
+  for (int i = 0; i < n; i++) {
+    sched_tick(sched, 1000);
+  }
+
+  bench_stop();
+
+  sched_destroy(sched);
+}
@@ -0,0 +1,39 @@
+#include "pass_test.h"
+#include "jit/ir/ir.h"
+#include "retest.h"
+
+static uint8_t ir_buffer[1024 * 1024];
+static char scratch_buffer[1024 * 1024];
+
+void pass_test_run(pass_test_cb run, const char *input_str,
+                   const char *output_str) {
+  struct ir ir;
+  ir_init(&ir, ir_buffer, sizeof(ir_buffer));
+
+  FILE *input = tmpfile();
+  fwrite(input_str, 1, strlen(input_str), input);
+  rewind(input);
+  int res = ir_read(input, &ir);
+  fclose(input);
+  CHECK(res);
+
+  run(&ir);
+
+  FILE *output = tmpfile();
+  ir_write(&ir, output);
+  rewind(output);
+
+  char line[1024];
+  char *ptr = scratch_buffer;
+  char *end = scratch_buffer + sizeof(scratch_buffer);
+
+  while (fgets(line, sizeof(line), output)) {
+    if (line[0] != '#') {
+      ptr += snprintf(ptr, end - ptr, "%s", line);
+    }
+  }
+
+  fclose(output);
+
+  CHECK_STREQ(scratch_buffer, output_str);
+}
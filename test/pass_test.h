@@ -0,0 +1,13 @@
+#ifndef PASS_TEST_H
+#define PASS_TEST_H
+
+struct ir;
+
+typedef void (*pass_test_cb)(struct ir *);
+
+/* parses input_str, runs the pass over it and checks the ir written back out
+   against output_str. the comments describing the control flow are ignored */
+void pass_test_run(pass_test_cb run, const char *input_str,
+                   const char *output_str);
+
+#endif
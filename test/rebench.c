@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include "rebench.h"
+#include "core/filesystem.h"
+#include "core/option.h"
+#include "core/time.h"
+#include "guest/dreamcast.h"
+
+DEFINE_OPTION_INT(iterations, 1000, "Iterations to time each benchmark over");
+DEFINE_OPTION_INT(warmup, 100, "Untimed iterations run before timing");
+DEFINE_OPTION_INT(json, 0, "Print results as json");
+DEFINE_OPTION_STRING(filter, "", "Run only benchmarks containing this string");
+
+static struct list benches;
+static struct dreamcast *dc;
+
+/* state of the running benchmark */
+static int timing;
+static int64_t timer_start;
+static int64_t timer_ns;
+static int timed;
+static const char *skipped;
+
+void bench_register(struct bench *bench) {
+  list_add(&benches, &bench->it);
+}
+
+void bench_start() {
+  CHECK(!timing);
+  timing = 1;
+  timed = 1;
+  timer_start = time_nanoseconds();
+}
+
+void bench_stop() {
+  CHECK(timing);
+  timer_ns += time_nanoseconds() - timer_start;
+  timing = 0;
+}
+
+void bench_skip(const char *reason) {
+  skipped = reason;
+}
+
+struct dreamcast *bench_dreamcast() {
+  if (!dc) {
+    dc = dc_create();
+    CHECK_NOTNULL(dc);
+  }
+  return dc;
+}
+
+static int64_t bench_run(struct bench *bench, int n) {
+  timing = 0;
+  timer_ns = 0;
+  timed = 0;
+
+  int64_t start = time_nanoseconds();
+  bench->run(n);
+  int64_t end = time_nanoseconds();
+
+  CHECK(!timing);
+
+  return timed ? timer_ns : end - start;
+}
+
+int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv)) {
+    return EXIT_FAILURE;
+  }
+
+  /* set application directory */
+  char appdir[PATH_MAX];
+  char userdir[PATH_MAX];
+  int r = fs_userdir(userdir, sizeof(userdir));
+  CHECK(r);
+  snprintf(appdir, sizeof(appdir), "%s" PATH_SEPARATOR ".redream", userdir);
+  fs_set_appdir(appdir);
+
+  int iterations = MAX(OPTION_iterations, 1);
+
+  list_for_each_entry(bench, &benches, struct bench, it) {
+    if (OPTION_filter[0] && !strstr(bench->name, OPTION_filter)) {
+      continue;
+    }
+
+    skipped = NULL;
+
+    if (OPTION_warmup > 0) {
+      bench_run(bench, OPTION_warmup);
+    }
+
+    if (!skipped) {
+      bench->ns = bench_run(bench, iterations);
+    }
+
+    bench->ran = 1;
+    bench->skipped = skipped;
+  }
+
+  /* results are printed once every benchmark has finished, so they aren't
+     interleaved with any logging from the benchmarks themselves */
+  int first = 1;
+
+  if (OPTION_json) {
+    printf("{\n");
+    printf("  \"iterations\": %d,\n", iterations);
+    printf("  \"warmup\": %d,\n", OPTION_warmup);
+    printf("  \"benchmarks\": [");
+  } else {
+    LOG_INFO("%-32s  %14s  %14s", "benchmark", "total ms", "ns / iter");
+  }
+
+  list_for_each_entry(bench, &benches, struct bench, it) {
+    if (!bench->ran) {
+      continue;
+    }
+
+    double ns_per_iter = bench->ns / (double)iterations;
+
+    if (OPTION_json) {
+      printf("%s\n    {\"name\": \"%s\", ", first ? "" : ",", bench->name);
+      if (bench->skipped) {
+        printf("\"skipped\": \"%s\"}", bench->skipped);
+      } else {
+        printf("\"ns\": %" PRId64 ", \"ns_per_iter\": %.3f}", bench->ns,
+               ns_per_iter);
+      }
+    } else if (bench->skipped) {
+      LOG_INFO("%-32s  skipped, %s", bench->name, bench->skipped);
+    } else {
+      LOG_INFO("%-32s  %14.3f  %14.3f", bench->name,
+               bench->ns / (double)NS_PER_MS, ns_per_iter);
+    }
+
+    first = 0;
+  }
+
+  if (OPTION_json) {
+    printf("\n  ]\n");
+    printf("}\n");
+  }
+
+  if (dc) {
+    dc_destroy(dc);
+  }
+
+  return EXIT_SUCCESS;
+}
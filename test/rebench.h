@@ -0,0 +1,48 @@
+#ifndef REBENCH_H
+#define REBENCH_H
+
+#include <stdint.h>
+#include "core/assert.h"
+#include "core/constructor.h"
+#include "core/list.h"
+
+struct dreamcast;
+
+/* each benchmark runs its kernel n times. by default, the entire call is
+   timed, benchmarks with their own setup can instead bracket the kernel with
+   bench_start / bench_stop */
+typedef void (*bench_callback_t)(int n);
+
+struct bench {
+  const char *name;
+  bench_callback_t run;
+  struct list_node it;
+
+  /* results, filled in by the runner */
+  int ran;
+  int64_t ns;
+  const char *skipped;
+};
+
+#define BENCH(name)                                                        \
+  static void bench_##name(int n);                                         \
+  CONSTRUCTOR(BENCH_REGISTER_##name) {                                     \
+    static struct bench bench = {"bench_" #name, &bench_##name, {0}, 0, 0, \
+                                 NULL};                                    \
+    bench_register(&bench);                                                \
+  }                                                                        \
+  void bench_##name(int n)
+
+void bench_register(struct bench *bench);
+
+void bench_start();
+void bench_stop();
+
+/* marks the running benchmark as skipped, for benchmarks missing their
+   input */
+void bench_skip(const char *reason);
+
+/* machine shared between the benchmarks needing one, created on first use */
+struct dreamcast *bench_dreamcast();
+
+#endif
@@ -54,9 +54,8 @@ static char scratch_buffer[1024 * 1024];
       "call i64 %6, i64 %8\n"
       "store_context i32 0x30, i32 0x8c000940\n";
 
-  struct ir ir = {0};
-  ir.buffer = ir_buffer;
-  ir.capacity = sizeof(ir_buffer);
+  struct ir ir;
+  ir_init(&ir, ir_buffer, sizeof(ir_buffer));
 
   FILE *input = tmpfile();
   fwrite(input_str, 1, sizeof(input_str) - 1, input);
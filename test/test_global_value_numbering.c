@@ -0,0 +1,151 @@
+#include "jit/ir/ir.h"
+#include "jit/passes/control_flow_analysis_pass.h"
+#include "jit/passes/global_value_numbering_pass.h"
+#include "pass_test.h"
+#include "retest.h"
+
+static void run_gvn(struct ir *ir) {
+  /* edges are needed to tell which blocks are dominated by the one before */
+  struct cfa *cfa = cfa_create();
+  cfa_run(cfa, ir);
+  cfa_destroy(cfa);
+
+  struct gvn *gvn = gvn_create();
+  gvn_run(gvn, ir);
+  gvn_destroy(gvn);
+}
+
+TEST(gvn_across_blocks) {
+  /* the second block is only entered from the first, so the expressions it
+     repeats are replaced with the first block's */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "i8 %3 = cmp i32 %2, i32 0x0, i32 0x0\n"
+      "branch_cond blk %4, blk %8, i8 %3\n"
+      "%4:\n"
+      "i32 %5 = add i32 %1, i32 0x4\n"
+      "i32 %6 = add i32 %5, i32 %2\n"
+      "store_context i32 0x14, i32 %6\n"
+      "branch blk %8\n"
+      "%8:\n"
+      "store_context i32 0x18, i32 %2\n";
+
+  static const char output_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "i8 %3 = cmp i32 %2, i32 0x0, i32 0x0\n"
+      "branch_cond blk %5, blk %9, i8 %3\n"
+      "%5:\n"
+      "i32 %6 = add i32 %2, i32 %2\n"
+      "store_context i32 0x14, i32 %6\n"
+      "branch blk %9\n"
+      "%9:\n"
+      "store_context i32 0x18, i32 %2\n";
+
+  pass_test_run(&run_gvn, input_str, output_str);
+}
+
+TEST(gvn_commutative) {
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = load_context i32 0x14\n"
+      "i32 %3 = add i32 %1, i32 %2\n"
+      "i32 %4 = add i32 %2, i32 %1\n"
+      "i32 %5 = sub i32 %1, i32 %2\n"
+      "i32 %6 = sub i32 %2, i32 %1\n"
+      "store_context i32 0x18, i32 %3\n"
+      "store_context i32 0x1c, i32 %4\n"
+      "store_context i32 0x20, i32 %5\n"
+      "store_context i32 0x24, i32 %6\n";
+
+  static const char output_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = load_context i32 0x14\n"
+      "i32 %3 = add i32 %1, i32 %2\n"
+      "i32 %4 = sub i32 %1, i32 %2\n"
+      "i32 %5 = sub i32 %2, i32 %1\n"
+      "store_context i32 0x18, i32 %3\n"
+      "store_context i32 0x1c, i32 %3\n"
+      "store_context i32 0x20, i32 %4\n"
+      "store_context i32 0x24, i32 %5\n";
+
+  pass_test_run(&run_gvn, input_str, output_str);
+}
+
+TEST(gvn_stores_and_calls) {
+  /* loads aren't numbered, their values may change with each store or call
+     in between. the pure expressions computed from them are still shared */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = add i32 %1, i32 0x1\n"
+      "store_context i32 0x10, i32 %2\n"
+      "i32 %4 = load_context i32 0x10\n"
+      "i32 %5 = add i32 %1, i32 0x1\n"
+      "i64 %6 = load_context i32 0x30\n"
+      "call i64 %6\n"
+      "i32 %8 = load_context i32 0x10\n"
+      "i32 %9 = load_guest i32 %4\n"
+      "store_guest i32 %4, i32 %5\n"
+      "i32 %11 = load_guest i32 %4\n"
+      "i32 %12 = add i32 %9, i32 %11\n"
+      "i32 %13 = add i32 %12, i32 %8\n"
+      "store_context i32 0x14, i32 %13\n";
+
+  static const char output_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = add i32 %1, i32 0x1\n"
+      "store_context i32 0x10, i32 %2\n"
+      "i32 %4 = load_context i32 0x10\n"
+      "i64 %5 = load_context i32 0x30\n"
+      "call i64 %5\n"
+      "i32 %7 = load_context i32 0x10\n"
+      "i32 %8 = load_guest i32 %4\n"
+      "store_guest i32 %4, i32 %2\n"
+      "i32 %10 = load_guest i32 %4\n"
+      "i32 %11 = add i32 %8, i32 %10\n"
+      "i32 %12 = add i32 %11, i32 %7\n"
+      "store_context i32 0x14, i32 %12\n";
+
+  pass_test_run(&run_gvn, input_str, output_str);
+}
+
+TEST(gvn_non_dominating) {
+  /* the last block is entered from both of the others, so neither the
+     expression computed in the middle block nor the one in the first block
+     are known to have been computed on every path. only the one in the first
+     block dominates, and this pass doesn't reach past the previous block */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i8 %2 = cmp i32 %1, i32 0x0, i32 0x0\n"
+      "branch_cond blk %3, blk %6, i8 %2\n"
+      "%3:\n"
+      "i32 %4 = xor i32 %1, i32 0xff\n"
+      "store_context i32 0x14, i32 %4\n"
+      "branch blk %6\n"
+      "%6:\n"
+      "i32 %7 = xor i32 %1, i32 0xff\n"
+      "store_context i32 0x18, i32 %7\n";
+
+  static const char output_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i8 %2 = cmp i32 %1, i32 0x0, i32 0x0\n"
+      "branch_cond blk %4, blk %8, i8 %2\n"
+      "%4:\n"
+      "i32 %5 = xor i32 %1, i32 0xff\n"
+      "store_context i32 0x14, i32 %5\n"
+      "branch blk %8\n"
+      "%8:\n"
+      "i32 %9 = xor i32 %1, i32 0xff\n"
+      "store_context i32 0x18, i32 %9\n";
+
+  pass_test_run(&run_gvn, input_str, output_str);
+}
@@ -0,0 +1,75 @@
+#include "core/hash_map.h"
+#include "retest.h"
+
+#define MAX_ENTRIES 0x1000
+
+DEFINE_HASH_MAP(test_map, uint32_t, int);
+
+static int count_entries(struct test_map *map, uint32_t key) {
+  int n = 0;
+  for (int i = test_map_find(map, key); i >= 0;
+       i = test_map_find_next(map, key, i)) {
+    n++;
+  }
+  return n;
+}
+
+TEST(hash_map_insert_get) {
+  struct test_map map = {0};
+
+  CHECK_EQ(test_map_get(&map, 0), NULL);
+
+  for (int i = 0; i < MAX_ENTRIES; i++) {
+    test_map_insert(&map, (uint32_t)i * 4, i);
+  }
+
+  CHECK_EQ(map.num_entries, MAX_ENTRIES);
+
+  for (int i = 0; i < MAX_ENTRIES; i++) {
+    int *value = test_map_get(&map, (uint32_t)i * 4);
+    CHECK_NOTNULL(value);
+    CHECK_EQ(*value, i);
+    CHECK_EQ(test_map_get(&map, (uint32_t)i * 4 + 1), NULL);
+  }
+
+  test_map_destroy(&map);
+}
+
+TEST(hash_map_duplicate_keys) {
+  struct test_map map = {0};
+
+  for (int i = 0; i < 3; i++) {
+    test_map_insert(&map, 0x8c010000, i);
+  }
+  test_map_insert(&map, 0x8c010002, 3);
+
+  CHECK_EQ(count_entries(&map, 0x8c010000), 3);
+  CHECK_EQ(count_entries(&map, 0x8c010002), 1);
+
+  CHECK(test_map_remove(&map, 0x8c010000));
+  CHECK_EQ(count_entries(&map, 0x8c010000), 2);
+  CHECK_EQ(map.num_entries, 3);
+
+  test_map_destroy(&map);
+}
+
+TEST(hash_map_remove) {
+  struct test_map map = {0};
+
+  for (int i = 0; i < MAX_ENTRIES; i++) {
+    test_map_insert(&map, (uint32_t)rand(), i);
+  }
+
+  /* drain the map, each removal shifts the rest of its probe sequence back
+     into the freed slot */
+  hash_map_for_each(i, &map, test_map) {
+    while (hash_map_occupied(&map, i)) {
+      test_map_remove_slot(&map, i);
+    }
+  }
+
+  CHECK_EQ(map.num_entries, 0);
+  CHECK_EQ(test_map_next_slot(&map, 0), map.size);
+
+  test_map_destroy(&map);
+}
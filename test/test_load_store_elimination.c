@@ -55,9 +55,8 @@ static char scratch_buffer[1024 * 1024];
       "i32 %5 = sub i32 %4, i32 0x10\n"
       "store_context i32 0x20, i32 %5\n";
 
-  struct ir ir = {0};
-  ir.buffer = ir_buffer;
-  ir.capacity = sizeof(ir_buffer);
+  struct ir ir;
+  ir_init(&ir, ir_buffer, sizeof(ir_buffer));
 
   FILE *input = tmpfile();
   fwrite(input_str, 1, sizeof(input_str) - 1, input);
@@ -0,0 +1,156 @@
+#include "jit/ir/ir.h"
+#include "jit/passes/memory_access_coalescing_pass.h"
+#include "pass_test.h"
+#include "retest.h"
+
+static void run_mac(struct ir *ir) {
+  struct mac *mac = mac_create();
+  mac_run(mac, ir);
+  mac_destroy(mac);
+}
+
+TEST(mac_merge_loads) {
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "i32 %3 = load_fast i32 %2\n"
+      "i32 %4 = load_fast i32 %1\n"
+      "store_context i32 0x14, i32 %4\n"
+      "store_context i32 0x18, i32 %3\n";
+
+  static const char output_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "i64 %3 = load_fast i32 %1\n"
+      "i32 %4 = trunc i64 %3\n"
+      "i64 %5 = lshr i64 %3, i32 0x20\n"
+      "i32 %6 = trunc i64 %5\n"
+      "store_context i32 0x14, i32 %4\n"
+      "store_context i32 0x18, i32 %6\n";
+
+  pass_test_run(&run_mac, input_str, output_str);
+}
+
+TEST(mac_merge_stores) {
+  /* the halves of a merged load are written back as a single store */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i64 %2 = load_context i32 0x18\n"
+      "i32 %3 = trunc i64 %2\n"
+      "i64 %4 = lshr i64 %2, i32 0x20\n"
+      "i32 %5 = trunc i64 %4\n"
+      "i32 %6 = add i32 %1, i32 0x8\n"
+      "i32 %7 = add i32 %1, i32 0xc\n"
+      "store_fast i32 %7, i32 %5\n"
+      "store_fast i32 %6, i32 %3\n";
+
+  static const char output_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i64 %2 = load_context i32 0x18\n"
+      "i32 %3 = trunc i64 %2\n"
+      "i64 %4 = lshr i64 %2, i32 0x20\n"
+      "i32 %5 = trunc i64 %4\n"
+      "i32 %6 = add i32 %1, i32 0x8\n"
+      "i32 %7 = add i32 %1, i32 0xc\n"
+      "store_fast i32 %6, i64 %2\n";
+
+  pass_test_run(&run_mac, input_str, output_str);
+}
+
+TEST(mac_aliasing_store) {
+  /* the store may write to either of the loaded addresses */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = load_context i32 0x14\n"
+      "i32 %3 = add i32 %1, i32 0x4\n"
+      "i32 %4 = load_fast i32 %1\n"
+      "store_fast i32 %2, i32 0x0\n"
+      "i32 %6 = load_fast i32 %3\n"
+      "store_context i32 0x18, i32 %4\n"
+      "store_context i32 0x1c, i32 %6\n";
+
+  pass_test_run(&run_mac, input_str, input_str);
+}
+
+TEST(mac_call) {
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i64 %2 = load_context i32 0x30\n"
+      "i32 %3 = add i32 %1, i32 0x4\n"
+      "i32 %4 = load_fast i32 %1\n"
+      "call i64 %2\n"
+      "i32 %6 = load_fast i32 %3\n"
+      "store_context i32 0x18, i32 %4\n"
+      "store_context i32 0x1c, i32 %6\n";
+
+  pass_test_run(&run_mac, input_str, input_str);
+}
+
+TEST(mac_slowmem) {
+  /* slowmem accesses may run arbitrary handlers */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = load_context i32 0x14\n"
+      "i32 %3 = add i32 %1, i32 0x4\n"
+      "i32 %4 = load_fast i32 %1\n"
+      "i32 %5 = load_guest i32 %2\n"
+      "i32 %6 = load_fast i32 %3\n"
+      "store_context i32 0x18, i32 %4\n"
+      "store_context i32 0x1c, i32 %5\n"
+      "store_context i32 0x20, i32 %6\n";
+
+  pass_test_run(&run_mac, input_str, input_str);
+}
+
+TEST(mac_stores_across_loads) {
+  /* stores aren't merged across any other access, fastmem or slowmem */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = load_context i32 0x14\n"
+      "i32 %3 = add i32 %1, i32 0x4\n"
+      "i32 %4 = add i32 %2, i32 0x4\n"
+      "i64 %5 = load_context i32 0x18\n"
+      "i32 %6 = trunc i64 %5\n"
+      "i64 %7 = lshr i64 %5, i32 0x20\n"
+      "i32 %8 = trunc i64 %7\n"
+      "store_fast i32 %1, i32 %6\n"
+      "i32 %10 = load_guest i32 %2\n"
+      "store_fast i32 %3, i32 %8\n"
+      "store_fast i32 %2, i32 %6\n"
+      "i32 %13 = load_fast i32 %1\n"
+      "store_fast i32 %4, i32 %8\n"
+      "store_context i32 0x1c, i32 %10\n"
+      "store_context i32 0x20, i32 %13\n";
+
+  pass_test_run(&run_mac, input_str, input_str);
+}
+
+TEST(mac_misaligned) {
+  /* merging accesses at offsets 0x4 and 0x8 would result in a misaligned
+     64-bit access */
+  static const char input_str[] =
+      "%0:\n"
+      "i32 %1 = load_context i32 0x10\n"
+      "i32 %2 = add i32 %1, i32 0x4\n"
+      "i32 %3 = add i32 %1, i32 0x8\n"
+      "i32 %4 = load_fast i32 %2\n"
+      "i32 %5 = load_fast i32 %3\n"
+      "i64 %6 = load_context i32 0x18\n"
+      "i32 %7 = trunc i64 %6\n"
+      "i64 %8 = lshr i64 %6, i32 0x20\n"
+      "i32 %9 = trunc i64 %8\n"
+      "store_fast i32 %2, i32 %7\n"
+      "store_fast i32 %3, i32 %9\n"
+      "store_context i32 0x14, i32 %4\n"
+      "store_context i32 0x14, i32 %5\n";
+
+  pass_test_run(&run_mac, input_str, input_str);
+}
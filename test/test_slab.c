@@ -0,0 +1,58 @@
+#include "core/slab.h"
+#include "retest.h"
+
+#define MAX_OBJS 0x1000
+
+struct obj {
+  int a;
+  int b;
+  int c;
+};
+
+static struct obj *objs[MAX_OBJS];
+
+TEST(slab_alloc_free) {
+  struct slab slab;
+  slab_init(&slab, sizeof(struct obj), 256);
+
+  for (int i = 0; i < MAX_OBJS; i++) {
+    objs[i] = slab_alloc(&slab);
+    CHECK_EQ(objs[i]->a, 0);
+    objs[i]->a = i;
+  }
+
+  for (int i = 0; i < MAX_OBJS; i++) {
+    CHECK_EQ(objs[i]->a, i);
+  }
+
+  /* freed objects are handed out again before new ones are carved out */
+  slab_free(&slab, objs[7]);
+  CHECK_EQ(slab_alloc(&slab), objs[7]);
+  CHECK_EQ(slab.num_objs, MAX_OBJS);
+
+  slab_destroy(&slab);
+}
+
+TEST(slab_reset) {
+  struct slab slab;
+  slab_init(&slab, sizeof(struct obj), 256);
+
+  for (int i = 0; i < MAX_OBJS; i++) {
+    objs[i] = slab_alloc(&slab);
+  }
+
+  struct slab_chunk *tail = slab.tail;
+
+  /* the same memory is reused in the same order after a reset, without
+     allocating any new chunks */
+  slab_reset(&slab);
+  CHECK_EQ(slab.num_objs, 0);
+
+  for (int i = 0; i < MAX_OBJS; i++) {
+    CHECK_EQ(slab_alloc(&slab), objs[i]);
+  }
+
+  CHECK_EQ(slab.tail, tail);
+
+  slab_destroy(&slab);
+}
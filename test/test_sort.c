@@ -0,0 +1,57 @@
+#include "core/core.h"
+#include "core/sort.h"
+#include "retest.h"
+
+struct entry {
+  int key;
+  int order;
+};
+
+static int entry_ascending(const void *a, const void *b) {
+  return ((const struct entry *)a)->key <= ((const struct entry *)b)->key;
+}
+
+static int entry_descending(const void *a, const void *b) {
+  return ((const struct entry *)a)->key >= ((const struct entry *)b)->key;
+}
+
+static void sort_entries(const int *keys, int num, sort_cmp cmp,
+                         const int *expected) {
+  struct entry entries[16];
+
+  for (int i = 0; i < num; i++) {
+    entries[i].key = keys[i];
+    entries[i].order = i;
+  }
+
+  msort(entries, num, sizeof(struct entry), cmp);
+
+  for (int i = 0; i < num; i++) {
+    CHECK_EQ(entries[i].key, expected[i]);
+  }
+
+  /* equal keys keep the order they were in */
+  for (int i = 1; i < num; i++) {
+    if (entries[i].key == entries[i - 1].key) {
+      CHECK_LT(entries[i - 1].order, entries[i].order);
+    }
+  }
+}
+
+TEST(msort_ascending) {
+  static const int keys[] = {3, 9, 1, 7, 5, 2, 8, 4};
+  static const int expected[] = {1, 2, 3, 4, 5, 7, 8, 9};
+  sort_entries(keys, ARRAY_SIZE(keys), &entry_ascending, expected);
+}
+
+TEST(msort_descending) {
+  static const int keys[] = {3, 9, 1, 7, 5, 2, 8, 4};
+  static const int expected[] = {9, 8, 7, 5, 4, 3, 2, 1};
+  sort_entries(keys, ARRAY_SIZE(keys), &entry_descending, expected);
+}
+
+TEST(msort_stable) {
+  static const int keys[] = {2, 1, 2, 0, 1, 2, 0};
+  static const int expected[] = {0, 0, 1, 1, 2, 2, 2};
+  sort_entries(keys, ARRAY_SIZE(keys), &entry_ascending, expected);
+}
@@ -0,0 +1,400 @@
+/* gentables generates the static lookup tables used by the emulator at build
+   time, so they live in the executable's read-only data instead of being
+   computed on each startup. it's built and run on the host, and must not link
+   against any of the sources whose tables it's generating */
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "guest/pvr/ta_types.h"
+#include "jit/frontend/armv3/armv3_disasm.h"
+#include "jit/frontend/sh4/sh4_disasm.h"
+
+static int popcnt(uint32_t v) {
+  int n = 0;
+  while (v) {
+    v &= v - 1;
+    n++;
+  }
+  return n;
+}
+
+static void parse_sig(const char *sig, uint32_t *opcode, uint32_t *mask) {
+  size_t len = strlen(sig);
+
+  *opcode = 0;
+  *mask = 0;
+
+  /* 0 or 1 represents part of the opcode, anything else is a flag */
+  for (size_t j = 0; j < len; j++) {
+    char c = sig[len - j - 1];
+
+    if (c == '0' || c == '1') {
+      *opcode |= (uint32_t)(c - '0') << j;
+      *mask |= (uint32_t)1 << j;
+    }
+  }
+}
+
+/*
+ * output helpers
+ */
+static FILE *open_table(const char *dir, const char *name) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(fp, "/* generated by gentables, do not edit */\n");
+
+  return fp;
+}
+
+static void write_ints(FILE *fp, const int *data, int n) {
+  for (int i = 0; i < n; i++) {
+    fprintf(fp, "%d,%s", data[i], (i % 16) == 15 || i == n - 1 ? "\n" : " ");
+  }
+}
+
+static void close_table(FILE *fp) {
+  if (ferror(fp) || fclose(fp)) {
+    fprintf(stderr, "failed to write table\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * sh4 opcode lookup, indexed by the full 16-bit instruction
+ */
+struct sig {
+  const char *name;
+  const char *sig;
+};
+
+static struct sig sh4_sigs[NUM_SH4_OPS] = {
+#define SH4_INSTR(name, desc, sig, cycles, flags) {#name, #sig},
+#include "jit/frontend/sh4/sh4_instr.inc"
+#undef SH4_INSTR
+};
+
+static void gen_sh4_optable(const char *dir) {
+  static int optable[UINT16_MAX + 1];
+  uint32_t opcodes[ARRAY_SIZE(sh4_sigs)];
+  uint32_t masks[ARRAY_SIZE(sh4_sigs)];
+
+  for (int i = 1; i < (int)ARRAY_SIZE(sh4_sigs); i++) {
+    parse_sig(sh4_sigs[i].sig, &opcodes[i], &masks[i]);
+  }
+
+  for (int value = 0; value <= UINT16_MAX; value++) {
+    for (int i = 1 /* skip SH4_OP_INVALID */; i < (int)ARRAY_SIZE(sh4_sigs);
+         i++) {
+      if ((value & masks[i]) == opcodes[i]) {
+        optable[value] = i;
+        break;
+      }
+    }
+  }
+
+  FILE *fp = open_table(dir, "jit/frontend/sh4/sh4_optable.inc");
+  write_ints(fp, optable, (int)ARRAY_SIZE(optable));
+  close_table(fp);
+}
+
+/*
+ * armv3 opcode lookup, indexed by the bits in ARMV3_LOOKUP_MASK
+ */
+static struct sig armv3_sigs[NUM_ARMV3_OPS] = {
+#define ARMV3_INSTR(name, desc, sig, cycles, flags) {#name, #sig},
+#include "jit/frontend/armv3/armv3_instr.inc"
+#undef ARMV3_INSTR
+};
+
+static void gen_armv3_optable(const char *dir) {
+  static int optable[ARMV3_LOOKUP_SIZE];
+  uint32_t opcodes[ARRAY_SIZE(armv3_sigs)];
+  uint32_t masks[ARRAY_SIZE(armv3_sigs)];
+
+  for (int i = 1; i < (int)ARRAY_SIZE(armv3_sigs); i++) {
+    parse_sig(armv3_sigs[i].sig, &opcodes[i], &masks[i]);
+
+    /* ignore bits outside of lookup mask */
+    opcodes[i] &= ARMV3_LOOKUP_MASK;
+    masks[i] &= ARMV3_LOOKUP_MASK;
+  }
+
+  for (uint32_t hi = 0; hi < ARMV3_LOOKUP_SIZE_HI; hi++) {
+    for (uint32_t lo = 0; lo < ARMV3_LOOKUP_SIZE_LO; lo++) {
+      uint32_t instr = ARMV3_LOOKUP_INSTR(hi, lo);
+
+      /* some operations are differentiated by having a fixed set of flags in
+         the lower bits (while sharing the same encoding in the upper bits).
+         due to this, operations with a more specific mask take precedence */
+      int prev_bits = 0;
+
+      for (int i = 1; i < (int)ARRAY_SIZE(armv3_sigs); i++) {
+        if ((instr & masks[i]) != opcodes[i]) {
+          continue;
+        }
+
+        int bits = popcnt(masks[i]);
+
+        if (bits == prev_bits) {
+          fprintf(stderr, "ambiguous armv3 encoding 0x%08x for %s\n", instr,
+                  armv3_sigs[i].name);
+          exit(EXIT_FAILURE);
+        }
+
+        if (bits > prev_bits) {
+          optable[ARMV3_LOOKUP_INDEX(instr)] = i;
+          prev_bits = bits;
+        }
+      }
+    }
+  }
+
+  FILE *fp = open_table(dir, "jit/frontend/armv3/armv3_optable.inc");
+  write_ints(fp, optable, (int)ARRAY_SIZE(optable));
+  close_table(fp);
+}
+
+/*
+ * ta parameter lookups, indexed by the pcw's obj control, para type and either
+ * the list or vertex type
+ */
+static int ta_poly_type_raw(union pcw pcw) {
+  if (pcw.list_type == TA_LIST_OPAQUE_MODVOL ||
+      pcw.list_type == TA_LIST_TRANSLUCENT_MODVOL) {
+    return 6;
+  }
+
+  if (pcw.para_type == TA_PARAM_SPRITE) {
+    return 5;
+  }
+
+  if (pcw.volume) {
+    if (pcw.col_type == 0) {
+      return 3;
+    }
+    if (pcw.col_type == 2) {
+      return 4;
+    }
+    if (pcw.col_type == 3) {
+      return 3;
+    }
+  }
+
+  if (pcw.col_type == 0 || pcw.col_type == 1 || pcw.col_type == 3) {
+    return 0;
+  }
+  if (pcw.col_type == 2 && pcw.texture && !pcw.offset) {
+    return 1;
+  }
+  if (pcw.col_type == 2 && pcw.texture && pcw.offset) {
+    return 2;
+  }
+  if (pcw.col_type == 2 && !pcw.texture) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int ta_vert_type_raw(union pcw pcw) {
+  if (pcw.list_type == TA_LIST_OPAQUE_MODVOL ||
+      pcw.list_type == TA_LIST_TRANSLUCENT_MODVOL) {
+    return 17;
+  }
+
+  if (pcw.para_type == TA_PARAM_SPRITE) {
+    return pcw.texture ? 16 : 15;
+  }
+
+  if (pcw.volume) {
+    if (pcw.texture) {
+      if (pcw.col_type == 0) {
+        return pcw.uv_16bit ? 12 : 11;
+      }
+      if (pcw.col_type == 2 || pcw.col_type == 3) {
+        return pcw.uv_16bit ? 14 : 13;
+      }
+    }
+
+    if (pcw.col_type == 0) {
+      return 9;
+    }
+    if (pcw.col_type == 2 || pcw.col_type == 3) {
+      return 10;
+    }
+  }
+
+  if (pcw.texture) {
+    if (pcw.col_type == 0) {
+      return pcw.uv_16bit ? 4 : 3;
+    }
+    if (pcw.col_type == 1) {
+      return pcw.uv_16bit ? 6 : 5;
+    }
+    if (pcw.col_type == 2 || pcw.col_type == 3) {
+      return pcw.uv_16bit ? 8 : 7;
+    }
+  }
+
+  if (pcw.col_type == 0) {
+    return 0;
+  }
+  if (pcw.col_type == 1) {
+    return 1;
+  }
+  if (pcw.col_type == 2 || pcw.col_type == 3) {
+    return 2;
+  }
+
+  return 0;
+}
+
+static int ta_param_size_raw(union pcw pcw, int vert_type) {
+  switch (pcw.para_type) {
+    case TA_PARAM_END_OF_LIST:
+      return 32;
+    case TA_PARAM_USER_TILE_CLIP:
+      return 32;
+    case TA_PARAM_OBJ_LIST_SET:
+      return 32;
+    case TA_PARAM_POLY_OR_VOL: {
+      int type = ta_poly_type_raw(pcw);
+      return type == 0 || type == 1 || type == 3 ? 32 : 64;
+    }
+    case TA_PARAM_SPRITE:
+      return 32;
+    case TA_PARAM_VERTEX: {
+      return vert_type == 0 || vert_type == 1 || vert_type == 2 ||
+                     vert_type == 3 || vert_type == 4 || vert_type == 7 ||
+                     vert_type == 8 || vert_type == 9 || vert_type == 10
+                 ? 32
+                 : 64;
+    }
+    default:
+      return 0;
+  }
+}
+
+static void gen_ta_tables(const char *dir) {
+  static int param_sizes[0x100 * TA_NUM_PARAMS * TA_NUM_VERTS];
+  static int poly_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS];
+  static int vert_types[0x100 * TA_NUM_PARAMS * TA_NUM_LISTS];
+
+  for (int i = 0; i < 0x100; i++) {
+    union pcw pcw = {0};
+    pcw.obj_control = (uint8_t)i;
+
+    for (int j = 0; j < TA_NUM_PARAMS; j++) {
+      pcw.para_type = j;
+
+      for (int k = 0; k < TA_NUM_VERTS; k++) {
+        int param_idx = i * TA_NUM_PARAMS * TA_NUM_VERTS + j * TA_NUM_VERTS + k;
+        param_sizes[param_idx] = ta_param_size_raw(pcw, k);
+      }
+
+      for (int k = 0; k < TA_NUM_LISTS; k++) {
+        pcw.list_type = k;
+
+        int idx = i * TA_NUM_PARAMS * TA_NUM_LISTS + j * TA_NUM_LISTS + k;
+        poly_types[idx] = ta_poly_type_raw(pcw);
+        vert_types[idx] = ta_vert_type_raw(pcw);
+      }
+
+      pcw.list_type = 0;
+    }
+  }
+
+  FILE *fp = open_table(dir, "guest/pvr/ta_param_sizes.inc");
+  write_ints(fp, param_sizes, (int)ARRAY_SIZE(param_sizes));
+  close_table(fp);
+
+  fp = open_table(dir, "guest/pvr/ta_poly_types.inc");
+  write_ints(fp, poly_types, (int)ARRAY_SIZE(poly_types));
+  close_table(fp);
+
+  fp = open_table(dir, "guest/pvr/ta_vert_types.inc");
+  write_ints(fp, vert_types, (int)ARRAY_SIZE(vert_types));
+  close_table(fp);
+}
+
+/*
+ * twiddled texture lookup, spreading the bits of each index out to the even
+ * bit positions
+ */
+static void gen_twiddle_table(const char *dir) {
+  static int twitbl[1024];
+
+  for (int i = 0; i < (int)ARRAY_SIZE(twitbl); i++) {
+    for (int j = 0, k = 1; k <= i; j++, k <<= 1) {
+      twitbl[i] |= (i & k) << j;
+    }
+  }
+
+  FILE *fp = open_table(dir, "guest/pvr/tex_twiddle.inc");
+  write_ints(fp, twitbl, (int)ARRAY_SIZE(twitbl));
+  close_table(fp);
+}
+
+/*
+ * aica volume scaling, see the comments in aica.c for the derivation of each.
+ * a 32-bit int is used for the scale, leaving 15 bits for the fraction
+ */
+static void gen_aica_tables(const char *dir) {
+  static int mvol_scale[16];
+  static int tl_scale[256];
+  static int pan_scale[16];
+
+  /* 0 is a special case that mutes the output */
+  for (int i = 1; i < 16; i++) {
+    mvol_scale[i] = (int)((1 << 15) / pow(2.0f, (15 - i) / 2.0f));
+  }
+
+  for (int i = 0; i < 256; i++) {
+    tl_scale[i] = (int)((1 << 15) / pow(2.0f, i / 16.0f));
+  }
+
+  /* 0xf is a special case that mutes the output */
+  for (int i = 0; i < 15; i++) {
+    pan_scale[i] = (int)((1 << 15) / pow(2.0f, i / 2.0f));
+  }
+
+  FILE *fp = open_table(dir, "guest/aica/aica_mvol_scale.inc");
+  write_ints(fp, mvol_scale, (int)ARRAY_SIZE(mvol_scale));
+  close_table(fp);
+
+  fp = open_table(dir, "guest/aica/aica_tl_scale.inc");
+  write_ints(fp, tl_scale, (int)ARRAY_SIZE(tl_scale));
+  close_table(fp);
+
+  fp = open_table(dir, "guest/aica/aica_pan_scale.inc");
+  write_ints(fp, pan_scale, (int)ARRAY_SIZE(pan_scale));
+  close_table(fp);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: gentables <output dir>\n");
+    return EXIT_FAILURE;
+  }
+
+  const char *dir = argv[1];
+
+  gen_sh4_optable(dir);
+  gen_armv3_optable(dir);
+  gen_ta_tables(dir);
+  gen_twiddle_table(dir);
+  gen_aica_tables(dir);
+
+  return EXIT_SUCCESS;
+}
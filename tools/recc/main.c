@@ -1,6 +1,7 @@
 #include "core/core.h"
 #include "core/filesystem.h"
 #include "core/option.h"
+#include "core/time.h"
 #include "jit/backend/x64/x64_backend.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
@@ -8,20 +9,83 @@
 #include "jit/pass_stats.h"
 #include "jit/passes/constant_propagation_pass.h"
 #include "jit/passes/control_flow_analysis_pass.h"
+#include "jit/passes/conversion_elimination_pass.h"
 #include "jit/passes/dead_code_elimination_pass.h"
 #include "jit/passes/expression_simplification_pass.h"
+#include "jit/passes/global_value_numbering_pass.h"
 #include "jit/passes/load_store_elimination_pass.h"
+#include "jit/passes/memory_access_coalescing_pass.h"
 #include "jit/passes/register_allocation_pass.h"
 
-DEFINE_OPTION_STRING(pass, "cfa,lse,cprop,esimp,dce,ra",
+DEFINE_OPTION_STRING(pass, "cfa,lse,cprop,esimp,gvn,mac,cve,dce,ra",
                      "Comma-separated list of passes to run");
+DEFINE_OPTION_INT(stats, 1, "Print pass stats and timings");
+DEFINE_OPTION_STRING(convert, "",
+                     "Convert the input ir to the binary format, writing it "
+                     "to this directory instead of compiling it");
+DEFINE_OPTION_INT(bench, 0,
+                  "Compile the input this many times, printing throughput "
+                  "metrics as json");
+DEFINE_OPTION_INT(tune, 0,
+                  "Search pass orders for this many rounds, printing the "
+                  "pareto-best pipelines");
 
 DEFINE_PASS_STAT(ir_instrs_total, "total ir instructions");
 DEFINE_PASS_STAT(ir_instrs_removed, "removed ir instructions");
 
+/* totals across every block compiled, reported in bench mode */
+static int64_t total_blocks;
+static int64_t total_guest_instrs;
+static int64_t total_host_bytes;
+
 DEFINE_JIT_CODE_BUFFER(code);
 static uint8_t ir_buffer[1024 * 1024];
 
+/* the backend's dispatch thunks call out to these, compiled code is never
+   actually run */
+static void guest_compile_code(void *data, uint32_t addr) {}
+static void guest_link_code(void *data, void *branch, uint32_t addr) {}
+static void guest_check_interrupts(void *data) {}
+
+/* guest memory accesses emitted as calls need a valid target to assemble */
+static uint32_t guest_read(void *userdata, uint32_t addr, uint32_t mask) {
+  return 0;
+}
+static void guest_write(void *userdata, uint32_t addr, uint32_t data,
+                        uint32_t mask) {}
+static void guest_lookup(struct memory *mem, uint32_t addr, void **userdata,
+                         uint8_t **ptr, mem_read_cb *read,
+                         mem_write_cb *write) {
+  if (userdata) {
+    *userdata = NULL;
+  }
+  if (ptr) {
+    *ptr = NULL;
+  }
+  if (read) {
+    *read = &guest_read;
+  }
+  if (write) {
+    *write = &guest_write;
+  }
+}
+static uint8_t guest_r8(struct memory *mem, uint32_t addr) {
+  return 0;
+}
+static uint16_t guest_r16(struct memory *mem, uint32_t addr) {
+  return 0;
+}
+static uint32_t guest_r32(struct memory *mem, uint32_t addr) {
+  return 0;
+}
+static uint64_t guest_r64(struct memory *mem, uint32_t addr) {
+  return 0;
+}
+static void guest_w8(struct memory *mem, uint32_t addr, uint8_t data) {}
+static void guest_w16(struct memory *mem, uint32_t addr, uint16_t data) {}
+static void guest_w32(struct memory *mem, uint32_t addr, uint32_t data) {}
+static void guest_w64(struct memory *mem, uint32_t addr, uint64_t data) {}
+
 static int get_num_instrs(const struct ir *ir) {
   int n = 0;
 
@@ -35,6 +99,20 @@ static int get_num_instrs(const struct ir *ir) {
   return n;
 }
 
+static int get_num_guest_instrs(const struct ir *ir) {
+  int n = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      if (instr->op == OP_SOURCE_INFO) {
+        n++;
+      }
+    }
+  }
+
+  return n;
+}
+
 static void sanitize_ir(struct ir *ir) {
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
     list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
@@ -44,25 +122,135 @@ static void sanitize_ir(struct ir *ir) {
 
       /* ensure that address are within 2 GB of the code buffer */
       uint64_t addr = instr->arg[0]->i64;
-      addr = (uint64_t)code | (addr & 0x7fffffff);
+      addr = (uint64_t)code.data | (addr & 0x7fffffff);
       ir_set_arg0(ir, instr, ir_alloc_i64(ir, addr));
     }
   }
 }
 
+static int read_ir(const char *filename, struct ir *ir) {
+  FILE *input = fopen(filename, "rb");
+  CHECK(input);
+
+  /* detect the format from the binary format's magic */
+  char magic[IR_BINARY_MAGIC_SIZE] = {0};
+  fread(magic, 1, sizeof(magic), input);
+
+  int res;
+
+  if (!memcmp(magic, IR_BINARY_MAGIC, IR_BINARY_MAGIC_SIZE)) {
+    fseek(input, 0, SEEK_END);
+    long size = ftell(input);
+    fseek(input, 0, SEEK_SET);
+
+    uint8_t *data = malloc(size);
+    CHECK_EQ((long)fread(data, 1, size, input), size);
+    res = ir_read_binary(data, (int)size, ir);
+    free(data);
+  } else {
+    fseek(input, 0, SEEK_SET);
+    res = ir_read(input, ir);
+  }
+
+  fclose(input);
+
+  return res;
+}
+
+static void convert_file(const char *filename, struct ir *ir) {
+  char base[PATH_MAX];
+  fs_basename(filename, base, sizeof(base));
+
+  char output_path[PATH_MAX];
+  snprintf(output_path, sizeof(output_path), "%s" PATH_SEPARATOR "%s.bin",
+           OPTION_convert, base);
+
+  FILE *output = fopen(output_path, "wb");
+  CHECK(output, "failed to open %s", output_path);
+  ir_write_binary(ir, output);
+  fclose(output);
+}
+
+static int run_pass(struct jit_backend *backend, const char *name,
+                    struct ir *ir) {
+  struct pass_timer timer;
+
+  if (!strcmp(name, "cfa")) {
+    struct cfa *cfa = cfa_create();
+    pass_timer_begin(&timer, PASS_CFA, ir);
+    cfa_run(cfa, ir);
+    pass_timer_end(&timer, ir);
+    cfa_destroy(cfa);
+  } else if (!strcmp(name, "lse")) {
+    struct lse *lse = lse_create();
+    pass_timer_begin(&timer, PASS_LSE, ir);
+    lse_run(lse, ir);
+    pass_timer_end(&timer, ir);
+    lse_destroy(lse);
+  } else if (!strcmp(name, "cprop")) {
+    struct cprop *cprop = cprop_create();
+    pass_timer_begin(&timer, PASS_CPROP, ir);
+    cprop_run(cprop, ir);
+    pass_timer_end(&timer, ir);
+    cprop_destroy(cprop);
+  } else if (!strcmp(name, "dce")) {
+    struct dce *dce = dce_create();
+    pass_timer_begin(&timer, PASS_DCE, ir);
+    dce_run(dce, ir);
+    pass_timer_end(&timer, ir);
+    dce_destroy(dce);
+  } else if (!strcmp(name, "esimp")) {
+    struct esimp *esimp = esimp_create();
+    pass_timer_begin(&timer, PASS_ESIMP, ir);
+    esimp_run(esimp, ir);
+    pass_timer_end(&timer, ir);
+    esimp_destroy(esimp);
+  } else if (!strcmp(name, "gvn")) {
+    struct gvn *gvn = gvn_create();
+    pass_timer_begin(&timer, PASS_GVN, ir);
+    gvn_run(gvn, ir);
+    pass_timer_end(&timer, ir);
+    gvn_destroy(gvn);
+  } else if (!strcmp(name, "mac")) {
+    struct mac *mac = mac_create();
+    pass_timer_begin(&timer, PASS_MAC, ir);
+    mac_run(mac, ir);
+    pass_timer_end(&timer, ir);
+    mac_destroy(mac);
+  } else if (!strcmp(name, "cve")) {
+    struct cve *cve = cve_create();
+    pass_timer_begin(&timer, PASS_CVE, ir);
+    cve_run(cve, ir);
+    pass_timer_end(&timer, ir);
+    cve_destroy(cve);
+  } else if (!strcmp(name, "ra")) {
+    struct ra *ra = ra_create(backend->registers, backend->num_registers,
+                              backend->emitters, backend->num_emitters);
+    pass_timer_begin(&timer, PASS_RA, ir);
+    ra_run(ra, ir);
+    pass_timer_end(&timer, ir);
+    ra_destroy(ra);
+  } else {
+    return 0;
+  }
+
+  return 1;
+}
+
 static void process_file(struct jit_backend *backend, const char *filename,
                          int disable_dumps) {
-  struct ir ir = {0};
-  ir.buffer = ir_buffer;
-  ir.capacity = sizeof(ir_buffer);
+  struct ir ir;
+  ir_init(&ir, ir_buffer, sizeof(ir_buffer));
 
   /* read in the input ir */
-  FILE *input = fopen(filename, "r");
-  CHECK(input);
-  int r = ir_read(input, &ir);
-  fclose(input);
+  int r = read_ir(filename, &ir);
   CHECK(r);
 
+  if (*OPTION_convert) {
+    convert_file(filename, &ir);
+    return;
+  }
+
   /* sanitize absolute addresses in the ir */
   sanitize_ir(&ir);
 
@@ -71,35 +259,11 @@ static void process_file(struct jit_backend *backend, const char *filename,
   strncpy(passes, OPTION_pass, sizeof(passes));
 
   int num_instrs_before = get_num_instrs(&ir);
+  int num_guest_instrs = get_num_guest_instrs(&ir);
 
   char *name = strtok(passes, ",");
   while (name) {
-    if (!strcmp(name, "cfa")) {
-      struct cfa *cfa = cfa_create();
-      cfa_run(cfa, &ir);
-      cfa_destroy(cfa);
-    } else if (!strcmp(name, "lse")) {
-      struct lse *lse = lse_create();
-      lse_run(lse, &ir);
-      lse_destroy(lse);
-    } else if (!strcmp(name, "cprop")) {
-      struct cprop *cprop = cprop_create();
-      cprop_run(cprop, &ir);
-      cprop_destroy(cprop);
-    } else if (!strcmp(name, "dce")) {
-      struct dce *dce = dce_create();
-      dce_run(dce, &ir);
-      dce_destroy(dce);
-    } else if (!strcmp(name, "esimp")) {
-      struct esimp *esimp = esimp_create();
-      esimp_run(esimp, &ir);
-      esimp_destroy(esimp);
-    } else if (!strcmp(name, "ra")) {
-      struct ra *ra = ra_create(backend->registers, backend->num_registers,
-                                backend->emitters, backend->num_emitters);
-      ra_run(ra, &ir);
-      ra_destroy(ra);
-    } else {
+    if (!run_pass(backend, name, &ir)) {
       LOG_WARNING("unknown pass %s", name);
     }
 
@@ -121,8 +285,11 @@ static void process_file(struct jit_backend *backend, const char *filename,
   backend->reset(backend);
   uint8_t *host_addr = NULL;
   int host_size = 0;
+  struct pass_timer timer;
+  pass_timer_begin(&timer, PASS_ASSEMBLE, &ir);
   int res =
       backend->assemble_code(backend, &ir, &host_addr, &host_size, NULL, NULL);
+  pass_timer_end(&timer, &ir);
   CHECK(res);
 
   if (!disable_dumps) {
@@ -136,6 +303,60 @@ static void process_file(struct jit_backend *backend, const char *filename,
   /* update stats */
   STAT_ir_instrs_total += num_instrs_before;
   STAT_ir_instrs_removed += num_instrs_before - num_instrs_after;
+
+  total_blocks++;
+  total_guest_instrs += num_guest_instrs;
+  total_host_bytes += host_size;
+}
+
+static void bench_dump(int iterations) {
+  /* only the passes and the assembler are timed, not reading the input */
+  int64_t compile_ns = 0;
+
+  for (int i = 0; i < PASS_NUM_STAGES; i++) {
+    struct pass_timing t;
+    pass_timings_get(i, &t);
+    compile_ns += t.ns;
+  }
+
+  double blocks_per_sec =
+      compile_ns ? total_blocks / (compile_ns / (double)NS_PER_SEC) : 0.0;
+  double bytes_per_instr =
+      total_guest_instrs ? total_host_bytes / (double)total_guest_instrs : 0.0;
+
+  printf("{\n");
+  printf("  \"iterations\": %d,\n", iterations);
+  printf("  \"blocks\": %" PRId64 ",\n", total_blocks);
+  printf("  \"guest_instrs\": %" PRId64 ",\n", total_guest_instrs);
+  printf("  \"host_bytes\": %" PRId64 ",\n", total_host_bytes);
+  printf("  \"compile_ns\": %" PRId64 ",\n", compile_ns);
+  printf("  \"blocks_per_sec\": %.3f,\n", blocks_per_sec);
+  printf("  \"host_bytes_per_guest_instr\": %.3f,\n", bytes_per_instr);
+  printf("  \"stages\": {");
+
+  int need_comma = 0;
+
+  for (int i = 0; i < PASS_NUM_STAGES; i++) {
+    struct pass_timing t;
+    pass_timings_get(i, &t);
+
+    if (!t.runs) {
+      continue;
+    }
+
+    double ns_per_instr = t.instrs_in ? t.ns / (double)t.instrs_in : 0.0;
+
+    printf("%s\n    \"%s\": {\"runs\": %" PRId64 ", \"ns\": %" PRId64
+           ", \"instrs_in\": %" PRId64 ", \"instrs_out\": %" PRId64
+           ", \"ns_per_instr\": %.3f}",
+           need_comma ? "," : "", pass_stage_name(i), t.runs, t.ns,
+           t.instrs_in, t.instrs_out, ns_per_instr);
+
+    need_comma = 1;
+  }
+
+  printf("\n  }\n");
+  printf("}\n");
 }
 
 static void process_dir(struct jit_backend *backend, const char *path) {
@@ -157,7 +378,10 @@ static void process_dir(struct jit_backend *backend, const char *path) {
     snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", path,
              ent->d_name);
 
-    LOG_INFO("processing %s", filename);
+    /* keep the bench output machine-readable */
+    if (!OPTION_bench) {
+      LOG_INFO("processing %s", filename);
+    }
 
     process_file(backend, filename, 1);
   }
@@ -165,6 +389,291 @@ static void process_dir(struct jit_backend *backend, const char *path) {
   closedir(dir);
 }
 
+/*
+ * pass order tuning
+ *
+ * searches the orders and repetitions of the optimization passes between cfa
+ * and ra, starting from the default pipeline. each round expands the current
+ * pareto-best pipelines by removing, repeating or swapping their passes, and
+ * compiles the entire corpus with every new pipeline to score it
+ */
+#define TUNE_MAX_PASSES 16
+#define TUNE_MAX_CANDIDATES 4096
+
+static const char *tune_passes[] = {"lse", "cprop", "esimp", "gvn",
+                                    "mac", "cve",   "dce"};
+
+struct tune_candidate {
+  int8_t passes[TUNE_MAX_PASSES];
+  int num_passes;
+
+  int64_t host_bytes;
+  int64_t cost;
+  int64_t compile_ns;
+};
+
+struct tune {
+  char **files;
+  int num_files;
+
+  struct tune_candidate candidates[TUNE_MAX_CANDIDATES];
+  int num_candidates;
+};
+
+/* static estimate of the cost of running the final ir, weighing the ops
+   which end up as calls or slow instructions more heavily */
+static int64_t estimate_cost(const struct ir *ir) {
+  int64_t cost = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      switch (instr->op) {
+        case OP_SOURCE_INFO:
+          break;
+        case OP_SDIV:
+        case OP_UDIV:
+        case OP_FDIV:
+        case OP_SQRT:
+          cost += 8;
+          break;
+        case OP_LOAD_FAST:
+        case OP_STORE_FAST:
+        case OP_LOAD_CONTEXT:
+        case OP_STORE_CONTEXT:
+        case OP_LOAD_LOCAL:
+        case OP_STORE_LOCAL:
+          cost += 2;
+          break;
+        default:
+          cost += (ir_opdefs[instr->op].flags & IR_FLAG_CALL) ? 10 : 1;
+          break;
+      }
+    }
+  }
+
+  return cost;
+}
+
+static void tune_pipeline(const struct tune_candidate *c, char *buf,
+                          size_t size) {
+  char *ptr = buf;
+  char *end = buf + size;
+
+  ptr += snprintf(ptr, end - ptr, "cfa");
+  for (int i = 0; i < c->num_passes && ptr < end; i++) {
+    ptr += snprintf(ptr, end - ptr, ",%s", tune_passes[c->passes[i]]);
+  }
+  if (ptr < end) {
+    snprintf(ptr, end - ptr, ",ra");
+  }
+}
+
+static void tune_score(struct jit_backend *backend, struct tune *tune,
+                       struct tune_candidate *c) {
+  c->host_bytes = 0;
+  c->cost = 0;
+  c->compile_ns = 0;
+
+  for (int i = 0; i < tune->num_files; i++) {
+    struct ir ir;
+    ir_init(&ir, ir_buffer, sizeof(ir_buffer));
+    CHECK(read_ir(tune->files[i], &ir));
+    sanitize_ir(&ir);
+
+    /* only the passes and the assembler are timed */
+    int64_t start = time_nanoseconds();
+
+    run_pass(backend, "cfa", &ir);
+    for (int j = 0; j < c->num_passes; j++) {
+      run_pass(backend, tune_passes[c->passes[j]], &ir);
+    }
+    run_pass(backend, "ra", &ir);
+
+    backend->reset(backend);
+    uint8_t *host_addr = NULL;
+    int host_size = 0;
+    int res = backend->assemble_code(backend, &ir, &host_addr, &host_size,
+                                     NULL, NULL);
+    CHECK(res);
+
+    c->compile_ns += time_nanoseconds() - start;
+    c->host_bytes += host_size;
+    c->cost += estimate_cost(&ir);
+  }
+}
+
+static int tune_dominates(const struct tune_candidate *a,
+                          const struct tune_candidate *b) {
+  return a->host_bytes <= b->host_bytes && a->cost <= b->cost &&
+         a->compile_ns <= b->compile_ns &&
+         (a->host_bytes < b->host_bytes || a->cost < b->cost ||
+          a->compile_ns < b->compile_ns);
+}
+
+static int tune_pareto(struct tune *tune, int index) {
+  for (int i = 0; i < tune->num_candidates; i++) {
+    if (tune_dominates(&tune->candidates[i], &tune->candidates[index])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void tune_add(struct jit_backend *backend, struct tune *tune,
+                     const struct tune_candidate *c) {
+  if (tune->num_candidates >= TUNE_MAX_CANDIDATES) {
+    return;
+  }
+
+  /* skip pipelines which have already been scored */
+  for (int i = 0; i < tune->num_candidates; i++) {
+    const struct tune_candidate *other = &tune->candidates[i];
+
+    if (other->num_passes == c->num_passes &&
+        !memcmp(other->passes, c->passes, c->num_passes)) {
+      return;
+    }
+  }
+
+  struct tune_candidate *added = &tune->candidates[tune->num_candidates++];
+  *added = *c;
+  tune_score(backend, tune, added);
+}
+
+static void tune_expand(struct jit_backend *backend, struct tune *tune,
+                        const struct tune_candidate *c) {
+  /* remove each pass */
+  for (int i = 0; i < c->num_passes; i++) {
+    struct tune_candidate next = *c;
+    memmove(&next.passes[i], &next.passes[i + 1], c->num_passes - i - 1);
+    next.num_passes--;
+    tune_add(backend, tune, &next);
+  }
+
+  /* insert another run of each pass at each position */
+  if (c->num_passes < TUNE_MAX_PASSES) {
+    for (int i = 0; i <= c->num_passes; i++) {
+      for (int j = 0; j < (int)ARRAY_SIZE(tune_passes); j++) {
+        struct tune_candidate next = *c;
+        memmove(&next.passes[i + 1], &next.passes[i], c->num_passes - i);
+        next.passes[i] = (int8_t)j;
+        next.num_passes++;
+        tune_add(backend, tune, &next);
+      }
+    }
+  }
+
+  /* swap each pair of adjacent passes */
+  for (int i = 0; i + 1 < c->num_passes; i++) {
+    struct tune_candidate next = *c;
+    next.passes[i] = c->passes[i + 1];
+    next.passes[i + 1] = c->passes[i];
+    tune_add(backend, tune, &next);
+  }
+}
+
+static void tune_collect(struct tune *tune, const char *path) {
+  if (fs_isfile(path)) {
+    tune->files = realloc(tune->files, sizeof(char *) * (tune->num_files + 1));
+    tune->files[tune->num_files++] = strdup(path);
+    return;
+  }
+
+  DIR *dir = opendir(path);
+
+  if (!dir) {
+    LOG_WARNING("failed to open directory %s", path);
+    return;
+  }
+
+  struct dirent *ent = NULL;
+
+  while ((ent = readdir(dir)) != NULL) {
+    if (!(ent->d_type & DT_REG)) {
+      continue;
+    }
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", path,
+             ent->d_name);
+    tune_collect(tune, filename);
+  }
+
+  closedir(dir);
+}
+
+static void tune_run(struct jit_backend *backend, const char *path,
+                     int rounds) {
+  struct tune *tune = calloc(1, sizeof(struct tune));
+
+  tune_collect(tune, path);
+  CHECK_GT(tune->num_files, 0, "no ir found in %s", path);
+
+  /* seed the search with the default pipeline */
+  struct tune_candidate def = {0};
+  char passes[OPTION_MAX_LENGTH];
+  strncpy(passes, OPTION_pass, sizeof(passes));
+
+  for (char *name = strtok(passes, ","); name; name = strtok(NULL, ",")) {
+    for (int j = 0; j < (int)ARRAY_SIZE(tune_passes); j++) {
+      if (!strcmp(name, tune_passes[j]) && def.num_passes < TUNE_MAX_PASSES) {
+        def.passes[def.num_passes++] = (int8_t)j;
+      }
+    }
+  }
+
+  /* compile the corpus once up front, so the default pipeline's time isn't
+     skewed by it being the first to touch the corpus and code buffer */
+  tune_score(backend, tune, &def);
+  tune_add(backend, tune, &def);
+
+  int *frontier = calloc(TUNE_MAX_CANDIDATES, sizeof(int));
+
+  for (int round = 0; round < rounds; round++) {
+    /* expand from the pareto-best pipelines as of the start of the round */
+    int num_frontier = 0;
+    for (int i = 0; i < tune->num_candidates; i++) {
+      if (tune_pareto(tune, i)) {
+        frontier[num_frontier++] = i;
+      }
+    }
+
+    int before = tune->num_candidates;
+    for (int i = 0; i < num_frontier; i++) {
+      struct tune_candidate c = tune->candidates[frontier[i]];
+      tune_expand(backend, tune, &c);
+    }
+
+    LOG_INFO("round %d, scored %d pipelines over %d blocks", round + 1,
+             tune->num_candidates - before, tune->num_files);
+  }
+
+  /* print the pareto-best pipelines, with the default for reference */
+  printf("%12s %12s %12s  %s\n", "host bytes", "cost", "compile ms",
+         "pipeline");
+
+  for (int i = 0; i < tune->num_candidates; i++) {
+    if (i && !tune_pareto(tune, i)) {
+      continue;
+    }
+
+    const struct tune_candidate *c = &tune->candidates[i];
+    char pipeline[OPTION_MAX_LENGTH];
+    tune_pipeline(c, pipeline, sizeof(pipeline));
+
+    printf("%12" PRId64 " %12" PRId64 " %12.3f  %s%s\n", c->host_bytes,
+           c->cost, c->compile_ns / (double)NS_PER_MS, pipeline,
+           i ? "" : " (default)");
+  }
+
+  free(frontier);
+  for (int i = 0; i < tune->num_files; i++) {
+    free(tune->files[i]);
+  }
+  free(tune->files);
+  free(tune);
+}
+
 int main(int argc, char **argv) {
   if (!options_parse(&argc, &argv)) {
     return EXIT_FAILURE;
@@ -172,19 +681,52 @@ int main(int argc, char **argv) {
 
   const char *path = argv[1];
 
+  if (*OPTION_convert) {
+    CHECK(fs_mkdir(OPTION_convert), "failed to create %s", OPTION_convert);
+  }
+
   struct jit_guest guest = {0};
   guest.addr_mask = 0xff;
+  guest.compile_code = &guest_compile_code;
+  guest.link_code = &guest_link_code;
+  guest.check_interrupts = &guest_check_interrupts;
+  guest.lookup = &guest_lookup;
+  guest.r8 = &guest_r8;
+  guest.r16 = &guest_r16;
+  guest.r32 = &guest_r32;
+  guest.r64 = &guest_r64;
+  guest.w8 = &guest_w8;
+  guest.w16 = &guest_w16;
+  guest.w32 = &guest_w32;
+  guest.w64 = &guest_w64;
+
+  struct jit_backend *backend =
+      x64_backend_create(&guest, &code, JIT_CODE_BUFFER_SIZE, 0, 0);
+
+  if (OPTION_tune) {
+    tune_run(backend, path, OPTION_tune);
+    backend->destroy(backend);
+    return EXIT_SUCCESS;
+  }
 
-  struct jit_backend *backend = x64_backend_create(&guest, code, sizeof(code));
+  /* in bench mode, the input is compiled repeatedly without any dumps */
+  int iterations = MAX(OPTION_bench, 1);
 
-  if (fs_isfile(path)) {
-    process_file(backend, path, 0);
-  } else {
-    process_dir(backend, path);
+  for (int i = 0; i < iterations; i++) {
+    if (fs_isfile(path)) {
+      process_file(backend, path, OPTION_bench > 0);
+    } else {
+      process_dir(backend, path);
+    }
   }
 
-  LOG_INFO("");
-  pass_stats_dump();
+  if (OPTION_bench) {
+    bench_dump(iterations);
+  } else if (OPTION_stats) {
+    LOG_INFO("");
+    pass_stats_dump();
+    pass_timings_dump();
+  }
 
   backend->destroy(backend);
 
@@ -0,0 +1,290 @@
+#include <zlib.h>
+#include "core/core.h"
+#include "guest/gdrom/disc.h"
+#include "guest/gdrom/rdz.h"
+
+#define MAX_BLOCK_SIZE (RDZ_BLOCK_SECTORS * DISC_MAX_SECTOR_SIZE)
+
+/* the dictionary is made up of whole sectors sampled evenly across the data
+   tracks, giving each block a head start on the structures repeated
+   throughout the filesystem */
+#define DICT_SECTORS (RDZ_MAX_DICT_SIZE / 2048)
+
+static int get_track_index(struct disc *disc, struct track *track) {
+  for (int i = 0; i < disc_get_num_tracks(disc); i++) {
+    if (disc_get_track(disc, i) == track) {
+      return i;
+    }
+  }
+  LOG_FATAL("get_track_index failed to find track %d", track->num);
+}
+
+static void write_toc(FILE *fp, int leadin_fad, int leadout_fad,
+                      int first_track, int last_track) {
+  struct rdz_toc toc = {0};
+  toc.leadin_fad = leadin_fad;
+  toc.leadout_fad = leadout_fad;
+  toc.first_track = first_track;
+  toc.last_track = last_track;
+  CHECK_EQ(fwrite(&toc, sizeof(toc), 1, fp), 1);
+}
+
+/* the sectors available to a track run up until the next track, or the end of
+   the session it lies in. not all of them are necessarily backed by the image,
+   so probe for how many of them actually are */
+static int count_sectors(struct disc *disc, int n) {
+  static uint8_t data[MAX_BLOCK_SIZE];
+
+  struct track *track = disc_get_track(disc, n);
+  int end = INT_MAX;
+
+  if (n + 1 < disc_get_num_tracks(disc)) {
+    end = disc_get_track(disc, n + 1)->fad;
+  }
+
+  for (int i = 0; i < disc_get_num_sessions(disc); i++) {
+    struct session *session = disc_get_session(disc, i);
+
+    if (track->fad >= session->leadin_fad &&
+        track->fad < session->leadout_fad) {
+      end = MIN(end, session->leadout_fad);
+    }
+  }
+
+  if (end == INT_MAX) {
+    end = track->fad;
+  }
+
+  int num_sectors = 0;
+  int step = RDZ_BLOCK_SECTORS;
+
+  while (track->fad + num_sectors < end) {
+    int count = MIN(step, end - track->fad - num_sectors);
+
+    if (disc->read_sectors(disc, track, track->fad + num_sectors, count,
+                           data)) {
+      num_sectors += count;
+      continue;
+    }
+
+    /* narrow down the last sector backed by the image */
+    if (step == 1) {
+      break;
+    }
+    step = 1;
+  }
+
+  return num_sectors;
+}
+
+static int build_dict(struct disc *disc, const int *num_sectors,
+                      uint8_t *dict) {
+  int total = 0;
+
+  for (int i = 0; i < disc_get_num_tracks(disc); i++) {
+    struct track *track = disc_get_track(disc, i);
+    if (track->sector_fmt != GD_SECTOR_CDDA) {
+      total += num_sectors[i];
+    }
+  }
+
+  if (!total) {
+    return 0;
+  }
+
+  int size = 0;
+
+  for (int k = 0; k < DICT_SECTORS && k < total; k++) {
+    int index = (int)((int64_t)k * total / MIN(DICT_SECTORS, total));
+
+    for (int i = 0; i < disc_get_num_tracks(disc); i++) {
+      struct track *track = disc_get_track(disc, i);
+      if (track->sector_fmt == GD_SECTOR_CDDA) {
+        continue;
+      }
+
+      if (index < num_sectors[i]) {
+        if (size + track->data_size > RDZ_MAX_DICT_SIZE) {
+          return size;
+        }
+        int res = disc->read_sectors(disc, track, track->fad + index, 1,
+                                     dict + size);
+        CHECK(res);
+        size += track->data_size;
+        break;
+      }
+
+      index -= num_sectors[i];
+    }
+  }
+
+  return size;
+}
+
+static int repack(const char *src, const char *dst) {
+  static uint8_t data[MAX_BLOCK_SIZE];
+  static uint8_t dict[RDZ_MAX_DICT_SIZE];
+  static int num_sectors[DISC_MAX_TRACKS];
+
+  struct disc *disc = disc_create(src, 1);
+  if (!disc) {
+    LOG_WARNING("repack failed to load %s", src);
+    return 0;
+  }
+
+  int num_tracks = disc_get_num_tracks(disc);
+  int num_sessions = disc_get_num_sessions(disc);
+  int format = disc_get_format(disc);
+  int num_areas = format == GD_DISC_GDROM ? 2 : 1;
+  int num_blocks = 0;
+
+  for (int i = 0; i < num_tracks; i++) {
+    num_sectors[i] = count_sectors(disc, i);
+    num_blocks += (num_sectors[i] + RDZ_BLOCK_SECTORS - 1) / RDZ_BLOCK_SECTORS;
+  }
+
+  int dict_size = build_dict(disc, num_sectors, dict);
+
+  FILE *fp = fopen(dst, "wb");
+  if (!fp) {
+    LOG_WARNING("repack failed to open %s", dst);
+    disc_destroy(disc);
+    return 0;
+  }
+
+  /* write out the header, sessions and the toc for each area */
+  struct rdz_header hdr = {0};
+  hdr.magic = RDZ_MAGIC;
+  hdr.format = format;
+  hdr.num_sessions = num_sessions;
+  hdr.num_areas = num_areas;
+  hdr.num_tracks = num_tracks;
+  hdr.num_blocks = num_blocks;
+  hdr.dict_size = dict_size;
+  CHECK_EQ(fwrite(&hdr, sizeof(hdr), 1, fp), 1);
+
+  for (int i = 0; i < num_sessions; i++) {
+    struct session *session = disc_get_session(disc, i);
+    write_toc(fp, session->leadin_fad, session->leadout_fad,
+              session->first_track, session->last_track);
+  }
+
+  for (int i = 0; i < num_areas; i++) {
+    struct track *first_track, *last_track;
+    int leadin_fad, leadout_fad;
+    disc_get_toc(disc, i, &first_track, &last_track, &leadin_fad,
+                 &leadout_fad);
+    write_toc(fp, leadin_fad, leadout_fad, get_track_index(disc, first_track),
+              get_track_index(disc, last_track));
+  }
+
+  /* write out the tracks */
+  int first_block = 0;
+
+  for (int i = 0; i < num_tracks; i++) {
+    struct track *track = disc_get_track(disc, i);
+
+    struct rdz_track entry = {0};
+    entry.num = track->num;
+    entry.fad = track->fad;
+    entry.adr = track->adr;
+    entry.ctrl = track->ctrl;
+    entry.sector_fmt = track->sector_fmt;
+    entry.data_size = track->data_size;
+    entry.num_sectors = num_sectors[i];
+    entry.first_block = first_block;
+    CHECK_EQ(fwrite(&entry, sizeof(entry), 1, fp), 1);
+
+    first_block +=
+        (num_sectors[i] + RDZ_BLOCK_SECTORS - 1) / RDZ_BLOCK_SECTORS;
+  }
+
+  /* reserve space for the block index, it's filled in once each block's size
+     is known */
+  struct rdz_block *blocks = calloc(MAX(num_blocks, 1), sizeof(*blocks));
+  long index_offset = ftell(fp);
+  CHECK_EQ((int)fwrite(blocks, sizeof(*blocks), num_blocks, fp), num_blocks);
+  CHECK_EQ((int)fwrite(dict, 1, dict_size, fp), dict_size);
+
+  /* deflate each block on its own against the shared dictionary */
+  z_stream strm = {0};
+  int res = deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 9,
+                         Z_DEFAULT_STRATEGY);
+  CHECK_EQ(res, Z_OK);
+
+  int out_size = (int)deflateBound(&strm, MAX_BLOCK_SIZE);
+  uint8_t *out = malloc(out_size);
+  int64_t total_in = 0;
+  int64_t total_out = 0;
+  int n = 0;
+
+  for (int i = 0; i < num_tracks; i++) {
+    struct track *track = disc_get_track(disc, i);
+
+    for (int first = 0; first < num_sectors[i]; first += RDZ_BLOCK_SECTORS) {
+      int count = MIN(num_sectors[i] - first, RDZ_BLOCK_SECTORS);
+      int size = count * track->data_size;
+
+      res = disc->read_sectors(disc, track, track->fad + first, count, data);
+      CHECK(res);
+
+      CHECK_EQ(deflateReset(&strm), Z_OK);
+      if (dict_size) {
+        CHECK_EQ(deflateSetDictionary(&strm, dict, dict_size), Z_OK);
+      }
+
+      strm.next_in = data;
+      strm.avail_in = size;
+      strm.next_out = out;
+      strm.avail_out = out_size;
+      CHECK_EQ(deflate(&strm, Z_FINISH), Z_STREAM_END);
+
+      /* store blocks which don't shrink as is */
+      int compressed = out_size - (int)strm.avail_out;
+      const uint8_t *block = out;
+      if (compressed >= size) {
+        compressed = size;
+        block = data;
+      }
+
+      blocks[n].offset = (uint64_t)ftell(fp);
+      blocks[n].size = compressed;
+      CHECK_EQ((int)fwrite(block, 1, compressed, fp), compressed);
+      n++;
+
+      total_in += size;
+      total_out += compressed;
+    }
+  }
+
+  CHECK_EQ(n, num_blocks);
+
+  int64_t file_size = (int64_t)ftell(fp);
+  fseek(fp, index_offset, SEEK_SET);
+  CHECK_EQ((int)fwrite(blocks, sizeof(*blocks), num_blocks, fp), num_blocks);
+
+  LOG_INFO("repack wrote %d blocks, %" PRId64 " bytes of sectors deflated to "
+           "%" PRId64 ", %" PRId64 " bytes total",
+           num_blocks, total_in, total_out, file_size);
+
+  deflateEnd(&strm);
+  free(out);
+  free(blocks);
+  fclose(fp);
+  disc_destroy(disc);
+
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    LOG_INFO("usage: repack <image> <output.rdz>");
+    return EXIT_FAILURE;
+  }
+
+  if (!repack(argv[1], argv[2])) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,442 @@
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/memory.h"
+#include "core/option.h"
+#include "core/profiler.h"
+#include "core/rb_tree.h"
+#include "core/time.h"
+#include "guest/bios/bios.h"
+#include "guest/dreamcast.h"
+#include "guest/gdrom/gdrom.h"
+#include "guest/movie.h"
+#include "guest/pvr/ta.h"
+#include "guest/pvr/tex.h"
+#include "guest/pvr/tr.h"
+#include "guest/scheduler.h"
+#include "jit/pass_stats.h"
+#include "options.h"
+#include "profile.h"
+#include "stats.h"
+
+#if !PLATFORM_WINDOWS
+#include <sys/resource.h>
+#endif
+
+DEFINE_OPTION_INT(frames, 3600, "Frames to run");
+DEFINE_OPTION_INT(convert, 1,
+                  "Convert each context submitted for rendering, as the video "
+                  "thread would");
+DEFINE_OPTION_INT(fast_boot, 1,
+                  "Boot discs with the hle bootstrap, skipping the bios");
+DEFINE_OPTION_STRING(movie, "",
+                     "Movie to replay the input of, booting the disc the same "
+                     "way it was recorded and running until it ends");
+DEFINE_OPTION_STRING(tune, "",
+                     "Option to tune over the movie as name=value,value,..., "
+                     "saving the fastest value which doesn't diverge to the "
+                     "disc's profile");
+
+DECLARE_COUNTER(fastmem_faults);
+DECLARE_COUNTER(fastmem_recompiles);
+
+/* textures are decoded the same as they would be for upload, but are never
+   handed to a render backend. like the emulator, they're only decoded again
+   once written to */
+struct bench_texture {
+  struct tr_texture;
+  struct rb_node live_it;
+  struct memory_watch *texture_watch;
+  struct memory_watch *palette_watch;
+};
+
+static struct dreamcast *dc;
+static struct movie *movie;
+static int movie_diverged;
+static struct ta_context *curr_ctx;
+static struct tr_converter *cvt;
+static struct tr_context rc;
+static struct rb_tree live_textures;
+static int frames;
+
+static int64_t num_contexts;
+static int64_t num_textures;
+
+static int bench_texture_cmp(const struct rb_node *rb_lhs,
+                             const struct rb_node *rb_rhs) {
+  const struct bench_texture *lhs =
+      rb_entry(rb_lhs, const struct bench_texture, live_it);
+  tr_texture_key_t lhs_key = tr_texture_key(lhs->tsp, lhs->tcw);
+
+  const struct bench_texture *rhs =
+      rb_entry(rb_rhs, const struct bench_texture, live_it);
+  tr_texture_key_t rhs_key = tr_texture_key(rhs->tsp, rhs->tcw);
+
+  if (lhs_key < rhs_key) {
+    return -1;
+  } else if (lhs_key > rhs_key) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+static struct rb_callbacks bench_texture_cb = {&bench_texture_cmp, NULL, NULL};
+
+static void bench_texture_modified(const struct exception_state *ex,
+                                   void *data) {
+  struct bench_texture *tex = data;
+  tex->texture_watch = NULL;
+  tex->dirty = 1;
+}
+
+static void bench_palette_modified(const struct exception_state *ex,
+                                   void *data) {
+  struct bench_texture *tex = data;
+  tex->palette_watch = NULL;
+  tex->dirty = 1;
+}
+
+static void bench_decode_texture(struct bench_texture *tex) {
+  static uint8_t converted[1024 * 1024 * 4];
+  union tsp tsp = tex->tsp;
+  union tcw tcw = tex->tcw;
+
+  ta_texture_info(dc->ta, tsp, tcw, &tex->texture, &tex->texture_size,
+                  &tex->palette, &tex->palette_size);
+
+  int width = ta_texture_width(tsp, tcw);
+  int height = ta_texture_height(tsp, tcw);
+  int stride = ta_texture_stride(tsp, tcw, curr_ctx->stride);
+  pvr_tex_decode_native(tex->texture, width, height, stride,
+                        ta_texture_format(tcw), tcw.pixel_fmt, tex->palette,
+                        curr_ctx->palette_fmt, converted, sizeof(converted));
+
+  if (!tex->texture_watch) {
+    tex->texture_watch = add_single_write_watch(
+        tex->texture, tex->texture_size, &bench_texture_modified, tex);
+  }
+
+  if (tex->palette && !tex->palette_watch) {
+    tex->palette_watch = add_single_write_watch(
+        tex->palette, tex->palette_size, &bench_palette_modified, tex);
+  }
+
+  /* the handle only has to be non-zero for the renderer to consider the
+     texture converted */
+  tex->handle = 1;
+  tex->dirty = 0;
+
+  num_textures++;
+}
+
+static struct tr_texture *bench_find_texture(void *userdata, union tsp tsp,
+                                             union tcw tcw) {
+  struct bench_texture search;
+  search.tsp = tsp;
+  search.tcw = tcw;
+
+  struct bench_texture *tex =
+      rb_find_entry(&live_textures, &search, struct bench_texture, live_it,
+                    &bench_texture_cb);
+
+  if (!tex) {
+    tex = calloc(1, sizeof(struct bench_texture));
+    tex->tsp = tsp;
+    tex->tcw = tcw;
+    tex->dirty = 1;
+    rb_insert(&live_textures, &tex->live_it, &bench_texture_cb);
+  }
+
+  if (tex->dirty) {
+    bench_decode_texture(tex);
+  }
+
+  return (struct tr_texture *)tex;
+}
+
+static void bench_destroy_textures() {
+  struct rb_node *it = rb_first(&live_textures);
+
+  while (it) {
+    struct rb_node *next = rb_next(it);
+    struct bench_texture *tex = rb_entry(it, struct bench_texture, live_it);
+
+    if (tex->texture_watch) {
+      remove_memory_watch(tex->texture_watch);
+    }
+    if (tex->palette_watch) {
+      remove_memory_watch(tex->palette_watch);
+    }
+    rb_unlink(&live_textures, &tex->live_it, &bench_texture_cb);
+    free(tex);
+
+    it = next;
+  }
+}
+
+static void bench_start_render(void *userdata, struct ta_context *ctx) {
+  if (!OPTION_convert) {
+    return;
+  }
+
+  curr_ctx = ctx;
+  tr_convert_context(cvt, NULL, NULL, &bench_find_texture, ctx, &rc);
+  num_contexts++;
+}
+
+static void bench_vblank_out(void *userdata) {
+  frames++;
+  dc_break(dc);
+}
+
+static int64_t bench_peak_rss() {
+#if PLATFORM_WINDOWS
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return 0;
+  }
+  /* reported in kilobytes on linux, bytes on mac */
+#if PLATFORM_DARWIN
+  return usage.ru_maxrss;
+#else
+  return (int64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static void bench_dump(int64_t host_ns) {
+  /* the aggregate counters aren't flipped while running, flip them once to
+     read back their totals */
+  prof_flip(time_nanoseconds() + NS_PER_SEC);
+
+  int64_t sh4_instrs = prof_counter_load(COUNTER_sh4_instrs);
+  int64_t arm7_instrs = prof_counter_load(COUNTER_arm7_instrs);
+  int64_t faults = prof_counter_load(COUNTER_fastmem_faults);
+  int64_t recompiles = prof_counter_load(COUNTER_fastmem_recompiles);
+
+  int64_t compile_ns = 0;
+
+  for (int i = 0; i < PASS_NUM_STAGES; i++) {
+    struct pass_timing t;
+    pass_timings_get(i, &t);
+    compile_ns += t.ns;
+  }
+
+  double host_sec = host_ns / (double)NS_PER_SEC;
+
+  printf("{\n");
+  printf("  \"frames\": %d,\n", frames);
+  if (OPTION_movie[0]) {
+    printf("  \"movie_diverged\": %d,\n", movie_diverged);
+  }
+  printf("  \"convert\": %d,\n", OPTION_convert);
+  printf("  \"host_ns\": %" PRId64 ",\n", host_ns);
+  printf("  \"fps\": %.3f,\n", frames / host_sec);
+  printf("  \"sh4_instrs\": %" PRId64 ",\n", sh4_instrs);
+  printf("  \"sh4_instrs_per_sec\": %.3f,\n", sh4_instrs / host_sec);
+  printf("  \"arm7_instrs\": %" PRId64 ",\n", arm7_instrs);
+  printf("  \"arm7_instrs_per_sec\": %.3f,\n", arm7_instrs / host_sec);
+  printf("  \"compile_ns\": %" PRId64 ",\n", compile_ns);
+  printf("  \"fastmem_faults\": %" PRId64 ",\n", faults);
+  printf("  \"fastmem_recompiles\": %" PRId64 ",\n", recompiles);
+  printf("  \"contexts_converted\": %" PRId64 ",\n", num_contexts);
+  printf("  \"textures_converted\": %" PRId64 ",\n", num_textures);
+  printf("  \"peak_rss\": %" PRId64 "\n", bench_peak_rss());
+  printf("}\n");
+}
+
+/* runs the disc for OPTION_frames, or the movie's length when replaying one,
+   returning 0 if it couldn't be loaded */
+static int bench_run(const char *disc, int64_t *host_ns) {
+  frames = 0;
+  num_contexts = 0;
+  num_textures = 0;
+  movie_diverged = 0;
+
+  if (OPTION_movie[0]) {
+    movie = movie_play(OPTION_movie);
+
+    if (!movie) {
+      return 0;
+    }
+
+    /* boot the machine configured the same as when the movie was recorded */
+    const struct movie_boot *boot = movie_boot(movie);
+    strncpy(OPTION_region, boot->region, OPTION_MAX_LENGTH - 1);
+    strncpy(OPTION_language, boot->language, OPTION_MAX_LENGTH - 1);
+    strncpy(OPTION_broadcast, boot->broadcast, OPTION_MAX_LENGTH - 1);
+    OPTION_fast_boot = boot->fast_boot;
+    OPTION_boot_cache = 0;
+    OPTION_frames = movie_frames(movie);
+  }
+
+  cvt = tr_converter_create();
+  dc = dc_create();
+  CHECK_NOTNULL(dc);
+  dc->start_render = &bench_start_render;
+  dc->vblank_out = &bench_vblank_out;
+
+  if (movie) {
+    bios_set_clock(dc->bios, movie_boot(movie)->clock);
+  }
+
+  int loaded = dc_load(dc, disc);
+
+  if (loaded) {
+    /* a disc resumed from its boot state is already past the bootstrap */
+    if (OPTION_fast_boot && gdrom_get_disc(dc->gdrom) && !dc->boot_resumed) {
+      bios_boot(dc->bios);
+    }
+
+    /* the tick is broken off at the end of each frame, see
+       bench_vblank_out */
+    const int64_t MACHINE_STEP = HZ_TO_NANO(60);
+    int64_t start = time_nanoseconds();
+    int started = -1;
+
+    while (frames < OPTION_frames) {
+      /* the movie's input is applied at the start of each frame, in between
+         ticks as the emulator does */
+      if (movie && started != frames) {
+        started = frames;
+
+        if (!movie_begin_frame(movie, dc)) {
+          movie_diverged = frames < OPTION_frames;
+          break;
+        }
+      }
+
+      dc_tick(dc, MACHINE_STEP);
+    }
+
+    *host_ns = time_nanoseconds() - start;
+  } else {
+    LOG_WARNING("failed to load %s", disc);
+  }
+
+  bench_destroy_textures();
+  dc_destroy(dc);
+  tr_converter_destroy(cvt);
+
+  if (movie) {
+    movie_destroy(movie);
+    movie = NULL;
+  }
+
+  return loaded;
+}
+
+/* benchmarks each value listed for an option over the movie, saving the
+   fastest which plays the movie back without diverging to the disc's
+   profile */
+static int bench_tune(const char *disc) {
+  char name[OPTION_MAX_LENGTH];
+  strncpy(name, OPTION_tune, sizeof(name) - 1);
+  name[sizeof(name) - 1] = 0;
+
+  char *values = strchr(name, '=');
+
+  if (!values || !OPTION_movie[0]) {
+    LOG_WARNING("tune expects name=value,value,... along with a movie");
+    return 0;
+  }
+
+  *(values++) = 0;
+
+  if (!option_get(name)) {
+    LOG_WARNING("tune unknown option %s", name);
+    return 0;
+  }
+
+  char best[OPTION_MAX_LENGTH] = {0};
+  int64_t best_ns = INT64_MAX;
+
+  for (char *value = strtok(values, ","); value; value = strtok(NULL, ",")) {
+    option_set(name, value);
+
+    int64_t host_ns = 0;
+
+    if (!bench_run(disc, &host_ns)) {
+      return 0;
+    }
+
+    double fps = frames / (host_ns / (double)NS_PER_SEC);
+    LOG_INFO("tune %s=%s fps=%.3f diverged=%d", name, value, fps,
+             movie_diverged);
+
+    if (!movie_diverged && host_ns < best_ns) {
+      strncpy(best, value, sizeof(best) - 1);
+      best_ns = host_ns;
+    }
+  }
+
+  if (!best[0]) {
+    LOG_WARNING("tune every value of %s diverged", name);
+    return 0;
+  }
+
+  option_set(name, best);
+
+  if (!profile_save(disc, name)) {
+    LOG_WARNING("tune failed to save the profile for %s", disc);
+    return 0;
+  }
+
+  LOG_INFO("tune saved %s=%s", name, best);
+
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv)) {
+    return EXIT_FAILURE;
+  }
+
+  /* a movie's disc may be overridden, e.g. when recorded on another machine */
+  const char *disc = argc > 1 ? argv[1] : NULL;
+  struct movie *header = NULL;
+
+  if (!disc && OPTION_movie[0]) {
+    header = movie_play(OPTION_movie);
+    disc = header ? movie_boot(header)->disc : NULL;
+  }
+
+  if (!disc) {
+    LOG_INFO("rerun [options] /path/to/disc");
+    return EXIT_FAILURE;
+  }
+
+  /* set application directory */
+  char appdir[PATH_MAX];
+  char userdir[PATH_MAX];
+  int r = fs_userdir(userdir, sizeof(userdir));
+  CHECK(r);
+  snprintf(appdir, sizeof(appdir), "%s" PATH_SEPARATOR ".redream", userdir);
+  fs_set_appdir(appdir);
+
+  /* the options tuned so far are the baseline for tuning others */
+  if (OPTION_profiles) {
+    profile_load(disc);
+  }
+
+  int res;
+
+  if (OPTION_tune[0]) {
+    res = bench_tune(disc);
+  } else {
+    int64_t host_ns = 0;
+    res = bench_run(disc, &host_ns) && !movie_diverged;
+
+    if (res || movie_diverged) {
+      bench_dump(host_ns);
+    }
+  }
+
+  if (header) {
+    movie_destroy(header);
+  }
+
+  return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,11 +1,35 @@
+#include <dirent.h>
 #include <stdio.h>
 #include "core/core.h"
 #include "core/filesystem.h"
+#include "core/option.h"
+#include "core/time.h"
+#include "file/trace.h"
+#include "guest/pvr/ta.h"
 #include "guest/pvr/tex.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+DEFINE_OPTION_INT(bench, 0,
+                  "Decode each texture this many times with each decoder, "
+                  "printing the throughput per format and size");
+DEFINE_OPTION_INT(validate, 0,
+                  "Validate each decoder against the scalar reference "
+                  "decoders, instead of writing out pngs");
+
+/* scalar decoders, see ref.c */
+extern void pvr_tex_decode_ref(const uint8_t *data, int width, int height,
+                               int stride, int texture_fmt, int pixel_fmt,
+                               const uint8_t *palette, int pal_pixel_fmt,
+                               uint8_t *out, int size);
+extern enum pxl_format pvr_tex_decode_native_ref(
+    const uint8_t *data, int width, int height, int stride, int texture_fmt,
+    int pixel_fmt, const uint8_t *palette, int pal_pixel_fmt, uint8_t *out,
+    int size);
+
+#define MAX_TEXTURE_SIZE 1024
+
 char *texture_fmt_names[] = {
     NULL,
     "TWIDDLED",
@@ -13,9 +37,9 @@ char *texture_fmt_names[] = {
     "VQ",
     "VQ_MIPMAPS",
     "PALETTE_4BPP",
-    NULL,
+    "PALETTE_4BPP_MIPMAPS",
     "PALETTE_8BPP",
-    NULL,
+    "PALETTE_8BPP_MIPMAPS",
     "PLANAR_RECT",
     NULL,
     "PLANAR",
@@ -25,9 +49,292 @@ char *texture_fmt_names[] = {
 
 char *pixel_fmt_names[] = {
     "ARGB1555", "RGB565", "ARGB4444", "YUV422",
+    "BUMPMAP",  "4BPP",   "8BPP",     "RESERVED",
+};
+
+char *palette_fmt_names[] = {
+    "ARGB1555", "RGB565", "ARGB4444", "ARGB8888",
+};
+
+enum {
+  DECODER_RGBA,
+  DECODER_RGBA_REF,
+  DECODER_NATIVE,
+  DECODER_NATIVE_REF,
+  NUM_DECODERS,
 };
 
-uint8_t *read_tex(const char *filename) {
+static const char *decoder_names[] = {
+    "rgba", "rgba (scalar)", "native", "native (scalar)",
+};
+
+struct texture {
+  char name[PATH_MAX];
+  const uint8_t *data;
+  const uint8_t *palette;
+  int texture_fmt;
+  int pixel_fmt;
+  int palette_fmt;
+  int width;
+  int height;
+  int stride;
+};
+
+/* decode throughput for each unique format and size */
+struct texture_stats {
+  int texture_fmt;
+  int pixel_fmt;
+  int palette_fmt;
+  int width;
+  int height;
+  int levels;
+  int64_t ns[NUM_DECODERS];
+};
+
+static struct texture_stats *stats;
+static int num_stats;
+static int max_stats;
+
+static int num_checked;
+static int num_mismatched;
+
+/* paletted .pvr files don't include their palette, a ramp is decoded with each
+   palette format in its place */
+static uint32_t ramp_palette[256];
+
+static uint8_t decoded[2][MAX_TEXTURE_SIZE * MAX_TEXTURE_SIZE * 4];
+
+static const char *format_name(char **names, int num_names, int fmt) {
+  return fmt >= 0 && fmt < num_names && names[fmt] ? names[fmt] : "UNKNOWN";
+}
+
+static int texture_paletted(int pixel_fmt) {
+  return pixel_fmt == PVR_PXL_4BPP || pixel_fmt == PVR_PXL_8BPP;
+}
+
+static int decode_level(int decoder, const struct texture *tex, int width,
+                        int height, uint8_t *dst) {
+  int stride = width == tex->width ? tex->stride : width;
+  int size = width * height * 4;
+  enum pxl_format format = PXL_RGBA;
+
+  switch (decoder) {
+    case DECODER_RGBA:
+      pvr_tex_decode(tex->data, width, height, stride, tex->texture_fmt,
+                     tex->pixel_fmt, tex->palette, tex->palette_fmt, dst,
+                     size);
+      break;
+    case DECODER_RGBA_REF:
+      pvr_tex_decode_ref(tex->data, width, height, stride, tex->texture_fmt,
+                         tex->pixel_fmt, tex->palette, tex->palette_fmt, dst,
+                         size);
+      break;
+    case DECODER_NATIVE:
+      format = pvr_tex_decode_native(tex->data, width, height, stride,
+                                     tex->texture_fmt, tex->pixel_fmt,
+                                     tex->palette, tex->palette_fmt, dst, size);
+      break;
+    case DECODER_NATIVE_REF:
+      format = pvr_tex_decode_native_ref(
+          tex->data, width, height, stride, tex->texture_fmt, tex->pixel_fmt,
+          tex->palette, tex->palette_fmt, dst, size);
+      break;
+    default:
+      LOG_FATAL("decode_level unexpected decoder %d", decoder);
+      break;
+  }
+
+  /* returns the size of the decoded data */
+  return format == PXL_RGBA ? width * height * 4 : width * height * 2;
+}
+
+static void validate_decoder(int decoder, int ref, const struct texture *tex,
+                             int width, int height) {
+  int size = decode_level(decoder, tex, width, height, decoded[0]);
+  int ref_size = decode_level(ref, tex, width, height, decoded[1]);
+  CHECK_EQ(size, ref_size);
+
+  num_checked++;
+
+  for (int i = 0; i < size; i++) {
+    if (decoded[0][i] == decoded[1][i]) {
+      continue;
+    }
+
+    int bpp = size / (width * height);
+    int x = (i / bpp) % width;
+    int y = (i / bpp) / width;
+
+    LOG_WARNING("%s %dx%d %s decoder differs from reference at %d,%d",
+                tex->name, width, height, decoder_names[decoder], x, y);
+
+    num_mismatched++;
+    break;
+  }
+}
+
+static void validate_level(const struct texture *tex, int width, int height) {
+  validate_decoder(DECODER_RGBA, DECODER_RGBA_REF, tex, width, height);
+  validate_decoder(DECODER_NATIVE, DECODER_NATIVE_REF, tex, width, height);
+}
+
+static struct texture_stats *find_stats(const struct texture *tex, int width,
+                                        int height) {
+  int palette_fmt = texture_paletted(tex->pixel_fmt) ? tex->palette_fmt : -1;
+
+  for (int i = 0; i < num_stats; i++) {
+    struct texture_stats *s = &stats[i];
+
+    if (s->texture_fmt == tex->texture_fmt && s->pixel_fmt == tex->pixel_fmt &&
+        s->palette_fmt == palette_fmt && s->width == width &&
+        s->height == height) {
+      return s;
+    }
+  }
+
+  if (num_stats >= max_stats) {
+    max_stats = MAX(max_stats * 2, 64);
+    stats = realloc(stats, max_stats * sizeof(struct texture_stats));
+  }
+
+  struct texture_stats *s = &stats[num_stats++];
+  memset(s, 0, sizeof(*s));
+  s->texture_fmt = tex->texture_fmt;
+  s->pixel_fmt = tex->pixel_fmt;
+  s->palette_fmt = palette_fmt;
+  s->width = width;
+  s->height = height;
+  return s;
+}
+
+static void bench_level(const struct texture *tex, int width, int height) {
+  struct texture_stats *s = find_stats(tex, width, height);
+
+  for (int decoder = 0; decoder < NUM_DECODERS; decoder++) {
+    int64_t start = time_nanoseconds();
+
+    for (int i = 0; i < OPTION_bench; i++) {
+      decode_level(decoder, tex, width, height, decoded[0]);
+    }
+
+    s->ns[decoder] += time_nanoseconds() - start;
+  }
+
+  s->levels++;
+}
+
+static int stats_cmp(const void *a, const void *b) {
+  const struct texture_stats *sa = a;
+  const struct texture_stats *sb = b;
+
+  if (sa->texture_fmt != sb->texture_fmt) {
+    return sa->texture_fmt - sb->texture_fmt;
+  }
+  if (sa->pixel_fmt != sb->pixel_fmt) {
+    return sa->pixel_fmt - sb->pixel_fmt;
+  }
+  if (sa->palette_fmt != sb->palette_fmt) {
+    return sa->palette_fmt - sb->palette_fmt;
+  }
+  return sa->width * sa->height - sb->width * sb->height;
+}
+
+static void bench_report() {
+  qsort(stats, num_stats, sizeof(struct texture_stats), &stats_cmp);
+
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("decode throughput in mtexels / s over %d iterations",
+           OPTION_bench);
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("");
+  LOG_INFO("%-20s %-8s %-8s %9s %6s %9s %9s %9s %9s", "format", "pixel",
+           "palette", "size", "count", "rgba", "scalar", "native", "scalar");
+
+  for (int i = 0; i < num_stats; i++) {
+    struct texture_stats *s = &stats[i];
+    double texels =
+        (double)s->width * s->height * s->levels * (double)OPTION_bench;
+    double mtexels[NUM_DECODERS];
+
+    for (int j = 0; j < NUM_DECODERS; j++) {
+      mtexels[j] = texels * 1000.0 / MAX(s->ns[j], 1);
+    }
+
+    char size[32];
+    snprintf(size, sizeof(size), "%dx%d", s->width, s->height);
+
+    LOG_INFO("%-20s %-8s %-8s %9s %6d %9.1f %9.1f %9.1f %9.1f",
+             texture_fmt_names[s->texture_fmt], pixel_fmt_names[s->pixel_fmt],
+             s->palette_fmt >= 0 ? palette_fmt_names[s->palette_fmt] : "-",
+             size, s->levels, mtexels[DECODER_RGBA], mtexels[DECODER_RGBA_REF],
+             mtexels[DECODER_NATIVE], mtexels[DECODER_NATIVE_REF]);
+  }
+}
+
+static void convert_level(const struct texture *tex, int width, int height) {
+  decode_level(DECODER_RGBA, tex, width, height, decoded[0]);
+
+  char pngname[PATH_MAX];
+  snprintf(pngname, sizeof(pngname), "%s.%dx%d.png", tex->name, width,
+           height);
+
+  LOG_INFO("writing %s", pngname);
+
+  int stride = width * 4;
+  int res = stbi_write_png(pngname, width, height, 4, decoded[0], stride);
+  CHECK_NE(res, 0);
+}
+
+static void process_levels(const struct texture *tex) {
+  /* process each mip level */
+  int mipmaps = pvr_tex_mipmaps(tex->texture_fmt);
+  int levels = mipmaps ? ctz32(tex->width) + 1 : 1;
+
+  while (levels--) {
+    int mip_width = tex->width >> levels;
+    int mip_height = tex->height >> levels;
+
+    if (OPTION_validate) {
+      validate_level(tex, mip_width, mip_height);
+    } else if (OPTION_bench) {
+      bench_level(tex, mip_width, mip_height);
+    } else {
+      convert_level(tex, mip_width, mip_height);
+    }
+  }
+}
+
+static void process_texture(const struct texture *tex) {
+  if (tex->texture_fmt <= PVR_TEX_INVALID ||
+      tex->texture_fmt >= (int)ARRAY_SIZE(texture_fmt_names) ||
+      !texture_fmt_names[tex->texture_fmt] ||
+      tex->pixel_fmt >= (int)ARRAY_SIZE(pixel_fmt_names)) {
+    LOG_WARNING("%s has an unsupported format", tex->name);
+    return;
+  }
+
+  if (tex->width > MAX_TEXTURE_SIZE || tex->height > MAX_TEXTURE_SIZE) {
+    LOG_WARNING("%s is too large", tex->name);
+    return;
+  }
+
+  if (!texture_paletted(tex->pixel_fmt) || tex->palette) {
+    process_levels(tex);
+    return;
+  }
+
+  /* when only converting, the ramp is written out as grayscale */
+  int first_fmt = OPTION_validate || OPTION_bench ? 0 : PVR_PAL_ARGB8888;
+
+  for (int fmt = first_fmt; fmt <= PVR_PAL_ARGB8888; fmt++) {
+    struct texture ramp = *tex;
+    ramp.palette = (const uint8_t *)ramp_palette;
+    ramp.palette_fmt = fmt;
+    process_levels(&ramp);
+  }
+}
+
+static uint8_t *read_tex(const char *filename, int *size) {
   FILE *fp = fopen(filename, "rb");
   if (!fp) {
     LOG_WARNING("failed to open '%s'", filename);
@@ -35,74 +342,181 @@ uint8_t *read_tex(const char *filename) {
   }
 
   fseek(fp, 0, SEEK_END);
-  int size = ftell(fp);
+  *size = ftell(fp);
   fseek(fp, 0, SEEK_SET);
 
-  uint8_t *buffer = malloc(size);
-  int n = (int)fread(buffer, 1, size, fp);
-  CHECK_EQ(n, size);
+  uint8_t *buffer = malloc(*size);
+  int n = (int)fread(buffer, 1, *size, fp);
+  CHECK_EQ(n, *size);
   fclose(fp);
 
   return buffer;
 }
 
-void convert_tex(const char *texname) {
-  LOG_INFO("#==--------------------------------------------------==#");
-  LOG_INFO("# %s", texname);
-  LOG_INFO("#==--------------------------------------------------==#");
+static void process_pvr(const char *filename) {
+  int size = 0;
+  uint8_t *buffer = read_tex(filename, &size);
 
-  uint8_t *buffer = read_tex(texname);
+  if (!buffer) {
+    return;
+  }
 
-  const struct pvr_tex_header *header = pvr_tex_header(buffer);
+  /* enough for the optional headers and the PVRT header itself */
+  const struct pvr_tex_header *header =
+      size >= 64 ? pvr_tex_header(buffer) : NULL;
 
   if (!header) {
-    LOG_WARNING("convert_tex failed to find a valid PVRT header");
+    LOG_WARNING("%s doesn't have a valid PVRT header", filename);
+    free(buffer);
     return;
   }
 
-  const uint8_t *data = pvr_tex_data(buffer);
-
-  CHECK_LT(header->pixel_fmt, ARRAY_SIZE(pixel_fmt_names));
+  struct texture tex = {0};
+  strncpy(tex.name, filename, sizeof(tex.name) - 1);
+  tex.data = pvr_tex_data(buffer);
+  tex.texture_fmt = header->texture_fmt;
+  tex.pixel_fmt = header->pixel_fmt;
+  tex.width = header->width;
+  tex.height = header->height;
+  tex.stride = header->width;
 
   /* dump header */
-  LOG_INFO("version:      %.4s", (char *)&header->version);
-  LOG_INFO("size:         %d bytes", header->size);
-  LOG_INFO("pixel_fmt:    %s", pixel_fmt_names[header->pixel_fmt]);
-  LOG_INFO("texture_fmt:  %s", texture_fmt_names[header->texture_fmt]);
-  LOG_INFO("width:        %d", header->width);
-  LOG_INFO("height:       %d", header->height);
-  LOG_INFO("");
+  if (!OPTION_validate && !OPTION_bench) {
+    LOG_INFO("#==--------------------------------------------------==#");
+    LOG_INFO("# %s", filename);
+    LOG_INFO("#==--------------------------------------------------==#");
+    LOG_INFO("version:      %.4s", (char *)&header->version);
+    LOG_INFO("size:         %d bytes", header->size);
+    LOG_INFO("pixel_fmt:    %s",
+             format_name(pixel_fmt_names, ARRAY_SIZE(pixel_fmt_names),
+                         header->pixel_fmt));
+    LOG_INFO("texture_fmt:  %s",
+             format_name(texture_fmt_names, ARRAY_SIZE(texture_fmt_names),
+                         header->texture_fmt));
+    LOG_INFO("width:        %d", header->width);
+    LOG_INFO("height:       %d", header->height);
+    LOG_INFO("");
+  }
 
-  /* convert each mip level to png */
-  static uint8_t converted[1024 * 1024 * 4];
-  int mipmaps = pvr_tex_mipmaps(header->texture_fmt);
-  int levels = mipmaps ? ctz32(header->width) + 1 : 1;
+  process_texture(&tex);
 
-  while (levels--) {
-    int mip_width = header->width >> levels;
-    int mip_height = header->height >> levels;
-    pvr_tex_decode(data, mip_width, mip_height, mip_width, header->texture_fmt,
-                   header->pixel_fmt, NULL, 0, converted, sizeof(converted));
+  free(buffer);
+}
 
-    char pngname[PATH_MAX];
-    snprintf(pngname, sizeof(pngname), "%s.%dx%d.png", texname, mip_width,
-             mip_height);
+static void process_trace(const char *filename) {
+  struct trace *trace = trace_parse(filename);
 
-    LOG_INFO("writing %s", pngname);
+  if (!trace) {
+    LOG_WARNING("failed to parse %s", filename);
+    return;
+  }
+
+  /* the palette format and stride of each texture come from the context it's
+     first rendered by */
+  struct trace_cmd *pending = trace->cmds;
+  int n = 0;
+
+  for (struct trace_cmd *cmd = trace->cmds; cmd; cmd = cmd->next) {
+    if (cmd->type != TRACE_CMD_CONTEXT) {
+      continue;
+    }
+
+    for (; pending != cmd; pending = pending->next) {
+      if (pending->type != TRACE_CMD_TEXTURE) {
+        continue;
+      }
 
-    int stride = mip_width * 4;
-    int res =
-        stbi_write_png(pngname, mip_width, mip_height, 4, converted, stride);
-    CHECK_NE(res, 0);
+      trace_load_cmd(trace, pending);
+
+      union tsp tsp = pending->texture.tsp;
+      union tcw tcw = pending->texture.tcw;
+
+      struct texture tex = {0};
+      snprintf(tex.name, sizeof(tex.name), "%s.%d", filename, n++);
+      tex.data = pending->texture.texture;
+      tex.palette =
+          pending->texture.palette_size ? pending->texture.palette : NULL;
+      tex.texture_fmt = ta_texture_format(tcw);
+      tex.pixel_fmt = tcw.pixel_fmt;
+      tex.palette_fmt = cmd->context.palette_fmt;
+      tex.width = ta_texture_width(tsp, tcw);
+      tex.height = ta_texture_height(tsp, tcw);
+      tex.stride = ta_texture_stride(tsp, tcw, cmd->context.stride);
+
+      process_texture(&tex);
+    }
   }
 
-  free(buffer);
+  trace_destroy(trace);
+}
+
+static void process_file(const char *filename) {
+  const char *ext = strrchr(filename, '.');
+
+  if (ext && !strcmp(ext, ".trace")) {
+    process_trace(filename);
+  } else {
+    process_pvr(filename);
+  }
+}
+
+static void process_dir(const char *path) {
+  DIR *dir = opendir(path);
+
+  if (!dir) {
+    LOG_WARNING("failed to open directory %s", path);
+    return;
+  }
+
+  struct dirent *ent = NULL;
+
+  while ((ent = readdir(dir)) != NULL) {
+    if (!(ent->d_type & DT_REG)) {
+      continue;
+    }
+
+    /* skip the pngs written out when converting */
+    const char *ext = strrchr(ent->d_name, '.');
+
+    if (ext && !strcmp(ext, ".png")) {
+      continue;
+    }
+
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", path,
+             ent->d_name);
+
+    process_file(filename);
+  }
+
+  closedir(dir);
 }
 
 int main(int argc, char **argv) {
+  if (!options_parse(&argc, &argv)) {
+    return EXIT_FAILURE;
+  }
+
+  for (int i = 0; i < (int)ARRAY_SIZE(ramp_palette); i++) {
+    ramp_palette[i] = (uint32_t)i * 0x01010101u;
+  }
+
   for (int i = 1; i < argc; i++) {
-    convert_tex(argv[i]);
+    if (fs_isdir(argv[i])) {
+      process_dir(argv[i]);
+    } else {
+      process_file(argv[i]);
+    }
+  }
+
+  if (OPTION_validate) {
+    LOG_INFO("%d of %d decodes matched the reference",
+             num_checked - num_mismatched, num_checked);
+  } else if (OPTION_bench) {
+    bench_report();
   }
 
-  return EXIT_SUCCESS;
+  free(stats);
+
+  return num_mismatched ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,12 @@
+/* the scalar decoders, built from the same source as the decoders linked in
+   from relib but with the sse2 paths disabled. retex validates the others
+   against these, so their public functions are renamed to not conflict */
+#define TEX_SIMD 0
+#define pvr_tex_header pvr_tex_header_ref
+#define pvr_tex_data pvr_tex_data_ref
+#define pvr_tex_decode pvr_tex_decode_ref
+#define pvr_tex_raw pvr_tex_raw_ref
+#define pvr_tex_native_format pvr_tex_native_format_ref
+#define pvr_tex_decode_native pvr_tex_decode_native_ref
+
+#include "guest/pvr/tex.c"
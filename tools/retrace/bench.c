@@ -0,0 +1,297 @@
+#include <glad/glad.h>
+#include <SDL.h>
+#include "core/core.h"
+#include "core/hash_map.h"
+#include "core/time.h"
+#include "file/trace.h"
+#include "guest/pvr/ta.h"
+#include "guest/pvr/tr.h"
+#include "render/render_backend.h"
+
+#define BENCH_WIDTH 640
+#define BENCH_HEIGHT 480
+#define BENCH_DEFAULT_ITERATIONS 10
+
+DEFINE_HASH_MAP(bench_texture_map, tr_texture_key_t, struct tr_texture *);
+
+/* totals for a single context, summed across each iteration */
+struct bench_frame {
+  int frame;
+  int params_size;
+  int num_verts;
+  int num_draws;
+  int64_t textures_decoded;
+  int64_t convert_ns;
+  int64_t decode_ns;
+  int64_t gpu_ns;
+};
+
+struct bench {
+  SDL_Window *win;
+  SDL_GLContext glctx;
+  struct render_backend *r;
+  GLuint query;
+
+  struct tr_converter *cvt;
+  struct bench_texture_map textures;
+  struct ta_context ctx;
+  struct tr_context rc;
+
+  struct bench_frame *frames;
+  int num_frames;
+};
+
+static struct tr_texture *bench_find_texture(void *userdata, union tsp tsp,
+                                             union tcw tcw) {
+  struct bench *bench = userdata;
+  struct tr_texture **tex =
+      bench_texture_map_get(&bench->textures, tr_texture_key(tsp, tcw));
+  return tex ? *tex : NULL;
+}
+
+static void bench_add_texture(struct bench *bench, struct trace *trace,
+                              struct trace_cmd *cmd) {
+  trace_load_cmd(trace, cmd);
+
+  tr_texture_key_t key = tr_texture_key(cmd->texture.tsp, cmd->texture.tcw);
+  struct tr_texture **existing = bench_texture_map_get(&bench->textures, key);
+  struct tr_texture *tex = existing ? *existing : NULL;
+
+  if (!tex) {
+    tex = calloc(1, sizeof(struct tr_texture));
+    tex->tsp = cmd->texture.tsp;
+    tex->tcw = cmd->texture.tcw;
+    bench_texture_map_insert(&bench->textures, key, tex);
+  }
+
+  tex->frame = cmd->texture.frame;
+  tex->dirty = 1;
+  tex->texture = cmd->texture.texture;
+  tex->texture_size = cmd->texture.texture_size;
+  tex->palette = cmd->texture.palette;
+  tex->palette_size = cmd->texture.palette_size;
+}
+
+static void bench_reset_textures(struct bench *bench) {
+  /* each iteration starts without any textures, so each decodes and uploads
+     the same ones */
+  hash_map_for_each(slot, &bench->textures, bench_texture_map) {
+    struct tr_texture *tex = *hash_map_value(&bench->textures, slot);
+    tr_release_texture(bench->cvt, bench->r, tex);
+    free(tex);
+  }
+
+  bench_texture_map_clear(&bench->textures);
+}
+
+static int bench_count_draws(const struct tr_context *rc) {
+  return rc->lists[TA_LIST_OPAQUE].num_surfs +
+         rc->lists[TA_LIST_PUNCH_THROUGH].num_surfs +
+         rc->lists[TA_LIST_TRANSLUCENT].num_surfs;
+}
+
+static void bench_context(struct bench *bench, struct trace *trace,
+                          struct trace_cmd *cmd, struct bench_frame *frame) {
+  struct tr_stats before, after;
+
+  trace_copy_context(trace, cmd, &bench->ctx);
+
+  /* conversion */
+  tr_converter_stats(bench->cvt, &before);
+  int64_t start = time_nanoseconds();
+
+  tr_convert_context(bench->cvt, bench->r, bench, &bench_find_texture,
+                     &bench->ctx, &bench->rc);
+
+  int64_t end = time_nanoseconds();
+  tr_converter_stats(bench->cvt, &after);
+
+  /* rendering, waiting on the gpu to finish each frame so it's measured in
+     isolation */
+  r_viewport(bench->r, 0, 0, BENCH_WIDTH, BENCH_HEIGHT);
+  r_clear(bench->r);
+
+  glBeginQuery(GL_TIME_ELAPSED, bench->query);
+  tr_render_context(bench->r, &bench->rc);
+  glEndQuery(GL_TIME_ELAPSED);
+
+  GLuint64 gpu_ns = 0;
+  glGetQueryObjectui64v(bench->query, GL_QUERY_RESULT, &gpu_ns);
+
+  frame->frame = cmd->context.frame;
+  frame->params_size = cmd->context.params_size;
+  frame->num_verts = bench->rc.num_verts;
+  frame->num_draws = bench_count_draws(&bench->rc);
+  frame->textures_decoded += after.textures_decoded - before.textures_decoded;
+  frame->convert_ns += end - start;
+  frame->decode_ns += after.decode_ns - before.decode_ns;
+  frame->gpu_ns += (int64_t)gpu_ns;
+}
+
+static void bench_run(struct bench *bench, struct trace *trace) {
+  int n = 0;
+
+  for (struct trace_cmd *cmd = trace->cmds; cmd; cmd = cmd->next) {
+    if (cmd->type == TRACE_CMD_TEXTURE) {
+      bench_add_texture(bench, trace, cmd);
+    } else if (cmd->type == TRACE_CMD_CONTEXT) {
+      bench_context(bench, trace, cmd, &bench->frames[n++]);
+    }
+  }
+
+  bench_reset_textures(bench);
+}
+
+static void bench_report(struct bench *bench, int iterations) {
+  struct bench_frame total = {0};
+
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("per-frame averages over %d iterations", iterations);
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("");
+  LOG_INFO("%8s %10s %8s %6s %8s %12s %12s %12s", "frame", "params", "verts",
+           "draws", "decoded", "convert ms", "decode ms", "gpu ms");
+
+  for (int i = 0; i < bench->num_frames; i++) {
+    struct bench_frame *frame = &bench->frames[i];
+
+    LOG_INFO("%8d %10d %8d %6d %8.1f %12.3f %12.3f %12.3f", frame->frame,
+             frame->params_size, frame->num_verts, frame->num_draws,
+             frame->textures_decoded / (float)iterations,
+             frame->convert_ns / (float)iterations / NS_PER_MS,
+             frame->decode_ns / (float)iterations / NS_PER_MS,
+             frame->gpu_ns / (float)iterations / NS_PER_MS);
+
+    total.num_draws += frame->num_draws;
+    total.textures_decoded += frame->textures_decoded;
+    total.convert_ns += frame->convert_ns;
+    total.decode_ns += frame->decode_ns;
+    total.gpu_ns += frame->gpu_ns;
+  }
+
+  int64_t num_samples = (int64_t)MAX(bench->num_frames, 1) * iterations;
+
+  LOG_INFO("");
+  LOG_INFO("frames:          %d", bench->num_frames);
+  LOG_INFO("draws / frame:   %.1f",
+           total.num_draws / (float)MAX(bench->num_frames, 1));
+  LOG_INFO("decoded / frame: %.1f",
+           total.textures_decoded / (float)num_samples);
+  LOG_INFO("convert / frame: %.3f ms",
+           total.convert_ns / (float)num_samples / NS_PER_MS);
+  LOG_INFO("decode / frame:  %.3f ms (summed across threads)",
+           total.decode_ns / (float)num_samples / NS_PER_MS);
+  LOG_INFO("gpu / frame:     %.3f ms",
+           total.gpu_ns / (float)num_samples / NS_PER_MS);
+}
+
+static void bench_destroy_video(struct bench *bench) {
+  if (bench->r) {
+    glDeleteQueries(1, &bench->query);
+    r_destroy(bench->r);
+  }
+
+  if (bench->glctx) {
+    SDL_GL_DeleteContext(bench->glctx);
+  }
+
+  if (bench->win) {
+    SDL_DestroyWindow(bench->win);
+  }
+
+  SDL_QuitSubSystem(SDL_INIT_VIDEO);
+}
+
+static int bench_create_video(struct bench *bench) {
+  if (SDL_InitSubSystem(SDL_INIT_VIDEO) < 0) {
+    LOG_WARNING("bench_create_video failed to init video: %s", SDL_GetError());
+    return 0;
+  }
+
+  /* the window is never shown, frames are only rendered to its backbuffer */
+  bench->win = SDL_CreateWindow("retrace", SDL_WINDOWPOS_UNDEFINED,
+                                SDL_WINDOWPOS_UNDEFINED, BENCH_WIDTH,
+                                BENCH_HEIGHT,
+                                SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+  if (!bench->win) {
+    LOG_WARNING("bench_create_video failed to create window: %s",
+                SDL_GetError());
+    return 0;
+  }
+
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+  SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+
+  bench->glctx = SDL_GL_CreateContext(bench->win);
+  if (!bench->glctx) {
+    LOG_WARNING("bench_create_video failed to create context: %s",
+                SDL_GetError());
+    return 0;
+  }
+
+  /* don't let vsync throttle the frames */
+  SDL_GL_SetSwapInterval(0);
+
+  if (!gladLoadGLLoader((GLADloadproc)&SDL_GL_GetProcAddress)) {
+    LOG_WARNING("bench_create_video failed to link");
+    return 0;
+  }
+
+  bench->r = r_create(BENCH_WIDTH, BENCH_HEIGHT);
+  glGenQueries(1, &bench->query);
+
+  return 1;
+}
+
+int cmd_bench(int argc, const char **argv) {
+  if (argc < 1) {
+    return 0;
+  }
+
+  const char *filename = argv[0];
+  int iterations = argc >= 2 ? atoi(argv[1]) : BENCH_DEFAULT_ITERATIONS;
+  iterations = MAX(iterations, 1);
+
+  struct trace *trace = trace_parse(filename);
+  if (!trace) {
+    LOG_WARNING("failed to parse %s", filename);
+    return 1;
+  }
+
+  struct bench *bench = calloc(1, sizeof(struct bench));
+
+  if (!bench_create_video(bench)) {
+    bench_destroy_video(bench);
+    free(bench);
+    trace_destroy(trace);
+    return 1;
+  }
+
+  for (struct trace_cmd *cmd = trace->cmds; cmd; cmd = cmd->next) {
+    if (cmd->type == TRACE_CMD_CONTEXT) {
+      bench->num_frames++;
+    }
+  }
+
+  bench->frames = calloc(MAX(bench->num_frames, 1), sizeof(struct bench_frame));
+  bench->cvt = tr_converter_create();
+
+  for (int i = 0; i < iterations; i++) {
+    bench_run(bench, trace);
+  }
+
+  bench_report(bench, iterations);
+
+  tr_free_context(&bench->rc);
+  ta_free_context(&bench->ctx);
+  bench_texture_map_destroy(&bench->textures);
+  tr_converter_destroy(bench->cvt);
+  bench_destroy_video(bench);
+  free(bench->frames);
+  free(bench);
+  trace_destroy(trace);
+
+  return 1;
+}
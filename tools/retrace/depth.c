@@ -3,6 +3,7 @@
 #include "core/assert.h"
 #include "core/sort.h"
 #include "file/trace.h"
+#include "guest/pvr/ta.h"
 #include "guest/pvr/tr.h"
 
 struct depth_entry {
@@ -47,16 +48,17 @@ static int depth_cmpf(const void *a, const void *b) {
   return ea->d.f <= eb->d.f;
 }
 
-static void test_context(struct trace_cmd *cmd, struct test *tests,
-                         int num_tests) {
+static void test_context(struct trace *trace, struct trace_cmd *cmd,
+                         struct test *tests, int num_tests) {
   CHECK_EQ(cmd->type, TRACE_CMD_CONTEXT);
 
   struct ta_context *ctx = calloc(1, sizeof(struct ta_context));
   struct tr_context *rc = calloc(1, sizeof(struct tr_context));
+  struct tr_converter *cvt = tr_converter_create();
 
   /* parse the context */
-  trace_copy_context(cmd, ctx);
-  tr_convert_context(NULL, NULL, &find_texture, ctx, rc);
+  trace_copy_context(trace, cmd, ctx);
+  tr_convert_context(cvt, NULL, NULL, &find_texture, ctx, rc);
 
   /* sort each vertex by the original w */
   struct depth_entry *original =
@@ -105,7 +107,10 @@ static void test_context(struct trace_cmd *cmd, struct test *tests,
   }
 
   free(original);
+  tr_free_context(rc);
   free(rc);
+  tr_converter_destroy(cvt);
+  ta_free_context(ctx);
   free(ctx);
 }
 
@@ -150,7 +155,7 @@ int cmd_depth(int argc, const char **argv) {
   struct trace_cmd *next = trace->cmds;
   while (next) {
     if (next->type == TRACE_CMD_CONTEXT) {
-      test_context(next, tests, num_tests);
+      test_context(trace, next, tests, num_tests);
       break;
     }
     next = next->next;
@@ -1,10 +1,12 @@
 #include "core/core.h"
 
+extern int cmd_bench(int argc, const char **argv);
 extern int cmd_depth(int argc, const char **argv);
 
 static void print_help() {
   LOG_INFO("usage: retrace <command> [<args> ...]");
   LOG_INFO("the available commands are:");
+  LOG_INFO("    bench    time converting and rendering each context");
   LOG_INFO("    depth    compare depth function accuracies");
 }
 
@@ -14,7 +16,9 @@ int main(int argc, const char **argv) {
   if (argc >= 2) {
     const char *cmd = argv[1];
 
-    if (!strcmp(cmd, "depth")) {
+    if (!strcmp(cmd, "bench")) {
+      res = cmd_bench(argc - 2, argv + 2);
+    } else if (!strcmp(cmd, "depth")) {
       res = cmd_depth(argc - 2, argv + 2);
     }
   }